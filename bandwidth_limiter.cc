@@ -0,0 +1,61 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/bandwidth_limiter.h"
+
+#include <algorithm>
+
+#include <base/logging.h>
+
+using base::Time;
+using base::TimeDelta;
+
+namespace chromeos_update_engine {
+
+BandwidthLimiter::BandwidthLimiter(ClockInterface* clock) : clock_(clock) {}
+
+void BandwidthLimiter::SetRate(int64_t rate_bps) {
+  rate_bps_ = std::max<int64_t>(0, rate_bps);
+  // Start with a full bucket.
+  tokens_ = rate_bps_;
+  last_refill_ = clock_->GetMonotonicTime();
+  if (rate_bps_)
+    LOG(INFO) << "Limiting the download rate to " << rate_bps_ << " bytes/sec.";
+}
+
+TimeDelta BandwidthLimiter::Consume(size_t bytes) {
+  if (rate_bps_ == 0)
+    return TimeDelta();
+  Refill();
+  tokens_ -= bytes;
+  if (tokens_ >= 0)
+    return TimeDelta();
+  return TimeDelta::FromMicroseconds(static_cast<int64_t>(
+      -tokens_ * Time::kMicrosecondsPerSecond / rate_bps_));
+}
+
+void BandwidthLimiter::Refill() {
+  Time now = clock_->GetMonotonicTime();
+  if (now > last_refill_) {
+    tokens_ = std::min<double>(
+        rate_bps_,
+        tokens_ + (now - last_refill_).InSecondsF() * rate_bps_);
+  }
+  last_refill_ = now;
+}
+
+}  // namespace chromeos_update_engine
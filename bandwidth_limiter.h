@@ -0,0 +1,67 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_BANDWIDTH_LIMITER_H_
+#define UPDATE_ENGINE_BANDWIDTH_LIMITER_H_
+
+#include <stdint.h>
+
+#include <base/macros.h>
+#include <base/time/time.h>
+
+#include "update_engine/common/clock_interface.h"
+
+namespace chromeos_update_engine {
+
+// A token bucket that limits the rate at which the HTTP fetchers sharing it
+// receive data. The bucket fills at the limit rate and holds up to one second
+// worth of data, so short bursts are not delayed. The fetchers take the bytes
+// they received out of it and pause their transfers for as long as it is
+// empty.
+class BandwidthLimiter {
+ public:
+  explicit BandwidthLimiter(ClockInterface* clock);
+
+  // Sets the maximum rate in bytes per second, or 0 for no limit. It may be
+  // changed at any time and applies to the following calls to Consume().
+  void SetRate(int64_t rate_bps);
+  int64_t rate() const { return rate_bps_; }
+
+  // Takes |bytes| received out of the bucket and returns for how long the
+  // caller should wait before receiving more, zero if it doesn't need to.
+  base::TimeDelta Consume(size_t bytes);
+
+ private:
+  // Adds the tokens accumulated since the last call.
+  void Refill();
+
+  ClockInterface* clock_;
+
+  int64_t rate_bps_{0};
+
+  // The bytes that can be received without waiting. Negative when more than
+  // that was received, in which case the caller waits until it is back to
+  // zero.
+  double tokens_{0};
+  base::Time last_refill_;
+
+  DISALLOW_COPY_AND_ASSIGN(BandwidthLimiter);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_BANDWIDTH_LIMITER_H_
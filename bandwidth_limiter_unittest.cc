@@ -0,0 +1,76 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/bandwidth_limiter.h"
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/fake_clock.h"
+
+using base::Time;
+using base::TimeDelta;
+
+namespace chromeos_update_engine {
+
+class BandwidthLimiterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    fake_clock_.SetMonotonicTime(Time::FromInternalValue(1000000));
+  }
+
+  void AdvanceClock(TimeDelta delta) {
+    fake_clock_.SetMonotonicTime(fake_clock_.GetMonotonicTime() + delta);
+  }
+
+  FakeClock fake_clock_;
+  BandwidthLimiter limiter_{&fake_clock_};
+};
+
+TEST_F(BandwidthLimiterTest, UnlimitedByDefaultTest) {
+  EXPECT_EQ(0, limiter_.rate());
+  EXPECT_EQ(TimeDelta(), limiter_.Consume(100 * 1024 * 1024));
+}
+
+TEST_F(BandwidthLimiterTest, WaitsWhenTheBucketIsEmptyTest) {
+  limiter_.SetRate(1000);
+  // One second worth of data goes through without waiting.
+  EXPECT_EQ(TimeDelta(), limiter_.Consume(1000));
+  EXPECT_EQ(TimeDelta::FromMilliseconds(500), limiter_.Consume(500));
+
+  // After waiting, the debt is paid back.
+  AdvanceClock(TimeDelta::FromMilliseconds(500));
+  EXPECT_EQ(TimeDelta(), limiter_.Consume(0));
+  EXPECT_EQ(TimeDelta::FromMilliseconds(250), limiter_.Consume(250));
+}
+
+TEST_F(BandwidthLimiterTest, BurstIsLimitedToOneSecondTest) {
+  limiter_.SetRate(1000);
+  AdvanceClock(TimeDelta::FromSeconds(10));
+  EXPECT_EQ(TimeDelta(), limiter_.Consume(1000));
+  EXPECT_EQ(TimeDelta::FromMilliseconds(1), limiter_.Consume(1));
+}
+
+TEST_F(BandwidthLimiterTest, RateChangesApplyImmediatelyTest) {
+  limiter_.SetRate(1000);
+  EXPECT_EQ(TimeDelta::FromSeconds(1), limiter_.Consume(2000));
+  limiter_.SetRate(0);
+  EXPECT_EQ(TimeDelta(), limiter_.Consume(2000));
+  limiter_.SetRate(4000);
+  EXPECT_EQ(TimeDelta::FromMilliseconds(500), limiter_.Consume(6000));
+}
+
+}  // namespace chromeos_update_engine
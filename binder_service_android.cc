@@ -174,4 +174,12 @@ Status BinderUpdateEngineAndroidService::setPerformanceMode(bool enable) {
   return Status::ok();
 }
 
+Status BinderUpdateEngineAndroidService::setDownloadRateLimit(
+    int64_t rate_bps) {
+  brillo::ErrorPtr error;
+  if (!service_delegate_->SetDownloadRateLimit(rate_bps, &error))
+    return ErrorPtrToStatus(error);
+  return Status::ok();
+}
+
 }  // namespace chromeos_update_engine
@@ -167,6 +167,17 @@ Status BinderUpdateEngineBrilloService::GetUpdateOverCellularPermission(
       out_cellular_permission);
 }
 
+Status BinderUpdateEngineBrilloService::SetDownloadRateLimit(int64_t rate_bps) {
+  return CallCommonHandler(&UpdateEngineService::SetDownloadRateLimit,
+                           rate_bps);
+}
+
+Status BinderUpdateEngineBrilloService::GetDownloadRateLimit(
+    int64_t* out_rate_bps) {
+  return CallCommonHandler(&UpdateEngineService::GetDownloadRateLimit,
+                           out_rate_bps);
+}
+
 Status BinderUpdateEngineBrilloService::GetDurationSinceUpdate(
     int64_t* out_duration) {
   return CallCommonHandler(&UpdateEngineService::GetDurationSinceUpdate,
@@ -221,6 +232,16 @@ Status BinderUpdateEngineBrilloService::GetEolStatus(int* out_eol_status) {
   return CallCommonHandler(&UpdateEngineService::GetEolStatus, out_eol_status);
 }
 
+Status BinderUpdateEngineBrilloService::GetPerfStats(
+    String16* out_perf_stats) {
+  string perf_stats;
+  auto ret =
+      CallCommonHandler(&UpdateEngineService::GetPerfStats, &perf_stats);
+
+  *out_perf_stats = String16(perf_stats.c_str());
+  return ret;
+}
+
 void BinderUpdateEngineBrilloService::UnregisterStatusCallback(
     IUpdateEngineStatusCallback* callback) {
   auto it = callbacks_.begin();
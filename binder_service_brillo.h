@@ -79,6 +79,9 @@ class BinderUpdateEngineBrilloService : public android::brillo::BnUpdateEngine,
       const android::String16& target_version, int64_t target_size) override;
   android::binder::Status GetUpdateOverCellularPermission(
       bool* out_cellular_permission) override;
+  android::binder::Status SetDownloadRateLimit(int64_t rate_bps) override;
+  android::binder::Status GetDownloadRateLimit(
+      int64_t* out_rate_bps) override;
   android::binder::Status GetDurationSinceUpdate(
       int64_t* out_duration) override;
   android::binder::Status GetPrevVersion(
@@ -91,6 +94,8 @@ class BinderUpdateEngineBrilloService : public android::brillo::BnUpdateEngine,
   android::binder::Status GetLastAttemptError(
       int* out_last_attempt_error) override;
   android::binder::Status GetEolStatus(int* out_eol_status) override;
+  android::binder::Status GetPerfStats(
+      android::String16* out_perf_stats) override;
 
  private:
   // Generic function for dispatching to the common service.
@@ -382,6 +382,40 @@ bool UnmapTargetPartitions(DynamicPartitionControlInterface* dynamic_control,
   return true;
 }
 
+// Maps all the target dynamic partitions with a single wait for their device
+// nodes, instead of one wait per partition when GetPartitionDevice() maps
+// them. Failures are not fatal: the partitions left unmapped are mapped one
+// at a time by GetPartitionDevice().
+void MapTargetPartitions(DynamicPartitionControlInterface* dynamic_control,
+                         Slot target_slot,
+                         const string& target_suffix,
+                         const PartitionMetadata& partition_metadata) {
+  string device_dir_str;
+  if (!dynamic_control->GetDeviceDir(&device_dir_str))
+    return;
+  base::FilePath device_dir(device_dir_str);
+  auto super_device =
+      device_dir.Append(fs_mgr_get_super_partition_name(target_slot)).value();
+  std::vector<string> partition_names;
+  for (const auto& group : partition_metadata.groups) {
+    for (const auto& partition : group.partitions) {
+      // Empty partitions have nothing to map.
+      if (partition.size > 0)
+        partition_names.push_back(partition.name + target_suffix);
+    }
+  }
+  std::vector<string> paths;
+  if (!partition_names.empty() &&
+      !dynamic_control->MapPartitionsOnDeviceMapper(super_device,
+                                                    partition_names,
+                                                    target_slot,
+                                                    true /* force_writable */,
+                                                    &paths)) {
+    LOG(WARNING) << "Unable to map all the target partitions at once, they "
+                 << "will be mapped one at a time.";
+  }
+}
+
 }  // namespace
 
 bool BootControlAndroid::InitPartitionMetadata(
@@ -413,27 +447,31 @@ bool BootControlAndroid::InitPartitionMetadata(
     return true;
   }
 
-  if (!update_metadata) {
-    return true;
-  }
-
   string target_suffix;
   if (!GetSuffix(target_slot, &target_suffix)) {
     return false;
   }
 
-  // Unmap all the target dynamic partitions because they would become
-  // inconsistent with the new metadata.
-  if (!UnmapTargetPartitions(
-          dynamic_control_.get(), target_suffix, partition_metadata)) {
-    return false;
-  }
+  if (update_metadata) {
+    // Unmap all the target dynamic partitions because they would become
+    // inconsistent with the new metadata.
+    if (!UnmapTargetPartitions(
+            dynamic_control_.get(), target_suffix, partition_metadata)) {
+      return false;
+    }
 
-  return UpdatePartitionMetadata(dynamic_control_.get(),
+    if (!UpdatePartitionMetadata(dynamic_control_.get(),
                                  source_slot,
                                  target_slot,
                                  target_suffix,
-                                 partition_metadata);
+                                 partition_metadata)) {
+      return false;
+    }
+  }
+
+  MapTargetPartitions(
+      dynamic_control_.get(), target_slot, target_suffix, partition_metadata);
+  return true;
 }
 
 }  // namespace chromeos_update_engine
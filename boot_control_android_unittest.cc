@@ -36,6 +36,7 @@ using std::string;
 using testing::_;
 using testing::AnyNumber;
 using testing::Contains;
+using testing::ElementsAre;
 using testing::Eq;
 using testing::Invoke;
 using testing::Key;
@@ -565,6 +566,39 @@ TEST_P(BootControlAndroidTestP,
   EXPECT_EQ(GetDevice(T("bar")), bar_device);
 }
 
+// Test that all the target partitions are mapped at once, except the empty
+// ones.
+TEST_P(BootControlAndroidTestP, MapTargetPartitionsAtOnce) {
+  SetMetadata(source(), {{S("system"), 2_GiB}, {S("vendor"), 1_GiB}});
+  ExpectStoreMetadata({{S("system"), 2_GiB},
+                       {S("vendor"), 1_GiB},
+                       {T("system"), 2_GiB},
+                       {T("vendor"), 1_GiB},
+                       {T("empty"), 0}});
+  ExpectUnmap({T("system"), T("vendor"), T("empty")});
+  EXPECT_CALL(dynamicControl(),
+              MapPartitionsOnDeviceMapper(GetSuperDevice(target()),
+                                          ElementsAre(T("system"), T("vendor")),
+                                          target(),
+                                          true,
+                                          _))
+      .WillOnce(Return(true));
+
+  EXPECT_TRUE(InitPartitionMetadata(
+      target(), {{"empty", 0}, {"system", 2_GiB}, {"vendor", 1_GiB}}));
+}
+
+// Test that failing to map the target partitions at once is not fatal.
+TEST_P(BootControlAndroidTestP, MapTargetPartitionsAtOnceFailureIsIgnored) {
+  SetMetadata(source(), {{S("system"), 2_GiB}});
+  ExpectStoreMetadata({{S("system"), 2_GiB}, {T("system"), 2_GiB}});
+  ExpectUnmap({T("system")});
+  EXPECT_CALL(dynamicControl(), MapPartitionsOnDeviceMapper(_, _, _, _, _))
+      .WillOnce(Return(false));
+
+  EXPECT_TRUE(InitPartitionMetadata(target(), {{"system", 2_GiB}}));
+}
+
 TEST_P(BootControlAndroidTestP, GetPartitionDeviceWhenResumingUpdate) {
   // Both of the two slots contain valid partition metadata, since this is
   // resuming an update.
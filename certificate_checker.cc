@@ -164,16 +164,23 @@ bool CertificateChecker::CheckCertificateChange(int preverify_ok,
                                           kPrefsUpdateServerCertificate,
                                           static_cast<int>(server_to_check),
                                           depth);
-  string stored_digest;
-  // If there's no stored certificate, we just store the current one and return.
-  if (!prefs_->GetString(storage_key, &stored_digest)) {
-    if (!prefs_->SetString(storage_key, digest_string)) {
-      LOG(WARNING) << "Failed to store server certificate on storage key "
-                   << storage_key;
+  auto stored_it = digests_.find(storage_key);
+  if (stored_it == digests_.end()) {
+    string stored_digest;
+    // If there's no stored certificate, we just store the current one and
+    // return.
+    if (!prefs_->GetString(storage_key, &stored_digest)) {
+      if (!prefs_->SetString(storage_key, digest_string)) {
+        LOG(WARNING) << "Failed to store server certificate on storage key "
+                     << storage_key;
+      }
+      digests_[storage_key] = digest_string;
+      NotifyCertificateChecked(server_to_check, CertificateCheckResult::kValid);
+      return true;
     }
-    NotifyCertificateChecked(server_to_check, CertificateCheckResult::kValid);
-    return true;
+    stored_it = digests_.emplace(storage_key, stored_digest).first;
   }
+  string& stored_digest = stored_it->second;
 
   // Certificate changed, we store a report to UMA and store the most recent
   // certificate.
@@ -184,6 +191,7 @@ bool CertificateChecker::CheckCertificateChange(int preverify_ok,
     }
     LOG(INFO) << "Certificate changed from " << stored_digest << " to "
               << digest_string << ".";
+    stored_digest = digest_string;
     NotifyCertificateChecked(server_to_check,
                              CertificateCheckResult::kValidChanged);
     return true;
@@ -20,6 +20,7 @@
 #include <curl/curl.h>
 #include <openssl/ssl.h>
 
+#include <map>
 #include <string>
 
 #include <base/macros.h>
@@ -125,6 +126,7 @@ class CertificateChecker {
   FRIEND_TEST(CertificateCheckerTest, SameCertificate);
   FRIEND_TEST(CertificateCheckerTest, ChangedCertificate);
   FRIEND_TEST(CertificateCheckerTest, FailedCertificate);
+  FRIEND_TEST(CertificateCheckerTest, StoredDigestIsReadOnce);
 
   // These callbacks are asynchronously called by openssl after initial SSL
   // verification. They are used to perform any additional security verification
@@ -164,6 +166,10 @@ class CertificateChecker {
   // The wrapper for openssl operations.
   OpenSSLWrapper* openssl_wrapper_;
 
+  // The digests stored in the prefs, by storage key, so the prefs are only
+  // read once per certificate instead of on every TLS handshake.
+  std::map<std::string, std::string> digests_;
+
   // The observer called whenever a certificate is checked, if not null.
   Observer* observer_{nullptr};
 
@@ -19,14 +19,34 @@
 #include <utility>
 
 #include <base/bind.h>
+#include <base/location.h>
 #include <base/memory/ptr_util.h>
 #include <base/strings/string_util.h>
 #include <brillo/http/http_proxy.h>
 
 #include "update_engine/dbus_connection.h"
 
+using brillo::MessageLoop;
+using std::string;
+
 namespace chromeos_update_engine {
 
+namespace {
+
+// How long the proxies resolved for a scheme and host are reused. A network
+// change clears them sooner.
+const int kProxiesCacheTimeoutSeconds = 60;
+
+// Returns the scheme and host (and port) part of |url|, which the proxies are
+// cached by.
+string GetCacheKey(const string& url) {
+  size_t host_start = url.find("://");
+  host_start = host_start == string::npos ? 0 : host_start + 3;
+  return url.substr(0, url.find_first_of("/?#", host_start));
+}
+
+}  // namespace
+
 ChromeBrowserProxyResolver::ChromeBrowserProxyResolver()
     : next_request_id_(kProxyRequestIdNull + 1), weak_ptr_factory_(this) {}
 
@@ -35,13 +55,32 @@ ChromeBrowserProxyResolver::~ChromeBrowserProxyResolver() = default;
 ProxyRequestId ChromeBrowserProxyResolver::GetProxiesForUrl(
     const std::string& url, const ProxiesResolvedFn& callback) {
   const ProxyRequestId id = next_request_id_++;
+  pending_callbacks_[id] = callback;
+
+  const string cache_key = GetCacheKey(url);
+  auto cached = cache_.find(cache_key);
+  if (cached != cache_.end()) {
+    if (base::TimeTicks::Now() < cached->second.expiration) {
+      // The callback is still run asynchronously, like for a D-Bus call.
+      MessageLoop::current()->PostTask(
+          FROM_HERE,
+          base::Bind(&ChromeBrowserProxyResolver::RunCallback,
+                     weak_ptr_factory_.GetWeakPtr(),
+                     id,
+                     cached->second.proxies));
+      return id;
+    }
+    cache_.erase(cached);
+  }
+
   brillo::http::GetChromeProxyServersAsync(
       DBusConnection::Get()->GetDBus(),
       url,
       base::Bind(&ChromeBrowserProxyResolver::OnGetChromeProxyServers,
                  weak_ptr_factory_.GetWeakPtr(),
-                 id));
-  pending_callbacks_[id] = callback;
+                 id,
+                 cache_key,
+                 cache_generation_));
   return id;
 }
 
@@ -49,19 +88,40 @@ bool ChromeBrowserProxyResolver::CancelProxyRequest(ProxyRequestId request) {
   return pending_callbacks_.erase(request) != 0;
 }
 
+void ChromeBrowserProxyResolver::ValueChanged(
+    chromeos_update_manager::BaseVariable* variable) {
+  cache_.clear();
+  cache_generation_++;
+}
+
 void ChromeBrowserProxyResolver::OnGetChromeProxyServers(
     ProxyRequestId request_id,
+    const string& cache_key,
+    uint64_t cache_generation,
     bool success,
     const std::vector<std::string>& proxies) {
   // If |success| is false, |proxies| will still hold the direct proxy option
   // which is what we do in our error case.
+  std::deque<string> proxies_deque(proxies.begin(), proxies.end());
+  if (success && cache_generation == cache_generation_) {
+    CachedProxies& cached = cache_[cache_key];
+    cached.proxies = proxies_deque;
+    cached.expiration =
+        base::TimeTicks::Now() +
+        base::TimeDelta::FromSeconds(kProxiesCacheTimeoutSeconds);
+  }
+  RunCallback(request_id, proxies_deque);
+}
+
+void ChromeBrowserProxyResolver::RunCallback(
+    ProxyRequestId request_id, const std::deque<std::string>& proxies) {
   auto it = pending_callbacks_.find(request_id);
   if (it == pending_callbacks_.end())
     return;
 
   ProxiesResolvedFn callback = it->second;
   pending_callbacks_.erase(it);
-  callback.Run(std::deque<std::string>(proxies.begin(), proxies.end()));
+  callback.Run(proxies);
 }
 
 }  // namespace chromeos_update_engine
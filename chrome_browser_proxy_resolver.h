@@ -23,12 +23,21 @@
 #include <vector>
 
 #include <base/memory/weak_ptr.h>
+#include <base/time/time.h>
 
 #include "update_engine/common/proxy_resolver.h"
+#include "update_engine/update_manager/variable.h"
 
 namespace chromeos_update_engine {
 
-class ChromeBrowserProxyResolver : public ProxyResolver {
+// Resolves the proxies through Chrome over D-Bus. The proxies resolved for a
+// scheme and host are cached for a short time, so the ranges and retries of a
+// transfer don't each need a D-Bus round trip. The cache is cleared whenever
+// the variable it observes changes, which is meant to be the time the network
+// connection last changed.
+class ChromeBrowserProxyResolver
+    : public ProxyResolver,
+      public chromeos_update_manager::BaseVariable::ObserverInterface {
  public:
   ChromeBrowserProxyResolver();
   ~ChromeBrowserProxyResolver() override;
@@ -38,9 +47,21 @@ class ChromeBrowserProxyResolver : public ProxyResolver {
                                   const ProxiesResolvedFn& callback) override;
   bool CancelProxyRequest(ProxyRequestId request) override;
 
+  // BaseVariable::ObserverInterface:
+  void ValueChanged(chromeos_update_manager::BaseVariable* variable) override;
+
  private:
-  // Callback for calls made by GetProxiesForUrl().
+  struct CachedProxies {
+    std::deque<std::string> proxies;
+    base::TimeTicks expiration;
+  };
+
+  // Callback for calls made by GetProxiesForUrl(). The proxies are cached for
+  // |cache_key| unless the cache was cleared since the call, in which case
+  // they may belong to the previous network.
   void OnGetChromeProxyServers(ProxyRequestId request_id,
+                               const std::string& cache_key,
+                               uint64_t cache_generation,
                                bool success,
                                const std::vector<std::string>& proxies);
 
@@ -56,6 +77,12 @@ class ChromeBrowserProxyResolver : public ProxyResolver {
   // Callbacks that were passed to GetProxiesForUrl() but haven't yet been run.
   std::map<ProxyRequestId, ProxiesResolvedFn> pending_callbacks_;
 
+  // The proxies resolved by Chrome, by scheme and host of the URL.
+  std::map<std::string, CachedProxies> cache_;
+
+  // Incremented whenever |cache_| is cleared.
+  uint64_t cache_generation_{0};
+
   base::WeakPtrFactory<ChromeBrowserProxyResolver> weak_ptr_factory_;
 
   DISALLOW_COPY_AND_ASSIGN(ChromeBrowserProxyResolver);
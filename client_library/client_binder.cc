@@ -260,5 +260,15 @@ bool BinderUpdateEngineClient::GetEolStatus(int32_t* eol_status) const {
   return true;
 }
 
+bool BinderUpdateEngineClient::GetPerfStats(string* out_perf_stats) const {
+  String16 out_as_string16;
+
+  if (!service_->GetPerfStats(&out_as_string16).isOk())
+    return false;
+
+  *out_perf_stats = String8{out_as_string16}.string();
+  return true;
+}
+
 }  // namespace internal
 }  // namespace update_engine
@@ -89,6 +89,8 @@ class BinderUpdateEngineClient : public UpdateEngineClient {
 
   bool GetEolStatus(int32_t* eol_status) const override;
 
+  bool GetPerfStats(std::string* out_perf_stats) const override;
+
  private:
   class StatusUpdateCallback
       : public android::brillo::BnUpdateEngineStatusCallback {
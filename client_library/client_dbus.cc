@@ -259,5 +259,9 @@ bool DBusUpdateEngineClient::GetEolStatus(int32_t* eol_status) const {
   return proxy_->GetEolStatus(eol_status, nullptr);
 }
 
+bool DBusUpdateEngineClient::GetPerfStats(string* out_perf_stats) const {
+  return proxy_->GetPerfStats(out_perf_stats, nullptr);
+}
+
 }  // namespace internal
 }  // namespace update_engine
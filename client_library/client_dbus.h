@@ -83,6 +83,8 @@ class DBusUpdateEngineClient : public UpdateEngineClient {
 
   bool GetEolStatus(int32_t* eol_status) const override;
 
+  bool GetPerfStats(std::string* out_perf_stats) const override;
+
  private:
   void DBusStatusHandlersRegistered(const std::string& interface,
                                     const std::string& signal_name,
@@ -135,6 +135,9 @@ class UpdateEngineClient {
   // Get the current end-of-life status code. See EolStatus enum for details.
   virtual bool GetEolStatus(int32_t* eol_status) const = 0;
 
+  // Get the performance statistics of the update_engine as JSON.
+  virtual bool GetPerfStats(std::string* out_perf_stats) const = 0;
+
  protected:
   // Use CreateInstance().
   UpdateEngineClient() = default;
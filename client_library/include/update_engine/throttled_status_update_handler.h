@@ -0,0 +1,98 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_CLIENT_LIBRARY_INCLUDE_UPDATE_ENGINE_THROTTLED_STATUS_UPDATE_HANDLER_H_
+#define UPDATE_ENGINE_CLIENT_LIBRARY_INCLUDE_UPDATE_ENGINE_THROTTLED_STATUS_UPDATE_HANDLER_H_
+
+#include <string>
+
+#include <base/time/time.h>
+#include <brillo/message_loops/message_loop.h>
+
+#include "update_engine/status_update_handler.h"
+#include "update_engine/update_status.h"
+
+namespace update_engine {
+
+// A status of update_engine, along with the download rate and the time left
+// estimated from the previous ones.
+struct ThrottledStatusUpdate {
+  int64_t last_checked_time{0};
+  double progress{0.0};
+  UpdateStatus current_operation{UpdateStatus::IDLE};
+  std::string new_version;
+  int64_t new_size{0};
+
+  // Whether |current_operation| changed since the previous status reported.
+  bool operation_changed{false};
+
+  // The average download rate in bytes per second since the download started,
+  // and the time left to finish it at that rate, or -1 if not downloading or
+  // not known yet.
+  double download_bytes_per_second{-1.0};
+  int64_t download_seconds_left{-1};
+};
+
+// A StatusUpdateHandler which coalesces the status updates of update_engine,
+// so they can be followed instead of polling GetStatus() without handling
+// every progress change. A status is reported right away when the operation
+// changes, and otherwise at most once per |min_interval|, with the latest
+// status received. Coalesced statuses are reported from the current
+// brillo::MessageLoop once the interval passed.
+class ThrottledStatusUpdateHandler : public StatusUpdateHandler {
+ public:
+  explicit ThrottledStatusUpdateHandler(base::TimeDelta min_interval);
+  ~ThrottledStatusUpdateHandler() override;
+
+  // Runs with the latest status when it is reported.
+  virtual void HandleThrottledStatusUpdate(
+      const ThrottledStatusUpdate& status) = 0;
+
+  // StatusUpdateHandler overrides.
+  void HandleStatusUpdate(int64_t last_checked_time,
+                          double progress,
+                          UpdateStatus current_operation,
+                          const std::string& new_version,
+                          int64_t new_size) override;
+
+ private:
+  // Reports |latest_| to HandleThrottledStatusUpdate().
+  void ReportLatestStatus();
+
+  const base::TimeDelta min_interval_;
+
+  // The latest status received, and whether any status was reported.
+  ThrottledStatusUpdate latest_;
+  bool reported_{false};
+  UpdateStatus reported_operation_{UpdateStatus::IDLE};
+  base::TimeTicks last_report_time_;
+
+  // The time and progress of the first status of the current download.
+  base::TimeTicks download_start_time_;
+  double download_start_progress_{0.0};
+
+  // The task reporting a coalesced status, if any.
+  brillo::MessageLoop::TaskId report_task_id_{
+      brillo::MessageLoop::kTaskIdNull};
+
+  ThrottledStatusUpdateHandler(const ThrottledStatusUpdateHandler&) = delete;
+  void operator=(const ThrottledStatusUpdateHandler&) = delete;
+};
+
+}  // namespace update_engine
+
+#endif  // UPDATE_ENGINE_CLIENT_LIBRARY_INCLUDE_UPDATE_ENGINE_THROTTLED_STATUS_UPDATE_HANDLER_H_
@@ -74,6 +74,16 @@ struct UpdateEngineStatus {
   std::string new_version;
   // the new system version, if there is one (empty, otherwise)
   std::string new_system_version;
+  // the download rate over the last seconds (bytes per second), or negative
+  // if not downloading or not known yet
+  double download_bytes_per_second;
+  // the estimated time left to complete the current operation (seconds), or
+  // -1 if not known
+  int64_t seconds_left;
+  // the bytes read from and written to the storage by the update_engine
+  // during the current operation
+  int64_t phase_bytes_read;
+  int64_t phase_bytes_written;
 };
 
 }  // namespace update_engine
@@ -0,0 +1,96 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/client_library/include/update_engine/throttled_status_update_handler.h"
+
+#include <base/bind.h>
+#include <base/location.h>
+
+using brillo::MessageLoop;
+using std::string;
+
+namespace update_engine {
+
+ThrottledStatusUpdateHandler::ThrottledStatusUpdateHandler(
+    base::TimeDelta min_interval)
+    : min_interval_(min_interval) {}
+
+ThrottledStatusUpdateHandler::~ThrottledStatusUpdateHandler() {
+  if (report_task_id_ != MessageLoop::kTaskIdNull && MessageLoop::current())
+    MessageLoop::current()->CancelTask(report_task_id_);
+}
+
+void ThrottledStatusUpdateHandler::HandleStatusUpdate(
+    int64_t last_checked_time,
+    double progress,
+    UpdateStatus current_operation,
+    const string& new_version,
+    int64_t new_size) {
+  const base::TimeTicks now = base::TimeTicks::Now();
+  if (current_operation != UpdateStatus::DOWNLOADING) {
+    download_start_time_ = base::TimeTicks();
+  } else if (download_start_time_.is_null() ||
+             latest_.current_operation != UpdateStatus::DOWNLOADING) {
+    download_start_time_ = now;
+    download_start_progress_ = progress;
+  }
+
+  latest_.last_checked_time = last_checked_time;
+  latest_.progress = progress;
+  latest_.current_operation = current_operation;
+  latest_.new_version = new_version;
+  latest_.new_size = new_size;
+  latest_.download_bytes_per_second = -1.0;
+  latest_.download_seconds_left = -1;
+  const double seconds = (now - download_start_time_).InSecondsF();
+  if (!download_start_time_.is_null() && seconds > 0 && new_size > 0 &&
+      progress > download_start_progress_) {
+    latest_.download_bytes_per_second =
+        (progress - download_start_progress_) * new_size / seconds;
+    latest_.download_seconds_left = static_cast<int64_t>(
+        (1.0 - progress) * new_size / latest_.download_bytes_per_second);
+  }
+
+  if (!reported_ || current_operation != reported_operation_ ||
+      now - last_report_time_ >= min_interval_) {
+    ReportLatestStatus();
+    return;
+  }
+  // Report the coalesced statuses once the interval passed.
+  if (report_task_id_ == MessageLoop::kTaskIdNull && MessageLoop::current()) {
+    report_task_id_ = MessageLoop::current()->PostDelayedTask(
+        FROM_HERE,
+        base::Bind(&ThrottledStatusUpdateHandler::ReportLatestStatus,
+                   base::Unretained(this)),
+        last_report_time_ + min_interval_ - now);
+  }
+}
+
+void ThrottledStatusUpdateHandler::ReportLatestStatus() {
+  if (report_task_id_ != MessageLoop::kTaskIdNull) {
+    MessageLoop::current()->CancelTask(report_task_id_);
+    report_task_id_ = MessageLoop::kTaskIdNull;
+  }
+  latest_.operation_changed =
+      !reported_ || latest_.current_operation != reported_operation_;
+  reported_ = true;
+  reported_operation_ = latest_.current_operation;
+  last_report_time_ = base::TimeTicks::Now();
+  HandleThrottledStatusUpdate(latest_);
+}
+
+}  // namespace update_engine
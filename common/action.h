@@ -21,6 +21,7 @@
 
 #include <memory>
 #include <string>
+#include <utility>
 
 #include <base/logging.h>
 #include <base/macros.h>
@@ -193,6 +194,14 @@ class Action : public AbstractAction {
     return in_pipe_->contents();
   }
 
+  // Moves the object out of the input pipe, for the actions keeping their own
+  // copy of it, like the big InstallPlan. The input pipe must not be read
+  // again afterwards.
+  typename ActionTraits<SubClass>::InputObjectType TakeInputObject() {
+    CHECK(HasInputObject());
+    return in_pipe_->TakeContents();
+  }
+
   // Returns true iff there's an output pipe.
   bool HasOutputPipe() const { return out_pipe_.get(); }
 
@@ -205,6 +214,14 @@ class Action : public AbstractAction {
     out_pipe_->set_contents(out_obj);
   }
 
+  // Same as above, but moves the object passed into the output pipe, for the
+  // actions which don't use it anymore.
+  void SetOutputObject(
+      typename ActionTraits<SubClass>::OutputObjectType&& out_obj) {
+    CHECK(HasOutputPipe());
+    out_pipe_->set_contents(std::move(out_obj));
+  }
+
   // Returns a reference to the object sitting in the output pipe.
   const typename ActionTraits<SubClass>::OutputObjectType& GetOutputObject() {
     CHECK(HasOutputPipe());
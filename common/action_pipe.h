@@ -22,6 +22,7 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <utility>
 
 #include <base/logging.h>
 #include <base/macros.h>
@@ -60,10 +61,17 @@ class ActionPipe {
   // Returns a reference to the stored object.
   const ObjectType& contents() const { return contents_; }
 
+  // This should be called by an Action on its input pipe to take the stored
+  // object instead of copying it. The pipe is left with a moved-from object.
+  ObjectType TakeContents() { return std::move(contents_); }
+
   // This should be called by an Action on its output pipe.
   // Stores a copy of the passed object in this pipe.
   void set_contents(const ObjectType& contents) { contents_ = contents; }
 
+  // Same as above, but moves the passed object into this pipe.
+  void set_contents(ObjectType&& contents) { contents_ = std::move(contents); }
+
   // Bonds two Actions together with a new ActionPipe. The ActionPipe is
   // jointly owned by the two Actions and will be automatically destroyed
   // when the last Action is destroyed.
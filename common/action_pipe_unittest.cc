@@ -18,6 +18,7 @@
 
 #include <gtest/gtest.h>
 #include <string>
+#include <utility>
 #include "update_engine/common/action.h"
 
 using std::string;
@@ -57,4 +58,16 @@ TEST(ActionPipeTest, SimpleTest) {
   EXPECT_EQ("foo", b.in_pipe()->contents());
 }
 
+// The contents are moved through the pipe when the actions don't need them.
+TEST(ActionPipeTest, MoveContentsTest) {
+  ActionPipeTestAction a, b;
+  BondActions(&a, &b);
+  string contents(1000, 'x');
+  const char* data = contents.data();
+  a.SetOutputObject(std::move(contents));
+  string taken = b.TakeInputObject();
+  EXPECT_EQ(string(1000, 'x'), taken);
+  EXPECT_EQ(data, taken.data());
+}
+
 }  // namespace chromeos_update_engine
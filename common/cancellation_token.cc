@@ -0,0 +1,52 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/common/cancellation_token.h"
+
+#include "update_engine/common/terminator.h"
+
+namespace chromeos_update_engine {
+
+CancellationToken::CancellationToken() : resumed_(&lock_) {}
+
+void CancellationToken::Cancel() {
+  base::AutoLock lock(lock_);
+  cancelled_ = true;
+  resumed_.Broadcast();
+}
+
+void CancellationToken::Pause() {
+  base::AutoLock lock(lock_);
+  paused_ = true;
+}
+
+void CancellationToken::Resume() {
+  base::AutoLock lock(lock_);
+  paused_ = false;
+  resumed_.Broadcast();
+}
+
+bool CancellationToken::Check() {
+  if (paused_) {
+    base::AutoLock lock(lock_);
+    while (paused_ && !cancelled_)
+      resumed_.Wait();
+  }
+  return !cancelled_ && !Terminator::exit_requested();
+}
+
+}  // namespace chromeos_update_engine
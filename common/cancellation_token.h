@@ -0,0 +1,68 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_COMMON_CANCELLATION_TOKEN_H_
+#define UPDATE_ENGINE_COMMON_CANCELLATION_TOKEN_H_
+
+#include <atomic>
+
+#include <base/macros.h>
+#include <base/synchronization/condition_variable.h>
+#include <base/synchronization/lock.h>
+
+namespace chromeos_update_engine {
+
+// CancellationToken lets a long running piece of work, such as applying a
+// single operation of a payload, be cancelled or paused from another thread.
+// The work calls Check() at regular points, which costs two atomic loads
+// unless the token is paused.
+class CancellationToken {
+ public:
+  CancellationToken();
+  ~CancellationToken() = default;
+
+  // Makes all the following calls to Check() return false, and wakes up the
+  // ones waiting for Resume().
+  void Cancel();
+
+  // Makes the following calls to Check() block until Resume() or Cancel() is
+  // called. It must not be called from the thread doing the work.
+  void Pause();
+  void Resume();
+
+  bool cancelled() const { return cancelled_; }
+
+  // Returns whether the work may go on, after waiting for Resume() if the
+  // token is paused. It returns false once the token is cancelled or the
+  // process was asked to terminate while its exit was blocked.
+  bool Check();
+
+ private:
+  std::atomic<bool> cancelled_{false};
+  std::atomic<bool> paused_{false};
+
+  // Protects the changes of |paused_| and |cancelled_| for the waiters of
+  // |resumed_|.
+  base::Lock lock_;
+  base::ConditionVariable resumed_;
+
+  DISALLOW_COPY_AND_ASSIGN(CancellationToken);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_COMMON_CANCELLATION_TOKEN_H_
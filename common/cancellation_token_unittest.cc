@@ -0,0 +1,100 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/common/cancellation_token.h"
+
+#include <atomic>
+
+#include <base/threading/platform_thread.h>
+#include <base/threading/simple_thread.h>
+#include <base/time/time.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/terminator.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Checks the token from another thread, as the work being paused would.
+class CheckingThread : public base::DelegateSimpleThread::Delegate {
+ public:
+  explicit CheckingThread(CancellationToken* token)
+      : token_(token), thread_(this, "cancellation-token-test") {}
+
+  void Start() { thread_.Start(); }
+  void Join() { thread_.Join(); }
+  bool done() const { return done_; }
+  bool result() const { return result_; }
+
+  void Run() override {
+    result_ = token_->Check();
+    done_ = true;
+  }
+
+ private:
+  CancellationToken* token_;
+  base::DelegateSimpleThread thread_;
+  std::atomic<bool> done_{false};
+  bool result_{false};
+};
+
+}  // namespace
+
+class CancellationTokenTest : public ::testing::Test {
+ protected:
+  void SetUp() override { Terminator::Init(); }
+  void TearDown() override { Terminator::Init(); }
+
+  CancellationToken token_;
+};
+
+TEST_F(CancellationTokenTest, CancelTest) {
+  EXPECT_TRUE(token_.Check());
+  token_.Cancel();
+  EXPECT_TRUE(token_.cancelled());
+  EXPECT_FALSE(token_.Check());
+}
+
+TEST_F(CancellationTokenTest, PauseBlocksUntilResumeTest) {
+  token_.Pause();
+  CheckingThread checker(&token_);
+  checker.Start();
+  base::PlatformThread::Sleep(base::TimeDelta::FromMilliseconds(50));
+  EXPECT_FALSE(checker.done());
+  token_.Resume();
+  checker.Join();
+  EXPECT_TRUE(checker.result());
+}
+
+TEST_F(CancellationTokenTest, CancelWakesUpThePausedWorkTest) {
+  token_.Pause();
+  CheckingThread checker(&token_);
+  checker.Start();
+  token_.Cancel();
+  checker.Join();
+  EXPECT_FALSE(checker.result());
+}
+
+TEST_F(CancellationTokenTest, TerminationRequestTest) {
+  Terminator::set_exit_blocked(true);
+  raise(SIGTERM);
+  EXPECT_FALSE(token_.Check());
+  EXPECT_FALSE(token_.cancelled());
+}
+
+}  // namespace chromeos_update_engine
@@ -37,6 +37,7 @@ const char kPrefsCurrentUrlIndex[] = "current-url-index";
 const char kPrefsDailyMetricsLastReportedAt[] =
     "daily-metrics-last-reported-at";
 const char kPrefsDeltaUpdateFailures[] = "delta-update-failures";
+const char kPrefsDownloadRateLimitBps[] = "download-rate-limit-bps";
 const char kPrefsDynamicPartitionMetadataUpdated[] =
     "dynamic-partition-metadata-updated";
 const char kPrefsFullPayloadAttemptNumber[] = "full-payload-attempt-number";
@@ -56,6 +57,7 @@ const char kPrefsOmahaCohort[] = "omaha-cohort";
 const char kPrefsOmahaCohortHint[] = "omaha-cohort-hint";
 const char kPrefsOmahaCohortName[] = "omaha-cohort-name";
 const char kPrefsOmahaEolStatus[] = "omaha-eol-status";
+const char kPrefsOmahaGzipRequests[] = "omaha-gzip-requests";
 const char kPrefsP2PEnabled[] = "p2p-enabled";
 const char kPrefsP2PFirstAttemptTimestamp[] = "p2p-first-attempt-timestamp";
 const char kPrefsP2PNumAttempts[] = "p2p-num-attempts";
@@ -70,6 +72,8 @@ const char kPrefsSystemUpdatedMarker[] = "system-updated-marker";
 const char kPrefsTargetVersionAttempt[] = "target-version-attempt";
 const char kPrefsTargetVersionInstalledFrom[] = "target-version-installed-from";
 const char kPrefsTargetVersionUniqueId[] = "target-version-unique-id";
+const char kPrefsThroughputHistoryBps[] = "throughput-history-bps";
+const char kPrefsThroughputHistoryRttMs[] = "throughput-history-rtt-ms";
 const char kPrefsTotalBytesDownloaded[] = "total-bytes-downloaded";
 const char kPrefsUpdateCheckCount[] = "update-check-count";
 const char kPrefsUpdateCheckResponseHash[] = "update-check-response-hash";
@@ -84,17 +88,23 @@ const char kPrefsUpdateOverCellularTargetVersion[] =
 const char kPrefsUpdateOverCellularTargetSize[] =
     "update-over-cellular-target-size";
 const char kPrefsUpdateServerCertificate[] = "update-server-cert";
+const char kPrefsUpdateStateHashContexts[] = "update-state-hash-contexts";
 const char kPrefsUpdateStateNextDataLength[] = "update-state-next-data-length";
 const char kPrefsUpdateStateNextDataOffset[] = "update-state-next-data-offset";
 const char kPrefsUpdateStateNextOperation[] = "update-state-next-operation";
+const char kPrefsUpdateStatePartialDataHash[] =
+    "update-state-partial-data-hash";
+const char kPrefsUpdateStatePartialDataLength[] =
+    "update-state-partial-data-length";
 const char kPrefsUpdateStatePayloadIndex[] = "update-state-payload-index";
-const char kPrefsUpdateStateSHA256Context[] = "update-state-sha-256-context";
 const char kPrefsUpdateStateSignatureBlob[] = "update-state-signature-blob";
-const char kPrefsUpdateStateSignedSHA256Context[] =
-    "update-state-signed-sha-256-context";
+const char kPrefsUpdateStateVerifiedSourceBlocks[] =
+    "update-state-verified-source-blocks";
 const char kPrefsUpdateBootTimestampStart[] = "update-boot-timestamp-start";
 const char kPrefsUpdateTimestampStart[] = "update-timestamp-start";
 const char kPrefsUrlSwitchCount[] = "url-switch-count";
+const char kPrefsVerityProgress[] = "verity-progress";
+const char kPrefsUrlStats[] = "url-stats";
 const char kPrefsVerityWritten[] = "verity-written";
 const char kPrefsWallClockScatteringWaitPeriod[] = "wall-clock-wait-period";
 const char kPrefsWallClockStagingWaitPeriod[] =
@@ -41,6 +41,7 @@ extern const char kPrefsCurrentUrlFailureCount[];
 extern const char kPrefsCurrentUrlIndex[];
 extern const char kPrefsDailyMetricsLastReportedAt[];
 extern const char kPrefsDeltaUpdateFailures[];
+extern const char kPrefsDownloadRateLimitBps[];
 extern const char kPrefsDynamicPartitionMetadataUpdated[];
 extern const char kPrefsFullPayloadAttemptNumber[];
 extern const char kPrefsInstallDateDays[];
@@ -57,6 +58,7 @@ extern const char kPrefsOmahaCohort[];
 extern const char kPrefsOmahaCohortHint[];
 extern const char kPrefsOmahaCohortName[];
 extern const char kPrefsOmahaEolStatus[];
+extern const char kPrefsOmahaGzipRequests[];
 extern const char kPrefsP2PEnabled[];
 extern const char kPrefsP2PFirstAttemptTimestamp[];
 extern const char kPrefsP2PNumAttempts[];
@@ -71,6 +73,8 @@ extern const char kPrefsSystemUpdatedMarker[];
 extern const char kPrefsTargetVersionAttempt[];
 extern const char kPrefsTargetVersionInstalledFrom[];
 extern const char kPrefsTargetVersionUniqueId[];
+extern const char kPrefsThroughputHistoryBps[];
+extern const char kPrefsThroughputHistoryRttMs[];
 extern const char kPrefsTotalBytesDownloaded[];
 extern const char kPrefsUpdateCheckCount[];
 extern const char kPrefsUpdateCheckResponseHash[];
@@ -82,16 +86,20 @@ extern const char kPrefsUpdateOverCellularPermission[];
 extern const char kPrefsUpdateOverCellularTargetVersion[];
 extern const char kPrefsUpdateOverCellularTargetSize[];
 extern const char kPrefsUpdateServerCertificate[];
+extern const char kPrefsUpdateStateHashContexts[];
 extern const char kPrefsUpdateStateNextDataLength[];
 extern const char kPrefsUpdateStateNextDataOffset[];
 extern const char kPrefsUpdateStateNextOperation[];
+extern const char kPrefsUpdateStatePartialDataHash[];
+extern const char kPrefsUpdateStatePartialDataLength[];
 extern const char kPrefsUpdateStatePayloadIndex[];
-extern const char kPrefsUpdateStateSHA256Context[];
 extern const char kPrefsUpdateStateSignatureBlob[];
-extern const char kPrefsUpdateStateSignedSHA256Context[];
+extern const char kPrefsUpdateStateVerifiedSourceBlocks[];
 extern const char kPrefsUpdateBootTimestampStart[];
 extern const char kPrefsUpdateTimestampStart[];
 extern const char kPrefsUrlSwitchCount[];
+extern const char kPrefsVerityProgress[];
+extern const char kPrefsUrlStats[];
 extern const char kPrefsVerityWritten[];
 extern const char kPrefsWallClockScatteringWaitPeriod[];
 extern const char kPrefsWallClockStagingWaitPeriod[];
@@ -144,6 +152,9 @@ const int kMaxP2PAttemptTimeSeconds = 5 * 24 * 60 * 60;
 // return while waiting in line to use the LAN - six hours.
 const int kMaxP2PNetworkWaitTimeSeconds = 6 * 60 * 60;
 
+// The maximum number of peers to download the same payload from at once.
+const int kMaxP2PPeers = 4;
+
 // The maximum number of payload files to keep in /var/cache/p2p.
 const int kMaxP2PFilesToKeep = 3;
 
@@ -16,6 +16,9 @@
 
 #include "update_engine/common/cpu_limiter.h"
 
+#include <sys/syscall.h>
+#include <unistd.h>
+
 #include <string>
 
 #include <base/bind.h>
@@ -31,6 +34,12 @@ namespace {
 // /etc/init/update-engine.conf.
 const char kCGroupSharesPath[] = "/sys/fs/cgroup/cpu/update-engine/cpu.shares";
 
+// The ioprio_set(2) constants, which the C library doesn't export.
+const int kIoprioWhoProcess = 1;
+const int kIoprioClassShift = 13;
+const int kIoprioClassBestEffort = 2;
+const int kIoprioLowestBestEffortLevel = 7;
+
 }  // namespace
 
 namespace chromeos_update_engine {
@@ -38,6 +47,7 @@ namespace chromeos_update_engine {
 CPULimiter::~CPULimiter() {
   // Set everything back to normal on destruction.
   CPULimiter::SetCpuShares(CpuShares::kNormal);
+  SetIoPriority(IoPriority::kNormal);
 }
 
 void CPULimiter::StartLimiter() {
@@ -50,6 +60,7 @@ void CPULimiter::StartLimiter() {
       base::Bind(&CPULimiter::StopLimiterCallback, base::Unretained(this)),
       base::TimeDelta::FromHours(2));
   SetCpuShares(CpuShares::kLow);
+  SetIoPriority(IoPriority::kLow);
 }
 
 void CPULimiter::StopLimiter() {
@@ -60,6 +71,7 @@ void CPULimiter::StopLimiter() {
     manage_shares_id_ = brillo::MessageLoop::kTaskIdNull;
   }
   SetCpuShares(CpuShares::kNormal);
+  SetIoPriority(IoPriority::kNormal);
 }
 
 bool CPULimiter::SetCpuShares(CpuShares shares) {
@@ -80,8 +92,30 @@ bool CPULimiter::SetCpuShares(CpuShares shares) {
   return true;
 }
 
+bool CPULimiter::SetIoPriority(IoPriority priority) {
+  // Short-circuit to avoid re-setting the priority.
+  if (io_priority_ == priority)
+    return true;
+
+  // A value of 0 sets no priority class, so the priority follows the nice
+  // value again.
+  int ioprio = 0;
+  if (priority == IoPriority::kLow) {
+    ioprio = (kIoprioClassBestEffort << kIoprioClassShift) |
+             kIoprioLowestBestEffortLevel;
+  }
+  if (syscall(SYS_ioprio_set, kIoprioWhoProcess, 0, ioprio) != 0) {
+    PLOG(ERROR) << "Failed to change the I/O priority to " << ioprio;
+    return false;
+  }
+  io_priority_ = priority;
+  LOG(INFO) << "I/O priority = " << ioprio;
+  return true;
+}
+
 void CPULimiter::StopLimiterCallback() {
   SetCpuShares(CpuShares::kNormal);
+  SetIoPriority(IoPriority::kNormal);
   manage_shares_id_ = brillo::MessageLoop::kTaskIdNull;
 }
 
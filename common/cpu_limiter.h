@@ -30,6 +30,15 @@ enum class CpuShares : int {
   kLow = 2,
 };
 
+// I/O priorities of the update-engine, see ioprio_set(2). kNormal lets the
+// kernel derive the priority from the CPU nice value, and kLow is the lowest
+// priority of the best-effort class, which unlike the idle class still lets the
+// update make progress while the disk is busy.
+enum class IoPriority : int {
+  kNormal,
+  kLow,
+};
+
 // Sets the current process shares to |shares|. Returns true on
 // success, false otherwise.
 bool SetCpuShares(CpuShares shares);
@@ -39,16 +48,23 @@ class CPULimiter {
   CPULimiter() = default;
   ~CPULimiter();
 
-  // Sets the cpu shares to low and sets up timeout events to stop the limiter.
+  // Sets the cpu shares and the I/O priority to low and sets up timeout events
+  // to stop the limiter.
   void StartLimiter();
 
-  // Resets the cpu shares to normal and destroys any scheduled timeout sources.
+  // Resets the cpu shares and the I/O priority to normal and destroys any
+  // scheduled timeout sources.
   void StopLimiter();
 
   // Sets the cpu shares to |shares|. This method can be user at any time, but
   // if the limiter is not running, the shares won't be reset to normal.
   bool SetCpuShares(CpuShares shares);
 
+  // Sets the I/O priority of the calling thread, and of the threads it creates
+  // afterwards, to |priority|. The limiter runs on the main thread, which
+  // writes and verifies the partitions.
+  bool SetIoPriority(IoPriority priority);
+
  private:
   // The cpu shares timeout source callback sets the current cpu shares to
   // normal.
@@ -57,6 +73,9 @@ class CPULimiter {
   // Current cpu shares.
   CpuShares shares_ = CpuShares::kNormal;
 
+  // Current I/O priority.
+  IoPriority io_priority_ = IoPriority::kNormal;
+
   // The cpu shares management timeout task id.
   brillo::MessageLoop::TaskId manage_shares_id_{
       brillo::MessageLoop::kTaskIdNull};
@@ -16,6 +16,9 @@
 
 #include "update_engine/common/cpu_limiter.h"
 
+#include <sys/syscall.h>
+#include <unistd.h>
+
 #include <gtest/gtest.h>
 
 namespace chromeos_update_engine {
@@ -39,4 +42,13 @@ TEST(CPULimiterTest, CompareCpuSharesTest) {
   EXPECT_GT(CompareCpuShares(CpuShares::kHigh, CpuShares::kNormal), 0);
 }
 
+TEST(CPULimiterTest, SetIoPriorityTest) {
+  CPULimiter limiter;
+  ASSERT_TRUE(limiter.SetIoPriority(IoPriority::kLow));
+  // The best-effort class with the lowest priority level, 7.
+  EXPECT_EQ((2 << 13) | 7, syscall(SYS_ioprio_get, 1, 0));
+  ASSERT_TRUE(limiter.SetIoPriority(IoPriority::kNormal));
+  EXPECT_NE((2 << 13) | 7, syscall(SYS_ioprio_get, 1, 0));
+}
+
 }  // namespace chromeos_update_engine
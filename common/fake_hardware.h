@@ -119,7 +119,10 @@ class FakeHardware : public HardwareInterface {
   bool IsPowerwashScheduled() { return powerwash_scheduled_; }
 
   bool GetNonVolatileDirectory(base::FilePath* path) const override {
-    return false;
+    if (non_volatile_directory_.empty())
+      return false;
+    *path = non_volatile_directory_;
+    return true;
   }
 
   bool GetPowerwashSafeDirectory(base::FilePath* path) const override {
@@ -137,6 +140,46 @@ class FakeHardware : public HardwareInterface {
     return true;
   }
 
+  int GetMaxApplyThreads() const override { return max_apply_threads_; }
+
+  size_t GetDownloadStagingBufferSize() const override {
+    return download_staging_buffer_size_;
+  }
+
+  bool UseDirectIoForPartitionWrites() const override {
+    return use_direct_io_;
+  }
+
+  int GetDownloadConnections() const override { return download_connections_; }
+
+  int GetDownloadPrefetchPayloads() const override {
+    return download_prefetch_payloads_;
+  }
+
+  bool HashPartitionsWhileWriting() const override {
+    return hash_while_writing_;
+  }
+
+  size_t GetVerifierReadSize() const override { return verifier_read_size_; }
+
+  size_t GetFileFetcherReadSize() const override {
+    return file_fetcher_read_size_;
+  }
+
+  uint64_t GetMaxApplyMemorySize() const override {
+    return max_apply_memory_size_;
+  }
+
+  bool SkipUnchangedPartitionWrites() const override {
+    return skip_unchanged_writes_;
+  }
+
+  bool ApplyOperationsInDestinationOrder() const override {
+    return destination_order_;
+  }
+
+  bool StagePayloadsWhenDeferred() const override { return stage_deferred_; }
+
   // Setters
   void SetIsOfficialBuild(bool is_official_build) {
     is_official_build_ = is_official_build;
@@ -189,6 +232,58 @@ class FakeHardware : public HardwareInterface {
     build_timestamp_ = build_timestamp;
   }
 
+  void SetNonVolatileDirectory(const base::FilePath& path) {
+    non_volatile_directory_ = path;
+  }
+
+  void SetMaxApplyThreads(int max_apply_threads) {
+    max_apply_threads_ = max_apply_threads;
+  }
+
+  void SetDownloadStagingBufferSize(size_t download_staging_buffer_size) {
+    download_staging_buffer_size_ = download_staging_buffer_size;
+  }
+
+  void SetUseDirectIoForPartitionWrites(bool use_direct_io) {
+    use_direct_io_ = use_direct_io;
+  }
+
+  void SetDownloadConnections(int download_connections) {
+    download_connections_ = download_connections;
+  }
+
+  void SetDownloadPrefetchPayloads(int download_prefetch_payloads) {
+    download_prefetch_payloads_ = download_prefetch_payloads;
+  }
+
+  void SetHashPartitionsWhileWriting(bool hash_while_writing) {
+    hash_while_writing_ = hash_while_writing;
+  }
+
+  void SetVerifierReadSize(size_t verifier_read_size) {
+    verifier_read_size_ = verifier_read_size;
+  }
+
+  void SetFileFetcherReadSize(size_t file_fetcher_read_size) {
+    file_fetcher_read_size_ = file_fetcher_read_size;
+  }
+
+  void SetMaxApplyMemorySize(uint64_t max_apply_memory_size) {
+    max_apply_memory_size_ = max_apply_memory_size;
+  }
+
+  void SetSkipUnchangedPartitionWrites(bool skip_unchanged_writes) {
+    skip_unchanged_writes_ = skip_unchanged_writes;
+  }
+
+  void SetApplyOperationsInDestinationOrder(bool destination_order) {
+    destination_order_ = destination_order;
+  }
+
+  void SetStagePayloadsWhenDeferred(bool stage_deferred) {
+    stage_deferred_ = stage_deferred;
+  }
+
   // Getters to verify state.
   int GetMaxKernelKeyRollforward() const { return kernel_max_rollforward_; }
 
@@ -216,6 +311,19 @@ class FakeHardware : public HardwareInterface {
   bool is_rollback_powerwash_{false};
   int64_t build_timestamp_{0};
   bool first_active_omaha_ping_sent_{false};
+  base::FilePath non_volatile_directory_;
+  int max_apply_threads_{1};
+  size_t download_staging_buffer_size_{0};
+  bool use_direct_io_{false};
+  int download_connections_{1};
+  int download_prefetch_payloads_{0};
+  bool hash_while_writing_{false};
+  size_t verifier_read_size_{0};
+  size_t file_fetcher_read_size_{0};
+  uint64_t max_apply_memory_size_{0};
+  bool skip_unchanged_writes_{false};
+  bool destination_order_{false};
+  bool stage_deferred_{false};
 
   DISALLOW_COPY_AND_ASSIGN(FakeHardware);
 };
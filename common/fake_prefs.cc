@@ -105,6 +105,18 @@ bool FakePrefs::Delete(const string& key) {
   return true;
 }
 
+bool FakePrefs::StartTransaction() {
+  EXPECT_FALSE(in_transaction_) << "Nested transactions aren't supported.";
+  in_transaction_ = true;
+  return true;
+}
+
+bool FakePrefs::CommitTransaction() {
+  EXPECT_TRUE(in_transaction_) << "No transaction was started.";
+  in_transaction_ = false;
+  return true;
+}
+
 string FakePrefs::GetTypeName(PrefType type) {
   switch (type) {
     case PrefType::kString:
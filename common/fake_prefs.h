@@ -49,6 +49,9 @@ class FakePrefs : public PrefsInterface {
   bool Exists(const std::string& key) const override;
   bool Delete(const std::string& key) override;
 
+  bool StartTransaction() override;
+  bool CommitTransaction() override;
+
   void AddObserver(const std::string& key,
                    ObserverInterface* observer) override;
   void RemoveObserver(const std::string& key,
@@ -105,6 +108,9 @@ class FakePrefs : public PrefsInterface {
   // The registered observers watching for changes.
   std::map<std::string, std::vector<ObserverInterface*>> observers_;
 
+  // Whether a transaction was started and not committed yet.
+  bool in_transaction_ = false;
+
   DISALLOW_COPY_AND_ASSIGN(FakePrefs);
 };
 
@@ -16,6 +16,12 @@
 
 #include "update_engine/common/file_fetcher.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <unistd.h>
+
 #include <algorithm>
 #include <string>
 
@@ -23,18 +29,27 @@
 #include <base/format_macros.h>
 #include <base/location.h>
 #include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
 #include <brillo/streams/file_stream.h>
 
 #include "update_engine/common/hardware_interface.h"
 #include "update_engine/common/platform_constants.h"
+#include "update_engine/common/utils.h"
 
+using brillo::MessageLoop;
 using std::string;
 
 namespace {
 
-size_t kReadBufferSize = 16 * 1024;
+// The default size of the data read from the file and passed to the delegate
+// at once.
+const size_t kDefaultReadSize = 1024 * 1024;
+
+// The size of the part of a file mapped at a time, which bounds the address
+// space used by the fetcher regardless of the size of the file.
+const size_t kMapWindowSize = 32 * 1024 * 1024;
 
 }  // namespace
 
@@ -68,6 +83,14 @@ void FileFetcher::BeginTransfer(const string& url) {
   }
 
   string file_path = url.substr(strlen("file://"));
+  if (OpenMappedFile(file_path)) {
+    http_response_code_ = kHttpResponseOk;
+    bytes_copied_ = 0;
+    transfer_in_progress_ = true;
+    ScheduleRead();
+    return;
+  }
+
   stream_ =
       brillo::FileStream::Open(base::FilePath(file_path),
                                brillo::Stream::AccessMode::READ,
@@ -103,7 +126,16 @@ void FileFetcher::ScheduleRead() {
   if (transfer_paused_ || ongoing_read_ || !transfer_in_progress_)
     return;
 
-  buffer_.resize(kReadBufferSize);
+  if (map_fd_.is_valid()) {
+    if (send_task_id_ == MessageLoop::kTaskIdNull) {
+      send_task_id_ = MessageLoop::current()->PostTask(
+          FROM_HERE,
+          base::Bind(&FileFetcher::SendMappedData, base::Unretained(this)));
+    }
+    return;
+  }
+
+  buffer_.resize(read_size_ ? read_size_ : kDefaultReadSize);
   size_t bytes_to_read = buffer_.size();
   if (data_length_ >= 0) {
     bytes_to_read = std::min(static_cast<uint64_t>(bytes_to_read),
@@ -152,6 +184,104 @@ void FileFetcher::OnReadErrorCallback(const brillo::Error* error) {
     delegate_->TransferComplete(this, false);
 }
 
+bool FileFetcher::OpenMappedFile(const string& file_path) {
+  base::ScopedFD fd(
+      HANDLE_EINTR(open(file_path.c_str(), O_RDONLY | O_CLOEXEC)));
+  if (!fd.is_valid())
+    return false;
+  // Pipes and character devices can't be mapped, and their size is unknown.
+  struct stat stbuf;
+  if (fstat(fd.get(), &stbuf) != 0 ||
+      !(S_ISREG(stbuf.st_mode) || S_ISBLK(stbuf.st_mode))) {
+    return false;
+  }
+  off_t file_size = utils::FileSize(fd.get());
+  if (file_size < 0)
+    return false;
+  // The payload is read once from start to end.
+  int err = posix_fadvise(fd.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+  if (err != 0)
+    LOG(WARNING) << "posix_fadvise() failed: " << strerror(err);
+
+  map_fd_ = std::move(fd);
+  map_end_ = file_size;
+  if (data_length_ >= 0)
+    map_end_ = std::min(map_end_, offset_ + data_length_);
+  // Fall back to the stream if even the first window can't be mapped.
+  if (offset_ < map_end_ && !MapWindow(offset_)) {
+    map_fd_.reset();
+    return false;
+  }
+  return true;
+}
+
+bool FileFetcher::MapWindow(uint64_t position) {
+  UnmapWindow();
+  // The mapping must start at a page boundary.
+  uint64_t start = position & ~static_cast<uint64_t>(getpagesize() - 1);
+  size_t length = std::min(static_cast<uint64_t>(kMapWindowSize),
+                           map_end_ - start);
+  void* addr =
+      mmap(nullptr, length, PROT_READ, MAP_SHARED, map_fd_.get(), start);
+  if (addr == MAP_FAILED) {
+    PLOG(ERROR) << "Unable to map " << length << " bytes at offset " << start;
+    return false;
+  }
+  // Start reading the whole window from the storage right away, and the next
+  // one too, so the storage keeps reading ahead of the delegate when it moves
+  // to the next window.
+  if (madvise(addr, length, MADV_WILLNEED) != 0)
+    PLOG(WARNING) << "Unable to prefetch the mapped file";
+  if (start + length < map_end_) {
+    int err = posix_fadvise(map_fd_.get(),
+                            start + length,
+                            std::min(static_cast<uint64_t>(kMapWindowSize),
+                                     map_end_ - start - length),
+                            POSIX_FADV_WILLNEED);
+    if (err != 0)
+      LOG(WARNING) << "Unable to prefetch the mapped file: " << strerror(err);
+  }
+  map_addr_ = addr;
+  map_start_ = start;
+  map_length_ = length;
+  return true;
+}
+
+void FileFetcher::UnmapWindow() {
+  if (map_addr_)
+    munmap(map_addr_, map_length_);
+  map_addr_ = nullptr;
+  map_start_ = 0;
+  map_length_ = 0;
+}
+
+void FileFetcher::SendMappedData() {
+  send_task_id_ = MessageLoop::kTaskIdNull;
+  uint64_t position = offset_ + bytes_copied_;
+  if (position >= map_end_) {
+    CleanUp();
+    if (delegate_)
+      delegate_->TransferComplete(this, true);
+    return;
+  }
+  if (position >= map_start_ + map_length_ && !MapWindow(position)) {
+    CleanUp();
+    if (delegate_)
+      delegate_->TransferComplete(this, false);
+    return;
+  }
+
+  size_t size = std::min(
+      static_cast<uint64_t>(read_size_ ? read_size_ : kDefaultReadSize),
+      map_start_ + map_length_ - position);
+  const uint8_t* data =
+      static_cast<const uint8_t*>(map_addr_) + (position - map_start_);
+  bytes_copied_ += size;
+  if (delegate_ && !delegate_->ReceivedBytes(this, data, size))
+    return;
+  ScheduleRead();
+}
+
 void FileFetcher::Pause() {
   if (transfer_paused_) {
     LOG(ERROR) << "Fetcher already paused.";
@@ -180,6 +310,14 @@ void FileFetcher::CleanUp() {
   ongoing_read_ = false;
   buffer_ = brillo::Blob();
 
+  if (send_task_id_ != MessageLoop::kTaskIdNull) {
+    MessageLoop::current()->CancelTask(send_task_id_);
+    send_task_id_ = MessageLoop::kTaskIdNull;
+  }
+  UnmapWindow();
+  map_fd_.reset();
+  map_end_ = 0;
+
   transfer_in_progress_ = false;
   transfer_paused_ = false;
 }
@@ -21,6 +21,7 @@
 #include <string>
 #include <utility>
 
+#include <base/files/scoped_file.h>
 #include <base/logging.h>
 #include <base/macros.h>
 #include <brillo/message_loops/message_loop.h>
@@ -29,7 +30,9 @@
 #include "update_engine/common/http_fetcher.h"
 
 // This is a concrete implementation of HttpFetcher that reads files
-// asynchronously.
+// asynchronously. Regular files and block devices are mapped in memory and
+// passed to the delegate straight from the mapping, in large chunks; other
+// files are read through a stream.
 
 namespace chromeos_update_engine {
 
@@ -65,6 +68,10 @@ class FileFetcher : public HttpFetcher {
   // Resume the suspended file read.
   void Unpause() override;
 
+  // Sets the size in bytes of the data read from the file and passed to the
+  // delegate at once. A value of 0 uses the default.
+  void set_read_size(size_t read_size) { read_size_ = read_size; }
+
   size_t GetBytesDownloaded() override {
     return static_cast<size_t>(bytes_copied_);
   }
@@ -87,6 +94,21 @@ class FileFetcher : public HttpFetcher {
   void OnReadDoneCallback(size_t bytes_read);
   void OnReadErrorCallback(const brillo::Error* error);
 
+  // Opens |file_path| and maps the start of the requested data, if the file
+  // can be mapped. Returns whether the data will be read from the mapping.
+  bool OpenMappedFile(const std::string& file_path);
+
+  // Maps the window of the file containing |position|, unmapping the
+  // previous one.
+  bool MapWindow(uint64_t position);
+
+  // Unmaps the current window, if any.
+  void UnmapWindow();
+
+  // Called from the main loop to pass the next chunk of the mapped file to
+  // the delegate.
+  void SendMappedData();
+
   // Whether the transfer was started and didn't finish yet.
   bool transfer_in_progress_{false};
 
@@ -106,8 +128,24 @@ class FileFetcher : public HttpFetcher {
   // The length of the data or -1 if unknown (will read until EOF).
   int64_t data_length_{-1};
 
+  // The size of each read, or 0 to use the default.
+  size_t read_size_{0};
+
   brillo::StreamPtr stream_;
 
+  // The file read through a mapping, if valid, and the offset in the file
+  // where the requested data ends.
+  base::ScopedFD map_fd_;
+  uint64_t map_end_{0};
+
+  // The mapped window of |map_fd_|, starting at the offset |map_start_|.
+  void* map_addr_{nullptr};
+  uint64_t map_start_{0};
+  size_t map_length_{0};
+
+  // The task sending the next chunk of the mapped file.
+  brillo::MessageLoop::TaskId send_task_id_{brillo::MessageLoop::kTaskIdNull};
+
   // The buffer used for reading from the stream.
   brillo::Blob buffer_;
 
@@ -18,13 +18,46 @@
 
 #include <string>
 
+#include <brillo/message_loops/fake_message_loop.h>
 #include <gtest/gtest.h>
 
 #include "update_engine/common/test_utils.h"
 
+using std::string;
+
 namespace chromeos_update_engine {
 
-class FileFetcherUnitTest : public ::testing::Test {};
+namespace {
+
+class FileFetcherTestDelegate : public HttpFetcherDelegate {
+ public:
+  bool ReceivedBytes(HttpFetcher* fetcher,
+                     const void* bytes,
+                     size_t length) override {
+    data_.append(static_cast<const char*>(bytes), length);
+    return true;
+  }
+
+  void TransferComplete(HttpFetcher* fetcher, bool successful) override {
+    completed_ = true;
+    successful_ = successful;
+  }
+
+  string data_;
+  bool completed_{false};
+  bool successful_{false};
+};
+
+}  // namespace
+
+class FileFetcherUnitTest : public ::testing::Test {
+ protected:
+  void SetUp() override { loop_.SetAsCurrent(); }
+
+  void TearDown() override { EXPECT_FALSE(loop_.PendingTasks()); }
+
+  brillo::FakeMessageLoop loop_{nullptr};
+};
 
 TEST_F(FileFetcherUnitTest, SupporterUrlsTest) {
   EXPECT_TRUE(FileFetcher::SupportedUrl("file:///path/to/somewhere.bin"));
@@ -34,4 +67,46 @@ TEST_F(FileFetcherUnitTest, SupporterUrlsTest) {
   EXPECT_FALSE(FileFetcher::SupportedUrl("http:///no_http_here"));
 }
 
+TEST_F(FileFetcherUnitTest, ReadsTheRequestedRangeOfAMappedFileTest) {
+  test_utils::ScopedTempFile file("ue_file_fetcher.XXXXXX");
+  string contents;
+  for (int i = 0; contents.size() < 3 * 4096; i++)
+    contents += std::to_string(i) + ",";
+  ASSERT_TRUE(test_utils::WriteFileString(file.path(), contents));
+
+  FileFetcherTestDelegate delegate;
+  FileFetcher fetcher;
+  fetcher.set_delegate(&delegate);
+  // The offset isn't aligned to the pages of the mapping, and the data is
+  // passed in several reads.
+  fetcher.set_read_size(1000);
+  fetcher.SetOffset(4097);
+  fetcher.SetLength(5000);
+  fetcher.BeginTransfer("file://" + file.path());
+  while (loop_.RunOnce(false)) {
+  }
+
+  EXPECT_TRUE(delegate.completed_);
+  EXPECT_TRUE(delegate.successful_);
+  EXPECT_EQ(contents.substr(4097, 5000), delegate.data_);
+  EXPECT_EQ(5000U, fetcher.GetBytesDownloaded());
+}
+
+TEST_F(FileFetcherUnitTest, ReadsUntilTheEndOfTheFileTest) {
+  test_utils::ScopedTempFile file("ue_file_fetcher.XXXXXX");
+  ASSERT_TRUE(test_utils::WriteFileString(file.path(), "some contents"));
+
+  FileFetcherTestDelegate delegate;
+  FileFetcher fetcher;
+  fetcher.set_delegate(&delegate);
+  fetcher.SetOffset(5);
+  fetcher.BeginTransfer("file://" + file.path());
+  while (loop_.RunOnce(false)) {
+  }
+
+  EXPECT_TRUE(delegate.completed_);
+  EXPECT_TRUE(delegate.successful_);
+  EXPECT_EQ("contents", delegate.data_);
+}
+
 }  // namespace chromeos_update_engine
@@ -130,6 +130,65 @@ class HardwareInterface {
   // Persist the fact that first active ping was sent to omaha and returns false
   // if failed to persist it.
   virtual bool SetFirstActiveOmahaPingSent() = 0;
+
+  // Returns the maximum number of threads that may be used to apply
+  // independent payload operations concurrently. A value of 1 applies all the
+  // operations serially, and 0 leaves the choice to the update engine, which
+  // then applies full payloads using all the CPUs and delta payloads serially.
+  virtual int GetMaxApplyThreads() const = 0;
+
+  // Returns the size in bytes of the buffer used to stage the downloaded
+  // payload data while the operations are being applied, so the download
+  // doesn't stall on slow operations. A value of 0 disables the staging.
+  virtual size_t GetDownloadStagingBufferSize() const = 0;
+
+  // Returns whether the partitions should be written with O_DIRECT and
+  // asynchronous I/O, bypassing the page cache.
+  virtual bool UseDirectIoForPartitionWrites() const = 0;
+
+  // Returns the number of HTTP connections used to download different ranges
+  // of the payload in parallel. A value of 1 or less downloads the payload
+  // over a single connection.
+  virtual int GetDownloadConnections() const = 0;
+
+  // Returns the number of payloads following the current one that are
+  // prefetched in parallel while the current one is downloaded and applied.
+  // A value of 0 downloads the payloads one after another.
+  virtual int GetDownloadPrefetchPayloads() const = 0;
+
+  // Returns whether the target partitions are hashed while they are written,
+  // so the FilesystemVerifierAction doesn't need to read them back. This
+  // trusts the storage to return the data that was written.
+  virtual bool HashPartitionsWhileWriting() const = 0;
+
+  // Returns the size in bytes of each read of the FilesystemVerifierAction,
+  // or 0 to use its default.
+  virtual size_t GetVerifierReadSize() const = 0;
+
+  // Returns the size in bytes of each read of a local payload file, or 0 to
+  // use the default of the FileFetcher.
+  virtual size_t GetFileFetcherReadSize() const = 0;
+
+  // Returns the maximum memory in bytes used to apply the operations of a
+  // payload, or 0 to use the default of the DeltaPerformer. The operations
+  // which would need more are applied streaming from the partitions.
+  virtual uint64_t GetMaxApplyMemorySize() const = 0;
+
+  // Returns whether the writes to the target partitions skip the blocks that
+  // already hold the data being written. This reads the target partitions
+  // before writing them, to save the flash from rewriting the blocks that
+  // didn't change since the version of the inactive slot.
+  virtual bool SkipUnchangedPartitionWrites() const = 0;
+
+  // Returns whether the independent operations of a delta payload whose data
+  // was received are applied in the order of their target blocks rather than
+  // in the payload order, so the partitions are written more sequentially.
+  virtual bool ApplyOperationsInDestinationOrder() const = 0;
+
+  // Returns whether the payloads of an update deferred by the policy are
+  // downloaded to a cache in the non-volatile directory, so the update is
+  // applied from it once the policy allows it.
+  virtual bool StagePayloadsWhenDeferred() const = 0;
 };
 
 }  // namespace chromeos_update_engine
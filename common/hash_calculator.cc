@@ -18,15 +18,27 @@
 
 #include <fcntl.h>
 
+#include <algorithm>
+
 #include <base/logging.h>
 #include <base/posix/eintr_wrapper.h>
 
+#include "update_engine/common/trace.h"
 #include "update_engine/common/utils.h"
 
 using std::string;
+using std::vector;
 
 namespace chromeos_update_engine {
 
+namespace {
+// The size of the chunks of data passed to each calculator in UpdateAll(). It
+// is a multiple of the SHA-256 block size that fits in the L1 data cache.
+const size_t kUpdateAllChunkSize = 8 * 1024;  // 8 KiB
+}  // namespace
+
+const size_t HashCalculator::kContextSize = sizeof(SHA256_CTX);
+
 HashCalculator::HashCalculator() : valid_(false) {
   valid_ = (SHA256_Init(&ctx_) == 1);
   LOG_IF(ERROR, !valid_) << "SHA256_Init failed";
@@ -35,6 +47,7 @@ HashCalculator::HashCalculator() : valid_(false) {
 // Update is called with all of the data that should be hashed in order.
 // Mostly just passes the data through to OpenSSL's SHA256_Update()
 bool HashCalculator::Update(const void* data, size_t length) {
+  UE_TRACE_SCOPE("HashCalculator::Update");
   TEST_AND_RETURN_FALSE(valid_);
   TEST_AND_RETURN_FALSE(raw_hash_.empty());
   static_assert(sizeof(size_t) <= sizeof(unsigned long),  // NOLINT(runtime/int)
@@ -43,6 +56,18 @@ bool HashCalculator::Update(const void* data, size_t length) {
   return true;
 }
 
+bool HashCalculator::UpdateAll(const vector<HashCalculator*>& calculators,
+                               const void* data,
+                               size_t length) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (size_t offset = 0; offset < length; offset += kUpdateAllChunkSize) {
+    size_t chunk_size = std::min(kUpdateAllChunkSize, length - offset);
+    for (HashCalculator* calculator : calculators)
+      TEST_AND_RETURN_FALSE(calculator->Update(bytes + offset, chunk_size));
+  }
+  return true;
+}
+
 off_t HashCalculator::UpdateFile(const string& name, off_t length) {
   int fd = HANDLE_EINTR(open(name.c_str(), O_RDONLY));
   if (fd < 0) {
@@ -114,9 +139,17 @@ string HashCalculator::GetContext() const {
   return string(reinterpret_cast<const char*>(&ctx_), sizeof(ctx_));
 }
 
+void HashCalculator::AppendContext(string* context) const {
+  context->append(reinterpret_cast<const char*>(&ctx_), sizeof(ctx_));
+}
+
 bool HashCalculator::SetContext(const string& context) {
-  TEST_AND_RETURN_FALSE(context.size() == sizeof(ctx_));
-  memcpy(&ctx_, context.data(), sizeof(ctx_));
+  return SetContext(context.data(), context.size());
+}
+
+bool HashCalculator::SetContext(const void* context, size_t size) {
+  TEST_AND_RETURN_FALSE(size == sizeof(ctx_));
+  memcpy(&ctx_, context, sizeof(ctx_));
   return true;
 }
 
@@ -28,7 +28,9 @@
 #include <brillo/secure_blob.h>
 
 // This class provides a simple wrapper around OpenSSL providing a hash of data
-// passed in.
+// passed in. OpenSSL selects the SHA-256 implementation for the CPU at runtime,
+// using the SHA extensions on x86 and the ARMv8 crypto extensions when they
+// are available, so large Update() calls hash at the hardware speed.
 // The methods of this class must be called in a very specific order: First the
 // ctor (of course), then 0 or more calls to Update(), then Finalize(), then 0
 // or more calls to raw_hash().
@@ -44,6 +46,13 @@ class HashCalculator {
   // Returns true on success.
   bool Update(const void* data, size_t length);
 
+  // Updates all the |calculators| with the same |length| bytes of |data|. The
+  // data is fed to them in chunks small enough to stay in the CPU cache, so
+  // it is only read once from memory. Returns true on success.
+  static bool UpdateAll(const std::vector<HashCalculator*>& calculators,
+                        const void* data,
+                        size_t length);
+
   // Updates the hash with up to |length| bytes of data from |file|. If |length|
   // is negative, reads in and updates with the whole file. Returns the number
   // of bytes that the hash was updated with, or -1 on error.
@@ -63,11 +72,23 @@ class HashCalculator {
   // data (including \0 characters).
   std::string GetContext() const;
 
+  // Appends the current hash context, which is kContextSize bytes long, to
+  // |context|. This avoids the copy of GetContext() when the context is stored
+  // along with other data.
+  void AppendContext(std::string* context) const;
+
   // Sets the current hash context. |context| must the string returned by a
   // previous HashCalculator::GetContext method call. Returns true on success,
   // and false otherwise.
   bool SetContext(const std::string& context);
 
+  // Sets the current hash context from the |size| bytes at |context|, which
+  // were appended by a previous AppendContext() call.
+  bool SetContext(const void* context, size_t size);
+
+  // The size of the hash contexts.
+  static const size_t kContextSize;
+
   static bool RawHashOfBytes(const void* data,
                              size_t length,
                              brillo::Blob* out_hash);
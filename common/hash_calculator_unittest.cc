@@ -77,6 +77,46 @@ TEST_F(HashCalculatorTest, ContextTest) {
   EXPECT_EQ(raw_hash, calc_next.raw_hash());
 }
 
+TEST_F(HashCalculatorTest, AppendContextTest) {
+  HashCalculator calc;
+  calc.Update("h", 1);
+  string contexts = "header";
+  calc.AppendContext(&contexts);
+  calc.AppendContext(&contexts);
+  EXPECT_EQ(6 + 2 * HashCalculator::kContextSize, contexts.size());
+
+  HashCalculator calc_next;
+  EXPECT_FALSE(calc_next.SetContext(contexts.data(), contexts.size()));
+  EXPECT_TRUE(calc_next.SetContext(contexts.data() + 6 +
+                                       HashCalculator::kContextSize,
+                                   HashCalculator::kContextSize));
+  calc_next.Update("i", 1);
+  calc_next.Finalize();
+  brillo::Blob raw_hash(std::begin(kExpectedRawHash),
+                        std::end(kExpectedRawHash));
+  EXPECT_EQ(raw_hash, calc_next.raw_hash());
+}
+
+TEST_F(HashCalculatorTest, UpdateAllTest) {
+  // Data larger than a chunk, fed to calculators with different contexts.
+  brillo::Blob data(100000);
+  test_utils::FillWithData(&data);
+  HashCalculator calc_1, calc_2, expected_1, expected_2;
+  calc_2.Update("hi", 2);
+  expected_2.Update("hi", 2);
+  EXPECT_TRUE(HashCalculator::UpdateAll(
+      {&calc_1, &calc_2}, data.data(), data.size()));
+  EXPECT_TRUE(calc_1.Finalize());
+  EXPECT_TRUE(calc_2.Finalize());
+
+  EXPECT_TRUE(expected_1.Update(data.data(), data.size()));
+  EXPECT_TRUE(expected_2.Update(data.data(), data.size()));
+  EXPECT_TRUE(expected_1.Finalize());
+  EXPECT_TRUE(expected_2.Finalize());
+  EXPECT_EQ(expected_1.raw_hash(), calc_1.raw_hash());
+  EXPECT_EQ(expected_2.raw_hash(), calc_2.raw_hash());
+}
+
 TEST_F(HashCalculatorTest, BigTest) {
   HashCalculator calc;
 
@@ -48,6 +48,7 @@ const char* GetHttpResponseDescription(HttpResponseCode code) {
       {kHttpResponseForbidden, "Forbidden"},
       {kHttpResponseNotFound, "Not Found"},
       {kHttpResponseRequestTimeout, "Request Timeout"},
+      {kHttpResponseUnsupportedMediaType, "Unsupported Media Type"},
       {kHttpResponseInternalServerError, "Internal Server Error"},
       {kHttpResponseNotImplemented, "Not Implemented"},
       {kHttpResponseServiceUnavailable, "Service Unavailable"},
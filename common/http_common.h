@@ -44,6 +44,7 @@ enum HttpResponseCode {
   kHttpResponseForbidden = 403,
   kHttpResponseNotFound = 404,
   kHttpResponseRequestTimeout = 408,
+  kHttpResponseUnsupportedMediaType = 415,
   kHttpResponseReqRangeNotSat = 416,
   kHttpResponseInternalServerError = 500,
   kHttpResponseNotImplemented = 501,
@@ -17,6 +17,7 @@
 #include "update_engine/common/http_fetcher.h"
 
 #include <base/bind.h>
+#include <base/strings/string_util.h>
 
 using base::Closure;
 using brillo::MessageLoop;
@@ -43,6 +44,11 @@ void HttpFetcher::SetPostData(const void* data, size_t size) {
   SetPostData(data, size, kHttpContentTypeUnspecified);
 }
 
+string HttpFetcher::GetResponseHeader(const string& header_name) const {
+  const auto it = response_headers_.find(base::ToLowerASCII(header_name));
+  return it == response_headers_.end() ? string() : it->second;
+}
+
 // Proxy methods to set the proxies, then to pop them off.
 void HttpFetcher::ResolveProxiesForUrl(const string& url,
                                        const Closure& callback) {
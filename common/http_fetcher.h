@@ -18,6 +18,7 @@
 #define UPDATE_ENGINE_COMMON_HTTP_FETCHER_H_
 
 #include <deque>
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
@@ -66,6 +67,17 @@ class HttpFetcher {
   // Same without a specified Content-Type.
   void SetPostData(const void* data, size_t size);
 
+  // Lets the server compress the response with any of the encodings supported
+  // by the fetcher. The delegate still receives the decompressed data.
+  void set_accept_compressed_response(bool accept_compressed_response) {
+    accept_compressed_response_ = accept_compressed_response;
+  }
+
+  // Returns the value of the header |header_name| of the last response, or
+  // the empty string if the server didn't send it. The header names are case
+  // insensitive.
+  std::string GetResponseHeader(const std::string& header_name) const;
+
   // Proxy methods to set the proxies, then to pop them off.
   void ResolveProxiesForUrl(const std::string& url,
                             const base::Closure& callback);
@@ -145,6 +157,12 @@ class HttpFetcher {
   brillo::Blob post_data_;
   HttpContentType post_content_type_;
 
+  // Whether the server may compress the response.
+  bool accept_compressed_response_{false};
+
+  // The headers of the last response, keyed by their lower case name.
+  std::map<std::string, std::string> response_headers_;
+
   // The server's HTTP response code from the last transfer. This
   // field should be set to 0 when a new transfer is initiated, and
   // set to the response code when the transfer is complete.
@@ -70,6 +70,9 @@ const int kMediumLength = 1000;
 const int kFlakyTruncateLength = 29000;
 const int kFlakySleepEvery = 3;
 const int kFlakySleepSecs = 10;
+const int kShapedBytesPerSec = 1000000;
+const int kShapedLatencyMs = 20;
+const int kShapedJitterMs = 10;
 
 }  // namespace
 
@@ -201,6 +204,10 @@ class AnyHttpFetcherTest {
     return NewSmallFetcher(&proxy_resolver_);
   }
 
+  // Returns a fetcher that the fetcher returned by NewLargeFetcher() can use
+  // to download ranges in parallel, if it is a MultiRangeHttpFetcher.
+  virtual HttpFetcher* NewParallelFetcher() { return nullptr; }
+
   virtual string BigUrl(in_port_t port) const { return kUnusedUrl; }
   virtual string SmallUrl(in_port_t port) const { return kUnusedUrl; }
   virtual string ErrorUrl(in_port_t port) const { return kUnusedUrl; }
@@ -310,6 +317,10 @@ class MultiRangeHttpFetcherTest : public LibcurlHttpFetcherTest {
     return NewLargeFetcher(proxy_resolver);
   }
 
+  HttpFetcher* NewParallelFetcher() override {
+    return LibcurlHttpFetcherTest::NewLargeFetcher(&proxy_resolver_);
+  }
+
   bool IsMulti() const override { return true; }
 };
 
@@ -384,6 +395,8 @@ class MultiRangeHttpFetcherOverFileFetcherTest : public FileFetcherTest {
     return NewLargeFetcher(proxy_resolver);
   }
 
+  HttpFetcher* NewParallelFetcher() override { return new FileFetcher(); }
+
   bool IsMulti() const override { return true; }
 };
 
@@ -803,6 +816,36 @@ TYPED_TEST(HttpFetcherTest, FlakyTest) {
   }
 }
 
+TYPED_TEST(HttpFetcherTest, ShapedTest) {
+  if (this->test_.IsMock() || !this->test_.IsHttpSupported())
+    return;
+  FlakyHttpFetcherTestDelegate delegate;
+  unique_ptr<HttpFetcher> fetcher(this->test_.NewSmallFetcher());
+  fetcher->set_delegate(&delegate);
+
+  unique_ptr<HttpServer> server(this->test_.CreateServer());
+  ASSERT_TRUE(server->started_);
+
+  // The connection is dropped every kFlakyTruncateLength bytes, so the
+  // transfer is resumed a few times.
+  string path = base::StringPrintf("/shaped/%d/%d/%d/%d/%d",
+                                   kBigLength,
+                                   kShapedBytesPerSec,
+                                   kShapedLatencyMs,
+                                   kShapedJitterMs,
+                                   kFlakyTruncateLength);
+  this->loop_.PostTask(
+      FROM_HERE,
+      base::Bind(&StartTransfer,
+                 fetcher.get(),
+                 LocalServerUrlForPath(server->GetPort(), path)));
+  this->loop_.Run();
+
+  ASSERT_EQ(kBigLength, static_cast<int>(delegate.data.size()));
+  for (int i = 0; i < kBigLength; i += 10)
+    ASSERT_EQ(delegate.data.substr(i, 10), "abcdefghij");
+}
+
 namespace {
 // This delegate kills the server attached to it after receiving any bytes.
 // This can be used for testing what happens when you try to fetch data and
@@ -1259,6 +1302,90 @@ TYPED_TEST(HttpFetcherTest, MultiHttpFetcherInsufficientTest) {
   }
 }
 
+TYPED_TEST(HttpFetcherTest, MultiHttpFetcherParallelTest) {
+  if (!this->test_.IsMulti())
+    return;
+
+  unique_ptr<HttpServer> server(this->test_.CreateServer());
+  ASSERT_TRUE(server->started_);
+
+  // The chunks are smaller than the ranges, so each range is downloaded over
+  // several fetchers and some chunks are received ahead of the others.
+  MultiRangeHttpFetcher* multi_fetcher =
+      static_cast<MultiRangeHttpFetcher*>(this->test_.NewLargeFetcher());
+  multi_fetcher->AddParallelFetcher(this->test_.NewParallelFetcher());
+  multi_fetcher->AddParallelFetcher(this->test_.NewParallelFetcher());
+  multi_fetcher->set_parallel_chunk_size(7);
+
+  vector<pair<off_t, off_t>> ranges;
+  ranges.push_back(make_pair(0, 25));
+  ranges.push_back(make_pair(99, 17));
+  MultiTest(multi_fetcher,
+            this->test_.fake_hardware(),
+            this->test_.BigUrl(server->GetPort()),
+            ranges,
+            "abcdefghijabcdefghijabcdejabcdefghijabcdef",
+            25 + 17,
+            this->test_.IsFileFetcher() ? kHttpResponseOk
+                                        : kHttpResponsePartialContent);
+}
+
+TYPED_TEST(HttpFetcherTest, MultiHttpFetcherParallelInsufficientTest) {
+  if (!this->test_.IsMulti())
+    return;
+
+  unique_ptr<HttpServer> server(this->test_.CreateServer());
+  ASSERT_TRUE(server->started_);
+
+  // The last chunk of the first range is cut short, so the delegate only
+  // receives the data before it, even when the later chunks are complete.
+  MultiRangeHttpFetcher* multi_fetcher =
+      static_cast<MultiRangeHttpFetcher*>(this->test_.NewLargeFetcher());
+  multi_fetcher->AddParallelFetcher(this->test_.NewParallelFetcher());
+  multi_fetcher->set_parallel_chunk_size(4);
+
+  vector<pair<off_t, off_t>> ranges;
+  ranges.push_back(make_pair(kBigLength - 6, 8));
+  ranges.push_back(make_pair(0, 10));
+  MultiTest(multi_fetcher,
+            this->test_.fake_hardware(),
+            this->test_.BigUrl(server->GetPort()),
+            ranges,
+            "efghij",
+            6,
+            kHttpResponseUndefined);
+}
+
+TYPED_TEST(HttpFetcherTest, MultiHttpFetcherParallelFallbackTest) {
+  if (!this->test_.IsMulti())
+    return;
+
+  unique_ptr<HttpServer> server(this->test_.CreateServer());
+  ASSERT_TRUE(server->started_);
+
+  // The parallel fetcher downloads from a URL failing all the requests, so
+  // its chunks are downloaded from the fallback URL instead.
+  MultiRangeHttpFetcher* multi_fetcher =
+      static_cast<MultiRangeHttpFetcher*>(this->test_.NewLargeFetcher());
+  multi_fetcher->AddParallelFetcher(this->test_.NewParallelFetcher());
+  multi_fetcher->set_parallel_chunk_size(7);
+  string url = this->test_.BigUrl(server->GetPort());
+  multi_fetcher->SetParallelUrls({this->test_.ErrorUrl(server->GetPort())},
+                                 url);
+
+  vector<pair<off_t, off_t>> ranges;
+  ranges.push_back(make_pair(0, 25));
+  ranges.push_back(make_pair(99, 17));
+  MultiTest(multi_fetcher,
+            this->test_.fake_hardware(),
+            url,
+            ranges,
+            "abcdefghijabcdefghijabcdejabcdefghijabcdef",
+            25 + 17,
+            this->test_.IsFileFetcher() ? kHttpResponseOk
+                                        : kHttpResponsePartialContent);
+}
+
 // Issue #18143: when a fetch of a secondary chunk out of a chain, then it
 // should retry with other proxies listed before giving up.
 //
@@ -0,0 +1,150 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/common/io_stats.h"
+
+#include <vector>
+
+#include <base/files/file_enumerator.h>
+#include <base/files/file_path.h>
+#include <base/files/file_util.h>
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/string_split.h>
+#include <base/strings/string_util.h>
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+const char kProcSelfIoPath[] = "/proc/self/io";
+const char kSysBlockDir[] = "/sys/block";
+
+// The fields of /sys/block/<device>/stat used, and the size of the sectors
+// it counts.
+const size_t kStatReadOps = 0;
+const size_t kStatReadSectors = 2;
+const size_t kStatWriteOps = 4;
+const size_t kStatWriteSectors = 6;
+const size_t kStatTimeInQueue = 10;
+const uint64_t kStatSectorSize = 512;
+
+}  // namespace
+
+IoStats operator-(const IoStats& a, const IoStats& b) {
+  IoStats diff;
+  diff.bytes_read = a.bytes_read - b.bytes_read;
+  diff.bytes_written = a.bytes_written - b.bytes_written;
+  diff.read_ops = a.read_ops - b.read_ops;
+  diff.write_ops = a.write_ops - b.write_ops;
+  diff.queue_time_ms = a.queue_time_ms - b.queue_time_ms;
+  return diff;
+}
+
+bool ReadProcessIoStats(const string& path, IoStats* stats) {
+  string contents;
+  if (!base::ReadFileToString(base::FilePath(path), &contents))
+    return false;
+  base::StringPairs pairs;
+  base::SplitStringIntoKeyValuePairs(contents, ':', '\n', &pairs);
+  *stats = IoStats();
+  for (const auto& pair : pairs) {
+    uint64_t value;
+    if (!base::StringToUint64(
+            base::TrimWhitespaceASCII(pair.second, base::TRIM_ALL), &value)) {
+      continue;
+    }
+    if (pair.first == "read_bytes")
+      stats->bytes_read = value;
+    else if (pair.first == "write_bytes")
+      stats->bytes_written = value;
+    else if (pair.first == "syscr")
+      stats->read_ops = value;
+    else if (pair.first == "syscw")
+      stats->write_ops = value;
+  }
+  return true;
+}
+
+bool ReadStorageIoStats(const string& sys_block_dir, IoStats* stats) {
+  *stats = IoStats();
+  bool found = false;
+  base::FileEnumerator devices(base::FilePath(sys_block_dir),
+                               false,
+                               base::FileEnumerator::DIRECTORIES |
+                                   base::FileEnumerator::SHOW_SYM_LINKS);
+  for (base::FilePath device = devices.Next(); !device.empty();
+       device = devices.Next()) {
+    // The virtual devices have no "device" entry.
+    if (!base::PathExists(device.Append("device")))
+      continue;
+    string contents;
+    if (!base::ReadFileToString(device.Append("stat"), &contents))
+      continue;
+    vector<base::StringPiece> fields = base::SplitStringPiece(
+        contents, " \t\n", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY);
+    if (fields.size() <= kStatTimeInQueue)
+      continue;
+    uint64_t values[kStatTimeInQueue + 1];
+    bool valid = true;
+    for (size_t i = 0; i <= kStatTimeInQueue && valid; i++)
+      valid = base::StringToUint64(fields[i], &values[i]);
+    if (!valid) {
+      LOG(WARNING) << "Invalid block device stats in " << device.value();
+      continue;
+    }
+    stats->read_ops += values[kStatReadOps];
+    stats->bytes_read += values[kStatReadSectors] * kStatSectorSize;
+    stats->write_ops += values[kStatWriteOps];
+    stats->bytes_written += values[kStatWriteSectors] * kStatSectorSize;
+    stats->queue_time_ms += values[kStatTimeInQueue];
+    found = true;
+  }
+  return found;
+}
+
+PhaseIoStatsRecorder::PhaseIoStatsRecorder()
+    : PhaseIoStatsRecorder(kProcSelfIoPath, kSysBlockDir) {}
+
+PhaseIoStatsRecorder::PhaseIoStatsRecorder(const string& proc_io_path,
+                                           const string& sys_block_dir)
+    : proc_io_path_(proc_io_path), sys_block_dir_(sys_block_dir) {
+  StartPhase();
+}
+
+void PhaseIoStatsRecorder::StartPhase() {
+  start_time_ = base::TimeTicks::Now();
+  process_known_ = ReadProcessIoStats(proc_io_path_, &start_process_);
+  storage_known_ = ReadStorageIoStats(sys_block_dir_, &start_storage_);
+}
+
+PhaseIoStats PhaseIoStatsRecorder::GetPhaseStats() const {
+  PhaseIoStats stats;
+  stats.duration = base::TimeTicks::Now() - start_time_;
+  // The counters that can't be read are left at zero.
+  IoStats current;
+  if (process_known_ && ReadProcessIoStats(proc_io_path_, &current))
+    stats.process = current - start_process_;
+  if (storage_known_ && ReadStorageIoStats(sys_block_dir_, &current))
+    stats.storage = current - start_storage_;
+  return stats;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,89 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_COMMON_IO_STATS_H_
+#define UPDATE_ENGINE_COMMON_IO_STATS_H_
+
+#include <string>
+
+#include <base/macros.h>
+#include <base/time/time.h>
+
+namespace chromeos_update_engine {
+
+// The I/O done over some time, by this process or by the storage.
+struct IoStats {
+  uint64_t bytes_read{0};
+  uint64_t bytes_written{0};
+  uint64_t read_ops{0};
+  uint64_t write_ops{0};
+  // The time the requests spent queued or in flight, summed over all of them.
+  // Only known for the storage.
+  uint64_t queue_time_ms{0};
+};
+
+IoStats operator-(const IoStats& a, const IoStats& b);
+
+// Reads the I/O done so far by the process from |path|, in the format of
+// /proc/self/io. The bytes are the ones that reached the storage, and the
+// operations are the read and write system calls.
+bool ReadProcessIoStats(const std::string& path, IoStats* stats);
+
+// Reads the I/O done so far by the block devices in |sys_block_dir|, in the
+// format of /sys/block. Only the devices backed by hardware are counted, so
+// the I/O of a device mapper or loop device isn't counted twice.
+bool ReadStorageIoStats(const std::string& sys_block_dir, IoStats* stats);
+
+// The I/O done during a phase of an update.
+struct PhaseIoStats {
+  base::TimeDelta duration;
+  IoStats process;
+  IoStats storage;
+};
+
+// Measures the I/O done by the process and by the storage since the start of
+// the current phase.
+class PhaseIoStatsRecorder {
+ public:
+  PhaseIoStatsRecorder();
+  PhaseIoStatsRecorder(const std::string& proc_io_path,
+                       const std::string& sys_block_dir);
+
+  // Starts measuring a new phase.
+  void StartPhase();
+
+  // Returns the I/O done since the last StartPhase() call.
+  PhaseIoStats GetPhaseStats() const;
+
+ private:
+  const std::string proc_io_path_;
+  const std::string sys_block_dir_;
+
+  // The time and I/O counters at the start of the phase, and whether the
+  // counters could be read.
+  base::TimeTicks start_time_;
+  IoStats start_process_;
+  IoStats start_storage_;
+  bool process_known_{false};
+  bool storage_known_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(PhaseIoStatsRecorder);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_COMMON_IO_STATS_H_
@@ -0,0 +1,117 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/common/io_stats.h"
+
+#include <string>
+
+#include <base/files/file_util.h>
+#include <base/files/scoped_temp_dir.h>
+#include <gtest/gtest.h>
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+class IoStatsTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+    proc_io_path_ = temp_dir_.GetPath().Append("io");
+    sys_block_dir_ = temp_dir_.GetPath().Append("block");
+    ASSERT_TRUE(base::CreateDirectory(sys_block_dir_));
+  }
+
+  void WriteFile(const base::FilePath& path, const string& contents) {
+    ASSERT_EQ(static_cast<int>(contents.size()),
+              base::WriteFile(path, contents.data(), contents.size()));
+  }
+
+  // Adds a block device with the given stats. Only the hardware devices have
+  // a "device" entry.
+  void AddBlockDevice(const string& name, bool hardware, const string& stat) {
+    base::FilePath device = sys_block_dir_.Append(name);
+    ASSERT_TRUE(base::CreateDirectory(device));
+    if (hardware)
+      ASSERT_TRUE(base::CreateDirectory(device.Append("device")));
+    WriteFile(device.Append("stat"), stat);
+  }
+
+  base::ScopedTempDir temp_dir_;
+  base::FilePath proc_io_path_;
+  base::FilePath sys_block_dir_;
+};
+
+TEST_F(IoStatsTest, ReadProcessIoStatsTest) {
+  WriteFile(proc_io_path_,
+            "rchar: 1000\n"
+            "wchar: 2000\n"
+            "syscr: 30\n"
+            "syscw: 40\n"
+            "read_bytes: 4096\n"
+            "write_bytes: 8192\n"
+            "cancelled_write_bytes: 0\n");
+  IoStats stats;
+  EXPECT_TRUE(ReadProcessIoStats(proc_io_path_.value(), &stats));
+  EXPECT_EQ(4096U, stats.bytes_read);
+  EXPECT_EQ(8192U, stats.bytes_written);
+  EXPECT_EQ(30U, stats.read_ops);
+  EXPECT_EQ(40U, stats.write_ops);
+  EXPECT_EQ(0U, stats.queue_time_ms);
+
+  EXPECT_FALSE(ReadProcessIoStats("/non/existent/path", &stats));
+}
+
+TEST_F(IoStatsTest, ReadStorageIoStatsTest) {
+  AddBlockDevice("sda", true, "10 0 8 0 20 0 16 0 0 0 100 0 0 0 0\n");
+  AddBlockDevice("mmcblk0", true, "1 0 2 0 3 0 4 0 0 0 5\n");
+  // The I/O of the virtual devices is already counted by the hardware ones.
+  AddBlockDevice("dm-0", false, "10 0 8 0 20 0 16 0 0 0 100\n");
+  AddBlockDevice("sdb", true, "invalid\n");
+
+  IoStats stats;
+  EXPECT_TRUE(ReadStorageIoStats(sys_block_dir_.value(), &stats));
+  EXPECT_EQ(11U, stats.read_ops);
+  EXPECT_EQ(10U * 512, stats.bytes_read);
+  EXPECT_EQ(23U, stats.write_ops);
+  EXPECT_EQ(20U * 512, stats.bytes_written);
+  EXPECT_EQ(105U, stats.queue_time_ms);
+}
+
+TEST_F(IoStatsTest, PhaseIoStatsRecorderTest) {
+  WriteFile(proc_io_path_, "read_bytes: 100\nwrite_bytes: 200\n");
+  AddBlockDevice("sda", true, "1 0 2 0 3 0 4 0 0 0 5\n");
+  PhaseIoStatsRecorder recorder(proc_io_path_.value(), sys_block_dir_.value());
+
+  WriteFile(proc_io_path_, "read_bytes: 150\nwrite_bytes: 1200\n");
+  AddBlockDevice("sda", true, "2 0 4 0 5 0 8 0 0 0 15\n");
+  PhaseIoStats stats = recorder.GetPhaseStats();
+  EXPECT_EQ(50U, stats.process.bytes_read);
+  EXPECT_EQ(1000U, stats.process.bytes_written);
+  EXPECT_EQ(1U, stats.storage.read_ops);
+  EXPECT_EQ(2U * 512, stats.storage.bytes_read);
+  EXPECT_EQ(2U, stats.storage.write_ops);
+  EXPECT_EQ(10U, stats.storage.queue_time_ms);
+
+  // A new phase starts from the current counters.
+  recorder.StartPhase();
+  stats = recorder.GetPhaseStats();
+  EXPECT_EQ(0U, stats.process.bytes_written);
+  EXPECT_EQ(0U, stats.storage.write_ops);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,244 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/common/memory_stats.h"
+
+#include <inttypes.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <utility>
+
+#include <base/bind.h>
+#include <base/files/file_path.h>
+#include <base/files/file_util.h>
+#include <base/json/json_writer.h>
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/string_split.h>
+#include <base/strings/string_util.h>
+#include <base/strings/stringprintf.h>
+#include <base/values.h>
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+const char kProcSelfDir[] = "/proc/self";
+
+// Reads the fields of |file| in |proc_dir| given in kB, in the format of
+// /proc/self/status. Returns false if the file can't be read.
+bool ReadKilobyteFields(const string& proc_dir,
+                        const char* file,
+                        const std::map<string, uint64_t*>& fields) {
+  string contents;
+  if (!base::ReadFileToString(base::FilePath(proc_dir).Append(file),
+                              &contents)) {
+    return false;
+  }
+  base::StringPairs pairs;
+  base::SplitStringIntoKeyValuePairs(contents, ':', '\n', &pairs);
+  for (const auto& pair : pairs) {
+    auto it = fields.find(pair.first);
+    if (it == fields.end())
+      continue;
+    base::StringPiece value =
+        base::TrimWhitespaceASCII(pair.second, base::TRIM_ALL);
+    uint64_t kilobytes;
+    if (!base::EndsWith(value, " kB", base::CompareCase::SENSITIVE) ||
+        !base::StringToUint64(value.substr(0, value.size() - 3), &kilobytes)) {
+      continue;
+    }
+    *it->second = kilobytes * 1024;
+  }
+  return true;
+}
+
+}  // namespace
+
+const char* MemoryCategoryName(MemoryCategory category) {
+  switch (category) {
+    case MemoryCategory::kManifest:
+      return "manifest";
+    case MemoryCategory::kDownloadBuffer:
+      return "download_buffer";
+    case MemoryCategory::kDiffScratch:
+      return "diff_scratch";
+    case MemoryCategory::kCache:
+      return "cache";
+    case MemoryCategory::kVerity:
+      return "verity";
+  }
+  return "unknown";
+}
+
+MemoryAccounting* MemoryAccounting::Get() {
+  static MemoryAccounting* accounting = new MemoryAccounting();
+  return accounting;
+}
+
+void MemoryAccounting::Add(MemoryCategory category, uint64_t bytes) {
+  size_t index = static_cast<size_t>(category);
+  uint64_t current = current_[index].fetch_add(bytes) + bytes;
+  uint64_t peak = peak_[index].load();
+  while (current > peak && !peak_[index].compare_exchange_weak(peak, current)) {
+  }
+}
+
+void MemoryAccounting::Remove(MemoryCategory category, uint64_t bytes) {
+  current_[static_cast<size_t>(category)].fetch_sub(bytes);
+}
+
+uint64_t MemoryAccounting::GetCurrent(MemoryCategory category) const {
+  return current_[static_cast<size_t>(category)].load();
+}
+
+uint64_t MemoryAccounting::GetPeak(MemoryCategory category) const {
+  return peak_[static_cast<size_t>(category)].load();
+}
+
+void MemoryAccounting::ResetPeaks() {
+  for (size_t i = 0; i < kNumMemoryCategories; i++)
+    peak_[i] = current_[i].load();
+}
+
+ScopedMemoryTracker::ScopedMemoryTracker(MemoryCategory category,
+                                         uint64_t bytes)
+    : category_(category), bytes_(bytes) {
+  MemoryAccounting::Get()->Add(category_, bytes_);
+}
+
+ScopedMemoryTracker::~ScopedMemoryTracker() {
+  MemoryAccounting::Get()->Remove(category_, bytes_);
+}
+
+void ScopedMemoryTracker::Resize(uint64_t bytes) {
+  if (bytes > bytes_)
+    MemoryAccounting::Get()->Add(category_, bytes - bytes_);
+  else
+    MemoryAccounting::Get()->Remove(category_, bytes_ - bytes);
+  bytes_ = bytes;
+}
+
+bool ReadProcessMemoryStats(const string& proc_dir,
+                            ProcessMemoryStats* stats) {
+  *stats = ProcessMemoryStats();
+  if (!ReadKilobyteFields(proc_dir,
+                          "status",
+                          {{"VmRSS", &stats->rss_bytes},
+                           {"VmHWM", &stats->peak_rss_bytes}})) {
+    return false;
+  }
+  // smaps_rollup is only in the recent kernels.
+  ReadKilobyteFields(proc_dir, "smaps_rollup", {{"Pss", &stats->pss_bytes}});
+  return true;
+}
+
+MemorySampler::MemorySampler() : MemorySampler(kProcSelfDir) {}
+
+MemorySampler::MemorySampler(const string& proc_dir) : proc_dir_(proc_dir) {}
+
+MemorySampler::~MemorySampler() {
+  Stop();
+}
+
+void MemorySampler::Start(base::TimeDelta interval) {
+  if (started_)
+    return;
+  started_ = true;
+  interval_ = interval;
+  peak_pss_bytes_ = 0;
+  MemoryAccounting::Get()->ResetPeaks();
+  SampleCallback();
+}
+
+void MemorySampler::Stop() {
+  if (sample_task_ != brillo::MessageLoop::kTaskIdNull) {
+    brillo::MessageLoop::current()->CancelTask(sample_task_);
+    sample_task_ = brillo::MessageLoop::kTaskIdNull;
+  }
+  started_ = false;
+}
+
+void MemorySampler::Sample() {
+  if (!ReadProcessMemoryStats(proc_dir_, &last_sample_))
+    return;
+  peak_pss_bytes_ = std::max(peak_pss_bytes_, last_sample_.pss_bytes);
+}
+
+void MemorySampler::SampleCallback() {
+  Sample();
+  sample_task_ = brillo::MessageLoop::kTaskIdNull;
+  // Without a message loop, the memory is only sampled on demand.
+  if (!brillo::MessageLoop::current())
+    return;
+  sample_task_ = brillo::MessageLoop::current()->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&MemorySampler::SampleCallback, base::Unretained(this)),
+      interval_);
+}
+
+string MemorySampler::ToJson() const {
+  // The sizes are doubles, since base::Value has no 64 bits integers.
+  auto categories = std::make_unique<base::ListValue>();
+  MemoryAccounting* accounting = MemoryAccounting::Get();
+  for (size_t i = 0; i < kNumMemoryCategories; i++) {
+    MemoryCategory category = static_cast<MemoryCategory>(i);
+    auto value = std::make_unique<base::DictionaryValue>();
+    value->SetString("name", MemoryCategoryName(category));
+    value->SetDouble("bytes", accounting->GetCurrent(category));
+    value->SetDouble("peak_bytes", accounting->GetPeak(category));
+    categories->Append(std::move(value));
+  }
+
+  base::DictionaryValue value;
+  value.SetDouble("rss_bytes", last_sample_.rss_bytes);
+  value.SetDouble("peak_rss_bytes", last_sample_.peak_rss_bytes);
+  value.SetDouble("pss_bytes", last_sample_.pss_bytes);
+  value.SetDouble("peak_pss_bytes", peak_pss_bytes_);
+  value.Set("categories", std::move(categories));
+
+  string json_str;
+  base::JSONWriter::WriteWithOptions(
+      value, base::JSONWriter::OPTIONS_PRETTY_PRINT, &json_str);
+  return json_str;
+}
+
+string MemorySampler::ToString() const {
+  const uint64_t kMiB = 1024 * 1024;
+  string str = base::StringPrintf(
+      "RSS %" PRIu64 " MiB (peak %" PRIu64 " MiB), PSS %" PRIu64
+      " MiB (peak %" PRIu64 " MiB)",
+      last_sample_.rss_bytes / kMiB,
+      last_sample_.peak_rss_bytes / kMiB,
+      last_sample_.pss_bytes / kMiB,
+      peak_pss_bytes_ / kMiB);
+  MemoryAccounting* accounting = MemoryAccounting::Get();
+  for (size_t i = 0; i < kNumMemoryCategories; i++) {
+    MemoryCategory category = static_cast<MemoryCategory>(i);
+    str += base::StringPrintf(", %s %" PRIu64 " KiB (peak %" PRIu64 " KiB)",
+                              MemoryCategoryName(category),
+                              accounting->GetCurrent(category) / 1024,
+                              accounting->GetPeak(category) / 1024);
+  }
+  return str;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,149 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_COMMON_MEMORY_STATS_H_
+#define UPDATE_ENGINE_COMMON_MEMORY_STATS_H_
+
+#include <atomic>
+#include <string>
+
+#include <base/macros.h>
+#include <base/time/time.h>
+#include <brillo/message_loops/message_loop.h>
+
+namespace chromeos_update_engine {
+
+// The categories of the memory accounted for during an update.
+enum class MemoryCategory {
+  kManifest,
+  kDownloadBuffer,
+  kDiffScratch,
+  kCache,
+  kVerity,
+};
+
+const size_t kNumMemoryCategories = 5;
+
+const char* MemoryCategoryName(MemoryCategory category);
+
+// MemoryAccounting keeps the memory of each category currently used by the
+// update, and its peak, from all the threads. It doesn't hook the allocator:
+// the big allocations are tagged where they are made, with a
+// ScopedMemoryTracker.
+class MemoryAccounting {
+ public:
+  // Returns the accounting of this process.
+  static MemoryAccounting* Get();
+
+  void Add(MemoryCategory category, uint64_t bytes);
+  void Remove(MemoryCategory category, uint64_t bytes);
+
+  uint64_t GetCurrent(MemoryCategory category) const;
+  uint64_t GetPeak(MemoryCategory category) const;
+
+  // Sets the peak of every category to its current memory.
+  void ResetPeaks();
+
+ private:
+  MemoryAccounting() = default;
+
+  std::atomic<uint64_t> current_[kNumMemoryCategories]{};
+  std::atomic<uint64_t> peak_[kNumMemoryCategories]{};
+
+  DISALLOW_COPY_AND_ASSIGN(MemoryAccounting);
+};
+
+// Accounts for |bytes| of memory of a category during its lifetime. The size
+// follows the tagged buffer through Resize(). A tracker isn't thread safe, the
+// accounting is.
+class ScopedMemoryTracker {
+ public:
+  explicit ScopedMemoryTracker(MemoryCategory category, uint64_t bytes = 0);
+  ~ScopedMemoryTracker();
+
+  void Resize(uint64_t bytes);
+
+  uint64_t size() const { return bytes_; }
+
+ private:
+  const MemoryCategory category_;
+  uint64_t bytes_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedMemoryTracker);
+};
+
+// The memory used by the process. The PSS is 0 if the kernel doesn't report
+// it.
+struct ProcessMemoryStats {
+  uint64_t rss_bytes{0};
+  uint64_t peak_rss_bytes{0};
+  uint64_t pss_bytes{0};
+};
+
+// Reads the memory used by the process of |proc_dir|, in the format of
+// /proc/self: the RSS and its peak from its status, and the PSS from its
+// smaps_rollup.
+bool ReadProcessMemoryStats(const std::string& proc_dir,
+                            ProcessMemoryStats* stats);
+
+// MemorySampler samples the memory used by the process periodically while it
+// is started, and reports the peaks along with the accounted memory.
+class MemorySampler {
+ public:
+  MemorySampler();
+  explicit MemorySampler(const std::string& proc_dir);
+  ~MemorySampler();
+
+  // Samples the memory every |interval| from the message loop, until Stop()
+  // is called. The peaks of the samples and of the accounting start over.
+  // Does nothing if already started.
+  void Start(base::TimeDelta interval);
+  void Stop();
+
+  bool started() const { return started_; }
+
+  // Samples the memory now.
+  void Sample();
+
+  const ProcessMemoryStats& last_sample() const { return last_sample_; }
+  uint64_t peak_pss_bytes() const { return peak_pss_bytes_; }
+
+  // Returns the last sample, the peaks and the accounted memory as JSON.
+  std::string ToJson() const;
+
+  // Returns a summary of the last sample and of the accounted memory for the
+  // logs.
+  std::string ToString() const;
+
+ private:
+  void SampleCallback();
+
+  const std::string proc_dir_;
+
+  bool started_{false};
+  base::TimeDelta interval_;
+  brillo::MessageLoop::TaskId sample_task_{brillo::MessageLoop::kTaskIdNull};
+
+  ProcessMemoryStats last_sample_;
+  uint64_t peak_pss_bytes_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(MemorySampler);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_COMMON_MEMORY_STATS_H_
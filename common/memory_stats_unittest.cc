@@ -0,0 +1,111 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/common/memory_stats.h"
+
+#include <memory>
+#include <string>
+
+#include <base/files/file_util.h>
+#include <base/files/scoped_temp_dir.h>
+#include <base/json/json_reader.h>
+#include <base/values.h>
+#include <gtest/gtest.h>
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+class MemoryStatsTest : public ::testing::Test {
+ protected:
+  void SetUp() override { ASSERT_TRUE(temp_dir_.CreateUniqueTempDir()); }
+
+  void WriteFile(const string& name, const string& contents) {
+    ASSERT_EQ(static_cast<int>(contents.size()),
+              base::WriteFile(temp_dir_.GetPath().Append(name),
+                              contents.data(),
+                              contents.size()));
+  }
+
+  base::ScopedTempDir temp_dir_;
+};
+
+TEST_F(MemoryStatsTest, ScopedMemoryTrackerTest) {
+  MemoryAccounting* accounting = MemoryAccounting::Get();
+  uint64_t initial = accounting->GetCurrent(MemoryCategory::kDiffScratch);
+  accounting->ResetPeaks();
+  {
+    ScopedMemoryTracker tracker(MemoryCategory::kDiffScratch, 100);
+    EXPECT_EQ(initial + 100,
+              accounting->GetCurrent(MemoryCategory::kDiffScratch));
+    tracker.Resize(300);
+    tracker.Resize(50);
+    EXPECT_EQ(initial + 50,
+              accounting->GetCurrent(MemoryCategory::kDiffScratch));
+  }
+  EXPECT_EQ(initial, accounting->GetCurrent(MemoryCategory::kDiffScratch));
+  EXPECT_EQ(initial + 300, accounting->GetPeak(MemoryCategory::kDiffScratch));
+
+  accounting->ResetPeaks();
+  EXPECT_EQ(initial, accounting->GetPeak(MemoryCategory::kDiffScratch));
+}
+
+TEST_F(MemoryStatsTest, ReadProcessMemoryStatsTest) {
+  WriteFile("status",
+            "Name:\tupdate_engine\n"
+            "VmHWM:\t    2048 kB\n"
+            "VmRSS:\t    1024 kB\n"
+            "Threads:\t4\n");
+  ProcessMemoryStats stats;
+  EXPECT_TRUE(ReadProcessMemoryStats(temp_dir_.GetPath().value(), &stats));
+  EXPECT_EQ(1024U * 1024, stats.rss_bytes);
+  EXPECT_EQ(2048U * 1024, stats.peak_rss_bytes);
+  // The PSS isn't known without smaps_rollup.
+  EXPECT_EQ(0U, stats.pss_bytes);
+
+  WriteFile("smaps_rollup",
+            "00400000-7fff0000 ---p 00000000 00:00 0  [rollup]\n"
+            "Rss:                1024 kB\n"
+            "Pss:                 512 kB\n");
+  EXPECT_TRUE(ReadProcessMemoryStats(temp_dir_.GetPath().value(), &stats));
+  EXPECT_EQ(512U * 1024, stats.pss_bytes);
+
+  EXPECT_FALSE(ReadProcessMemoryStats("/non/existent/path", &stats));
+}
+
+TEST_F(MemoryStatsTest, MemorySamplerTest) {
+  WriteFile("status", "VmRSS:\t1024 kB\n");
+  WriteFile("smaps_rollup", "Pss:\t512 kB\n");
+  MemorySampler sampler(temp_dir_.GetPath().value());
+  sampler.Sample();
+  WriteFile("smaps_rollup", "Pss:\t256 kB\n");
+  sampler.Sample();
+  EXPECT_EQ(256U * 1024, sampler.last_sample().pss_bytes);
+  EXPECT_EQ(512U * 1024, sampler.peak_pss_bytes());
+
+  std::unique_ptr<base::Value> json = base::JSONReader::Read(sampler.ToJson());
+  const base::DictionaryValue* dict = nullptr;
+  ASSERT_TRUE(json && json->GetAsDictionary(&dict));
+  double bytes;
+  EXPECT_TRUE(dict->GetDouble("peak_pss_bytes", &bytes));
+  EXPECT_DOUBLE_EQ(512.0 * 1024, bytes);
+  const base::ListValue* categories = nullptr;
+  ASSERT_TRUE(dict->GetList("categories", &categories));
+  EXPECT_EQ(kNumMemoryCategories, categories->GetSize());
+}
+
+}  // namespace chromeos_update_engine
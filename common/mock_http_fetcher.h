@@ -22,6 +22,7 @@
 #include <vector>
 
 #include <base/logging.h>
+#include <base/strings/string_util.h>
 #include <brillo/message_loops/message_loop.h>
 
 #include "update_engine/common/http_fetcher.h"
@@ -93,6 +94,12 @@ class MockHttpFetcher : public HttpFetcher {
   // set.
   std::string GetHeader(const std::string& header_name) const;
 
+  // Sets the header |header_name| of the response.
+  void SetResponseHeader(const std::string& header_name,
+                         const std::string& header_value) {
+    response_headers_[base::ToLowerASCII(header_name)] = header_value;
+  }
+
   // Suspend the mock transfer.
   void Pause() override;
 
@@ -28,6 +28,13 @@ namespace chromeos_update_engine {
 
 class MockPrefs : public PrefsInterface {
  public:
+  MockPrefs() {
+    // The transactions only group the other calls, so they succeed unless the
+    // test expects otherwise.
+    ON_CALL(*this, StartTransaction()).WillByDefault(testing::Return(true));
+    ON_CALL(*this, CommitTransaction()).WillByDefault(testing::Return(true));
+  }
+
   MOCK_CONST_METHOD2(GetString,
                      bool(const std::string& key, std::string* value));
   MOCK_METHOD2(SetString,
@@ -41,6 +48,9 @@ class MockPrefs : public PrefsInterface {
   MOCK_CONST_METHOD1(Exists, bool(const std::string& key));
   MOCK_METHOD1(Delete, bool(const std::string& key));
 
+  MOCK_METHOD0(StartTransaction, bool());
+  MOCK_METHOD0(CommitTransaction, bool());
+
   MOCK_METHOD2(AddObserver, void(const std::string& key, ObserverInterface*));
   MOCK_METHOD2(RemoveObserver,
                void(const std::string& key, ObserverInterface*));
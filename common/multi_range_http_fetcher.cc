@@ -30,6 +30,7 @@ namespace chromeos_update_engine {
 // (corner case: Stopped -> Stopped for an empty request)
 void MultiRangeHttpFetcher::BeginTransfer(const std::string& url) {
   CHECK(!base_fetcher_active_) << "BeginTransfer but already active.";
+  CHECK(!parallel_transfer_) << "BeginTransfer but already active.";
   CHECK(!pending_transfer_ended_) << "BeginTransfer but pending.";
   CHECK(!terminating_) << "BeginTransfer but terminating.";
 
@@ -40,6 +41,10 @@ void MultiRangeHttpFetcher::BeginTransfer(const std::string& url) {
     return;
   }
   url_ = url;
+  if (CanTransferInParallel()) {
+    BeginParallelTransfer();
+    return;
+  }
   current_index_ = 0;
   bytes_received_this_range_ = 0;
   LOG(INFO) << "starting first transfer";
@@ -49,6 +54,10 @@ void MultiRangeHttpFetcher::BeginTransfer(const std::string& url) {
 
 // State change: Downloading -> Pending transfer ended
 void MultiRangeHttpFetcher::TerminateTransfer() {
+  if (parallel_transfer_) {
+    TerminateParallelTransfer();
+    return;
+  }
   if (!base_fetcher_active_) {
     LOG(INFO) << "Called TerminateTransfer but not active.";
     // Note that after the callback returns this object may be destroyed.
@@ -89,6 +98,8 @@ void MultiRangeHttpFetcher::StartTransfer() {
 bool MultiRangeHttpFetcher::ReceivedBytes(HttpFetcher* fetcher,
                                           const void* bytes,
                                           size_t length) {
+  if (parallel_transfer_)
+    return ParallelReceivedBytes(fetcher, bytes, length);
   CHECK_LT(current_index_, ranges_.size());
   CHECK_EQ(fetcher, base_fetcher_.get());
   CHECK(!pending_transfer_ended_);
@@ -122,6 +133,10 @@ bool MultiRangeHttpFetcher::ReceivedBytes(HttpFetcher* fetcher,
 // State change: Downloading or Pending transfer ended -> Stopped
 void MultiRangeHttpFetcher::TransferEnded(HttpFetcher* fetcher,
                                           bool successful) {
+  if (parallel_transfer_) {
+    ParallelTransferEnded(fetcher);
+    return;
+  }
   CHECK(base_fetcher_active_) << "Transfer ended unexpectedly.";
   CHECK_EQ(fetcher, base_fetcher_.get());
   pending_transfer_ended_ = false;
@@ -182,6 +197,296 @@ void MultiRangeHttpFetcher::Reset() {
   base_fetcher_active_ = pending_transfer_ended_ = terminating_ = false;
   current_index_ = 0;
   bytes_received_this_range_ = 0;
+  parallel_transfer_ = parallel_failed_ = parallel_short_chunk_ = false;
+  chunks_.clear();
+  current_chunk_ = next_chunk_ = 0;
+  connections_.clear();
+  parallel_references_ = 0;
+}
+
+void MultiRangeHttpFetcher::AddParallelFetcher(HttpFetcher* fetcher) {
+  CHECK(!base_fetcher_active_) << "AddParallelFetcher but already active.";
+  CHECK(!parallel_transfer_) << "AddParallelFetcher but already active.";
+  for (const auto& header : headers_)
+    fetcher->SetHeader(header.first, header.second);
+  parallel_fetchers_.emplace_back(fetcher);
+}
+
+void MultiRangeHttpFetcher::SetHeader(const std::string& header_name,
+                                      const std::string& header_value) {
+  headers_[header_name] = header_value;
+  base_fetcher_->SetHeader(header_name, header_value);
+  for (auto& fetcher : parallel_fetchers_)
+    fetcher->SetHeader(header_name, header_value);
+}
+
+void MultiRangeHttpFetcher::Pause() {
+  base_fetcher_->Pause();
+  for (auto& fetcher : parallel_fetchers_)
+    fetcher->Pause();
+}
+
+void MultiRangeHttpFetcher::Unpause() {
+  base_fetcher_->Unpause();
+  for (auto& fetcher : parallel_fetchers_)
+    fetcher->Unpause();
+}
+
+void MultiRangeHttpFetcher::set_idle_seconds(int seconds) {
+  base_fetcher_->set_idle_seconds(seconds);
+  for (auto& fetcher : parallel_fetchers_)
+    fetcher->set_idle_seconds(seconds);
+}
+
+void MultiRangeHttpFetcher::set_retry_seconds(int seconds) {
+  base_fetcher_->set_retry_seconds(seconds);
+  for (auto& fetcher : parallel_fetchers_)
+    fetcher->set_retry_seconds(seconds);
+}
+
+void MultiRangeHttpFetcher::SetProxies(const std::deque<std::string>& proxies) {
+  base_fetcher_->SetProxies(proxies);
+  for (auto& fetcher : parallel_fetchers_)
+    fetcher->SetProxies(proxies);
+}
+
+size_t MultiRangeHttpFetcher::GetBytesDownloaded() {
+  size_t bytes_downloaded = base_fetcher_->GetBytesDownloaded();
+  for (auto& fetcher : parallel_fetchers_)
+    bytes_downloaded += fetcher->GetBytesDownloaded();
+  return bytes_downloaded;
+}
+
+void MultiRangeHttpFetcher::set_low_speed_limit(int low_speed_bps,
+                                                int low_speed_sec) {
+  base_fetcher_->set_low_speed_limit(low_speed_bps, low_speed_sec);
+  for (auto& fetcher : parallel_fetchers_)
+    fetcher->set_low_speed_limit(low_speed_bps, low_speed_sec);
+}
+
+void MultiRangeHttpFetcher::set_connect_timeout(int connect_timeout_seconds) {
+  base_fetcher_->set_connect_timeout(connect_timeout_seconds);
+  for (auto& fetcher : parallel_fetchers_)
+    fetcher->set_connect_timeout(connect_timeout_seconds);
+}
+
+void MultiRangeHttpFetcher::set_max_retry_count(int max_retry_count) {
+  base_fetcher_->set_max_retry_count(max_retry_count);
+  for (auto& fetcher : parallel_fetchers_)
+    fetcher->set_max_retry_count(max_retry_count);
+}
+
+bool MultiRangeHttpFetcher::CanTransferInParallel() const {
+  if (parallel_fetchers_.empty())
+    return false;
+  // The end of a range without a length is unknown, so it can't be split.
+  for (const Range& range : ranges_) {
+    if (!range.HasLength())
+      return false;
+  }
+  return true;
+}
+
+void MultiRangeHttpFetcher::BeginParallelTransfer() {
+  for (const Range& range : ranges_) {
+    for (size_t pos = 0; pos < range.length(); pos += parallel_chunk_size_) {
+      Chunk chunk;
+      chunk.offset = range.offset() + pos;
+      chunk.length = std::min(parallel_chunk_size_, range.length() - pos);
+      chunk.starts_range = pos == 0;
+      chunk.received = chunk.delivered = 0;
+      chunk.done = false;
+      chunks_.push_back(std::move(chunk));
+    }
+  }
+  std::vector<std::string> urls = {url_};
+  urls.insert(urls.end(), parallel_urls_.begin(), parallel_urls_.end());
+  connections_.push_back({base_fetcher_.get(), url_, 0, false, false});
+  for (auto& fetcher : parallel_fetchers_) {
+    const std::string& url = urls[connections_.size() % urls.size()];
+    connections_.push_back({fetcher.get(), url, 0, false, false});
+  }
+  for (Connection& connection : connections_)
+    connection.fetcher->set_delegate(this);
+  LOG(INFO) << "starting parallel transfer of " << chunks_.size()
+            << " chunks over " << connections_.size() << " connections";
+
+  parallel_transfer_ = true;
+  current_chunk_ = next_chunk_ = 0;
+  parallel_references_ = 1;
+  StartParallelChunks();
+  ReleaseParallelTransfer();
+}
+
+void MultiRangeHttpFetcher::TerminateParallelTransfer() {
+  parallel_references_++;
+  terminating_ = true;
+  TerminateConnections();
+  ReleaseParallelTransfer();
+}
+
+bool MultiRangeHttpFetcher::ParallelReceivedBytes(HttpFetcher* fetcher,
+                                                  const void* bytes,
+                                                  size_t length) {
+  auto connection = std::find_if(
+      connections_.begin(), connections_.end(), [fetcher](const Connection& c) {
+        return c.fetcher == fetcher;
+      });
+  CHECK(connection != connections_.end());
+  CHECK(connection->active);
+  if (connection->ending)
+    return false;
+
+  parallel_references_++;
+  Chunk* chunk = &chunks_[connection->chunk];
+  size_t next_size = std::min(length, chunk->length - chunk->received);
+  chunk->received += next_size;
+  bool keep_going = true;
+  if (!terminating_ && !parallel_failed_) {
+    if (connection->chunk == current_chunk_) {
+      keep_going = DeliverChunkBytes(chunk, bytes, next_size);
+    } else {
+      const uint8_t* data = static_cast<const uint8_t*>(bytes);
+      chunk->data.insert(chunk->data.end(), data, data + next_size);
+    }
+  }
+  if (keep_going && chunk->received >= chunk->length) {
+    // The next chunk is started when the fetcher is done, as in the serial
+    // case.
+    connection->ending = true;
+    fetcher->TerminateTransfer();
+    keep_going = false;
+  }
+  ReleaseParallelTransfer();
+  return keep_going;
+}
+
+void MultiRangeHttpFetcher::ParallelTransferEnded(HttpFetcher* fetcher) {
+  auto connection = std::find_if(
+      connections_.begin(), connections_.end(), [fetcher](const Connection& c) {
+        return c.fetcher == fetcher;
+      });
+  CHECK(connection != connections_.end());
+  CHECK(connection->active) << "Transfer ended unexpectedly.";
+  // The reference of the connection is kept until the end of this call.
+  connection->active = connection->ending = false;
+  http_response_code_ = fetcher->http_response_code();
+
+  Chunk* chunk = &chunks_[connection->chunk];
+  if (chunk->received < chunk->length && !terminating_ && !parallel_failed_ &&
+      !fallback_url_.empty() && connection->url != fallback_url_) {
+    // The bytes received so far are kept, only the rest of the chunk is
+    // downloaded again.
+    LOG(INFO) << "Didn't get enough bytes of chunk " << connection->chunk
+              << " from " << connection->url << " (code "
+              << http_response_code_ << "), falling back to " << fallback_url_;
+    connection->url = fallback_url_;
+    BeginChunkTransfer(&*connection);
+    ReleaseParallelTransfer();
+    return;
+  }
+  chunk->done = true;
+  if (chunk->received < chunk->length && !terminating_ && !parallel_failed_) {
+    // The bytes before the missing ones are still passed to the delegate, so
+    // the transfer fails once this becomes the current chunk.
+    LOG(INFO) << "Didn't get enough bytes of chunk " << connection->chunk
+              << " (code " << http_response_code_ << ").";
+    parallel_short_chunk_ = true;
+  }
+  if (!terminating_ && !parallel_failed_ && FlushCurrentChunk())
+    StartParallelChunks();
+  ReleaseParallelTransfer();
+}
+
+void MultiRangeHttpFetcher::StartParallelChunks() {
+  const size_t max_next_chunk =
+      current_chunk_ + kParallelChunksAheadPerFetcher * connections_.size();
+  for (Connection& connection : connections_) {
+    if (terminating_ || parallel_failed_ || parallel_short_chunk_ ||
+        next_chunk_ >= chunks_.size() || next_chunk_ >= max_next_chunk) {
+      return;
+    }
+    if (connection.active)
+      continue;
+    connection.chunk = next_chunk_++;
+    BeginChunkTransfer(&connection);
+  }
+}
+
+void MultiRangeHttpFetcher::BeginChunkTransfer(Connection* connection) {
+  connection->active = true;
+  parallel_references_++;
+  const Chunk& chunk = chunks_[connection->chunk];
+  connection->fetcher->SetOffset(chunk.offset + chunk.received);
+  connection->fetcher->SetLength(chunk.length - chunk.received);
+  connection->fetcher->BeginTransfer(connection->url);
+}
+
+bool MultiRangeHttpFetcher::FlushCurrentChunk() {
+  while (current_chunk_ < chunks_.size()) {
+    Chunk* chunk = &chunks_[current_chunk_];
+    if (!chunk->data.empty()) {
+      brillo::Blob data;
+      data.swap(chunk->data);
+      if (!DeliverChunkBytes(chunk, data.data(), data.size()))
+        return false;
+    }
+    if (!chunk->done)
+      break;
+    if (chunk->received < chunk->length) {
+      LOG(INFO) << "Ending w/ failure.";
+      parallel_failed_ = true;
+      TerminateConnections();
+      return false;
+    }
+    current_chunk_++;
+  }
+  return true;
+}
+
+bool MultiRangeHttpFetcher::DeliverChunkBytes(Chunk* chunk,
+                                              const void* bytes,
+                                              size_t length) {
+  if (!delegate_)
+    return true;
+  if (chunk->starts_range && chunk->delivered == 0)
+    delegate_->SeekToOffset(chunk->offset);
+  chunk->delivered += length;
+  if (delegate_->ReceivedBytes(this, bytes, length))
+    return true;
+  if (!terminating_ && !parallel_failed_) {
+    // The delegate is expected to terminate the transfer when it stops it.
+    parallel_failed_ = true;
+    TerminateConnections();
+  }
+  return false;
+}
+
+void MultiRangeHttpFetcher::TerminateConnections() {
+  for (Connection& connection : connections_) {
+    if (connection.active && !connection.ending) {
+      connection.ending = true;
+      connection.fetcher->TerminateTransfer();
+    }
+  }
+}
+
+void MultiRangeHttpFetcher::ReleaseParallelTransfer() {
+  CHECK_GT(parallel_references_, static_cast<size_t>(0));
+  if (--parallel_references_ > 0)
+    return;
+
+  bool terminated = terminating_;
+  bool successful = !parallel_failed_ && current_chunk_ == chunks_.size();
+  LOG(INFO) << "Done w/ parallel transfer, successful: " << successful;
+  Reset();
+  // Note that after the callback returns this object may be destroyed.
+  if (!delegate_)
+    return;
+  if (terminated)
+    delegate_->TransferTerminated(this);
+  else
+    delegate_->TransferComplete(this, successful);
 }
 
 std::string MultiRangeHttpFetcher::Range::ToString() const {
@@ -18,11 +18,14 @@
 #define UPDATE_ENGINE_COMMON_MULTI_RANGE_HTTP_FETCHER_H_
 
 #include <deque>
+#include <map>
 #include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <brillo/secure_blob.h>
+
 #include "update_engine/common/http_fetcher.h"
 
 // This class is a simple wrapper around an HttpFetcher. The client
@@ -32,6 +35,18 @@
 // as a length to specify unlimited length. It really only would make sense
 // for the last range specified to have unlimited length, tho it is legal for
 // other entries to have unlimited length.
+//
+// Additional fetchers can be added with AddParallelFetcher(). If all the
+// ranges have a length, they are then split in chunks which are downloaded
+// over all the fetchers at once, each one with its own connection. The data
+// of the chunks received ahead of the current one is buffered, so the
+// delegate still receives all the ranges in order. At most
+// kParallelChunksAheadPerFetcher chunks per fetcher are downloaded ahead of
+// the current one, which bounds the memory used by the buffered chunks.
+//
+// The parallel fetchers may download from other URLs serving the same data,
+// set with SetParallelUrls(), and fall back to another URL to download the
+// rest of a chunk when its transfer from one of those fails.
 
 // There are three states a MultiRangeHttpFetcher object will be in:
 // - Stopped (start state)
@@ -55,6 +70,33 @@ class MultiRangeHttpFetcher : public HttpFetcher, public HttpFetcherDelegate {
         bytes_received_this_range_(0) {}
   ~MultiRangeHttpFetcher() override {}
 
+  // The number of chunks each fetcher may download ahead of the chunk being
+  // passed to the delegate in a parallel transfer.
+  static const size_t kParallelChunksAheadPerFetcher = 2;
+
+  // Takes ownership of the passed in fetcher, which downloads chunks of the
+  // ranges in parallel with the base fetcher and the other parallel ones.
+  void AddParallelFetcher(HttpFetcher* fetcher);
+
+  // Returns whether parallel fetchers were added, so ranges with a length are
+  // downloaded over several connections at once.
+  bool has_parallel_fetchers() const { return !parallel_fetchers_.empty(); }
+
+  // Sets the other URLs the parallel transfers download from, assigned to
+  // the fetchers in turn after the URL passed to BeginTransfer(), and the URL
+  // to download the rest of a chunk from when its transfer from any other URL
+  // fails. An empty |fallback_url| disables the fallback.
+  void SetParallelUrls(const std::vector<std::string>& urls,
+                       const std::string& fallback_url) {
+    parallel_urls_ = urls;
+    fallback_url_ = fallback_url;
+  }
+
+  void set_parallel_chunk_size(size_t parallel_chunk_size) {
+    CHECK_GT(parallel_chunk_size, static_cast<size_t>(0));
+    parallel_chunk_size_ = parallel_chunk_size;
+  }
+
   void ClearRanges() { ranges_.clear(); }
 
   void AddRange(off_t offset, size_t size) {
@@ -78,43 +120,30 @@ class MultiRangeHttpFetcher : public HttpFetcher, public HttpFetcherDelegate {
   // State change: Downloading -> Pending transfer ended
   void TerminateTransfer() override;
 
+  // The following settings are applied to the base fetcher and all the
+  // parallel fetchers. The headers are also set on the parallel fetchers added
+  // later.
   void SetHeader(const std::string& header_name,
-                 const std::string& header_value) override {
-    base_fetcher_->SetHeader(header_name, header_value);
-  }
+                 const std::string& header_value) override;
 
-  void Pause() override { base_fetcher_->Pause(); }
+  void Pause() override;
 
-  void Unpause() override { base_fetcher_->Unpause(); }
+  void Unpause() override;
 
   // These functions are overloaded in LibcurlHttp fetcher for testing purposes.
-  void set_idle_seconds(int seconds) override {
-    base_fetcher_->set_idle_seconds(seconds);
-  }
-  void set_retry_seconds(int seconds) override {
-    base_fetcher_->set_retry_seconds(seconds);
-  }
+  void set_idle_seconds(int seconds) override;
+  void set_retry_seconds(int seconds) override;
   // TODO(deymo): Determine if this method should be virtual in HttpFetcher so
   // this call is sent to the base_fetcher_.
-  virtual void SetProxies(const std::deque<std::string>& proxies) {
-    base_fetcher_->SetProxies(proxies);
-  }
+  virtual void SetProxies(const std::deque<std::string>& proxies);
 
-  inline size_t GetBytesDownloaded() override {
-    return base_fetcher_->GetBytesDownloaded();
-  }
+  size_t GetBytesDownloaded() override;
 
-  void set_low_speed_limit(int low_speed_bps, int low_speed_sec) override {
-    base_fetcher_->set_low_speed_limit(low_speed_bps, low_speed_sec);
-  }
+  void set_low_speed_limit(int low_speed_bps, int low_speed_sec) override;
 
-  void set_connect_timeout(int connect_timeout_seconds) override {
-    base_fetcher_->set_connect_timeout(connect_timeout_seconds);
-  }
+  void set_connect_timeout(int connect_timeout_seconds) override;
 
-  void set_max_retry_count(int max_retry_count) override {
-    base_fetcher_->set_max_retry_count(max_retry_count);
-  }
+  void set_max_retry_count(int max_retry_count) override;
 
  private:
   // A range object defining the offset and length of a download chunk.  Zero
@@ -139,9 +168,76 @@ class MultiRangeHttpFetcher : public HttpFetcher, public HttpFetcherDelegate {
 
   typedef std::vector<Range> RangesVect;
 
+  // A part of a range downloaded by one of the fetchers in a parallel
+  // transfer.
+  struct Chunk {
+    off_t offset;
+    size_t length;
+    // Whether this is the first chunk of its range, so the delegate is told to
+    // seek to |offset| before receiving it.
+    bool starts_range;
+    // The number of bytes received and passed to the delegate so far.
+    size_t received;
+    size_t delivered;
+    // The bytes received but not passed to the delegate yet.
+    brillo::Blob data;
+    // Whether the transfer of the chunk ended, which failed if it ended before
+    // all the bytes were received.
+    bool done;
+  };
+
+  // A fetcher used in a parallel transfer, the URL it downloads from and the
+  // chunk it downloads.
+  struct Connection {
+    HttpFetcher* fetcher;
+    std::string url;
+    size_t chunk;
+    // Whether the fetcher is transferring |chunk|.
+    bool active;
+    // Whether TerminateTransfer() was called on the fetcher.
+    bool ending;
+  };
+
+  // Returns whether the ranges can be downloaded with the parallel fetchers.
+  bool CanTransferInParallel() const;
+
   // State change: Stopped or Downloading -> Downloading
   void StartTransfer();
 
+  // The parallel counterparts of BeginTransfer(), TerminateTransfer(),
+  // ReceivedBytes() and TransferEnded().
+  void BeginParallelTransfer();
+  void TerminateParallelTransfer();
+  bool ParallelReceivedBytes(HttpFetcher* fetcher,
+                             const void* bytes,
+                             size_t length);
+  void ParallelTransferEnded(HttpFetcher* fetcher);
+
+  // Starts the next chunks on the idle connections, within the limit of
+  // chunks downloaded ahead of the current one.
+  void StartParallelChunks();
+
+  // Starts the transfer of the bytes of the chunk of |connection| not
+  // received yet.
+  void BeginChunkTransfer(Connection* connection);
+
+  // Passes the buffered data of the current chunk to the delegate and moves
+  // to the next chunk for as long as the current one is done. Returns false
+  // if the delegate stopped the transfer.
+  bool FlushCurrentChunk();
+
+  // Passes |length| bytes of |chunk| to the delegate. Returns false if the
+  // delegate stopped the transfer.
+  bool DeliverChunkBytes(Chunk* chunk, const void* bytes, size_t length);
+
+  // Calls TerminateTransfer() on all the active connections.
+  void TerminateConnections();
+
+  // Each public entry point of a parallel transfer holds a reference, as
+  // does each active connection. Releasing the last one ends the transfer and
+  // notifies the delegate, after which this object may be destroyed.
+  void ReleaseParallelTransfer();
+
   // HttpFetcherDelegate overrides.
   // State change: Downloading -> Downloading or Pending transfer ended
   bool ReceivedBytes(HttpFetcher* fetcher,
@@ -157,6 +253,14 @@ class MultiRangeHttpFetcher : public HttpFetcher, public HttpFetcherDelegate {
   void Reset();
 
   std::unique_ptr<HttpFetcher> base_fetcher_;
+  std::vector<std::unique_ptr<HttpFetcher>> parallel_fetchers_;
+
+  // See SetParallelUrls().
+  std::vector<std::string> parallel_urls_;
+  std::string fallback_url_;
+
+  // The headers set with SetHeader(), for the parallel fetchers added later.
+  std::map<std::string, std::string> headers_;
 
   // If true, do not send any more data or TransferComplete to the delegate.
   bool base_fetcher_active_;
@@ -174,6 +278,21 @@ class MultiRangeHttpFetcher : public HttpFetcher, public HttpFetcherDelegate {
   RangesVect::size_type current_index_;  // index into ranges_
   size_t bytes_received_this_range_;
 
+  // The state of a parallel transfer.
+  size_t parallel_chunk_size_{4 * 1024 * 1024};
+  bool parallel_transfer_{false};
+  // Whether the transfer failed, and whether a chunk ended before all its
+  // bytes were received, in which case no more chunks are started.
+  bool parallel_failed_{false};
+  bool parallel_short_chunk_{false};
+  std::vector<Chunk> chunks_;
+  // The chunk passed to the delegate and the next one to download.
+  size_t current_chunk_{0};
+  size_t next_chunk_{0};
+  std::vector<Connection> connections_;
+  // See ReleaseParallelTransfer().
+  size_t parallel_references_{0};
+
   DISALLOW_COPY_AND_ASSIGN(MultiRangeHttpFetcher);
 };
 
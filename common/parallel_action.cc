@@ -0,0 +1,130 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/parallel_action.h"
+
+#include <utility>
+
+#include <base/logging.h>
+
+#include "update_engine/common/error_code_utils.h"
+
+using std::unique_ptr;
+
+namespace chromeos_update_engine {
+
+ParallelAction::~ParallelAction() {
+  // The branches still running are stopped without reporting it.
+  terminating_ = true;
+  branches_.clear();
+}
+
+void ParallelAction::AddAction(unique_ptr<AbstractAction> action) {
+  CHECK_EQ(running_branches_, 0U) << "AddAction() called while running.";
+  unique_ptr<ActionProcessor> branch(new ActionProcessor());
+  branch->set_delegate(this);
+  branch->EnqueueAction(std::move(action));
+  branches_.push_back(std::move(branch));
+}
+
+void ParallelAction::PerformAction() {
+  LOG(INFO) << "ParallelAction: running " << branches_.size()
+            << " actions in parallel.";
+  code_ = ErrorCode::kSuccess;
+  running_branches_ = branches_.size();
+  // Actions may complete synchronously, so the ParallelAction only completes
+  // once all of them were started.
+  starting_ = true;
+  for (const auto& branch : branches_) {
+    // A failed action may have stopped the branches not started yet.
+    if (code_ != ErrorCode::kSuccess) {
+      running_branches_--;
+      continue;
+    }
+    branch->StartProcessing();
+  }
+  starting_ = false;
+  MaybeComplete();
+}
+
+void ParallelAction::TerminateProcessing() {
+  terminating_ = true;
+  for (const auto& branch : branches_) {
+    if (branch->IsRunning())
+      branch->StopProcessing();
+  }
+  running_branches_ = 0;
+  terminating_ = false;
+}
+
+void ParallelAction::SuspendAction() {
+  for (const auto& branch : branches_) {
+    if (branch->IsRunning())
+      branch->SuspendProcessing();
+  }
+}
+
+void ParallelAction::ResumeAction() {
+  for (const auto& branch : branches_) {
+    if (branch->IsRunning())
+      branch->ResumeProcessing();
+  }
+}
+
+void ParallelAction::ProcessingDone(const ActionProcessor* processor,
+                                    ErrorCode code) {
+  BranchFinished(code);
+}
+
+void ParallelAction::ProcessingStopped(const ActionProcessor* processor) {
+  // Only this action stops its branches, either when terminated or when
+  // another action failed.
+  if (!terminating_)
+    BranchFinished(ErrorCode::kSuccess);
+}
+
+void ParallelAction::ActionCompleted(ActionProcessor* processor,
+                                     AbstractAction* action,
+                                     ErrorCode code) {
+  if (processor_ && processor_->delegate())
+    processor_->delegate()->ActionCompleted(processor_, action, code);
+}
+
+void ParallelAction::BranchFinished(ErrorCode code) {
+  CHECK_GT(running_branches_, 0U);
+  running_branches_--;
+  if (code != ErrorCode::kSuccess && code_ == ErrorCode::kSuccess) {
+    LOG(INFO) << "ParallelAction: stopping the other actions after a failure "
+              << "with code " << utils::ErrorCodeToString(code);
+    code_ = code;
+    stopping_ = true;
+    for (const auto& branch : branches_) {
+      if (branch->IsRunning())
+        branch->StopProcessing();
+    }
+    stopping_ = false;
+  }
+  MaybeComplete();
+}
+
+void ParallelAction::MaybeComplete() {
+  if (running_branches_ > 0 || starting_ || stopping_ || terminating_)
+    return;
+  // This may delete this object.
+  processor_->ActionComplete(this, code_);
+}
+
+}  // namespace chromeos_update_engine
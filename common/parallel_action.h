@@ -0,0 +1,98 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_COMMON_PARALLEL_ACTION_H_
+#define UPDATE_ENGINE_COMMON_PARALLEL_ACTION_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+
+#include "update_engine/common/action.h"
+#include "update_engine/common/action_processor.h"
+
+namespace chromeos_update_engine {
+
+// A ParallelAction runs independent actions at the same time and completes
+// once all of them completed. Each action runs in an ActionProcessor of its
+// own, so to the ActionProcessor running the ParallelAction the group is a
+// single step between the actions before and after it.
+//
+// The actions may be bonded with pipes to actions outside of the group, as
+// long as they don't depend on each other. If one of them fails, the others
+// are stopped and the ParallelAction completes with the error code of the
+// failed one.
+//
+// The completion of each action is also reported to the delegate of the
+// ActionProcessor running the ParallelAction, as if that processor ran it.
+class ParallelAction : public AbstractAction, public ActionProcessorDelegate {
+ public:
+  ParallelAction() = default;
+  ~ParallelAction() override;
+
+  // Adds an action to run in parallel with the other ones. Must be called
+  // before the ParallelAction is performed.
+  void AddAction(std::unique_ptr<AbstractAction> action);
+
+  // AbstractAction overrides.
+  void PerformAction() override;
+  void TerminateProcessing() override;
+  void SuspendAction() override;
+  void ResumeAction() override;
+
+  static std::string StaticType() { return "ParallelAction"; }
+  std::string Type() const override { return StaticType(); }
+
+  // ActionProcessorDelegate overrides.
+  void ProcessingDone(const ActionProcessor* processor,
+                      ErrorCode code) override;
+  void ProcessingStopped(const ActionProcessor* processor) override;
+  void ActionCompleted(ActionProcessor* processor,
+                       AbstractAction* action,
+                       ErrorCode code) override;
+
+ private:
+  // Called once for each branch that is done running, either because its
+  // action completed with |code| or because the branch was stopped.
+  void BranchFinished(ErrorCode code);
+
+  // Completes the ParallelAction if all the branches are done.
+  void MaybeComplete();
+
+  // One processor for each action added.
+  std::vector<std::unique_ptr<ActionProcessor>> branches_;
+
+  // The number of branches still running.
+  size_t running_branches_{0};
+
+  // The error code of the first action that failed, if any.
+  ErrorCode code_{ErrorCode::kSuccess};
+
+  // Set while the branches are being started or stopped, to complete only
+  // once this is done, and while the ParallelAction is being terminated, to
+  // not complete at all.
+  bool starting_{false};
+  bool stopping_{false};
+  bool terminating_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(ParallelAction);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_COMMON_PARALLEL_ACTION_H_
@@ -0,0 +1,164 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/parallel_action.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <base/macros.h>
+#include <gtest/gtest.h>
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// An action that completes when the test asks it to. |terminated| is set when
+// the action is terminated, since it is deleted right after.
+class ParallelActionTestAction : public AbstractAction {
+ public:
+  explicit ParallelActionTestAction(bool* terminated)
+      : terminated_(terminated) {}
+
+  void PerformAction() override { performed_ = true; }
+  void TerminateProcessing() override { *terminated_ = true; }
+  void SuspendAction() override { suspended_ = true; }
+  void ResumeAction() override { suspended_ = false; }
+  string Type() const override { return "ParallelActionTestAction"; }
+
+  void CompleteAction(ErrorCode code) {
+    ASSERT_TRUE(processor_);
+    processor_->ActionComplete(this, code);
+  }
+
+  bool* terminated_;
+  bool performed_{false};
+  bool suspended_{false};
+};
+
+class ParallelActionTestDelegate : public ActionProcessorDelegate {
+ public:
+  void ProcessingDone(const ActionProcessor* processor,
+                      ErrorCode code) override {
+    processing_done_called_ = true;
+    processing_done_code_ = code;
+  }
+
+  void ActionCompleted(ActionProcessor* processor,
+                       AbstractAction* action,
+                       ErrorCode code) override {
+    completed_types_.push_back(action->Type());
+  }
+
+  bool processing_done_called_{false};
+  ErrorCode processing_done_code_{ErrorCode::kError};
+  std::vector<string> completed_types_;
+};
+
+}  // namespace
+
+class ParallelActionTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    processor_.set_delegate(&delegate_);
+    auto parallel_action = std::make_unique<ParallelAction>();
+    for (size_t i = 0; i < arraysize(actions_); i++) {
+      auto action =
+          std::make_unique<ParallelActionTestAction>(&terminated_[i]);
+      actions_[i] = action.get();
+      parallel_action->AddAction(std::move(action));
+    }
+    processor_.EnqueueAction(std::move(parallel_action));
+  }
+
+  void TearDown() override { processor_.set_delegate(nullptr); }
+
+  ActionProcessor processor_;
+  ParallelActionTestDelegate delegate_;
+  ParallelActionTestAction* actions_[2];
+  bool terminated_[2] = {false, false};
+};
+
+TEST_F(ParallelActionTest, CompletesOnceAllActionsCompletedTest) {
+  processor_.StartProcessing();
+  EXPECT_TRUE(actions_[0]->performed_);
+  EXPECT_TRUE(actions_[1]->performed_);
+
+  actions_[1]->CompleteAction(ErrorCode::kSuccess);
+  EXPECT_FALSE(delegate_.processing_done_called_);
+  EXPECT_TRUE(processor_.IsRunning());
+
+  actions_[0]->CompleteAction(ErrorCode::kSuccess);
+  EXPECT_TRUE(delegate_.processing_done_called_);
+  EXPECT_EQ(ErrorCode::kSuccess, delegate_.processing_done_code_);
+  EXPECT_FALSE(processor_.IsRunning());
+  // Both actions and the ParallelAction itself were reported.
+  EXPECT_EQ((std::vector<string>{"ParallelActionTestAction",
+                                 "ParallelActionTestAction",
+                                 ParallelAction::StaticType()}),
+            delegate_.completed_types_);
+}
+
+TEST_F(ParallelActionTest, FailureStopsTheOtherActionsTest) {
+  processor_.StartProcessing();
+  actions_[0]->CompleteAction(ErrorCode::kDownloadWriteError);
+  EXPECT_FALSE(terminated_[0]);
+  EXPECT_TRUE(terminated_[1]);
+  EXPECT_TRUE(delegate_.processing_done_called_);
+  EXPECT_EQ(ErrorCode::kDownloadWriteError, delegate_.processing_done_code_);
+  EXPECT_FALSE(processor_.IsRunning());
+}
+
+TEST_F(ParallelActionTest, SuspendAndResumeTest) {
+  processor_.StartProcessing();
+  processor_.SuspendProcessing();
+  EXPECT_TRUE(actions_[0]->suspended_);
+  EXPECT_TRUE(actions_[1]->suspended_);
+  processor_.ResumeProcessing();
+  EXPECT_FALSE(actions_[0]->suspended_);
+  EXPECT_FALSE(actions_[1]->suspended_);
+
+  actions_[0]->CompleteAction(ErrorCode::kSuccess);
+  actions_[1]->CompleteAction(ErrorCode::kSuccess);
+  EXPECT_TRUE(delegate_.processing_done_called_);
+}
+
+TEST_F(ParallelActionTest, StopProcessingTerminatesAllActionsTest) {
+  processor_.StartProcessing();
+  processor_.StopProcessing();
+  EXPECT_TRUE(terminated_[0]);
+  EXPECT_TRUE(terminated_[1]);
+  EXPECT_FALSE(delegate_.processing_done_called_);
+  EXPECT_FALSE(processor_.IsRunning());
+  EXPECT_TRUE(delegate_.completed_types_.empty());
+}
+
+TEST(ParallelActionEmptyTest, CompletesRightAwayTest) {
+  ActionProcessor processor;
+  ParallelActionTestDelegate delegate;
+  processor.set_delegate(&delegate);
+  processor.EnqueueAction(std::make_unique<ParallelAction>());
+  processor.StartProcessing();
+  EXPECT_TRUE(delegate.processing_done_called_);
+  EXPECT_EQ(ErrorCode::kSuccess, delegate.processing_done_code_);
+  processor.set_delegate(nullptr);
+}
+
+}  // namespace chromeos_update_engine
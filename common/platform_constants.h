@@ -50,6 +50,10 @@ extern const char kOmahaResponseDeadlineFile[];
 // The stateful directory used by update_engine.
 extern const char kNonVolatileDirectory[];
 
+// The read-only directory of the payloads preloaded on the image, named like
+// the payload cache. Empty if not supported.
+extern const char kPreloadedPayloadsDirectory[];
+
 // Options passed to the filesystem when mounting the new partition during
 // postinstall.
 extern const char kPostinstallMountOptions[];
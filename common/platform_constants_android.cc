@@ -31,6 +31,8 @@ const char kCACertificatesPath[] = "/system/etc/security/cacerts_google";
 // No deadline file API support on Android.
 const char kOmahaResponseDeadlineFile[] = "";
 const char kNonVolatileDirectory[] = "/data/misc/update_engine";
+// No preloaded payloads on Android.
+const char kPreloadedPayloadsDirectory[] = "";
 const char kPostinstallMountOptions[] =
     "context=u:object_r:postinstall_file:s0";
 
@@ -31,6 +31,8 @@ const char kCACertificatesPath[] = "/usr/share/chromeos-ca-certificates";
 const char kOmahaResponseDeadlineFile[] = "/tmp/update-check-response-deadline";
 // This directory is wiped during powerwash.
 const char kNonVolatileDirectory[] = "/var/lib/update_engine";
+const char kPreloadedPayloadsDirectory[] =
+    "/var/cache/update_engine/preloaded_payloads";
 const char kPostinstallMountOptions[] = "";
 
 }  // namespace constants
@@ -16,10 +16,17 @@
 
 #include "update_engine/common/prefs.h"
 
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <utility>
 
+#include <base/files/file_enumerator.h>
 #include <base/files/file_util.h>
 #include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
 #include <base/strings/string_number_conversions.h>
 #include <base/strings/string_util.h>
 
@@ -92,6 +99,14 @@ bool PrefsBase::Delete(const string& key) {
   return true;
 }
 
+bool PrefsBase::StartTransaction() {
+  return storage_->StartTransaction();
+}
+
+bool PrefsBase::CommitTransaction() {
+  return storage_->CommitTransaction();
+}
+
 void PrefsBase::AddObserver(const string& key, ObserverInterface* observer) {
   observers_[key].push_back(observer);
 }
@@ -112,45 +127,130 @@ bool Prefs::Init(const base::FilePath& prefs_dir) {
 
 bool Prefs::FileStorage::Init(const base::FilePath& prefs_dir) {
   prefs_dir_ = prefs_dir;
+  values_.clear();
+  // Read all the keys at once rather than opening a file on every read, since
+  // most of the keys are read while starting up.
+  base::FileEnumerator files(prefs_dir_, false, base::FileEnumerator::FILES);
+  for (base::FilePath path = files.Next(); !path.empty();
+       path = files.Next()) {
+    string key = path.BaseName().value();
+    base::FilePath filename;
+    if (!GetFileNameForKey(key, &filename))
+      continue;
+    string value;
+    if (!base::ReadFileToString(filename, &value)) {
+      LOG(WARNING) << "Unable to read " << filename.value();
+      continue;
+    }
+    values_[key] = std::move(value);
+  }
   return true;
 }
 
 bool Prefs::FileStorage::GetKey(const string& key, string* value) const {
   base::FilePath filename;
   TEST_AND_RETURN_FALSE(GetFileNameForKey(key, &filename));
-  if (!base::ReadFileToString(filename, value)) {
+  auto it = values_.find(key);
+  if (it == values_.end()) {
     LOG(INFO) << key << " not present in " << prefs_dir_.value();
     return false;
   }
+  *value = it->second;
   return true;
 }
 
 bool Prefs::FileStorage::SetKey(const string& key, const string& value) {
   base::FilePath filename;
   TEST_AND_RETURN_FALSE(GetFileNameForKey(key, &filename));
-  if (!base::DirectoryExists(filename.DirName())) {
-    // Only attempt to create the directory if it doesn't exist to avoid calls
-    // to parent directories where we might not have permission to write to.
-    TEST_AND_RETURN_FALSE(base::CreateDirectory(filename.DirName()));
+  if (in_transaction_) {
+    AddTransactionKey(key);
+  } else {
+    TEST_AND_RETURN_FALSE(WriteKeyFile(filename, value));
   }
-  TEST_AND_RETURN_FALSE(base::WriteFile(filename, value.data(), value.size()) ==
-                        static_cast<int>(value.size()));
+  values_[key] = value;
   return true;
 }
 
 bool Prefs::FileStorage::KeyExists(const string& key) const {
   base::FilePath filename;
   TEST_AND_RETURN_FALSE(GetFileNameForKey(key, &filename));
-  return base::PathExists(filename);
+  return values_.find(key) != values_.end();
 }
 
 bool Prefs::FileStorage::DeleteKey(const string& key) {
   base::FilePath filename;
   TEST_AND_RETURN_FALSE(GetFileNameForKey(key, &filename));
-  TEST_AND_RETURN_FALSE(base::DeleteFile(filename, false));
+  if (in_transaction_) {
+    AddTransactionKey(key);
+  } else {
+    TEST_AND_RETURN_FALSE(base::DeleteFile(filename, false));
+  }
+  values_.erase(key);
+  return true;
+}
+
+bool Prefs::FileStorage::StartTransaction() {
+  TEST_AND_RETURN_FALSE(!in_transaction_);
+  in_transaction_ = true;
+  return true;
+}
+
+// Only the last change of each key is written, and the files are synced
+// together rather than one by one. Writing them in the order of their last
+// change keeps the order the callers rely on if the process dies midway, like
+// writing the key which validates the others last.
+bool Prefs::FileStorage::CommitTransaction() {
+  TEST_AND_RETURN_FALSE(in_transaction_);
+  in_transaction_ = false;
+  std::vector<string> keys;
+  keys.swap(transaction_keys_);
+  bool success = true;
+  for (const string& key : keys) {
+    base::FilePath filename = prefs_dir_.Append(key);
+    auto it = values_.find(key);
+    if (it == values_.end()) {
+      success = base::DeleteFile(filename, false) && success;
+    } else {
+      success = WriteKeyFile(filename, it->second) && success;
+    }
+  }
+  if (sync_on_commit_ && !keys.empty())
+    success = SyncPrefsDir() && success;
+  return success;
+}
+
+void Prefs::FileStorage::AddTransactionKey(const string& key) {
+  transaction_keys_.erase(
+      std::remove(transaction_keys_.begin(), transaction_keys_.end(), key),
+      transaction_keys_.end());
+  transaction_keys_.push_back(key);
+}
+
+bool Prefs::FileStorage::WriteKeyFile(const base::FilePath& filename,
+                                      const string& value) {
+  if (!base::DirectoryExists(filename.DirName())) {
+    // Only attempt to create the directory if it doesn't exist to avoid calls
+    // to parent directories where we might not have permission to write to.
+    TEST_AND_RETURN_FALSE(base::CreateDirectory(filename.DirName()));
+  }
+  TEST_AND_RETURN_FALSE(base::WriteFile(filename, value.data(), value.size()) ==
+                        static_cast<int>(value.size()));
   return true;
 }
 
+bool Prefs::FileStorage::SyncPrefsDir() {
+  int fd = HANDLE_EINTR(
+      open(prefs_dir_.value().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+  TEST_AND_RETURN_FALSE_ERRNO(fd >= 0);
+  // A single syncfs() flushes all the files written by the transaction and
+  // the directory entries of the created and deleted ones.
+  bool success = syncfs(fd) == 0;
+  if (!success)
+    PLOG(ERROR) << "Failed to sync " << prefs_dir_.value();
+  IGNORE_EINTR(close(fd));
+  return success;
+}
+
 bool Prefs::FileStorage::GetFileNameForKey(const string& key,
                                            base::FilePath* filename) const {
   // Allows only non-empty keys containing [A-Za-z0-9_-].
@@ -193,4 +293,219 @@ bool MemoryPrefs::MemoryStorage::DeleteKey(const string& key) {
   return true;
 }
 
+bool MemoryPrefs::MemoryStorage::StartTransaction() {
+  return true;
+}
+
+bool MemoryPrefs::MemoryStorage::CommitTransaction() {
+  return true;
+}
+
+// JournaledPrefs
+
+namespace {
+
+// The types of the records of the journal. A set record holds the size of the
+// key, the key, the size of the value and the value, and a delete record holds
+// the size of the key and the key. The sizes are 32-bit integers in host byte
+// order. A commit record follows the records of every transaction.
+const char kJournalSetRecord = 'S';
+const char kJournalDeleteRecord = 'D';
+const char kJournalCommitRecord = 'C';
+
+// The journal is compacted when it grows larger than both this size and
+// kJournalCompactionRatio times the size of its last snapshot.
+const int64_t kJournalMinCompactionSize = 64 * 1024;
+const int64_t kJournalCompactionRatio = 4;
+
+void AppendJournalField(const string& field, string* records) {
+  uint32_t size = field.size();
+  records->append(reinterpret_cast<const char*>(&size), sizeof(size));
+  records->append(field);
+}
+
+// Reads a field written by AppendJournalField() at |*offset| in |contents|
+// into |field| and moves |*offset| past it. Returns false if |contents| ends
+// before the field does.
+bool ReadJournalField(const string& contents, size_t* offset, string* field) {
+  uint32_t size;
+  if (contents.size() - *offset < sizeof(size))
+    return false;
+  memcpy(&size, contents.data() + *offset, sizeof(size));
+  *offset += sizeof(size);
+  if (contents.size() - *offset < size)
+    return false;
+  field->assign(contents, *offset, size);
+  *offset += size;
+  return true;
+}
+
+}  // namespace
+
+bool JournaledPrefs::Init(const base::FilePath& journal_path) {
+  return journal_storage_.Init(journal_path);
+}
+
+bool JournaledPrefs::JournalStorage::Init(const base::FilePath& journal_path) {
+  journal_path_ = journal_path;
+  values_.clear();
+  string contents;
+  if (base::PathExists(journal_path_)) {
+    TEST_AND_RETURN_FALSE(base::ReadFileToString(journal_path_, &contents));
+  } else if (!base::DirectoryExists(journal_path_.DirName())) {
+    TEST_AND_RETURN_FALSE(base::CreateDirectory(journal_path_.DirName()));
+  }
+  size_t committed_size = ReplayJournal(contents);
+  if (committed_size < contents.size()) {
+    LOG(WARNING) << "Discarding " << contents.size() - committed_size
+                 << " bytes of uncommitted changes from "
+                 << journal_path_.value();
+  }
+  // Start from a snapshot, which also drops the uncommitted changes.
+  return CompactJournal();
+}
+
+bool JournaledPrefs::JournalStorage::GetKey(const string& key,
+                                            string* value) const {
+  auto it = values_.find(key);
+  if (it == values_.end())
+    return false;
+  *value = it->second;
+  return true;
+}
+
+bool JournaledPrefs::JournalStorage::SetKey(const string& key,
+                                            const string& value) {
+  TEST_AND_RETURN_FALSE(!key.empty());
+  values_[key] = value;
+  if (in_transaction_) {
+    AppendRecord(kJournalSetRecord, key, value, &transaction_records_);
+    return true;
+  }
+  string records;
+  AppendRecord(kJournalSetRecord, key, value, &records);
+  return AppendToJournal(records);
+}
+
+bool JournaledPrefs::JournalStorage::KeyExists(const string& key) const {
+  return values_.find(key) != values_.end();
+}
+
+bool JournaledPrefs::JournalStorage::DeleteKey(const string& key) {
+  if (values_.erase(key) == 0)
+    return true;
+  if (in_transaction_) {
+    AppendRecord(kJournalDeleteRecord, key, "", &transaction_records_);
+    return true;
+  }
+  string records;
+  AppendRecord(kJournalDeleteRecord, key, "", &records);
+  return AppendToJournal(records);
+}
+
+bool JournaledPrefs::JournalStorage::StartTransaction() {
+  TEST_AND_RETURN_FALSE(!in_transaction_);
+  in_transaction_ = true;
+  return true;
+}
+
+bool JournaledPrefs::JournalStorage::CommitTransaction() {
+  TEST_AND_RETURN_FALSE(in_transaction_);
+  in_transaction_ = false;
+  string records;
+  records.swap(transaction_records_);
+  if (records.empty())
+    return true;
+  return AppendToJournal(records);
+}
+
+void JournaledPrefs::JournalStorage::AppendRecord(char type,
+                                                  const string& key,
+                                                  const string& value,
+                                                  string* records) {
+  records->push_back(type);
+  AppendJournalField(key, records);
+  if (type == kJournalSetRecord)
+    AppendJournalField(value, records);
+}
+
+size_t JournaledPrefs::JournalStorage::ReplayJournal(const string& contents) {
+  std::map<string, string> values;
+  size_t committed_size = 0;
+  size_t offset = 0;
+  while (offset < contents.size()) {
+    char type = contents[offset++];
+    if (type == kJournalCommitRecord) {
+      values_ = values;
+      committed_size = offset;
+      continue;
+    }
+    string key, value;
+    if (!ReadJournalField(contents, &offset, &key))
+      break;
+    if (type == kJournalSetRecord) {
+      if (!ReadJournalField(contents, &offset, &value))
+        break;
+      values[key] = value;
+    } else if (type == kJournalDeleteRecord) {
+      values.erase(key);
+    } else {
+      LOG(ERROR) << "Invalid record type " << static_cast<int>(type)
+                 << " in " << journal_path_.value();
+      break;
+    }
+  }
+  return committed_size;
+}
+
+bool JournaledPrefs::JournalStorage::AppendToJournal(const string& records) {
+  TEST_AND_RETURN_FALSE(journal_.IsValid());
+  string transaction = records;
+  transaction.push_back(kJournalCommitRecord);
+  if (journal_.WriteAtCurrentPos(transaction.data(), transaction.size()) !=
+          static_cast<int>(transaction.size()) ||
+      !journal_.Flush()) {
+    PLOG(ERROR) << "Failed to append to " << journal_path_.value();
+    // Drop a partial write so that the following transactions are replayed.
+    journal_.SetLength(journal_size_);
+    return false;
+  }
+  journal_size_ += transaction.size();
+  if (journal_size_ > kJournalMinCompactionSize &&
+      journal_size_ > kJournalCompactionRatio * snapshot_size_) {
+    // The transaction is already persisted, so a failed compaction only
+    // leaves a larger journal.
+    if (!CompactJournal())
+      LOG(WARNING) << "Failed to compact " << journal_path_.value();
+  }
+  return true;
+}
+
+bool JournaledPrefs::JournalStorage::CompactJournal() {
+  string snapshot;
+  for (const auto& key_value : values_) {
+    AppendRecord(
+        kJournalSetRecord, key_value.first, key_value.second, &snapshot);
+  }
+  snapshot.push_back(kJournalCommitRecord);
+
+  // Write the snapshot to a new file replacing the journal only once it is
+  // synced, so that the old journal is kept if this fails.
+  base::FilePath new_journal_path = journal_path_.AddExtension("new");
+  base::File new_journal(new_journal_path,
+                         base::File::FLAG_CREATE_ALWAYS |
+                             base::File::FLAG_APPEND);
+  TEST_AND_RETURN_FALSE(new_journal.IsValid());
+  TEST_AND_RETURN_FALSE(
+      new_journal.WriteAtCurrentPos(snapshot.data(), snapshot.size()) ==
+      static_cast<int>(snapshot.size()));
+  TEST_AND_RETURN_FALSE(new_journal.Flush());
+  TEST_AND_RETURN_FALSE(
+      base::ReplaceFile(new_journal_path, journal_path_, nullptr));
+  journal_ = std::move(new_journal);
+  journal_size_ = snapshot.size();
+  snapshot_size_ = snapshot.size();
+  return true;
+}
+
 }  // namespace chromeos_update_engine
@@ -21,6 +21,7 @@
 #include <string>
 #include <vector>
 
+#include <base/files/file.h>
 #include <base/files/file_path.h>
 
 #include "gtest/gtest_prod.h"  // for FRIEND_TEST
@@ -53,6 +54,11 @@ class PrefsBase : public PrefsInterface {
     // key was deleted.
     virtual bool DeleteKey(const std::string& key) = 0;
 
+    // Start and commit a transaction grouping the following SetKey() and
+    // DeleteKey() calls. Return whether the operation succeeded.
+    virtual bool StartTransaction() = 0;
+    virtual bool CommitTransaction() = 0;
+
    private:
     DISALLOW_COPY_AND_ASSIGN(StorageInterface);
   };
@@ -70,6 +76,9 @@ class PrefsBase : public PrefsInterface {
   bool Exists(const std::string& key) const override;
   bool Delete(const std::string& key) override;
 
+  bool StartTransaction() override;
+  bool CommitTransaction() override;
+
   void AddObserver(const std::string& key,
                    ObserverInterface* observer) override;
   void RemoveObserver(const std::string& key,
@@ -87,17 +96,27 @@ class PrefsBase : public PrefsInterface {
 
 // Implements a preference store by storing the value associated with
 // a key in a separate file named after the key under a preference
-// store directory.
+// store directory. All the keys are loaded into memory by Init() with a
+// single scan of the directory, and the reads are served from memory.
+// The files changed by a transaction are written when it is committed.
 
 class Prefs : public PrefsBase {
  public:
   Prefs() : PrefsBase(&file_storage_) {}
 
   // Initializes the store by associating this object with |prefs_dir|
-  // as the preference store directory. Returns true on success, false
-  // otherwise.
+  // as the preference store directory and loading the keys stored in it.
+  // Changes made to the directory by others afterwards are not seen until
+  // the next call. Returns true on success, false otherwise.
   bool Init(const base::FilePath& prefs_dir);
 
+  // Sets whether committing a transaction syncs its files to disk, with a
+  // single sync of the filesystem holding the store. The changes made
+  // outside of a transaction are never synced.
+  void set_sync_on_commit(bool sync_on_commit) {
+    file_storage_.set_sync_on_commit(sync_on_commit);
+  }
+
  private:
   FRIEND_TEST(PrefsTest, GetFileNameForKey);
   FRIEND_TEST(PrefsTest, GetFileNameForKeyBadCharacter);
@@ -109,11 +128,17 @@ class Prefs : public PrefsBase {
 
     bool Init(const base::FilePath& prefs_dir);
 
+    void set_sync_on_commit(bool sync_on_commit) {
+      sync_on_commit_ = sync_on_commit;
+    }
+
     // PrefsBase::StorageInterface overrides.
     bool GetKey(const std::string& key, std::string* value) const override;
     bool SetKey(const std::string& key, const std::string& value) override;
     bool KeyExists(const std::string& key) const override;
     bool DeleteKey(const std::string& key) override;
+    bool StartTransaction() override;
+    bool CommitTransaction() override;
 
    private:
     FRIEND_TEST(PrefsTest, GetFileNameForKey);
@@ -125,8 +150,29 @@ class Prefs : public PrefsBase {
     bool GetFileNameForKey(const std::string& key,
                            base::FilePath* filename) const;
 
+    // Writes |value| to |filename|, creating the store directory if needed.
+    bool WriteKeyFile(const base::FilePath& filename, const std::string& value);
+
+    // Adds |key| to the keys changed by the current transaction.
+    void AddTransactionKey(const std::string& key);
+
+    // Syncs the filesystem holding the store directory.
+    bool SyncPrefsDir();
+
     // Preference store directory.
     base::FilePath prefs_dir_;
+
+    // The values of the keys stored in |prefs_dir_|, kept in sync with the
+    // files by SetKey() and DeleteKey(), or by CommitTransaction() for the
+    // keys changed in a transaction.
+    std::map<std::string, std::string> values_;
+
+    // Whether a transaction was started, and the keys it changed in the order
+    // of their last change, which is the order their files are written in.
+    bool in_transaction_ = false;
+    std::vector<std::string> transaction_keys_;
+
+    bool sync_on_commit_ = false;
   };
 
   // The concrete file storage implementation.
@@ -152,6 +198,8 @@ class MemoryPrefs : public PrefsBase {
     bool SetKey(const std::string& key, const std::string& value) override;
     bool KeyExists(const std::string& key) const override;
     bool DeleteKey(const std::string& key) override;
+    bool StartTransaction() override;
+    bool CommitTransaction() override;
 
    private:
     // The std::map holding the values in memory.
@@ -163,6 +211,86 @@ class MemoryPrefs : public PrefsBase {
 
   DISALLOW_COPY_AND_ASSIGN(MemoryPrefs);
 };
+
+// Implements a preference store by appending the changes of the keys to a
+// journal file, which is replayed into memory on Init(). The changes of a
+// transaction, or a single change made outside of one, are appended with a
+// single write followed by a sync, and are replayed only if all of them made it
+// to the journal. The journal is compacted into a snapshot of the values when
+// it grows much larger than its last snapshot.
+
+class JournaledPrefs : public PrefsBase {
+ public:
+  JournaledPrefs() : PrefsBase(&journal_storage_) {}
+
+  // Initializes the store by loading the values from the journal file at
+  // |journal_path|, which is created if it doesn't exist. Returns true on
+  // success, false otherwise.
+  bool Init(const base::FilePath& journal_path);
+
+ private:
+  FRIEND_TEST(JournaledPrefsTest, UncommittedChangesDiscarded);
+  FRIEND_TEST(JournaledPrefsTest, JournalCompacted);
+
+  class JournalStorage : public PrefsBase::StorageInterface {
+   public:
+    JournalStorage() = default;
+
+    bool Init(const base::FilePath& journal_path);
+
+    // PrefsBase::StorageInterface overrides.
+    bool GetKey(const std::string& key, std::string* value) const override;
+    bool SetKey(const std::string& key, const std::string& value) override;
+    bool KeyExists(const std::string& key) const override;
+    bool DeleteKey(const std::string& key) override;
+    bool StartTransaction() override;
+    bool CommitTransaction() override;
+
+   private:
+    FRIEND_TEST(JournaledPrefsTest, UncommittedChangesDiscarded);
+    FRIEND_TEST(JournaledPrefsTest, JournalCompacted);
+
+    // Appends the record of the change |type| of |key| to |value| to
+    // |records|. The |value| is ignored by the deletion records.
+    static void AppendRecord(char type,
+                             const std::string& key,
+                             const std::string& value,
+                             std::string* records);
+
+    // Loads the values of the transactions committed in the journal
+    // |contents| into |values_|. Returns the size of the prefix of |contents|
+    // holding them.
+    size_t ReplayJournal(const std::string& contents);
+
+    // Appends the change |records| of a transaction and its commit record to
+    // the journal and syncs it. Compacts the journal if it grew too large.
+    bool AppendToJournal(const std::string& records);
+
+    // Replaces the journal with a new one holding a snapshot of |values_|.
+    bool CompactJournal();
+
+    // The path of the journal file and the journal opened for appending.
+    base::FilePath journal_path_;
+    base::File journal_;
+
+    // The size of the journal, and its size when it was last compacted.
+    int64_t journal_size_ = 0;
+    int64_t snapshot_size_ = 0;
+
+    // The current values of the keys, including the uncommitted ones.
+    std::map<std::string, std::string> values_;
+
+    // Whether a transaction was started, and the records of its changes.
+    bool in_transaction_ = false;
+    std::string transaction_records_;
+  };
+
+  // The concrete journal storage implementation.
+  JournalStorage journal_storage_;
+
+  DISALLOW_COPY_AND_ASSIGN(JournaledPrefs);
+};
+
 }  // namespace chromeos_update_engine
 
 #endif  // UPDATE_ENGINE_COMMON_PREFS_H_
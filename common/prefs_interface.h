@@ -21,6 +21,8 @@
 
 #include <string>
 
+#include <base/macros.h>
+
 namespace chromeos_update_engine {
 
 // The prefs interface allows access to a persistent preferences
@@ -42,6 +44,32 @@ class PrefsInterface {
     virtual void OnPrefDeleted(const std::string& key) = 0;
   };
 
+  // Groups the changes to the prefs made during its lifetime in a transaction,
+  // started on construction and committed by Commit() or on destruction.
+  class Transaction {
+   public:
+    explicit Transaction(PrefsInterface* prefs)
+        : prefs_(prefs), started_(prefs->StartTransaction()) {}
+    ~Transaction() { Commit(); }
+
+    // Commits the transaction if it wasn't already. Returns whether the
+    // changes were persisted.
+    bool Commit() {
+      if (!started_)
+        return committed_;
+      started_ = false;
+      committed_ = prefs_->CommitTransaction();
+      return committed_;
+    }
+
+   private:
+    PrefsInterface* prefs_;
+    bool started_;
+    bool committed_ = false;
+
+    DISALLOW_COPY_AND_ASSIGN(Transaction);
+  };
+
   virtual ~PrefsInterface() = default;
 
   // Gets a string |value| associated with |key|. Returns true on
@@ -79,6 +107,17 @@ class PrefsInterface {
   // this key. Calling with non-existent keys does nothing.
   virtual bool Delete(const std::string& key) = 0;
 
+  // Starts a transaction grouping the following Set*() and Delete() calls
+  // until CommitTransaction(), which the store persists together in a single
+  // atomic write when it supports it. The values are readable as soon as they
+  // are set. Transactions can't be nested. Returns whether the transaction
+  // started.
+  virtual bool StartTransaction() = 0;
+
+  // Persists the Set*() and Delete() calls of the transaction started by
+  // StartTransaction(). Returns whether they were all persisted.
+  virtual bool CommitTransaction() = 0;
+
   // Add an observer to watch whenever the given |key| is modified. The
   // OnPrefSet() and OnPrefDelete() methods will be called whenever any of the
   // Set*() methods or the Delete() method are called on the given key,
@@ -48,10 +48,14 @@ class PrefsTest : public ::testing::Test {
     ASSERT_TRUE(prefs_.Init(prefs_dir_));
   }
 
+  // Writes |value| to the file of |key| and reloads the keys, since they are
+  // only read from the directory on Init().
   bool SetValue(const string& key, const string& value) {
     return base::WriteFile(prefs_dir_.Append(key),
                            value.data(),
-                           value.length()) == static_cast<int>(value.length());
+                           value.length()) ==
+               static_cast<int>(value.length()) &&
+           prefs_.Init(prefs_dir_);
   }
 
   base::ScopedTempDir temp_dir_;
@@ -279,6 +283,38 @@ TEST_F(PrefsTest, DeleteWorks) {
   EXPECT_FALSE(prefs_.Exists(kKey));
 }
 
+TEST_F(PrefsTest, InitLoadsAllKeys) {
+  ASSERT_TRUE(SetValue(kKey, "value"));
+  ASSERT_TRUE(SetValue("other-key", "other value"));
+  // Files not named after a valid key and directories are ignored.
+  ASSERT_TRUE(SetValue("not.a.key", "ignored"));
+  ASSERT_TRUE(base::CreateDirectory(prefs_dir_.Append("subdir")));
+  ASSERT_TRUE(prefs_.Init(prefs_dir_));
+
+  // The values are served from memory once loaded.
+  ASSERT_TRUE(base::DeleteFile(prefs_dir_.Append(kKey), false));
+  string value;
+  EXPECT_TRUE(prefs_.GetString(kKey, &value));
+  EXPECT_EQ("value", value);
+  EXPECT_TRUE(prefs_.GetString("other-key", &value));
+  EXPECT_EQ("other value", value);
+  EXPECT_FALSE(prefs_.Exists("subdir"));
+}
+
+TEST_F(PrefsTest, ChangesKeptInSyncWithFiles) {
+  ASSERT_TRUE(prefs_.SetString(kKey, "value"));
+  ASSERT_TRUE(prefs_.SetString("other-key", "other value"));
+  ASSERT_TRUE(prefs_.Delete("other-key"));
+
+  Prefs prefs;
+  ASSERT_TRUE(prefs.Init(prefs_dir_));
+  string value;
+  EXPECT_TRUE(prefs.GetString(kKey, &value));
+  EXPECT_EQ("value", value);
+  EXPECT_FALSE(prefs.Exists("other-key"));
+  EXPECT_FALSE(prefs_.Exists("other-key"));
+}
+
 class MockPrefsObserver : public PrefsInterface::ObserverInterface {
  public:
   MOCK_METHOD1(OnPrefSet, void(const string&));
@@ -341,6 +377,31 @@ TEST_F(PrefsTest, UnsuccessfulCallsNotObserved) {
   prefs_.RemoveObserver(kInvalidKey, &mock_obserser);
 }
 
+TEST_F(PrefsTest, TransactionWrittenOnCommit) {
+  EXPECT_TRUE(prefs_.SetString("deleted-key", "value"));
+  prefs_.set_sync_on_commit(true);
+  EXPECT_TRUE(prefs_.StartTransaction());
+  EXPECT_FALSE(prefs_.StartTransaction());
+  EXPECT_TRUE(prefs_.SetInt64(kKey, 1));
+  EXPECT_TRUE(prefs_.SetInt64(kKey, 2));
+  EXPECT_TRUE(prefs_.Delete("deleted-key"));
+  // The values are readable before the transaction is committed, but the
+  // files are not written.
+  int64_t value = 0;
+  EXPECT_TRUE(prefs_.GetInt64(kKey, &value));
+  EXPECT_EQ(2, value);
+  EXPECT_FALSE(prefs_.Exists("deleted-key"));
+  EXPECT_FALSE(base::PathExists(prefs_dir_.Append(kKey)));
+  EXPECT_TRUE(base::PathExists(prefs_dir_.Append("deleted-key")));
+
+  EXPECT_TRUE(prefs_.CommitTransaction());
+  EXPECT_FALSE(prefs_.CommitTransaction());
+  string file_value;
+  EXPECT_TRUE(base::ReadFileToString(prefs_dir_.Append(kKey), &file_value));
+  EXPECT_EQ("2", file_value);
+  EXPECT_FALSE(base::PathExists(prefs_dir_.Append("deleted-key")));
+}
+
 class MemoryPrefsTest : public ::testing::Test {
  protected:
   MemoryPrefs prefs_;
@@ -361,4 +422,121 @@ TEST_F(MemoryPrefsTest, BasicTest) {
   EXPECT_FALSE(prefs_.Delete(kKey));
 }
 
+class JournaledPrefsTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+    journal_path_ = temp_dir_.GetPath().Append("prefs_journal");
+    ASSERT_TRUE(prefs_.Init(journal_path_));
+  }
+
+  base::ScopedTempDir temp_dir_;
+  base::FilePath journal_path_;
+  JournaledPrefs prefs_;
+};
+
+TEST_F(JournaledPrefsTest, BasicTest) {
+  EXPECT_FALSE(prefs_.Exists(kKey));
+  EXPECT_TRUE(prefs_.SetInt64(kKey, 1234));
+  EXPECT_TRUE(prefs_.SetString("other-key", "value"));
+  EXPECT_TRUE(prefs_.Delete("other-key"));
+
+  JournaledPrefs prefs;
+  ASSERT_TRUE(prefs.Init(journal_path_));
+  int64_t value = 0;
+  EXPECT_TRUE(prefs.GetInt64(kKey, &value));
+  EXPECT_EQ(1234, value);
+  EXPECT_FALSE(prefs.Exists("other-key"));
+}
+
+TEST_F(JournaledPrefsTest, TransactionCommittedTogether) {
+  EXPECT_TRUE(prefs_.SetInt64(kKey, 1));
+  EXPECT_TRUE(prefs_.StartTransaction());
+  EXPECT_FALSE(prefs_.StartTransaction());
+  EXPECT_TRUE(prefs_.SetInt64(kKey, 2));
+  EXPECT_TRUE(prefs_.SetBoolean("other-key", true));
+  // The values are readable before the transaction is committed, but not
+  // persisted.
+  int64_t value = 0;
+  EXPECT_TRUE(prefs_.GetInt64(kKey, &value));
+  EXPECT_EQ(2, value);
+  {
+    JournaledPrefs prefs;
+    ASSERT_TRUE(prefs.Init(journal_path_));
+    EXPECT_TRUE(prefs.GetInt64(kKey, &value));
+    EXPECT_EQ(1, value);
+    EXPECT_FALSE(prefs.Exists("other-key"));
+  }
+
+  EXPECT_TRUE(prefs_.CommitTransaction());
+  EXPECT_FALSE(prefs_.CommitTransaction());
+  JournaledPrefs prefs;
+  ASSERT_TRUE(prefs.Init(journal_path_));
+  EXPECT_TRUE(prefs.GetInt64(kKey, &value));
+  EXPECT_EQ(2, value);
+  EXPECT_TRUE(prefs.Exists("other-key"));
+}
+
+TEST_F(JournaledPrefsTest, TransactionCommittedOnDestruction) {
+  {
+    PrefsInterface::Transaction transaction(&prefs_);
+    EXPECT_TRUE(prefs_.SetInt64(kKey, 1));
+  }
+  PrefsInterface::Transaction transaction(&prefs_);
+  EXPECT_TRUE(prefs_.SetInt64(kKey, 2));
+  EXPECT_TRUE(transaction.Commit());
+  EXPECT_TRUE(transaction.Commit());
+
+  JournaledPrefs prefs;
+  ASSERT_TRUE(prefs.Init(journal_path_));
+  int64_t value = 0;
+  EXPECT_TRUE(prefs.GetInt64(kKey, &value));
+  EXPECT_EQ(2, value);
+}
+
+TEST_F(JournaledPrefsTest, UncommittedChangesDiscarded) {
+  EXPECT_TRUE(prefs_.SetString(kKey, "committed"));
+  // Append the records of a transaction interrupted before its commit record,
+  // the last one of them partially written.
+  string records;
+  JournaledPrefs::JournalStorage::AppendRecord(
+      'S', kKey, "uncommitted", &records);
+  JournaledPrefs::JournalStorage::AppendRecord(
+      'S', "other-key", "uncommitted", &records);
+  records.resize(records.size() - 4);
+  EXPECT_TRUE(
+      base::AppendToFile(journal_path_, records.data(), records.size()));
+
+  JournaledPrefs prefs;
+  ASSERT_TRUE(prefs.Init(journal_path_));
+  string value;
+  EXPECT_TRUE(prefs.GetString(kKey, &value));
+  EXPECT_EQ("committed", value);
+  EXPECT_FALSE(prefs.Exists("other-key"));
+  // The journal was replaced by a snapshot of the committed values.
+  EXPECT_EQ(prefs.journal_storage_.snapshot_size_,
+            prefs.journal_storage_.journal_size_);
+}
+
+TEST_F(JournaledPrefsTest, JournalCompacted) {
+  const string kValue(1000, 'a');
+  for (int i = 0; i < 1000; i++) {
+    EXPECT_TRUE(prefs_.SetString(kKey, kValue));
+    EXPECT_TRUE(prefs_.SetInt64("other-key", i));
+  }
+  int64_t journal_size = 0;
+  EXPECT_TRUE(base::GetFileSize(journal_path_, &journal_size));
+  EXPECT_EQ(prefs_.journal_storage_.journal_size_, journal_size);
+  EXPECT_LT(journal_size, 128 * 1024);
+
+  JournaledPrefs prefs;
+  ASSERT_TRUE(prefs.Init(journal_path_));
+  string value;
+  EXPECT_TRUE(prefs.GetString(kKey, &value));
+  EXPECT_EQ(kValue, value);
+  int64_t int_value = 0;
+  EXPECT_TRUE(prefs.GetInt64("other-key", &int_value));
+  EXPECT_EQ(999, int_value);
+}
+
 }  // namespace chromeos_update_engine
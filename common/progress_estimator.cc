@@ -0,0 +1,85 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/common/progress_estimator.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+// The maximum number of samples kept over the window. Closer samples are
+// merged, since the progress may be reported for every write.
+const size_t kMaxSamples = 64;
+
+// The units of the phases reported as a fraction.
+const uint64_t kFractionUnits = 1000000;
+}  // namespace
+
+ProgressEstimator::ProgressEstimator(base::TimeDelta window)
+    : window_(window) {}
+
+void ProgressEstimator::Reset() {
+  samples_.clear();
+  total_ = 0;
+}
+
+void ProgressEstimator::AddSample(base::TimeTicks now,
+                                    uint64_t done,
+                                    uint64_t total) {
+  // Start over if the phase went back, e.g. when the download restarted.
+  if (!samples_.empty() && (done < samples_.back().done || total != total_))
+    Reset();
+  total_ = total;
+
+  if (samples_.size() >= 2 &&
+      now - samples_[samples_.size() - 2].time < window_ / kMaxSamples) {
+    samples_.back() = {now, done};
+  } else {
+    samples_.push_back({now, done});
+  }
+  // Keep the newest sample older than the window, so the rate covers it all.
+  while (samples_.size() > 2 && now - samples_[1].time >= window_)
+    samples_.pop_front();
+}
+
+void ProgressEstimator::AddFraction(base::TimeTicks now, double fraction) {
+  AddSample(now, static_cast<uint64_t>(fraction * kFractionUnits),
+            kFractionUnits);
+}
+
+double ProgressEstimator::GetUnitsPerSecond() const {
+  if (samples_.size() < 2)
+    return -1.0;
+  double seconds = (samples_.back().time - samples_.front().time).InSecondsF();
+  if (seconds <= 0)
+    return -1.0;
+  return (samples_.back().done - samples_.front().done) / seconds;
+}
+
+int64_t ProgressEstimator::GetSecondsLeft() const {
+  if (samples_.empty())
+    return -1;
+  uint64_t left = total_ > samples_.back().done ? total_ - samples_.back().done
+                                                : 0;
+  if (left == 0)
+    return 0;
+  double rate = GetUnitsPerSecond();
+  if (rate <= 0)
+    return -1;
+  return static_cast<int64_t>(left / rate + 0.5);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,70 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_COMMON_PROGRESS_ESTIMATOR_H_
+#define UPDATE_ENGINE_COMMON_PROGRESS_ESTIMATOR_H_
+
+#include <deque>
+
+#include <base/macros.h>
+#include <base/time/time.h>
+
+namespace chromeos_update_engine {
+
+// Estimates the rate at which a phase of the update progresses over a sliding
+// window of its latest samples, and the time left to complete it at that
+// rate. The units are bytes for the download, but any monotonic count works.
+class ProgressEstimator {
+ public:
+  explicit ProgressEstimator(base::TimeDelta window);
+
+  // Forgets all the samples, to start estimating a new phase.
+  void Reset();
+
+  // Records that |done| out of |total| units were completed at |now|.
+  void AddSample(base::TimeTicks now, uint64_t done, uint64_t total);
+
+  // Records that |fraction| of the phase was completed at |now|, for the
+  // phases which don't count any unit.
+  void AddFraction(base::TimeTicks now, double fraction);
+
+  // Returns the number of units completed per second over the window, or a
+  // negative value if not known yet.
+  double GetUnitsPerSecond() const;
+
+  // Returns the number of seconds left to complete the phase at the current
+  // rate, or -1 if not known.
+  int64_t GetSecondsLeft() const;
+
+ private:
+  struct Sample {
+    base::TimeTicks time;
+    uint64_t done;
+  };
+
+  const base::TimeDelta window_;
+
+  // The samples over the window, the oldest first.
+  std::deque<Sample> samples_;
+  uint64_t total_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(ProgressEstimator);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_COMMON_PROGRESS_ESTIMATOR_H_
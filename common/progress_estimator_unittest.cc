@@ -0,0 +1,80 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/common/progress_estimator.h"
+
+#include <gtest/gtest.h>
+
+using base::TimeDelta;
+using base::TimeTicks;
+
+namespace chromeos_update_engine {
+
+class ProgressEstimatorTest : public ::testing::Test {
+ protected:
+  TimeTicks At(int seconds) {
+    return start_ + TimeDelta::FromSeconds(seconds);
+  }
+
+  ProgressEstimator estimator_{TimeDelta::FromSeconds(10)};
+  TimeTicks start_ = TimeTicks::Now();
+};
+
+TEST_F(ProgressEstimatorTest, UnknownWithASingleSampleTest) {
+  EXPECT_LT(estimator_.GetUnitsPerSecond(), 0);
+  EXPECT_EQ(-1, estimator_.GetSecondsLeft());
+  estimator_.AddSample(At(0), 100, 1000);
+  EXPECT_LT(estimator_.GetUnitsPerSecond(), 0);
+  EXPECT_EQ(-1, estimator_.GetSecondsLeft());
+}
+
+TEST_F(ProgressEstimatorTest, EstimatesTheRateAndTimeLeftTest) {
+  estimator_.AddSample(At(0), 0, 1000);
+  estimator_.AddSample(At(2), 100, 1000);
+  estimator_.AddSample(At(4), 200, 1000);
+  EXPECT_DOUBLE_EQ(50.0, estimator_.GetUnitsPerSecond());
+  EXPECT_EQ(16, estimator_.GetSecondsLeft());
+
+  estimator_.AddSample(At(5), 1000, 1000);
+  EXPECT_EQ(0, estimator_.GetSecondsLeft());
+}
+
+TEST_F(ProgressEstimatorTest, OnlyTheWindowCountsTest) {
+  // A fast start followed by a slow transfer.
+  estimator_.AddSample(At(0), 0, 10000);
+  estimator_.AddSample(At(1), 5000, 10000);
+  for (int i = 2; i <= 20; i++)
+    estimator_.AddSample(At(i), 5000 + (i - 1) * 10, 10000);
+  EXPECT_NEAR(10.0, estimator_.GetUnitsPerSecond(), 0.01);
+}
+
+TEST_F(ProgressEstimatorTest, StartsOverWhenTheProgressGoesBackTest) {
+  estimator_.AddSample(At(0), 0, 1000);
+  estimator_.AddSample(At(1), 500, 1000);
+  estimator_.AddSample(At(2), 100, 1000);
+  EXPECT_LT(estimator_.GetUnitsPerSecond(), 0);
+  estimator_.AddSample(At(3), 150, 1000);
+  EXPECT_DOUBLE_EQ(50.0, estimator_.GetUnitsPerSecond());
+}
+
+TEST_F(ProgressEstimatorTest, EstimatesTheTimeLeftOfAFractionTest) {
+  estimator_.AddFraction(At(0), 0.0);
+  estimator_.AddFraction(At(5), 0.25);
+  EXPECT_EQ(15, estimator_.GetSecondsLeft());
+}
+
+}  // namespace chromeos_update_engine
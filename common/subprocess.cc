@@ -17,21 +17,28 @@
 #include "update_engine/common/subprocess.h"
 
 #include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <map>
 #include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include <base/bind.h>
+#include <base/files/file_enumerator.h>
+#include <base/files/file_path.h>
 #include <base/logging.h>
 #include <base/posix/eintr_wrapper.h>
+#include <base/strings/string_number_conversions.h>
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
-#include <brillo/process.h>
 #include <brillo/secure_blob.h>
 
 #include "update_engine/common/utils.h"
@@ -45,57 +52,138 @@ namespace chromeos_update_engine {
 
 namespace {
 
-bool SetupChild(const std::map<string, string>& env, uint32_t flags) {
-  // Setup the environment variables.
-  clearenv();
-  for (const auto& key_value : env) {
-    setenv(key_value.first.c_str(), key_value.second.c_str(), 0);
+// The exit status of the child process when it fails to execute the command.
+const int kExecErrorExitStatus = 127;
+
+// Returns the file descriptors open in this process which are not closed when
+// executing a new program.
+vector<int> GetInheritableFileDescriptors() {
+  vector<int> fds;
+  base::FileEnumerator fd_dir(
+      base::FilePath("/proc/self/fd"), false, base::FileEnumerator::FILES);
+  for (base::FilePath path = fd_dir.Next(); !path.empty();
+       path = fd_dir.Next()) {
+    int fd;
+    if (base::StringToInt(path.BaseName().value(), &fd))
+      fds.push_back(fd);
   }
-
-  if ((flags & Subprocess::kRedirectStderrToStdout) != 0) {
-    if (HANDLE_EINTR(dup2(STDOUT_FILENO, STDERR_FILENO)) != STDERR_FILENO)
-      return false;
+  if (fds.empty()) {
+    // /proc is not available, so check all the possible file descriptors.
+    for (int fd = 0; fd < sysconf(_SC_OPEN_MAX); fd++)
+      fds.push_back(fd);
   }
-
-  int fd = HANDLE_EINTR(open("/dev/null", O_RDONLY));
-  if (fd < 0)
-    return false;
-  if (HANDLE_EINTR(dup2(fd, STDIN_FILENO)) != STDIN_FILENO)
-    return false;
-  IGNORE_EINTR(close(fd));
-
-  return true;
+  // This also drops the descriptor used to read /proc/self/fd, which is
+  // already closed.
+  vector<int> inheritable_fds;
+  for (int fd : fds) {
+    int fd_flags = fcntl(fd, F_GETFD);
+    if (fd_flags >= 0 && (fd_flags & FD_CLOEXEC) == 0)
+      inheritable_fds.push_back(fd);
+  }
+  return inheritable_fds;
 }
 
 // Helper function to launch a process with the given Subprocess::Flags.
 // This function only sets up and starts the process according to the |flags|.
 // The caller is responsible for watching the termination of the subprocess.
-// Return whether the process was successfully launched and fills in the |proc|
-// Process.
-bool LaunchProcess(const vector<string>& cmd,
-                   uint32_t flags,
-                   const vector<int>& output_pipes,
-                   brillo::Process* proc) {
-  for (const string& arg : cmd)
-    proc->AddArg(arg);
-  proc->SetSearchPath((flags & Subprocess::kSearchPath) != 0);
-
+// The process is started with posix_spawn(), which doesn't copy the address
+// space of the daemon like fork() does. Only stdin, redirected from /dev/null,
+// stdout, stderr and the file descriptors in |output_pipes| are open in the
+// child. Returns the pid of the launched process and fills in |pipes| with our
+// end of the pipes mapped onto stdout and |output_pipes| in the child, or
+// returns 0 on failure.
+pid_t LaunchProcess(const vector<string>& cmd,
+                    uint32_t flags,
+                    const vector<int>& output_pipes,
+                    std::map<int, int>* pipes) {
   // Create an environment for the child process with just the required PATHs.
-  std::map<string, string> env;
+  vector<string> env;
   for (const char* key : {"LD_LIBRARY_PATH", "PATH"}) {
     const char* value = getenv(key);
     if (value)
-      env.emplace(key, value);
+      env.push_back(string(key) + "=" + value);
+  }
+  vector<char*> argv;
+  for (const string& arg : cmd)
+    argv.push_back(const_cast<char*>(arg.c_str()));
+  argv.push_back(nullptr);
+  vector<char*> envp;
+  for (const string& key_value : env)
+    envp.push_back(const_cast<char*>(key_value.c_str()));
+  envp.push_back(nullptr);
+
+  vector<int> child_fds(output_pipes);
+  child_fds.push_back(STDOUT_FILENO);
+  int min_writer_fd = *std::max_element(child_fds.begin(), child_fds.end()) + 1;
+  min_writer_fd = std::max(min_writer_fd, STDERR_FILENO + 1);
+
+  // Create the pipes with the child end above all the file descriptors it is
+  // mapped onto, so mapping one doesn't replace the end of another.
+  std::map<int, int> writers;
+  bool success = true;
+  for (int child_fd : child_fds) {
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) != 0) {
+      PLOG(ERROR) << "Unable to create a pipe";
+      success = false;
+      break;
+    }
+    (*pipes)[child_fd] = pipe_fds[0];
+    writers[child_fd] = fcntl(pipe_fds[1], F_DUPFD_CLOEXEC, min_writer_fd);
+    IGNORE_EINTR(close(pipe_fds[1]));
+    if (writers[child_fd] < 0) {
+      PLOG(ERROR) << "Unable to duplicate the pipe";
+      success = false;
+      break;
+    }
   }
 
-  for (const int fd : output_pipes) {
-    proc->RedirectUsingPipe(fd, false);
+  pid_t pid = 0;
+  if (success) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    // Close the other file descriptors inherited from the daemon first.
+    for (int fd : GetInheritableFileDescriptors()) {
+      if (fd > STDERR_FILENO && writers.find(fd) == writers.end())
+        posix_spawn_file_actions_addclose(&actions, fd);
+    }
+    for (const auto& child_fd_writer : writers) {
+      posix_spawn_file_actions_adddup2(
+          &actions, child_fd_writer.second, child_fd_writer.first);
+    }
+    if ((flags & Subprocess::kRedirectStderrToStdout) != 0) {
+      posix_spawn_file_actions_adddup2(
+          &actions, writers[STDOUT_FILENO], STDERR_FILENO);
+    }
+    posix_spawn_file_actions_addopen(
+        &actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+
+    int error;
+    if ((flags & Subprocess::kSearchPath) != 0) {
+      error = posix_spawnp(
+          &pid, argv[0], &actions, nullptr, argv.data(), envp.data());
+    } else {
+      error = posix_spawn(
+          &pid, argv[0], &actions, nullptr, argv.data(), envp.data());
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    if (error != 0) {
+      LOG(ERROR) << "Unable to execute " << cmd[0] << ": " << strerror(error);
+      pid = 0;
+    }
   }
-  proc->SetCloseUnusedFileDescriptors(true);
-  proc->RedirectUsingPipe(STDOUT_FILENO, false);
-  proc->SetPreExecCallback(base::Bind(&SetupChild, env, flags));
 
-  return proc->Start();
+  // The child has its own copy of the writer ends now.
+  for (const auto& child_fd_writer : writers) {
+    if (child_fd_writer.second >= 0)
+      IGNORE_EINTR(close(child_fd_writer.second));
+  }
+  if (pid == 0) {
+    for (const auto& child_fd_reader : *pipes)
+      IGNORE_EINTR(close(child_fd_reader.second));
+    pipes->clear();
+  }
+  return pid;
 }
 
 }  // namespace
@@ -115,6 +203,15 @@ Subprocess::~Subprocess() {
     subprocess_singleton_ = nullptr;
 }
 
+Subprocess::SubprocessRecord::~SubprocessRecord() {
+  // Close our side of the pipes first, giving the child a chance to handle
+  // the SIGPIPE, though it likely won't have the time.
+  for (const auto& child_fd_reader : pipes)
+    IGNORE_EINTR(close(child_fd_reader.second));
+  if (pid != 0 && kill(pid, SIGKILL) != 0)
+    PLOG(WARNING) << "Error sending SIGKILL to " << pid;
+}
+
 void Subprocess::OnStdoutReady(SubprocessRecord* record) {
   char buf[1024];
   size_t bytes_read;
@@ -160,12 +257,10 @@ void Subprocess::ChildExitedCallback(const siginfo_t& info) {
     record->callback.Run(info.si_status, record->stdout);
   }
   // Release and close all the pipes after calling the callback so our
-  // redirected pipes are still alive. Releasing the process first makes
-  // Reset(0) not attempt to kill the process, which is already a zombie at this
+  // redirected pipes are still alive. Releasing the process first makes the
+  // record not attempt to kill the process, which is already a zombie at this
   // point.
-  record->proc.Release();
-  record->proc.Reset(0);
-
+  record->pid = 0;
   subprocess_records_.erase(pid_record);
 }
 
@@ -180,18 +275,19 @@ pid_t Subprocess::ExecFlags(const vector<string>& cmd,
                             const ExecCallback& callback) {
   unique_ptr<SubprocessRecord> record(new SubprocessRecord(callback));
 
-  if (!LaunchProcess(cmd, flags, output_pipes, &record->proc)) {
+  record->pid = LaunchProcess(cmd, flags, output_pipes, &record->pipes);
+  if (record->pid == 0) {
     LOG(ERROR) << "Failed to launch subprocess";
     return 0;
   }
 
-  pid_t pid = record->proc.pid();
+  pid_t pid = record->pid;
   CHECK(process_reaper_.WatchForChild(
       FROM_HERE,
       pid,
       base::Bind(&Subprocess::ChildExitedCallback, base::Unretained(this))));
 
-  record->stdout_fd = record->proc.GetPipe(STDOUT_FILENO);
+  record->stdout_fd = record->pipes[STDOUT_FILENO];
   // Capture the subprocess output. Make our end of the pipe non-blocking.
   int fd_flags = fcntl(record->stdout_fd, F_GETFL, 0) | O_NONBLOCK;
   if (HANDLE_EINTR(fcntl(record->stdout_fd, F_SETFL, fd_flags)) < 0) {
@@ -222,14 +318,18 @@ void Subprocess::KillExec(pid_t pid) {
   }
   // Release the pid now so we don't try to kill it if Subprocess is destroyed
   // before the corresponding ChildExitedCallback() is called.
-  pid_record->second->proc.Release();
+  pid_record->second->pid = 0;
 }
 
 int Subprocess::GetPipeFd(pid_t pid, int fd) const {
   auto pid_record = subprocess_records_.find(pid);
   if (pid_record == subprocess_records_.end())
     return -1;
-  return pid_record->second->proc.GetPipe(fd);
+  const auto& pipes = pid_record->second->pipes;
+  auto pipe = pipes.find(fd);
+  if (pipe == pipes.end())
+    return -1;
+  return pipe->second;
 }
 
 bool Subprocess::SynchronousExec(const vector<string>& cmd,
@@ -245,11 +345,12 @@ bool Subprocess::SynchronousExecFlags(const vector<string>& cmd,
                                       uint32_t flags,
                                       int* return_code,
                                       string* stdout) {
-  brillo::ProcessImpl proc;
   // It doesn't make sense to redirect some pipes in the synchronous case
   // because we won't be reading on our end, so we don't expose the output_pipes
   // in this case.
-  if (!LaunchProcess(cmd, flags, {}, &proc)) {
+  std::map<int, int> pipes;
+  pid_t pid = LaunchProcess(cmd, flags, {}, &pipes);
+  if (pid == 0) {
     LOG(ERROR) << "Failed to launch subprocess";
     return false;
   }
@@ -258,7 +359,7 @@ bool Subprocess::SynchronousExecFlags(const vector<string>& cmd,
     stdout->clear();
   }
 
-  int fd = proc.GetPipe(STDOUT_FILENO);
+  int fd = pipes[STDOUT_FILENO];
   vector<char> buffer(32 * 1024);
   while (true) {
     int rc = HANDLE_EINTR(read(fd, buffer.data(), buffer.size()));
@@ -272,12 +373,22 @@ bool Subprocess::SynchronousExecFlags(const vector<string>& cmd,
         stdout->append(buffer.data(), rc);
     }
   }
+  IGNORE_EINTR(close(fd));
   // At this point, the subprocess already closed the output, so we only need to
   // wait for it to finish.
-  int proc_return_code = proc.Wait();
+  int status;
+  int proc_return_code = -1;
+  if (HANDLE_EINTR(waitpid(pid, &status, 0)) < 0) {
+    PLOG(ERROR) << "Unable to wait for subprocess " << pid;
+  } else if (WIFEXITED(status)) {
+    proc_return_code = WEXITSTATUS(status);
+  } else {
+    LOG(ERROR) << "Subprocess " << pid << " was terminated by signal "
+               << WTERMSIG(status);
+  }
   if (return_code)
     *return_code = proc_return_code;
-  return proc_return_code != brillo::Process::kErrorExitStatus;
+  return proc_return_code != kExecErrorExitStatus;
 }
 
 void Subprocess::FlushBufferedLogsAtExit() {
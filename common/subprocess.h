@@ -29,7 +29,6 @@
 #include <base/macros.h>
 #include <brillo/asynchronous_signal_handler_interface.h>
 #include <brillo/message_loops/message_loop.h>
-#include <brillo/process.h>
 #include <brillo/process_reaper.h>
 #include <gtest/gtest_prod.h>  // for FRIEND_TEST
 
@@ -111,12 +110,19 @@ class Subprocess {
     explicit SubprocessRecord(const ExecCallback& callback)
         : callback(callback) {}
 
+    // Closes our end of the pipes and kills the child process unless it was
+    // released by setting |pid| to 0.
+    ~SubprocessRecord();
+
     // The callback supplied by the caller.
     ExecCallback callback;
 
-    // The ProcessImpl instance managing the child process. Destroying this
-    // will close our end of the pipes we have open.
-    brillo::ProcessImpl proc;
+    // The process id of the child process.
+    pid_t pid{0};
+
+    // Our end of the pipes redirected in the child process, indexed by the file
+    // descriptor they are mapped onto in the child.
+    std::map<int, int> pipes;
 
     // These are used to monitor the stdout of the running process, including
     // the stderr if it was redirected.
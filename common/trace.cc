@@ -0,0 +1,85 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/trace.h"
+
+#ifdef __ANDROID__
+#define ATRACE_TAG ATRACE_TAG_PACKAGE_MANAGER
+#include <cutils/trace.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <base/posix/eintr_wrapper.h>
+#include <base/strings/stringprintf.h>
+#endif  // __ANDROID__
+
+namespace chromeos_update_engine {
+
+#ifdef __ANDROID__
+
+ScopedTrace::ScopedTrace(const char* name) {
+  ATRACE_BEGIN(name);
+}
+
+ScopedTrace::~ScopedTrace() {
+  ATRACE_END();
+}
+
+#else
+
+namespace {
+
+// Returns the trace_marker of ftrace, opened on the first call, or -1 if it
+// is not available.
+int GetTraceMarkerFd() {
+  static const int fd = [] {
+    int fd = HANDLE_EINTR(
+        open("/sys/kernel/tracing/trace_marker", O_WRONLY | O_CLOEXEC));
+    if (fd < 0) {
+      fd = HANDLE_EINTR(open("/sys/kernel/debug/tracing/trace_marker",
+                             O_WRONLY | O_CLOEXEC));
+    }
+    return fd;
+  }();
+  return fd;
+}
+
+// Writes |event| to the trace_marker. Failures are ignored, since the kernel
+// rejects the writes while tracing is off.
+void WriteTraceEvent(const std::string& event) {
+  int fd = GetTraceMarkerFd();
+  if (fd >= 0)
+    ignore_result(HANDLE_EINTR(write(fd, event.data(), event.size())));
+}
+
+}  // namespace
+
+ScopedTrace::ScopedTrace(const char* name) {
+  if (GetTraceMarkerFd() >= 0)
+    WriteTraceEvent(base::StringPrintf("B|%d|%s", getpid(), name));
+}
+
+ScopedTrace::~ScopedTrace() {
+  if (GetTraceMarkerFd() >= 0)
+    WriteTraceEvent(base::StringPrintf("E|%d", getpid()));
+}
+
+#endif  // __ANDROID__
+
+}  // namespace chromeos_update_engine
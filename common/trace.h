@@ -0,0 +1,45 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_COMMON_TRACE_H_
+#define UPDATE_ENGINE_COMMON_TRACE_H_
+
+#include <base/macros.h>
+
+namespace chromeos_update_engine {
+
+// Marks the lifetime of the object as a section named |name| in the
+// system-wide traces, so the work of the update can be correlated with the
+// rest of the system. On Android the sections are atrace events in the "pm"
+// category, recorded by systrace and perfetto. Elsewhere they are written to
+// the ftrace trace_marker, if it is available, in the same format. |name| must
+// outlive the object.
+class ScopedTrace {
+ public:
+  explicit ScopedTrace(const char* name);
+  ~ScopedTrace();
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ScopedTrace);
+};
+
+}  // namespace chromeos_update_engine
+
+// Traces the rest of the current scope as the section |name|.
+#define UE_TRACE_SCOPE(name) \
+  ::chromeos_update_engine::ScopedTrace ue_scoped_trace(name)
+
+#endif  // UPDATE_ENGINE_COMMON_TRACE_H_
@@ -32,6 +32,12 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include <algorithm>
 #include <utility>
 #include <vector>
@@ -435,6 +441,46 @@ off_t FileSize(const string& path) {
   return size;
 }
 
+bool IsZeroBlock(const void* data, size_t size) {
+  // The bytes are OR'ed 64 at a time in vector registers, when available.
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  size_t offset = 0;
+  for (; offset + 64 <= size; offset += 64) {
+    const uint8_t* chunk = bytes + offset;
+#if defined(__SSE2__)
+    auto load = [chunk](int i) {
+      return _mm_loadu_si128(reinterpret_cast<const __m128i*>(chunk) + i);
+    };
+    __m128i bits = _mm_or_si128(_mm_or_si128(load(0), load(1)),
+                                _mm_or_si128(load(2), load(3)));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(bits, _mm_setzero_si128())) !=
+        0xffff) {
+      return false;
+    }
+#elif defined(__ARM_NEON)
+    uint8x16_t low = vorrq_u8(vld1q_u8(chunk), vld1q_u8(chunk + 16));
+    uint8x16_t high = vorrq_u8(vld1q_u8(chunk + 32), vld1q_u8(chunk + 48));
+    uint64x2_t words = vreinterpretq_u64_u8(vorrq_u8(low, high));
+    if (vgetq_lane_u64(words, 0) | vgetq_lane_u64(words, 1))
+      return false;
+#else
+    uint64_t bits = 0;
+    for (size_t i = 0; i < 64; i += 8) {
+      uint64_t word;
+      memcpy(&word, chunk + i, sizeof(word));
+      bits |= word;
+    }
+    if (bits)
+      return false;
+#endif
+  }
+  for (; offset < size; offset++) {
+    if (bytes[offset])
+      return false;
+  }
+  return true;
+}
+
 void HexDumpArray(const uint8_t* const arr, const size_t length) {
   LOG(INFO) << "Logging array of length: " << length;
   const unsigned int bytes_per_line = 16;
@@ -643,6 +689,35 @@ bool SetBlockDeviceReadOnly(const string& device, bool read_only) {
   return true;
 }
 
+string GetFilesystemType(const string& device) {
+  // The squashfs superblock starts the device, and the ext2 one is at 1024.
+  brillo::Blob header;
+  if (!ReadFileChunk(device, 0, 2048, &header) || header.size() < 2048)
+    return "";
+  auto read_le32 = [&header](size_t offset) {
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; i--)
+      value = value << 8 | header[offset + i];
+    return value;
+  };
+  if (read_le32(0) == 0x73717368)  // "hsqs"
+    return "squashfs";
+  const size_t kExt2SuperblockOffset = 1024;
+  if ((read_le32(kExt2SuperblockOffset + 0x38) & 0xffff) != 0xef53)
+    return "";
+  // The ext4 features, other than those of ext2 and ext3, need ext4. The
+  // ext3 ones are only a journal.
+  const uint32_t compat = read_le32(kExt2SuperblockOffset + 0x5c);
+  const uint32_t incompat = read_le32(kExt2SuperblockOffset + 0x60);
+  const uint32_t ro_compat = read_le32(kExt2SuperblockOffset + 0x64);
+  const uint32_t kExt3Incompat = 0x1f;  // COMPRESSION to META_BG.
+  const uint32_t kExt3RoCompat = 0x7;   // SPARSE_SUPER to BTREE_DIR.
+  const uint32_t kHasJournal = 0x4;
+  if ((incompat & ~kExt3Incompat) || (ro_compat & ~kExt3RoCompat))
+    return "ext4";
+  return (compat & kHasJournal) ? "ext3" : "ext2";
+}
+
 bool MountFilesystem(const string& device,
                      const string& mountpoint,
                      unsigned long mountflags,  // NOLINT(runtime/int)
@@ -651,6 +726,12 @@ bool MountFilesystem(const string& device,
   vector<const char*> fstypes;
   if (type.empty()) {
     fstypes = {"ext2", "ext3", "ext4", "squashfs"};
+    // Each failed mount probes the device, so the type of the filesystem is
+    // tried first, and the others only if its driver isn't available.
+    string guessed_type = GetFilesystemType(device);
+    auto it = std::find(fstypes.begin(), fstypes.end(), guessed_type);
+    if (it != fstypes.end())
+      std::rotate(fstypes.begin(), it, it + 1);
   } else {
     fstypes = {type.c_str()};
   }
@@ -1011,7 +1092,7 @@ bool ReadExtents(const string& path,
     bytes_read += bytes_read_this_iteration;
   }
   TEST_AND_RETURN_FALSE(out_data_size == bytes_read);
-  *out_data = data;
+  *out_data = std::move(data);
   return true;
 }
 
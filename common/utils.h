@@ -174,10 +174,16 @@ std::string MakePartitionNameForMount(const std::string& part_name);
 // in |read_only|. Return whether the operation succeeded.
 bool SetBlockDeviceReadOnly(const std::string& device, bool read_only);
 
+// Returns the type of the filesystem on |device|, one of "ext2", "ext3",
+// "ext4" and "squashfs", from the magic number and features in its superblock,
+// or an empty string if it isn't one of those.
+std::string GetFilesystemType(const std::string& device);
+
 // Synchronously mount or unmount a filesystem. Return true on success.
 // When mounting, it will attempt to mount the device as the passed filesystem
 // type |type|, with the passed |flags| options. If |type| is empty, "ext2",
-// "ext3", "ext4" and "squashfs" will be tried.
+// "ext3", "ext4" and "squashfs" will be tried, starting from the type found by
+// GetFilesystemType().
 bool MountFilesystem(const std::string& device,
                      const std::string& mountpoint,
                      unsigned long flags,  // NOLINT(runtime/int)
@@ -212,6 +218,9 @@ std::string ToString(PayloadType payload_type);
 // [value - range / 2, value + range - range / 2]
 int FuzzInt(int value, unsigned int range);
 
+// Returns whether all the |size| bytes at |data| are zero.
+bool IsZeroBlock(const void* data, size_t size);
+
 // Log a string in hex to LOG(INFO). Useful for debugging.
 void HexDumpArray(const uint8_t* const arr, const size_t length);
 inline void HexDumpString(const std::string& str) {
@@ -18,6 +18,7 @@
 
 #include <fcntl.h>
 #include <stdint.h>
+#include <string.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -425,6 +426,34 @@ TEST(UtilsTest, RunAsRootUnmountFilesystemFailureTest) {
   EXPECT_FALSE(utils::UnmountFilesystem("/path/to/non-existing-dir"));
 }
 
+TEST(UtilsTest, GetFilesystemTypeTest) {
+  EXPECT_EQ("ext2",
+            utils::GetFilesystemType(
+                test_utils::GetBuildArtifactsPath("gen/disk_ext2_4k.img")));
+  EXPECT_EQ("", utils::GetFilesystemType("/path/to/non-existing-file"));
+
+  test_utils::ScopedTempFile file("fs.XXXXXX");
+  brillo::Blob superblock(4096, 0);
+  auto check_type = [&](const string& type) {
+    EXPECT_TRUE(test_utils::WriteFileVector(file.path(), superblock));
+    EXPECT_EQ(type, utils::GetFilesystemType(file.path()));
+  };
+  check_type("");
+  superblock[1024 + 0x38] = 0x53;
+  superblock[1024 + 0x39] = 0xef;
+  check_type("ext2");
+  // A journal.
+  superblock[1024 + 0x5c] = 0x4;
+  check_type("ext3");
+  // Extents.
+  superblock[1024 + 0x60] = 0x40;
+  check_type("ext4");
+
+  superblock.assign(4096, 0);
+  memcpy(superblock.data(), "hsqs", 4);
+  check_type("squashfs");
+}
+
 TEST(UtilsTest, RunAsRootUnmountFilesystemBusyFailureTest) {
   test_utils::ScopedTempFile tmp_image("img.XXXXXX");
 
@@ -470,6 +499,20 @@ TEST(UtilsTest, IsMountpointTest) {
   EXPECT_FALSE(utils::IsMountpoint(file.path()));
 }
 
+TEST(UtilsTest, IsZeroBlockTest) {
+  brillo::Blob data(4096 + 3, 0);
+  EXPECT_TRUE(utils::IsZeroBlock(data.data(), data.size()));
+  EXPECT_TRUE(utils::IsZeroBlock(data.data(), 0));
+  // A byte set in the vectorized part or in the tail is found.
+  data[100] = 1;
+  EXPECT_FALSE(utils::IsZeroBlock(data.data(), data.size()));
+  EXPECT_TRUE(utils::IsZeroBlock(data.data(), 100));
+  data[100] = 0;
+  data[4096 + 2] = 0x80;
+  EXPECT_FALSE(utils::IsZeroBlock(data.data(), data.size()));
+  EXPECT_TRUE(utils::IsZeroBlock(data.data() + 1, data.size() - 2));
+}
+
 TEST(UtilsTest, VersionPrefix) {
   EXPECT_EQ(10575, utils::VersionPrefix("10575.39."));
   EXPECT_EQ(10575, utils::VersionPrefix("10575.39"));
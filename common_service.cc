@@ -363,6 +363,39 @@ bool UpdateEngineService::GetUpdateOverCellularPermission(ErrorPtr* error,
   return true;
 }
 
+bool UpdateEngineService::SetDownloadRateLimit(ErrorPtr* error,
+                                               int64_t in_rate_bps) {
+  if (in_rate_bps < 0) {
+    LogAndSetError(error,
+                   FROM_HERE,
+                   "Invalid download rate limit " +
+                       std::to_string(in_rate_bps) + ".");
+    return false;
+  }
+  PrefsInterface* prefs = system_state_->prefs();
+  if (!prefs->SetInt64(kPrefsDownloadRateLimitBps, in_rate_bps)) {
+    LogAndSetError(error, FROM_HERE, "Error setting the download rate limit.");
+    return false;
+  }
+  system_state_->update_attempter()->UpdateDownloadRateLimit();
+  return true;
+}
+
+bool UpdateEngineService::GetDownloadRateLimit(ErrorPtr* error,
+                                               int64_t* out_rate_bps) {
+  PrefsInterface* prefs = system_state_->prefs();
+
+  int64_t rate_bps = 0;  // Default if no setting is present.
+  if (prefs->Exists(kPrefsDownloadRateLimitBps) &&
+      !prefs->GetInt64(kPrefsDownloadRateLimitBps, &rate_bps)) {
+    LogAndSetError(error, FROM_HERE, "Error getting the download rate limit.");
+    return false;
+  }
+
+  *out_rate_bps = rate_bps;
+  return true;
+}
+
 bool UpdateEngineService::GetDurationSinceUpdate(ErrorPtr* error,
                                                  int64_t* out_usec_wallclock) {
   base::Time time;
@@ -428,4 +461,10 @@ bool UpdateEngineService::GetEolStatus(ErrorPtr* error,
   return true;
 }
 
+bool UpdateEngineService::GetPerfStats(ErrorPtr* /* error */,
+                                       string* out_perf_stats) {
+  *out_perf_stats = system_state_->update_attempter()->GetPerfStats();
+  return true;
+}
+
 }  // namespace chromeos_update_engine
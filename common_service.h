@@ -134,6 +134,15 @@ class UpdateEngineService {
   bool GetUpdateOverCellularPermission(brillo::ErrorPtr* error,
                                        bool* out_allowed);
 
+  // Sets the maximum rate of the non-interactive downloads to |in_rate_bps|
+  // bytes per second, or removes the limit if it is 0. The new limit applies
+  // to the download in progress.
+  bool SetDownloadRateLimit(brillo::ErrorPtr* error, int64_t in_rate_bps);
+
+  // Returns the maximum rate of the non-interactive downloads in bytes per
+  // second, or 0 if it's not limited.
+  bool GetDownloadRateLimit(brillo::ErrorPtr* error, int64_t* out_rate_bps);
+
   // Returns the duration since the last successful update, as the
   // duration on the wallclock. Returns an error if the device has not
   // updated.
@@ -157,6 +166,9 @@ class UpdateEngineService {
   // on every update check and persisted on disk across reboots.
   bool GetEolStatus(brillo::ErrorPtr* error, int32_t* out_eol_status);
 
+  // Returns the performance statistics of the update_engine as JSON.
+  bool GetPerfStats(brillo::ErrorPtr* error, std::string* out_perf_stats);
+
  private:
   SystemState* system_state_;
 };
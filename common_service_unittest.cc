@@ -184,4 +184,33 @@ TEST_F(UpdateEngineServiceTest, GetEolStatusTest) {
   EXPECT_EQ(EolStatus::kSecurityOnly, static_cast<EolStatus>(eol_status));
 }
 
+TEST_F(UpdateEngineServiceTest, GetPerfStatsTest) {
+  EXPECT_CALL(*mock_update_attempter_, GetPerfStats())
+      .WillOnce(Return("{\"rss_bytes\": 1024.0}"));
+  string perf_stats;
+  EXPECT_TRUE(common_service_.GetPerfStats(&error_, &perf_stats));
+  EXPECT_EQ(nullptr, error_);
+  EXPECT_EQ("{\"rss_bytes\": 1024.0}", perf_stats);
+}
+
+TEST_F(UpdateEngineServiceTest, DownloadRateLimitTest) {
+  FakePrefs fake_prefs;
+  fake_system_state_.set_prefs(&fake_prefs);
+  // The downloads are not limited by default.
+  int64_t rate_bps = -1;
+  EXPECT_TRUE(common_service_.GetDownloadRateLimit(&error_, &rate_bps));
+  EXPECT_EQ(nullptr, error_);
+  EXPECT_EQ(0, rate_bps);
+
+  EXPECT_TRUE(common_service_.SetDownloadRateLimit(&error_, 100000));
+  EXPECT_EQ(nullptr, error_);
+  EXPECT_TRUE(common_service_.GetDownloadRateLimit(&error_, &rate_bps));
+  EXPECT_EQ(100000, rate_bps);
+
+  EXPECT_FALSE(common_service_.SetDownloadRateLimit(&error_, -1));
+  ASSERT_NE(nullptr, error_);
+  EXPECT_TRUE(error_->HasError(UpdateEngineService::kErrorDomain,
+                               UpdateEngineService::kErrorFailed));
+}
+
 }  // namespace chromeos_update_engine
@@ -24,17 +24,12 @@
 #include <base/strings/string_util.h>
 #include <policy/device_policy.h>
 #include <shill/dbus-constants.h>
-#include <shill/dbus-proxies.h>
 
 #include "update_engine/common/prefs.h"
 #include "update_engine/common/utils.h"
-#include "update_engine/connection_utils.h"
-#include "update_engine/shill_proxy.h"
 #include "update_engine/system_state.h"
 #include "update_engine/update_attempter.h"
 
-using org::chromium::flimflam::ManagerProxyInterface;
-using org::chromium::flimflam::ServiceProxyInterface;
 using std::set;
 using std::string;
 
@@ -43,14 +38,17 @@ namespace chromeos_update_engine {
 namespace connection_manager {
 std::unique_ptr<ConnectionManagerInterface> CreateConnectionManager(
     SystemState* system_state) {
+  ShillConnectionCache* shill_cache = ShillConnectionCache::Get();
+  if (!shill_cache->Init())
+    LOG(WARNING) << "Reading the connection properties from shill each time.";
   return std::unique_ptr<ConnectionManagerInterface>(
-      new ConnectionManager(new ShillProxy(), system_state));
+      new ConnectionManager(shill_cache, system_state));
 }
 }  // namespace connection_manager
 
-ConnectionManager::ConnectionManager(ShillProxyInterface* shill_proxy,
+ConnectionManager::ConnectionManager(ShillConnectionCache* shill_cache,
                                      SystemState* system_state)
-    : shill_proxy_(shill_proxy), system_state_(system_state) {}
+    : shill_cache_(shill_cache), system_state_(system_state) {}
 
 bool ConnectionManager::IsUpdateAllowedOver(
     ConnectionType type, ConnectionTethering tethering) const {
@@ -133,87 +131,20 @@ bool ConnectionManager::IsAllowedConnectionTypesForUpdateSet() const {
 
 bool ConnectionManager::GetConnectionProperties(
     ConnectionType* out_type, ConnectionTethering* out_tethering) {
-  dbus::ObjectPath default_service_path;
-  TEST_AND_RETURN_FALSE(GetDefaultServicePath(&default_service_path));
-  if (!default_service_path.IsValid())
+  // The cached properties are only read from shill when the signals can't
+  // have updated them yet.
+  if (!shill_cache_->initialized() || !shill_cache_->default_service_known())
+    TEST_AND_RETURN_FALSE(shill_cache_->Refresh());
+  if (!shill_cache_->default_service_path().IsValid())
     return false;
   // Shill uses the "/" service path to indicate that it is not connected.
-  if (default_service_path.value() == "/") {
+  if (!shill_cache_->is_connected()) {
     *out_type = ConnectionType::kDisconnected;
     *out_tethering = ConnectionTethering::kUnknown;
     return true;
   }
-  TEST_AND_RETURN_FALSE(
-      GetServicePathProperties(default_service_path, out_type, out_tethering));
-  return true;
-}
-
-bool ConnectionManager::GetDefaultServicePath(dbus::ObjectPath* out_path) {
-  brillo::VariantDictionary properties;
-  brillo::ErrorPtr error;
-  ManagerProxyInterface* manager_proxy = shill_proxy_->GetManagerProxy();
-  if (!manager_proxy)
-    return false;
-  TEST_AND_RETURN_FALSE(manager_proxy->GetProperties(&properties, &error));
-
-  const auto& prop_default_service =
-      properties.find(shill::kDefaultServiceProperty);
-  if (prop_default_service == properties.end())
-    return false;
-
-  *out_path = prop_default_service->second.TryGet<dbus::ObjectPath>();
-  return out_path->IsValid();
-}
-
-bool ConnectionManager::GetServicePathProperties(
-    const dbus::ObjectPath& path,
-    ConnectionType* out_type,
-    ConnectionTethering* out_tethering) {
-  // We create and dispose the ServiceProxyInterface on every request.
-  std::unique_ptr<ServiceProxyInterface> service =
-      shill_proxy_->GetServiceForPath(path);
-
-  brillo::VariantDictionary properties;
-  brillo::ErrorPtr error;
-  TEST_AND_RETURN_FALSE(service->GetProperties(&properties, &error));
-
-  // Populate the out_tethering.
-  const auto& prop_tethering = properties.find(shill::kTetheringProperty);
-  if (prop_tethering == properties.end()) {
-    // Set to Unknown if not present.
-    *out_tethering = ConnectionTethering::kUnknown;
-  } else {
-    // If the property doesn't contain a string value, the empty string will
-    // become kUnknown.
-    *out_tethering = connection_utils::ParseConnectionTethering(
-        prop_tethering->second.TryGet<string>());
-  }
-
-  // Populate the out_type property.
-  const auto& prop_type = properties.find(shill::kTypeProperty);
-  if (prop_type == properties.end()) {
-    // Set to Unknown if not present.
-    *out_type = ConnectionType::kUnknown;
-    return false;
-  }
-
-  string type_str = prop_type->second.TryGet<string>();
-  if (type_str == shill::kTypeVPN) {
-    const auto& prop_physical =
-        properties.find(shill::kPhysicalTechnologyProperty);
-    if (prop_physical == properties.end()) {
-      LOG(ERROR) << "No PhysicalTechnology property found for a VPN"
-                    " connection (service: "
-                 << path.value() << "). Returning default kUnknown value.";
-      *out_type = ConnectionType::kUnknown;
-    } else {
-      *out_type = connection_utils::ParseConnectionType(
-          prop_physical->second.TryGet<string>());
-    }
-  } else {
-    *out_type = connection_utils::ParseConnectionType(type_str);
-  }
-  return true;
+  shill_cache_->GetConnectionTethering(out_tethering);
+  return shill_cache_->GetConnectionType(out_type);
 }
 
 }  // namespace chromeos_update_engine
@@ -17,25 +17,21 @@
 #ifndef UPDATE_ENGINE_CONNECTION_MANAGER_H_
 #define UPDATE_ENGINE_CONNECTION_MANAGER_H_
 
-#include <memory>
-#include <string>
-
 #include <base/macros.h>
-#include <dbus/object_path.h>
 
 #include "update_engine/connection_manager_interface.h"
-#include "update_engine/shill_proxy_interface.h"
+#include "update_engine/shill_connection_cache.h"
 
 namespace chromeos_update_engine {
 
-// This class implements the concrete class that talks with the connection
-// manager (shill) over DBus.
+// This class implements the concrete class that gets the connection properties
+// from the connection manager (shill) through the ShillConnectionCache.
 // TODO(deymo): Remove this class and use ShillProvider from the UpdateManager.
 class ConnectionManager : public ConnectionManagerInterface {
  public:
   // Constructs a new ConnectionManager object initialized with the
-  // given system state.
-  ConnectionManager(ShillProxyInterface* shill_proxy,
+  // given system state. The |shill_cache| must outlive this object.
+  ConnectionManager(ShillConnectionCache* shill_cache,
                     SystemState* system_state);
   ~ConnectionManager() override = default;
 
@@ -47,16 +43,8 @@ class ConnectionManager : public ConnectionManagerInterface {
   bool IsAllowedConnectionTypesForUpdateSet() const override;
 
  private:
-  // Returns (via out_path) the default network path, or "/" if there's no
-  // network up. Returns true on success.
-  bool GetDefaultServicePath(dbus::ObjectPath* out_path);
-
-  bool GetServicePathProperties(const dbus::ObjectPath& path,
-                                ConnectionType* out_type,
-                                ConnectionTethering* out_tethering);
-
-  // The mockable interface to access the shill DBus proxies.
-  std::unique_ptr<ShillProxyInterface> shill_proxy_;
+  // The properties of the default service of shill.
+  ShillConnectionCache* shill_cache_;
 
   // The global context for update_engine.
   SystemState* system_state_;
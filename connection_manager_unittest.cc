@@ -32,6 +32,7 @@
 #include <shill/dbus-proxy-mocks.h>
 
 #include "update_engine/common/test_utils.h"
+#include "update_engine/dbus_test_utils.h"
 #include "update_engine/fake_shill_proxy.h"
 #include "update_engine/fake_system_state.h"
 
@@ -66,10 +67,11 @@ class ConnectionManagerTest : public ::testing::Test {
   // properties in the mocked service |service_path|. If any of the three
   // const char* is a nullptr, the corresponding property will not be included
   // in the response.
-  void SetServiceReply(const string& service_path,
-                       const char* service_type,
-                       const char* physical_technology,
-                       const char* service_tethering);
+  // Returns the mock object pointer, owned by the |fake_shill_proxy_|.
+  ServiceProxyMock* SetServiceReply(const string& service_path,
+                                    const char* service_type,
+                                    const char* physical_technology,
+                                    const char* service_tethering);
 
   void TestWithServiceType(const char* service_type,
                            const char* physical_technology,
@@ -83,9 +85,10 @@ class ConnectionManagerTest : public ::testing::Test {
   brillo::FakeMessageLoop loop_{nullptr};
   FakeSystemState fake_system_state_;
   FakeShillProxy* fake_shill_proxy_;
+  ShillConnectionCache shill_cache_{fake_shill_proxy_};
 
   // ConnectionManager under test.
-  ConnectionManager cmut_{fake_shill_proxy_, &fake_system_state_};
+  ConnectionManager cmut_{&shill_cache_, &fake_system_state_};
 };
 
 void ConnectionManagerTest::SetManagerReply(const char* default_service,
@@ -110,10 +113,11 @@ void ConnectionManagerTest::SetManagerReply(const char* default_service,
       .WillOnce(DoAll(SetArgPointee<0>(reply_dict), Return(true)));
 }
 
-void ConnectionManagerTest::SetServiceReply(const string& service_path,
-                                            const char* service_type,
-                                            const char* physical_technology,
-                                            const char* service_tethering) {
+ServiceProxyMock* ConnectionManagerTest::SetServiceReply(
+    const string& service_path,
+    const char* service_type,
+    const char* physical_technology,
+    const char* service_tethering) {
   brillo::VariantDictionary reply_dict;
   reply_dict["SomeOtherProperty"] = 0xC0FFEE;
 
@@ -134,8 +138,10 @@ void ConnectionManagerTest::SetServiceReply(const string& service_path,
   EXPECT_CALL(*service_proxy_mock.get(), GetProperties(_, _, _))
       .WillOnce(DoAll(SetArgPointee<0>(reply_dict), Return(true)));
 
+  ServiceProxyMock* result = service_proxy_mock.get();
   fake_shill_proxy_->SetServiceForPath(dbus::ObjectPath(service_path),
                                        std::move(service_proxy_mock));
+  return result;
 }
 
 void ConnectionManagerTest::TestWithServiceType(const char* service_type,
@@ -382,4 +388,50 @@ TEST_F(ConnectionManagerTest, MalformedServiceList) {
   EXPECT_FALSE(cmut_.GetConnectionProperties(&type, &tethering));
 }
 
+TEST_F(ConnectionManagerTest, CachedPropertiesTest) {
+  ManagerProxyMock* manager_proxy_mock = fake_shill_proxy_->GetManagerProxy();
+  dbus_test_utils::MockSignalHandler<void(const string&, const brillo::Any&)>
+      manager_property_changed;
+  dbus_test_utils::MockSignalHandler<void(const string&, const brillo::Any&)>
+      service_property_changed;
+  MOCK_SIGNAL_HANDLER_EXPECT_SIGNAL_HANDLER(manager_property_changed,
+                                            *manager_proxy_mock,
+                                            PropertyChanged);
+  SetManagerReply("/service/guest/network", true);
+  ServiceProxyMock* service_proxy_mock =
+      SetServiceReply("/service/guest/network",
+                      shill::kTypeWifi,
+                      nullptr,
+                      shill::kTetheringNotDetectedState);
+  MOCK_SIGNAL_HANDLER_EXPECT_SIGNAL_HANDLER(
+      service_property_changed, *service_proxy_mock, PropertyChanged);
+  EXPECT_TRUE(shill_cache_.Init());
+  while (loop_.RunOnce(false)) {
+  }
+
+  // The properties are only read from shill once.
+  ConnectionType type;
+  ConnectionTethering tethering;
+  for (int i = 0; i < 2; i++) {
+    EXPECT_TRUE(cmut_.GetConnectionProperties(&type, &tethering));
+    EXPECT_EQ(ConnectionType::kWifi, type);
+    EXPECT_EQ(ConnectionTethering::kNotDetected, tethering);
+  }
+
+  // The signals of the default service update them.
+  ASSERT_TRUE(service_property_changed.IsHandlerRegistered());
+  service_property_changed.signal_callback().Run(
+      shill::kTetheringProperty,
+      brillo::Any(string(shill::kTetheringConfirmedState)));
+  EXPECT_TRUE(cmut_.GetConnectionProperties(&type, &tethering));
+  EXPECT_EQ(ConnectionTethering::kConfirmed, tethering);
+
+  // And the ones of the manager change the default service.
+  ASSERT_TRUE(manager_property_changed.IsHandlerRegistered());
+  manager_property_changed.signal_callback().Run(
+      shill::kDefaultServiceProperty, dbus::ObjectPath("/"));
+  EXPECT_TRUE(cmut_.GetConnectionProperties(&type, &tethering));
+  EXPECT_EQ(ConnectionType::kDisconnected, type);
+}
+
 }  // namespace chromeos_update_engine
@@ -0,0 +1,90 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/connection_prewarmer.h"
+
+#include <utility>
+
+#include <base/logging.h>
+#include <base/strings/string_util.h>
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+ConnectionPrewarmer::ConnectionPrewarmer(const FetcherFactory& fetcher_factory)
+    : fetcher_factory_(fetcher_factory) {}
+
+void ConnectionPrewarmer::Prewarm(const string& url) {
+  string server_url = GetServerUrl(url);
+  if (server_url.empty() || fetchers_.count(server_url))
+    return;
+  std::unique_ptr<HttpFetcher> fetcher = fetcher_factory_.Run();
+  if (!fetcher)
+    return;
+  LOG(INFO) << "Prewarming the connection to " << server_url;
+  HttpFetcher* fetcher_ptr = fetcher.get();
+  fetcher_ptr->set_delegate(this);
+  fetchers_[server_url] = std::move(fetcher);
+  fetcher_ptr->BeginTransfer(server_url);
+}
+
+bool ConnectionPrewarmer::IsPrewarming(const string& url) const {
+  return fetchers_.count(GetServerUrl(url)) > 0;
+}
+
+// static
+string ConnectionPrewarmer::GetServerUrl(const string& url) {
+  size_t scheme_end = url.find("://");
+  if (scheme_end == string::npos)
+    return "";
+  string scheme = base::ToLowerASCII(url.substr(0, scheme_end));
+  if (scheme != "http" && scheme != "https")
+    return "";
+  size_t host_start = scheme_end + 3;
+  size_t host_end = url.find_first_of("/?#", host_start);
+  string host = url.substr(host_start, host_end - host_start);
+  // The user info, if any, is not part of the server.
+  size_t at = host.rfind('@');
+  if (at != string::npos)
+    host = host.substr(at + 1);
+  if (host.empty())
+    return "";
+  return scheme + "://" + base::ToLowerASCII(host) + "/";
+}
+
+bool ConnectionPrewarmer::ReceivedBytes(HttpFetcher* fetcher,
+                                        const void* bytes,
+                                        size_t length) {
+  // Only the connection matters, the response is dropped.
+  return true;
+}
+
+void ConnectionPrewarmer::TransferComplete(HttpFetcher* fetcher,
+                                           bool successful) {
+  // Any response, even an error, leaves the connection set up. The fetcher
+  // may be destroyed in this callback.
+  for (auto it = fetchers_.begin(); it != fetchers_.end(); ++it) {
+    if (it->second.get() == fetcher) {
+      LOG(INFO) << "Prewarmed the connection to " << it->first;
+      fetchers_.erase(it);
+      return;
+    }
+  }
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,76 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_CONNECTION_PREWARMER_H_
+#define UPDATE_ENGINE_CONNECTION_PREWARMER_H_
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include <base/callback.h>
+#include <base/macros.h>
+
+#include "update_engine/common/http_fetcher.h"
+
+namespace chromeos_update_engine {
+
+// ConnectionPrewarmer resolves the name of a server and sets up the TCP and
+// TLS connection to it ahead of the transfers that need it, by sending it a
+// request that is otherwise ignored. The fetchers share their DNS cache, TLS
+// sessions and connections, so the following transfers to the same server
+// skip these round trips.
+class ConnectionPrewarmer : public HttpFetcherDelegate {
+ public:
+  // Creates the fetchers sending the prewarming requests, which should only
+  // ask for the headers of the response.
+  using FetcherFactory = base::Callback<std::unique_ptr<HttpFetcher>()>;
+
+  explicit ConnectionPrewarmer(const FetcherFactory& fetcher_factory);
+  ~ConnectionPrewarmer() override = default;
+
+  // Starts connecting to the server of |url| in the background. Does nothing
+  // if |url| is not an HTTP or HTTPS URL, or if the server is being
+  // prewarmed already.
+  void Prewarm(const std::string& url);
+
+  // Returns whether the server of |url| is being prewarmed.
+  bool IsPrewarming(const std::string& url) const;
+
+  // Returns the root URL of the server of |url|, such as
+  // "https://example.com/", or the empty string if |url| is not an HTTP or
+  // HTTPS URL.
+  static std::string GetServerUrl(const std::string& url);
+
+  // HttpFetcherDelegate overrides.
+  bool ReceivedBytes(HttpFetcher* fetcher,
+                     const void* bytes,
+                     size_t length) override;
+  void TransferComplete(HttpFetcher* fetcher, bool successful) override;
+
+ private:
+  FetcherFactory fetcher_factory_;
+
+  // The fetchers of the servers being prewarmed, by their root URL.
+  std::map<std::string, std::unique_ptr<HttpFetcher>> fetchers_;
+
+  DISALLOW_COPY_AND_ASSIGN(ConnectionPrewarmer);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_CONNECTION_PREWARMER_H_
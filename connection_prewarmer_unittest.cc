@@ -0,0 +1,93 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/connection_prewarmer.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/bind.h>
+#include <brillo/message_loops/fake_message_loop.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/mock_http_fetcher.h"
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+class ConnectionPrewarmerTest : public ::testing::Test {
+ protected:
+  void SetUp() override { loop_.SetAsCurrent(); }
+
+  void TearDown() override {
+    // Complete the pending requests before the fetchers are destroyed.
+    while (loop_.RunOnce(false)) {
+    }
+  }
+
+  std::unique_ptr<HttpFetcher> CreateFetcher() {
+    created_fetchers_++;
+    return std::make_unique<MockHttpFetcher>("x", 1, nullptr);
+  }
+
+  brillo::FakeMessageLoop loop_{nullptr};
+  int created_fetchers_{0};
+  ConnectionPrewarmer prewarmer_{base::Bind(
+      &ConnectionPrewarmerTest::CreateFetcher, base::Unretained(this))};
+};
+
+TEST_F(ConnectionPrewarmerTest, GetServerUrlTest) {
+  EXPECT_EQ("https://example.com/",
+            ConnectionPrewarmer::GetServerUrl("https://example.com"));
+  EXPECT_EQ("http://example.com:8080/",
+            ConnectionPrewarmer::GetServerUrl(
+                "HTTP://Example.com:8080/path/payload.bin?a=b"));
+  EXPECT_EQ("https://example.com/",
+            ConnectionPrewarmer::GetServerUrl("https://user@example.com/"));
+  EXPECT_EQ("", ConnectionPrewarmer::GetServerUrl("file:///tmp/payload"));
+  EXPECT_EQ("", ConnectionPrewarmer::GetServerUrl("https:///payload"));
+  EXPECT_EQ("", ConnectionPrewarmer::GetServerUrl("example.com"));
+}
+
+TEST_F(ConnectionPrewarmerTest, PrewarmsEachServerOnceTest) {
+  prewarmer_.Prewarm("https://example.com/service/update2");
+  prewarmer_.Prewarm("https://example.com/payload.bin");
+  prewarmer_.Prewarm("https://dl.example.com/payload.bin");
+  EXPECT_EQ(2, created_fetchers_);
+  EXPECT_TRUE(prewarmer_.IsPrewarming("https://example.com/other"));
+  EXPECT_TRUE(prewarmer_.IsPrewarming("https://dl.example.com/"));
+  EXPECT_FALSE(prewarmer_.IsPrewarming("http://example.com/"));
+}
+
+TEST_F(ConnectionPrewarmerTest, PrewarmsAgainOnceCompletedTest) {
+  prewarmer_.Prewarm("https://example.com/");
+  while (loop_.RunOnce(false)) {
+  }
+  EXPECT_FALSE(prewarmer_.IsPrewarming("https://example.com/"));
+  prewarmer_.Prewarm("https://example.com/");
+  EXPECT_EQ(2, created_fetchers_);
+}
+
+TEST_F(ConnectionPrewarmerTest, IgnoresOtherSchemesTest) {
+  prewarmer_.Prewarm("file:///var/cache/payload");
+  prewarmer_.Prewarm("");
+  EXPECT_EQ(0, created_fetchers_);
+}
+
+}  // namespace chromeos_update_engine
@@ -117,6 +117,33 @@ bool DBusUpdateEngineService::GetStatus(ErrorPtr* error,
   return true;
 }
 
+bool DBusUpdateEngineService::GetStatusAdvanced(
+    ErrorPtr* error,
+    int64_t* out_last_checked_time,
+    double* out_progress,
+    string* out_current_operation,
+    string* out_new_version,
+    int64_t* out_new_size,
+    double* out_download_bytes_per_second,
+    int64_t* out_seconds_left,
+    int64_t* out_phase_bytes_read,
+    int64_t* out_phase_bytes_written) {
+  UpdateEngineStatus status;
+  if (!common_->GetStatus(error, &status)) {
+    return false;
+  }
+  *out_last_checked_time = status.last_checked_time;
+  *out_progress = status.progress;
+  *out_current_operation = UpdateStatusToString(status.status);
+  *out_new_version = status.new_version;
+  *out_new_size = status.new_size_bytes;
+  *out_download_bytes_per_second = status.download_bytes_per_second;
+  *out_seconds_left = status.seconds_left;
+  *out_phase_bytes_read = status.phase_bytes_read;
+  *out_phase_bytes_written = status.phase_bytes_written;
+  return true;
+}
+
 bool DBusUpdateEngineService::RebootIfNeeded(ErrorPtr* error) {
   return common_->RebootIfNeeded(error);
 }
@@ -171,6 +198,16 @@ bool DBusUpdateEngineService::GetUpdateOverCellularPermission(
   return common_->GetUpdateOverCellularPermission(error, out_allowed);
 }
 
+bool DBusUpdateEngineService::SetDownloadRateLimit(ErrorPtr* error,
+                                                   int64_t in_rate_bps) {
+  return common_->SetDownloadRateLimit(error, in_rate_bps);
+}
+
+bool DBusUpdateEngineService::GetDownloadRateLimit(ErrorPtr* error,
+                                                   int64_t* out_rate_bps) {
+  return common_->GetDownloadRateLimit(error, out_rate_bps);
+}
+
 bool DBusUpdateEngineService::GetDurationSinceUpdate(
     ErrorPtr* error, int64_t* out_usec_wallclock) {
   return common_->GetDurationSinceUpdate(error, out_usec_wallclock);
@@ -196,6 +233,11 @@ bool DBusUpdateEngineService::GetEolStatus(ErrorPtr* error,
   return common_->GetEolStatus(error, out_eol_status);
 }
 
+bool DBusUpdateEngineService::GetPerfStats(ErrorPtr* error,
+                                           string* out_perf_stats) {
+  return common_->GetPerfStats(error, out_perf_stats);
+}
+
 UpdateEngineAdaptor::UpdateEngineAdaptor(SystemState* system_state)
     : org::chromium::UpdateEngineInterfaceAdaptor(&dbus_service_),
       bus_(DBusConnection::Get()->GetDBus()),
@@ -72,6 +72,20 @@ class DBusUpdateEngineService
                  std::string* out_new_version,
                  int64_t* out_new_size) override;
 
+  // Same as GetStatus(), along with the current download rate and the time
+  // left in the current operation, estimated from the recent progress, and
+  // the bytes read and written during the current operation.
+  bool GetStatusAdvanced(brillo::ErrorPtr* error,
+                         int64_t* out_last_checked_time,
+                         double* out_progress,
+                         std::string* out_current_operation,
+                         std::string* out_new_version,
+                         int64_t* out_new_size,
+                         double* out_download_bytes_per_second,
+                         int64_t* out_seconds_left,
+                         int64_t* out_phase_bytes_read,
+                         int64_t* out_phase_bytes_written) override;
+
   // Reboots the device if an update is applied and a reboot is required.
   bool RebootIfNeeded(brillo::ErrorPtr* error) override;
 
@@ -129,6 +143,16 @@ class DBusUpdateEngineService
   bool GetUpdateOverCellularPermission(brillo::ErrorPtr* error,
                                        bool* out_allowed) override;
 
+  // Sets the maximum rate of the non-interactive downloads in bytes per
+  // second, 0 for no limit.
+  bool SetDownloadRateLimit(brillo::ErrorPtr* error,
+                            int64_t in_rate_bps) override;
+
+  // Returns the maximum rate of the non-interactive downloads in bytes per
+  // second, or 0 if it's not limited.
+  bool GetDownloadRateLimit(brillo::ErrorPtr* error,
+                            int64_t* out_rate_bps) override;
+
   // Returns the duration since the last successful update, as the
   // duration on the wallclock. Returns an error if the device has not
   // updated.
@@ -153,6 +177,11 @@ class DBusUpdateEngineService
   // Returns the current end-of-life status of the device in |out_eol_status|.
   bool GetEolStatus(brillo::ErrorPtr* error, int32_t* out_eol_status) override;
 
+  // Returns the performance statistics of the update_engine as JSON in
+  // |out_perf_stats|.
+  bool GetPerfStats(brillo::ErrorPtr* error,
+                    std::string* out_perf_stats) override;
+
  private:
   std::unique_ptr<UpdateEngineService> common_;
 };
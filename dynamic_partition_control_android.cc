@@ -16,14 +16,19 @@
 
 #include "update_engine/dynamic_partition_control_android.h"
 
+#include <string.h>
+
 #include <memory>
 #include <set>
 #include <string>
+#include <vector>
 
 #include <android-base/properties.h>
 #include <android-base/strings.h>
 #include <base/files/file_util.h>
 #include <base/logging.h>
+#include <base/threading/platform_thread.h>
+#include <base/time/time.h>
 #include <bootloader_message/bootloader_message.h>
 #include <fs_mgr_dm_linear.h>
 
@@ -36,15 +41,46 @@ using android::dm::DeviceMapper;
 using android::dm::DmDeviceState;
 using android::fs_mgr::CreateLogicalPartition;
 using android::fs_mgr::DestroyLogicalPartition;
+using android::fs_mgr::LpMetadata;
 using android::fs_mgr::MetadataBuilder;
 using android::fs_mgr::PartitionOpener;
+using android::fs_mgr::ReadMetadata;
 
 namespace chromeos_update_engine {
 
+namespace {
+
+// Returns whether the tables |a| and |b| of the metadata have the same
+// entries. The entries are packed on-disk structures, so they are compared
+// byte by byte.
+template <typename T>
+bool MetadataTablesEqual(const std::vector<T>& a, const std::vector<T>& b) {
+  return a.size() == b.size() &&
+         (a.empty() || memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+
+// Returns whether writing |metadata| would not change the layout described by
+// |current|: the same partitions, extents, groups and block devices, in the
+// same metadata format version.
+bool MetadataLayoutEqual(const LpMetadata& current,
+                         const LpMetadata& metadata) {
+  return current.header.major_version == metadata.header.major_version &&
+         current.header.minor_version == metadata.header.minor_version &&
+         MetadataTablesEqual(current.partitions, metadata.partitions) &&
+         MetadataTablesEqual(current.extents, metadata.extents) &&
+         MetadataTablesEqual(current.groups, metadata.groups) &&
+         MetadataTablesEqual(current.block_devices, metadata.block_devices);
+}
+
+}  // namespace
+
 constexpr char kUseDynamicPartitions[] = "ro.boot.dynamic_partitions";
 constexpr char kRetrfoitDynamicPartitions[] =
     "ro.boot.dynamic_partitions_retrofit";
 constexpr uint64_t kMapTimeoutMillis = 1000;
+// The interval between the checks for the device nodes of the partitions
+// mapped by MapPartitionsOnDeviceMapper().
+constexpr uint64_t kMapPollMillis = 5;
 
 DynamicPartitionControlAndroid::~DynamicPartitionControlAndroid() {
   CleanupInternal(false /* wait */);
@@ -63,12 +99,13 @@ bool DynamicPartitionControlAndroid::MapPartitionInternal(
     const std::string& target_partition_name,
     uint32_t slot,
     bool force_writable,
+    std::chrono::milliseconds timeout,
     std::string* path) {
   if (!CreateLogicalPartition(super_device.c_str(),
                               slot,
                               target_partition_name,
                               force_writable,
-                              std::chrono::milliseconds(kMapTimeoutMillis),
+                              timeout,
                               path)) {
     LOG(ERROR) << "Cannot map " << target_partition_name << " in "
                << super_device << " on device mapper.";
@@ -87,6 +124,71 @@ bool DynamicPartitionControlAndroid::MapPartitionOnDeviceMapper(
     uint32_t slot,
     bool force_writable,
     std::string* path) {
+  return MapPartition(super_device,
+                      target_partition_name,
+                      slot,
+                      force_writable,
+                      std::chrono::milliseconds(kMapTimeoutMillis),
+                      path);
+}
+
+bool DynamicPartitionControlAndroid::MapPartitionsOnDeviceMapper(
+    const std::string& super_device,
+    const std::vector<std::string>& target_partition_names,
+    uint32_t slot,
+    bool force_writable,
+    std::vector<std::string>* paths) {
+  // Create all the devices without waiting for their device nodes, so udev
+  // creates all of them at the same time.
+  paths->clear();
+  for (const auto& partition_name : target_partition_names) {
+    std::string path;
+    if (!MapPartition(super_device,
+                      partition_name,
+                      slot,
+                      force_writable,
+                      std::chrono::milliseconds(0),
+                      &path)) {
+      return false;
+    }
+    paths->push_back(path);
+  }
+
+  base::TimeTicks deadline =
+      base::TimeTicks::Now() +
+      base::TimeDelta::FromMilliseconds(kMapTimeoutMillis);
+  for (size_t i = 0; i < paths->size(); i++) {
+    while (!DeviceExists((*paths)[i])) {
+      if (base::TimeTicks::Now() < deadline) {
+        base::PlatformThread::Sleep(
+            base::TimeDelta::FromMilliseconds(kMapPollMillis));
+        continue;
+      }
+      LOG(ERROR) << "Timed out waiting for " << (*paths)[i] << " of "
+                 << target_partition_names[i];
+      // Unmap the partitions without a device node, so they are mapped and
+      // waited for again the next time they are needed.
+      for (size_t j = i; j < paths->size(); j++) {
+        if (!DeviceExists((*paths)[j])) {
+          ignore_result(UnmapPartitionOnDeviceMapper(target_partition_names[j],
+                                                     false /* wait */));
+        }
+      }
+      return false;
+    }
+  }
+  LOG(INFO) << "Mapped [" << Join(target_partition_names, ", ")
+            << "] to device mapper.";
+  return true;
+}
+
+bool DynamicPartitionControlAndroid::MapPartition(
+    const std::string& super_device,
+    const std::string& target_partition_name,
+    uint32_t slot,
+    bool force_writable,
+    std::chrono::milliseconds timeout,
+    std::string* path) {
   DmDeviceState state = GetState(target_partition_name);
   if (state == DmDeviceState::ACTIVE) {
     if (mapped_devices_.find(target_partition_name) != mapped_devices_.end()) {
@@ -116,8 +218,12 @@ bool DynamicPartitionControlAndroid::MapPartitionOnDeviceMapper(
     }
   }
   if (state == DmDeviceState::INVALID) {
-    return MapPartitionInternal(
-        super_device, target_partition_name, slot, force_writable, path);
+    return MapPartitionInternal(super_device,
+                                target_partition_name,
+                                slot,
+                                force_writable,
+                                timeout,
+                                path);
   }
 
   LOG(ERROR) << target_partition_name
@@ -212,6 +318,20 @@ bool DynamicPartitionControlAndroid::StoreMetadata(
     return false;
   }
 
+  // The metadata of the target slot is rewritten on every update start, but
+  // it usually already has the requested layout, e.g. when resizing to the
+  // same sizes or when the same update is applied again. Skip the write, and
+  // its sync of the super partition, in that case.
+  if (!IsDynamicPartitionsRetrofit()) {
+    auto current = ReadMetadata(super_device, target_slot);
+    if (current != nullptr && MetadataLayoutEqual(*current, *metadata)) {
+      LOG(INFO) << "Metadata in slot "
+                << BootControlInterface::SlotName(target_slot) << " in "
+                << super_device << " is up to date, not writing it.";
+      return true;
+    }
+  }
+
   if (IsDynamicPartitionsRetrofit()) {
     if (!FlashPartitionTable(super_device, *metadata)) {
       LOG(ERROR) << "Cannot write metadata to " << super_device;
@@ -19,9 +19,11 @@
 
 #include "update_engine/dynamic_partition_control_interface.h"
 
+#include <chrono>
 #include <memory>
 #include <set>
 #include <string>
+#include <vector>
 
 namespace chromeos_update_engine {
 
@@ -36,6 +38,12 @@ class DynamicPartitionControlAndroid : public DynamicPartitionControlInterface {
                                   uint32_t slot,
                                   bool force_writable,
                                   std::string* path) override;
+  bool MapPartitionsOnDeviceMapper(
+      const std::string& super_device,
+      const std::vector<std::string>& target_partition_names,
+      uint32_t slot,
+      bool force_writable,
+      std::vector<std::string>* paths) override;
   bool UnmapPartitionOnDeviceMapper(const std::string& target_partition_name,
                                     bool wait) override;
   void Cleanup() override;
@@ -56,10 +64,19 @@ class DynamicPartitionControlAndroid : public DynamicPartitionControlInterface {
   std::set<std::string> mapped_devices_;
 
   void CleanupInternal(bool wait);
+  // Maps the partition like MapPartitionOnDeviceMapper(), waiting up to
+  // |timeout| for its device node.
+  bool MapPartition(const std::string& super_device,
+                    const std::string& target_partition_name,
+                    uint32_t slot,
+                    bool force_writable,
+                    std::chrono::milliseconds timeout,
+                    std::string* path);
   bool MapPartitionInternal(const std::string& super_device,
                             const std::string& target_partition_name,
                             uint32_t slot,
                             bool force_writable,
+                            std::chrono::milliseconds timeout,
                             std::string* path);
 
   DISALLOW_COPY_AND_ASSIGN(DynamicPartitionControlAndroid);
@@ -21,6 +21,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <base/files/file_util.h>
 #include <libdm/dm.h>
@@ -52,6 +53,18 @@ class DynamicPartitionControlInterface {
       bool force_writable,
       std::string* path) = 0;
 
+  // Map the logical partitions |target_partition_names| on device-mapper like
+  // MapPartitionOnDeviceMapper(), but wait for all their device nodes at once
+  // instead of one partition after the other.
+  // Returns true if all of them were mapped successfully; if so, |paths| is
+  // set to their device paths, in the same order.
+  virtual bool MapPartitionsOnDeviceMapper(
+      const std::string& super_device,
+      const std::vector<std::string>& target_partition_names,
+      uint32_t slot,
+      bool force_writable,
+      std::vector<std::string>* paths) = 0;
+
   // Unmap logical partition on device mapper. This is the reverse operation
   // of MapPartitionOnDeviceMapper.
   // If |wait| is set, wait until the device is unmapped.
@@ -18,6 +18,7 @@
 #define UPDATE_ENGINE_FAKE_P2P_MANAGER_H_
 
 #include <string>
+#include <vector>
 
 #include "update_engine/p2p_manager.h"
 
@@ -51,6 +52,19 @@ class FakeP2PManager : public P2PManager {
     callback.Run(lookup_url_for_file_result_);
   }
 
+  void LookupUrlsForFile(const std::string& file_id,
+                         size_t minimum_size,
+                         base::TimeDelta max_time_to_wait,
+                         size_t max_num_urls,
+                         LookupUrlsCallback callback) override {
+    std::vector<std::string> urls = lookup_urls_for_file_result_;
+    if (urls.empty() && !lookup_url_for_file_result_.empty())
+      urls.push_back(lookup_url_for_file_result_);
+    if (urls.size() > max_num_urls)
+      urls.resize(max_num_urls);
+    callback.Run(urls);
+  }
+
   bool FileShare(const std::string& file_id, size_t expected_size) override {
     return false;
   }
@@ -96,6 +110,11 @@ class FakeP2PManager : public P2PManager {
     lookup_url_for_file_result_ = url;
   }
 
+  // If not set, LookupUrlsForFile() returns the LookupUrlForFile() result.
+  void SetLookupUrlsForFileResult(const std::vector<std::string>& urls) {
+    lookup_urls_for_file_result_ = urls;
+  }
+
  private:
   bool is_p2p_enabled_;
   bool ensure_p2p_running_result_;
@@ -103,6 +122,7 @@ class FakeP2PManager : public P2PManager {
   bool perform_housekeeping_result_;
   int count_shared_files_result_;
   std::string lookup_url_for_file_result_;
+  std::vector<std::string> lookup_urls_for_file_result_;
 
   DISALLOW_COPY_AND_ASSIGN(FakeP2PManager);
 };
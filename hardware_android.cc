@@ -30,6 +30,7 @@
 using android::base::GetBoolProperty;
 using android::base::GetIntProperty;
 using android::base::GetProperty;
+using android::base::GetUintProperty;
 using std::string;
 
 namespace chromeos_update_engine {
@@ -45,6 +46,18 @@ const char kPropProductManufacturer[] = "ro.product.manufacturer";
 const char kPropBootHardwareSKU[] = "ro.boot.hardware.sku";
 const char kPropBootRevision[] = "ro.boot.revision";
 const char kPropBuildDateUTC[] = "ro.build.date.utc";
+const char kPropApplyThreads[] = "ro.update_engine.apply_threads";
+const char kPropStagingBufferMB[] = "ro.update_engine.staging_buffer_mb";
+const char kPropDirectIo[] = "ro.update_engine.direct_io";
+const char kPropDownloadConnections[] =
+    "ro.update_engine.download_connections";
+const char kPropHashWhileWriting[] = "ro.update_engine.hash_while_writing";
+const char kPropVerifierReadKB[] = "ro.update_engine.verifier_read_kb";
+const char kPropFileReadKB[] = "ro.update_engine.file_read_kb";
+const char kPropApplyMemoryMB[] = "ro.update_engine.apply_memory_mb";
+const char kPropSkipUnchangedWrites[] =
+    "ro.update_engine.skip_unchanged_writes";
+const char kPropDestinationOrder[] = "ro.update_engine.destination_order";
 
 }  // namespace
 
@@ -203,4 +216,54 @@ bool HardwareAndroid::SetFirstActiveOmahaPingSent() {
   return true;
 }
 
+int HardwareAndroid::GetMaxApplyThreads() const {
+  return GetIntProperty<int>(kPropApplyThreads, 0, 0);
+}
+
+size_t HardwareAndroid::GetDownloadStagingBufferSize() const {
+  return GetUintProperty<size_t>(kPropStagingBufferMB, 0) * 1024 * 1024;
+}
+
+bool HardwareAndroid::UseDirectIoForPartitionWrites() const {
+  return GetBoolProperty(kPropDirectIo, false);
+}
+
+int HardwareAndroid::GetDownloadConnections() const {
+  return GetIntProperty<int>(kPropDownloadConnections, 1, 1);
+}
+
+int HardwareAndroid::GetDownloadPrefetchPayloads() const {
+  // Android updates are applied from a single payload.
+  return 0;
+}
+
+bool HardwareAndroid::HashPartitionsWhileWriting() const {
+  return GetBoolProperty(kPropHashWhileWriting, false);
+}
+
+size_t HardwareAndroid::GetVerifierReadSize() const {
+  return GetUintProperty<size_t>(kPropVerifierReadKB, 0) * 1024;
+}
+
+size_t HardwareAndroid::GetFileFetcherReadSize() const {
+  return GetUintProperty<size_t>(kPropFileReadKB, 0) * 1024;
+}
+
+uint64_t HardwareAndroid::GetMaxApplyMemorySize() const {
+  return GetUintProperty<uint64_t>(kPropApplyMemoryMB, 0) * 1024 * 1024;
+}
+
+bool HardwareAndroid::SkipUnchangedPartitionWrites() const {
+  return GetBoolProperty(kPropSkipUnchangedWrites, false);
+}
+
+bool HardwareAndroid::ApplyOperationsInDestinationOrder() const {
+  return GetBoolProperty(kPropDestinationOrder, false);
+}
+
+bool HardwareAndroid::StagePayloadsWhenDeferred() const {
+  // The updates are never deferred by the policy on Android.
+  return false;
+}
+
 }  // namespace chromeos_update_engine
@@ -55,6 +55,18 @@ class HardwareAndroid final : public HardwareInterface {
   int64_t GetBuildTimestamp() const override;
   bool GetFirstActiveOmahaPingSent() const override;
   bool SetFirstActiveOmahaPingSent() override;
+  int GetMaxApplyThreads() const override;
+  size_t GetDownloadStagingBufferSize() const override;
+  bool UseDirectIoForPartitionWrites() const override;
+  int GetDownloadConnections() const override;
+  int GetDownloadPrefetchPayloads() const override;
+  bool HashPartitionsWhileWriting() const override;
+  size_t GetVerifierReadSize() const override;
+  size_t GetFileFetcherReadSize() const override;
+  uint64_t GetMaxApplyMemorySize() const override;
+  bool SkipUnchangedPartitionWrites() const override;
+  bool ApplyOperationsInDestinationOrder() const override;
+  bool StagePayloadsWhenDeferred() const override;
 
  private:
   DISALLOW_COPY_AND_ASSIGN(HardwareAndroid);
@@ -73,6 +73,18 @@ const char* kConfigFilePath = "/etc/update_manager.conf";
 
 // UpdateManager config options:
 const char* kConfigOptsIsOOBEEnabled = "is_oobe_enabled";
+const char* kConfigOptsMaxApplyThreads = "max_apply_threads";
+const char* kConfigOptsDownloadStagingBufferMB = "download_staging_buffer_mb";
+const char* kConfigOptsUseDirectIo = "use_direct_io";
+const char* kConfigOptsDownloadConnections = "download_connections";
+const char* kConfigOptsDownloadPrefetchPayloads = "download_prefetch_payloads";
+const char* kConfigOptsHashWhileWriting = "hash_while_writing";
+const char* kConfigOptsVerifierReadKB = "verifier_read_kb";
+const char* kConfigOptsFileReadKB = "file_read_kb";
+const char* kConfigOptsApplyMemoryMB = "apply_memory_mb";
+const char* kConfigOptsSkipUnchangedWrites = "skip_unchanged_writes";
+const char* kConfigOptsDestinationOrder = "destination_order";
+const char* kConfigOptsStageDeferredPayloads = "stage_deferred_payloads";
 
 const char* kActivePingKey = "first_active_omaha_ping_sent";
 
@@ -288,17 +300,111 @@ void HardwareChromeOS::LoadConfig(const string& root_prefix, bool normal_mode) {
 
   if (!store.GetBoolean(kConfigOptsIsOOBEEnabled, &is_oobe_enabled_))
     is_oobe_enabled_ = true;  // Default value.
+
+  string max_apply_threads;
+  if (!store.GetString(kConfigOptsMaxApplyThreads, &max_apply_threads) ||
+      !base::StringToInt(max_apply_threads, &max_apply_threads_) ||
+      max_apply_threads_ < 0) {
+    max_apply_threads_ = 0;  // Default value.
+  }
+
+  string staging_buffer_mb_str;
+  unsigned staging_buffer_mb;
+  if (store.GetString(kConfigOptsDownloadStagingBufferMB,
+                      &staging_buffer_mb_str) &&
+      base::StringToUint(staging_buffer_mb_str, &staging_buffer_mb)) {
+    download_staging_buffer_size_ =
+        static_cast<size_t>(staging_buffer_mb) * 1024 * 1024;
+  } else {
+    download_staging_buffer_size_ = 0;  // Default value.
+  }
+
+  if (!store.GetBoolean(kConfigOptsUseDirectIo, &use_direct_io_))
+    use_direct_io_ = false;  // Default value.
+
+  string download_connections;
+  if (!store.GetString(kConfigOptsDownloadConnections, &download_connections) ||
+      !base::StringToInt(download_connections, &download_connections_) ||
+      download_connections_ < 1) {
+    download_connections_ = 1;  // Default value.
+  }
+
+  string download_prefetch_payloads;
+  if (!store.GetString(kConfigOptsDownloadPrefetchPayloads,
+                       &download_prefetch_payloads) ||
+      !base::StringToInt(download_prefetch_payloads,
+                         &download_prefetch_payloads_) ||
+      download_prefetch_payloads_ < 0) {
+    download_prefetch_payloads_ = 0;  // Default value.
+  }
+
+  if (!store.GetBoolean(kConfigOptsHashWhileWriting, &hash_while_writing_))
+    hash_while_writing_ = false;  // Default value.
+
+  string verifier_read_kb_str;
+  unsigned verifier_read_kb;
+  if (store.GetString(kConfigOptsVerifierReadKB, &verifier_read_kb_str) &&
+      base::StringToUint(verifier_read_kb_str, &verifier_read_kb)) {
+    verifier_read_size_ = static_cast<size_t>(verifier_read_kb) * 1024;
+  } else {
+    verifier_read_size_ = 0;  // Default value.
+  }
+
+  string file_read_kb_str;
+  unsigned file_read_kb;
+  if (store.GetString(kConfigOptsFileReadKB, &file_read_kb_str) &&
+      base::StringToUint(file_read_kb_str, &file_read_kb)) {
+    file_fetcher_read_size_ = static_cast<size_t>(file_read_kb) * 1024;
+  } else {
+    file_fetcher_read_size_ = 0;  // Default value.
+  }
+
+  string apply_memory_mb_str;
+  unsigned apply_memory_mb;
+  if (store.GetString(kConfigOptsApplyMemoryMB, &apply_memory_mb_str) &&
+      base::StringToUint(apply_memory_mb_str, &apply_memory_mb)) {
+    max_apply_memory_size_ =
+        static_cast<uint64_t>(apply_memory_mb) * 1024 * 1024;
+  } else {
+    max_apply_memory_size_ = 0;  // Default value.
+  }
+
+  if (!store.GetBoolean(kConfigOptsSkipUnchangedWrites,
+                        &skip_unchanged_writes_))
+    skip_unchanged_writes_ = false;  // Default value.
+
+  if (!store.GetBoolean(kConfigOptsDestinationOrder, &destination_order_))
+    destination_order_ = false;  // Default value.
+
+  if (!store.GetBoolean(kConfigOptsStageDeferredPayloads,
+                        &stage_deferred_payloads_))
+    stage_deferred_payloads_ = false;  // Default value.
 }
 
 bool HardwareChromeOS::GetFirstActiveOmahaPingSent() const {
-  int exit_code = 0;
+  // The value only changes through SetFirstActiveOmahaPingSent(), so it is
+  // read once rather than at every update check.
+  if (active_ping_cached_)
+    return active_ping_sent_;
+
   string active_ping_str;
-  vector<string> cmd = {"vpd_get_value", kActivePingKey};
-  if (!Subprocess::SynchronousExec(cmd, &exit_code, &active_ping_str) ||
-      exit_code) {
-    LOG(ERROR) << "Failed to get vpd key for " << kActivePingKey
-               << " with exit code: " << exit_code;
-    return false;
+  if (base::DirectoryExists(base::FilePath(vpd_rw_dir_))) {
+    // Reading the value from sysfs avoids running vpd_get_value on the main
+    // loop. A missing key was never set.
+    if (!base::ReadFileToString(
+            base::FilePath(vpd_rw_dir_).Append(kActivePingKey),
+            &active_ping_str)) {
+      active_ping_str = "0";
+    }
+  } else {
+    int exit_code = 0;
+    vector<string> cmd = {"vpd_get_value", kActivePingKey};
+    if (!Subprocess::SynchronousExec(cmd, &exit_code, &active_ping_str) ||
+        exit_code) {
+      LOG(ERROR) << "Failed to get vpd key for " << kActivePingKey
+                 << " with exit code: " << exit_code;
+      return false;
+    }
   }
 
   base::TrimWhitespaceASCII(active_ping_str, base::TRIM_ALL, &active_ping_str);
@@ -308,7 +414,9 @@ bool HardwareChromeOS::GetFirstActiveOmahaPingSent() const {
     LOG(INFO) << "Failed to parse active_ping value: " << active_ping_str;
     return false;
   }
-  return static_cast<bool>(active_ping);
+  active_ping_sent_ = static_cast<bool>(active_ping);
+  active_ping_cached_ = true;
+  return active_ping_sent_;
 }
 
 bool HardwareChromeOS::SetFirstActiveOmahaPingSent() {
@@ -322,6 +430,8 @@ bool HardwareChromeOS::SetFirstActiveOmahaPingSent() {
                << " with exit code: " << exit_code << " with error: " << output;
     return false;
   }
+  active_ping_sent_ = true;
+  active_ping_cached_ = true;
 
   vector<string> vpd_dump_cmd = {"dump_vpd_log", "--force"};
   if (!Subprocess::SynchronousExec(vpd_dump_cmd, &exit_code, &output) ||
@@ -333,4 +443,52 @@ bool HardwareChromeOS::SetFirstActiveOmahaPingSent() {
   return true;
 }
 
+int HardwareChromeOS::GetMaxApplyThreads() const {
+  return max_apply_threads_;
+}
+
+size_t HardwareChromeOS::GetDownloadStagingBufferSize() const {
+  return download_staging_buffer_size_;
+}
+
+bool HardwareChromeOS::UseDirectIoForPartitionWrites() const {
+  return use_direct_io_;
+}
+
+int HardwareChromeOS::GetDownloadConnections() const {
+  return download_connections_;
+}
+
+int HardwareChromeOS::GetDownloadPrefetchPayloads() const {
+  return download_prefetch_payloads_;
+}
+
+bool HardwareChromeOS::HashPartitionsWhileWriting() const {
+  return hash_while_writing_;
+}
+
+size_t HardwareChromeOS::GetVerifierReadSize() const {
+  return verifier_read_size_;
+}
+
+size_t HardwareChromeOS::GetFileFetcherReadSize() const {
+  return file_fetcher_read_size_;
+}
+
+uint64_t HardwareChromeOS::GetMaxApplyMemorySize() const {
+  return max_apply_memory_size_;
+}
+
+bool HardwareChromeOS::SkipUnchangedPartitionWrites() const {
+  return skip_unchanged_writes_;
+}
+
+bool HardwareChromeOS::ApplyOperationsInDestinationOrder() const {
+  return destination_order_;
+}
+
+bool HardwareChromeOS::StagePayloadsWhenDeferred() const {
+  return stage_deferred_payloads_;
+}
+
 }  // namespace chromeos_update_engine
@@ -60,17 +60,82 @@ class HardwareChromeOS final : public HardwareInterface {
   int64_t GetBuildTimestamp() const override;
   bool GetFirstActiveOmahaPingSent() const override;
   bool SetFirstActiveOmahaPingSent() override;
+  int GetMaxApplyThreads() const override;
+  size_t GetDownloadStagingBufferSize() const override;
+  bool UseDirectIoForPartitionWrites() const override;
+  int GetDownloadConnections() const override;
+  int GetDownloadPrefetchPayloads() const override;
+  bool HashPartitionsWhileWriting() const override;
+  size_t GetVerifierReadSize() const override;
+  size_t GetFileFetcherReadSize() const override;
+  uint64_t GetMaxApplyMemorySize() const override;
+  bool SkipUnchangedPartitionWrites() const override;
+  bool ApplyOperationsInDestinationOrder() const override;
+  bool StagePayloadsWhenDeferred() const override;
 
  private:
   friend class HardwareChromeOSTest;
 
-  // Load the update manager config flags (is_oobe_enabled flag) from the
-  // appropriate location based on whether we are in a normal mode boot (as
-  // passed in |normal_mode|) prefixing the paths with |root_prefix|.
+  // Load the update manager config flags (is_oobe_enabled, max_apply_threads,
+  // download_staging_buffer_mb, use_direct_io, download_connections,
+  // download_prefetch_payloads, hash_while_writing, verifier_read_kb,
+  // file_read_kb, apply_memory_mb, skip_unchanged_writes, destination_order
+  // and stage_deferred_payloads flags) from the appropriate location based
+  // on whether we are in a normal mode boot (as passed in |normal_mode|)
+  // prefixing the paths with |root_prefix|.
   void LoadConfig(const std::string& root_prefix, bool normal_mode);
 
   bool is_oobe_enabled_;
 
+  // The number of threads used to apply payload operations, as configured by
+  // the board, or 0 if not set.
+  int max_apply_threads_{0};
+
+  // The size in bytes of the buffer used to stage the downloaded payload, as
+  // configured by the board.
+  size_t download_staging_buffer_size_{0};
+
+  // Whether the partitions are written with O_DIRECT.
+  bool use_direct_io_{false};
+
+  // The number of HTTP connections used to download the payload.
+  int download_connections_{1};
+
+  // The number of payloads prefetched while the current one is downloaded.
+  int download_prefetch_payloads_{0};
+
+  // Whether the target partitions are hashed while they are written.
+  bool hash_while_writing_{false};
+
+  // The size in bytes of each read of the FilesystemVerifierAction, or 0 if
+  // not set.
+  size_t verifier_read_size_{0};
+
+  // The size in bytes of each read of a local payload file, or 0 if not set.
+  size_t file_fetcher_read_size_{0};
+
+  // The maximum memory in bytes used to apply the payload operations, or 0
+  // if not set.
+  uint64_t max_apply_memory_size_{0};
+
+  // Whether the writes to the target partitions skip the unchanged blocks.
+  bool skip_unchanged_writes_{false};
+
+  // Whether the operations are applied in the order of their target blocks.
+  bool destination_order_{false};
+
+  // Whether the payloads of an update deferred by the policy are cached.
+  bool stage_deferred_payloads_{false};
+
+  // The directory of the RW_VPD values exposed by the kernel. When it doesn't
+  // exist, the values are read with vpd_get_value instead.
+  std::string vpd_rw_dir_{"/sys/firmware/vpd/rw"};
+
+  // The first active Omaha ping value read from or written to the VPD, once
+  // |active_ping_cached_| is set.
+  mutable bool active_ping_cached_{false};
+  mutable bool active_ping_sent_{false};
+
   std::unique_ptr<org::chromium::debugdProxyInterface> debugd_proxy_;
 
   DISALLOW_COPY_AND_ASSIGN(HardwareChromeOS);
@@ -55,6 +55,15 @@ class HardwareChromeOSTest : public ::testing::Test {
     hardware_.LoadConfig(root_dir_.GetPath().value(), normal_mode);
   }
 
+  // Writes the RW_VPD |value| of |key| in the test directory and reads the
+  // VPD values from there.
+  void WriteVpdRwValue(const string& key, const string& value) {
+    base::FilePath vpd_dir = root_dir_.GetPath().Append("vpd/rw");
+    ASSERT_TRUE(base::CreateDirectory(vpd_dir));
+    ASSERT_TRUE(WriteFileString(vpd_dir.Append(key).value(), value));
+    hardware_.vpd_rw_dir_ = vpd_dir.value();
+  }
+
   HardwareChromeOS hardware_;
   base::ScopedTempDir root_dir_;
 };
@@ -87,4 +96,145 @@ TEST_F(HardwareChromeOSTest, ReadRootfsIfStatefulNotFound) {
   EXPECT_FALSE(hardware_.IsOOBEEnabled());
 }
 
+TEST_F(HardwareChromeOSTest, MaxApplyThreadsDefault) {
+  CallLoadConfig(true /* normal_mode */);
+  EXPECT_EQ(0, hardware_.GetMaxApplyThreads());
+}
+
+TEST_F(HardwareChromeOSTest, ReadMaxApplyThreads) {
+  WriteRootfsConfig("max_apply_threads=4");
+
+  CallLoadConfig(true /* normal_mode */);
+  EXPECT_EQ(4, hardware_.GetMaxApplyThreads());
+}
+
+TEST_F(HardwareChromeOSTest, InvalidMaxApplyThreadsReturnsDefault) {
+  WriteRootfsConfig("max_apply_threads=-1");
+
+  CallLoadConfig(true /* normal_mode */);
+  EXPECT_EQ(0, hardware_.GetMaxApplyThreads());
+}
+
+TEST_F(HardwareChromeOSTest, DownloadStagingBufferDisabledByDefault) {
+  CallLoadConfig(true /* normal_mode */);
+  EXPECT_EQ(0U, hardware_.GetDownloadStagingBufferSize());
+}
+
+TEST_F(HardwareChromeOSTest, ReadDownloadStagingBufferSize) {
+  WriteRootfsConfig("download_staging_buffer_mb=32");
+
+  CallLoadConfig(true /* normal_mode */);
+  EXPECT_EQ(32U * 1024 * 1024, hardware_.GetDownloadStagingBufferSize());
+}
+
+TEST_F(HardwareChromeOSTest, DirectIoDisabledByDefault) {
+  CallLoadConfig(true /* normal_mode */);
+  EXPECT_FALSE(hardware_.UseDirectIoForPartitionWrites());
+}
+
+TEST_F(HardwareChromeOSTest, ReadUseDirectIo) {
+  WriteRootfsConfig("use_direct_io=true");
+
+  CallLoadConfig(true /* normal_mode */);
+  EXPECT_TRUE(hardware_.UseDirectIoForPartitionWrites());
+}
+
+TEST_F(HardwareChromeOSTest, SingleDownloadConnectionByDefault) {
+  CallLoadConfig(true /* normal_mode */);
+  EXPECT_EQ(1, hardware_.GetDownloadConnections());
+}
+
+TEST_F(HardwareChromeOSTest, ReadDownloadConnections) {
+  WriteRootfsConfig("download_connections=4");
+
+  CallLoadConfig(true /* normal_mode */);
+  EXPECT_EQ(4, hardware_.GetDownloadConnections());
+}
+
+TEST_F(HardwareChromeOSTest, ReadDownloadPrefetchPayloads) {
+  CallLoadConfig(true /* normal_mode */);
+  EXPECT_EQ(0, hardware_.GetDownloadPrefetchPayloads());
+
+  WriteRootfsConfig("download_prefetch_payloads=3");
+  CallLoadConfig(true /* normal_mode */);
+  EXPECT_EQ(3, hardware_.GetDownloadPrefetchPayloads());
+}
+
+TEST_F(HardwareChromeOSTest, ReadHashWhileWriting) {
+  CallLoadConfig(true /* normal_mode */);
+  EXPECT_FALSE(hardware_.HashPartitionsWhileWriting());
+
+  WriteRootfsConfig("hash_while_writing=true");
+  CallLoadConfig(true /* normal_mode */);
+  EXPECT_TRUE(hardware_.HashPartitionsWhileWriting());
+}
+
+TEST_F(HardwareChromeOSTest, ReadVerifierReadSize) {
+  CallLoadConfig(true /* normal_mode */);
+  EXPECT_EQ(0U, hardware_.GetVerifierReadSize());
+
+  WriteRootfsConfig("verifier_read_kb=512");
+  CallLoadConfig(true /* normal_mode */);
+  EXPECT_EQ(512U * 1024, hardware_.GetVerifierReadSize());
+}
+
+TEST_F(HardwareChromeOSTest, ReadFileFetcherReadSize) {
+  CallLoadConfig(true /* normal_mode */);
+  EXPECT_EQ(0U, hardware_.GetFileFetcherReadSize());
+
+  WriteRootfsConfig("file_read_kb=4096");
+  CallLoadConfig(true /* normal_mode */);
+  EXPECT_EQ(4096U * 1024, hardware_.GetFileFetcherReadSize());
+}
+
+TEST_F(HardwareChromeOSTest, ReadMaxApplyMemorySize) {
+  CallLoadConfig(true /* normal_mode */);
+  EXPECT_EQ(0U, hardware_.GetMaxApplyMemorySize());
+
+  WriteRootfsConfig("apply_memory_mb=64");
+  CallLoadConfig(true /* normal_mode */);
+  EXPECT_EQ(64U * 1024 * 1024, hardware_.GetMaxApplyMemorySize());
+}
+
+TEST_F(HardwareChromeOSTest, ReadSkipUnchangedPartitionWrites) {
+  CallLoadConfig(true /* normal_mode */);
+  EXPECT_FALSE(hardware_.SkipUnchangedPartitionWrites());
+
+  WriteRootfsConfig("skip_unchanged_writes=true");
+  CallLoadConfig(true /* normal_mode */);
+  EXPECT_TRUE(hardware_.SkipUnchangedPartitionWrites());
+}
+
+TEST_F(HardwareChromeOSTest, ReadApplyOperationsInDestinationOrder) {
+  CallLoadConfig(true /* normal_mode */);
+  EXPECT_FALSE(hardware_.ApplyOperationsInDestinationOrder());
+
+  WriteRootfsConfig("destination_order=true");
+  CallLoadConfig(true /* normal_mode */);
+  EXPECT_TRUE(hardware_.ApplyOperationsInDestinationOrder());
+}
+
+TEST_F(HardwareChromeOSTest, ReadStagePayloadsWhenDeferred) {
+  CallLoadConfig(true /* normal_mode */);
+  EXPECT_FALSE(hardware_.StagePayloadsWhenDeferred());
+
+  WriteRootfsConfig("stage_deferred_payloads=true");
+  CallLoadConfig(true /* normal_mode */);
+  EXPECT_TRUE(hardware_.StagePayloadsWhenDeferred());
+}
+
+TEST_F(HardwareChromeOSTest, FirstActiveOmahaPingSentIsReadOnce) {
+  WriteVpdRwValue("first_active_omaha_ping_sent", "1\n");
+  EXPECT_TRUE(hardware_.GetFirstActiveOmahaPingSent());
+
+  // The value is cached, and only changed by SetFirstActiveOmahaPingSent().
+  WriteVpdRwValue("first_active_omaha_ping_sent", "0");
+  EXPECT_TRUE(hardware_.GetFirstActiveOmahaPingSent());
+}
+
+TEST_F(HardwareChromeOSTest, FirstActiveOmahaPingNotSetInVpd) {
+  WriteVpdRwValue("other_key", "1");
+  EXPECT_FALSE(hardware_.GetFirstActiveOmahaPingSent());
+}
+
 }  // namespace chromeos_update_engine
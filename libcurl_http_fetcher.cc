@@ -20,6 +20,7 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <set>
 #include <string>
 
 #include <base/bind.h>
@@ -37,6 +38,7 @@
 #include "update_engine/certificate_checker.h"
 #include "update_engine/common/hardware_interface.h"
 #include "update_engine/common/platform_constants.h"
+#include "update_engine/common/trace.h"
 
 using base::TimeDelta;
 using brillo::MessageLoop;
@@ -67,25 +69,57 @@ int LibcurlSockoptCallback(void* /* clientp */,
   return CURL_SOCKOPT_OK;
 }
 
+// Returns the share handle used by all the fetchers. It holds the connection
+// cache, the TLS sessions and the DNS cache, so the connections to the Omaha
+// and payload servers are reused across the transfers and their retries
+// instead of being set up again. All the fetchers run on the same message
+// loop, so the shared data doesn't need a lock.
+CURLSH* GetCurlShareHandle() {
+  static CURLSH* share_handle = []() {
+    CURLSH* handle = curl_share_init();
+    CHECK(handle);
+    CHECK_EQ(curl_share_setopt(handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS),
+             CURLSHE_OK);
+    CHECK_EQ(
+        curl_share_setopt(handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION),
+        CURLSHE_OK);
+#if LIBCURL_VERSION_NUM >= 0x073900  // 7.57.0
+    CHECK_EQ(curl_share_setopt(handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT),
+             CURLSHE_OK);
+#endif
+    return handle;
+  }();
+  return share_handle;
+}
+
+// The fetchers alive. A cached connection may be closed by another fetcher
+// than the one that opened it, so the socket is unwatched in all of them.
+std::set<LibcurlHttpFetcher*>* GetLiveFetchers() {
+  static std::set<LibcurlHttpFetcher*>* live_fetchers =
+      new std::set<LibcurlHttpFetcher*>();
+  return live_fetchers;
+}
+
 }  // namespace
 
 // static
-int LibcurlHttpFetcher::LibcurlCloseSocketCallback(void* clientp,
+int LibcurlHttpFetcher::LibcurlCloseSocketCallback(void* /* clientp */,
                                                    curl_socket_t item) {
 #ifdef __ANDROID__
   qtaguid_untagSocket(item);
 #endif  // __ANDROID__
-  LibcurlHttpFetcher* fetcher = static_cast<LibcurlHttpFetcher*>(clientp);
   // Stop watching the socket before closing it.
-  for (size_t t = 0; t < arraysize(fetcher->fd_task_maps_); ++t) {
-    const auto fd_task_pair = fetcher->fd_task_maps_[t].find(item);
-    if (fd_task_pair != fetcher->fd_task_maps_[t].end()) {
-      if (!MessageLoop::current()->CancelTask(fd_task_pair->second)) {
-        LOG(WARNING) << "Error canceling the watch task "
-                     << fd_task_pair->second << " for "
-                     << (t ? "writing" : "reading") << " the fd " << item;
+  for (LibcurlHttpFetcher* fetcher : *GetLiveFetchers()) {
+    for (size_t t = 0; t < arraysize(fetcher->fd_task_maps_); ++t) {
+      const auto fd_task_pair = fetcher->fd_task_maps_[t].find(item);
+      if (fd_task_pair != fetcher->fd_task_maps_[t].end()) {
+        if (!MessageLoop::current()->CancelTask(fd_task_pair->second)) {
+          LOG(WARNING) << "Error canceling the watch task "
+                       << fd_task_pair->second << " for "
+                       << (t ? "writing" : "reading") << " the fd " << item;
+        }
+        fetcher->fd_task_maps_[t].erase(item);
       }
-      fetcher->fd_task_maps_[t].erase(item);
     }
   }
 
@@ -100,10 +134,13 @@ LibcurlHttpFetcher::LibcurlHttpFetcher(ProxyResolver* proxy_resolver,
     : HttpFetcher(proxy_resolver), hardware_(hardware) {
   // Dev users want a longer timeout (180 seconds) because they may
   // be waiting on the dev server to build an image.
-  if (!hardware_->IsOfficialBuild())
+  if (!hardware_->IsOfficialBuild()) {
     low_speed_time_seconds_ = kDownloadDevModeLowSpeedTimeSeconds;
+    low_speed_limit_set_ = true;
+  }
   if (hardware_->IsOOBEEnabled() && !hardware_->IsOOBEComplete(nullptr))
     max_retry_count_ = kDownloadMaxRetryCountOobeNotComplete;
+  GetLiveFetchers()->insert(this);
 }
 
 LibcurlHttpFetcher::~LibcurlHttpFetcher() {
@@ -111,6 +148,7 @@ LibcurlHttpFetcher::~LibcurlHttpFetcher() {
       << "Destroying the fetcher while a transfer is in progress.";
   CancelProxyResolution();
   CleanUp();
+  GetLiveFetchers()->erase(this);
 }
 
 bool LibcurlHttpFetcher::GetProxyType(const string& proxy,
@@ -158,7 +196,20 @@ void LibcurlHttpFetcher::ResumeTransfer(const string& url) {
       curl_handle_, CURLOPT_SOCKOPTFUNCTION, LibcurlSockoptCallback);
   curl_easy_setopt(
       curl_handle_, CURLOPT_CLOSESOCKETFUNCTION, LibcurlCloseSocketCallback);
-  curl_easy_setopt(curl_handle_, CURLOPT_CLOSESOCKETDATA, this);
+
+  // Reuse the connections and TLS sessions of the previous transfers.
+  CHECK_EQ(curl_easy_setopt(curl_handle_, CURLOPT_SHARE, GetCurlShareHandle()),
+           CURLE_OK);
+#if LIBCURL_VERSION_NUM >= 0x072f00  // 7.47.0
+  // Negotiate HTTP/2 through ALPN when the server supports it, so the requests
+  // to the same server are multiplexed over a single connection. Plain HTTP
+  // stays on HTTP/1.1.
+  if (curl_easy_setopt(curl_handle_,
+                       CURLOPT_HTTP_VERSION,
+                       CURL_HTTP_VERSION_2TLS) != CURLE_OK) {
+    LOG(INFO) << "HTTP/2 is not supported by libcurl, using HTTP/1.1.";
+  }
+#endif
 
   CHECK(HasProxy());
   bool is_direct = (GetCurrentProxy() == kNoProxy);
@@ -177,6 +228,9 @@ void LibcurlHttpFetcher::ResumeTransfer(const string& url) {
     }
   }
 
+  if (head_request_)
+    CHECK_EQ(curl_easy_setopt(curl_handle_, CURLOPT_NOBODY, 1), CURLE_OK);
+
   if (post_data_set_) {
     CHECK_EQ(curl_easy_setopt(curl_handle_, CURLOPT_POST, 1), CURLE_OK);
     CHECK_EQ(
@@ -211,6 +265,18 @@ void LibcurlHttpFetcher::ResumeTransfer(const string& url) {
   CHECK_EQ(
       curl_easy_setopt(curl_handle_, CURLOPT_HTTPHEADER, curl_http_headers_),
       CURLE_OK);
+  if (accept_compressed_response_) {
+    // An empty list offers all the encodings libcurl was built with, such as
+    // gzip and brotli, and libcurl decodes the response as it is received.
+    CHECK_EQ(curl_easy_setopt(curl_handle_, CURLOPT_ACCEPT_ENCODING, ""),
+             CURLE_OK);
+  }
+  response_headers_.clear();
+  CHECK_EQ(curl_easy_setopt(curl_handle_, CURLOPT_HEADERDATA, this),
+           CURLE_OK);
+  CHECK_EQ(curl_easy_setopt(
+               curl_handle_, CURLOPT_HEADERFUNCTION, StaticLibcurlHeader),
+           CURLE_OK);
 
   if (bytes_downloaded_ > 0 || download_length_) {
     // Resume from where we left off.
@@ -242,12 +308,21 @@ void LibcurlHttpFetcher::ResumeTransfer(const string& url) {
 
   // If the connection drops under |low_speed_limit_bps_| (10
   // bytes/sec by default) for |low_speed_time_seconds_| (90 seconds,
-  // 180 on non-official builds), reconnect.
+  // 180 on non-official builds), reconnect. Unless they were set explicitly,
+  // the throughput tracker adapts them to the history of the connection.
+  int low_speed_limit_bps = low_speed_limit_bps_;
+  int low_speed_time_seconds = low_speed_time_seconds_;
+  if (throughput_tracker_ && !low_speed_limit_set_ &&
+      throughput_tracker_->GetLowSpeedLimit(&low_speed_limit_bps,
+                                            &low_speed_time_seconds)) {
+    LOG(INFO) << "Using a low-speed limit of " << low_speed_limit_bps
+              << " bytes/sec for " << low_speed_time_seconds << " seconds.";
+  }
   CHECK_EQ(curl_easy_setopt(
-               curl_handle_, CURLOPT_LOW_SPEED_LIMIT, low_speed_limit_bps_),
+               curl_handle_, CURLOPT_LOW_SPEED_LIMIT, low_speed_limit_bps),
            CURLE_OK);
   CHECK_EQ(curl_easy_setopt(
-               curl_handle_, CURLOPT_LOW_SPEED_TIME, low_speed_time_seconds_),
+               curl_handle_, CURLOPT_LOW_SPEED_TIME, low_speed_time_seconds),
            CURLE_OK);
   CHECK_EQ(curl_easy_setopt(
                curl_handle_, CURLOPT_CONNECTTIMEOUT, connect_timeout_seconds_),
@@ -431,6 +506,7 @@ void LibcurlHttpFetcher::CurlPerformOnce() {
   } else {
     LOG(ERROR) << "Unable to get http response code.";
   }
+  AddThroughputSample();
 
   // we're done!
   CleanUp();
@@ -446,7 +522,8 @@ void LibcurlHttpFetcher::CurlPerformOnce() {
         FROM_HERE,
         base::Bind(&LibcurlHttpFetcher::RetryTimeoutCallback,
                    base::Unretained(this)),
-        TimeDelta::FromSeconds(kNoNetworkRetrySeconds));
+        GetRetryDelay(no_network_retry_count_,
+                      TimeDelta::FromSeconds(kNoNetworkRetrySeconds)));
     LOG(INFO) << "No HTTP response, retry " << no_network_retry_count_;
   } else if ((!sent_byte_ && !IsHttpResponseSuccess()) ||
              IsHttpResponseError()) {
@@ -494,12 +571,16 @@ void LibcurlHttpFetcher::CurlPerformOnce() {
       return;
     }
     // Need to restart transfer
-    LOG(INFO) << "Restarting transfer to download the remaining bytes";
+    TimeDelta retry_delay = TimeDelta::FromSeconds(retry_seconds_);
+    if (!retry_seconds_set_)
+      retry_delay = GetRetryDelay(retry_count_, retry_delay);
+    LOG(INFO) << "Restarting transfer to download the remaining bytes in "
+              << retry_delay.InMilliseconds() << " ms";
     retry_task_id_ = MessageLoop::current()->PostDelayedTask(
         FROM_HERE,
         base::Bind(&LibcurlHttpFetcher::RetryTimeoutCallback,
                    base::Unretained(this)),
-        TimeDelta::FromSeconds(retry_seconds_));
+        retry_delay);
   } else {
     LOG(INFO) << "Transfer completed (" << http_response_code_ << "), "
               << bytes_downloaded_ << " bytes downloaded";
@@ -516,6 +597,7 @@ void LibcurlHttpFetcher::CurlPerformOnce() {
 }
 
 size_t LibcurlHttpFetcher::LibcurlWrite(void* ptr, size_t size, size_t nmemb) {
+  UE_TRACE_SCOPE("LibcurlHttpFetcher::LibcurlWrite");
   // Update HTTP response first.
   GetHttpResponseCode();
   const size_t payload_size = size * nmemb;
@@ -535,7 +617,10 @@ size_t LibcurlHttpFetcher::LibcurlWrite(void* ptr, size_t size, size_t nmemb) {
                                &transfer_size_double),
              CURLE_OK);
     off_t new_transfer_size = static_cast<off_t>(transfer_size_double);
-    if (new_transfer_size > 0) {
+    // The length of an encoded response doesn't match the decoded data
+    // received.
+    if (new_transfer_size > 0 &&
+        GetResponseHeader("Content-Encoding").empty()) {
       transfer_size_ = resume_offset_ + new_transfer_size;
     }
   }
@@ -552,9 +637,36 @@ size_t LibcurlHttpFetcher::LibcurlWrite(void* ptr, size_t size, size_t nmemb) {
       return 0;
     }
   }
+  if (bandwidth_limiter_ && !terminate_requested_) {
+    TimeDelta delay = bandwidth_limiter_->Consume(payload_size);
+    if (delay > TimeDelta() && !transfer_throttled_)
+      ThrottleTransfer(delay);
+  }
   return payload_size;
 }
 
+size_t LibcurlHttpFetcher::LibcurlHeader(char* buffer,
+                                         size_t size,
+                                         size_t nitems) {
+  const size_t length = size * nitems;
+  const string line(buffer, length);
+  // A status line starts the headers of a new response, such as the one
+  // following a redirect.
+  if (base::StartsWith(line, "HTTP/", base::CompareCase::SENSITIVE)) {
+    response_headers_.clear();
+    return length;
+  }
+  const size_t colon = line.find(':');
+  if (colon != string::npos) {
+    string name;
+    base::TrimWhitespaceASCII(line.substr(0, colon), base::TRIM_ALL, &name);
+    string value;
+    base::TrimWhitespaceASCII(line.substr(colon + 1), base::TRIM_ALL, &value);
+    response_headers_[base::ToLowerASCII(name)] = value;
+  }
+  return length;
+}
+
 void LibcurlHttpFetcher::Pause() {
   if (transfer_paused_) {
     LOG(ERROR) << "Fetcher already paused.";
@@ -582,6 +694,10 @@ void LibcurlHttpFetcher::Unpause() {
     CurlPerformOnce();
     return;
   }
+  if (transfer_throttled_) {
+    // The transfer continues once the throttle delay expires.
+    return;
+  }
   if (!transfer_in_progress_) {
     // If resumed before starting the connection, there's no need to notify
     // anybody. We will simply start the connection once it is time.
@@ -692,6 +808,30 @@ void LibcurlHttpFetcher::RetryTimeoutCallback() {
   CurlPerformOnce();
 }
 
+void LibcurlHttpFetcher::ThrottleTransfer(TimeDelta delay) {
+  CHECK(curl_handle_);
+  transfer_throttled_ = true;
+  // Pausing from the write callback is allowed, the data just received is
+  // still consumed.
+  CHECK_EQ(curl_easy_pause(curl_handle_, CURLPAUSE_ALL), CURLE_OK);
+  throttle_task_id_ = MessageLoop::current()->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&LibcurlHttpFetcher::ThrottleTimeoutCallback,
+                 base::Unretained(this)),
+      delay);
+}
+
+void LibcurlHttpFetcher::ThrottleTimeoutCallback() {
+  throttle_task_id_ = MessageLoop::kTaskIdNull;
+  transfer_throttled_ = false;
+  // If the transfer was paused meanwhile, Unpause() resumes it.
+  if (transfer_paused_ || !transfer_in_progress_)
+    return;
+  CHECK(curl_handle_);
+  CHECK_EQ(curl_easy_pause(curl_handle_, CURLPAUSE_CONT), CURLE_OK);
+  CurlPerformOnce();
+}
+
 void LibcurlHttpFetcher::TimeoutCallback() {
   // We always re-schedule the callback, even if we don't want to be called
   // anymore. We will remove the event source separately if we don't want to
@@ -714,6 +854,10 @@ void LibcurlHttpFetcher::CleanUp() {
   MessageLoop::current()->CancelTask(timeout_id_);
   timeout_id_ = MessageLoop::kTaskIdNull;
 
+  MessageLoop::current()->CancelTask(throttle_task_id_);
+  throttle_task_id_ = MessageLoop::kTaskIdNull;
+  transfer_throttled_ = false;
+
   for (size_t t = 0; t < arraysize(fd_task_maps_); ++t) {
     for (const auto& fd_taks_pair : fd_task_maps_[t]) {
       if (!MessageLoop::current()->CancelTask(fd_taks_pair.second)) {
@@ -746,6 +890,47 @@ void LibcurlHttpFetcher::CleanUp() {
   restart_transfer_on_unpause_ = false;
 }
 
+void LibcurlHttpFetcher::AddThroughputSample() {
+  if (!throughput_tracker_ || !http_response_code_ ||
+      base::StartsWith(url_, "file://", base::CompareCase::INSENSITIVE_ASCII)) {
+    return;
+  }
+  // The times are in seconds since the start of the transfer.
+  double name_lookup_time = 0, connect_time = 0, start_transfer_time = 0,
+         total_time = 0;
+  if (curl_easy_getinfo(
+          curl_handle_, CURLINFO_NAMELOOKUP_TIME, &name_lookup_time) !=
+          CURLE_OK ||
+      curl_easy_getinfo(curl_handle_, CURLINFO_CONNECT_TIME, &connect_time) !=
+          CURLE_OK ||
+      curl_easy_getinfo(
+          curl_handle_, CURLINFO_STARTTRANSFER_TIME, &start_transfer_time) !=
+          CURLE_OK ||
+      curl_easy_getinfo(curl_handle_, CURLINFO_TOTAL_TIME, &total_time) !=
+          CURLE_OK) {
+    return;
+  }
+  // The TCP handshake takes one round trip. It is skipped when the connection
+  // is reused, in which case the round-trip time is unknown.
+  TimeDelta rtt;
+  if (connect_time > name_lookup_time) {
+    rtt = TimeDelta::FromMicroseconds(
+        static_cast<int64_t>((connect_time - name_lookup_time) * 1e6));
+  }
+  TimeDelta duration = TimeDelta::FromMicroseconds(
+      static_cast<int64_t>(std::max(0.0, total_time - start_transfer_time) *
+                           1e6));
+  off_t bytes = std::max<off_t>(0, bytes_downloaded_ - resume_offset_);
+  throughput_tracker_->AddSample(bytes, duration, rtt);
+}
+
+TimeDelta LibcurlHttpFetcher::GetRetryDelay(int attempt,
+                                            TimeDelta max_delay) const {
+  if (!throughput_tracker_)
+    return max_delay;
+  return throughput_tracker_->GetRetryDelay(attempt, max_delay);
+}
+
 void LibcurlHttpFetcher::GetHttpResponseCode() {
   long http_response_code = 0;  // NOLINT(runtime/int) - curl needs long.
   if (base::StartsWith(url_, "file://", base::CompareCase::INSENSITIVE_ASCII)) {
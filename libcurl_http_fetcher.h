@@ -30,7 +30,9 @@
 
 #include "update_engine/certificate_checker.h"
 #include "update_engine/common/hardware_interface.h"
+#include "update_engine/bandwidth_limiter.h"
 #include "update_engine/common/http_fetcher.h"
+#include "update_engine/throughput_tracker.h"
 
 // This is a concrete implementation of HttpFetcher that uses libcurl to do the
 // http work.
@@ -79,7 +81,10 @@ class LibcurlHttpFetcher : public HttpFetcher {
   void set_idle_seconds(int seconds) override { idle_seconds_ = seconds; }
 
   // Sets the retry timeout. Useful for testing.
-  void set_retry_seconds(int seconds) override { retry_seconds_ = seconds; }
+  void set_retry_seconds(int seconds) override {
+    retry_seconds_ = seconds;
+    retry_seconds_set_ = true;
+  }
 
   void set_no_network_max_retries(int retries) {
     no_network_max_retries_ = retries;
@@ -89,6 +94,20 @@ class LibcurlHttpFetcher : public HttpFetcher {
     server_to_check_ = server_to_check;
   }
 
+  // Sets the tracker that measures the transfers and adapts the low-speed
+  // limit and the retry delays to the connection, unless they were set
+  // explicitly. Does not take ownership of |throughput_tracker|.
+  void set_throughput_tracker(ThroughputTracker* throughput_tracker) {
+    throughput_tracker_ = throughput_tracker;
+  }
+
+  // Sets the limiter of the rate at which the data is received, which may be
+  // shared with other fetchers. Does not take ownership of
+  // |bandwidth_limiter|.
+  void set_bandwidth_limiter(BandwidthLimiter* bandwidth_limiter) {
+    bandwidth_limiter_ = bandwidth_limiter;
+  }
+
   size_t GetBytesDownloaded() override {
     return static_cast<size_t>(bytes_downloaded_);
   }
@@ -96,6 +115,7 @@ class LibcurlHttpFetcher : public HttpFetcher {
   void set_low_speed_limit(int low_speed_bps, int low_speed_sec) override {
     low_speed_limit_bps_ = low_speed_bps;
     low_speed_time_seconds_ = low_speed_sec;
+    low_speed_limit_set_ = true;
   }
 
   void set_connect_timeout(int connect_timeout_seconds) override {
@@ -106,15 +126,27 @@ class LibcurlHttpFetcher : public HttpFetcher {
     max_retry_count_ = max_retry_count;
   }
 
+  // Sends HEAD requests, which only receive the headers of the response.
+  void set_head_request(bool head_request) { head_request_ = head_request; }
+
  private:
   // libcurl's CURLOPT_CLOSESOCKETFUNCTION callback function. Called when
   // closing a socket created with the CURLOPT_OPENSOCKETFUNCTION callback.
+  // The connections are shared by all the fetchers, so the socket may have
+  // been opened by another fetcher.
   static int LibcurlCloseSocketCallback(void* clientp, curl_socket_t item);
 
   // Callback for when proxy resolution has completed. This begins the
   // transfer.
   void ProxiesResolved();
 
+  // Adds the throughput and the connection latency of the transfer that just
+  // completed to |throughput_tracker_|.
+  void AddThroughputSample();
+
+  // Returns the delay before the |attempt|-th retry, at most |max_delay|.
+  base::TimeDelta GetRetryDelay(int attempt, base::TimeDelta max_delay) const;
+
   // Asks libcurl for the http response code and stores it in the object.
   void GetHttpResponseCode();
 
@@ -136,6 +168,11 @@ class LibcurlHttpFetcher : public HttpFetcher {
 
   void TimeoutCallback();
   void RetryTimeoutCallback();
+  void ThrottleTimeoutCallback();
+
+  // Pauses receiving data for |delay| to stay under the rate of
+  // |bandwidth_limiter_|.
+  void ThrottleTransfer(base::TimeDelta delay);
 
   // Calls into curl_multi_perform to let libcurl do its work. Returns after
   // curl_multi_perform is finished, which may actually be after more than
@@ -160,6 +197,16 @@ class LibcurlHttpFetcher : public HttpFetcher {
         ptr, size, nmemb);
   }
 
+  // Callback called by libcurl for each line of the response headers.
+  size_t LibcurlHeader(char* buffer, size_t size, size_t nitems);
+  static size_t StaticLibcurlHeader(char* buffer,
+                                    size_t size,
+                                    size_t nitems,
+                                    void* userdata) {
+    return reinterpret_cast<LibcurlHttpFetcher*>(userdata)->LibcurlHeader(
+        buffer, size, nitems);
+  }
+
   // Cleans up the following if they are non-null:
   // curl(m) handles, fd_task_maps_, timeout_id_.
   void CleanUp();
@@ -236,8 +283,13 @@ class LibcurlHttpFetcher : public HttpFetcher {
   int retry_count_{0};
   int max_retry_count_{kDownloadMaxRetryCount};
 
-  // Seconds to wait before retrying a resume.
+  // Whether the requests are HEAD requests.
+  bool head_request_{false};
+
+  // Seconds to wait before retrying a resume, and whether they were set
+  // explicitly.
   int retry_seconds_{20};
+  bool retry_seconds_set_{false};
 
   // When waiting for a retry, the task id of the retry callback.
   brillo::MessageLoop::TaskId retry_task_id_{brillo::MessageLoop::kTaskIdNull};
@@ -269,6 +321,20 @@ class LibcurlHttpFetcher : public HttpFetcher {
   int low_speed_time_seconds_{kDownloadLowSpeedTimeSeconds};
   int connect_timeout_seconds_{kDownloadConnectTimeoutSeconds};
 
+  // Whether the low-speed limit was set explicitly, in which case the
+  // |throughput_tracker_| doesn't change it.
+  bool low_speed_limit_set_{false};
+
+  // Not owned, may be null.
+  ThroughputTracker* throughput_tracker_{nullptr};
+  BandwidthLimiter* bandwidth_limiter_{nullptr};
+
+  // Whether receiving is paused by the |bandwidth_limiter_|, independently of
+  // Pause(), and the task id of the callback resuming it.
+  bool transfer_throttled_{false};
+  brillo::MessageLoop::TaskId throttle_task_id_{
+      brillo::MessageLoop::kTaskIdNull};
+
   DISALLOW_COPY_AND_ASSIGN(LibcurlHttpFetcher);
 };
 
@@ -52,6 +52,8 @@ constexpr char kMetricsUpdateEngineAttemptPayloadType[] =
     "ota_update_engine_attempt_payload_type";
 constexpr char kMetricsUpdateEngineAttemptCurrentBytesDownloadedMiB[] =
     "ota_update_engine_attempt_fixed_current_bytes_downloaded_mib";
+constexpr char kMetricsUpdateEngineAttemptLongestChunkIntervalSeconds[] =
+    "ota_update_engine_attempt_longest_chunk_interval_seconds";
 
 constexpr char kMetricsUpdateEngineSuccessfulUpdateAttemptCount[] =
     "ota_update_engine_successful_update_attempt_count";
@@ -112,6 +114,13 @@ void MetricsReporterAndroid::ReportUpdateAttemptDownloadMetrics(
                payload_bytes_downloaded / kNumBytesInOneMiB);
 }
 
+void MetricsReporterAndroid::ReportDownloadChunkIntervalMetrics(
+    const std::vector<uint32_t>& /* chunk_interval_counts */,
+    base::TimeDelta longest_chunk_interval) {
+  LogHistogram(metrics::kMetricsUpdateEngineAttemptLongestChunkIntervalSeconds,
+               longest_chunk_interval.InSeconds());
+}
+
 void MetricsReporterAndroid::ReportSuccessfulUpdateMetrics(
     int attempt_count,
     int /* updates_abandoned_count */,
@@ -18,6 +18,7 @@
 #define UPDATE_ENGINE_METRICS_REPORTER_ANDROID_H_
 
 #include <string>
+#include <vector>
 
 #include "update_engine/common/error_code.h"
 #include "update_engine/metrics_constants.h"
@@ -62,6 +63,10 @@ class MetricsReporterAndroid : public MetricsReporterInterface {
       metrics::DownloadErrorCode payload_download_error_code,
       metrics::ConnectionType connection_type) override;
 
+  void ReportDownloadChunkIntervalMetrics(
+      const std::vector<uint32_t>& chunk_interval_counts,
+      base::TimeDelta longest_chunk_interval) override;
+
   void ReportAbnormallyTerminatedUpdateAttemptMetrics() override;
 
   void ReportSuccessfulUpdateMetrics(
@@ -94,6 +99,16 @@ class MetricsReporterAndroid : public MetricsReporterInterface {
   void ReportEnterpriseUpdateSeenToDownloadDays(
       bool has_time_restriction_policy, int time_to_update_days) override {}
 
+  void ReportInstallOperationMetrics(const std::string& operation_type,
+                                     int count,
+                                     base::TimeDelta duration,
+                                     int64_t bytes_read,
+                                     int64_t bytes_written,
+                                     int64_t bytes_downloaded) override {}
+
+  void ReportPhaseIoMetrics(const std::string& phase,
+                            const PhaseIoStats& stats) override {}
+
  private:
   DISALLOW_COPY_AND_ASSIGN(MetricsReporterAndroid);
 };
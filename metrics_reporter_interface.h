@@ -19,11 +19,13 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <base/time/time.h>
 
 #include "update_engine/common/constants.h"
 #include "update_engine/common/error_code.h"
+#include "update_engine/common/io_stats.h"
 #include "update_engine/metrics_constants.h"
 #include "update_engine/system_state.h"
 
@@ -146,6 +148,18 @@ class MetricsReporterInterface {
       metrics::DownloadErrorCode payload_download_error_code,
       metrics::ConnectionType connection_type) = 0;
 
+  // Helper function to report how steadily the payload was downloaded in an
+  // update attempt, right before ReportUpdateAttemptDownloadMetrics().
+  // |chunk_interval_counts| are the counts of the intervals between the
+  // received chunks, in the buckets of metrics_utils::ChunkIntervalHistogram.
+  // The following metrics are reported:
+  //
+  // |kMetricAttemptLongestChunkIntervalSeconds|
+  // |kMetricAttemptNumDownloadStalls|
+  virtual void ReportDownloadChunkIntervalMetrics(
+      const std::vector<uint32_t>& chunk_interval_counts,
+      base::TimeDelta longest_chunk_interval) = 0;
+
   // Reports the |kAbnormalTermination| for the |kMetricAttemptResult|
   // metric. No other metrics in the UpdateEngine.Attempt.* namespace
   // will be reported.
@@ -242,6 +256,38 @@ class MetricsReporterInterface {
   //
   virtual void ReportEnterpriseUpdateSeenToDownloadDays(
       bool has_time_restriction_policy, int time_to_update_days) = 0;
+
+  // Helper function to report the statistics of the InstallOperations of a
+  // given type applied from a payload. |operation_type| is the name of the
+  // type, as returned by InstallOperationTypeName(). The following metrics are
+  // reported, named after |operation_type|:
+  //
+  //  |kMetricInstallOperationCount|
+  //  |kMetricInstallOperationDurationSeconds|
+  //  |kMetricInstallOperationBytesReadMiB|
+  //  |kMetricInstallOperationBytesWrittenMiB|
+  //  |kMetricInstallOperationBytesDownloadedMiB|
+  virtual void ReportInstallOperationMetrics(const std::string& operation_type,
+                                             int count,
+                                             base::TimeDelta duration,
+                                             int64_t bytes_read,
+                                             int64_t bytes_written,
+                                             int64_t bytes_downloaded) = 0;
+
+  // Helper function to report the I/O done during a phase of an update, like
+  // "Downloading", as returned by UpdatePhaseName(). The following metrics are
+  // reported, named after |phase|:
+  //
+  //  |kMetricPhaseDurationSeconds|
+  //  |kMetricPhaseProcessBytesReadMiB|
+  //  |kMetricPhaseProcessBytesWrittenMiB|
+  //  |kMetricPhaseStorageBytesReadMiB|
+  //  |kMetricPhaseStorageBytesWrittenMiB|
+  //  |kMetricPhaseStorageReadOps|
+  //  |kMetricPhaseStorageWriteOps|
+  //  |kMetricPhaseStorageQueueTimeSeconds|
+  virtual void ReportPhaseIoMetrics(const std::string& phase,
+                                    const PhaseIoStats& stats) = 0;
 };
 
 }  // namespace chromeos_update_engine
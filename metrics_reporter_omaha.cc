@@ -16,8 +16,13 @@
 
 #include "update_engine/metrics_reporter_omaha.h"
 
+#include <limits.h>
+
+#include <algorithm>
 #include <memory>
+#include <vector>
 
+#include <base/bind.h>
 #include <base/logging.h>
 #include <base/strings/string_number_conversions.h>
 #include <metrics/metrics_library.h>
@@ -31,6 +36,7 @@
 #include "update_engine/system_state.h"
 
 using std::string;
+using std::vector;
 
 namespace chromeos_update_engine {
 
@@ -78,6 +84,10 @@ const char kMetricAttemptInternalErrorCode[] =
     "UpdateEngine.Attempt.InternalErrorCode";
 const char kMetricAttemptDownloadErrorCode[] =
     "UpdateEngine.Attempt.DownloadErrorCode";
+const char kMetricAttemptLongestChunkIntervalSeconds[] =
+    "UpdateEngine.Attempt.LongestChunkIntervalSeconds";
+const char kMetricAttemptNumDownloadStalls[] =
+    "UpdateEngine.Attempt.NumDownloadStalls";
 
 // UpdateEngine.SuccessfulUpdate.* metrics.
 const char kMetricSuccessfulUpdateAttemptCount[] =
@@ -129,6 +139,26 @@ const char kMetricKernelMaxRollforwardVersion[] =
 const char kMetricKernelMaxRollforwardSetSuccess[] =
     "UpdateEngine.KernelKey.MaxRollforwardSetSuccess";
 
+// UpdateEngine.InstallOperation.<type>.* metrics.
+const char kMetricInstallOperationPrefix[] = "UpdateEngine.InstallOperation.";
+const char kMetricInstallOperationCount[] = ".Count";
+const char kMetricInstallOperationDurationSeconds[] = ".DurationSeconds";
+const char kMetricInstallOperationBytesReadMiB[] = ".BytesReadMiB";
+const char kMetricInstallOperationBytesWrittenMiB[] = ".BytesWrittenMiB";
+const char kMetricInstallOperationBytesDownloadedMiB[] =
+    ".BytesDownloadedMiB";
+
+// UpdateEngine.Phase.<phase>.* metrics.
+const char kMetricPhasePrefix[] = "UpdateEngine.Phase.";
+const char kMetricPhaseDurationSeconds[] = ".DurationSeconds";
+const char kMetricPhaseProcessBytesReadMiB[] = ".ProcessBytesReadMiB";
+const char kMetricPhaseProcessBytesWrittenMiB[] = ".ProcessBytesWrittenMiB";
+const char kMetricPhaseStorageBytesReadMiB[] = ".StorageBytesReadMiB";
+const char kMetricPhaseStorageBytesWrittenMiB[] = ".StorageBytesWrittenMiB";
+const char kMetricPhaseStorageReadOps[] = ".StorageReadOps";
+const char kMetricPhaseStorageWriteOps[] = ".StorageWriteOps";
+const char kMetricPhaseStorageQueueTimeSeconds[] = ".StorageQueueTimeSeconds";
+
 // UpdateEngine.* metrics.
 const char kMetricFailedUpdateCount[] = "UpdateEngine.FailedUpdateCount";
 const char kMetricInstallDateProvisioningSource[] =
@@ -144,6 +174,12 @@ std::unique_ptr<MetricsReporterInterface> CreateMetricsReporter() {
 MetricsReporterOmaha::MetricsReporterOmaha()
     : metrics_lib_(new MetricsLibrary()) {}
 
+MetricsReporterOmaha::~MetricsReporterOmaha() {
+  if (send_samples_task_id_ != brillo::MessageLoop::kTaskIdNull)
+    brillo::MessageLoop::current()->CancelTask(send_samples_task_id_);
+  SendQueuedSamples();
+}
+
 void MetricsReporterOmaha::Initialize() {
   metrics_lib_->Init();
 }
@@ -152,11 +188,11 @@ void MetricsReporterOmaha::ReportDailyMetrics(base::TimeDelta os_age) {
   string metric = metrics::kMetricDailyOSAgeDays;
   LOG(INFO) << "Uploading " << utils::FormatTimeDelta(os_age) << " for metric "
             << metric;
-  metrics_lib_->SendToUMA(metric,
-                          static_cast<int>(os_age.InDays()),
-                          0,       // min: 0 days
-                          6 * 30,  // max: 6 months (approx)
-                          50);     // num_buckets
+  SendToUMA(metric,
+            static_cast<int>(os_age.InDays()),
+            0,       // min: 0 days
+            6 * 30,  // max: 6 months (approx)
+            50);     // num_buckets
 }
 
 void MetricsReporterOmaha::ReportUpdateCheckMetrics(
@@ -173,20 +209,20 @@ void MetricsReporterOmaha::ReportUpdateCheckMetrics(
     value = static_cast<int>(result);
     max_value = static_cast<int>(metrics::CheckResult::kNumConstants) - 1;
     LOG(INFO) << "Sending " << value << " for metric " << metric << " (enum)";
-    metrics_lib_->SendEnumToUMA(metric, value, max_value);
+    SendEnumToUMA(metric, value, max_value);
   }
   if (reaction != metrics::CheckReaction::kUnset) {
     metric = metrics::kMetricCheckReaction;
     value = static_cast<int>(reaction);
     max_value = static_cast<int>(metrics::CheckReaction::kNumConstants) - 1;
     LOG(INFO) << "Sending " << value << " for metric " << metric << " (enum)";
-    metrics_lib_->SendEnumToUMA(metric, value, max_value);
+    SendEnumToUMA(metric, value, max_value);
   }
   if (download_error_code != metrics::DownloadErrorCode::kUnset) {
     metric = metrics::kMetricCheckDownloadErrorCode;
     value = static_cast<int>(download_error_code);
     LOG(INFO) << "Sending " << value << " for metric " << metric << " (sparse)";
-    metrics_lib_->SendSparseToUMA(metric, value);
+    SendSparseToUMA(metric, value);
   }
 
   base::TimeDelta time_since_last;
@@ -197,11 +233,11 @@ void MetricsReporterOmaha::ReportUpdateCheckMetrics(
     metric = metrics::kMetricCheckTimeSinceLastCheckMinutes;
     LOG(INFO) << "Sending " << utils::FormatTimeDelta(time_since_last)
               << " for metric " << metric;
-    metrics_lib_->SendToUMA(metric,
-                            time_since_last.InMinutes(),
-                            0,             // min: 0 min
-                            30 * 24 * 60,  // max: 30 days
-                            50);           // num_buckets
+    SendToUMA(metric,
+              time_since_last.InMinutes(),
+              0,             // min: 0 min
+              30 * 24 * 60,  // max: 30 days
+              50);           // num_buckets
   }
 
   base::TimeDelta uptime_since_last;
@@ -211,11 +247,11 @@ void MetricsReporterOmaha::ReportUpdateCheckMetrics(
     metric = metrics::kMetricCheckTimeSinceLastCheckUptimeMinutes;
     LOG(INFO) << "Sending " << utils::FormatTimeDelta(uptime_since_last)
               << " for metric " << metric;
-    metrics_lib_->SendToUMA(metric,
-                            uptime_since_last.InMinutes(),
-                            0,             // min: 0 min
-                            30 * 24 * 60,  // max: 30 days
-                            50);           // num_buckets
+    SendToUMA(metric,
+              uptime_since_last.InMinutes(),
+              0,             // min: 0 min
+              30 * 24 * 60,  // max: 30 days
+              50);           // num_buckets
   }
 
   // First section of target version specified for the update.
@@ -227,12 +263,12 @@ void MetricsReporterOmaha::ReportUpdateCheckMetrics(
       metric = metrics::kMetricCheckTargetVersion;
       LOG(INFO) << "Sending " << value << " for metric " << metric
                 << " (sparse)";
-      metrics_lib_->SendSparseToUMA(metric, value);
+      SendSparseToUMA(metric, value);
       if (system_state->request_params()->rollback_allowed()) {
         metric = metrics::kMetricCheckRollbackTargetVersion;
         LOG(INFO) << "Sending " << value << " for metric " << metric
                   << " (sparse)";
-        metrics_lib_->SendSparseToUMA(metric, value);
+        SendSparseToUMA(metric, value);
       }
     }
   }
@@ -245,10 +281,9 @@ void MetricsReporterOmaha::ReportAbnormallyTerminatedUpdateAttemptMetrics() {
 
   LOG(INFO) << "Uploading " << static_cast<int>(attempt_result)
             << " for metric " << metric;
-  metrics_lib_->SendEnumToUMA(
-      metric,
-      static_cast<int>(attempt_result),
-      static_cast<int>(metrics::AttemptResult::kNumConstants));
+  SendEnumToUMA(metric,
+                static_cast<int>(attempt_result),
+                static_cast<int>(metrics::AttemptResult::kNumConstants));
 }
 
 void MetricsReporterOmaha::ReportUpdateAttemptMetrics(
@@ -262,51 +297,50 @@ void MetricsReporterOmaha::ReportUpdateAttemptMetrics(
     ErrorCode internal_error_code) {
   string metric = metrics::kMetricAttemptNumber;
   LOG(INFO) << "Uploading " << attempt_number << " for metric " << metric;
-  metrics_lib_->SendToUMA(metric,
-                          attempt_number,
-                          0,    // min: 0 attempts
-                          49,   // max: 49 attempts
-                          50);  // num_buckets
+  SendToUMA(metric,
+            attempt_number,
+            0,    // min: 0 attempts
+            49,   // max: 49 attempts
+            50);  // num_buckets
 
   metric = metrics::kMetricAttemptPayloadType;
   LOG(INFO) << "Uploading " << utils::ToString(payload_type) << " for metric "
             << metric;
-  metrics_lib_->SendEnumToUMA(metric, payload_type, kNumPayloadTypes);
+  SendEnumToUMA(metric, payload_type, kNumPayloadTypes);
 
   metric = metrics::kMetricAttemptDurationMinutes;
   LOG(INFO) << "Uploading " << utils::FormatTimeDelta(duration)
             << " for metric " << metric;
-  metrics_lib_->SendToUMA(metric,
-                          duration.InMinutes(),
-                          0,             // min: 0 min
-                          10 * 24 * 60,  // max: 10 days
-                          50);           // num_buckets
+  SendToUMA(metric,
+            duration.InMinutes(),
+            0,             // min: 0 min
+            10 * 24 * 60,  // max: 10 days
+            50);           // num_buckets
 
   metric = metrics::kMetricAttemptDurationUptimeMinutes;
   LOG(INFO) << "Uploading " << utils::FormatTimeDelta(duration_uptime)
             << " for metric " << metric;
-  metrics_lib_->SendToUMA(metric,
-                          duration_uptime.InMinutes(),
-                          0,             // min: 0 min
-                          10 * 24 * 60,  // max: 10 days
-                          50);           // num_buckets
+  SendToUMA(metric,
+            duration_uptime.InMinutes(),
+            0,             // min: 0 min
+            10 * 24 * 60,  // max: 10 days
+            50);           // num_buckets
 
   metric = metrics::kMetricAttemptPayloadSizeMiB;
   int64_t payload_size_mib = payload_size / kNumBytesInOneMiB;
   LOG(INFO) << "Uploading " << payload_size_mib << " for metric " << metric;
-  metrics_lib_->SendToUMA(metric,
-                          payload_size_mib,
-                          0,     // min: 0 MiB
-                          1024,  // max: 1024 MiB = 1 GiB
-                          50);   // num_buckets
+  SendToUMA(metric,
+            payload_size_mib,
+            0,     // min: 0 MiB
+            1024,  // max: 1024 MiB = 1 GiB
+            50);   // num_buckets
 
   metric = metrics::kMetricAttemptResult;
   LOG(INFO) << "Uploading " << static_cast<int>(attempt_result)
             << " for metric " << metric;
-  metrics_lib_->SendEnumToUMA(
-      metric,
-      static_cast<int>(attempt_result),
-      static_cast<int>(metrics::AttemptResult::kNumConstants));
+  SendEnumToUMA(metric,
+                static_cast<int>(attempt_result),
+                static_cast<int>(metrics::AttemptResult::kNumConstants));
 
   if (internal_error_code != ErrorCode::kSuccess) {
     ReportInternalErrorCode(internal_error_code);
@@ -320,11 +354,11 @@ void MetricsReporterOmaha::ReportUpdateAttemptMetrics(
     metric = metrics::kMetricAttemptTimeSinceLastAttemptMinutes;
     LOG(INFO) << "Sending " << utils::FormatTimeDelta(time_since_last)
               << " for metric " << metric;
-    metrics_lib_->SendToUMA(metric,
-                            time_since_last.InMinutes(),
-                            0,             // min: 0 min
-                            30 * 24 * 60,  // max: 30 days
-                            50);           // num_buckets
+    SendToUMA(metric,
+              time_since_last.InMinutes(),
+              0,             // min: 0 min
+              30 * 24 * 60,  // max: 30 days
+              50);           // num_buckets
   }
 
   static int64_t uptime_since_last_storage = 0;
@@ -334,11 +368,11 @@ void MetricsReporterOmaha::ReportUpdateAttemptMetrics(
     metric = metrics::kMetricAttemptTimeSinceLastAttemptUptimeMinutes;
     LOG(INFO) << "Sending " << utils::FormatTimeDelta(uptime_since_last)
               << " for metric " << metric;
-    metrics_lib_->SendToUMA(metric,
-                            uptime_since_last.InMinutes(),
-                            0,             // min: 0 min
-                            30 * 24 * 60,  // max: 30 days
-                            50);           // num_buckets
+    SendToUMA(metric,
+              uptime_since_last.InMinutes(),
+              0,             // min: 0 min
+              30 * 24 * 60,  // max: 30 days
+              50);           // num_buckets
   }
 }
 
@@ -353,41 +387,67 @@ void MetricsReporterOmaha::ReportUpdateAttemptDownloadMetrics(
       payload_bytes_downloaded / kNumBytesInOneMiB;
   LOG(INFO) << "Uploading " << payload_bytes_downloaded_mib << " for metric "
             << metric;
-  metrics_lib_->SendToUMA(metric,
-                          payload_bytes_downloaded_mib,
-                          0,     // min: 0 MiB
-                          1024,  // max: 1024 MiB = 1 GiB
-                          50);   // num_buckets
+  SendToUMA(metric,
+            payload_bytes_downloaded_mib,
+            0,     // min: 0 MiB
+            1024,  // max: 1024 MiB = 1 GiB
+            50);   // num_buckets
 
   metric = metrics::kMetricAttemptPayloadDownloadSpeedKBps;
   int64_t payload_download_speed_kbps = payload_download_speed_bps / 1000;
   LOG(INFO) << "Uploading " << payload_download_speed_kbps << " for metric "
             << metric;
-  metrics_lib_->SendToUMA(metric,
-                          payload_download_speed_kbps,
-                          0,          // min: 0 kB/s
-                          10 * 1000,  // max: 10000 kB/s = 10 MB/s
-                          50);        // num_buckets
+  SendToUMA(metric,
+            payload_download_speed_kbps,
+            0,          // min: 0 kB/s
+            10 * 1000,  // max: 10000 kB/s = 10 MB/s
+            50);        // num_buckets
 
   metric = metrics::kMetricAttemptDownloadSource;
   LOG(INFO) << "Uploading " << download_source << " for metric " << metric;
-  metrics_lib_->SendEnumToUMA(metric, download_source, kNumDownloadSources);
+  SendEnumToUMA(metric, download_source, kNumDownloadSources);
 
   if (payload_download_error_code != metrics::DownloadErrorCode::kUnset) {
     metric = metrics::kMetricAttemptDownloadErrorCode;
     LOG(INFO) << "Uploading " << static_cast<int>(payload_download_error_code)
               << " for metric " << metric << " (sparse)";
-    metrics_lib_->SendSparseToUMA(
-        metric, static_cast<int>(payload_download_error_code));
+    SendSparseToUMA(metric, static_cast<int>(payload_download_error_code));
   }
 
   metric = metrics::kMetricAttemptConnectionType;
   LOG(INFO) << "Uploading " << static_cast<int>(connection_type)
             << " for metric " << metric;
-  metrics_lib_->SendEnumToUMA(
-      metric,
-      static_cast<int>(connection_type),
-      static_cast<int>(metrics::ConnectionType::kNumConstants));
+  SendEnumToUMA(metric,
+                static_cast<int>(connection_type),
+                static_cast<int>(metrics::ConnectionType::kNumConstants));
+}
+
+void MetricsReporterOmaha::ReportDownloadChunkIntervalMetrics(
+    const vector<uint32_t>& chunk_interval_counts,
+    base::TimeDelta longest_chunk_interval) {
+  string metric = metrics::kMetricAttemptLongestChunkIntervalSeconds;
+  int64_t longest_chunk_interval_seconds = longest_chunk_interval.InSeconds();
+  LOG(INFO) << "Uploading " << longest_chunk_interval_seconds
+            << " for metric " << metric;
+  SendToUMA(metric,
+            longest_chunk_interval_seconds,
+            0,     // min: 0 seconds
+            3600,  // max: 1 hour
+            50);   // num_buckets
+
+  // A stall is an interval of 4 seconds or more between two chunks, which
+  // starts the bucket 12 of the histogram.
+  const size_t kFirstStallBucket = 12;
+  int64_t num_download_stalls = 0;
+  for (size_t i = kFirstStallBucket; i < chunk_interval_counts.size(); i++)
+    num_download_stalls += chunk_interval_counts[i];
+  metric = metrics::kMetricAttemptNumDownloadStalls;
+  LOG(INFO) << "Uploading " << num_download_stalls << " for metric " << metric;
+  SendToUMA(metric,
+            num_download_stalls,
+            0,     // min: 0 stalls
+            1000,  // max: 1000 stalls
+            50);   // num_buckets
 }
 
 void MetricsReporterOmaha::ReportSuccessfulUpdateMetrics(
@@ -404,11 +464,11 @@ void MetricsReporterOmaha::ReportSuccessfulUpdateMetrics(
   string metric = metrics::kMetricSuccessfulUpdatePayloadSizeMiB;
   int64_t mbs = payload_size / kNumBytesInOneMiB;
   LOG(INFO) << "Uploading " << mbs << " (MiBs) for metric " << metric;
-  metrics_lib_->SendToUMA(metric,
-                          mbs,
-                          0,     // min: 0 MiB
-                          1024,  // max: 1024 MiB = 1 GiB
-                          50);   // num_buckets
+  SendToUMA(metric,
+            mbs,
+            0,     // min: 0 MiB
+            1024,  // max: 1024 MiB = 1 GiB
+            50);   // num_buckets
 
   int64_t total_bytes = 0;
   int download_sources_used = 0;
@@ -434,89 +494,89 @@ void MetricsReporterOmaha::ReportSuccessfulUpdateMetrics(
 
     if (mbs > 0) {
       LOG(INFO) << "Uploading " << mbs << " (MiBs) for metric " << metric;
-      metrics_lib_->SendToUMA(metric,
-                              mbs,
-                              0,     // min: 0 MiB
-                              1024,  // max: 1024 MiB = 1 GiB
-                              50);   // num_buckets
+      SendToUMA(metric,
+                mbs,
+                0,     // min: 0 MiB
+                1024,  // max: 1024 MiB = 1 GiB
+                50);   // num_buckets
     }
   }
 
   metric = metrics::kMetricSuccessfulUpdateDownloadSourcesUsed;
   LOG(INFO) << "Uploading 0x" << std::hex << download_sources_used
             << " (bit flags) for metric " << metric;
-  metrics_lib_->SendToUMA(metric,
-                          download_sources_used,
-                          0,                               // min
-                          (1 << kNumDownloadSources) - 1,  // max
-                          1 << kNumDownloadSources);       // num_buckets
+  SendToUMA(metric,
+            download_sources_used,
+            0,                               // min
+            (1 << kNumDownloadSources) - 1,  // max
+            1 << kNumDownloadSources);       // num_buckets
 
   metric = metrics::kMetricSuccessfulUpdateDownloadOverheadPercentage;
   LOG(INFO) << "Uploading " << download_overhead_percentage << "% for metric "
             << metric;
-  metrics_lib_->SendToUMA(metric,
-                          download_overhead_percentage,
-                          0,     // min: 0% overhead
-                          1000,  // max: 1000% overhead
-                          50);   // num_buckets
+  SendToUMA(metric,
+            download_overhead_percentage,
+            0,     // min: 0% overhead
+            1000,  // max: 1000% overhead
+            50);   // num_buckets
 
   metric = metrics::kMetricSuccessfulUpdateUrlSwitchCount;
   LOG(INFO) << "Uploading " << url_switch_count << " (count) for metric "
             << metric;
-  metrics_lib_->SendToUMA(metric,
-                          url_switch_count,
-                          0,    // min: 0 URL switches
-                          49,   // max: 49 URL switches
-                          50);  // num_buckets
+  SendToUMA(metric,
+            url_switch_count,
+            0,    // min: 0 URL switches
+            49,   // max: 49 URL switches
+            50);  // num_buckets
 
   metric = metrics::kMetricSuccessfulUpdateTotalDurationMinutes;
   LOG(INFO) << "Uploading " << utils::FormatTimeDelta(total_duration)
             << " for metric " << metric;
-  metrics_lib_->SendToUMA(metric,
-                          static_cast<int>(total_duration.InMinutes()),
-                          0,              // min: 0 min
-                          365 * 24 * 60,  // max: 365 days ~= 1 year
-                          50);            // num_buckets
+  SendToUMA(metric,
+            static_cast<int>(total_duration.InMinutes()),
+            0,              // min: 0 min
+            365 * 24 * 60,  // max: 365 days ~= 1 year
+            50);            // num_buckets
 
   metric = metrics::kMetricSuccessfulUpdateTotalDurationUptimeMinutes;
   LOG(INFO) << "Uploading " << utils::FormatTimeDelta(total_duration_uptime)
             << " for metric " << metric;
-  metrics_lib_->SendToUMA(metric,
-                          static_cast<int>(total_duration_uptime.InMinutes()),
-                          0,             // min: 0 min
-                          30 * 24 * 60,  // max: 30 days
-                          50);           // num_buckets
+  SendToUMA(metric,
+            static_cast<int>(total_duration_uptime.InMinutes()),
+            0,             // min: 0 min
+            30 * 24 * 60,  // max: 30 days
+            50);           // num_buckets
 
   metric = metrics::kMetricSuccessfulUpdateRebootCount;
   LOG(INFO) << "Uploading reboot count of " << reboot_count << " for metric "
             << metric;
-  metrics_lib_->SendToUMA(metric,
-                          reboot_count,
-                          0,    // min: 0 reboots
-                          49,   // max: 49 reboots
-                          50);  // num_buckets
+  SendToUMA(metric,
+            reboot_count,
+            0,    // min: 0 reboots
+            49,   // max: 49 reboots
+            50);  // num_buckets
 
   metric = metrics::kMetricSuccessfulUpdatePayloadType;
-  metrics_lib_->SendEnumToUMA(metric, payload_type, kNumPayloadTypes);
+  SendEnumToUMA(metric, payload_type, kNumPayloadTypes);
   LOG(INFO) << "Uploading " << utils::ToString(payload_type) << " for metric "
             << metric;
 
   metric = metrics::kMetricSuccessfulUpdateAttemptCount;
-  metrics_lib_->SendToUMA(metric,
-                          attempt_count,
-                          1,    // min: 1 attempt
-                          50,   // max: 50 attempts
-                          50);  // num_buckets
+  SendToUMA(metric,
+            attempt_count,
+            1,    // min: 1 attempt
+            50,   // max: 50 attempts
+            50);  // num_buckets
   LOG(INFO) << "Uploading " << attempt_count << " for metric " << metric;
 
   metric = metrics::kMetricSuccessfulUpdateUpdatesAbandonedCount;
   LOG(INFO) << "Uploading " << updates_abandoned_count << " (count) for metric "
             << metric;
-  metrics_lib_->SendToUMA(metric,
-                          updates_abandoned_count,
-                          0,    // min: 0 counts
-                          49,   // max: 49 counts
-                          50);  // num_buckets
+  SendToUMA(metric,
+            updates_abandoned_count,
+            0,    // min: 0 counts
+            49,   // max: 49 counts
+            50);  // num_buckets
 }
 
 void MetricsReporterOmaha::ReportRollbackMetrics(
@@ -524,8 +584,9 @@ void MetricsReporterOmaha::ReportRollbackMetrics(
   string metric = metrics::kMetricRollbackResult;
   int value = static_cast<int>(result);
   LOG(INFO) << "Sending " << value << " for metric " << metric << " (enum)";
-  metrics_lib_->SendEnumToUMA(
-      metric, value, static_cast<int>(metrics::RollbackResult::kNumConstants));
+  SendEnumToUMA(metric,
+                value,
+                static_cast<int>(metrics::RollbackResult::kNumConstants));
 }
 
 void MetricsReporterOmaha::ReportEnterpriseRollbackMetrics(
@@ -535,7 +596,7 @@ void MetricsReporterOmaha::ReportEnterpriseRollbackMetrics(
   if (!success)
     metric = metrics::kMetricEnterpriseRollbackFailure;
   LOG(INFO) << "Sending " << value << " for metric " << metric;
-  metrics_lib_->SendSparseToUMA(metric, value);
+  SendSparseToUMA(metric, value);
 }
 
 void MetricsReporterOmaha::ReportCertificateCheckMetrics(
@@ -553,19 +614,18 @@ void MetricsReporterOmaha::ReportCertificateCheckMetrics(
   }
   LOG(INFO) << "Uploading " << static_cast<int>(result) << " for metric "
             << metric;
-  metrics_lib_->SendEnumToUMA(
-      metric,
-      static_cast<int>(result),
-      static_cast<int>(CertificateCheckResult::kNumConstants));
+  SendEnumToUMA(metric,
+                static_cast<int>(result),
+                static_cast<int>(CertificateCheckResult::kNumConstants));
 }
 
 void MetricsReporterOmaha::ReportFailedUpdateCount(int target_attempt) {
   string metric = metrics::kMetricFailedUpdateCount;
-  metrics_lib_->SendToUMA(metric,
-                          target_attempt,
-                          1,   // min value
-                          50,  // max value
-                          kNumDefaultUmaBuckets);
+  SendToUMA(metric,
+            target_attempt,
+            1,   // min value
+            50,  // max value
+            kNumDefaultUmaBuckets);
 
   LOG(INFO) << "Uploading " << target_attempt << " (count) for metric "
             << metric;
@@ -573,11 +633,11 @@ void MetricsReporterOmaha::ReportFailedUpdateCount(int target_attempt) {
 
 void MetricsReporterOmaha::ReportTimeToReboot(int time_to_reboot_minutes) {
   string metric = metrics::kMetricTimeToRebootMinutes;
-  metrics_lib_->SendToUMA(metric,
-                          time_to_reboot_minutes,
-                          0,             // min: 0 minute
-                          30 * 24 * 60,  // max: 1 month (approx)
-                          kNumDefaultUmaBuckets);
+  SendToUMA(metric,
+            time_to_reboot_minutes,
+            0,             // min: 0 minute
+            30 * 24 * 60,  // max: 1 month (approx)
+            kNumDefaultUmaBuckets);
 
   LOG(INFO) << "Uploading " << time_to_reboot_minutes << " for metric "
             << metric;
@@ -585,17 +645,17 @@ void MetricsReporterOmaha::ReportTimeToReboot(int time_to_reboot_minutes) {
 
 void MetricsReporterOmaha::ReportInstallDateProvisioningSource(int source,
                                                                int max) {
-  metrics_lib_->SendEnumToUMA(metrics::kMetricInstallDateProvisioningSource,
-                              source,  // Sample.
-                              max);
+  SendEnumToUMA(metrics::kMetricInstallDateProvisioningSource,
+                source,  // Sample.
+                max);
 }
 
 void MetricsReporterOmaha::ReportInternalErrorCode(ErrorCode error_code) {
   auto metric = metrics::kMetricAttemptInternalErrorCode;
   LOG(INFO) << "Uploading " << error_code << " for metric " << metric;
-  metrics_lib_->SendEnumToUMA(metric,
-                              static_cast<int>(error_code),
-                              static_cast<int>(ErrorCode::kUmaReportedMax));
+  SendEnumToUMA(metric,
+                static_cast<int>(error_code),
+                static_cast<int>(ErrorCode::kUmaReportedMax));
 }
 
 void MetricsReporterOmaha::ReportKeyVersionMetrics(
@@ -605,18 +665,18 @@ void MetricsReporterOmaha::ReportKeyVersionMetrics(
   int value = kernel_min_version;
   string metric = metrics::kMetricKernelMinVersion;
   LOG(INFO) << "Sending " << value << " for metric " << metric;
-  metrics_lib_->SendSparseToUMA(metric, value);
+  SendSparseToUMA(metric, value);
 
   value = kernel_max_rollforward_version;
   metric = metrics::kMetricKernelMaxRollforwardVersion;
   LOG(INFO) << "Sending " << value << " for metric " << metric;
-  metrics_lib_->SendSparseToUMA(metric, value);
+  SendSparseToUMA(metric, value);
 
   bool bool_value = kernel_max_rollforward_success;
   metric = metrics::kMetricKernelMaxRollforwardSetSuccess;
   LOG(INFO) << "Sending " << bool_value << " for metric " << metric
             << " (bool)";
-  metrics_lib_->SendBoolToUMA(metric, bool_value);
+  SendBoolToUMA(metric, bool_value);
 }
 
 void MetricsReporterOmaha::ReportEnterpriseUpdateSeenToDownloadDays(
@@ -627,11 +687,182 @@ void MetricsReporterOmaha::ReportEnterpriseUpdateSeenToDownloadDays(
           : metrics::kMetricSuccessfulUpdateDurationFromSeenDays;
   LOG(INFO) << "Sending " << time_to_update_days << " for metric " << metric;
 
-  metrics_lib_->SendToUMA(metric,
-                          time_to_update_days,
-                          1,       // min: 1 days
-                          6 * 30,  // max: 6 months (approx)
-                          50);     // num_buckets
+  SendToUMA(metric,
+            time_to_update_days,
+            1,       // min: 1 days
+            6 * 30,  // max: 6 months (approx)
+            50);     // num_buckets
+}
+
+void MetricsReporterOmaha::ReportInstallOperationMetrics(
+    const string& operation_type,
+    int count,
+    base::TimeDelta duration,
+    int64_t bytes_read,
+    int64_t bytes_written,
+    int64_t bytes_downloaded) {
+  string metric_prefix = metrics::kMetricInstallOperationPrefix;
+  metric_prefix += operation_type;
+
+  string metric = metric_prefix + metrics::kMetricInstallOperationCount;
+  LOG(INFO) << "Uploading " << count << " (count) for metric " << metric;
+  SendToUMA(metric,
+            count,
+            1,       // min: 1 operation
+            100000,  // max: 100000 operations
+            50);     // num_buckets
+
+  metric = metric_prefix + metrics::kMetricInstallOperationDurationSeconds;
+  LOG(INFO) << "Uploading " << utils::FormatTimeDelta(duration)
+            << " for metric " << metric;
+  SendToUMA(metric,
+            static_cast<int>(duration.InSeconds()),
+            0,         // min: 0 seconds
+            6 * 3600,  // max: 6 hours
+            50);       // num_buckets
+
+  const struct {
+    const char* suffix;
+    int64_t bytes;
+  } byte_metrics[] = {
+      {metrics::kMetricInstallOperationBytesReadMiB, bytes_read},
+      {metrics::kMetricInstallOperationBytesWrittenMiB, bytes_written},
+      {metrics::kMetricInstallOperationBytesDownloadedMiB, bytes_downloaded},
+  };
+  for (const auto& byte_metric : byte_metrics) {
+    metric = metric_prefix + byte_metric.suffix;
+    int64_t mbs = byte_metric.bytes / kNumBytesInOneMiB;
+    LOG(INFO) << "Uploading " << mbs << " (MiBs) for metric " << metric;
+    SendToUMA(metric,
+              mbs,
+              0,     // min: 0 MiB
+              8192,  // max: 8192 MiB = 8 GiB
+              50);   // num_buckets
+  }
+}
+
+void MetricsReporterOmaha::ReportPhaseIoMetrics(const string& phase,
+                                                const PhaseIoStats& stats) {
+  string metric_prefix = metrics::kMetricPhasePrefix;
+  metric_prefix += phase;
+
+  const struct {
+    const char* suffix;
+    int64_t seconds;
+  } time_metrics[] = {
+      {metrics::kMetricPhaseDurationSeconds, stats.duration.InSeconds()},
+      {metrics::kMetricPhaseStorageQueueTimeSeconds,
+       static_cast<int64_t>(stats.storage.queue_time_ms / 1000)},
+  };
+  for (const auto& time_metric : time_metrics) {
+    string metric = metric_prefix + time_metric.suffix;
+    LOG(INFO) << "Uploading " << time_metric.seconds << " (seconds) for metric "
+              << metric;
+    SendToUMA(metric,
+              time_metric.seconds,
+              0,         // min: 0 seconds
+              6 * 3600,  // max: 6 hours
+              50);       // num_buckets
+  }
+
+  const struct {
+    const char* suffix;
+    uint64_t bytes;
+  } byte_metrics[] = {
+      {metrics::kMetricPhaseProcessBytesReadMiB, stats.process.bytes_read},
+      {metrics::kMetricPhaseProcessBytesWrittenMiB,
+       stats.process.bytes_written},
+      {metrics::kMetricPhaseStorageBytesReadMiB, stats.storage.bytes_read},
+      {metrics::kMetricPhaseStorageBytesWrittenMiB,
+       stats.storage.bytes_written},
+  };
+  for (const auto& byte_metric : byte_metrics) {
+    string metric = metric_prefix + byte_metric.suffix;
+    int64_t mbs = byte_metric.bytes / kNumBytesInOneMiB;
+    LOG(INFO) << "Uploading " << mbs << " (MiBs) for metric " << metric;
+    SendToUMA(metric,
+              mbs,
+              0,      // min: 0 MiB
+              16384,  // max: 16384 MiB = 16 GiB
+              50);    // num_buckets
+  }
+
+  const struct {
+    const char* suffix;
+    uint64_t ops;
+  } ops_metrics[] = {
+      {metrics::kMetricPhaseStorageReadOps, stats.storage.read_ops},
+      {metrics::kMetricPhaseStorageWriteOps, stats.storage.write_ops},
+  };
+  for (const auto& ops_metric : ops_metrics) {
+    string metric = metric_prefix + ops_metric.suffix;
+    LOG(INFO) << "Uploading " << ops_metric.ops << " (count) for metric "
+              << metric;
+    SendToUMA(metric,
+              static_cast<int>(std::min<uint64_t>(ops_metric.ops, INT_MAX)),
+              1,         // min: 1 operation
+              10000000,  // max: 10 million operations
+              50);       // num_buckets
+  }
+}
+
+void MetricsReporterOmaha::SendToUMA(
+    const string& metric, int value, int min, int max, int num_buckets) {
+  QueueSample({Sample::Type::kHistogram, metric, value, min, max, num_buckets});
+}
+
+void MetricsReporterOmaha::SendEnumToUMA(const string& metric,
+                                         int value,
+                                         int max) {
+  QueueSample({Sample::Type::kEnum, metric, value, 0, max, 0});
+}
+
+void MetricsReporterOmaha::SendSparseToUMA(const string& metric, int value) {
+  QueueSample({Sample::Type::kSparse, metric, value, 0, 0, 0});
+}
+
+void MetricsReporterOmaha::SendBoolToUMA(const string& metric, bool value) {
+  QueueSample({Sample::Type::kBool, metric, value, 0, 0, 0});
+}
+
+void MetricsReporterOmaha::QueueSample(const Sample& sample) {
+  queued_samples_.push_back(sample);
+  brillo::MessageLoop* loop = brillo::MessageLoop::current();
+  if (!loop) {
+    SendQueuedSamples();
+    return;
+  }
+  if (send_samples_task_id_ == brillo::MessageLoop::kTaskIdNull) {
+    send_samples_task_id_ = loop->PostTask(
+        FROM_HERE,
+        base::Bind(&MetricsReporterOmaha::SendQueuedSamples,
+                   base::Unretained(this)));
+  }
+}
+
+void MetricsReporterOmaha::SendQueuedSamples() {
+  send_samples_task_id_ = brillo::MessageLoop::kTaskIdNull;
+  for (const Sample& sample : queued_samples_) {
+    switch (sample.type) {
+      case Sample::Type::kHistogram:
+        SendToUMA(sample.metric,
+                  sample.value,
+                  sample.min,
+                  sample.max,
+                  sample.num_buckets);
+        break;
+      case Sample::Type::kEnum:
+        SendEnumToUMA(sample.metric, sample.value, sample.max);
+        break;
+      case Sample::Type::kSparse:
+        SendSparseToUMA(sample.metric, sample.value);
+        break;
+      case Sample::Type::kBool:
+        SendBoolToUMA(sample.metric, sample.value != 0);
+        break;
+    }
+  }
+  queued_samples_.clear();
 }
 
 }  // namespace chromeos_update_engine
@@ -19,8 +19,10 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <base/time/time.h>
+#include <brillo/message_loops/message_loop.h>
 #include <metrics/metrics_library.h>
 
 #include "update_engine/certificate_checker.h"
@@ -63,6 +65,8 @@ extern const char kMetricAttemptDownloadSource[];
 extern const char kMetricAttemptResult[];
 extern const char kMetricAttemptInternalErrorCode[];
 extern const char kMetricAttemptDownloadErrorCode[];
+extern const char kMetricAttemptLongestChunkIntervalSeconds[];
+extern const char kMetricAttemptNumDownloadStalls[];
 
 // UpdateEngine.SuccessfulUpdate.* metrics.
 extern const char kMetricSuccessfulUpdateAttemptCount[];
@@ -95,6 +99,27 @@ extern const char kMetricKernelMinVersion[];
 extern const char kMetricKernelMaxRollforwardVersion[];
 extern const char kMetricKernelMaxRollforwardSetSuccess[];
 
+// UpdateEngine.InstallOperation.<type>.* metrics, where <type> is the name of
+// the InstallOperation type.
+extern const char kMetricInstallOperationPrefix[];
+extern const char kMetricInstallOperationCount[];
+extern const char kMetricInstallOperationDurationSeconds[];
+extern const char kMetricInstallOperationBytesReadMiB[];
+extern const char kMetricInstallOperationBytesWrittenMiB[];
+extern const char kMetricInstallOperationBytesDownloadedMiB[];
+
+// UpdateEngine.Phase.<phase>.* metrics, where <phase> is the name of the phase
+// of the update.
+extern const char kMetricPhasePrefix[];
+extern const char kMetricPhaseDurationSeconds[];
+extern const char kMetricPhaseProcessBytesReadMiB[];
+extern const char kMetricPhaseProcessBytesWrittenMiB[];
+extern const char kMetricPhaseStorageBytesReadMiB[];
+extern const char kMetricPhaseStorageBytesWrittenMiB[];
+extern const char kMetricPhaseStorageReadOps[];
+extern const char kMetricPhaseStorageWriteOps[];
+extern const char kMetricPhaseStorageQueueTimeSeconds[];
+
 // UpdateEngine.* metrics.
 extern const char kMetricFailedUpdateCount[];
 extern const char kMetricInstallDateProvisioningSource[];
@@ -106,7 +131,8 @@ class MetricsReporterOmaha : public MetricsReporterInterface {
  public:
   MetricsReporterOmaha();
 
-  ~MetricsReporterOmaha() override = default;
+  // Sends the samples still waiting to be sent.
+  ~MetricsReporterOmaha() override;
 
   void Initialize() override;
 
@@ -139,6 +165,10 @@ class MetricsReporterOmaha : public MetricsReporterInterface {
       metrics::DownloadErrorCode payload_download_error_code,
       metrics::ConnectionType connection_type) override;
 
+  void ReportDownloadChunkIntervalMetrics(
+      const std::vector<uint32_t>& chunk_interval_counts,
+      base::TimeDelta longest_chunk_interval) override;
+
   void ReportAbnormallyTerminatedUpdateAttemptMetrics() override;
 
   void ReportSuccessfulUpdateMetrics(
@@ -171,11 +201,51 @@ class MetricsReporterOmaha : public MetricsReporterInterface {
   void ReportEnterpriseUpdateSeenToDownloadDays(
       bool has_time_restriction_policy, int time_to_update_days) override;
 
+  void ReportInstallOperationMetrics(const std::string& operation_type,
+                                     int count,
+                                     base::TimeDelta duration,
+                                     int64_t bytes_read,
+                                     int64_t bytes_written,
+                                     int64_t bytes_downloaded) override;
+
+  void ReportPhaseIoMetrics(const std::string& phase,
+                            const PhaseIoStats& stats) override;
+
  private:
   friend class MetricsReporterOmahaTest;
 
+  // A sample waiting to be sent through |metrics_lib_|.
+  struct Sample {
+    enum class Type { kHistogram, kEnum, kSparse, kBool };
+
+    Type type;
+    std::string metric;
+    int value;
+    int min;
+    int max;
+    int num_buckets;
+  };
+
+  // Queue a sample to be sent along with all the other samples reported while
+  // running the same message loop task, once that task is done. The samples
+  // are sent right away when there is no message loop.
+  void SendToUMA(
+      const std::string& metric, int value, int min, int max, int num_buckets);
+  void SendEnumToUMA(const std::string& metric, int value, int max);
+  void SendSparseToUMA(const std::string& metric, int value);
+  void SendBoolToUMA(const std::string& metric, bool value);
+  void QueueSample(const Sample& sample);
+
+  // Sends the queued samples through |metrics_lib_|.
+  void SendQueuedSamples();
+
   std::unique_ptr<MetricsLibraryInterface> metrics_lib_;
 
+  // The samples waiting to be sent and the task sending them.
+  std::vector<Sample> queued_samples_;
+  brillo::MessageLoop::TaskId send_samples_task_id_{
+      brillo::MessageLoop::kTaskIdNull};
+
   DISALLOW_COPY_AND_ASSIGN(MetricsReporterOmaha);
 };  // class metrics
 
@@ -18,8 +18,10 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <base/time/time.h>
+#include <brillo/message_loops/fake_message_loop.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include <metrics/metrics_library_mock.h>
@@ -57,6 +59,25 @@ TEST_F(MetricsReporterOmahaTest, ReportDailyMetrics) {
   reporter_.ReportDailyMetrics(age);
 }
 
+TEST_F(MetricsReporterOmahaTest, SamplesSentFromMessageLoop) {
+  brillo::FakeMessageLoop loop(nullptr);
+  loop.SetAsCurrent();
+  EXPECT_CALL(*mock_metrics_lib_, SendToUMA(_, _, _, _, _)).Times(0);
+  reporter_.ReportDailyMetrics(TimeDelta::FromDays(10));
+  testing::Mock::VerifyAndClearExpectations(mock_metrics_lib_);
+
+  // The samples reported from the same task are sent by a single task.
+  EXPECT_CALL(*mock_metrics_lib_,
+              SendToUMA(metrics::kMetricDailyOSAgeDays, _, _, _, _))
+      .Times(1);
+  EXPECT_CALL(*mock_metrics_lib_,
+              SendToUMA(metrics::kMetricFailedUpdateCount, 2, _, _, _))
+      .Times(1);
+  reporter_.ReportFailedUpdateCount(2);
+  EXPECT_TRUE(loop.RunOnce(false));
+  EXPECT_FALSE(loop.PendingTasks());
+}
+
 TEST_F(MetricsReporterOmahaTest, ReportUpdateCheckMetrics) {
   FakeSystemState fake_system_state;
   FakeClock fake_clock;
@@ -312,6 +333,28 @@ TEST_F(MetricsReporterOmahaTest, ReportUpdateAttemptDownloadMetrics) {
                                                connection_type);
 }
 
+TEST_F(MetricsReporterOmahaTest, ReportDownloadChunkIntervalMetrics) {
+  std::vector<uint32_t> chunk_interval_counts(16, 0);
+  chunk_interval_counts[0] = 100;
+  chunk_interval_counts[11] = 4;  // Just under 4 seconds.
+  chunk_interval_counts[12] = 2;
+  chunk_interval_counts[15] = 1;
+
+  EXPECT_CALL(*mock_metrics_lib_,
+              SendToUMA(metrics::kMetricAttemptLongestChunkIntervalSeconds,
+                        40,
+                        _,
+                        _,
+                        _))
+      .Times(1);
+  EXPECT_CALL(*mock_metrics_lib_,
+              SendToUMA(metrics::kMetricAttemptNumDownloadStalls, 3, _, _, _))
+      .Times(1);
+
+  reporter_.ReportDownloadChunkIntervalMetrics(
+      chunk_interval_counts, base::TimeDelta::FromSeconds(40));
+}
+
 TEST_F(MetricsReporterOmahaTest, ReportSuccessfulUpdateMetrics) {
   int attempt_count = 3;
   int updates_abandoned_count = 2;
@@ -538,4 +581,92 @@ TEST_F(MetricsReporterOmahaTest,
       true /* has_time_restriction_policy */, kDaysToUpdate);
 }
 
+TEST_F(MetricsReporterOmahaTest, ReportInstallOperationMetrics) {
+  const std::string prefix =
+      std::string(metrics::kMetricInstallOperationPrefix) + "PUFFDIFF";
+
+  EXPECT_CALL(
+      *mock_metrics_lib_,
+      SendToUMA(prefix + metrics::kMetricInstallOperationCount,
+                42,
+                _,
+                _,
+                _))
+      .Times(1);
+  EXPECT_CALL(
+      *mock_metrics_lib_,
+      SendToUMA(prefix + metrics::kMetricInstallOperationDurationSeconds,
+                90,
+                _,
+                _,
+                _))
+      .Times(1);
+  EXPECT_CALL(
+      *mock_metrics_lib_,
+      SendToUMA(prefix + metrics::kMetricInstallOperationBytesReadMiB,
+                10,
+                _,
+                _,
+                _))
+      .Times(1);
+  EXPECT_CALL(
+      *mock_metrics_lib_,
+      SendToUMA(prefix + metrics::kMetricInstallOperationBytesWrittenMiB,
+                20,
+                _,
+                _,
+                _))
+      .Times(1);
+  EXPECT_CALL(
+      *mock_metrics_lib_,
+      SendToUMA(prefix + metrics::kMetricInstallOperationBytesDownloadedMiB,
+                3,
+                _,
+                _,
+                _))
+      .Times(1);
+
+  reporter_.ReportInstallOperationMetrics("PUFFDIFF",
+                                          42,
+                                          TimeDelta::FromSeconds(90),
+                                          10 * kNumBytesInOneMiB,
+                                          20 * kNumBytesInOneMiB,
+                                          3 * kNumBytesInOneMiB);
+}
+
+TEST_F(MetricsReporterOmahaTest, ReportPhaseIoMetrics) {
+  const std::string prefix =
+      std::string(metrics::kMetricPhasePrefix) + "Downloading";
+  PhaseIoStats stats;
+  stats.duration = TimeDelta::FromSeconds(600);
+  stats.process.bytes_read = 10 * kNumBytesInOneMiB;
+  stats.process.bytes_written = 20 * kNumBytesInOneMiB;
+  stats.storage.bytes_read = 30 * kNumBytesInOneMiB;
+  stats.storage.bytes_written = 40 * kNumBytesInOneMiB;
+  stats.storage.read_ops = 500;
+  stats.storage.write_ops = 600;
+  stats.storage.queue_time_ms = 70000;
+
+  const struct {
+    const char* suffix;
+    int value;
+  } expected_metrics[] = {
+      {metrics::kMetricPhaseDurationSeconds, 600},
+      {metrics::kMetricPhaseStorageQueueTimeSeconds, 70},
+      {metrics::kMetricPhaseProcessBytesReadMiB, 10},
+      {metrics::kMetricPhaseProcessBytesWrittenMiB, 20},
+      {metrics::kMetricPhaseStorageBytesReadMiB, 30},
+      {metrics::kMetricPhaseStorageBytesWrittenMiB, 40},
+      {metrics::kMetricPhaseStorageReadOps, 500},
+      {metrics::kMetricPhaseStorageWriteOps, 600},
+  };
+  for (const auto& expected : expected_metrics) {
+    EXPECT_CALL(*mock_metrics_lib_,
+                SendToUMA(prefix + expected.suffix, expected.value, _, _, _))
+        .Times(1);
+  }
+
+  reporter_.ReportPhaseIoMetrics("Downloading", stats);
+}
+
 }  // namespace chromeos_update_engine
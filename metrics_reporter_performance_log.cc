@@ -0,0 +1,280 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/metrics_reporter_performance_log.h"
+
+#include <sys/resource.h>
+
+#include <memory>
+#include <utility>
+
+#include <base/files/file_util.h>
+#include <base/json/json_writer.h>
+#include <base/logging.h>
+#include <base/strings/string_split.h>
+
+#include "update_engine/common/error_code_utils.h"
+#include "update_engine/common/utils.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+const char kPerformanceLogFileName[] = "update_performance_log";
+
+namespace {
+
+// The number of update attempts kept in the log.
+const size_t kPerformanceLogMaxRecords = 20;
+
+}  // namespace
+
+MetricsReporterPerformanceLog::MetricsReporterPerformanceLog(
+    std::unique_ptr<MetricsReporterInterface> reporter)
+    : reporter_(std::move(reporter)),
+      max_records_(kPerformanceLogMaxRecords),
+      operations_(new base::ListValue()) {}
+
+void MetricsReporterPerformanceLog::Initialize() {
+  reporter_->Initialize();
+}
+
+void MetricsReporterPerformanceLog::ReportRollbackMetrics(
+    metrics::RollbackResult result) {
+  reporter_->ReportRollbackMetrics(result);
+}
+
+void MetricsReporterPerformanceLog::ReportEnterpriseRollbackMetrics(
+    bool success, const string& rollback_version) {
+  reporter_->ReportEnterpriseRollbackMetrics(success, rollback_version);
+}
+
+void MetricsReporterPerformanceLog::ReportDailyMetrics(
+    base::TimeDelta os_age) {
+  reporter_->ReportDailyMetrics(os_age);
+}
+
+void MetricsReporterPerformanceLog::ReportUpdateCheckMetrics(
+    SystemState* system_state,
+    metrics::CheckResult result,
+    metrics::CheckReaction reaction,
+    metrics::DownloadErrorCode download_error_code) {
+  reporter_->ReportUpdateCheckMetrics(
+      system_state, result, reaction, download_error_code);
+}
+
+void MetricsReporterPerformanceLog::ReportUpdateAttemptMetrics(
+    SystemState* system_state,
+    int attempt_number,
+    PayloadType payload_type,
+    base::TimeDelta duration,
+    base::TimeDelta duration_uptime,
+    int64_t payload_size,
+    metrics::AttemptResult attempt_result,
+    ErrorCode internal_error_code) {
+  reporter_->ReportUpdateAttemptMetrics(system_state,
+                                        attempt_number,
+                                        payload_type,
+                                        duration,
+                                        duration_uptime,
+                                        payload_size,
+                                        attempt_result,
+                                        internal_error_code);
+  record_.SetDouble("time", base::Time::Now().ToDoubleT());
+  record_.SetInteger("attempt_number", attempt_number);
+  record_.SetString("payload_type", utils::ToString(payload_type));
+  record_.SetDouble("duration_ms", duration.InMillisecondsF());
+  record_.SetDouble("duration_uptime_ms", duration_uptime.InMillisecondsF());
+  // The sizes are stored as doubles, since DictionaryValue only holds 32-bit
+  // integers.
+  record_.SetDouble("payload_size", payload_size);
+  record_.SetInteger("result", static_cast<int>(attempt_result));
+  record_.SetString("internal_error_code",
+                    utils::ErrorCodeToString(internal_error_code));
+}
+
+void MetricsReporterPerformanceLog::ReportUpdateAttemptDownloadMetrics(
+    int64_t payload_bytes_downloaded,
+    int64_t payload_download_speed_bps,
+    DownloadSource download_source,
+    metrics::DownloadErrorCode payload_download_error_code,
+    metrics::ConnectionType connection_type) {
+  reporter_->ReportUpdateAttemptDownloadMetrics(payload_bytes_downloaded,
+                                                payload_download_speed_bps,
+                                                download_source,
+                                                payload_download_error_code,
+                                                connection_type);
+  // This is reported right after ReportUpdateAttemptMetrics(), and completes
+  // the record of the attempt.
+  record_.SetDouble("bytes_downloaded", payload_bytes_downloaded);
+  record_.SetDouble("download_speed_bps", payload_download_speed_bps);
+  record_.SetString("download_source", utils::ToString(download_source));
+  record_.SetInteger("download_error_code",
+                     static_cast<int>(payload_download_error_code));
+  record_.SetInteger("connection_type", static_cast<int>(connection_type));
+  WriteRecord();
+}
+
+void MetricsReporterPerformanceLog::ReportDownloadChunkIntervalMetrics(
+    const vector<uint32_t>& chunk_interval_counts,
+    base::TimeDelta longest_chunk_interval) {
+  reporter_->ReportDownloadChunkIntervalMetrics(chunk_interval_counts,
+                                                longest_chunk_interval);
+  auto counts = std::make_unique<base::ListValue>();
+  for (uint32_t count : chunk_interval_counts)
+    counts->AppendInteger(static_cast<int>(count));
+  record_.Set("chunk_interval_counts", std::move(counts));
+  record_.SetDouble("longest_chunk_interval_ms",
+                    longest_chunk_interval.InMillisecondsF());
+}
+
+void MetricsReporterPerformanceLog::
+    ReportAbnormallyTerminatedUpdateAttemptMetrics() {
+  reporter_->ReportAbnormallyTerminatedUpdateAttemptMetrics();
+}
+
+void MetricsReporterPerformanceLog::ReportSuccessfulUpdateMetrics(
+    int attempt_count,
+    int updates_abandoned_count,
+    PayloadType payload_type,
+    int64_t payload_size,
+    int64_t num_bytes_downloaded[kNumDownloadSources],
+    int download_overhead_percentage,
+    base::TimeDelta total_duration,
+    base::TimeDelta total_duration_uptime,
+    int reboot_count,
+    int url_switch_count) {
+  reporter_->ReportSuccessfulUpdateMetrics(attempt_count,
+                                           updates_abandoned_count,
+                                           payload_type,
+                                           payload_size,
+                                           num_bytes_downloaded,
+                                           download_overhead_percentage,
+                                           total_duration,
+                                           total_duration_uptime,
+                                           reboot_count,
+                                           url_switch_count);
+}
+
+void MetricsReporterPerformanceLog::ReportCertificateCheckMetrics(
+    ServerToCheck server_to_check, CertificateCheckResult result) {
+  reporter_->ReportCertificateCheckMetrics(server_to_check, result);
+}
+
+void MetricsReporterPerformanceLog::ReportFailedUpdateCount(
+    int target_attempt) {
+  reporter_->ReportFailedUpdateCount(target_attempt);
+}
+
+void MetricsReporterPerformanceLog::ReportTimeToReboot(
+    int time_to_reboot_minutes) {
+  reporter_->ReportTimeToReboot(time_to_reboot_minutes);
+}
+
+void MetricsReporterPerformanceLog::ReportInstallDateProvisioningSource(
+    int source, int max) {
+  reporter_->ReportInstallDateProvisioningSource(source, max);
+}
+
+void MetricsReporterPerformanceLog::ReportInternalErrorCode(
+    ErrorCode error_code) {
+  reporter_->ReportInternalErrorCode(error_code);
+}
+
+void MetricsReporterPerformanceLog::ReportKeyVersionMetrics(
+    int kernel_min_version,
+    int kernel_max_rollforward_version,
+    bool kernel_max_rollforward_success) {
+  reporter_->ReportKeyVersionMetrics(kernel_min_version,
+                                     kernel_max_rollforward_version,
+                                     kernel_max_rollforward_success);
+}
+
+void MetricsReporterPerformanceLog::ReportEnterpriseUpdateSeenToDownloadDays(
+    bool has_time_restriction_policy, int time_to_update_days) {
+  reporter_->ReportEnterpriseUpdateSeenToDownloadDays(
+      has_time_restriction_policy, time_to_update_days);
+}
+
+void MetricsReporterPerformanceLog::ReportInstallOperationMetrics(
+    const string& operation_type,
+    int count,
+    base::TimeDelta duration,
+    int64_t bytes_read,
+    int64_t bytes_written,
+    int64_t bytes_downloaded) {
+  reporter_->ReportInstallOperationMetrics(operation_type,
+                                           count,
+                                           duration,
+                                           bytes_read,
+                                           bytes_written,
+                                           bytes_downloaded);
+  auto operation = std::make_unique<base::DictionaryValue>();
+  operation->SetString("type", operation_type);
+  operation->SetInteger("count", count);
+  operation->SetDouble("duration_ms", duration.InMillisecondsF());
+  operation->SetDouble("bytes_read", bytes_read);
+  operation->SetDouble("bytes_written", bytes_written);
+  operation->SetDouble("bytes_downloaded", bytes_downloaded);
+  operations_->Append(std::move(operation));
+}
+
+void MetricsReporterPerformanceLog::ReportPhaseIoMetrics(
+    const string& phase, const PhaseIoStats& stats) {
+  // The record is written once the payload is downloaded, before the later
+  // phases end, so they aren't part of it.
+  reporter_->ReportPhaseIoMetrics(phase, stats);
+}
+
+void MetricsReporterPerformanceLog::WriteRecord() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+    record_.SetDouble("peak_rss_kib", usage.ru_maxrss);
+  record_.Set("operations", std::move(operations_));
+  operations_.reset(new base::ListValue());
+  string record_json;
+  base::JSONWriter::Write(record_, &record_json);
+  record_.Clear();
+  if (log_path_.empty())
+    return;
+
+  // Keep the most recent records, the new one included.
+  string contents;
+  vector<string> records;
+  if (base::ReadFileToString(log_path_, &contents)) {
+    records = base::SplitString(
+        contents, "\n", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY);
+  }
+  records.push_back(record_json);
+  if (records.size() > max_records_)
+    records.erase(records.begin(), records.end() - max_records_);
+  contents.clear();
+  for (const string& record : records)
+    contents += record + "\n";
+
+  // Write the log to a temporary file first, so a crash or a power loss never
+  // leaves it half written.
+  base::FilePath temp_path = log_path_.AddExtension("tmp");
+  if (!utils::WriteFile(temp_path.value().c_str(),
+                        contents.data(),
+                        contents.size()) ||
+      !base::Move(temp_path, log_path_)) {
+    LOG(ERROR) << "Unable to write the performance log " << log_path_.value();
+  }
+}
+
+}  // namespace chromeos_update_engine
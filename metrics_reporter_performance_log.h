@@ -0,0 +1,155 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_METRICS_REPORTER_PERFORMANCE_LOG_H_
+#define UPDATE_ENGINE_METRICS_REPORTER_PERFORMANCE_LOG_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/files/file_path.h>
+#include <base/values.h>
+
+#include "update_engine/metrics_reporter_interface.h"
+
+namespace chromeos_update_engine {
+
+// The name of the performance log in the non-volatile directory.
+extern const char kPerformanceLogFileName[];
+
+// A MetricsReporterInterface which passes all the metrics on to another
+// reporter, and also writes a record of the performance of every update
+// attempt to a local log for collecting in the field. The log keeps the most
+// recent records, one JSON dictionary per line, with the duration, size and
+// download throughput of the attempt along with its download source and
+// connection type, the histogram of the intervals between the received chunks,
+// the count, time and bytes of each type of operation applied and the peak
+// resident memory of the daemon.
+class MetricsReporterPerformanceLog : public MetricsReporterInterface {
+ public:
+  explicit MetricsReporterPerformanceLog(
+      std::unique_ptr<MetricsReporterInterface> reporter);
+
+  ~MetricsReporterPerformanceLog() override = default;
+
+  // Sets the log the records are written to. No record is written until it is
+  // set.
+  void set_log_path(const base::FilePath& log_path) { log_path_ = log_path; }
+
+  void Initialize() override;
+
+  void ReportRollbackMetrics(metrics::RollbackResult result) override;
+
+  void ReportEnterpriseRollbackMetrics(
+      bool success, const std::string& rollback_version) override;
+
+  void ReportDailyMetrics(base::TimeDelta os_age) override;
+
+  void ReportUpdateCheckMetrics(
+      SystemState* system_state,
+      metrics::CheckResult result,
+      metrics::CheckReaction reaction,
+      metrics::DownloadErrorCode download_error_code) override;
+
+  void ReportUpdateAttemptMetrics(SystemState* system_state,
+                                  int attempt_number,
+                                  PayloadType payload_type,
+                                  base::TimeDelta duration,
+                                  base::TimeDelta duration_uptime,
+                                  int64_t payload_size,
+                                  metrics::AttemptResult attempt_result,
+                                  ErrorCode internal_error_code) override;
+
+  void ReportUpdateAttemptDownloadMetrics(
+      int64_t payload_bytes_downloaded,
+      int64_t payload_download_speed_bps,
+      DownloadSource download_source,
+      metrics::DownloadErrorCode payload_download_error_code,
+      metrics::ConnectionType connection_type) override;
+
+  void ReportDownloadChunkIntervalMetrics(
+      const std::vector<uint32_t>& chunk_interval_counts,
+      base::TimeDelta longest_chunk_interval) override;
+
+  void ReportAbnormallyTerminatedUpdateAttemptMetrics() override;
+
+  void ReportSuccessfulUpdateMetrics(
+      int attempt_count,
+      int updates_abandoned_count,
+      PayloadType payload_type,
+      int64_t payload_size,
+      int64_t num_bytes_downloaded[kNumDownloadSources],
+      int download_overhead_percentage,
+      base::TimeDelta total_duration,
+      base::TimeDelta total_duration_uptime,
+      int reboot_count,
+      int url_switch_count) override;
+
+  void ReportCertificateCheckMetrics(ServerToCheck server_to_check,
+                                     CertificateCheckResult result) override;
+
+  void ReportFailedUpdateCount(int target_attempt) override;
+
+  void ReportTimeToReboot(int time_to_reboot_minutes) override;
+
+  void ReportInstallDateProvisioningSource(int source, int max) override;
+
+  void ReportInternalErrorCode(ErrorCode error_code) override;
+
+  void ReportKeyVersionMetrics(int kernel_min_version,
+                               int kernel_max_rollforward_version,
+                               bool kernel_max_rollforward_success) override;
+
+  void ReportEnterpriseUpdateSeenToDownloadDays(
+      bool has_time_restriction_policy, int time_to_update_days) override;
+
+  void ReportInstallOperationMetrics(const std::string& operation_type,
+                                     int count,
+                                     base::TimeDelta duration,
+                                     int64_t bytes_read,
+                                     int64_t bytes_written,
+                                     int64_t bytes_downloaded) override;
+
+  void ReportPhaseIoMetrics(const std::string& phase,
+                            const PhaseIoStats& stats) override;
+
+ private:
+  friend class MetricsReporterPerformanceLogTest;
+
+  // Adds the peak memory to the record of the current attempt, writes it to
+  // the log and starts a new one.
+  void WriteRecord();
+
+  // The reporter all the metrics are passed on to.
+  std::unique_ptr<MetricsReporterInterface> reporter_;
+
+  base::FilePath log_path_;
+
+  // The maximum number of records kept in the log.
+  size_t max_records_;
+
+  // The record of the current attempt, and the stats of the operations applied
+  // by it.
+  base::DictionaryValue record_;
+  std::unique_ptr<base::ListValue> operations_;
+
+  DISALLOW_COPY_AND_ASSIGN(MetricsReporterPerformanceLog);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_METRICS_REPORTER_PERFORMANCE_LOG_H_
@@ -0,0 +1,155 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/metrics_reporter_performance_log.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/files/file_util.h>
+#include <base/files/scoped_temp_dir.h>
+#include <base/json/json_reader.h>
+#include <base/strings/string_split.h>
+#include <base/values.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/mock_metrics_reporter.h"
+
+using base::TimeDelta;
+using std::string;
+using std::vector;
+using testing::_;
+
+namespace chromeos_update_engine {
+
+class MetricsReporterPerformanceLogTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+    log_path_ = temp_dir_.GetPath().Append(kPerformanceLogFileName);
+    mock_reporter_ = new testing::NiceMock<MockMetricsReporter>();
+    reporter_ = std::make_unique<MetricsReporterPerformanceLog>(
+        std::unique_ptr<MetricsReporterInterface>(mock_reporter_));
+    reporter_->set_log_path(log_path_);
+  }
+
+  void ReportAttempt(int attempt_number) {
+    reporter_->ReportUpdateAttemptMetrics(
+        nullptr,
+        attempt_number,
+        kPayloadTypeDelta,
+        TimeDelta::FromMinutes(3),
+        TimeDelta::FromMinutes(2),
+        1000,
+        metrics::AttemptResult::kUpdateSucceeded,
+        ErrorCode::kSuccess);
+    reporter_->ReportDownloadChunkIntervalMetrics(vector<uint32_t>(16, 1),
+                                                  TimeDelta::FromSeconds(5));
+    reporter_->ReportUpdateAttemptDownloadMetrics(
+        1000,
+        8,
+        kDownloadSourceHttpsServer,
+        metrics::DownloadErrorCode::kUnset,
+        metrics::ConnectionType::kWifi);
+  }
+
+  // Returns the records in the log.
+  vector<string> ReadRecords() {
+    string contents;
+    EXPECT_TRUE(base::ReadFileToString(log_path_, &contents));
+    return base::SplitString(
+        contents, "\n", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY);
+  }
+
+  void set_max_records(size_t max_records) {
+    reporter_->max_records_ = max_records;
+  }
+
+  base::ScopedTempDir temp_dir_;
+  base::FilePath log_path_;
+  testing::NiceMock<MockMetricsReporter>* mock_reporter_;
+  std::unique_ptr<MetricsReporterPerformanceLog> reporter_;
+};
+
+TEST_F(MetricsReporterPerformanceLogTest, AttemptRecordWritten) {
+  EXPECT_CALL(*mock_reporter_,
+              ReportInstallOperationMetrics("REPLACE", 2, _, 0, 8192, 100));
+  EXPECT_CALL(*mock_reporter_,
+              ReportUpdateAttemptMetrics(_, 1, _, _, _, _, _, _));
+  EXPECT_CALL(*mock_reporter_,
+              ReportUpdateAttemptDownloadMetrics(1000, 8, _, _, _));
+  reporter_->ReportInstallOperationMetrics(
+      "REPLACE", 2, TimeDelta::FromSeconds(1), 0, 8192, 100);
+  ReportAttempt(1);
+
+  vector<string> records = ReadRecords();
+  ASSERT_EQ(1U, records.size());
+  std::unique_ptr<base::Value> value = base::JSONReader::Read(records[0]);
+  const base::DictionaryValue* record = nullptr;
+  ASSERT_TRUE(value && value->GetAsDictionary(&record));
+  int attempt_number;
+  EXPECT_TRUE(record->GetInteger("attempt_number", &attempt_number));
+  EXPECT_EQ(1, attempt_number);
+  double duration_ms;
+  EXPECT_TRUE(record->GetDouble("duration_ms", &duration_ms));
+  EXPECT_DOUBLE_EQ(180000.0, duration_ms);
+  string download_source;
+  EXPECT_TRUE(record->GetString("download_source", &download_source));
+  EXPECT_EQ("HttpsServer", download_source);
+  const base::ListValue* chunk_interval_counts = nullptr;
+  ASSERT_TRUE(record->GetList("chunk_interval_counts", &chunk_interval_counts));
+  EXPECT_EQ(16U, chunk_interval_counts->GetSize());
+  double longest_chunk_interval_ms;
+  EXPECT_TRUE(record->GetDouble("longest_chunk_interval_ms",
+                                &longest_chunk_interval_ms));
+  EXPECT_DOUBLE_EQ(5000.0, longest_chunk_interval_ms);
+  EXPECT_TRUE(record->HasKey("peak_rss_kib"));
+
+  const base::ListValue* operations = nullptr;
+  ASSERT_TRUE(record->GetList("operations", &operations));
+  ASSERT_EQ(1U, operations->GetSize());
+  const base::DictionaryValue* operation = nullptr;
+  ASSERT_TRUE(operations->GetDictionary(0, &operation));
+  string type;
+  EXPECT_TRUE(operation->GetString("type", &type));
+  EXPECT_EQ("REPLACE", type);
+  double bytes_written;
+  EXPECT_TRUE(operation->GetDouble("bytes_written", &bytes_written));
+  EXPECT_DOUBLE_EQ(8192.0, bytes_written);
+}
+
+TEST_F(MetricsReporterPerformanceLogTest, OldestRecordsDropped) {
+  set_max_records(2);
+  for (int attempt_number = 1; attempt_number <= 3; attempt_number++)
+    ReportAttempt(attempt_number);
+
+  vector<string> records = ReadRecords();
+  ASSERT_EQ(2U, records.size());
+  std::unique_ptr<base::Value> value = base::JSONReader::Read(records[1]);
+  const base::DictionaryValue* record = nullptr;
+  ASSERT_TRUE(value && value->GetAsDictionary(&record));
+  int attempt_number;
+  EXPECT_TRUE(record->GetInteger("attempt_number", &attempt_number));
+  EXPECT_EQ(3, attempt_number);
+  // The operations are only in the record of the attempt that applied them.
+  const base::ListValue* operations = nullptr;
+  ASSERT_TRUE(record->GetList("operations", &operations));
+  EXPECT_TRUE(operations->empty());
+}
+
+}  // namespace chromeos_update_engine
@@ -16,6 +16,7 @@
 
 #include "update_engine/metrics_utils.h"
 
+#include <algorithm>
 #include <string>
 
 #include <base/time/time.h>
@@ -405,5 +406,30 @@ bool LoadAndReportTimeToReboot(MetricsReporterInterface* metrics_reporter,
   return true;
 }
 
+const size_t ChunkIntervalHistogram::kNumBuckets;
+
+ChunkIntervalHistogram::ChunkIntervalHistogram() : counts_(kNumBuckets) {}
+
+void ChunkIntervalHistogram::Reset() {
+  std::fill(counts_.begin(), counts_.end(), 0);
+  last_chunk_time_ = Time();
+  longest_interval_ = TimeDelta();
+}
+
+void ChunkIntervalHistogram::AddChunk(Time now) {
+  if (!last_chunk_time_.is_null()) {
+    TimeDelta interval = now - last_chunk_time_;
+    longest_interval_ = std::max(longest_interval_, interval);
+    size_t bucket = 0;
+    for (int64_t ms = interval.InMilliseconds();
+         ms > 1 && bucket < kNumBuckets - 1;
+         ms >>= 1) {
+      bucket++;
+    }
+    counts_[bucket]++;
+  }
+  last_chunk_time_ = now;
+}
+
 }  // namespace metrics_utils
 }  // namespace chromeos_update_engine
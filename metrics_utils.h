@@ -18,6 +18,7 @@
 #define UPDATE_ENGINE_METRICS_UTILS_H_
 
 #include <string>
+#include <vector>
 
 #include <base/time/time.h>
 
@@ -106,6 +107,34 @@ bool LoadAndReportTimeToReboot(MetricsReporterInterface* metrics_reporter,
                                PrefsInterface* prefs,
                                ClockInterface* clock);
 
+// Counts the intervals between the chunks received by a download, which tell
+// a steadily slow download from one that stalls. Bucket i counts the
+// intervals of [2^i, 2^(i+1)) milliseconds; the first bucket also counts the
+// shorter intervals and the last one all the longer ones. The counters are
+// only kept in memory, so recording a chunk costs no I/O.
+class ChunkIntervalHistogram {
+ public:
+  // The number of buckets. The last one starts at about 33 seconds.
+  static const size_t kNumBuckets = 16;
+
+  ChunkIntervalHistogram();
+
+  // Forgets the recorded intervals and the time of the last chunk.
+  void Reset();
+
+  // Records a chunk received at the monotonic time |now|, counting the
+  // interval since the previous chunk, if any.
+  void AddChunk(base::Time now);
+
+  const std::vector<uint32_t>& counts() const { return counts_; }
+  base::TimeDelta longest_interval() const { return longest_interval_; }
+
+ private:
+  std::vector<uint32_t> counts_;
+  base::Time last_chunk_time_;
+  base::TimeDelta longest_interval_;
+};
+
 }  // namespace metrics_utils
 }  // namespace chromeos_update_engine
 
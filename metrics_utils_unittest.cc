@@ -16,6 +16,8 @@
 
 #include "update_engine/metrics_utils.h"
 
+#include <vector>
+
 #include <gtest/gtest.h>
 
 #include "update_engine/common/fake_clock.h"
@@ -191,5 +193,34 @@ TEST(MetricsUtilsTest, MonotonicDurationHelper) {
   EXPECT_EQ(duration.InSeconds(), 0);
 }
 
+TEST(MetricsUtilsTest, ChunkIntervalHistogram) {
+  ChunkIntervalHistogram histogram;
+  base::Time now = base::Time::FromInternalValue(1000000);
+  // The first chunk has no interval.
+  histogram.AddChunk(now);
+  EXPECT_EQ(std::vector<uint32_t>(ChunkIntervalHistogram::kNumBuckets, 0),
+            histogram.counts());
+
+  for (int ms : {0, 1, 3, 4, 1000, 60000}) {
+    now += base::TimeDelta::FromMilliseconds(ms);
+    histogram.AddChunk(now);
+  }
+  std::vector<uint32_t> expected(ChunkIntervalHistogram::kNumBuckets, 0);
+  expected[0] = 2;  // 0 and 1 ms.
+  expected[1] = 1;  // 3 ms.
+  expected[2] = 1;  // 4 ms.
+  expected[9] = 1;  // 1000 ms.
+  expected[ChunkIntervalHistogram::kNumBuckets - 1] = 1;  // 60 s.
+  EXPECT_EQ(expected, histogram.counts());
+  EXPECT_EQ(base::TimeDelta::FromSeconds(60), histogram.longest_interval());
+
+  // After a reset the next chunk has no interval again.
+  histogram.Reset();
+  histogram.AddChunk(now + base::TimeDelta::FromSeconds(1));
+  EXPECT_EQ(std::vector<uint32_t>(ChunkIntervalHistogram::kNumBuckets, 0),
+            histogram.counts());
+  EXPECT_EQ(base::TimeDelta(), histogram.longest_interval());
+}
+
 }  // namespace metrics_utils
 }  // namespace chromeos_update_engine
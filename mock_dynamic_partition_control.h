@@ -18,6 +18,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <gmock/gmock.h>
 
@@ -33,6 +34,12 @@ class MockDynamicPartitionControl : public DynamicPartitionControlInterface {
                     uint32_t,
                     bool,
                     std::string*));
+  MOCK_METHOD5(MapPartitionsOnDeviceMapper,
+               bool(const std::string&,
+                    const std::vector<std::string>&,
+                    uint32_t,
+                    bool,
+                    std::vector<std::string>*));
   MOCK_METHOD2(UnmapPartitionOnDeviceMapper, bool(const std::string&, bool));
   MOCK_METHOD0(Cleanup, void());
   MOCK_METHOD1(DeviceExists, bool(const std::string&));
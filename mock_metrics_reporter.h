@@ -18,6 +18,7 @@
 #define UPDATE_ENGINE_MOCK_METRICS_REPORTER_H_
 
 #include <string>
+#include <vector>
 
 #include <gmock/gmock.h>
 
@@ -59,6 +60,10 @@ class MockMetricsReporter : public MetricsReporterInterface {
                     metrics::DownloadErrorCode payload_download_error_code,
                     metrics::ConnectionType connection_type));
 
+  MOCK_METHOD2(ReportDownloadChunkIntervalMetrics,
+               void(const std::vector<uint32_t>& chunk_interval_counts,
+                    base::TimeDelta longest_chunk_interval));
+
   MOCK_METHOD0(ReportAbnormallyTerminatedUpdateAttemptMetrics, void());
 
   MOCK_METHOD10(ReportSuccessfulUpdateMetrics,
@@ -92,6 +97,17 @@ class MockMetricsReporter : public MetricsReporterInterface {
 
   MOCK_METHOD2(ReportEnterpriseUpdateSeenToDownloadDays,
                void(bool has_time_restriction_policy, int time_to_update_days));
+
+  MOCK_METHOD6(ReportInstallOperationMetrics,
+               void(const std::string& operation_type,
+                    int count,
+                    base::TimeDelta duration,
+                    int64_t bytes_read,
+                    int64_t bytes_written,
+                    int64_t bytes_downloaded));
+
+  MOCK_METHOD2(ReportPhaseIoMetrics,
+               void(const std::string& phase, const PhaseIoStats& stats));
 };
 
 }  // namespace chromeos_update_engine
@@ -48,6 +48,11 @@ class MockP2PManager : public P2PManager {
             LookupUrlForFile(testing::_, testing::_, testing::_, testing::_))
         .WillByDefault(
             testing::Invoke(&fake_, &FakeP2PManager::LookupUrlForFile));
+    ON_CALL(*this,
+            LookupUrlsForFile(
+                testing::_, testing::_, testing::_, testing::_, testing::_))
+        .WillByDefault(
+            testing::Invoke(&fake_, &FakeP2PManager::LookupUrlsForFile));
     ON_CALL(*this, FileShare(testing::_, testing::_))
         .WillByDefault(testing::Invoke(&fake_, &FakeP2PManager::FileShare));
     ON_CALL(*this, FileGetPath(testing::_))
@@ -79,6 +84,12 @@ class MockP2PManager : public P2PManager {
   MOCK_METHOD4(
       LookupUrlForFile,
       void(const std::string&, size_t, base::TimeDelta, LookupCallback));
+  MOCK_METHOD5(LookupUrlsForFile,
+               void(const std::string&,
+                    size_t,
+                    base::TimeDelta,
+                    size_t,
+                    LookupUrlsCallback));
   MOCK_METHOD2(FileShare, bool(const std::string&, size_t));
   MOCK_METHOD1(FileGetPath, base::FilePath(const std::string&));
   MOCK_METHOD1(FileGetSize, ssize_t(const std::string&));
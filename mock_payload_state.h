@@ -18,6 +18,7 @@
 #define UPDATE_ENGINE_MOCK_PAYLOAD_STATE_H_
 
 #include <string>
+#include <vector>
 
 #include <gmock/gmock.h>
 
@@ -50,6 +51,7 @@ class MockPayloadState : public PayloadStateInterface {
   MOCK_METHOD1(SetUsingP2PForSharing, void(bool value));
   MOCK_METHOD1(SetScatteringWaitPeriod, void(base::TimeDelta));
   MOCK_METHOD1(SetP2PUrl, void(const std::string&));
+  MOCK_METHOD1(SetP2PPeerUrls, void(const std::vector<std::string>&));
   MOCK_METHOD0(NextPayload, bool());
   MOCK_METHOD1(SetStagingWaitPeriod, void(base::TimeDelta));
 
@@ -58,6 +60,7 @@ class MockPayloadState : public PayloadStateInterface {
   MOCK_METHOD0(GetPayloadAttemptNumber, int());
   MOCK_METHOD0(GetFullPayloadAttemptNumber, int());
   MOCK_METHOD0(GetCurrentUrl, std::string());
+  MOCK_METHOD1(GetPayloadUrl, std::string(size_t payload_index));
   MOCK_METHOD0(GetUrlFailureCount, uint32_t());
   MOCK_METHOD0(GetUrlSwitchCount, uint32_t());
   MOCK_METHOD0(GetNumResponsesSeen, int());
@@ -76,6 +79,7 @@ class MockPayloadState : public PayloadStateInterface {
   MOCK_CONST_METHOD0(GetUsingP2PForSharing, bool());
   MOCK_METHOD0(GetScatteringWaitPeriod, base::TimeDelta());
   MOCK_CONST_METHOD0(GetP2PUrl, std::string());
+  MOCK_CONST_METHOD0(GetP2PPeerUrls, std::vector<std::string>());
   MOCK_METHOD0(GetStagingWaitPeriod, base::TimeDelta());
 };
 
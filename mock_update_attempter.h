@@ -41,6 +41,8 @@ class MockUpdateAttempter : public UpdateAttempter {
 
   MOCK_METHOD1(GetStatus, bool(update_engine::UpdateEngineStatus* out_status));
 
+  MOCK_METHOD0(GetPerfStats, std::string(void));
+
   MOCK_METHOD1(GetBootTimeAtUpdate, bool(base::Time* out_boot_time));
 
   MOCK_METHOD0(ResetStatus, bool(void));
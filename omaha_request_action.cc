@@ -17,7 +17,9 @@
 #include "update_engine/omaha_request_action.h"
 
 #include <inttypes.h>
+#include <string.h>
 
+#include <algorithm>
 #include <limits>
 #include <map>
 #include <sstream>
@@ -37,6 +39,7 @@
 #include <expat.h>
 #include <metrics/metrics_library.h>
 #include <policy/libpolicy.h>
+#include <zlib.h>
 
 #include "update_engine/common/action_pipe.h"
 #include "update_engine/common/constants.h"
@@ -46,6 +49,7 @@
 #include "update_engine/common/prefs_interface.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/connection_manager_interface.h"
+#include "update_engine/connection_prewarmer.h"
 #include "update_engine/metrics_reporter_interface.h"
 #include "update_engine/metrics_utils.h"
 #include "update_engine/omaha_request_params.h"
@@ -113,6 +117,14 @@ constexpr char kXGoogleUpdateInteractivity[] = "X-Goog-Update-Interactivity";
 constexpr char kXGoogleUpdateAppId[] = "X-Goog-Update-AppId";
 constexpr char kXGoogleUpdateUpdater[] = "X-Goog-Update-Updater";
 
+// The request body is compressed with gzip once the server listed it in the
+// Accept-Encoding header of a response, as described by RFC 7694. Smaller
+// requests are sent as is since compressing them saves little.
+constexpr char kHeaderAcceptEncoding[] = "Accept-Encoding";
+constexpr char kHeaderContentEncoding[] = "Content-Encoding";
+constexpr char kEncodingGzip[] = "gzip";
+constexpr size_t kMinCompressedRequestSize = 512;
+
 // updatecheck attributes (without the underscore prefix).
 constexpr char kAttrEol[] = "eol";
 constexpr char kAttrRollback[] = "rollback";
@@ -121,56 +133,95 @@ constexpr char kAttrKernelVersion[] = "kernel_version";
 
 namespace {
 
-// Returns an XML ping element attribute assignment with attribute
-// |name| and value |ping_days| if |ping_days| has a value that needs
-// to be sent, or an empty string otherwise.
-string GetPingAttribute(const string& name, int ping_days) {
-  if (ping_days > 0 || ping_days == OmahaRequestAction::kNeverPinged)
-    return base::StringPrintf(" %s=\"%d\"", name.c_str(), ping_days);
-  return "";
+// Compresses |data| to |out| in the gzip format. Returns whether it succeeded.
+bool GzipCompress(const string& data, brillo::Blob* out) {
+  z_stream stream = {};
+  // Adding 16 to the window bits writes a gzip header instead of a zlib one.
+  if (deflateInit2(&stream,
+                   Z_DEFAULT_COMPRESSION,
+                   Z_DEFLATED,
+                   MAX_WBITS + 16,
+                   8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+  out->resize(deflateBound(&stream, data.size()));
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = data.size();
+  stream.next_out = out->data();
+  stream.avail_out = out->size();
+  const int result = deflate(&stream, Z_FINISH);
+  out->resize(stream.total_out);
+  deflateEnd(&stream);
+  return result == Z_STREAM_END;
 }
 
-// Returns an XML ping element if any of the elapsed days need to be
-// sent, or an empty string otherwise.
-string GetPingXml(int ping_active_days, int ping_roll_call_days) {
-  string ping_active = GetPingAttribute("a", ping_active_days);
-  string ping_roll_call = GetPingAttribute("r", ping_roll_call_days);
-  if (!ping_active.empty() || !ping_roll_call.empty()) {
-    return base::StringPrintf("        <ping active=\"1\"%s%s></ping>\n",
-                              ping_active.c_str(),
-                              ping_roll_call.c_str());
-  }
-  return "";
+// Returns whether the elapsed |ping_days| need to be sent in the ping.
+bool ShouldSendPingDays(int ping_days) {
+  return ping_days > 0 || ping_days == OmahaRequestAction::kNeverPinged;
 }
 
-// Returns an XML that goes into the body of the <app> element of the Omaha
-// request based on the given parameters.
-string GetAppBody(const OmahaEvent* event,
-                  OmahaRequestParams* params,
-                  bool ping_only,
-                  bool include_ping,
-                  bool skip_updatecheck,
-                  int ping_active_days,
-                  int ping_roll_call_days,
-                  PrefsInterface* prefs) {
-  string app_body;
+// Appends an XML ping element attribute assignment with attribute |name| and
+// value |ping_days| to |xml| if |ping_days| has a value that needs to be sent.
+void AppendPingAttribute(const char* name, int ping_days, string* xml) {
+  if (ShouldSendPingDays(ping_days))
+    base::StringAppendF(xml, " %s=\"%d\"", name, ping_days);
+}
+
+// Appends an XML ping element to |xml| if any of the elapsed days need to be
+// sent.
+void AppendPingXml(int ping_active_days, int ping_roll_call_days, string* xml) {
+  if (!ShouldSendPingDays(ping_active_days) &&
+      !ShouldSendPingDays(ping_roll_call_days)) {
+    return;
+  }
+  xml->append("        <ping active=\"1\"");
+  AppendPingAttribute("a", ping_active_days, xml);
+  AppendPingAttribute("r", ping_roll_call_days, xml);
+  xml->append("></ping>\n");
+}
+
+// Appends the XML attribute assignment of |name| to |value|, encoded with
+// AppendXmlEncoded() or replaced by |default_value| if it is invalid, and a
+// space to |xml|.
+void AppendXmlAttribute(const char* name,
+                        const string& value,
+                        const char* default_value,
+                        string* xml) {
+  xml->append(name);
+  xml->append("=\"");
+  if (!AppendXmlEncoded(value, xml))
+    xml->append(default_value);
+  xml->append("\" ");
+}
+
+// Appends the XML that goes into the body of the <app> element of the Omaha
+// request based on the given parameters to |xml|.
+void AppendAppBody(const OmahaEvent* event,
+                   OmahaRequestParams* params,
+                   bool ping_only,
+                   bool include_ping,
+                   bool skip_updatecheck,
+                   int ping_active_days,
+                   int ping_roll_call_days,
+                   PrefsInterface* prefs,
+                   string* xml) {
   if (event == nullptr) {
     if (include_ping)
-      app_body = GetPingXml(ping_active_days, ping_roll_call_days);
+      AppendPingXml(ping_active_days, ping_roll_call_days, xml);
     if (!ping_only) {
       if (!skip_updatecheck) {
-        app_body += "        <updatecheck";
+        xml->append("        <updatecheck");
         if (!params->target_version_prefix().empty()) {
-          app_body += base::StringPrintf(
-              " targetversionprefix=\"%s\"",
-              XmlEncodeWithDefault(params->target_version_prefix(), "")
-                  .c_str());
+          xml->append(" targetversionprefix=\"");
+          AppendXmlEncoded(params->target_version_prefix(), xml);
+          xml->append("\"");
           // Rollback requires target_version_prefix set.
           if (params->rollback_allowed()) {
-            app_body += " rollback_allowed=\"true\"";
+            xml->append(" rollback_allowed=\"true\"");
           }
         }
-        app_body += "></updatecheck>\n";
+        xml->append("></updatecheck>\n");
       }
 
       // If this is the first update check after a reboot following a previous
@@ -189,47 +240,48 @@ string GetAppBody(const OmahaEvent* event,
       // update in the previous boot. After reporting it back to the server,
       // we clear the previous version value so it doesn't get reported again.
       if (!prev_version.empty()) {
-        app_body += base::StringPrintf(
+        base::StringAppendF(
+            xml,
             "        <event eventtype=\"%d\" eventresult=\"%d\" "
-            "previousversion=\"%s\"></event>\n",
+            "previousversion=\"",
             OmahaEvent::kTypeRebootedAfterUpdate,
-            OmahaEvent::kResultSuccess,
-            XmlEncodeWithDefault(prev_version, "0.0.0.0").c_str());
+            OmahaEvent::kResultSuccess);
+        if (!AppendXmlEncoded(prev_version, xml))
+          xml->append("0.0.0.0");
+        xml->append("\"></event>\n");
         LOG_IF(WARNING, !prefs->SetString(kPrefsPreviousVersion, ""))
             << "Unable to reset the previous version.";
       }
     }
   } else {
+    base::StringAppendF(xml,
+                        "        <event eventtype=\"%d\" eventresult=\"%d\"",
+                        event->type,
+                        event->result);
     // The error code is an optional attribute so append it only if the result
     // is not success.
-    string error_code;
     if (event->result != OmahaEvent::kResultSuccess) {
-      error_code = base::StringPrintf(" errorcode=\"%d\"",
-                                      static_cast<int>(event->error_code));
+      base::StringAppendF(
+          xml, " errorcode=\"%d\"", static_cast<int>(event->error_code));
     }
-    app_body = base::StringPrintf(
-        "        <event eventtype=\"%d\" eventresult=\"%d\"%s></event>\n",
-        event->type,
-        event->result,
-        error_code.c_str());
+    xml->append("></event>\n");
   }
-
-  return app_body;
 }
 
-// Returns the cohort* argument to include in the <app> tag for the passed
-// |arg_name| and |prefs_key|, if any. The return value is suitable to
+// Appends the cohort* argument to include in the <app> tag for the passed
+// |arg_name| and |prefs_key|, if any, to |xml|. The argument is suitable to
 // concatenate to the list of arguments and includes a space at the end.
-string GetCohortArgXml(PrefsInterface* prefs,
-                       const string arg_name,
-                       const string prefs_key) {
+void AppendCohortArgXml(PrefsInterface* prefs,
+                        const char* arg_name,
+                        const char* prefs_key,
+                        string* xml) {
   // There's nothing wrong with not having a given cohort setting, so we check
   // existence first to avoid the warning log message.
   if (!prefs->Exists(prefs_key))
-    return "";
+    return;
   string cohort_value;
   if (!prefs->GetString(prefs_key, &cohort_value) || cohort_value.empty())
-    return "";
+    return;
   // This is a sanity check to avoid sending a huge XML file back to Ohama due
   // to a compromised stateful partition making the update check fail in low
   // network environments envent after a reboot.
@@ -237,18 +289,19 @@ string GetCohortArgXml(PrefsInterface* prefs,
     LOG(WARNING) << "The omaha cohort setting " << arg_name
                  << " has a too big value, which must be an error or an "
                     "attacker trying to inhibit updates.";
-    return "";
+    return;
   }
 
-  string escaped_xml_value;
-  if (!XmlEncode(cohort_value, &escaped_xml_value)) {
+  size_t xml_size = xml->size();
+  xml->append(arg_name);
+  xml->append("=\"");
+  if (!AppendXmlEncoded(cohort_value, xml)) {
     LOG(WARNING) << "The omaha cohort setting " << arg_name
                  << " is ASCII-7 invalid, ignoring it.";
-    return "";
+    xml->resize(xml_size);
+    return;
   }
-
-  return base::StringPrintf(
-      "%s=\"%s\" ", arg_name.c_str(), escaped_xml_value.c_str());
+  xml->append("\" ");
 }
 
 struct OmahaAppData {
@@ -265,27 +318,26 @@ bool IsValidComponentID(const string& id) {
   return true;
 }
 
-// Returns an XML that corresponds to the entire <app> node of the Omaha
-// request based on the given parameters.
-string GetAppXml(const OmahaEvent* event,
-                 OmahaRequestParams* params,
-                 const OmahaAppData& app_data,
-                 bool ping_only,
-                 bool include_ping,
-                 bool skip_updatecheck,
-                 int ping_active_days,
-                 int ping_roll_call_days,
-                 int install_date_in_days,
-                 SystemState* system_state) {
-  string app_body = GetAppBody(event,
-                               params,
-                               ping_only,
-                               include_ping,
-                               skip_updatecheck,
-                               ping_active_days,
-                               ping_roll_call_days,
-                               system_state->prefs());
-  string app_versions;
+// Appends the XML that corresponds to the entire <app> node of the Omaha
+// request based on the given parameters to |xml|.
+void AppendAppXml(const OmahaEvent* event,
+                  OmahaRequestParams* params,
+                  const OmahaAppData& app_data,
+                  bool ping_only,
+                  bool include_ping,
+                  bool skip_updatecheck,
+                  int ping_active_days,
+                  int ping_roll_call_days,
+                  int install_date_in_days,
+                  SystemState* system_state,
+                  string* xml) {
+  xml->append("    <app ");
+  AppendXmlAttribute("appid", app_data.id, "", xml);
+
+  PrefsInterface* prefs = system_state->prefs();
+  AppendCohortArgXml(prefs, "cohort", kPrefsOmahaCohort, xml);
+  AppendCohortArgXml(prefs, "cohorthint", kPrefsOmahaCohortHint, xml);
+  AppendCohortArgXml(prefs, "cohortname", kPrefsOmahaCohortName, xml);
 
   // If we are downgrading to a more stable channel and we are allowed to do
   // powerwash, then pass 0.0.0.0 as the version. This is needed to get the
@@ -293,53 +345,17 @@ string GetAppXml(const OmahaEvent* event,
   if (params->ShouldPowerwash()) {
     LOG(INFO) << "Passing OS version as 0.0.0.0 as we are set to powerwash "
               << "on downgrading to the version in the more stable channel";
-    app_versions = "version=\"0.0.0.0\" from_version=\"" +
-                   XmlEncodeWithDefault(app_data.version, "0.0.0.0") + "\" ";
+    xml->append("version=\"0.0.0.0\" ");
+    AppendXmlAttribute("from_version", app_data.version, "0.0.0.0", xml);
   } else {
-    app_versions = "version=\"" +
-                   XmlEncodeWithDefault(app_data.version, "0.0.0.0") + "\" ";
+    AppendXmlAttribute("version", app_data.version, "0.0.0.0", xml);
   }
 
   string download_channel = params->download_channel();
-  string app_channels =
-      "track=\"" + XmlEncodeWithDefault(download_channel, "") + "\" ";
-  if (params->current_channel() != download_channel) {
-    app_channels += "from_track=\"" +
-                    XmlEncodeWithDefault(params->current_channel(), "") + "\" ";
-  }
-
-  string delta_okay_str = params->delta_okay() ? "true" : "false";
-
-  // If install_date_days is not set (e.g. its value is -1 ), don't
-  // include the attribute.
-  string install_date_in_days_str = "";
-  if (install_date_in_days >= 0) {
-    install_date_in_days_str =
-        base::StringPrintf("installdate=\"%d\" ", install_date_in_days);
-  }
-
-  string app_cohort_args;
-  app_cohort_args +=
-      GetCohortArgXml(system_state->prefs(), "cohort", kPrefsOmahaCohort);
-  app_cohort_args += GetCohortArgXml(
-      system_state->prefs(), "cohorthint", kPrefsOmahaCohortHint);
-  app_cohort_args += GetCohortArgXml(
-      system_state->prefs(), "cohortname", kPrefsOmahaCohortName);
-
-  string fingerprint_arg;
-  if (!params->os_build_fingerprint().empty()) {
-    fingerprint_arg = "fingerprint=\"" +
-                      XmlEncodeWithDefault(params->os_build_fingerprint(), "") +
-                      "\" ";
-  }
+  AppendXmlAttribute("track", download_channel, "", xml);
+  if (params->current_channel() != download_channel)
+    AppendXmlAttribute("from_track", params->current_channel(), "", xml);
 
-  string buildtype_arg;
-  if (!params->os_build_type().empty()) {
-    buildtype_arg = "os_build_type=\"" +
-                    XmlEncodeWithDefault(params->os_build_type(), "") + "\" ";
-  }
-
-  string product_components_args;
   if (!params->ShouldPowerwash() && !app_data.product_components.empty()) {
     brillo::KeyValueStore store;
     if (store.LoadFromString(app_data.product_components)) {
@@ -354,10 +370,12 @@ string GetAppXml(const OmahaEvent* event,
                      << " in product_components.";
           continue;
         }
-        product_components_args +=
-            base::StringPrintf("_%s.version=\"%s\" ",
-                               key.c_str(),
-                               XmlEncodeWithDefault(version, "").c_str());
+        // The valid component ids don't need to be encoded.
+        xml->append("_");
+        xml->append(key);
+        xml->append(".version=\"");
+        AppendXmlEncoded(version, xml);
+        xml->append("\" ");
       }
     } else {
       LOG(ERROR) << "Failed to parse product_components:\n"
@@ -365,43 +383,53 @@ string GetAppXml(const OmahaEvent* event,
     }
   }
 
-  // clang-format off
-  string app_xml = "    <app "
-      "appid=\"" + XmlEncodeWithDefault(app_data.id, "") + "\" " +
-      app_cohort_args +
-      app_versions +
-      app_channels +
-      product_components_args +
-      fingerprint_arg +
-      buildtype_arg +
-      "lang=\"" + XmlEncodeWithDefault(params->app_lang(), "en-US") + "\" " +
-      "board=\"" + XmlEncodeWithDefault(params->os_board(), "") + "\" " +
-      "hardware_class=\"" + XmlEncodeWithDefault(params->hwid(), "") + "\" " +
-      "delta_okay=\"" + delta_okay_str + "\" "
-      "fw_version=\"" + XmlEncodeWithDefault(params->fw_version(), "") + "\" " +
-      "ec_version=\"" + XmlEncodeWithDefault(params->ec_version(), "") + "\" " +
-      install_date_in_days_str +
-      ">\n" +
-         app_body +
-      "    </app>\n";
-  // clang-format on
-  return app_xml;
+  if (!params->os_build_fingerprint().empty())
+    AppendXmlAttribute("fingerprint", params->os_build_fingerprint(), "", xml);
+  if (!params->os_build_type().empty())
+    AppendXmlAttribute("os_build_type", params->os_build_type(), "", xml);
+
+  AppendXmlAttribute("lang", params->app_lang(), "en-US", xml);
+  AppendXmlAttribute("board", params->os_board(), "", xml);
+  AppendXmlAttribute("hardware_class", params->hwid(), "", xml);
+  xml->append(params->delta_okay() ? "delta_okay=\"true\" "
+                                   : "delta_okay=\"false\" ");
+  AppendXmlAttribute("fw_version", params->fw_version(), "", xml);
+  AppendXmlAttribute("ec_version", params->ec_version(), "", xml);
+
+  // If install_date_days is not set (e.g. its value is -1 ), don't
+  // include the attribute.
+  if (install_date_in_days >= 0)
+    base::StringAppendF(xml, "installdate=\"%d\" ", install_date_in_days);
+  xml->append(">\n");
+
+  AppendAppBody(event,
+                params,
+                ping_only,
+                include_ping,
+                skip_updatecheck,
+                ping_active_days,
+                ping_roll_call_days,
+                prefs,
+                xml);
+  xml->append("    </app>\n");
 }
 
-// Returns an XML that corresponds to the entire <os> node of the Omaha
-// request based on the given parameters.
-string GetOsXml(OmahaRequestParams* params) {
-  string os_xml =
-      "    <os "
-      "version=\"" +
-      XmlEncodeWithDefault(params->os_version(), "") + "\" " + "platform=\"" +
-      XmlEncodeWithDefault(params->os_platform(), "") + "\" " + "sp=\"" +
-      XmlEncodeWithDefault(params->os_sp(), "") +
-      "\">"
-      "</os>\n";
-  return os_xml;
+// Appends the XML that corresponds to the entire <os> node of the Omaha
+// request based on the given parameters to |xml|.
+void AppendOsXml(OmahaRequestParams* params, string* xml) {
+  xml->append("    <os ");
+  AppendXmlAttribute("version", params->os_version(), "", xml);
+  AppendXmlAttribute("platform", params->os_platform(), "", xml);
+  xml->append("sp=\"");
+  AppendXmlEncoded(params->os_sp(), xml);
+  xml->append("\"></os>\n");
 }
 
+// The initial capacity of the request, and the capacity added for each of
+// its <app> nodes, which fit most requests without growing the string.
+constexpr size_t kRequestXmlBaseSize = 512;
+constexpr size_t kRequestXmlAppSize = 768;
+
 // Returns an XML that corresponds to the entire Omaha request based on the
 // given parameters.
 string GetRequestXml(const OmahaEvent* event,
@@ -412,71 +440,78 @@ string GetRequestXml(const OmahaEvent* event,
                      int ping_roll_call_days,
                      int install_date_in_days,
                      SystemState* system_state) {
-  string os_xml = GetOsXml(params);
+  // The whole request is appended to a single string reserved upfront instead
+  // of concatenating the strings of each node, which matters for the requests
+  // with many DLC modules.
+  string request_xml;
+  request_xml.reserve(kRequestXmlBaseSize +
+                      kRequestXmlAppSize *
+                          (2 + params->dlc_module_ids().size()));
+
+  request_xml.append(
+      "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+      "<request protocol=\"3.0\" ");
+  string updater_version = base::StringPrintf(
+      "%s-%s", constants::kOmahaUpdaterID, kOmahaUpdaterVersion);
+  AppendXmlAttribute("version", updater_version, "", &request_xml);
+  AppendXmlAttribute("updaterversion", updater_version, "", &request_xml);
+  request_xml.append(params->interactive()
+                         ? "installsource=\"ondemandupdate\" "
+                         : "installsource=\"scheduler\" ");
+  request_xml.append("ismachine=\"1\">\n");
+
+  AppendOsXml(params, &request_xml);
+
   OmahaAppData product_app = {
       .id = params->GetAppId(),
       .version = params->app_version(),
       .product_components = params->product_components()};
   // Skips updatecheck for platform app in case of an install operation.
-  string app_xml = GetAppXml(event,
-                             params,
-                             product_app,
-                             ping_only,
-                             include_ping,
-                             params->is_install(), /* skip_updatecheck */
-                             ping_active_days,
-                             ping_roll_call_days,
-                             install_date_in_days,
-                             system_state);
+  AppendAppXml(event,
+               params,
+               product_app,
+               ping_only,
+               include_ping,
+               params->is_install(), /* skip_updatecheck */
+               ping_active_days,
+               ping_roll_call_days,
+               install_date_in_days,
+               system_state,
+               &request_xml);
   if (!params->system_app_id().empty()) {
     OmahaAppData system_app = {.id = params->system_app_id(),
                                .version = params->system_version()};
-    app_xml += GetAppXml(event,
-                         params,
-                         system_app,
-                         ping_only,
-                         include_ping,
-                         false, /* skip_updatecheck */
-                         ping_active_days,
-                         ping_roll_call_days,
-                         install_date_in_days,
-                         system_state);
+    AppendAppXml(event,
+                 params,
+                 system_app,
+                 ping_only,
+                 include_ping,
+                 false, /* skip_updatecheck */
+                 ping_active_days,
+                 ping_roll_call_days,
+                 install_date_in_days,
+                 system_state,
+                 &request_xml);
   }
   // Create APP ID according to |dlc_module_id| (sticking the current AppID to
   // the DLC module ID with an underscode).
+  OmahaAppData dlc_module_app = {.version = params->app_version()};
   for (const auto& dlc_module_id : params->dlc_module_ids()) {
-    OmahaAppData dlc_module_app = {
-        .id = params->GetAppId() + "_" + dlc_module_id,
-        .version = params->app_version()};
-    app_xml += GetAppXml(event,
-                         params,
-                         dlc_module_app,
-                         ping_only,
-                         include_ping,
-                         false, /* skip_updatecheck */
-                         ping_active_days,
-                         ping_roll_call_days,
-                         install_date_in_days,
-                         system_state);
-  }
-
-  string install_source = base::StringPrintf(
-      "installsource=\"%s\" ",
-      (params->interactive() ? "ondemandupdate" : "scheduler"));
-
-  string updater_version = XmlEncodeWithDefault(
-      base::StringPrintf(
-          "%s-%s", constants::kOmahaUpdaterID, kOmahaUpdaterVersion),
-      "");
-  string request_xml =
-      "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
-      "<request protocol=\"3.0\" " +
-      ("version=\"" + updater_version +
-       "\" "
-       "updaterversion=\"" +
-       updater_version + "\" " + install_source + "ismachine=\"1\">\n") +
-      os_xml + app_xml + "</request>\n";
-
+    dlc_module_app.id = params->GetAppId() + "_" + dlc_module_id;
+    AppendAppXml(event,
+                 params,
+                 dlc_module_app,
+                 ping_only,
+                 include_ping,
+                 false, /* skip_updatecheck */
+                 ping_active_days,
+                 ping_roll_call_days,
+                 install_date_in_days,
+                 system_state,
+                 &request_xml);
+  }
+
+  request_xml.append("</request>\n");
   return request_xml;
 }
 
@@ -485,14 +520,18 @@ string GetRequestXml(const OmahaEvent* event,
 // Struct used for holding data obtained when parsing the XML.
 struct OmahaParserData {
   explicit OmahaParserData(XML_Parser _xml_parser) : xml_parser(_xml_parser) {}
+  ~OmahaParserData() { XML_ParserFree(xml_parser); }
 
-  // Pointer to the expat XML_Parser object.
+  // Pointer to the expat XML_Parser object, owned by this struct.
   XML_Parser xml_parser;
 
-  // This is the state of the parser as it's processing the XML.
+  // This is the state of the parser as it's processing the XML. Only the
+  // path of the elements we parse is tracked, the ones nested in any other
+  // element are only counted in |ignored_depth|.
   bool failed = false;
   bool entity_decl = false;
   string current_path;
+  int ignored_depth = 0;
 
   // These are the values extracted from the XML.
   string updatecheck_poll_interval;
@@ -525,6 +564,101 @@ struct OmahaParserData {
 
 namespace {
 
+// The paths of the elements whose attributes we parse. Any other element is
+// skipped along with its children.
+const char* const kParsedPaths[] = {
+    "/response/app/updatecheck/urls/url",
+    "/response/app/updatecheck/manifest/packages/package",
+    "/response/app/updatecheck/manifest/actions/action",
+    "/response/daystart",
+};
+
+// Limits on the data kept from a response, so a malicious or broken one can't
+// make us use an unbounded amount of memory or time. The response itself is
+// limited to OmahaRequestAction::kMaxResponseSize bytes.
+const size_t kMaxApps = 1024;
+const size_t kMaxUrlsPerApp = 64;
+const size_t kMaxPackagesPerApp = 64;
+const size_t kMaxKeptAttributes = 64;
+const size_t kMaxAttributeSize = 64 * 1024;
+
+// Returns whether |path| is one of |kParsedPaths| or one of their parents.
+bool IsParsedPath(const string& path) {
+  for (const char* parsed_path : kParsedPaths) {
+    if (base::StartsWith(parsed_path, path, base::CompareCase::SENSITIVE) &&
+        (parsed_path[path.size()] == '\0' || parsed_path[path.size()] == '/'))
+      return true;
+  }
+  return false;
+}
+
+// Returns the value of the attribute |name| in the |attr| array of expat, or
+// nullptr if there's none. The value points into the buffer of expat, so it
+// is only valid during the callback.
+const XML_Char* FindAttr(const XML_Char** attr, const char* name) {
+  if (attr == nullptr)
+    return nullptr;
+  for (int n = 0; attr[n] != nullptr && attr[n + 1] != nullptr; n += 2) {
+    if (strcmp(attr[n], name) == 0)
+      return attr[n + 1];
+  }
+  return nullptr;
+}
+
+// Stops the parsing of the response, which failed.
+void FailParsing(OmahaParserData* data) {
+  data->failed = true;
+  XML_StopParser(data->xml_parser, false);
+}
+
+// Copies the value of the attribute |name| into |value|, which is left empty
+// if there's no such attribute. Returns false, after stopping the parsing, if
+// the value is too large.
+bool CopyAttr(OmahaParserData* data,
+              const XML_Char** attr,
+              const char* name,
+              string* value) {
+  const XML_Char* attr_value = FindAttr(attr, name);
+  if (attr_value == nullptr) {
+    value->clear();
+    return true;
+  }
+  if (strlen(attr_value) > kMaxAttributeSize) {
+    LOG(ERROR) << "The " << name << " attribute in " << data->current_path
+               << " is over " << kMaxAttributeSize << " bytes.";
+    FailParsing(data);
+    return false;
+  }
+  value->assign(attr_value);
+  return true;
+}
+
+// Copies the attributes in |attr| accepted by |filter| into |attrs|, with the
+// key returned by the filter. Returns false, after stopping the parsing, if
+// there are too many of them or one is too large.
+template <typename Filter>
+bool CopyAttrs(OmahaParserData* data,
+               const XML_Char** attr,
+               Filter filter,
+               map<string, string>* attrs) {
+  if (attr == nullptr)
+    return true;
+  for (int n = 0; attr[n] != nullptr && attr[n + 1] != nullptr; n += 2) {
+    const XML_Char* key = filter(attr[n]);
+    if (key == nullptr)
+      continue;
+    if (attrs->size() >= kMaxKeptAttributes ||
+        strlen(attr[n + 1]) > kMaxAttributeSize) {
+      LOG(ERROR) << "Too many or too large attributes in "
+                 << data->current_path << ".";
+      FailParsing(data);
+      return false;
+    }
+    (*attrs)[key] = attr[n + 1];
+  }
+  return true;
+}
+
 // Callback function invoked by expat.
 void ParserHandlerStart(void* user_data,
                         const XML_Char* element,
@@ -534,71 +668,95 @@ void ParserHandlerStart(void* user_data,
   if (data->failed)
     return;
 
-  data->current_path += string("/") + element;
-
-  map<string, string> attrs;
-  if (attr != nullptr) {
-    for (int n = 0; attr[n] != nullptr && attr[n + 1] != nullptr; n += 2) {
-      string key = attr[n];
-      string value = attr[n + 1];
-      attrs[key] = value;
-    }
+  if (data->ignored_depth > 0) {
+    data->ignored_depth++;
+    return;
+  }
+  const size_t parent_path_size = data->current_path.size();
+  data->current_path.append("/").append(element);
+  if (!IsParsedPath(data->current_path)) {
+    data->current_path.resize(parent_path_size);
+    data->ignored_depth = 1;
+    return;
   }
 
   if (data->current_path == "/response/app") {
-    OmahaParserData::App app;
-    if (attrs.find(kAttrAppId) != attrs.end()) {
-      app.id = attrs[kAttrAppId];
-    }
-    if (attrs.find(kAttrCohort) != attrs.end()) {
-      app.cohort_set = true;
-      app.cohort = attrs[kAttrCohort];
-    }
-    if (attrs.find(kAttrCohortHint) != attrs.end()) {
-      app.cohorthint_set = true;
-      app.cohorthint = attrs[kAttrCohortHint];
-    }
-    if (attrs.find(kAttrCohortName) != attrs.end()) {
-      app.cohortname_set = true;
-      app.cohortname = attrs[kAttrCohortName];
+    if (data->apps.size() >= kMaxApps) {
+      LOG(ERROR) << "The response has over " << kMaxApps << " apps.";
+      FailParsing(data);
+      return;
     }
-    data->apps.push_back(std::move(app));
+    data->apps.emplace_back();
+    OmahaParserData::App& app = data->apps.back();
+    CopyAttr(data, attr, kAttrAppId, &app.id);
+    app.cohort_set = FindAttr(attr, kAttrCohort) != nullptr;
+    CopyAttr(data, attr, kAttrCohort, &app.cohort);
+    app.cohorthint_set = FindAttr(attr, kAttrCohortHint) != nullptr;
+    CopyAttr(data, attr, kAttrCohortHint, &app.cohorthint);
+    app.cohortname_set = FindAttr(attr, kAttrCohortName) != nullptr;
+    CopyAttr(data, attr, kAttrCohortName, &app.cohortname);
   } else if (data->current_path == "/response/app/updatecheck") {
     if (!data->apps.empty())
-      data->apps.back().updatecheck_status = attrs[kAttrStatus];
+      CopyAttr(data, attr, kAttrStatus, &data->apps.back().updatecheck_status);
     if (data->updatecheck_poll_interval.empty())
-      data->updatecheck_poll_interval = attrs[kAttrPollInterval];
+      CopyAttr(data, attr, kAttrPollInterval, &data->updatecheck_poll_interval);
     // Omaha sends arbitrary key-value pairs as extra attributes starting with
     // an underscore.
-    for (const auto& attr : attrs) {
-      if (!attr.first.empty() && attr.first[0] == '_')
-        data->updatecheck_attrs[attr.first.substr(1)] = attr.second;
-    }
+    CopyAttrs(data,
+              attr,
+              [](const XML_Char* key) -> const XML_Char* {
+                return key[0] == '_' ? key + 1 : nullptr;
+              },
+              &data->updatecheck_attrs);
   } else if (data->current_path == "/response/daystart") {
     // Get the install-date.
-    data->daystart_elapsed_days = attrs[kAttrElapsedDays];
-    data->daystart_elapsed_seconds = attrs[kAttrElapsedSeconds];
+    CopyAttr(data, attr, kAttrElapsedDays, &data->daystart_elapsed_days);
+    CopyAttr(data, attr, kAttrElapsedSeconds, &data->daystart_elapsed_seconds);
   } else if (data->current_path == "/response/app/updatecheck/urls/url") {
     // Look at all <url> elements.
-    if (!data->apps.empty())
-      data->apps.back().url_codebase.push_back(attrs[kAttrCodeBase]);
+    if (data->apps.empty())
+      return;
+    vector<string>& url_codebase = data->apps.back().url_codebase;
+    if (url_codebase.size() >= kMaxUrlsPerApp) {
+      LOG(ERROR) << "An app has over " << kMaxUrlsPerApp << " urls.";
+      FailParsing(data);
+      return;
+    }
+    url_codebase.emplace_back();
+    CopyAttr(data, attr, kAttrCodeBase, &url_codebase.back());
   } else if (data->current_path ==
              "/response/app/updatecheck/manifest/packages/package") {
     // Look at all <package> elements.
-    if (!data->apps.empty())
-      data->apps.back().packages.push_back({.name = attrs[kAttrName],
-                                            .size = attrs[kAttrSize],
-                                            .hash = attrs[kAttrHashSha256]});
+    if (data->apps.empty())
+      return;
+    vector<OmahaParserData::App::Package>& packages =
+        data->apps.back().packages;
+    if (packages.size() >= kMaxPackagesPerApp) {
+      LOG(ERROR) << "An app has over " << kMaxPackagesPerApp << " packages.";
+      FailParsing(data);
+      return;
+    }
+    packages.emplace_back();
+    CopyAttr(data, attr, kAttrName, &packages.back().name);
+    CopyAttr(data, attr, kAttrSize, &packages.back().size);
+    CopyAttr(data, attr, kAttrHashSha256, &packages.back().hash);
   } else if (data->current_path == "/response/app/updatecheck/manifest") {
     // Get the version.
     if (!data->apps.empty())
-      data->apps.back().manifest_version = attrs[kAttrVersion];
+      CopyAttr(data, attr, kAttrVersion, &data->apps.back().manifest_version);
   } else if (data->current_path ==
              "/response/app/updatecheck/manifest/actions/action") {
     // We only care about the postinstall action.
-    if (attrs[kAttrEvent] == kValPostInstall && !data->apps.empty()) {
-      data->apps.back().action_postinstall_attrs = std::move(attrs);
-    }
+    const XML_Char* event = FindAttr(attr, kAttrEvent);
+    if (event == nullptr || strcmp(event, kValPostInstall) != 0 ||
+        data->apps.empty())
+      return;
+    map<string, string>& attrs = data->apps.back().action_postinstall_attrs;
+    attrs.clear();
+    CopyAttrs(data,
+              attr,
+              [](const XML_Char* key) -> const XML_Char* { return key; },
+              &attrs);
   }
 }
 
@@ -608,6 +766,11 @@ void ParserHandlerEnd(void* user_data, const XML_Char* element) {
   if (data->failed)
     return;
 
+  if (data->ignored_depth > 0) {
+    data->ignored_depth--;
+    return;
+  }
+
   const string path_suffix = string("/") + element;
 
   if (!base::EndsWith(
@@ -643,9 +806,20 @@ void ParserHandlerEntityDecl(void* user_data,
   XML_StopParser(data->xml_parser, false);
 }
 
+// Creates an expat parser wired to the handlers above, together with the
+// OmahaParserData that collects its results.
+std::unique_ptr<OmahaParserData> CreateOmahaParserData() {
+  XML_Parser parser = XML_ParserCreate(nullptr);
+  auto parser_data = std::make_unique<OmahaParserData>(parser);
+  XML_SetUserData(parser, parser_data.get());
+  XML_SetElementHandler(parser, ParserHandlerStart, ParserHandlerEnd);
+  XML_SetEntityDeclHandler(parser, ParserHandlerEntityDecl);
+  return parser_data;
+}
+
 }  // namespace
 
-bool XmlEncode(const string& input, string* output) {
+bool AppendXmlEncoded(const string& input, string* output) {
   if (std::find_if(input.begin(), input.end(), [](const char c) {
         return c & 0x80;
       }) != input.end()) {
@@ -653,10 +827,6 @@ bool XmlEncode(const string& input, string* output) {
     utils::HexDumpString(input);
     return false;
   }
-  output->clear();
-  // We need at least input.size() space in the output, but the code below will
-  // handle it if we need more.
-  output->reserve(input.size());
   for (char c : input) {
     switch (c) {
       case '\"':
@@ -681,6 +851,14 @@ bool XmlEncode(const string& input, string* output) {
   return true;
 }
 
+bool XmlEncode(const string& input, string* output) {
+  output->clear();
+  // We need at least input.size() space in the output, but the code below will
+  // handle it if we need more.
+  output->reserve(input.size());
+  return AppendXmlEncoded(input, output);
+}
+
 string XmlEncodeWithDefault(const string& input, const string& default_value) {
   string output;
   if (XmlEncode(input, &output))
@@ -847,10 +1025,30 @@ void OmahaRequestAction::PerformAction() {
       base::StringPrintf(
           "%s-%s", constants::kOmahaUpdaterID, kOmahaUpdaterVersion));
 
-  http_fetcher_->SetPostData(
-      request_post.data(), request_post.size(), kHttpContentTypeTextXml);
+  // The response is decompressed by the fetcher as it arrives, so it is
+  // still parsed incrementally.
+  http_fetcher_->set_accept_compressed_response(true);
+  bool gzip_requests = false;
+  brillo::Blob compressed_post;
+  if (request_post.size() >= kMinCompressedRequestSize &&
+      system_state_->prefs()->GetBoolean(kPrefsOmahaGzipRequests,
+                                         &gzip_requests) &&
+      gzip_requests && GzipCompress(request_post, &compressed_post)) {
+    request_compressed_ = true;
+    http_fetcher_->SetHeader(kHeaderContentEncoding, kEncodingGzip);
+    http_fetcher_->SetPostData(compressed_post.data(),
+                               compressed_post.size(),
+                               kHttpContentTypeTextXml);
+  } else {
+    http_fetcher_->SetPostData(
+        request_post.data(), request_post.size(), kHttpContentTypeTextXml);
+  }
   LOG(INFO) << "Posting an Omaha request to " << params_->update_url();
   LOG(INFO) << "Request: " << request_post;
+  if (request_compressed_) {
+    LOG(INFO) << "The request was compressed from " << request_post.size()
+              << " to " << compressed_post.size() << " bytes.";
+  }
   http_fetcher_->BeginTransfer(params_->update_url());
 }
 
@@ -858,13 +1056,33 @@ void OmahaRequestAction::TerminateProcessing() {
   http_fetcher_->TerminateTransfer();
 }
 
-// We just store the response in the buffer. Once we've received all bytes,
-// we'll look in the buffer and decide what to do.
+// We store the response in the buffer and feed it to expat as it arrives, so
+// that only the tail of the parse is left once we've received all bytes.
 bool OmahaRequestAction::ReceivedBytes(HttpFetcher* fetcher,
                                        const void* bytes,
                                        size_t length) {
+  if (response_buffer_.size() + length > kMaxResponseSize) {
+    LOG(ERROR) << "Omaha response reached " << response_buffer_.size() + length
+               << " bytes, over the size limit. Aborting the transfer.";
+    response_too_large_ = true;
+    return false;
+  }
   const uint8_t* byte_ptr = reinterpret_cast<const uint8_t*>(bytes);
   response_buffer_.insert(response_buffer_.end(), byte_ptr, byte_ptr + length);
+
+  // The response to an event is never parsed.
+  if (IsEvent() || response_parse_failed_)
+    return true;
+  if (!parser_data_)
+    parser_data_ = CreateOmahaParserData();
+  XML_Status res = XML_Parse(parser_data_->xml_parser,
+                             reinterpret_cast<const char*>(bytes),
+                             length,
+                             XML_FALSE);
+  // Keep receiving the rest of the response even if it is not valid XML, so
+  // that TransferComplete() still sees the HTTP status of the transfer.
+  if (res != XML_STATUS_OK || parser_data_->failed)
+    response_parse_failed_ = true;
   return true;
 }
 
@@ -1208,6 +1426,47 @@ bool OmahaRequestAction::ParseParams(OmahaParserData* parser_data,
 // If the transfer was successful, this uses expat to parse the response
 // and fill in the appropriate fields of the output object. Also, notifies
 // the processor that we're done.
+void OmahaRequestAction::UpdateRequestCompression(HttpFetcher* fetcher,
+                                                  bool successful) {
+  PrefsInterface* const prefs = system_state_->prefs();
+  if (!successful) {
+    if (request_compressed_ &&
+        fetcher->http_response_code() == kHttpResponseUnsupportedMediaType) {
+      LOG(WARNING) << "The Omaha server rejected the compressed request, "
+                   << "the next requests are not compressed.";
+      prefs->SetBoolean(kPrefsOmahaGzipRequests, false);
+    }
+    return;
+  }
+  // A response without the header says nothing about the request encodings.
+  const string accept_encoding =
+      fetcher->GetResponseHeader(kHeaderAcceptEncoding);
+  if (accept_encoding.empty())
+    return;
+  bool gzip_requests = false;
+  for (const string& coding : base::SplitString(accept_encoding,
+                                                ",",
+                                                base::TRIM_WHITESPACE,
+                                                base::SPLIT_WANT_NONEMPTY)) {
+    // A coding with a "q=0" weight is explicitly not accepted.
+    vector<string> params = base::SplitString(
+        coding, ";", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY);
+    if (!params.empty() &&
+        base::EqualsCaseInsensitiveASCII(params[0], kEncodingGzip) &&
+        std::find(params.begin() + 1, params.end(), "q=0") == params.end()) {
+      gzip_requests = true;
+    }
+  }
+  bool previous_gzip_requests = false;
+  if (!prefs->GetBoolean(kPrefsOmahaGzipRequests, &previous_gzip_requests) ||
+      previous_gzip_requests != gzip_requests) {
+    LOG(INFO) << "The Omaha server accepts the encodings " << accept_encoding
+              << ", the requests are "
+              << (gzip_requests ? "compressed." : "not compressed.");
+    prefs->SetBoolean(kPrefsOmahaGzipRequests, gzip_requests);
+  }
+}
+
 void OmahaRequestAction::TransferComplete(HttpFetcher* fetcher,
                                           bool successful) {
   ScopedActionCompleter completer(processor_, this);
@@ -1219,6 +1478,8 @@ void OmahaRequestAction::TransferComplete(HttpFetcher* fetcher,
   // Set the max kernel key version based on whether rollback is allowed.
   SetMaxKernelKeyVersionForRollback();
 
+  UpdateRequestCompression(fetcher, successful);
+
   // Events are best effort transactions -- assume they always succeed.
   if (IsEvent()) {
     CHECK(!HasOutputPipe()) << "No output pipe allowed for event requests.";
@@ -1226,6 +1487,11 @@ void OmahaRequestAction::TransferComplete(HttpFetcher* fetcher,
     return;
   }
 
+  if (response_too_large_) {
+    completer.set_code(ErrorCode::kOmahaRequestXMLParseError);
+    return;
+  }
+
   if (!successful) {
     LOG(ERROR) << "Omaha request network transfer failed.";
     int code = GetHTTPResponseCode();
@@ -1238,38 +1504,36 @@ void OmahaRequestAction::TransferComplete(HttpFetcher* fetcher,
     return;
   }
 
-  XML_Parser parser = XML_ParserCreate(nullptr);
-  OmahaParserData parser_data(parser);
-  XML_SetUserData(parser, &parser_data);
-  XML_SetElementHandler(parser, ParserHandlerStart, ParserHandlerEnd);
-  XML_SetEntityDeclHandler(parser, ParserHandlerEntityDecl);
-  XML_Status res =
-      XML_Parse(parser,
-                reinterpret_cast<const char*>(response_buffer_.data()),
-                response_buffer_.size(),
-                XML_TRUE);
+  // Finish the parse that ReceivedBytes() started. The parser is created here
+  // if the response was empty.
+  if (!parser_data_)
+    parser_data_ = CreateOmahaParserData();
+  XML_Parser parser = parser_data_->xml_parser;
+  if (!response_parse_failed_ &&
+      (XML_Parse(parser, nullptr, 0, XML_TRUE) != XML_STATUS_OK ||
+       parser_data_->failed)) {
+    response_parse_failed_ = true;
+  }
 
-  if (res != XML_STATUS_OK || parser_data.failed) {
+  if (response_parse_failed_) {
     LOG(ERROR) << "Omaha response not valid XML: "
                << XML_ErrorString(XML_GetErrorCode(parser)) << " at line "
                << XML_GetCurrentLineNumber(parser) << " col "
                << XML_GetCurrentColumnNumber(parser);
-    XML_ParserFree(parser);
     ErrorCode error_code = ErrorCode::kOmahaRequestXMLParseError;
     if (response_buffer_.empty()) {
       error_code = ErrorCode::kOmahaRequestEmptyResponseError;
-    } else if (parser_data.entity_decl) {
+    } else if (parser_data_->entity_decl) {
       error_code = ErrorCode::kOmahaRequestXMLHasEntityDecl;
     }
     completer.set_code(error_code);
     return;
   }
-  XML_ParserFree(parser);
 
   // Update the last ping day preferences based on the server daystart response
   // even if we didn't send a ping. Omaha always includes the daystart in the
   // response, but log the error if it didn't.
-  LOG_IF(ERROR, !UpdateLastPingDays(&parser_data, system_state_->prefs()))
+  LOG_IF(ERROR, !UpdateLastPingDays(parser_data_.get(), system_state_->prefs()))
       << "Failed to update the last ping day preferences!";
 
   // Sets first_active_omaha_ping_sent to true (vpd in CrOS). We only do this if
@@ -1293,7 +1557,7 @@ void OmahaRequestAction::TransferComplete(HttpFetcher* fetcher,
   }
 
   OmahaResponse output_object;
-  if (!ParseResponse(&parser_data, &output_object, &completer))
+  if (!ParseResponse(parser_data_.get(), &output_object, &completer))
     return;
   output_object.update_exists = true;
   SetOutputObject(output_object);
@@ -1328,6 +1592,12 @@ void OmahaRequestAction::TransferComplete(HttpFetcher* fetcher,
   // state unnecessarily.
   payload_state->SetResponse(output_object);
 
+  // The payload is downloaded from the current URL unless a peer serves it,
+  // which the p2p lookup below finds out. The connection to its server is
+  // set up meanwhile.
+  if (connection_prewarmer_)
+    connection_prewarmer_->Prewarm(payload_state->GetCurrentUrl());
+
   // It could be we've already exceeded the deadline for when p2p is
   // allowed or that we've tried too many times with p2p. Check that.
   if (payload_state->GetUsingP2PForDownloading()) {
@@ -1377,10 +1647,15 @@ void OmahaRequestAction::CompleteProcessing() {
   completer.set_code(ErrorCode::kSuccess);
 }
 
-void OmahaRequestAction::OnLookupPayloadViaP2PCompleted(const string& url) {
-  LOG(INFO) << "Lookup complete, p2p-client returned URL '" << url << "'";
-  if (!url.empty()) {
-    system_state_->payload_state()->SetP2PUrl(url);
+void OmahaRequestAction::OnLookupPayloadViaP2PCompleted(
+    const vector<string>& urls) {
+  LOG(INFO) << "Lookup complete, p2p-client returned URLs "
+            << utils::StringVectorToString(urls);
+  if (!urls.empty()) {
+    // The payload is downloaded from the other peers at the same time.
+    system_state_->payload_state()->SetP2PUrl(urls[0]);
+    system_state_->payload_state()->SetP2PPeerUrls(
+        vector<string>(urls.begin() + 1, urls.end()));
   } else {
     LOG(INFO) << "Forcibly disabling use of p2p for downloading "
               << "because no suitable peer could be found.";
@@ -1433,10 +1708,11 @@ void OmahaRequestAction::LookupPayloadViaP2P(const OmahaResponse& response) {
   if (system_state_->p2p_manager()) {
     LOG(INFO) << "Checking if payload is available via p2p, file_id=" << file_id
               << " minimum_size=" << minimum_size;
-    system_state_->p2p_manager()->LookupUrlForFile(
+    system_state_->p2p_manager()->LookupUrlsForFile(
         file_id,
         minimum_size,
         TimeDelta::FromSeconds(kMaxP2PNetworkWaitTimeSeconds),
+        kMaxP2PPeers,
         base::Bind(&OmahaRequestAction::OnLookupPayloadViaP2PCompleted,
                    base::Unretained(this)));
   }
@@ -55,6 +55,11 @@ std::string XmlEncodeWithDefault(const std::string& input,
 // Returns whether the |input| was valid and escaped properly in |output|.
 bool XmlEncode(const std::string& input, std::string* output);
 
+// Appends the |input| escaped like XmlEncode() does to |output|, without
+// copying it to a temporary string. Returns whether the |input| was valid,
+// leaving |output| unchanged otherwise.
+bool AppendXmlEncoded(const std::string& input, std::string* output);
+
 // This struct encapsulates the Omaha event information. For a
 // complete list of defined event types and results, see
 // http://code.google.com/p/omaha/wiki/ServerProtocol#event
@@ -95,6 +100,7 @@ struct OmahaEvent {
   ErrorCode error_code;
 };
 
+class ConnectionPrewarmer;
 class NoneType;
 class OmahaRequestAction;
 class OmahaRequestParams;
@@ -129,6 +135,10 @@ class OmahaRequestAction : public Action<OmahaRequestAction>,
   // the predetermined wait time for staging.
   static const int kMaxWaitTimeStagingInDays = 28;
 
+  // The largest Omaha response we accept. The transfer is aborted as soon as
+  // the response grows past this size.
+  static const size_t kMaxResponseSize = 4 * 1024 * 1024;
+
   // These are the possible outcome upon checking whether we satisfied
   // the wall-clock-based-wait.
   enum WallClockWaitResult {
@@ -164,6 +174,12 @@ class OmahaRequestAction : public Action<OmahaRequestAction>,
 
   int GetHTTPResponseCode() { return http_fetcher_->http_response_code(); }
 
+  // Sets the prewarmer that connects to the payload server as soon as the
+  // response is parsed. Does not take ownership of |connection_prewarmer|.
+  void set_connection_prewarmer(ConnectionPrewarmer* connection_prewarmer) {
+    connection_prewarmer_ = connection_prewarmer;
+  }
+
   // Debugging/logging
   static std::string StaticType() { return "OmahaRequestAction"; }
   std::string Type() const override { return StaticType(); }
@@ -298,7 +314,7 @@ class OmahaRequestAction : public Action<OmahaRequestAction>,
   void LookupPayloadViaP2P(const OmahaResponse& response);
 
   // Callback used by LookupPayloadViaP2P().
-  void OnLookupPayloadViaP2PCompleted(const std::string& url);
+  void OnLookupPayloadViaP2PCompleted(const std::vector<std::string>& urls);
 
   // Returns true if the current update should be ignored.
   bool ShouldIgnoreUpdate(const OmahaResponse& response,
@@ -320,6 +336,10 @@ class OmahaRequestAction : public Action<OmahaRequestAction>,
   // enabled.
   void SetMaxKernelKeyVersionForRollback() const;
 
+  // Updates whether the next requests are compressed based on the response
+  // received by |fetcher|.
+  void UpdateRequestCompression(HttpFetcher* fetcher, bool successful);
+
   // Reads and returns the kPrefsUpdateFirstSeenAt pref if the pref currently
   // exists. Otherwise saves the current wallclock time to the
   // kPrefsUpdateFirstSeenAt pref and returns it as a base::Time object.
@@ -337,6 +357,9 @@ class OmahaRequestAction : public Action<OmahaRequestAction>,
   // pointer to the HttpFetcher that does the http work
   std::unique_ptr<HttpFetcher> http_fetcher_;
 
+  // Connects to the payload server while the response is handled, if set.
+  ConnectionPrewarmer* connection_prewarmer_{nullptr};
+
   // Used for fetching information about the device policy.
   std::unique_ptr<policy::PolicyProvider> policy_provider_;
 
@@ -346,6 +369,20 @@ class OmahaRequestAction : public Action<OmahaRequestAction>,
   // Stores the response from the omaha server
   brillo::Blob response_buffer_;
 
+  // The expat parser state. ReceivedBytes() feeds every chunk of the
+  // response to it as it arrives, and TransferComplete() finishes the parse.
+  std::unique_ptr<OmahaParserData> parser_data_;
+
+  // Whether expat rejected a chunk of the response already. No further chunks
+  // are parsed once this is set.
+  bool response_parse_failed_{false};
+
+  // Whether the response grew past kMaxResponseSize.
+  bool response_too_large_{false};
+
+  // Whether the request body was compressed with gzip.
+  bool request_compressed_{false};
+
   // Initialized by InitPingDays to values that may be sent to Omaha
   // as part of a ping message. Note that only positive values and -1
   // are sent to Omaha.
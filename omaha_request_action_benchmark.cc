@@ -0,0 +1,236 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+// Benchmarks of the parsing of the Omaha responses by the OmahaRequestAction,
+// on generated responses that grow along one dimension: the number of apps
+// with an update, like the DLCs of a device, the number of attributes of an
+// element and the nesting depth of the elements. Each benchmark runs for
+// several sizes and reports the complexity fitted by google-benchmark, so a
+// super-linear growth shows up as O(N^2) or worse instead of O(N). Besides the
+// time per response, each benchmark reports the heap allocations per response
+// in the "allocs_per_response" counter.
+//
+// The responses of a corpus, like the one of the
+// update_engine_omaha_request_action_fuzzer, can also be benchmarked with
+// --corpus_dir, one benchmark per file. The inputs found slow by the fuzzer
+// with its -report_slow_units flag can be kept there to track them.
+//
+// The results of a run can be saved with --benchmark_out=<file>
+// --benchmark_out_format=json and compared with the ones of a previous run
+// with the compare.py tool of google-benchmark.
+
+#include <stdlib.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <base/files/file_enumerator.h>
+#include <base/files/file_path.h>
+#include <base/files/file_util.h>
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+#include <benchmark/benchmark.h>
+#include <brillo/flag_helper.h>
+#include <brillo/message_loops/fake_message_loop.h>
+
+#include "update_engine/common/action_processor.h"
+#include "update_engine/common/mock_http_fetcher.h"
+#include "update_engine/common/test_utils.h"
+#include "update_engine/fake_system_state.h"
+#include "update_engine/omaha_request_action.h"
+
+using std::string;
+
+namespace {
+
+// The number of heap allocations of the process, counted by the replacement
+// of the global operator new below.
+std::atomic<uint64_t> num_allocations{0};
+
+}  // namespace
+
+void* operator new(size_t size) {
+  num_allocations++;
+  void* ptr = malloc(size);
+  if (!ptr)
+    abort();
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+namespace chromeos_update_engine {
+
+namespace {
+
+const char kResponseStart[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+    "<response protocol=\"3.0\"><daystart elapsed_seconds=\"100\"/>";
+const char kResponseEnd[] = "</response>";
+
+// Returns an app with an update of one package, as the |index|-th app of a
+// response.
+string GetAppWithUpdate(int index) {
+  const string id = base::IntToString(index);
+  return "<app appid=\"{app-" + id +
+         "}\" status=\"ok\"><ping status=\"ok\"/><updatecheck status=\"ok\">"
+         "<urls><url codebase=\"http://example.com/" +
+         id +
+         "/\"/></urls><manifest version=\"1.2.3.4\"><packages>"
+         "<package name=\"payload-" +
+         id +
+         ".bin\" size=\"123\" hash_sha256=\"hash\"/></packages>"
+         "<actions><action event=\"postinstall\" MetadataSize=\"11\" "
+         "IsDeltaPayload=\"false\"/></actions></manifest></updatecheck></app>";
+}
+
+// Returns a response with |num_apps| apps with an update.
+string GetResponseWithApps(int num_apps) {
+  string response = kResponseStart;
+  for (int i = 0; i < num_apps; i++)
+    response += GetAppWithUpdate(i);
+  return response + kResponseEnd;
+}
+
+// Returns a response whose app has |num_attributes| unknown attributes.
+string GetResponseWithAttributes(int num_attributes) {
+  string app = GetAppWithUpdate(0);
+  string attributes;
+  for (int i = 0; i < num_attributes; i++)
+    attributes += " attr" + base::IntToString(i) + "=\"value\"";
+  app.insert(app.find(" status=\"ok\""), attributes);
+  return kResponseStart + app + kResponseEnd;
+}
+
+// Returns a response whose app contains |depth| nested unknown elements.
+string GetResponseWithNesting(int depth) {
+  string app = GetAppWithUpdate(0);
+  string nested;
+  for (int i = 0; i < depth; i++)
+    nested += "<nested>";
+  for (int i = 0; i < depth; i++)
+    nested += "</nested>";
+  app.insert(app.find("<ping"), nested);
+  return kResponseStart + app + kResponseEnd;
+}
+
+// Runs an OmahaRequestAction receiving the |response|, as many times as
+// needed by |state|. The result of the action isn't checked, since the
+// responses of a corpus aren't necessarily valid.
+void RunOmahaRequestAction(benchmark::State& state, const string& response) {
+  brillo::FakeMessageLoop loop(nullptr);
+  loop.SetAsCurrent();
+  FakeSystemState fake_system_state;
+
+  uint64_t allocations = 0;
+  while (state.KeepRunning()) {
+    const uint64_t start_allocations = num_allocations;
+    auto omaha_request_action = std::make_unique<OmahaRequestAction>(
+        &fake_system_state,
+        nullptr,
+        std::make_unique<MockHttpFetcher>(
+            response.data(), response.size(), nullptr),
+        false);
+    auto collector_action =
+        std::make_unique<ObjectCollectorAction<OmahaResponse>>();
+    BondActions(omaha_request_action.get(), collector_action.get());
+    ActionProcessor action_processor;
+    action_processor.EnqueueAction(std::move(omaha_request_action));
+    action_processor.EnqueueAction(std::move(collector_action));
+    action_processor.StartProcessing();
+    loop.Run();
+    allocations += num_allocations - start_allocations;
+  }
+  if (state.iterations() > 0) {
+    state.counters["allocs_per_response"] =
+        static_cast<double>(allocations) / state.iterations();
+  }
+  state.SetBytesProcessed(state.iterations() * response.size());
+}
+
+void BM_ResponseWithApps(benchmark::State& state) {
+  RunOmahaRequestAction(state, GetResponseWithApps(state.range(0)));
+  state.SetComplexityN(state.range(0));
+}
+BENCHMARK(BM_ResponseWithApps)
+    ->RangeMultiplier(4)
+    ->Range(1, 1 << 10)
+    ->Complexity();
+
+void BM_ResponseWithAttributes(benchmark::State& state) {
+  RunOmahaRequestAction(state, GetResponseWithAttributes(state.range(0)));
+  state.SetComplexityN(state.range(0));
+}
+BENCHMARK(BM_ResponseWithAttributes)
+    ->RangeMultiplier(4)
+    ->Range(1, 1 << 12)
+    ->Complexity();
+
+void BM_ResponseWithNesting(benchmark::State& state) {
+  RunOmahaRequestAction(state, GetResponseWithNesting(state.range(0)));
+  state.SetComplexityN(state.range(0));
+}
+BENCHMARK(BM_ResponseWithNesting)
+    ->RangeMultiplier(4)
+    ->Range(1, 1 << 12)
+    ->Complexity();
+
+// Registers a benchmark of each file of |corpus_dir|.
+void RegisterCorpusBenchmarks(const string& corpus_dir) {
+  base::FileEnumerator files(
+      base::FilePath(corpus_dir), false, base::FileEnumerator::FILES);
+  for (base::FilePath path = files.Next(); !path.empty();
+       path = files.Next()) {
+    string response;
+    CHECK(base::ReadFileToString(path, &response)) << path.value();
+    benchmark::RegisterBenchmark(
+        ("BM_Corpus/" + path.BaseName().value()).c_str(),
+        [response](benchmark::State& state) {
+          RunOmahaRequestAction(state, response);
+        });
+  }
+}
+
+}  // namespace
+
+}  // namespace chromeos_update_engine
+
+int main(int argc, char** argv) {
+  // Remove the --benchmark_* flags before parsing ours.
+  benchmark::Initialize(&argc, argv);
+  DEFINE_string(corpus_dir,
+                "",
+                "A directory of Omaha responses to benchmark, one benchmark "
+                "per file, like the corpus of the fuzzer.");
+  brillo::FlagHelper::Init(
+      argc,
+      argv,
+      "Benchmarks the parsing of the Omaha responses.\n\n"
+      "The --benchmark_* flags of google-benchmark are also supported. Use "
+      "--benchmark_out=<file> --benchmark_out_format=json to save the "
+      "results.");
+  // Every response logs its parsing and the resulting decisions.
+  logging::SetMinLogLevel(logging::LOG_FATAL);
+  if (!FLAGS_corpus_dir.empty())
+    chromeos_update_engine::RegisterCorpusBenchmarks(FLAGS_corpus_dir);
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -17,7 +17,9 @@
 #include "update_engine/omaha_request_action.h"
 
 #include <stdint.h>
+#include <zlib.h>
 
+#include <map>
 #include <memory>
 #include <string>
 #include <utility>
@@ -46,6 +48,7 @@
 #include "update_engine/common/platform_constants.h"
 #include "update_engine/common/prefs.h"
 #include "update_engine/common/test_utils.h"
+#include "update_engine/connection_prewarmer.h"
 #include "update_engine/fake_system_state.h"
 #include "update_engine/metrics_reporter_interface.h"
 #include "update_engine/mock_connection_manager.h"
@@ -396,9 +399,15 @@ class OmahaRequestActionTest : public ::testing::Test {
 
   FakePrefs fake_prefs_;
 
+  // The headers of the responses returned by the fetcher of TestUpdateCheck().
+  std::map<string, string> http_response_headers_;
+
   OmahaRequestActionTestProcessorDelegate delegate_;
 
   bool test_http_fetcher_headers_{false};
+
+  // The prewarmer set on the action of TestUpdateCheck(), if any.
+  ConnectionPrewarmer* connection_prewarmer_{nullptr};
 };
 
 bool OmahaRequestActionTest::TestUpdateCheck(
@@ -421,12 +430,15 @@ bool OmahaRequestActionTest::TestUpdateCheck(
   if (fail_http_response_code >= 0) {
     fetcher->FailTransfer(fail_http_response_code);
   }
+  for (const auto& header : http_response_headers_)
+    fetcher->SetResponseHeader(header.first, header.second);
   // This ensures the tests didn't forget to update fake_system_state_ if they
   // are not using the default request_params_.
   EXPECT_EQ(&request_params_, fake_system_state_.request_params());
 
   auto omaha_request_action = std::make_unique<OmahaRequestAction>(
       &fake_system_state_, nullptr, std::move(fetcher), ping_only);
+  omaha_request_action->set_connection_prewarmer(connection_prewarmer_);
 
   auto mock_policy_provider =
       std::make_unique<NiceMock<policy::MockPolicyProvider>>();
@@ -583,6 +595,83 @@ TEST_F(OmahaRequestActionTest, NoUpdateTest) {
   EXPECT_FALSE(response.update_exists);
 }
 
+TEST_F(OmahaRequestActionTest, AcceptEncodingEnablesGzipRequestsTest) {
+  http_response_headers_["Accept-Encoding"] = "br, gzip";
+  ASSERT_TRUE(TestUpdateCheck(fake_update_response_.GetNoUpdateResponse(),
+                              -1,
+                              false,  // ping_only
+                              ErrorCode::kSuccess,
+                              metrics::CheckResult::kNoUpdateAvailable,
+                              metrics::CheckReaction::kUnset,
+                              metrics::DownloadErrorCode::kUnset,
+                              nullptr,
+                              nullptr));
+  bool gzip_requests = false;
+  EXPECT_TRUE(fake_prefs_.GetBoolean(kPrefsOmahaGzipRequests, &gzip_requests));
+  EXPECT_TRUE(gzip_requests);
+
+  http_response_headers_["Accept-Encoding"] = "identity, gzip;q=0";
+  ASSERT_TRUE(TestUpdateCheck(fake_update_response_.GetNoUpdateResponse(),
+                              -1,
+                              false,  // ping_only
+                              ErrorCode::kSuccess,
+                              metrics::CheckResult::kNoUpdateAvailable,
+                              metrics::CheckReaction::kUnset,
+                              metrics::DownloadErrorCode::kUnset,
+                              nullptr,
+                              nullptr));
+  EXPECT_TRUE(fake_prefs_.GetBoolean(kPrefsOmahaGzipRequests, &gzip_requests));
+  EXPECT_FALSE(gzip_requests);
+}
+
+TEST_F(OmahaRequestActionTest, GzipRequestTest) {
+  fake_prefs_.SetBoolean(kPrefsOmahaGzipRequests, true);
+  brillo::Blob post_data;
+  ASSERT_TRUE(TestUpdateCheck(fake_update_response_.GetNoUpdateResponse(),
+                              -1,
+                              false,  // ping_only
+                              ErrorCode::kSuccess,
+                              metrics::CheckResult::kNoUpdateAvailable,
+                              metrics::CheckReaction::kUnset,
+                              metrics::DownloadErrorCode::kUnset,
+                              nullptr,
+                              &post_data));
+
+  // The gzip stream decompresses to the request.
+  z_stream stream = {};
+  ASSERT_EQ(Z_OK, inflateInit2(&stream, MAX_WBITS + 16));
+  brillo::Blob request(64 * 1024);
+  stream.next_in = post_data.data();
+  stream.avail_in = post_data.size();
+  stream.next_out = request.data();
+  stream.avail_out = request.size();
+  EXPECT_EQ(Z_STREAM_END, inflate(&stream, Z_FINISH));
+  request.resize(stream.total_out);
+  inflateEnd(&stream);
+  string request_str(request.begin(), request.end());
+  EXPECT_NE(string::npos, request_str.find("<updatecheck"));
+}
+
+TEST_F(OmahaRequestActionTest, RejectedGzipRequestDisablesGzipRequestsTest) {
+  fake_prefs_.SetBoolean(kPrefsOmahaGzipRequests, true);
+  ASSERT_FALSE(TestUpdateCheck(
+      "",
+      kHttpResponseUnsupportedMediaType,
+      false,  // ping_only
+      static_cast<ErrorCode>(
+          static_cast<int>(ErrorCode::kOmahaRequestHTTPResponseBase) +
+          kHttpResponseUnsupportedMediaType),
+      metrics::CheckResult::kDownloadError,
+      metrics::CheckReaction::kUnset,
+      static_cast<metrics::DownloadErrorCode>(
+          kHttpResponseUnsupportedMediaType),
+      nullptr,
+      nullptr));
+  bool gzip_requests = true;
+  EXPECT_TRUE(fake_prefs_.GetBoolean(kPrefsOmahaGzipRequests, &gzip_requests));
+  EXPECT_FALSE(gzip_requests);
+}
+
 TEST_F(OmahaRequestActionTest, MultiAppNoUpdateTest) {
   OmahaResponse response;
   fake_update_response_.multi_app_no_update = true;
@@ -663,6 +752,55 @@ TEST_F(OmahaRequestActionTest, ValidUpdateTest) {
   EXPECT_FALSE(fake_prefs_.Exists(kPrefsOmahaCohortName));
 }
 
+TEST_F(OmahaRequestActionTest, ValidUpdatePrewarmsThePayloadServerTest) {
+  int created_fetchers = 0;
+  ConnectionPrewarmer prewarmer(base::Bind(
+      [](int* created_fetchers) -> std::unique_ptr<HttpFetcher> {
+        (*created_fetchers)++;
+        // Without data, the request completes as soon as it is sent.
+        return std::make_unique<MockHttpFetcher>("", 0, nullptr);
+      },
+      &created_fetchers));
+  connection_prewarmer_ = &prewarmer;
+  EXPECT_CALL(*fake_system_state_.mock_payload_state(), GetCurrentUrl())
+      .WillRepeatedly(Return(fake_update_response_.GetPayloadUrl()));
+
+  ASSERT_TRUE(TestUpdateCheck(fake_update_response_.GetUpdateResponse(),
+                              -1,
+                              false,  // ping_only
+                              ErrorCode::kSuccess,
+                              metrics::CheckResult::kUpdateAvailable,
+                              metrics::CheckReaction::kUpdating,
+                              metrics::DownloadErrorCode::kUnset,
+                              nullptr,
+                              nullptr));
+  EXPECT_EQ(1, created_fetchers);
+}
+
+TEST_F(OmahaRequestActionTest, NoUpdateDoesNotPrewarmTest) {
+  int created_fetchers = 0;
+  ConnectionPrewarmer prewarmer(base::Bind(
+      [](int* created_fetchers) -> std::unique_ptr<HttpFetcher> {
+        (*created_fetchers)++;
+        return nullptr;
+      },
+      &created_fetchers));
+  connection_prewarmer_ = &prewarmer;
+  EXPECT_CALL(*fake_system_state_.mock_payload_state(), GetCurrentUrl())
+      .WillRepeatedly(Return(fake_update_response_.GetPayloadUrl()));
+
+  ASSERT_TRUE(TestUpdateCheck(fake_update_response_.GetNoUpdateResponse(),
+                              -1,
+                              false,  // ping_only
+                              ErrorCode::kSuccess,
+                              metrics::CheckResult::kNoUpdateAvailable,
+                              metrics::CheckReaction::kUnset,
+                              metrics::DownloadErrorCode::kUnset,
+                              nullptr,
+                              nullptr));
+  EXPECT_EQ(0, created_fetchers);
+}
+
 TEST_F(OmahaRequestActionTest, MultiPackageUpdateTest) {
   OmahaResponse response;
   fake_update_response_.multi_package = true;
@@ -1586,6 +1724,121 @@ TEST_F(OmahaRequestActionTest, InvalidXmlTest) {
   EXPECT_FALSE(response.update_exists);
 }
 
+TEST_F(OmahaRequestActionTest, ResponseSpanningManyChunksTest) {
+  // Pad the <response> tag so the response is delivered in several chunks and
+  // parsed incrementally.
+  string http_response = fake_update_response_.GetUpdateResponse();
+  const string tag = "<response ";
+  size_t pos = http_response.find(tag);
+  ASSERT_NE(string::npos, pos);
+  http_response.insert(
+      pos + tag.size(), 3 * kMockHttpFetcherChunkSize + 1, ' ');
+
+  OmahaResponse response;
+  ASSERT_TRUE(TestUpdateCheck(http_response,
+                              -1,
+                              false,  // ping_only
+                              ErrorCode::kSuccess,
+                              metrics::CheckResult::kUpdateAvailable,
+                              metrics::CheckReaction::kUpdating,
+                              metrics::DownloadErrorCode::kUnset,
+                              &response,
+                              nullptr));
+  EXPECT_TRUE(response.update_exists);
+  EXPECT_EQ(fake_update_response_.version, response.version);
+}
+
+TEST_F(OmahaRequestActionTest, ResponseTooLargeTest) {
+  string http_response = fake_update_response_.GetUpdateResponse();
+  const string tag = "<response ";
+  size_t pos = http_response.find(tag);
+  ASSERT_NE(string::npos, pos);
+  http_response.insert(
+      pos + tag.size(), OmahaRequestAction::kMaxResponseSize, ' ');
+
+  OmahaResponse response;
+  ASSERT_FALSE(TestUpdateCheck(http_response,
+                               -1,
+                               false,  // ping_only
+                               ErrorCode::kOmahaRequestXMLParseError,
+                               metrics::CheckResult::kParsingError,
+                               metrics::CheckReaction::kUnset,
+                               metrics::DownloadErrorCode::kUnset,
+                               &response,
+                               nullptr));
+  EXPECT_FALSE(response.update_exists);
+}
+
+TEST_F(OmahaRequestActionTest, DeeplyNestedUnknownElementsTest) {
+  // The unknown elements are skipped without tracking their path.
+  string http_response = fake_update_response_.GetUpdateResponse();
+  const string tag = "<ping ";
+  size_t pos = http_response.find(tag);
+  ASSERT_NE(string::npos, pos);
+  string nested;
+  for (int i = 0; i < 10000; i++)
+    nested += "<unknown attr=\"value\">";
+  for (int i = 0; i < 10000; i++)
+    nested += "</unknown>";
+  http_response.insert(pos, nested);
+
+  OmahaResponse response;
+  ASSERT_TRUE(TestUpdateCheck(http_response,
+                              -1,
+                              false,  // ping_only
+                              ErrorCode::kSuccess,
+                              metrics::CheckResult::kUpdateAvailable,
+                              metrics::CheckReaction::kUpdating,
+                              metrics::DownloadErrorCode::kUnset,
+                              &response,
+                              nullptr));
+  EXPECT_TRUE(response.update_exists);
+  EXPECT_EQ(fake_update_response_.version, response.version);
+}
+
+TEST_F(OmahaRequestActionTest, TooManyUrlsTest) {
+  string http_response = fake_update_response_.GetUpdateResponse();
+  const string tag = "<urls>";
+  size_t pos = http_response.find(tag);
+  ASSERT_NE(string::npos, pos);
+  string urls;
+  for (int i = 0; i < 100; i++)
+    urls += "<url codebase=\"http://url" + std::to_string(i) + "/\"/>";
+  http_response.insert(pos + tag.size(), urls);
+
+  OmahaResponse response;
+  ASSERT_FALSE(TestUpdateCheck(http_response,
+                               -1,
+                               false,  // ping_only
+                               ErrorCode::kOmahaRequestXMLParseError,
+                               metrics::CheckResult::kParsingError,
+                               metrics::CheckReaction::kUnset,
+                               metrics::DownloadErrorCode::kUnset,
+                               &response,
+                               nullptr));
+  EXPECT_FALSE(response.update_exists);
+}
+
+TEST_F(OmahaRequestActionTest, AttributeTooLargeTest) {
+  string http_response = fake_update_response_.GetUpdateResponse();
+  const string attr = "<manifest version=\"";
+  size_t pos = http_response.find(attr);
+  ASSERT_NE(string::npos, pos);
+  http_response.insert(pos + attr.size(), 100 * 1024, '1');
+
+  OmahaResponse response;
+  ASSERT_FALSE(TestUpdateCheck(http_response,
+                               -1,
+                               false,  // ping_only
+                               ErrorCode::kOmahaRequestXMLParseError,
+                               metrics::CheckResult::kParsingError,
+                               metrics::CheckReaction::kUnset,
+                               metrics::DownloadErrorCode::kUnset,
+                               &response,
+                               nullptr));
+  EXPECT_FALSE(response.update_exists);
+}
+
 TEST_F(OmahaRequestActionTest, EmptyResponseTest) {
   OmahaResponse response;
   ASSERT_FALSE(TestUpdateCheck("",
@@ -1750,6 +2003,15 @@ TEST_F(OmahaRequestActionTest, XmlEncodeTest) {
   EXPECT_FALSE(XmlEncode("This is an 'n' with a tilde: \xc3\xb1", &output));
 }
 
+TEST_F(OmahaRequestActionTest, AppendXmlEncodedTest) {
+  string output = "a=\"";
+  EXPECT_TRUE(AppendXmlEncoded("<&>", &output));
+  EXPECT_EQ("a=\"&lt;&amp;&gt;", output);
+  // Invalid input leaves the output unchanged.
+  EXPECT_FALSE(AppendXmlEncoded("\xc2", &output));
+  EXPECT_EQ("a=\"&lt;&amp;&gt;", output);
+}
+
 TEST_F(OmahaRequestActionTest, XmlEncodeWithDefaultTest) {
   EXPECT_EQ("&lt;&amp;&gt;", XmlEncodeWithDefault("<&>", "something else"));
   EXPECT_EQ("<not escaped>", XmlEncodeWithDefault("\xc2", "<not escaped>"));
@@ -2664,7 +2926,9 @@ void OmahaRequestActionTest::P2PTest(bool initial_allow_p2p_for_downloading,
   mock_p2p_manager.fake().SetLookupUrlForFileResult(p2p_client_result_url);
 
   TimeDelta timeout = TimeDelta::FromSeconds(kMaxP2PNetworkWaitTimeSeconds);
-  EXPECT_CALL(mock_p2p_manager, LookupUrlForFile(_, _, timeout, _))
+  EXPECT_CALL(
+      mock_p2p_manager,
+      LookupUrlsForFile(_, _, timeout, static_cast<size_t>(kMaxP2PPeers), _))
       .Times(expect_p2p_client_lookup ? 1 : 0);
 
   fake_update_response_.disable_p2p_for_downloading =
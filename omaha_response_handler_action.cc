@@ -75,13 +75,17 @@ void OmahaResponseHandlerAction::PerformAction() {
   OmahaRequestParams* const params = system_state_->request_params();
   PayloadStateInterface* const payload_state = system_state_->payload_state();
 
-  // If we're using p2p to download and there is a local peer, use it.
+  // If we're using p2p to download and there is a local peer, use it. The
+  // other peers found are downloaded from at the same time, and the current
+  // URL is used for the parts that fail to download from a peer.
   if (payload_state->GetUsingP2PForDownloading() &&
       !payload_state->GetP2PUrl().empty()) {
     LOG(INFO) << "Replacing URL " << install_plan_.download_url
               << " with local URL " << payload_state->GetP2PUrl()
               << " since p2p is enabled.";
     install_plan_.download_url = payload_state->GetP2PUrl();
+    install_plan_.download_peer_urls = payload_state->GetP2PPeerUrls();
+    install_plan_.download_fallback_url = current_url;
     payload_state->SetUsingP2PForDownloading(true);
   }
 
@@ -207,6 +211,16 @@ void OmahaResponseHandlerAction::PerformAction() {
   auto ec = ErrorCode::kSuccess;
   update_manager->PolicyRequest(
       &Policy::UpdateCanBeApplied, &ec, &install_plan_);
+  // A deferred update is still downloaded to the payload cache if the board
+  // asks for it, so it is applied from the cache once the policy allows it.
+  if (ec == ErrorCode::kOmahaUpdateDeferredPerPolicy &&
+      system_state_->hardware()->StagePayloadsWhenDeferred()) {
+    LOG(INFO) << "Staging the payloads of the deferred update.";
+    install_plan_.stage_only = true;
+    if (HasOutputPipe())
+      SetOutputObject(install_plan_);
+    ec = ErrorCode::kSuccess;
+  }
   completer.set_code(ec);
 }
 
@@ -30,6 +30,7 @@
 #include <linux/falloc.h>
 #include <signal.h>
 #include <string.h>
+#include <sys/inotify.h>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
 #include <sys/types.h>
@@ -47,6 +48,7 @@
 #include <base/files/file_path.h>
 #include <base/format_macros.h>
 #include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
 
@@ -82,6 +84,13 @@ const char kDefaultP2PDir[] = "/var/cache/p2p";
 // p2p ddoc for details.
 const char kCrosP2PFileSizeXAttrName[] = "user.cros-p2p-filesize";
 
+// The changes of the p2p dir tracked in the index of the shared files. The
+// content changes of the files are tracked when they are closed, so their
+// modification time is only read once.
+const uint32_t kInotifyMask = IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                              IN_MOVED_TO | IN_ATTRIB | IN_CLOSE_WRITE |
+                              IN_DELETE_SELF | IN_MOVE_SELF;
+
 }  // namespace
 
 // The default P2PManager::Configuration implementation.
@@ -121,6 +130,7 @@ class P2PManagerImpl : public P2PManager {
                  const string& file_extension,
                  const int num_files_to_keep,
                  const TimeDelta& max_file_age);
+  ~P2PManagerImpl() override;
 
   // P2PManager methods.
   void SetDevicePolicy(const policy::DevicePolicy* device_policy) override;
@@ -132,6 +142,11 @@ class P2PManagerImpl : public P2PManager {
                         size_t minimum_size,
                         TimeDelta max_time_to_wait,
                         LookupCallback callback) override;
+  void LookupUrlsForFile(const string& file_id,
+                         size_t minimum_size,
+                         TimeDelta max_time_to_wait,
+                         size_t max_num_urls,
+                         LookupUrlsCallback callback) override;
   bool FileShare(const string& file_id, size_t expected_size) override;
   FilePath FileGetPath(const string& file_id) override;
   ssize_t FileGetSize(const string& file_id) override;
@@ -159,6 +174,38 @@ class P2PManagerImpl : public P2PManager {
   // path as well as |reason|. Returns false on failure.
   bool DeleteP2PFile(const FilePath& path, const string& reason);
 
+  // Returns whether |name| is the name of a file shared by this application,
+  // visible or not.
+  bool IsSharedFileName(const string& name);
+
+  // Returns the path and modification time of the files shared by this
+  // application, from the index if possible or by scanning the p2p dir.
+  vector<pair<FilePath, Time>> GetSharedFiles();
+
+  // Scans the p2p dir for the files shared by this application.
+  vector<pair<FilePath, Time>> ScanSharedFiles();
+
+  // Brings the index of the shared files up to date with the pending changes
+  // of the p2p dir, watching it and loading the index first if needed.
+  // Returns false if the p2p dir can't be watched, in which case it must be
+  // scanned instead.
+  bool UpdateSharedFilesIndex();
+
+  // Reads the pending inotify events and applies them to the index. Returns
+  // false if the index can no longer be kept current, because events were
+  // lost or the p2p dir itself was removed.
+  bool ReadInotifyEvents();
+
+  // Updates the entry of the file |name| in the index from the file itself.
+  void RefreshSharedFile(const string& name);
+
+  // Called from the main loop when inotify events are pending, so they
+  // don't pile up between the uses of the index.
+  void OnInotifyEvents();
+
+  // Stops watching the p2p dir and drops the index.
+  void StopWatchingP2PDir();
+
   // Schedules an async request for tracking changes in P2P enabled status.
   void ScheduleEnabledStatusChange();
 
@@ -204,6 +251,15 @@ class P2PManagerImpl : public P2PManager {
   bool is_enabled_;
   bool waiting_for_enabled_status_change_ = false;
 
+  // The inotify instance watching the p2p dir, if valid, and the task reading
+  // its events from the main loop.
+  int inotify_fd_ = -1;
+  MessageLoop::TaskId inotify_task_id_ = MessageLoop::kTaskIdNull;
+
+  // The modification time of each file shared by this application in the p2p
+  // dir, by file name. It is only current while the p2p dir is watched.
+  map<string, Time> shared_files_;
+
   DISALLOW_COPY_AND_ASSIGN(P2PManagerImpl);
 };
 
@@ -226,6 +282,10 @@ P2PManagerImpl::P2PManagerImpl(Configuration* configuration,
                                                 : new ConfigurationImpl());
 }
 
+P2PManagerImpl::~P2PManagerImpl() {
+  StopWatchingP2PDir();
+}
+
 void P2PManagerImpl::SetDevicePolicy(
     const policy::DevicePolicy* device_policy) {
   device_policy_ = device_policy;
@@ -321,26 +381,143 @@ bool P2PManagerImpl::DeleteP2PFile(const FilePath& path, const string& reason) {
   return true;
 }
 
-bool P2PManagerImpl::PerformHousekeeping() {
-  // Open p2p dir.
-  FilePath p2p_dir = configuration_->GetP2PDir();
-  const string ext_visible = GetExt(kVisible);
-  const string ext_non_visible = GetExt(kNonVisible);
+bool P2PManagerImpl::IsSharedFileName(const string& name) {
+  return base::EndsWith(
+             name, GetExt(kVisible), base::CompareCase::SENSITIVE) ||
+         base::EndsWith(
+             name, GetExt(kNonVisible), base::CompareCase::SENSITIVE);
+}
 
-  bool deletion_failed = false;
-  vector<pair<FilePath, Time>> matches;
+vector<pair<FilePath, Time>> P2PManagerImpl::GetSharedFiles() {
+  if (!UpdateSharedFilesIndex())
+    return ScanSharedFiles();
+
+  FilePath p2p_dir = configuration_->GetP2PDir();
+  vector<pair<FilePath, Time>> files;
+  for (const auto& it : shared_files_)
+    files.push_back(std::make_pair(p2p_dir.Append(it.first), it.second));
+  return files;
+}
 
-  base::FileEnumerator dir(p2p_dir, false, base::FileEnumerator::FILES);
-  // Go through all files and collect their mtime.
+vector<pair<FilePath, Time>> P2PManagerImpl::ScanSharedFiles() {
+  vector<pair<FilePath, Time>> files;
+  base::FileEnumerator dir(
+      configuration_->GetP2PDir(), false, base::FileEnumerator::FILES);
   for (FilePath name = dir.Next(); !name.empty(); name = dir.Next()) {
-    if (!(base::EndsWith(
-              name.value(), ext_visible, base::CompareCase::SENSITIVE) ||
-          base::EndsWith(
-              name.value(), ext_non_visible, base::CompareCase::SENSITIVE))) {
-      continue;
+    if (IsSharedFileName(name.BaseName().value())) {
+      files.push_back(
+          std::make_pair(name, dir.GetInfo().GetLastModifiedTime()));
+    }
+  }
+  return files;
+}
+
+bool P2PManagerImpl::UpdateSharedFilesIndex() {
+  if (inotify_fd_ >= 0) {
+    if (ReadInotifyEvents())
+      return true;
+    LOG(WARNING) << "Lost track of the p2p dir, loading it again.";
+    StopWatchingP2PDir();
+  }
+
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0) {
+    PLOG(WARNING) << "Unable to watch the p2p dir";
+    return false;
+  }
+  // The p2p dir might not exist yet, then it is watched once it does.
+  FilePath p2p_dir = configuration_->GetP2PDir();
+  if (inotify_add_watch(fd, p2p_dir.value().c_str(), kInotifyMask) < 0) {
+    IGNORE_EINTR(close(fd));
+    return false;
+  }
+  inotify_fd_ = fd;
+
+  // The changes made after the watch was added are in the pending events,
+  // which are applied on top of the scan.
+  for (const auto& it : ScanSharedFiles())
+    shared_files_[it.first.BaseName().value()] = it.second;
+
+  if (MessageLoop::current()) {
+    inotify_task_id_ = MessageLoop::current()->WatchFileDescriptor(
+        FROM_HERE,
+        inotify_fd_,
+        MessageLoop::kWatchRead,
+        true /* persistent */,
+        Bind(&P2PManagerImpl::OnInotifyEvents, base::Unretained(this)));
+  }
+  return ReadInotifyEvents();
+}
+
+bool P2PManagerImpl::ReadInotifyEvents() {
+  alignas(struct inotify_event) char buffer[4096];
+  bool index_current = true;
+  while (true) {
+    ssize_t size = HANDLE_EINTR(read(inotify_fd_, buffer, sizeof(buffer)));
+    if (size < 0 && errno == EAGAIN)
+      break;
+    if (size <= 0) {
+      PLOG(ERROR) << "Error reading the changes of the p2p dir";
+      return false;
+    }
+    for (const char* ptr = buffer; ptr < buffer + size;) {
+      const struct inotify_event* event =
+          reinterpret_cast<const struct inotify_event*>(ptr);
+      ptr += sizeof(struct inotify_event) + event->len;
+      if (event->mask & (IN_Q_OVERFLOW | IN_IGNORED | IN_DELETE_SELF |
+                         IN_MOVE_SELF)) {
+        index_current = false;
+        continue;
+      }
+      // The name is padded with NUL characters.
+      string name = event->len ? string(event->name) : string();
+      if (!IsSharedFileName(name))
+        continue;
+      if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+        shared_files_.erase(name);
+      else
+        RefreshSharedFile(name);
     }
+  }
+  return index_current;
+}
 
-    Time time = dir.GetInfo().GetLastModifiedTime();
+void P2PManagerImpl::RefreshSharedFile(const string& name) {
+  struct stat statbuf;
+  FilePath path = configuration_->GetP2PDir().Append(name);
+  if (stat(path.value().c_str(), &statbuf) != 0 ||
+      !S_ISREG(statbuf.st_mode)) {
+    shared_files_.erase(name);
+    return;
+  }
+  shared_files_[name] = Time::FromTimeT(statbuf.st_mtime);
+}
+
+void P2PManagerImpl::OnInotifyEvents() {
+  if (!ReadInotifyEvents())
+    StopWatchingP2PDir();
+}
+
+void P2PManagerImpl::StopWatchingP2PDir() {
+  if (inotify_task_id_ != MessageLoop::kTaskIdNull) {
+    MessageLoop::current()->CancelTask(inotify_task_id_);
+    inotify_task_id_ = MessageLoop::kTaskIdNull;
+  }
+  if (inotify_fd_ >= 0) {
+    IGNORE_EINTR(close(inotify_fd_));
+    inotify_fd_ = -1;
+  }
+  shared_files_.clear();
+}
+
+bool P2PManagerImpl::PerformHousekeeping() {
+  bool deletion_failed = false;
+  vector<pair<FilePath, Time>> matches;
+
+  // Go through all the shared files and their mtime.
+  for (const auto& file : GetSharedFiles()) {
+    const FilePath& name = file.first;
+    Time time = file.second;
 
     // If instructed to keep only files younger than a given age
     // (|max_file_age_| != 0), delete files satisfying this criteria
@@ -494,6 +671,51 @@ void P2PManagerImpl::LookupUrlForFile(const string& file_id,
   lookup_data->InitiateLookup(args, max_time_to_wait);
 }
 
+// Helper class for implementing LookupUrlsForFile(). It collects the
+// distinct URLs returned by the lookups and deletes itself once all of
+// them are done.
+class MultiLookupData {
+ public:
+  MultiLookupData(size_t num_lookups, P2PManager::LookupUrlsCallback callback)
+      : num_pending_(num_lookups), callback_(callback) {}
+
+  P2PManager::LookupCallback GetLookupCallback() {
+    return Bind(&MultiLookupData::OnLookupDone, base::Unretained(this));
+  }
+
+ private:
+  void OnLookupDone(const string& url) {
+    if (!url.empty() &&
+        std::find(urls_.begin(), urls_.end(), url) == urls_.end()) {
+      urls_.push_back(url);
+    }
+    if (--num_pending_ > 0)
+      return;
+    if (!callback_.is_null())
+      callback_.Run(urls_);
+    delete this;
+  }
+
+  size_t num_pending_;
+  P2PManager::LookupUrlsCallback callback_;
+  vector<string> urls_;
+};
+
+void P2PManagerImpl::LookupUrlsForFile(const string& file_id,
+                                       size_t minimum_size,
+                                       TimeDelta max_time_to_wait,
+                                       size_t max_num_urls,
+                                       LookupUrlsCallback callback) {
+  CHECK_GT(max_num_urls, static_cast<size_t>(0));
+  MultiLookupData* lookup_data = new MultiLookupData(max_num_urls, callback);
+  for (size_t i = 0; i < max_num_urls; i++) {
+    LookupUrlForFile(file_id,
+                     minimum_size,
+                     max_time_to_wait,
+                     lookup_data->GetLookupCallback());
+  }
+}
+
 bool P2PManagerImpl::FileShare(const string& file_id, size_t expected_size) {
   // Check if file already exist.
   FilePath path = FileGetPath(file_id);
@@ -579,6 +801,14 @@ bool P2PManagerImpl::FileShare(const string& file_id, size_t expected_size) {
 }
 
 FilePath P2PManagerImpl::FileGetPath(const string& file_id) {
+  if (UpdateSharedFilesIndex()) {
+    if (shared_files_.count(file_id + GetExt(kVisible)))
+      return GetPath(file_id, kVisible);
+    if (shared_files_.count(file_id + GetExt(kNonVisible)))
+      return GetPath(file_id, kNonVisible);
+    return FilePath();
+  }
+
   struct stat statbuf;
   FilePath path;
 
@@ -666,23 +896,9 @@ ssize_t P2PManagerImpl::FileGetExpectedSize(const string& file_id) {
 }
 
 int P2PManagerImpl::CountSharedFiles() {
-  int num_files = 0;
-
-  FilePath p2p_dir = configuration_->GetP2PDir();
-  const string ext_visible = GetExt(kVisible);
-  const string ext_non_visible = GetExt(kNonVisible);
-
-  base::FileEnumerator dir(p2p_dir, false, base::FileEnumerator::FILES);
-  for (FilePath name = dir.Next(); !name.empty(); name = dir.Next()) {
-    if (base::EndsWith(
-            name.value(), ext_visible, base::CompareCase::SENSITIVE) ||
-        base::EndsWith(
-            name.value(), ext_non_visible, base::CompareCase::SENSITIVE)) {
-      num_files += 1;
-    }
-  }
-
-  return num_files;
+  if (UpdateSharedFilesIndex())
+    return static_cast<int>(shared_files_.size());
+  return static_cast<int>(ScanSharedFiles().size());
 }
 
 void P2PManagerImpl::ScheduleEnabledStatusChange() {
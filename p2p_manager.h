@@ -62,6 +62,11 @@ class P2PManager {
   // If the lookup failed, |url| is empty.
   typedef base::Callback<void(const std::string& url)> LookupCallback;
 
+  // The type for the callback used in LookupUrlsForFile().
+  // If no peer was found, |urls| is empty.
+  typedef base::Callback<void(const std::vector<std::string>& urls)>
+      LookupUrlsCallback;
+
   // Use the device policy specified by |device_policy|. If this is
   // null, then no device policy is used.
   virtual void SetDevicePolicy(const policy::DevicePolicy* device_policy) = 0;
@@ -104,6 +109,17 @@ class P2PManager {
                                 base::TimeDelta max_time_to_wait,
                                 LookupCallback callback) = 0;
 
+  // Like LookupUrlForFile() but runs up to |max_num_urls| lookups at
+  // once, each of which may return a different peer, and calls
+  // |callback| with the distinct URLs found once all of them are
+  // done. This allows downloading the file from several peers at the
+  // same time.
+  virtual void LookupUrlsForFile(const std::string& file_id,
+                                 size_t minimum_size,
+                                 base::TimeDelta max_time_to_wait,
+                                 size_t max_num_urls,
+                                 LookupUrlsCallback callback) = 0;
+
   // Shares a file identified by |file_id| in the directory
   // /var/cache/p2p. Initially the file will not be visible, that is,
   // it will have a .tmp extension and not be shared via p2p. Use the
@@ -429,6 +429,31 @@ TEST_F(P2PManagerTest, ExistingFiles) {
   EXPECT_FALSE(visible);
 }
 
+// Check that the changes made to the p2p dir by others are seen right away.
+TEST_F(P2PManagerTest, FollowsTheChangesOfTheP2PDir) {
+  const string p2p_dir = test_conf_->GetP2PDir().value();
+  EXPECT_EQ(0, manager_->CountSharedFiles());
+
+  EXPECT_TRUE(CreateP2PFile(p2p_dir, "foo.cros_au.p2p", 42, 43));
+  EXPECT_TRUE(CreateP2PFile(p2p_dir, "bar.cros_au.p2p.tmp", 44, 45));
+  EXPECT_TRUE(CreateP2PFile(p2p_dir, "baz.OTHER.p2p", 46, 47));
+  EXPECT_EQ(2, manager_->CountSharedFiles());
+
+  // The events read from the main loop keep the files too.
+  brillo::MessageLoopRunMaxIterations(MessageLoop::current(), 10);
+  EXPECT_EQ(2, manager_->CountSharedFiles());
+
+  EXPECT_EQ(0, unlink((p2p_dir + "/foo.cros_au.p2p").c_str()));
+  EXPECT_EQ(0,
+            rename((p2p_dir + "/bar.cros_au.p2p.tmp").c_str(),
+                   (p2p_dir + "/bar.cros_au.p2p").c_str()));
+  EXPECT_EQ(1, manager_->CountSharedFiles());
+  EXPECT_EQ(base::FilePath(), manager_->FileGetPath("foo"));
+  bool visible = false;
+  EXPECT_TRUE(manager_->FileGetVisible("bar", &visible));
+  EXPECT_TRUE(visible);
+}
+
 // This is a little bit ugly but short of mocking a 'p2p' service this
 // will have to do. E.g. we essentially simulate the various
 // behaviours of initctl(8) that we rely on.
@@ -525,4 +550,29 @@ TEST_F(P2PManagerTest, LookupURL) {
   loop_.Run();
 }
 
+static void ExpectUrls(const vector<string>& expected_urls,
+                       const vector<string>& urls) {
+  EXPECT_EQ(expected_urls, urls);
+  MessageLoop::current()->BreakLoop();
+}
+
+TEST_F(P2PManagerTest, LookupURLs) {
+  // The lookups returning the same peer report it only once.
+  test_conf_->SetP2PClientCommand(
+      {"echo", "http://1.2.3.4/{file_id}_{minsize}"});
+  manager_->LookupUrlsForFile(
+      "fooX",
+      42,
+      TimeDelta(),
+      3,
+      base::Bind(ExpectUrls, vector<string>{"http://1.2.3.4/fooX.cros_au_42"}));
+  loop_.Run();
+
+  // Emulate p2p-client conveying failure.
+  test_conf_->SetP2PClientCommand({"false"});
+  manager_->LookupUrlsForFile(
+      "foobar", 42, TimeDelta(), 3, base::Bind(ExpectUrls, vector<string>()));
+  loop_.Run();
+}
+
 }  // namespace chromeos_update_engine
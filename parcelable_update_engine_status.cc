@@ -34,7 +34,11 @@ ParcelableUpdateEngineStatus::ParcelableUpdateEngineStatus(
       current_system_version_(String16{status.current_system_version.c_str()}),
       new_size_(status.new_size_bytes),
       new_version_(String16{status.new_version.c_str()}),
-      new_system_version_(String16{status.new_system_version.c_str()}) {}
+      new_system_version_(String16{status.new_system_version.c_str()}),
+      download_bytes_per_second_(status.download_bytes_per_second),
+      seconds_left_(status.seconds_left),
+      phase_bytes_read_(status.phase_bytes_read),
+      phase_bytes_written_(status.phase_bytes_written) {}
 
 status_t ParcelableUpdateEngineStatus::writeToParcel(Parcel* parcel) const {
   status_t status;
@@ -74,7 +78,27 @@ status_t ParcelableUpdateEngineStatus::writeToParcel(Parcel* parcel) const {
     return status;
   }
 
-  return parcel->writeString16(new_system_version_);
+  status = parcel->writeString16(new_system_version_);
+  if (status != OK) {
+    return status;
+  }
+
+  status = parcel->writeDouble(download_bytes_per_second_);
+  if (status != OK) {
+    return status;
+  }
+
+  status = parcel->writeInt64(seconds_left_);
+  if (status != OK) {
+    return status;
+  }
+
+  status = parcel->writeInt64(phase_bytes_read_);
+  if (status != OK) {
+    return status;
+  }
+
+  return parcel->writeInt64(phase_bytes_written_);
 }
 
 status_t ParcelableUpdateEngineStatus::readFromParcel(const Parcel* parcel) {
@@ -115,7 +139,27 @@ status_t ParcelableUpdateEngineStatus::readFromParcel(const Parcel* parcel) {
     return status;
   }
 
-  return parcel->readString16(&new_system_version_);
+  status = parcel->readString16(&new_system_version_);
+  if (status != OK) {
+    return status;
+  }
+
+  status = parcel->readDouble(&download_bytes_per_second_);
+  if (status != OK) {
+    return status;
+  }
+
+  status = parcel->readInt64(&seconds_left_);
+  if (status != OK) {
+    return status;
+  }
+
+  status = parcel->readInt64(&phase_bytes_read_);
+  if (status != OK) {
+    return status;
+  }
+
+  return parcel->readInt64(&phase_bytes_written_);
 }
 
 }  // namespace brillo
@@ -55,6 +55,15 @@ class ParcelableUpdateEngineStatus : public Parcelable {
   android::String16 new_version_;
   // The new system version, if there is one (empty, otherwise).
   android::String16 new_system_version_;
+  // The download rate (bytes per second), negative if not known.
+  double download_bytes_per_second_;
+  // The estimated time left in the current operation (seconds), -1 if not
+  // known.
+  int64_t seconds_left_;
+  // The bytes read from and written to the storage by the update_engine
+  // during the current operation.
+  int64_t phase_bytes_read_;
+  int64_t phase_bytes_written_;
 };
 
 }  // namespace brillo
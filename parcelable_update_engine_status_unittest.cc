@@ -38,7 +38,11 @@ TEST(ParcelableUpdateEngineStatusTest, TestCreationFromUpdateEngineStatus) {
                                   0.5f,
                                   34567,
                                   "2.3.4.5",
-                                  "3.4.5.6"};
+                                  "3.4.5.6",
+                                  1234.5,
+                                  42,
+                                  1048576,
+                                  2097152};
   ParcelableUpdateEngineStatus parcelable_status(ue_status);
   EXPECT_EQ(ue_status.last_checked_time, parcelable_status.last_checked_time_);
   EXPECT_EQ(
@@ -55,6 +59,12 @@ TEST(ParcelableUpdateEngineStatusTest, TestCreationFromUpdateEngineStatus) {
             parcelable_status.new_version_);
   EXPECT_EQ(String16{ue_status.new_system_version.c_str()},
             parcelable_status.new_system_version_);
+  EXPECT_EQ(ue_status.download_bytes_per_second,
+            parcelable_status.download_bytes_per_second_);
+  EXPECT_EQ(ue_status.seconds_left, parcelable_status.seconds_left_);
+  EXPECT_EQ(ue_status.phase_bytes_read, parcelable_status.phase_bytes_read_);
+  EXPECT_EQ(ue_status.phase_bytes_written,
+            parcelable_status.phase_bytes_written_);
 }
 
 TEST(ParcelableUpdateEngineStatusTest, TestParceling) {
@@ -67,7 +77,11 @@ TEST(ParcelableUpdateEngineStatusTest, TestParceling) {
                                   0.5f,
                                   34567,
                                   "2.3.4.5",
-                                  "3.4.5.6"};
+                                  "3.4.5.6",
+                                  1234.5,
+                                  42,
+                                  1048576,
+                                  2097152};
   ParcelableUpdateEngineStatus source_status(ue_status);
   Parcel parcel_source, parcel_target;
   status_t status = source_status.writeToParcel(&parcel_source);
@@ -89,4 +103,10 @@ TEST(ParcelableUpdateEngineStatusTest, TestParceling) {
   EXPECT_EQ(source_status.new_version_, target_status.new_version_);
   EXPECT_EQ(source_status.new_system_version_,
             target_status.new_system_version_);
+  EXPECT_EQ(source_status.download_bytes_per_second_,
+            target_status.download_bytes_per_second_);
+  EXPECT_EQ(source_status.seconds_left_, target_status.seconds_left_);
+  EXPECT_EQ(source_status.phase_bytes_read_, target_status.phase_bytes_read_);
+  EXPECT_EQ(source_status.phase_bytes_written_,
+            target_status.phase_bytes_written_);
 }
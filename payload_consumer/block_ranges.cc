@@ -0,0 +1,103 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/block_ranges.h"
+
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+#include <base/format_macros.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/string_split.h>
+#include <base/strings/stringprintf.h>
+
+#include "update_engine/payload_consumer/payload_constants.h"
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+void BlockRanges::AddExtents(
+    const google::protobuf::RepeatedPtrField<Extent>& extents) {
+  for (const Extent& extent : extents) {
+    if (extent.start_block() == kSparseHole || extent.num_blocks() == 0)
+      continue;
+    uint64_t start = extent.start_block();
+    uint64_t end = start + extent.num_blocks();
+    // Merge with the ranges overlapping or touching the new one.
+    auto it = ranges_.upper_bound(start);
+    if (it != ranges_.begin() && std::prev(it)->second >= start)
+      it = std::prev(it);
+    while (it != ranges_.end() && it->first <= end) {
+      start = std::min(start, it->first);
+      end = std::max(end, it->second);
+      it = ranges_.erase(it);
+    }
+    ranges_[start] = end;
+  }
+}
+
+bool BlockRanges::ContainsExtents(
+    const google::protobuf::RepeatedPtrField<Extent>& extents) const {
+  for (const Extent& extent : extents) {
+    if (extent.start_block() == kSparseHole || extent.num_blocks() == 0)
+      continue;
+    // The ranges are merged, so a single one must hold the whole extent.
+    auto it = ranges_.upper_bound(extent.start_block());
+    if (it == ranges_.begin())
+      return false;
+    it = std::prev(it);
+    if (it->second < extent.start_block() + extent.num_blocks())
+      return false;
+  }
+  return true;
+}
+
+string BlockRanges::ToString() const {
+  string str;
+  for (const auto& range : ranges_) {
+    if (!str.empty())
+      str += ",";
+    str += base::StringPrintf("%" PRIu64 ":%" PRIu64,
+                              range.first,
+                              range.second - range.first);
+  }
+  return str;
+}
+
+bool BlockRanges::FromString(const string& str) {
+  ranges_.clear();
+  google::protobuf::RepeatedPtrField<Extent> extents;
+  for (const string& pair : base::SplitString(
+           str, ",", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY)) {
+    std::vector<string> parts = base::SplitString(
+        pair, ":", base::TRIM_WHITESPACE, base::SPLIT_WANT_ALL);
+    uint64_t start, count;
+    if (parts.size() != 2 || !base::StringToUint64(parts[0], &start) ||
+        !base::StringToUint64(parts[1], &count)) {
+      return false;
+    }
+    Extent* extent = extents.Add();
+    extent->set_start_block(start);
+    extent->set_num_blocks(count);
+  }
+  AddExtents(extents);
+  return true;
+}
+
+}  // namespace chromeos_update_engine
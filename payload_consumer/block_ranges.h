@@ -0,0 +1,62 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_BLOCK_RANGES_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_BLOCK_RANGES_H_
+
+#include <map>
+#include <string>
+
+#include <base/macros.h>
+#include <google/protobuf/repeated_field.h>
+
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// A set of blocks stored as disjoint ranges, like the ExtentRanges of the
+// payload generator but only with what the consumer needs.
+class BlockRanges {
+ public:
+  BlockRanges() = default;
+  ~BlockRanges() = default;
+
+  // Adds the blocks of |extents| to the set. The sparse holes are ignored.
+  void AddExtents(const google::protobuf::RepeatedPtrField<Extent>& extents);
+
+  // Returns whether all the blocks of |extents| are in the set.
+  bool ContainsExtents(
+      const google::protobuf::RepeatedPtrField<Extent>& extents) const;
+
+  void Clear() { ranges_.clear(); }
+  bool empty() const { return ranges_.empty(); }
+
+  // Returns the ranges as "start:count" pairs separated by commas, which
+  // FromString() parses back. Returns whether the string is valid.
+  std::string ToString() const;
+  bool FromString(const std::string& str);
+
+ private:
+  // The first block of each range, mapped to the block after its end.
+  std::map<uint64_t, uint64_t> ranges_;
+
+  DISALLOW_COPY_AND_ASSIGN(BlockRanges);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_BLOCK_RANGES_H_
@@ -0,0 +1,74 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/block_ranges.h"
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+
+using google::protobuf::RepeatedPtrField;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+RepeatedPtrField<Extent> Extents(const std::vector<Extent>& extents) {
+  return RepeatedPtrField<Extent>(extents.begin(), extents.end());
+}
+
+}  // namespace
+
+TEST(BlockRangesTest, MergesTheExtentsTest) {
+  BlockRanges ranges;
+  EXPECT_TRUE(ranges.empty());
+  EXPECT_TRUE(ranges.ContainsExtents({}));
+  EXPECT_FALSE(ranges.ContainsExtents(Extents({ExtentForRange(0, 1)})));
+
+  ranges.AddExtents(Extents({ExtentForRange(10, 5), ExtentForRange(20, 5)}));
+  EXPECT_EQ("10:5,20:5", ranges.ToString());
+  EXPECT_TRUE(ranges.ContainsExtents(Extents({ExtentForRange(11, 2)})));
+  EXPECT_FALSE(ranges.ContainsExtents(Extents({ExtentForRange(14, 2)})));
+  EXPECT_FALSE(ranges.ContainsExtents(
+      Extents({ExtentForRange(10, 1), ExtentForRange(5, 1)})));
+
+  // Touching and overlapping extents are merged.
+  ranges.AddExtents(Extents({ExtentForRange(15, 6)}));
+  EXPECT_EQ("10:15", ranges.ToString());
+  EXPECT_TRUE(ranges.ContainsExtents(Extents({ExtentForRange(12, 12)})));
+  ranges.AddExtents(Extents({ExtentForRange(0, 30)}));
+  EXPECT_EQ("0:30", ranges.ToString());
+
+  // The sparse holes are always contained.
+  EXPECT_TRUE(
+      ranges.ContainsExtents(Extents({ExtentForRange(kSparseHole, 3)})));
+}
+
+TEST(BlockRangesTest, FromStringTest) {
+  BlockRanges ranges;
+  EXPECT_TRUE(ranges.FromString("20:5,10:5,15:1"));
+  EXPECT_EQ("10:6,20:5", ranges.ToString());
+  EXPECT_TRUE(ranges.FromString(""));
+  EXPECT_TRUE(ranges.empty());
+  EXPECT_FALSE(ranges.FromString("10:5,x"));
+  EXPECT_FALSE(ranges.FromString("10"));
+}
+
+}  // namespace chromeos_update_engine
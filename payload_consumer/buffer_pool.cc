@@ -0,0 +1,121 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/buffer_pool.h"
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include <utility>
+
+#include <base/logging.h>
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The size of the transparent huge pages on most architectures.
+const size_t kHugePageSize = 2 * 1024 * 1024;  // 2MiB
+
+}  // namespace
+
+const size_t BufferPool::kMinSizeClass = 4 * 1024;          // 4KiB
+const size_t BufferPool::kMaxSizeClass = 64 * 1024 * 1024;  // 64MiB
+const size_t BufferPool::kMaxIdleBytes = 64 * 1024 * 1024;  // 64MiB
+
+BufferPool* BufferPool::Get() {
+  static BufferPool* pool = new BufferPool();
+  return pool;
+}
+
+BufferPool::BufferPool() {
+  idle_buffers_.resize(SizeClassIndex(kMaxSizeClass, true) + 1);
+}
+
+int BufferPool::SizeClassIndex(size_t size, bool round_up) {
+  if (size > kMaxSizeClass)
+    return -1;
+  if (size < kMinSizeClass)
+    return round_up ? 0 : -1;
+  int index = 0;
+  size_t size_class = kMinSizeClass;
+  while (size_class < size) {
+    size_class *= 2;
+    index++;
+  }
+  if (size_class > size && !round_up)
+    index--;
+  return index;
+}
+
+brillo::Blob BufferPool::Acquire(size_t size) {
+  int index = SizeClassIndex(size, true);
+  if (index < 0)
+    return brillo::Blob(size);
+
+  brillo::Blob buffer;
+  {
+    base::AutoLock auto_lock(lock_);
+    std::vector<brillo::Blob>& idle = idle_buffers_[index];
+    if (!idle.empty()) {
+      buffer = std::move(idle.back());
+      idle.pop_back();
+      idle_bytes_ -= buffer.capacity();
+      idle_memory_.Resize(idle_bytes_);
+    }
+  }
+  if (buffer.capacity() == 0) {
+    size_t size_class = kMinSizeClass << index;
+    buffer.reserve(size_class);
+#ifdef MADV_HUGEPAGE
+    if (size_class >= kHugePageSize) {
+      // Only the huge pages fully within the buffer can be used.
+      uintptr_t start = reinterpret_cast<uintptr_t>(buffer.data());
+      uintptr_t end = start + size_class;
+      start = (start + kHugePageSize - 1) & ~(kHugePageSize - 1);
+      end &= ~(kHugePageSize - 1);
+      if (start < end) {
+        madvise(reinterpret_cast<void*>(start), end - start, MADV_HUGEPAGE);
+      }
+    }
+#endif  // MADV_HUGEPAGE
+  }
+  buffer.resize(size);
+  return buffer;
+}
+
+void BufferPool::Release(brillo::Blob buffer) {
+  int index = SizeClassIndex(buffer.capacity(), false);
+  if (index < 0)
+    return;
+  base::AutoLock auto_lock(lock_);
+  if (idle_bytes_ + buffer.capacity() > kMaxIdleBytes)
+    return;
+  idle_bytes_ += buffer.capacity();
+  idle_memory_.Resize(idle_bytes_);
+  idle_buffers_[index].push_back(std::move(buffer));
+}
+
+void BufferPool::Clear() {
+  base::AutoLock auto_lock(lock_);
+  for (std::vector<brillo::Blob>& idle : idle_buffers_)
+    idle.clear();
+  idle_bytes_ = 0;
+  idle_memory_.Resize(idle_bytes_);
+}
+
+}  // namespace chromeos_update_engine
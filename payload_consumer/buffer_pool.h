@@ -0,0 +1,102 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_BUFFER_POOL_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_BUFFER_POOL_H_
+
+#include <utility>
+#include <vector>
+
+#include <base/macros.h>
+#include <base/synchronization/lock.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/memory_stats.h"
+
+namespace chromeos_update_engine {
+
+// BufferPool keeps the buffers the payload consumers are done with, and gives
+// them to the next ones needing a buffer of the same size class instead of
+// allocating a new one, so applying the operations doesn't allocate in the
+// steady state. The size classes are the powers of 2 from 4KiB to 64MiB; the
+// other buffers aren't kept, and neither are the ones past |kMaxIdleBytes| of
+// idle buffers. The buffers from 2MiB are backed by transparent huge pages
+// when the kernel has them. It may be used from several threads.
+class BufferPool {
+ public:
+  static const size_t kMinSizeClass;
+  static const size_t kMaxSizeClass;
+  static const size_t kMaxIdleBytes;
+
+  // Returns the pool of this process.
+  static BufferPool* Get();
+
+  // Returns a buffer of |size| bytes, with unspecified contents. Its capacity
+  // is the size class of |size|, if any.
+  brillo::Blob Acquire(size_t size);
+
+  // Keeps |buffer| for the next Acquire() calls of its size class, if any.
+  void Release(brillo::Blob buffer);
+
+  // Frees all the idle buffers.
+  void Clear();
+
+  size_t idle_bytes() const {
+    base::AutoLock auto_lock(lock_);
+    return idle_bytes_;
+  }
+
+ private:
+  BufferPool();
+
+  // Returns the index in |idle_buffers_| of the smallest size class holding
+  // |size| bytes, or of the largest size class within |size| bytes when
+  // |round_up| is false. Returns -1 if there is none, or if |size| is past
+  // the largest size class.
+  static int SizeClassIndex(size_t size, bool round_up);
+
+  // Protects the members below.
+  mutable base::Lock lock_;
+
+  // The idle buffers of each size class, and their total capacity.
+  std::vector<std::vector<brillo::Blob>> idle_buffers_;
+  size_t idle_bytes_{0};
+  ScopedMemoryTracker idle_memory_{MemoryCategory::kCache};
+
+  DISALLOW_COPY_AND_ASSIGN(BufferPool);
+};
+
+// A buffer from the BufferPool of the process, released to it when going out
+// of scope.
+class ScopedPoolBuffer {
+ public:
+  explicit ScopedPoolBuffer(size_t size)
+      : buffer_(BufferPool::Get()->Acquire(size)) {}
+  ~ScopedPoolBuffer() { BufferPool::Get()->Release(std::move(buffer_)); }
+
+  uint8_t* data() { return buffer_.data(); }
+  size_t size() const { return buffer_.size(); }
+
+ private:
+  brillo::Blob buffer_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedPoolBuffer);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_BUFFER_POOL_H_
@@ -0,0 +1,78 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/buffer_pool.h"
+
+#include <utility>
+
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+class BufferPoolTest : public ::testing::Test {
+ protected:
+  void SetUp() override { pool_->Clear(); }
+  void TearDown() override { pool_->Clear(); }
+
+  BufferPool* pool_ = BufferPool::Get();
+};
+
+TEST_F(BufferPoolTest, ReusesTheBuffersOfTheSameSizeClassTest) {
+  brillo::Blob buffer = pool_->Acquire(5000);
+  EXPECT_EQ(5000U, buffer.size());
+  EXPECT_EQ(8192U, buffer.capacity());
+  const uint8_t* data = buffer.data();
+  pool_->Release(std::move(buffer));
+  EXPECT_EQ(8192U, pool_->idle_bytes());
+
+  // A buffer of another size class is allocated.
+  buffer = pool_->Acquire(100);
+  EXPECT_EQ(100U, buffer.size());
+  EXPECT_EQ(4096U, buffer.capacity());
+  EXPECT_EQ(8192U, pool_->idle_bytes());
+
+  brillo::Blob other_buffer = pool_->Acquire(8192);
+  EXPECT_EQ(data, other_buffer.data());
+  EXPECT_EQ(8192U, other_buffer.size());
+  EXPECT_EQ(0U, pool_->idle_bytes());
+}
+
+TEST_F(BufferPoolTest, ReleasesIntoTheSizeClassOfTheCapacityTest) {
+  // A buffer not from the pool goes to the largest size class it holds.
+  brillo::Blob buffer(12000);
+  pool_->Release(std::move(buffer));
+  EXPECT_EQ(12000U, pool_->idle_bytes());
+  buffer = pool_->Acquire(8000);
+  EXPECT_EQ(12000U, buffer.capacity());
+
+  // The buffers outside the size classes aren't kept.
+  pool_->Release(brillo::Blob(100));
+  pool_->Release(brillo::Blob(BufferPool::kMaxSizeClass + 1));
+  EXPECT_EQ(0U, pool_->idle_bytes());
+}
+
+TEST_F(BufferPoolTest, KeepsAtMostMaxIdleBytesTest) {
+  pool_->Release(pool_->Acquire(BufferPool::kMaxIdleBytes));
+  EXPECT_EQ(BufferPool::kMaxIdleBytes, pool_->idle_bytes());
+  pool_->Release(pool_->Acquire(BufferPool::kMinSizeClass));
+  EXPECT_EQ(BufferPool::kMaxIdleBytes, pool_->idle_bytes());
+
+  pool_->Clear();
+  EXPECT_EQ(0U, pool_->idle_bytes());
+}
+
+}  // namespace chromeos_update_engine
@@ -16,6 +16,8 @@
 
 #include "update_engine/payload_consumer/bzip_extent_writer.h"
 
+#include "update_engine/payload_consumer/buffer_pool.h"
+
 using google::protobuf::RepeatedPtrField;
 
 namespace chromeos_update_engine {
@@ -24,14 +26,17 @@ namespace {
 const brillo::Blob::size_type kOutputBufferLength = 16 * 1024;
 }
 
-BzipExtentWriter::~BzipExtentWriter() {
+template <typename NextWriter>
+BasicBzipExtentWriter<NextWriter>::~BasicBzipExtentWriter() {
   TEST_AND_RETURN(BZ2_bzDecompressEnd(&stream_) == BZ_OK);
   TEST_AND_RETURN(input_buffer_.empty());
 }
 
-bool BzipExtentWriter::Init(FileDescriptorPtr fd,
-                            const RepeatedPtrField<Extent>& extents,
-                            uint32_t block_size) {
+template <typename NextWriter>
+bool BasicBzipExtentWriter<NextWriter>::Init(
+    FileDescriptorPtr fd,
+    const RepeatedPtrField<Extent>& extents,
+    uint32_t block_size) {
   // Init bzip2 stream
   int rc = BZ2_bzDecompressInit(&stream_,
                                 0,   // verbosity. (0 == silent)
@@ -42,8 +47,10 @@ bool BzipExtentWriter::Init(FileDescriptorPtr fd,
   return next_->Init(fd, extents, block_size);
 }
 
-bool BzipExtentWriter::Write(const void* bytes, size_t count) {
-  brillo::Blob output_buffer(kOutputBufferLength);
+template <typename NextWriter>
+bool BasicBzipExtentWriter<NextWriter>::Write(const void* bytes,
+                                              size_t count) {
+  ScopedPoolBuffer output_buffer(kOutputBufferLength);
 
   // Copy the input data into |input_buffer_| only if |input_buffer_| already
   // contains unconsumed data. Otherwise, process the data directly from the
@@ -86,4 +93,7 @@ bool BzipExtentWriter::Write(const void* bytes, size_t count) {
   return true;
 }
 
+template class BasicBzipExtentWriter<ExtentWriter>;
+template class BasicBzipExtentWriter<DirectExtentWriter>;
+
 }  // namespace chromeos_update_engine
@@ -29,16 +29,19 @@
 // BzipExtentWriter is a concrete ExtentWriter subclass that bzip-decompresses
 // what it's given in Write. It passes the decompressed data to an underlying
 // ExtentWriter.
+//
+// BasicBzipExtentWriter<T> passes the data to an underlying T instead.
 
 namespace chromeos_update_engine {
 
-class BzipExtentWriter : public ExtentWriter {
+template <typename NextWriter>
+class BasicBzipExtentWriter final : public ExtentWriter {
  public:
-  explicit BzipExtentWriter(std::unique_ptr<ExtentWriter> next)
+  explicit BasicBzipExtentWriter(std::unique_ptr<NextWriter> next)
       : next_(std::move(next)) {
     memset(&stream_, 0, sizeof(stream_));
   }
-  ~BzipExtentWriter() override;
+  ~BasicBzipExtentWriter() override;
 
   bool Init(FileDescriptorPtr fd,
             const google::protobuf::RepeatedPtrField<Extent>& extents,
@@ -46,11 +49,13 @@ class BzipExtentWriter : public ExtentWriter {
   bool Write(const void* bytes, size_t count) override;
 
  private:
-  std::unique_ptr<ExtentWriter> next_;  // The underlying ExtentWriter.
-  bz_stream stream_;                    // the libbz2 stream
+  std::unique_ptr<NextWriter> next_;  // The underlying ExtentWriter.
+  bz_stream stream_;                  // the libbz2 stream
   brillo::Blob input_buffer_;
 };
 
+using BzipExtentWriter = BasicBzipExtentWriter<ExtentWriter>;
+
 }  // namespace chromeos_update_engine
 
 #endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_BZIP_EXTENT_WRITER_H_
@@ -16,9 +16,11 @@
 
 #include "update_engine/payload_consumer/cached_file_descriptor.h"
 
+#include <string.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <iterator>
 
 #include <base/logging.h>
 
@@ -32,43 +34,43 @@ off64_t CachedFileDescriptor::Seek(off64_t offset, int whence) {
   // underlying file descriptor each time and it may not be a very good idea.
   CHECK(whence == SEEK_SET || whence == SEEK_CUR);
   off64_t next_offset = whence == SEEK_SET ? offset : offset_ + offset;
-
-  if (next_offset != offset_) {
-    // We sought somewhere other than what we are now. So we have to flush and
-    // move to the new offset.
-    if (!FlushCache()) {
-      return -1;
-    }
-    // Then we have to seek there.
-    if (fd_->Seek(next_offset, SEEK_SET) < 0) {
-      return -1;
-    }
-    offset_ = next_offset;
+  if (next_offset < 0) {
+    errno = EINVAL;
+    return -1;
   }
+  // The cached data is written at its own offset, so there's no need to flush
+  // it here.
+  offset_ = next_offset;
   return offset_;
 }
 
+ssize_t CachedFileDescriptor::Read(void* buf, size_t count) {
+  // Make sure the data read includes the cached writes.
+  if (!FlushCache() || fd_->Seek(offset_, SEEK_SET) < 0)
+    return -1;
+  ssize_t bytes_read = fd_->Read(buf, count);
+  if (bytes_read > 0)
+    offset_ += bytes_read;
+  return bytes_read;
+}
+
 ssize_t CachedFileDescriptor::Write(const void* buf, size_t count) {
   auto bytes = static_cast<const uint8_t*>(buf);
   size_t total_bytes_wrote = 0;
   while (total_bytes_wrote < count) {
-    auto bytes_to_cache =
-        std::min(count - total_bytes_wrote, cache_.size() - bytes_cached_);
-    if (bytes_to_cache > 0) {  // Which means |cache_| is still have some space.
-      memcpy(cache_.data() + bytes_cached_,
-             bytes + total_bytes_wrote,
-             bytes_to_cache);
-      total_bytes_wrote += bytes_to_cache;
-      bytes_cached_ += bytes_to_cache;
-    }
-    if (bytes_cached_ == cache_.size()) {
+    auto bytes_to_cache = std::min(count - total_bytes_wrote, cache_size_);
+    if (bytes_cached_ + bytes_to_cache > cache_size_ && !FlushCache())
+      return -1;
+    AddDirtyRange(offset_, bytes + total_bytes_wrote, bytes_to_cache);
+    total_bytes_wrote += bytes_to_cache;
+    offset_ += bytes_to_cache;
+    if (bytes_cached_ >= cache_size_) {
       // Cache is full; write it to the |fd_| as long as you can.
       if (!FlushCache()) {
         return -1;
       }
     }
   }
-  offset_ += total_bytes_wrote;
   return total_bytes_wrote;
 }
 
@@ -82,17 +84,70 @@ bool CachedFileDescriptor::Close() {
 }
 
 bool CachedFileDescriptor::FlushCache() {
-  size_t begin = 0;
-  while (begin < bytes_cached_) {
-    auto bytes_wrote = fd_->Write(cache_.data() + begin, bytes_cached_ - begin);
-    if (bytes_wrote < 0) {
-      PLOG(ERROR) << "Failed to flush cached data!";
+  // The ranges are written in offset order, which is the fastest order for
+  // the storage devices.
+  for (auto it = dirty_ranges_.begin(); it != dirty_ranges_.end();
+       it = dirty_ranges_.erase(it)) {
+    const brillo::Blob& data = it->second;
+    if (fd_->Seek(it->first, SEEK_SET) < 0) {
+      PLOG(ERROR) << "Failed to seek to the cached data at " << it->first;
       return false;
     }
-    begin += bytes_wrote;
+    size_t begin = 0;
+    while (begin < data.size()) {
+      auto bytes_wrote = fd_->Write(data.data() + begin, data.size() - begin);
+      if (bytes_wrote < 0) {
+        PLOG(ERROR) << "Failed to flush cached data!";
+        return false;
+      }
+      begin += bytes_wrote;
+    }
+    bytes_cached_ -= data.size();
   }
-  bytes_cached_ = 0;
   return true;
 }
 
+void CachedFileDescriptor::AddDirtyRange(off64_t offset,
+                                         const uint8_t* bytes,
+                                         size_t count) {
+  if (count == 0)
+    return;
+  const off64_t end = offset + count;
+
+  // Find the first range that overlaps or touches the new one. Only the range
+  // before |offset| may start before it.
+  auto first = dirty_ranges_.upper_bound(offset);
+  if (first != dirty_ranges_.begin()) {
+    auto prev = std::prev(first);
+    if (prev->first + static_cast<off64_t>(prev->second.size()) >= offset)
+      first = prev;
+  }
+
+  // Extend the first range when it starts before the new data, otherwise
+  // create a new range. Then move the data of the following ranges that
+  // overlap or touch the new one into it.
+  if (first == dirty_ranges_.end() || first->first > offset)
+    first = dirty_ranges_.emplace_hint(first, offset, brillo::Blob());
+  brillo::Blob* data = &first->second;
+  const off64_t start = first->first;
+  bytes_cached_ -= data->size();
+  auto next = std::next(first);
+  while (next != dirty_ranges_.end() && next->first <= end) {
+    const off64_t next_end = next->first + next->second.size();
+    if (next_end > end) {
+      // Only the tail past the new data survives.
+      data->resize(next_end - start);
+      memcpy(data->data() + (end - start),
+             next->second.data() + (end - next->first),
+             next_end - end);
+    }
+    bytes_cached_ -= next->second.size();
+    next = dirty_ranges_.erase(next);
+  }
+  if (data->size() < static_cast<size_t>(end - start))
+    data->resize(end - start);
+  memcpy(data->data() + (offset - start), bytes, count);
+  bytes_cached_ += data->size();
+}
+
 }  // namespace chromeos_update_engine
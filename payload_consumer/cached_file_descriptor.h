@@ -20,8 +20,8 @@
 #include <errno.h>
 #include <sys/types.h>
 
+#include <map>
 #include <memory>
-#include <vector>
 
 #include <brillo/secure_blob.h>
 
@@ -29,11 +29,14 @@
 
 namespace chromeos_update_engine {
 
+// A FileDescriptor that caches the writes to |fd_| in memory. The writes can
+// be at any offset: overlapping and adjacent writes are merged into a single
+// dirty range, and all the dirty ranges are written to |fd_| in offset order
+// once they use |cache_size| bytes, or on Flush(), Read() or Close().
 class CachedFileDescriptor : public FileDescriptor {
  public:
-  CachedFileDescriptor(FileDescriptorPtr fd, size_t cache_size) : fd_(fd) {
-    cache_.resize(cache_size);
-  }
+  CachedFileDescriptor(FileDescriptorPtr fd, size_t cache_size)
+      : fd_(fd), cache_size_(cache_size) {}
   ~CachedFileDescriptor() override = default;
 
   bool Open(const char* path, int flags, mode_t mode) override {
@@ -42,9 +45,7 @@ class CachedFileDescriptor : public FileDescriptor {
   bool Open(const char* path, int flags) override {
     return fd_->Open(path, flags);
   }
-  ssize_t Read(void* buf, size_t count) override {
-    return fd_->Read(buf, count);
-  }
+  ssize_t Read(void* buf, size_t count) override;
   ssize_t Write(const void* buf, size_t count) override;
   off64_t Seek(off64_t offset, int whence) override;
   uint64_t BlockDevSize() override { return fd_->BlockDevSize(); }
@@ -54,6 +55,9 @@ class CachedFileDescriptor : public FileDescriptor {
                 int* result) override {
     return fd_->BlkIoctl(request, start, length, result);
   }
+  bool Prefetch(uint64_t offset, uint64_t length) override {
+    return fd_->Prefetch(offset, length);
+  }
   bool Flush() override;
   bool Close() override;
   bool IsSettingErrno() override { return fd_->IsSettingErrno(); }
@@ -63,9 +67,19 @@ class CachedFileDescriptor : public FileDescriptor {
   // Internal flush without the need to call |fd_->Flush()|.
   bool FlushCache();
 
+  // Caches the |count| bytes at |bytes| to be written at |offset|, merging
+  // them with the dirty ranges they overlap or touch.
+  void AddDirtyRange(off64_t offset, const uint8_t* bytes, size_t count);
+
   FileDescriptorPtr fd_;
-  brillo::Blob cache_;
+  size_t cache_size_;
+
+  // The data to write to |fd_|, indexed by its offset. The ranges never
+  // overlap nor touch each other.
+  std::map<off64_t, brillo::Blob> dirty_ranges_;
   size_t bytes_cached_{0};
+
+  // The offset of the next Read() or Write().
   off64_t offset_{0};
 
   DISALLOW_COPY_AND_ASSIGN(CachedFileDescriptor);
@@ -193,12 +193,50 @@ TEST_F(CachedFileDescriptorTest, SeekAfterWriteTest) {
   // We are writing less than  one cache size; then it should not be committed.
   Write(&blob_in[seek], less_than_cache_size);
 
-  // Then we seek, it should've written the cache after seek.
-  EXPECT_EQ(cfd_->Seek(200, SEEK_SET), 200);
+  // Then we seek and write somewhere else, which is cached as well.
+  EXPECT_EQ(cfd_->Seek(300, SEEK_SET), 300);
+  Write(&blob_in[seek], 2);
+  std::copy_n(&blob_in[seek], 2, &blob_in[300]);
 
   brillo::Blob blob_out;
   EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  EXPECT_EQ(brillo::Blob(kFileSize, 0), blob_out);
+
+  EXPECT_TRUE(cfd_->Flush());
+  brillo::Blob flushed_blob_out;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &flushed_blob_out));
+  EXPECT_EQ(blob_in, flushed_blob_out);
+}
+
+TEST_F(CachedFileDescriptorTest, MergeOverlappingWritesTest) {
+  brillo::Blob blob_in(kFileSize, 0);
+  // Write the ranges [40, 50), [60, 70) and [20, 30), then one that overlaps
+  // all of them.
+  for (off64_t start : {40, 60, 20, 25}) {
+    size_t size = start == 25 ? 40 : 10;
+    std::fill_n(&blob_in[start], size, start);
+    EXPECT_EQ(cfd_->Seek(start, SEEK_SET), start);
+    Write(&blob_in[start], size);
+  }
+  EXPECT_TRUE(cfd_->Flush());
+
+  brillo::Blob blob_out;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  EXPECT_EQ(blob_in, blob_out);
+}
+
+TEST_F(CachedFileDescriptorTest, ReadAfterWriteTest) {
+  brillo::Blob blob_in(10, value_);
+  EXPECT_EQ(cfd_->Seek(10, SEEK_SET), 10);
+  Write(blob_in.data(), blob_in.size());
+
+  // Reading returns the cached data.
+  brillo::Blob blob_out(blob_in.size());
+  EXPECT_EQ(cfd_->Seek(10, SEEK_SET), 10);
+  EXPECT_EQ(static_cast<ssize_t>(blob_out.size()),
+            cfd_->Read(blob_out.data(), blob_out.size()));
   EXPECT_EQ(blob_in, blob_out);
+  EXPECT_EQ(cfd_->Seek(0, SEEK_CUR), 20);
 }
 
 }  // namespace chromeos_update_engine
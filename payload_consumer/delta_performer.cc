@@ -21,8 +21,10 @@
 
 #include <algorithm>
 #include <cstring>
+#include <limits>
 #include <map>
 #include <memory>
+#include <numeric>
 #include <string>
 #include <utility>
 #include <vector>
@@ -33,6 +35,9 @@
 #include <base/strings/string_number_conversions.h>
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
+#include <base/synchronization/lock.h>
+#include <base/sys_info.h>
+#include <base/threading/simple_thread.h>
 #include <base/time/time.h>
 #include <brillo/data_encoding.h>
 #include <bsdiff/bspatch.h>
@@ -44,8 +49,11 @@
 #include "update_engine/common/prefs_interface.h"
 #include "update_engine/common/subprocess.h"
 #include "update_engine/common/terminator.h"
+#include "update_engine/common/trace.h"
+#include "update_engine/payload_consumer/buffer_pool.h"
 #include "update_engine/payload_consumer/bzip_extent_writer.h"
 #include "update_engine/payload_consumer/cached_file_descriptor.h"
+#include "update_engine/payload_consumer/direct_io_file_descriptor.h"
 #include "update_engine/payload_consumer/download_action.h"
 #include "update_engine/payload_consumer/extent_reader.h"
 #include "update_engine/payload_consumer/extent_writer.h"
@@ -53,13 +61,19 @@
 #include "update_engine/payload_consumer/fec_file_descriptor.h"
 #endif  // USE_FEC
 #include "update_engine/payload_consumer/file_descriptor_utils.h"
+#include "update_engine/payload_consumer/lz4_extent_writer.h"
 #include "update_engine/payload_consumer/mount_history.h"
 #if USE_MTD
 #include "update_engine/payload_consumer/mtd_file_descriptor.h"
 #endif  // USE_MTD
+#include "update_engine/payload_consumer/packed_extents.h"
 #include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_consumer/payload_verifier.h"
+#include "update_engine/payload_consumer/skip_unchanged_file_descriptor.h"
+#include "update_engine/payload_consumer/writeback_file_descriptor.h"
 #include "update_engine/payload_consumer/xz_extent_writer.h"
+#include "update_engine/payload_consumer/zstd_bspatch.h"
+#include "update_engine/payload_consumer/zstd_extent_writer.h"
 
 using google::protobuf::RepeatedPtrField;
 using std::min;
@@ -71,7 +85,11 @@ const unsigned DeltaPerformer::kProgressLogMaxChunks = 10;
 const unsigned DeltaPerformer::kProgressLogTimeoutSeconds = 30;
 const unsigned DeltaPerformer::kProgressDownloadWeight = 50;
 const unsigned DeltaPerformer::kProgressOperationsWeight = 50;
-const uint64_t DeltaPerformer::kCheckpointFrequencySeconds = 1;
+const int64_t DeltaPerformer::kCheckpointCostRatio = 100;
+const int64_t DeltaPerformer::kCheckpointMinIntervalMs = 200;
+const int64_t DeltaPerformer::kCheckpointMaxIntervalSeconds = 10;
+const size_t DeltaPerformer::kMinPrefetchOperations = 16;
+const size_t DeltaPerformer::kMaxPrefetchOperations = 256;
 
 namespace {
 const int kUpdateStateOperationInvalid = -1;
@@ -82,7 +100,195 @@ const int kUbiVolumeAttachTimeout = 5 * 60;
 
 const uint64_t kCacheSize = 1024 * 1024;  // 1MB
 
-FileDescriptorPtr CreateFileDescriptor(const char* path) {
+// The dirty data of each partition written without O_DIRECT is written back
+// progressively, so closing the partition doesn't wait for all of it and the
+// update doesn't fill the page cache.
+const uint64_t kWritebackMaxDirtyBytes = 16 * 1024 * 1024;  // 16MB
+
+// Limits of a window of operations applied in parallel. The blobs of all the
+// operations in the window are kept in memory until the window is applied.
+const size_t kMaxParallelOperations = 64;
+const uint64_t kMaxParallelDataSize = 32 * 1024 * 1024;  // 32MB
+// The default memory used to apply the operations, unless the board sets it.
+// It bounds the sum of the |apply_memory_size| of the operations in a window,
+// so the diffs applied at once fit in the memory of small devices, since any
+// of the operations of the window may run at the same time.
+const uint64_t kDefaultMaxApplyMemorySize = 128 * 1024 * 1024;  // 128MB
+
+// The ZSTD_BSDIFF operations that write at least this much data are patched
+// by several threads, as long as the old data and twice the new data fit in
+// the memory used to apply the operations.
+const uint64_t kMinParallelBspatchSize = 4 * 1024 * 1024;  // 4MB
+
+// The biggest source data of a PUFFDIFF operation kept in memory for the
+// next operations reading the same data.
+const uint64_t kMaxPuffdiffCachedSourceSize = 16 * 1024 * 1024;  // 16MB
+
+// The memory allocated by |buffer_| is reused for the following operations as
+// long as it doesn't exceed this size, which covers the default chunk size of
+// full payloads.
+const size_t kMaxRetainedBufferSize = 4 * 1024 * 1024;  // 4MB
+
+// The minimum size of the data received for the next operations that is saved
+// when the update is interrupted. Smaller amounts are downloaded again.
+const size_t kMinPartialOperationDataSize = 1024 * 1024;  // 1MB
+
+// The name of the file the partial operation data is saved to, in the
+// non-volatile directory.
+const char kPartialOperationDataFileName[] = "partial-operation-data";
+
+// The prefetch window grows when the source reads still wait for the storage
+// and shrinks back after kPrefetchShrinkOperations reads that didn't.
+const size_t kPrefetchShrinkOperations = 64;
+
+// A source read waited for the storage if it took longer than this and read
+// slower than kMinCachedReadSpeed, well below the speed of hashing data
+// already in the page cache.
+const int64_t kPrefetchStallTimeUs = 1000;
+const uint64_t kMinCachedReadSpeed = 200 * 1024 * 1024;  // 200MB/s
+
+// The maximum amount of data written ahead of the hashed part of the target
+// partition that is kept in memory while hashing it during the apply.
+const size_t kMaxPendingHashDataSize = 16 * 1024 * 1024;  // 16MB
+
+// The maximum size of a run of adjacent SOURCE_COPY operations copied at once.
+// The source data of the whole run is kept in memory.
+const uint64_t kMaxSourceCopyRunSize = 4 * 1024 * 1024;  // 4MB
+
+// The maximum size of a run of ZERO or DISCARD operations applied at once,
+// which bounds the time between the checkpoints of the run.
+const uint64_t kMaxZeroOrDiscardRunSize = 256 * 1024 * 1024;  // 256MB
+
+// The header of the checkpoint record of the hash contexts, which is followed
+// by the contexts of the payload hash and of the signed hash. The next data
+// offset of the checkpoint is kept in the record so that contexts from another
+// checkpoint are not used.
+struct HashContextsHeader {
+  uint32_t version;
+  uint32_t reserved;
+  int64_t next_data_offset;
+};
+const uint32_t kHashContextsVersion = 1;
+
+// Returns the checkpoint record of the contexts of the |payload_hash| and
+// |signed_hash| calculators at |next_data_offset|.
+string GetHashContexts(const HashCalculator& payload_hash,
+                       const HashCalculator& signed_hash,
+                       int64_t next_data_offset) {
+  const HashContextsHeader header = {kHashContextsVersion, 0, next_data_offset};
+  string contexts;
+  contexts.reserve(sizeof(header) + 2 * HashCalculator::kContextSize);
+  contexts.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  payload_hash.AppendContext(&contexts);
+  signed_hash.AppendContext(&contexts);
+  return contexts;
+}
+
+// Sets the contexts of the |payload_hash| and |signed_hash| calculators from
+// the checkpoint record |contexts|, which must have been taken at
+// |next_data_offset|. Returns whether they were set.
+bool SetHashContexts(const string& contexts,
+                     int64_t next_data_offset,
+                     HashCalculator* payload_hash,
+                     HashCalculator* signed_hash) {
+  HashContextsHeader header;
+  TEST_AND_RETURN_FALSE(contexts.size() ==
+                        sizeof(header) + 2 * HashCalculator::kContextSize);
+  memcpy(&header, contexts.data(), sizeof(header));
+  TEST_AND_RETURN_FALSE(header.version == kHashContextsVersion);
+  TEST_AND_RETURN_FALSE(header.next_data_offset == next_data_offset);
+  const char* context = contexts.data() + sizeof(header);
+  return payload_hash->SetContext(context, HashCalculator::kContextSize) &&
+         signed_hash->SetContext(context + HashCalculator::kContextSize,
+                                 HashCalculator::kContextSize);
+}
+
+// Returns the first block written by |operation|, or 0 if it writes none.
+uint64_t GetFirstDestinationBlock(const InstallOperation& operation) {
+  uint64_t first_block = std::numeric_limits<uint64_t>::max();
+  for (const Extent& extent : operation.dst_extents())
+    first_block = std::min(first_block, extent.start_block());
+  return operation.dst_extents().empty() ? 0 : first_block;
+}
+
+// Writes the |data| of the REPLACE |operation| to its extents of |target_fd|
+// with |writer|, whose type is a template parameter so that its calls are not
+// virtual.
+template <typename Writer>
+bool WriteOperationData(Writer* writer,
+                        const InstallOperation& operation,
+                        const uint8_t* data,
+                        const FileDescriptorPtr& target_fd,
+                        uint32_t block_size) {
+  TEST_AND_RETURN_FALSE(
+      writer->Init(target_fd, operation.dst_extents(), block_size));
+  TEST_AND_RETURN_FALSE(writer->Write(data, operation.data_length()));
+  return true;
+}
+
+// Adds the |extents| to |blocks|, a map from the first block of a range to the
+// block past its end, and returns true if none of them overlaps with the blocks
+// already there. Otherwise returns false and leaves |blocks| untouched.
+bool AddNonOverlappingExtents(const RepeatedPtrField<Extent>& extents,
+                              std::map<uint64_t, uint64_t>* blocks) {
+  for (const Extent& extent : extents) {
+    const uint64_t start = extent.start_block();
+    const uint64_t end = start + extent.num_blocks();
+    auto next = blocks->lower_bound(end);
+    if (next != blocks->begin() && std::prev(next)->second > start)
+      return false;
+  }
+  for (const Extent& extent : extents) {
+    uint64_t& end = (*blocks)[extent.start_block()];
+    end = std::max(end, extent.start_block() + extent.num_blocks());
+  }
+  return true;
+}
+
+// Appends the |extents| to |merged|, extending the last extent of |merged|
+// instead when they are contiguous.
+void AppendMergedExtents(const RepeatedPtrField<Extent>& extents,
+                         RepeatedPtrField<Extent>* merged) {
+  for (const Extent& extent : extents) {
+    if (!merged->empty()) {
+      Extent* last = merged->Mutable(merged->size() - 1);
+      if (last->start_block() + last->num_blocks() == extent.start_block()) {
+        last->set_num_blocks(last->num_blocks() + extent.num_blocks());
+        continue;
+      }
+    }
+    *merged->Add() = extent;
+  }
+}
+
+// Returns the |extents| sorted by their first block, with the overlapping and
+// contiguous ones merged.
+RepeatedPtrField<Extent> SortAndMergeExtents(vector<Extent> extents) {
+  std::sort(extents.begin(),
+            extents.end(),
+            [](const Extent& a, const Extent& b) {
+              return a.start_block() < b.start_block();
+            });
+  RepeatedPtrField<Extent> merged;
+  for (const Extent& extent : extents) {
+    if (!merged.empty()) {
+      Extent* last = merged.Mutable(merged.size() - 1);
+      uint64_t last_end = last->start_block() + last->num_blocks();
+      if (last_end >= extent.start_block()) {
+        uint64_t end = std::max(last_end,
+                                extent.start_block() + extent.num_blocks());
+        last->set_num_blocks(end - last->start_block());
+        continue;
+      }
+    }
+    *merged.Add() = extent;
+  }
+  return merged;
+}
+
+FileDescriptorPtr CreateFileDescriptor(const char* path,
+                                       bool direct_io,
+                                       bool writeback) {
   FileDescriptorPtr ret;
 #if USE_MTD
   if (strstr(path, "/dev/ubi") == path) {
@@ -103,7 +309,12 @@ FileDescriptorPtr CreateFileDescriptor(const char* path) {
   } else {
     LOG(INFO) << path << " is not an MTD nor a UBI device.";
 #endif
-    ret.reset(new EintrSafeFileDescriptor);
+    if (direct_io)
+      ret.reset(new DirectIoFileDescriptor);
+    else if (writeback)
+      ret.reset(new WritebackFileDescriptor(kWritebackMaxDirtyBytes));
+    else
+      ret.reset(new EintrSafeFileDescriptor);
 #if USE_MTD
   }
 #endif
@@ -112,17 +323,31 @@ FileDescriptorPtr CreateFileDescriptor(const char* path) {
 
 // Opens path for read/write. On success returns an open FileDescriptor
 // and sets *err to 0. On failure, sets *err to errno and returns nullptr.
+// When |direct_io| is set the writes bypass the page cache and are already
+// buffered, so |cache_writes| is ignored. When |skip_unchanged_block_size| is
+// not 0, the writes skip the blocks of that size which already hold the data.
 FileDescriptorPtr OpenFile(const char* path,
                            int mode,
                            bool cache_writes,
-                           int* err) {
+                           bool direct_io,
+                           int* err,
+                           uint32_t skip_unchanged_block_size = 0) {
   // Try to mark the block device read-only based on the mode. Ignore any
   // failure since this won't work when passing regular files.
   bool read_only = (mode & O_ACCMODE) == O_RDONLY;
   utils::SetBlockDeviceReadOnly(path, read_only);
 
-  FileDescriptorPtr fd = CreateFileDescriptor(path);
-  if (cache_writes && !read_only) {
+  FileDescriptorPtr fd =
+      CreateFileDescriptor(path, direct_io && !read_only, !read_only);
+  if (skip_unchanged_block_size && !read_only) {
+    // The cached writes are compared once they are merged, with fewer reads.
+    fd = FileDescriptorPtr(
+        new SkipUnchangedFileDescriptor(fd, skip_unchanged_block_size));
+    LOG(INFO) << "Skipping the writes of unchanged blocks.";
+  }
+  if (direct_io && !read_only) {
+    LOG(INFO) << "Writing with O_DIRECT.";
+  } else if (cache_writes && !read_only) {
     fd = FileDescriptorPtr(new CachedFileDescriptor(fd, kCacheSize));
     LOG(INFO) << "Caching writes.";
   }
@@ -174,6 +399,22 @@ bool DiscardPartitionTail(const FileDescriptorPtr& fd, uint64_t data_size) {
   return false;
 }
 
+// Zeroes the first |size| bytes of the block device referenced by |fd| with a
+// single ioctl, which discards the blocks instead on the devices where they
+// then read as zeros. Returns whether the data now reads as zeros.
+bool ZeroPartition(const FileDescriptorPtr& fd, uint64_t size) {
+#ifdef BLKZEROOUT
+  if (!fd->BlockDevSize())
+    return false;
+  int error = 0;
+  if (fd->BlkIoctl(BLKZEROOUT, 0, size, &error) && error == 0)
+    return true;
+  LOG(WARNING) << "Error zeroing the first " << size / 1024
+               << " KiB using ioctl(BLKZEROOUT)";
+#endif  // BLKZEROOUT
+  return false;
+}
+
 }  // namespace
 
 // Computes the ratio of |part| and |total|, scaled to |norm|, using integer
@@ -211,6 +452,16 @@ void DeltaPerformer::LogProgress(const char* message_prefix) {
             << payload_size_str << " bytes downloaded"
             << downloaded_percentage_str << ", overall progress "
             << overall_progress_ << "%";
+
+  for (const auto& type_stats : operation_stats_) {
+    const OperationStats& stats = type_stats.second;
+    LOG(INFO) << "  " << InstallOperationTypeName(type_stats.first) << ": "
+              << stats.count << " operations in "
+              << utils::FormatTimeDelta(stats.duration) << ", "
+              << stats.bytes_read << " bytes read, " << stats.bytes_written
+              << " bytes written, " << stats.bytes_downloaded
+              << " bytes downloaded";
+  }
 }
 
 void DeltaPerformer::UpdateOverallProgress(bool force_log,
@@ -273,18 +524,38 @@ size_t DeltaPerformer::CopyDataToBuffer(const char** bytes_p,
                                         size_t* count_p,
                                         size_t max) {
   const size_t count = *count_p;
-  if (!count)
+  if (!count || BufferSize() >= max)
     return 0;  // Special case shortcut.
+  buffer_.reserve(max);
+  if (external_data_size_) {
+    // The data used in place isn't enough anymore, it needs to be kept with
+    // the data received in the following Write() calls.
+    buffer_.assign(external_data_, external_data_ + external_data_size_);
+    external_data_ = nullptr;
+    external_data_size_ = 0;
+  }
   size_t read_len = min(count, max - buffer_.size());
   const char* bytes_start = *bytes_p;
   const char* bytes_end = bytes_start + read_len;
-  buffer_.reserve(max);
   buffer_.insert(buffer_.end(), bytes_start, bytes_end);
+  buffer_memory_.Resize(buffer_.capacity());
   *bytes_p = bytes_end;
   *count_p = count - read_len;
   return read_len;
 }
 
+size_t DeltaPerformer::ReadOperationData(const char** bytes_p,
+                                         size_t* count_p,
+                                         size_t max) {
+  if (!max || BufferSize() > 0 || *count_p < max)
+    return CopyDataToBuffer(bytes_p, count_p, max);
+  external_data_ = reinterpret_cast<const uint8_t*>(*bytes_p);
+  external_data_size_ = max;
+  *bytes_p += max;
+  *count_p -= max;
+  return max;
+}
+
 bool DeltaPerformer::HandleOpResult(bool op_result,
                                     const char* op_type_name,
                                     ErrorCode* error) {
@@ -305,6 +576,15 @@ bool DeltaPerformer::HandleOpResult(bool op_result,
 
 int DeltaPerformer::Close() {
   int err = -CloseCurrentPartition();
+  if (next_source_fd_)
+    next_source_fd_->Close();
+  next_source_fd_.reset();
+  next_source_partition_ = std::numeric_limits<size_t>::max();
+  // The buffers pooled for the operations aren't needed until the next
+  // payload.
+  BufferPool::Get()->Clear();
+  if (!buffer_.empty() && !write_failed_ && SavePartialOperationData())
+    brillo::Blob().swap(buffer_);
   LOG_IF(ERROR,
          !payload_hash_calculator_.Finalize() ||
              !signed_hash_calculator_.Finalize())
@@ -343,10 +623,54 @@ int DeltaPerformer::CloseCurrentPartition() {
       err = 1;
   }
   target_fd_.reset();
+
+  for (WorkerFileDescriptors& worker_fds : worker_fds_) {
+    if (worker_fds.source_fd && !worker_fds.source_fd->Close()) {
+      err = errno;
+      PLOG(ERROR) << "Error closing worker source partition";
+      if (!err)
+        err = 1;
+    }
+    if (worker_fds.target_fd && !worker_fds.target_fd->Close()) {
+      err = errno;
+      PLOG(ERROR) << "Error closing worker target partition";
+      if (!err)
+        err = 1;
+    }
+  }
+  worker_fds_.clear();
+  if (puffdiff_source_cache_)
+    puffdiff_source_cache_->Clear();
+
+  if (partition_hasher_) {
+    if (!err)
+      FinishPartitionHash();
+    partition_hasher_.reset();
+  }
   target_path_.clear();
   return -err;
 }
 
+void DeltaPerformer::FinishPartitionHash() {
+  // The partition is only complete if all its operations were applied.
+  if (current_partition_ >= partitions_.size() ||
+      next_operation_num_ < acc_num_operations_[current_partition_]) {
+    return;
+  }
+  size_t num_previous_partitions =
+      install_plan_->partitions.size() - partitions_.size();
+  InstallPlan::Partition* install_part =
+      &install_plan_->partitions[num_previous_partitions + current_partition_];
+  brillo::Blob hash;
+  if (!partition_hasher_->Finish(target_path_, &hash))
+    return;
+  install_part->target_hash_verified = (hash == install_part->target_hash);
+  if (!install_part->target_hash_verified) {
+    LOG(WARNING) << "The hash of the data written to partition "
+                 << install_part->name << " doesn't match the target hash.";
+  }
+}
+
 bool DeltaPerformer::OpenCurrentPartition() {
   if (current_partition_ >= partitions_.size())
     return false;
@@ -356,6 +680,7 @@ bool DeltaPerformer::OpenCurrentPartition() {
       install_plan_->partitions.size() - partitions_.size();
   const InstallPlan::Partition& install_part =
       install_plan_->partitions[num_previous_partitions + current_partition_];
+  LoadVerifiedSourceBlocks(partition.partition_name());
   // Open source fds if we have a delta payload with minor version >= 2.
   if (payload_->type == InstallPayloadType::kDelta &&
       GetMinorVersion() != kInPlaceMinorPayloadVersion &&
@@ -364,7 +689,11 @@ bool DeltaPerformer::OpenCurrentPartition() {
       install_part.source_size > 0) {
     source_path_ = install_part.source_path;
     int err;
-    source_fd_ = OpenFile(source_path_.c_str(), O_RDONLY, false, &err);
+    // The source may already be open if it was prefetched.
+    if (next_source_fd_ && next_source_partition_ == current_partition_)
+      source_fd_ = std::move(next_source_fd_);
+    else
+      source_fd_ = OpenFile(source_path_.c_str(), O_RDONLY, false, false, &err);
     if (!source_fd_) {
       LOG(ERROR) << "Unable to open source partition "
                  << partition.partition_name() << " on slot "
@@ -375,6 +704,8 @@ bool DeltaPerformer::OpenCurrentPartition() {
   }
 
   target_path_ = install_part.target_path;
+  zero_ioctl_supported_ = true;
+  discard_ioctl_supported_ = true;
   int err;
 
   int flags = O_RDWR;
@@ -384,7 +715,13 @@ bool DeltaPerformer::OpenCurrentPartition() {
   LOG(INFO) << "Opening " << target_path_ << " partition with"
             << (interactive_ ? "out" : "") << " O_DSYNC";
 
-  target_fd_ = OpenFile(target_path_.c_str(), flags, true, &err);
+  target_fd_ = OpenFile(target_path_.c_str(),
+                        flags,
+                        true,
+                        hardware_->UseDirectIoForPartitionWrites(),
+                        &err,
+                        hardware_->SkipUnchangedPartitionWrites() ? block_size_
+                                                                  : 0);
   if (!target_fd_) {
     LOG(ERROR) << "Unable to open target partition "
                << partition.partition_name() << " on slot "
@@ -397,12 +734,56 @@ bool DeltaPerformer::OpenCurrentPartition() {
             << " operations to partition \"" << partition.partition_name()
             << "\"";
 
+  // A full payload writes the whole partition, which is then zeroed at once
+  // when applied from its first operation, so the blocks of zeros of the
+  // payload don't need to be written. The hashing below still sees them.
+  const size_t partition_first_op_num =
+      current_partition_ ? acc_num_operations_[current_partition_ - 1] : 0;
+  if (payload_->type == InstallPayloadType::kFull &&
+      next_operation_num_ == partition_first_op_num &&
+      install_part.target_size > 0 &&
+      ZeroPartition(target_fd_, install_part.target_size)) {
+    LOG(INFO) << "Zeroed partition " << partition.partition_name()
+              << ", skipping the writes of blocks of zeros.";
+    target_fd_ = FileDescriptorPtr(
+        new SkipUnchangedFileDescriptor(target_fd_, block_size_, true));
+  }
+
+  // Hash the partition while it is written if it is applied from its first
+  // operation. The in-place operations write through |target_path_|.
+  if (hardware_->HashPartitionsWhileWriting() &&
+      next_operation_num_ == partition_first_op_num &&
+      install_part.target_size > 0 &&
+      !(payload_->type == InstallPayloadType::kDelta &&
+        GetMinorVersion() == kInPlaceMinorPayloadVersion)) {
+    partition_hasher_ = std::make_unique<PartitionWriteHasher>(
+        install_part.target_size, kMaxPendingHashDataSize);
+    target_fd_ = FileDescriptorPtr(
+        new HashingFileDescriptor(target_fd_, partition_hasher_.get()));
+  }
+
   // Discard the end of the partition, but ignore failures.
   DiscardPartitionTail(target_fd_, install_part.target_size);
 
   return true;
 }
 
+void DeltaPerformer::LoadVerifiedSourceBlocks(const string& partition_name) {
+  // The blocks are saved after the name of their partition.
+  verified_source_blocks_.Clear();
+  verified_source_blocks_changed_ = false;
+  string saved;
+  const string prefix = partition_name + " ";
+  if (!prefs_->GetString(kPrefsUpdateStateVerifiedSourceBlocks, &saved) ||
+      !base::StartsWith(saved, prefix, base::CompareCase::SENSITIVE)) {
+    return;
+  }
+  if (!verified_source_blocks_.FromString(saved.substr(prefix.size()))) {
+    LOG(WARNING) << "Ignoring the invalid verified source blocks " << saved;
+    verified_source_blocks_.Clear();
+  }
+}
+
 bool DeltaPerformer::OpenCurrentECCPartition() {
   if (source_ecc_fd_)
     return true;
@@ -551,12 +932,25 @@ MetadataParseResult DeltaPerformer::ParsePayloadMetadata(
   }
 
   // The payload metadata is deemed valid, it's safe to parse the protobuf.
-  if (!payload_metadata_.GetManifest(payload, &manifest_)) {
+  // The operations of the partitions are parsed when the update gets to them.
+  bool manifest_ok =
+      major_payload_version_ == kBrilloMajorPayloadVersion
+          ? payload_metadata_.GetManifestWithoutOperations(
+                payload, &manifest_, &serialized_partitions_)
+          : payload_metadata_.GetManifest(payload, &manifest_);
+  if (!manifest_ok) {
     LOG(ERROR) << "Unable to parse manifest in update file.";
     *error = ErrorCode::kDownloadManifestParseError;
     return MetadataParseResult::kError;
   }
 
+  // The lite protobuf runtime can't tell the memory of the parsed manifest,
+  // so it is accounted for by its serialized size.
+  uint64_t manifest_size = metadata_size_;
+  for (const SerializedPartitionUpdate& serialized : serialized_partitions_)
+    manifest_size += serialized.data.size();
+  manifest_memory_.Resize(manifest_size);
+
   manifest_parsed_ = true;
   return MetadataParseResult::kSuccess;
 }
@@ -573,6 +967,15 @@ MetadataParseResult DeltaPerformer::ParsePayloadMetadata(
 // were written, or false on any error, regardless of progress
 // and stores an action exit code in |error|.
 bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
+  if (WriteData(bytes, count, error))
+    return true;
+  write_failed_ = true;
+  return false;
+}
+
+bool DeltaPerformer::WriteData(const void* bytes,
+                               size_t count,
+                               ErrorCode* error) {
   *error = ErrorCode::kSuccess;
   const char* c_bytes = reinterpret_cast<const char*>(bytes);
 
@@ -611,6 +1014,35 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
 
     block_size_ = manifest_.block_size();
 
+#if USE_MTD
+    // MTD and UBI devices can't be opened more than once for writing.
+    max_apply_threads_ = 1;
+#else
+    int max_apply_threads = hardware_->GetMaxApplyThreads();
+    if (max_apply_threads <= 0) {
+      // Full payloads only have independent replace operations whose
+      // decompression is CPU bound, so use all the CPUs for them unless the
+      // board sets a value.
+      max_apply_threads = payload_->type == InstallPayloadType::kFull
+                              ? base::SysInfo::NumberOfProcessors()
+                              : 1;
+    }
+    max_apply_threads_ = std::max(max_apply_threads, 1);
+    // The A/B delta operations don't read the target partition, so those
+    // whose data was received may be applied in any order.
+    destination_order_ = hardware_->ApplyOperationsInDestinationOrder() &&
+                         payload_->type == InstallPayloadType::kDelta &&
+                         GetMinorVersion() != kInPlaceMinorPayloadVersion;
+#endif  // USE_MTD
+
+    max_apply_memory_size_ = hardware_->GetMaxApplyMemorySize();
+    if (max_apply_memory_size_ == 0)
+      max_apply_memory_size_ = kDefaultMaxApplyMemorySize;
+    // A quarter of the memory keeps the source data shared by the PUFFDIFF
+    // operations, 32MB by default.
+    puffdiff_source_cache_ =
+        std::make_unique<SourceDataCache>(max_apply_memory_size_ / 4);
+
     // This populates |partitions_| and the |install_plan.partitions| with the
     // list of partitions from the manifest.
     if (!ParseManifestPartitions(error))
@@ -623,8 +1055,10 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
       return false;
 
     num_total_operations_ = 0;
-    for (const auto& partition : partitions_) {
-      num_total_operations_ += partition.operations_size();
+    for (size_t i = 0; i < partitions_.size(); i++) {
+      num_total_operations_ += i < serialized_partitions_.size()
+                                   ? serialized_partitions_[i].num_operations
+                                   : partitions_[i].operations_size();
       acc_num_operations_.push_back(num_total_operations_);
     }
 
@@ -643,6 +1077,10 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
     }
 
     if (next_operation_num_ < acc_num_operations_[current_partition_]) {
+      if (!LoadPartitionOperations(current_partition_)) {
+        *error = ErrorCode::kDownloadManifestParseError;
+        return false;
+      }
       if (!OpenCurrentPartition()) {
         *error = ErrorCode::kInstallDeviceOpenError;
         return false;
@@ -669,6 +1107,10 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
       while (next_operation_num_ >= acc_num_operations_[current_partition_]) {
         current_partition_++;
       }
+      if (!LoadPartitionOperations(current_partition_)) {
+        *error = ErrorCode::kDownloadManifestParseError;
+        return false;
+      }
       if (!OpenCurrentPartition()) {
         *error = ErrorCode::kInstallDeviceOpenError;
         return false;
@@ -681,7 +1123,40 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
     const InstallOperation& op =
         partitions_[current_partition_].operations(partition_operation_num);
 
-    CopyDataToBuffer(&c_bytes, &count, op.data_length());
+    PrefetchSourceExtents();
+
+    // Zero or discard runs of ZERO or DISCARD operations at once, rather than
+    // spreading them among the parallel workers.
+    size_t zero_run_size = GetZeroOrDiscardRun();
+    if (zero_run_size > 1) {
+      if (!PerformZeroOrDiscardRun(zero_run_size, error))
+        return false;
+      continue;
+    }
+
+    // Apply the next operations concurrently if they are independent. This
+    // waits until the data for all of them was received.
+    uint64_t window_data_length = 0;
+    size_t window_size = GetParallelWindow(&window_data_length);
+    if (window_size > 1) {
+      ReadOperationData(&c_bytes, &count, window_data_length);
+      if (BufferSize() < window_data_length)
+        return true;
+      if (!PerformOperationsInParallel(window_size, error))
+        return false;
+      continue;
+    }
+
+    // Copy runs of adjacent SOURCE_COPY operations with a single read and
+    // write.
+    size_t run_size = GetSourceCopyRun();
+    if (run_size > 1) {
+      if (!PerformSourceCopyRun(run_size, error))
+        return false;
+      continue;
+    }
+
+    ReadOperationData(&c_bytes, &count, op.data_length());
 
     // Check whether we received all of the next operation's data payload.
     if (!CanPerformInstallOperation(op))
@@ -697,7 +1172,8 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
       // Note: Validate must be called only if CanPerformInstallOperation is
       // called. Otherwise, we might be failing operations before even if there
       // isn't sufficient data to compute the proper hash.
-      *error = ValidateOperationHash(op);
+      *error = ValidateOperationHash(
+          op, BufferData(), next_operation_num_, true);
       if (*error != ErrorCode::kSuccess) {
         if (install_plan_->hash_checks_mandatory) {
           LOG(ERROR) << "Mandatory operation hash check failed";
@@ -715,12 +1191,15 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
         ScopedTerminatorExitUnblocker();  // Avoids a compiler unused var bug.
 
     base::TimeTicks op_start_time = base::TimeTicks::Now();
+    UE_TRACE_SCOPE(InstallOperationTypeName(op.type()));
 
     bool op_result;
     switch (op.type()) {
       case InstallOperation::REPLACE:
       case InstallOperation::REPLACE_BZ:
       case InstallOperation::REPLACE_XZ:
+      case InstallOperation::REPLACE_ZSTD:
+      case InstallOperation::REPLACE_LZ4:
         op_result = PerformReplaceOperation(op);
         OP_DURATION_HISTOGRAM("REPLACE", op_start_time);
         break;
@@ -743,6 +1222,7 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
         break;
       case InstallOperation::SOURCE_BSDIFF:
       case InstallOperation::BROTLI_BSDIFF:
+      case InstallOperation::ZSTD_BSDIFF:
         op_result = PerformSourceBsdiffOperation(op, error);
         OP_DURATION_HISTOGRAM("SOURCE_BSDIFF", op_start_time);
         break;
@@ -753,8 +1233,10 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
       default:
         op_result = false;
     }
+    base::TimeDelta op_duration = base::TimeTicks::Now() - op_start_time;
     if (!HandleOpResult(op_result, InstallOperationTypeName(op.type()), error))
       return false;
+    RecordOperationStats(op, op_duration);
 
     if (!target_fd_->Flush()) {
       return false;
@@ -779,7 +1261,7 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
     }
     CopyDataToBuffer(&c_bytes, &count, manifest_.signatures_size());
     // Needs more data to cover entire signature.
-    if (buffer_.size() < manifest_.signatures_size())
+    if (BufferSize() < manifest_.signatures_size())
       return true;
     if (!ExtractSignatureMessage()) {
       LOG(ERROR) << "Extract payload signature failed.";
@@ -803,15 +1285,18 @@ bool DeltaPerformer::IsManifestValid() {
 }
 
 bool DeltaPerformer::ParseManifestPartitions(ErrorCode* error) {
+  // The manifest data is moved to |partitions_| with Swap() instead of being
+  // copied, since the operations of a big payload take a lot of memory.
   if (major_payload_version_ == kBrilloMajorPayloadVersion) {
     partitions_.clear();
-    for (const PartitionUpdate& partition : manifest_.partitions()) {
-      partitions_.push_back(partition);
-    }
+    partitions_.resize(manifest_.partitions_size());
+    for (int i = 0; i < manifest_.partitions_size(); i++)
+      partitions_[i].Swap(manifest_.mutable_partitions(i));
     manifest_.clear_partitions();
   } else if (major_payload_version_ == kChromeOSMajorPayloadVersion) {
     LOG(INFO) << "Converting update information from old format.";
-    PartitionUpdate root_part;
+    partitions_.resize(partitions_.size() + 1);
+    PartitionUpdate& root_part = partitions_.back();
     root_part.set_partition_name(kPartitionNameRoot);
 #ifdef __ANDROID__
     LOG(WARNING) << "Legacy payload major version provided to an Android "
@@ -822,35 +1307,40 @@ bool DeltaPerformer::ParseManifestPartitions(ErrorCode* error) {
     root_part.set_run_postinstall(true);
 #endif  // __ANDROID__
     if (manifest_.has_old_rootfs_info()) {
-      *root_part.mutable_old_partition_info() = manifest_.old_rootfs_info();
+      root_part.mutable_old_partition_info()->Swap(
+          manifest_.mutable_old_rootfs_info());
       manifest_.clear_old_rootfs_info();
     }
     if (manifest_.has_new_rootfs_info()) {
-      *root_part.mutable_new_partition_info() = manifest_.new_rootfs_info();
+      root_part.mutable_new_partition_info()->Swap(
+          manifest_.mutable_new_rootfs_info());
       manifest_.clear_new_rootfs_info();
     }
-    *root_part.mutable_operations() = manifest_.install_operations();
-    manifest_.clear_install_operations();
-    partitions_.push_back(std::move(root_part));
+    root_part.mutable_operations()->Swap(
+        manifest_.mutable_install_operations());
 
-    PartitionUpdate kern_part;
+    partitions_.resize(partitions_.size() + 1);
+    PartitionUpdate& kern_part = partitions_.back();
     kern_part.set_partition_name(kPartitionNameKernel);
     kern_part.set_run_postinstall(false);
     if (manifest_.has_old_kernel_info()) {
-      *kern_part.mutable_old_partition_info() = manifest_.old_kernel_info();
+      kern_part.mutable_old_partition_info()->Swap(
+          manifest_.mutable_old_kernel_info());
       manifest_.clear_old_kernel_info();
     }
     if (manifest_.has_new_kernel_info()) {
-      *kern_part.mutable_new_partition_info() = manifest_.new_kernel_info();
+      kern_part.mutable_new_partition_info()->Swap(
+          manifest_.mutable_new_kernel_info());
       manifest_.clear_new_kernel_info();
     }
-    *kern_part.mutable_operations() = manifest_.kernel_install_operations();
-    manifest_.clear_kernel_install_operations();
-    partitions_.push_back(std::move(kern_part));
+    kern_part.mutable_operations()->Swap(
+        manifest_.mutable_kernel_install_operations());
   }
 
   // Fill in the InstallPlan::partitions based on the partitions from the
   // payload.
+  install_plan_->partitions.reserve(install_plan_->partitions.size() +
+                                    partitions_.size());
   for (const auto& partition : partitions_) {
     InstallPlan::Partition install_part;
     install_part.name = partition.partition_name();
@@ -862,6 +1352,7 @@ bool DeltaPerformer::ParseManifestPartitions(ErrorCode* error) {
                                             : kPostinstallDefaultScript);
       install_part.filesystem_type = partition.filesystem_type();
       install_part.postinstall_optional = partition.postinstall_optional();
+      install_part.postinstall_parallel = partition.postinstall_parallel();
     }
 
     if (partition.has_old_partition_info()) {
@@ -919,7 +1410,7 @@ bool DeltaPerformer::ParseManifestPartitions(ErrorCode* error) {
       install_part.fec_roots = partition.fec_roots();
     }
 
-    install_plan_->partitions.push_back(install_part);
+    install_plan_->partitions.push_back(std::move(install_part));
   }
 
   if (install_plan_->target_slot != BootControlInterface::kInvalidSlot) {
@@ -994,19 +1485,21 @@ bool DeltaPerformer::CanPerformInstallOperation(
   }
 
   return (operation.data_offset() + operation.data_length() <=
-          buffer_offset_ + buffer_.size());
+          buffer_offset_ + BufferSize());
 }
 
 bool DeltaPerformer::PerformReplaceOperation(
     const InstallOperation& operation) {
   CHECK(operation.type() == InstallOperation::REPLACE ||
         operation.type() == InstallOperation::REPLACE_BZ ||
-        operation.type() == InstallOperation::REPLACE_XZ);
+        operation.type() == InstallOperation::REPLACE_XZ ||
+        operation.type() == InstallOperation::REPLACE_ZSTD ||
+        operation.type() == InstallOperation::REPLACE_LZ4);
 
   // Since we delete data off the beginning of the buffer as we use it,
   // the data we need should be exactly at the beginning of the buffer.
   TEST_AND_RETURN_FALSE(buffer_offset_ == operation.data_offset());
-  TEST_AND_RETURN_FALSE(buffer_.size() >= operation.data_length());
+  TEST_AND_RETURN_FALSE(BufferSize() >= operation.data_length());
 
   // Extract the signature message if it's in this operation.
   if (ExtractSignatureMessageFromOperation(operation)) {
@@ -1016,59 +1509,119 @@ bool DeltaPerformer::PerformReplaceOperation(
     return true;
   }
 
-  // Setup the ExtentWriter stack based on the operation type.
-  std::unique_ptr<ExtentWriter> writer = std::make_unique<DirectExtentWriter>();
-
-  if (operation.type() == InstallOperation::REPLACE_BZ) {
-    writer.reset(new BzipExtentWriter(std::move(writer)));
-  } else if (operation.type() == InstallOperation::REPLACE_XZ) {
-    writer.reset(new XzExtentWriter(std::move(writer)));
-  }
-
-  TEST_AND_RETURN_FALSE(
-      writer->Init(target_fd_, operation.dst_extents(), block_size_));
-  TEST_AND_RETURN_FALSE(writer->Write(buffer_.data(), operation.data_length()));
+  // The runs of zeros of the data are zeroed with an ioctl when possible.
+  TEST_AND_RETURN_FALSE(ApplyReplaceOperation(operation,
+                                              BufferData(),
+                                              target_fd_,
+                                              block_size_,
+                                              &zero_ioctl_supported_));
 
   // Update buffer
-  DiscardBuffer(true, buffer_.size());
+  ConsumeBuffer(operation.data_length());
   return true;
 }
 
+bool DeltaPerformer::ApplyReplaceOperation(const InstallOperation& operation,
+                                           const uint8_t* data,
+                                           const FileDescriptorPtr& target_fd,
+                                           uint32_t block_size,
+                                           bool* zero_ioctl_supported) {
+  // Setup the ExtentWriter stack based on the operation type. The types of
+  // the writers are known here, so the decompressed chunks are written without
+  // virtual calls.
+  auto direct_writer =
+      std::make_unique<DirectExtentWriter>(zero_ioctl_supported);
+  switch (operation.type()) {
+    case InstallOperation::REPLACE_BZ: {
+      BasicBzipExtentWriter<DirectExtentWriter> writer(
+          std::move(direct_writer));
+      return WriteOperationData(&writer, operation, data, target_fd,
+                                block_size);
+    }
+    case InstallOperation::REPLACE_XZ: {
+      BasicXzExtentWriter<DirectExtentWriter> writer(std::move(direct_writer));
+      return WriteOperationData(&writer, operation, data, target_fd,
+                                block_size);
+    }
+    case InstallOperation::REPLACE_ZSTD: {
+      BasicZstdExtentWriter<DirectExtentWriter> writer(
+          std::move(direct_writer));
+      return WriteOperationData(&writer, operation, data, target_fd,
+                                block_size);
+    }
+    case InstallOperation::REPLACE_LZ4: {
+      BasicLz4ExtentWriter<DirectExtentWriter> writer(
+          std::move(direct_writer));
+      return WriteOperationData(&writer, operation, data, target_fd,
+                                block_size);
+    }
+    default:
+      return WriteOperationData(direct_writer.get(), operation, data,
+                                target_fd, block_size);
+  }
+}
+
 bool DeltaPerformer::PerformZeroOrDiscardOperation(
     const InstallOperation& operation) {
   CHECK(operation.type() == InstallOperation::DISCARD ||
         operation.type() == InstallOperation::ZERO);
+  // These operations have no blob.
+  TEST_AND_RETURN_FALSE(!operation.has_data_offset());
+  TEST_AND_RETURN_FALSE(!operation.has_data_length());
+  return ZeroOrDiscardExtents(operation.type(),
+                              operation.dst_extents(),
+                              target_fd_,
+                              block_size_,
+                              GetZeroOrDiscardIoctlSupport(operation.type()));
+}
 
+bool DeltaPerformer::ApplyZeroOrDiscardOperation(
+    const InstallOperation& operation,
+    const FileDescriptorPtr& target_fd,
+    uint32_t block_size) {
   // These operations have no blob.
   TEST_AND_RETURN_FALSE(!operation.has_data_offset());
   TEST_AND_RETURN_FALSE(!operation.has_data_length());
+  bool use_ioctl = true;
+  return ZeroOrDiscardExtents(operation.type(),
+                              operation.dst_extents(),
+                              target_fd,
+                              block_size,
+                              &use_ioctl);
+}
 
+bool DeltaPerformer::ZeroOrDiscardExtents(
+    InstallOperation::Type type,
+    const RepeatedPtrField<Extent>& extents,
+    const FileDescriptorPtr& target_fd,
+    uint32_t block_size,
+    bool* use_ioctl) {
 #ifdef BLKZEROOUT
-  bool attempt_ioctl = true;
-  int request =
-      (operation.type() == InstallOperation::ZERO ? BLKZEROOUT : BLKDISCARD);
+  int request = (type == InstallOperation::ZERO ? BLKZEROOUT : BLKDISCARD);
 #else   // !defined(BLKZEROOUT)
-  bool attempt_ioctl = false;
+  *use_ioctl = false;
   int request = 0;
 #endif  // !defined(BLKZEROOUT)
 
   brillo::Blob zeros;
-  for (const Extent& extent : operation.dst_extents()) {
-    const uint64_t start = extent.start_block() * block_size_;
-    const uint64_t length = extent.num_blocks() * block_size_;
-    if (attempt_ioctl) {
+  for (const Extent& extent : extents) {
+    const uint64_t start = extent.start_block() * block_size;
+    const uint64_t length = extent.num_blocks() * block_size;
+    if (*use_ioctl) {
       int result = 0;
-      if (target_fd_->BlkIoctl(request, start, length, &result) && result == 0)
+      if (target_fd->BlkIoctl(request, start, length, &result) && result == 0)
         continue;
-      attempt_ioctl = false;
+      LOG(INFO) << "The " << InstallOperationTypeName(type)
+                << " ioctl failed, writing zeros instead.";
+      *use_ioctl = false;
     }
     // In case of failure, we fall back to writing 0 to the selected region.
-    zeros.resize(16 * block_size_);
+    zeros.resize(16 * block_size);
     for (uint64_t offset = 0; offset < length; offset += zeros.size()) {
       uint64_t chunk_length =
           min(length - offset, static_cast<uint64_t>(zeros.size()));
       TEST_AND_RETURN_FALSE(utils::PWriteAll(
-          target_fd_, zeros.data(), chunk_length, start + offset));
+          target_fd, zeros.data(), chunk_length, start + offset));
     }
   }
   return true;
@@ -1259,12 +1812,22 @@ FileDescriptorPtr DeltaPerformer::ChooseSourceFD(
     return source_fd_;
   }
 
+  // The blocks verified by earlier operations still hold the right data.
+  if (verified_source_blocks_.ContainsExtents(operation.src_extents()))
+    return source_fd_;
+
   brillo::Blob source_hash;
   brillo::Blob expected_source_hash(operation.src_sha256_hash().begin(),
                                     operation.src_sha256_hash().end());
-  if (fd_utils::ReadAndHashExtents(
-          source_fd_, operation.src_extents(), block_size_, &source_hash) &&
-      source_hash == expected_source_hash) {
+  base::TimeTicks read_start_time = base::TimeTicks::Now();
+  bool read_ok = fd_utils::ReadAndHashExtents(
+      source_fd_, operation.src_extents(), block_size_, &source_hash);
+  UpdatePrefetchWindow(
+      base::TimeTicks::Now() - read_start_time,
+      utils::BlocksInExtents(operation.src_extents()) * block_size_);
+  if (read_ok && source_hash == expected_source_hash) {
+    verified_source_blocks_.AddExtents(operation.src_extents());
+    verified_source_blocks_changed_ = true;
     return source_fd_;
   }
   // We fall back to use the error corrected device if the hash of the raw
@@ -1320,7 +1883,7 @@ bool DeltaPerformer::PerformBsdiffOperation(const InstallOperation& operation) {
   // Since we delete data off the beginning of the buffer as we use it,
   // the data we need should be exactly at the beginning of the buffer.
   TEST_AND_RETURN_FALSE(buffer_offset_ == operation.data_offset());
-  TEST_AND_RETURN_FALSE(buffer_.size() >= operation.data_length());
+  TEST_AND_RETURN_FALSE(BufferSize() >= operation.data_length());
 
   string input_positions;
   TEST_AND_RETURN_FALSE(ExtentsToBsdiffPositionsString(operation.src_extents(),
@@ -1335,11 +1898,11 @@ bool DeltaPerformer::PerformBsdiffOperation(const InstallOperation& operation) {
 
   TEST_AND_RETURN_FALSE(bsdiff::bspatch(target_path_.c_str(),
                                         target_path_.c_str(),
-                                        buffer_.data(),
-                                        buffer_.size(),
+                                        BufferData(),
+                                        operation.data_length(),
                                         input_positions.c_str(),
                                         output_positions.c_str()) == 0);
-  DiscardBuffer(true, buffer_.size());
+  ConsumeBuffer(operation.data_length());
 
   if (operation.dst_length() % block_size_) {
     // Zero out rest of final block.
@@ -1359,6 +1922,99 @@ bool DeltaPerformer::PerformBsdiffOperation(const InstallOperation& operation) {
 
 namespace {
 
+// The diff operations check their CancellationToken every time they read or
+// write this many bytes, which takes a few milliseconds at most.
+const size_t kCancellationCheckSize = 1024 * 1024;
+
+// An ExtentReader splitting the reads of |reader_| in chunks of at most
+// kCancellationCheckSize bytes, checking |token_| before each one.
+class CancelableExtentReader : public ExtentReader {
+ public:
+  CancelableExtentReader(std::unique_ptr<ExtentReader> reader,
+                         CancellationToken* token)
+      : reader_(std::move(reader)), token_(token) {}
+  ~CancelableExtentReader() override = default;
+
+  bool Init(FileDescriptorPtr fd,
+            const RepeatedPtrField<Extent>& extents,
+            uint32_t block_size) override {
+    return reader_->Init(fd, extents, block_size);
+  }
+
+  bool Seek(uint64_t offset) override { return reader_->Seek(offset); }
+
+  bool Read(void* buffer, size_t count) override {
+    uint8_t* bytes = static_cast<uint8_t*>(buffer);
+    while (count > 0) {
+      TEST_AND_RETURN_FALSE(token_->Check());
+      size_t chunk_size = std::min(count, kCancellationCheckSize);
+      TEST_AND_RETURN_FALSE(reader_->Read(bytes, chunk_size));
+      bytes += chunk_size;
+      count -= chunk_size;
+    }
+    return true;
+  }
+
+  bool Prefetch(uint64_t count) override { return reader_->Prefetch(count); }
+
+ private:
+  std::unique_ptr<ExtentReader> reader_;
+  CancellationToken* token_;
+
+  DISALLOW_COPY_AND_ASSIGN(CancelableExtentReader);
+};
+
+// The ExtentWriter counterpart of CancelableExtentReader.
+class CancelableExtentWriter : public ExtentWriter {
+ public:
+  CancelableExtentWriter(std::unique_ptr<ExtentWriter> writer,
+                         CancellationToken* token)
+      : writer_(std::move(writer)), token_(token) {}
+  ~CancelableExtentWriter() override = default;
+
+  bool Init(FileDescriptorPtr fd,
+            const RepeatedPtrField<Extent>& extents,
+            uint32_t block_size) override {
+    return writer_->Init(fd, extents, block_size);
+  }
+
+  bool Write(const void* bytes, size_t count) override {
+    const uint8_t* data = static_cast<const uint8_t*>(bytes);
+    while (count > 0) {
+      TEST_AND_RETURN_FALSE(token_->Check());
+      size_t chunk_size = std::min(count, kCancellationCheckSize);
+      TEST_AND_RETURN_FALSE(writer_->Write(data, chunk_size));
+      data += chunk_size;
+      count -= chunk_size;
+    }
+    return true;
+  }
+
+ private:
+  std::unique_ptr<ExtentWriter> writer_;
+  CancellationToken* token_;
+
+  DISALLOW_COPY_AND_ASSIGN(CancelableExtentWriter);
+};
+
+// Returns the reader and writer of the extents of a diff operation, which
+// check |token| if not null.
+std::unique_ptr<ExtentReader> CreateDiffExtentReader(
+    CancellationToken* token) {
+  std::unique_ptr<ExtentReader> reader = std::make_unique<DirectExtentReader>();
+  if (token)
+    reader = std::make_unique<CancelableExtentReader>(std::move(reader), token);
+  return reader;
+}
+
+std::unique_ptr<ExtentWriter> CreateDiffExtentWriter(
+    CancellationToken* token) {
+  std::unique_ptr<ExtentWriter> writer = std::make_unique<DirectExtentWriter>();
+  if (token)
+    writer = std::make_unique<CancelableExtentWriter>(std::move(writer), token);
+  return writer;
+}
+
 class BsdiffExtentFile : public bsdiff::FileInterface {
  public:
   BsdiffExtentFile(std::unique_ptr<ExtentReader> reader, size_t size)
@@ -1418,6 +2074,49 @@ class BsdiffExtentFile : public bsdiff::FileInterface {
   DISALLOW_COPY_AND_ASSIGN(BsdiffExtentFile);
 };
 
+// A read-only bsdiff::FileInterface holding the data in memory, which goes
+// back to the BufferPool once done.
+class BsdiffMemoryFile : public bsdiff::FileInterface {
+ public:
+  explicit BsdiffMemoryFile(brillo::Blob data) : data_(std::move(data)) {}
+  ~BsdiffMemoryFile() override {
+    BufferPool::Get()->Release(std::move(data_));
+  }
+
+  bool Read(void* buf, size_t count, size_t* bytes_read) override {
+    *bytes_read = std::min<uint64_t>(count, data_.size() - offset_);
+    memcpy(buf, data_.data() + offset_, *bytes_read);
+    offset_ += *bytes_read;
+    return true;
+  }
+
+  bool Write(const void* buf, size_t count, size_t* bytes_written) override {
+    return false;
+  }
+
+  bool Seek(off_t pos) override {
+    TEST_AND_RETURN_FALSE(pos >= 0 &&
+                          static_cast<uint64_t>(pos) <= data_.size());
+    offset_ = pos;
+    return true;
+  }
+
+  bool Close() override { return true; }
+
+  bool GetSize(uint64_t* size) override {
+    *size = data_.size();
+    return true;
+  }
+
+  uint8_t* data() { return data_.data(); }
+
+ private:
+  brillo::Blob data_;
+  uint64_t offset_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(BsdiffMemoryFile);
+};
+
 }  // namespace
 
 bool DeltaPerformer::PerformSourceBsdiffOperation(
@@ -1425,34 +2124,93 @@ bool DeltaPerformer::PerformSourceBsdiffOperation(
   // Since we delete data off the beginning of the buffer as we use it,
   // the data we need should be exactly at the beginning of the buffer.
   TEST_AND_RETURN_FALSE(buffer_offset_ == operation.data_offset());
-  TEST_AND_RETURN_FALSE(buffer_.size() >= operation.data_length());
-  if (operation.has_src_length())
-    TEST_AND_RETURN_FALSE(operation.src_length() % block_size_ == 0);
-  if (operation.has_dst_length())
-    TEST_AND_RETURN_FALSE(operation.dst_length() % block_size_ == 0);
+  TEST_AND_RETURN_FALSE(BufferSize() >= operation.data_length());
 
   FileDescriptorPtr source_fd = ChooseSourceFD(operation, error);
   TEST_AND_RETURN_FALSE(source_fd != nullptr);
 
-  auto reader = std::make_unique<DirectExtentReader>();
   TEST_AND_RETURN_FALSE(
-      reader->Init(source_fd, operation.src_extents(), block_size_));
-  auto src_file = std::make_unique<BsdiffExtentFile>(
-      std::move(reader),
-      utils::BlocksInExtents(operation.src_extents()) * block_size_);
+      ApplySourceBsdiffOperation(operation,
+                                 BufferData(),
+                                 source_fd,
+                                 target_fd_,
+                                 block_size_,
+                                 base::SysInfo::NumberOfProcessors(),
+                                 max_apply_memory_size_,
+                                 &apply_token_));
+  ConsumeBuffer(operation.data_length());
+  return true;
+}
 
-  auto writer = std::make_unique<DirectExtentWriter>();
+bool DeltaPerformer::ApplySourceBsdiffOperation(
+    const InstallOperation& operation,
+    const uint8_t* data,
+    const FileDescriptorPtr& source_fd,
+    const FileDescriptorPtr& target_fd,
+    uint32_t block_size,
+    size_t num_threads,
+    uint64_t max_memory_size,
+    CancellationToken* token) {
+  if (operation.has_src_length())
+    TEST_AND_RETURN_FALSE(operation.src_length() % block_size == 0);
+  if (operation.has_dst_length())
+    TEST_AND_RETURN_FALSE(operation.dst_length() % block_size == 0);
+
+  const uint64_t src_size =
+      utils::BlocksInExtents(operation.src_extents()) * block_size;
+  std::unique_ptr<ExtentReader> reader = CreateDiffExtentReader(token);
   TEST_AND_RETURN_FALSE(
-      writer->Init(target_fd_, operation.dst_extents(), block_size_));
-  auto dst_file = std::make_unique<BsdiffExtentFile>(
-      std::move(writer),
-      utils::BlocksInExtents(operation.dst_extents()) * block_size_);
+      reader->Init(source_fd, operation.src_extents(), block_size));
+  const uint64_t dst_size =
+      utils::BlocksInExtents(operation.dst_extents()) * block_size;
+  if (operation.type() == InstallOperation::ZSTD_BSDIFF) {
+    // The parallel patching keeps the old data and twice the new data in
+    // memory, while the serial one streams them.
+    if (dst_size < kMinParallelBspatchSize ||
+        src_size + 2 * dst_size > max_memory_size) {
+      num_threads = 1;
+    }
+    ScopedMemoryTracker scratch_memory(
+        MemoryCategory::kDiffScratch,
+        num_threads > 1 ? src_size + 2 * dst_size : 0);
+    std::unique_ptr<ExtentWriter> writer = CreateDiffExtentWriter(token);
+    TEST_AND_RETURN_FALSE(
+        writer->Init(target_fd, operation.dst_extents(), block_size));
+    return ZstdBspatchParallel(data,
+                               operation.data_length(),
+                               reader.get(),
+                               src_size,
+                               writer.get(),
+                               num_threads);
+  }
+
+  // bspatch seeks all over the source data, so it is read at once rather
+  // than with a small read of the extents for each seek. The memory is
+  // already accounted for in the |apply_memory_size| of the operation. The
+  // source data too big for the memory budget is read from the partition as
+  // it is patched instead.
+  std::unique_ptr<bsdiff::FileInterface> src_file;
+  ScopedMemoryTracker scratch_memory(MemoryCategory::kDiffScratch);
+  if (src_size <= max_memory_size) {
+    scratch_memory.Resize(src_size);
+    auto memory_file = std::make_unique<BsdiffMemoryFile>(
+        BufferPool::Get()->Acquire(src_size));
+    TEST_AND_RETURN_FALSE(reader->Read(memory_file->data(), src_size));
+    src_file = std::move(memory_file);
+  } else {
+    src_file = std::make_unique<BsdiffExtentFile>(std::move(reader), src_size);
+  }
+
+  std::unique_ptr<ExtentWriter> writer = CreateDiffExtentWriter(token);
+  TEST_AND_RETURN_FALSE(
+      writer->Init(target_fd, operation.dst_extents(), block_size));
+  auto dst_file =
+      std::make_unique<BsdiffExtentFile>(std::move(writer), dst_size);
 
   TEST_AND_RETURN_FALSE(bsdiff::bspatch(std::move(src_file),
                                         std::move(dst_file),
-                                        buffer_.data(),
-                                        buffer_.size()) == 0);
-  DiscardBuffer(true, buffer_.size());
+                                        data,
+                                        operation.data_length()) == 0);
   return true;
 }
 
@@ -1529,6 +2287,47 @@ class PuffinExtentStream : public puffin::StreamInterface {
   DISALLOW_COPY_AND_ASSIGN(PuffinExtentStream);
 };
 
+// A class to be passed to |puffpatch| for reading source data held in memory.
+class PuffinBufferStream : public puffin::StreamInterface {
+ public:
+  explicit PuffinBufferStream(std::shared_ptr<const brillo::Blob> data)
+      : data_(std::move(data)) {}
+  ~PuffinBufferStream() override = default;
+
+  bool GetSize(uint64_t* size) const override {
+    *size = data_->size();
+    return true;
+  }
+
+  bool GetOffset(uint64_t* offset) const override {
+    *offset = offset_;
+    return true;
+  }
+
+  bool Seek(uint64_t offset) override {
+    TEST_AND_RETURN_FALSE(offset <= data_->size());
+    offset_ = offset;
+    return true;
+  }
+
+  bool Read(void* buffer, size_t count) override {
+    TEST_AND_RETURN_FALSE(count <= data_->size() - offset_);
+    memcpy(buffer, data_->data() + offset_, count);
+    offset_ += count;
+    return true;
+  }
+
+  bool Write(const void* buffer, size_t count) override { return false; }
+
+  bool Close() override { return true; }
+
+ private:
+  std::shared_ptr<const brillo::Blob> data_;
+  uint64_t offset_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(PuffinBufferStream);
+};
+
 }  // namespace
 
 bool DeltaPerformer::PerformPuffDiffOperation(const InstallOperation& operation,
@@ -1536,32 +2335,806 @@ bool DeltaPerformer::PerformPuffDiffOperation(const InstallOperation& operation,
   // Since we delete data off the beginning of the buffer as we use it,
   // the data we need should be exactly at the beginning of the buffer.
   TEST_AND_RETURN_FALSE(buffer_offset_ == operation.data_offset());
-  TEST_AND_RETURN_FALSE(buffer_.size() >= operation.data_length());
+  TEST_AND_RETURN_FALSE(BufferSize() >= operation.data_length());
 
   FileDescriptorPtr source_fd = ChooseSourceFD(operation, error);
   TEST_AND_RETURN_FALSE(source_fd != nullptr);
 
-  auto reader = std::make_unique<DirectExtentReader>();
+  TEST_AND_RETURN_FALSE(ApplyPuffDiffOperation(operation,
+                                               BufferData(),
+                                               source_fd,
+                                               target_fd_,
+                                               block_size_,
+                                               puffdiff_source_cache_.get(),
+                                               max_apply_memory_size_,
+                                               &apply_token_));
+  ConsumeBuffer(operation.data_length());
+  return true;
+}
+
+bool DeltaPerformer::ApplyPuffDiffOperation(const InstallOperation& operation,
+                                            const uint8_t* data,
+                                            const FileDescriptorPtr& source_fd,
+                                            const FileDescriptorPtr& target_fd,
+                                            uint32_t block_size,
+                                            SourceDataCache* source_cache,
+                                            uint64_t max_memory_size,
+                                            CancellationToken* token) {
+  const uint64_t src_size =
+      utils::BlocksInExtents(operation.src_extents()) * block_size;
+  std::unique_ptr<ExtentReader> reader = CreateDiffExtentReader(token);
   TEST_AND_RETURN_FALSE(
-      reader->Init(source_fd, operation.src_extents(), block_size_));
-  puffin::UniqueStreamPtr src_stream(new PuffinExtentStream(
-      std::move(reader),
-      utils::BlocksInExtents(operation.src_extents()) * block_size_));
+      reader->Init(source_fd, operation.src_extents(), block_size));
+  puffin::UniqueStreamPtr src_stream;
+  // The source data is identified by its hash, already checked by the caller.
+  // The data too big for the cache is still read as it is patched.
+  if (source_cache && operation.has_src_sha256_hash() &&
+      src_size <= std::min(kMaxPuffdiffCachedSourceSize, max_memory_size)) {
+    std::shared_ptr<const brillo::Blob> src_data =
+        source_cache->Get(operation.src_sha256_hash());
+    if (!src_data) {
+      auto data = std::make_shared<brillo::Blob>(src_size);
+      TEST_AND_RETURN_FALSE(reader->Read(data->data(), data->size()));
+      src_data = std::move(data);
+      source_cache->Put(operation.src_sha256_hash(), src_data);
+    }
+    src_stream.reset(new PuffinBufferStream(std::move(src_data)));
+  } else {
+    src_stream.reset(new PuffinExtentStream(std::move(reader), src_size));
+  }
 
-  auto writer = std::make_unique<DirectExtentWriter>();
+  std::unique_ptr<ExtentWriter> writer = CreateDiffExtentWriter(token);
   TEST_AND_RETURN_FALSE(
-      writer->Init(target_fd_, operation.dst_extents(), block_size_));
+      writer->Init(target_fd, operation.dst_extents(), block_size));
   puffin::UniqueStreamPtr dst_stream(new PuffinExtentStream(
       std::move(writer),
-      utils::BlocksInExtents(operation.dst_extents()) * block_size_));
+      utils::BlocksInExtents(operation.dst_extents()) * block_size));
 
   const size_t kMaxCacheSize = 5 * 1024 * 1024;  // Total 5MB cache.
+  ScopedMemoryTracker scratch_memory(MemoryCategory::kDiffScratch,
+                                     kMaxCacheSize);
   TEST_AND_RETURN_FALSE(puffin::PuffPatch(std::move(src_stream),
                                           std::move(dst_stream),
-                                          buffer_.data(),
-                                          buffer_.size(),
+                                          data,
+                                          operation.data_length(),
                                           kMaxCacheSize));
-  DiscardBuffer(true, buffer_.size());
+  return true;
+}
+
+class DeltaPerformer::ParallelApplyWorker
+    : public base::DelegateSimpleThread::Delegate {
+ public:
+  enum class Result {
+    kNotApplied,
+    kSuccess,
+    kFailed,
+    kHashCheckFailed,
+    kRetrySerially,
+  };
+
+  // An operation of a parallel batch and the result of applying it.
+  struct Operation {
+    const InstallOperation* operation;
+    const uint8_t* data;
+    size_t operation_num;
+    Result result{Result::kNotApplied};
+    ErrorCode error{ErrorCode::kSuccess};
+    // The time the worker spent applying the operation.
+    base::TimeDelta duration;
+  };
+
+  // The operations shared by all the workers of a batch. Each worker picks the
+  // next operation not yet taken by any worker, so they are started in the
+  // order of |apply_order|.
+  struct Batch {
+    std::vector<Operation> operations;
+    // The indexes of |operations| in the order they are started.
+    std::vector<size_t> apply_order;
+    // The threads each SOURCE_BSDIFF operation may use.
+    size_t bsdiff_threads{1};
+    base::Lock lock;
+    // The index of the next operation to apply. Protected by |lock|.
+    size_t next_index{0};
+    // Whether any operation failed, so there's no point in applying the rest.
+    // Protected by |lock|.
+    bool failed{false};
+  };
+
+  ParallelApplyWorker(DeltaPerformer* performer,
+                      const WorkerFileDescriptors* fds,
+                      Batch* batch)
+      : performer_(performer), fds_(fds), batch_(batch) {}
+
+  // base::DelegateSimpleThread::Delegate overrides.
+  void Run() override {
+    while (true) {
+      Operation* op;
+      {
+        base::AutoLock auto_lock(batch_->lock);
+        if (batch_->failed || batch_->next_index >= batch_->operations.size())
+          return;
+        op = &batch_->operations[batch_->apply_order[batch_->next_index++]];
+      }
+      UE_TRACE_SCOPE(InstallOperationTypeName(op->operation->type()));
+      base::TimeTicks start_time = base::TimeTicks::Now();
+      op->result = ApplyOperation(op);
+      op->duration = base::TimeTicks::Now() - start_time;
+      if (op->result == Result::kFailed ||
+          op->result == Result::kHashCheckFailed) {
+        base::AutoLock auto_lock(batch_->lock);
+        batch_->failed = true;
+      }
+    }
+  }
+
+ private:
+  Result ApplyOperation(Operation* op) {
+    const InstallOperation& operation = *op->operation;
+    // Same as in DeltaPerformer::Write(), validate the operation only if the
+    // metadata signature is present.
+    if (!performer_->payload_->metadata_signature.empty()) {
+      op->error = performer_->ValidateOperationHash(
+          operation, op->data, op->operation_num, false);
+      if (op->error != ErrorCode::kSuccess) {
+        if (performer_->install_plan_->hash_checks_mandatory)
+          return Result::kHashCheckFailed;
+        LOG(WARNING) << "Ignoring operation validation errors";
+        op->error = ErrorCode::kSuccess;
+      }
+    }
+
+    const uint32_t block_size = performer_->block_size_;
+    if (operation.has_src_length() && operation.src_length() % block_size)
+      return Result::kFailed;
+    if (operation.has_dst_length() && operation.dst_length() % block_size)
+      return Result::kFailed;
+
+    // Only the raw source device is used here. If its hash doesn't match, the
+    // operation is retried serially, which falls back to the error corrected
+    // device.
+    brillo::Blob expected_source_hash(operation.src_sha256_hash().begin(),
+                                      operation.src_sha256_hash().end());
+    brillo::Blob source_hash;
+    bool success = false;
+    switch (operation.type()) {
+      case InstallOperation::REPLACE:
+      case InstallOperation::REPLACE_BZ:
+      case InstallOperation::REPLACE_XZ:
+      case InstallOperation::REPLACE_ZSTD:
+      case InstallOperation::REPLACE_LZ4:
+        success = ApplyReplaceOperation(
+            operation, op->data, fds_->target_fd, block_size);
+        break;
+      case InstallOperation::ZERO:
+      case InstallOperation::DISCARD:
+        success =
+            ApplyZeroOrDiscardOperation(operation, fds_->target_fd, block_size);
+        break;
+      case InstallOperation::SOURCE_COPY:
+        if (!fd_utils::CopyAndHashExtents(fds_->source_fd,
+                                          operation.src_extents(),
+                                          fds_->target_fd,
+                                          operation.dst_extents(),
+                                          block_size,
+                                          &source_hash) ||
+            source_hash != expected_source_hash) {
+          return Result::kRetrySerially;
+        }
+        success = true;
+        break;
+      case InstallOperation::SOURCE_BSDIFF:
+      case InstallOperation::BROTLI_BSDIFF:
+      case InstallOperation::ZSTD_BSDIFF:
+      case InstallOperation::PUFFDIFF:
+        if (!fd_utils::ReadAndHashExtents(fds_->source_fd,
+                                          operation.src_extents(),
+                                          block_size,
+                                          &source_hash) ||
+            source_hash != expected_source_hash) {
+          return Result::kRetrySerially;
+        }
+        if (operation.type() == InstallOperation::PUFFDIFF) {
+          success =
+              ApplyPuffDiffOperation(operation,
+                                     op->data,
+                                     fds_->source_fd,
+                                     fds_->target_fd,
+                                     block_size,
+                                     performer_->puffdiff_source_cache_.get(),
+                                     performer_->max_apply_memory_size_,
+                                     &performer_->apply_token_);
+        } else {
+          success = ApplySourceBsdiffOperation(
+              operation,
+              op->data,
+              fds_->source_fd,
+              fds_->target_fd,
+              block_size,
+              batch_->bsdiff_threads,
+              performer_->max_apply_memory_size_,
+              &performer_->apply_token_);
+        }
+        break;
+      default:
+        break;
+    }
+    // Same as in DeltaPerformer::Write(), flush the cached writes before the
+    // operation is considered applied.
+    if (success)
+      success = fds_->target_fd->Flush();
+    return success ? Result::kSuccess : Result::kFailed;
+  }
+
+  DeltaPerformer* performer_;
+  const WorkerFileDescriptors* fds_;
+  Batch* batch_;
+
+  DISALLOW_COPY_AND_ASSIGN(ParallelApplyWorker);
+};
+
+size_t DeltaPerformer::GetParallelWindow(uint64_t* data_length) {
+  *data_length = 0;
+  if ((max_apply_threads_ <= 1 && !destination_order_) ||
+      next_operation_num_ == serial_retry_operation_num_) {
+    return 0;
+  }
+  // In-place operations read from the target partition, so they must be
+  // applied in order.
+  if (payload_->type == InstallPayloadType::kDelta &&
+      GetMinorVersion() == kInPlaceMinorPayloadVersion) {
+    return 0;
+  }
+
+  const size_t partition_first_op_num =
+      current_partition_ ? acc_num_operations_[current_partition_ - 1] : 0;
+  const PartitionUpdate& partition = partitions_[current_partition_];
+  std::map<uint64_t, uint64_t> dst_blocks;
+  size_t num_operations = 0;
+  uint64_t apply_memory_size = 0;
+  for (size_t op_num = next_operation_num_;
+       op_num < acc_num_operations_[current_partition_] &&
+       num_operations < kMaxParallelOperations;
+       op_num++) {
+    const InstallOperation& op =
+        partition.operations(op_num - partition_first_op_num);
+    switch (op.type()) {
+      case InstallOperation::REPLACE:
+      case InstallOperation::REPLACE_BZ:
+      case InstallOperation::REPLACE_XZ:
+      case InstallOperation::REPLACE_ZSTD:
+      case InstallOperation::REPLACE_LZ4:
+      case InstallOperation::ZERO:
+      case InstallOperation::DISCARD:
+        break;
+      case InstallOperation::SOURCE_COPY:
+      case InstallOperation::SOURCE_BSDIFF:
+      case InstallOperation::BROTLI_BSDIFF:
+      case InstallOperation::ZSTD_BSDIFF:
+      case InstallOperation::PUFFDIFF:
+        // Operations without a source hash try the error corrected device
+        // first, which is only done serially.
+        if (source_fd_ && op.has_src_sha256_hash())
+          break;
+        return num_operations;
+      default:
+        return num_operations;
+    }
+    if (op.data_length()) {
+      // The blobs must be contiguous so they can be consumed from |buffer_|
+      // in order. The signature blob is always handled serially.
+      if (op.data_offset() != buffer_offset_ + *data_length ||
+          (manifest_.has_signatures_offset() &&
+           manifest_.signatures_offset() == op.data_offset()))
+        break;
+      if (num_operations &&
+          *data_length + op.data_length() > kMaxParallelDataSize)
+        break;
+    }
+    if (num_operations &&
+        apply_memory_size + op.apply_memory_size() > max_apply_memory_size_)
+      break;
+    if (!AddNonOverlappingExtents(op.dst_extents(), &dst_blocks))
+      break;
+    *data_length += op.data_length();
+    apply_memory_size += op.apply_memory_size();
+    num_operations++;
+  }
+  return num_operations;
+}
+
+size_t DeltaPerformer::GetSourceCopyRun() {
+  if (!source_fd_ || next_operation_num_ == serial_retry_operation_num_)
+    return 0;
+
+  const size_t partition_first_op_num =
+      current_partition_ ? acc_num_operations_[current_partition_ - 1] : 0;
+  const PartitionUpdate& partition = partitions_[current_partition_];
+  uint64_t src_end_block = 0;
+  uint64_t dst_end_block = 0;
+  uint64_t run_size = 0;
+  size_t num_operations = 0;
+  for (size_t op_num = next_operation_num_;
+       op_num < acc_num_operations_[current_partition_];
+       op_num++) {
+    const InstallOperation& op =
+        partition.operations(op_num - partition_first_op_num);
+    // Operations without a source hash try the error corrected device first
+    // and the deprecated lengths are only validated serially.
+    if (op.type() != InstallOperation::SOURCE_COPY ||
+        !op.has_src_sha256_hash() || op.has_src_length() ||
+        op.has_dst_length() || op.src_extents_size() == 0 ||
+        op.dst_extents_size() == 0) {
+      break;
+    }
+    uint64_t num_blocks = utils::BlocksInExtents(op.src_extents());
+    if (num_blocks != utils::BlocksInExtents(op.dst_extents()))
+      break;
+    if (num_operations &&
+        (op.src_extents(0).start_block() != src_end_block ||
+         op.dst_extents(0).start_block() != dst_end_block ||
+         run_size + num_blocks * block_size_ > kMaxSourceCopyRunSize)) {
+      break;
+    }
+    const Extent& src_last = op.src_extents(op.src_extents_size() - 1);
+    const Extent& dst_last = op.dst_extents(op.dst_extents_size() - 1);
+    src_end_block = src_last.start_block() + src_last.num_blocks();
+    dst_end_block = dst_last.start_block() + dst_last.num_blocks();
+    run_size += num_blocks * block_size_;
+    num_operations++;
+  }
+  return num_operations;
+}
+
+bool DeltaPerformer::PerformSourceCopyRun(size_t num_operations,
+                                          ErrorCode* error) {
+  const size_t partition_first_op_num =
+      current_partition_ ? acc_num_operations_[current_partition_ - 1] : 0;
+  const PartitionUpdate& partition = partitions_[current_partition_];
+  RepeatedPtrField<Extent> src_extents;
+  for (size_t i = 0; i < num_operations; i++) {
+    AppendMergedExtents(
+        partition.operations(next_operation_num_ + i - partition_first_op_num)
+            .src_extents(),
+        &src_extents);
+  }
+
+  // Makes sure we unblock exit when these operations complete.
+  ScopedTerminatorExitUnblocker exit_unblocker =
+      ScopedTerminatorExitUnblocker();  // Avoids a compiler unused var bug.
+
+  base::TimeTicks op_start_time = base::TimeTicks::Now();
+
+  brillo::Blob data(utils::BlocksInExtents(src_extents) * block_size_);
+  DirectExtentReader reader;
+  if (!reader.Init(source_fd_, src_extents, block_size_) ||
+      !reader.Read(data.data(), data.size())) {
+    LOG(WARNING) << "Unable to read the source of operation "
+                 << next_operation_num_ << ", retrying serially.";
+    serial_retry_operation_num_ = next_operation_num_;
+    return true;
+  }
+
+  // Only the operations before the first one whose source hash doesn't match
+  // are copied; that one is retried serially, which may use the error
+  // corrected device.
+  RepeatedPtrField<Extent> dst_extents;
+  uint64_t verified_size = 0;
+  size_t num_verified = 0;
+  for (; num_verified < num_operations; num_verified++) {
+    const InstallOperation& op = partition.operations(
+        next_operation_num_ + num_verified - partition_first_op_num);
+    uint64_t size = utils::BlocksInExtents(op.src_extents()) * block_size_;
+    brillo::Blob source_hash;
+    if (!HashCalculator::RawHashOfBytes(
+            data.data() + verified_size, size, &source_hash) ||
+        source_hash != brillo::Blob(op.src_sha256_hash().begin(),
+                                    op.src_sha256_hash().end())) {
+      LOG(INFO) << "Retrying operation " << next_operation_num_ + num_verified
+                << " serially.";
+      serial_retry_operation_num_ = next_operation_num_ + num_verified;
+      break;
+    }
+    AppendMergedExtents(op.dst_extents(), &dst_extents);
+    verified_size += size;
+  }
+  if (num_verified == 0)
+    return true;
+
+  DirectExtentWriter writer;
+  if (!writer.Init(target_fd_, dst_extents, block_size_) ||
+      !writer.Write(data.data(), verified_size) || !target_fd_->Flush()) {
+    // Retrying the first operation serially falls back to the error
+    // corrected device, like a failed write of a single SOURCE_COPY.
+    LOG(WARNING) << "Unable to write the target of operation "
+                 << next_operation_num_ << ", retrying serially.";
+    serial_retry_operation_num_ = next_operation_num_;
+    return true;
+  }
+  OP_DURATION_HISTOGRAM("SOURCE_COPY", op_start_time);
+
+  // The time of the run is split evenly among its operations.
+  base::TimeDelta op_duration = (base::TimeTicks::Now() - op_start_time) /
+                                static_cast<int64_t>(num_verified);
+  for (size_t i = 0; i < num_verified; i++) {
+    RecordOperationStats(partition.operations(next_operation_num_ -
+                                              partition_first_op_num),
+                         op_duration);
+    next_operation_num_++;
+    UpdateOverallProgress(false, "Completed ");
+    CheckpointUpdateProgress(false);
+  }
+  return true;
+}
+
+bool* DeltaPerformer::GetZeroOrDiscardIoctlSupport(
+    InstallOperation::Type type) {
+  return type == InstallOperation::ZERO ? &zero_ioctl_supported_
+                                        : &discard_ioctl_supported_;
+}
+
+size_t DeltaPerformer::GetZeroOrDiscardRun() {
+  if (next_operation_num_ == serial_retry_operation_num_)
+    return 0;
+
+  const size_t partition_first_op_num =
+      current_partition_ ? acc_num_operations_[current_partition_ - 1] : 0;
+  const PartitionUpdate& partition = partitions_[current_partition_];
+  const InstallOperation* first_op = nullptr;
+  uint64_t run_size = 0;
+  size_t num_operations = 0;
+  for (size_t op_num = next_operation_num_;
+       op_num < acc_num_operations_[current_partition_];
+       op_num++) {
+    const InstallOperation& op =
+        partition.operations(op_num - partition_first_op_num);
+    if ((op.type() != InstallOperation::ZERO &&
+         op.type() != InstallOperation::DISCARD) ||
+        (first_op && op.type() != first_op->type()) ||
+        op.has_data_offset() || op.has_data_length()) {
+      break;
+    }
+    uint64_t size = utils::BlocksInExtents(op.dst_extents()) * block_size_;
+    if (num_operations && run_size + size > kMaxZeroOrDiscardRunSize)
+      break;
+    if (!first_op)
+      first_op = &op;
+    run_size += size;
+    num_operations++;
+  }
+  return num_operations;
+}
+
+bool DeltaPerformer::PerformZeroOrDiscardRun(size_t num_operations,
+                                             ErrorCode* error) {
+  const size_t partition_first_op_num =
+      current_partition_ ? acc_num_operations_[current_partition_ - 1] : 0;
+  const PartitionUpdate& partition = partitions_[current_partition_];
+  const InstallOperation::Type type =
+      partition.operations(next_operation_num_ - partition_first_op_num)
+          .type();
+  // The operations of a run are all of the same type, so they can be applied
+  // in any order: their extents are sorted and merged into the fewest ranges.
+  vector<Extent> extents;
+  for (size_t i = 0; i < num_operations; i++) {
+    const InstallOperation& op =
+        partition.operations(next_operation_num_ + i - partition_first_op_num);
+    extents.insert(
+        extents.end(), op.dst_extents().begin(), op.dst_extents().end());
+  }
+  RepeatedPtrField<Extent> merged_extents =
+      SortAndMergeExtents(std::move(extents));
+
+  // Makes sure we unblock exit when these operations complete.
+  ScopedTerminatorExitUnblocker exit_unblocker =
+      ScopedTerminatorExitUnblocker();  // Avoids a compiler unused var bug.
+
+  base::TimeTicks op_start_time = base::TimeTicks::Now();
+  UE_TRACE_SCOPE(InstallOperationTypeName(type));
+  bool op_result = ZeroOrDiscardExtents(type,
+                                        merged_extents,
+                                        target_fd_,
+                                        block_size_,
+                                        GetZeroOrDiscardIoctlSupport(type)) &&
+                   target_fd_->Flush();
+  if (!HandleOpResult(op_result, InstallOperationTypeName(type), error))
+    return false;
+  OP_DURATION_HISTOGRAM("ZERO_OR_DISCARD", op_start_time);
+
+  // The time of the run is split evenly among its operations.
+  base::TimeDelta op_duration = (base::TimeTicks::Now() - op_start_time) /
+                                static_cast<int64_t>(num_operations);
+  for (size_t i = 0; i < num_operations; i++) {
+    RecordOperationStats(partition.operations(next_operation_num_ -
+                                              partition_first_op_num),
+                         op_duration);
+    next_operation_num_++;
+    UpdateOverallProgress(false, "Completed ");
+    CheckpointUpdateProgress(false);
+  }
+  return true;
+}
+
+void DeltaPerformer::PrefetchSourceExtents() {
+  const PartitionUpdate& partition = partitions_[current_partition_];
+  const size_t partition_first_op_num =
+      current_partition_ ? acc_num_operations_[current_partition_ - 1] : 0;
+  const size_t end_op_num =
+      std::min(next_operation_num_ + prefetch_window_,
+               acc_num_operations_[current_partition_]);
+  next_prefetch_operation_num_ =
+      std::max(next_prefetch_operation_num_, next_operation_num_);
+  if (source_fd_) {
+    for (; next_prefetch_operation_num_ < end_op_num;
+         next_prefetch_operation_num_++) {
+      const InstallOperation& op = partition.operations(
+          next_prefetch_operation_num_ - partition_first_op_num);
+      // Prefetching is only an optimization.
+      if (!PrefetchOperationSource(source_fd_, op))
+        break;
+    }
+  }
+
+  // The prefetch window reaches past the end of this partition.
+  if (next_operation_num_ + prefetch_window_ >
+      acc_num_operations_[current_partition_]) {
+    PrefetchNextPartition();
+  }
+}
+
+void DeltaPerformer::PrefetchNextPartition() {
+  size_t next_partition = current_partition_ + 1;
+  while (next_partition < partitions_.size() &&
+         acc_num_operations_[next_partition] ==
+             acc_num_operations_[next_partition - 1]) {
+    next_partition++;
+  }
+  if (next_partition >= partitions_.size() ||
+      next_partition == next_source_partition_) {
+    return;
+  }
+  next_source_partition_ = next_partition;
+  next_source_fd_.reset();
+  if (!LoadPartitionOperations(next_partition))
+    return;
+
+  size_t num_previous_partitions =
+      install_plan_->partitions.size() - partitions_.size();
+  const InstallPlan::Partition& install_part =
+      install_plan_->partitions[num_previous_partitions + next_partition];
+  // Same condition as in OpenCurrentPartition().
+  if (payload_->type != InstallPayloadType::kDelta ||
+      GetMinorVersion() == kInPlaceMinorPayloadVersion ||
+      install_part.source_size == 0) {
+    return;
+  }
+  int err;
+  next_source_fd_ =
+      OpenFile(install_part.source_path.c_str(), O_RDONLY, false, false, &err);
+  if (!next_source_fd_) {
+    // OpenCurrentPartition() will report the error when it gets there.
+    return;
+  }
+
+  const PartitionUpdate& partition = partitions_[next_partition];
+  const int num_ops = std::min(partition.operations_size(),
+                               static_cast<int>(prefetch_window_));
+  for (int i = 0; i < num_ops; i++) {
+    if (!PrefetchOperationSource(next_source_fd_, partition.operations(i)))
+      break;
+  }
+}
+
+void DeltaPerformer::UpdatePrefetchWindow(base::TimeDelta read_time,
+                                          uint64_t bytes) {
+  int64_t read_time_us = read_time.InMicroseconds();
+  bool stalled = read_time_us > kPrefetchStallTimeUs &&
+                 bytes * base::Time::kMicrosecondsPerSecond <
+                     kMinCachedReadSpeed * static_cast<uint64_t>(read_time_us);
+  if (stalled) {
+    prefetch_fast_reads_ = 0;
+    if (prefetch_window_ < kMaxPrefetchOperations) {
+      prefetch_window_ = std::min(prefetch_window_ * 2, kMaxPrefetchOperations);
+      LOG(INFO) << "Source read of " << bytes << " bytes took "
+                << utils::FormatTimeDelta(read_time)
+                << ", prefetching " << prefetch_window_ << " operations ahead.";
+    }
+    return;
+  }
+  if (++prefetch_fast_reads_ >= kPrefetchShrinkOperations &&
+      prefetch_window_ > kMinPrefetchOperations) {
+    prefetch_fast_reads_ = 0;
+    prefetch_window_ = std::max(prefetch_window_ / 2, kMinPrefetchOperations);
+  }
+}
+
+bool DeltaPerformer::LoadPartitionOperations(size_t partition_index) {
+  // The operations of the partitions already updated aren't needed anymore.
+  // Clear() would keep them allocated.
+  for (size_t i = 0; i < current_partition_; i++) {
+    google::protobuf::RepeatedPtrField<InstallOperation>().Swap(
+        partitions_[i].mutable_operations());
+  }
+
+  PartitionUpdate& partition = partitions_[partition_index];
+  if (partition_index < serialized_partitions_.size() &&
+      partition.operations_size() == 0) {
+    const SerializedPartitionUpdate& serialized =
+        serialized_partitions_[partition_index];
+    PartitionUpdate parsed;
+    if (!parsed.ParseFromArray(serialized.data.data(),
+                               serialized.data.size()) ||
+        static_cast<size_t>(parsed.operations_size()) !=
+            serialized.num_operations) {
+      LOG(ERROR) << "Unable to parse the operations of partition "
+                 << partition.partition_name();
+      return false;
+    }
+    partition.mutable_operations()->Swap(parsed.mutable_operations());
+  }
+
+  for (InstallOperation& op : *partition.mutable_operations()) {
+    if (!UnpackOperationExtents(&op)) {
+      LOG(ERROR) << "Invalid packed extents in partition "
+                 << partition.partition_name();
+      return false;
+    }
+  }
+  return true;
+}
+
+bool DeltaPerformer::PrefetchOperationSource(const FileDescriptorPtr& fd,
+                                             const InstallOperation& op) {
+  switch (op.type()) {
+    case InstallOperation::SOURCE_COPY:
+    case InstallOperation::SOURCE_BSDIFF:
+    case InstallOperation::BROTLI_BSDIFF:
+    case InstallOperation::ZSTD_BSDIFF:
+    case InstallOperation::PUFFDIFF: {
+      DirectExtentReader reader;
+      return reader.Init(fd, op.src_extents(), block_size_) &&
+             reader.Prefetch(utils::BlocksInExtents(op.src_extents()) *
+                             block_size_);
+    }
+    default:
+      // The other operations don't read from the source partition.
+      return true;
+  }
+}
+
+bool DeltaPerformer::OpenWorkerFileDescriptors(size_t num_workers) {
+  int flags = O_RDWR;
+  if (!interactive_)
+    flags |= O_DSYNC;
+
+  while (worker_fds_.size() < num_workers) {
+    WorkerFileDescriptors worker_fds;
+    int err;
+    if (source_fd_) {
+      worker_fds.source_fd =
+          OpenFile(source_path_.c_str(), O_RDONLY, false, false, &err);
+      if (!worker_fds.source_fd)
+        return false;
+    }
+    worker_fds.target_fd =
+        OpenFile(target_path_.c_str(),
+                 flags,
+                 true,
+                 hardware_->UseDirectIoForPartitionWrites(),
+                 &err,
+                 hardware_->SkipUnchangedPartitionWrites() ? block_size_ : 0);
+    if (!worker_fds.target_fd) {
+      if (worker_fds.source_fd)
+        worker_fds.source_fd->Close();
+      return false;
+    }
+    if (partition_hasher_) {
+      worker_fds.target_fd = FileDescriptorPtr(new HashingFileDescriptor(
+          worker_fds.target_fd, partition_hasher_.get()));
+    }
+    worker_fds_.push_back(worker_fds);
+  }
+  return true;
+}
+
+bool DeltaPerformer::PerformOperationsInParallel(size_t num_operations,
+                                                 ErrorCode* error) {
+  const size_t num_workers = min(max_apply_threads_, num_operations);
+  if (!OpenWorkerFileDescriptors(num_workers)) {
+    LOG(WARNING) << "Unable to open the partition for the apply workers, "
+                 << "applying the operations serially.";
+    max_apply_threads_ = 1;
+    destination_order_ = false;
+    return true;
+  }
+
+  const size_t partition_first_op_num =
+      current_partition_ ? acc_num_operations_[current_partition_ - 1] : 0;
+  ParallelApplyWorker::Batch batch;
+  batch.operations.resize(num_operations);
+  for (size_t i = 0; i < num_operations; i++) {
+    ParallelApplyWorker::Operation* op = &batch.operations[i];
+    op->operation_num = next_operation_num_ + i;
+    op->operation = &partitions_[current_partition_].operations(
+        op->operation_num - partition_first_op_num);
+    op->data = nullptr;
+    if (op->operation->data_length()) {
+      op->data =
+          BufferData() + (op->operation->data_offset() - buffer_offset_);
+    }
+  }
+  batch.apply_order.resize(num_operations);
+  std::iota(batch.apply_order.begin(), batch.apply_order.end(), 0);
+  if (destination_order_) {
+    // The operations of a window don't write the same blocks and are committed
+    // in order below, so the order they are applied in doesn't matter.
+    std::stable_sort(batch.apply_order.begin(),
+                     batch.apply_order.end(),
+                     [&batch](size_t a, size_t b) {
+                       return GetFirstDestinationBlock(
+                                  *batch.operations[a].operation) <
+                              GetFirstDestinationBlock(
+                                  *batch.operations[b].operation);
+                     });
+  }
+  // Several workers already use the other CPUs, while a single one may use
+  // them all.
+  if (num_workers == 1)
+    batch.bsdiff_threads = base::SysInfo::NumberOfProcessors();
+
+  // Makes sure we unblock exit when these operations complete.
+  ScopedTerminatorExitUnblocker exit_unblocker =
+      ScopedTerminatorExitUnblocker();  // Avoids a compiler unused var bug.
+
+  base::TimeTicks batch_start_time = base::TimeTicks::Now();
+  std::vector<std::unique_ptr<ParallelApplyWorker>> workers;
+  for (size_t i = 0; i < num_workers; i++) {
+    workers.emplace_back(
+        std::make_unique<ParallelApplyWorker>(this, &worker_fds_[i], &batch));
+  }
+  if (num_workers == 1) {
+    // A single worker applies the operations in destination order from this
+    // thread.
+    workers[0]->Run();
+  } else {
+    base::DelegateSimpleThreadPool thread_pool("delta-performer", num_workers);
+    thread_pool.Start();
+    for (auto& worker : workers)
+      thread_pool.AddWork(worker.get());
+    thread_pool.JoinAll();
+  }
+  OP_DURATION_HISTOGRAM("PARALLEL_BATCH", batch_start_time);
+
+  // Commit the results in order, as if they had been applied serially.
+  for (const ParallelApplyWorker::Operation& op : batch.operations) {
+    // When applied in destination order, an operation may not have been
+    // started before a later one failed. It is applied serially, and the
+    // failed one fails again once reached.
+    if (op.result == ParallelApplyWorker::Result::kNotApplied) {
+      serial_retry_operation_num_ = next_operation_num_;
+      break;
+    }
+    if (op.result == ParallelApplyWorker::Result::kRetrySerially) {
+      LOG(INFO) << "Retrying operation " << next_operation_num_
+                << " serially.";
+      serial_retry_operation_num_ = next_operation_num_;
+      break;
+    }
+    *error = op.error;
+    if (op.result == ParallelApplyWorker::Result::kHashCheckFailed) {
+      LOG(ERROR) << "Mandatory operation hash check failed";
+      return false;
+    }
+    if (!HandleOpResult(op.result == ParallelApplyWorker::Result::kSuccess,
+                        InstallOperationTypeName(op.operation->type()),
+                        error))
+      return false;
+    RecordOperationStats(*op.operation, op.duration);
+
+    ConsumeBuffer(op.operation->data_length());
+    next_operation_num_++;
+    UpdateOverallProgress(false, "Completed ");
+    CheckpointUpdateProgress(false);
+  }
   return true;
 }
 
@@ -1581,9 +3154,9 @@ bool DeltaPerformer::ExtractSignatureMessageFromOperation(
 bool DeltaPerformer::ExtractSignatureMessage() {
   TEST_AND_RETURN_FALSE(signatures_message_data_.empty());
   TEST_AND_RETURN_FALSE(buffer_offset_ == manifest_.signatures_offset());
-  TEST_AND_RETURN_FALSE(buffer_.size() >= manifest_.signatures_size());
+  TEST_AND_RETURN_FALSE(BufferSize() >= manifest_.signatures_size());
   signatures_message_data_.assign(
-      buffer_.begin(), buffer_.begin() + manifest_.signatures_size());
+      BufferData(), BufferData() + manifest_.signatures_size());
 
   // Save the signature blob because if the update is interrupted after the
   // download phase we don't go through this path anymore. Some alternatives to
@@ -1711,7 +3284,10 @@ ErrorCode DeltaPerformer::ValidateManifest() {
 }
 
 ErrorCode DeltaPerformer::ValidateOperationHash(
-    const InstallOperation& operation) {
+    const InstallOperation& operation,
+    const uint8_t* data,
+    size_t operation_num,
+    bool hash_payload_data) {
   if (!operation.data_sha256_hash().size()) {
     if (!operation.data_length()) {
       // Operations that do not have any data blob won't have any operation hash
@@ -1733,15 +3309,15 @@ ErrorCode DeltaPerformer::ValidateOperationHash(
     if (manifest_.signatures_offset() &&
         manifest_.signatures_offset() == operation.data_offset()) {
       LOG(INFO) << "Skipping hash verification for signature operation "
-                << next_operation_num_ + 1;
+                << operation_num + 1;
     } else {
       if (install_plan_->hash_checks_mandatory) {
         LOG(ERROR) << "Missing mandatory operation hash for operation "
-                   << next_operation_num_ + 1;
+                   << operation_num + 1;
         return ErrorCode::kDownloadOperationHashMissingError;
       }
 
-      LOG(WARNING) << "Cannot validate operation " << next_operation_num_ + 1
+      LOG(WARNING) << "Cannot validate operation " << operation_num + 1
                    << " as there's no operation hash in manifest";
     }
     return ErrorCode::kSuccess;
@@ -1752,17 +3328,29 @@ ErrorCode DeltaPerformer::ValidateOperationHash(
                           (operation.data_sha256_hash().data() +
                            operation.data_sha256_hash().size()));
 
-  brillo::Blob calculated_op_hash;
-  if (!HashCalculator::RawHashOfBytes(
-          buffer_.data(), operation.data_length(), &calculated_op_hash)) {
+  // When the data is the next one in the payload, update the payload hashes
+  // in the same pass so it is only read once from memory.
+  HashCalculator op_hash_calculator;
+  vector<HashCalculator*> calculators = {&op_hash_calculator};
+  if (hash_payload_data) {
+    DCHECK_EQ(data, BufferData());
+    DCHECK_EQ(prehashed_buffer_size_, 0u);
+    calculators.push_back(&payload_hash_calculator_);
+    calculators.push_back(&signed_hash_calculator_);
+    prehashed_buffer_size_ = operation.data_length();
+  }
+  if (!HashCalculator::UpdateAll(
+          calculators, data, operation.data_length()) ||
+      !op_hash_calculator.Finalize()) {
     LOG(ERROR) << "Unable to compute actual hash of operation "
-               << next_operation_num_;
+               << operation_num;
     return ErrorCode::kDownloadOperationHashVerificationError;
   }
+  const brillo::Blob& calculated_op_hash = op_hash_calculator.raw_hash();
 
   if (calculated_op_hash != expected_op_hash) {
     LOG(ERROR) << "Hash verification failed for operation "
-               << next_operation_num_ << ". Expected hash = ";
+               << operation_num << ". Expected hash = ";
     utils::HexDumpVector(expected_op_hash);
     LOG(ERROR) << "Calculated hash over " << operation.data_length()
                << " bytes at offset: " << operation.data_offset() << " = ";
@@ -1834,14 +3422,51 @@ void DeltaPerformer::DiscardBuffer(bool do_advance_offset,
                                    size_t signed_hash_buffer_size) {
   // Update the buffer offset.
   if (do_advance_offset)
-    buffer_offset_ += buffer_.size();
+    buffer_offset_ += BufferSize();
 
   // Hash the content.
-  payload_hash_calculator_.Update(buffer_.data(), buffer_.size());
-  signed_hash_calculator_.Update(buffer_.data(), signed_hash_buffer_size);
+  DCHECK_EQ(prehashed_buffer_size_, 0u);
+  HashCalculator::UpdateAll(
+      {&payload_hash_calculator_, &signed_hash_calculator_},
+      BufferData(),
+      signed_hash_buffer_size);
+  payload_hash_calculator_.Update(BufferData() + signed_hash_buffer_size,
+                                  BufferSize() - signed_hash_buffer_size);
 
   // Swap content with an empty vector to ensure that all memory is released.
   brillo::Blob().swap(buffer_);
+  external_data_ = nullptr;
+  external_data_size_ = 0;
+}
+
+void DeltaPerformer::ConsumeBuffer(size_t count) {
+  DCHECK_LE(count, BufferSize());
+  buffer_offset_ += count;
+  // The first |prehashed_buffer_size_| bytes were hashed when the operation
+  // was validated.
+  size_t prehashed_size = min(count, prehashed_buffer_size_);
+  prehashed_buffer_size_ -= prehashed_size;
+  HashCalculator::UpdateAll(
+      {&payload_hash_calculator_, &signed_hash_calculator_},
+      BufferData() + prehashed_size,
+      count - prehashed_size);
+
+  if (external_data_size_) {
+    external_data_ += count;
+    external_data_size_ -= count;
+    if (!external_data_size_)
+      external_data_ = nullptr;
+  } else if (count == buffer_.size()) {
+    // Keep the memory for the next operation unless it is too large, in which
+    // case swap content with an empty vector to ensure that it is released.
+    if (buffer_.capacity() <= kMaxRetainedBufferSize)
+      buffer_.clear();
+    else
+      brillo::Blob().swap(buffer_);
+  } else {
+    buffer_.erase(buffer_.begin(), buffer_.begin() + count);
+  }
+  buffer_memory_.Resize(buffer_.capacity());
 }
 
 bool DeltaPerformer::CanResumeUpdate(PrefsInterface* prefs,
@@ -1870,9 +3495,9 @@ bool DeltaPerformer::CanResumeUpdate(PrefsInterface* prefs,
         next_data_offset >= 0))
     return false;
 
-  string sha256_context;
-  if (!(prefs->GetString(kPrefsUpdateStateSHA256Context, &sha256_context) &&
-        !sha256_context.empty()))
+  string hash_contexts;
+  if (!(prefs->GetString(kPrefsUpdateStateHashContexts, &hash_contexts) &&
+        !hash_contexts.empty()))
     return false;
 
   int64_t manifest_metadata_size = 0;
@@ -1892,39 +3517,139 @@ bool DeltaPerformer::CanResumeUpdate(PrefsInterface* prefs,
 bool DeltaPerformer::ResetUpdateProgress(PrefsInterface* prefs, bool quick) {
   TEST_AND_RETURN_FALSE(prefs->SetInt64(kPrefsUpdateStateNextOperation,
                                         kUpdateStateOperationInvalid));
+  // The partial operation data follows the next data offset, which is about
+  // to change.
+  prefs->Delete(kPrefsUpdateStatePartialDataLength);
   if (!quick) {
     prefs->SetInt64(kPrefsUpdateStateNextDataOffset, -1);
     prefs->SetInt64(kPrefsUpdateStateNextDataLength, 0);
-    prefs->SetString(kPrefsUpdateStateSHA256Context, "");
-    prefs->SetString(kPrefsUpdateStateSignedSHA256Context, "");
+    prefs->Delete(kPrefsUpdateStateHashContexts);
     prefs->SetString(kPrefsUpdateStateSignatureBlob, "");
     prefs->SetInt64(kPrefsManifestMetadataSize, -1);
     prefs->SetInt64(kPrefsManifestSignatureSize, -1);
     prefs->SetInt64(kPrefsResumedUpdateFailures, 0);
     prefs->Delete(kPrefsPostInstallSucceeded);
+    prefs->Delete(kPrefsVerityProgress);
     prefs->Delete(kPrefsVerityWritten);
     prefs->Delete(kPrefsDynamicPartitionMetadataUpdated);
+    prefs->Delete(kPrefsUpdateStateVerifiedSourceBlocks);
   }
   return true;
 }
 
+bool DeltaPerformer::GetPartialOperationDataPath(base::FilePath* path) const {
+  base::FilePath dir;
+  if (!hardware_->GetNonVolatileDirectory(&dir))
+    return false;
+  *path = dir.Append(kPartialOperationDataFileName);
+  return true;
+}
+
+bool DeltaPerformer::SavePartialOperationData() {
+  // The data of the signatures is always downloaded again.
+  if (!manifest_valid_ || next_operation_num_ >= num_total_operations_ ||
+      external_data_size_ || buffer_.size() < kMinPartialOperationDataSize) {
+    return false;
+  }
+  base::FilePath path;
+  if (!GetPartialOperationDataPath(&path))
+    return false;
+
+  // The resumed update starts with this data, so the checkpoint must point
+  // to it.
+  TEST_AND_RETURN_FALSE(CheckpointUpdateProgress(true));
+  TEST_AND_RETURN_FALSE(
+      utils::WriteFile(path.value().c_str(), buffer_.data(), buffer_.size()));
+  brillo::Blob hash;
+  TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfData(buffer_, &hash));
+  TEST_AND_RETURN_FALSE(prefs_->SetString(
+      kPrefsUpdateStatePartialDataHash,
+      base::HexEncode(hash.data(), hash.size())));
+  TEST_AND_RETURN_FALSE(
+      prefs_->SetInt64(kPrefsUpdateStatePartialDataLength, buffer_.size()));
+  LOG(INFO) << "Saved " << buffer_.size() << " bytes of the next operations "
+            << "at data offset " << buffer_offset_ << " to " << path.value();
+  return true;
+}
+
+bool DeltaPerformer::LoadPartialOperationData(uint64_t length) {
+  base::FilePath path;
+  TEST_AND_RETURN_FALSE(GetPartialOperationDataPath(&path));
+  brillo::Blob data;
+  bool loaded = utils::ReadFile(path.value(), &data);
+  base::DeleteFile(path, false);
+  TEST_AND_RETURN_FALSE(loaded && data.size() == length);
+
+  brillo::Blob hash;
+  string expected_hash;
+  TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfData(data, &hash));
+  TEST_AND_RETURN_FALSE(
+      prefs_->GetString(kPrefsUpdateStatePartialDataHash, &expected_hash) &&
+      base::HexEncode(hash.data(), hash.size()) == expected_hash);
+  buffer_.swap(data);
+  LOG(INFO) << "Loaded " << length << " bytes of the next operations from "
+            << path.value();
+  return true;
+}
+
+uint64_t DeltaPerformer::GetPartialOperationDataLength(PrefsInterface* prefs) {
+  int64_t length = 0;
+  if (!prefs->GetInt64(kPrefsUpdateStatePartialDataLength, &length) ||
+      length < 0) {
+    return 0;
+  }
+  return length;
+}
+
+void DeltaPerformer::RecordOperationStats(const InstallOperation& operation,
+                                          base::TimeDelta duration) {
+  OperationStats* stats = &operation_stats_[operation.type()];
+  stats->count++;
+  stats->duration += duration;
+  stats->bytes_read +=
+      utils::BlocksInExtents(operation.src_extents()) * block_size_;
+  stats->bytes_written +=
+      utils::BlocksInExtents(operation.dst_extents()) * block_size_;
+  stats->bytes_downloaded += operation.data_length();
+}
+
 bool DeltaPerformer::CheckpointUpdateProgress(bool force) {
   base::TimeTicks curr_time = base::TimeTicks::Now();
-  if (force || curr_time > update_checkpoint_time_) {
-    update_checkpoint_time_ = curr_time + update_checkpoint_wait_;
-  } else {
+  if (!force && curr_time <= update_checkpoint_time_)
     return false;
-  }
+  UE_TRACE_SCOPE("CheckpointUpdateProgress");
 
   Terminator::set_exit_blocked(true);
+  // A single transaction persists all the keys of the checkpoint at once. It is
+  // committed even if a key failed, the same way the keys set before the
+  // failure would have been persisted without it.
+  PrefsInterface::Transaction transaction(prefs_);
+  bool success = WriteUpdateProgress();
+  bool committed = transaction.Commit();
+  update_checkpoint_time_ =
+      curr_time + GetCheckpointInterval(base::TimeTicks::Now() - curr_time);
+  TEST_AND_RETURN_FALSE(committed);
+  return success;
+}
+
+base::TimeDelta DeltaPerformer::GetCheckpointInterval(
+    base::TimeDelta checkpoint_duration) {
+  return std::min(
+      std::max(checkpoint_duration * kCheckpointCostRatio,
+               base::TimeDelta::FromMilliseconds(kCheckpointMinIntervalMs)),
+      base::TimeDelta::FromSeconds(kCheckpointMaxIntervalSeconds));
+}
+
+bool DeltaPerformer::WriteUpdateProgress() {
   if (last_updated_buffer_offset_ != buffer_offset_) {
     // Resets the progress in case we die in the middle of the state update.
     ResetUpdateProgress(prefs_, true);
-    TEST_AND_RETURN_FALSE(prefs_->SetString(
-        kPrefsUpdateStateSHA256Context, payload_hash_calculator_.GetContext()));
+    // Both hash contexts are written in a single record.
     TEST_AND_RETURN_FALSE(
-        prefs_->SetString(kPrefsUpdateStateSignedSHA256Context,
-                          signed_hash_calculator_.GetContext()));
+        prefs_->SetString(kPrefsUpdateStateHashContexts,
+                          GetHashContexts(payload_hash_calculator_,
+                                          signed_hash_calculator_,
+                                          buffer_offset_)));
     TEST_AND_RETURN_FALSE(
         prefs_->SetInt64(kPrefsUpdateStateNextDataOffset, buffer_offset_));
     last_updated_buffer_offset_ = buffer_offset_;
@@ -1936,6 +3661,7 @@ bool DeltaPerformer::CheckpointUpdateProgress(bool force) {
       const size_t partition_operation_num =
           next_operation_num_ -
           (partition_index ? acc_num_operations_[partition_index - 1] : 0);
+      TEST_AND_RETURN_FALSE(LoadPartitionOperations(partition_index));
       const InstallOperation& op =
           partitions_[partition_index].operations(partition_operation_num);
       TEST_AND_RETURN_FALSE(
@@ -1945,6 +3671,14 @@ bool DeltaPerformer::CheckpointUpdateProgress(bool force) {
           prefs_->SetInt64(kPrefsUpdateStateNextDataLength, 0));
     }
   }
+  if (verified_source_blocks_changed_ &&
+      current_partition_ < partitions_.size()) {
+    TEST_AND_RETURN_FALSE(prefs_->SetString(
+        kPrefsUpdateStateVerifiedSourceBlocks,
+        partitions_[current_partition_].partition_name() + " " +
+            verified_source_blocks_.ToString()));
+    verified_source_blocks_changed_ = false;
+  }
   TEST_AND_RETURN_FALSE(
       prefs_->SetInt64(kPrefsUpdateStateNextOperation, next_operation_num_));
   return true;
@@ -1968,21 +3702,17 @@ bool DeltaPerformer::PrimeUpdateState() {
       next_data_offset >= 0);
   buffer_offset_ = next_data_offset;
 
-  // The signed hash context and the signature blob may be empty if the
-  // interrupted update didn't reach the signature.
-  string signed_hash_context;
-  if (prefs_->GetString(kPrefsUpdateStateSignedSHA256Context,
-                        &signed_hash_context)) {
-    TEST_AND_RETURN_FALSE(
-        signed_hash_calculator_.SetContext(signed_hash_context));
-  }
-
-  prefs_->GetString(kPrefsUpdateStateSignatureBlob, &signatures_message_data_);
-
-  string hash_context;
+  string hash_contexts;
   TEST_AND_RETURN_FALSE(
-      prefs_->GetString(kPrefsUpdateStateSHA256Context, &hash_context) &&
-      payload_hash_calculator_.SetContext(hash_context));
+      prefs_->GetString(kPrefsUpdateStateHashContexts, &hash_contexts) &&
+      SetHashContexts(hash_contexts,
+                      next_data_offset,
+                      &payload_hash_calculator_,
+                      &signed_hash_calculator_));
+
+  // The signature blob may be empty if the interrupted update didn't reach the
+  // signature.
+  prefs_->GetString(kPrefsUpdateStateSignatureBlob, &signatures_message_data_);
 
   int64_t manifest_metadata_size = 0;
   TEST_AND_RETURN_FALSE(
@@ -1996,9 +3726,18 @@ bool DeltaPerformer::PrimeUpdateState() {
       manifest_signature_size >= 0);
   metadata_signature_size_ = manifest_signature_size;
 
+  // The saved data is only used once, it is saved again if this attempt is
+  // interrupted too. If it can't be loaded the update fails and the next
+  // attempt resumes without it.
+  uint64_t partial_data_length = GetPartialOperationDataLength(prefs_);
+  if (partial_data_length > 0) {
+    prefs_->Delete(kPrefsUpdateStatePartialDataLength);
+    TEST_AND_RETURN_FALSE(LoadPartialOperationData(partial_data_length));
+  }
+
   // Advance the download progress to reflect what doesn't need to be
   // re-downloaded.
-  total_bytes_received_ += buffer_offset_;
+  total_bytes_received_ += buffer_offset_ + buffer_.size();
 
   // Speculatively count the resume as a failure.
   int64_t resumed_update_failures;
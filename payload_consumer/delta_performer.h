@@ -20,6 +20,8 @@
 #include <inttypes.h>
 
 #include <limits>
+#include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -28,12 +30,17 @@
 #include <google/protobuf/repeated_field.h>
 #include <gtest/gtest_prod.h>  // for FRIEND_TEST
 
+#include "update_engine/common/cancellation_token.h"
 #include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/memory_stats.h"
 #include "update_engine/common/platform_constants.h"
+#include "update_engine/payload_consumer/block_ranges.h"
 #include "update_engine/payload_consumer/file_descriptor.h"
 #include "update_engine/payload_consumer/file_writer.h"
 #include "update_engine/payload_consumer/install_plan.h"
+#include "update_engine/payload_consumer/partition_write_hasher.h"
 #include "update_engine/payload_consumer/payload_metadata.h"
+#include "update_engine/payload_consumer/source_data_cache.h"
 #include "update_engine/update_metadata.pb.h"
 
 namespace chromeos_update_engine {
@@ -60,7 +67,20 @@ class DeltaPerformer : public FileWriter {
   // operations. They must add up to one hundred (100).
   static const unsigned kProgressDownloadWeight;
   static const unsigned kProgressOperationsWeight;
-  static const uint64_t kCheckpointFrequencySeconds;
+  // The interval between the starts of two non-forced checkpoints is
+  // kCheckpointCostRatio times the time the first one took to write, so that
+  // the checkpoints take at most 1% of the update time. It is clamped between
+  // kCheckpointMinIntervalMs and kCheckpointMaxIntervalSeconds, which bounds
+  // the work redone after an interruption.
+  static const int64_t kCheckpointCostRatio;
+  static const int64_t kCheckpointMinIntervalMs;
+  static const int64_t kCheckpointMaxIntervalSeconds;
+
+  // The range of the number of operations, starting at the next one, whose
+  // source extents are prefetched so they are read while the previous
+  // operations are applied.
+  static const size_t kMinPrefetchOperations;
+  static const size_t kMaxPrefetchOperations;
 
   DeltaPerformer(PrefsInterface* prefs,
                  BootControlInterface* boot_control,
@@ -89,7 +109,10 @@ class DeltaPerformer : public FileWriter {
   bool Write(const void* bytes, size_t count, ErrorCode* error) override;
 
   // Wrapper around close. Returns 0 on success or -errno on error.
-  // Closes both 'path' given to Open() and the kernel path.
+  // Closes both 'path' given to Open() and the kernel path. If all the Write()
+  // calls succeeded, the data received for the next operations is saved so a
+  // resumed update doesn't download it again, see
+  // GetPartialOperationDataLength().
   int Close() override;
 
   // Open the target and source (if delta payload) file descriptors for the
@@ -101,13 +124,32 @@ class DeltaPerformer : public FileWriter {
   // Returns whether the operation succeeded.
   bool OpenCurrentECCPartition();
 
+  // Loads the |verified_source_blocks_| of the partition |partition_name|
+  // saved by a previous checkpoint, if any.
+  void LoadVerifiedSourceBlocks(const std::string& partition_name);
+
   // Closes the current partition file descriptors if open. Returns 0 on success
   // or -errno on error.
   int CloseCurrentPartition();
 
+  // Finishes |partition_hasher_| once all the operations of the current
+  // partition were applied and records in the install plan whether the
+  // target hash matched. Called after the target file descriptors are closed.
+  void FinishPartitionHash();
+
   // Returns |true| only if the manifest has been processed and it's valid.
   bool IsManifestValid();
 
+  // Stops or pauses the SOURCE_BSDIFF, BROTLI_BSDIFF, ZSTD_BSDIFF and PUFFDIFF
+  // operations being applied from another thread, such as the staging thread
+  // or the threads applying a parallel batch. A cancelled operation fails
+  // before it is checkpointed, so it is applied again when the update is
+  // resumed. Once cancelled, all the following diff operations fail.
+  // PauseApply() must not be called from the thread applying the operations.
+  void CancelApply() { apply_token_.Cancel(); }
+  void PauseApply() { apply_token_.Pause(); }
+  void ResumeApply() { apply_token_.Resume(); }
+
   // Verifies the downloaded payload against the signed hash included in the
   // payload, against the update check hash and size using the public key and
   // returns ErrorCode::kSuccess on success, an error code on failure.
@@ -144,6 +186,11 @@ class DeltaPerformer : public FileWriter {
   // success, false otherwise.
   static bool ResetUpdateProgress(PrefsInterface* prefs, bool quick);
 
+  // Returns the number of bytes following the resume data offset that were
+  // saved when the previous update attempt was interrupted, and thus don't
+  // need to be downloaded again when resuming it.
+  static uint64_t GetPartialOperationDataLength(PrefsInterface* prefs);
+
   // Attempts to parse the update metadata starting from the beginning of
   // |payload|. On success, returns kMetadataParseSuccess. Returns
   // kMetadataParseInsufficientData if more data is needed to parse the complete
@@ -171,13 +218,52 @@ class DeltaPerformer : public FileWriter {
                                  const FileDescriptorPtr source_fd,
                                  ErrorCode* error);
 
+  // The statistics of the operations of a given type applied so far. The
+  // bytes read and written are the size of the source and destination
+  // extents, and the bytes downloaded the size of the operation data.
+  struct OperationStats {
+    size_t count{0};
+    base::TimeDelta duration;
+    uint64_t bytes_read{0};
+    uint64_t bytes_written{0};
+    uint64_t bytes_downloaded{0};
+  };
+
+  // Returns the statistics of the operations applied from this payload, by
+  // operation type. The operations applied concurrently add the time each of
+  // them took, so their duration may be longer than the time spent applying
+  // them.
+  const std::map<InstallOperation::Type, OperationStats>& operation_stats()
+      const {
+    return operation_stats_;
+  }
+
  private:
   friend class DeltaPerformerTest;
   friend class DeltaPerformerIntegrationTest;
   FRIEND_TEST(DeltaPerformerTest, BrilloMetadataSignatureSizeTest);
   FRIEND_TEST(DeltaPerformerTest, BrilloParsePayloadMetadataTest);
   FRIEND_TEST(DeltaPerformerTest, ChooseSourceFDTest);
+  FRIEND_TEST(DeltaPerformerTest, ChooseSourceFDSkipsVerifiedBlocksTest);
+  FRIEND_TEST(DeltaPerformerTest, CheckpointIntervalTest);
   FRIEND_TEST(DeltaPerformerTest, UsePublicKeyFromResponse);
+  FRIEND_TEST(DeltaPerformerTest, FullPayloadDefaultApplyThreadsTest);
+  FRIEND_TEST(DeltaPerformerTest, ParallelWindowTest);
+  FRIEND_TEST(DeltaPerformerTest, ParallelWindowApplyMemoryTest);
+  FRIEND_TEST(DeltaPerformerTest, PartialOperationDataTest);
+  FRIEND_TEST(DeltaPerformerTest, PrefetchNextPartitionTest);
+  FRIEND_TEST(DeltaPerformerTest, PrefetchSourceExtentsTest);
+  FRIEND_TEST(DeltaPerformerTest, PrefetchWindowTest);
+  FRIEND_TEST(DeltaPerformerTest, SourceCopyRunTest);
+  FRIEND_TEST(DeltaPerformerTest, ZeroOrDiscardRunTest);
+  FRIEND_TEST(DeltaPerformerTest, ReadOperationDataTest);
+
+  // Applies a subset of the operations of a parallel batch using its own set
+  // of file descriptors. Defined in the .cc file.
+  class ParallelApplyWorker;
+
+  // The implementation of Write(), which records whether it failed.
+  bool WriteData(const void* bytes, size_t count, ErrorCode* error);
 
   // Parse and move the update instructions of all partitions into our local
   // |partitions_| variable based on the version of the payload. Requires the
@@ -190,6 +276,97 @@ class DeltaPerformer : public FileWriter {
   // and returns this number.
   size_t CopyDataToBuffer(const char** bytes_p, size_t* count_p, size_t max);
 
+  // Same as CopyDataToBuffer() but, if there's no buffered data and the |max|
+  // bytes needed by the next operations are all in |*bytes_p|, uses them in
+  // place instead of copying them to |buffer_|. This data is only used until
+  // the current Write() call returns.
+  size_t ReadOperationData(const char** bytes_p, size_t* count_p, size_t max);
+
+  // Returns the unconsumed data starting at |buffer_offset_|, either in
+  // |buffer_| or in the data being used in place.
+  const uint8_t* BufferData() const {
+    return external_data_size_ ? external_data_ : buffer_.data();
+  }
+  size_t BufferSize() const {
+    return external_data_size_ ? external_data_size_ : buffer_.size();
+  }
+
+  // Returns the number of operations, starting at |next_operation_num_|, that
+  // can be applied concurrently: they all belong to the current partition,
+  // their blobs are contiguous in the payload and their |dst_extents| don't
+  // overlap. Stores in |data_length| the total size of their blobs. Returns 0
+  // when the parallel mode is disabled or the next operation must be applied
+  // serially.
+  size_t GetParallelWindow(uint64_t* data_length);
+
+  // Applies the next |num_operations| operations on the worker threads and
+  // then, in manifest order, consumes their data and checkpoints the progress
+  // as if they were applied serially. Stops at the first operation that needs
+  // to be retried serially (for example on a source hash mismatch, to use the
+  // error corrected device). Returns false and sets |error| on failure.
+  bool PerformOperationsInParallel(size_t num_operations, ErrorCode* error);
+
+  // Returns the number of SOURCE_COPY operations, starting at
+  // |next_operation_num_|, that can be copied at once: they all belong to the
+  // current partition, have a source hash, and each one reads and writes the
+  // blocks right after the ones of the previous operation. Returns 0 when the
+  // next operation must be applied on its own.
+  size_t GetSourceCopyRun();
+
+  // Copies the source blocks of the next |num_operations| SOURCE_COPY
+  // operations, as returned by GetSourceCopyRun(), with a single read and
+  // write of their merged extents. The operations starting at the first one
+  // that fails its source hash check are left to be retried serially. Returns
+  // false and sets |error| on failure.
+  bool PerformSourceCopyRun(size_t num_operations, ErrorCode* error);
+
+  // Returns the number of ZERO or DISCARD operations, starting at
+  // |next_operation_num_|, that can be applied at once: they all belong to the
+  // current partition, are of the same type and zero or discard at most
+  // kMaxZeroOrDiscardRunSize bytes together. Returns 0 when the next operation
+  // must be applied on its own.
+  size_t GetZeroOrDiscardRun();
+
+  // Applies the next |num_operations| ZERO or DISCARD operations, as returned
+  // by GetZeroOrDiscardRun(), with one ioctl per range of their merged
+  // extents. Returns false and sets |error| on failure.
+  bool PerformZeroOrDiscardRun(size_t num_operations, ErrorCode* error);
+
+  // Returns whether the ioctl of the ZERO or DISCARD operation |type| may
+  // still work on the current target partition.
+  bool* GetZeroOrDiscardIoctlSupport(InstallOperation::Type type);
+
+  // Prefetches the source extents of the next operations in the current
+  // partition, starting at |next_operation_num_|, so they are read from the
+  // storage while the operations before them are applied. The operations
+  // before |next_prefetch_operation_num_| were already prefetched. Near the
+  // end of the partition, the next one is prefetched as well.
+  void PrefetchSourceExtents();
+
+  // Opens the source of the next partition with operations ahead of time in
+  // |next_source_fd_| and prefetches the source extents of its first
+  // operations, so switching to it doesn't wait for them.
+  void PrefetchNextPartition();
+
+  // Parses the operations of the partition |partition_index| from
+  // |serialized_partitions_| and unpacks their extents, which is only done
+  // when the update gets to it. The operations of the partitions before the
+  // current one are released. Returns false if they aren't valid.
+  bool LoadPartitionOperations(size_t partition_index);
+
+  // Adapts |prefetch_window_| to a source read of |bytes| that took
+  // |read_time|, growing it when the read had to wait for the storage.
+  void UpdatePrefetchWindow(base::TimeDelta read_time, uint64_t bytes);
+
+  // Prefetches the source extents of |op| from |fd|. Returns false if they
+  // couldn't be prefetched.
+  bool PrefetchOperationSource(const FileDescriptorPtr& fd,
+                               const InstallOperation& op);
+
+  // Makes sure |worker_fds_| has at least |num_workers| entries opened on
+  // |source_path_| and |target_path_|. Returns whether they were opened.
+  bool OpenWorkerFileDescriptors(size_t num_workers);
+
   // If |op_result| is false, emits an error message using |op_type_name| and
   // sets |*error| accordingly. Otherwise does nothing. Returns |op_result|.
   bool HandleOpResult(bool op_result,
@@ -210,10 +387,17 @@ class DeltaPerformer : public FileWriter {
   // false otherwise.
   ErrorCode ValidateManifest();
 
-  // Validates that the hash of the blobs corresponding to the given |operation|
-  // matches what's specified in the manifest in the payload.
+  // Validates that the hash of the blob |data| of the given |operation|, the
+  // |operation_num|-th operation of the payload, matches what's specified in
+  // the manifest in the payload.
+  // If |hash_payload_data|, |data| must be BufferData() and the payload hash
+  // calculators are updated with it in the same pass, so ConsumeBuffer()
+  // doesn't hash it again.
   // Returns ErrorCode::kSuccess on match or a suitable error code otherwise.
-  ErrorCode ValidateOperationHash(const InstallOperation& operation);
+  ErrorCode ValidateOperationHash(const InstallOperation& operation,
+                                  const uint8_t* data,
+                                  size_t operation_num,
+                                  bool hash_payload_data);
 
   // Returns true on success.
   bool PerformInstallOperation(const InstallOperation& operation);
@@ -232,6 +416,54 @@ class DeltaPerformer : public FileWriter {
   bool PerformPuffDiffOperation(const InstallOperation& operation,
                                 ErrorCode* error);
 
+  // These apply a specific type of operation reading the blob from |data|, the
+  // source from |source_fd| and writing to |target_fd|. They don't use any
+  // other DeltaPerformer state, so the parallel workers can call them as long
+  // as each one uses its own file descriptors. A REPLACE zeroes its runs of
+  // zeros with an ioctl when |zero_ioctl_supported| points to true.
+  static bool ApplyReplaceOperation(const InstallOperation& operation,
+                                    const uint8_t* data,
+                                    const FileDescriptorPtr& target_fd,
+                                    uint32_t block_size,
+                                    bool* zero_ioctl_supported = nullptr);
+  static bool ApplyZeroOrDiscardOperation(const InstallOperation& operation,
+                                          const FileDescriptorPtr& target_fd,
+                                          uint32_t block_size);
+
+  // Zeroes or discards the |extents| of |target_fd|, as the ZERO or DISCARD
+  // operation |type|, with the matching ioctl when |*use_ioctl| and by writing
+  // zeros otherwise. |*use_ioctl| is cleared when the ioctl fails, so that the
+  // following calls for the same device don't try it again.
+  static bool ZeroOrDiscardExtents(
+      InstallOperation::Type type,
+      const google::protobuf::RepeatedPtrField<Extent>& extents,
+      const FileDescriptorPtr& target_fd,
+      uint32_t block_size,
+      bool* use_ioctl);
+  // The ZSTD_BSDIFF patches are applied with up to |num_threads| threads.
+  // The data is only held in memory when it fits in |max_memory_size| bytes,
+  // otherwise it is streamed from and to the partitions. The data is read and
+  // written in chunks checking |token|, if not null, in between.
+  static bool ApplySourceBsdiffOperation(const InstallOperation& operation,
+                                         const uint8_t* data,
+                                         const FileDescriptorPtr& source_fd,
+                                         const FileDescriptorPtr& target_fd,
+                                         uint32_t block_size,
+                                         size_t num_threads,
+                                         uint64_t max_memory_size,
+                                         CancellationToken* token);
+  // The source data of the PUFFDIFF operations is kept in |source_cache|, if
+  // not null and the data fits in |max_memory_size| bytes, for the next
+  // operations reading the same data.
+  static bool ApplyPuffDiffOperation(const InstallOperation& operation,
+                                     const uint8_t* data,
+                                     const FileDescriptorPtr& source_fd,
+                                     const FileDescriptorPtr& target_fd,
+                                     uint32_t block_size,
+                                     SourceDataCache* source_cache,
+                                     uint64_t max_memory_size,
+                                     CancellationToken* token);
+
   // For a given operation, choose the source fd to be used (raw device or error
   // correction device) based on the source operation hash.
   // Returns nullptr if the source hash mismatch cannot be corrected, and set
@@ -244,28 +476,60 @@ class DeltaPerformer : public FileWriter {
   // signature was extracted.
   bool ExtractSignatureMessageFromOperation(const InstallOperation& operation);
 
-  // Extracts the payload signature message from the current |buffer_| if the
-  // offset matches the one specified by the manifest. Returns whether the
+  // Extracts the payload signature message from the current BufferData() if
+  // the offset matches the one specified by the manifest. Returns whether the
   // signature was extracted.
   bool ExtractSignatureMessage();
 
-  // Updates the payload hash calculator with the bytes in |buffer_|, also
-  // updates the signed hash calculator with the first |signed_hash_buffer_size|
-  // bytes in |buffer_|. Then discard the content, ensuring that memory is being
-  // deallocated. If |do_advance_offset|, advances the internal offset counter
-  // accordingly.
+  // Updates the payload hash calculator with the bytes in BufferData(), also
+  // updates the signed hash calculator with the first
+  // |signed_hash_buffer_size| bytes in it. Then discard the content, ensuring
+  // that memory is being deallocated. If |do_advance_offset|, advances the
+  // internal offset counter accordingly.
   void DiscardBuffer(bool do_advance_offset, size_t signed_hash_buffer_size);
 
+  // Updates both hash calculators with the first |count| bytes in
+  // BufferData(), advances the internal offset counter and removes them from
+  // the buffered data, keeping any data already received for the following
+  // operations.
+  void ConsumeBuffer(size_t count);
+
+  // Adds the successfully applied |operation|, which took |duration|, to the
+  // |operation_stats_|.
+  void RecordOperationStats(const InstallOperation& operation,
+                            base::TimeDelta duration);
+
   // Checkpoints the update progress into persistent storage to allow this
   // update attempt to be resumed after reboot.
   // If |force| is false, checkpoint may be throttled.
   bool CheckpointUpdateProgress(bool force);
 
+  // Writes the update progress checkpointed by CheckpointUpdateProgress() to
+  // the prefs, within the transaction of the checkpoint.
+  bool WriteUpdateProgress();
+
+  // Returns the interval after the start of a checkpoint that took
+  // |checkpoint_duration| to write until the next non-forced one. The time
+  // since a checkpoint accounts for both the data downloaded and the
+  // operations applied since then, so this weighs the work redone after an
+  // interruption against the cost of checkpointing.
+  static base::TimeDelta GetCheckpointInterval(
+      base::TimeDelta checkpoint_duration);
+
   // Primes the required update state. Returns true if the update state was
   // successfully initialized to a saved resume state or if the update is a new
   // update. Returns false otherwise.
   bool PrimeUpdateState();
 
+  // Saves the data received for the next operations and checkpoints the
+  // update progress at its start, or loads the data saved by the interrupted
+  // update being resumed into |buffer_|. Return whether they succeeded.
+  bool SavePartialOperationData();
+  bool LoadPartialOperationData(uint64_t length);
+
+  // Returns the path of the file the partial operation data is saved to.
+  bool GetPartialOperationDataPath(base::FilePath* path) const;
+
   // Get the public key to be used to verify metadata signature or payload
   // signature. Always use |public_key_path_| if exists, otherwise if the Omaha
   // response contains a public RSA key and we're allowed to use it (e.g. if
@@ -314,10 +578,72 @@ class DeltaPerformer : public FileWriter {
   // error corrected.
   bool source_ecc_open_failure_{false};
 
+  // The blocks of |source_fd_| whose hash already matched in an operation,
+  // whose later operations don't hash them again, since the source partition
+  // doesn't change. Saved with the checkpoints when changed.
+  BlockRanges verified_source_blocks_;
+  bool verified_source_blocks_changed_{false};
+
   // File descriptor of the target partition. Only set while performing the
   // operations of a given partition.
   FileDescriptorPtr target_fd_{nullptr};
 
+  // The maximum number of threads used to apply operations concurrently, as
+  // reported by the HardwareInterface once the manifest is parsed. When 1,
+  // all the operations are applied serially from Write().
+  size_t max_apply_threads_{1};
+
+  // Whether the independent operations whose data was received are applied
+  // in parallel windows started in the order of their target blocks, even
+  // with a single thread. Only set for the delta payloads without in-place
+  // operations, when enabled by the HardwareInterface.
+  bool destination_order_{false};
+
+  // The maximum memory in bytes used to apply the operations, as reported by
+  // the HardwareInterface once the manifest is parsed. It bounds the
+  // |apply_memory_size| of a parallel window and the data any operation keeps
+  // in memory; the bigger operations are streamed from the partitions.
+  uint64_t max_apply_memory_size_{0};
+
+  // The file descriptors used by each parallel apply worker. A FileDescriptor
+  // keeps its own offset so they can't be shared across threads. Only set
+  // while performing the operations of a given partition.
+  struct WorkerFileDescriptors {
+    FileDescriptorPtr source_fd;
+    FileDescriptorPtr target_fd;
+  };
+  std::vector<WorkerFileDescriptors> worker_fds_;
+
+  // Hashes the data written to the current target partition through
+  // |target_fd_| and |worker_fds_|, when enabled by the HardwareInterface.
+  // Only set while performing the operations of a partition that started
+  // from its first operation.
+  std::unique_ptr<PartitionWriteHasher> partition_hasher_;
+
+  // The source data of the last PUFFDIFF operations of the current partition.
+  // Several APKs are often diffed against the same old APK, whose deflate
+  // streams are then only read once. Sized from |max_apply_memory_size_| once
+  // the manifest is parsed.
+  std::unique_ptr<SourceDataCache> puffdiff_source_cache_;
+
+  // Checked while the diff operations are applied, see CancelApply().
+  CancellationToken apply_token_;
+
+  // The operation number that a parallel batch or a SOURCE_COPY run asked to
+  // retry serially, which should not be part of the next window or run.
+  size_t serial_retry_operation_num_{std::numeric_limits<size_t>::max()};
+
+  // Whether the BLKZEROOUT and BLKDISCARD ioctls may work on |target_fd_|.
+  // Each one is cleared the first time it fails on the current partition.
+  bool zero_ioctl_supported_{true};
+  bool discard_ioctl_supported_{true};
+
+  // The source of the partition |next_source_partition_|, opened while the
+  // previous partition is still being updated. Used as |source_fd_| once the
+  // update gets to it.
+  FileDescriptorPtr next_source_fd_;
+  size_t next_source_partition_{std::numeric_limits<size_t>::max()};
+
   // Paths the |source_fd_| and |target_fd_| refer to.
   std::string source_path_;
   std::string target_path_;
@@ -329,6 +655,9 @@ class DeltaPerformer : public FileWriter {
   DeltaArchiveManifest manifest_;
   bool manifest_parsed_{false};
   bool manifest_valid_{false};
+  // Whether a Write() call failed, in which case the buffered data isn't
+  // saved on Close().
+  bool write_failed_{false};
   uint64_t metadata_size_{0};
   uint32_t metadata_signature_size_{0};
   uint64_t major_payload_version_{0};
@@ -347,6 +676,10 @@ class DeltaPerformer : public FileWriter {
   // this format instead.
   std::vector<PartitionUpdate> partitions_;
 
+  // The serialized partitions of a major version 2 manifest. The partitions
+  // in |partitions_| only get their operations from them when needed.
+  std::vector<SerializedPartitionUpdate> serialized_partitions_;
+
   // Index in the list of partitions (|partitions_| member) of the current
   // partition being processed.
   size_t current_partition_{0};
@@ -355,6 +688,19 @@ class DeltaPerformer : public FileWriter {
   // on the total number of operation on the manifest.
   size_t next_operation_num_{0};
 
+  // Index of the next operation, in the same linear order, whose source
+  // extents weren't prefetched yet.
+  size_t next_prefetch_operation_num_{0};
+
+  // The number of operations whose source extents are prefetched ahead, and
+  // the number of source reads since it last changed that didn't wait for
+  // the storage.
+  size_t prefetch_window_{kMinPrefetchOperations};
+  size_t prefetch_fast_reads_{0};
+
+  // The statistics of the operations applied so far, by operation type.
+  std::map<InstallOperation::Type, OperationStats> operation_stats_;
+
   // A buffer used for accumulating downloaded data. Initially, it stores the
   // payload metadata; once that's downloaded and parsed, it stores data for the
   // next update operation.
@@ -362,6 +708,16 @@ class DeltaPerformer : public FileWriter {
   // Offset of buffer_ in the binary blobs section of the update.
   uint64_t buffer_offset_{0};
 
+  // The unconsumed part of the data passed to Write() that is being used in
+  // place of |buffer_| by ReadOperationData(). |buffer_| is always empty while
+  // |external_data_size_| is not 0.
+  const uint8_t* external_data_{nullptr};
+  size_t external_data_size_{0};
+
+  // The memory of |buffer_| and of the manifest, for the memory accounting.
+  ScopedMemoryTracker buffer_memory_{MemoryCategory::kDownloadBuffer};
+  ScopedMemoryTracker manifest_memory_{MemoryCategory::kManifest};
+
   // Last |buffer_offset_| value updated as part of the progress update.
   uint64_t last_updated_buffer_offset_{std::numeric_limits<uint64_t>::max()};
 
@@ -376,6 +732,10 @@ class DeltaPerformer : public FileWriter {
   // the metadata and doesn't include the payload signature itself.
   HashCalculator signed_hash_calculator_;
 
+  // The number of bytes at the beginning of BufferData() that were already
+  // added to both hash calculators by ValidateOperationHash().
+  size_t prehashed_buffer_size_{0};
+
   // Signatures message blob extracted directly from the payload.
   std::string signatures_message_data_;
 
@@ -402,10 +762,8 @@ class DeltaPerformer : public FileWriter {
       base::TimeDelta::FromSeconds(kProgressLogTimeoutSeconds)};
   base::TimeTicks forced_progress_log_time_;
 
-  // The frequency that we should write an update checkpoint (constant), and
-  // the point in time at which the next checkpoint should be written.
-  const base::TimeDelta update_checkpoint_wait_{
-      base::TimeDelta::FromSeconds(kCheckpointFrequencySeconds)};
+  // The point in time at which the next non-forced checkpoint should be
+  // written, as computed by GetCheckpointInterval().
   base::TimeTicks update_checkpoint_time_;
 
   DISALLOW_COPY_AND_ASSIGN(DeltaPerformer);
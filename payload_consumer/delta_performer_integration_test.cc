@@ -682,9 +682,7 @@ static void ApplyDeltaFile(bool full_kernel,
       .WillRepeatedly(Return(true));
   EXPECT_CALL(prefs, SetInt64(kPrefsUpdateStateNextDataLength, _))
       .WillRepeatedly(Return(true));
-  EXPECT_CALL(prefs, SetString(kPrefsUpdateStateSHA256Context, _))
-      .WillRepeatedly(Return(true));
-  EXPECT_CALL(prefs, SetString(kPrefsUpdateStateSignedSHA256Context, _))
+  EXPECT_CALL(prefs, SetString(kPrefsUpdateStateHashContexts, _))
       .WillRepeatedly(Return(true));
   EXPECT_CALL(prefs, SetBoolean(kPrefsDynamicPartitionMetadataUpdated, _))
       .WillRepeatedly(Return(true));
@@ -732,11 +730,14 @@ static void ApplyDeltaFile(bool full_kernel,
   EXPECT_TRUE(utils::FileExists(public_key_path.c_str()));
   (*performer)->set_public_key_path(public_key_path);
 
+  brillo::Blob source_hash;
   EXPECT_EQ(static_cast<off_t>(state->image_size),
             HashCalculator::RawHashOfFile(
-                state->a_img, state->image_size, &root_part.source_hash));
-  EXPECT_TRUE(HashCalculator::RawHashOfData(state->old_kernel_data,
-                                            &kernel_part.source_hash));
+                state->a_img, state->image_size, &source_hash));
+  root_part.source_hash = source_hash;
+  EXPECT_TRUE(
+      HashCalculator::RawHashOfData(state->old_kernel_data, &source_hash));
+  kernel_part.source_hash = source_hash;
 
   // The partitions should be empty before DeltaPerformer.
   install_plan->partitions.clear();
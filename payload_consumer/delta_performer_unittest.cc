@@ -20,6 +20,7 @@
 #include <inttypes.h>
 #include <time.h>
 
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <vector>
@@ -30,6 +31,8 @@
 #include <base/strings/string_number_conversions.h>
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
+#include <base/sys_info.h>
+#include <bsdiff/bsdiff.h>
 #include <gmock/gmock.h>
 #include <google/protobuf/repeated_field.h>
 #include <gtest/gtest.h>
@@ -43,10 +46,14 @@
 #include "update_engine/payload_consumer/fake_file_descriptor.h"
 #include "update_engine/payload_consumer/mock_download_action.h"
 #include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_consumer/payload_metadata.h"
 #include "update_engine/payload_generator/bzip.h"
 #include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/lz4.h"
 #include "update_engine/payload_generator/payload_file.h"
 #include "update_engine/payload_generator/payload_signer.h"
+#include "update_engine/payload_generator/zstd.h"
+#include "update_engine/payload_generator/zstd_bsdiff_patch_writer.h"
 #include "update_engine/update_metadata.pb.h"
 
 namespace chromeos_update_engine {
@@ -292,8 +299,16 @@ class DeltaPerformerTest : public ::testing::Test {
     fake_boot_control_.SetPartitionDevice(
         kPartitionNameKernel, install_plan_.source_slot, "/dev/null");
 
-    EXPECT_EQ(expect_success,
-              performer_.Write(payload_data.data(), payload_data.size()));
+    // Pass the payload in chunks of |write_size_| bytes, if set.
+    size_t write_size = write_size_ ? write_size_ : payload_data.size();
+    bool result = true;
+    for (size_t offset = 0; result && offset < payload_data.size();
+         offset += write_size) {
+      result = performer_.Write(payload_data.data() + offset,
+                                std::min(write_size,
+                                         payload_data.size() - offset));
+    }
+    EXPECT_EQ(expect_success, result);
     EXPECT_EQ(0, performer_.Close());
 
     brillo::Blob partition_data;
@@ -431,6 +446,9 @@ class DeltaPerformerTest : public ::testing::Test {
   FakeHardware fake_hardware_;
   MockDownloadActionDelegate mock_delegate_;
   FileDescriptorPtr fake_ecc_fd_;
+  // The maximum number of bytes passed on each Write() call by
+  // ApplyPayloadToData(), or 0 to pass the whole payload at once.
+  size_t write_size_{0};
   DeltaPerformer performer_{&prefs_,
                             &fake_boot_control_,
                             &fake_hardware_,
@@ -462,6 +480,32 @@ TEST_F(DeltaPerformerTest, FullPayloadWriteTest) {
   EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
 }
 
+TEST_F(DeltaPerformerTest, FullPayloadDefaultApplyThreadsTest) {
+  fake_hardware_.SetMaxApplyThreads(0);
+  payload_.type = InstallPayloadType::kFull;
+  brillo::Blob expected_data =
+      brillo::Blob(std::begin(kRandomString), std::end(kRandomString));
+  expected_data.resize(4096);  // block size
+  vector<AnnotatedOperation> aops;
+  AnnotatedOperation aop;
+  *(aop.op.add_dst_extents()) = ExtentForRange(0, 1);
+  aop.op.set_data_offset(0);
+  aop.op.set_data_length(expected_data.size());
+  aop.op.set_type(InstallOperation::REPLACE);
+  aops.push_back(aop);
+
+  brillo::Blob payload_data = GeneratePayload(expected_data,
+                                              aops,
+                                              false,
+                                              kChromeOSMajorPayloadVersion,
+                                              kFullPayloadMinorVersion);
+  EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
+
+  // Full payloads use all the CPUs unless the board sets a value.
+  const int num_cpus = std::max(base::SysInfo::NumberOfProcessors(), 1);
+  EXPECT_EQ(static_cast<size_t>(num_cpus), performer_.max_apply_threads_);
+}
+
 TEST_F(DeltaPerformerTest, ShouldCancelTest) {
   payload_.type = InstallPayloadType::kFull;
   brillo::Blob expected_data =
@@ -506,6 +550,71 @@ TEST_F(DeltaPerformerTest, ReplaceOperationTest) {
   EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
 }
 
+TEST_F(DeltaPerformerTest, OperationStatsTest) {
+  brillo::Blob blob_data(4096 * 2);
+  test_utils::FillWithData(&blob_data);
+  vector<AnnotatedOperation> aops;
+  AnnotatedOperation aop;
+  *(aop.op.add_dst_extents()) = ExtentForRange(0, 2);
+  aop.op.set_data_offset(0);
+  aop.op.set_data_length(blob_data.size());
+  aop.op.set_type(InstallOperation::REPLACE);
+  aops.push_back(aop);
+
+  aop.op.Clear();
+  *(aop.op.add_dst_extents()) = ExtentForRange(2, 1);
+  *(aop.op.add_dst_extents()) = ExtentForRange(4, 2);
+  aop.op.set_type(InstallOperation::ZERO);
+  aops.push_back(aop);
+
+  brillo::Blob payload_data = GeneratePayload(blob_data, aops, false);
+  ApplyPayload(payload_data, "/dev/null", true);
+
+  const auto& stats = performer_.operation_stats();
+  EXPECT_EQ(2u, stats.size());
+  const auto& replace_stats = stats.at(InstallOperation::REPLACE);
+  EXPECT_EQ(1u, replace_stats.count);
+  EXPECT_EQ(0u, replace_stats.bytes_read);
+  EXPECT_EQ(4096u * 2, replace_stats.bytes_written);
+  EXPECT_EQ(blob_data.size(), replace_stats.bytes_downloaded);
+  const auto& zero_stats = stats.at(InstallOperation::ZERO);
+  EXPECT_EQ(1u, zero_stats.count);
+  EXPECT_EQ(0u, zero_stats.bytes_read);
+  EXPECT_EQ(4096u * 3, zero_stats.bytes_written);
+  EXPECT_EQ(0u, zero_stats.bytes_downloaded);
+}
+
+TEST_F(DeltaPerformerTest, ManifestWithoutOperationsTest) {
+  vector<AnnotatedOperation> aops(2);
+  *(aops[0].op.add_dst_extents()) = ExtentForRange(0, 2);
+  aops[0].op.set_type(InstallOperation::ZERO);
+  *(aops[1].op.add_dst_extents()) = ExtentForRange(4, 1);
+  aops[1].op.set_type(InstallOperation::DISCARD);
+  brillo::Blob payload_data = GeneratePayload(brillo::Blob(), aops, false);
+
+  PayloadMetadata payload_metadata;
+  EXPECT_TRUE(payload_metadata.ParsePayloadHeader(payload_data));
+  DeltaArchiveManifest manifest, manifest_without_operations;
+  vector<SerializedPartitionUpdate> partitions;
+  EXPECT_TRUE(payload_metadata.GetManifest(payload_data, &manifest));
+  EXPECT_TRUE(payload_metadata.GetManifestWithoutOperations(
+      payload_data, &manifest_without_operations, &partitions));
+
+  // The root and kernel partitions.
+  ASSERT_EQ(2U, partitions.size());
+  EXPECT_EQ(2U, partitions[0].num_operations);
+  EXPECT_EQ(0U, partitions[1].num_operations);
+  EXPECT_EQ(0, manifest_without_operations.partitions(0).operations_size());
+  // Adding the serialized partitions back gives the whole manifest.
+  manifest_without_operations.clear_partitions();
+  for (const SerializedPartitionUpdate& partition : partitions) {
+    EXPECT_TRUE(manifest_without_operations.add_partitions()->ParseFromArray(
+        partition.data.data(), partition.data.size()));
+  }
+  EXPECT_EQ(manifest.SerializeAsString(),
+            manifest_without_operations.SerializeAsString());
+}
+
 TEST_F(DeltaPerformerTest, ReplaceBzOperationTest) {
   brillo::Blob expected_data =
       brillo::Blob(std::begin(kRandomString), std::end(kRandomString));
@@ -546,6 +655,44 @@ TEST_F(DeltaPerformerTest, ReplaceXzOperationTest) {
   EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
 }
 
+TEST_F(DeltaPerformerTest, ReplaceZstdOperationTest) {
+  brillo::Blob expected_data(4096 * 3);
+  for (size_t i = 0; i < expected_data.size(); i++)
+    expected_data[i] = i % 251;
+  brillo::Blob zstd_data;
+  EXPECT_TRUE(ZstdCompress(expected_data, &zstd_data));
+
+  AnnotatedOperation aop;
+  *(aop.op.add_dst_extents()) = ExtentForRange(0, 3);
+  aop.op.set_data_offset(0);
+  aop.op.set_data_length(zstd_data.size());
+  aop.op.set_type(InstallOperation::REPLACE_ZSTD);
+  vector<AnnotatedOperation> aops = {aop};
+
+  brillo::Blob payload_data = GeneratePayload(zstd_data, aops, false);
+
+  EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
+}
+
+TEST_F(DeltaPerformerTest, ReplaceLz4OperationTest) {
+  brillo::Blob expected_data(4096 * 3);
+  for (size_t i = 0; i < expected_data.size(); i++)
+    expected_data[i] = i % 251;
+  brillo::Blob lz4_data;
+  EXPECT_TRUE(Lz4Compress(expected_data, &lz4_data));
+
+  AnnotatedOperation aop;
+  *(aop.op.add_dst_extents()) = ExtentForRange(0, 3);
+  aop.op.set_data_offset(0);
+  aop.op.set_data_length(lz4_data.size());
+  aop.op.set_type(InstallOperation::REPLACE_LZ4);
+  vector<AnnotatedOperation> aops = {aop};
+
+  brillo::Blob payload_data = GeneratePayload(lz4_data, aops, false);
+
+  EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
+}
+
 TEST_F(DeltaPerformerTest, ZeroOperationTest) {
   brillo::Blob existing_data = brillo::Blob(4096 * 10, 'a');
   brillo::Blob expected_data = existing_data;
@@ -593,6 +740,74 @@ TEST_F(DeltaPerformerTest, SourceCopyOperationTest) {
   EXPECT_EQ(expected_data, ApplyPayload(payload_data, source.path(), true));
 }
 
+TEST_F(DeltaPerformerTest, SkipUnchangedWritesTest) {
+  fake_hardware_.SetSkipUnchangedPartitionWrites(true);
+  brillo::Blob expected_data(4096 * 2);
+  test_utils::FillWithData(&expected_data);
+  AnnotatedOperation aop;
+  *(aop.op.add_src_extents()) = ExtentForRange(0, 2);
+  *(aop.op.add_dst_extents()) = ExtentForRange(0, 2);
+  aop.op.set_type(InstallOperation::SOURCE_COPY);
+  brillo::Blob src_hash;
+  EXPECT_TRUE(HashCalculator::RawHashOfData(expected_data, &src_hash));
+  aop.op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+
+  test_utils::ScopedTempFile source("Source-XXXXXX");
+  EXPECT_TRUE(test_utils::WriteFileVector(source.path(), expected_data));
+
+  PartitionConfig old_part(kPartitionNameRoot);
+  old_part.path = source.path();
+  old_part.size = expected_data.size();
+
+  brillo::Blob payload_data =
+      GeneratePayload(brillo::Blob(), {aop}, false, &old_part);
+
+  // The target already holds the first block, but not the second one.
+  brillo::Blob existing_data = expected_data;
+  existing_data[4096 + 10] ^= 0xff;
+  EXPECT_EQ(expected_data,
+            ApplyPayloadToData(
+                payload_data, source.path(), existing_data, true));
+}
+
+TEST_F(DeltaPerformerTest, SourceCopyRunOperationsTest) {
+  constexpr size_t kNumBlocks = 6;
+  brillo::Blob source_data(kNumBlocks * 4096);
+  test_utils::FillWithData(&source_data);
+  test_utils::ScopedTempFile source("Source-XXXXXX");
+  EXPECT_TRUE(test_utils::WriteFileVector(source.path(), source_data));
+
+  // Copy each block with its own operation, moving it 4 blocks forward. The
+  // operations form two runs: blocks 0-1 to 4-5 and blocks 2-5 to 0-3.
+  vector<AnnotatedOperation> aops;
+  brillo::Blob expected_data(source_data.size());
+  for (size_t block = 0; block < kNumBlocks; block++) {
+    const size_t dst_block = (block + 4) % kNumBlocks;
+    AnnotatedOperation aop;
+    *(aop.op.add_src_extents()) = ExtentForRange(block, 1);
+    *(aop.op.add_dst_extents()) = ExtentForRange(dst_block, 1);
+    aop.op.set_type(InstallOperation::SOURCE_COPY);
+    brillo::Blob block_data(source_data.begin() + block * 4096,
+                            source_data.begin() + (block + 1) * 4096);
+    brillo::Blob src_hash;
+    EXPECT_TRUE(HashCalculator::RawHashOfData(block_data, &src_hash));
+    aop.op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+    aops.push_back(aop);
+    std::copy(block_data.begin(),
+              block_data.end(),
+              expected_data.begin() + dst_block * 4096);
+  }
+
+  PartitionConfig old_part(kPartitionNameRoot);
+  old_part.path = source.path();
+  old_part.size = source_data.size();
+
+  brillo::Blob payload_data =
+      GeneratePayload(brillo::Blob(), aops, false, &old_part);
+
+  EXPECT_EQ(expected_data, ApplyPayload(payload_data, source.path(), true));
+}
+
 TEST_F(DeltaPerformerTest, PuffdiffOperationTest) {
   AnnotatedOperation aop;
   *(aop.op.add_src_extents()) = ExtentForRange(0, 1);
@@ -622,6 +837,82 @@ TEST_F(DeltaPerformerTest, PuffdiffOperationTest) {
   EXPECT_EQ(dst, ApplyPayload(payload_data, source.path(), true));
 }
 
+TEST_F(DeltaPerformerTest, CancelApplyTest) {
+  AnnotatedOperation aop;
+  *(aop.op.add_src_extents()) = ExtentForRange(0, 1);
+  *(aop.op.add_dst_extents()) = ExtentForRange(0, 1);
+  brillo::Blob puffdiff_payload(std::begin(puffdiff_patch),
+                                std::end(puffdiff_patch));
+  aop.op.set_data_offset(0);
+  aop.op.set_data_length(puffdiff_payload.size());
+  aop.op.set_type(InstallOperation::PUFFDIFF);
+  brillo::Blob src(std::begin(src_deflates), std::end(src_deflates));
+  src.resize(4096);  // block size
+  brillo::Blob src_hash;
+  EXPECT_TRUE(HashCalculator::RawHashOfData(src, &src_hash));
+  aop.op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+
+  test_utils::ScopedTempFile source("Source-XXXXXX");
+  EXPECT_TRUE(test_utils::WriteFileVector(source.path(), src));
+
+  PartitionConfig old_part(kPartitionNameRoot);
+  old_part.path = source.path();
+  old_part.size = src.size();
+
+  brillo::Blob payload_data =
+      GeneratePayload(puffdiff_payload, {aop}, false, &old_part);
+
+  // The operation fails without writing anything, and isn't checkpointed.
+  performer_.CancelApply();
+  EXPECT_EQ(brillo::Blob(), ApplyPayload(payload_data, source.path(), false));
+  int64_t next_operation = 0;
+  if (prefs_.GetInt64(kPrefsUpdateStateNextOperation, &next_operation))
+    EXPECT_LE(next_operation, 0);
+}
+
+TEST_F(DeltaPerformerTest, ZstdBsdiffOperationTest) {
+  brillo::Blob src(4096 * 2);
+  test_utils::FillWithData(&src);
+  // Change a few bytes, move the second block and add new data, so the patch
+  // has diff, extra and backward control entries.
+  brillo::Blob dst(src.begin() + 4096, src.end());
+  dst.insert(dst.end(), src.begin(), src.begin() + 4096);
+  for (size_t i = 0; i < dst.size(); i += 512)
+    dst[i] ^= 0x5a;
+  std::fill(dst.begin() + 6000, dst.begin() + 7000, 'x');
+
+  brillo::Blob patch;
+  ZstdBsdiffPatchWriter patch_writer(&patch);
+  ASSERT_EQ(0,
+            bsdiff::bsdiff(src.data(),
+                           src.size(),
+                           dst.data(),
+                           dst.size(),
+                           &patch_writer,
+                           nullptr));
+
+  AnnotatedOperation aop;
+  *(aop.op.add_src_extents()) = ExtentForRange(0, 2);
+  *(aop.op.add_dst_extents()) = ExtentForRange(0, 2);
+  aop.op.set_data_offset(0);
+  aop.op.set_data_length(patch.size());
+  aop.op.set_type(InstallOperation::ZSTD_BSDIFF);
+  brillo::Blob src_hash;
+  EXPECT_TRUE(HashCalculator::RawHashOfData(src, &src_hash));
+  aop.op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+
+  test_utils::ScopedTempFile source("Source-XXXXXX");
+  EXPECT_TRUE(test_utils::WriteFileVector(source.path(), src));
+
+  PartitionConfig old_part(kPartitionNameRoot);
+  old_part.path = source.path();
+  old_part.size = src.size();
+
+  brillo::Blob payload_data = GeneratePayload(patch, {aop}, false, &old_part);
+
+  EXPECT_EQ(dst, ApplyPayload(payload_data, source.path(), true));
+}
+
 TEST_F(DeltaPerformerTest, SourceHashMismatchTest) {
   brillo::Blob expected_data = {'f', 'o', 'o'};
   brillo::Blob actual_data = {'b', 'a', 'r'};
@@ -707,6 +998,24 @@ TEST_F(DeltaPerformerTest, ErrorCorrectionSourceCopyWhenNoHashFallbackTest) {
   EXPECT_EQ(0U, GetSourceEccRecoveredFailures());
 }
 
+TEST_F(DeltaPerformerTest, CheckpointIntervalTest) {
+  // Cheap checkpoints are as frequent as the minimum interval allows.
+  EXPECT_EQ(base::TimeDelta::FromMilliseconds(
+                DeltaPerformer::kCheckpointMinIntervalMs),
+            DeltaPerformer::GetCheckpointInterval(
+                base::TimeDelta::FromMicroseconds(100)));
+  // Otherwise, they're spaced in proportion to their cost.
+  EXPECT_EQ(base::TimeDelta::FromMilliseconds(
+                10 * DeltaPerformer::kCheckpointCostRatio),
+            DeltaPerformer::GetCheckpointInterval(
+                base::TimeDelta::FromMilliseconds(10)));
+  // Up to the maximum interval.
+  EXPECT_EQ(base::TimeDelta::FromSeconds(
+                DeltaPerformer::kCheckpointMaxIntervalSeconds),
+            DeltaPerformer::GetCheckpointInterval(
+                base::TimeDelta::FromSeconds(1)));
+}
+
 TEST_F(DeltaPerformerTest, ChooseSourceFDTest) {
   constexpr size_t kSourceSize = 4 * 4096;
   test_utils::ScopedTempFile source("Source-XXXXXX");
@@ -738,6 +1047,531 @@ TEST_F(DeltaPerformerTest, ChooseSourceFDTest) {
   EXPECT_EQ(1U, GetSourceEccRecoveredFailures());
 }
 
+TEST_F(DeltaPerformerTest, ChooseSourceFDSkipsVerifiedBlocksTest) {
+  constexpr size_t kSourceSize = 4 * 4096;
+  test_utils::ScopedTempFile source("Source-XXXXXX");
+  brillo::Blob source_data = FakeFileDescriptorData(kSourceSize);
+  EXPECT_TRUE(test_utils::WriteFileVector(source.path(), source_data));
+
+  performer_.source_fd_ = std::make_shared<EintrSafeFileDescriptor>();
+  performer_.source_fd_->Open(source.path().c_str(), O_RDONLY);
+  performer_.block_size_ = 4096;
+
+  InstallOperation op;
+  *(op.add_src_extents()) = ExtentForRange(1, 2);
+  brillo::Blob src_hash;
+  EXPECT_TRUE(HashCalculator::RawHashOfData(
+      brillo::Blob(source_data.begin() + 4096, source_data.begin() + 3 * 4096),
+      &src_hash));
+  op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+
+  ErrorCode error = ErrorCode::kSuccess;
+  EXPECT_EQ(performer_.source_fd_, performer_.ChooseSourceFD(op, &error));
+  EXPECT_EQ("1:2", performer_.verified_source_blocks_.ToString());
+
+  // Once verified, the blocks aren't hashed again, so an operation reading
+  // a part of them is accepted even with a hash that doesn't match.
+  InstallOperation other_op;
+  *(other_op.add_src_extents()) = ExtentForRange(2, 1);
+  other_op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+  EXPECT_EQ(performer_.source_fd_, performer_.ChooseSourceFD(other_op, &error));
+  EXPECT_EQ(ErrorCode::kSuccess, error);
+
+  // The blocks that weren't verified are still hashed.
+  *(other_op.add_src_extents()) = ExtentForRange(3, 1);
+  EXPECT_EQ(nullptr, performer_.ChooseSourceFD(other_op, &error));
+}
+
+TEST_F(DeltaPerformerTest, ParallelReplaceOperationsTest) {
+  fake_hardware_.SetMaxApplyThreads(4);
+  constexpr size_t kNumBlocks = 8;
+  brillo::Blob expected_data = FakeFileDescriptorData(kNumBlocks * 4096);
+
+  // Write the blocks in reverse order, each one with its own operation.
+  vector<AnnotatedOperation> aops;
+  brillo::Blob blob_data;
+  for (size_t i = 0; i < kNumBlocks; i++) {
+    const size_t block = kNumBlocks - 1 - i;
+    AnnotatedOperation aop;
+    *(aop.op.add_dst_extents()) = ExtentForRange(block, 1);
+    aop.op.set_data_offset(blob_data.size());
+    aop.op.set_data_length(4096);
+    aop.op.set_type(InstallOperation::REPLACE);
+    aops.push_back(aop);
+    blob_data.insert(blob_data.end(),
+                     expected_data.begin() + block * 4096,
+                     expected_data.begin() + (block + 1) * 4096);
+  }
+
+  brillo::Blob payload_data = GeneratePayload(blob_data, aops, false);
+
+  EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
+}
+
+// Test that an operation whose source hash mismatches while applied in
+// parallel is retried serially using the error-corrected file descriptor.
+TEST_F(DeltaPerformerTest, ParallelSourceCopyErrorCorrectionFallbackTest) {
+  fake_hardware_.SetMaxApplyThreads(4);
+  constexpr size_t kPartitionSize = 8 * 4096;
+  brillo::Blob expected_data = FakeFileDescriptorData(kPartitionSize);
+  // Only the first half of the source image doesn't match the expected hash.
+  brillo::Blob source_data = expected_data;
+  std::fill(
+      source_data.begin(), source_data.begin() + kPartitionSize / 2, 0x55);
+  test_utils::ScopedTempFile source("Source-XXXXXX");
+  EXPECT_TRUE(test_utils::WriteFileVector(source.path(), source_data));
+
+  FakeFileDescriptor* fake_fec = SetFakeECCFile(kPartitionSize);
+
+  vector<AnnotatedOperation> aops;
+  for (uint64_t start_block : {0, 4}) {
+    AnnotatedOperation aop;
+    *(aop.op.add_src_extents()) = ExtentForRange(start_block, 4);
+    *(aop.op.add_dst_extents()) = ExtentForRange(start_block, 4);
+    aop.op.set_type(InstallOperation::SOURCE_COPY);
+    brillo::Blob src_hash;
+    EXPECT_TRUE(HashCalculator::RawHashOfBytes(
+        expected_data.data() + start_block * 4096, 4 * 4096, &src_hash));
+    aop.op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+    aops.push_back(aop);
+  }
+
+  PartitionConfig old_part(kPartitionNameRoot);
+  old_part.path = source.path();
+  old_part.size = kPartitionSize;
+
+  brillo::Blob payload_data =
+      GeneratePayload(brillo::Blob(), aops, false, &old_part);
+  EXPECT_EQ(expected_data, ApplyPayload(payload_data, source.path(), true));
+  EXPECT_EQ(1U, fake_fec->GetReadOps().size());
+  EXPECT_EQ(1U, GetSourceEccRecoveredFailures());
+}
+
+// Test that the operations of a delta payload applied in destination order by
+// a single thread write the same data.
+TEST_F(DeltaPerformerTest, DestinationOrderSourceCopyTest) {
+  fake_hardware_.SetApplyOperationsInDestinationOrder(true);
+  constexpr size_t kNumBlocks = 8;
+  brillo::Blob expected_data = FakeFileDescriptorData(kNumBlocks * 4096);
+  test_utils::ScopedTempFile source("Source-XXXXXX");
+  EXPECT_TRUE(test_utils::WriteFileVector(source.path(), expected_data));
+
+  // Copy the blocks in reverse order, each one with its own operation.
+  vector<AnnotatedOperation> aops;
+  for (size_t i = 0; i < kNumBlocks; i++) {
+    const uint64_t block = kNumBlocks - 1 - i;
+    AnnotatedOperation aop;
+    *(aop.op.add_src_extents()) = ExtentForRange(block, 1);
+    *(aop.op.add_dst_extents()) = ExtentForRange(block, 1);
+    aop.op.set_type(InstallOperation::SOURCE_COPY);
+    brillo::Blob src_hash;
+    EXPECT_TRUE(HashCalculator::RawHashOfBytes(
+        expected_data.data() + block * 4096, 4096, &src_hash));
+    aop.op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+    aops.push_back(aop);
+  }
+
+  PartitionConfig old_part(kPartitionNameRoot);
+  old_part.path = source.path();
+  old_part.size = expected_data.size();
+
+  brillo::Blob payload_data =
+      GeneratePayload(brillo::Blob(), aops, false, &old_part);
+  EXPECT_EQ(expected_data, ApplyPayload(payload_data, source.path(), true));
+  EXPECT_TRUE(performer_.destination_order_);
+}
+
+TEST_F(DeltaPerformerTest, ParallelWindowTest) {
+  payload_.type = InstallPayloadType::kFull;
+  performer_.max_apply_threads_ = 4;
+
+  PartitionUpdate partition;
+  uint64_t data_offset = 0;
+  auto add_operation = [&partition, &data_offset](InstallOperation::Type type,
+                                                  uint64_t start_block,
+                                                  uint64_t data_length) {
+    InstallOperation* op = partition.add_operations();
+    op->set_type(type);
+    *(op->add_dst_extents()) = ExtentForRange(start_block, 1);
+    if (data_length) {
+      op->set_data_offset(data_offset);
+      op->set_data_length(data_length);
+      data_offset += data_length;
+    }
+  };
+  add_operation(InstallOperation::REPLACE, 0, 10);
+  add_operation(InstallOperation::ZERO, 1, 0);
+  add_operation(InstallOperation::REPLACE_XZ, 2, 20);
+  // Overlaps with the first operation.
+  add_operation(InstallOperation::REPLACE, 0, 30);
+  add_operation(InstallOperation::REPLACE, 3, 40);
+  // Source operations can't be applied in parallel without a source hash.
+  add_operation(InstallOperation::SOURCE_COPY, 4, 0);
+  performer_.partitions_ = {partition};
+  performer_.acc_num_operations_ = {
+      static_cast<size_t>(partition.operations_size())};
+
+  uint64_t data_length = 0;
+  EXPECT_EQ(3U, performer_.GetParallelWindow(&data_length));
+  EXPECT_EQ(30U, data_length);
+
+  performer_.next_operation_num_ = 3;
+  performer_.buffer_offset_ = 30;
+  EXPECT_EQ(2U, performer_.GetParallelWindow(&data_length));
+  EXPECT_EQ(70U, data_length);
+
+  // An operation retried serially is never part of a window.
+  performer_.serial_retry_operation_num_ = 3;
+  EXPECT_EQ(0U, performer_.GetParallelWindow(&data_length));
+
+  // The parallel mode is disabled by default.
+  performer_.serial_retry_operation_num_ = 0;
+  performer_.max_apply_threads_ = 1;
+  EXPECT_EQ(0U, performer_.GetParallelWindow(&data_length));
+
+  // A single thread applies the windows in destination order.
+  performer_.destination_order_ = true;
+  EXPECT_EQ(2U, performer_.GetParallelWindow(&data_length));
+}
+
+TEST_F(DeltaPerformerTest, ParallelWindowApplyMemoryTest) {
+  payload_.type = InstallPayloadType::kFull;
+  performer_.max_apply_threads_ = 4;
+  performer_.max_apply_memory_size_ = 128 * 1024 * 1024;
+
+  PartitionUpdate partition;
+  for (uint64_t i = 0; i < 3; i++) {
+    InstallOperation* op = partition.add_operations();
+    op->set_type(InstallOperation::ZERO);
+    *(op->add_dst_extents()) = ExtentForRange(i, 1);
+  }
+  partition.mutable_operations(0)->set_apply_memory_size(100 * 1024 * 1024);
+  partition.mutable_operations(1)->set_apply_memory_size(20 * 1024 * 1024);
+  partition.mutable_operations(2)->set_apply_memory_size(20 * 1024 * 1024);
+  performer_.partitions_ = {partition};
+  performer_.acc_num_operations_ = {
+      static_cast<size_t>(partition.operations_size())};
+
+  // The third operation would exceed the memory of a window.
+  uint64_t data_length = 0;
+  EXPECT_EQ(2U, performer_.GetParallelWindow(&data_length));
+
+  // A smaller memory budget set by the board shrinks the window.
+  performer_.max_apply_memory_size_ = 64 * 1024 * 1024;
+  EXPECT_EQ(1U, performer_.GetParallelWindow(&data_length));
+  performer_.max_apply_memory_size_ = 128 * 1024 * 1024;
+
+  // An operation alone is always part of a window, even if it exceeds it.
+  partition.mutable_operations(2)->set_apply_memory_size(1024 * 1024 * 1024);
+  performer_.partitions_ = {partition};
+  performer_.next_operation_num_ = 2;
+  EXPECT_EQ(1U, performer_.GetParallelWindow(&data_length));
+}
+
+TEST_F(DeltaPerformerTest, PrefetchSourceExtentsTest) {
+  auto fake_source = std::make_shared<FakeFileDescriptor>();
+  performer_.source_fd_ = fake_source;
+  performer_.block_size_ = 4096;
+
+  PartitionUpdate partition;
+  InstallOperation* op = partition.add_operations();
+  op->set_type(InstallOperation::SOURCE_COPY);
+  *(op->add_src_extents()) = ExtentForRange(0, 2);
+  op = partition.add_operations();
+  op->set_type(InstallOperation::REPLACE);
+  op = partition.add_operations();
+  op->set_type(InstallOperation::SOURCE_BSDIFF);
+  *(op->add_src_extents()) = ExtentForRange(10, 1);
+  *(op->add_src_extents()) = ExtentForRange(20, 0);
+  *(op->add_src_extents()) = ExtentForRange(30, 1);
+  // In-place operations read from the target partition.
+  op = partition.add_operations();
+  op->set_type(InstallOperation::MOVE);
+  *(op->add_src_extents()) = ExtentForRange(5, 1);
+  performer_.partitions_ = {partition};
+  performer_.acc_num_operations_ = {
+      static_cast<size_t>(partition.operations_size())};
+
+  performer_.PrefetchSourceExtents();
+  vector<std::pair<uint64_t, uint64_t>> expected_prefetch_ops = {
+      {0, 8192}, {10 * 4096, 4096}, {30 * 4096, 4096}};
+  EXPECT_EQ(expected_prefetch_ops, fake_source->GetPrefetchOps());
+
+  // The operations are only prefetched once.
+  performer_.next_operation_num_ = 1;
+  performer_.PrefetchSourceExtents();
+  EXPECT_EQ(expected_prefetch_ops, fake_source->GetPrefetchOps());
+}
+
+TEST_F(DeltaPerformerTest, PrefetchNextPartitionTest) {
+  test_utils::ScopedTempFile source("Source-XXXXXX");
+  ASSERT_TRUE(utils::WriteFile(source.path().c_str(), "x", 1));
+  payload_.type = InstallPayloadType::kDelta;
+  performer_.block_size_ = 4096;
+
+  PartitionUpdate partition;
+  InstallOperation* op = partition.add_operations();
+  op->set_type(InstallOperation::SOURCE_COPY);
+  *(op->add_src_extents()) = ExtentForRange(0, 1);
+  PartitionUpdate empty_partition;
+  // The partition without operations is skipped.
+  performer_.partitions_ = {partition, empty_partition, partition};
+  performer_.acc_num_operations_ = {1, 1, 2};
+  install_plan_.partitions.resize(3);
+  install_plan_.partitions[2].source_path = source.path();
+  install_plan_.partitions[2].source_size = 4096;
+
+  performer_.PrefetchSourceExtents();
+  EXPECT_EQ(2U, performer_.next_source_partition_);
+  EXPECT_TRUE(performer_.next_source_fd_);
+
+  // The last partition has no next one.
+  performer_.next_source_fd_.reset();
+  performer_.current_partition_ = 2;
+  performer_.next_operation_num_ = 1;
+  performer_.PrefetchSourceExtents();
+  EXPECT_EQ(2U, performer_.next_source_partition_);
+  EXPECT_FALSE(performer_.next_source_fd_);
+}
+
+TEST_F(DeltaPerformerTest, PrefetchWindowTest) {
+  const size_t kMinWindow = DeltaPerformer::kMinPrefetchOperations;
+  EXPECT_EQ(kMinWindow, performer_.prefetch_window_);
+
+  // 1MB in 50ms had to wait for the storage.
+  base::TimeDelta slow_read = base::TimeDelta::FromMilliseconds(50);
+  performer_.UpdatePrefetchWindow(slow_read, 1024 * 1024);
+  EXPECT_EQ(kMinWindow * 2, performer_.prefetch_window_);
+  for (int i = 0; i < 10; i++)
+    performer_.UpdatePrefetchWindow(slow_read, 1024 * 1024);
+  EXPECT_EQ(DeltaPerformer::kMaxPrefetchOperations,
+            performer_.prefetch_window_);
+
+  // Short reads and reads from the page cache don't grow it, and enough of
+  // them shrink it.
+  performer_.UpdatePrefetchWindow(base::TimeDelta::FromMicroseconds(100), 4096);
+  performer_.UpdatePrefetchWindow(base::TimeDelta::FromMilliseconds(2),
+                                  4 * 1024 * 1024);
+  EXPECT_EQ(DeltaPerformer::kMaxPrefetchOperations,
+            performer_.prefetch_window_);
+  for (int i = 0; i < 1000; i++)
+    performer_.UpdatePrefetchWindow(base::TimeDelta(), 4096);
+  EXPECT_EQ(kMinWindow, performer_.prefetch_window_);
+}
+
+TEST_F(DeltaPerformerTest, SourceCopyRunTest) {
+  performer_.source_fd_ = std::make_shared<FakeFileDescriptor>();
+  performer_.block_size_ = 4096;
+
+  PartitionUpdate partition;
+  auto add_operation = [&partition](uint64_t src_block,
+                                    uint64_t dst_block,
+                                    uint64_t num_blocks,
+                                    bool add_hash) {
+    InstallOperation* op = partition.add_operations();
+    op->set_type(InstallOperation::SOURCE_COPY);
+    *(op->add_src_extents()) = ExtentForRange(src_block, num_blocks);
+    *(op->add_dst_extents()) = ExtentForRange(dst_block, num_blocks);
+    if (add_hash)
+      op->set_src_sha256_hash("hash");
+  };
+  add_operation(0, 10, 1, true);
+  add_operation(1, 11, 2, true);
+  // The destination isn't adjacent to the previous one.
+  add_operation(3, 14, 1, true);
+  add_operation(4, 15, 1, false);
+  // Larger than a run on its own.
+  add_operation(5, 16, 2048, true);
+  add_operation(2053, 2064, 1, true);
+  performer_.partitions_ = {partition};
+  performer_.acc_num_operations_ = {
+      static_cast<size_t>(partition.operations_size())};
+
+  EXPECT_EQ(2U, performer_.GetSourceCopyRun());
+
+  // Operations without a source hash are never part of a run.
+  performer_.next_operation_num_ = 2;
+  EXPECT_EQ(1U, performer_.GetSourceCopyRun());
+  performer_.next_operation_num_ = 3;
+  EXPECT_EQ(0U, performer_.GetSourceCopyRun());
+
+  performer_.next_operation_num_ = 4;
+  EXPECT_EQ(1U, performer_.GetSourceCopyRun());
+
+  // An operation retried serially is never part of a run.
+  performer_.next_operation_num_ = 0;
+  performer_.serial_retry_operation_num_ = 0;
+  EXPECT_EQ(0U, performer_.GetSourceCopyRun());
+}
+
+TEST_F(DeltaPerformerTest, ZeroOrDiscardRunTest) {
+  performer_.block_size_ = 4096;
+
+  PartitionUpdate partition;
+  auto add_operation = [&partition](InstallOperation::Type type,
+                                    uint64_t dst_block,
+                                    uint64_t num_blocks) {
+    InstallOperation* op = partition.add_operations();
+    op->set_type(type);
+    *(op->add_dst_extents()) = ExtentForRange(dst_block, num_blocks);
+  };
+  // The extents of a run don't need to be adjacent.
+  add_operation(InstallOperation::ZERO, 0, 1);
+  add_operation(InstallOperation::ZERO, 10, 2);
+  add_operation(InstallOperation::ZERO, 5, 1);
+  // A different type starts a new run.
+  add_operation(InstallOperation::DISCARD, 20, 1);
+  add_operation(InstallOperation::DISCARD, 21, 1);
+  // Too large to join the previous run.
+  add_operation(InstallOperation::DISCARD, 30, 65536);
+  add_operation(InstallOperation::REPLACE, 100, 1);
+  performer_.partitions_ = {partition};
+  performer_.acc_num_operations_ = {
+      static_cast<size_t>(partition.operations_size())};
+
+  EXPECT_EQ(3U, performer_.GetZeroOrDiscardRun());
+  performer_.next_operation_num_ = 3;
+  EXPECT_EQ(2U, performer_.GetZeroOrDiscardRun());
+  performer_.next_operation_num_ = 5;
+  EXPECT_EQ(1U, performer_.GetZeroOrDiscardRun());
+  performer_.next_operation_num_ = 6;
+  EXPECT_EQ(0U, performer_.GetZeroOrDiscardRun());
+
+  // An operation retried serially is never part of a run.
+  performer_.next_operation_num_ = 0;
+  performer_.serial_retry_operation_num_ = 0;
+  EXPECT_EQ(0U, performer_.GetZeroOrDiscardRun());
+}
+
+TEST_F(DeltaPerformerTest, ReadOperationDataTest) {
+  const char kData[] = "0123456789";
+  const char* bytes = kData;
+  size_t count = 10;
+
+  // The data is used in place when all of it was received.
+  EXPECT_EQ(4U, performer_.ReadOperationData(&bytes, &count, 4));
+  EXPECT_EQ(reinterpret_cast<const uint8_t*>(kData), performer_.BufferData());
+  EXPECT_EQ(4U, performer_.BufferSize());
+  EXPECT_TRUE(performer_.buffer_.empty());
+  EXPECT_EQ(6U, count);
+
+  // Needing more data copies the data used in place to |buffer_|.
+  EXPECT_EQ(2U, performer_.ReadOperationData(&bytes, &count, 6));
+  EXPECT_EQ("012345",
+            string(performer_.buffer_.begin(), performer_.buffer_.end()));
+  EXPECT_EQ(6U, performer_.BufferSize());
+  EXPECT_EQ(4U, count);
+
+  performer_.ConsumeBuffer(6);
+  EXPECT_EQ(6U, performer_.buffer_offset_);
+  EXPECT_EQ(0U, performer_.BufferSize());
+
+  // Data received partially is copied.
+  EXPECT_EQ(4U, performer_.ReadOperationData(&bytes, &count, 8));
+  EXPECT_EQ("6789",
+            string(performer_.buffer_.begin(), performer_.buffer_.end()));
+  EXPECT_EQ(0U, count);
+}
+
+TEST_F(DeltaPerformerTest, PartialOperationDataTest) {
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  fake_hardware_.SetNonVolatileDirectory(temp_dir.GetPath());
+
+  // An interrupted update with the data of the second operation partially
+  // received.
+  PartitionUpdate partition;
+  partition.add_operations()->set_data_length(10);
+  partition.add_operations()->set_data_length(2 * 1024 * 1024);
+  performer_.partitions_.push_back(partition);
+  performer_.acc_num_operations_.push_back(2);
+  performer_.num_total_operations_ = 2;
+  performer_.next_operation_num_ = 1;
+  performer_.manifest_valid_ = true;
+  performer_.buffer_offset_ = 10;
+  brillo::Blob data = FakeFileDescriptorData(1024 * 1024 + 1);
+  performer_.buffer_ = data;
+
+  EXPECT_EQ(0, performer_.Close());
+  EXPECT_TRUE(performer_.buffer_.empty());
+  EXPECT_EQ(data.size(),
+            DeltaPerformer::GetPartialOperationDataLength(&prefs_));
+  int64_t value;
+  EXPECT_TRUE(prefs_.GetInt64(kPrefsUpdateStateNextDataOffset, &value));
+  EXPECT_EQ(10, value);
+  EXPECT_TRUE(prefs_.GetInt64(kPrefsUpdateStateNextOperation, &value));
+  EXPECT_EQ(1, value);
+
+  EXPECT_TRUE(performer_.LoadPartialOperationData(data.size()));
+  EXPECT_EQ(data, performer_.buffer_);
+
+  // The saved data is only loaded once.
+  EXPECT_FALSE(performer_.LoadPartialOperationData(data.size()));
+
+  // Resetting the progress drops the saved data.
+  EXPECT_TRUE(performer_.SavePartialOperationData());
+  EXPECT_TRUE(DeltaPerformer::ResetUpdateProgress(&prefs_, false));
+  EXPECT_EQ(0U, DeltaPerformer::GetPartialOperationDataLength(&prefs_));
+}
+
+TEST_F(DeltaPerformerTest, HashContextsCheckpointTest) {
+  PartitionUpdate partition;
+  partition.add_operations()->set_data_length(10);
+  partition.add_operations()->set_data_length(20);
+  performer_.partitions_.push_back(partition);
+  performer_.acc_num_operations_.push_back(2);
+  performer_.num_total_operations_ = 2;
+  performer_.next_operation_num_ = 1;
+  performer_.manifest_valid_ = true;
+  performer_.buffer_offset_ = 10;
+  performer_.payload_hash_calculator_.Update("payload", 7);
+  performer_.signed_hash_calculator_.Update("signed", 6);
+  const string payload_context =
+      performer_.payload_hash_calculator_.GetContext();
+  const string signed_context = performer_.signed_hash_calculator_.GetContext();
+  EXPECT_TRUE(performer_.CheckpointUpdateProgress(true));
+
+  // Both contexts are in a single record.
+  string hash_contexts;
+  EXPECT_TRUE(prefs_.GetString(kPrefsUpdateStateHashContexts, &hash_contexts));
+  EXPECT_NE(string::npos, hash_contexts.find(payload_context));
+  EXPECT_NE(string::npos, hash_contexts.find(signed_context));
+
+  // Resuming restores both contexts.
+  performer_.payload_hash_calculator_.Update("more", 4);
+  performer_.signed_hash_calculator_.Update("more", 4);
+  EXPECT_TRUE(prefs_.SetInt64(kPrefsManifestMetadataSize, 100));
+  EXPECT_TRUE(prefs_.SetInt64(kPrefsManifestSignatureSize, 0));
+  EXPECT_TRUE(performer_.PrimeUpdateState());
+  EXPECT_EQ(payload_context, performer_.payload_hash_calculator_.GetContext());
+  EXPECT_EQ(signed_context, performer_.signed_hash_calculator_.GetContext());
+
+  // The contexts of another checkpoint are not used.
+  EXPECT_TRUE(prefs_.SetInt64(kPrefsUpdateStateNextDataOffset, 30));
+  EXPECT_FALSE(performer_.PrimeUpdateState());
+}
+
+// Test that operations are applied correctly when their data is received in
+// chunks which are sometimes used in place and sometimes buffered.
+TEST_F(DeltaPerformerTest, ReplaceOperationsSplitWriteTest) {
+  constexpr size_t kNumBlocks = 8;
+  brillo::Blob expected_data = FakeFileDescriptorData(kNumBlocks * 4096);
+
+  vector<AnnotatedOperation> aops;
+  for (size_t block = 0; block < kNumBlocks; block++) {
+    AnnotatedOperation aop;
+    *(aop.op.add_dst_extents()) = ExtentForRange(block, 1);
+    aop.op.set_data_offset(block * 4096);
+    aop.op.set_data_length(4096);
+    aop.op.set_type(InstallOperation::REPLACE);
+    aops.push_back(aop);
+  }
+  brillo::Blob payload_data = GeneratePayload(expected_data, aops, false);
+
+  write_size_ = 4096 * 3 / 2;
+  EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
+}
+
 TEST_F(DeltaPerformerTest, ExtentsToByteStringTest) {
   uint64_t test[] = {1, 1, 4, 2, 0, 1};
   static_assert(arraysize(test) % 2 == 0, "Array size uneven");
@@ -0,0 +1,354 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/direct_io_file_descriptor.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <base/posix/eintr_wrapper.h>
+
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The alignment of the offsets, sizes and memory of the O_DIRECT writes. The
+// page size is used, which is a multiple of the logical block size of the
+// storage devices we support, so the unaligned parts written through the page
+// cache never share a page with the O_DIRECT writes.
+const size_t kAlignment = 4096;
+
+// The size and number of the buffers, which is the maximum number of writes
+// in flight.
+const size_t kBufferSize = 256 * 1024;  // 256 KiB
+const size_t kNumBuffers = 8;
+
+}  // namespace
+
+DirectIoFileDescriptor::DirectIoFileDescriptor() = default;
+
+DirectIoFileDescriptor::~DirectIoFileDescriptor() {
+  // io_destroy() waits for the writes in flight, so the buffers can be freed
+  // after it.
+  if (aio_context_)
+    syscall(__NR_io_destroy, aio_context_);
+  if (direct_fd_ >= 0)
+    IGNORE_EINTR(close(direct_fd_));
+  free(buffers_memory_);
+}
+
+bool DirectIoFileDescriptor::Open(const char* path, int flags, mode_t mode) {
+  if (!EintrSafeFileDescriptor::Open(path, flags, mode))
+    return false;
+  OpenDirect(path, flags);
+  return true;
+}
+
+bool DirectIoFileDescriptor::Open(const char* path, int flags) {
+  if (!EintrSafeFileDescriptor::Open(path, flags))
+    return false;
+  OpenDirect(path, flags);
+  return true;
+}
+
+void DirectIoFileDescriptor::OpenDirect(const char* path, int flags) {
+  CHECK_EQ(direct_fd_, -1);
+  offset_ = 0;
+  failed_ = false;
+  if ((flags & O_ACCMODE) == O_RDONLY)
+    return;
+
+  direct_fd_ = HANDLE_EINTR(
+      open(path, (flags & ~(O_CREAT | O_EXCL | O_TRUNC)) | O_DIRECT));
+  if (direct_fd_ < 0) {
+    PLOG(WARNING) << "Unable to open " << path << " with O_DIRECT, writing "
+                  << "through the page cache.";
+    return;
+  }
+
+  if (!buffers_memory_) {
+    void* memory = nullptr;
+    if (posix_memalign(&memory, kAlignment, kBufferSize * kNumBuffers) != 0) {
+      LOG(WARNING) << "Unable to allocate the O_DIRECT buffers, writing "
+                   << "through the page cache.";
+      IGNORE_EINTR(close(direct_fd_));
+      direct_fd_ = -1;
+      return;
+    }
+    buffers_memory_ = static_cast<uint8_t*>(memory);
+  }
+  buffers_.resize(kNumBuffers);
+  for (size_t i = 0; i < kNumBuffers; i++) {
+    memset(&buffers_[i], 0, sizeof(buffers_[i]));
+    buffers_[i].data = buffers_memory_ + i * kBufferSize;
+  }
+  current_buffer_ = 0;
+  num_in_flight_ = 0;
+
+  if (!aio_context_ &&
+      syscall(__NR_io_setup, kNumBuffers, &aio_context_) != 0) {
+    PLOG(INFO) << "AIO is not available, writing the O_DIRECT buffers "
+               << "synchronously.";
+    aio_context_ = 0;
+  }
+}
+
+ssize_t DirectIoFileDescriptor::Read(void* buf, size_t count) {
+  CHECK_GE(fd_, 0);
+  if (!FlushWrites()) {
+    errno = EIO;
+    return -1;
+  }
+  ssize_t ret = HANDLE_EINTR(pread(fd_, buf, count, offset_));
+  if (ret > 0)
+    offset_ += ret;
+  return ret;
+}
+
+ssize_t DirectIoFileDescriptor::Write(const void* buf, size_t count) {
+  CHECK_GE(fd_, 0);
+  if (failed_) {
+    errno = EIO;
+    return -1;
+  }
+  if (direct_fd_ < 0) {
+    if (!utils::PWriteAll(fd_, buf, count, offset_))
+      return -1;
+    offset_ += count;
+    return count;
+  }
+
+  const uint8_t* bytes = static_cast<const uint8_t*>(buf);
+  size_t written = 0;
+  while (written < count) {
+    Buffer* buffer = &buffers_[current_buffer_];
+    if (buffer->size > 0 &&
+        buffer->offset + static_cast<off64_t>(buffer->size) != offset_) {
+      // The write doesn't continue the data in the current buffer.
+      if (!SubmitCurrentBuffer())
+        return -1;
+      continue;
+    }
+
+    size_t length;
+    if (buffer->size == 0 && offset_ % kAlignment) {
+      // Write up to the next aligned offset through the page cache.
+      length = std::min(count - written, kAlignment - offset_ % kAlignment);
+      if (!FlushWrites() ||
+          !utils::PWriteAll(fd_, bytes + written, length, offset_)) {
+        return -1;
+      }
+    } else {
+      if (buffer->size == 0)
+        buffer->offset = offset_;
+      length = std::min(count - written, kBufferSize - buffer->size);
+      memcpy(buffer->data + buffer->size, bytes + written, length);
+      buffer->size += length;
+    }
+    offset_ += length;
+    written += length;
+
+    if (buffer->size == kBufferSize && !SubmitCurrentBuffer())
+      return -1;
+  }
+  return written;
+}
+
+off64_t DirectIoFileDescriptor::Seek(off64_t offset, int whence) {
+  CHECK_GE(fd_, 0);
+  off64_t next_offset;
+  switch (whence) {
+    case SEEK_SET:
+      next_offset = offset;
+      break;
+    case SEEK_CUR:
+      next_offset = offset_ + offset;
+      break;
+    case SEEK_END: {
+      // The pending writes may extend the file.
+      if (!FlushWrites())
+        return -1;
+      off64_t end = lseek64(fd_, 0, SEEK_END);
+      if (end < 0)
+        return -1;
+      next_offset = end + offset;
+      break;
+    }
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+  if (next_offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  // The buffered data is written on the next Write() if it isn't contiguous.
+  offset_ = next_offset;
+  return offset_;
+}
+
+bool DirectIoFileDescriptor::BlkIoctl(int request,
+                                      uint64_t start,
+                                      uint64_t length,
+                                      int* result) {
+  return FlushWrites() &&
+         EintrSafeFileDescriptor::BlkIoctl(request, start, length, result);
+}
+
+bool DirectIoFileDescriptor::Flush() {
+  return FlushWrites() && EintrSafeFileDescriptor::Flush();
+}
+
+bool DirectIoFileDescriptor::Close() {
+  bool success = FlushWrites();
+  if (aio_context_) {
+    syscall(__NR_io_destroy, aio_context_);
+    aio_context_ = 0;
+    num_in_flight_ = 0;
+  }
+  if (direct_fd_ >= 0) {
+    if (IGNORE_EINTR(close(direct_fd_)))
+      success = false;
+    direct_fd_ = -1;
+  }
+  buffers_.clear();
+  offset_ = 0;
+  return EintrSafeFileDescriptor::Close() && success;
+}
+
+bool DirectIoFileDescriptor::SubmitCurrentBuffer() {
+  Buffer* buffer = &buffers_[current_buffer_];
+  if (buffer->size == 0)
+    return !failed_;
+
+  // Reaping the writes below resets the buffer once its write completed.
+  const off64_t offset = buffer->offset;
+  const size_t size = buffer->size;
+  const size_t aligned_size = size - size % kAlignment;
+  if (aligned_size > 0) {
+    // Writes in flight to the same blocks could complete in any order.
+    if (!WaitForOverlappingWrites(offset, aligned_size))
+      return false;
+    if (aio_context_) {
+      memset(&buffer->iocb, 0, sizeof(buffer->iocb));
+      buffer->iocb.aio_data = current_buffer_;
+      buffer->iocb.aio_lio_opcode = IOCB_CMD_PWRITE;
+      buffer->iocb.aio_fildes = direct_fd_;
+      buffer->iocb.aio_buf = reinterpret_cast<uint64_t>(buffer->data);
+      buffer->iocb.aio_nbytes = aligned_size;
+      buffer->iocb.aio_offset = offset;
+      struct iocb* iocbs[] = {&buffer->iocb};
+      if (HANDLE_EINTR(syscall(__NR_io_submit, aio_context_, 1, iocbs)) != 1) {
+        PLOG(ERROR) << "Unable to submit the write at offset " << offset;
+        failed_ = true;
+        return false;
+      }
+      buffer->submitted_size = aligned_size;
+      buffer->in_flight = true;
+      num_in_flight_++;
+    } else if (!utils::PWriteAll(
+                   direct_fd_, buffer->data, aligned_size, offset)) {
+      failed_ = true;
+      return false;
+    }
+  }
+
+  if (aligned_size < size) {
+    // Write the unaligned tail through the page cache once there are no
+    // writes in flight.
+    while (num_in_flight_ > 0) {
+      if (!ReapWrites(num_in_flight_))
+        return false;
+    }
+    if (!utils::PWriteAll(fd_,
+                          buffer->data + aligned_size,
+                          size - aligned_size,
+                          offset + aligned_size)) {
+      failed_ = true;
+      return false;
+    }
+  }
+  if (!buffer->in_flight)
+    buffer->size = 0;
+
+  current_buffer_ = (current_buffer_ + 1) % buffers_.size();
+  while (buffers_[current_buffer_].in_flight) {
+    if (!ReapWrites(1))
+      return false;
+  }
+  return !failed_;
+}
+
+bool DirectIoFileDescriptor::ReapWrites(size_t min_completions) {
+  struct io_event events[kNumBuffers];
+  int64_t ret = HANDLE_EINTR(syscall(__NR_io_getevents,
+                                      aio_context_,
+                                      min_completions,
+                                      kNumBuffers,
+                                      events,
+                                      nullptr));
+  if (ret < 0) {
+    PLOG(ERROR) << "Unable to wait for the writes in flight";
+    failed_ = true;
+    return false;
+  }
+  for (int64_t i = 0; i < ret; i++) {
+    Buffer* buffer = &buffers_[events[i].data];
+    if (events[i].res != static_cast<int64_t>(buffer->submitted_size)) {
+      LOG(ERROR) << "Write of " << buffer->submitted_size << " bytes at offset "
+                 << buffer->offset << " returned " << events[i].res;
+      failed_ = true;
+    }
+    buffer->in_flight = false;
+    buffer->size = 0;
+    num_in_flight_--;
+  }
+  return true;
+}
+
+bool DirectIoFileDescriptor::WaitForOverlappingWrites(off64_t offset,
+                                                      size_t size) {
+  const off64_t end = offset + static_cast<off64_t>(size);
+  for (const Buffer& buffer : buffers_) {
+    const off64_t buffer_end =
+        buffer.offset + static_cast<off64_t>(buffer.submitted_size);
+    while (buffer.in_flight && buffer.offset < end && offset < buffer_end) {
+      if (!ReapWrites(1))
+        return false;
+    }
+  }
+  return true;
+}
+
+bool DirectIoFileDescriptor::FlushWrites() {
+  if (direct_fd_ < 0)
+    return !failed_;
+  bool success = SubmitCurrentBuffer();
+  while (num_in_flight_ > 0) {
+    if (!ReapWrites(num_in_flight_))
+      return false;
+  }
+  return success && !failed_;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,111 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_DIRECT_IO_FILE_DESCRIPTOR_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_DIRECT_IO_FILE_DESCRIPTOR_H_
+
+#include <linux/aio_abi.h>
+
+#include <vector>
+
+#include "update_engine/payload_consumer/file_descriptor.h"
+
+namespace chromeos_update_engine {
+
+// A file descriptor that writes the data with O_DIRECT, bypassing the page
+// cache. Contiguous writes are collected in page aligned buffers which are
+// submitted with Linux AIO, so several of them are in flight at once. The
+// parts of the writes that are not aligned, as well as all the reads, go
+// through a second, regular file descriptor once all the pending writes
+// completed. If the file doesn't support O_DIRECT the data is written
+// through the regular file descriptor, and if AIO is not available the
+// buffers are written synchronously.
+//
+// The errors of the submitted writes are reported by the following call to
+// Write(), Read(), Flush() or Close().
+class DirectIoFileDescriptor : public EintrSafeFileDescriptor {
+ public:
+  DirectIoFileDescriptor();
+  ~DirectIoFileDescriptor() override;
+
+  bool Open(const char* path, int flags, mode_t mode) override;
+  bool Open(const char* path, int flags) override;
+  ssize_t Read(void* buf, size_t count) override;
+  ssize_t Write(const void* buf, size_t count) override;
+  off64_t Seek(off64_t offset, int whence) override;
+  bool BlkIoctl(int request,
+                uint64_t start,
+                uint64_t length,
+                int* result) override;
+  bool Flush() override;
+  bool Close() override;
+
+ private:
+  // A buffer collecting contiguous writes starting at |offset|.
+  struct Buffer {
+    uint8_t* data;
+    off64_t offset;
+    size_t size;
+    // The number of bytes submitted to the kernel, if |in_flight|.
+    size_t submitted_size;
+    bool in_flight;
+    struct iocb iocb;
+  };
+
+  // Opens |direct_fd_| and sets up the AIO context after |fd_| was opened
+  // with |flags|.
+  void OpenDirect(const char* path, int flags);
+
+  // Writes the page aligned part of the current buffer with |direct_fd_| and
+  // the rest with |fd_|, then moves to the next buffer once it is available.
+  bool SubmitCurrentBuffer();
+
+  // Waits until at least |min_completions| writes in flight completed. Only
+  // returns false if waiting failed; failed writes set |failed_|.
+  bool ReapWrites(size_t min_completions);
+
+  // Waits for the writes in flight that overlap [|offset|, |offset| +
+  // |size|).
+  bool WaitForOverlappingWrites(off64_t offset, size_t size);
+
+  // Submits the current buffer and waits for all the writes in flight.
+  bool FlushWrites();
+
+  // The file descriptor opened with O_DIRECT, or -1 if it isn't supported.
+  int direct_fd_{-1};
+
+  // The AIO context, or 0 if AIO is not available.
+  aio_context_t aio_context_{0};
+
+  // The current file offset, since the reads and writes are done with
+  // pread() and pwrite().
+  off64_t offset_{0};
+
+  // The memory of all the |buffers_|, allocated with posix_memalign().
+  uint8_t* buffers_memory_{nullptr};
+  std::vector<Buffer> buffers_;
+  size_t current_buffer_{0};
+  size_t num_in_flight_{0};
+
+  // Whether a submitted write failed.
+  bool failed_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(DirectIoFileDescriptor);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_DIRECT_IO_FILE_DESCRIPTOR_H_
@@ -0,0 +1,104 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/direct_io_file_descriptor.h"
+
+#include <fcntl.h>
+
+#include <algorithm>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+
+using chromeos_update_engine::test_utils::ExpectVectorsEq;
+
+namespace chromeos_update_engine {
+
+namespace {
+// Larger than all the buffers together, so some of them are reused.
+const size_t kFileSize = 4 * 1024 * 1024;
+}  // namespace
+
+class DirectIoFileDescriptorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    expected_.resize(kFileSize);
+    for (size_t i = 0; i < expected_.size(); i++)
+      expected_[i] = static_cast<uint8_t>(i * 13 + i / 4096);
+    brillo::Blob zero_blob(kFileSize, 0);
+    EXPECT_TRUE(utils::WriteFile(
+        temp_file_.path().c_str(), zero_blob.data(), zero_blob.size()));
+    EXPECT_TRUE(fd_->Open(temp_file_.path().c_str(), O_RDWR));
+  }
+
+  // Writes |count| bytes of |expected_| at |offset| with |fd_|.
+  void WriteAt(off64_t offset, size_t count) {
+    ASSERT_EQ(offset, fd_->Seek(offset, SEEK_SET));
+    EXPECT_TRUE(utils::WriteAll(fd_, expected_.data() + offset, count));
+  }
+
+  void ExpectFileContents() {
+    brillo::Blob data;
+    EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &data));
+    ExpectVectorsEq(expected_, data);
+  }
+
+  test_utils::ScopedTempFile temp_file_{"DirectIoFileDescriptor-file.XXXXXX"};
+  FileDescriptorPtr fd_{new DirectIoFileDescriptor};
+  brillo::Blob expected_;
+};
+
+TEST_F(DirectIoFileDescriptorTest, SequentialWritesTest) {
+  // Chunks that are not multiple of the alignment.
+  for (size_t offset = 0; offset < kFileSize; offset += 10000)
+    WriteAt(offset, std::min<size_t>(10000, kFileSize - offset));
+  EXPECT_TRUE(fd_->Close());
+  ExpectFileContents();
+}
+
+TEST_F(DirectIoFileDescriptorTest, UnalignedDiscontiguousWritesTest) {
+  // Write the second half first, then the first half in reverse order, so
+  // the writes in flight overlap with the unaligned ones.
+  const size_t kChunkSize = 300000;
+  WriteAt(kFileSize / 2 + 1, kFileSize / 2 - 1);
+  for (off64_t offset = kFileSize / 2 + 1; offset > 0;) {
+    size_t count = std::min<size_t>(kChunkSize, offset);
+    offset -= count;
+    WriteAt(offset, count);
+  }
+  EXPECT_TRUE(fd_->Flush());
+  ExpectFileContents();
+  EXPECT_TRUE(fd_->Close());
+}
+
+TEST_F(DirectIoFileDescriptorTest, ReadAfterWriteTest) {
+  WriteAt(100, 200000);
+  std::fill(expected_.begin(), expected_.begin() + 100, 0);
+  std::fill(expected_.begin() + 200100, expected_.end(), 0);
+
+  brillo::Blob data(300000);
+  ssize_t bytes_read;
+  EXPECT_TRUE(utils::PReadAll(fd_, data.data(), data.size(), 0, &bytes_read));
+  EXPECT_EQ(static_cast<ssize_t>(data.size()), bytes_read);
+  ExpectVectorsEq(
+      brillo::Blob(expected_.begin(), expected_.begin() + data.size()), data);
+  EXPECT_EQ(static_cast<off64_t>(kFileSize), fd_->Seek(0, SEEK_END));
+  EXPECT_TRUE(fd_->Close());
+}
+
+}  // namespace chromeos_update_engine
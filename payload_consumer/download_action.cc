@@ -20,25 +20,42 @@
 
 #include <algorithm>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <base/files/file_path.h>
+#include <base/files/file_util.h>
 #include <base/metrics/statistics_recorder.h>
 #include <base/strings/stringprintf.h>
 
 #include "update_engine/common/action_pipe.h"
 #include "update_engine/common/boot_control_interface.h"
 #include "update_engine/common/error_code_utils.h"
+#include "update_engine/common/file_fetcher.h"
+#include "update_engine/common/hardware_interface.h"
 #include "update_engine/common/multi_range_http_fetcher.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/metrics_reporter_interface.h"
 #include "update_engine/omaha_request_params.h"
 #include "update_engine/p2p_manager.h"
+#include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_state_interface.h"
 
 using base::FilePath;
 using std::string;
+using std::vector;
 
 namespace chromeos_update_engine {
 
+namespace {
+
+// The share of the memory allowed to apply the payload that holds the data
+// prefetched for the next payloads. The rest of a payload is downloaded when
+// it becomes the current one.
+const uint64_t kPrefetchMemoryShare = 4;
+
+}  // namespace
+
 DownloadAction::DownloadAction(PrefsInterface* prefs,
                                BootControlInterface* boot_control,
                                HardwareInterface* hardware,
@@ -55,6 +72,7 @@ DownloadAction::DownloadAction(PrefsInterface* prefs,
       code_(ErrorCode::kSuccess),
       delegate_(nullptr),
       p2p_sharing_fd_(-1),
+      p2p_file_size_(0),
       p2p_visible_(true) {
 #if BASE_VER < 576279
   base::StatisticsRecorder::Initialize();
@@ -114,6 +132,13 @@ bool DownloadAction::SetupP2PSharingFd() {
     return false;
   }
 
+  p2p_file_size_ = utils::FileSize(p2p_sharing_fd_);
+  if (p2p_file_size_ < 0) {
+    PLOG(ERROR) << "Error getting file status for p2p file";
+    CloseP2PSharingFd(true);  // Delete p2p file.
+    return false;
+  }
+
   // All good.
   LOG(INFO) << "Writing payload contents to " << path.value();
   p2p_manager->FileGetVisible(p2p_file_id_, &p2p_visible_);
@@ -138,33 +163,25 @@ void DownloadAction::WriteToP2PFile(const void* data,
   //  1. the p2p file didn't get properly synced to stable storage; or
   //  2. the file was deleted at bootup (it's in /var/cache after all); or
   //  3. other reasons
-  off_t p2p_size = utils::FileSize(p2p_sharing_fd_);
-  if (p2p_size < 0) {
-    PLOG(ERROR) << "Error getting file status for p2p file";
-    CloseP2PSharingFd(true);  // Delete p2p file.
-    return;
-  }
-  if (p2p_size < file_offset) {
+  //
+  // The size is tracked in |p2p_file_size_| rather than read from the file
+  // on every write, so each write is a single pwrite() call.
+  if (p2p_file_size_ < file_offset) {
     LOG(ERROR) << "Wanting to write to file offset " << file_offset
-               << " but existing p2p file is only " << p2p_size << " bytes.";
+               << " but existing p2p file is only " << p2p_file_size_
+               << " bytes.";
     CloseP2PSharingFd(true);  // Delete p2p file.
     return;
   }
 
-  off_t cur_file_offset = lseek(p2p_sharing_fd_, file_offset, SEEK_SET);
-  if (cur_file_offset != static_cast<off_t>(file_offset)) {
-    PLOG(ERROR) << "Error seeking to position " << file_offset
-                << " in p2p file";
+  if (!utils::PWriteAll(p2p_sharing_fd_, data, length, file_offset)) {
+    PLOG(ERROR) << "Error writing " << length << " bytes at file offset "
+                << file_offset << " in p2p file";
     CloseP2PSharingFd(true);  // Delete p2p file.
-  } else {
-    // OK, seeking worked, now write the data
-    ssize_t bytes_written = write(p2p_sharing_fd_, data, length);
-    if (bytes_written != static_cast<ssize_t>(length)) {
-      PLOG(ERROR) << "Error writing " << length << " bytes at file offset "
-                  << file_offset << " in p2p file";
-      CloseP2PSharingFd(true);  // Delete p2p file.
-    }
+    return;
   }
+  p2p_file_size_ = std::max(p2p_file_size_,
+                            file_offset + static_cast<off_t>(length));
 }
 
 void DownloadAction::PerformAction() {
@@ -172,7 +189,7 @@ void DownloadAction::PerformAction() {
 
   // Get the InstallPlan and read it
   CHECK(HasInputObject());
-  install_plan_ = GetInputObject();
+  install_plan_ = TakeInputObject();
   install_plan_.Dump();
 
   bytes_received_ = 0;
@@ -196,6 +213,12 @@ void DownloadAction::PerformAction() {
   if (!payload_)
     payload_ = &install_plan_.payloads[0];
 
+  // The update is only downloaded, so the new slot is left untouched.
+  if (install_plan_.stage_only) {
+    StartStaging();
+    return;
+  }
+
   LOG(INFO) << "Marking new slot as unbootable";
   if (!boot_control_->MarkSlotUnbootable(install_plan_.target_slot)) {
     LOG(WARNING) << "Unable to mark new slot "
@@ -208,7 +231,23 @@ void DownloadAction::PerformAction() {
 
 void DownloadAction::StartDownloading() {
   download_active_ = true;
-  http_fetcher_->ClearRanges();
+  // A payload staged by a previous attempt, or linked from a local copy, is
+  // read from the cache, where it starts at offset 0.
+  local_copy_path_.clear();
+  reading_cache_ =
+      base_offset_ == 0 &&
+      (PayloadCacheWriter::IsCached(payload_cache_dir_, *payload_) ||
+       LinkLocalCopy());
+  if (reading_cache_ && !cache_fetcher_) {
+    cache_fetcher_.reset(new MultiRangeHttpFetcher(new FileFetcher()));
+    cache_fetcher_->set_delegate(this);
+  }
+  MultiRangeHttpFetcher* const fetcher = active_fetcher();
+  fetcher->ClearRanges();
+  // The beginning of the payload may have been prefetched while the previous
+  // payload was being applied. It is applied first and only the rest of the
+  // payload is downloaded.
+  brillo::Blob prefetched_data = TakePrefetchedData();
   if (install_plan_.is_resume &&
       payload_ == &install_plan_.payloads[resume_payload_index_]) {
     // Resuming an update so fetch the update manifest metadata first.
@@ -216,34 +255,58 @@ void DownloadAction::StartDownloading() {
     int64_t manifest_signature_size = 0;
     prefs_->GetInt64(kPrefsManifestMetadataSize, &manifest_metadata_size);
     prefs_->GetInt64(kPrefsManifestSignatureSize, &manifest_signature_size);
-    http_fetcher_->AddRange(base_offset_,
+    fetcher->AddRange(base_offset_,
                             manifest_metadata_size + manifest_signature_size);
     // If there're remaining unprocessed data blobs, fetch them. Be careful not
     // to request data beyond the end of the payload to avoid 416 HTTP response
     // error codes.
     int64_t next_data_offset = 0;
     prefs_->GetInt64(kPrefsUpdateStateNextDataOffset, &next_data_offset);
+    // The data of the next operations received by the interrupted attempt,
+    // if it was saved, isn't downloaded again.
     uint64_t resume_offset =
-        manifest_metadata_size + manifest_signature_size + next_data_offset;
+        manifest_metadata_size + manifest_signature_size + next_data_offset +
+        DeltaPerformer::GetPartialOperationDataLength(prefs_);
     if (!payload_->size) {
-      http_fetcher_->AddRange(base_offset_ + resume_offset);
+      fetcher->AddRange(base_offset_ + resume_offset);
     } else if (resume_offset < payload_->size) {
-      http_fetcher_->AddRange(base_offset_ + resume_offset,
+      fetcher->AddRange(base_offset_ + resume_offset,
                               payload_->size - resume_offset);
     }
   } else {
-    if (payload_->size) {
-      http_fetcher_->AddRange(base_offset_, payload_->size);
+    const uint64_t prefetched_size = prefetched_data.size();
+    if (payload_->size && payload_->metadata_size &&
+        prefetched_size < payload_->metadata_size &&
+        payload_->metadata_size < payload_->size &&
+        fetcher->has_parallel_fetchers()) {
+      // Fetch the metadata as a range of its own when its size is known, so
+      // the other connections start downloading the operation data while the
+      // metadata is being downloaded, parsed and verified. With a single
+      // connection this would only add a request.
+      fetcher->AddRange(base_offset_ + prefetched_size,
+                              payload_->metadata_size - prefetched_size);
+      fetcher->AddRange(base_offset_ + payload_->metadata_size,
+                              payload_->size - payload_->metadata_size);
+    } else if (payload_->size) {
+      // A fully prefetched payload leaves no range, the transfer then
+      // completes right away.
+      if (prefetched_size < payload_->size) {
+        fetcher->AddRange(base_offset_ + prefetched_size,
+                                payload_->size - prefetched_size);
+      }
     } else {
       // If no payload size is passed we assume we read until the end of the
       // stream.
-      http_fetcher_->AddRange(base_offset_);
+      fetcher->AddRange(base_offset_);
     }
   }
 
   if (writer_ && writer_ != delta_performer_.get()) {
     LOG(INFO) << "Using writer for test.";
   } else {
+    // The staging writer of the previous payload, if any, was closed already.
+    staging_writer_.reset();
+    staging_buffer_size_ = hardware_->GetDownloadStagingBufferSize();
     delta_performer_.reset(new DeltaPerformer(prefs_,
                                               boot_control_,
                                               hardware_,
@@ -258,9 +321,13 @@ void DownloadAction::StartDownloading() {
     string file_id = utils::CalculateP2PFileId(payload_->hash, payload_->size);
     if (payload_state->GetUsingP2PForSharing()) {
       // If we're sharing the update, store the file_id to convey
-      // that we should write to the file.
-      p2p_file_id_ = file_id;
-      LOG(INFO) << "p2p file id: " << p2p_file_id_;
+      // that we should write to the file, unless it is the complete file
+      // the payload is applied from.
+      FilePath path = system_state_->p2p_manager()->FileGetPath(file_id);
+      if (local_copy_path_.empty() || local_copy_path_ != path) {
+        p2p_file_id_ = file_id;
+        LOG(INFO) << "p2p file id: " << p2p_file_id_;
+      }
     } else {
       // Even if we're not sharing the update, it could be that
       // there's a partial file from a previous attempt with the same
@@ -290,27 +357,225 @@ void DownloadAction::StartDownloading() {
     }
   }
 
-  http_fetcher_->BeginTransfer(install_plan_.download_url);
+  // The parallel connections download from the other peers serving the
+  // payload, if any. A bad peer sending corrupted data is caught by the
+  // operation hashes like any other corrupted download.
+  http_fetcher_->SetParallelUrls(install_plan_.download_peer_urls,
+                                 install_plan_.download_fallback_url);
+  StartPrefetching();
+
+  if (!prefetched_data.empty()) {
+    SeekToOffset(base_offset_);
+    // On failure the action was terminated already.
+    if (!ReceivedBytes(
+            fetcher, prefetched_data.data(), prefetched_data.size())) {
+      return;
+    }
+  }
+  if (reading_cache_) {
+    FilePath path =
+        PayloadCacheWriter::GetCachePath(payload_cache_dir_, *payload_);
+    LOG(INFO) << "Applying the payload cached in " << path.value();
+    fetcher->BeginTransfer("file://" + path.value());
+  } else {
+    http_fetcher_->BeginTransfer(install_plan_.download_url);
+  }
+}
+
+bool DownloadAction::LinkLocalCopy() {
+  if (payload_cache_dir_.empty() || !payload_->size || !payload_->hash.size())
+    return false;
+  vector<FilePath> candidates;
+  if (!preloaded_payload_dir_.empty()) {
+    candidates.push_back(
+        PayloadCacheWriter::GetCachePath(preloaded_payload_dir_, *payload_));
+  }
+  // Only a complete p2p file is used, a partial one is still being
+  // downloaded. This runs before a p2p file that isn't shared is deleted.
+  if (system_state_) {
+    P2PManager* p2p_manager = system_state_->p2p_manager();
+    string file_id = utils::CalculateP2PFileId(payload_->hash, payload_->size);
+    FilePath path = p2p_manager->FileGetPath(file_id);
+    if (!path.empty() &&
+        p2p_manager->FileGetSize(file_id) ==
+            static_cast<ssize_t>(payload_->size) &&
+        p2p_manager->FileGetExpectedSize(file_id) ==
+            static_cast<ssize_t>(payload_->size)) {
+      candidates.push_back(path);
+    }
+  }
+  for (const FilePath& path : candidates) {
+    if (!base::PathExists(path) ||
+        !PayloadCacheWriter::LinkLocalCopy(payload_cache_dir_, *payload_, path))
+      continue;
+    LOG(INFO) << "Linked the local copy " << path.value()
+              << " of the payload into the cache.";
+    local_copy_path_ = path;
+    return true;
+  }
+  return false;
+}
+
+void DownloadAction::StartStaging() {
+  for (; payload_ <= &install_plan_.payloads.back(); payload_++) {
+    const size_t payload_index = payload_ - &install_plan_.payloads[0];
+    // Only the payloads of a known size can be verified before they are
+    // cached.
+    if (!payload_->size || payload_->already_applied ||
+        PayloadCacheWriter::IsCached(payload_cache_dir_, *payload_)) {
+      bytes_received_previous_payloads_ += payload_->size;
+      continue;
+    }
+    string url;
+    if (system_state_)
+      url = system_state_->payload_state()->GetPayloadUrl(payload_index);
+    if (url.empty() || payload_cache_dir_.empty()) {
+      LOG(WARNING) << "Unable to stage payload " << payload_index;
+      bytes_received_previous_payloads_ += payload_->size;
+      continue;
+    }
+
+    cache_writer_.reset(new PayloadCacheWriter(payload_cache_dir_, *payload_));
+    if (!cache_writer_->Open()) {
+      cache_writer_.reset();
+      processor_->ActionComplete(this, ErrorCode::kDownloadWriteError);
+      return;
+    }
+    writer_ = cache_writer_.get();
+    download_active_ = true;
+    http_fetcher_->ClearRanges();
+    http_fetcher_->AddRange(base_offset_, payload_->size);
+    LOG(INFO) << "Staging payload " << payload_index << " from " << url;
+    http_fetcher_->BeginTransfer(url);
+    return;
+  }
+
+  // The update attempt ends here, as if the policy deferred it right away,
+  // and the update is applied from the cache by a later attempt.
+  LOG(INFO) << "The payloads are staged, applying them is deferred.";
+  processor_->ActionComplete(this, ErrorCode::kOmahaUpdateDeferredPerPolicy);
+}
+
+void DownloadAction::FinishStaging(bool successful) {
+  download_active_ = false;
+  writer_ = nullptr;
+  ErrorCode code = successful ? cache_writer_->Commit()
+                              : ErrorCode::kDownloadTransferError;
+  cache_writer_.reset();
+  if (code != ErrorCode::kSuccess) {
+    processor_->ActionComplete(this, code);
+    return;
+  }
+  bytes_received_previous_payloads_ += payload_->size;
+  payload_++;
+  StartStaging();
+}
+
+void DownloadAction::StartPrefetching() {
+  if (prefetchers_.empty() || !system_state_)
+    return;
+  PayloadStateInterface* const payload_state = system_state_->payload_state();
+  // The p2p peers only serve the payload being downloaded.
+  if (payload_state->GetUsingP2PForDownloading())
+    return;
+
+  // All the prefetches share a budget, so more prefetchers download ahead
+  // more payloads instead of using more memory.
+  uint64_t budget = hardware_->GetMaxApplyMemorySize() / kPrefetchMemoryShare;
+  size_t next_index = payload_ - &install_plan_.payloads[0] + 1;
+  for (const auto& prefetcher : prefetchers_) {
+    if (!prefetcher->idle()) {
+      next_index = std::max(next_index, prefetcher->payload_index() + 1);
+      budget -= std::min<uint64_t>(budget, prefetcher->length());
+    }
+  }
+  for (const auto& prefetcher : prefetchers_) {
+    if (budget == 0)
+      break;
+    if (!prefetcher->idle())
+      continue;
+    for (; next_index < install_plan_.payloads.size(); next_index++) {
+      const InstallPlan::Payload& payload = install_plan_.payloads[next_index];
+      // A resumed payload is downloaded from its checkpoint instead, and a
+      // cached payload is read from the cache.
+      if (!payload.size || payload.already_applied ||
+          (install_plan_.is_resume && next_index == resume_payload_index_) ||
+          PayloadCacheWriter::IsCached(payload_cache_dir_, payload)) {
+        continue;
+      }
+      string url = payload_state->GetPayloadUrl(next_index);
+      if (url.empty())
+        continue;
+      const uint64_t length = std::min(payload.size, budget);
+      prefetcher->Start(next_index, url, base_offset_, length);
+      budget -= length;
+      next_index++;
+      break;
+    }
+  }
+}
+
+brillo::Blob DownloadAction::TakePrefetchedData() {
+  const size_t payload_index = payload_ - &install_plan_.payloads[0];
+  for (const auto& prefetcher : prefetchers_) {
+    if (prefetcher->idle() || prefetcher->payload_index() != payload_index)
+      continue;
+    // The URL changed if the previous payload failed over to another one.
+    if (prefetcher->url() != install_plan_.download_url) {
+      LOG(INFO) << "Dropping the data of payload " << payload_index
+                << " prefetched from " << prefetcher->url();
+      prefetcher->Cancel();
+      break;
+    }
+    brillo::Blob data = prefetcher->Take();
+    LOG(INFO) << "Applying " << data.size() << " prefetched bytes of payload "
+              << payload_index;
+    return data;
+  }
+  return brillo::Blob();
+}
+
+void DownloadAction::CancelPrefetching() {
+  for (const auto& prefetcher : prefetchers_)
+    prefetcher->Cancel();
 }
 
 void DownloadAction::SuspendAction() {
-  http_fetcher_->Pause();
+  active_fetcher()->Pause();
+  for (const auto& prefetcher : prefetchers_)
+    prefetcher->Pause();
+  // The staging thread stops within the operation it is applying. Otherwise
+  // the operations are applied from this thread, which is not in the middle of
+  // one.
+  if (writer_ && writer_ == staging_writer_.get())
+    delta_performer_->PauseApply();
 }
 
 void DownloadAction::ResumeAction() {
-  http_fetcher_->Unpause();
+  if (delta_performer_)
+    delta_performer_->ResumeApply();
+  active_fetcher()->Unpause();
+  for (const auto& prefetcher : prefetchers_)
+    prefetcher->Unpause();
 }
 
 void DownloadAction::TerminateProcessing() {
   if (writer_) {
+    // Drop the payload data not applied yet, it is downloaded again on resume,
+    // and stop the operation being applied, which is applied again then.
+    if (writer_ == staging_writer_.get()) {
+      staging_writer_->Cancel();
+      delta_performer_->CancelApply();
+    }
     writer_->Close();
     writer_ = nullptr;
   }
   download_active_ = false;
+  CancelPrefetching();
   CloseP2PSharingFd(false);  // Keep p2p file.
   // Terminates the transfer. The action is terminated, if necessary, when the
   // TransferTerminated callback is received.
-  http_fetcher_->TerminateTransfer();
+  active_fetcher()->TerminateTransfer();
 }
 
 void DownloadAction::SeekToOffset(off_t offset) {
@@ -355,24 +620,64 @@ bool DownloadAction::ReceivedBytes(HttpFetcher* fetcher,
     system_state_->p2p_manager()->FileMakeVisible(p2p_file_id_);
     p2p_visible_ = true;
   }
+
+  // Once the manifest is parsed, stage the rest of the payload so the download
+  // continues while the operations are being applied. The manifest itself is
+  // always processed in this thread so |p2p_visible_| is set by now.
+  if (writer_ && writer_ == delta_performer_.get() &&
+      staging_buffer_size_ > 0 && delta_performer_->IsManifestValid()) {
+    LOG(INFO) << "Staging up to " << staging_buffer_size_
+              << " bytes of the payload while applying it.";
+    staging_writer_.reset(
+        new StagingFileWriter(delta_performer_.get(), staging_buffer_size_));
+    writer_ = staging_writer_.get();
+  }
   return true;
 }
 
 void DownloadAction::TransferComplete(HttpFetcher* fetcher, bool successful) {
+  if (install_plan_.stage_only) {
+    FinishStaging(successful);
+    return;
+  }
+  ErrorCode code =
+      successful ? ErrorCode::kSuccess : ErrorCode::kDownloadTransferError;
   if (writer_) {
+    // Apply the staged payload data before verifying the payload.
+    if (code == ErrorCode::kSuccess && writer_ == staging_writer_.get() &&
+        !staging_writer_->Flush(&code)) {
+      LOG(ERROR) << "Error " << utils::ErrorCodeToString(code) << " (" << code
+                 << ") when processing the staged payload.";
+      // Delete p2p file, if applicable.
+      if (!p2p_file_id_.empty())
+        CloseP2PSharingFd(true);
+    }
     LOG_IF(WARNING, writer_->Close() != 0) << "Error closing the writer.";
-    if (delta_performer_.get() == writer_) {
+    if (delta_performer_.get() == writer_ || staging_writer_.get() == writer_) {
       // no delta_performer_ in tests, so leave the test writer in place
       writer_ = nullptr;
     }
   }
   download_active_ = false;
-  ErrorCode code =
-      successful ? ErrorCode::kSuccess : ErrorCode::kDownloadTransferError;
   if (code == ErrorCode::kSuccess) {
     if (delta_performer_ && !payload_->already_applied)
       code = delta_performer_->VerifyPayload(payload_->hash, payload_->size);
+    // The cached payload is not needed anymore once it was applied, and it
+    // is downloaded again if it didn't verify.
+    if (reading_cache_) {
+      base::DeleteFile(
+          PayloadCacheWriter::GetCachePath(payload_cache_dir_, *payload_),
+          false);
+      if (code != ErrorCode::kSuccess && !local_copy_path_.empty()) {
+        LOG(WARNING) << "Deleting the local copy " << local_copy_path_.value()
+                     << " of the payload, which didn't verify.";
+        base::DeleteFile(local_copy_path_, false);
+      }
+    }
     if (code == ErrorCode::kSuccess) {
+      if (delta_performer_ && !payload_->already_applied)
+        ReportInstallOperationMetrics();
+
       if (payload_ < &install_plan_.payloads.back() &&
           system_state_->payload_state()->NextPayload()) {
         LOG(INFO) << "Incrementing to next payload";
@@ -407,12 +712,28 @@ void DownloadAction::TransferComplete(HttpFetcher* fetcher, bool successful) {
     }
   }
 
+  CancelPrefetching();
   // Write the path to the output pipe if we're successful.
   if (code == ErrorCode::kSuccess && HasOutputPipe())
-    SetOutputObject(install_plan_);
+    SetOutputObject(std::move(install_plan_));
   processor_->ActionComplete(this, code);
 }
 
+void DownloadAction::ReportInstallOperationMetrics() {
+  if (!system_state_)
+    return;
+  for (const auto& type_stats : delta_performer_->operation_stats()) {
+    const DeltaPerformer::OperationStats& stats = type_stats.second;
+    system_state_->metrics_reporter()->ReportInstallOperationMetrics(
+        InstallOperationTypeName(type_stats.first),
+        stats.count,
+        stats.duration,
+        stats.bytes_read,
+        stats.bytes_written,
+        stats.bytes_downloaded);
+  }
+}
+
 void DownloadAction::TransferTerminated(HttpFetcher* fetcher) {
   if (code_ != ErrorCode::kSuccess) {
     processor_->ActionComplete(this, code_);
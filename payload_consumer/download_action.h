@@ -23,6 +23,9 @@
 
 #include <memory>
 #include <string>
+#include <vector>
+
+#include <base/files/file_path.h>
 
 #include "update_engine/common/action.h"
 #include "update_engine/common/boot_control_interface.h"
@@ -30,6 +33,9 @@
 #include "update_engine/common/multi_range_http_fetcher.h"
 #include "update_engine/payload_consumer/delta_performer.h"
 #include "update_engine/payload_consumer/install_plan.h"
+#include "update_engine/payload_consumer/payload_cache_writer.h"
+#include "update_engine/payload_consumer/payload_prefetcher.h"
+#include "update_engine/payload_consumer/staging_file_writer.h"
 #include "update_engine/system_state.h"
 
 // The Download Action downloads a specified url to disk. The url should point
@@ -91,7 +97,7 @@ class DownloadAction : public InstallPlanAction, public HttpFetcherDelegate {
   // Testing
   void SetTestFileWriter(FileWriter* writer) { writer_ = writer; }
 
-  int GetHTTPResponseCode() { return http_fetcher_->http_response_code(); }
+  int GetHTTPResponseCode() { return active_fetcher()->http_response_code(); }
 
   // HttpFetcherDelegate methods (see http_fetcher.h)
   bool ReceivedBytes(HttpFetcher* fetcher,
@@ -106,6 +112,38 @@ class DownloadAction : public InstallPlanAction, public HttpFetcherDelegate {
 
   void set_base_offset(int64_t base_offset) { base_offset_ = base_offset; }
 
+  // Takes ownership of the passed in HttpFetcher, which downloads parts of the
+  // payload in parallel with the one passed to the constructor.
+  void AddParallelFetcher(HttpFetcher* http_fetcher) {
+    http_fetcher_->AddParallelFetcher(http_fetcher);
+  }
+
+  // Sets the size of the chunks the parallel fetchers download.
+  void set_parallel_chunk_size(size_t parallel_chunk_size) {
+    http_fetcher_->set_parallel_chunk_size(parallel_chunk_size);
+  }
+
+  // Takes ownership of the passed in HttpFetcher, which prefetches one of the
+  // payloads following the current one while the current one is downloaded
+  // and applied.
+  void AddPrefetchFetcher(HttpFetcher* http_fetcher) {
+    prefetchers_.emplace_back(new PayloadPrefetcher(http_fetcher));
+  }
+
+  // Sets the directory where the payloads are downloaded when the install
+  // plan is |stage_only|. The payloads found there are read from it instead
+  // of being downloaded again.
+  void set_payload_cache_dir(const base::FilePath& payload_cache_dir) {
+    payload_cache_dir_ = payload_cache_dir;
+  }
+
+  // Sets the read-only directory of the payloads preloaded on the image. A
+  // payload found there or complete in the p2p directory is linked into the
+  // payload cache and applied from it instead of being downloaded.
+  void set_preloaded_payload_dir(const base::FilePath& preloaded_payload_dir) {
+    preloaded_payload_dir_ = preloaded_payload_dir;
+  }
+
   HttpFetcher* http_fetcher() { return http_fetcher_.get(); }
 
   // Returns the p2p file id for the file being written or the empty
@@ -134,6 +172,40 @@ class DownloadAction : public InstallPlanAction, public HttpFetcherDelegate {
   // Start downloading the current payload using delta_performer.
   void StartDownloading();
 
+  // Links a local copy of the current payload, preloaded or complete in the
+  // p2p directory, into the |payload_cache_dir_|. Returns whether one was
+  // linked, its path is then kept in |local_copy_path_|.
+  bool LinkLocalCopy();
+
+  // Downloads the current payload, or the next one not cached yet, to the
+  // |payload_cache_dir_|. Completes the action once all the payloads are
+  // cached.
+  void StartStaging();
+
+  // Commits the payload downloaded to the cache and starts staging the next
+  // one.
+  void FinishStaging(bool successful);
+
+  // Returns the fetcher reading the current payload.
+  MultiRangeHttpFetcher* active_fetcher() {
+    return reading_cache_ ? cache_fetcher_.get() : http_fetcher_.get();
+  }
+
+  // Starts prefetching the payloads following the current one on the idle
+  // |prefetchers_|, in order.
+  void StartPrefetching();
+
+  // Returns the data prefetched for the current payload, if any, and releases
+  // its prefetcher.
+  brillo::Blob TakePrefetchedData();
+
+  // Stops all the prefetches and drops their data.
+  void CancelPrefetching();
+
+  // Reports the statistics of the operations applied by |delta_performer_|
+  // to the metrics reporter.
+  void ReportInstallOperationMetrics();
+
   // The InstallPlan passed in
   InstallPlan install_plan_;
 
@@ -151,17 +223,49 @@ class DownloadAction : public InstallPlanAction, public HttpFetcherDelegate {
   // Pointer to the MultiRangeHttpFetcher that does the http work.
   std::unique_ptr<MultiRangeHttpFetcher> http_fetcher_;
 
+  // Reads the current payload from the |payload_cache_dir_| instead of
+  // |http_fetcher_| when |reading_cache_| is set.
+  std::unique_ptr<MultiRangeHttpFetcher> cache_fetcher_;
+  bool reading_cache_{false};
+
+  // The directory of the cached payloads, empty if they are not cached.
+  base::FilePath payload_cache_dir_;
+
+  // The directory of the preloaded payloads, empty if there are none.
+  base::FilePath preloaded_payload_dir_;
+
+  // The local copy the cached payload was linked from, deleted if the
+  // payload doesn't verify so it isn't linked again.
+  base::FilePath local_copy_path_;
+
+  // Writes the current payload to the cache in |stage_only| mode.
+  std::unique_ptr<PayloadCacheWriter> cache_writer_;
+
+  // Download the beginning of the following payloads in parallel with the
+  // current one.
+  std::vector<std::unique_ptr<PayloadPrefetcher>> prefetchers_;
+
   // If |true|, the update is user initiated (vs. periodic update checks). Hence
   // the |delta_performer_| can decide not to use O_DSYNC flag for faster
   // update.
   bool interactive_;
 
   // The FileWriter that downloaded data should be written to. It will
-  // either point to *decompressing_file_writer_ or *delta_performer_.
+  // either point to *delta_performer_ or, once the manifest is parsed, to
+  // *staging_writer_.
   FileWriter* writer_;
 
   std::unique_ptr<DeltaPerformer> delta_performer_;
 
+  // Stages the downloaded data and writes it to |delta_performer_| from a
+  // separate thread. Declared after |delta_performer_| so it is destroyed
+  // first.
+  std::unique_ptr<StagingFileWriter> staging_writer_;
+
+  // The size of the |staging_writer_| buffer for the current payload, or 0 if
+  // the staging is disabled.
+  size_t staging_buffer_size_{0};
+
   // Used by TransferTerminated to figure if this action terminated itself or
   // was terminated by the action processor.
   ErrorCode code_;
@@ -181,6 +285,10 @@ class DownloadAction : public InstallPlanAction, public HttpFetcherDelegate {
   // if we're not using p2p to share.
   int p2p_sharing_fd_;
 
+  // The size of the p2p file. It is read when the file is opened and then
+  // updated with the writes, since nothing else writes to the file.
+  off_t p2p_file_size_;
+
   // Set to |false| if p2p file is not visible.
   bool p2p_visible_;
 
@@ -27,6 +27,7 @@
 #include <base/bind.h>
 #include <base/files/file_path.h>
 #include <base/files/file_util.h>
+#include <base/files/scoped_temp_dir.h>
 #include <base/location.h>
 #include <base/strings/stringprintf.h>
 #include <brillo/message_loops/fake_message_loop.h>
@@ -333,6 +334,119 @@ TEST(DownloadActionTest, MultiPayloadProgressTest) {
   EXPECT_FALSE(loop.PendingTasks());
 }
 
+TEST(DownloadActionTest, MultiPayloadPrefetchTest) {
+  brillo::Blob first_payload(4 * kMockHttpFetcherChunkSize + 256);
+  brillo::Blob second_payload(2 * kMockHttpFetcherChunkSize);
+  brillo::FakeMessageLoop loop(nullptr);
+  loop.SetAsCurrent();
+  FakeSystemState fake_system_state;
+  const string second_url = "http://fake/second_payload";
+  EXPECT_CALL(*fake_system_state.mock_payload_state(), NextPayload())
+      .WillOnce(Return(true));
+  EXPECT_CALL(*fake_system_state.mock_payload_state(), GetPayloadUrl(1))
+      .WillOnce(Return(second_url));
+  EXPECT_CALL(*fake_system_state.mock_payload_state(), GetCurrentUrl())
+      .WillRepeatedly(Return(second_url));
+
+  MockFileWriter mock_file_writer;
+  EXPECT_CALL(mock_file_writer, Close()).WillRepeatedly(Return(0));
+  EXPECT_CALL(mock_file_writer, Write(_, _, _))
+      .WillRepeatedly(
+          DoAll(SetArgPointee<2>(ErrorCode::kSuccess), Return(true)));
+
+  InstallPlan install_plan;
+  install_plan.payloads.push_back(
+      {.size = first_payload.size(), .type = InstallPayloadType::kFull});
+  install_plan.payloads.push_back(
+      {.size = second_payload.size(), .type = InstallPayloadType::kFull});
+  const uint64_t total_size = first_payload.size() + second_payload.size();
+  auto feeder_action = std::make_unique<ObjectFeederAction<InstallPlan>>();
+  feeder_action->set_obj(install_plan);
+  MockPrefs prefs;
+  // takes ownership of passed in HttpFetchers
+  auto download_action = std::make_unique<DownloadAction>(
+      &prefs,
+      fake_system_state.boot_control(),
+      fake_system_state.hardware(),
+      &fake_system_state,
+      new MockHttpFetcher(first_payload.data(), first_payload.size(), nullptr),
+      false /* interactive */);
+  download_action->AddPrefetchFetcher(new MockHttpFetcher(
+      second_payload.data(), second_payload.size(), nullptr));
+  download_action->SetTestFileWriter(&mock_file_writer);
+  BondActions(feeder_action.get(), download_action.get());
+  MockDownloadActionDelegate download_delegate;
+  download_action->set_delegate(&download_delegate);
+  // The second payload was prefetched while the first one was downloaded, so
+  // it is applied at once without being downloaded again.
+  EXPECT_CALL(download_delegate, BytesReceived(_, _, total_size)).Times(5);
+  EXPECT_CALL(download_delegate,
+              BytesReceived(second_payload.size(), total_size, total_size));
+
+  ActionProcessor processor;
+  processor.EnqueueAction(std::move(feeder_action));
+  processor.EnqueueAction(std::move(download_action));
+
+  loop.PostTask(
+      FROM_HERE,
+      base::Bind(
+          [](ActionProcessor* processor) { processor->StartProcessing(); },
+          base::Unretained(&processor)));
+  loop.Run();
+  EXPECT_FALSE(loop.PendingTasks());
+}
+
+TEST(DownloadActionTest, StageOnlyCachesThePayloadTest) {
+  brillo::Blob data(3 * kMockHttpFetcherChunkSize + 256, 'x');
+  brillo::FakeMessageLoop loop(nullptr);
+  loop.SetAsCurrent();
+  FakeSystemState fake_system_state;
+  EXPECT_CALL(*fake_system_state.mock_payload_state(), GetPayloadUrl(0))
+      .WillOnce(Return("http://fake/payload"));
+  // The payloads are only staged, so the update doesn't move forward.
+  EXPECT_CALL(*fake_system_state.mock_payload_state(), NextPayload()).Times(0);
+  base::ScopedTempDir cache_dir;
+  ASSERT_TRUE(cache_dir.CreateUniqueTempDir());
+
+  InstallPlan install_plan;
+  install_plan.stage_only = true;
+  InstallPlan::Payload payload;
+  payload.size = data.size();
+  ASSERT_TRUE(HashCalculator::RawHashOfData(data, &payload.hash));
+  install_plan.payloads.push_back(payload);
+  auto feeder_action = std::make_unique<ObjectFeederAction<InstallPlan>>();
+  feeder_action->set_obj(install_plan);
+  MockPrefs prefs;
+  auto download_action = std::make_unique<DownloadAction>(
+      &prefs,
+      fake_system_state.boot_control(),
+      fake_system_state.hardware(),
+      &fake_system_state,
+      new MockHttpFetcher(data.data(), data.size(), nullptr),
+      false /* interactive */);
+  download_action->set_payload_cache_dir(cache_dir.GetPath());
+  BondActions(feeder_action.get(), download_action.get());
+
+  DownloadActionTestProcessorDelegate delegate;
+  delegate.expected_code_ = ErrorCode::kOmahaUpdateDeferredPerPolicy;
+  delegate.expected_data_ = data;
+  delegate.path_ =
+      PayloadCacheWriter::GetCachePath(cache_dir.GetPath(), payload).value();
+  ActionProcessor processor;
+  processor.set_delegate(&delegate);
+  processor.EnqueueAction(std::move(feeder_action));
+  processor.EnqueueAction(std::move(download_action));
+
+  loop.PostTask(
+      FROM_HERE,
+      base::Bind(
+          [](ActionProcessor* processor) { processor->StartProcessing(); },
+          base::Unretained(&processor)));
+  loop.Run();
+  EXPECT_FALSE(loop.PendingTasks());
+  EXPECT_TRUE(PayloadCacheWriter::IsCached(cache_dir.GetPath(), payload));
+}
+
 namespace {
 class TerminateEarlyTestProcessorDelegate : public ActionProcessorDelegate {
  public:
@@ -32,10 +32,29 @@ bool DirectExtentReader::Init(FileDescriptorPtr fd,
                               const RepeatedPtrField<Extent>& extents,
                               uint32_t block_size) {
   fd_ = fd;
-  extents_ = extents;
   block_size_ = block_size;
+  // Consecutive extents that are also contiguous in |fd| are merged so they
+  // are read with a single read.
+  extents_.Clear();
+  for (const Extent& extent : extents) {
+    if (extent.num_blocks() == 0)
+      continue;
+    if (!extents_.empty()) {
+      Extent* last = extents_.Mutable(extents_.size() - 1);
+      if (last->start_block() != kSparseHole &&
+          last->start_block() + last->num_blocks() == extent.start_block()) {
+        last->set_num_blocks(last->num_blocks() + extent.num_blocks());
+        continue;
+      }
+    }
+    *extents_.Add() = extent;
+  }
   cur_extent_ = extents_.begin();
 
+  offset_ = 0;
+  cur_extent_bytes_read_ = 0;
+  total_size_ = 0;
+  extents_upper_bounds_.clear();
   extents_upper_bounds_.reserve(extents_.size() + 1);
   // We add this pad as the first element to not bother with boundary checks
   // later.
@@ -98,4 +117,23 @@ bool DirectExtentReader::Read(void* buffer, size_t count) {
   return true;
 }
 
+bool DirectExtentReader::Prefetch(uint64_t count) {
+  auto extent = cur_extent_;
+  uint64_t extent_bytes_read = cur_extent_bytes_read_;
+  while (count > 0 && extent != extents_.end()) {
+    uint64_t bytes_to_prefetch = std::min(
+        count, extent->num_blocks() * block_size_ - extent_bytes_read);
+    // A length of 0 would prefetch up to the end of the file.
+    if (bytes_to_prefetch > 0 &&
+        !fd_->Prefetch(extent->start_block() * block_size_ + extent_bytes_read,
+                       bytes_to_prefetch)) {
+      return false;
+    }
+    count -= bytes_to_prefetch;
+    extent_bytes_read = 0;
+    extent++;
+  }
+  return true;
+}
+
 }  // namespace chromeos_update_engine
@@ -40,6 +40,11 @@ class ExtentReader {
 
   // Returns true on success.
   virtual bool Read(void* buffer, size_t count) = 0;
+
+  // Hints that the next |count| bytes from the current offset will be read
+  // soon, so they can be read from the storage in the background. Returns
+  // whether the hint is supported.
+  virtual bool Prefetch(uint64_t count) = 0;
 };
 
 // DirectExtentReader is probably the simplest ExtentReader implementation.
@@ -54,6 +59,7 @@ class DirectExtentReader : public ExtentReader {
             uint32_t block_size) override;
   bool Seek(uint64_t offset) override;
   bool Read(void* bytes, size_t count) override;
+  bool Prefetch(uint64_t count) override;
 
  private:
   FileDescriptorPtr fd_{nullptr};
@@ -27,6 +27,7 @@
 
 #include "update_engine/common/test_utils.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/fake_file_descriptor.h"
 #include "update_engine/payload_consumer/file_descriptor.h"
 #include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_generator/extent_ranges.h"
@@ -167,4 +168,46 @@ TEST_F(ExtentReaderTest, RandomReadTest) {
   }
 }
 
+TEST_F(ExtentReaderTest, PrefetchTest) {
+  auto fake_fd = std::make_shared<FakeFileDescriptor>();
+  vector<Extent> extents = {
+      ExtentForRange(1, 2), ExtentForRange(10, 0), ExtentForRange(20, 3)};
+  DirectExtentReader reader;
+  EXPECT_TRUE(
+      reader.Init(fake_fd, {extents.begin(), extents.end()}, kBlockSize));
+  EXPECT_TRUE(reader.Seek(12));
+  // Prefetching stops at the end of the extents and skips the empty ones.
+  EXPECT_TRUE(reader.Prefetch(1000));
+  vector<std::pair<uint64_t, uint64_t>> expected_prefetch_ops = {
+      {20, 4}, {20 * kBlockSize, 3 * kBlockSize}};
+  EXPECT_EQ(expected_prefetch_ops, fake_fd->GetPrefetchOps());
+}
+
+TEST_F(ExtentReaderTest, MergeContiguousExtentsTest) {
+  auto fake_fd = std::make_shared<FakeFileDescriptor>();
+  vector<Extent> extents = {ExtentForRange(1, 2),
+                            ExtentForRange(3, 0),
+                            ExtentForRange(3, 1),
+                            ExtentForRange(10, 1),
+                            ExtentForRange(5, 1)};
+  DirectExtentReader reader;
+  EXPECT_TRUE(
+      reader.Init(fake_fd, {extents.begin(), extents.end()}, kBlockSize));
+  // The extents contiguous in the file are read at once, in order.
+  brillo::Blob blob(utils::BlocksInExtents(extents) * kBlockSize);
+  EXPECT_TRUE(reader.Read(blob.data(), blob.size()));
+  vector<std::pair<uint64_t, uint64_t>> expected_read_ops = {
+      {1 * kBlockSize, 3 * kBlockSize},
+      {10 * kBlockSize, kBlockSize},
+      {5 * kBlockSize, kBlockSize}};
+  EXPECT_EQ(expected_read_ops, fake_fd->GetReadOps());
+
+  // Seeking in the middle of a merged extent.
+  EXPECT_TRUE(reader.Seek(2 * kBlockSize));
+  EXPECT_TRUE(reader.Read(blob.data(), 2 * kBlockSize));
+  ASSERT_EQ(5u, fake_fd->GetReadOps().size());
+  EXPECT_EQ((std::pair<uint64_t, uint64_t>(3 * kBlockSize, kBlockSize)),
+            fake_fd->GetReadOps()[3]);
+}
+
 }  // namespace chromeos_update_engine
@@ -17,52 +17,143 @@
 #include "update_engine/payload_consumer/extent_writer.h"
 
 #include <errno.h>
+#include <linux/fs.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include <algorithm>
 
+#include "update_engine/common/trace.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_consumer/payload_constants.h"
 
+using google::protobuf::RepeatedPtrField;
 using std::min;
 
 namespace chromeos_update_engine {
 
+const size_t DirectExtentWriter::kMinZeroRunSize = 128 * 1024;
+
+bool DirectExtentWriter::Init(FileDescriptorPtr fd,
+                              const RepeatedPtrField<Extent>& extents,
+                              uint32_t block_size) {
+  fd_ = fd;
+  block_size_ = block_size;
+  // Only the byte ranges of the extents are kept, merging the adjacent ones.
+  ranges_.clear();
+  ranges_.reserve(extents.size());
+  for (const Extent& extent : extents) {
+    const uint64_t length = extent.num_blocks() * block_size_;
+    if (length == 0)
+      continue;
+    const bool sparse_hole = extent.start_block() == kSparseHole;
+    const off64_t offset = sparse_hole ? 0 : extent.start_block() * block_size_;
+    ByteRange* last = ranges_.empty() ? nullptr : &ranges_.back();
+    if (last && last->sparse_hole == sparse_hole &&
+        (sparse_hole ||
+         last->offset + static_cast<off64_t>(last->length) == offset)) {
+      last->length += length;
+      continue;
+    }
+    ranges_.push_back({offset, length, sparse_hole});
+  }
+  cur_range_ = ranges_.begin();
+  range_bytes_written_ = 0;
+  return true;
+}
+
 bool DirectExtentWriter::Write(const void* bytes, size_t count) {
   if (count == 0)
     return true;
+  UE_TRACE_SCOPE("DirectExtentWriter::Write");
   const char* c_bytes = reinterpret_cast<const char*>(bytes);
   size_t bytes_written = 0;
   while (bytes_written < count) {
-    TEST_AND_RETURN_FALSE(cur_extent_ != extents_.end());
-    uint64_t bytes_remaining_cur_extent =
-        cur_extent_->num_blocks() * block_size_ - extent_bytes_written_;
-    CHECK_NE(bytes_remaining_cur_extent, static_cast<uint64_t>(0));
+    TEST_AND_RETURN_FALSE(cur_range_ != ranges_.end());
+    uint64_t bytes_remaining_cur_range =
+        cur_range_->length - range_bytes_written_;
     size_t bytes_to_write =
         static_cast<size_t>(min(static_cast<uint64_t>(count - bytes_written),
-                                bytes_remaining_cur_extent));
+                                bytes_remaining_cur_range));
     TEST_AND_RETURN_FALSE(bytes_to_write > 0);
 
-    if (cur_extent_->start_block() != kSparseHole) {
-      const off64_t offset =
-          cur_extent_->start_block() * block_size_ + extent_bytes_written_;
-      TEST_AND_RETURN_FALSE_ERRNO(fd_->Seek(offset, SEEK_SET) !=
-                                  static_cast<off64_t>(-1));
-      TEST_AND_RETURN_FALSE(
-          utils::WriteAll(fd_, c_bytes + bytes_written, bytes_to_write));
+    if (!cur_range_->sparse_hole) {
+      TEST_AND_RETURN_FALSE(WriteAt(cur_range_->offset + range_bytes_written_,
+                                    c_bytes + bytes_written,
+                                    bytes_to_write));
     }
     bytes_written += bytes_to_write;
-    extent_bytes_written_ += bytes_to_write;
-    if (bytes_remaining_cur_extent == bytes_to_write) {
-      // We filled this extent
-      CHECK_EQ(extent_bytes_written_, cur_extent_->num_blocks() * block_size_);
-      // move to next extent
-      extent_bytes_written_ = 0;
-      cur_extent_++;
+    range_bytes_written_ += bytes_to_write;
+    if (bytes_remaining_cur_range == bytes_to_write) {
+      // We filled this range, move to the next one.
+      range_bytes_written_ = 0;
+      cur_range_++;
+      // The writer isn't told when the data ends, so the run of zeros is
+      // zeroed once the last range is filled.
+      if (cur_range_ == ranges_.end())
+        TEST_AND_RETURN_FALSE(FlushZeroRun());
     }
   }
   return true;
 }
 
+bool DirectExtentWriter::WriteAt(off64_t offset,
+                                 const char* bytes,
+                                 size_t count) {
+  // Look for whole blocks of zeros, aligned to the blocks of |fd_|, and write
+  // the data between them at once.
+  size_t data_start = 0;
+  size_t pos = 0;
+  while (zero_ioctl_supported_ && *zero_ioctl_supported_ && pos < count) {
+    size_t block_end =
+        min(count, pos + block_size_ - (offset + pos) % block_size_);
+    if (block_end - pos == block_size_ &&
+        utils::IsZeroBlock(bytes + pos, block_size_)) {
+      if (data_start < pos) {
+        TEST_AND_RETURN_FALSE(utils::PWriteAll(
+            fd_, bytes + data_start, pos - data_start, offset + data_start));
+      }
+      if (zero_run_offset_ + static_cast<off64_t>(zero_run_length_) !=
+          offset + static_cast<off64_t>(pos)) {
+        TEST_AND_RETURN_FALSE(FlushZeroRun());
+        zero_run_offset_ = offset + pos;
+      }
+      zero_run_length_ += block_size_;
+      data_start = block_end;
+    }
+    pos = block_end;
+  }
+  if (data_start < count) {
+    TEST_AND_RETURN_FALSE(utils::PWriteAll(
+        fd_, bytes + data_start, count - data_start, offset + data_start));
+  }
+  return true;
+}
+
+bool DirectExtentWriter::FlushZeroRun() {
+  if (!zero_run_length_)
+    return true;
+  const uint64_t length = zero_run_length_;
+  zero_run_length_ = 0;
+#ifdef BLKZEROOUT
+  if (length >= kMinZeroRunSize) {
+    int result = 0;
+    if (fd_->BlkIoctl(BLKZEROOUT, zero_run_offset_, length, &result) &&
+        result == 0) {
+      return true;
+    }
+    LOG(INFO) << "The BLKZEROOUT ioctl failed, writing zeros instead.";
+    *zero_ioctl_supported_ = false;
+  }
+#endif  // BLKZEROOUT
+  brillo::Blob zeros(min(length, static_cast<uint64_t>(kMinZeroRunSize)));
+  for (uint64_t offset = 0; offset < length; offset += zeros.size()) {
+    uint64_t chunk_length =
+        min(length - offset, static_cast<uint64_t>(zeros.size()));
+    TEST_AND_RETURN_FALSE(utils::PWriteAll(
+        fd_, zeros.data(), chunk_length, zero_run_offset_ + offset));
+  }
+  return true;
+}
+
 }  // namespace chromeos_update_engine
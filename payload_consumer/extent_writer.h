@@ -19,6 +19,7 @@
 
 #include <memory>
 #include <utility>
+#include <vector>
 
 #include <base/logging.h>
 #include <brillo/secure_blob.h>
@@ -47,33 +48,61 @@ class ExtentWriter {
 };
 
 // DirectExtentWriter is probably the simplest ExtentWriter implementation.
-// It writes the data directly into the extents.
+// It writes the data directly into the extents, with a single write for each
+// run of adjacent extents.
+//
+// When |zero_ioctl_supported| is set and points to true, the runs of at least
+// kMinZeroRunSize bytes of whole blocks of zeros are zeroed with a BLKZEROOUT
+// ioctl instead, which discards them on the devices where the discarded
+// blocks read as zeros. |*zero_ioctl_supported| is cleared the first time the
+// ioctl fails, and the zeros are written then.
+//
+// It is final, so the decompressing ExtentWriters instantiated with it as
+// their underlying writer call it without a virtual call for every chunk.
 
-class DirectExtentWriter : public ExtentWriter {
+class DirectExtentWriter final : public ExtentWriter {
  public:
-  DirectExtentWriter() = default;
+  // The smallest run of zeros worth an ioctl.
+  static const size_t kMinZeroRunSize;
+
+  explicit DirectExtentWriter(bool* zero_ioctl_supported = nullptr)
+      : zero_ioctl_supported_(zero_ioctl_supported) {}
   ~DirectExtentWriter() override = default;
 
   bool Init(FileDescriptorPtr fd,
             const google::protobuf::RepeatedPtrField<Extent>& extents,
-            uint32_t block_size) override {
-    fd_ = fd;
-    block_size_ = block_size;
-    extents_ = extents;
-    cur_extent_ = extents_.begin();
-    return true;
-  }
+            uint32_t block_size) override;
   bool Write(const void* bytes, size_t count) override;
 
  private:
+  // Writes the |count| bytes at |bytes| at |offset| of |fd_|, deferring the
+  // runs of blocks of zeros when the ioctl may be used.
+  bool WriteAt(off64_t offset, const char* bytes, size_t count);
+
+  // Zeroes the deferred run of zeros, if any.
+  bool FlushZeroRun();
+
   FileDescriptorPtr fd_{nullptr};
+  bool* zero_ioctl_supported_;
+
+  // The deferred run of zeros of |fd_|, in bytes.
+  off64_t zero_run_offset_{0};
+  uint64_t zero_run_length_{0};
 
   size_t block_size_{0};
-  // Bytes written into |cur_extent_| thus far.
-  uint64_t extent_bytes_written_{0};
-  google::protobuf::RepeatedPtrField<Extent> extents_;
-  // The next call to write should correspond to |cur_extents_|.
-  google::protobuf::RepeatedPtrField<Extent>::iterator cur_extent_;
+
+  // A range of bytes of |fd_| made of adjacent extents, which is written with
+  // a single write.
+  struct ByteRange {
+    off64_t offset;
+    uint64_t length;
+    bool sparse_hole;
+  };
+  std::vector<ByteRange> ranges_;
+  // The next call to write should correspond to |cur_range_|.
+  std::vector<ByteRange>::const_iterator cur_range_;
+  // Bytes written into |cur_range_| thus far.
+  uint64_t range_bytes_written_{0};
 };
 
 }  // namespace chromeos_update_engine
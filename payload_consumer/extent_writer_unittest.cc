@@ -42,7 +42,18 @@ static_assert(sizeof(off_t) == 8, "off_t not 64 bit");
 
 namespace {
 const size_t kBlockSize = 4096;
-}
+
+// A file descriptor counting the calls to Write().
+class WriteCountingFileDescriptor : public EintrSafeFileDescriptor {
+ public:
+  ssize_t Write(const void* buf, size_t count) override {
+    writes_++;
+    return EintrSafeFileDescriptor::Write(buf, count);
+  }
+
+  size_t writes_{0};
+};
+}  // namespace
 
 class ExtentWriterTest : public ::testing::Test {
  protected:
@@ -180,4 +191,59 @@ TEST_F(ExtentWriterTest, SparseFileTest) {
   ExpectVectorsEq(expected_data, resultant_data);
 }
 
+TEST_F(ExtentWriterTest, AdjacentExtentsTest) {
+  auto fd = std::make_shared<WriteCountingFileDescriptor>();
+  ASSERT_TRUE(fd->Open(temp_file_.path().c_str(), O_RDWR, 0600));
+  // Blocks 1 to 3 are written at once, then block 0.
+  vector<Extent> extents = {
+      ExtentForRange(1, 1), ExtentForRange(2, 2), ExtentForRange(0, 1)};
+  brillo::Blob data(kBlockSize * 4);
+  test_utils::FillWithData(&data);
+
+  DirectExtentWriter direct_writer;
+  EXPECT_TRUE(
+      direct_writer.Init(fd, {extents.begin(), extents.end()}, kBlockSize));
+  EXPECT_TRUE(direct_writer.Write(data.data(), data.size()));
+  EXPECT_EQ(2U, fd->writes_);
+  EXPECT_TRUE(fd->Close());
+
+  brillo::Blob result_file;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &result_file));
+  brillo::Blob expected_file(data.begin() + kBlockSize * 3, data.end());
+  expected_file.insert(
+      expected_file.end(), data.begin(), data.begin() + kBlockSize * 3);
+  ExpectVectorsEq(expected_file, result_file);
+}
+
+TEST_F(ExtentWriterTest, ZeroRunTest) {
+  // The file holds other data, which the zeros must replace.
+  const size_t block_count = 40;
+  brillo::Blob old_data(block_count * kBlockSize, 0xff);
+  ASSERT_TRUE(utils::WriteFile(
+      temp_file_.path().c_str(), old_data.data(), old_data.size()));
+
+  // A short run of zeros in blocks 1 and 2 and a long one from block 4.
+  brillo::Blob data(block_count * kBlockSize, 0);
+  test_utils::FillWithData(&data);
+  std::fill(data.begin() + kBlockSize, data.begin() + 3 * kBlockSize, 0);
+  std::fill(data.begin() + 4 * kBlockSize, data.end(), 0);
+  ASSERT_LE(DirectExtentWriter::kMinZeroRunSize, data.size() - 4 * kBlockSize);
+
+  // The ioctl doesn't work on regular files, so the zeros are written.
+  bool zero_ioctl_supported = true;
+  DirectExtentWriter direct_writer(&zero_ioctl_supported);
+  vector<Extent> extents = {ExtentForRange(0, block_count)};
+  EXPECT_TRUE(
+      direct_writer.Init(fd_, {extents.begin(), extents.end()}, kBlockSize));
+  for (size_t offset = 0; offset < data.size(); offset += 5000) {
+    EXPECT_TRUE(direct_writer.Write(data.data() + offset,
+                                    min(data.size() - offset, size_t{5000})));
+  }
+  EXPECT_FALSE(zero_ioctl_supported);
+
+  brillo::Blob result_file;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &result_file));
+  ExpectVectorsEq(data, result_file);
+}
+
 }  // namespace chromeos_update_engine
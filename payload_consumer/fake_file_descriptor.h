@@ -69,6 +69,11 @@ class FakeFileDescriptor : public FileDescriptor {
     return false;
   }
 
+  bool Prefetch(uint64_t offset, uint64_t length) override {
+    prefetch_ops_.emplace_back(offset, length);
+    return true;
+  }
+
   bool Flush() override { return open_; }
 
   bool Close() override {
@@ -101,6 +106,12 @@ class FakeFileDescriptor : public FileDescriptor {
     return read_ops_;
   }
 
+  // Return the list of ranges of bytes passed to Prefetch() as (offset,
+  // length).
+  std::vector<std::pair<uint64_t, uint64_t>> GetPrefetchOps() const {
+    return prefetch_ops_;
+  }
+
  private:
   // Whether the fake file is open.
   bool open_{false};
@@ -118,6 +129,9 @@ class FakeFileDescriptor : public FileDescriptor {
   // List of reads performed as (offset, length) of the read request.
   std::vector<std::pair<uint64_t, uint64_t>> read_ops_;
 
+  // List of prefetch hints as (offset, length).
+  std::vector<std::pair<uint64_t, uint64_t>> prefetch_ops_;
+
   DISALLOW_COPY_AND_ASSIGN(FakeFileDescriptor);
 };
 
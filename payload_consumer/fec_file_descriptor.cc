@@ -16,8 +16,81 @@
 
 #include "update_engine/payload_consumer/fec_file_descriptor.h"
 
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <utility>
+
+#include <base/logging.h>
+#include <base/sys_info.h>
+#include <base/threading/simple_thread.h>
+
 namespace chromeos_update_engine {
 
+namespace {
+
+// The most threads correcting the windows at once.
+const size_t kMaxCorrectionThreads = 4;
+
+// Reads the |count| bytes at |offset| of |fh| into |buf|, correcting them.
+bool PReadAll(fec::io* fh, uint8_t* buf, size_t count, uint64_t offset) {
+  size_t bytes_read = 0;
+  while (bytes_read < count) {
+    ssize_t rc = fh->pread(buf + bytes_read, count - bytes_read, offset);
+    if (rc <= 0) {
+      PLOG(ERROR) << "Unable to read the corrected data at " << offset;
+      return false;
+    }
+    bytes_read += rc;
+    offset += rc;
+  }
+  return true;
+}
+
+// Corrects a set of windows with a libfec handle on a worker thread.
+class FecCorrectionJob : public base::DelegateSimpleThread::Delegate {
+ public:
+  explicit FecCorrectionJob(fec::io* fh) : fh_(fh) {}
+
+  // Adds the window of |size| bytes at |offset| to correct.
+  void AddWindow(uint64_t index, uint64_t offset, size_t size) {
+    windows_.push_back({index, offset, brillo::Blob(size)});
+  }
+
+  // base::DelegateSimpleThread::Delegate overrides.
+  void Run() override {
+    success_ = true;
+    for (Window& window : windows_) {
+      success_ = PReadAll(
+          fh_, window.data.data(), window.data.size(), window.offset);
+      if (!success_)
+        return;
+    }
+  }
+
+  struct Window {
+    uint64_t index;
+    uint64_t offset;
+    brillo::Blob data;
+  };
+
+  bool success() const { return success_; }
+  std::vector<Window>* windows() { return &windows_; }
+
+ private:
+  fec::io* fh_;
+  std::vector<Window> windows_;
+  bool success_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(FecCorrectionJob);
+};
+
+}  // namespace
+
+const uint64_t FecFileDescriptor::kWindowSize = 1024 * 1024;
+const size_t FecFileDescriptor::kMaxCachedWindows = 16;
+
 bool FecFileDescriptor::Open(const char* path, int flags) {
   return Open(path, flags, 0600);
 }
@@ -40,11 +113,50 @@ bool FecFileDescriptor::Open(const char* path, int flags, mode_t mode) {
   }
 
   dev_size_ = status.data_size;
+  path_ = path;
+  flags_ = flags;
+  mode_ = mode;
+  offset_ = 0;
   return true;
 }
 
 ssize_t FecFileDescriptor::Read(void* buf, size_t count) {
-  return fh_.read(buf, count);
+  if (offset_ >= dev_size_ || count == 0)
+    return 0;
+  // A Read() corrects at most as many windows as the cache holds, and
+  // returns less data if it needs more.
+  const uint64_t first = offset_ / kWindowSize;
+  const uint64_t last = std::min((offset_ + count - 1) / kWindowSize,
+                                 (dev_size_ - 1) / kWindowSize);
+  const uint64_t end = std::min(last + 1, first + kMaxCachedWindows);
+  // The cached windows are marked as used first, so the corrected ones don't
+  // evict them.
+  std::vector<uint64_t> missing;
+  for (uint64_t index = first; index < end; index++) {
+    if (windows_.find(index) == windows_.end()) {
+      missing.push_back(index);
+    } else {
+      window_order_.remove(index);
+      window_order_.push_front(index);
+    }
+  }
+  if (!CorrectWindows(missing)) {
+    errno = EIO;
+    return -1;
+  }
+
+  auto bytes = static_cast<uint8_t*>(buf);
+  size_t bytes_read = 0;
+  for (uint64_t index = first; index < end && bytes_read < count; index++) {
+    const brillo::Blob& window = windows_[index];
+    const uint64_t window_offset = offset_ - index * kWindowSize;
+    const size_t size = std::min(static_cast<uint64_t>(count - bytes_read),
+                                 window.size() - window_offset);
+    memcpy(bytes + bytes_read, window.data() + window_offset, size);
+    bytes_read += size;
+    offset_ += size;
+  }
+  return bytes_read;
 }
 
 ssize_t FecFileDescriptor::Write(const void* buf, size_t count) {
@@ -53,10 +165,19 @@ ssize_t FecFileDescriptor::Write(const void* buf, size_t count) {
 }
 
 off64_t FecFileDescriptor::Seek(off64_t offset, int whence) {
-  if (fh_.seek(offset, whence)) {
-    return offset;
+  off64_t next_offset = offset;
+  if (whence == SEEK_CUR)
+    next_offset += offset_;
+  else if (whence == SEEK_END)
+    next_offset += dev_size_;
+  else if (whence != SEEK_SET)
+    next_offset = -1;
+  if (next_offset < 0) {
+    errno = EINVAL;
+    return -1;
   }
-  return -1;
+  offset_ = next_offset;
+  return offset_;
 }
 
 uint64_t FecFileDescriptor::BlockDevSize() {
@@ -72,7 +193,69 @@ bool FecFileDescriptor::BlkIoctl(int request,
 }
 
 bool FecFileDescriptor::Close() {
+  windows_.clear();
+  window_order_.clear();
+  extra_handles_.clear();
   return fh_.close();
 }
 
+bool FecFileDescriptor::CorrectWindows(const std::vector<uint64_t>& indexes) {
+  if (indexes.empty())
+    return true;
+
+  // Each thread needs its own handle. Opening one parses the verity metadata
+  // again, so fewer threads are used if that fails.
+  const size_t num_threads = std::min(
+      indexes.size(),
+      std::min(static_cast<size_t>(
+                   std::max(base::SysInfo::NumberOfProcessors(), 1)),
+               kMaxCorrectionThreads));
+  while (extra_handles_.size() + 1 < num_threads) {
+    auto fh = std::make_unique<fec::io>();
+    if (!fh->open(path_, flags_, mode_)) {
+      LOG(WARNING) << "Unable to open another FEC handle for " << path_;
+      break;
+    }
+    extra_handles_.push_back(std::move(fh));
+  }
+
+  std::vector<std::unique_ptr<FecCorrectionJob>> jobs;
+  jobs.emplace_back(new FecCorrectionJob(&fh_));
+  for (size_t i = 0; i + 1 < num_threads && i < extra_handles_.size(); i++)
+    jobs.emplace_back(new FecCorrectionJob(extra_handles_[i].get()));
+  for (size_t i = 0; i < indexes.size(); i++) {
+    const uint64_t offset = indexes[i] * kWindowSize;
+    jobs[i % jobs.size()]->AddWindow(
+        indexes[i], offset, std::min(kWindowSize, dev_size_ - offset));
+  }
+
+  if (jobs.size() == 1) {
+    jobs[0]->Run();
+  } else {
+    base::DelegateSimpleThreadPool thread_pool("fec-correct", jobs.size());
+    thread_pool.Start();
+    for (const auto& job : jobs)
+      thread_pool.AddWork(job.get());
+    thread_pool.JoinAll();
+  }
+
+  for (const auto& job : jobs) {
+    if (!job->success())
+      return false;
+    for (auto& window : *job->windows())
+      CacheWindow(window.index, std::move(window.data));
+  }
+  return true;
+}
+
+void FecFileDescriptor::CacheWindow(uint64_t index, brillo::Blob data) {
+  windows_[index] = std::move(data);
+  window_order_.remove(index);
+  window_order_.push_front(index);
+  while (window_order_.size() > kMaxCachedWindows) {
+    windows_.erase(window_order_.back());
+    window_order_.pop_back();
+  }
+}
+
 }  // namespace chromeos_update_engine
@@ -17,6 +17,13 @@
 #ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_FEC_FILE_DESCRIPTOR_H_
 #define UPDATE_ENGINE_PAYLOAD_CONSUMER_FEC_FILE_DESCRIPTOR_H_
 
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <brillo/secure_blob.h>
 #include <fec/io.h>
 
 #include "update_engine/payload_consumer/file_descriptor.h"
@@ -29,7 +36,11 @@
 
 namespace chromeos_update_engine {
 
-// An error corrected file based on FEC.
+// An error corrected file based on FEC. libfec corrects each block on its own,
+// which is slow, so the data is corrected in windows of kWindowSize bytes: the
+// windows a Read() covers are corrected at once on several threads, each with
+// its own libfec handle, and the last kMaxCachedWindows windows are kept for
+// the next reads, since the source data of the operations is often close.
 class FecFileDescriptor : public FileDescriptor {
  public:
   FecFileDescriptor() = default;
@@ -46,6 +57,7 @@ class FecFileDescriptor : public FileDescriptor {
                 uint64_t start,
                 uint64_t length,
                 int* result) override;
+  bool Prefetch(uint64_t offset, uint64_t length) override { return false; }
   bool Flush() override { return true; }
   bool Close() override;
   bool IsSettingErrno() override { return true; }
@@ -56,8 +68,36 @@ class FecFileDescriptor : public FileDescriptor {
   }
 
  protected:
+  // The size and number of the windows of corrected data.
+  static const uint64_t kWindowSize;
+  static const size_t kMaxCachedWindows;
+
+  // Corrects the windows with the |indexes| missing from |windows_| and adds
+  // them to it.
+  bool CorrectWindows(const std::vector<uint64_t>& indexes);
+
+  // Caches the corrected |data| of the window |index|, evicting the least
+  // recently used window if there are too many.
+  void CacheWindow(uint64_t index, brillo::Blob data);
+
   fec::io fh_;
   uint64_t dev_size_{0};
+
+  // The libfec handles of the threads correcting the windows other than the
+  // first one, which uses |fh_|, opened on demand with the arguments of
+  // Open().
+  std::vector<std::unique_ptr<fec::io>> extra_handles_;
+  std::string path_;
+  int flags_{0};
+  mode_t mode_{0};
+
+  // The offset of the next Read().
+  uint64_t offset_{0};
+
+  // The corrected windows by index, and their indexes from the most to the
+  // least recently used.
+  std::map<uint64_t, brillo::Blob> windows_;
+  std::list<uint64_t> window_order_;
 };
 
 }  // namespace chromeos_update_engine
@@ -123,6 +123,13 @@ bool EintrSafeFileDescriptor::BlkIoctl(int request,
 #endif  // defined(BLKZEROOUT)
 }
 
+bool EintrSafeFileDescriptor::Prefetch(uint64_t offset, uint64_t length) {
+  CHECK_GE(fd_, 0);
+  // POSIX_FADV_WILLNEED starts an asynchronous read of the range into the
+  // page cache, for both regular files and block devices.
+  return posix_fadvise(fd_, offset, length, POSIX_FADV_WILLNEED) == 0;
+}
+
 bool EintrSafeFileDescriptor::Flush() {
   CHECK_GE(fd_, 0);
   return true;
@@ -87,6 +87,11 @@ class FileDescriptor {
                         uint64_t length,
                         int* result) = 0;
 
+  // Hints that the |length| bytes at |offset| will be read soon, so the
+  // implementation can start reading them in the background. Returns whether
+  // the hint is supported.
+  virtual bool Prefetch(uint64_t offset, uint64_t length) = 0;
+
   // Flushes any cached data. The descriptor must be opened prior to this
   // call. Returns false if it fails to write data. Implementations may set
   // errno accrodingly.
@@ -123,6 +128,7 @@ class EintrSafeFileDescriptor : public FileDescriptor {
                 uint64_t start,
                 uint64_t length,
                 int* result) override;
+  bool Prefetch(uint64_t offset, uint64_t length) override;
   bool Flush() override;
   bool Close() override;
   bool IsSettingErrno() override { return true; }
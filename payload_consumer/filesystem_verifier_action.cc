@@ -24,22 +24,187 @@
 #include <algorithm>
 #include <cstdlib>
 #include <string>
+#include <utility>
 
 #include <base/bind.h>
+#include <base/posix/eintr_wrapper.h>
+#include <base/sys_info.h>
 #include <brillo/data_encoding.h>
 #include <brillo/streams/file_stream.h>
 
+#include "update_engine/common/trace.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/buffer_pool.h"
 
+using brillo::MessageLoop;
 using brillo::data_encoding::Base64Encode;
 using std::string;
+using std::vector;
 
 namespace chromeos_update_engine {
 
 namespace {
 const off_t kReadFileBufferSize = 128 * 1024;
+
+// The size and alignment of the buffer of each PartitionHashJob.
+const size_t kParallelReadBufferSize = 1024 * 1024;  // 1 MiB
+const size_t kParallelReadBufferAlignment = 4096;
+
+// How often the main loop checks whether the PartitionHashJobs are done.
+const int kHashCheckIntervalMs = 100;
+
+// Returns the end of the range that can be read from |offset| in
+// |partition|, which is |partition_size| bytes long. Anything past the hash
+// tree or the FEC data can only be read once all the data blocks they cover
+// were read, since they might be written from that data.
+uint64_t GetReadEnd(const InstallPlan::Partition& partition,
+                    uint64_t partition_size,
+                    uint64_t offset) {
+  uint64_t read_end = partition_size;
+  if (partition.hash_tree_size != 0 &&
+      offset < partition.hash_tree_data_offset + partition.hash_tree_data_size)
+    read_end = std::min(read_end, partition.hash_tree_offset);
+  if (partition.fec_size != 0 &&
+      offset < partition.fec_data_offset + partition.fec_data_size)
+    read_end = std::min(read_end, partition.fec_offset);
+  return read_end;
+}
+
+// Returns whether the target hash of |partition| was verified by the
+// DeltaPerformer while writing it, so it doesn't need to be read again. The
+// partitions that still need the verity data written are always read.
+bool IsTargetHashVerified(const InstallPlan::Partition& partition,
+                          bool write_verity) {
+  return partition.target_hash_verified &&
+         !(write_verity && (partition.hash_tree_size || partition.fec_size));
+}
+
 }  // namespace
 
+class FilesystemVerifierAction::PartitionHashJob
+    : public base::DelegateSimpleThread::Delegate {
+ public:
+  PartitionHashJob(FilesystemVerifierAction* action, size_t partition_index)
+      : action_(action),
+        partition_index_(partition_index),
+        partition_(action->install_plan_.partitions[partition_index]),
+        write_verity_(action->install_plan_.write_verity),
+        read_size_(action->read_size_ ? action->read_size_
+                                      : kParallelReadBufferSize) {}
+  ~PartitionHashJob() override { free(buffer_); }
+
+  // base::DelegateSimpleThread::Delegate overrides.
+  void Run() override {
+    error_ = HashPartition();
+    base::AutoLock auto_lock(action_->hash_lock_);
+    action_->num_hash_jobs_done_++;
+  }
+
+  size_t partition_index() const { return partition_index_; }
+  uint64_t size() const { return partition_.target_size; }
+
+  // The result of the job and the hash of the partition, once it is done.
+  ErrorCode error() const { return error_; }
+  const brillo::Blob& hash() const { return hash_; }
+
+ private:
+  // Reads and hashes the target partition, writing its verity data if
+  // needed.
+  ErrorCode HashPartition() {
+    const string& path = partition_.target_path;
+    const uint64_t partition_size = partition_.target_size;
+    std::unique_ptr<VerityWriterInterface> verity_writer;
+    if (write_verity_) {
+      verity_writer = verity_writer::CreateVerityWriter();
+      if (!verity_writer->Init(partition_, action_->prefs_))
+        return ErrorCode::kVerityCalculationError;
+    }
+
+    void* memory = nullptr;
+    if (posix_memalign(&memory, kParallelReadBufferAlignment, read_size_)) {
+      LOG(ERROR) << "Unable to allocate the read buffer for " << path;
+      return ErrorCode::kError;
+    }
+    buffer_ = static_cast<uint8_t*>(memory);
+
+    int fd = HANDLE_EINTR(open(path.c_str(), O_RDONLY));
+    if (fd < 0) {
+      PLOG(ERROR) << "Unable to open " << path << " for reading";
+      return ErrorCode::kFilesystemVerifierError;
+    }
+    ScopedFdCloser fd_closer(&fd);
+    posix_fadvise(fd, 0, partition_size, POSIX_FADV_SEQUENTIAL);
+
+    HashCalculator hasher;
+    uint64_t offset = 0;
+    while (offset < partition_size) {
+      {
+        base::AutoLock auto_lock(action_->hash_lock_);
+        if (action_->hash_jobs_cancelled_)
+          return ErrorCode::kError;
+      }
+      size_t bytes_to_read =
+          std::min(static_cast<uint64_t>(read_size_),
+                   GetReadEnd(partition_, partition_size, offset) - offset);
+      if (!bytes_to_read)
+        break;
+
+      // Let the kernel read the next range while this one is hashed.
+      const uint64_t next_offset = offset + bytes_to_read;
+      if (next_offset < partition_size) {
+        posix_fadvise(fd,
+                      next_offset,
+                      std::min(static_cast<uint64_t>(read_size_),
+                               partition_size - next_offset),
+                      POSIX_FADV_WILLNEED);
+      }
+
+      ssize_t bytes_read = 0;
+      if (!utils::PReadAll(fd, buffer_, bytes_to_read, offset, &bytes_read) ||
+          bytes_read != static_cast<ssize_t>(bytes_to_read)) {
+        LOG(ERROR) << "Failed to read the remaining " << partition_size - offset
+                   << " bytes from partition " << partition_.name;
+        return ErrorCode::kFilesystemVerifierError;
+      }
+      if (!hasher.Update(buffer_, bytes_to_read)) {
+        LOG(ERROR) << "Unable to update the hash.";
+        return ErrorCode::kError;
+      }
+      if (verity_writer &&
+          !verity_writer->Update(offset, buffer_, bytes_to_read)) {
+        return ErrorCode::kVerityCalculationError;
+      }
+      offset = next_offset;
+    }
+
+    if (!hasher.Finalize()) {
+      LOG(ERROR) << "Unable to finalize the hash.";
+      return ErrorCode::kError;
+    }
+    hash_ = hasher.raw_hash();
+    return ErrorCode::kSuccess;
+  }
+
+  FilesystemVerifierAction* action_;
+  size_t partition_index_;
+  const InstallPlan::Partition partition_;
+  bool write_verity_;
+  size_t read_size_;
+
+  ErrorCode error_{ErrorCode::kError};
+  brillo::Blob hash_;
+  uint8_t* buffer_{nullptr};
+
+  DISALLOW_COPY_AND_ASSIGN(PartitionHashJob);
+};
+
+FilesystemVerifierAction::FilesystemVerifierAction()
+    : verity_writer_(verity_writer::CreateVerityWriter()) {}
+
+FilesystemVerifierAction::~FilesystemVerifierAction() {
+  StopParallelHashing();
+}
+
 void FilesystemVerifierAction::PerformAction() {
   // Will tell the ActionProcessor we've failed if we return.
   ScopedActionCompleter abort_action_completer(processor_, this);
@@ -48,17 +213,17 @@ void FilesystemVerifierAction::PerformAction() {
     LOG(ERROR) << "FilesystemVerifierAction missing input object.";
     return;
   }
-  install_plan_ = GetInputObject();
+  install_plan_ = TakeInputObject();
 
   if (install_plan_.partitions.empty()) {
     LOG(INFO) << "No partitions to verify.";
     if (HasOutputPipe())
-      SetOutputObject(install_plan_);
+      SetOutputObject(std::move(install_plan_));
     abort_action_completer.set_code(ErrorCode::kSuccess);
     return;
   }
 
-  StartPartitionHashing();
+  StartParallelHashing();
   abort_action_completer.set_should_complete(false);
 }
 
@@ -68,17 +233,144 @@ void FilesystemVerifierAction::TerminateProcessing() {
 }
 
 void FilesystemVerifierAction::Cleanup(ErrorCode code) {
+  StopParallelHashing();
   src_stream_.reset();
+  src_fd_ = -1;
   // This memory is not used anymore.
-  buffer_.clear();
+  BufferPool::Get()->Release(std::move(buffer_));
 
   if (cancelled_)
     return;
   if (code == ErrorCode::kSuccess && HasOutputPipe())
-    SetOutputObject(install_plan_);
+    SetOutputObject(std::move(install_plan_));
   processor_->ActionComplete(this, code);
 }
 
+void FilesystemVerifierAction::StartParallelHashing() {
+  vector<size_t> partition_indexes;
+  for (size_t i = 0; i < install_plan_.partitions.size(); i++) {
+    const InstallPlan::Partition& partition = install_plan_.partitions[i];
+    if (partition.target_path.empty() && partition.target_size == 0) {
+      LOG(INFO) << "Skip hashing partition " << i << " (" << partition.name
+                << ") because size is 0.";
+      continue;
+    }
+    if (IsTargetHashVerified(partition, install_plan_.write_verity)) {
+      LOG(INFO) << "Skip hashing partition " << i << " (" << partition.name
+                << ") because it was verified while writing.";
+      continue;
+    }
+    partition_indexes.push_back(i);
+  }
+  if (partition_indexes.size() <= 1) {
+    StartPartitionHashing();
+    return;
+  }
+
+  for (size_t i : partition_indexes) {
+    const InstallPlan::Partition& partition = install_plan_.partitions[i];
+    if (partition.target_path.empty()) {
+      LOG(ERROR) << "Cannot hash partition " << i << " (" << partition.name
+                 << ") because its device path cannot be determined.";
+      Cleanup(ErrorCode::kFilesystemVerifierError);
+      return;
+    }
+    LOG(INFO) << "Hashing partition " << i << " (" << partition.name
+              << ") on device " << partition.target_path;
+    hash_jobs_.emplace_back(new PartitionHashJob(this, i));
+  }
+
+  const size_t num_threads = std::min(
+      hash_jobs_.size(),
+      static_cast<size_t>(std::max(base::SysInfo::NumberOfProcessors(), 1)));
+  LOG(INFO) << "Hashing " << hash_jobs_.size() << " partitions on "
+            << num_threads << " threads.";
+  num_hash_jobs_done_ = 0;
+  hash_jobs_cancelled_ = false;
+  hash_thread_pool_.reset(
+      new base::DelegateSimpleThreadPool("fs-verifier", num_threads));
+  hash_thread_pool_->Start();
+
+  // Start the largest partitions first so they don't delay the end.
+  vector<PartitionHashJob*> jobs;
+  for (const auto& job : hash_jobs_)
+    jobs.push_back(job.get());
+  std::stable_sort(jobs.begin(),
+                   jobs.end(),
+                   [](const PartitionHashJob* a, const PartitionHashJob* b) {
+                     return a->size() > b->size();
+                   });
+  for (PartitionHashJob* job : jobs)
+    hash_thread_pool_->AddWork(job);
+
+  CheckParallelHashing();
+}
+
+void FilesystemVerifierAction::CheckParallelHashing() {
+  hash_check_task_ = MessageLoop::kTaskIdNull;
+  bool done;
+  {
+    base::AutoLock auto_lock(hash_lock_);
+    done = num_hash_jobs_done_ == hash_jobs_.size();
+  }
+  if (!done) {
+    hash_check_task_ = MessageLoop::current()->PostDelayedTask(
+        FROM_HERE,
+        base::Bind(&FilesystemVerifierAction::CheckParallelHashing,
+                   base::Unretained(this)),
+        base::TimeDelta::FromMilliseconds(kHashCheckIntervalMs));
+    return;
+  }
+  hash_thread_pool_->JoinAll();
+  hash_thread_pool_.reset();
+
+  for (const auto& job : hash_jobs_) {
+    if (job->error() != ErrorCode::kSuccess) {
+      Cleanup(job->error());
+      return;
+    }
+  }
+  for (const auto& job : hash_jobs_) {
+    const InstallPlan::Partition& partition =
+        install_plan_.partitions[job->partition_index()];
+    LOG(INFO) << "Hash of " << partition.name << ": "
+              << Base64Encode(job->hash());
+    if (partition.target_hash == job->hash())
+      continue;
+
+    LOG(ERROR) << "New '" << partition.name
+               << "' partition verification failed.";
+    if (partition.source_hash.empty()) {
+      // No need to verify source if it is a full payload.
+      Cleanup(ErrorCode::kNewRootfsVerificationError);
+      return;
+    }
+    // Check whether the source partition is the cause of the mismatch.
+    partition_index_ = job->partition_index();
+    verifier_step_ = VerifierStep::kVerifySourceHash;
+    hash_jobs_.clear();
+    StartPartitionHashing();
+    return;
+  }
+  Cleanup(ErrorCode::kSuccess);
+}
+
+void FilesystemVerifierAction::StopParallelHashing() {
+  if (hash_check_task_ != MessageLoop::kTaskIdNull) {
+    MessageLoop::current()->CancelTask(hash_check_task_);
+    hash_check_task_ = MessageLoop::kTaskIdNull;
+  }
+  if (hash_thread_pool_) {
+    {
+      base::AutoLock auto_lock(hash_lock_);
+      hash_jobs_cancelled_ = true;
+    }
+    hash_thread_pool_->JoinAll();
+    hash_thread_pool_.reset();
+  }
+  hash_jobs_.clear();
+}
+
 void FilesystemVerifierAction::StartPartitionHashing() {
   if (partition_index_ == install_plan_.partitions.size()) {
     Cleanup(ErrorCode::kSuccess);
@@ -94,6 +386,14 @@ void FilesystemVerifierAction::StartPartitionHashing() {
       partition_size_ = partition.source_size;
       break;
     case VerifierStep::kVerifyTargetHash:
+      if (IsTargetHashVerified(partition, install_plan_.write_verity)) {
+        LOG(INFO) << "Skip hashing partition " << partition_index_ << " ("
+                  << partition.name << ") because it was verified while "
+                  << "writing.";
+        partition_index_++;
+        StartPartitionHashing();
+        return;
+      }
       part_path = partition.target_path;
       partition_size_ = partition.target_size;
       break;
@@ -117,26 +417,33 @@ void FilesystemVerifierAction::StartPartitionHashing() {
   LOG(INFO) << "Hashing partition " << partition_index_ << " ("
             << partition.name << ") on device " << part_path;
 
+  // The file descriptor is kept to hint the kernel about the next reads.
+  int fd = HANDLE_EINTR(open(part_path.c_str(), O_RDONLY));
   brillo::ErrorPtr error;
-  src_stream_ =
-      brillo::FileStream::Open(base::FilePath(part_path),
-                               brillo::Stream::AccessMode::READ,
-                               brillo::FileStream::Disposition::OPEN_EXISTING,
-                               &error);
-
+  if (fd >= 0)
+    src_stream_ = brillo::FileStream::FromFileDescriptor(fd, true, &error);
   if (!src_stream_) {
     LOG(ERROR) << "Unable to open " << part_path << " for reading";
+    if (fd >= 0)
+      IGNORE_EINTR(close(fd));
     Cleanup(ErrorCode::kFilesystemVerifierError);
     return;
   }
+  src_fd_ = fd;
+  posix_fadvise(src_fd_, 0, partition_size_, POSIX_FADV_SEQUENTIAL);
 
-  buffer_.resize(kReadFileBufferSize);
+  size_t buffer_size = read_size_ ? read_size_ : kReadFileBufferSize;
+  if (buffer_.capacity() < buffer_size) {
+    BufferPool::Get()->Release(std::move(buffer_));
+    buffer_ = BufferPool::Get()->Acquire(buffer_size);
+  }
+  buffer_.resize(buffer_size);
   hasher_ = std::make_unique<HashCalculator>();
 
   offset_ = 0;
   if (verifier_step_ == VerifierStep::kVerifyTargetHash &&
       install_plan_.write_verity) {
-    if (!verity_writer_->Init(partition)) {
+    if (!verity_writer_->Init(partition, prefs_)) {
       Cleanup(ErrorCode::kVerityCalculationError);
       return;
     }
@@ -150,18 +457,9 @@ void FilesystemVerifierAction::ScheduleRead() {
   const InstallPlan::Partition& partition =
       install_plan_.partitions[partition_index_];
 
-  // We can only start reading anything past |hash_tree_offset| after we have
-  // already read all the data blocks that the hash tree covers. The same
-  // applies to FEC.
-  uint64_t read_end = partition_size_;
-  if (partition.hash_tree_size != 0 &&
-      offset_ < partition.hash_tree_data_offset + partition.hash_tree_data_size)
-    read_end = std::min(read_end, partition.hash_tree_offset);
-  if (partition.fec_size != 0 &&
-      offset_ < partition.fec_data_offset + partition.fec_data_size)
-    read_end = std::min(read_end, partition.fec_offset);
   size_t bytes_to_read =
-      std::min(static_cast<uint64_t>(buffer_.size()), read_end - offset_);
+      std::min(static_cast<uint64_t>(buffer_.size()),
+               GetReadEnd(partition, partition_size_, offset_) - offset_);
   if (!bytes_to_read) {
     FinishPartitionHashing();
     return;
@@ -183,6 +481,7 @@ void FilesystemVerifierAction::ScheduleRead() {
 }
 
 void FilesystemVerifierAction::OnReadDoneCallback(size_t bytes_read) {
+  UE_TRACE_SCOPE("FilesystemVerifierAction::OnReadDone");
   if (cancelled_) {
     Cleanup(ErrorCode::kError);
     return;
@@ -196,6 +495,17 @@ void FilesystemVerifierAction::OnReadDoneCallback(size_t bytes_read) {
     return;
   }
 
+  // Let the kernel read the next range while this one is hashed, since the
+  // next read is only scheduled afterwards.
+  const uint64_t next_offset = offset_ + bytes_read;
+  if (next_offset < partition_size_) {
+    posix_fadvise(src_fd_,
+                  next_offset,
+                  std::min(static_cast<uint64_t>(buffer_.size()),
+                           partition_size_ - next_offset),
+                  POSIX_FADV_WILLNEED);
+  }
+
   if (!hasher_->Update(buffer_.data(), bytes_read)) {
     LOG(ERROR) << "Unable to update the hash.";
     Cleanup(ErrorCode::kError);
@@ -272,7 +582,9 @@ void FilesystemVerifierAction::FinishPartitionHashing() {
                    << partition.name << " partition I have has hash: "
                    << Base64Encode(hasher_->raw_hash())
                    << " but the update expected me to have "
-                   << Base64Encode(partition.source_hash) << " .";
+                   << Base64Encode(partition.source_hash.data(),
+                                   partition.source_hash.size())
+                   << " .";
         LOG(INFO) << "To get the checksum of the " << partition.name
                   << " partition run this command: dd if="
                   << partition.source_path
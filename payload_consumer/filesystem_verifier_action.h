@@ -24,10 +24,14 @@
 #include <string>
 #include <vector>
 
+#include <base/synchronization/lock.h>
+#include <base/threading/simple_thread.h>
+#include <brillo/message_loops/message_loop.h>
 #include <brillo/streams/stream.h>
 
 #include "update_engine/common/action.h"
 #include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/prefs_interface.h"
 #include "update_engine/payload_consumer/install_plan.h"
 #include "update_engine/payload_consumer/verity_writer_interface.h"
 
@@ -35,7 +39,8 @@
 // update. The hashes are then verified against the ones in the InstallPlan.
 // If the target hash does not match, the action will fail. In case of failure,
 // the error code will depend on whether the source slot hashes are provided and
-// match.
+// match. When several partitions are hashed, their target hashes are computed
+// in parallel on worker threads.
 
 namespace chromeos_update_engine {
 
@@ -51,19 +56,29 @@ enum class VerifierStep {
 
 class FilesystemVerifierAction : public InstallPlanAction {
  public:
-  FilesystemVerifierAction()
-      : verity_writer_(verity_writer::CreateVerityWriter()) {}
-  ~FilesystemVerifierAction() override = default;
+  FilesystemVerifierAction();
+  ~FilesystemVerifierAction() override;
 
   void PerformAction() override;
   void TerminateProcessing() override;
 
+  // Sets the size in bytes of each read from the partitions. The default is
+  // used if 0.
+  void set_read_size(size_t read_size) { read_size_ = read_size; }
+
+  // Sets the prefs where the progress of the verity data written is kept, so
+  // it is resumed along with the update. Not owned, may be null.
+  void set_prefs(PrefsInterface* prefs) { prefs_ = prefs; }
+
   // Debugging/logging
   static std::string StaticType() { return "FilesystemVerifierAction"; }
   std::string Type() const override { return StaticType(); }
 
  private:
   friend class FilesystemVerifierActionTestDelegate;
+  // Hashes a target partition on a worker thread.
+  class PartitionHashJob;
+
   // Starts the hashing of the current partition. If there aren't any partitions
   // remaining to be hashed, it finishes the action.
   void StartPartitionHashing();
@@ -80,6 +95,18 @@ class FilesystemVerifierAction : public InstallPlanAction {
   // and continue checking the next one.
   void FinishPartitionHashing();
 
+  // Starts hashing the target partitions on worker threads, or hashes the
+  // only one with StartPartitionHashing().
+  void StartParallelHashing();
+
+  // Called from the main loop until all the PartitionHashJobs are done, then
+  // verifies their hashes. If a target hash doesn't match, continues with the
+  // kVerifySourceHash step for that partition with StartPartitionHashing().
+  void CheckParallelHashing();
+
+  // Cancels the PartitionHashJobs and waits for the worker threads.
+  void StopParallelHashing();
+
   // Cleans up all the variables we use for async operations and tells the
   // ActionProcessor we're done w/ |code| as passed in. |cancelled_| should be
   // true if TerminateProcessing() was called.
@@ -92,8 +119,16 @@ class FilesystemVerifierAction : public InstallPlanAction {
   // being hashed.
   size_t partition_index_{0};
 
-  // If not null, the FileStream used to read from the device.
+  // If not null, the FileStream used to read from the device, and the file
+  // descriptor it owns.
   brillo::StreamPtr src_stream_;
+  int src_fd_{-1};
+
+  // The size of each read, or 0 to use the default.
+  size_t read_size_{0};
+
+  // The prefs keeping the progress of the verity data, if not null.
+  PrefsInterface* prefs_{nullptr};
 
   // Buffer for storing data we read.
   brillo::Blob buffer_;
@@ -119,6 +154,20 @@ class FilesystemVerifierAction : public InstallPlanAction {
   // The byte offset that we are reading in the current partition.
   uint64_t offset_{0};
 
+  // The jobs hashing the target partitions in parallel, in partition order,
+  // and the threads running them.
+  std::vector<std::unique_ptr<PartitionHashJob>> hash_jobs_;
+  std::unique_ptr<base::DelegateSimpleThreadPool> hash_thread_pool_;
+
+  // The task checking whether the jobs are done.
+  brillo::MessageLoop::TaskId hash_check_task_{
+      brillo::MessageLoop::kTaskIdNull};
+
+  // Protects the members below, which are shared with the jobs.
+  base::Lock hash_lock_;
+  size_t num_hash_jobs_done_{0};
+  bool hash_jobs_cancelled_{false};
+
   DISALLOW_COPY_AND_ASSIGN(FilesystemVerifierAction);
 };
 
@@ -19,6 +19,7 @@
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <base/bind.h>
 #include <base/posix/eintr_wrapper.h>
@@ -49,8 +50,18 @@ class FilesystemVerifierActionTest : public ::testing::Test {
 
   void BuildActions(const InstallPlan& install_plan);
 
+  // Returns the SHA-256 hash of |data| for the partitions of an InstallPlan.
+  static Sha256Hash HashOfData(const brillo::Blob& data) {
+    brillo::Blob hash;
+    EXPECT_TRUE(HashCalculator::RawHashOfData(data, &hash));
+    return hash;
+  }
+
   brillo::FakeMessageLoop loop_{nullptr};
   ActionProcessor processor_;
+
+  // The read size set on the FilesystemVerifierAction by BuildActions().
+  size_t read_size_{0};
 };
 
 class FilesystemVerifierActionTestDelegate : public ActionProcessorDelegate {
@@ -124,16 +135,10 @@ bool FilesystemVerifierActionTest::DoTest(bool terminate_early,
   part.name = "part";
   part.target_size = kLoopFileSize - (hash_fail ? 1 : 0);
   part.target_path = a_dev;
-  if (!HashCalculator::RawHashOfData(a_loop_data, &part.target_hash)) {
-    ADD_FAILURE();
-    success = false;
-  }
+  part.target_hash = HashOfData(a_loop_data);
   part.source_size = kLoopFileSize;
   part.source_path = a_dev;
-  if (!HashCalculator::RawHashOfData(a_loop_data, &part.source_hash)) {
-    ADD_FAILURE();
-    success = false;
-  }
+  part.source_hash = HashOfData(a_loop_data);
   install_plan.partitions = {part};
 
   BuildActions(install_plan);
@@ -189,6 +194,7 @@ void FilesystemVerifierActionTest::BuildActions(
     const InstallPlan& install_plan) {
   auto feeder_action = std::make_unique<ObjectFeederAction<InstallPlan>>();
   auto verifier_action = std::make_unique<FilesystemVerifierAction>();
+  verifier_action->set_read_size(read_size_);
   auto collector_action =
       std::make_unique<ObjectCollectorAction<InstallPlan>>();
 
@@ -254,6 +260,145 @@ TEST_F(FilesystemVerifierActionTest, NonExistentDriveTest) {
   EXPECT_EQ(ErrorCode::kFilesystemVerifierError, delegate.code_);
 }
 
+TEST_F(FilesystemVerifierActionTest, SkipVerifiedWhileWritingTest) {
+  // The partition is not read again if its hash was verified while writing.
+  InstallPlan install_plan;
+  InstallPlan::Partition part;
+  part.name = "verified";
+  part.target_path = "/no/such/file";
+  part.target_size = 4096;
+  part.target_hash_verified = true;
+  install_plan.partitions = {part};
+
+  BuildActions(install_plan);
+
+  FilesystemVerifierActionTest2Delegate delegate;
+  processor_.set_delegate(&delegate);
+
+  processor_.StartProcessing();
+  EXPECT_FALSE(processor_.IsRunning());
+  EXPECT_TRUE(delegate.ran_);
+  EXPECT_EQ(ErrorCode::kSuccess, delegate.code_);
+}
+
+TEST_F(FilesystemVerifierActionTest, ReadSizeTest) {
+  // A read size that doesn't divide the partition size.
+  read_size_ = 10000;
+  test_utils::ScopedTempFile part_file("part.XXXXXX");
+  brillo::Blob part_data(100000 + 512);
+  test_utils::FillWithData(&part_data);
+  ASSERT_TRUE(test_utils::WriteFileVector(part_file.path(), part_data));
+
+  InstallPlan install_plan;
+  InstallPlan::Partition part;
+  part.name = "part";
+  part.target_path = part_file.path();
+  part.target_size = part_data.size();
+  part.target_hash = HashOfData(part_data);
+  install_plan.partitions = {part};
+
+  BuildActions(install_plan);
+
+  FilesystemVerifierActionTestDelegate delegate;
+  processor_.set_delegate(&delegate);
+
+  loop_.PostTask(
+      FROM_HERE,
+      base::Bind(
+          [](ActionProcessor* processor) { processor->StartProcessing(); },
+          base::Unretained(&processor_)));
+  loop_.Run();
+
+  EXPECT_FALSE(processor_.IsRunning());
+  EXPECT_TRUE(delegate.ran());
+  EXPECT_EQ(ErrorCode::kSuccess, delegate.code());
+}
+
+TEST_F(FilesystemVerifierActionTest, ParallelHashTest) {
+  // Partitions of different sizes, hashed in parallel.
+  const size_t kPartitionSizes[] = {3 * 1024 * 1024 + 512, 4096, 100000};
+  std::vector<std::unique_ptr<test_utils::ScopedTempFile>> part_files;
+  InstallPlan install_plan;
+  for (size_t size : kPartitionSizes) {
+    part_files.emplace_back(new test_utils::ScopedTempFile("part.XXXXXX"));
+    brillo::Blob part_data(size);
+    test_utils::FillWithData(&part_data);
+    ASSERT_TRUE(
+        test_utils::WriteFileVector(part_files.back()->path(), part_data));
+
+    InstallPlan::Partition part;
+    part.name = "part" + std::to_string(install_plan.partitions.size());
+    part.target_path = part_files.back()->path();
+    part.target_size = size;
+    part.target_hash = HashOfData(part_data);
+    install_plan.partitions.push_back(part);
+  }
+  // A partition without a device is skipped if it is empty.
+  InstallPlan::Partition empty_part;
+  empty_part.name = "empty";
+  install_plan.partitions.push_back(empty_part);
+
+  BuildActions(install_plan);
+
+  FilesystemVerifierActionTestDelegate delegate;
+  processor_.set_delegate(&delegate);
+
+  loop_.PostTask(
+      FROM_HERE,
+      base::Bind(
+          [](ActionProcessor* processor) { processor->StartProcessing(); },
+          base::Unretained(&processor_)));
+  loop_.Run();
+
+  EXPECT_FALSE(processor_.IsRunning());
+  EXPECT_TRUE(delegate.ran());
+  EXPECT_EQ(ErrorCode::kSuccess, delegate.code());
+  ASSERT_TRUE(delegate.install_plan_);
+  EXPECT_TRUE(*delegate.install_plan_ == install_plan);
+}
+
+TEST_F(FilesystemVerifierActionTest, ParallelHashFailTest) {
+  test_utils::ScopedTempFile part_file1("part1.XXXXXX");
+  test_utils::ScopedTempFile part_file2("part2.XXXXXX");
+  brillo::Blob part_data(200000);
+  test_utils::FillWithData(&part_data);
+  ASSERT_TRUE(test_utils::WriteFileVector(part_file1.path(), part_data));
+  ASSERT_TRUE(test_utils::WriteFileVector(part_file2.path(), part_data));
+
+  InstallPlan install_plan;
+  InstallPlan::Partition part;
+  part.name = "part1";
+  part.target_path = part_file1.path();
+  part.target_size = part_data.size();
+  part.target_hash = HashOfData(part_data);
+  install_plan.partitions.push_back(part);
+  // The target hash of the second partition doesn't match, but its source
+  // does.
+  part.name = "part2";
+  part.target_path = part_file2.path();
+  part.target_hash[0] ^= 1;
+  part.source_path = part_file2.path();
+  part.source_size = part_data.size();
+  part.source_hash = HashOfData(part_data);
+  install_plan.partitions.push_back(part);
+
+  BuildActions(install_plan);
+
+  FilesystemVerifierActionTestDelegate delegate;
+  processor_.set_delegate(&delegate);
+
+  loop_.PostTask(
+      FROM_HERE,
+      base::Bind(
+          [](ActionProcessor* processor) { processor->StartProcessing(); },
+          base::Unretained(&processor_)));
+  loop_.Run();
+
+  EXPECT_FALSE(processor_.IsRunning());
+  EXPECT_TRUE(delegate.ran());
+  EXPECT_EQ(ErrorCode::kNewRootfsVerificationError, delegate.code());
+}
+
 TEST_F(FilesystemVerifierActionTest, RunAsRootVerifyHashTest) {
   ASSERT_EQ(0U, getuid());
   EXPECT_TRUE(DoTest(false, false));
@@ -306,10 +451,10 @@ TEST_F(FilesystemVerifierActionTest, RunAsRootWriteVerityTest) {
   //     --output_vbmeta_image vbmeta
   // truncate -s $((256 * 4096)) part
   // sha256sum part | xxd -r -p | hexdump -v -e '/1 "0x%02x, "'
-  part.target_hash = {0x28, 0xd4, 0x96, 0x75, 0x4c, 0xf5, 0x8a, 0x3e,
-                      0x31, 0x85, 0x08, 0x92, 0x85, 0x62, 0xf0, 0x37,
-                      0xbc, 0x8d, 0x7e, 0xa4, 0xcb, 0x24, 0x18, 0x7b,
-                      0xf3, 0xeb, 0xb5, 0x8d, 0x6f, 0xc8, 0xd8, 0x1a};
+  part.target_hash = brillo::Blob{
+      0x28, 0xd4, 0x96, 0x75, 0x4c, 0xf5, 0x8a, 0x3e, 0x31, 0x85, 0x08,
+      0x92, 0x85, 0x62, 0xf0, 0x37, 0xbc, 0x8d, 0x7e, 0xa4, 0xcb, 0x24,
+      0x18, 0x7b, 0xf3, 0xeb, 0xb5, 0x8d, 0x6f, 0xc8, 0xd8, 0x1a};
   // avbtool info_image --image vbmeta | grep Salt | cut -d':' -f 2 |
   //     xxd -r -p | hexdump -v -e '/1 "0x%02x, "'
   part.hash_tree_salt = {0x9e, 0xcb, 0xf8, 0xd5, 0x0b, 0xb4, 0x43,
@@ -361,7 +506,7 @@ TEST_F(FilesystemVerifierActionTest, RunAsRootSkipWriteVerityTest) {
   part.fec_data_size = filesystem_size + part.hash_tree_size;
   part.fec_offset = part.fec_data_size;
   part.fec_size = 2 * 4096;
-  EXPECT_TRUE(HashCalculator::RawHashOfData(part_data, &part.target_hash));
+  part.target_hash = HashOfData(part_data);
   install_plan.partitions = {part};
 
   BuildActions(install_plan);
@@ -16,6 +16,8 @@
 
 #include "update_engine/payload_consumer/install_plan.h"
 
+#include <string.h>
+
 #include <base/format_macros.h>
 #include <base/logging.h>
 #include <base/strings/string_number_conversions.h>
@@ -40,6 +42,13 @@ string InstallPayloadTypeToString(InstallPayloadType type) {
   return "invalid type";
 }
 
+const size_t Sha256Hash::kSize;
+
+bool Sha256Hash::operator==(const brillo::Blob& blob) const {
+  return size_ == blob.size() && size_ <= kSize &&
+         memcmp(bytes_.data(), blob.data(), size_) == 0;
+}
+
 bool InstallPlan::operator==(const InstallPlan& that) const {
   return ((is_resume == that.is_resume) &&
           (download_url == that.download_url) && (payloads == that.payloads) &&
@@ -80,11 +89,20 @@ void InstallPlan::Dump() const {
         base::StringPrintf(", system_version: %s", system_version.c_str());
   }
 
+  string url_str = download_url;
+  if (!download_peer_urls.empty()) {
+    url_str += ", peer urls: " +
+               utils::StringVectorToString(download_peer_urls);
+  }
+  if (!download_fallback_url.empty()) {
+    url_str += ", fallback url: " + download_fallback_url;
+  }
+
   LOG(INFO) << "InstallPlan: " << (is_resume ? "resume" : "new_update")
             << version_str
             << ", source_slot: " << BootControlInterface::SlotName(source_slot)
             << ", target_slot: " << BootControlInterface::SlotName(target_slot)
-            << ", url: " << download_url << payloads_str << partitions_str
+            << ", url: " << url_str << payloads_str << partitions_str
             << ", hash_checks_mandatory: "
             << utils::ToString(hash_checks_mandatory)
             << ", powerwash_required: " << utils::ToString(powerwash_required)
@@ -92,6 +110,7 @@ void InstallPlan::Dump() const {
             << utils::ToString(switch_slot_on_reboot)
             << ", run_post_install: " << utils::ToString(run_post_install)
             << ", is_rollback: " << utils::ToString(is_rollback)
+            << ", stage_only: " << utils::ToString(stage_only)
             << ", write_verity: " << utils::ToString(write_verity);
 }
 
@@ -128,7 +147,8 @@ bool InstallPlan::Partition::operator==(
           run_postinstall == that.run_postinstall &&
           postinstall_path == that.postinstall_path &&
           filesystem_type == that.filesystem_type &&
-          postinstall_optional == that.postinstall_optional);
+          postinstall_optional == that.postinstall_optional &&
+          postinstall_parallel == that.postinstall_parallel);
 }
 
 }  // namespace chromeos_update_engine
@@ -17,6 +17,11 @@
 #ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_INSTALL_PLAN_H_
 #define UPDATE_ENGINE_PAYLOAD_CONSUMER_INSTALL_PLAN_H_
 
+#include <stdint.h>
+
+#include <algorithm>
+#include <array>
+#include <iterator>
 #include <string>
 #include <vector>
 
@@ -38,6 +43,53 @@ enum class InstallPayloadType {
 
 std::string InstallPayloadTypeToString(InstallPayloadType type);
 
+// A SHA-256 hash stored inline, so the partitions of an InstallPlan don't
+// allocate their hashes separately. It is empty until a hash is assigned, and
+// it can be assigned from and compared with a brillo::Blob. A hash of the
+// wrong size, like from a malformed manifest, never matches a real hash.
+class Sha256Hash {
+ public:
+  static const size_t kSize = 32;
+
+  Sha256Hash() = default;
+  Sha256Hash(const brillo::Blob& blob) {  // NOLINT(runtime/explicit)
+    assign(blob.begin(), blob.end());
+  }
+
+  template <typename Iterator>
+  void assign(Iterator begin, Iterator end) {
+    size_ = static_cast<size_t>(std::distance(begin, end));
+    bytes_.fill(0);
+    std::copy_n(begin, std::min(size_, kSize), bytes_.begin());
+  }
+
+  bool empty() const { return size_ == 0; }
+  size_t size() const { return std::min(size_, kSize); }
+  const uint8_t* data() const { return bytes_.data(); }
+  uint8_t& operator[](size_t index) { return bytes_[index]; }
+
+  brillo::Blob ToBlob() const { return brillo::Blob(data(), data() + size()); }
+
+  bool operator==(const Sha256Hash& that) const {
+    return size_ == that.size_ && bytes_ == that.bytes_;
+  }
+  bool operator!=(const Sha256Hash& that) const { return !(*this == that); }
+  bool operator==(const brillo::Blob& blob) const;
+  bool operator!=(const brillo::Blob& blob) const { return !(*this == blob); }
+
+ private:
+  std::array<uint8_t, kSize> bytes_{};
+  // The size of the assigned hash, which may be bigger than |bytes_|.
+  size_t size_{0};
+};
+
+inline bool operator==(const brillo::Blob& blob, const Sha256Hash& hash) {
+  return hash == blob;
+}
+inline bool operator!=(const brillo::Blob& blob, const Sha256Hash& hash) {
+  return hash != blob;
+}
+
 struct InstallPlan {
   InstallPlan() = default;
 
@@ -53,6 +105,12 @@ struct InstallPlan {
 
   bool is_resume{false};
   std::string download_url;  // url to download from
+  // Other URLs serving the same payload as |download_url|, such as other
+  // p2p peers, downloaded from at the same time over the parallel
+  // connections, and the URL the connections fall back to when a download
+  // from one of these URLs fails.
+  std::vector<std::string> download_peer_urls;
+  std::string download_fallback_url;
   std::string version;       // version we are installing.
   // system version, if present and separate from version
   std::string system_version;
@@ -96,11 +154,11 @@ struct InstallPlan {
 
     std::string source_path;
     uint64_t source_size{0};
-    brillo::Blob source_hash;
+    Sha256Hash source_hash;
 
     std::string target_path;
     uint64_t target_size{0};
-    brillo::Blob target_hash;
+    Sha256Hash target_hash;
     uint32_t block_size{0};
 
     // Whether we should run the postinstall script from this partition and the
@@ -109,6 +167,7 @@ struct InstallPlan {
     std::string postinstall_path;
     std::string filesystem_type;
     bool postinstall_optional{false};
+    bool postinstall_parallel{false};
 
     // Verity hash tree and FEC config. See update_metadata.proto for details.
     // All offsets and sizes are in bytes.
@@ -124,6 +183,11 @@ struct InstallPlan {
     uint64_t fec_offset{0};
     uint64_t fec_size{0};
     uint32_t fec_roots{0};
+
+    // Whether |target_hash| was already verified by hashing the data while it
+    // was written to |target_path|, so FilesystemVerifierAction doesn't need
+    // to read the partition again.
+    bool target_hash_verified{false};
   };
   std::vector<Partition> partitions;
 
@@ -146,6 +210,10 @@ struct InstallPlan {
   // True if this update is a rollback.
   bool is_rollback{false};
 
+  // True if the payloads should only be downloaded to the payload cache, to
+  // be applied by a later update attempt when the policy allows it.
+  bool stage_only{false};
+
   // True if the update should write verity.
   // False otherwise.
   bool write_verity{true};
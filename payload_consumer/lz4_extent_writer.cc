@@ -0,0 +1,80 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/lz4_extent_writer.h"
+
+using google::protobuf::RepeatedPtrField;
+
+namespace chromeos_update_engine {
+
+namespace {
+const brillo::Blob::size_type kOutputBufferLength = 64 * 1024;
+}  // namespace
+
+template <typename UnderlyingWriter>
+BasicLz4ExtentWriter<UnderlyingWriter>::~BasicLz4ExtentWriter() {
+  LZ4F_freeDecompressionContext(stream_);
+}
+
+template <typename UnderlyingWriter>
+bool BasicLz4ExtentWriter<UnderlyingWriter>::Init(
+    FileDescriptorPtr fd,
+    const RepeatedPtrField<Extent>& extents,
+    uint32_t block_size) {
+  LZ4F_errorCode_t ret =
+      LZ4F_createDecompressionContext(&stream_, LZ4F_VERSION);
+  if (LZ4F_isError(ret)) {
+    LOG(ERROR) << "LZ4F_createDecompressionContext failed: "
+               << LZ4F_getErrorName(ret);
+    return false;
+  }
+  output_buffer_.resize(kOutputBufferLength);
+  return underlying_writer_->Init(fd, extents, block_size);
+}
+
+template <typename UnderlyingWriter>
+bool BasicLz4ExtentWriter<UnderlyingWriter>::Write(const void* bytes,
+                                                   size_t count) {
+  // LZ4F_decompress() buffers the partial blocks itself, so all the input is
+  // always consumed. The decompressed data is flushed until the output
+  // buffer is no longer filled.
+  const uint8_t* input = reinterpret_cast<const uint8_t*>(bytes);
+  for (;;) {
+    size_t in_size = count;
+    size_t out_size = output_buffer_.size();
+    size_t ret = LZ4F_decompress(
+        stream_, output_buffer_.data(), &out_size, input, &in_size, nullptr);
+    if (LZ4F_isError(ret)) {
+      LOG(ERROR) << "LZ4F_decompress failed: " << LZ4F_getErrorName(ret);
+      return false;
+    }
+    if (out_size > 0) {
+      TEST_AND_RETURN_FALSE(
+          underlying_writer_->Write(output_buffer_.data(), out_size));
+    }
+    input += in_size;
+    count -= in_size;
+    if (count == 0 && out_size < output_buffer_.size())
+      break;
+  }
+  return true;
+}
+
+template class BasicLz4ExtentWriter<ExtentWriter>;
+template class BasicLz4ExtentWriter<DirectExtentWriter>;
+
+}  // namespace chromeos_update_engine
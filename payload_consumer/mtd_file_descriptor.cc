@@ -22,6 +22,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <algorithm>
 #include <memory>
 #include <string>
 
@@ -199,6 +200,8 @@ bool UbiFileDescriptor::Open(const char* path, int flags, mode_t mode) {
     }
     mode_ = kWriteOnly;
     nr_written_ = 0;
+    buffer_.clear();
+    buffer_.reserve(eraseblock_size_);
   } else {
     mode_ = kReadOnly;
   }
@@ -219,11 +222,18 @@ ssize_t UbiFileDescriptor::Read(void* buf, size_t count) {
 
 ssize_t UbiFileDescriptor::Write(const void* buf, size_t count) {
   CHECK(mode_ == kWriteOnly);
-  ssize_t nr_chunk = EintrSafeFileDescriptor::Write(buf, count);
-  if (nr_chunk >= 0) {
-    nr_written_ += nr_chunk;
+  const uint8_t* data = static_cast<const uint8_t*>(buf);
+  size_t copied = 0;
+  while (copied < count) {
+    size_t to_copy =
+        std::min<size_t>(count - copied, eraseblock_size_ - buffer_.size());
+    buffer_.insert(buffer_.end(), data + copied, data + copied + to_copy);
+    copied += to_copy;
+    if (buffer_.size() == eraseblock_size_ && !WriteBuffer())
+      return -1;
   }
-  return nr_chunk;
+  nr_written_ += count;
+  return count;
 }
 
 off64_t UbiFileDescriptor::Seek(off64_t offset, int whence) {
@@ -237,27 +247,42 @@ off64_t UbiFileDescriptor::Seek(off64_t offset, int whence) {
 bool UbiFileDescriptor::Close() {
   bool pad_ok = true;
   if (IsOpen() && mode_ == kWriteOnly) {
-    char buf[1024];
-    memset(buf, 0xFF, sizeof(buf));
-    while (nr_written_ < volume_size_) {
-      // We have written less than the whole volume. In order for us to clear
-      // the update marker, we need to fill the rest. It is recommended to fill
-      // UBI writes with 0xFF.
-      uint64_t to_write = volume_size_ - nr_written_;
-      if (to_write > sizeof(buf)) {
-        to_write = sizeof(buf);
-      }
-      ssize_t nr_chunk = EintrSafeFileDescriptor::Write(buf, to_write);
-      if (nr_chunk < 0) {
-        LOG(ERROR) << "Cannot 0xFF-pad before closing.";
-        // There is an error, but we can't really do any meaningful thing here.
-        pad_ok = false;
-        break;
-      }
-      nr_written_ += nr_chunk;
+    // We have written less than the whole volume. In order for us to clear the
+    // update marker, we need to fill the rest. It is recommended to fill UBI
+    // writes with 0xFF. The volume is made of whole eraseblocks, so the rest is
+    // written through the buffer as well.
+    while (pad_ok && nr_written_ < volume_size_) {
+      uint64_t to_write = std::min<uint64_t>(
+          volume_size_ - nr_written_, eraseblock_size_ - buffer_.size());
+      buffer_.insert(buffer_.end(), to_write, 0xFF);
+      nr_written_ += to_write;
+      pad_ok = WriteBuffer();
+    }
+    // Data written past the end of the volume is still left in the buffer.
+    if (pad_ok && !buffer_.empty())
+      pad_ok = WriteBuffer();
+    if (!pad_ok) {
+      LOG(ERROR) << "Cannot 0xFF-pad before closing.";
+      // There is an error, but we can't really do any meaningful thing here.
     }
   }
+  buffer_.clear();
   return EintrSafeFileDescriptor::Close() && pad_ok;
 }
 
+bool UbiFileDescriptor::WriteBuffer() {
+  size_t written = 0;
+  while (written < buffer_.size()) {
+    ssize_t nr_chunk = EintrSafeFileDescriptor::Write(
+        buffer_.data() + written, buffer_.size() - written);
+    if (nr_chunk < 0) {
+      PLOG(ERROR) << "Cannot write to the UBI volume";
+      return false;
+    }
+    written += nr_chunk;
+  }
+  buffer_.clear();
+  return true;
+}
+
 }  // namespace chromeos_update_engine
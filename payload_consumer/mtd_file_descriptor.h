@@ -22,6 +22,7 @@
 
 #include <memory>
 
+#include <brillo/secure_blob.h>
 #include <mtdutils.h>
 
 #include "update_engine/payload_consumer/file_descriptor.h"
@@ -49,6 +50,7 @@ class MtdFileDescriptor : public EintrSafeFileDescriptor {
                 int* result) override {
     return false;
   }
+  bool Prefetch(uint64_t offset, uint64_t length) override { return false; }
   bool Close() override;
 
  private:
@@ -67,7 +69,8 @@ struct UbiVolumeInfo {
 // A file descriptor to update a UBI volume, similar to MtdFileDescriptor.
 // Once the file descriptor is opened for write, the volume is marked as being
 // updated. The volume will not be usable until an update is completed. See
-// UBI_IOCVOLUP ioctl operation.
+// UBI_IOCVOLUP ioctl operation. The written data is buffered and written to the
+// volume one whole eraseblock at a time.
 class UbiFileDescriptor : public EintrSafeFileDescriptor {
  public:
   // Perform some queries about |path| to see if it is a UBI volume.
@@ -85,16 +88,24 @@ class UbiFileDescriptor : public EintrSafeFileDescriptor {
                 int* result) override {
     return false;
   }
+  bool Prefetch(uint64_t offset, uint64_t length) override { return false; }
   bool Close() override;
 
  private:
   enum Mode { kReadOnly, kWriteOnly };
 
+  // Writes the buffered data to the volume. Returns false on failure.
+  bool WriteBuffer();
+
   uint64_t usable_eb_blocks_;
   uint64_t eraseblock_size_;
   uint64_t volume_size_;
   uint64_t nr_written_;
 
+  // The data written since the last eraseblock boundary. A volume update can't
+  // be resumed, so this is not written when flushing either.
+  brillo::Blob buffer_;
+
   Mode mode_;
 };
 
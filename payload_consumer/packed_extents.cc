@@ -0,0 +1,109 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/packed_extents.h"
+
+#include <base/logging.h>
+
+using google::protobuf::RepeatedPtrField;
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+void AppendVarint(uint64_t value, string* out) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+bool ReadVarint(const string& in, size_t* pos, uint64_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 64 && *pos < in.size(); shift += 7) {
+    uint8_t byte = static_cast<uint8_t>(in[(*pos)++]);
+    *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+string PackExtents(const RepeatedPtrField<Extent>& extents) {
+  string packed;
+  uint64_t prev_end = 0;
+  for (const Extent& extent : extents) {
+    // The difference wraps around when going backwards, and is zigzag
+    // encoded so small negative ones stay short.
+    int64_t delta = static_cast<int64_t>(extent.start_block() - prev_end);
+    AppendVarint((static_cast<uint64_t>(delta) << 1) ^
+                     static_cast<uint64_t>(delta >> 63),
+                 &packed);
+    AppendVarint(extent.num_blocks(), &packed);
+    prev_end = extent.start_block() + extent.num_blocks();
+  }
+  return packed;
+}
+
+bool UnpackExtents(const string& packed, RepeatedPtrField<Extent>* extents) {
+  size_t pos = 0;
+  uint64_t prev_end = 0;
+  while (pos < packed.size()) {
+    uint64_t zigzag, num_blocks;
+    if (!ReadVarint(packed, &pos, &zigzag) ||
+        !ReadVarint(packed, &pos, &num_blocks)) {
+      LOG(ERROR) << "Invalid packed extents.";
+      return false;
+    }
+    Extent* extent = extents->Add();
+    extent->set_start_block(prev_end + ((zigzag >> 1) ^ -(zigzag & 1)));
+    extent->set_num_blocks(num_blocks);
+    prev_end = extent->start_block() + num_blocks;
+  }
+  return true;
+}
+
+void PackOperationExtents(InstallOperation* op) {
+  if (op->src_extents_size() > 0) {
+    op->set_src_extents_packed(PackExtents(op->src_extents()));
+    op->clear_src_extents();
+  }
+  if (op->dst_extents_size() > 0) {
+    op->set_dst_extents_packed(PackExtents(op->dst_extents()));
+    op->clear_dst_extents();
+  }
+}
+
+bool UnpackOperationExtents(InstallOperation* op) {
+  if (op->has_src_extents_packed()) {
+    if (!UnpackExtents(op->src_extents_packed(), op->mutable_src_extents()))
+      return false;
+    op->clear_src_extents_packed();
+  }
+  if (op->has_dst_extents_packed()) {
+    if (!UnpackExtents(op->dst_extents_packed(), op->mutable_dst_extents()))
+      return false;
+    op->clear_dst_extents_packed();
+  }
+  return true;
+}
+
+}  // namespace chromeos_update_engine
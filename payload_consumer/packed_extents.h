@@ -0,0 +1,49 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_PACKED_EXTENTS_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_PACKED_EXTENTS_H_
+
+#include <string>
+
+#include <google/protobuf/repeated_field.h>
+
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// Returns |extents| in the packed encoding of the |src_extents_packed| and
+// |dst_extents_packed| fields of an InstallOperation, described in
+// update_metadata.proto.
+std::string PackExtents(
+    const google::protobuf::RepeatedPtrField<Extent>& extents);
+
+// Appends the extents encoded in |packed| to |extents|. Returns false if
+// |packed| isn't valid.
+bool UnpackExtents(const std::string& packed,
+                   google::protobuf::RepeatedPtrField<Extent>* extents);
+
+// Moves the |src_extents| and |dst_extents| of |op| to their packed fields.
+void PackOperationExtents(InstallOperation* op);
+
+// Moves the packed extents of |op|, if any, back to its |src_extents| and
+// |dst_extents|. Returns false if they aren't valid.
+bool UnpackOperationExtents(InstallOperation* op);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_PACKED_EXTENTS_H_
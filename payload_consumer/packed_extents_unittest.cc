@@ -0,0 +1,88 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/packed_extents.h"
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/extent_utils.h"
+
+using google::protobuf::RepeatedPtrField;
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+RepeatedPtrField<Extent> Extents(const std::vector<Extent>& extents) {
+  return RepeatedPtrField<Extent>(extents.begin(), extents.end());
+}
+
+}  // namespace
+
+TEST(PackedExtentsTest, RoundTripTest) {
+  RepeatedPtrField<Extent> extents = Extents({ExtentForRange(100, 5),
+                                              ExtentForRange(105, 1),
+                                              ExtentForRange(20, 3),
+                                              ExtentForRange(kSparseHole, 2),
+                                              ExtentForRange(1ULL << 40, 7)});
+  string packed = PackExtents(extents);
+  RepeatedPtrField<Extent> unpacked;
+  EXPECT_TRUE(UnpackExtents(packed, &unpacked));
+  ASSERT_EQ(extents.size(), unpacked.size());
+  for (int i = 0; i < extents.size(); i++)
+    EXPECT_EQ(extents.Get(i), unpacked.Get(i));
+}
+
+TEST(PackedExtentsTest, AdjacentExtentsAreSmallTest) {
+  // Each extent following the previous one takes two bytes.
+  string packed = PackExtents(
+      Extents({ExtentForRange(123456789, 8), ExtentForRange(123456797, 8)}));
+  EXPECT_EQ(PackExtents(Extents({ExtentForRange(123456789, 8)})).size() + 2,
+            packed.size());
+}
+
+TEST(PackedExtentsTest, InvalidPackedExtentsTest) {
+  RepeatedPtrField<Extent> extents;
+  // The number of blocks is missing.
+  EXPECT_FALSE(UnpackExtents("\x02", &extents));
+  // The varint doesn't end.
+  EXPECT_FALSE(UnpackExtents("\x02\x80", &extents));
+}
+
+TEST(PackedExtentsTest, OperationTest) {
+  InstallOperation op;
+  *op.add_src_extents() = ExtentForRange(10, 2);
+  *op.add_dst_extents() = ExtentForRange(20, 4);
+  InstallOperation original = op;
+  PackOperationExtents(&op);
+  EXPECT_EQ(0, op.src_extents_size());
+  EXPECT_EQ(0, op.dst_extents_size());
+  EXPECT_TRUE(op.has_src_extents_packed());
+
+  EXPECT_TRUE(UnpackOperationExtents(&op));
+  EXPECT_FALSE(op.has_src_extents_packed());
+  EXPECT_FALSE(op.has_dst_extents_packed());
+  EXPECT_EQ(original.SerializeAsString(), op.SerializeAsString());
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,211 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/partition_write_hasher.h"
+
+#include <fcntl.h>
+#include <linux/fs.h>
+
+#include <algorithm>
+#include <iterator>
+
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+// The size of the buffer used to read back the partition and to hash zeros.
+const size_t kReadBufferSize = 1024 * 1024;  // 1 MiB
+}  // namespace
+
+void PartitionWriteHasher::Write(uint64_t offset,
+                                 const void* data,
+                                 size_t count) {
+  if (offset >= size_ || !count)
+    return;
+  count = std::min(static_cast<uint64_t>(count), size_ - offset);
+
+  base::AutoLock auto_lock(lock_);
+  if (failed_)
+    return;
+  if (offset < hashed_size_) {
+    LOG(WARNING) << "The data hashed at offset " << offset
+                 << " was written again, the partition will be read back.";
+    failed_ = true;
+    DropPendingData();
+    return;
+  }
+  if (incomplete_)
+    return;
+
+  if (offset == hashed_size_) {
+    hasher_.Update(data, count);
+    hashed_size_ += count;
+    HashPendingData();
+    return;
+  }
+
+  // Keep the data until the hashed prefix reaches it, unless it overlaps
+  // other pending data.
+  auto next = pending_.lower_bound(offset);
+  bool overlaps = next != pending_.end() && next->first < offset + count;
+  if (next != pending_.begin()) {
+    auto prev = std::prev(next);
+    overlaps |= prev->first + prev->second.size() > offset;
+  }
+  if (overlaps || pending_bytes_ + count > max_pending_bytes_) {
+    DropPendingData();
+    return;
+  }
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  pending_.emplace(offset, brillo::Blob(bytes, bytes + count));
+  pending_bytes_ += count;
+}
+
+void PartitionWriteHasher::Zero(uint64_t offset, uint64_t length) {
+  static const brillo::Blob zeros(kReadBufferSize, 0);
+  for (uint64_t pos = 0; pos < length; pos += zeros.size()) {
+    Write(offset + pos,
+          zeros.data(),
+          std::min(length - pos, static_cast<uint64_t>(zeros.size())));
+  }
+}
+
+void PartitionWriteHasher::Invalidate(uint64_t offset, uint64_t length) {
+  if (offset >= size_ || !length)
+    return;
+  base::AutoLock auto_lock(lock_);
+  if (offset < hashed_size_) {
+    LOG(WARNING) << "The data hashed at offset " << offset
+                 << " was discarded, the partition will be read back.";
+    failed_ = true;
+  }
+  DropPendingData();
+}
+
+bool PartitionWriteHasher::Finish(const std::string& path,
+                                  brillo::Blob* hash) {
+  base::AutoLock auto_lock(lock_);
+  TEST_AND_RETURN_FALSE(!failed_);
+  if (hashed_size_ < size_) {
+    LOG(INFO) << "Reading back " << size_ - hashed_size_ << " of " << size_
+              << " bytes of " << path << " to hash it.";
+    int fd = HANDLE_EINTR(open(path.c_str(), O_RDONLY));
+    TEST_AND_RETURN_FALSE_ERRNO(fd >= 0);
+    ScopedFdCloser fd_closer(&fd);
+    brillo::Blob buffer(kReadBufferSize);
+    while (hashed_size_ < size_) {
+      size_t bytes_to_read = std::min(static_cast<uint64_t>(buffer.size()),
+                                      size_ - hashed_size_);
+      ssize_t bytes_read = 0;
+      TEST_AND_RETURN_FALSE(utils::PReadAll(
+          fd, buffer.data(), bytes_to_read, hashed_size_, &bytes_read));
+      TEST_AND_RETURN_FALSE(bytes_read ==
+                            static_cast<ssize_t>(bytes_to_read));
+      TEST_AND_RETURN_FALSE(hasher_.Update(buffer.data(), bytes_to_read));
+      hashed_size_ += bytes_to_read;
+    }
+  }
+  DropPendingData();
+  TEST_AND_RETURN_FALSE(hasher_.Finalize());
+  *hash = hasher_.raw_hash();
+  return true;
+}
+
+uint64_t PartitionWriteHasher::hashed_size() const {
+  base::AutoLock auto_lock(lock_);
+  return hashed_size_;
+}
+
+void PartitionWriteHasher::HashPendingData() {
+  while (!pending_.empty() && pending_.begin()->first <= hashed_size_) {
+    auto it = pending_.begin();
+    if (it->first < hashed_size_) {
+      // The pending data was overwritten by the data just hashed.
+      DropPendingData();
+      return;
+    }
+    hasher_.Update(it->second.data(), it->second.size());
+    hashed_size_ += it->second.size();
+    pending_bytes_ -= it->second.size();
+    pending_.erase(it);
+  }
+}
+
+void PartitionWriteHasher::DropPendingData() {
+  if (!failed_ && !incomplete_ && hashed_size_ < size_) {
+    LOG(INFO) << "Hashed " << hashed_size_ << " bytes while writing, the rest "
+              << "of the partition will be read back.";
+  }
+  incomplete_ = true;
+  pending_.clear();
+  pending_bytes_ = 0;
+}
+
+bool HashingFileDescriptor::Open(const char* path, int flags, mode_t mode) {
+  offset_ = 0;
+  return fd_->Open(path, flags, mode);
+}
+
+bool HashingFileDescriptor::Open(const char* path, int flags) {
+  offset_ = 0;
+  return fd_->Open(path, flags);
+}
+
+ssize_t HashingFileDescriptor::Read(void* buf, size_t count) {
+  ssize_t ret = fd_->Read(buf, count);
+  if (ret > 0)
+    offset_ += ret;
+  return ret;
+}
+
+ssize_t HashingFileDescriptor::Write(const void* buf, size_t count) {
+  ssize_t ret = fd_->Write(buf, count);
+  if (ret > 0) {
+    hasher_->Write(offset_, buf, ret);
+    offset_ += ret;
+  }
+  return ret;
+}
+
+off64_t HashingFileDescriptor::Seek(off64_t offset, int whence) {
+  off64_t ret = fd_->Seek(offset, whence);
+  if (ret >= 0)
+    offset_ = ret;
+  return ret;
+}
+
+bool HashingFileDescriptor::BlkIoctl(int request,
+                                     uint64_t start,
+                                     uint64_t length,
+                                     int* result) {
+  if (!fd_->BlkIoctl(request, start, length, result))
+    return false;
+#ifdef BLKZEROOUT
+  if (request == BLKZEROOUT && *result == 0) {
+    hasher_->Zero(start, length);
+    return true;
+  }
+#endif  // BLKZEROOUT
+  hasher_->Invalidate(start, length);
+  return true;
+}
+
+}  // namespace chromeos_update_engine
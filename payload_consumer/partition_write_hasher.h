@@ -0,0 +1,132 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_PARTITION_WRITE_HASHER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_PARTITION_WRITE_HASHER_H_
+
+#include <sys/types.h>
+
+#include <map>
+#include <string>
+
+#include <base/synchronization/lock.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/payload_consumer/file_descriptor.h"
+
+namespace chromeos_update_engine {
+
+// Computes the SHA-256 hash of the first |size| bytes of a partition from the
+// data written to it, so it doesn't need to be read back. The writes can come
+// in any order and from several threads. The data written right after the
+// hashed prefix of the partition is hashed right away, and the data written
+// past it is kept in memory until the prefix reaches it, up to
+// |max_pending_bytes|. Whatever couldn't be hashed that way is read back by
+// Finish().
+class PartitionWriteHasher {
+ public:
+  PartitionWriteHasher(uint64_t size, size_t max_pending_bytes)
+      : size_(size), max_pending_bytes_(max_pending_bytes) {}
+
+  // Notifies that the |count| bytes at |data| were written at |offset|.
+  void Write(uint64_t offset, const void* data, size_t count);
+
+  // Notifies that the |length| bytes at |offset| were set to zero.
+  void Zero(uint64_t offset, uint64_t length);
+
+  // Notifies that the contents of the |length| bytes at |offset| changed in an
+  // unknown way, like when they are discarded.
+  void Invalidate(uint64_t offset, uint64_t length);
+
+  // Reads the part of the partition at |path| that wasn't hashed yet and
+  // stores the hash of the partition in |hash|. Returns false if the data
+  // already hashed was written again or the partition couldn't be read.
+  bool Finish(const std::string& path, brillo::Blob* hash);
+
+  // The number of bytes hashed from the written data so far.
+  uint64_t hashed_size() const;
+
+ private:
+  // Hashes the pending data at the end of the hashed prefix.
+  void HashPendingData();
+
+  // Drops the pending data, leaving the rest of the partition to Finish().
+  void DropPendingData();
+
+  const uint64_t size_;
+  const size_t max_pending_bytes_;
+
+  // Protects the members below.
+  mutable base::Lock lock_;
+
+  HashCalculator hasher_;
+  uint64_t hashed_size_{0};
+
+  // The data written past the hashed prefix, indexed by its offset.
+  std::map<uint64_t, brillo::Blob> pending_;
+  size_t pending_bytes_{0};
+
+  // Whether the data written past the hashed prefix is no longer tracked, so
+  // Finish() reads the rest of the partition back.
+  bool incomplete_{false};
+
+  // Whether data already hashed was written again.
+  bool failed_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(PartitionWriteHasher);
+};
+
+// A FileDescriptor that notifies a PartitionWriteHasher of the data written
+// to |fd|.
+class HashingFileDescriptor : public FileDescriptor {
+ public:
+  HashingFileDescriptor(FileDescriptorPtr fd, PartitionWriteHasher* hasher)
+      : fd_(fd), hasher_(hasher) {}
+  ~HashingFileDescriptor() override = default;
+
+  bool Open(const char* path, int flags, mode_t mode) override;
+  bool Open(const char* path, int flags) override;
+  ssize_t Read(void* buf, size_t count) override;
+  ssize_t Write(const void* buf, size_t count) override;
+  off64_t Seek(off64_t offset, int whence) override;
+  uint64_t BlockDevSize() override { return fd_->BlockDevSize(); }
+  bool BlkIoctl(int request,
+                uint64_t start,
+                uint64_t length,
+                int* result) override;
+  bool Prefetch(uint64_t offset, uint64_t length) override {
+    return fd_->Prefetch(offset, length);
+  }
+  bool Flush() override { return fd_->Flush(); }
+  bool Close() override { return fd_->Close(); }
+  bool IsSettingErrno() override { return fd_->IsSettingErrno(); }
+  bool IsOpen() override { return fd_->IsOpen(); }
+
+ private:
+  FileDescriptorPtr fd_;
+  PartitionWriteHasher* hasher_;
+
+  // The offset of |fd_|.
+  off64_t offset_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(HashingFileDescriptor);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_PARTITION_WRITE_HASHER_H_
@@ -0,0 +1,163 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/partition_write_hasher.h"
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <memory>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+const size_t kPartitionSize = 1024 * 1024 + 100;
+const size_t kChunkSize = 10000;
+const char kMissingPath[] = "/no/such/partition";
+}  // namespace
+
+class PartitionWriteHasherTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    data_.resize(kPartitionSize);
+    test_utils::FillWithData(&data_);
+    EXPECT_TRUE(HashCalculator::RawHashOfData(data_, &expected_hash_));
+  }
+
+  // Notifies |hasher| of the write of the chunk of |data_| at |offset|.
+  void WriteChunk(PartitionWriteHasher* hasher, size_t offset) {
+    hasher->Write(offset,
+                  data_.data() + offset,
+                  std::min(kChunkSize, kPartitionSize - offset));
+  }
+
+  brillo::Blob data_;
+  brillo::Blob expected_hash_;
+};
+
+TEST_F(PartitionWriteHasherTest, InOrderWritesTest) {
+  PartitionWriteHasher hasher(kPartitionSize, 0);
+  for (size_t offset = 0; offset < kPartitionSize; offset += kChunkSize)
+    WriteChunk(&hasher, offset);
+  // Writes past the hashed size are ignored.
+  hasher.Write(kPartitionSize, data_.data(), 10);
+  EXPECT_EQ(kPartitionSize, hasher.hashed_size());
+
+  // The partition doesn't need to be read.
+  brillo::Blob hash;
+  EXPECT_TRUE(hasher.Finish(kMissingPath, &hash));
+  EXPECT_EQ(expected_hash_, hash);
+}
+
+TEST_F(PartitionWriteHasherTest, OutOfOrderWritesTest) {
+  PartitionWriteHasher hasher(kPartitionSize, 3 * kChunkSize);
+  // Write the chunks in pairs, the second chunk of each pair first.
+  for (size_t offset = 0; offset < kPartitionSize; offset += 2 * kChunkSize) {
+    if (offset + kChunkSize < kPartitionSize)
+      WriteChunk(&hasher, offset + kChunkSize);
+    WriteChunk(&hasher, offset);
+  }
+  EXPECT_EQ(kPartitionSize, hasher.hashed_size());
+
+  brillo::Blob hash;
+  EXPECT_TRUE(hasher.Finish(kMissingPath, &hash));
+  EXPECT_EQ(expected_hash_, hash);
+}
+
+TEST_F(PartitionWriteHasherTest, ReadBackTest) {
+  test_utils::ScopedTempFile part_file("PartitionWriteHasher-part.XXXXXX");
+  EXPECT_TRUE(test_utils::WriteFileVector(part_file.path(), data_));
+
+  // The pending data doesn't fit, so the rest is read back.
+  PartitionWriteHasher hasher(kPartitionSize, kChunkSize);
+  WriteChunk(&hasher, 0);
+  WriteChunk(&hasher, 3 * kChunkSize);
+  WriteChunk(&hasher, 2 * kChunkSize);
+  // Nothing else is hashed once the pending data was dropped.
+  WriteChunk(&hasher, kChunkSize);
+  EXPECT_EQ(kChunkSize, hasher.hashed_size());
+
+  brillo::Blob hash;
+  EXPECT_FALSE(hasher.Finish(kMissingPath, &hash));
+  EXPECT_TRUE(hasher.Finish(part_file.path(), &hash));
+  EXPECT_EQ(expected_hash_, hash);
+}
+
+TEST_F(PartitionWriteHasherTest, ZeroTest) {
+  std::fill(data_.begin() + kChunkSize, data_.end(), 0);
+  EXPECT_TRUE(HashCalculator::RawHashOfData(data_, &expected_hash_));
+
+  PartitionWriteHasher hasher(kPartitionSize, 0);
+  WriteChunk(&hasher, 0);
+  hasher.Zero(kChunkSize, kPartitionSize);
+  EXPECT_EQ(kPartitionSize, hasher.hashed_size());
+
+  brillo::Blob hash;
+  EXPECT_TRUE(hasher.Finish(kMissingPath, &hash));
+  EXPECT_EQ(expected_hash_, hash);
+}
+
+TEST_F(PartitionWriteHasherTest, RewriteFailsTest) {
+  PartitionWriteHasher hasher(kPartitionSize, 0);
+  WriteChunk(&hasher, 0);
+  WriteChunk(&hasher, kChunkSize);
+  WriteChunk(&hasher, 0);
+
+  brillo::Blob hash;
+  EXPECT_FALSE(hasher.Finish(kMissingPath, &hash));
+}
+
+TEST_F(PartitionWriteHasherTest, DiscardFailsTest) {
+  PartitionWriteHasher hasher(kPartitionSize, 0);
+  WriteChunk(&hasher, 0);
+  // Discarding past the hashed size is fine.
+  hasher.Invalidate(kPartitionSize, 4096);
+  hasher.Invalidate(0, 4096);
+
+  brillo::Blob hash;
+  EXPECT_FALSE(hasher.Finish(kMissingPath, &hash));
+}
+
+TEST_F(PartitionWriteHasherTest, HashingFileDescriptorTest) {
+  test_utils::ScopedTempFile part_file("PartitionWriteHasher-part.XXXXXX");
+  EXPECT_TRUE(test_utils::WriteFileVector(part_file.path(), brillo::Blob()));
+
+  PartitionWriteHasher hasher(kPartitionSize, kPartitionSize);
+  FileDescriptorPtr fd(new HashingFileDescriptor(
+      std::make_shared<EintrSafeFileDescriptor>(), &hasher));
+  EXPECT_TRUE(fd->Open(part_file.path().c_str(), O_RDWR));
+  // Write the second half first.
+  const size_t half = kPartitionSize / 2;
+  EXPECT_TRUE(utils::PWriteAll(
+      fd, data_.data() + half, kPartitionSize - half, half));
+  EXPECT_EQ(0U, hasher.hashed_size());
+  EXPECT_TRUE(utils::PWriteAll(fd, data_.data(), half, 0));
+  EXPECT_EQ(kPartitionSize, hasher.hashed_size());
+  EXPECT_TRUE(fd->Close());
+
+  brillo::Blob hash;
+  EXPECT_TRUE(hasher.Finish(kMissingPath, &hash));
+  EXPECT_EQ(expected_hash_, hash);
+}
+
+}  // namespace chromeos_update_engine
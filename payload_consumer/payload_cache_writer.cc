@@ -0,0 +1,219 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/payload_cache_writer.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <base/files/file_util.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/stringprintf.h>
+
+#include "update_engine/common/utils.h"
+
+using base::FilePath;
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+const char kPartialSuffix[] = ".partial";
+
+// Makes |target_path| a reflink of |source_path|, sharing its blocks. Returns
+// false if the filesystem doesn't support it.
+bool ReflinkFile(const FilePath& source_path, const FilePath& target_path) {
+#ifdef FICLONE
+  int source_fd =
+      HANDLE_EINTR(open(source_path.value().c_str(), O_RDONLY | O_CLOEXEC));
+  if (source_fd < 0)
+    return false;
+  ScopedFdCloser source_fd_closer(&source_fd);
+  int target_fd = HANDLE_EINTR(open(target_path.value().c_str(),
+                                    O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                                    0600));
+  if (target_fd < 0)
+    return false;
+  ScopedFdCloser target_fd_closer(&target_fd);
+  if (ioctl(target_fd, FICLONE, source_fd) == 0)
+    return true;
+  base::DeleteFile(target_path, false);
+#endif  // FICLONE
+  return false;
+}
+
+}  // namespace
+
+PayloadCacheWriter::PayloadCacheWriter(const FilePath& cache_dir,
+                                       const InstallPlan::Payload& payload)
+    : cache_path_(GetCachePath(cache_dir, payload)), payload_(payload) {
+  partial_path_ = cache_path_.AddExtension(kPartialSuffix);
+}
+
+PayloadCacheWriter::~PayloadCacheWriter() {
+  // A partial file is never resumed, since the data it holds wasn't hashed
+  // by this writer.
+  Close();
+  base::DeleteFile(partial_path_, false);
+}
+
+FilePath PayloadCacheWriter::GetCachePath(
+    const FilePath& cache_dir, const InstallPlan::Payload& payload) {
+  // The payload hash is hex encoded since the name of a p2p file may contain
+  // a '/'.
+  return cache_dir.Append(base::StringPrintf(
+      "payload_%" PRIu64 "_%s",
+      payload.size,
+      base::HexEncode(payload.hash.data(), payload.hash.size()).c_str()));
+}
+
+bool PayloadCacheWriter::IsCached(const FilePath& cache_dir,
+                                  const InstallPlan::Payload& payload) {
+  if (cache_dir.empty() || payload.size == 0)
+    return false;
+  int64_t size;
+  return base::GetFileSize(GetCachePath(cache_dir, payload), &size) &&
+         static_cast<uint64_t>(size) == payload.size;
+}
+
+bool PayloadCacheWriter::LinkLocalCopy(const FilePath& cache_dir,
+                                       const InstallPlan::Payload& payload,
+                                       const FilePath& path) {
+  if (IsCached(cache_dir, payload))
+    return true;
+  int64_t size;
+  if (cache_dir.empty() || payload.size == 0 ||
+      !base::GetFileSize(path, &size) ||
+      static_cast<uint64_t>(size) != payload.size) {
+    return false;
+  }
+  if (!base::CreateDirectory(cache_dir)) {
+    PLOG(ERROR) << "Unable to create " << cache_dir.value();
+    return false;
+  }
+  // The link is made under the partial name first, so an interrupted link
+  // is never taken for a cached payload.
+  FilePath cache_path = GetCachePath(cache_dir, payload);
+  FilePath partial_path = cache_path.AddExtension(kPartialSuffix);
+  base::DeleteFile(partial_path, false);
+  if (ReflinkFile(path, partial_path)) {
+    LOG(INFO) << "Reflinked the local payload " << path.value();
+  } else if (link(path.value().c_str(), partial_path.value().c_str()) == 0) {
+    LOG(INFO) << "Hard linked the local payload " << path.value();
+  } else {
+    PLOG(WARNING) << "Unable to link the local payload " << path.value();
+    return false;
+  }
+  if (!base::Move(partial_path, cache_path)) {
+    PLOG(ERROR) << "Unable to move the linked payload to "
+                << cache_path.value();
+    base::DeleteFile(partial_path, false);
+    return false;
+  }
+  return true;
+}
+
+bool PayloadCacheWriter::Open() {
+  TEST_AND_RETURN_FALSE(fd_ == -1);
+  if (!base::CreateDirectory(cache_path_.DirName())) {
+    PLOG(ERROR) << "Unable to create " << cache_path_.DirName().value();
+    return false;
+  }
+  fd_ = HANDLE_EINTR(open(partial_path_.value().c_str(),
+                          O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                          0600));
+  if (fd_ < 0) {
+    PLOG(ERROR) << "Unable to open " << partial_path_.value();
+    return false;
+  }
+  LOG(INFO) << "Caching the payload to " << partial_path_.value();
+  return true;
+}
+
+bool PayloadCacheWriter::Write(const void* bytes, size_t count) {
+  ErrorCode error;
+  return Write(bytes, count, &error);
+}
+
+bool PayloadCacheWriter::Write(const void* bytes,
+                               size_t count,
+                               ErrorCode* error) {
+  *error = ErrorCode::kDownloadWriteError;
+  TEST_AND_RETURN_FALSE(fd_ >= 0);
+  // Fail as soon as the server sends more than the payload, instead of
+  // filling the stateful partition.
+  if (payload_.size && size_ + count > payload_.size) {
+    LOG(ERROR) << "Received " << size_ + count << " bytes for a payload of "
+               << payload_.size << " bytes.";
+    *error = ErrorCode::kPayloadSizeMismatchError;
+    return false;
+  }
+  TEST_AND_RETURN_FALSE(hash_calculator_.Update(bytes, count));
+  if (!utils::WriteAll(fd_, bytes, count)) {
+    PLOG(ERROR) << "Unable to write to " << partial_path_.value();
+    return false;
+  }
+  size_ += count;
+  return true;
+}
+
+int PayloadCacheWriter::Close() {
+  if (fd_ < 0)
+    return 0;
+  int result = 0;
+  if (IGNORE_EINTR(close(fd_)) != 0)
+    result = -errno;
+  fd_ = -1;
+  return result;
+}
+
+ErrorCode PayloadCacheWriter::Commit() {
+  ErrorCode code = ErrorCode::kSuccess;
+  if (fd_ < 0 || fdatasync(fd_) != 0 || Close() != 0) {
+    PLOG(ERROR) << "Unable to sync " << partial_path_.value();
+    code = ErrorCode::kDownloadWriteError;
+  } else if (payload_.size && size_ != payload_.size) {
+    LOG(ERROR) << "Cached " << size_ << " bytes of a payload of "
+               << payload_.size << " bytes.";
+    code = ErrorCode::kPayloadSizeMismatchError;
+  } else if (!hash_calculator_.Finalize()) {
+    code = ErrorCode::kDownloadWriteError;
+  } else if (!payload_.hash.empty() &&
+             hash_calculator_.raw_hash() != payload_.hash) {
+    LOG(ERROR) << "The hash of the cached payload doesn't match.";
+    code = ErrorCode::kPayloadHashMismatchError;
+  } else if (!base::Move(partial_path_, cache_path_)) {
+    PLOG(ERROR) << "Unable to move the cached payload to "
+                << cache_path_.value();
+    code = ErrorCode::kDownloadWriteError;
+  }
+  if (code != ErrorCode::kSuccess) {
+    Close();
+    base::DeleteFile(partial_path_, false);
+    return code;
+  }
+  LOG(INFO) << "Cached the payload as " << cache_path_.value();
+  return code;
+}
+
+}  // namespace chromeos_update_engine
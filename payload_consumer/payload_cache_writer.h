@@ -0,0 +1,87 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_PAYLOAD_CACHE_WRITER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_PAYLOAD_CACHE_WRITER_H_
+
+#include <base/files/file_path.h>
+#include <base/macros.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/payload_consumer/file_writer.h"
+#include "update_engine/payload_consumer/install_plan.h"
+
+namespace chromeos_update_engine {
+
+// PayloadCacheWriter downloads a payload to a cache directory, so it can be
+// applied later without downloading it again. The payload is written to a
+// partial file and hashed as it is received, and it only gets its final name
+// in the cache once its size and hash were verified by Commit(). A partial
+// file left by an interrupted download is discarded.
+class PayloadCacheWriter : public FileWriter {
+ public:
+  PayloadCacheWriter(const base::FilePath& cache_dir,
+                     const InstallPlan::Payload& payload);
+  ~PayloadCacheWriter() override;
+
+  // Returns the path of |payload| in |cache_dir| once it was committed.
+  static base::FilePath GetCachePath(const base::FilePath& cache_dir,
+                                     const InstallPlan::Payload& payload);
+
+  // Returns whether |payload| was committed to |cache_dir|.
+  static bool IsCached(const base::FilePath& cache_dir,
+                       const InstallPlan::Payload& payload);
+
+  // Adds the local copy of |payload| at |path|, such as a complete p2p file
+  // or a preloaded payload, to |cache_dir| without copying its data: it is
+  // reflinked, or hard linked when the filesystem doesn't support it. The
+  // copy is not hashed, since the payload is verified as it is applied from
+  // the cache. Returns whether |payload| is cached now.
+  static bool LinkLocalCopy(const base::FilePath& cache_dir,
+                            const InstallPlan::Payload& payload,
+                            const base::FilePath& path);
+
+  // Creates the cache directory if needed and the partial file. Returns
+  // whether it succeeded.
+  bool Open();
+
+  // FileWriter overrides. Writing more data than the size of the payload
+  // fails with kPayloadSizeMismatchError.
+  bool Write(const void* bytes, size_t count) override;
+  bool Write(const void* bytes, size_t count, ErrorCode* error) override;
+  int Close() override;
+
+  // Closes the partial file and moves it to the path returned by
+  // GetCachePath() if it holds the whole payload with the expected hash.
+  // Otherwise the partial file is deleted and the error is returned.
+  ErrorCode Commit();
+
+ private:
+  base::FilePath partial_path_;
+  base::FilePath cache_path_;
+  const InstallPlan::Payload payload_;
+
+  int fd_{-1};
+  uint64_t size_{0};
+  HashCalculator hash_calculator_;
+
+  DISALLOW_COPY_AND_ASSIGN(PayloadCacheWriter);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_PAYLOAD_CACHE_WRITER_H_
@@ -0,0 +1,125 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/payload_cache_writer.h"
+
+#include <string>
+
+#include <base/files/file_util.h>
+#include <base/files/scoped_temp_dir.h>
+#include <brillo/secure_blob.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+class PayloadCacheWriterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+    cache_dir_ = temp_dir_.GetPath().Append("payload_cache");
+    data_ = brillo::Blob(1000, 'x');
+    payload_.size = data_.size();
+    ASSERT_TRUE(HashCalculator::RawHashOfData(data_, &payload_.hash));
+  }
+
+  base::ScopedTempDir temp_dir_;
+  base::FilePath cache_dir_;
+  brillo::Blob data_;
+  InstallPlan::Payload payload_;
+};
+
+TEST_F(PayloadCacheWriterTest, CommitsTheVerifiedPayloadTest) {
+  PayloadCacheWriter writer(cache_dir_, payload_);
+  ASSERT_TRUE(writer.Open());
+  EXPECT_TRUE(writer.Write(data_.data(), 600));
+  // Nothing is cached until the payload was verified.
+  EXPECT_FALSE(PayloadCacheWriter::IsCached(cache_dir_, payload_));
+  EXPECT_TRUE(writer.Write(data_.data() + 600, data_.size() - 600));
+  EXPECT_EQ(ErrorCode::kSuccess, writer.Commit());
+
+  EXPECT_TRUE(PayloadCacheWriter::IsCached(cache_dir_, payload_));
+  brillo::Blob cached_data;
+  EXPECT_TRUE(utils::ReadFile(
+      PayloadCacheWriter::GetCachePath(cache_dir_, payload_).value(),
+      &cached_data));
+  EXPECT_EQ(data_, cached_data);
+}
+
+TEST_F(PayloadCacheWriterTest, HashMismatchIsNotCachedTest) {
+  PayloadCacheWriter writer(cache_dir_, payload_);
+  ASSERT_TRUE(writer.Open());
+  data_[10] = 'y';
+  EXPECT_TRUE(writer.Write(data_.data(), data_.size()));
+  EXPECT_EQ(ErrorCode::kPayloadHashMismatchError, writer.Commit());
+  EXPECT_FALSE(PayloadCacheWriter::IsCached(cache_dir_, payload_));
+  EXPECT_TRUE(base::IsDirectoryEmpty(cache_dir_));
+}
+
+TEST_F(PayloadCacheWriterTest, TooMuchDataFailsTheWriteTest) {
+  PayloadCacheWriter writer(cache_dir_, payload_);
+  ASSERT_TRUE(writer.Open());
+  EXPECT_TRUE(writer.Write(data_.data(), data_.size()));
+  ErrorCode error;
+  EXPECT_FALSE(writer.Write(data_.data(), 1, &error));
+  EXPECT_EQ(ErrorCode::kPayloadSizeMismatchError, error);
+}
+
+TEST_F(PayloadCacheWriterTest, InterruptedDownloadIsDiscardedTest) {
+  {
+    PayloadCacheWriter writer(cache_dir_, payload_);
+    ASSERT_TRUE(writer.Open());
+    EXPECT_TRUE(writer.Write(data_.data(), 600));
+    EXPECT_EQ(0, writer.Close());
+  }
+  EXPECT_FALSE(PayloadCacheWriter::IsCached(cache_dir_, payload_));
+  EXPECT_TRUE(base::IsDirectoryEmpty(cache_dir_));
+}
+
+TEST_F(PayloadCacheWriterTest, LinksTheLocalCopyTest) {
+  base::FilePath local_path = temp_dir_.GetPath().Append("local_payload");
+  ASSERT_TRUE(utils::WriteFile(
+      local_path.value().c_str(), data_.data(), data_.size()));
+  EXPECT_TRUE(
+      PayloadCacheWriter::LinkLocalCopy(cache_dir_, payload_, local_path));
+
+  EXPECT_TRUE(PayloadCacheWriter::IsCached(cache_dir_, payload_));
+  brillo::Blob cached_data;
+  EXPECT_TRUE(utils::ReadFile(
+      PayloadCacheWriter::GetCachePath(cache_dir_, payload_).value(),
+      &cached_data));
+  EXPECT_EQ(data_, cached_data);
+  // Deleting the cached payload once applied keeps the local copy.
+  EXPECT_TRUE(base::DeleteFile(
+      PayloadCacheWriter::GetCachePath(cache_dir_, payload_), false));
+  EXPECT_TRUE(base::PathExists(local_path));
+}
+
+TEST_F(PayloadCacheWriterTest, LocalCopyOfAnotherSizeIsNotLinkedTest) {
+  base::FilePath local_path = temp_dir_.GetPath().Append("local_payload");
+  ASSERT_TRUE(
+      utils::WriteFile(local_path.value().c_str(), data_.data(), 600));
+  EXPECT_FALSE(
+      PayloadCacheWriter::LinkLocalCopy(cache_dir_, payload_, local_path));
+  EXPECT_FALSE(PayloadCacheWriter::IsCached(cache_dir_, payload_));
+}
+
+}  // namespace chromeos_update_engine
@@ -22,7 +22,7 @@ const uint64_t kChromeOSMajorPayloadVersion = 1;
 const uint64_t kBrilloMajorPayloadVersion = 2;
 
 const uint32_t kMinSupportedMinorPayloadVersion = 1;
-const uint32_t kMaxSupportedMinorPayloadVersion = 6;
+const uint32_t kMaxSupportedMinorPayloadVersion = 10;
 
 const uint32_t kFullPayloadMinorVersion = 0;
 const uint32_t kInPlaceMinorPayloadVersion = 1;
@@ -31,6 +31,10 @@ const uint32_t kOpSrcHashMinorPayloadVersion = 3;
 const uint32_t kBrotliBsdiffMinorPayloadVersion = 4;
 const uint32_t kPuffdiffMinorPayloadVersion = 5;
 const uint32_t kVerityMinorPayloadVersion = 6;
+const uint32_t kZstdMinorPayloadVersion = 7;
+const uint32_t kLz4MinorPayloadVersion = 8;
+const uint32_t kZstdBsdiffMinorPayloadVersion = 9;
+const uint32_t kPackedExtentsMinorPayloadVersion = 10;
 
 const uint64_t kMinSupportedMajorPayloadVersion = 1;
 const uint64_t kMaxSupportedMajorPayloadVersion = 2;
@@ -66,6 +70,12 @@ const char* InstallOperationTypeName(InstallOperation::Type op_type) {
       return "PUFFDIFF";
     case InstallOperation::BROTLI_BSDIFF:
       return "BROTLI_BSDIFF";
+    case InstallOperation::REPLACE_ZSTD:
+      return "REPLACE_ZSTD";
+    case InstallOperation::REPLACE_LZ4:
+      return "REPLACE_LZ4";
+    case InstallOperation::ZSTD_BSDIFF:
+      return "ZSTD_BSDIFF";
   }
   return "<unknown_op>";
 }
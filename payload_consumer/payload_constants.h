@@ -56,6 +56,18 @@ extern const uint32_t kPuffdiffMinorPayloadVersion;
 // The minor version that allows Verity hash tree and FEC generation.
 extern const uint32_t kVerityMinorPayloadVersion;
 
+// The minor version that allows REPLACE_ZSTD operation.
+extern const uint32_t kZstdMinorPayloadVersion;
+
+// The minor version that allows REPLACE_LZ4 operation.
+extern const uint32_t kLz4MinorPayloadVersion;
+
+// The minor version that allows ZSTD_BSDIFF operation.
+extern const uint32_t kZstdBsdiffMinorPayloadVersion;
+
+// The minor version that allows packed operation extents.
+extern const uint32_t kPackedExtentsMinorPayloadVersion;
+
 // The minimum and maximum supported minor version.
 extern const uint32_t kMinSupportedMinorPayloadVersion;
 extern const uint32_t kMaxSupportedMinorPayloadVersion;
@@ -0,0 +1,508 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Benchmarks of the payload application: the ExtentWriters used by the
+// REPLACE operations and the DeltaPerformer applying SOURCE_COPY,
+// SOURCE_BSDIFF and PUFFDIFF payloads. The images are generated on startup and
+// their size is set with --image_size_mib.
+
+#include <fcntl.h>
+#include <string.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <base/logging.h>
+#include <benchmark/benchmark.h>
+#include <brillo/flag_helper.h>
+#include <brillo/secure_blob.h>
+#include <bsdiff/bsdiff.h>
+#include <bsdiff/patch_writer_factory.h>
+#include <puffin/puffdiff.h>
+#include <xz.h>
+
+#include "update_engine/common/constants.h"
+#include "update_engine/common/fake_boot_control.h"
+#include "update_engine/common/fake_hardware.h"
+#include "update_engine/common/fake_prefs.h"
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/bzip_extent_writer.h"
+#include "update_engine/payload_consumer/delta_performer.h"
+#include "update_engine/payload_consumer/extent_writer.h"
+#include "update_engine/payload_consumer/file_descriptor.h"
+#include "update_engine/payload_consumer/install_plan.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_consumer/xz_extent_writer.h"
+#include "update_engine/payload_generator/annotated_operation.h"
+#include "update_engine/payload_generator/bzip.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/payload_file.h"
+#include "update_engine/payload_generator/payload_generation_config.h"
+#include "update_engine/payload_generator/xz.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+const uint32_t kBlockSize = 4096;
+
+// The size of the data written by each operation, like the chunks the payload
+// generator splits the files in.
+const size_t kOperationSize = 1024 * 1024;  // 1 MiB
+const size_t kOperationBlocks = kOperationSize / kBlockSize;
+
+// The size of the uncompressed data of each deflate stream of the PUFFDIFF
+// images.
+const size_t kDeflateChunkSize = 64 * 1024;  // 64 KiB
+
+const char kPartitionName[] = "system";
+
+// The size of the generated images, a multiple of |kOperationSize|. Set from
+// the command line before running the benchmarks.
+size_t image_size = 0;
+
+// Generates |size| bytes of data that compress about as well as a filesystem
+// image: half of the blocks are random and the other half repeat a short
+// text.
+brillo::Blob GenerateImage(size_t size, uint32_t seed) {
+  std::mt19937 rng(seed);
+  brillo::Blob image(size);
+  for (size_t offset = 0; offset < size; offset += kBlockSize) {
+    const size_t block_end = std::min(size, offset + kBlockSize);
+    if (rng() % 2) {
+      for (size_t i = offset; i < block_end; i++)
+        image[i] = static_cast<uint8_t>(rng());
+    } else {
+      const string text = "block " + std::to_string(offset / kBlockSize) +
+                          " of the generated image\n";
+      for (size_t i = offset; i < block_end; i++)
+        image[i] = text[(i - offset) % text.size()];
+    }
+  }
+  return image;
+}
+
+// Returns a copy of |image| where a few bytes of one out of eight blocks were
+// changed, like an image built from slightly different sources.
+brillo::Blob MutateImage(const brillo::Blob& image, uint32_t seed) {
+  std::mt19937 rng(seed);
+  brillo::Blob mutated = image;
+  for (size_t offset = 0; offset + kBlockSize <= mutated.size();
+       offset += kBlockSize) {
+    if (rng() % 8)
+      continue;
+    const size_t start = offset + rng() % (kBlockSize - 16);
+    for (size_t i = start; i < start + 16; i++)
+      mutated[i] = static_cast<uint8_t>(rng());
+  }
+  return mutated;
+}
+
+// Compresses |size| bytes at |data| into a raw deflate stream in |out|.
+bool Deflate(const uint8_t* data, size_t size, brillo::Blob* out) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  TEST_AND_RETURN_FALSE(deflateInit2(&stream,
+                                     Z_DEFAULT_COMPRESSION,
+                                     Z_DEFLATED,
+                                     -15,  // Raw deflate, 32 KiB window.
+                                     8,
+                                     Z_DEFAULT_STRATEGY) == Z_OK);
+  out->resize(deflateBound(&stream, size));
+  stream.next_in = const_cast<uint8_t*>(data);
+  stream.avail_in = size;
+  stream.next_out = out->data();
+  stream.avail_out = out->size();
+  int ret = deflate(&stream, Z_FINISH);
+  out->resize(stream.total_out);
+  deflateEnd(&stream);
+  TEST_AND_RETURN_FALSE(ret == Z_STREAM_END);
+  return true;
+}
+
+// Generates an image of |image_size| bytes made of raw deflate streams of
+// consecutive chunks of |raw|, like the compressed files of a filesystem.
+// The streams never cross the boundary of an operation, and the location of
+// the ones within each operation are stored in |deflates|.
+bool GenerateDeflateImage(const brillo::Blob& raw,
+                          brillo::Blob* image,
+                          vector<vector<puffin::BitExtent>>* deflates) {
+  image->clear();
+  deflates->clear();
+  size_t raw_offset = 0;
+  brillo::Blob stream;
+  while (image->size() < image_size) {
+    const size_t operation_start = image->size();
+    deflates->emplace_back();
+    TEST_AND_RETURN_FALSE(raw_offset + kDeflateChunkSize <= raw.size());
+    TEST_AND_RETURN_FALSE(
+        Deflate(raw.data() + raw_offset, kDeflateChunkSize, &stream));
+    while (image->size() + stream.size() <= operation_start + kOperationSize) {
+      deflates->back().emplace_back((image->size() - operation_start) * 8,
+                                    stream.size() * 8);
+      image->insert(image->end(), stream.begin(), stream.end());
+      raw_offset += kDeflateChunkSize;
+      TEST_AND_RETURN_FALSE(raw_offset + kDeflateChunkSize <= raw.size());
+      TEST_AND_RETURN_FALSE(
+          Deflate(raw.data() + raw_offset, kDeflateChunkSize, &stream));
+    }
+    image->resize(operation_start + kOperationSize);
+  }
+  return true;
+}
+
+// Creates a temporary file with the |data| and returns its path. The file is
+// removed when the benchmark exits.
+string CreateTempFile(const brillo::Blob& data) {
+  static vector<std::unique_ptr<ScopedPathUnlinker>> unlinkers;
+  string path;
+  CHECK(utils::MakeTempFile("Benchmark-XXXXXX", &path, nullptr));
+  unlinkers.push_back(std::make_unique<ScopedPathUnlinker>(path));
+  CHECK(utils::WriteFile(path.c_str(), data.data(), data.size()));
+  return path;
+}
+
+// The compressed chunks of an image, each written to its own operation.
+struct CompressedImage {
+  vector<brillo::Blob> chunks;
+  string target_path;
+};
+
+std::unique_ptr<CompressedImage> CreateCompressedImage(
+    const std::function<bool(const brillo::Blob&, brillo::Blob*)>& compress) {
+  auto image = std::make_unique<CompressedImage>();
+  const brillo::Blob data = GenerateImage(image_size, 1);
+  for (size_t offset = 0; offset < data.size(); offset += kOperationSize) {
+    brillo::Blob chunk(data.begin() + offset,
+                       data.begin() + offset + kOperationSize);
+    image->chunks.emplace_back();
+    if (compress) {
+      CHECK(compress(chunk, &image->chunks.back()));
+    } else {
+      image->chunks.back() = std::move(chunk);
+    }
+  }
+  image->target_path = CreateTempFile(brillo::Blob(image_size));
+  return image;
+}
+
+// Writes all the |image| chunks to their target blocks using the ExtentWriter
+// returned by |create_writer|, as many times as needed by |state|.
+void RunExtentWriterBenchmark(
+    benchmark::State& state,
+    const CompressedImage& image,
+    const std::function<std::unique_ptr<ExtentWriter>()>& create_writer) {
+  FileDescriptorPtr fd(new EintrSafeFileDescriptor());
+  CHECK(fd->Open(image.target_path.c_str(), O_RDWR));
+  while (state.KeepRunning()) {
+    for (size_t i = 0; i < image.chunks.size(); i++) {
+      google::protobuf::RepeatedPtrField<Extent> extents;
+      *extents.Add() = ExtentForRange(i * kOperationBlocks, kOperationBlocks);
+      std::unique_ptr<ExtentWriter> writer = create_writer();
+      CHECK(writer->Init(fd, extents, kBlockSize));
+      CHECK(writer->Write(image.chunks[i].data(), image.chunks[i].size()));
+    }
+    CHECK(fd->Flush());
+  }
+  CHECK(fd->Close());
+  state.SetBytesProcessed(state.iterations() * image_size);
+}
+
+void BM_DirectExtentWriter(benchmark::State& state) {
+  static const CompressedImage* image =
+      CreateCompressedImage(nullptr).release();
+  RunExtentWriterBenchmark(state, *image, [] {
+    return std::make_unique<DirectExtentWriter>();
+  });
+}
+BENCHMARK(BM_DirectExtentWriter)->Unit(benchmark::kMillisecond);
+
+void BM_XzExtentWriter(benchmark::State& state) {
+  static const CompressedImage* image =
+      CreateCompressedImage(XzCompress).release();
+  RunExtentWriterBenchmark(state, *image, [] {
+    return std::make_unique<XzExtentWriter>(
+        std::make_unique<DirectExtentWriter>());
+  });
+}
+BENCHMARK(BM_XzExtentWriter)->Unit(benchmark::kMillisecond);
+
+// The XzExtentWriter used by the REPLACE_XZ operations, which calls its
+// DirectExtentWriter without virtual calls.
+void BM_XzDirectExtentWriter(benchmark::State& state) {
+  static const CompressedImage* image =
+      CreateCompressedImage(XzCompress).release();
+  RunExtentWriterBenchmark(state, *image, [] {
+    return std::make_unique<BasicXzExtentWriter<DirectExtentWriter>>(
+        std::make_unique<DirectExtentWriter>());
+  });
+}
+BENCHMARK(BM_XzDirectExtentWriter)->Unit(benchmark::kMillisecond);
+
+void BM_BzipExtentWriter(benchmark::State& state) {
+  static const CompressedImage* image =
+      CreateCompressedImage(BzipCompress).release();
+  RunExtentWriterBenchmark(state, *image, [] {
+    return std::make_unique<BzipExtentWriter>(
+        std::make_unique<DirectExtentWriter>());
+  });
+}
+BENCHMARK(BM_BzipExtentWriter)->Unit(benchmark::kMillisecond);
+
+// A delta payload updating the |source_path| image into the target one.
+struct DeltaPayload {
+  brillo::Blob data;
+  uint64_t metadata_size{0};
+  string source_path;
+  string target_path;
+};
+
+// Creates a delta payload with one operation per |kOperationSize| bytes of
+// the images. |create_operation| returns the operation updating the
+// |source_data| chunk into the |target_data| one and its blob.
+std::unique_ptr<DeltaPayload> CreateDeltaPayload(
+    const brillo::Blob& source,
+    const brillo::Blob& target,
+    const std::function<bool(size_t index,
+                             const brillo::Blob& source_data,
+                             const brillo::Blob& target_data,
+                             InstallOperation* operation,
+                             brillo::Blob* blob)>& create_operation) {
+  auto payload = std::make_unique<DeltaPayload>();
+  payload->source_path = CreateTempFile(source);
+  const string new_image_path = CreateTempFile(target);
+  payload->target_path = CreateTempFile(brillo::Blob(image_size));
+
+  vector<AnnotatedOperation> aops;
+  brillo::Blob blobs;
+  for (size_t i = 0; i < image_size / kOperationSize; i++) {
+    const size_t offset = i * kOperationSize;
+    AnnotatedOperation aop;
+    aop.name = "chunk " + std::to_string(i);
+    brillo::Blob blob;
+    CHECK(create_operation(
+        i,
+        brillo::Blob(source.begin() + offset,
+                     source.begin() + offset + kOperationSize),
+        brillo::Blob(target.begin() + offset,
+                     target.begin() + offset + kOperationSize),
+        &aop.op,
+        &blob));
+    *aop.op.add_src_extents() =
+        ExtentForRange(i * kOperationBlocks, kOperationBlocks);
+    *aop.op.add_dst_extents() =
+        ExtentForRange(i * kOperationBlocks, kOperationBlocks);
+    if (!blob.empty()) {
+      aop.op.set_data_offset(blobs.size());
+      aop.op.set_data_length(blob.size());
+      blobs.insert(blobs.end(), blob.begin(), blob.end());
+    }
+    aops.push_back(aop);
+  }
+
+  PayloadGenerationConfig config;
+  config.version.major = kBrilloMajorPayloadVersion;
+  config.version.minor = kMaxSupportedMinorPayloadVersion;
+  PayloadFile payload_file;
+  CHECK(payload_file.Init(config));
+  PartitionConfig old_part(kPartitionName);
+  old_part.path = payload->source_path;
+  old_part.size = image_size;
+  PartitionConfig new_part(kPartitionName);
+  new_part.path = new_image_path;
+  new_part.size = image_size;
+  CHECK(payload_file.AddPartition(old_part, new_part, aops));
+
+  const string blobs_path = CreateTempFile(blobs);
+  const string payload_path = CreateTempFile(brillo::Blob());
+  CHECK(payload_file.WritePayload(
+      payload_path, blobs_path, "", &payload->metadata_size));
+  CHECK(utils::ReadFile(payload_path, &payload->data));
+  return payload;
+}
+
+// Applies the |payload| with a new DeltaPerformer each time, as many times as
+// needed by |state|.
+void RunDeltaPerformerBenchmark(benchmark::State& state,
+                                const DeltaPayload& payload) {
+  while (state.KeepRunning()) {
+    FakePrefs prefs;
+    FakeBootControl boot_control;
+    FakeHardware hardware;
+    InstallPlan install_plan;
+    install_plan.source_slot = 0;
+    install_plan.target_slot = 1;
+    boot_control.SetPartitionDevice(
+        kPartitionName, install_plan.source_slot, payload.source_path);
+    boot_control.SetPartitionDevice(
+        kPartitionName, install_plan.target_slot, payload.target_path);
+    InstallPlan::Payload install_payload;
+    install_payload.size = payload.data.size();
+    install_payload.metadata_size = payload.metadata_size;
+    install_payload.type = InstallPayloadType::kDelta;
+
+    DeltaPerformer performer(&prefs,
+                             &boot_control,
+                             &hardware,
+                             nullptr,
+                             &install_plan,
+                             &install_payload,
+                             true);  // interactive
+    // The generated payloads aren't signed.
+    performer.set_public_key_path("");
+    CHECK(performer.Write(payload.data.data(), payload.data.size()));
+    CHECK_EQ(0, performer.Close());
+  }
+  state.SetBytesProcessed(state.iterations() * image_size);
+}
+
+// Sets the hash of the |source_data| in the |operation|.
+bool SetSourceHash(const brillo::Blob& source_data,
+                   InstallOperation* operation) {
+  brillo::Blob hash;
+  TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfData(source_data, &hash));
+  operation->set_src_sha256_hash(hash.data(), hash.size());
+  return true;
+}
+
+void BM_SourceCopy(benchmark::State& state) {
+  static const DeltaPayload* payload = [] {
+    const brillo::Blob image = GenerateImage(image_size, 1);
+    return CreateDeltaPayload(image,
+                              image,
+                              [](size_t index,
+                                 const brillo::Blob& source_data,
+                                 const brillo::Blob& target_data,
+                                 InstallOperation* operation,
+                                 brillo::Blob* blob) {
+                                operation->set_type(
+                                    InstallOperation::SOURCE_COPY);
+                                return SetSourceHash(source_data, operation);
+                              })
+        .release();
+  }();
+  RunDeltaPerformerBenchmark(state, *payload);
+}
+BENCHMARK(BM_SourceCopy)->Unit(benchmark::kMillisecond);
+
+void BM_SourceBsdiff(benchmark::State& state) {
+  static const DeltaPayload* payload = [] {
+    const brillo::Blob source = GenerateImage(image_size, 1);
+    const brillo::Blob target = MutateImage(source, 2);
+    return CreateDeltaPayload(
+               source,
+               target,
+               [](size_t index,
+                  const brillo::Blob& source_data,
+                  const brillo::Blob& target_data,
+                  InstallOperation* operation,
+                  brillo::Blob* blob) {
+                 operation->set_type(InstallOperation::SOURCE_BSDIFF);
+                 string patch_path;
+                 TEST_AND_RETURN_FALSE(utils::MakeTempFile(
+                     "bsdiff-delta.XXXXXX", &patch_path, nullptr));
+                 ScopedPathUnlinker patch_path_unlinker(patch_path);
+                 std::unique_ptr<bsdiff::PatchWriterInterface> patch_writer =
+                     bsdiff::CreateBsdiffPatchWriter(patch_path);
+                 TEST_AND_RETURN_FALSE(0 == bsdiff::bsdiff(source_data.data(),
+                                                           source_data.size(),
+                                                           target_data.data(),
+                                                           target_data.size(),
+                                                           patch_writer.get(),
+                                                           nullptr));
+                 TEST_AND_RETURN_FALSE(utils::ReadFile(patch_path, blob));
+                 return SetSourceHash(source_data, operation);
+               })
+        .release();
+  }();
+  RunDeltaPerformerBenchmark(state, *payload);
+}
+BENCHMARK(BM_SourceBsdiff)->Unit(benchmark::kMillisecond);
+
+void BM_Puffdiff(benchmark::State& state) {
+  static const DeltaPayload* payload = [] {
+    // Enough data for the deflate streams, which are about half the size of
+    // the data.
+    const brillo::Blob source_raw = GenerateImage(image_size * 4, 1);
+    const brillo::Blob target_raw = MutateImage(source_raw, 2);
+    brillo::Blob source, target;
+    vector<vector<puffin::BitExtent>> source_deflates, target_deflates;
+    CHECK(GenerateDeflateImage(source_raw, &source, &source_deflates));
+    CHECK(GenerateDeflateImage(target_raw, &target, &target_deflates));
+    return CreateDeltaPayload(
+               source,
+               target,
+               [&source_deflates, &target_deflates](
+                   size_t index,
+                   const brillo::Blob& source_data,
+                   const brillo::Blob& target_data,
+                   InstallOperation* operation,
+                   brillo::Blob* blob) {
+                 operation->set_type(InstallOperation::PUFFDIFF);
+                 string temp_path;
+                 TEST_AND_RETURN_FALSE(utils::MakeTempFile(
+                     "puffdiff-delta.XXXXXX", &temp_path, nullptr));
+                 ScopedPathUnlinker temp_path_unlinker(temp_path);
+                 TEST_AND_RETURN_FALSE(puffin::PuffDiff(source_data,
+                                                        target_data,
+                                                        source_deflates[index],
+                                                        target_deflates[index],
+                                                        temp_path,
+                                                        blob));
+                 return SetSourceHash(source_data, operation);
+               })
+        .release();
+  }();
+  RunDeltaPerformerBenchmark(state, *payload);
+}
+BENCHMARK(BM_Puffdiff)->Unit(benchmark::kMillisecond);
+
+}  // namespace
+
+}  // namespace chromeos_update_engine
+
+int main(int argc, char** argv) {
+  // Remove the --benchmark_* flags before parsing ours.
+  benchmark::Initialize(&argc, argv);
+  DEFINE_int32(image_size_mib, 16, "The size of the generated images, in MiB.");
+  brillo::FlagHelper::Init(
+      argc,
+      argv,
+      "Benchmarks the application of the payload operations.\n\n"
+      "The --benchmark_* flags of google-benchmark are also supported.");
+  CHECK_GT(FLAGS_image_size_mib, 0);
+  chromeos_update_engine::image_size =
+      static_cast<size_t>(FLAGS_image_size_mib) *
+      chromeos_update_engine::kNumBytesInOneMiB;
+
+  // The DeltaPerformer logs every partition and operation it applies.
+  logging::SetMinLogLevel(logging::LOG_WARNING);
+  // xz-embedded requires to initialize its CRC-32 table once on startup.
+  xz_crc32_init();
+  chromeos_update_engine::XzCompressInit();
+
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
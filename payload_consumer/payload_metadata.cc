@@ -18,7 +18,12 @@
 
 #include <endian.h>
 
+#include <utility>
+
 #include <brillo/data_encoding.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <google/protobuf/wire_format_lite.h>
 
 #include "update_engine/common/constants.h"
 #include "update_engine/common/hash_calculator.h"
@@ -26,6 +31,7 @@
 #include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_consumer/payload_verifier.h"
 
+using google::protobuf::internal::WireFormatLite;
 using std::string;
 
 namespace chromeos_update_engine {
@@ -156,6 +162,60 @@ bool PayloadMetadata::GetManifest(const brillo::Blob& payload,
                                       manifest_size_);
 }
 
+bool PayloadMetadata::GetManifestWithoutOperations(
+    const brillo::Blob& payload,
+    DeltaArchiveManifest* out_manifest,
+    std::vector<SerializedPartitionUpdate>* out_partitions) const {
+  uint64_t manifest_offset;
+  if (!GetManifestOffset(&manifest_offset))
+    return false;
+  CHECK_GE(payload.size(), manifest_offset + manifest_size_);
+  out_partitions->clear();
+
+  // Copy the serialized partitions aside and parse the other fields as usual.
+  google::protobuf::io::CodedInputStream input(&payload[manifest_offset],
+                                              manifest_size_);
+  string other_fields;
+  {
+    google::protobuf::io::StringOutputStream output_stream(&other_fields);
+    google::protobuf::io::CodedOutputStream output(&output_stream);
+    uint32_t tag;
+    while ((tag = input.ReadTag()) != 0) {
+      if (WireFormatLite::GetTagFieldNumber(tag) !=
+              DeltaArchiveManifest::kPartitionsFieldNumber ||
+          WireFormatLite::GetTagWireType(tag) !=
+              WireFormatLite::WIRETYPE_LENGTH_DELIMITED) {
+        if (!WireFormatLite::SkipField(&input, tag, &output))
+          return false;
+        continue;
+      }
+      uint32_t size;
+      SerializedPartitionUpdate partition;
+      if (!input.ReadVarint32(&size))
+        return false;
+      partition.data.resize(size);
+      if (!input.ReadRaw(partition.data.data(), size))
+        return false;
+      out_partitions->push_back(std::move(partition));
+    }
+    if (!input.ConsumedEntireMessage())
+      return false;
+  }
+  if (!out_manifest->ParseFromString(other_fields))
+    return false;
+
+  for (SerializedPartitionUpdate& partition : *out_partitions) {
+    PartitionUpdate* update = out_manifest->add_partitions();
+    if (!update->ParseFromArray(partition.data.data(), partition.data.size()))
+      return false;
+    partition.num_operations = update->operations_size();
+    // Clear() would keep the parsed operations allocated.
+    google::protobuf::RepeatedPtrField<InstallOperation>().Swap(
+        update->mutable_operations());
+  }
+  return true;
+}
+
 ErrorCode PayloadMetadata::ValidateMetadataSignature(
     const brillo::Blob& payload,
     const string& metadata_signature,
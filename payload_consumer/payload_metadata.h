@@ -37,6 +37,13 @@ enum class MetadataParseResult {
   kInsufficientData,
 };
 
+// A PartitionUpdate of the manifest kept serialized, so its operations are
+// only parsed when they are needed.
+struct SerializedPartitionUpdate {
+  brillo::Blob data;
+  size_t num_operations{0};
+};
+
 // This class parses payload metadata and validate its signature.
 class PayloadMetadata {
  public:
@@ -86,6 +93,15 @@ class PayloadMetadata {
   bool GetManifest(const brillo::Blob& payload,
                    DeltaArchiveManifest* out_manifest) const;
 
+  // Like GetManifest(), but the partitions in |*out_manifest| have no
+  // operations. |out_partitions| is set to the serialized partitions, with
+  // their number of operations. Only one partition is parsed at a time, so
+  // the memory this takes doesn't grow with the number of partitions.
+  bool GetManifestWithoutOperations(
+      const brillo::Blob& payload,
+      DeltaArchiveManifest* out_manifest,
+      std::vector<SerializedPartitionUpdate>* out_partitions) const;
+
  private:
   // Set |*out_offset| to the byte offset at which the manifest protobuf begins
   // in a payload. Return true on success, false if the offset is unknown.
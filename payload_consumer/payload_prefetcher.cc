@@ -0,0 +1,113 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/payload_prefetcher.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <base/logging.h>
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+PayloadPrefetcher::PayloadPrefetcher(HttpFetcher* http_fetcher)
+    : http_fetcher_(http_fetcher) {
+  http_fetcher_->set_delegate(this);
+}
+
+PayloadPrefetcher::~PayloadPrefetcher() {
+  StopTransfer();
+}
+
+void PayloadPrefetcher::Start(size_t payload_index,
+                              const string& url,
+                              off_t offset,
+                              size_t length) {
+  CHECK(!started_) << "Start() called while prefetching.";
+  CHECK_GT(length, 0U);
+  started_ = true;
+  payload_index_ = payload_index;
+  url_ = url;
+  length_ = length;
+  data_.clear();
+  data_.reserve(length);
+
+  LOG(INFO) << "Prefetching " << length << " bytes of payload "
+            << payload_index << " from " << url;
+  transfer_active_ = true;
+  http_fetcher_->SetOffset(offset);
+  http_fetcher_->SetLength(length);
+  http_fetcher_->BeginTransfer(url);
+}
+
+brillo::Blob PayloadPrefetcher::Take() {
+  StopTransfer();
+  started_ = false;
+  return std::move(data_);
+}
+
+void PayloadPrefetcher::Cancel() {
+  StopTransfer();
+  started_ = false;
+  data_.clear();
+}
+
+void PayloadPrefetcher::Pause() {
+  if (transfer_active_)
+    http_fetcher_->Pause();
+}
+
+void PayloadPrefetcher::Unpause() {
+  if (transfer_active_)
+    http_fetcher_->Unpause();
+}
+
+void PayloadPrefetcher::StopTransfer() {
+  if (transfer_active_)
+    http_fetcher_->TerminateTransfer();
+  // The fetcher may not report the termination synchronously.
+  transfer_active_ = false;
+}
+
+bool PayloadPrefetcher::ReceivedBytes(HttpFetcher* fetcher,
+                                      const void* bytes,
+                                      size_t length) {
+  if (!transfer_active_)
+    return false;
+  // Ignore anything past the requested range.
+  length = std::min(length, length_ - data_.size());
+  const uint8_t* byte_ptr = static_cast<const uint8_t*>(bytes);
+  data_.insert(data_.end(), byte_ptr, byte_ptr + length);
+  return true;
+}
+
+void PayloadPrefetcher::TransferComplete(HttpFetcher* fetcher,
+                                         bool successful) {
+  transfer_active_ = false;
+  // The data received before a failure is still the beginning of the payload,
+  // the DownloadAction downloads the rest.
+  LOG(INFO) << "Prefetched " << data_.size() << " bytes of payload "
+            << payload_index_
+            << (successful ? "." : ", then the transfer failed.");
+}
+
+void PayloadPrefetcher::TransferTerminated(HttpFetcher* fetcher) {
+  transfer_active_ = false;
+}
+
+}  // namespace chromeos_update_engine
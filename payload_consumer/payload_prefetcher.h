@@ -0,0 +1,97 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_PAYLOAD_PREFETCHER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_PAYLOAD_PREFETCHER_H_
+
+#include <memory>
+#include <string>
+
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/http_fetcher.h"
+
+namespace chromeos_update_engine {
+
+// PayloadPrefetcher downloads the beginning of a payload into memory, so the
+// DownloadAction can fetch a payload while it is still applying the previous
+// one and then apply it without waiting for the network.
+class PayloadPrefetcher : public HttpFetcherDelegate {
+ public:
+  // Takes ownership of the passed in HttpFetcher.
+  explicit PayloadPrefetcher(HttpFetcher* http_fetcher);
+  ~PayloadPrefetcher() override;
+
+  // Starts downloading |length| bytes of |url| from |offset| for the payload
+  // at |payload_index| in the install plan. The prefetcher must be idle.
+  void Start(size_t payload_index,
+             const std::string& url,
+             off_t offset,
+             size_t length);
+
+  // Stops the transfer, if any, and returns the data received so far, which
+  // is the beginning of the requested range. The prefetcher is idle again.
+  brillo::Blob Take();
+
+  // Stops the transfer, if any, and drops the data received so far.
+  void Cancel();
+
+  // Pauses and resumes the transfer, if any.
+  void Pause();
+  void Unpause();
+
+  // Whether no prefetch was started since the last Take() or Cancel().
+  bool idle() const { return !started_; }
+
+  // The payload being prefetched and the URL it is downloaded from.
+  size_t payload_index() const { return payload_index_; }
+  const std::string& url() const { return url_; }
+
+  // The number of bytes requested by Start().
+  size_t length() const { return length_; }
+
+  // HttpFetcherDelegate overrides.
+  bool ReceivedBytes(HttpFetcher* fetcher,
+                     const void* bytes,
+                     size_t length) override;
+  void TransferComplete(HttpFetcher* fetcher, bool successful) override;
+  void TransferTerminated(HttpFetcher* fetcher) override;
+
+ private:
+  // Terminates the transfer if it is still in progress.
+  void StopTransfer();
+
+  std::unique_ptr<HttpFetcher> http_fetcher_;
+
+  // Whether Start() was called since the last Take() or Cancel().
+  bool started_{false};
+
+  // Whether |http_fetcher_| is transferring data.
+  bool transfer_active_{false};
+
+  size_t payload_index_{0};
+  std::string url_;
+
+  // The number of bytes requested and the ones received so far.
+  size_t length_{0};
+  brillo::Blob data_;
+
+  DISALLOW_COPY_AND_ASSIGN(PayloadPrefetcher);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_PAYLOAD_PREFETCHER_H_
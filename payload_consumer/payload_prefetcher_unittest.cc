@@ -0,0 +1,86 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/payload_prefetcher.h"
+
+#include <brillo/message_loops/fake_message_loop.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/mock_http_fetcher.h"
+
+namespace chromeos_update_engine {
+
+class PayloadPrefetcherTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    loop_.SetAsCurrent();
+    data_.resize(3 * kMockHttpFetcherChunkSize);
+    for (size_t i = 0; i < data_.size(); i++)
+      data_[i] = static_cast<uint8_t>(i * 7);
+  }
+
+  void TearDown() override { EXPECT_FALSE(loop_.PendingTasks()); }
+
+  void RunLoop() {
+    while (loop_.RunOnce(false)) {
+    }
+  }
+
+  brillo::FakeMessageLoop loop_{nullptr};
+  brillo::Blob data_;
+};
+
+TEST_F(PayloadPrefetcherTest, PrefetchesTheRequestedRangeTest) {
+  PayloadPrefetcher prefetcher(
+      new MockHttpFetcher(data_.data(), data_.size(), nullptr));
+  EXPECT_TRUE(prefetcher.idle());
+
+  const size_t length = kMockHttpFetcherChunkSize + 10;
+  prefetcher.Start(2, "http://fake/payload", 5, length);
+  EXPECT_FALSE(prefetcher.idle());
+  EXPECT_EQ(2U, prefetcher.payload_index());
+  EXPECT_EQ("http://fake/payload", prefetcher.url());
+  RunLoop();
+
+  brillo::Blob expected(data_.begin() + 5, data_.begin() + 5 + length);
+  EXPECT_EQ(expected, prefetcher.Take());
+  EXPECT_TRUE(prefetcher.idle());
+}
+
+TEST_F(PayloadPrefetcherTest, TakeStopsTheTransferTest) {
+  PayloadPrefetcher prefetcher(
+      new MockHttpFetcher(data_.data(), data_.size(), nullptr));
+  prefetcher.Start(0, "http://fake/payload", 0, data_.size());
+  // Deliver a single chunk before taking the data.
+  loop_.RunOnce(false);
+
+  brillo::Blob expected(data_.begin(),
+                        data_.begin() + kMockHttpFetcherChunkSize);
+  EXPECT_EQ(expected, prefetcher.Take());
+  EXPECT_TRUE(prefetcher.idle());
+}
+
+TEST_F(PayloadPrefetcherTest, CancelDropsTheDataTest) {
+  PayloadPrefetcher prefetcher(
+      new MockHttpFetcher(data_.data(), data_.size(), nullptr));
+  prefetcher.Start(1, "http://fake/payload", 0, data_.size());
+  RunLoop();
+  prefetcher.Cancel();
+  EXPECT_TRUE(prefetcher.idle());
+  EXPECT_TRUE(prefetcher.Take().empty());
+}
+
+}  // namespace chromeos_update_engine
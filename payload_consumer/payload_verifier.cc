@@ -16,10 +16,12 @@
 
 #include "update_engine/payload_consumer/payload_verifier.h"
 
+#include <map>
 #include <utility>
 #include <vector>
 
 #include <base/logging.h>
+#include <base/synchronization/lock.h>
 #include <openssl/pem.h>
 
 #include "update_engine/common/constants.h"
@@ -49,6 +51,36 @@ const uint8_t kSHA256DigestInfoPrefix[] = {
     0x65, 0x03, 0x04, 0x02, 0x01, 0x05, 0x00, 0x04, 0x20,
 };
 
+// The most public keys kept parsed. They are the built-in key of the daemon
+// or the one of the Omaha response, so there are few of them.
+const size_t kMaxCachedPublicKeys = 4;
+
+// Returns a reference to the RSA key of the PEM |pem_public_key|, which the
+// caller releases with RSA_free(), or nullptr if it isn't valid. The parsed
+// keys are kept, and OpenSSL caches the Montgomery context of their modulus
+// in them, so each key is only parsed and prepared once per process instead
+// of for each signature.
+RSA* GetPublicKey(const string& pem_public_key) {
+  static base::Lock* lock = new base::Lock();
+  static std::map<string, RSA*>* keys = new std::map<string, RSA*>();
+  base::AutoLock auto_lock(*lock);
+  auto it = keys->find(pem_public_key);
+  if (it != keys->end()) {
+    RSA_up_ref(it->second);
+    return it->second;
+  }
+
+  BIO* bp = BIO_new_mem_buf(pem_public_key.data(), pem_public_key.size());
+  char dummy_password[] = {' ', 0};  // Ensure no password is read from stdin.
+  RSA* rsa = PEM_read_bio_RSA_PUBKEY(bp, nullptr, nullptr, dummy_password);
+  BIO_free(bp);
+  if (rsa && keys->size() < kMaxCachedPublicKeys) {
+    RSA_up_ref(rsa);
+    (*keys)[pem_public_key] = rsa;
+  }
+  return rsa;
+}
+
 }  // namespace
 
 bool PayloadVerifier::VerifySignature(const string& signature_proto,
@@ -99,11 +131,7 @@ bool PayloadVerifier::GetRawHashFromSignature(const brillo::Blob& sig_data,
   // openssl rsautl -verify -pubin -inkey <(echo |pem_public_key|)
   //   -in |sig_data| -out |out_hash_data|
 
-  BIO* bp = BIO_new_mem_buf(pem_public_key.data(), pem_public_key.size());
-  char dummy_password[] = {' ', 0};  // Ensure no password is read from stdin.
-  RSA* rsa = PEM_read_bio_RSA_PUBKEY(bp, nullptr, nullptr, dummy_password);
-  BIO_free(bp);
-
+  RSA* rsa = GetPublicKey(pem_public_key);
   TEST_AND_RETURN_FALSE(rsa != nullptr);
   unsigned int keysize = RSA_size(rsa);
   if (sig_data.size() > 2 * keysize) {
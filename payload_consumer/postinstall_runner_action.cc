@@ -25,6 +25,7 @@
 #include <unistd.h>
 
 #include <cmath>
+#include <utility>
 
 #include <base/files/file_path.h>
 #include <base/files/file_util.h>
@@ -46,6 +47,13 @@ namespace {
 // sample_images.sh file.
 const int kPostinstallStatusFd = 3;
 
+#ifdef __ANDROID__
+// The path where the filesystem is mounted to run the postinstall program.
+// The programs running at the same time as another one use the directory
+// "/postinstall_<partition name>" instead, if the device provides it.
+const char kPostinstallMountDir[] = "/postinstall";
+#endif  // __ANDROID__
+
 }  // namespace
 
 namespace chromeos_update_engine {
@@ -56,7 +64,7 @@ using std::vector;
 
 void PostinstallRunnerAction::PerformAction() {
   CHECK(HasInputObject());
-  install_plan_ = GetInputObject();
+  install_plan_ = TakeInputObject();
 
   // Currently we're always powerwashing when rolling back.
   if (install_plan_.powerwash_required || install_plan_.is_rollback) {
@@ -78,7 +86,7 @@ void PostinstallRunnerAction::PerformAction() {
     total_weight_ += partition_weight_[i];
   }
   accumulated_weight_ = 0;
-  ReportProgress(0);
+  ReportProgress();
 
   PerformPartitionPostinstall();
 }
@@ -94,42 +102,91 @@ void PostinstallRunnerAction::PerformPartitionPostinstall() {
     return CompletePostinstall(ErrorCode::kSuccess);
   }
 
-  // Skip all the partitions that don't have a post-install step.
-  while (current_partition_ < install_plan_.partitions.size() &&
-         !install_plan_.partitions[current_partition_].run_postinstall) {
-    VLOG(1) << "Skipping post-install on partition "
-            << install_plan_.partitions[current_partition_].name;
-    current_partition_++;
+  while (next_partition_ < install_plan_.partitions.size()) {
+    const InstallPlan::Partition& partition =
+        install_plan_.partitions[next_partition_];
+    // Skip all the partitions that don't have a post-install step.
+    if (!partition.run_postinstall) {
+      VLOG(1) << "Skipping post-install on partition " << partition.name;
+      next_partition_++;
+      continue;
+    }
+    // A partition only runs at the same time as the ones already running if
+    // all of them are parallel.
+    if (!steps_.empty() &&
+        (!partition.postinstall_parallel ||
+         !install_plan_.partitions[steps_.front()->partition]
+              .postinstall_parallel)) {
+      break;
+    }
+
+    string fs_mount_dir;
+    if (!GetMountDir(partition, &fs_mount_dir)) {
+      // Wait for the running programs to finish and try again.
+      if (!steps_.empty())
+        break;
+      LOG(ERROR) << "Cannot create a mountpoint for " << partition.name;
+      return CompletePostinstall(ErrorCode::kPostinstallRunnerError);
+    }
+
+    steps_.emplace_back(new PostinstallStep());
+    PostinstallStep* step = steps_.back().get();
+    step->partition = next_partition_++;
+    step->fs_mount_dir = fs_mount_dir;
+    if (!StartPartitionPostinstall(step))
+      return;
   }
-  if (current_partition_ == install_plan_.partitions.size())
-    return CompletePostinstall(ErrorCode::kSuccess);
 
+  if (steps_.empty())
+    CompletePostinstall(ErrorCode::kSuccess);
+}
+
+bool PostinstallRunnerAction::GetMountDir(
+    const InstallPlan::Partition& partition, string* fs_mount_dir) {
+#ifdef __ANDROID__
+  vector<string> candidates = {kPostinstallMountDir};
+  if (!steps_.empty())
+    candidates.push_back(string(kPostinstallMountDir) + "_" + partition.name);
+  for (const string& candidate : candidates) {
+    bool in_use = false;
+    for (const auto& step : steps_)
+      in_use = in_use || step->fs_mount_dir == candidate;
+    if (!in_use && base::DirectoryExists(base::FilePath(candidate))) {
+      *fs_mount_dir = candidate;
+      return true;
+    }
+  }
+  return false;
+#else   // __ANDROID__
+  base::FilePath temp_dir;
+  TEST_AND_RETURN_FALSE(
+      base::CreateNewTempDirectory("au_postint_mount", &temp_dir));
+  *fs_mount_dir = temp_dir.value();
+  return true;
+#endif  // __ANDROID__
+}
+
+bool PostinstallRunnerAction::StartPartitionPostinstall(PostinstallStep* step) {
   const InstallPlan::Partition& partition =
-      install_plan_.partitions[current_partition_];
+      install_plan_.partitions[step->partition];
 
   const string mountable_device =
       utils::MakePartitionNameForMount(partition.target_path);
   if (mountable_device.empty()) {
     LOG(ERROR) << "Cannot make mountable device from " << partition.target_path;
-    return CompletePostinstall(ErrorCode::kPostinstallRunnerError);
+    CompletePostinstall(ErrorCode::kPostinstallRunnerError);
+    return false;
   }
 
-  // Perform post-install for the current_partition_ partition. At this point we
-  // need to call CompletePartitionPostinstall to complete the operation and
-  // cleanup.
-#ifdef __ANDROID__
-  fs_mount_dir_ = "/postinstall";
-#else   // __ANDROID__
-  base::FilePath temp_dir;
-  TEST_AND_RETURN(base::CreateNewTempDirectory("au_postint_mount", &temp_dir));
-  fs_mount_dir_ = temp_dir.value();
-#endif  // __ANDROID__
+  // Perform post-install for the partition of |step|. At this point we need to
+  // call FinishPartitionPostinstall to complete the operation and cleanup.
 
   // Double check that the fs_mount_dir is not busy with a previous mounted
   // filesystem from a previous crashed postinstall step.
-  if (utils::IsMountpoint(fs_mount_dir_)) {
-    LOG(INFO) << "Found previously mounted filesystem at " << fs_mount_dir_;
-    utils::UnmountFilesystem(fs_mount_dir_);
+  if (utils::IsMountpoint(step->fs_mount_dir)) {
+    LOG(INFO) << "Found previously mounted filesystem at "
+              << step->fs_mount_dir;
+    utils::UnmountFilesystem(step->fs_mount_dir);
   }
 
   base::FilePath postinstall_path(partition.postinstall_path);
@@ -137,16 +194,18 @@ void PostinstallRunnerAction::PerformPartitionPostinstall() {
     LOG(ERROR) << "Invalid absolute path passed to postinstall, use a relative"
                   "path instead: "
                << partition.postinstall_path;
-    return CompletePostinstall(ErrorCode::kPostinstallRunnerError);
+    CompletePostinstall(ErrorCode::kPostinstallRunnerError);
+    return false;
   }
 
   string abs_path =
-      base::FilePath(fs_mount_dir_).Append(postinstall_path).value();
+      base::FilePath(step->fs_mount_dir).Append(postinstall_path).value();
   if (!base::StartsWith(
-          abs_path, fs_mount_dir_, base::CompareCase::SENSITIVE)) {
+          abs_path, step->fs_mount_dir, base::CompareCase::SENSITIVE)) {
     LOG(ERROR) << "Invalid relative postinstall path: "
                << partition.postinstall_path;
-    return CompletePostinstall(ErrorCode::kPostinstallRunnerError);
+    CompletePostinstall(ErrorCode::kPostinstallRunnerError);
+    return false;
   }
 
 #ifdef __ANDROID__
@@ -189,17 +248,20 @@ void PostinstallRunnerAction::PerformPartitionPostinstall() {
   if (mount_count > 0) {
     // Mount the target partition R/W
     LOG(INFO) << "Running backuptool scripts";
-    utils::MountFilesystem(mountable_device, fs_mount_dir_, MS_NOATIME | MS_NODEV | MS_NODIRATIME,
+    utils::MountFilesystem(mountable_device, step->fs_mount_dir, MS_NOATIME | MS_NODEV | MS_NODIRATIME,
                            partition.filesystem_type, "seclabel");
 
     // Switch to a permissive domain
     if (setexeccon("u:r:backuptool:s0")) {
       LOG(ERROR) << "Failed to set backuptool context";
-      return CompletePostinstall(ErrorCode::kPostinstallRunnerError);
+      CompletePostinstall(ErrorCode::kPostinstallRunnerError);
+      return false;
     }
 
     // Run backuptool script
-    int ret = system("/postinstall/system/bin/backuptool_postinstall.sh");
+    string backuptool_path =
+        step->fs_mount_dir + "/system/bin/backuptool_postinstall.sh";
+    int ret = system(backuptool_path.c_str());
     if (ret == -1 || WEXITSTATUS(ret) != 0) {
       LOG(ERROR) << "Backuptool postinstall step failed. ret=" << ret;
     }
@@ -207,13 +269,14 @@ void PostinstallRunnerAction::PerformPartitionPostinstall() {
     // Switch back to update_engine domain
     if (setexeccon(nullptr)) {
       LOG(ERROR) << "Failed to set update_engine context";
-      return CompletePostinstall(ErrorCode::kPostinstallRunnerError);
+      CompletePostinstall(ErrorCode::kPostinstallRunnerError);
+      return false;
     }
   } else {
     LOG(INFO) << "Skipping backuptool scripts";
   }
 
-  utils::UnmountFilesystem(fs_mount_dir_);
+  utils::UnmountFilesystem(step->fs_mount_dir);
 
   // In Chromium OS, the postinstall step is allowed to write to the block
   // device on the target image, so we don't mark it as read-only and should
@@ -221,18 +284,19 @@ void PostinstallRunnerAction::PerformPartitionPostinstall() {
 
   // Mark the block device as read-only before mounting for post-install.
   if (!utils::SetBlockDeviceReadOnly(mountable_device, true)) {
-    return CompletePartitionPostinstall(
-        1, "Error marking the device " + mountable_device + " read only.");
+    LOG(ERROR) << "Error marking the device " << mountable_device
+               << " read only.";
+    return FinishPartitionPostinstall(step, 1);
   }
 #endif  // __ANDROID__
 
   if (!utils::MountFilesystem(mountable_device,
-                              fs_mount_dir_,
+                              step->fs_mount_dir,
                               MS_RDONLY,
                               partition.filesystem_type,
                               constants::kPostinstallMountOptions)) {
-    return CompletePartitionPostinstall(
-        1, "Error mounting the device " + mountable_device);
+    LOG(ERROR) << "Error mounting the device " << mountable_device;
+    return FinishPartitionPostinstall(step, 1);
   }
 
   LOG(INFO) << "Performing postinst (" << partition.postinstall_path << " at "
@@ -257,115 +321,158 @@ void PostinstallRunnerAction::PerformPartitionPostinstall() {
   command.push_back(partition.target_path);
 #endif  // __ANDROID__
 
-  current_command_ = Subprocess::Get().ExecFlags(
+  step->command = Subprocess::Get().ExecFlags(
       command,
       Subprocess::kRedirectStderrToStdout,
       {kPostinstallStatusFd},
       base::Bind(&PostinstallRunnerAction::CompletePartitionPostinstall,
-                 base::Unretained(this)));
+                 base::Unretained(this),
+                 base::Unretained(step)));
   // Subprocess::Exec should never return a negative process id.
-  CHECK_GE(current_command_, 0);
+  CHECK_GE(step->command, 0);
 
-  if (!current_command_) {
-    CompletePartitionPostinstall(1, "Postinstall didn't launch");
-    return;
+  if (!step->command) {
+    LOG(ERROR) << "Postinstall didn't launch";
+    return FinishPartitionPostinstall(step, 1);
   }
 
   // Monitor the status file descriptor.
-  progress_fd_ =
-      Subprocess::Get().GetPipeFd(current_command_, kPostinstallStatusFd);
-  int fd_flags = fcntl(progress_fd_, F_GETFL, 0) | O_NONBLOCK;
-  if (HANDLE_EINTR(fcntl(progress_fd_, F_SETFL, fd_flags)) < 0) {
-    PLOG(ERROR) << "Unable to set non-blocking I/O mode on fd " << progress_fd_;
+  step->progress_fd =
+      Subprocess::Get().GetPipeFd(step->command, kPostinstallStatusFd);
+  int fd_flags = fcntl(step->progress_fd, F_GETFL, 0) | O_NONBLOCK;
+  if (HANDLE_EINTR(fcntl(step->progress_fd, F_SETFL, fd_flags)) < 0) {
+    PLOG(ERROR) << "Unable to set non-blocking I/O mode on fd "
+                << step->progress_fd;
   }
 
-  progress_task_ = MessageLoop::current()->WatchFileDescriptor(
+  step->progress_task = MessageLoop::current()->WatchFileDescriptor(
       FROM_HERE,
-      progress_fd_,
+      step->progress_fd,
       MessageLoop::WatchMode::kWatchRead,
       true,
       base::Bind(&PostinstallRunnerAction::OnProgressFdReady,
-                 base::Unretained(this)));
+                 base::Unretained(this),
+                 base::Unretained(step)));
+  return true;
 }
 
-void PostinstallRunnerAction::OnProgressFdReady() {
+void PostinstallRunnerAction::OnProgressFdReady(PostinstallStep* step) {
   char buf[1024];
   size_t bytes_read;
   do {
     bytes_read = 0;
     bool eof;
-    bool ok =
-        utils::ReadAll(progress_fd_, buf, arraysize(buf), &bytes_read, &eof);
-    progress_buffer_.append(buf, bytes_read);
+    bool ok = utils::ReadAll(
+        step->progress_fd, buf, arraysize(buf), &bytes_read, &eof);
+    step->progress_buffer.append(buf, bytes_read);
     // Process every line.
-    vector<string> lines = base::SplitString(
-        progress_buffer_, "\n", base::KEEP_WHITESPACE, base::SPLIT_WANT_ALL);
+    vector<string> lines = base::SplitString(step->progress_buffer,
+                                             "\n",
+                                             base::KEEP_WHITESPACE,
+                                             base::SPLIT_WANT_ALL);
     if (!lines.empty()) {
-      progress_buffer_ = lines.back();
+      step->progress_buffer = lines.back();
       lines.pop_back();
       for (const auto& line : lines) {
-        ProcessProgressLine(line);
+        ProcessProgressLine(step, line);
       }
     }
     if (!ok || eof) {
       // There was either an error or an EOF condition, so we are done watching
       // the file descriptor.
-      MessageLoop::current()->CancelTask(progress_task_);
-      progress_task_ = MessageLoop::kTaskIdNull;
+      MessageLoop::current()->CancelTask(step->progress_task);
+      step->progress_task = MessageLoop::kTaskIdNull;
       return;
     }
   } while (bytes_read);
 }
 
-bool PostinstallRunnerAction::ProcessProgressLine(const string& line) {
+bool PostinstallRunnerAction::ProcessProgressLine(PostinstallStep* step,
+                                                  const string& line) {
   double frac = 0;
   if (sscanf(line.c_str(), "global_progress %lf", &frac) == 1 &&
       !std::isnan(frac)) {
-    ReportProgress(frac);
+    if (!std::isfinite(frac) || frac < 0)
+      frac = 0;
+    if (frac > 1)
+      frac = 1;
+    step->progress = frac;
+    ReportProgress();
     return true;
   }
 
   return false;
 }
 
-void PostinstallRunnerAction::ReportProgress(double frac) {
+void PostinstallRunnerAction::ReportProgress() {
   if (!delegate_)
     return;
-  if (current_partition_ >= partition_weight_.size() || total_weight_ == 0) {
+  if (total_weight_ == 0) {
     delegate_->ProgressUpdate(1.);
     return;
   }
-  if (!std::isfinite(frac) || frac < 0)
-    frac = 0;
-  if (frac > 1)
-    frac = 1;
-  double postinst_action_progress =
-      (accumulated_weight_ + partition_weight_[current_partition_] * frac) /
-      total_weight_;
-  delegate_->ProgressUpdate(postinst_action_progress);
+  double weight = accumulated_weight_;
+  for (const auto& step : steps_)
+    weight += partition_weight_[step->partition] * step->progress;
+  delegate_->ProgressUpdate(weight / total_weight_);
 }
 
-void PostinstallRunnerAction::Cleanup() {
-  utils::UnmountFilesystem(fs_mount_dir_);
+void PostinstallRunnerAction::Cleanup(PostinstallStep* step) {
+  utils::UnmountFilesystem(step->fs_mount_dir);
 #ifndef __ANDROID__
-  if (!base::DeleteFile(base::FilePath(fs_mount_dir_), false)) {
-    PLOG(WARNING) << "Not removing temporary mountpoint " << fs_mount_dir_;
+  if (!base::DeleteFile(base::FilePath(step->fs_mount_dir), false)) {
+    PLOG(WARNING) << "Not removing temporary mountpoint "
+                  << step->fs_mount_dir;
   }
 #endif  // !__ANDROID__
-  fs_mount_dir_.clear();
+  step->fs_mount_dir.clear();
 
-  progress_fd_ = -1;
-  if (progress_task_ != MessageLoop::kTaskIdNull) {
-    MessageLoop::current()->CancelTask(progress_task_);
-    progress_task_ = MessageLoop::kTaskIdNull;
+  step->progress_fd = -1;
+  if (step->progress_task != MessageLoop::kTaskIdNull) {
+    MessageLoop::current()->CancelTask(step->progress_task);
+    step->progress_task = MessageLoop::kTaskIdNull;
+  }
+  step->progress_buffer.clear();
+}
+
+void PostinstallRunnerAction::StopPostinstallSteps() {
+  for (const auto& step : steps_) {
+    if (step->command) {
+      // Calling KillExec() will discard the callback we registered and
+      // therefore the unretained reference to this object.
+      Subprocess::Get().KillExec(step->command);
+
+      // If the command has been suspended, resume it after KillExec() so that
+      // the process can process the SIGTERM sent by KillExec().
+      if (step->suspended && kill(step->command, SIGCONT) != 0)
+        PLOG(ERROR) << "Couldn't resume child process " << step->command;
+      step->command = 0;
+    }
+    Cleanup(step.get());
   }
-  progress_buffer_.clear();
+  steps_.clear();
 }
 
 void PostinstallRunnerAction::CompletePartitionPostinstall(
-    int return_code, const string& output) {
-  current_command_ = 0;
-  Cleanup();
+    PostinstallStep* step, int return_code, const string& output) {
+  if (!FinishPartitionPostinstall(step, return_code))
+    return;
+  // The next partitions start once all the running programs are done.
+  if (steps_.empty())
+    PerformPartitionPostinstall();
+}
+
+bool PostinstallRunnerAction::FinishPartitionPostinstall(PostinstallStep* step,
+                                                         int return_code) {
+  step->command = 0;
+  Cleanup(step);
+  size_t partition = step->partition;
+  for (auto it = steps_.begin(); it != steps_.end(); ++it) {
+    if (it->get() == step) {
+      steps_.erase(it);
+      break;
+    }
+  }
 
   if (return_code != 0) {
     LOG(ERROR) << "Postinst command failed with code: " << return_code;
@@ -387,20 +494,22 @@ void PostinstallRunnerAction::CompletePartitionPostinstall(
 
     // If postinstall script for this partition is optional we can ignore the
     // result.
-    if (install_plan_.partitions[current_partition_].postinstall_optional) {
+    if (install_plan_.partitions[partition].postinstall_optional) {
       LOG(INFO) << "Ignoring postinstall failure since it is optional";
     } else {
-      return CompletePostinstall(error_code);
+      CompletePostinstall(error_code);
+      return false;
     }
   }
-  accumulated_weight_ += partition_weight_[current_partition_];
-  current_partition_++;
-  ReportProgress(0);
-
-  PerformPartitionPostinstall();
+  accumulated_weight_ += partition_weight_[partition];
+  ReportProgress();
+  return true;
 }
 
 void PostinstallRunnerAction::CompletePostinstall(ErrorCode error_code) {
+  // Stop the programs still running, if this is a failure.
+  StopPostinstallSteps();
+
   // We only attempt to mark the new slot as active if all the postinstall
   // steps succeeded.
   if (error_code == ErrorCode::kSuccess) {
@@ -429,45 +538,36 @@ void PostinstallRunnerAction::CompletePostinstall(ErrorCode error_code) {
 
   LOG(INFO) << "All post-install commands succeeded";
   if (HasOutputPipe()) {
-    SetOutputObject(install_plan_);
+    SetOutputObject(std::move(install_plan_));
   }
 }
 
 void PostinstallRunnerAction::SuspendAction() {
-  if (!current_command_)
-    return;
-  if (kill(current_command_, SIGSTOP) != 0) {
-    PLOG(ERROR) << "Couldn't pause child process " << current_command_;
-  } else {
-    is_current_command_suspended_ = true;
+  for (const auto& step : steps_) {
+    if (!step->command)
+      continue;
+    if (kill(step->command, SIGSTOP) != 0) {
+      PLOG(ERROR) << "Couldn't pause child process " << step->command;
+    } else {
+      step->suspended = true;
+    }
   }
 }
 
 void PostinstallRunnerAction::ResumeAction() {
-  if (!current_command_)
-    return;
-  if (kill(current_command_, SIGCONT) != 0) {
-    PLOG(ERROR) << "Couldn't resume child process " << current_command_;
-  } else {
-    is_current_command_suspended_ = false;
+  for (const auto& step : steps_) {
+    if (!step->command)
+      continue;
+    if (kill(step->command, SIGCONT) != 0) {
+      PLOG(ERROR) << "Couldn't resume child process " << step->command;
+    } else {
+      step->suspended = false;
+    }
   }
 }
 
 void PostinstallRunnerAction::TerminateProcessing() {
-  if (!current_command_)
-    return;
-  // Calling KillExec() will discard the callback we registered and therefore
-  // the unretained reference to this object.
-  Subprocess::Get().KillExec(current_command_);
-
-  // If the command has been suspended, resume it after KillExec() so that the
-  // process can process the SIGTERM sent by KillExec().
-  if (is_current_command_suspended_) {
-    ResumeAction();
-  }
-
-  current_command_ = 0;
-  Cleanup();
+  StopPostinstallSteps();
 }
 
 }  // namespace chromeos_update_engine
@@ -17,6 +17,7 @@
 #ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_POSTINSTALL_RUNNER_ACTION_H_
 #define UPDATE_ENGINE_PAYLOAD_CONSUMER_POSTINSTALL_RUNNER_ACTION_H_
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -65,31 +66,81 @@ class PostinstallRunnerAction : public InstallPlanAction {
  private:
   friend class PostinstallRunnerActionTest;
   FRIEND_TEST(PostinstallRunnerActionTest, ProcessProgressLineTest);
+  FRIEND_TEST(PostinstallRunnerActionTest, ParallelProgressTest);
 
+  // The postinstall program of one partition and its state while it runs.
+  struct PostinstallStep {
+    // The index of the partition in the InstallPlan.
+    size_t partition{0};
+
+    // The path where the filesystem is mounted while the program runs.
+    std::string fs_mount_dir;
+
+    // The postinstall command running, or 0 if no program is running.
+    pid_t command{0};
+
+    // True if |command| has been suspended by SuspendAction().
+    bool suspended{false};
+
+    // The parent progress file descriptor used to watch for progress reports
+    // from the postinstall program and the task watching for them.
+    int progress_fd{-1};
+    brillo::MessageLoop::TaskId progress_task{brillo::MessageLoop::kTaskIdNull};
+
+    // A buffer of a partial read line from the progress file descriptor.
+    std::string progress_buffer;
+
+    // The last progress reported by the program, between 0 and 1.
+    double progress{0};
+  };
+
+  // Starts the postinstall programs of the next partitions. Consecutive
+  // partitions with |postinstall_parallel| set run at the same time, the other
+  // ones run alone.
   void PerformPartitionPostinstall();
 
-  // Called whenever the |progress_fd_| has data available to read.
-  void OnProgressFdReady();
+  // Picks the path where the filesystem of |partition| is mounted, which must
+  // not be in use by any of the running |steps_|. Returns false if there is no
+  // such path available.
+  bool GetMountDir(const InstallPlan::Partition& partition,
+                   std::string* fs_mount_dir);
+
+  // Mounts the filesystem of the partition of |step| and starts its postinstall
+  // program. Returns false if the action was completed because of a failure.
+  bool StartPartitionPostinstall(PostinstallStep* step);
 
-  // Updates the action progress according to the |line| passed from the
+  // Called whenever the progress file descriptor of |step| has data available
+  // to read.
+  void OnProgressFdReady(PostinstallStep* step);
+
+  // Updates the progress of |step| according to the |line| passed from its
   // postinstall program. Valid lines are:
   //     global_progress <frac>
   //         <frac> should be between 0.0 and 1.0; sets the progress to the
   //         <frac> value.
-  bool ProcessProgressLine(const std::string& line);
+  bool ProcessProgressLine(PostinstallStep* step, const std::string& line);
+
+  // Report the overall progress to the delegate, combining the progress of the
+  // partitions already done and the ones in |steps_|, weighted by their
+  // |partition_weight_|.
+  void ReportProgress();
+
+  // Cleanup the setup made when running postinstall for |step|. Unmount and
+  // remove the mountpoint directory if needed and cleanup the status file
+  // descriptor and message loop task watching for it.
+  void Cleanup(PostinstallStep* step);
 
-  // Report the progress to the delegate given that the postinstall operation
-  // for |current_partition_| has a current progress of |frac|, a value between
-  // 0 and 1 for that step.
-  void ReportProgress(double frac);
+  // Kills the running postinstall programs and removes all the |steps_|.
+  void StopPostinstallSteps();
 
-  // Cleanup the setup made when running postinstall for a given partition.
-  // Unmount and remove the mountpoint directory if needed and cleanup the
-  // status file descriptor and message loop task watching for it.
-  void Cleanup();
+  // Subprocess::Exec callback for the program of |step|.
+  void CompletePartitionPostinstall(PostinstallStep* step,
+                                    int return_code,
+                                    const std::string& output);
 
-  // Subprocess::Exec callback.
-  void CompletePartitionPostinstall(int return_code, const std::string& output);
+  // Cleans up and removes |step|, whose program exited with |return_code|.
+  // Returns false if the action was completed because of a failure.
+  bool FinishPartitionPostinstall(PostinstallStep* step, int return_code);
 
   // Complete the Action with the passed |error_code| and mark the new slot as
   // ready. Called when the post-install script was run for all the partitions.
@@ -97,12 +148,12 @@ class PostinstallRunnerAction : public InstallPlanAction {
 
   InstallPlan install_plan_;
 
-  // The path where the filesystem will be mounted during post-install.
-  std::string fs_mount_dir_;
-
-  // The partition being processed on the list of partitions specified in the
+  // The next partition to process on the list of partitions specified in the
   // InstallPlan.
-  size_t current_partition_{0};
+  size_t next_partition_{0};
+
+  // The postinstall programs started and not yet finished.
+  std::vector<std::unique_ptr<PostinstallStep>> steps_;
 
   // A non-negative value representing the estimated weight of each partition
   // passed in the install plan. The weight is used to predict the overall
@@ -113,8 +164,8 @@ class PostinstallRunnerAction : public InstallPlanAction {
   // The sum of all the weights in |partition_weight_|.
   double total_weight_{0};
 
-  // The sum of all the weights in |partition_weight_| up to but not including
-  // the |current_partition_|.
+  // The sum of the weights in |partition_weight_| of the partitions already
+  // done.
   double accumulated_weight_{0};
 
   // The delegate used to notify of progress updates, if any.
@@ -130,20 +181,6 @@ class PostinstallRunnerAction : public InstallPlanAction {
   // Used for cleaning up if post-install fails.
   bool powerwash_scheduled_{false};
 
-  // Postinstall command currently running, or 0 if no program running.
-  pid_t current_command_{0};
-
-  // True if |current_command_| has been suspended by SuspendAction().
-  bool is_current_command_suspended_{false};
-
-  // The parent progress file descriptor used to watch for progress reports from
-  // the postinstall program and the task watching for them.
-  int progress_fd_{-1};
-  brillo::MessageLoop::TaskId progress_task_{brillo::MessageLoop::kTaskIdNull};
-
-  // A buffer of a partial read line from the progress file descriptor.
-  std::string progress_buffer_;
-
   DISALLOW_COPY_AND_ASSIGN(PostinstallRunnerAction);
 };
 
@@ -103,15 +103,22 @@ class PostinstallRunnerActionTest : public ::testing::Test {
                             bool is_rollback);
 
  public:
+  // Returns the pid of the first postinstall program running, if any.
+  pid_t RunningCommand() const {
+    if (!postinstall_action_ || postinstall_action_->steps_.empty())
+      return 0;
+    return postinstall_action_->steps_.front()->command;
+  }
+
   void ResumeRunningAction() {
     ASSERT_NE(nullptr, postinstall_action_);
     postinstall_action_->ResumeAction();
   }
 
   void SuspendRunningAction() {
-    if (!postinstall_action_ || !postinstall_action_->current_command_ ||
-        test_utils::Readlink(base::StringPrintf(
-            "/proc/%d/fd/0", postinstall_action_->current_command_)) !=
+    if (!RunningCommand() ||
+        test_utils::Readlink(base::StringPrintf("/proc/%d/fd/0",
+                                                RunningCommand())) !=
             "/dev/zero") {
       // We need to wait for the postinstall command to start and flag that it
       // is ready by redirecting its input to /dev/zero.
@@ -132,7 +139,7 @@ class PostinstallRunnerActionTest : public ::testing::Test {
   }
 
   void CancelWhenStarted() {
-    if (!postinstall_action_ || !postinstall_action_->current_command_) {
+    if (!RunningCommand()) {
       // Wait for the postinstall command to run.
       loop_.PostDelayedTask(
           FROM_HERE,
@@ -220,28 +227,60 @@ TEST_F(PostinstallRunnerActionTest, ProcessProgressLineTest) {
   testing::StrictMock<MockPostinstallRunnerActionDelegate> mock_delegate_;
   action.set_delegate(&mock_delegate_);
 
-  action.current_partition_ = 1;
   action.partition_weight_ = {1, 2, 5};
   action.accumulated_weight_ = 1;
   action.total_weight_ = 8;
+  action.steps_.emplace_back(new PostinstallRunnerAction::PostinstallStep());
+  PostinstallRunnerAction::PostinstallStep* step = action.steps_[0].get();
+  step->partition = 1;
 
   // 50% of the second action is 2/8 = 0.25 of the total.
   EXPECT_CALL(mock_delegate_, ProgressUpdate(0.25));
-  action.ProcessProgressLine("global_progress 0.5");
+  action.ProcessProgressLine(step, "global_progress 0.5");
   testing::Mock::VerifyAndClearExpectations(&mock_delegate_);
 
   // 1.5 should be read as 100%, to catch rounding error cases like 1.000001.
   // 100% of the second is 3/8 of the total.
   EXPECT_CALL(mock_delegate_, ProgressUpdate(0.375));
-  action.ProcessProgressLine("global_progress 1.5");
+  action.ProcessProgressLine(step, "global_progress 1.5");
   testing::Mock::VerifyAndClearExpectations(&mock_delegate_);
 
   // None of these should trigger a progress update.
-  action.ProcessProgressLine("foo_bar");
-  action.ProcessProgressLine("global_progress");
-  action.ProcessProgressLine("global_progress ");
-  action.ProcessProgressLine("global_progress NaN");
-  action.ProcessProgressLine("global_progress Exception in ... :)");
+  action.ProcessProgressLine(step, "foo_bar");
+  action.ProcessProgressLine(step, "global_progress");
+  action.ProcessProgressLine(step, "global_progress ");
+  action.ProcessProgressLine(step, "global_progress NaN");
+  action.ProcessProgressLine(step, "global_progress Exception in ... :)");
+  action.steps_.clear();
+}
+
+// Test that the progress of the postinstall programs running at the same time
+// is combined in a single value.
+TEST_F(PostinstallRunnerActionTest, ParallelProgressTest) {
+  PostinstallRunnerAction action(&fake_boot_control_, &fake_hardware_);
+  testing::StrictMock<MockPostinstallRunnerActionDelegate> mock_delegate_;
+  action.set_delegate(&mock_delegate_);
+
+  action.partition_weight_ = {1, 1, 2};
+  action.accumulated_weight_ = 1;
+  action.total_weight_ = 4;
+  PostinstallRunnerAction::PostinstallStep* steps[2];
+  for (size_t i = 0; i < arraysize(steps); i++) {
+    action.steps_.emplace_back(new PostinstallRunnerAction::PostinstallStep());
+    steps[i] = action.steps_.back().get();
+    steps[i]->partition = i + 1;
+  }
+
+  // 50% of the second partition is 0.5/4 of the total.
+  EXPECT_CALL(mock_delegate_, ProgressUpdate(0.375));
+  action.ProcessProgressLine(steps[0], "global_progress 0.5");
+  testing::Mock::VerifyAndClearExpectations(&mock_delegate_);
+
+  // 50% of the third partition adds 1/4 of the total.
+  EXPECT_CALL(mock_delegate_, ProgressUpdate(0.625));
+  action.ProcessProgressLine(steps[1], "global_progress 0.5");
+  testing::Mock::VerifyAndClearExpectations(&mock_delegate_);
+  action.steps_.clear();
 }
 
 // Test that postinstall succeeds in the simple case of running the default
@@ -0,0 +1,146 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/skip_unchanged_file_descriptor.h"
+
+#include <errno.h>
+#include <linux/fs.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <base/logging.h>
+
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+off64_t SkipUnchangedFileDescriptor::Seek(off64_t offset, int whence) {
+  // Same as the CachedFileDescriptor, SEEK_END would need the size of |fd_|.
+  CHECK(whence == SEEK_SET || whence == SEEK_CUR);
+  off64_t next_offset = whence == SEEK_SET ? offset : offset_ + offset;
+  if (next_offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  offset_ = next_offset;
+  return offset_;
+}
+
+ssize_t SkipUnchangedFileDescriptor::Read(void* buf, size_t count) {
+  if (fd_->Seek(offset_, SEEK_SET) < 0)
+    return -1;
+  ssize_t bytes_read = fd_->Read(buf, count);
+  if (bytes_read > 0)
+    offset_ += bytes_read;
+  return bytes_read;
+}
+
+ssize_t SkipUnchangedFileDescriptor::Write(const void* buf, size_t count) {
+  auto bytes = static_cast<const uint8_t*>(buf);
+
+  // Read the data being overwritten. Whatever can't be read, like past the
+  // end of the partition, is written as is.
+  size_t old_size = 0;
+  if (zeroed_) {
+    old_size = count;
+  } else if (fd_->Seek(offset_, SEEK_SET) >= 0) {
+    old_data_.resize(count);
+    while (old_size < count) {
+      ssize_t bytes_read =
+          fd_->Read(old_data_.data() + old_size, count - old_size);
+      if (bytes_read <= 0)
+        break;
+      old_size += bytes_read;
+    }
+  }
+
+  // Compare the data one block at a time, aligned to the blocks of |fd_|, and
+  // write the runs of changed blocks at once.
+  size_t run_start = 0;
+  size_t pos = 0;
+  while (pos < old_size) {
+    size_t block_end = std::min(
+        old_size, pos + block_size_ - (offset_ + pos) % block_size_);
+    bool unchanged =
+        zeroed_
+            ? utils::IsZeroBlock(bytes + pos, block_end - pos)
+            : memcmp(old_data_.data() + pos, bytes + pos, block_end - pos) == 0;
+    if (unchanged) {
+      if (run_start < pos && !WriteAt(offset_ + run_start,
+                                      bytes + run_start,
+                                      pos - run_start)) {
+        return -1;
+      }
+      skipped_bytes_ += block_end - pos;
+      run_start = block_end;
+    }
+    pos = block_end;
+  }
+  if (run_start < count &&
+      !WriteAt(offset_ + run_start, bytes + run_start, count - run_start)) {
+    return -1;
+  }
+  offset_ += count;
+  return count;
+}
+
+bool SkipUnchangedFileDescriptor::BlkIoctl(int request,
+                                           uint64_t start,
+                                           uint64_t length,
+                                           int* result) {
+#ifdef BLKZEROOUT
+  if (zeroed_ && (request == BLKZEROOUT || request == BLKDISCARD)) {
+    skipped_bytes_ += length;
+    *result = 0;
+    return true;
+  }
+#endif  // BLKZEROOUT
+  return fd_->BlkIoctl(request, start, length, result);
+}
+
+bool SkipUnchangedFileDescriptor::Close() {
+  if (written_bytes_ || skipped_bytes_) {
+    LOG(INFO) << "Skipped writing " << skipped_bytes_ << " unchanged bytes, "
+              << "wrote " << written_bytes_ << " bytes.";
+  }
+  offset_ = 0;
+  written_bytes_ = 0;
+  skipped_bytes_ = 0;
+  old_data_.clear();
+  old_data_.shrink_to_fit();
+  return fd_->Close();
+}
+
+bool SkipUnchangedFileDescriptor::WriteAt(off64_t offset,
+                                          const uint8_t* bytes,
+                                          size_t count) {
+  if (fd_->Seek(offset, SEEK_SET) < 0)
+    return false;
+  size_t begin = 0;
+  while (begin < count) {
+    ssize_t bytes_wrote = fd_->Write(bytes + begin, count - begin);
+    if (bytes_wrote < 0)
+      return false;
+    begin += bytes_wrote;
+  }
+  written_bytes_ += count;
+  return true;
+}
+
+}  // namespace chromeos_update_engine
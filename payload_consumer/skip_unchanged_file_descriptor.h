@@ -0,0 +1,98 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_SKIP_UNCHANGED_FILE_DESCRIPTOR_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_SKIP_UNCHANGED_FILE_DESCRIPTOR_H_
+
+#include <sys/types.h>
+
+#include <brillo/secure_blob.h>
+
+#include "update_engine/payload_consumer/file_descriptor.h"
+
+namespace chromeos_update_engine {
+
+// A FileDescriptor that only writes the blocks of |block_size| bytes of |fd_|
+// whose contents change. Each Write() reads the data it overwrites first, and
+// the blocks that already hold the new data are skipped. The inactive slot
+// usually holds the previous version of the partition, whose unchanged blocks
+// are then not written again, saving the flash from most of the writes of a
+// small delta.
+//
+// When |zeroed| is set, |fd_| is known to read as zeros where it wasn't
+// written yet, like a partition that was just discarded. The data isn't read
+// then and only the blocks of zeros are skipped, so each block must be
+// written at most once, as a full payload does. The ioctls zeroing or
+// discarding the blocks are skipped too.
+class SkipUnchangedFileDescriptor : public FileDescriptor {
+ public:
+  SkipUnchangedFileDescriptor(FileDescriptorPtr fd,
+                              size_t block_size,
+                              bool zeroed = false)
+      : fd_(fd), block_size_(block_size), zeroed_(zeroed) {}
+  ~SkipUnchangedFileDescriptor() override = default;
+
+  bool Open(const char* path, int flags, mode_t mode) override {
+    return fd_->Open(path, flags, mode);
+  }
+  bool Open(const char* path, int flags) override {
+    return fd_->Open(path, flags);
+  }
+  ssize_t Read(void* buf, size_t count) override;
+  ssize_t Write(const void* buf, size_t count) override;
+  off64_t Seek(off64_t offset, int whence) override;
+  uint64_t BlockDevSize() override { return fd_->BlockDevSize(); }
+  bool BlkIoctl(int request,
+                uint64_t start,
+                uint64_t length,
+                int* result) override;
+  bool Prefetch(uint64_t offset, uint64_t length) override {
+    return fd_->Prefetch(offset, length);
+  }
+  bool Flush() override { return fd_->Flush(); }
+  bool Close() override;
+  bool IsSettingErrno() override { return fd_->IsSettingErrno(); }
+  bool IsOpen() override { return fd_->IsOpen(); }
+
+  // The number of bytes written and skipped so far.
+  uint64_t written_bytes() const { return written_bytes_; }
+  uint64_t skipped_bytes() const { return skipped_bytes_; }
+
+ private:
+  // Writes the |count| bytes at |bytes| at |offset| of |fd_|.
+  bool WriteAt(off64_t offset, const uint8_t* bytes, size_t count);
+
+  FileDescriptorPtr fd_;
+  const size_t block_size_;
+  const bool zeroed_;
+
+  // The offset of the next Read() or Write().
+  off64_t offset_{0};
+
+  // The data currently stored where the data is written, reused across the
+  // writes.
+  brillo::Blob old_data_;
+
+  uint64_t written_bytes_{0};
+  uint64_t skipped_bytes_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(SkipUnchangedFileDescriptor);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_SKIP_UNCHANGED_FILE_DESCRIPTOR_H_
@@ -0,0 +1,129 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/skip_unchanged_file_descriptor.h"
+
+#include <fcntl.h>
+#include <linux/fs.h>
+
+#include <algorithm>
+#include <memory>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+const size_t kBlockSize = 16;
+const size_t kFileSize = 4 * kBlockSize;
+}  // namespace
+
+class SkipUnchangedFileDescriptorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    data_.resize(kFileSize);
+    test_utils::FillWithData(&data_);
+    ASSERT_TRUE(utils::WriteFile(
+        temp_file_.path().c_str(), data_.data(), data_.size()));
+    fd_.reset(new SkipUnchangedFileDescriptor(
+        FileDescriptorPtr(new EintrSafeFileDescriptor), kBlockSize));
+    ASSERT_TRUE(fd_->Open(temp_file_.path().c_str(), O_RDWR, 0600));
+  }
+
+  // Writes |data| at |offset| and checks the file now holds |data_| with it.
+  void WriteAndCheck(off64_t offset, const brillo::Blob& data) {
+    ASSERT_EQ(offset, fd_->Seek(offset, SEEK_SET));
+    ASSERT_TRUE(utils::WriteAll(fd_, data.data(), data.size()));
+    EXPECT_EQ(offset + static_cast<off64_t>(data.size()),
+              fd_->Seek(0, SEEK_CUR));
+    if (data_.size() < offset + data.size())
+      data_.resize(offset + data.size());
+    std::copy(data.begin(), data.end(), data_.begin() + offset);
+    brillo::Blob file_data;
+    ASSERT_TRUE(utils::ReadFile(temp_file_.path(), &file_data));
+    EXPECT_EQ(data_, file_data);
+  }
+
+  test_utils::ScopedTempFile temp_file_{"SkipUnchanged-file.XXXXXX"};
+  brillo::Blob data_;
+  std::shared_ptr<SkipUnchangedFileDescriptor> fd_;
+};
+
+TEST_F(SkipUnchangedFileDescriptorTest, OnlyWritesChangedBlocksTest) {
+  brillo::Blob data = data_;
+  data[kBlockSize + 3] ^= 0xff;
+  data[3 * kBlockSize] ^= 0xff;
+  WriteAndCheck(0, data);
+  EXPECT_EQ(2 * kBlockSize, fd_->written_bytes());
+  EXPECT_EQ(2 * kBlockSize, fd_->skipped_bytes());
+
+  // Writing the same data again writes nothing.
+  WriteAndCheck(0, data);
+  EXPECT_EQ(2 * kBlockSize, fd_->written_bytes());
+  EXPECT_EQ(2 * kFileSize - 2 * kBlockSize, fd_->skipped_bytes());
+}
+
+TEST_F(SkipUnchangedFileDescriptorTest, UnalignedWriteTest) {
+  // The write covers the end of the first block, which changes, and the
+  // start of the second one, which doesn't.
+  brillo::Blob data(data_.begin() + 10, data_.begin() + 20);
+  data[0] ^= 0xff;
+  WriteAndCheck(10, data);
+  EXPECT_EQ(6U, fd_->written_bytes());
+  EXPECT_EQ(4U, fd_->skipped_bytes());
+}
+
+TEST_F(SkipUnchangedFileDescriptorTest, WritePastTheEndTest) {
+  // The data past the end of the file can't be read, so it is written.
+  brillo::Blob data(data_.end() - kBlockSize, data_.end());
+  data.resize(2 * kBlockSize, 'x');
+  WriteAndCheck(kFileSize - kBlockSize, data);
+  EXPECT_EQ(kBlockSize, fd_->written_bytes());
+  EXPECT_EQ(kBlockSize, fd_->skipped_bytes());
+}
+
+TEST_F(SkipUnchangedFileDescriptorTest, ZeroedSkipsZeroBlocksTest) {
+  // The file reads as zeros, so only the blocks of zeros are skipped without
+  // comparing them to the data in the file.
+  data_.assign(kFileSize, 0);
+  ASSERT_TRUE(utils::WriteFile(
+      temp_file_.path().c_str(), data_.data(), data_.size()));
+  fd_.reset(new SkipUnchangedFileDescriptor(
+      FileDescriptorPtr(new EintrSafeFileDescriptor), kBlockSize, true));
+  ASSERT_TRUE(fd_->Open(temp_file_.path().c_str(), O_RDWR, 0600));
+
+  brillo::Blob data(kFileSize, 0);
+  data[kBlockSize + 3] = 'x';
+  data[kFileSize - 1] = 'x';
+  WriteAndCheck(0, data);
+  EXPECT_EQ(2 * kBlockSize, fd_->written_bytes());
+  EXPECT_EQ(2 * kBlockSize, fd_->skipped_bytes());
+
+#ifdef BLKZEROOUT
+  // Zeroing the blocks is skipped too, even where the file isn't a block
+  // device.
+  int result = -1;
+  EXPECT_TRUE(fd_->BlkIoctl(BLKZEROOUT, 0, kBlockSize, &result));
+  EXPECT_EQ(0, result);
+  EXPECT_EQ(3 * kBlockSize, fd_->skipped_bytes());
+#endif  // BLKZEROOUT
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,59 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/source_data_cache.h"
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+std::shared_ptr<const brillo::Blob> SourceDataCache::Get(const string& hash) {
+  base::AutoLock auto_lock(lock_);
+  auto it = positions_.find(hash);
+  if (it == positions_.end())
+    return nullptr;
+  entries_.splice(entries_.begin(), entries_, it->second);
+  return it->second->second;
+}
+
+void SourceDataCache::Put(const string& hash,
+                          std::shared_ptr<const brillo::Blob> data) {
+  if (!data || data->size() > max_size_)
+    return;
+  base::AutoLock auto_lock(lock_);
+  if (positions_.find(hash) != positions_.end())
+    return;
+  size_ += data->size();
+  entries_.emplace_front(hash, std::move(data));
+  positions_[hash] = entries_.begin();
+  while (size_ > max_size_) {
+    size_ -= entries_.back().second->size();
+    positions_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+  memory_.Resize(size_);
+}
+
+void SourceDataCache::Clear() {
+  base::AutoLock auto_lock(lock_);
+  entries_.clear();
+  positions_.clear();
+  size_ = 0;
+  memory_.Resize(size_);
+}
+
+}  // namespace chromeos_update_engine
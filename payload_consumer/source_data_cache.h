@@ -0,0 +1,78 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_SOURCE_DATA_CACHE_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_SOURCE_DATA_CACHE_H_
+
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <base/macros.h>
+#include <base/synchronization/lock.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/memory_stats.h"
+
+namespace chromeos_update_engine {
+
+// A cache of the source data of the operations, keyed by its SHA-256 hash, so
+// the operations reading the same source data share a single copy. The least
+// recently used data is evicted once the cache holds more than |max_size|
+// bytes. It may be used from several threads.
+class SourceDataCache {
+ public:
+  explicit SourceDataCache(size_t max_size) : max_size_(max_size) {}
+  ~SourceDataCache() = default;
+
+  // Returns the data of |hash|, or nullptr if it isn't cached.
+  std::shared_ptr<const brillo::Blob> Get(const std::string& hash);
+
+  // Caches the |data| of |hash|. The data bigger than the cache isn't kept.
+  void Put(const std::string& hash, std::shared_ptr<const brillo::Blob> data);
+
+  // Drops all the cached data.
+  void Clear();
+
+  size_t size() const {
+    base::AutoLock auto_lock(lock_);
+    return size_;
+  }
+
+ private:
+  using Entry = std::pair<std::string, std::shared_ptr<const brillo::Blob>>;
+
+  const size_t max_size_;
+
+  // Protects the members below.
+  mutable base::Lock lock_;
+
+  // The cached data, from the most to the least recently used, and its
+  // position by hash.
+  std::list<Entry> entries_;
+  std::map<std::string, std::list<Entry>::iterator> positions_;
+  size_t size_{0};
+  ScopedMemoryTracker memory_{MemoryCategory::kCache};
+
+  DISALLOW_COPY_AND_ASSIGN(SourceDataCache);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_SOURCE_DATA_CACHE_H_
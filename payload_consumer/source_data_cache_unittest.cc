@@ -0,0 +1,69 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/source_data_cache.h"
+
+#include <memory>
+
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+namespace {
+
+std::shared_ptr<const brillo::Blob> MakeData(size_t size, uint8_t value) {
+  return std::make_shared<const brillo::Blob>(size, value);
+}
+
+}  // namespace
+
+TEST(SourceDataCacheTest, GetReturnsTheCachedDataTest) {
+  SourceDataCache cache(100);
+  EXPECT_EQ(nullptr, cache.Get("a"));
+  cache.Put("a", MakeData(10, 'a'));
+  auto data = cache.Get("a");
+  ASSERT_NE(nullptr, data);
+  EXPECT_EQ(brillo::Blob(10, 'a'), *data);
+  EXPECT_EQ(10U, cache.size());
+}
+
+TEST(SourceDataCacheTest, EvictsTheLeastRecentlyUsedDataTest) {
+  SourceDataCache cache(100);
+  cache.Put("a", MakeData(40, 'a'));
+  cache.Put("b", MakeData(40, 'b'));
+  // Using "a" makes "b" the least recently used data.
+  EXPECT_NE(nullptr, cache.Get("a"));
+  cache.Put("c", MakeData(40, 'c'));
+  EXPECT_NE(nullptr, cache.Get("a"));
+  EXPECT_EQ(nullptr, cache.Get("b"));
+  EXPECT_NE(nullptr, cache.Get("c"));
+  EXPECT_EQ(80U, cache.size());
+}
+
+TEST(SourceDataCacheTest, DataBiggerThanTheCacheIsNotKeptTest) {
+  SourceDataCache cache(100);
+  cache.Put("a", MakeData(40, 'a'));
+  cache.Put("b", MakeData(101, 'b'));
+  EXPECT_NE(nullptr, cache.Get("a"));
+  EXPECT_EQ(nullptr, cache.Get("b"));
+
+  cache.Clear();
+  EXPECT_EQ(nullptr, cache.Get("a"));
+  EXPECT_EQ(0U, cache.size());
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,145 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/staging_file_writer.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace chromeos_update_engine {
+
+StagingFileWriter::StagingFileWriter(FileWriter* next, size_t capacity)
+    : next_(next),
+      data_available_(&lock_),
+      space_available_(&lock_),
+      buffer_(capacity) {
+  CHECK_GT(capacity, 0U);
+  thread_.reset(new base::DelegateSimpleThread(this, "staging_writer"));
+  thread_->Start();
+}
+
+StagingFileWriter::~StagingFileWriter() {
+  Cancel();
+  StopThread();
+}
+
+bool StagingFileWriter::Write(const void* bytes, size_t count) {
+  ErrorCode error;
+  return Write(bytes, count, &error);
+}
+
+bool StagingFileWriter::Write(const void* bytes,
+                              size_t count,
+                              ErrorCode* error) {
+  const uint8_t* data = static_cast<const uint8_t*>(bytes);
+  base::AutoLock lock(lock_);
+  while (true) {
+    if (failed_) {
+      *error = error_;
+      return false;
+    }
+    if (cancelled_ || stopping_) {
+      *error = ErrorCode::kDownloadWriteError;
+      return false;
+    }
+    if (count == 0)
+      return true;
+    if (size_ == buffer_.size()) {
+      space_available_.Wait();
+      continue;
+    }
+    size_t write_pos = (read_pos_ + size_) % buffer_.size();
+    size_t length = std::min(
+        {count, buffer_.size() - size_, buffer_.size() - write_pos});
+    memcpy(buffer_.data() + write_pos, data, length);
+    size_ += length;
+    data += length;
+    count -= length;
+    data_available_.Signal();
+  }
+}
+
+int StagingFileWriter::Close() {
+  StopThread();
+  return next_->Close();
+}
+
+bool StagingFileWriter::Flush(ErrorCode* error) {
+  base::AutoLock lock(lock_);
+  while (size_ > 0 && !failed_ && !cancelled_)
+    space_available_.Wait();
+  if (failed_) {
+    *error = error_;
+    return false;
+  }
+  return true;
+}
+
+void StagingFileWriter::Cancel() {
+  base::AutoLock lock(lock_);
+  cancelled_ = true;
+  data_available_.Signal();
+  space_available_.Broadcast();
+}
+
+void StagingFileWriter::Run() {
+  base::AutoLock lock(lock_);
+  while (!cancelled_ && !failed_) {
+    if (size_ == 0) {
+      if (stopping_)
+        break;
+      data_available_.Wait();
+      continue;
+    }
+    // Only the contiguous part of the staged data is written on each
+    // iteration; the rest, if any, wraps around to the start of |buffer_|.
+    const uint8_t* data = buffer_.data() + read_pos_;
+    size_t length = std::min(size_, buffer_.size() - read_pos_);
+    ErrorCode error = ErrorCode::kSuccess;
+    bool success;
+    {
+      base::AutoUnlock unlock(lock_);
+      success = next_->Write(data, length, &error);
+    }
+    read_pos_ = (read_pos_ + length) % buffer_.size();
+    size_ -= length;
+    if (!success) {
+      LOG(ERROR) << "Failed to write " << length << " staged bytes.";
+      failed_ = true;
+      // The next writer may not set an error code when it stops processing
+      // the data, use the same default error as FileWriter in that case.
+      error_ = error == ErrorCode::kSuccess ? ErrorCode::kDownloadWriteError
+                                            : error;
+    }
+    space_available_.Broadcast();
+  }
+  space_available_.Broadcast();
+}
+
+void StagingFileWriter::StopThread() {
+  if (!thread_)
+    return;
+  {
+    base::AutoLock lock(lock_);
+    stopping_ = true;
+    data_available_.Signal();
+  }
+  thread_->Join();
+  thread_.reset();
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,101 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_STAGING_FILE_WRITER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_STAGING_FILE_WRITER_H_
+
+#include <memory>
+
+#include <base/synchronization/condition_variable.h>
+#include <base/synchronization/lock.h>
+#include <base/threading/simple_thread.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/payload_consumer/file_writer.h"
+
+namespace chromeos_update_engine {
+
+// StagingFileWriter copies the data written to it into a bounded ring buffer
+// and passes it to another FileWriter from a separate thread, so the caller
+// doesn't block while the next writer is busy unless the buffer is full.
+// Errors reported by the next writer are returned by the following call to
+// Write() or Flush().
+class StagingFileWriter final : public FileWriter,
+                                public base::DelegateSimpleThread::Delegate {
+ public:
+  // Stages up to |capacity| bytes before passing them to |next|, which must
+  // outlive this object and is only used from the staging thread until
+  // Close() returns.
+  StagingFileWriter(FileWriter* next, size_t capacity);
+  ~StagingFileWriter() override;
+
+  // FileWriter overrides.
+  bool Write(const void* bytes, size_t count) override;
+  bool Write(const void* bytes, size_t count, ErrorCode* error) override;
+
+  // Writes all the staged data to the next writer, stops the staging thread
+  // and closes the next writer, returning its result.
+  int Close() override;
+
+  // Blocks until all the staged data was written to the next writer. Returns
+  // false and sets |error| if the next writer failed.
+  bool Flush(ErrorCode* error);
+
+  // Discards the staged data that wasn't passed to the next writer yet. All
+  // the following calls to Write() will fail.
+  void Cancel();
+
+  // base::DelegateSimpleThread::Delegate overrides.
+  void Run() override;
+
+ private:
+  // Stops the staging thread once it is done with the staged data, or right
+  // after the current write if Cancel() was called.
+  void StopThread();
+
+  FileWriter* next_;
+
+  // The thread passing the staged data to |next_|.
+  std::unique_ptr<base::DelegateSimpleThread> thread_;
+
+  // Protects all the members below and |buffer_| outside of the
+  // [|read_pos_|, |read_pos_| + |size_|) range being written to |next_|.
+  base::Lock lock_;
+
+  // Signaled when data is staged or the thread should stop.
+  base::ConditionVariable data_available_;
+
+  // Signaled when staged data was passed to |next_| or it failed.
+  base::ConditionVariable space_available_;
+
+  // The ring buffer and the location of the staged data in it.
+  brillo::Blob buffer_;
+  size_t read_pos_{0};
+  size_t size_{0};
+
+  bool stopping_{false};
+  bool cancelled_{false};
+
+  // Whether |next_| failed to write and the error it returned.
+  bool failed_{false};
+  ErrorCode error_{ErrorCode::kSuccess};
+
+  DISALLOW_COPY_AND_ASSIGN(StagingFileWriter);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_STAGING_FILE_WRITER_H_
@@ -0,0 +1,130 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/staging_file_writer.h"
+
+#include <string>
+
+#include <brillo/secure_blob.h>
+#include <gtest/gtest.h>
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// A FileWriter that stores all the data written to it and fails once more
+// than |fail_after| bytes were written.
+class BlobFileWriter : public FileWriter {
+ public:
+  explicit BlobFileWriter(size_t fail_after) : fail_after_(fail_after) {}
+
+  bool Write(const void* bytes, size_t count) override {
+    ErrorCode error;
+    return Write(bytes, count, &error);
+  }
+
+  bool Write(const void* bytes, size_t count, ErrorCode* error) override {
+    const uint8_t* data = static_cast<const uint8_t*>(bytes);
+    data_.insert(data_.end(), data, data + count);
+    if (data_.size() > fail_after_) {
+      *error = ErrorCode::kDownloadOperationExecutionError;
+      return false;
+    }
+    return true;
+  }
+
+  int Close() override {
+    closed_ = true;
+    return 0;
+  }
+
+  const brillo::Blob& data() const { return data_; }
+  bool closed() const { return closed_; }
+
+ private:
+  size_t fail_after_;
+  brillo::Blob data_;
+  bool closed_{false};
+};
+
+}  // namespace
+
+class StagingFileWriterTest : public ::testing::Test {};
+
+TEST(StagingFileWriterTest, WritesAllDataInOrderTest) {
+  brillo::Blob expected;
+  for (size_t i = 0; i < 1000; i++)
+    expected.push_back(static_cast<uint8_t>(i * 7));
+
+  BlobFileWriter blob_writer(expected.size());
+  // Use a capacity that doesn't divide the chunk size so the ring buffer
+  // wraps around in the middle of the writes.
+  StagingFileWriter staging_writer(&blob_writer, 64);
+  for (size_t offset = 0; offset < expected.size(); offset += 50) {
+    ErrorCode error = ErrorCode::kSuccess;
+    EXPECT_TRUE(staging_writer.Write(expected.data() + offset, 50, &error));
+    EXPECT_EQ(ErrorCode::kSuccess, error);
+  }
+  ErrorCode error = ErrorCode::kSuccess;
+  EXPECT_TRUE(staging_writer.Flush(&error));
+  EXPECT_EQ(expected, blob_writer.data());
+
+  EXPECT_EQ(0, staging_writer.Close());
+  EXPECT_TRUE(blob_writer.closed());
+}
+
+TEST(StagingFileWriterTest, CloseWritesStagedDataTest) {
+  BlobFileWriter blob_writer(10);
+  StagingFileWriter staging_writer(&blob_writer, 10);
+  EXPECT_TRUE(staging_writer.Write("test", 4));
+  EXPECT_EQ(0, staging_writer.Close());
+  const brillo::Blob& data = blob_writer.data();
+  EXPECT_EQ("test", string(data.begin(), data.end()));
+  EXPECT_TRUE(blob_writer.closed());
+}
+
+TEST(StagingFileWriterTest, ErrorIsReportedTest) {
+  BlobFileWriter blob_writer(4);
+  StagingFileWriter staging_writer(&blob_writer, 10);
+  EXPECT_TRUE(staging_writer.Write("test", 4));
+  EXPECT_TRUE(staging_writer.Write("12345", 5));
+
+  ErrorCode error = ErrorCode::kSuccess;
+  EXPECT_FALSE(staging_writer.Flush(&error));
+  EXPECT_EQ(ErrorCode::kDownloadOperationExecutionError, error);
+
+  // The following writes fail with the same error.
+  error = ErrorCode::kSuccess;
+  EXPECT_FALSE(staging_writer.Write("test", 4, &error));
+  EXPECT_EQ(ErrorCode::kDownloadOperationExecutionError, error);
+  EXPECT_EQ(0, staging_writer.Close());
+}
+
+TEST(StagingFileWriterTest, WriteFailsAfterCancelTest) {
+  BlobFileWriter blob_writer(10);
+  StagingFileWriter staging_writer(&blob_writer, 10);
+  staging_writer.Cancel();
+
+  ErrorCode error = ErrorCode::kSuccess;
+  EXPECT_FALSE(staging_writer.Write("test", 4, &error));
+  EXPECT_EQ(ErrorCode::kDownloadWriteError, error);
+  EXPECT_EQ(0, staging_writer.Close());
+  EXPECT_TRUE(blob_writer.data().empty());
+}
+
+}  // namespace chromeos_update_engine
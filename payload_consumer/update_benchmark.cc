@@ -0,0 +1,361 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+// Benchmarks of a whole update: a payload is generated on startup for each
+// image size and mix of operations, then each iteration downloads it with a
+// FileFetcher, applies it with the DownloadAction and verifies the target
+// partition with the FilesystemVerifierAction, like the UpdateAttempter does
+// after an update check. Besides the throughput, the time spent in each
+// action is reported in the "<action>_ms" counters, averaged over the
+// iterations.
+//
+// The payloads and partitions are files in --temp_dir, which can be a tmpfs
+// to leave the storage out of the measurements, or a filesystem mounted from
+// a loop device to include it.
+//
+// The results of a run can be saved with --benchmark_out=<file>
+// --benchmark_out_format=json and compared with the ones of a previous run
+// with the compare.py tool of google-benchmark.
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <base/bind.h>
+#include <base/logging.h>
+#include <base/time/time.h>
+#include <benchmark/benchmark.h>
+#include <brillo/flag_helper.h>
+#include <brillo/message_loops/base_message_loop.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/action_processor.h"
+#include "update_engine/common/constants.h"
+#include "update_engine/common/fake_boot_control.h"
+#include "update_engine/common/fake_hardware.h"
+#include "update_engine/common/fake_prefs.h"
+#include "update_engine/common/file_fetcher.h"
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/download_action.h"
+#include "update_engine/payload_consumer/filesystem_verifier_action.h"
+#include "update_engine/payload_consumer/install_plan.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/fake_filesystem.h"
+#include "update_engine/payload_generator/payload_generation_config.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The size of the files of the generated filesystems.
+const size_t kFileSize = 1024 * 1024;  // 1 MiB
+const size_t kFileBlocks = kFileSize / 4096;
+
+const char kPartitionName[] = "system";
+
+// The operations the payloads are made of.
+enum class OperationMix {
+  // A full payload, made of REPLACE_* operations.
+  kFull = 0,
+  // A delta payload generated with GenerationProfile::kFast, mostly made of
+  // SOURCE_COPY and REPLACE_* operations.
+  kDeltaFast = 1,
+  // A delta payload generated with GenerationProfile::kMax, mostly made of
+  // SOURCE_COPY and *DIFF operations.
+  kDeltaMax = 2,
+};
+
+// Set from the command line before running the benchmarks. The files are
+// created in |temp_dir|, or in the default temporary directory if empty.
+string temp_dir;
+
+// Generates |size| bytes of data that compress about as well as a filesystem
+// image: half of the blocks are random and the other half repeat a short
+// text.
+brillo::Blob GenerateImage(size_t size, uint32_t seed) {
+  std::mt19937 rng(seed);
+  brillo::Blob image(size);
+  for (size_t offset = 0; offset < size; offset += kBlockSize) {
+    const size_t block_end = std::min(size, offset + kBlockSize);
+    if (rng() % 2) {
+      for (size_t i = offset; i < block_end; i++)
+        image[i] = static_cast<uint8_t>(rng());
+    } else {
+      const string text = "block " + std::to_string(offset / kBlockSize) +
+                          " of the generated image\n";
+      for (size_t i = offset; i < block_end; i++)
+        image[i] = text[(i - offset) % text.size()];
+    }
+  }
+  return image;
+}
+
+// Returns a copy of |image| where a few bytes of one out of eight blocks were
+// changed, like an image built from slightly different sources.
+brillo::Blob MutateImage(const brillo::Blob& image, uint32_t seed) {
+  std::mt19937 rng(seed);
+  brillo::Blob mutated = image;
+  for (size_t offset = 0; offset + kBlockSize <= mutated.size();
+       offset += kBlockSize) {
+    if (rng() % 8)
+      continue;
+    const size_t start = offset + rng() % (kBlockSize - 16);
+    for (size_t i = start; i < start + 16; i++)
+      mutated[i] = static_cast<uint8_t>(rng());
+  }
+  return mutated;
+}
+
+// Creates a temporary file with the |data| and returns its path. The file is
+// removed when the benchmark exits.
+string CreateTempFile(const brillo::Blob& data) {
+  static vector<std::unique_ptr<ScopedPathUnlinker>> unlinkers;
+  string path;
+  const string pattern = "UpdateBenchmark-XXXXXX";
+  CHECK(utils::MakeTempFile(
+      temp_dir.empty() ? pattern : temp_dir + "/" + pattern, &path, nullptr));
+  unlinkers.push_back(std::make_unique<ScopedPathUnlinker>(path));
+  CHECK(utils::WriteFile(path.c_str(), data.data(), data.size()));
+  return path;
+}
+
+// Sets up the |part| config of the partition image of |size| bytes at |path|,
+// with a filesystem made of files of |kFileSize| bytes.
+void InitPartitionConfig(const string& path,
+                         size_t size,
+                         PartitionConfig* part) {
+  part->path = path;
+  part->size = size;
+  const uint64_t num_blocks = size / kBlockSize;
+  auto fs = std::make_unique<FakeFilesystem>(kBlockSize, num_blocks);
+  for (uint64_t block = 0; block + kFileBlocks <= num_blocks;
+       block += kFileBlocks) {
+    fs->AddFile("/file" + std::to_string(block / kFileBlocks),
+                {ExtentForRange(block, kFileBlocks)});
+  }
+  part->fs_interface = std::move(fs);
+}
+
+// A payload updating the |source_path| partition, if any, to the new image.
+struct UpdatePayload {
+  string path;
+  uint64_t size{0};
+  uint64_t metadata_size{0};
+  brillo::Blob hash;
+  string source_path;
+  string target_path;
+};
+
+// Returns the payload for images of |image_size| bytes and the operations of
+// |mix|, generating it the first time.
+const UpdatePayload& GetUpdatePayload(size_t image_size, OperationMix mix) {
+  static std::map<std::pair<size_t, OperationMix>,
+                  std::unique_ptr<UpdatePayload>>
+      payloads;
+  std::unique_ptr<UpdatePayload>& payload = payloads[{image_size, mix}];
+  if (payload)
+    return *payload;
+
+  payload = std::make_unique<UpdatePayload>();
+  const brillo::Blob old_image = GenerateImage(image_size, 1);
+  const string new_image_path = CreateTempFile(MutateImage(old_image, 2));
+  payload->target_path = CreateTempFile(brillo::Blob(image_size));
+
+  PayloadGenerationConfig config;
+  config.version.major = kBrilloMajorPayloadVersion;
+  config.version.minor = kFullPayloadMinorVersion;
+  config.hard_chunk_size = kFileSize;
+  if (mix != OperationMix::kFull) {
+    payload->source_path = CreateTempFile(old_image);
+    config.is_delta = true;
+    config.version.minor = kMaxSupportedMinorPayloadVersion;
+    config.profile = mix == OperationMix::kDeltaFast ? GenerationProfile::kFast
+                                                     : GenerationProfile::kMax;
+    config.source.partitions.emplace_back(kPartitionName);
+    InitPartitionConfig(
+        payload->source_path, image_size, &config.source.partitions.back());
+  }
+  config.target.partitions.emplace_back(kPartitionName);
+  InitPartitionConfig(
+      new_image_path, image_size, &config.target.partitions.back());
+  CHECK(config.Validate());
+
+  payload->path = CreateTempFile(brillo::Blob());
+  CHECK(GenerateUpdatePayloadFile(
+      config, payload->path, "", &payload->metadata_size));
+  payload->size = utils::FileSize(payload->path);
+  CHECK_EQ(static_cast<off_t>(payload->size),
+           HashCalculator::RawHashOfFile(
+               payload->path, payload->size, &payload->hash));
+  return *payload;
+}
+
+// Stops the message loop once all the actions completed, and adds the time
+// each action took to |action_times_|.
+class UpdateProcessorDelegate : public ActionProcessorDelegate {
+ public:
+  explicit UpdateProcessorDelegate(std::map<string, base::TimeDelta>* times)
+      : action_times_(times) {}
+
+  void ProcessingDone(const ActionProcessor* processor,
+                      ErrorCode code) override {
+    code_ = code;
+    brillo::MessageLoop::current()->BreakLoop();
+  }
+
+  void ActionCompleted(ActionProcessor* processor,
+                       AbstractAction* action,
+                       ErrorCode code) override {
+    const base::TimeTicks now = base::TimeTicks::Now();
+    (*action_times_)[action->Type()] += now - last_completion_;
+    last_completion_ = now;
+  }
+
+  void Start() { last_completion_ = base::TimeTicks::Now(); }
+
+  ErrorCode code() const { return code_; }
+
+ private:
+  std::map<string, base::TimeDelta>* action_times_;
+  base::TimeTicks last_completion_;
+  ErrorCode code_{ErrorCode::kError};
+};
+
+// Downloads, applies and verifies the payload for images of |state.range(0)|
+// MiB and the OperationMix in |state.range(1)|, as many times as needed by
+// |state|.
+void BM_Update(benchmark::State& state) {
+  const size_t image_size = state.range(0) * kNumBytesInOneMiB;
+  const OperationMix mix = static_cast<OperationMix>(state.range(1));
+  const UpdatePayload& payload = GetUpdatePayload(image_size, mix);
+
+  brillo::BaseMessageLoop loop;
+  loop.SetAsCurrent();
+  InstallPlan install_plan;
+  install_plan.download_url = "file://" + payload.path;
+  install_plan.target_slot = 1;
+  install_plan.source_slot = payload.source_path.empty()
+                                 ? BootControlInterface::kInvalidSlot
+                                 : 0;
+  InstallPlan::Payload install_payload;
+  install_payload.size = payload.size;
+  install_payload.metadata_size = payload.metadata_size;
+  install_payload.hash = payload.hash;
+  install_payload.type = payload.source_path.empty()
+                             ? InstallPayloadType::kFull
+                             : InstallPayloadType::kDelta;
+  install_plan.payloads.push_back(install_payload);
+
+  std::map<string, base::TimeDelta> action_times;
+  while (state.KeepRunning()) {
+    FakePrefs prefs;
+    FakeBootControl boot_control;
+    FakeHardware hardware;
+    if (!payload.source_path.empty()) {
+      boot_control.SetPartitionDevice(
+          kPartitionName, install_plan.source_slot, payload.source_path);
+    }
+    boot_control.SetPartitionDevice(
+        kPartitionName, install_plan.target_slot, payload.target_path);
+
+    ActionProcessor processor;
+    UpdateProcessorDelegate delegate(&action_times);
+    processor.set_delegate(&delegate);
+    auto install_plan_action =
+        std::make_unique<InstallPlanAction>(install_plan);
+    auto download_action =
+        std::make_unique<DownloadAction>(&prefs,
+                                         &boot_control,
+                                         &hardware,
+                                         nullptr,  // system_state
+                                         new FileFetcher(),
+                                         true);  // interactive
+    auto verifier_action = std::make_unique<FilesystemVerifierAction>();
+    BondActions(install_plan_action.get(), download_action.get());
+    BondActions(download_action.get(), verifier_action.get());
+    processor.EnqueueAction(std::move(install_plan_action));
+    processor.EnqueueAction(std::move(download_action));
+    processor.EnqueueAction(std::move(verifier_action));
+    delegate.Start();
+    loop.PostTask(FROM_HERE,
+                  base::Bind(&ActionProcessor::StartProcessing,
+                             base::Unretained(&processor)));
+    loop.Run();
+    CHECK(delegate.code() == ErrorCode::kSuccess);
+  }
+
+  state.SetBytesProcessed(state.iterations() * image_size);
+  state.counters["payload_bytes"] = payload.size;
+  if (state.iterations() > 0) {
+    for (const auto& it : action_times) {
+      state.counters[it.first + "_ms"] =
+          it.second.InMillisecondsF() / state.iterations();
+    }
+  }
+}
+BENCHMARK(BM_Update)
+    ->ArgNames({"image_mib", "mix"})
+    ->Apply([](benchmark::internal::Benchmark* benchmark) {
+      for (int image_mib : {16, 64, 256}) {
+        for (OperationMix mix : {OperationMix::kFull,
+                                 OperationMix::kDeltaFast,
+                                 OperationMix::kDeltaMax}) {
+          benchmark->Args({image_mib, static_cast<int>(mix)});
+        }
+      }
+    })
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+}  // namespace
+
+}  // namespace chromeos_update_engine
+
+int main(int argc, char** argv) {
+  // Remove the --benchmark_* flags before parsing ours.
+  benchmark::Initialize(&argc, argv);
+  DEFINE_string(temp_dir,
+                "",
+                "The directory of the generated payloads and partitions, like "
+                "a tmpfs or a loop device mount. Defaults to the temporary "
+                "directory.");
+  brillo::FlagHelper::Init(
+      argc,
+      argv,
+      "Benchmarks the download, application and verification of whole "
+      "updates.\n\n"
+      "The --benchmark_* flags of google-benchmark are also supported. Use "
+      "--benchmark_out=<file> --benchmark_out_format=json to save the "
+      "results.");
+  chromeos_update_engine::temp_dir = FLAGS_temp_dir;
+
+  // The payload generator and the actions log every file and operation.
+  logging::SetMinLogLevel(logging::LOG_WARNING);
+
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
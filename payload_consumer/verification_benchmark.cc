@@ -0,0 +1,364 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Benchmarks of the verification of the target partitions: the SHA-256 of the
+// HashCalculator, the FilesystemVerifierAction reading and hashing a partition
+// and the verity hash tree and FEC written by the VerityWriter. Besides the
+// throughput, each benchmark reports the CPU time used by all the threads of
+// the process per byte in the "cpu_ns_per_byte" counter.
+//
+// The partition is a file of --image_size_mib MiB generated in --temp_dir,
+// which can be a tmpfs to leave the storage out of the measurements. The
+// FilesystemVerifierAction benchmarks can also read an existing file or block
+// device passed in --device, which is never written.
+//
+// The results of a run can be saved with --benchmark_out=<file>
+// --benchmark_out_format=json and compared with the ones of a previous run
+// with the compare.py tool of google-benchmark.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <base/bind.h>
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+#include <benchmark/benchmark.h>
+#include <brillo/flag_helper.h>
+#include <brillo/message_loops/base_message_loop.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/action_processor.h"
+#include "update_engine/common/constants.h"
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/filesystem_verifier_action.h"
+#include "update_engine/payload_consumer/install_plan.h"
+#include "update_engine/payload_consumer/verity_writer_interface.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+const uint32_t kBlockSize = 4096;
+
+// The size of the buffers passed to the HashCalculator and the VerityWriter,
+// like the operations written by the DeltaPerformer.
+const size_t kChunkSize = 1024 * 1024;  // 1 MiB
+
+// The verity settings of the Android partitions.
+const char kHashTreeAlgorithm[] = "sha256";
+const size_t kHashTreeDigestSize = 32;
+const uint32_t kFecRoots = 2;
+// The number of bytes of each rs block, the M in RS(M, N) of libfec.
+const uint64_t kFecRsm = 255;
+
+const char kPartitionName[] = "system";
+
+// Set from the command line before running the benchmarks. |image_size| is a
+// multiple of |kChunkSize| and the files are created in |temp_dir|, or in the
+// default temporary directory if empty. The FilesystemVerifierAction reads
+// |device| instead of a generated file if not empty.
+size_t image_size = 0;
+string temp_dir;
+string device;
+
+// Generates |size| bytes of random data.
+brillo::Blob GenerateData(size_t size, uint32_t seed) {
+  std::mt19937 rng(seed);
+  brillo::Blob data(size);
+  for (uint8_t& byte : data)
+    byte = static_cast<uint8_t>(rng());
+  return data;
+}
+
+// Returns the data of the generated partitions.
+const brillo::Blob& GetPartitionData() {
+  static const brillo::Blob* data =
+      new brillo::Blob(GenerateData(image_size, 1));
+  return *data;
+}
+
+// Creates a temporary file with the |data| and returns its path. The file is
+// removed when the benchmark exits.
+string CreateTempFile(const brillo::Blob& data) {
+  static vector<std::unique_ptr<ScopedPathUnlinker>> unlinkers;
+  string path;
+  const string pattern = "VerificationBenchmark-XXXXXX";
+  CHECK(utils::MakeTempFile(
+      temp_dir.empty() ? pattern : temp_dir + "/" + pattern, &path, nullptr));
+  unlinkers.push_back(std::make_unique<ScopedPathUnlinker>(path));
+  CHECK(utils::WriteFile(path.c_str(), data.data(), data.size()));
+  return path;
+}
+
+// Returns the CPU time used by all the threads of the process, in
+// nanoseconds.
+int64_t ProcessCpuTimeNs() {
+  struct timespec now;
+  CHECK_EQ(0, clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now));
+  return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+// Reports the throughput of |state| and the CPU time per byte, given the
+// |bytes| processed by each iteration and the |cpu_time_ns| of all of them.
+void SetThroughputCounters(benchmark::State& state,
+                           size_t bytes,
+                           int64_t cpu_time_ns) {
+  state.SetBytesProcessed(state.iterations() * bytes);
+  if (state.iterations() > 0) {
+    state.counters["cpu_ns_per_byte"] =
+        static_cast<double>(cpu_time_ns) / (state.iterations() * bytes);
+  }
+}
+
+// Drops the pages of the file at |path| from the page cache, so they are read
+// again from the storage.
+void DropPageCache(const string& path) {
+  int fd = HANDLE_EINTR(open(path.c_str(), O_RDONLY));
+  PCHECK(fd >= 0) << "Unable to open " << path;
+  PCHECK(fdatasync(fd) == 0 || errno == EINVAL);
+  PCHECK(posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0);
+  IGNORE_EINTR(close(fd));
+}
+
+void BM_HashCalculator(benchmark::State& state) {
+  const brillo::Blob& data = GetPartitionData();
+  int64_t cpu_time_ns = 0;
+  while (state.KeepRunning()) {
+    const int64_t start = ProcessCpuTimeNs();
+    HashCalculator hasher;
+    for (size_t offset = 0; offset < data.size(); offset += kChunkSize)
+      CHECK(hasher.Update(data.data() + offset, kChunkSize));
+    CHECK(hasher.Finalize());
+    cpu_time_ns += ProcessCpuTimeNs() - start;
+  }
+  SetThroughputCounters(state, image_size, cpu_time_ns);
+}
+BENCHMARK(BM_HashCalculator)->Unit(benchmark::kMillisecond);
+
+// The partition read by the FilesystemVerifierAction and its expected hash.
+struct VerifiedPartition {
+  string path;
+  brillo::Blob hash;
+};
+
+const VerifiedPartition& GetVerifiedPartition() {
+  static const VerifiedPartition* partition = [] {
+    auto verified_partition = new VerifiedPartition;
+    if (device.empty()) {
+      const brillo::Blob& data = GetPartitionData();
+      verified_partition->path = CreateTempFile(data);
+      CHECK(HashCalculator::RawHashOfData(data, &verified_partition->hash));
+    } else {
+      verified_partition->path = device;
+      CHECK_EQ(static_cast<off_t>(image_size),
+               HashCalculator::RawHashOfFile(
+                   device, image_size, &verified_partition->hash))
+          << device << " is smaller than --image_size_mib.";
+    }
+    return verified_partition;
+  }();
+  return *partition;
+}
+
+// Stops the message loop once the FilesystemVerifierAction completed.
+class VerifierProcessorDelegate : public ActionProcessorDelegate {
+ public:
+  void ProcessingDone(const ActionProcessor* processor,
+                      ErrorCode code) override {
+    code_ = code;
+    brillo::MessageLoop::current()->BreakLoop();
+  }
+
+  ErrorCode code() const { return code_; }
+
+ private:
+  ErrorCode code_{ErrorCode::kError};
+};
+
+// Verifies the partition reading |state.range(0)| KiB at a time, or the
+// default read size of the FilesystemVerifierAction if 0. The page cache is dropped before each iteration if |state.range(1)| is not 0.
+void BM_FilesystemVerifierAction(benchmark::State& state) {
+  const VerifiedPartition& verified_partition = GetVerifiedPartition();
+  const size_t read_size = state.range(0) * 1024;
+  const bool cold_cache = state.range(1) != 0;
+
+  brillo::BaseMessageLoop loop;
+  loop.SetAsCurrent();
+  InstallPlan install_plan;
+  InstallPlan::Partition partition;
+  partition.name = kPartitionName;
+  partition.target_path = verified_partition.path;
+  partition.target_size = image_size;
+  partition.target_hash = verified_partition.hash;
+  install_plan.partitions.push_back(partition);
+
+  int64_t cpu_time_ns = 0;
+  while (state.KeepRunning()) {
+    if (cold_cache) {
+      state.PauseTiming();
+      DropPageCache(verified_partition.path);
+      state.ResumeTiming();
+    }
+    const int64_t start = ProcessCpuTimeNs();
+    ActionProcessor processor;
+    VerifierProcessorDelegate delegate;
+    processor.set_delegate(&delegate);
+    auto install_plan_action =
+        std::make_unique<InstallPlanAction>(install_plan);
+    auto verifier_action = std::make_unique<FilesystemVerifierAction>();
+    verifier_action->set_read_size(read_size);
+    BondActions(install_plan_action.get(), verifier_action.get());
+    processor.EnqueueAction(std::move(install_plan_action));
+    processor.EnqueueAction(std::move(verifier_action));
+    loop.PostTask(FROM_HERE,
+                  base::Bind(&ActionProcessor::StartProcessing,
+                             base::Unretained(&processor)));
+    loop.Run();
+    CHECK(delegate.code() == ErrorCode::kSuccess);
+    cpu_time_ns += ProcessCpuTimeNs() - start;
+  }
+  SetThroughputCounters(state, image_size, cpu_time_ns);
+}
+BENCHMARK(BM_FilesystemVerifierAction)
+    ->ArgNames({"read_kib", "cold_cache"})
+    ->Args({0, 0})
+    ->Args({0, 1})
+    ->Args({1024, 1})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// Returns the size of the SHA-256 hash tree of |data_size| bytes, like the
+// HashTreeBuilder::CalculateSize() of libverity_tree.
+uint64_t HashTreeSize(uint64_t data_size) {
+  const uint64_t hashes_per_block = kBlockSize / kHashTreeDigestSize;
+  uint64_t level_blocks = utils::DivRoundUp(data_size, kBlockSize);
+  uint64_t tree_blocks = 0;
+  do {
+    level_blocks = utils::DivRoundUp(level_blocks, hashes_per_block);
+    tree_blocks += level_blocks;
+  } while (level_blocks > 1);
+  return tree_blocks * kBlockSize;
+}
+
+// Returns the size of the FEC of |data_size| bytes.
+uint64_t FecSize(uint64_t data_size) {
+  return utils::DivRoundUp(data_size / kBlockSize, kFecRsm - kFecRoots) *
+         kFecRoots * kBlockSize;
+}
+
+// Passes the partition data to a new VerityWriter as many times as needed by
+// |state|. The |partition| is backed by a temporary file with the data
+// followed by enough space for the hash tree and the FEC.
+void RunVerityWriterBenchmark(benchmark::State& state,
+                              InstallPlan::Partition* partition) {
+  const brillo::Blob& data = GetPartitionData();
+  brillo::Blob partition_data = data;
+  partition_data.resize(
+      image_size + HashTreeSize(image_size) + FecSize(image_size));
+  partition->name = kPartitionName;
+  partition->target_path = CreateTempFile(partition_data);
+  partition->target_size = image_size;
+  partition->block_size = kBlockSize;
+
+  int64_t cpu_time_ns = 0;
+  while (state.KeepRunning()) {
+    const int64_t start = ProcessCpuTimeNs();
+    std::unique_ptr<VerityWriterInterface> verity_writer =
+        verity_writer::CreateVerityWriter();
+    if (!verity_writer->Init(*partition, nullptr)) {
+      state.SkipWithError("Verity is not supported in this build.");
+      break;
+    }
+    for (size_t offset = 0; offset < data.size(); offset += kChunkSize)
+      CHECK(verity_writer->Update(offset, data.data() + offset, kChunkSize));
+    cpu_time_ns += ProcessCpuTimeNs() - start;
+  }
+  SetThroughputCounters(state, image_size, cpu_time_ns);
+}
+
+void BM_VerityHashTree(benchmark::State& state) {
+  InstallPlan::Partition partition;
+  partition.hash_tree_data_offset = 0;
+  partition.hash_tree_data_size = image_size;
+  partition.hash_tree_offset = image_size;
+  partition.hash_tree_size = HashTreeSize(image_size);
+  partition.hash_tree_algorithm = kHashTreeAlgorithm;
+  RunVerityWriterBenchmark(state, &partition);
+}
+BENCHMARK(BM_VerityHashTree)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// The FEC is encoded from the data read again from the partition once it was
+// all written.
+void BM_VerityFec(benchmark::State& state) {
+  InstallPlan::Partition partition;
+  partition.fec_data_offset = 0;
+  partition.fec_data_size = image_size;
+  partition.fec_offset = image_size + HashTreeSize(image_size);
+  partition.fec_size = FecSize(image_size);
+  partition.fec_roots = kFecRoots;
+  RunVerityWriterBenchmark(state, &partition);
+}
+BENCHMARK(BM_VerityFec)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+}  // namespace
+
+}  // namespace chromeos_update_engine
+
+int main(int argc, char** argv) {
+  // Remove the --benchmark_* flags before parsing ours.
+  benchmark::Initialize(&argc, argv);
+  DEFINE_int32(image_size_mib, 64, "The size of the partition, in MiB.");
+  DEFINE_string(temp_dir,
+                "",
+                "The directory of the generated partitions, like a tmpfs "
+                "mount. Defaults to the temporary directory.");
+  DEFINE_string(device,
+                "",
+                "A file or block device read by the FilesystemVerifierAction "
+                "benchmarks instead of a generated partition. Only its first "
+                "--image_size_mib MiB are read.");
+  brillo::FlagHelper::Init(
+      argc,
+      argv,
+      "Benchmarks the verification of the target partitions.\n\n"
+      "The --benchmark_* flags of google-benchmark are also supported. Use "
+      "--benchmark_out=<file> --benchmark_out_format=json to save the "
+      "results.");
+  CHECK_GT(FLAGS_image_size_mib, 0);
+  chromeos_update_engine::image_size =
+      static_cast<size_t>(FLAGS_image_size_mib) *
+      chromeos_update_engine::kNumBytesInOneMiB;
+  chromeos_update_engine::temp_dir = FLAGS_temp_dir;
+  chromeos_update_engine::device = FLAGS_device;
+
+  // The FilesystemVerifierAction and the VerityWriter log every partition.
+  logging::SetMinLogLevel(logging::LOG_WARNING);
+
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
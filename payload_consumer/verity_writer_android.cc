@@ -17,34 +17,250 @@
 #include "update_engine/payload_consumer/verity_writer_android.h"
 
 #include <fcntl.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <memory>
+#include <string>
+#include <vector>
 
+#include <base/bind.h>
 #include <base/logging.h>
 #include <base/posix/eintr_wrapper.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/string_split.h>
+#include <base/strings/string_util.h>
+#include <base/synchronization/lock.h>
+#include <base/sys_info.h>
+#include <base/threading/simple_thread.h>
 #include <fec/ecc.h>
 extern "C" {
 #include <fec.h>
 }
 
+#include "update_engine/common/constants.h"
 #include "update_engine/common/utils.h"
 
+using std::string;
+using std::vector;
+
 namespace chromeos_update_engine {
 
+namespace {
+
+// The maximum number of threads encoding the FEC of a partition.
+const int kMaxFECThreads = 8;
+
+// The maximum number of consecutive rounds of rs blocks each thread reads and
+// encodes at once.
+const uint64_t kMaxFECBatchRounds = 4;
+
+// The number of rounds of rs blocks whose FEC is written between the updates
+// of the persisted progress. Each round covers about 1 MiB of data for 4K
+// blocks.
+const uint64_t kFECCheckpointRounds = 256;
+
+// Protects the progress of all the partitions in kPrefsVerityProgress, which
+// are written from the threads hashing the partitions.
+base::Lock* VerityProgressLock() {
+  static auto* lock = new base::Lock;
+  return lock;
+}
+
+// Returns the lines of the persisted progress, one per partition, as
+// "<partition> <hash tree written> <FEC rounds written>".
+vector<string> LoadProgressLines(PrefsInterface* prefs) {
+  string progress;
+  if (!prefs->GetString(kPrefsVerityProgress, &progress))
+    return {};
+  return base::SplitString(
+      progress, "\n", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY);
+}
+
+// The parameters of EncodeFEC() shared by all the threads encoding the FEC of
+// a partition. |fd| is opened on the partition.
+struct FECParams {
+  int fd;
+  uint64_t data_offset;
+  uint64_t data_size;
+  uint64_t fec_offset;
+  uint32_t fec_roots;
+  uint32_t block_size;
+  uint64_t rounds;
+  bool verify_mode;
+};
+
+// Encodes, or verifies if |params.verify_mode|, the FEC of the rounds in
+// [|first_round|, |end_round|).
+bool EncodeFECRounds(const FECParams& params,
+                     uint64_t first_round,
+                     uint64_t end_round) {
+  const uint32_t block_size = params.block_size;
+  const uint32_t fec_roots = params.fec_roots;
+  // This is the N in RS(M, N), which is the number of bytes for each rs block.
+  size_t rs_n = FEC_RSM - fec_roots;
+
+  std::unique_ptr<void, decltype(&free_rs_char)> rs_char(
+      init_rs_char(FEC_PARAMS(fec_roots)), &free_rs_char);
+  TEST_AND_RETURN_FALSE(rs_char != nullptr);
+
+  // Encodes |block_size| number of rs blocks each round so that we can read
+  // one block each time instead of 1 byte to increase random read
+  // performance. The data blocks of consecutive rounds are consecutive in
+  // each of the |rs_n| interleaved stripes, so up to |kMaxFECBatchRounds|
+  // rounds are read with a single read per stripe and their FEC is written
+  // at once. This uses about 4 MiB memory for 4K block size.
+  const uint64_t max_batch_rounds =
+      std::min(kMaxFECBatchRounds, end_round - first_round);
+  brillo::Blob stripes(max_batch_rounds * block_size * rs_n);
+  brillo::Blob rs_blocks(block_size * rs_n);
+  brillo::Blob fec(max_batch_rounds * block_size * fec_roots);
+  brillo::Blob fec_read;
+  ScopedMemoryTracker memory(MemoryCategory::kVerity,
+                             stripes.size() + rs_blocks.size() + fec.size());
+  for (uint64_t first = first_round; first < end_round;) {
+    const uint64_t batch_rounds = std::min(max_batch_rounds, end_round - first);
+    const size_t stripe_size = batch_rounds * block_size;
+    for (size_t j = 0; j < rs_n; j++) {
+      uint8_t* stripe = stripes.data() + j * stripe_size;
+      uint64_t offset = fec_ecc_interleave(
+          first * rs_n * block_size + j, rs_n, params.rounds);
+      // Don't read past |data_size|, treat them as 0.
+      size_t bytes_to_read = 0;
+      if (offset < params.data_size) {
+        bytes_to_read = std::min(static_cast<uint64_t>(stripe_size),
+                                 params.data_size - offset);
+        ssize_t bytes_read = 0;
+        TEST_AND_RETURN_FALSE(utils::PReadAll(params.fd,
+                                              stripe,
+                                              bytes_to_read,
+                                              params.data_offset + offset,
+                                              &bytes_read));
+        TEST_AND_RETURN_FALSE(bytes_read ==
+                              static_cast<ssize_t>(bytes_to_read));
+      }
+      std::fill(stripe + bytes_to_read, stripe + stripe_size, 0);
+    }
+
+    for (uint64_t r = 0; r < batch_rounds; r++) {
+      for (size_t j = 0; j < rs_n; j++) {
+        const uint8_t* block =
+            stripes.data() + j * stripe_size + r * block_size;
+        for (size_t k = 0; k < block_size; k++) {
+          rs_blocks[k * rs_n + j] = block[k];
+        }
+      }
+      uint8_t* round_fec = fec.data() + r * block_size * fec_roots;
+      for (size_t j = 0; j < block_size; j++) {
+        // Encode [j * rs_n : (j + 1) * rs_n) in |rs_blocks| and write
+        // |fec_roots| number of parity bytes to |j * fec_roots| in the FEC of
+        // the round.
+        encode_rs_char(rs_char.get(),
+                       rs_blocks.data() + j * rs_n,
+                       round_fec + j * fec_roots);
+      }
+    }
+
+    const uint64_t fec_offset =
+        params.fec_offset + first * block_size * fec_roots;
+    const size_t batch_fec_size = batch_rounds * block_size * fec_roots;
+    if (params.verify_mode) {
+      fec_read.resize(batch_fec_size);
+      ssize_t bytes_read = 0;
+      TEST_AND_RETURN_FALSE(utils::PReadAll(params.fd,
+                                            fec_read.data(),
+                                            fec_read.size(),
+                                            fec_offset,
+                                            &bytes_read));
+      TEST_AND_RETURN_FALSE(bytes_read ==
+                            static_cast<ssize_t>(fec_read.size()));
+      TEST_AND_RETURN_FALSE(
+          std::equal(fec_read.begin(), fec_read.end(), fec.begin()));
+    } else {
+      TEST_AND_RETURN_FALSE(
+          utils::PWriteAll(params.fd, fec.data(), batch_fec_size, fec_offset));
+    }
+    first += batch_rounds;
+  }
+  return true;
+}
+
+// Runs EncodeFECRounds() on a worker thread.
+class FECEncodeJob : public base::DelegateSimpleThread::Delegate {
+ public:
+  FECEncodeJob(const FECParams* params,
+               uint64_t first_round,
+               uint64_t end_round)
+      : params_(params), first_round_(first_round), end_round_(end_round) {}
+
+  // base::DelegateSimpleThread::Delegate overrides.
+  void Run() override {
+    success_ = EncodeFECRounds(*params_, first_round_, end_round_);
+  }
+
+  bool success() const { return success_; }
+
+ private:
+  const FECParams* params_;
+  uint64_t first_round_;
+  uint64_t end_round_;
+  bool success_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(FECEncodeJob);
+};
+
+// Encodes, or verifies, the FEC of the rounds in [|first_round|,
+// |end_round|), split in contiguous ranges encoded on several threads.
+bool EncodeFECRoundsInParallel(const FECParams& params,
+                               uint64_t first_round,
+                               uint64_t end_round) {
+  // The rounds are independent, and each thread reads and writes with its
+  // own offsets.
+  const uint64_t rounds = end_round - first_round;
+  const uint64_t num_threads =
+      std::min(rounds,
+               static_cast<uint64_t>(std::min(
+                   std::max(base::SysInfo::NumberOfProcessors(), 1),
+                   kMaxFECThreads)));
+  if (num_threads <= 1)
+    return EncodeFECRounds(params, first_round, end_round);
+
+  std::vector<std::unique_ptr<FECEncodeJob>> jobs;
+  for (uint64_t i = 0; i < num_threads; i++) {
+    jobs.emplace_back(
+        new FECEncodeJob(&params,
+                         first_round + rounds * i / num_threads,
+                         first_round + rounds * (i + 1) / num_threads));
+  }
+  base::DelegateSimpleThreadPool thread_pool("verity-fec", num_threads);
+  thread_pool.Start();
+  for (const auto& job : jobs)
+    thread_pool.AddWork(job.get());
+  thread_pool.JoinAll();
+
+  for (const auto& job : jobs)
+    TEST_AND_RETURN_FALSE(job->success());
+  return true;
+}
+
+}  // namespace
+
 namespace verity_writer {
 std::unique_ptr<VerityWriterInterface> CreateVerityWriter() {
   return std::make_unique<VerityWriterAndroid>();
 }
 }  // namespace verity_writer
 
-bool VerityWriterAndroid::Init(const InstallPlan::Partition& partition) {
+bool VerityWriterAndroid::Init(const InstallPlan::Partition& partition,
+                               PrefsInterface* prefs) {
   partition_ = &partition;
+  prefs_ = prefs;
+  LoadProgress();
 
   if (partition_->hash_tree_size != 0 || partition_->fec_size != 0) {
     utils::SetBlockDeviceReadOnly(partition_->target_path, false);
   }
-  if (partition_->hash_tree_size != 0) {
+  if (partition_->hash_tree_size != 0 && !hash_tree_written_) {
     auto hash_function =
         HashTreeBuilder::HashFunction(partition_->hash_tree_algorithm);
     if (hash_function == nullptr) {
@@ -64,6 +280,7 @@ bool VerityWriterAndroid::Init(const InstallPlan::Partition& partition) {
                         partition_->hash_tree_data_size);
       return false;
     }
+    hash_tree_memory_.Resize(partition_->hash_tree_size);
   }
   return true;
 }
@@ -71,7 +288,7 @@ bool VerityWriterAndroid::Init(const InstallPlan::Partition& partition) {
 bool VerityWriterAndroid::Update(uint64_t offset,
                                  const uint8_t* buffer,
                                  size_t size) {
-  if (partition_->hash_tree_size != 0) {
+  if (hash_tree_builder_) {
     uint64_t hash_tree_data_end =
         partition_->hash_tree_data_offset + partition_->hash_tree_data_size;
     uint64_t start_offset = std::max(offset, partition_->hash_tree_data_offset);
@@ -95,6 +312,12 @@ bool VerityWriterAndroid::Update(uint64_t offset,
         TEST_AND_RETURN_FALSE(hash_tree_builder_->WriteHashTreeToFd(
             fd, partition_->hash_tree_offset));
         hash_tree_builder_.reset();
+        hash_tree_memory_.Resize(0);
+        if (prefs_) {
+          TEST_AND_RETURN_FALSE_ERRNO(fsync(fd) == 0);
+          hash_tree_written_ = true;
+          StoreProgress();
+        }
       }
     }
   }
@@ -103,14 +326,21 @@ bool VerityWriterAndroid::Update(uint64_t offset,
         partition_->fec_data_offset + partition_->fec_data_size;
     if (offset < fec_data_end && offset + size >= fec_data_end) {
       LOG(INFO) << "Writing verity FEC to " << partition_->target_path;
-      TEST_AND_RETURN_FALSE(EncodeFEC(partition_->target_path,
-                                      partition_->fec_data_offset,
-                                      partition_->fec_data_size,
-                                      partition_->fec_offset,
-                                      partition_->fec_size,
-                                      partition_->fec_roots,
-                                      partition_->block_size,
-                                      false /* verify_mode */));
+      FECProgressCallback progress;
+      if (prefs_) {
+        progress = base::Bind(&VerityWriterAndroid::OnFECProgress,
+                              base::Unretained(this));
+      }
+      TEST_AND_RETURN_FALSE(EncodeFECFromRound(partition_->target_path,
+                                               partition_->fec_data_offset,
+                                               partition_->fec_data_size,
+                                               partition_->fec_offset,
+                                               partition_->fec_size,
+                                               partition_->fec_roots,
+                                               partition_->block_size,
+                                               false /* verify_mode */,
+                                               fec_rounds_written_,
+                                               progress));
     }
   }
   return true;
@@ -124,16 +354,43 @@ bool VerityWriterAndroid::EncodeFEC(const std::string& path,
                                     uint32_t fec_roots,
                                     uint32_t block_size,
                                     bool verify_mode) {
+  return EncodeFECFromRound(path,
+                            data_offset,
+                            data_size,
+                            fec_offset,
+                            fec_size,
+                            fec_roots,
+                            block_size,
+                            verify_mode,
+                            0,
+                            FECProgressCallback());
+}
+
+bool VerityWriterAndroid::EncodeFECFromRound(
+    const string& path,
+    uint64_t data_offset,
+    uint64_t data_size,
+    uint64_t fec_offset,
+    uint64_t fec_size,
+    uint32_t fec_roots,
+    uint32_t block_size,
+    bool verify_mode,
+    uint64_t first_round,
+    const FECProgressCallback& progress) {
   TEST_AND_RETURN_FALSE(data_size % block_size == 0);
   TEST_AND_RETURN_FALSE(fec_roots >= 0 && fec_roots < FEC_RSM);
   // This is the N in RS(M, N), which is the number of bytes for each rs block.
   size_t rs_n = FEC_RSM - fec_roots;
   uint64_t rounds = utils::DivRoundUp(data_size / block_size, rs_n);
   TEST_AND_RETURN_FALSE(rounds * fec_roots * block_size == fec_size);
-
-  std::unique_ptr<void, decltype(&free_rs_char)> rs_char(
-      init_rs_char(FEC_PARAMS(fec_roots)), &free_rs_char);
-  TEST_AND_RETURN_FALSE(rs_char != nullptr);
+  if (first_round >= rounds) {
+    LOG(INFO) << "The FEC of " << path << " was already written.";
+    return true;
+  }
+  if (first_round > 0) {
+    LOG(INFO) << "Resuming the FEC of " << path << " at round " << first_round
+              << " of " << rounds;
+  }
 
   int fd = HANDLE_EINTR(open(path.c_str(), verify_mode ? O_RDONLY : O_RDWR));
   if (fd < 0) {
@@ -142,54 +399,74 @@ bool VerityWriterAndroid::EncodeFEC(const std::string& path,
   }
   ScopedFdCloser fd_closer(&fd);
 
-  for (size_t i = 0; i < rounds; i++) {
-    // Encodes |block_size| number of rs blocks each round so that we can read
-    // one block each time instead of 1 byte to increase random read
-    // performance. This uses about 1 MiB memory for 4K block size.
-    brillo::Blob rs_blocks(block_size * rs_n);
-    for (size_t j = 0; j < rs_n; j++) {
-      brillo::Blob buffer(block_size, 0);
-      uint64_t offset =
-          fec_ecc_interleave(i * rs_n * block_size + j, rs_n, rounds);
-      // Don't read past |data_size|, treat them as 0.
-      if (offset < data_size) {
-        ssize_t bytes_read = 0;
-        TEST_AND_RETURN_FALSE(utils::PReadAll(fd,
-                                              buffer.data(),
-                                              buffer.size(),
-                                              data_offset + offset,
-                                              &bytes_read));
-        TEST_AND_RETURN_FALSE(bytes_read ==
-                              static_cast<ssize_t>(buffer.size()));
-      }
-      for (size_t k = 0; k < buffer.size(); k++) {
-        rs_blocks[k * rs_n + j] = buffer[k];
-      }
-    }
-    brillo::Blob fec(block_size * fec_roots);
-    for (size_t j = 0; j < block_size; j++) {
-      // Encode [j * rs_n : (j + 1) * rs_n) in |rs_blocks| and write |fec_roots|
-      // number of parity bytes to |j * fec_roots| in |fec|.
-      encode_rs_char(rs_char.get(),
-                     rs_blocks.data() + j * rs_n,
-                     fec.data() + j * fec_roots);
+  const FECParams params = {fd,
+                            data_offset,
+                            data_size,
+                            fec_offset,
+                            fec_roots,
+                            block_size,
+                            rounds,
+                            verify_mode};
+  if (progress.is_null())
+    return EncodeFECRoundsInParallel(params, first_round, rounds);
+
+  // The written FEC is synced before reporting it, so the progress never
+  // covers FEC lost in a power cut.
+  for (uint64_t first = first_round; first < rounds;) {
+    const uint64_t end = std::min(rounds, first + kFECCheckpointRounds);
+    TEST_AND_RETURN_FALSE(EncodeFECRoundsInParallel(params, first, end));
+    TEST_AND_RETURN_FALSE_ERRNO(fsync(fd) == 0);
+    progress.Run(end);
+    first = end;
+  }
+  return true;
+}
+
+void VerityWriterAndroid::LoadProgress() {
+  hash_tree_written_ = false;
+  fec_rounds_written_ = 0;
+  if (!prefs_)
+    return;
+  base::AutoLock auto_lock(*VerityProgressLock());
+  for (const string& line : LoadProgressLines(prefs_)) {
+    vector<string> fields = base::SplitString(
+        line, " ", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY);
+    uint64_t fec_rounds = 0;
+    if (fields.size() != 3 || fields[0] != partition_->name ||
+        !base::StringToUint64(fields[2], &fec_rounds)) {
+      continue;
     }
+    hash_tree_written_ = fields[1] == "1";
+    fec_rounds_written_ = fec_rounds;
+    LOG(INFO) << "Resuming the verity data of " << partition_->name
+              << ", hash tree written: " << hash_tree_written_
+              << ", FEC rounds written: " << fec_rounds_written_;
+  }
+}
 
-    if (verify_mode) {
-      brillo::Blob fec_read(fec.size());
-      ssize_t bytes_read = 0;
-      TEST_AND_RETURN_FALSE(utils::PReadAll(
-          fd, fec_read.data(), fec_read.size(), fec_offset, &bytes_read));
-      TEST_AND_RETURN_FALSE(bytes_read ==
-                            static_cast<ssize_t>(fec_read.size()));
-      TEST_AND_RETURN_FALSE(fec == fec_read);
-    } else {
-      TEST_AND_RETURN_FALSE(
-          utils::PWriteAll(fd, fec.data(), fec.size(), fec_offset));
+void VerityWriterAndroid::StoreProgress() {
+  if (!prefs_)
+    return;
+  base::AutoLock auto_lock(*VerityProgressLock());
+  vector<string> lines;
+  for (const string& line : LoadProgressLines(prefs_)) {
+    if (!base::StartsWith(
+            line, partition_->name + " ", base::CompareCase::SENSITIVE)) {
+      lines.push_back(line);
     }
-    fec_offset += fec.size();
   }
+  lines.push_back(partition_->name + (hash_tree_written_ ? " 1 " : " 0 ") +
+                  base::NumberToString(fec_rounds_written_));
+  if (!prefs_->SetString(kPrefsVerityProgress,
+                         base::JoinString(lines, "\n"))) {
+    LOG(WARNING) << "Unable to store the verity progress of "
+                 << partition_->name;
+  }
+}
 
-  return true;
+void VerityWriterAndroid::OnFECProgress(uint64_t rounds) {
+  fec_rounds_written_ = rounds;
+  StoreProgress();
 }
+
 }  // namespace chromeos_update_engine
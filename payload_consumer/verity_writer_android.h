@@ -20,8 +20,10 @@
 #include <memory>
 #include <string>
 
+#include <base/callback.h>
 #include <verity/hash_tree_builder.h>
 
+#include "update_engine/common/memory_stats.h"
 #include "update_engine/payload_consumer/verity_writer_interface.h"
 
 namespace chromeos_update_engine {
@@ -31,7 +33,8 @@ class VerityWriterAndroid : public VerityWriterInterface {
   VerityWriterAndroid() = default;
   ~VerityWriterAndroid() override = default;
 
-  bool Init(const InstallPlan::Partition& partition) override;
+  bool Init(const InstallPlan::Partition& partition,
+            PrefsInterface* prefs) override;
   bool Update(uint64_t offset, const uint8_t* buffer, size_t size) override;
 
   // Read [data_offset : data_offset + data_size) from |path| and encode FEC
@@ -39,7 +42,8 @@ class VerityWriterAndroid : public VerityWriterInterface {
   // |path|, otherwise write the encoded FEC to |path|. We can't encode as we go
   // in each Update() like hash tree, because for every rs block, its data are
   // spreaded across entire |data_size|, unless we can cache all data in
-  // memory, we have to re-read them from disk.
+  // memory, we have to re-read them from disk. The rs blocks are encoded on
+  // several threads.
   static bool EncodeFEC(const std::string& path,
                         uint64_t data_offset,
                         uint64_t data_size,
@@ -50,9 +54,44 @@ class VerityWriterAndroid : public VerityWriterInterface {
                         bool verify_mode);
 
  private:
+  // Called with the number of rounds of rs blocks whose FEC was written to
+  // the disk so far.
+  using FECProgressCallback = base::Callback<void(uint64_t rounds)>;
+
+  // Same as EncodeFEC(), but starts at the round |first_round|. If not null,
+  // |progress| is called every few rounds once their FEC is synced to the
+  // disk.
+  static bool EncodeFECFromRound(const std::string& path,
+                                 uint64_t data_offset,
+                                 uint64_t data_size,
+                                 uint64_t fec_offset,
+                                 uint64_t fec_size,
+                                 uint32_t fec_roots,
+                                 uint32_t block_size,
+                                 bool verify_mode,
+                                 uint64_t first_round,
+                                 const FECProgressCallback& progress);
+
+  // Loads the progress of |partition_| from |prefs_|, if any.
+  void LoadProgress();
+
+  // Stores the progress of |partition_| in |prefs_|, if any.
+  void StoreProgress();
+
+  // Records that the FEC of the first |rounds| rounds was written.
+  void OnFECProgress(uint64_t rounds);
+
   const InstallPlan::Partition* partition_ = nullptr;
+  PrefsInterface* prefs_ = nullptr;
 
   std::unique_ptr<HashTreeBuilder> hash_tree_builder_;
+  // The hash tree kept in memory by |hash_tree_builder_| until it is written.
+  ScopedMemoryTracker hash_tree_memory_{MemoryCategory::kVerity};
+
+  // The verity data of |partition_| already written to the disk, possibly by
+  // a previous attempt of the same update.
+  bool hash_tree_written_{false};
+  uint64_t fec_rounds_written_{0};
 
   DISALLOW_COPY_AND_ASSIGN(VerityWriterAndroid);
 };
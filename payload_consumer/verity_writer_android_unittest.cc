@@ -16,17 +16,27 @@
 
 #include "update_engine/payload_consumer/verity_writer_android.h"
 
+#include <string>
+
 #include <brillo/secure_blob.h>
 #include <gtest/gtest.h>
+extern "C" {
+#include <fec.h>
+}
 
+#include "update_engine/common/constants.h"
+#include "update_engine/common/fake_prefs.h"
 #include "update_engine/common/test_utils.h"
 #include "update_engine/common/utils.h"
 
+using std::string;
+
 namespace chromeos_update_engine {
 
 class VerityWriterAndroidTest : public ::testing::Test {
  protected:
   void SetUp() override {
+    partition_.name = "system";
     partition_.target_path = temp_file_.path();
     partition_.block_size = 4096;
     partition_.hash_tree_data_offset = 0;
@@ -45,7 +55,7 @@ class VerityWriterAndroidTest : public ::testing::Test {
 TEST_F(VerityWriterAndroidTest, SimpleTest) {
   brillo::Blob part_data(8192);
   test_utils::WriteFileVector(partition_.target_path, part_data);
-  ASSERT_TRUE(verity_writer_.Init(partition_));
+  ASSERT_TRUE(verity_writer_.Init(partition_, nullptr));
   EXPECT_TRUE(verity_writer_.Update(0, part_data.data(), 4096));
   EXPECT_TRUE(verity_writer_.Update(4096, part_data.data() + 4096, 4096));
   brillo::Blob actual_part;
@@ -63,7 +73,7 @@ TEST_F(VerityWriterAndroidTest, NoOpTest) {
   partition_.hash_tree_data_size = 0;
   partition_.hash_tree_size = 0;
   brillo::Blob part_data(4096);
-  ASSERT_TRUE(verity_writer_.Init(partition_));
+  ASSERT_TRUE(verity_writer_.Init(partition_, nullptr));
   EXPECT_TRUE(verity_writer_.Update(0, part_data.data(), part_data.size()));
   EXPECT_TRUE(verity_writer_.Update(4096, part_data.data(), part_data.size()));
   EXPECT_TRUE(verity_writer_.Update(8192, part_data.data(), part_data.size()));
@@ -71,19 +81,19 @@ TEST_F(VerityWriterAndroidTest, NoOpTest) {
 
 TEST_F(VerityWriterAndroidTest, InvalidHashAlgorithmTest) {
   partition_.hash_tree_algorithm = "sha123";
-  EXPECT_FALSE(verity_writer_.Init(partition_));
+  EXPECT_FALSE(verity_writer_.Init(partition_, nullptr));
 }
 
 TEST_F(VerityWriterAndroidTest, WrongHashTreeSizeTest) {
   partition_.hash_tree_size = 8192;
-  EXPECT_FALSE(verity_writer_.Init(partition_));
+  EXPECT_FALSE(verity_writer_.Init(partition_, nullptr));
 }
 
 TEST_F(VerityWriterAndroidTest, SHA256Test) {
   partition_.hash_tree_algorithm = "sha256";
   brillo::Blob part_data(8192);
   test_utils::WriteFileVector(partition_.target_path, part_data);
-  ASSERT_TRUE(verity_writer_.Init(partition_));
+  ASSERT_TRUE(verity_writer_.Init(partition_, nullptr));
   EXPECT_TRUE(verity_writer_.Update(0, part_data.data(), 4096));
   EXPECT_TRUE(verity_writer_.Update(4096, part_data.data() + 4096, 4096));
   brillo::Blob actual_part;
@@ -105,7 +115,7 @@ TEST_F(VerityWriterAndroidTest, FECTest) {
   partition_.fec_size = 2 * 4096;
   brillo::Blob part_data(3 * 4096, 0x1);
   test_utils::WriteFileVector(partition_.target_path, part_data);
-  ASSERT_TRUE(verity_writer_.Init(partition_));
+  ASSERT_TRUE(verity_writer_.Init(partition_, nullptr));
   EXPECT_TRUE(verity_writer_.Update(0, part_data.data(), part_data.size()));
   brillo::Blob actual_part;
   utils::ReadFile(partition_.target_path, &actual_part);
@@ -117,4 +127,94 @@ TEST_F(VerityWriterAndroidTest, FECTest) {
   EXPECT_EQ(part_data, actual_part);
 }
 
+TEST_F(VerityWriterAndroidTest, HashTreeNotWrittenAgainWhenResumedTest) {
+  FakePrefs prefs;
+  brillo::Blob part_data(8192);
+  test_utils::WriteFileVector(partition_.target_path, part_data);
+  ASSERT_TRUE(verity_writer_.Init(partition_, &prefs));
+  EXPECT_TRUE(verity_writer_.Update(0, part_data.data(), part_data.size()));
+  string progress;
+  EXPECT_TRUE(prefs.GetString(kPrefsVerityProgress, &progress));
+  EXPECT_EQ("system 1 0", progress);
+
+  // A resumed update doesn't write the hash tree again.
+  test_utils::WriteFileVector(partition_.target_path, part_data);
+  VerityWriterAndroid resumed_verity_writer;
+  ASSERT_TRUE(resumed_verity_writer.Init(partition_, &prefs));
+  EXPECT_TRUE(
+      resumed_verity_writer.Update(0, part_data.data(), part_data.size()));
+  brillo::Blob actual_part;
+  utils::ReadFile(partition_.target_path, &actual_part);
+  EXPECT_EQ(part_data, actual_part);
+}
+
+TEST_F(VerityWriterAndroidTest, FECResumedFromTheWrittenRoundsTest) {
+  partition_.hash_tree_size = 0;
+  partition_.fec_data_offset = 0;
+  partition_.fec_data_size = 4096;
+  partition_.fec_offset = 4096;
+  partition_.fec_size = 2 * 4096;
+  brillo::Blob part_data(3 * 4096, 0x1);
+  test_utils::WriteFileVector(partition_.target_path, part_data);
+  FakePrefs prefs;
+  // The progress of other partitions is kept.
+  prefs.SetString(kPrefsVerityProgress, "vendor 1 3\nsystem 0 1");
+  ASSERT_TRUE(verity_writer_.Init(partition_, &prefs));
+  EXPECT_TRUE(verity_writer_.Update(0, part_data.data(), part_data.size()));
+  // The only round was already written.
+  brillo::Blob actual_part;
+  utils::ReadFile(partition_.target_path, &actual_part);
+  EXPECT_EQ(part_data, actual_part);
+
+  prefs.SetString(kPrefsVerityProgress, "vendor 1 3");
+  ASSERT_TRUE(verity_writer_.Init(partition_, &prefs));
+  EXPECT_TRUE(verity_writer_.Update(0, part_data.data(), part_data.size()));
+  utils::ReadFile(partition_.target_path, &actual_part);
+  EXPECT_NE(part_data, actual_part);
+  string progress;
+  EXPECT_TRUE(prefs.GetString(kPrefsVerityProgress, &progress));
+  EXPECT_EQ("vendor 1 3\nsystem 0 1", progress);
+}
+
+TEST_F(VerityWriterAndroidTest, FECMultipleRoundsTest) {
+  // Enough data for several rounds of rs blocks, which are encoded on
+  // different threads.
+  const uint64_t kRounds = 5;
+  const uint64_t kDataSize = kRounds * (FEC_RSM - 2) * 4096;
+  const uint64_t kFECSize = kRounds * 2 * 4096;
+  brillo::Blob part_data(kDataSize + kFECSize);
+  test_utils::FillWithData(&part_data);
+  test_utils::WriteFileVector(partition_.target_path, part_data);
+  EXPECT_TRUE(VerityWriterAndroid::EncodeFEC(partition_.target_path,
+                                             0,
+                                             kDataSize,
+                                             kDataSize,
+                                             kFECSize,
+                                             2,
+                                             4096,
+                                             false /* verify_mode */));
+  EXPECT_TRUE(VerityWriterAndroid::EncodeFEC(partition_.target_path,
+                                             0,
+                                             kDataSize,
+                                             kDataSize,
+                                             kFECSize,
+                                             2,
+                                             4096,
+                                             true /* verify_mode */));
+
+  // Corrupt the FEC of the last round.
+  brillo::Blob actual_part;
+  ASSERT_TRUE(utils::ReadFile(partition_.target_path, &actual_part));
+  actual_part.back() ^= 0xff;
+  test_utils::WriteFileVector(partition_.target_path, actual_part);
+  EXPECT_FALSE(VerityWriterAndroid::EncodeFEC(partition_.target_path,
+                                              0,
+                                              kDataSize,
+                                              kDataSize,
+                                              kFECSize,
+                                              2,
+                                              4096,
+                                              true /* verify_mode */));
+}
+
 }  // namespace chromeos_update_engine
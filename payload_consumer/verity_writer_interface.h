@@ -22,6 +22,7 @@
 
 #include <base/macros.h>
 
+#include "update_engine/common/prefs_interface.h"
 #include "update_engine/payload_consumer/install_plan.h"
 
 namespace chromeos_update_engine {
@@ -30,7 +31,11 @@ class VerityWriterInterface {
  public:
   virtual ~VerityWriterInterface() = default;
 
-  virtual bool Init(const InstallPlan::Partition& partition) = 0;
+  // Prepares to write the verity data of |partition|. If not null, |prefs|
+  // keeps the progress of the verity data written so far, so an interrupted
+  // update doesn't write it again when it is resumed.
+  virtual bool Init(const InstallPlan::Partition& partition,
+                    PrefsInterface* prefs) = 0;
   // Update partition data at [offset : offset + size) stored in |buffer|.
   // Data not in |hash_tree_data_extent| or |fec_data_extent| is ignored.
   // Will write verity data to the target partition once all the necessary
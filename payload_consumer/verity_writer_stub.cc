@@ -26,7 +26,8 @@ std::unique_ptr<VerityWriterInterface> CreateVerityWriter() {
 }
 }  // namespace verity_writer
 
-bool VerityWriterStub::Init(const InstallPlan::Partition& partition) {
+bool VerityWriterStub::Init(const InstallPlan::Partition& partition,
+                            PrefsInterface* prefs) {
   return partition.hash_tree_size == 0 && partition.fec_size == 0;
 }
 
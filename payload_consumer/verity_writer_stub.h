@@ -26,7 +26,8 @@ class VerityWriterStub : public VerityWriterInterface {
   VerityWriterStub() = default;
   ~VerityWriterStub() override = default;
 
-  bool Init(const InstallPlan::Partition& partition) override;
+  bool Init(const InstallPlan::Partition& partition,
+            PrefsInterface* prefs) override;
   bool Update(uint64_t offset, const uint8_t* buffer, size_t size) override;
 
  private:
@@ -0,0 +1,112 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/writeback_file_descriptor.h"
+
+#include <fcntl.h>
+
+#include <algorithm>
+
+#include <base/logging.h>
+
+namespace chromeos_update_engine {
+
+ssize_t WritebackFileDescriptor::Read(void* buf, size_t count) {
+  ssize_t read = EintrSafeFileDescriptor::Read(buf, count);
+  if (read > 0)
+    offset_ += read;
+  return read;
+}
+
+ssize_t WritebackFileDescriptor::Write(const void* buf, size_t count) {
+  ssize_t written = EintrSafeFileDescriptor::Write(buf, count);
+  if (written <= 0 || !writeback_supported_) {
+    if (written > 0)
+      offset_ += written;
+    return written;
+  }
+
+  Range range{offset_, offset_ + written};
+  offset_ += written;
+  if (dirty_.empty()) {
+    dirty_ = range;
+  } else {
+    dirty_.start = std::min(dirty_.start, range.start);
+    dirty_.end = std::max(dirty_.end, range.end);
+  }
+  dirty_bytes_ += written;
+  if (dirty_bytes_ >= max_dirty_bytes_ / 2 && !StartWriteback())
+    return -1;
+  return written;
+}
+
+off64_t WritebackFileDescriptor::Seek(off64_t offset, int whence) {
+  off64_t new_offset = EintrSafeFileDescriptor::Seek(offset, whence);
+  if (new_offset >= 0)
+    offset_ = new_offset;
+  return new_offset;
+}
+
+bool WritebackFileDescriptor::Close() {
+  // The kernel would write the remaining dirty pages on close anyway, they
+  // are only dropped from the page cache once written.
+  bool success = StartWriteback() && CompleteWriteback();
+  offset_ = 0;
+  return EintrSafeFileDescriptor::Close() && success;
+}
+
+bool WritebackFileDescriptor::StartWriteback() {
+  if (!CompleteWriteback())
+    return false;
+  Range range = dirty_;
+  dirty_ = Range();
+  dirty_bytes_ = 0;
+  if (range.empty() || !writeback_supported_)
+    return true;
+  if (sync_file_range(
+          fd_, range.start, range.end - range.start, SYNC_FILE_RANGE_WRITE) !=
+      0) {
+    PLOG(WARNING) << "Unable to start the writeback, leaving it to the kernel";
+    writeback_supported_ = false;
+    return true;
+  }
+  in_flight_ = range;
+  return true;
+}
+
+bool WritebackFileDescriptor::CompleteWriteback() {
+  Range range = in_flight_;
+  in_flight_ = Range();
+  if (range.empty())
+    return true;
+  off64_t length = range.end - range.start;
+  if (sync_file_range(fd_,
+                      range.start,
+                      length,
+                      SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                          SYNC_FILE_RANGE_WAIT_AFTER) != 0) {
+    PLOG(ERROR) << "Unable to write back " << length << " bytes at "
+                << range.start;
+    return false;
+  }
+  // The pages are clean now, dropping them doesn't lose any data.
+  posix_fadvise(fd_, range.start, length, POSIX_FADV_DONTNEED);
+  written_back_bytes_ += length;
+  return true;
+}
+
+}  // namespace chromeos_update_engine
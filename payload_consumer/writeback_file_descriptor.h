@@ -0,0 +1,90 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_WRITEBACK_FILE_DESCRIPTOR_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_WRITEBACK_FILE_DESCRIPTOR_H_
+
+#include <sys/types.h>
+
+#include "update_engine/payload_consumer/file_descriptor.h"
+
+namespace chromeos_update_engine {
+
+// A file descriptor that writes its data back to the storage as it goes,
+// instead of leaving the kernel to flush all the dirty pages at once when the
+// partition is closed. Once half of |max_dirty_bytes| were written, the
+// writeback of the range they span is started with sync_file_range(), after
+// waiting for the previous one. The pages of the ranges already on the
+// storage are dropped from the page cache, so the update doesn't push the
+// data of the other processes out of it.
+//
+// The ranges are the span of the writes, which the delta payloads scatter,
+// so more than |max_dirty_bytes| may be waited for at once. If the file
+// doesn't support sync_file_range(), the writeback is left to the kernel.
+class WritebackFileDescriptor : public EintrSafeFileDescriptor {
+ public:
+  explicit WritebackFileDescriptor(uint64_t max_dirty_bytes)
+      : max_dirty_bytes_(max_dirty_bytes) {}
+  ~WritebackFileDescriptor() override = default;
+
+  ssize_t Read(void* buf, size_t count) override;
+  ssize_t Write(const void* buf, size_t count) override;
+  off64_t Seek(off64_t offset, int whence) override;
+  bool Close() override;
+
+  // The size of the ranges written back and dropped from the page cache so
+  // far.
+  uint64_t written_back_bytes() const { return written_back_bytes_; }
+
+ private:
+  // A range of bytes of the file, empty when |start| >= |end|.
+  struct Range {
+    off64_t start{0};
+    off64_t end{0};
+    bool empty() const { return start >= end; }
+  };
+
+  // Starts the writeback of |dirty_| once the previous one completed.
+  // Returns false if the previous writeback failed.
+  bool StartWriteback();
+
+  // Waits for the writeback of |in_flight_| and drops its pages from the
+  // page cache. Returns false if the data couldn't be written.
+  bool CompleteWriteback();
+
+  const uint64_t max_dirty_bytes_;
+
+  // The offset of the next Read() or Write().
+  off64_t offset_{0};
+
+  // The span of the writes whose writeback wasn't started, the bytes they
+  // wrote, and the span whose writeback is in progress.
+  Range dirty_;
+  uint64_t dirty_bytes_{0};
+  Range in_flight_;
+
+  // Whether the file supports sync_file_range().
+  bool writeback_supported_{true};
+
+  uint64_t written_back_bytes_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(WritebackFileDescriptor);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_WRITEBACK_FILE_DESCRIPTOR_H_
@@ -0,0 +1,99 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/writeback_file_descriptor.h"
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <memory>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+const size_t kBlockSize = 4096;
+// The writeback starts every 2 blocks.
+const uint64_t kMaxDirtyBytes = 4 * kBlockSize;
+}  // namespace
+
+class WritebackFileDescriptorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    fd_.reset(new WritebackFileDescriptor(kMaxDirtyBytes));
+    ASSERT_TRUE(fd_->Open(temp_file_.path().c_str(), O_RDWR, 0600));
+  }
+
+  // Writes the block |index| of |data_| at its offset.
+  void WriteBlock(size_t index) {
+    off64_t offset = index * kBlockSize;
+    ASSERT_EQ(offset, fd_->Seek(offset, SEEK_SET));
+    ASSERT_TRUE(utils::WriteAll(fd_, data_.data() + offset, kBlockSize));
+  }
+
+  test_utils::ScopedTempFile temp_file_{"Writeback-file.XXXXXX"};
+  brillo::Blob data_;
+  std::shared_ptr<WritebackFileDescriptor> fd_;
+};
+
+TEST_F(WritebackFileDescriptorTest, WritesBackAsItGoesTest) {
+  data_.resize(5 * kBlockSize);
+  test_utils::FillWithData(&data_);
+  WriteBlock(0);
+  WriteBlock(1);
+  // The writeback of the first 2 blocks started, but wasn't waited for.
+  EXPECT_EQ(0U, fd_->written_back_bytes());
+  WriteBlock(3);
+  WriteBlock(2);
+  EXPECT_EQ(2 * kBlockSize, fd_->written_back_bytes());
+  WriteBlock(4);
+  EXPECT_EQ(2 * kBlockSize, fd_->written_back_bytes());
+
+  // Closing writes back the rest.
+  EXPECT_TRUE(fd_->Close());
+  EXPECT_EQ(5 * kBlockSize, fd_->written_back_bytes());
+  brillo::Blob file_data;
+  ASSERT_TRUE(utils::ReadFile(temp_file_.path(), &file_data));
+  EXPECT_EQ(data_, file_data);
+}
+
+TEST_F(WritebackFileDescriptorTest, ScatteredWritesTest) {
+  // The writeback covers the span of the writes, here blocks 1 to 7, and
+  // then the block 4 again.
+  data_.resize(8 * kBlockSize);
+  test_utils::FillWithData(&data_);
+  WriteBlock(7);
+  WriteBlock(1);
+  WriteBlock(4);
+  EXPECT_TRUE(fd_->Close());
+  EXPECT_EQ(8 * kBlockSize, fd_->written_back_bytes());
+
+  brillo::Blob file_data;
+  ASSERT_TRUE(utils::ReadFile(temp_file_.path(), &file_data));
+  ASSERT_EQ(data_.size(), file_data.size());
+  for (size_t index : {1, 4, 7}) {
+    EXPECT_TRUE(std::equal(data_.begin() + index * kBlockSize,
+                           data_.begin() + (index + 1) * kBlockSize,
+                           file_data.begin() + index * kBlockSize));
+  }
+}
+
+}  // namespace chromeos_update_engine
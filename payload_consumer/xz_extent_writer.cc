@@ -16,6 +16,8 @@
 
 #include "update_engine/payload_consumer/xz_extent_writer.h"
 
+#include "update_engine/payload_consumer/buffer_pool.h"
+
 using google::protobuf::RepeatedPtrField;
 
 namespace chromeos_update_engine {
@@ -52,20 +54,25 @@ const char* XzErrorString(enum xz_ret error) {
 }
 }  // namespace
 
-XzExtentWriter::~XzExtentWriter() {
+template <typename UnderlyingWriter>
+BasicXzExtentWriter<UnderlyingWriter>::~BasicXzExtentWriter() {
   xz_dec_end(stream_);
   TEST_AND_RETURN(input_buffer_.empty());
 }
 
-bool XzExtentWriter::Init(FileDescriptorPtr fd,
-                          const RepeatedPtrField<Extent>& extents,
-                          uint32_t block_size) {
+template <typename UnderlyingWriter>
+bool BasicXzExtentWriter<UnderlyingWriter>::Init(
+    FileDescriptorPtr fd,
+    const RepeatedPtrField<Extent>& extents,
+    uint32_t block_size) {
   stream_ = xz_dec_init(XZ_DYNALLOC, kXzMaxDictSize);
   TEST_AND_RETURN_FALSE(stream_ != nullptr);
   return underlying_writer_->Init(fd, extents, block_size);
 }
 
-bool XzExtentWriter::Write(const void* bytes, size_t count) {
+template <typename UnderlyingWriter>
+bool BasicXzExtentWriter<UnderlyingWriter>::Write(const void* bytes,
+                                                  size_t count) {
   // Copy the input data into |input_buffer_| only if |input_buffer_| already
   // contains unconsumed data. Otherwise, process the data directly from the
   // source.
@@ -81,7 +88,7 @@ bool XzExtentWriter::Write(const void* bytes, size_t count) {
   request.in_pos = 0;
   request.in_size = count;
 
-  brillo::Blob output_buffer(kOutputBufferLength);
+  ScopedPoolBuffer output_buffer(kOutputBufferLength);
   request.out = output_buffer.data();
   request.out_size = output_buffer.size();
   for (;;) {
@@ -103,7 +110,6 @@ bool XzExtentWriter::Write(const void* bytes, size_t count) {
     if (request.in_size == request.in_pos)
       break;  // No more input to process.
   }
-  output_buffer.clear();
 
   // Store unconsumed data (if any) in |input_buffer_|. Since |input| can point
   // to the existing |input_buffer_| we create a new one before assigning it.
@@ -113,4 +119,7 @@ bool XzExtentWriter::Write(const void* bytes, size_t count) {
   return true;
 }
 
+template class BasicXzExtentWriter<ExtentWriter>;
+template class BasicXzExtentWriter<DirectExtentWriter>;
+
 }  // namespace chromeos_update_engine
@@ -30,14 +30,18 @@
 // what it's given in Write using xz-embedded. Note that xz-embedded only
 // supports files with either no CRC or CRC-32. It passes the decompressed data
 // to an underlying ExtentWriter.
+//
+// BasicXzExtentWriter<T> passes the data to an underlying T instead.
 
 namespace chromeos_update_engine {
 
-class XzExtentWriter : public ExtentWriter {
+template <typename UnderlyingWriter>
+class BasicXzExtentWriter final : public ExtentWriter {
  public:
-  explicit XzExtentWriter(std::unique_ptr<ExtentWriter> underlying_writer)
+  explicit BasicXzExtentWriter(
+      std::unique_ptr<UnderlyingWriter> underlying_writer)
       : underlying_writer_(std::move(underlying_writer)) {}
-  ~XzExtentWriter() override;
+  ~BasicXzExtentWriter() override;
 
   bool Init(FileDescriptorPtr fd,
             const google::protobuf::RepeatedPtrField<Extent>& extents,
@@ -46,14 +50,16 @@ class XzExtentWriter : public ExtentWriter {
 
  private:
   // The underlying ExtentWriter.
-  std::unique_ptr<ExtentWriter> underlying_writer_;
+  std::unique_ptr<UnderlyingWriter> underlying_writer_;
   // The opaque xz decompressor struct.
   xz_dec* stream_{nullptr};
   brillo::Blob input_buffer_;
 
-  DISALLOW_COPY_AND_ASSIGN(XzExtentWriter);
+  DISALLOW_COPY_AND_ASSIGN(BasicXzExtentWriter);
 };
 
+using XzExtentWriter = BasicXzExtentWriter<ExtentWriter>;
+
 }  // namespace chromeos_update_engine
 
 #endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_XZ_EXTENT_WRITER_H_
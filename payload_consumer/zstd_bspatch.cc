@@ -0,0 +1,352 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/zstd_bspatch.h"
+
+#include <endian.h>
+#include <string.h>
+#include <zstd.h>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <base/logging.h>
+#include <base/macros.h>
+#include <base/threading/simple_thread.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+const char kZstdBsdiffMagic[8] = {'Z', 'S', 'T', 'D', 'B', 'S', 'D', 'F'};
+const size_t kZstdBsdiffHeaderSize = 32;
+
+namespace {
+
+// The same window limit as the REPLACE_ZSTD operations.
+const int kZstdMaxWindowLog = 23;
+
+// The size of the chunks the diff and extra streams are applied in.
+const size_t kChunkSize = 64 * 1024;
+
+uint64_t ReadLE64(const uint8_t* data) {
+  uint64_t value;
+  memcpy(&value, data, sizeof(value));
+  return le64toh(value);
+}
+
+struct ZstdDCtxDeleter {
+  void operator()(ZSTD_DCtx* dctx) const { ZSTD_freeDCtx(dctx); }
+};
+
+// Decompresses a zstd frame held in memory as it is read.
+class ZstdStreamReader {
+ public:
+  ZstdStreamReader() = default;
+
+  bool Init(const uint8_t* data, size_t size) {
+    dctx_.reset(ZSTD_createDCtx());
+    TEST_AND_RETURN_FALSE(dctx_);
+    TEST_AND_RETURN_FALSE(!ZSTD_isError(ZSTD_DCtx_setParameter(
+        dctx_.get(), ZSTD_d_windowLogMax, kZstdMaxWindowLog)));
+    input_ = {data, size, 0};
+    return true;
+  }
+
+  // Reads exactly |count| decompressed bytes into |buffer|.
+  bool Read(void* buffer, size_t count) {
+    ZSTD_outBuffer output = {buffer, count, 0};
+    while (output.pos < output.size) {
+      size_t previous_in_pos = input_.pos;
+      size_t previous_out_pos = output.pos;
+      size_t ret = ZSTD_decompressStream(dctx_.get(), &output, &input_);
+      if (ZSTD_isError(ret)) {
+        LOG(ERROR) << "ZSTD_decompressStream failed: "
+                   << ZSTD_getErrorName(ret);
+        return false;
+      }
+      // The stream ended before |count| bytes were read.
+      if (input_.pos == previous_in_pos && output.pos == previous_out_pos) {
+        LOG(ERROR) << "Truncated zstd stream in the patch.";
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  std::unique_ptr<ZSTD_DCtx, ZstdDCtxDeleter> dctx_;
+  ZSTD_inBuffer input_{nullptr, 0, 0};
+
+  DISALLOW_COPY_AND_ASSIGN(ZstdStreamReader);
+};
+
+// The streams of a ZSTD_BSDIFF patch.
+struct ZstdBsdiffStreams {
+  ZstdStreamReader ctrl;
+  ZstdStreamReader diff;
+  ZstdStreamReader extra;
+  uint64_t new_size;
+};
+
+// Checks the header of the |patch| and starts decompressing its streams.
+bool OpenZstdBsdiffPatch(const uint8_t* patch,
+                         size_t patch_size,
+                         ZstdBsdiffStreams* streams) {
+  TEST_AND_RETURN_FALSE(patch_size >= kZstdBsdiffHeaderSize);
+  TEST_AND_RETURN_FALSE(
+      memcmp(patch, kZstdBsdiffMagic, sizeof(kZstdBsdiffMagic)) == 0);
+  const uint64_t ctrl_size = ReadLE64(patch + 8);
+  const uint64_t diff_size = ReadLE64(patch + 16);
+  streams->new_size = ReadLE64(patch + 24);
+  const uint64_t streams_size = patch_size - kZstdBsdiffHeaderSize;
+  TEST_AND_RETURN_FALSE(ctrl_size <= streams_size &&
+                        diff_size <= streams_size - ctrl_size);
+
+  const uint8_t* ctrl_data = patch + kZstdBsdiffHeaderSize;
+  const uint8_t* diff_data = ctrl_data + ctrl_size;
+  const uint8_t* extra_data = diff_data + diff_size;
+  TEST_AND_RETURN_FALSE(streams->ctrl.Init(ctrl_data, ctrl_size));
+  TEST_AND_RETURN_FALSE(streams->diff.Init(diff_data, diff_size));
+  TEST_AND_RETURN_FALSE(streams->extra.Init(
+      extra_data, streams_size - ctrl_size - diff_size));
+  return true;
+}
+
+// An entry of the control stream.
+struct ControlEntry {
+  uint64_t diff_size;
+  uint64_t extra_size;
+  int64_t offset_increment;
+};
+
+// Reads the next control entry of the |streams|, with |new_pos| bytes of the
+// new data already written.
+bool ReadControlEntry(ZstdBsdiffStreams* streams,
+                      uint64_t new_pos,
+                      ControlEntry* entry) {
+  uint8_t data[24];
+  TEST_AND_RETURN_FALSE(streams->ctrl.Read(data, sizeof(data)));
+  entry->diff_size = ReadLE64(data);
+  entry->extra_size = ReadLE64(data + 8);
+  entry->offset_increment = static_cast<int64_t>(ReadLE64(data + 16));
+  const uint64_t remaining = streams->new_size - new_pos;
+  TEST_AND_RETURN_FALSE(entry->diff_size <= remaining &&
+                        entry->extra_size <= remaining - entry->diff_size);
+  return true;
+}
+
+// A control entry with the offsets of its data in the new data and in the
+// decompressed streams, and of the old data it is added to.
+struct PatchRange {
+  uint64_t new_offset;
+  uint64_t diff_offset;
+  uint64_t extra_offset;
+  int64_t old_pos;
+  uint64_t diff_size;
+  uint64_t extra_size;
+};
+
+// Writes the bytes [|begin|, |end|) of the |new_data| from the decompressed
+// |diff| and |extra| streams and the |old_data|, following the |ranges|.
+void PatchNewData(const std::vector<PatchRange>& ranges,
+                  const brillo::Blob& old_data,
+                  const brillo::Blob& diff,
+                  const brillo::Blob& extra,
+                  uint64_t begin,
+                  uint64_t end,
+                  uint8_t* new_data) {
+  // The last range starting at or before |begin|.
+  auto it = std::upper_bound(ranges.begin(),
+                             ranges.end(),
+                             begin,
+                             [](uint64_t offset, const PatchRange& range) {
+                               return offset < range.new_offset;
+                             });
+  for (--it; it != ranges.end() && it->new_offset < end; ++it) {
+    const uint64_t diff_begin = std::max(begin, it->new_offset);
+    const uint64_t diff_end = std::min(end, it->new_offset + it->diff_size);
+    for (uint64_t pos = diff_begin; pos < diff_end; pos++) {
+      const uint64_t i = pos - it->new_offset;
+      uint8_t byte = diff[it->diff_offset + i];
+      const int64_t old_pos = it->old_pos + static_cast<int64_t>(i);
+      if (old_pos >= 0 && static_cast<uint64_t>(old_pos) < old_data.size())
+        byte += old_data[old_pos];
+      new_data[pos] = byte;
+    }
+
+    const uint64_t extra_start = it->new_offset + it->diff_size;
+    const uint64_t extra_begin = std::max(begin, extra_start);
+    const uint64_t extra_end = std::min(end, extra_start + it->extra_size);
+    if (extra_begin < extra_end) {
+      memcpy(new_data + extra_begin,
+             extra.data() + it->extra_offset + (extra_begin - extra_start),
+             extra_end - extra_begin);
+    }
+  }
+}
+
+// Runs a function on a thread.
+class FunctionDelegate : public base::DelegateSimpleThread::Delegate {
+ public:
+  explicit FunctionDelegate(std::function<void()> function)
+      : function_(std::move(function)) {}
+  ~FunctionDelegate() override = default;
+
+  // Overrides DelegateSimpleThread::Delegate.
+  void Run() override { function_(); }
+
+ private:
+  std::function<void()> function_;
+
+  DISALLOW_COPY_AND_ASSIGN(FunctionDelegate);
+};
+
+}  // namespace
+
+bool ZstdBspatch(const uint8_t* patch,
+                 size_t patch_size,
+                 ExtentReader* old_reader,
+                 uint64_t old_size,
+                 ExtentWriter* new_writer) {
+  ZstdBsdiffStreams streams;
+  TEST_AND_RETURN_FALSE(OpenZstdBsdiffPatch(patch, patch_size, &streams));
+
+  brillo::Blob new_buffer(kChunkSize);
+  brillo::Blob old_buffer(kChunkSize);
+  int64_t old_pos = 0;
+  uint64_t new_pos = 0;
+  while (new_pos < streams.new_size) {
+    ControlEntry entry;
+    TEST_AND_RETURN_FALSE(ReadControlEntry(&streams, new_pos, &entry));
+
+    // Add the diff stream to the old data. The bytes out of the old data are
+    // taken from the diff stream as is.
+    for (uint64_t done = 0; done < entry.diff_size;) {
+      const size_t chunk_size =
+          std::min<uint64_t>(kChunkSize, entry.diff_size - done);
+      TEST_AND_RETURN_FALSE(streams.diff.Read(new_buffer.data(), chunk_size));
+      const int64_t chunk_old_pos = old_pos + static_cast<int64_t>(done);
+      const int64_t read_start = std::max<int64_t>(chunk_old_pos, 0);
+      const int64_t read_end = std::min<int64_t>(
+          chunk_old_pos + static_cast<int64_t>(chunk_size), old_size);
+      if (read_start < read_end) {
+        const size_t read_size = read_end - read_start;
+        TEST_AND_RETURN_FALSE(old_reader->Seek(read_start));
+        TEST_AND_RETURN_FALSE(old_reader->Read(old_buffer.data(), read_size));
+        uint8_t* new_bytes = new_buffer.data() + (read_start - chunk_old_pos);
+        for (size_t i = 0; i < read_size; i++)
+          new_bytes[i] += old_buffer[i];
+      }
+      TEST_AND_RETURN_FALSE(new_writer->Write(new_buffer.data(), chunk_size));
+      done += chunk_size;
+    }
+
+    // Copy the extra stream.
+    for (uint64_t done = 0; done < entry.extra_size;) {
+      const size_t chunk_size =
+          std::min<uint64_t>(kChunkSize, entry.extra_size - done);
+      TEST_AND_RETURN_FALSE(streams.extra.Read(new_buffer.data(), chunk_size));
+      TEST_AND_RETURN_FALSE(new_writer->Write(new_buffer.data(), chunk_size));
+      done += chunk_size;
+    }
+
+    new_pos += entry.diff_size + entry.extra_size;
+    old_pos += static_cast<int64_t>(entry.diff_size) + entry.offset_increment;
+  }
+  return true;
+}
+
+bool ZstdBspatchParallel(const uint8_t* patch,
+                         size_t patch_size,
+                         ExtentReader* old_reader,
+                         uint64_t old_size,
+                         ExtentWriter* new_writer,
+                         size_t num_threads) {
+  if (num_threads <= 1)
+    return ZstdBspatch(patch, patch_size, old_reader, old_size, new_writer);
+
+  ZstdBsdiffStreams streams;
+  TEST_AND_RETURN_FALSE(OpenZstdBsdiffPatch(patch, patch_size, &streams));
+  const uint64_t new_size = streams.new_size;
+
+  // The control stream gives where each entry writes the new data, so the new
+  // data can be split into ranges patched independently.
+  std::vector<PatchRange> ranges;
+  uint64_t diff_size = 0;
+  uint64_t extra_size = 0;
+  int64_t old_pos = 0;
+  uint64_t new_pos = 0;
+  while (new_pos < new_size) {
+    ControlEntry entry;
+    TEST_AND_RETURN_FALSE(ReadControlEntry(&streams, new_pos, &entry));
+    ranges.push_back({new_pos,
+                      diff_size,
+                      extra_size,
+                      old_pos,
+                      entry.diff_size,
+                      entry.extra_size});
+    diff_size += entry.diff_size;
+    extra_size += entry.extra_size;
+    new_pos += entry.diff_size + entry.extra_size;
+    old_pos += static_cast<int64_t>(entry.diff_size) + entry.offset_increment;
+  }
+  if (ranges.empty())
+    return true;
+
+  // Decompress the extra stream on a thread while the diff stream and the old
+  // data are read on this one.
+  brillo::Blob extra(extra_size);
+  bool extra_success = true;
+  FunctionDelegate extra_delegate([&streams, &extra, &extra_success] {
+    extra_success = streams.extra.Read(extra.data(), extra.size());
+  });
+  base::DelegateSimpleThread extra_thread(&extra_delegate, "bspatch-extra");
+  extra_thread.Start();
+  brillo::Blob diff(diff_size);
+  bool success = streams.diff.Read(diff.data(), diff.size());
+  brillo::Blob old_data(old_size);
+  success = success && old_reader->Seek(0) &&
+            old_reader->Read(old_data.data(), old_data.size());
+  extra_thread.Join();
+  TEST_AND_RETURN_FALSE(success && extra_success);
+
+  brillo::Blob new_data(new_size);
+  const uint64_t range_size = (new_size + num_threads - 1) / num_threads;
+  std::vector<std::unique_ptr<FunctionDelegate>> delegates;
+  for (uint64_t begin = 0; begin < new_size; begin += range_size) {
+    const uint64_t end = std::min(begin + range_size, new_size);
+    delegates.push_back(std::make_unique<FunctionDelegate>([&, begin, end] {
+      PatchNewData(
+          ranges, old_data, diff, extra, begin, end, new_data.data());
+    }));
+  }
+  base::DelegateSimpleThreadPool thread_pool("bspatch", delegates.size());
+  thread_pool.Start();
+  for (auto& delegate : delegates)
+    thread_pool.AddWork(delegate.get());
+  thread_pool.JoinAll();
+
+  TEST_AND_RETURN_FALSE(new_writer->Write(new_data.data(), new_data.size()));
+  return true;
+}
+
+}  // namespace chromeos_update_engine
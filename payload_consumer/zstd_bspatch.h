@@ -0,0 +1,69 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_ZSTD_BSPATCH_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_ZSTD_BSPATCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "update_engine/payload_consumer/extent_reader.h"
+#include "update_engine/payload_consumer/extent_writer.h"
+
+namespace chromeos_update_engine {
+
+// The ZSTD_BSDIFF patches hold the control, diff and extra streams of a bsdiff
+// patch, each compressed as a zstd frame with a window of at most 8 MiB. The
+// patch starts with a header of |kZstdBsdiffHeaderSize| bytes:
+//   char[8]  magic: "ZSTDBSDF".
+//   uint64   the size of the compressed control stream, little endian.
+//   uint64   the size of the compressed diff stream, little endian.
+//   uint64   the size of the new data, little endian.
+// followed by the control, diff and extra frames, where an empty stream has no
+// frame at all. The control stream is a sequence of entries of three little
+// endian int64: the number of bytes of the diff stream to add to the old data,
+// the number of bytes to copy from the extra stream, and the offset to then
+// move by in the old data.
+extern const char kZstdBsdiffMagic[8];
+extern const size_t kZstdBsdiffHeaderSize;
+
+// Applies the ZSTD_BSDIFF |patch| of |patch_size| bytes to the |old_size|
+// bytes of old data read from |old_reader|, and writes the new data to
+// |new_writer|. The streams are decompressed as they are applied, so it uses
+// a fixed amount of memory whatever the size of the data. Returns whether the
+// patch was applied.
+bool ZstdBspatch(const uint8_t* patch,
+                 size_t patch_size,
+                 ExtentReader* old_reader,
+                 uint64_t old_size,
+                 ExtentWriter* new_writer);
+
+// Like ZstdBspatch(), but applies the patch with up to |num_threads| threads.
+// The old data is read at once while the diff and extra streams are
+// decompressed in parallel, then ranges of the new data are patched by each
+// thread and written at once. It holds the old data and twice the new data in
+// memory, so it is meant for the big patches of the devices that have it.
+bool ZstdBspatchParallel(const uint8_t* patch,
+                         size_t patch_size,
+                         ExtentReader* old_reader,
+                         uint64_t old_size,
+                         ExtentWriter* new_writer,
+                         size_t num_threads);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_ZSTD_BSPATCH_H_
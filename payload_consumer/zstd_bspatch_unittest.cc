@@ -0,0 +1,127 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/zstd_bspatch.h"
+
+#include <fcntl.h>
+
+#include <algorithm>
+
+#include <brillo/secure_blob.h>
+#include <bsdiff/bsdiff.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/fake_extent_writer.h"
+#include "update_engine/payload_consumer/file_descriptor.h"
+#include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/zstd_bsdiff_patch_writer.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+const size_t kBlockSize = 4096;
+const size_t kNumBlocks = 16;
+}  // namespace
+
+class ZstdBspatchTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    old_data_.resize(kBlockSize * kNumBlocks);
+    test_utils::FillWithData(&old_data_);
+    ASSERT_TRUE(test_utils::WriteFileVector(old_file_.path(), old_data_));
+    old_fd_.reset(new EintrSafeFileDescriptor());
+    ASSERT_TRUE(old_fd_->Open(old_file_.path().c_str(), O_RDONLY, 0600));
+    *old_extents_.Add() = ExtentForRange(0, kNumBlocks);
+
+    // Swap the two halves of the old data, change some bytes and add some new
+    // data, so the patch has backward moves, diff and extra bytes.
+    const size_t half = old_data_.size() / 2;
+    new_data_.assign(old_data_.begin() + half, old_data_.end());
+    new_data_.insert(
+        new_data_.end(), old_data_.begin(), old_data_.begin() + half);
+    for (size_t i = 0; i < new_data_.size(); i += 1000)
+      new_data_[i] ^= 0x5a;
+    std::fill(new_data_.begin() + 10000, new_data_.begin() + 12000, 'x');
+
+    ZstdBsdiffPatchWriter patch_writer(&patch_);
+    ASSERT_EQ(0,
+              bsdiff::bsdiff(old_data_.data(),
+                             old_data_.size(),
+                             new_data_.data(),
+                             new_data_.size(),
+                             &patch_writer,
+                             nullptr));
+  }
+
+  void TearDown() override { old_fd_->Close(); }
+
+  // Applies the |patch_| with |num_threads| threads and stores the new data
+  // in |new_data|.
+  bool ApplyPatch(size_t num_threads, brillo::Blob* new_data) {
+    DirectExtentReader old_reader;
+    TEST_AND_RETURN_FALSE(old_reader.Init(old_fd_, old_extents_, kBlockSize));
+    FakeExtentWriter new_writer;
+    TEST_AND_RETURN_FALSE(new_writer.Init(nullptr, {}, kBlockSize));
+    TEST_AND_RETURN_FALSE(ZstdBspatchParallel(patch_.data(),
+                                              patch_.size(),
+                                              &old_reader,
+                                              old_data_.size(),
+                                              &new_writer,
+                                              num_threads));
+    *new_data = new_writer.WrittenData();
+    return true;
+  }
+
+  test_utils::ScopedTempFile old_file_{"ZstdBspatchTest-old.XXXXXX"};
+  FileDescriptorPtr old_fd_;
+  google::protobuf::RepeatedPtrField<Extent> old_extents_;
+  brillo::Blob old_data_;
+  brillo::Blob new_data_;
+  brillo::Blob patch_;
+};
+
+TEST_F(ZstdBspatchTest, SerialPatchTest) {
+  brillo::Blob new_data;
+  EXPECT_TRUE(ApplyPatch(1, &new_data));
+  EXPECT_EQ(new_data_, new_data);
+}
+
+TEST_F(ZstdBspatchTest, ParallelPatchTest) {
+  // Uneven ranges of the new data are patched by each thread.
+  for (size_t num_threads : {2, 3, 7}) {
+    brillo::Blob new_data;
+    EXPECT_TRUE(ApplyPatch(num_threads, &new_data));
+    EXPECT_EQ(new_data_, new_data);
+  }
+}
+
+TEST_F(ZstdBspatchTest, BadPatchTest) {
+  brillo::Blob new_data;
+  patch_[0] ^= 1;
+  EXPECT_FALSE(ApplyPatch(1, &new_data));
+  EXPECT_FALSE(ApplyPatch(2, &new_data));
+
+  // A truncated patch is detected by both ways of applying it.
+  patch_[0] ^= 1;
+  patch_.resize(patch_.size() - 1);
+  EXPECT_FALSE(ApplyPatch(1, &new_data));
+  EXPECT_FALSE(ApplyPatch(2, &new_data));
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,80 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/zstd_extent_writer.h"
+
+using google::protobuf::RepeatedPtrField;
+
+namespace chromeos_update_engine {
+
+namespace {
+// The window of a zstd frame has to be kept in RAM during decompression. The
+// generator compresses each operation at a level using an 8 MiB window at
+// most, so the frames requiring more than that are rejected.
+const int kZstdMaxWindowLog = 23;
+}  // namespace
+
+template <typename UnderlyingWriter>
+BasicZstdExtentWriter<UnderlyingWriter>::~BasicZstdExtentWriter() {
+  ZSTD_freeDCtx(stream_);
+}
+
+template <typename UnderlyingWriter>
+bool BasicZstdExtentWriter<UnderlyingWriter>::Init(
+    FileDescriptorPtr fd,
+    const RepeatedPtrField<Extent>& extents,
+    uint32_t block_size) {
+  stream_ = ZSTD_createDCtx();
+  TEST_AND_RETURN_FALSE(stream_ != nullptr);
+  size_t ret =
+      ZSTD_DCtx_setParameter(stream_, ZSTD_d_windowLogMax, kZstdMaxWindowLog);
+  if (ZSTD_isError(ret)) {
+    LOG(ERROR) << "ZSTD_DCtx_setParameter failed: " << ZSTD_getErrorName(ret);
+    return false;
+  }
+  output_buffer_.resize(ZSTD_DStreamOutSize());
+  return underlying_writer_->Init(fd, extents, block_size);
+}
+
+template <typename UnderlyingWriter>
+bool BasicZstdExtentWriter<UnderlyingWriter>::Write(const void* bytes,
+                                                    size_t count) {
+  // zstd keeps the unconsumed input in its own context, so all the input is
+  // always consumed. A full output buffer may leave decompressed data behind,
+  // so it is flushed before returning.
+  ZSTD_inBuffer input = {bytes, count, 0};
+  for (;;) {
+    ZSTD_outBuffer output = {output_buffer_.data(), output_buffer_.size(), 0};
+    size_t ret = ZSTD_decompressStream(stream_, &output, &input);
+    if (ZSTD_isError(ret)) {
+      LOG(ERROR) << "ZSTD_decompressStream failed: " << ZSTD_getErrorName(ret);
+      return false;
+    }
+    if (output.pos > 0) {
+      TEST_AND_RETURN_FALSE(
+          underlying_writer_->Write(output_buffer_.data(), output.pos));
+    }
+    if (input.pos == input.size && output.pos < output.size)
+      break;
+  }
+  return true;
+}
+
+template class BasicZstdExtentWriter<ExtentWriter>;
+template class BasicZstdExtentWriter<DirectExtentWriter>;
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,65 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_ZSTD_EXTENT_WRITER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_ZSTD_EXTENT_WRITER_H_
+
+#include <zstd.h>
+
+#include <memory>
+#include <utility>
+
+#include <brillo/secure_blob.h>
+
+#include "update_engine/payload_consumer/extent_writer.h"
+
+// ZstdExtentWriter is a concrete ExtentWriter subclass that zstd-decompresses
+// what it's given in Write. The data is decompressed as it arrives and passed
+// to an underlying ExtentWriter.
+//
+// BasicZstdExtentWriter<T> passes the data to an underlying T instead.
+
+namespace chromeos_update_engine {
+
+template <typename UnderlyingWriter>
+class BasicZstdExtentWriter final : public ExtentWriter {
+ public:
+  explicit BasicZstdExtentWriter(
+      std::unique_ptr<UnderlyingWriter> underlying_writer)
+      : underlying_writer_(std::move(underlying_writer)) {}
+  ~BasicZstdExtentWriter() override;
+
+  bool Init(FileDescriptorPtr fd,
+            const google::protobuf::RepeatedPtrField<Extent>& extents,
+            uint32_t block_size) override;
+  bool Write(const void* bytes, size_t count) override;
+
+ private:
+  // The underlying ExtentWriter.
+  std::unique_ptr<UnderlyingWriter> underlying_writer_;
+  // The zstd decompression context.
+  ZSTD_DCtx* stream_{nullptr};
+  brillo::Blob output_buffer_;
+
+  DISALLOW_COPY_AND_ASSIGN(BasicZstdExtentWriter);
+};
+
+using ZstdExtentWriter = BasicZstdExtentWriter<ExtentWriter>;
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_ZSTD_EXTENT_WRITER_H_
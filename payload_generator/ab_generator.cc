@@ -20,6 +20,7 @@
 #include <utility>
 
 #include <base/strings/stringprintf.h>
+#include <base/threading/simple_thread.h>
 
 #include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/utils.h"
@@ -28,6 +29,9 @@
 #include "update_engine/payload_generator/bzip.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
 #include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/diff_cache.h"
+#include "update_engine/payload_generator/mapped_image.h"
+#include "update_engine/payload_generator/phase_timings.h"
 
 using chromeos_update_engine::diff_utils::IsAReplaceOperation;
 using std::string;
@@ -35,6 +39,65 @@ using std::vector;
 
 namespace chromeos_update_engine {
 
+namespace {
+
+// The number of ranges of operations hashed by each thread. Smaller ranges
+// balance the work better when some operations read much more than others.
+const size_t kSourceHashRangesPerThread = 4;
+
+// Adds the source hash to a range of operations, reading their source extents
+// from the source partition. The source extents of different operations can
+// overlap, but the data is only read, so the ranges can be hashed in parallel.
+class SourceHashProcessor : public base::DelegateSimpleThread::Delegate {
+ public:
+  SourceHashProcessor(const string& source_part_path,
+                      AnnotatedOperation* begin,
+                      AnnotatedOperation* end)
+      : source_part_path_(source_part_path), begin_(begin), end_(end) {}
+  SourceHashProcessor(SourceHashProcessor&&) = default;
+  ~SourceHashProcessor() override = default;
+
+  // Overrides DelegateSimpleThread::Delegate.
+  void Run() override;
+
+  bool success() const { return success_; }
+
+ private:
+  const string& source_part_path_;
+  AnnotatedOperation* begin_;
+  AnnotatedOperation* end_;
+  bool success_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(SourceHashProcessor);
+};
+
+void SourceHashProcessor::Run() {
+  for (AnnotatedOperation* aop = begin_; aop != end_; ++aop) {
+    if (aop->op.src_extents_size() == 0)
+      continue;
+
+    vector<Extent> src_extents;
+    ExtentsToVector(aop->op.src_extents(), &src_extents);
+    ImageExtentsData src_data;
+    brillo::Blob src_hash;
+    uint64_t src_length =
+        aop->op.has_src_length()
+            ? aop->op.src_length()
+            : utils::BlocksInExtents(aop->op.src_extents()) * kBlockSize;
+    if (!src_data.Load(
+            source_part_path_, src_extents, src_length, kBlockSize) ||
+        !HashCalculator::RawHashOfBytes(
+            src_data.data(), src_data.size(), &src_hash)) {
+      LOG(ERROR) << "Failed to hash the source of operation " << aop->name;
+      return;
+    }
+    aop->op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+  }
+  success_ = true;
+}
+
+}  // namespace
+
 bool ABGenerator::GenerateOperations(const PayloadGenerationConfig& config,
                                      const PartitionConfig& old_part,
                                      const PartitionConfig& new_part,
@@ -47,15 +110,25 @@ bool ABGenerator::GenerateOperations(const PayloadGenerationConfig& config,
            ? -1
            : config.hard_chunk_size / config.block_size);
   size_t soft_chunk_blocks = config.soft_chunk_size / config.block_size;
+  diff_utils::DiffSettings settings =
+      diff_utils::GetDiffSettings(config.profile);
+  settings.apply_cost = diff_utils::GetApplyCostModel(config.device_class);
+  settings.num_shards = config.num_shards;
+  settings.shard_index = config.shard_index;
 
   aops->clear();
-  TEST_AND_RETURN_FALSE(diff_utils::DeltaReadPartition(aops,
-                                                       old_part,
-                                                       new_part,
-                                                       hard_chunk_blocks,
-                                                       soft_chunk_blocks,
-                                                       config.version,
-                                                       blob_file));
+  TEST_AND_RETURN_FALSE(
+      diff_utils::DeltaReadPartition(aops,
+                                     old_part,
+                                     new_part,
+                                     hard_chunk_blocks,
+                                     soft_chunk_blocks,
+                                     config.content_defined_chunking,
+                                     config.memory_budget,
+                                     config.version,
+                                     settings,
+                                     diff_cache_,
+                                     blob_file));
   LOG(INFO) << "done reading " << new_part.name;
 
   SortOperationsByDestination(aops);
@@ -69,12 +142,27 @@ bool ABGenerator::GenerateOperations(const PayloadGenerationConfig& config,
   }
 
   LOG(INFO) << "Merging " << aops->size() << " operations.";
-  TEST_AND_RETURN_FALSE(MergeOperations(
-      aops, config.version, merge_chunk_blocks, new_part.path, blob_file));
+  {
+    ScopedPhaseTimer timer(kPhaseMergeOperations);
+    TEST_AND_RETURN_FALSE(MergeOperations(aops,
+                                          config.version,
+                                          settings.apply_cost,
+                                          merge_chunk_blocks,
+                                          new_part.path,
+                                          blob_file));
+  }
   LOG(INFO) << aops->size() << " operations after merge.";
 
-  if (config.version.minor >= kOpSrcHashMinorPayloadVersion)
+  if (config.sort_operations_by_source) {
+    ScopedPhaseTimer timer(kPhaseMergeOperations);
+    SortAndMergeOperationsBySource(aops, merge_chunk_blocks);
+    LOG(INFO) << aops->size() << " operations after merge by source.";
+  }
+
+  if (config.version.minor >= kOpSrcHashMinorPayloadVersion) {
+    ScopedPhaseTimer timer(kPhaseSourceHashes);
     TEST_AND_RETURN_FALSE(AddSourceHash(aops, old_part.path));
+  }
 
   return true;
 }
@@ -84,12 +172,15 @@ void ABGenerator::SortOperationsByDestination(
   sort(aops->begin(), aops->end(), diff_utils::CompareAopsByDestination);
 }
 
-bool ABGenerator::FragmentOperations(const PayloadVersion& version,
-                                     vector<AnnotatedOperation>* aops,
-                                     const string& target_part_path,
-                                     BlobFileWriter* blob_file) {
+bool ABGenerator::FragmentOperations(
+    const PayloadVersion& version,
+    const diff_utils::ApplyCostModel& apply_cost,
+    vector<AnnotatedOperation>* aops,
+    const string& target_part_path,
+    BlobFileWriter* blob_file) {
   vector<AnnotatedOperation> fragmented_aops;
-  for (const AnnotatedOperation& aop : *aops) {
+  fragmented_aops.reserve(aops->size());
+  for (AnnotatedOperation& aop : *aops) {
     // Only do split if the operation has more than one dst extents.
     if (aop.op.dst_extents_size() > 1) {
       if (aop.op.type() == InstallOperation::SOURCE_COPY) {
@@ -97,12 +188,16 @@ bool ABGenerator::FragmentOperations(const PayloadVersion& version,
         continue;
       }
       if (IsAReplaceOperation(aop.op.type())) {
-        TEST_AND_RETURN_FALSE(SplitAReplaceOp(
-            version, aop, target_part_path, &fragmented_aops, blob_file));
+        TEST_AND_RETURN_FALSE(SplitAReplaceOp(version,
+                                              apply_cost,
+                                              aop,
+                                              target_part_path,
+                                              &fragmented_aops,
+                                              blob_file));
         continue;
       }
     }
-    fragmented_aops.push_back(aop);
+    fragmented_aops.push_back(std::move(aop));
   }
   *aops = std::move(fragmented_aops);
   return true;
@@ -110,7 +205,7 @@ bool ABGenerator::FragmentOperations(const PayloadVersion& version,
 
 bool ABGenerator::SplitSourceCopy(const AnnotatedOperation& original_aop,
                                   vector<AnnotatedOperation>* result_aops) {
-  InstallOperation original_op = original_aop.op;
+  const InstallOperation& original_op = original_aop.op;
   TEST_AND_RETURN_FALSE(original_op.type() == InstallOperation::SOURCE_COPY);
   // Keeps track of the index of curr_src_ext.
   int curr_src_ext_index = 0;
@@ -147,9 +242,9 @@ bool ABGenerator::SplitSourceCopy(const AnnotatedOperation& original_aop,
     *(new_op.add_dst_extents()) = dst_ext;
 
     AnnotatedOperation new_aop;
-    new_aop.op = new_op;
+    new_aop.op.Swap(&new_op);
     new_aop.name = base::StringPrintf("%s:%d", original_aop.name.c_str(), i);
-    result_aops->push_back(new_aop);
+    result_aops->push_back(std::move(new_aop));
   }
   if (curr_src_ext_index != original_op.src_extents().size() - 1) {
     LOG(FATAL) << "Incorrectly split SOURCE_COPY operation. Did not use all "
@@ -159,11 +254,12 @@ bool ABGenerator::SplitSourceCopy(const AnnotatedOperation& original_aop,
 }
 
 bool ABGenerator::SplitAReplaceOp(const PayloadVersion& version,
+                                  const diff_utils::ApplyCostModel& apply_cost,
                                   const AnnotatedOperation& original_aop,
                                   const string& target_part_path,
                                   vector<AnnotatedOperation>* result_aops,
                                   BlobFileWriter* blob_file) {
-  InstallOperation original_op = original_aop.op;
+  const InstallOperation& original_op = original_aop.op;
   TEST_AND_RETURN_FALSE(IsAReplaceOperation(original_op.type()));
   const bool is_replace = original_op.type() == InstallOperation::REPLACE;
 
@@ -183,25 +279,27 @@ bool ABGenerator::SplitAReplaceOp(const PayloadVersion& version,
     }
 
     AnnotatedOperation new_aop;
-    new_aop.op = new_op;
+    new_aop.op.Swap(&new_op);
     new_aop.name = base::StringPrintf("%s:%d", original_aop.name.c_str(), i);
-    TEST_AND_RETURN_FALSE(
-        AddDataAndSetType(&new_aop, version, target_part_path, blob_file));
+    TEST_AND_RETURN_FALSE(AddDataAndSetType(
+        &new_aop, version, apply_cost, target_part_path, blob_file));
 
-    result_aops->push_back(new_aop);
+    result_aops->push_back(std::move(new_aop));
   }
   return true;
 }
 
 bool ABGenerator::MergeOperations(vector<AnnotatedOperation>* aops,
                                   const PayloadVersion& version,
+                                  const diff_utils::ApplyCostModel& apply_cost,
                                   size_t chunk_blocks,
                                   const string& target_part_path,
                                   BlobFileWriter* blob_file) {
   vector<AnnotatedOperation> new_aops;
-  for (const AnnotatedOperation& curr_aop : *aops) {
+  new_aops.reserve(aops->size());
+  for (AnnotatedOperation& curr_aop : *aops) {
     if (new_aops.empty()) {
-      new_aops.push_back(curr_aop);
+      new_aops.push_back(std::move(curr_aop));
       continue;
     }
     AnnotatedOperation& last_aop = new_aops.back();
@@ -209,7 +307,7 @@ bool ABGenerator::MergeOperations(vector<AnnotatedOperation>* aops,
 
     if (last_aop.op.dst_extents_size() <= 0 ||
         curr_aop.op.dst_extents_size() <= 0) {
-      new_aops.push_back(curr_aop);
+      new_aops.push_back(std::move(curr_aop));
       continue;
     }
     uint32_t last_dst_idx = last_aop.op.dst_extents_size() - 1;
@@ -245,7 +343,7 @@ bool ABGenerator::MergeOperations(vector<AnnotatedOperation>* aops,
         last_aop.op.set_data_length(0);
     } else {
       // Otherwise just include the extent as is.
-      new_aops.push_back(curr_aop);
+      new_aops.push_back(std::move(curr_aop));
     }
   }
 
@@ -254,31 +352,79 @@ bool ABGenerator::MergeOperations(vector<AnnotatedOperation>* aops,
   for (AnnotatedOperation& curr_aop : new_aops) {
     if (curr_aop.op.data_length() == 0 &&
         IsAReplaceOperation(curr_aop.op.type())) {
-      TEST_AND_RETURN_FALSE(
-          AddDataAndSetType(&curr_aop, version, target_part_path, blob_file));
+      TEST_AND_RETURN_FALSE(AddDataAndSetType(
+          &curr_aop, version, apply_cost, target_part_path, blob_file));
     }
   }
 
-  *aops = new_aops;
+  *aops = std::move(new_aops);
   return true;
 }
 
-bool ABGenerator::AddDataAndSetType(AnnotatedOperation* aop,
-                                    const PayloadVersion& version,
-                                    const string& target_part_path,
-                                    BlobFileWriter* blob_file) {
+void ABGenerator::SortAndMergeOperationsBySource(
+    vector<AnnotatedOperation>* aops, size_t chunk_blocks) {
+  std::stable_sort(
+      aops->begin(),
+      aops->end(),
+      [](const AnnotatedOperation& a, const AnnotatedOperation& b) {
+        if (a.op.src_extents_size() == 0 || b.op.src_extents_size() == 0)
+          return a.op.src_extents_size() > b.op.src_extents_size();
+        return a.op.src_extents(0).start_block() <
+               b.op.src_extents(0).start_block();
+      });
+
+  vector<AnnotatedOperation> new_aops;
+  for (AnnotatedOperation& curr_aop : *aops) {
+    if (!new_aops.empty()) {
+      AnnotatedOperation& last_aop = new_aops.back();
+      if (last_aop.op.type() == InstallOperation::SOURCE_COPY &&
+          curr_aop.op.type() == InstallOperation::SOURCE_COPY &&
+          last_aop.op.src_extents_size() > 0 &&
+          curr_aop.op.src_extents_size() > 0) {
+        const Extent& last_src_ext =
+            last_aop.op.src_extents(last_aop.op.src_extents_size() - 1);
+        uint64_t combined_block_count =
+            utils::BlocksInExtents(last_aop.op.src_extents()) +
+            utils::BlocksInExtents(curr_aop.op.src_extents());
+        if (last_src_ext.start_block() + last_src_ext.num_blocks() ==
+                curr_aop.op.src_extents(0).start_block() &&
+            combined_block_count <= chunk_blocks) {
+          // The source and destination blocks are paired in order, so both
+          // lists are extended the same way.
+          last_aop.name = base::StringPrintf(
+              "%s,%s", last_aop.name.c_str(), curr_aop.name.c_str());
+          ExtendExtents(last_aop.op.mutable_src_extents(),
+                        curr_aop.op.src_extents());
+          ExtendExtents(last_aop.op.mutable_dst_extents(),
+                        curr_aop.op.dst_extents());
+          continue;
+        }
+      }
+    }
+    new_aops.push_back(std::move(curr_aop));
+  }
+  *aops = std::move(new_aops);
+}
+
+bool ABGenerator::AddDataAndSetType(
+    AnnotatedOperation* aop,
+    const PayloadVersion& version,
+    const diff_utils::ApplyCostModel& apply_cost,
+    const string& target_part_path,
+    BlobFileWriter* blob_file) {
   TEST_AND_RETURN_FALSE(IsAReplaceOperation(aop->op.type()));
 
   vector<Extent> dst_extents;
   ExtentsToVector(aop->op.dst_extents(), &dst_extents);
   brillo::Blob data(utils::BlocksInExtents(dst_extents) * kBlockSize);
-  TEST_AND_RETURN_FALSE(utils::ReadExtents(
+  TEST_AND_RETURN_FALSE(ReadImageExtents(
       target_part_path, dst_extents, &data, data.size(), kBlockSize));
 
   brillo::Blob blob;
   InstallOperation::Type op_type;
   TEST_AND_RETURN_FALSE(
-      diff_utils::GenerateBestFullOperation(data, version, &blob, &op_type));
+      diff_utils::GenerateBestFullOperation(
+          data, version, apply_cost, &blob, &op_type));
 
   // If the operation doesn't point to a data blob or points to a data blob of
   // a different type then we add it.
@@ -292,22 +438,28 @@ bool ABGenerator::AddDataAndSetType(AnnotatedOperation* aop,
 
 bool ABGenerator::AddSourceHash(vector<AnnotatedOperation>* aops,
                                 const string& source_part_path) {
-  for (AnnotatedOperation& aop : *aops) {
-    if (aop.op.src_extents_size() == 0)
-      continue;
-
-    vector<Extent> src_extents;
-    ExtentsToVector(aop.op.src_extents(), &src_extents);
-    brillo::Blob src_data, src_hash;
-    uint64_t src_length =
-        aop.op.has_src_length()
-            ? aop.op.src_length()
-            : utils::BlocksInExtents(aop.op.src_extents()) * kBlockSize;
-    TEST_AND_RETURN_FALSE(utils::ReadExtents(
-        source_part_path, src_extents, &src_data, src_length, kBlockSize));
-    TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfData(src_data, &src_hash));
-    aop.op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+  if (aops->empty())
+    return true;
+
+  size_t max_threads = diff_utils::GetMaxThreads();
+  size_t range_size = utils::DivRoundUp(
+      aops->size(), max_threads * kSourceHashRangesPerThread);
+  vector<SourceHashProcessor> processors;
+  processors.reserve(utils::DivRoundUp(aops->size(), range_size));
+  for (size_t i = 0; i < aops->size(); i += range_size) {
+    size_t end = std::min(i + range_size, aops->size());
+    processors.emplace_back(
+        source_part_path, aops->data() + i, aops->data() + end);
   }
+
+  base::DelegateSimpleThreadPool thread_pool("source-hash", max_threads);
+  thread_pool.Start();
+  for (SourceHashProcessor& processor : processors)
+    thread_pool.AddWork(&processor);
+  thread_pool.JoinAll();
+
+  for (const SourceHashProcessor& processor : processors)
+    TEST_AND_RETURN_FALSE(processor.success());
   return true;
 }
 
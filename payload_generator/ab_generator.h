@@ -25,6 +25,8 @@
 
 #include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_generator/blob_file_writer.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/diff_cache.h"
 #include "update_engine/payload_generator/extent_utils.h"
 #include "update_engine/payload_generator/filesystem_interface.h"
 #include "update_engine/payload_generator/operations_generator.h"
@@ -38,7 +40,8 @@ namespace chromeos_update_engine {
 // minor version 2 format.
 class ABGenerator : public OperationsGenerator {
  public:
-  ABGenerator() = default;
+  // The diffs are reused from and stored in the |diff_cache|, if not null.
+  explicit ABGenerator(DiffCache* diff_cache) : diff_cache_(diff_cache) {}
 
   // Generate the update payload operations for the given partition using
   // SOURCE_* operations, used for generating deltas for the minor version
@@ -60,8 +63,10 @@ class ABGenerator : public OperationsGenerator {
   // BSDIFF and SOURCE_BSDIFF, PUFFDIFF and BROTLI_BSDIFF operations.  The
   // |target_part_path| is the filename of the new image, where the destination
   // extents refer to. The blobs of the operations in |aops| should reference
-  // |blob_file|. |blob_file| are updated if needed.
+  // |blob_file|. |blob_file| are updated if needed. The REPLACE_* operations
+  // are recompressed as picked by the |apply_cost| model.
   static bool FragmentOperations(const PayloadVersion& version,
+                                 const diff_utils::ApplyCostModel& apply_cost,
                                  std::vector<AnnotatedOperation>* aops,
                                  const std::string& target_part_path,
                                  BlobFileWriter* blob_file);
@@ -89,6 +94,7 @@ class ABGenerator : public OperationsGenerator {
   // to |ops| will have only one dst extent each, and may be of a different
   // type depending on whether compression is advantageous.
   static bool SplitAReplaceOp(const PayloadVersion& version,
+                              const diff_utils::ApplyCostModel& apply_cost,
                               const AnnotatedOperation& original_aop,
                               const std::string& target_part,
                               std::vector<AnnotatedOperation>* result_aops,
@@ -102,15 +108,27 @@ class ABGenerator : public OperationsGenerator {
   //   - Their destination blocks are contiguous.
   //   - Their combined blocks do not exceed |chunk_blocks| blocks.
   // Note that unlike other methods, you can't pass a negative number in
-  // |chunk_blocks|.
+  // |chunk_blocks|. The merged REPLACE_* operations are recompressed as picked
+  // by the |apply_cost| model.
   static bool MergeOperations(std::vector<AnnotatedOperation>* aops,
                               const PayloadVersion& version,
+                              const diff_utils::ApplyCostModel& apply_cost,
                               size_t chunk_blocks,
                               const std::string& target_part,
                               BlobFileWriter* blob_file);
 
+  // Sorts the operations |aops| reading the source partition by their first
+  // source block, followed by the other operations in their current order,
+  // and merges the SOURCE_COPY operations whose source blocks are contiguous
+  // as long as their combined blocks do not exceed |chunk_blocks| blocks. The
+  // source partition is then read mostly sequentially by the client. The A/B
+  // operations never read the blocks written by another one, so they can be
+  // applied in any order.
+  static void SortAndMergeOperationsBySource(
+      std::vector<AnnotatedOperation>* aops, size_t chunk_blocks);
+
   // Takes a vector of AnnotatedOperations |aops|, adds source hash to all
-  // operations that have src_extents.
+  // operations that have src_extents. The operations are hashed in parallel.
   static bool AddSourceHash(std::vector<AnnotatedOperation>* aops,
                             const std::string& source_part_path);
 
@@ -124,9 +142,12 @@ class ABGenerator : public OperationsGenerator {
   // written. Caller should only set type and data blob if it's valid.
   static bool AddDataAndSetType(AnnotatedOperation* aop,
                                 const PayloadVersion& version,
+                                const diff_utils::ApplyCostModel& apply_cost,
                                 const std::string& target_part_path,
                                 BlobFileWriter* blob_file);
 
+  DiffCache* diff_cache_;
+
   DISALLOW_COPY_AND_ASSIGN(ABGenerator);
 };
 
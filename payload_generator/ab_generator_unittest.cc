@@ -120,8 +120,12 @@ void TestSplitReplaceOrReplaceBzOperation(InstallOperation::Type orig_type,
   vector<AnnotatedOperation> result_ops;
   PayloadVersion version(kChromeOSMajorPayloadVersion,
                          kSourceMinorPayloadVersion);
-  ASSERT_TRUE(ABGenerator::SplitAReplaceOp(
-      version, aop, part_file.path(), &result_ops, &blob_file));
+  ASSERT_TRUE(ABGenerator::SplitAReplaceOp(version,
+                                          diff_utils::ApplyCostModel(),
+                                          aop,
+                                          part_file.path(),
+                                          &result_ops,
+                                          &blob_file));
 
   // Check the result.
   InstallOperation::Type expected_type =
@@ -149,6 +153,7 @@ void TestSplitReplaceOrReplaceBzOperation(InstallOperation::Type orig_type,
   }
   EXPECT_EQ(first_expected_blob.size(), first_op.data_length());
   // Check that the actual blob matches what's expected.
+  ASSERT_TRUE(blob_file.Flush());
   brillo::Blob first_data_blob(first_op.data_length());
   ssize_t bytes_read;
   ASSERT_TRUE(utils::PReadAll(data_fd,
@@ -283,8 +288,12 @@ void TestMergeReplaceOrReplaceBzOperations(InstallOperation::Type orig_type,
   // Merge the operations.
   PayloadVersion version(kChromeOSMajorPayloadVersion,
                          kSourceMinorPayloadVersion);
-  EXPECT_TRUE(ABGenerator::MergeOperations(
-      &aops, version, 5, part_file.path(), &blob_file));
+  EXPECT_TRUE(ABGenerator::MergeOperations(&aops,
+                                           version,
+                                           diff_utils::ApplyCostModel(),
+                                           5,
+                                           part_file.path(),
+                                           &blob_file));
 
   // Check the result.
   InstallOperation::Type expected_op_type =
@@ -310,6 +319,7 @@ void TestMergeReplaceOrReplaceBzOperations(InstallOperation::Type orig_type,
   ASSERT_EQ(expected_blob.size(), new_op.data_length());
   ASSERT_EQ(blob_data.size() + expected_blob.size(),
             static_cast<size_t>(data_file_size));
+  ASSERT_TRUE(blob_file.Flush());
   brillo::Blob new_op_blob(new_op.data_length());
   ssize_t bytes_read;
   ASSERT_TRUE(utils::PReadAll(data_fd,
@@ -466,7 +476,8 @@ TEST_F(ABGeneratorTest, MergeSourceCopyOperationsTest) {
   BlobFileWriter blob_file(0, nullptr);
   PayloadVersion version(kChromeOSMajorPayloadVersion,
                          kSourceMinorPayloadVersion);
-  EXPECT_TRUE(ABGenerator::MergeOperations(&aops, version, 5, "", &blob_file));
+  EXPECT_TRUE(ABGenerator::MergeOperations(
+      &aops, version, diff_utils::ApplyCostModel(), 5, "", &blob_file));
 
   EXPECT_EQ(1U, aops.size());
   InstallOperation first_result_op = aops[0].op;
@@ -539,12 +550,61 @@ TEST_F(ABGeneratorTest, NoMergeOperationsTest) {
   BlobFileWriter blob_file(0, nullptr);
   PayloadVersion version(kChromeOSMajorPayloadVersion,
                          kSourceMinorPayloadVersion);
-  EXPECT_TRUE(ABGenerator::MergeOperations(&aops, version, 4, "", &blob_file));
+  EXPECT_TRUE(ABGenerator::MergeOperations(
+      &aops, version, diff_utils::ApplyCostModel(), 4, "", &blob_file));
 
   // No operations were merged, the number of ops is the same.
   EXPECT_EQ(4U, aops.size());
 }
 
+TEST_F(ABGeneratorTest, SortAndMergeOperationsBySourceTest) {
+  vector<AnnotatedOperation> aops;
+  InstallOperation replace_op;
+  replace_op.set_type(InstallOperation::REPLACE);
+  *(replace_op.add_dst_extents()) = ExtentForRange(0, 1);
+  AnnotatedOperation replace_aop;
+  replace_aop.op = replace_op;
+  replace_aop.name = "replace";
+  aops.push_back(replace_aop);
+
+  // The destinations are in order, but the sources are in reverse order.
+  for (uint64_t i = 0; i < 3; i++) {
+    InstallOperation op;
+    op.set_type(InstallOperation::SOURCE_COPY);
+    *(op.add_src_extents()) = ExtentForRange(20 - 2 * i, 2);
+    *(op.add_dst_extents()) = ExtentForRange(1 + 2 * i, 2);
+    AnnotatedOperation aop;
+    aop.op = op;
+    aop.name = std::to_string(i);
+    aops.push_back(aop);
+  }
+
+  InstallOperation bsdiff_op;
+  bsdiff_op.set_type(InstallOperation::SOURCE_BSDIFF);
+  *(bsdiff_op.add_src_extents()) = ExtentForRange(5, 1);
+  *(bsdiff_op.add_dst_extents()) = ExtentForRange(7, 1);
+  AnnotatedOperation bsdiff_aop;
+  bsdiff_aop.op = bsdiff_op;
+  bsdiff_aop.name = "bsdiff";
+  aops.push_back(bsdiff_aop);
+
+  // Only the last two SOURCE_COPY operations fit in the chunk size.
+  ABGenerator::SortAndMergeOperationsBySource(&aops, 4);
+
+  ASSERT_EQ(4U, aops.size());
+  EXPECT_EQ("bsdiff", aops[0].name);
+  EXPECT_EQ("2,1", aops[1].name);
+  EXPECT_EQ(InstallOperation::SOURCE_COPY, aops[1].op.type());
+  ASSERT_EQ(1, aops[1].op.src_extents_size());
+  EXPECT_TRUE(ExtentEquals(aops[1].op.src_extents(0), 16, 4));
+  ASSERT_EQ(2, aops[1].op.dst_extents_size());
+  EXPECT_TRUE(ExtentEquals(aops[1].op.dst_extents(0), 5, 2));
+  EXPECT_TRUE(ExtentEquals(aops[1].op.dst_extents(1), 3, 2));
+  EXPECT_EQ("0", aops[2].name);
+  // The operations without source are left at the end.
+  EXPECT_EQ("replace", aops[3].name);
+}
+
 TEST_F(ABGeneratorTest, AddSourceHashTest) {
   vector<AnnotatedOperation> aops;
   InstallOperation first_op;
@@ -577,4 +637,32 @@ TEST_F(ABGeneratorTest, AddSourceHashTest) {
   EXPECT_EQ(expected_hash, result_hash);
 }
 
+TEST_F(ABGeneratorTest, AddSourceHashManyOperationsTest) {
+  // More operations than threads, so they are hashed in several ranges.
+  const size_t kNumBlocks = 64;
+  test_utils::ScopedTempFile src_part_file(
+      "AddSourceHashManyOperationsTest_src_part.XXXXXX");
+  brillo::Blob src_data(kNumBlocks * kBlockSize);
+  test_utils::FillWithData(&src_data);
+  ASSERT_TRUE(test_utils::WriteFileVector(src_part_file.path(), src_data));
+
+  vector<AnnotatedOperation> aops(kNumBlocks);
+  for (size_t i = 0; i < kNumBlocks; i++) {
+    aops[i].op.set_type(InstallOperation::SOURCE_COPY);
+    *(aops[i].op.add_src_extents()) = ExtentForRange(kNumBlocks - 1 - i, 1);
+  }
+
+  EXPECT_TRUE(ABGenerator::AddSourceHash(&aops, src_part_file.path()));
+
+  for (size_t i = 0; i < kNumBlocks; i++) {
+    size_t block = kNumBlocks - 1 - i;
+    brillo::Blob expected_hash;
+    EXPECT_TRUE(HashCalculator::RawHashOfBytes(
+        src_data.data() + block * kBlockSize, kBlockSize, &expected_hash));
+    brillo::Blob result_hash(aops[i].op.src_sha256_hash().begin(),
+                             aops[i].op.src_sha256_hash().end());
+    EXPECT_EQ(expected_hash, result_hash);
+  }
+}
+
 }  // namespace chromeos_update_engine
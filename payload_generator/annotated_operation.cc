@@ -16,6 +16,8 @@
 
 #include "update_engine/payload_generator/annotated_operation.h"
 
+#include <utility>
+
 #include <base/format_macros.h>
 #include <base/strings/string_number_conversions.h>
 #include <base/strings/stringprintf.h>
@@ -36,6 +38,20 @@ void OutputExtents(std::ostream* os,
 }
 }  // namespace
 
+AnnotatedOperation::AnnotatedOperation(AnnotatedOperation&& other) noexcept
+    : name(std::move(other.name)) {
+  op.Swap(&other.op);
+}
+
+AnnotatedOperation& AnnotatedOperation::operator=(
+    AnnotatedOperation&& other) noexcept {
+  if (this != &other) {
+    name = std::move(other.name);
+    op.Swap(&other.op);
+  }
+  return *this;
+}
+
 bool AnnotatedOperation::SetOperationBlob(const brillo::Blob& blob,
                                           BlobFileWriter* blob_file) {
   if (blob.empty()) {
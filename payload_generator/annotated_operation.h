@@ -28,6 +28,15 @@
 namespace chromeos_update_engine {
 
 struct AnnotatedOperation {
+  AnnotatedOperation() = default;
+  AnnotatedOperation(const AnnotatedOperation&) = default;
+  AnnotatedOperation& operator=(const AnnotatedOperation&) = default;
+  // Moving an operation swaps its InstallOperation, which never copies the
+  // extents, so the passes sorting and merging the operations of a partition
+  // don't copy them.
+  AnnotatedOperation(AnnotatedOperation&& other) noexcept;
+  AnnotatedOperation& operator=(AnnotatedOperation&& other) noexcept;
+
   // The name given to the operation, for logging and debugging purposes only.
   // This normally includes the path to the file and the chunk used, if any.
   std::string name;
@@ -16,16 +16,51 @@
 
 #include "update_engine/payload_generator/blob_file_writer.h"
 
+#include <utility>
+
 #include "update_engine/common/utils.h"
 
 namespace chromeos_update_engine {
 
+namespace {
+
+// The size of the batches written at once, and how many full batches can
+// wait for the writer thread before storing a blob blocks.
+const size_t kBatchSize = 4 * 1024 * 1024;
+const size_t kMaxQueuedBatches = 4;
+
+}  // namespace
+
+BlobFileWriter::BlobFileWriter(int blob_fd, off_t* blob_file_size)
+    : blob_fd_(blob_fd),
+      blob_file_size_(blob_file_size),
+      batch_queued_(&blob_mutex_),
+      batch_written_(&blob_mutex_) {
+  thread_.reset(new base::DelegateSimpleThread(this, "blob_file_writer"));
+  thread_->Start();
+}
+
+BlobFileWriter::~BlobFileWriter() {
+  LOG_IF(ERROR, !Flush()) << "Failed to write the stored blobs.";
+  {
+    base::AutoLock auto_lock(blob_mutex_);
+    stopping_ = true;
+    batch_queued_.Signal();
+  }
+  thread_->Join();
+}
+
 off_t BlobFileWriter::StoreBlob(const brillo::Blob& blob) {
   base::AutoLock auto_lock(blob_mutex_);
-  if (!utils::PWriteAll(blob_fd_, blob.data(), blob.size(), *blob_file_size_))
+  if (failed_)
     return -1;
 
   off_t result = *blob_file_size_;
+  if (batch_.empty()) {
+    batch_offset_ = result;
+    batch_.reserve(kBatchSize);
+  }
+  batch_.insert(batch_.end(), blob.begin(), blob.end());
   *blob_file_size_ += blob.size();
 
   stored_blobs_++;
@@ -35,12 +70,64 @@ off_t BlobFileWriter::StoreBlob(const brillo::Blob& blob) {
               << stored_blobs_ << "/" << total_blobs_
               << " ops (output size: " << *blob_file_size_ << ")";
   }
+
+  if (batch_.size() >= kBatchSize)
+    QueueBatch();
   return result;
 }
 
+bool BlobFileWriter::Flush() {
+  base::AutoLock auto_lock(blob_mutex_);
+  if (!batch_.empty())
+    QueueBatch();
+  while (!failed_ && (!queued_batches_.empty() || writing_))
+    batch_written_.Wait();
+  return !failed_;
+}
+
 void BlobFileWriter::SetTotalBlobs(size_t total_blobs) {
   total_blobs_ = total_blobs;
   stored_blobs_ = 0;
 }
 
+void BlobFileWriter::QueueBatch() {
+  // The lock is released while waiting, so other blobs may be added to the
+  // batch meanwhile, or another thread may queue it.
+  while (!failed_ && queued_batches_.size() >= kMaxQueuedBatches)
+    batch_written_.Wait();
+  if (failed_ || batch_.empty())
+    return;
+  queued_batches_.push_back({batch_offset_, std::move(batch_)});
+  batch_.clear();
+  batch_queued_.Signal();
+}
+
+void BlobFileWriter::Run() {
+  base::AutoLock auto_lock(blob_mutex_);
+  while (true) {
+    while (queued_batches_.empty() && !stopping_)
+      batch_queued_.Wait();
+    if (queued_batches_.empty())
+      return;
+    Batch batch = std::move(queued_batches_.front());
+    queued_batches_.pop_front();
+    writing_ = true;
+    bool success;
+    {
+      base::AutoUnlock auto_unlock(blob_mutex_);
+      success = utils::PWriteAll(
+          blob_fd_, batch.data.data(), batch.data.size(), batch.offset);
+    }
+    writing_ = false;
+    if (!success) {
+      PLOG(ERROR) << "Unable to write " << batch.data.size()
+                  << " bytes of blobs at offset " << batch.offset;
+      // The following batches can't be written either.
+      failed_ = true;
+      queued_batches_.clear();
+    }
+    batch_written_.Broadcast();
+  }
+}
+
 }  // namespace chromeos_update_engine
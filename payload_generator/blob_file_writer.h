@@ -17,39 +17,89 @@
 #ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_BLOB_FILE_WRITER_H_
 #define UPDATE_ENGINE_PAYLOAD_GENERATOR_BLOB_FILE_WRITER_H_
 
-#include <base/macros.h>
+#include <deque>
+#include <memory>
 
+#include <base/macros.h>
+#include <base/synchronization/condition_variable.h>
 #include <base/synchronization/lock.h>
+#include <base/threading/simple_thread.h>
 #include <brillo/secure_blob.h>
 
 namespace chromeos_update_engine {
 
-class BlobFileWriter {
+// BlobFileWriter stores the blobs of the operations generated by any thread
+// in a file. The blobs are assigned their offset and copied into a large
+// batch right away, and a separate thread writes the full batches to the
+// file, so the threads storing blobs don't wait for the disk. The file only
+// holds all the stored blobs once Flush() returned.
+class BlobFileWriter : public base::DelegateSimpleThread::Delegate {
  public:
   // Create the BlobFileWriter object that will manage the blobs stored to
-  // |blob_fd| in a thread safe way.
-  BlobFileWriter(int blob_fd, off_t* blob_file_size)
-      : blob_fd_(blob_fd), blob_file_size_(blob_file_size) {}
+  // |blob_fd| in a thread safe way. The |blob_file_size| is updated as the
+  // blobs are stored.
+  BlobFileWriter(int blob_fd, off_t* blob_file_size);
+
+  // Writes the blobs stored so far before returning.
+  ~BlobFileWriter() override;
 
   // Store the passed |blob| in the blob file. Returns the offset at which it
-  // was stored, or -1 in case of failure.
+  // is stored, or -1 if writing a previous blob failed.
   off_t StoreBlob(const brillo::Blob& blob);
 
+  // Blocks until all the blobs stored so far are written to the file. Returns
+  // whether all of them were written.
+  bool Flush();
+
   // The number of |total_blobs| is the number of blobs that will be stored but
   // is only used for logging purposes. If not set or set to 0, logging will be
   // skipped. This function will also reset the number of stored blobs to 0.
   void SetTotalBlobs(size_t total_blobs);
 
+  // base::DelegateSimpleThread::Delegate overrides.
+  void Run() override;
+
  private:
+  // A batch of consecutive blobs written with a single write.
+  struct Batch {
+    off_t offset;
+    brillo::Blob data;
+  };
+
+  // Queues the current batch for the writer thread, waiting while too many
+  // batches are queued already. Must be called with |blob_mutex_| held.
+  void QueueBatch();
+
   size_t total_blobs_{0};
   size_t stored_blobs_{0};
 
-  // The file and its size are protected with the |blob_mutex_|.
+  // The file and its size are protected with the |blob_mutex_|, along with
+  // all the members below. The file is only written by the |thread_|.
   int blob_fd_;
   off_t* blob_file_size_;
 
   base::Lock blob_mutex_;
 
+  // Signaled when a batch is queued or the thread should stop.
+  base::ConditionVariable batch_queued_;
+
+  // Signaled when the thread wrote a batch or failed to.
+  base::ConditionVariable batch_written_;
+
+  // The batch receiving the stored blobs and its offset in the file.
+  brillo::Blob batch_;
+  off_t batch_offset_{0};
+
+  // The full batches waiting to be written, and whether one is being written.
+  std::deque<Batch> queued_batches_;
+  bool writing_{false};
+
+  bool stopping_{false};
+  bool failed_{false};
+
+  // The thread writing the batches to the file.
+  std::unique_ptr<base::DelegateSimpleThread> thread_;
+
   DISALLOW_COPY_AND_ASSIGN(BlobFileWriter);
 };
 
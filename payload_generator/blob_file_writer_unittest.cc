@@ -16,6 +16,8 @@
 
 #include "update_engine/payload_generator/blob_file_writer.h"
 
+#include <fcntl.h>
+
 #include <string>
 
 #include <gtest/gtest.h>
@@ -43,6 +45,7 @@ TEST(BlobFileWriterTest, SimpleTest) {
   FillWithData(&blob);
   EXPECT_EQ(0, blob_file.StoreBlob(blob));
   EXPECT_EQ(blob_size, blob_file.StoreBlob(blob));
+  EXPECT_TRUE(blob_file.Flush());
 
   brillo::Blob stored_blob(blob_size);
   ssize_t bytes_read;
@@ -52,4 +55,44 @@ TEST(BlobFileWriterTest, SimpleTest) {
   EXPECT_EQ(blob, stored_blob);
 }
 
+TEST(BlobFileWriterTest, ManyBatchesTest) {
+  test_utils::ScopedTempFile blob_file_path("BlobFileWriterTest.XXXXXX");
+  int blob_fd = open(blob_file_path.path().c_str(), O_WRONLY);
+  ASSERT_GE(blob_fd, 0);
+  ScopedFdCloser blob_fd_closer(&blob_fd);
+  off_t blob_file_size = 0;
+  brillo::Blob expected;
+  {
+    BlobFileWriter blob_file(blob_fd, &blob_file_size);
+    // Enough blobs of an odd size to fill several batches.
+    for (int i = 0; i < 40; i++) {
+      brillo::Blob blob(1024 * 1024 + 7, static_cast<uint8_t>(i));
+      EXPECT_EQ(static_cast<off_t>(expected.size()),
+                blob_file.StoreBlob(blob));
+      expected.insert(expected.end(), blob.begin(), blob.end());
+    }
+    EXPECT_EQ(static_cast<off_t>(expected.size()), blob_file_size);
+    // The last blobs are written when the writer is destroyed.
+  }
+
+  brillo::Blob stored;
+  EXPECT_TRUE(utils::ReadFile(blob_file_path.path(), &stored));
+  EXPECT_EQ(expected, stored);
+}
+
+TEST(BlobFileWriterTest, WriteFailureTest) {
+  test_utils::ScopedTempFile blob_file_path("BlobFileWriterTest.XXXXXX");
+  // The blobs can't be written to a read-only file descriptor.
+  int blob_fd = open(blob_file_path.path().c_str(), O_RDONLY);
+  ASSERT_GE(blob_fd, 0);
+  ScopedFdCloser blob_fd_closer(&blob_fd);
+  off_t blob_file_size = 0;
+  BlobFileWriter blob_file(blob_fd, &blob_file_size);
+
+  brillo::Blob blob(1024, 'x');
+  EXPECT_EQ(0, blob_file.StoreBlob(blob));
+  EXPECT_FALSE(blob_file.Flush());
+  EXPECT_EQ(-1, blob_file.StoreBlob(blob));
+}
+
 }  // namespace chromeos_update_engine
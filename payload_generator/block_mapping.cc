@@ -16,25 +16,84 @@
 
 #include "update_engine/payload_generator/block_mapping.h"
 
+#include <errno.h>
 #include <fcntl.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
-#include <functional>
+#include <algorithm>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <base/threading/simple_thread.h>
+
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
 
 using std::string;
 using std::vector;
 
 namespace {
 
-size_t HashValue(const brillo::Blob& blob) {
-  std::hash<string> hash_fn;
-  return hash_fn(string(blob.begin(), blob.end()));
+// The number of blocks read at once by AddManyDiskBlocks().
+const size_t kReadBlocks = 256;
+
+const uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+
+uint64_t RotateLeft(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+uint64_t LoadWord(const uint8_t* data) {
+  uint64_t word;
+  memcpy(&word, data, sizeof(word));
+  return word;
+}
+
+uint64_t HashRound(uint64_t lane, uint64_t word) {
+  return RotateLeft(lane + word * kPrime2, 31) * kPrime1;
+}
+
+// Returns the hash of the |size| bytes of |data|, computed like xxHash64 but
+// without its tail handling, since the blocks are a multiple of 32 bytes. The
+// four independent lanes let the compiler pipeline and vectorize the loop,
+// which is several times faster than hashing a std::string copy of the block.
+size_t HashValue(const uint8_t* data, size_t size) {
+  uint64_t lanes[4] = {kPrime1 + kPrime2, kPrime2, 0, 0ULL - kPrime1};
+  size_t offset = 0;
+  for (; offset + 32 <= size; offset += 32) {
+    for (size_t i = 0; i < 4; i++)
+      lanes[i] = HashRound(lanes[i], LoadWord(data + offset + i * 8));
+  }
+  uint64_t hash = RotateLeft(lanes[0], 1) + RotateLeft(lanes[1], 7) +
+                  RotateLeft(lanes[2], 12) + RotateLeft(lanes[3], 18);
+  for (; offset < size; offset++)
+    hash = RotateLeft(hash ^ (data[offset] * kPrime3), 11) * kPrime1;
+  hash ^= size;
+  hash ^= hash >> 33;
+  hash *= kPrime2;
+  hash ^= hash >> 29;
+  hash *= kPrime4;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+// Returns whether the |length| bytes at |offset| of the sparse file |fd| of
+// |file_size| bytes are all in a hole, so they read as zeros. Files that
+// don't report their holes, like block devices, have none.
+bool IsHole(int fd, off_t offset, off_t length, off_t file_size) {
+  if (offset + length > file_size)
+    return false;
+  off_t data_offset = lseek(fd, offset, SEEK_DATA);
+  if (data_offset < 0)
+    return errno == ENXIO;  // No data past |offset|.
+  return data_offset >= offset + length;
 }
 
 }  // namespace
@@ -42,7 +101,9 @@ size_t HashValue(const brillo::Blob& blob) {
 namespace chromeos_update_engine {
 
 BlockMapping::BlockId BlockMapping::AddBlock(const brillo::Blob& block_data) {
-  return AddBlock(-1, 0, block_data);
+  if (block_data.size() != block_size_)
+    return -1;
+  return AddBlock(-1, 0, block_data.data());
 }
 
 BlockMapping::BlockId BlockMapping::AddDiskBlock(int fd, off_t byte_offset) {
@@ -52,7 +113,7 @@ BlockMapping::BlockId BlockMapping::AddDiskBlock(int fd, off_t byte_offset) {
     return -1;
   if (static_cast<size_t>(bytes_read) != block_size_)
     return -1;
-  return AddBlock(fd, byte_offset, blob);
+  return AddBlock(fd, byte_offset, blob.data());
 }
 
 bool BlockMapping::AddManyDiskBlocks(int fd,
@@ -61,33 +122,77 @@ bool BlockMapping::AddManyDiskBlocks(int fd,
                                      vector<BlockId>* block_ids) {
   bool ret = true;
   block_ids->resize(num_blocks);
-  for (size_t block = 0; block < num_blocks; block++) {
-    (*block_ids)[block] =
-        AddDiskBlock(fd, initial_byte_offset + block * block_size_);
-    ret = ret && (*block_ids)[block] != -1;
+  // The holes of sparse images are mapped to the block with all zeros without
+  // reading them, once that block was added.
+  BlockId zero_block_id = zero_block_id_.load();
+  struct stat stbuf;
+  off_t file_size = -1;
+  if (zero_block_id != -1 && fstat(fd, &stbuf) == 0 &&
+      S_ISREG(stbuf.st_mode)) {
+    file_size = stbuf.st_size;
+  }
+  // Read several blocks at once to save system calls.
+  brillo::Blob blob(std::min(num_blocks, kReadBlocks) * block_size_);
+  for (size_t first_block = 0; first_block < num_blocks;
+       first_block += kReadBlocks) {
+    size_t read_blocks = std::min(num_blocks - first_block, kReadBlocks);
+    off_t read_offset = initial_byte_offset + first_block * block_size_;
+    if (file_size >= 0 &&
+        IsHole(fd, read_offset, read_blocks * block_size_, file_size)) {
+      std::fill(block_ids->begin() + first_block,
+                block_ids->begin() + first_block + read_blocks,
+                zero_block_id);
+      continue;
+    }
+    ssize_t bytes_read = 0;
+    if (!utils::PReadAll(fd,
+                         blob.data(),
+                         read_blocks * block_size_,
+                         read_offset,
+                         &bytes_read)) {
+      bytes_read = 0;
+    }
+    for (size_t i = 0; i < read_blocks; i++) {
+      BlockId block_id = -1;
+      if (static_cast<size_t>(bytes_read) >= (i + 1) * block_size_) {
+        block_id = AddBlock(
+            fd, read_offset + i * block_size_, blob.data() + i * block_size_);
+      }
+      (*block_ids)[first_block + i] = block_id;
+      ret = ret && block_id != -1;
+    }
   }
   return ret;
 }
 
 BlockMapping::BlockId BlockMapping::AddBlock(int fd,
                                              off_t byte_offset,
-                                             const brillo::Blob& block_data) {
-  if (block_data.size() != block_size_)
-    return -1;
-  size_t h = HashValue(block_data);
+                                             const uint8_t* block_data) {
+  // Blocks with all zeros are very common in the images, so they are detected
+  // without looking them up.
+  bool is_zero = utils::IsZeroBlock(block_data, block_size_);
+  if (is_zero) {
+    BlockId zero_block_id = zero_block_id_.load();
+    if (zero_block_id != -1)
+      return zero_block_id;
+  }
+
+  size_t h = HashValue(block_data, block_size_);
+  Shard* shard = &shards_[h % kNumShards];
+  std::lock_guard<std::mutex> shard_lock(shard->lock);
 
   // We either reuse a UniqueBlock or create a new one. If we need a new
   // UniqueBlock it could also be part of a new or existing bucket (if there is
   // a hash collision).
   vector<UniqueBlock>* bucket = nullptr;
 
-  auto mapping_it = mapping_.find(h);
-  if (mapping_it == mapping_.end()) {
-    bucket = &mapping_[h];
+  auto mapping_it = shard->mapping.find(h);
+  if (mapping_it == shard->mapping.end()) {
+    bucket = &shard->mapping[h];
   } else {
     for (UniqueBlock& existing_block : mapping_it->second) {
       bool equals = false;
-      if (!existing_block.CompareData(block_data, &equals))
+      if (!existing_block.CompareData(block_data, block_size_, &equals))
         return -1;
       if (equals)
         return existing_block.block_id;
@@ -106,25 +211,28 @@ BlockMapping::BlockId BlockMapping::AddBlock(int fd,
   new_ublock->block_id = used_block_ids++;
   // We need to cache blocks that are not referencing any disk location.
   if (fd == -1)
-    new_ublock->block_data = block_data;
+    new_ublock->block_data.assign(block_data, block_data + block_size_);
+  // All the zero blocks are in the same shard, so only one of them is added.
+  if (is_zero)
+    zero_block_id_ = new_ublock->block_id;
 
   return new_ublock->block_id;
 }
 
-bool BlockMapping::UniqueBlock::CompareData(const brillo::Blob& other_block,
+bool BlockMapping::UniqueBlock::CompareData(const uint8_t* other_block,
+                                            size_t block_size,
                                             bool* equals) {
   if (!block_data.empty()) {
-    *equals = block_data == other_block;
+    *equals = memcmp(block_data.data(), other_block, block_size) == 0;
     return true;
   }
-  const size_t block_size = other_block.size();
   brillo::Blob blob(block_size);
   ssize_t bytes_read = 0;
   if (!utils::PReadAll(fd, blob.data(), block_size, byte_offset, &bytes_read))
     return false;
   if (static_cast<size_t>(bytes_read) != block_size)
     return false;
-  *equals = blob == other_block;
+  *equals = memcmp(blob.data(), other_block, block_size) == 0;
 
   // We increase the number of times we had to read this block from disk and
   // we cache this block based on that. This caching method is optimized for
@@ -137,6 +245,62 @@ bool BlockMapping::UniqueBlock::CompareData(const brillo::Blob& other_block,
   return true;
 }
 
+namespace {
+
+// The number of blocks mapped by each of the MapPartitionBlocks() jobs.
+const size_t kMapRangeBlocks = 16384;
+
+// Adds a range of blocks of a partition to a shared BlockMapping.
+class MapRangeProcessor : public base::DelegateSimpleThread::Delegate {
+ public:
+  MapRangeProcessor(BlockMapping* mapping,
+                    int fd,
+                    off_t byte_offset,
+                    size_t num_blocks)
+      : mapping_(mapping),
+        fd_(fd),
+        byte_offset_(byte_offset),
+        num_blocks_(num_blocks) {}
+  MapRangeProcessor(MapRangeProcessor&&) = default;
+  ~MapRangeProcessor() override = default;
+
+  // Overrides DelegateSimpleThread::Delegate.
+  void Run() override {
+    success_ = mapping_->AddManyDiskBlocks(
+        fd_, byte_offset_, num_blocks_, &block_ids_);
+  }
+
+  bool success() const { return success_; }
+  const vector<BlockMapping::BlockId>& block_ids() const { return block_ids_; }
+
+ private:
+  BlockMapping* mapping_;
+  int fd_;
+  off_t byte_offset_;
+  size_t num_blocks_;
+
+  bool success_{false};
+  vector<BlockMapping::BlockId> block_ids_;
+
+  DISALLOW_COPY_AND_ASSIGN(MapRangeProcessor);
+};
+
+// Adds the jobs to map the first |num_blocks| blocks of |fd| to |processors|.
+void AddMapRangeProcessors(BlockMapping* mapping,
+                           int fd,
+                           size_t num_blocks,
+                           size_t block_size,
+                           vector<MapRangeProcessor>* processors) {
+  for (size_t block = 0; block < num_blocks; block += kMapRangeBlocks) {
+    processors->emplace_back(mapping,
+                             fd,
+                             static_cast<off_t>(block) * block_size,
+                             std::min(num_blocks - block, kMapRangeBlocks));
+  }
+}
+
+}  // namespace
+
 bool MapPartitionBlocks(const string& old_part,
                         const string& new_part,
                         size_t old_size,
@@ -152,10 +316,95 @@ bool MapPartitionBlocks(const string& old_part,
   ScopedFdCloser old_fd_closer(&old_fd);
   ScopedFdCloser new_fd_closer(&new_fd);
 
-  TEST_AND_RETURN_FALSE(mapping.AddManyDiskBlocks(
-      old_fd, 0, old_size / block_size, old_block_ids));
-  TEST_AND_RETURN_FALSE(mapping.AddManyDiskBlocks(
-      new_fd, 0, new_size / block_size, new_block_ids));
+  // The ranges of both partitions are added to the mapping in parallel. The
+  // BlockMapping is sharded, so the threads rarely wait for each other.
+  size_t num_old_blocks = old_size / block_size;
+  size_t num_new_blocks = new_size / block_size;
+  vector<MapRangeProcessor> processors;
+  AddMapRangeProcessors(
+      &mapping, old_fd, num_old_blocks, block_size, &processors);
+  size_t num_old_processors = processors.size();
+  AddMapRangeProcessors(
+      &mapping, new_fd, num_new_blocks, block_size, &processors);
+
+  base::DelegateSimpleThreadPool thread_pool(
+      "map-partition-blocks",
+      std::min(processors.size(), diff_utils::GetMaxThreads()));
+  thread_pool.Start();
+  for (MapRangeProcessor& processor : processors)
+    thread_pool.AddWork(&processor);
+  thread_pool.JoinAll();
+
+  // The block ids depend on the order the threads added the blocks, so they
+  // are renumbered in the order the blocks first appear in the partitions.
+  // This keeps the generated payloads deterministic.
+  vector<BlockMapping::BlockId> renumbered_ids(1, 0);
+  BlockMapping::BlockId next_block_id = 1;
+  old_block_ids->clear();
+  old_block_ids->reserve(num_old_blocks);
+  new_block_ids->clear();
+  new_block_ids->reserve(num_new_blocks);
+  for (size_t i = 0; i < processors.size(); i++) {
+    TEST_AND_RETURN_FALSE(processors[i].success());
+    vector<BlockMapping::BlockId>* block_ids =
+        i < num_old_processors ? old_block_ids : new_block_ids;
+    for (BlockMapping::BlockId block_id : processors[i].block_ids()) {
+      if (static_cast<size_t>(block_id) >= renumbered_ids.size())
+        renumbered_ids.resize(block_id + 1, -1);
+      if (renumbered_ids[block_id] == -1)
+        renumbered_ids[block_id] = next_block_id++;
+      block_ids->push_back(renumbered_ids[block_id]);
+    }
+  }
+  return true;
+}
+
+bool CountDuplicatedBlocks(const vector<string>& parts,
+                           const vector<size_t>& sizes,
+                           size_t block_size,
+                           vector<uint64_t>* duplicated_blocks) {
+  TEST_AND_RETURN_FALSE(parts.size() == sizes.size());
+  BlockMapping mapping(block_size);
+  if (mapping.AddBlock(brillo::Blob(block_size, '\0')) != 0)
+    return false;
+
+  // The partitions are mapped one after the other, so the blocks first seen in
+  // a partition get a block id past the ones of all the previous partitions,
+  // regardless of the order the threads add them.
+  BlockMapping::BlockId first_new_block_id = 1;
+  duplicated_blocks->clear();
+  for (size_t i = 0; i < parts.size(); i++) {
+    int fd = HANDLE_EINTR(open(parts[i].c_str(), O_RDONLY));
+    TEST_AND_RETURN_FALSE_ERRNO(fd >= 0);
+    ScopedFdCloser fd_closer(&fd);
+
+    vector<MapRangeProcessor> processors;
+    AddMapRangeProcessors(
+        &mapping, fd, sizes[i] / block_size, block_size, &processors);
+    if (!processors.empty()) {
+      base::DelegateSimpleThreadPool thread_pool(
+          "count-duplicated-blocks",
+          std::min(processors.size(), diff_utils::GetMaxThreads()));
+      thread_pool.Start();
+      for (MapRangeProcessor& processor : processors)
+        thread_pool.AddWork(&processor);
+      thread_pool.JoinAll();
+    }
+
+    uint64_t num_duplicated = 0;
+    BlockMapping::BlockId next_first_new_block_id = first_new_block_id;
+    for (const MapRangeProcessor& processor : processors) {
+      TEST_AND_RETURN_FALSE(processor.success());
+      for (BlockMapping::BlockId block_id : processor.block_ids()) {
+        if (block_id > 0 && block_id < first_new_block_id)
+          num_duplicated++;
+        next_first_new_block_id =
+            std::max(next_first_new_block_id, block_id + 1);
+      }
+    }
+    duplicated_blocks->push_back(num_duplicated);
+    first_new_block_id = next_first_new_block_id;
+  }
   return true;
 }
 
@@ -17,8 +17,10 @@
 #ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_BLOCK_MAPPING_H_
 #define UPDATE_ENGINE_PAYLOAD_GENERATOR_BLOCK_MAPPING_H_
 
-#include <map>
+#include <atomic>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <brillo/secure_blob.h>
@@ -33,11 +35,16 @@ namespace chromeos_update_engine {
 // hash function in that two blocks with the same data will have the same id but
 // also two blocks with the same id will have the same data. This is only valid
 // in the context of the same BlockMapping instance.
+//
+// Blocks can be added from several threads at once. The block ids are assigned
+// in the order the blocks are added, so they are only deterministic if the
+// blocks are added from a single thread.
 class BlockMapping {
  public:
   using BlockId = int64_t;
 
-  explicit BlockMapping(size_t block_size) : block_size_(block_size) {}
+  explicit BlockMapping(size_t block_size)
+      : block_size_(block_size), shards_(kNumShards) {}
 
   // Add a single data block to the mapping. Returns its unique block id.
   // In case of error returns -1.
@@ -52,7 +59,9 @@ class BlockMapping {
   // This is a helper method to add |num_blocks| contiguous blocks reading them
   // from the file descriptor |fd| starting at offset |initial_byte_offset|.
   // Returns whether it succeeded to add all the disk blocks and stores in
-  // |block_ids| the block id for each one of the added blocks.
+  // |block_ids| the block id for each one of the added blocks. The blocks in
+  // the holes of a sparse file are not read if the block with all zeros was
+  // already added.
   bool AddManyDiskBlocks(int fd,
                          off_t initial_byte_offset,
                          size_t num_blocks,
@@ -61,14 +70,22 @@ class BlockMapping {
  private:
   FRIEND_TEST(BlockMappingTest, BlocksAreNotKeptInMemory);
 
-  // Add a single block passed in |block_data|. If |fd| is not -1, the block
-  // can be discarded to save RAM and retrieved later from |fd| at the position
-  // |byte_offset|.
-  BlockId AddBlock(int fd, off_t byte_offset, const brillo::Blob& block_data);
+  // Add a single block of |block_size_| bytes passed in |block_data|. If |fd|
+  // is not -1, the block can be discarded to save RAM and retrieved later from
+  // |fd| at the position |byte_offset|.
+  BlockId AddBlock(int fd, off_t byte_offset, const uint8_t* block_data);
+
+  // The number of independently locked parts of the mapping, so the threads
+  // adding blocks rarely wait for each other. The shard of a block is selected
+  // by its hash value.
+  static const size_t kNumShards = 256;
 
   size_t block_size_;
 
-  BlockId used_block_ids{0};
+  std::atomic<BlockId> used_block_ids{0};
+
+  // The block id of the block with all zeros, or -1 if it wasn't added yet.
+  std::atomic<BlockId> zero_block_id_{-1};
 
   // The UniqueBlock represents the data of a block associated to a unique
   // block id.
@@ -85,22 +102,31 @@ class BlockMapping {
     // Number of times we have seen this data block. Used for caching.
     uint32_t times_read{0};
 
-    // Compares the UniqueBlock data with the other_block data and stores if
-    // they are equal in |equals|. Returns whether there was an error reading
-    // the block from disk while comparing it.
-    bool CompareData(const brillo::Blob& other_block, bool* equals);
+    // Compares the UniqueBlock data with the |block_size| bytes of
+    // |other_block| and stores if they are equal in |equals|. Returns whether
+    // there was an error reading the block from disk while comparing it.
+    bool CompareData(const uint8_t* other_block,
+                     size_t block_size,
+                     bool* equals);
   };
 
-  // A mapping from hash values to possible block ids.
-  std::map<size_t, std::vector<UniqueBlock>> mapping_;
+  // A part of the mapping from hash values to possible block ids, with the
+  // lock that protects it and its UniqueBlocks.
+  struct Shard {
+    std::mutex lock;
+    std::unordered_map<size_t, std::vector<UniqueBlock>> mapping;
+  };
+  std::vector<Shard> shards_;
 };
 
 // Maps the blocks of the old and new partitions |old_part| and |new_part| whose
 // size in bytes are |old_size| and |new_size| into block ids where two blocks
 // with the same data will have the same block id and vice versa, regardless of
 // the partition they are on.
-// The block ids number 0 corresponds to the block with all zeros, but any
-// other block id number is assigned randomly.
+// The block ids number 0 corresponds to the block with all zeros, and the
+// other block ids are assigned in the order the blocks first appear in the old
+// and then the new partition. The partitions are split in ranges of blocks
+// which are mapped in parallel.
 bool MapPartitionBlocks(const std::string& old_part,
                         const std::string& new_part,
                         size_t old_size,
@@ -109,6 +135,15 @@ bool MapPartitionBlocks(const std::string& old_part,
                         std::vector<BlockMapping::BlockId>* old_block_ids,
                         std::vector<BlockMapping::BlockId>* new_block_ids);
 
+// Maps the blocks of the partitions |parts|, whose sizes in bytes are |sizes|,
+// in order and stores in |duplicated_blocks| the number of blocks of each
+// partition whose data is also in one of the partitions before it. The blocks
+// with all zeros are not counted.
+bool CountDuplicatedBlocks(const std::vector<std::string>& parts,
+                           const std::vector<size_t>& sizes,
+                           size_t block_size,
+                           std::vector<uint64_t>* duplicated_blocks);
+
 }  // namespace chromeos_update_engine
 
 #endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_BLOCK_MAPPING_H_
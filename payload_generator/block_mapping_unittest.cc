@@ -19,6 +19,7 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include <string>
 #include <vector>
@@ -62,9 +63,11 @@ TEST_F(BlockMappingTest, BlocksAreNotKeptInMemory) {
 
   // Check that the block_data is not stored on memory if we just used the block
   // once.
-  for (const auto& it : bm_.mapping_) {
-    for (const BlockMapping::UniqueBlock& ublock : it.second) {
-      EXPECT_TRUE(ublock.block_data.empty());
+  for (const BlockMapping::Shard& shard : bm_.shards_) {
+    for (const auto& it : shard.mapping) {
+      for (const BlockMapping::UniqueBlock& ublock : it.second) {
+        EXPECT_TRUE(ublock.block_data.empty());
+      }
     }
   }
 
@@ -74,16 +77,45 @@ TEST_F(BlockMappingTest, BlocksAreNotKeptInMemory) {
     EXPECT_EQ(0, bm_.AddBlock(block));
   }
 
-  for (const auto& it : bm_.mapping_) {
-    for (const BlockMapping::UniqueBlock& ublock : it.second) {
-      EXPECT_FALSE(ublock.block_data.empty());
-      // The block was loaded from disk only 4 times, and after that the counter
-      // is not updated anymore.
-      EXPECT_EQ(4U, ublock.times_read);
+  for (const BlockMapping::Shard& shard : bm_.shards_) {
+    for (const auto& it : shard.mapping) {
+      for (const BlockMapping::UniqueBlock& ublock : it.second) {
+        EXPECT_FALSE(ublock.block_data.empty());
+        // The block was loaded from disk only 4 times, and after that the
+        // counter is not updated anymore.
+        EXPECT_EQ(4U, ublock.times_read);
+      }
     }
   }
 }
 
+TEST_F(BlockMappingTest, AddManyDiskBlocksTest) {
+  // More blocks than read at once, repeating every 100 blocks. The first block
+  // of each group has all zeros.
+  const size_t kNumBlocks = 300;
+  string contents(kNumBlocks * block_size_, '\0');
+  for (size_t i = 0; i < contents.size(); ++i) {
+    if ((i / block_size_) % 100)
+      contents[i] = (i / block_size_) % 100 + (i % block_size_) % 7;
+  }
+  test_utils::WriteFileString(old_part_.path(), contents);
+  int old_fd = HANDLE_EINTR(open(old_part_.path().c_str(), O_RDONLY));
+  ScopedFdCloser old_fd_closer(&old_fd);
+
+  EXPECT_EQ(0, bm_.AddBlock(brillo::Blob(block_size_, 0)));
+  // The last block is past the end of the file.
+  vector<BlockMapping::BlockId> ids;
+  EXPECT_FALSE(bm_.AddManyDiskBlocks(old_fd, 0, kNumBlocks + 1, &ids));
+  ASSERT_EQ(kNumBlocks + 1, ids.size());
+  EXPECT_EQ(-1, ids[kNumBlocks]);
+  for (size_t i = 0; i < kNumBlocks; ++i) {
+    if (i % 100 == 0)
+      EXPECT_EQ(0, ids[i]);
+    else
+      EXPECT_EQ(static_cast<BlockMapping::BlockId>(i % 100), ids[i]);
+  }
+}
+
 TEST_F(BlockMappingTest, MapPartitionBlocks) {
   // A string with 10 blocks where all the blocks are different.
   string old_contents(10 * block_size_, '\0');
@@ -112,4 +144,92 @@ TEST_F(BlockMappingTest, MapPartitionBlocks) {
   EXPECT_EQ((vector<BlockMapping::BlockId>{0, 11, 12, 13, 1, 2}), new_ids);
 }
 
+TEST_F(BlockMappingTest, MapPartitionBlocksWithHoles) {
+  // A sparse file with a hole bigger than a read, followed by a data block
+  // and a hole up to the end of the file.
+  const size_t kNumBlocks = 1024;
+  int fd = HANDLE_EINTR(open(new_part_.path().c_str(), O_WRONLY));
+  ASSERT_GE(fd, 0);
+  ScopedFdCloser fd_closer(&fd);
+  ASSERT_EQ(0, ftruncate(fd, kNumBlocks * block_size_));
+  string data(block_size_, 'a');
+  ASSERT_TRUE(utils::PWriteAll(
+      fd, data.data(), data.size(), (kNumBlocks / 2) * block_size_));
+
+  vector<BlockMapping::BlockId> old_ids, new_ids;
+  EXPECT_TRUE(MapPartitionBlocks(old_part_.path(),
+                                 new_part_.path(),
+                                 0,
+                                 kNumBlocks * block_size_,
+                                 block_size_,
+                                 &old_ids,
+                                 &new_ids));
+
+  vector<BlockMapping::BlockId> expected_ids(kNumBlocks, 0);
+  expected_ids[kNumBlocks / 2] = 1;
+  EXPECT_EQ(expected_ids, new_ids);
+}
+
+TEST_F(BlockMappingTest, MapPartitionBlocksInParallel) {
+  // Partitions with more blocks than mapped by each thread. There are 1000
+  // different blocks repeated over the partitions, and the new blocks are
+  // shifted by 500 blocks.
+  const size_t kNumBlocks = 33000;
+  const size_t kPeriod = 1000;
+  const size_t kShift = 500;
+  string old_contents(kNumBlocks * block_size_, '\0');
+  string new_contents(kNumBlocks * block_size_, '\0');
+  // Block number |value| of the period has all zeros when |value| is 0.
+  auto set_block = [this](string* contents, size_t blk, size_t value) {
+    if (value) {
+      (*contents)[blk * block_size_] = value & 0xff;
+      (*contents)[blk * block_size_ + 1] = value >> 8;
+      (*contents)[blk * block_size_ + 2] = 1;
+    }
+  };
+  for (size_t blk = 0; blk < kNumBlocks; ++blk) {
+    set_block(&old_contents, blk, blk % kPeriod);
+    set_block(&new_contents, blk, (blk + kShift) % kPeriod);
+  }
+  test_utils::WriteFileString(old_part_.path(), old_contents);
+  test_utils::WriteFileString(new_part_.path(), new_contents);
+
+  vector<BlockMapping::BlockId> old_ids, new_ids;
+  EXPECT_TRUE(MapPartitionBlocks(old_part_.path(),
+                                 new_part_.path(),
+                                 old_contents.size(),
+                                 new_contents.size(),
+                                 block_size_,
+                                 &old_ids,
+                                 &new_ids));
+  ASSERT_EQ(kNumBlocks, old_ids.size());
+  ASSERT_EQ(kNumBlocks, new_ids.size());
+  // The block ids are assigned in the order the blocks first appear.
+  for (size_t blk = 0; blk < kNumBlocks; ++blk) {
+    EXPECT_EQ(static_cast<BlockMapping::BlockId>(blk % kPeriod), old_ids[blk]);
+    EXPECT_EQ(old_ids[(blk + kShift) % kPeriod], new_ids[blk]);
+  }
+}
+
+TEST_F(BlockMappingTest, CountDuplicatedBlocks) {
+  string zero_block(block_size_, '\0');
+  string a(block_size_, 'a');
+  string b(block_size_, 'b');
+  string c(block_size_, 'c');
+  string d(block_size_, 'd');
+  string old_contents = a + b + zero_block + c + c;
+  string new_contents = b + zero_block + d + d + a;
+  test_utils::WriteFileString(old_part_.path(), old_contents);
+  test_utils::WriteFileString(new_part_.path(), new_contents);
+
+  // Only the blocks of a previous partition are counted, not the ones
+  // repeated in the same partition or the zero blocks.
+  vector<uint64_t> duplicated_blocks;
+  EXPECT_TRUE(CountDuplicatedBlocks({old_part_.path(), new_part_.path()},
+                                    {old_contents.size(), new_contents.size()},
+                                    block_size_,
+                                    &duplicated_blocks));
+  EXPECT_EQ((vector<uint64_t>{0, 2}), duplicated_blocks);
+}
+
 }  // namespace chromeos_update_engine
@@ -0,0 +1,51 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/cached_filesystem.h"
+
+#include <utility>
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+size_t CachedFilesystem::GetBlockSize() const {
+  return fs_->GetBlockSize();
+}
+
+size_t CachedFilesystem::GetBlockCount() const {
+  return fs_->GetBlockCount();
+}
+
+bool CachedFilesystem::GetFiles(vector<File>* files) const {
+  base::AutoLock auto_lock(lock_);
+  if (!files_cached_) {
+    vector<File> fs_files;
+    if (!fs_->GetFiles(&fs_files))
+      return false;
+    files_ = std::move(fs_files);
+    files_cached_ = true;
+  }
+  *files = files_;
+  return true;
+}
+
+bool CachedFilesystem::LoadSettings(brillo::KeyValueStore* store) const {
+  return fs_->LoadSettings(store);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,60 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_CACHED_FILESYSTEM_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_CACHED_FILESYSTEM_H_
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <base/macros.h>
+#include <base/synchronization/lock.h>
+
+#include "update_engine/payload_generator/filesystem_interface.h"
+
+namespace chromeos_update_engine {
+
+// CachedFilesystem keeps the files of another filesystem after they are
+// listed the first time, so generating several payloads to the same target
+// parses the target filesystem only once.
+class CachedFilesystem : public FilesystemInterface {
+ public:
+  explicit CachedFilesystem(std::unique_ptr<FilesystemInterface> fs)
+      : fs_(std::move(fs)) {}
+  ~CachedFilesystem() override = default;
+
+  // FilesystemInterface overrides.
+  size_t GetBlockSize() const override;
+  size_t GetBlockCount() const override;
+  bool GetFiles(std::vector<File>* files) const override;
+  bool LoadSettings(brillo::KeyValueStore* store) const override;
+
+ private:
+  std::unique_ptr<FilesystemInterface> fs_;
+
+  // Protects the cached files below.
+  mutable base::Lock lock_;
+  mutable bool files_cached_{false};
+  mutable std::vector<File> files_;
+
+  DISALLOW_COPY_AND_ASSIGN(CachedFilesystem);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_CACHED_FILESYSTEM_H_
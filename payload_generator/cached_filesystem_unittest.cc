@@ -0,0 +1,54 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/cached_filesystem.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/fake_filesystem.h"
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+TEST(CachedFilesystemTest, ListsTheFilesOnceTest) {
+  auto fake_fs = std::make_unique<FakeFilesystem>(4096, 100);
+  FakeFilesystem* fake_fs_ptr = fake_fs.get();
+  fake_fs->AddFile("/foo", {ExtentForRange(1, 2)});
+  CachedFilesystem fs(std::move(fake_fs));
+  EXPECT_EQ(4096U, fs.GetBlockSize());
+  EXPECT_EQ(100U, fs.GetBlockCount());
+
+  vector<FilesystemInterface::File> files;
+  EXPECT_TRUE(fs.GetFiles(&files));
+  ASSERT_EQ(1U, files.size());
+  EXPECT_EQ("/foo", files[0].name);
+
+  // The files added later are not listed, since the first list is kept.
+  fake_fs_ptr->AddFile("/bar", {ExtentForRange(3, 1)});
+  files.clear();
+  EXPECT_TRUE(fs.GetFiles(&files));
+  ASSERT_EQ(1U, files.size());
+  EXPECT_EQ("/foo", files[0].name);
+}
+
+}  // namespace chromeos_update_engine
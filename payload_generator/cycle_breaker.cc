@@ -18,109 +18,233 @@
 
 #include <inttypes.h>
 
+#include <algorithm>
 #include <limits>
+#include <memory>
 #include <set>
 #include <string>
 #include <utility>
 
-#include <base/stl_util.h>
-#include <base/strings/string_util.h>
-#include <base/strings/stringprintf.h>
+#include <base/logging.h>
+#include <base/macros.h>
+#include <base/threading/simple_thread.h>
 
+#include "update_engine/payload_generator/delta_diff_utils.h"
 #include "update_engine/payload_generator/graph_utils.h"
 #include "update_engine/payload_generator/tarjan.h"
 
 using std::make_pair;
+using std::pair;
 using std::set;
 using std::vector;
 
 namespace chromeos_update_engine {
 
-// This is the outer function from the original paper.
-void CycleBreaker::BreakCycles(const Graph& graph, set<Edge>* out_cut_edges) {
-  cut_edges_.clear();
+namespace {
 
-  // Make a copy, which we will modify by removing edges. Thus, in each
-  // iteration subgraph_ is the current subgraph or the original with
-  // vertices we desire. This variable was "A_K" in the original paper.
-  subgraph_ = graph;
+const size_t kMaxEdgesToConsider = 2;
 
-  // The paper calls for the "adjacency structure (i.e., graph) of
-  // strong (-ly connected) component K with least vertex in subgraph
-  // induced by {s, s + 1, ..., n}".
-  // We arbitrarily order each vertex by its index in the graph. Thus,
-  // each iteration, we are looking at the subgraph {s, s + 1, ..., n}
-  // and looking for the strongly connected component with vertex s.
+bool IsSkippedOp(const Vertex& vertex) {
+  InstallOperation::Type op_type = vertex.aop.op.type();
+  return op_type == InstallOperation::REPLACE ||
+         op_type == InstallOperation::REPLACE_BZ;
+}
 
-  TarjanAlgorithm tarjan;
-  skipped_ops_ = 0;
+// A strongly connected component of the graph, stored in compressed sparse
+// row form. Its vertices are numbered from 0 in the order of their index in
+// the graph, so walking them or their sorted edges visits them in the same
+// order as walking the graph does.
+struct ComponentGraph {
+  // The index in the graph of each vertex.
+  vector<Vertex::Index> vertices;
+  // The edges of vertex v are the entries edge_offsets[v] up to
+  // edge_offsets[v + 1] of edge_targets and edge_weights.
+  vector<size_t> edge_offsets;
+  vector<size_t> edge_targets;
+  vector<uint64_t> edge_weights;
+  // Whether the vertex is not used as a starting vertex "s".
+  vector<bool> skipped;
+  // Whether the vertex is taken out of the subgraph once the vertices after
+  // it are the starting vertex, which only happens when the vertex right
+  // after it in the graph is not skipped.
+  vector<bool> removable;
+};
 
-  for (Graph::size_type i = 0; i < subgraph_.size(); i++) {
-    InstallOperation::Type op_type = graph[i].aop.op.type();
-    if (op_type == InstallOperation::REPLACE ||
-        op_type == InstallOperation::REPLACE_BZ) {
-      skipped_ops_++;
+// Breaks the cycles of a single strongly connected component. This is the
+// algorithm from the paper, where the subgraph "A_K" induced by
+// {s, s + 1, ..., n} is never built: a vertex before s is simply ignored
+// while looking for the component of s and its circuits.
+class ComponentCycleBreaker : public base::DelegateSimpleThread::Delegate {
+ public:
+  explicit ComponentCycleBreaker(std::unique_ptr<ComponentGraph> graph)
+      : graph_(std::move(graph)) {}
+  ~ComponentCycleBreaker() override = default;
+
+  // Overrides DelegateSimpleThread::Delegate.
+  // This is the outer function from the original paper.
+  void Run() override;
+
+  // Adds the cut edges, with their indexes in the graph, to |cut_edges|.
+  void GetCutEdges(set<Edge>* cut_edges) const;
+
+  size_t size() const { return graph_->vertices.size(); }
+
+ private:
+  bool IsActive(size_t vertex) const {
+    return vertex >= current_vertex_ || !graph_->removable[vertex];
+  }
+
+  // Sets |in_component_| for the strongly connected component of
+  // |current_vertex_| in the subgraph.
+  void FindComponent();
+
+  uint64_t EdgeWeight(size_t from, size_t to) const;
+  void HandleCircuit();
+  void Unblock(size_t u);
+  bool Circuit(size_t vertex, size_t depth);
+  bool StackContainsCutEdge() const;
+
+  std::unique_ptr<ComponentGraph> graph_;
+
+  vector<bool> blocked_;               // "blocked" in the paper
+  size_t current_vertex_{0};           // "s" in the paper
+  vector<size_t> stack_;               // the stack variable in the paper
+  vector<set<size_t>> blocked_graph_;  // "B" in the paper
+  // The vertices whose |blocked_| or |blocked_graph_| entry was set for the
+  // current vertex, so only those are reset for the next one.
+  vector<size_t> touched_;
+  vector<bool> in_component_;
+
+  // The state of the Tarjan's algorithm run by FindComponent().
+  vector<size_t> index_;
+  vector<size_t> lowlink_;
+  vector<bool> visited_;
+  vector<size_t> visited_vertices_;
+  vector<bool> on_stack_;
+  vector<size_t> tarjan_stack_;
+
+  set<pair<size_t, size_t>> cut_edges_;
+  int counter_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(ComponentCycleBreaker);
+};
+
+void ComponentCycleBreaker::Run() {
+  size_t n = size();
+  blocked_.assign(n, false);
+  blocked_graph_.assign(n, set<size_t>());
+  in_component_.assign(n, false);
+  index_.assign(n, 0);
+  lowlink_.assign(n, 0);
+  visited_.assign(n, false);
+  on_stack_.assign(n, false);
+
+  for (current_vertex_ = 0; current_vertex_ < n; current_vertex_++) {
+    if (graph_->skipped[current_vertex_])
       continue;
-    }
 
-    if (i > 0) {
-      // Erase node (i - 1) from subgraph_. First, erase what it points to
-      subgraph_[i - 1].out_edges.clear();
-      // Now, erase any pointers to node (i - 1)
-      for (Graph::size_type j = i; j < subgraph_.size(); j++) {
-        subgraph_[j].out_edges.erase(i - 1);
-      }
+    FindComponent();
+    Circuit(current_vertex_, 0);
+
+    for (size_t vertex : touched_) {
+      blocked_[vertex] = false;
+      blocked_graph_[vertex].clear();
     }
+    touched_.clear();
+  }
+  DCHECK(stack_.empty());
+}
+
+void ComponentCycleBreaker::GetCutEdges(set<Edge>* cut_edges) const {
+  for (const auto& edge : cut_edges_) {
+    cut_edges->insert(make_pair(graph_->vertices[edge.first],
+                                graph_->vertices[edge.second]));
+  }
+}
 
-    // Calculate SCC (strongly connected component) with vertex i.
-    vector<Vertex::Index> component_indexes;
-    tarjan.Execute(i, &subgraph_, &component_indexes);
-
-    // Set subgraph edges for the components in the SCC.
-    for (vector<Vertex::Index>::iterator it = component_indexes.begin();
-         it != component_indexes.end();
-         ++it) {
-      subgraph_[*it].subgraph_edges.clear();
-      for (vector<Vertex::Index>::iterator jt = component_indexes.begin();
-           jt != component_indexes.end();
-           ++jt) {
-        // If there's a link from *it -> *jt in the graph,
-        // add a subgraph_ edge
-        if (base::ContainsKey(subgraph_[*it].out_edges, *jt))
-          subgraph_[*it].subgraph_edges.insert(*jt);
+void ComponentCycleBreaker::FindComponent() {
+  for (size_t vertex : visited_vertices_) {
+    visited_[vertex] = false;
+    in_component_[vertex] = false;
+  }
+  visited_vertices_.clear();
+  size_t next_index = 0;
+  // The vertices being visited, with the position of their next edge.
+  vector<pair<size_t, size_t>> call_stack;
+
+  index_[current_vertex_] = lowlink_[current_vertex_] = next_index++;
+  visited_[current_vertex_] = true;
+  visited_vertices_.push_back(current_vertex_);
+  on_stack_[current_vertex_] = true;
+  tarjan_stack_.push_back(current_vertex_);
+  call_stack.emplace_back(current_vertex_,
+                          graph_->edge_offsets[current_vertex_]);
+
+  while (!call_stack.empty()) {
+    size_t vertex = call_stack.back().first;
+    size_t& edge = call_stack.back().second;
+    if (edge < graph_->edge_offsets[vertex + 1]) {
+      size_t vertex_next = graph_->edge_targets[edge++];
+      if (!IsActive(vertex_next))
+        continue;
+      if (!visited_[vertex_next]) {
+        index_[vertex_next] = lowlink_[vertex_next] = next_index++;
+        visited_[vertex_next] = true;
+        visited_vertices_.push_back(vertex_next);
+        on_stack_[vertex_next] = true;
+        tarjan_stack_.push_back(vertex_next);
+        call_stack.emplace_back(vertex_next,
+                                graph_->edge_offsets[vertex_next]);
+      } else if (on_stack_[vertex_next]) {
+        lowlink_[vertex] = std::min(lowlink_[vertex], index_[vertex_next]);
       }
+      continue;
     }
 
-    current_vertex_ = i;
-    blocked_.clear();
-    blocked_.resize(subgraph_.size());
-    blocked_graph_.clear();
-    blocked_graph_.resize(subgraph_.size());
-    Circuit(current_vertex_, 0);
+    call_stack.pop_back();
+    if (!call_stack.empty()) {
+      size_t parent = call_stack.back().first;
+      lowlink_[parent] = std::min(lowlink_[parent], lowlink_[vertex]);
+    }
+    if (lowlink_[vertex] == index_[vertex]) {
+      // The component of |current_vertex_| is the last one found, since it's
+      // where the search started.
+      size_t other_vertex;
+      do {
+        other_vertex = tarjan_stack_.back();
+        tarjan_stack_.pop_back();
+        on_stack_[other_vertex] = false;
+        if (vertex == current_vertex_)
+          in_component_[other_vertex] = true;
+      } while (other_vertex != vertex);
+    }
   }
-
-  out_cut_edges->swap(cut_edges_);
-  LOG(INFO) << "Cycle breaker skipped " << skipped_ops_ << " ops.";
-  DCHECK(stack_.empty());
+  DCHECK(tarjan_stack_.empty());
 }
 
-static const size_t kMaxEdgesToConsider = 2;
+uint64_t ComponentCycleBreaker::EdgeWeight(size_t from, size_t to) const {
+  auto begin = graph_->edge_targets.begin() + graph_->edge_offsets[from];
+  auto end = graph_->edge_targets.begin() + graph_->edge_offsets[from + 1];
+  auto it = std::lower_bound(begin, end, to);
+  CHECK(it != end && *it == to);
+  return graph_->edge_weights[it - graph_->edge_targets.begin()];
+}
 
-void CycleBreaker::HandleCircuit() {
+void ComponentCycleBreaker::HandleCircuit() {
   stack_.push_back(current_vertex_);
-  CHECK_GE(stack_.size(), static_cast<vector<Vertex::Index>::size_type>(2));
-  Edge min_edge = make_pair(stack_[0], stack_[1]);
+  CHECK_GE(stack_.size(), static_cast<vector<size_t>::size_type>(2));
+  pair<size_t, size_t> min_edge = make_pair(stack_[0], stack_[1]);
   uint64_t min_edge_weight = std::numeric_limits<uint64_t>::max();
   size_t edges_considered = 0;
-  for (vector<Vertex::Index>::const_iterator it = stack_.begin();
+  for (vector<size_t>::const_iterator it = stack_.begin();
        it != (stack_.end() - 1);
        ++it) {
-    Edge edge = make_pair(*it, *(it + 1));
+    pair<size_t, size_t> edge = make_pair(*it, *(it + 1));
     if (cut_edges_.find(edge) != cut_edges_.end()) {
       stack_.pop_back();
       return;
     }
-    uint64_t edge_weight = graph_utils::EdgeWeight(subgraph_, edge);
+    uint64_t edge_weight = EdgeWeight(edge.first, edge.second);
     if (edge_weight < min_edge_weight) {
       min_edge_weight = edge_weight;
       min_edge = edge;
@@ -133,62 +257,57 @@ void CycleBreaker::HandleCircuit() {
   stack_.pop_back();
 }
 
-void CycleBreaker::Unblock(Vertex::Index u) {
+void ComponentCycleBreaker::Unblock(size_t u) {
   blocked_[u] = false;
 
-  for (Vertex::EdgeMap::iterator it = blocked_graph_[u].out_edges.begin();
-       it != blocked_graph_[u].out_edges.end();) {
-    Vertex::Index w = it->first;
-    blocked_graph_[u].out_edges.erase(it++);
+  for (set<size_t>::iterator it = blocked_graph_[u].begin();
+       it != blocked_graph_[u].end();) {
+    size_t w = *it;
+    blocked_graph_[u].erase(it++);
     if (blocked_[w])
       Unblock(w);
   }
 }
 
-bool CycleBreaker::StackContainsCutEdge() const {
-  for (vector<Vertex::Index>::const_iterator it = ++stack_.begin(),
-                                             e = stack_.end();
+bool ComponentCycleBreaker::StackContainsCutEdge() const {
+  for (vector<size_t>::const_iterator it = ++stack_.begin(), e = stack_.end();
        it != e;
        ++it) {
-    Edge edge = make_pair(*(it - 1), *it);
-    if (base::ContainsKey(cut_edges_, edge)) {
+    if (cut_edges_.count(make_pair(*(it - 1), *it)))
       return true;
-    }
   }
   return false;
 }
 
-bool CycleBreaker::Circuit(Vertex::Index vertex, Vertex::Index depth) {
+bool ComponentCycleBreaker::Circuit(size_t vertex, size_t depth) {
   // "vertex" was "v" in the original paper.
   bool found = false;  // Was "f" in the original paper.
   stack_.push_back(vertex);
   blocked_[vertex] = true;
-  {
-    static int counter = 0;
-    counter++;
-    if (counter == 10000) {
-      counter = 0;
-      std::string stack_str;
-      for (Vertex::Index index : stack_) {
-        stack_str += std::to_string(index);
-        stack_str += " -> ";
-      }
-      LOG(INFO) << "stack: " << stack_str;
+  touched_.push_back(vertex);
+  if (++counter_ == 10000) {
+    counter_ = 0;
+    std::string stack_str;
+    for (size_t index : stack_) {
+      stack_str += std::to_string(graph_->vertices[index]);
+      stack_str += " -> ";
     }
+    LOG(INFO) << "stack: " << stack_str;
   }
 
-  for (Vertex::SubgraphEdgeMap::iterator w =
-           subgraph_[vertex].subgraph_edges.begin();
-       w != subgraph_[vertex].subgraph_edges.end();
-       ++w) {
-    if (*w == current_vertex_) {
+  size_t edges_end = graph_->edge_offsets[vertex + 1];
+  for (size_t edge = graph_->edge_offsets[vertex]; edge < edges_end; edge++) {
+    size_t w = graph_->edge_targets[edge];
+    if (!in_component_[w])
+      continue;
+    if (w == current_vertex_) {
       // The original paper called for printing stack_ followed by
       // current_vertex_ here, which is a cycle. Instead, we call
       // HandleCircuit() to break it.
       HandleCircuit();
       found = true;
-    } else if (!blocked_[*w]) {
-      if (Circuit(*w, depth + 1)) {
+    } else if (!blocked_[w]) {
+      if (Circuit(w, depth + 1)) {
         found = true;
         if ((depth > kMaxEdgesToConsider) || StackContainsCutEdge())
           break;
@@ -199,15 +318,11 @@ bool CycleBreaker::Circuit(Vertex::Index vertex, Vertex::Index depth) {
   if (found) {
     Unblock(vertex);
   } else {
-    for (Vertex::SubgraphEdgeMap::iterator w =
-             subgraph_[vertex].subgraph_edges.begin();
-         w != subgraph_[vertex].subgraph_edges.end();
-         ++w) {
-      if (blocked_graph_[*w].out_edges.find(vertex) ==
-          blocked_graph_[*w].out_edges.end()) {
-        blocked_graph_[*w].out_edges.insert(
-            make_pair(vertex, EdgeProperties()));
-      }
+    for (size_t edge = graph_->edge_offsets[vertex]; edge < edges_end;
+         edge++) {
+      size_t w = graph_->edge_targets[edge];
+      if (in_component_[w] && blocked_graph_[w].insert(vertex).second)
+        touched_.push_back(w);
     }
   }
   CHECK_EQ(vertex, stack_.back());
@@ -215,4 +330,86 @@ bool CycleBreaker::Circuit(Vertex::Index vertex, Vertex::Index depth) {
   return found;
 }
 
+}  // namespace
+
+void CycleBreaker::BreakCycles(const Graph& graph, set<Edge>* out_cut_edges) {
+  // The paper calls for the "adjacency structure (i.e., graph) of
+  // strong (-ly connected) component K with least vertex in subgraph
+  // induced by {s, s + 1, ..., n}".
+  // We arbitrarily order each vertex by its index in the graph. Thus,
+  // each iteration, we are looking at the subgraph {s, s + 1, ..., n}
+  // and looking for the strongly connected component with vertex s.
+  // That component is always part of a strongly connected component of the
+  // whole graph, so each of those is handled on its own.
+  skipped_ops_ = 0;
+  for (const Vertex& vertex : graph)
+    if (IsSkippedOp(vertex))
+      skipped_ops_++;
+
+  vector<vector<Vertex::Index>> components;
+  TarjanAlgorithm::FindAllComponents(graph, &components);
+
+  // The component of each vertex, and its index in that component.
+  vector<size_t> component_of(graph.size());
+  vector<size_t> local_index(graph.size());
+  for (size_t c = 0; c < components.size(); c++) {
+    for (size_t i = 0; i < components[c].size(); i++) {
+      component_of[components[c][i]] = c;
+      local_index[components[c][i]] = i;
+    }
+  }
+
+  vector<std::unique_ptr<ComponentCycleBreaker>> breakers;
+  for (size_t c = 0; c < components.size(); c++) {
+    vector<Vertex::Index>& vertices = components[c];
+    // A component without any cycle doesn't need to be broken.
+    if (vertices.size() == 1 &&
+        graph[vertices[0]].out_edges.count(vertices[0]) == 0) {
+      continue;
+    }
+
+    auto component = std::make_unique<ComponentGraph>();
+    component->edge_offsets.push_back(0);
+    for (Vertex::Index vertex : vertices) {
+      for (const auto& edge : graph[vertex].out_edges) {
+        if (component_of[edge.first] != c)
+          continue;
+        component->edge_targets.push_back(local_index[edge.first]);
+        component->edge_weights.push_back(
+            graph_utils::EdgeWeight(graph, make_pair(vertex, edge.first)));
+      }
+      component->edge_offsets.push_back(component->edge_targets.size());
+      component->skipped.push_back(IsSkippedOp(graph[vertex]));
+      component->removable.push_back(vertex + 1 < graph.size() &&
+                                     !IsSkippedOp(graph[vertex + 1]));
+    }
+    component->vertices.swap(vertices);
+    breakers.emplace_back(new ComponentCycleBreaker(std::move(component)));
+  }
+
+  // Start with the biggest components, which take the longest.
+  std::sort(breakers.begin(),
+            breakers.end(),
+            [](const std::unique_ptr<ComponentCycleBreaker>& a,
+               const std::unique_ptr<ComponentCycleBreaker>& b) {
+              return a->size() > b->size();
+            });
+  size_t num_threads = std::min(breakers.size(), diff_utils::GetMaxThreads());
+  if (num_threads > 0) {
+    LOG(INFO) << "Breaking the cycles of " << breakers.size()
+              << " strongly connected components using " << num_threads
+              << " threads.";
+    base::DelegateSimpleThreadPool thread_pool("cycle-breaker", num_threads);
+    thread_pool.Start();
+    for (auto& breaker : breakers)
+      thread_pool.AddWork(breaker.get());
+    thread_pool.JoinAll();
+  }
+
+  out_cut_edges->clear();
+  for (const auto& breaker : breakers)
+    breaker->GetCutEdges(out_cut_edges);
+  LOG(INFO) << "Cycle breaker skipped " << skipped_ops_ << " ops.";
+}
+
 }  // namespace chromeos_update_engine
@@ -33,7 +33,6 @@
 // 5 * 10^15 cycles.
 
 #include <set>
-#include <vector>
 
 #include "update_engine/payload_generator/graph_types.h"
 
@@ -42,25 +41,14 @@ namespace chromeos_update_engine {
 class CycleBreaker {
  public:
   CycleBreaker() : skipped_ops_(0) {}
-  // out_cut_edges is replaced with the cut edges.
+  // out_cut_edges is replaced with the cut edges. Since no cycle goes across
+  // two strongly connected components, each component of |graph| is broken
+  // on its own, in parallel with the others.
   void BreakCycles(const Graph& graph, std::set<Edge>* out_cut_edges);
 
   size_t skipped_ops() const { return skipped_ops_; }
 
  private:
-  void HandleCircuit();
-  void Unblock(Vertex::Index u);
-  bool Circuit(Vertex::Index vertex, Vertex::Index depth);
-  bool StackContainsCutEdge() const;
-
-  std::vector<bool> blocked_;         // "blocked" in the paper
-  Vertex::Index current_vertex_;      // "s" in the paper
-  std::vector<Vertex::Index> stack_;  // the stack variable in the paper
-  Graph subgraph_;                    // "A_K" in the paper
-  Graph blocked_graph_;               // "B" in the paper
-
-  std::set<Edge> cut_edges_;
-
   // Number of operations skipped b/c we know they don't have any
   // incoming edges.
   size_t skipped_ops_;
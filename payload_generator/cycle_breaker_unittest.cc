@@ -276,4 +276,36 @@ TEST(CycleBreakerTest, SkipOpsTest) {
   EXPECT_EQ(2U, breaker.skipped_ops());
 }
 
+TEST(CycleBreakerTest, SeparateComponentsTest) {
+  size_t counter = 0;
+  const Vertex::Index n_a = counter++;
+  const Vertex::Index n_b = counter++;
+  const Vertex::Index n_c = counter++;
+  const Vertex::Index n_d = counter++;
+  const Vertex::Index n_e = counter++;
+  const Graph::size_type kNodeCount = counter++;
+
+  Graph graph(kNodeCount);
+  SetOpForNodes(&graph);
+
+  // Two cycles in different components, linked by an edge that isn't part of
+  // any cycle, plus a vertex pointing to itself.
+  graph[n_a].out_edges.insert(EdgeWithWeight(n_b, 3));
+  graph[n_b].out_edges.insert(EdgeWithWeight(n_a, 2));
+  graph[n_b].out_edges.insert(EdgeWithWeight(n_c, 1));
+  graph[n_c].out_edges.insert(EdgeWithWeight(n_d, 1));
+  graph[n_d].out_edges.insert(EdgeWithWeight(n_c, 4));
+  graph[n_e].out_edges.insert(EdgeWithWeight(n_e, 1));
+
+  CycleBreaker breaker;
+
+  set<Edge> broken_edges;
+  breaker.BreakCycles(graph, &broken_edges);
+
+  EXPECT_EQ((set<Edge>{make_pair(n_b, n_a),
+                       make_pair(n_c, n_d),
+                       make_pair(n_e, n_e)}),
+            broken_edges);
+}
+
 }  // namespace chromeos_update_engine
@@ -16,18 +16,29 @@
 
 #include "update_engine/payload_generator/deflate_utils.h"
 
+#include <string.h>
+
 #include <algorithm>
+#include <iterator>
+#include <memory>
 #include <string>
 #include <utility>
 
 #include <base/files/file_util.h>
 #include <base/logging.h>
+#include <base/macros.h>
+#include <base/strings/string_number_conversions.h>
 #include <base/strings/string_util.h>
+#include <base/threading/simple_thread.h>
 
+#include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/diff_cache.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/mapped_image.h"
 #include "update_engine/payload_generator/squashfs_filesystem.h"
 #include "update_engine/update_metadata.pb.h"
 
@@ -43,15 +54,22 @@ namespace {
 // The minimum size for a squashfs image to be processed.
 const uint64_t kMinimumSquashfsImageSize = 1 * 1024 * 1024;  // bytes
 
+// The version of the deflates stored in the cache. It must be increased
+// whenever the deflates located in the same data change, for example with a
+// new version of puffin, so the old entries are not used.
+const uint32_t kDeflatesCacheVersion = 1;
+
 // TODO(*): Optimize this so we don't have to read all extents into memory in
 // case it is large.
 bool CopyExtentsToFile(const string& in_path,
                        const vector<Extent> extents,
                        const string& out_path,
                        size_t block_size) {
-  brillo::Blob data(utils::BlocksInExtents(extents) * block_size);
-  TEST_AND_RETURN_FALSE(
-      utils::ReadExtents(in_path, extents, &data, data.size(), block_size));
+  ImageExtentsData data;
+  TEST_AND_RETURN_FALSE(data.Load(in_path,
+                                  extents,
+                                  utils::BlocksInExtents(extents) * block_size,
+                                  block_size));
   TEST_AND_RETURN_FALSE(
       utils::WriteFile(out_path.c_str(), data.data(), data.size()));
   return true;
@@ -111,6 +129,125 @@ bool IsFileExtensions(const string& name,
   });
 }
 
+// Splits a squashfs image into its files, or locates the deflates of a zip or
+// gzip file, in one of the threads of PreprocessPartitionFiles().
+class FilePreprocessor : public base::DelegateSimpleThread::Delegate {
+ public:
+  FilePreprocessor(const string& part_path,
+                   const FilesystemInterface::File& file,
+                   bool extract_deflates,
+                   DeflatesCache* deflates_cache)
+      : part_path_(part_path),
+        file_(file),
+        extract_deflates_(extract_deflates),
+        deflates_cache_(deflates_cache) {}
+
+  // base::DelegateSimpleThread::Delegate overrides.
+  void Run() override { ok_ = Process(); }
+
+  uint64_t num_blocks() const { return utils::BlocksInExtents(file_.extents); }
+  bool ok() const { return ok_; }
+  vector<FilesystemInterface::File>* files() { return &files_; }
+
+ private:
+  // Fills |files_| with the processed file, or with the files of the squashfs
+  // image it contains.
+  bool Process();
+
+  // Locates the deflates of the zip or gzip file in |file_|, relative to the
+  // start of the file, reusing the ones in |deflates_cache_| if any.
+  bool LocateDeflates(bool is_zip, vector<BitExtent>* deflates);
+
+  const string& part_path_;
+  FilesystemInterface::File file_;
+  bool extract_deflates_;
+  DeflatesCache* deflates_cache_;
+
+  bool ok_{false};
+  vector<FilesystemInterface::File> files_;
+
+  DISALLOW_COPY_AND_ASSIGN(FilePreprocessor);
+};
+
+bool FilePreprocessor::Process() {
+  if (IsSquashfsImage(part_path_, file_)) {
+    // Read the image into a file.
+    base::FilePath path;
+    TEST_AND_RETURN_FALSE(base::CreateTemporaryFile(&path));
+    ScopedPathUnlinker old_unlinker(path.value());
+    TEST_AND_RETURN_FALSE(
+        CopyExtentsToFile(part_path_, file_.extents, path.value(), kBlockSize));
+    // Test if it is actually a Squashfs file.
+    auto sqfs =
+        SquashfsFilesystem::CreateFromFile(path.value(), extract_deflates_);
+    if (sqfs) {
+      // It is an squashfs file. Get its files to replace with itself.
+      vector<FilesystemInterface::File> files;
+      sqfs->GetFiles(&files);
+
+      // Replace squashfs file with its files only if |files| has at least two
+      // files or if it has some deflates (since it is better to replace it to
+      // take advantage of the deflates.)
+      if (files.size() > 1 ||
+          (files.size() == 1 && !files[0].deflates.empty())) {
+        TEST_AND_RETURN_FALSE(RealignSplittedFiles(file_, &files));
+        files_ = std::move(files);
+        return true;
+      }
+    } else {
+      LOG(WARNING) << "We thought file: " << file_.name
+                   << " was a Squashfs file, but it was not.";
+    }
+  }
+
+  if (extract_deflates_) {
+    // Search for deflates if the file is in zip or gzip format.
+    // .zvoice files may eventually move out of rootfs. If that happens,
+    // remove ".zvoice" (crbug.com/782918).
+    bool is_zip = IsFileExtensions(
+        file_.name, {".apk", ".zip", ".jar", ".zvoice", ".apex"});
+    bool is_gzip = IsFileExtensions(file_.name, {".gz", ".gzip", ".tgz"});
+    if (is_zip || is_gzip) {
+      vector<BitExtent> deflates;
+      TEST_AND_RETURN_FALSE(LocateDeflates(is_zip, &deflates));
+      // Shift the deflate's extent to the offset starting from the beginning
+      // of the current partition; and the delta processor will align the
+      // extents in a continuous buffer later.
+      TEST_AND_RETURN_FALSE(
+          ShiftBitExtentsOverExtents(file_.extents, &deflates));
+      file_.deflates = std::move(deflates);
+    }
+  }
+
+  files_.push_back(std::move(file_));
+  return true;
+}
+
+bool FilePreprocessor::LocateDeflates(bool is_zip,
+                                      vector<BitExtent>* deflates) {
+  brillo::Blob data;
+  TEST_AND_RETURN_FALSE(
+      ReadImageExtents(part_path_,
+                       file_.extents,
+                       &data,
+                       kBlockSize * utils::BlocksInExtents(file_.extents),
+                       kBlockSize));
+  string cache_key;
+  if (deflates_cache_) {
+    cache_key = DeflatesCache::GetKey(data, is_zip);
+    if (deflates_cache_->Get(cache_key, deflates))
+      return true;
+  }
+  if (is_zip) {
+    TEST_AND_RETURN_FALSE(puffin::LocateDeflatesInZipArchive(data, deflates));
+  } else {
+    TEST_AND_RETURN_FALSE(puffin::LocateDeflatesInGzip(data, deflates));
+  }
+  if (deflates_cache_)
+    deflates_cache_->Put(cache_key, *deflates);
+  return true;
+}
+
 }  // namespace
 
 ByteExtent ExpandToByteExtent(const BitExtent& extent) {
@@ -258,78 +395,119 @@ bool FindAndCompactDeflates(const vector<Extent>& extents,
 
 bool PreprocessPartitionFiles(const PartitionConfig& part,
                               vector<FilesystemInterface::File>* result_files,
-                              bool extract_deflates) {
+                              bool extract_deflates,
+                              DeflatesCache* deflates_cache) {
   // Get the file system files.
   vector<FilesystemInterface::File> tmp_files;
   part.fs_interface->GetFiles(&tmp_files);
+
+  // The files are processed in parallel, the biggest ones first so the
+  // smallest ones keep all the threads busy until the end. The results are
+  // merged in the order of the files.
+  vector<std::unique_ptr<FilePreprocessor>> processors;
+  processors.reserve(tmp_files.size());
+  for (const auto& file : tmp_files) {
+    processors.emplace_back(new FilePreprocessor(
+        part.path, file, extract_deflates, deflates_cache));
+  }
+  vector<FilePreprocessor*> sorted_processors;
+  sorted_processors.reserve(processors.size());
+  for (auto& processor : processors)
+    sorted_processors.push_back(processor.get());
+  std::stable_sort(sorted_processors.begin(),
+                   sorted_processors.end(),
+                   [](const FilePreprocessor* a, const FilePreprocessor* b) {
+                     return a->num_blocks() > b->num_blocks();
+                   });
+
+  size_t num_threads = std::max<size_t>(
+      1, std::min(processors.size(), diff_utils::GetMaxThreads()));
+  base::DelegateSimpleThreadPool thread_pool("partition-file-preprocessor",
+                                             num_threads);
+  thread_pool.Start();
+  for (FilePreprocessor* processor : sorted_processors)
+    thread_pool.AddWork(processor);
+  thread_pool.JoinAll();
+
   result_files->reserve(tmp_files.size());
+  for (auto& processor : processors) {
+    TEST_AND_RETURN_FALSE(processor->ok());
+    result_files->insert(result_files->end(),
+                         std::make_move_iterator(processor->files()->begin()),
+                         std::make_move_iterator(processor->files()->end()));
+  }
+  return true;
+}
 
-  for (auto& file : tmp_files) {
-    if (IsSquashfsImage(part.path, file)) {
-      // Read the image into a file.
-      base::FilePath path;
-      TEST_AND_RETURN_FALSE(base::CreateTemporaryFile(&path));
-      ScopedPathUnlinker old_unlinker(path.value());
-      TEST_AND_RETURN_FALSE(
-          CopyExtentsToFile(part.path, file.extents, path.value(), kBlockSize));
-      // Test if it is actually a Squashfs file.
-      auto sqfs =
-          SquashfsFilesystem::CreateFromFile(path.value(), extract_deflates);
-      if (sqfs) {
-        // It is an squashfs file. Get its files to replace with itself.
-        vector<FilesystemInterface::File> files;
-        sqfs->GetFiles(&files);
-
-        // Replace squashfs file with its files only if |files| has at least two
-        // files or if it has some deflates (since it is better to replace it to
-        // take advantage of the deflates.)
-        if (files.size() > 1 ||
-            (files.size() == 1 && !files[0].deflates.empty())) {
-          TEST_AND_RETURN_FALSE(RealignSplittedFiles(file, &files));
-          result_files->insert(result_files->end(), files.begin(), files.end());
-          continue;
-        }
-      } else {
-        LOG(WARNING) << "We thought file: " << file.name
-                     << " was a Squashfs file, but it was not.";
-      }
-    }
+string DeflatesCache::GetKey(const brillo::Blob& data, bool is_zip) {
+  brillo::Blob data_hash;
+  HashCalculator hasher;
+  uint32_t version = kDeflatesCacheVersion;
+  uint8_t format = is_zip ? 1 : 0;
+  if (!HashCalculator::RawHashOfData(data, &data_hash) ||
+      !hasher.Update(&version, sizeof(version)) ||
+      !hasher.Update(&format, sizeof(format)) ||
+      !hasher.Update(data_hash.data(), data_hash.size()) ||
+      !hasher.Finalize()) {
+    return "";
+  }
+  return base::HexEncode(hasher.raw_hash().data(), hasher.raw_hash().size());
+}
 
-    if (extract_deflates) {
-      // Search for deflates if the file is in zip or gzip format.
-      // .zvoice files may eventually move out of rootfs. If that happens,
-      // remove ".zvoice" (crbug.com/782918).
-      bool is_zip = IsFileExtensions(
-          file.name, {".apk", ".zip", ".jar", ".zvoice", ".apex"});
-      bool is_gzip = IsFileExtensions(file.name, {".gz", ".gzip", ".tgz"});
-      if (is_zip || is_gzip) {
-        brillo::Blob data;
-        TEST_AND_RETURN_FALSE(utils::ReadExtents(
-            part.path,
-            file.extents,
-            &data,
-            kBlockSize * utils::BlocksInExtents(file.extents),
-            kBlockSize));
-        vector<puffin::BitExtent> deflates;
-        if (is_zip) {
-          TEST_AND_RETURN_FALSE(
-              puffin::LocateDeflatesInZipArchive(data, &deflates));
-        } else if (is_gzip) {
-          TEST_AND_RETURN_FALSE(puffin::LocateDeflatesInGzip(data, &deflates));
-        }
-        // Shift the deflate's extent to the offset starting from the beginning
-        // of the current partition; and the delta processor will align the
-        // extents in a continuous buffer later.
-        TEST_AND_RETURN_FALSE(
-            ShiftBitExtentsOverExtents(file.extents, &deflates));
-        file.deflates = std::move(deflates);
-      }
+bool DeflatesCache::Get(const string& key, vector<BitExtent>* deflates) {
+  if (key.empty())
+    return false;
+  {
+    base::AutoLock auto_lock(lock_);
+    auto it = deflates_.find(key);
+    if (it != deflates_.end()) {
+      *deflates = it->second;
+      return true;
     }
-
-    result_files->push_back(file);
   }
+  if (!diff_cache_)
+    return false;
+
+  // The deflates are stored as their number followed by the offset and length
+  // of each one.
+  brillo::Blob blob;
+  if (!diff_cache_->Get(key, &blob) || blob.size() < sizeof(uint64_t))
+    return false;
+  uint64_t num_deflates;
+  memcpy(&num_deflates, blob.data(), sizeof(num_deflates));
+  if (blob.size() != sizeof(num_deflates) + num_deflates * sizeof(BitExtent))
+    return false;
+  const BitExtent* stored_deflates =
+      reinterpret_cast<const BitExtent*>(blob.data() + sizeof(num_deflates));
+  deflates->assign(stored_deflates, stored_deflates + num_deflates);
+
+  base::AutoLock auto_lock(lock_);
+  deflates_[key] = *deflates;
   return true;
 }
 
+void DeflatesCache::Put(const string& key, const vector<BitExtent>& deflates) {
+  if (key.empty())
+    return;
+  {
+    base::AutoLock auto_lock(lock_);
+    deflates_[key] = deflates;
+  }
+  if (!diff_cache_)
+    return;
+
+  uint64_t num_deflates = deflates.size();
+  const uint8_t* num_deflates_bytes =
+      reinterpret_cast<const uint8_t*>(&num_deflates);
+  const uint8_t* deflates_bytes =
+      reinterpret_cast<const uint8_t*>(deflates.data());
+  brillo::Blob blob(num_deflates_bytes,
+                    num_deflates_bytes + sizeof(num_deflates));
+  blob.insert(blob.end(),
+              deflates_bytes,
+              deflates_bytes + num_deflates * sizeof(BitExtent));
+  diff_cache_->Put(key, blob);
+}
+
 }  // namespace deflate_utils
 }  // namespace chromeos_update_engine
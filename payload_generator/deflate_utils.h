@@ -17,22 +17,60 @@
 #ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_DEFLATE_UTILS_H_
 #define UPDATE_ENGINE_PAYLOAD_GENERATOR_DEFLATE_UTILS_H_
 
-#include <puffin/puffdiff.h>
+#include <map>
+#include <string>
 #include <vector>
 
+#include <base/macros.h>
+#include <base/synchronization/lock.h>
+#include <brillo/secure_blob.h>
+#include <puffin/puffdiff.h>
+
+#include "update_engine/payload_generator/diff_cache.h"
 #include "update_engine/payload_generator/filesystem_interface.h"
 #include "update_engine/payload_generator/payload_generation_config.h"
 
 namespace chromeos_update_engine {
 namespace deflate_utils {
 
-// Gets the files from the partition and processes all its files. Processing
-// includes:
+// A cache of the deflates located in the zip and gzip files, by the hash of
+// their data. The files found in both the old and new partitions are then only
+// scanned once. With a |diff_cache|, the deflates are also stored in it and
+// reused by the next payloads generated with the same cache directory. It can
+// be used from several threads.
+class DeflatesCache {
+ public:
+  explicit DeflatesCache(DiffCache* diff_cache) : diff_cache_(diff_cache) {}
+
+  // Returns the key of the deflates of the zip file |data| if |is_zip| or of
+  // the gzip file |data| otherwise.
+  static std::string GetKey(const brillo::Blob& data, bool is_zip);
+
+  // Reads the deflates stored for |key| in |deflates|. Returns false if there
+  // are none.
+  bool Get(const std::string& key, std::vector<puffin::BitExtent>* deflates);
+
+  // Stores the |deflates| for |key|.
+  void Put(const std::string& key,
+           const std::vector<puffin::BitExtent>& deflates);
+
+ private:
+  base::Lock lock_;
+  std::map<std::string, std::vector<puffin::BitExtent>> deflates_;
+  DiffCache* diff_cache_;
+
+  DISALLOW_COPY_AND_ASSIGN(DeflatesCache);
+};
+
+// Gets the files from the partition and processes all its files in parallel.
+// Processing includes:
 //  - splitting large Squashfs containers into its smaller files.
-//  - extracting deflates in zip and gzip files.
+//  - extracting deflates in zip and gzip files, reusing the ones in the
+//    |deflates_cache| if not null.
 bool PreprocessPartitionFiles(const PartitionConfig& part,
                               std::vector<FilesystemInterface::File>* result,
-                              bool extract_deflates);
+                              bool extract_deflates,
+                              DeflatesCache* deflates_cache);
 
 // Spreads all extents in |over_extents| over |base_extents|. Here we assume the
 // |over_extents| are non-overlapping and sorted by their offset.
@@ -19,9 +19,11 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <string>
 #include <utility>
 #include <vector>
 
+#include <base/files/scoped_temp_dir.h>
 #include <gtest/gtest.h>
 
 #include "update_engine/common/test_utils.h"
@@ -31,6 +33,7 @@
 
 using puffin::BitExtent;
 using puffin::ByteExtent;
+using std::string;
 using std::vector;
 
 namespace chromeos_update_engine {
@@ -186,5 +189,44 @@ TEST(DeflateUtilsTest, CompactBoundaryTest) {
   EXPECT_EQ(out_deflates, expected_out_deflates);
 }
 
+TEST(DeflateUtilsTest, DeflatesCacheTest) {
+  brillo::Blob data(1024);
+  test_utils::FillWithData(&data);
+  string key = DeflatesCache::GetKey(data, true);
+  // The same data located as gzip has other deflates.
+  EXPECT_NE(key, DeflatesCache::GetKey(data, false));
+
+  base::ScopedTempDir cache_dir;
+  ASSERT_TRUE(cache_dir.CreateUniqueTempDir());
+  DiffCache diff_cache(cache_dir.GetPath().value());
+  DeflatesCache deflates_cache(&diff_cache);
+  vector<BitExtent> deflates;
+  EXPECT_FALSE(deflates_cache.Get(key, &deflates));
+
+  vector<BitExtent> expected_deflates = ByteToBitExtent({{10, 20}, {40, 50}});
+  deflates_cache.Put(key, expected_deflates);
+  EXPECT_TRUE(deflates_cache.Get(key, &deflates));
+  EXPECT_EQ(expected_deflates, deflates);
+
+  // Another cache on the same directory reads the same deflates, even when
+  // there are none.
+  string empty_key = DeflatesCache::GetKey(data, false);
+  deflates_cache.Put(empty_key, {});
+  DeflatesCache other_deflates_cache(&diff_cache);
+  deflates.clear();
+  EXPECT_TRUE(other_deflates_cache.Get(key, &deflates));
+  EXPECT_EQ(expected_deflates, deflates);
+  deflates = expected_deflates;
+  EXPECT_TRUE(other_deflates_cache.Get(empty_key, &deflates));
+  EXPECT_TRUE(deflates.empty());
+
+  // Without a diff cache, the deflates are only kept in memory.
+  DeflatesCache memory_deflates_cache(nullptr);
+  EXPECT_FALSE(memory_deflates_cache.Get(key, &deflates));
+  memory_deflates_cache.Put(key, expected_deflates);
+  EXPECT_TRUE(memory_deflates_cache.Get(key, &deflates));
+  EXPECT_EQ(expected_deflates, deflates);
+}
+
 }  // namespace deflate_utils
 }  // namespace chromeos_update_engine
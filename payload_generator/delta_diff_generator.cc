@@ -35,7 +35,9 @@
 #include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_generator/ab_generator.h"
 #include "update_engine/payload_generator/blob_file_writer.h"
+#include "update_engine/payload_generator/block_mapping.h"
 #include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/diff_cache.h"
 #include "update_engine/payload_generator/full_update_generator.h"
 #include "update_engine/payload_generator/inplace_generator.h"
 #include "update_engine/payload_generator/payload_file.h"
@@ -50,9 +52,47 @@ namespace chromeos_update_engine {
 const size_t kRootFSPartitionSize = static_cast<size_t>(2) * 1024 * 1024 * 1024;
 const size_t kBlockSize = 4096;  // bytes
 
+namespace {
+
+// Logs how much of each target partition duplicates the data of the previous
+// ones. The payload operations only read the source partition they write to,
+// so these blocks are stored again in the payload.
+bool ReportDuplicatedBlocks(const PayloadGenerationConfig& config) {
+  vector<string> paths;
+  vector<size_t> sizes;
+  for (const PartitionConfig& part : config.target.partitions) {
+    paths.push_back(part.path);
+    sizes.push_back(part.size);
+  }
+  vector<uint64_t> duplicated_blocks;
+  TEST_AND_RETURN_FALSE(CountDuplicatedBlocks(
+      paths, sizes, config.block_size, &duplicated_blocks));
+  for (size_t i = 0; i < duplicated_blocks.size(); i++) {
+    LOG(INFO) << "Partition " << config.target.partitions[i].name << " has "
+              << duplicated_blocks[i] << " blocks ("
+              << duplicated_blocks[i] * config.block_size
+              << " bytes) found in the previous partitions.";
+  }
+  return true;
+}
+
+}  // namespace
+
+bool GenerateUpdatePayloadFile(const PayloadGenerationConfig& config,
+                               const string& output_path,
+                               const string& private_key_path,
+                               uint64_t* metadata_size) {
+  // The diff cache is shared by all the partitions, so the same data found
+  // in several of them is only diffed once.
+  DiffCache diff_cache(config.diff_cache_dir);
+  return GenerateUpdatePayloadFile(
+      config, output_path, private_key_path, &diff_cache, metadata_size);
+}
+
 bool GenerateUpdatePayloadFile(const PayloadGenerationConfig& config,
                                const string& output_path,
                                const string& private_key_path,
+                               DiffCache* diff_cache,
                                uint64_t* metadata_size) {
   if (!config.version.Validate()) {
     LOG(ERROR) << "Unsupported major.minor version: " << config.version.major
@@ -64,6 +104,9 @@ bool GenerateUpdatePayloadFile(const PayloadGenerationConfig& config,
   PayloadFile payload;
   TEST_AND_RETURN_FALSE(payload.Init(config));
 
+  if (config.report_duplicated_blocks)
+    TEST_AND_RETURN_FALSE(ReportDuplicatedBlocks(config));
+
   const string kTempFileTemplate("CrAU_temp_data.XXXXXX");
   string temp_file_path;
   int data_file_fd;
@@ -95,10 +138,10 @@ bool GenerateUpdatePayloadFile(const PayloadGenerationConfig& config,
         // Delta update.
         if (config.version.minor == kInPlaceMinorPayloadVersion) {
           LOG(INFO) << "Using generator InplaceGenerator().";
-          strategy.reset(new InplaceGenerator());
+          strategy.reset(new InplaceGenerator(diff_cache));
         } else {
           LOG(INFO) << "Using generator ABGenerator().";
-          strategy.reset(new ABGenerator());
+          strategy.reset(new ABGenerator(diff_cache));
         }
       } else {
         LOG(INFO) << "Using generator FullUpdateGenerator().";
@@ -115,8 +158,19 @@ bool GenerateUpdatePayloadFile(const PayloadGenerationConfig& config,
       // happened.
       diff_utils::FilterNoopOperations(&aops);
 
-      TEST_AND_RETURN_FALSE(payload.AddPartition(old_part, new_part, aops));
+      if (config.num_shards == 0) {
+        TEST_AND_RETURN_FALSE(
+            payload.AddPartition(old_part, new_part, std::move(aops)));
+      }
     }
+    TEST_AND_RETURN_FALSE(blob_file.Flush());
+  }
+
+  if (config.num_shards > 0) {
+    LOG(INFO) << "Stored the diffs of shard " << config.shard_index << " of "
+              << config.num_shards << " in " << config.diff_cache_dir;
+    *metadata_size = 0;
+    return true;
   }
 
   LOG(INFO) << "Writing payload file...";
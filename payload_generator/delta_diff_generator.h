@@ -19,6 +19,7 @@
 
 #include <string>
 
+#include "update_engine/payload_generator/diff_cache.h"
 #include "update_engine/payload_generator/payload_generation_config.h"
 
 namespace chromeos_update_engine {
@@ -41,6 +42,16 @@ bool GenerateUpdatePayloadFile(const PayloadGenerationConfig& config,
                                const std::string& private_key_path,
                                uint64_t* metadata_size);
 
+// Same as above, but looking up and storing the diffs in the |diff_cache|
+// instead of a cache of its own, so the payloads generated in a row from
+// several source images to the same target share the diffs and the deflates
+// found in the target files.
+bool GenerateUpdatePayloadFile(const PayloadGenerationConfig& config,
+                               const std::string& output_path,
+                               const std::string& private_key_path,
+                               DiffCache* diff_cache,
+                               uint64_t* metadata_size);
+
 };  // namespace chromeos_update_engine
 
 #endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_DELTA_DIFF_GENERATOR_H_
@@ -26,14 +26,17 @@
 #if defined(__clang__)
 #pragma clang diagnostic pop
 #endif
+#include <string.h>
 #include <unistd.h>
 
 #include <algorithm>
 #include <functional>
+#include <limits>
 #include <list>
 #include <map>
 #include <memory>
 #include <numeric>
+#include <random>
 #include <utility>
 
 #include <base/files/file_util.h>
@@ -45,6 +48,7 @@
 #include <brillo/data_encoding.h>
 #include <bsdiff/bsdiff.h>
 #include <bsdiff/patch_writer_factory.h>
+#include <bsdiff/suffix_array_index.h>
 #include <puffin/utils.h>
 
 #include "update_engine/common/hash_calculator.h"
@@ -56,10 +60,18 @@
 #include "update_engine/payload_generator/bzip.h"
 #include "update_engine/payload_generator/deflate_utils.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/diff_cache.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/file_similarity_index.h"
+#include "update_engine/payload_generator/lz4.h"
+#include "update_engine/payload_generator/mapped_image.h"
+#include "update_engine/payload_generator/memory_budget.h"
+#include "update_engine/payload_generator/phase_timings.h"
 #include "update_engine/payload_generator/squashfs_filesystem.h"
 #include "update_engine/payload_generator/xz.h"
+#include "update_engine/payload_generator/zstd.h"
+#include "update_engine/payload_generator/zstd_bsdiff_patch_writer.h"
 
 using std::list;
 using std::map;
@@ -69,19 +81,26 @@ using std::vector;
 namespace chromeos_update_engine {
 namespace {
 
-// The maximum destination size allowed for bsdiff. In general, bsdiff should
-// work for arbitrary big files, but the payload generation and payload
-// application requires a significant amount of RAM. We put a hard-limit of
-// 200 MiB that should not affect any released board, but will limit the
-// Chrome binary in ASan builders.
-const uint64_t kMaxBsdiffDestinationSize = 200 * 1024 * 1024;  // bytes
+// The sizes of the content-defined chunks in which large files are split.
+// The chunks are at least |kCdcMinChunkSize| long, and are cut on average
+// |kCdcAverageChunkSize| bytes after that. The maximum sizes are below both
+// the default bsdiff and puffdiff limits, so these operations stay enabled for
+// every chunk.
+const uint64_t kCdcMinChunkSize = 16 * 1024 * 1024;      // bytes
+const uint64_t kCdcAverageChunkSize = 16 * 1024 * 1024;  // bytes
+const uint64_t kCdcMaxChunkSize = 64 * 1024 * 1024;      // bytes
+const uint64_t kCdcMaxOldChunkSize = 128 * 1024 * 1024;  // bytes
 
-// The maximum destination size allowed for puffdiff. In general, puffdiff
-// should work for arbitrary big files, but the payload application is quite
-// memory intensive, so we limit these operations to 150 MiB.
-const uint64_t kMaxPuffdiffDestinationSize = 150 * 1024 * 1024;  // bytes
+// The number of blocks read at once while looking for the chunk boundaries.
+const uint64_t kCdcReadBlocks = 256;
 
-const int kBrotliCompressionQuality = 11;
+// The minimum size of the old data whose suffix array is sorted in its own
+// thread, while the full operation of the new data is compressed.
+const uint64_t kMinSuffixArrayThreadSize = 1024 * 1024;  // bytes
+
+// The minimum estimated fraction of blocks a new file without an old file of
+// the same name must share with an old file to be diffed against it.
+const double kMinFileSimilarity = 0.25;
 
 // Process a range of blocks from |range_start| to |range_end| in the extent at
 // position |*idx_p| of |extents|. If |do_remove| is true, this range will be
@@ -228,13 +247,324 @@ int LevenshteinDistance(const string& a, const string& b) {
   }
   return distances.back();
 }
+
+// Returns the table of random values used by the gear rolling hash.
+const uint64_t* GearTable() {
+  static const std::vector<uint64_t> table = [] {
+    // The seed is fixed so the chunks, and therefore the payloads, are
+    // reproducible.
+    std::mt19937_64 generator(0x5eed);
+    std::vector<uint64_t> values(256);
+    for (uint64_t& value : values)
+      value = generator();
+    return values;
+  }();
+  return table.data();
+}
+
+// A content-defined chunk of a file, ending at |end_block| blocks from the
+// start of the file. The |anchor| is the value of the rolling hash where the
+// chunk was cut, which identifies the same cut point in another file.
+struct ContentDefinedChunk {
+  uint64_t end_block;
+  uint64_t anchor;
+};
+
+// Splits the blocks |extents| of |part| in chunks with a gear rolling hash,
+// as in FastCDC. A chunk is cut at the end of the block where the hash of the
+// last 64 bytes matches |cut_mask|, once the chunk is at least
+// |min_chunk_blocks| long, or when it reaches |max_chunk_blocks|. Since the
+// cut points only depend on the data around them, inserting or removing data
+// in a file only changes the chunks around the modification.
+bool ComputeContentDefinedChunks(const string& part,
+                                 const vector<Extent>& extents,
+                                 uint64_t min_chunk_blocks,
+                                 uint64_t max_chunk_blocks,
+                                 uint64_t cut_mask,
+                                 vector<ContentDefinedChunk>* chunks) {
+  const uint64_t* gear = GearTable();
+  uint64_t total_blocks = utils::BlocksInExtents(extents);
+  uint64_t hash = 0;
+  uint64_t chunk_start = 0;
+  ImageExtentsData data;
+  for (uint64_t read_offset = 0; read_offset < total_blocks;
+       read_offset += kCdcReadBlocks) {
+    vector<Extent> read_extents =
+        ExtentsSublist(extents, read_offset, kCdcReadBlocks);
+    uint64_t read_blocks = utils::BlocksInExtents(read_extents);
+    TEST_AND_RETURN_FALSE(
+        data.Load(part, read_extents, read_blocks * kBlockSize, kBlockSize));
+    for (uint64_t i = 0; i < read_blocks; i++) {
+      uint64_t chunk_blocks = read_offset + i + 1 - chunk_start;
+      bool check_cut = chunk_blocks >= min_chunk_blocks;
+      bool cut = false;
+      uint64_t anchor = 0;
+      for (const uint8_t* byte = data.data() + i * kBlockSize;
+           byte < data.data() + (i + 1) * kBlockSize;
+           byte++) {
+        hash = (hash << 1) + gear[*byte];
+        if (check_cut && !cut && (hash & cut_mask) == 0) {
+          cut = true;
+          anchor = hash;
+        }
+      }
+      if (!cut && chunk_blocks >= max_chunk_blocks) {
+        cut = true;
+        anchor = hash;
+      }
+      if (cut) {
+        chunk_start = read_offset + i + 1;
+        chunks->push_back({chunk_start, anchor});
+      }
+    }
+  }
+  if (chunk_start < total_blocks)
+    chunks->push_back({total_blocks, hash});
+  return true;
+}
+
+// A thread delegate running a function.
+class FunctionDelegate : public base::DelegateSimpleThread::Delegate {
+ public:
+  explicit FunctionDelegate(std::function<void()> function)
+      : function_(std::move(function)) {}
+  ~FunctionDelegate() override = default;
+
+  // Overrides DelegateSimpleThread::Delegate.
+  void Run() override { function_(); }
+
+ private:
+  std::function<void()> function_;
+
+  DISALLOW_COPY_AND_ASSIGN(FunctionDelegate);
+};
+
+// Builds the suffix array of some data in its own thread, from its creation.
+// The data must outlive the SuffixArrayThread.
+class SuffixArrayThread : public base::DelegateSimpleThread::Delegate {
+ public:
+  explicit SuffixArrayThread(const brillo::Blob& data)
+      : data_(data), thread_(this, "suffix-array") {
+    thread_.Start();
+  }
+  ~SuffixArrayThread() override { Get(); }
+
+  // Overrides DelegateSimpleThread::Delegate.
+  void Run() override {
+    index_ = bsdiff::CreateSuffixArrayIndex(data_.data(), data_.size());
+  }
+
+  // Waits for the suffix array to be built and returns it, or null if it
+  // failed.
+  bsdiff::SuffixArrayIndexInterface* Get() {
+    if (!joined_) {
+      thread_.Join();
+      joined_ = true;
+    }
+    return index_.get();
+  }
+
+ private:
+  const brillo::Blob& data_;
+  std::unique_ptr<bsdiff::SuffixArrayIndexInterface> index_;
+  base::DelegateSimpleThread thread_;
+  bool joined_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(SuffixArrayThread);
+};
+
+// Passes a bsdiff patch to two patch writers, so a single diff is stored in
+// two formats.
+class TeePatchWriter : public bsdiff::PatchWriterInterface {
+ public:
+  TeePatchWriter(bsdiff::PatchWriterInterface* first,
+                 bsdiff::PatchWriterInterface* second)
+      : first_(first), second_(second) {}
+  ~TeePatchWriter() override = default;
+
+  bool Init(size_t new_size) override {
+    return first_->Init(new_size) && second_->Init(new_size);
+  }
+  bool WriteDiffStream(const uint8_t* data, size_t size) override {
+    return first_->WriteDiffStream(data, size) &&
+           second_->WriteDiffStream(data, size);
+  }
+  bool WriteExtraStream(const uint8_t* data, size_t size) override {
+    return first_->WriteExtraStream(data, size) &&
+           second_->WriteExtraStream(data, size);
+  }
+  bool AddControlEntry(const bsdiff::ControlEntry& entry) override {
+    return first_->AddControlEntry(entry) && second_->AddControlEntry(entry);
+  }
+  bool Close() override { return first_->Close() && second_->Close(); }
+
+ private:
+  bsdiff::PatchWriterInterface* first_;
+  bsdiff::PatchWriterInterface* second_;
+
+  DISALLOW_COPY_AND_ASSIGN(TeePatchWriter);
+};
+
+// Returns the key of the bsdiff patch of |type| from |old_data| to |new_data|
+// in the DiffCache.
+string GetBsdiffCacheKey(InstallOperation::Type type,
+                         const PayloadVersion& version,
+                         const DiffSettings& settings,
+                         const brillo::Blob& old_data,
+                         const brillo::Blob& new_data) {
+  return DiffCache::GetKey(
+      type,
+      version,
+      type == InstallOperation::BROTLI_BSDIFF ? settings.brotli_quality : 0,
+      old_data,
+      new_data,
+      {},   // src_deflates
+      {});  // dst_deflates
+}
+
+// Stores in |delta| the bsdiff patch of |type| from |old_data| to |new_data|
+// and, if |zstd_delta| is not null, the same patch as a ZSTD_BSDIFF patch in
+// |zstd_delta|. The patches in the |diff_cache|, if not null, are reused. The
+// |cache_key| of the patch is computed if empty. The suffix array of the old
+// data is taken from the |suffix_array_thread|, if not null.
+bool BsdiffData(InstallOperation::Type type,
+                const PayloadVersion& version,
+                const brillo::Blob& old_data,
+                const brillo::Blob& new_data,
+                const DiffSettings& settings,
+                DiffCache* diff_cache,
+                string cache_key,
+                SuffixArrayThread* suffix_array_thread,
+                brillo::Blob* delta,
+                brillo::Blob* zstd_delta) {
+  string zstd_cache_key;
+  if (diff_cache) {
+    if (cache_key.empty()) {
+      cache_key =
+          GetBsdiffCacheKey(type, version, settings, old_data, new_data);
+    }
+    if (zstd_delta) {
+      zstd_cache_key = GetBsdiffCacheKey(
+          InstallOperation::ZSTD_BSDIFF, version, settings, old_data, new_data);
+    }
+    if (diff_cache->Get(cache_key, delta) &&
+        (!zstd_delta || diff_cache->Get(zstd_cache_key, zstd_delta)))
+      return true;
+  }
+
+  base::FilePath patch;
+  TEST_AND_RETURN_FALSE(base::CreateTemporaryFile(&patch));
+  ScopedPathUnlinker unlinker(patch.value());
+
+  std::unique_ptr<bsdiff::PatchWriterInterface> bsdiff_patch_writer;
+  if (type == InstallOperation::BROTLI_BSDIFF) {
+    bsdiff_patch_writer =
+        bsdiff::CreateBSDF2PatchWriter(patch.value(),
+                                       bsdiff::CompressorType::kBrotli,
+                                       settings.brotli_quality);
+  } else {
+    bsdiff_patch_writer = bsdiff::CreateBsdiffPatchWriter(patch.value());
+  }
+  // The suffix sorting takes most of the time of bsdiff, so the zstd patch is
+  // written from the same diff.
+  ZstdBsdiffPatchWriter zstd_patch_writer(zstd_delta);
+  TeePatchWriter tee_patch_writer(bsdiff_patch_writer.get(),
+                                  &zstd_patch_writer);
+  bsdiff::PatchWriterInterface* patch_writer =
+      zstd_delta ? &tee_patch_writer : bsdiff_patch_writer.get();
+
+  bsdiff::SuffixArrayIndexInterface* sarray =
+      suffix_array_thread ? suffix_array_thread->Get() : nullptr;
+  TEST_AND_RETURN_FALSE(0 == bsdiff::bsdiff(old_data.data(),
+                                            old_data.size(),
+                                            new_data.data(),
+                                            new_data.size(),
+                                            patch_writer,
+                                            sarray ? &sarray : nullptr));
+
+  TEST_AND_RETURN_FALSE(utils::ReadFile(patch.value(), delta));
+  // A failure to store the diff only makes the next payload slower.
+  if (diff_cache) {
+    diff_cache->Put(cache_key, *delta);
+    if (zstd_delta)
+      diff_cache->Put(zstd_cache_key, *zstd_delta);
+  }
+  return true;
+}
+
+// Stores in |delta| the puffdiff patch from |old_data| to |new_data| with the
+// deflates |src_deflates| and |dst_deflates|, reusing the patch in the
+// |diff_cache|, if not null.
+bool PuffdiffData(const PayloadVersion& version,
+                  const brillo::Blob& old_data,
+                  const brillo::Blob& new_data,
+                  const vector<puffin::BitExtent>& src_deflates,
+                  const vector<puffin::BitExtent>& dst_deflates,
+                  DiffCache* diff_cache,
+                  brillo::Blob* delta) {
+  string cache_key;
+  if (diff_cache) {
+    cache_key = DiffCache::GetKey(InstallOperation::PUFFDIFF,
+                                  version,
+                                  0,  // compression_quality
+                                  old_data,
+                                  new_data,
+                                  src_deflates,
+                                  dst_deflates);
+    if (diff_cache->Get(cache_key, delta))
+      return true;
+  }
+
+  string temp_file_path;
+  TEST_AND_RETURN_FALSE(
+      utils::MakeTempFile("puffdiff-delta.XXXXXX", &temp_file_path, nullptr));
+  ScopedPathUnlinker temp_file_unlinker(temp_file_path);
+
+  // Perform PuffDiff operation.
+  TEST_AND_RETURN_FALSE(puffin::PuffDiff(
+      old_data, new_data, src_deflates, dst_deflates, temp_file_path, delta));
+  if (diff_cache)
+    diff_cache->Put(cache_key, *delta);
+  return true;
+}
+// Stores in |equals| whether the data of the |extents| of the file |path| is
+// the same as |data|. The file is mapped in memory instead of read, so big
+// files are compared without copying them to the heap.
+bool CompareExtentsData(const string& path,
+                        const vector<Extent>& extents,
+                        const brillo::Blob& data,
+                        bool* equals) {
+  *equals = false;
+  if (utils::BlocksInExtents(extents) * kBlockSize != data.size())
+    return true;
+  std::unique_ptr<MappedImage> file_image;
+  const MappedImage* image = MappedImage::Get(path);
+  if (!image) {
+    file_image = MappedImage::Create(path);
+    TEST_AND_RETURN_FALSE(file_image);
+    image = file_image.get();
+  }
+
+  uint64_t offset = 0;
+  for (const Extent& extent : extents) {
+    const uint8_t* extent_data = image->GetExtentData(extent, kBlockSize);
+    TEST_AND_RETURN_FALSE(extent_data);
+    uint64_t size = extent.num_blocks() * kBlockSize;
+    if (memcmp(extent_data, data.data() + offset, size) != 0)
+      return true;
+    offset += size;
+  }
+  *equals = true;
+  return true;
+}
+
 }  // namespace
 
 namespace diff_utils {
 
 // This class encapsulates a file delta processing thread work. The
-// processor computes the delta between the source and target files;
-// and write the compressed delta to the blob.
+// processor computes the delta between the source and target files, or a
+// chunk of them, and write the compressed delta to the blob.
 class FileDeltaProcessor : public base::DelegateSimpleThread::Delegate {
  public:
   FileDeltaProcessor(const string& old_part,
@@ -246,6 +576,9 @@ class FileDeltaProcessor : public base::DelegateSimpleThread::Delegate {
                      const vector<puffin::BitExtent>& new_deflates,
                      const string& name,
                      ssize_t chunk_blocks,
+                     const DiffSettings& settings,
+                     DiffCache* diff_cache,
+                     MemoryBudget* memory_budget,
                      BlobFileWriter* blob_file)
       : old_part_(old_part),
         new_part_(new_part),
@@ -257,6 +590,9 @@ class FileDeltaProcessor : public base::DelegateSimpleThread::Delegate {
         new_deflates_(new_deflates),
         name_(name),
         chunk_blocks_(chunk_blocks),
+        settings_(settings),
+        diff_cache_(diff_cache),
+        memory_budget_(memory_budget),
         blob_file_(blob_file) {}
 
   bool operator>(const FileDeltaProcessor& other) const {
@@ -274,6 +610,12 @@ class FileDeltaProcessor : public base::DelegateSimpleThread::Delegate {
   bool MergeOperation(vector<AnnotatedOperation>* aops);
 
  private:
+  // Returns the estimated number of bytes of memory used to compute the delta.
+  uint64_t EstimateMemoryUsage() const;
+
+  // Computes the delta, setting |failed_| on errors.
+  void Process();
+
   const string& old_part_;  // NOLINT(runtime/member_string_references)
   const string& new_part_;  // NOLINT(runtime/member_string_references)
   const PayloadVersion& version_;
@@ -287,6 +629,10 @@ class FileDeltaProcessor : public base::DelegateSimpleThread::Delegate {
   const string name_;
   // Block limit of one aop.
   const ssize_t chunk_blocks_;
+  const DiffSettings settings_;
+  DiffCache* diff_cache_;
+  // Limits the memory used by the processors running at once, if not null.
+  MemoryBudget* memory_budget_;
   BlobFileWriter* blob_file_;
 
   // The list of ops to reach the new file from the old file.
@@ -297,38 +643,77 @@ class FileDeltaProcessor : public base::DelegateSimpleThread::Delegate {
   DISALLOW_COPY_AND_ASSIGN(FileDeltaProcessor);
 };
 
+uint64_t FileDeltaProcessor::EstimateMemoryUsage() const {
+  // The new data is read in full, and compressed and diffed in buffers about
+  // as big.
+  uint64_t old_size = utils::BlocksInExtents(old_extents_) * kBlockSize;
+  uint64_t new_size = new_extents_blocks_ * kBlockSize;
+  if (chunk_blocks_ != -1) {
+    new_size =
+        std::min(new_size, static_cast<uint64_t>(chunk_blocks_) * kBlockSize);
+  }
+  uint64_t usage = 3 * new_size;
+  // The old data is only read when it can be diffed, and bsdiff's suffix
+  // array takes about 8 bytes for each byte of it. Puffdiff works on the
+  // deflated data, which is a few times bigger.
+  if (old_size <= settings_.max_bsdiff_size)
+    usage += 9 * old_size;
+  if (!old_deflates_.empty() && !new_deflates_.empty() &&
+      old_size <= settings_.max_puffdiff_size) {
+    usage += 3 * 9 * old_size + 3 * new_size;
+  }
+  return usage;
+}
+
 void FileDeltaProcessor::Run() {
   TEST_AND_RETURN(blob_file_ != nullptr);
+  uint64_t memory_usage = memory_budget_ ? EstimateMemoryUsage() : 0;
+  if (memory_budget_)
+    memory_budget_->Acquire(memory_usage);
   base::TimeTicks start = base::TimeTicks::Now();
+  Process();
+  if (memory_budget_)
+    memory_budget_->Release(memory_usage);
+  LOG_IF(INFO, !failed_) << "Encoded file " << name_ << " ("
+                         << new_extents_blocks_ << " blocks) in "
+                         << (base::TimeTicks::Now() - start);
+}
 
-  if (!DeltaReadFile(&file_aops_,
-                     old_part_,
-                     new_part_,
-                     old_extents_,
-                     new_extents_,
-                     old_deflates_,
-                     new_deflates_,
-                     name_,
-                     chunk_blocks_,
-                     version_,
-                     blob_file_)) {
-    LOG(ERROR) << "Failed to generate delta for " << name_ << " ("
-               << new_extents_blocks_ << " blocks)";
-    failed_ = true;
-    return;
+void FileDeltaProcessor::Process() {
+  {
+    ScopedPhaseTimer timer(kPhaseFileDiff, name_);
+    if (!DeltaReadFile(&file_aops_,
+                       old_part_,
+                       new_part_,
+                       old_extents_,
+                       new_extents_,
+                       old_deflates_,
+                       new_deflates_,
+                       name_,
+                       chunk_blocks_,
+                       version_,
+                       settings_,
+                       diff_cache_,
+                       blob_file_)) {
+      LOG(ERROR) << "Failed to generate delta for " << name_ << " ("
+                 << new_extents_blocks_ << " blocks)";
+      failed_ = true;
+      return;
+    }
   }
 
   if (!version_.InplaceUpdate()) {
-    if (!ABGenerator::FragmentOperations(
-            version_, &file_aops_, new_part_, blob_file_)) {
+    ScopedPhaseTimer timer(kPhaseFragmentOperations);
+    if (!ABGenerator::FragmentOperations(version_,
+                                         settings_.apply_cost,
+                                         &file_aops_,
+                                         new_part_,
+                                         blob_file_)) {
       LOG(ERROR) << "Failed to fragment operations for " << name_;
       failed_ = true;
       return;
     }
   }
-
-  LOG(INFO) << "Encoded file " << name_ << " (" << new_extents_blocks_
-            << " blocks) in " << (base::TimeTicks::Now() - start);
 }
 
 bool FileDeltaProcessor::MergeOperation(vector<AnnotatedOperation>* aops) {
@@ -354,7 +739,7 @@ FilesystemInterface::File GetOldFile(
   // This works great if the file has version number in it, but even for
   // a completely new file, using a similar file can still help.
   int min_distance = new_file_name.size();
-  const FilesystemInterface::File* old_file;
+  const FilesystemInterface::File* old_file = nullptr;
   for (const auto& pair : old_files_map) {
     int distance = LevenshteinDistance(new_file_name, pair.first);
     if (distance < min_distance) {
@@ -362,16 +747,225 @@ FilesystemInterface::File GetOldFile(
       old_file = &pair.second;
     }
   }
+  if (!old_file)
+    return {};
   LOG(INFO) << "Using " << old_file->name << " as source for " << new_file_name;
   return *old_file;
 }
 
+FilesystemInterface::File GetOldFile(
+    const map<string, FilesystemInterface::File>& old_files_map,
+    const FileSimilarityIndex& old_files_index,
+    const FilesystemInterface::File& new_file,
+    const vector<BlockMapping::BlockId>& new_block_ids) {
+  if (old_files_map.count(new_file.name) == 0) {
+    // A renamed or moved file keeps most of its blocks, unlike a file with a
+    // similar name.
+    string similar_name = old_files_index.FindSimilarFile(
+        new_file.extents, new_block_ids, kMinFileSimilarity);
+    auto old_file_iter = old_files_map.find(similar_name);
+    if (old_file_iter != old_files_map.end()) {
+      LOG(INFO) << "Using " << similar_name << " as source for "
+                << new_file.name << " by content";
+      return old_file_iter->second;
+    }
+  }
+  return GetOldFile(old_files_map, new_file.name);
+}
+
+bool SplitContentDefinedChunks(const string& old_part,
+                               const string& new_part,
+                               const vector<Extent>& old_extents,
+                               const vector<Extent>& new_extents,
+                               uint64_t min_chunk_blocks,
+                               uint64_t average_chunk_blocks,
+                               uint64_t max_chunk_blocks,
+                               uint64_t max_old_chunk_blocks,
+                               vector<vector<Extent>>* old_chunks,
+                               vector<vector<Extent>>* new_chunks) {
+  TEST_AND_RETURN_FALSE(min_chunk_blocks <= max_chunk_blocks);
+  TEST_AND_RETURN_FALSE(max_old_chunk_blocks > 0);
+  // Cut with a probability of one every |average_chunk_blocks| blocks, using
+  // the most significant bits of the hash, which depend on the most bytes.
+  uint64_t cut_bits = 0;
+  while (cut_bits < 63 &&
+         (static_cast<uint64_t>(1) << cut_bits) <
+             average_chunk_blocks * kBlockSize) {
+    cut_bits++;
+  }
+  const uint64_t cut_mask =
+      cut_bits == 0 ? 0 : ~static_cast<uint64_t>(0) << (64 - cut_bits);
+
+  vector<ContentDefinedChunk> old_cdc_chunks;
+  vector<ContentDefinedChunk> new_cdc_chunks;
+  TEST_AND_RETURN_FALSE(ComputeContentDefinedChunks(old_part,
+                                                    old_extents,
+                                                    min_chunk_blocks,
+                                                    max_chunk_blocks,
+                                                    cut_mask,
+                                                    &old_cdc_chunks));
+  TEST_AND_RETURN_FALSE(ComputeContentDefinedChunks(new_part,
+                                                    new_extents,
+                                                    min_chunk_blocks,
+                                                    max_chunk_blocks,
+                                                    cut_mask,
+                                                    &new_cdc_chunks));
+
+  // The block offsets in the old file of the cut points of each anchor.
+  map<uint64_t, vector<uint64_t>> old_cut_points;
+  for (const ContentDefinedChunk& chunk : old_cdc_chunks)
+    old_cut_points[chunk.anchor].push_back(chunk.end_block);
+
+  // Pair each new chunk with the old data between the same cut points. When
+  // the cut point ending a new chunk doesn't exist in the old file, the old
+  // chunk is assumed to have the same size.
+  uint64_t old_total_blocks = utils::BlocksInExtents(old_extents);
+  uint64_t old_start = 0;
+  uint64_t new_start = 0;
+  old_chunks->clear();
+  new_chunks->clear();
+  for (size_t i = 0; i < new_cdc_chunks.size(); i++) {
+    const ContentDefinedChunk& chunk = new_cdc_chunks[i];
+    uint64_t new_blocks = chunk.end_block - new_start;
+    uint64_t old_end = old_total_blocks;
+    if (i + 1 < new_cdc_chunks.size()) {
+      old_end = std::min(old_total_blocks, old_start + new_blocks);
+      auto cut_points = old_cut_points.find(chunk.anchor);
+      if (cut_points != old_cut_points.end()) {
+        auto cut_point = std::upper_bound(
+            cut_points->second.begin(), cut_points->second.end(), old_start);
+        if (cut_point != cut_points->second.end())
+          old_end = *cut_point;
+      }
+    }
+    old_end = std::max(old_end, old_start);
+    // Keep the data closer to the cut point if the old chunk is too big, for
+    // example when data was removed from the file.
+    uint64_t old_blocks = std::min(old_end - old_start, max_old_chunk_blocks);
+    old_chunks->push_back(
+        ExtentsSublist(old_extents, old_end - old_blocks, old_blocks));
+    new_chunks->push_back(ExtentsSublist(new_extents, new_start, new_blocks));
+    old_start = old_end;
+    new_start = chunk.end_block;
+  }
+  return true;
+}
+
+// Adds the processors computing the delta of a file to |processors|. Files
+// bigger than |chunk_blocks| are split in the same chunks DeltaReadFile()
+// would use, with one processor per chunk, so the chunks of a large file are
+// processed concurrently. If |content_defined_chunking| is true, the files too
+// big for bsdiff or puffdiff are split in content-defined chunks instead.
+bool AddFileDeltaProcessors(list<FileDeltaProcessor>* processors,
+                            const string& old_part,
+                            const string& new_part,
+                            const PayloadVersion& version,
+                            const vector<Extent>& old_extents,
+                            const vector<Extent>& new_extents,
+                            const vector<puffin::BitExtent>& old_deflates,
+                            const vector<puffin::BitExtent>& new_deflates,
+                            const string& name,
+                            ssize_t chunk_blocks,
+                            bool content_defined_chunking,
+                            const DiffSettings& settings,
+                            DiffCache* diff_cache,
+                            MemoryBudget* memory_budget,
+                            BlobFileWriter* blob_file) {
+  uint64_t total_blocks = utils::BlocksInExtents(new_extents);
+  uint64_t max_diff_size = settings.max_bsdiff_size;
+  if (!new_deflates.empty() && settings.max_puffdiff_size > 0)
+    max_diff_size = std::min(max_diff_size, settings.max_puffdiff_size);
+  uint64_t max_size =
+      std::max(total_blocks, utils::BlocksInExtents(old_extents)) * kBlockSize;
+  if (content_defined_chunking && max_diff_size >= kBlockSize &&
+      max_size > max_diff_size) {
+    uint64_t max_chunk_blocks =
+        std::min(kCdcMaxChunkSize, max_diff_size) / kBlockSize;
+    if (chunk_blocks != -1)
+      max_chunk_blocks =
+          std::min(max_chunk_blocks, static_cast<uint64_t>(chunk_blocks));
+    vector<vector<Extent>> old_chunks;
+    vector<vector<Extent>> new_chunks;
+    TEST_AND_RETURN_FALSE(SplitContentDefinedChunks(
+        old_part,
+        new_part,
+        old_extents,
+        new_extents,
+        std::min(kCdcMinChunkSize / kBlockSize, max_chunk_blocks),
+        kCdcAverageChunkSize / kBlockSize,
+        max_chunk_blocks,
+        kCdcMaxOldChunkSize / kBlockSize,
+        &old_chunks,
+        &new_chunks));
+    LOG(INFO) << "Split " << name << " (" << total_blocks << " blocks) in "
+              << new_chunks.size() << " content-defined chunks";
+    for (size_t i = 0; i < new_chunks.size(); i++) {
+      processors->emplace_back(
+          old_part,
+          new_part,
+          version,
+          old_chunks[i],
+          new_chunks[i],
+          old_deflates,
+          new_deflates,
+          base::StringPrintf("%s:%" PRIuS, name.c_str(), i),
+          -1,  // chunk_blocks
+          settings,
+          diff_cache,
+          memory_budget,
+          blob_file);
+    }
+    return true;
+  }
+
+  if (chunk_blocks == -1 ||
+      static_cast<uint64_t>(chunk_blocks) >= total_blocks) {
+    processors->emplace_back(old_part,
+                             new_part,
+                             version,
+                             old_extents,
+                             new_extents,
+                             old_deflates,
+                             new_deflates,
+                             name,
+                             chunk_blocks,
+                             settings,
+                             diff_cache,
+                             memory_budget,
+                             blob_file);
+    return true;
+  }
+  for (uint64_t block_offset = 0; block_offset < total_blocks;
+       block_offset += chunk_blocks) {
+    processors->emplace_back(
+        old_part,
+        new_part,
+        version,
+        ExtentsSublist(old_extents, block_offset, chunk_blocks),
+        ExtentsSublist(new_extents, block_offset, chunk_blocks),
+        old_deflates,
+        new_deflates,
+        base::StringPrintf(
+            "%s:%" PRIu64, name.c_str(), block_offset / chunk_blocks),
+        -1,  // chunk_blocks
+        settings,
+        diff_cache,
+        memory_budget,
+        blob_file);
+  }
+  return true;
+}
+
 bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
                         const PartitionConfig& old_part,
                         const PartitionConfig& new_part,
                         ssize_t hard_chunk_blocks,
                         size_t soft_chunk_blocks,
+                        bool content_defined_chunking,
+                        uint64_t memory_budget,
                         const PayloadVersion& version,
+                        const DiffSettings& settings,
+                        DiffCache* diff_cache,
                         BlobFileWriter* blob_file) {
   ExtentRanges old_visited_blocks;
   ExtentRanges new_visited_blocks;
@@ -389,6 +983,8 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
   }
 
   ExtentRanges old_zero_blocks;
+  vector<BlockMapping::BlockId> old_block_ids;
+  vector<BlockMapping::BlockId> new_block_ids;
   TEST_AND_RETURN_FALSE(DeltaMovedAndZeroBlocks(aops,
                                                 old_part.path,
                                                 new_part.path,
@@ -399,23 +995,34 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
                                                 blob_file,
                                                 &old_visited_blocks,
                                                 &new_visited_blocks,
-                                                &old_zero_blocks));
+                                                &old_zero_blocks,
+                                                &old_block_ids,
+                                                &new_block_ids));
 
   bool puffdiff_allowed = version.OperationAllowed(InstallOperation::PUFFDIFF);
+  deflate_utils::DeflatesCache deflates_cache(diff_cache);
   map<string, FilesystemInterface::File> old_files_map;
   if (old_part.fs_interface) {
     vector<FilesystemInterface::File> old_files;
     TEST_AND_RETURN_FALSE(deflate_utils::PreprocessPartitionFiles(
-        old_part, &old_files, puffdiff_allowed));
+        old_part, &old_files, puffdiff_allowed, &deflates_cache));
     for (const FilesystemInterface::File& file : old_files)
       old_files_map[file.name] = file;
   }
+  // Index the old files by their blocks, in name order, to find the previous
+  // version of the renamed files.
+  FileSimilarityIndex old_files_index;
+  for (const auto& pair : old_files_map)
+    old_files_index.AddFile(pair.first, pair.second.extents, old_block_ids);
 
   TEST_AND_RETURN_FALSE(new_part.fs_interface);
   vector<FilesystemInterface::File> new_files;
   TEST_AND_RETURN_FALSE(deflate_utils::PreprocessPartitionFiles(
-      new_part, &new_files, puffdiff_allowed));
+      new_part, &new_files, puffdiff_allowed, &deflates_cache));
 
+  std::unique_ptr<MemoryBudget> processors_memory_budget;
+  if (memory_budget > 0)
+    processors_memory_budget.reset(new MemoryBudget(memory_budget));
   list<FileDeltaProcessor> file_delta_processors;
 
   // The processing is very straightforward here, we generate operations for
@@ -446,7 +1053,7 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
     // time, it will be easy (non-complex) to have many operations read
     // from the same source blocks. At that time, this code can die. -adlr
     FilesystemInterface::File old_file =
-        GetOldFile(old_files_map, new_file.name);
+        GetOldFile(old_files_map, old_files_index, new_file, new_block_ids);
     vector<Extent> old_file_extents;
     if (version.InplaceUpdate())
       old_file_extents =
@@ -455,16 +1062,22 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
       old_file_extents = FilterExtentRanges(old_file.extents, old_zero_blocks);
     old_visited_blocks.AddExtents(old_file_extents);
 
-    file_delta_processors.emplace_back(old_part.path,
-                                       new_part.path,
-                                       version,
-                                       std::move(old_file_extents),
-                                       std::move(new_file_extents),
-                                       old_file.deflates,
-                                       new_file.deflates,
-                                       new_file.name,  // operation name
-                                       hard_chunk_blocks,
-                                       blob_file);
+    TEST_AND_RETURN_FALSE(
+        AddFileDeltaProcessors(&file_delta_processors,
+                               old_part.path,
+                               new_part.path,
+                               version,
+                               old_file_extents,
+                               new_file_extents,
+                               old_file.deflates,
+                               new_file.deflates,
+                               new_file.name,  // operation name
+                               hard_chunk_blocks,
+                               content_defined_chunking,
+                               settings,
+                               diff_cache,
+                               processors_memory_budget.get(),
+                               blob_file));
   }
   // Process all the blocks not included in any file. We provided all the unused
   // blocks in the old partition as available data.
@@ -484,35 +1097,60 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
     // We use the soft_chunk_blocks limit for the <non-file-data> as we don't
     // really know the structure of this data and we should not expect it to
     // have redundancy between partitions.
-    file_delta_processors.emplace_back(
-        old_part.path,
-        new_part.path,
-        version,
-        std::move(old_unvisited),
-        std::move(new_unvisited),
-        vector<puffin::BitExtent>{},  // old_deflates,
-        vector<puffin::BitExtent>{},  // new_deflates
-        "<non-file-data>",            // operation name
-        soft_chunk_blocks,
-        blob_file);
+    TEST_AND_RETURN_FALSE(
+        AddFileDeltaProcessors(&file_delta_processors,
+                               old_part.path,
+                               new_part.path,
+                               version,
+                               old_unvisited,
+                               new_unvisited,
+                               vector<puffin::BitExtent>{},  // old_deflates,
+                               vector<puffin::BitExtent>{},  // new_deflates
+                               "<non-file-data>",            // operation name
+                               soft_chunk_blocks,
+                               false,  // content_defined_chunking
+                               settings,
+                               diff_cache,
+                               processors_memory_budget.get(),
+                               blob_file));
   }
 
   size_t max_threads = GetMaxThreads();
 
-  // Sort the files in descending order based on number of new blocks to make
-  // sure we start the largest ones first.
-  if (file_delta_processors.size() > max_threads) {
-    file_delta_processors.sort(std::greater<FileDeltaProcessor>());
-  }
+  // Start the largest files and chunks first. The threads of the pool take
+  // the next processor as soon as they are done with the previous one, so
+  // this leaves the smallest ones to keep all the threads busy until the end.
+  vector<FileDeltaProcessor*> sorted_processors;
+  sorted_processors.reserve(file_delta_processors.size());
+  for (auto& processor : file_delta_processors)
+    sorted_processors.push_back(&processor);
+  std::stable_sort(
+      sorted_processors.begin(),
+      sorted_processors.end(),
+      [](const FileDeltaProcessor* a, const FileDeltaProcessor* b) {
+        return *a > *b;
+      });
 
   base::DelegateSimpleThreadPool thread_pool("incremental-update-generator",
                                              max_threads);
   thread_pool.Start();
-  for (auto& processor : file_delta_processors) {
-    thread_pool.AddWork(&processor);
+  for (size_t i = 0; i < sorted_processors.size(); i++) {
+    // The shards take the processors in turns, so each gets a similar share
+    // of the largest ones.
+    if (settings.num_shards > 0 &&
+        i % settings.num_shards != settings.shard_index) {
+      continue;
+    }
+    thread_pool.AddWork(sorted_processors[i]);
   }
   thread_pool.JoinAll();
 
+  if (settings.num_shards > 0) {
+    // The operations of the other shards are missing, so the diffs of this
+    // one are only left in the diff cache.
+    aops->clear();
+    return true;
+  }
   for (auto& processor : file_delta_processors) {
     TEST_AND_RETURN_FALSE(processor.MergeOperation(aops));
   }
@@ -520,26 +1158,32 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
   return true;
 }
 
-bool DeltaMovedAndZeroBlocks(vector<AnnotatedOperation>* aops,
-                             const string& old_part,
-                             const string& new_part,
-                             size_t old_num_blocks,
-                             size_t new_num_blocks,
-                             ssize_t chunk_blocks,
-                             const PayloadVersion& version,
-                             BlobFileWriter* blob_file,
-                             ExtentRanges* old_visited_blocks,
-                             ExtentRanges* new_visited_blocks,
-                             ExtentRanges* old_zero_blocks) {
+bool DeltaMovedAndZeroBlocks(
+    vector<AnnotatedOperation>* aops,
+    const string& old_part,
+    const string& new_part,
+    size_t old_num_blocks,
+    size_t new_num_blocks,
+    ssize_t chunk_blocks,
+    const PayloadVersion& version,
+    BlobFileWriter* blob_file,
+    ExtentRanges* old_visited_blocks,
+    ExtentRanges* new_visited_blocks,
+    ExtentRanges* old_zero_blocks,
+    vector<BlockMapping::BlockId>* old_block_ids_out,
+    vector<BlockMapping::BlockId>* new_block_ids_out) {
   vector<BlockMapping::BlockId> old_block_ids;
   vector<BlockMapping::BlockId> new_block_ids;
-  TEST_AND_RETURN_FALSE(MapPartitionBlocks(old_part,
-                                           new_part,
-                                           old_num_blocks * kBlockSize,
-                                           new_num_blocks * kBlockSize,
-                                           kBlockSize,
-                                           &old_block_ids,
-                                           &new_block_ids));
+  {
+    ScopedPhaseTimer timer(kPhaseBlockMapping);
+    TEST_AND_RETURN_FALSE(MapPartitionBlocks(old_part,
+                                             new_part,
+                                             old_num_blocks * kBlockSize,
+                                             new_num_blocks * kBlockSize,
+                                             kBlockSize,
+                                             &old_block_ids,
+                                             &new_block_ids));
+  }
 
   // If the update is inplace, we map all the blocks that didn't move,
   // regardless of the contents since they are already copied and no operation
@@ -625,7 +1269,9 @@ bool DeltaMovedAndZeroBlocks(vector<AnnotatedOperation>* aops,
         operation.set_type(InstallOperation::ZERO);
         *(operation.add_dst_extents()) =
             ExtentForRange(extent.start_block() + offset, num_blocks);
-        aops->push_back({.name = "<zeros>", .op = operation});
+        aops->emplace_back();
+        aops->back().name = "<zeros>";
+        aops->back().op.Swap(&operation);
       }
     } else {
       TEST_AND_RETURN_FALSE(DeltaReadFile(aops,
@@ -638,6 +1284,8 @@ bool DeltaMovedAndZeroBlocks(vector<AnnotatedOperation>* aops,
                                           "<zeros>",
                                           chunk_blocks,
                                           version,
+                                          DiffSettings(),
+                                          nullptr,  // diff_cache
                                           blob_file));
     }
   }
@@ -686,6 +1334,10 @@ bool DeltaMovedAndZeroBlocks(vector<AnnotatedOperation>* aops,
   LOG(INFO) << "Produced " << (aops->size() - num_ops) << " operations for "
             << used_blocks << " identical blocks moved";
 
+  if (old_block_ids_out)
+    *old_block_ids_out = std::move(old_block_ids);
+  if (new_block_ids_out)
+    *new_block_ids_out = std::move(new_block_ids);
   return true;
 }
 
@@ -699,6 +1351,8 @@ bool DeltaReadFile(vector<AnnotatedOperation>* aops,
                    const string& name,
                    ssize_t chunk_blocks,
                    const PayloadVersion& version,
+                   const DiffSettings& settings,
+                   DiffCache* diff_cache,
                    BlobFileWriter* blob_file) {
   brillo::Blob data;
   InstallOperation operation;
@@ -727,6 +1381,8 @@ bool DeltaReadFile(vector<AnnotatedOperation>* aops,
                                             old_deflates,
                                             new_deflates,
                                             version,
+                                            settings,
+                                            diff_cache,
                                             &data,
                                             &operation));
 
@@ -748,17 +1404,19 @@ bool DeltaReadFile(vector<AnnotatedOperation>* aops,
       aop.name = base::StringPrintf(
           "%s:%" PRIu64, name.c_str(), block_offset / chunk_blocks);
     }
-    aop.op = operation;
+    // The next chunk overwrites the whole |operation|.
+    aop.op.Swap(&operation);
 
     // Write the data
     TEST_AND_RETURN_FALSE(aop.SetOperationBlob(data, blob_file));
-    aops->emplace_back(aop);
+    aops->push_back(std::move(aop));
   }
   return true;
 }
 
 bool GenerateBestFullOperation(const brillo::Blob& new_data,
                                const PayloadVersion& version,
+                               const ApplyCostModel& apply_cost,
                                brillo::Blob* out_blob,
                                InstallOperation::Type* out_type) {
   if (new_data.empty())
@@ -776,23 +1434,70 @@ bool GenerateBestFullOperation(const brillo::Blob& new_data,
 
   bool out_blob_set = false;
 
+  // Returns the estimated time to download and apply an operation of |type|
+  // with a |blob_size| bytes blob on the devices of the cost model.
+  auto apply_cost_of = [&](InstallOperation::Type type, size_t blob_size) {
+    return EstimateApplyCost(apply_cost, type, blob_size, 0, new_data.size());
+  };
+  // Returns whether a |blob| of |type| is better than the current one:
+  // faster to download and apply on the devices of the cost model or, without
+  // one, smaller.
+  auto is_better = [&](InstallOperation::Type type, const brillo::Blob& blob) {
+    if (blob.empty())
+      return false;
+    if (!out_blob_set)
+      return true;
+    if (apply_cost.enabled()) {
+      return apply_cost_of(type, blob.size()) <
+             apply_cost_of(*out_type, out_blob->size());
+    }
+    return blob.size() < out_blob->size();
+  };
+
   // Try compressing |new_data| with xz first.
   if (version.OperationAllowed(InstallOperation::REPLACE_XZ)) {
     brillo::Blob new_data_xz;
-    if (XzCompress(new_data, &new_data_xz) && !new_data_xz.empty()) {
+    if (XzCompress(new_data, &new_data_xz) &&
+        is_better(InstallOperation::REPLACE_XZ, new_data_xz)) {
       *out_type = InstallOperation::REPLACE_XZ;
       *out_blob = std::move(new_data_xz);
       out_blob_set = true;
     }
   }
 
+  // Try compressing it with zstd, which is decompressed several times faster
+  // than xz.
+  if (version.OperationAllowed(InstallOperation::REPLACE_ZSTD)) {
+    brillo::Blob new_data_zstd;
+    if (ZstdCompress(new_data, &new_data_zstd) &&
+        is_better(InstallOperation::REPLACE_ZSTD, new_data_zstd)) {
+      *out_type = InstallOperation::REPLACE_ZSTD;
+      *out_blob = std::move(new_data_zstd);
+      out_blob_set = true;
+    }
+  }
+
+  // LZ4 is decompressed at close to the speed of a copy but compresses worse
+  // than all the others, so it is only tried when the devices of the cost
+  // model are slower to decompress the data than to download it.
+  if (version.OperationAllowed(InstallOperation::REPLACE_LZ4) &&
+      apply_cost.enabled() && apply_cost.replace_lz4_speed > 0) {
+    brillo::Blob new_data_lz4;
+    if (Lz4Compress(new_data, &new_data_lz4) &&
+        is_better(InstallOperation::REPLACE_LZ4, new_data_lz4)) {
+      *out_type = InstallOperation::REPLACE_LZ4;
+      *out_blob = std::move(new_data_lz4);
+      out_blob_set = true;
+    }
+  }
+
   // Try compressing it with bzip2.
   if (version.OperationAllowed(InstallOperation::REPLACE_BZ)) {
     brillo::Blob new_data_bz;
     // TODO(deymo): Implement some heuristic to determine if it is worth trying
     // to compress the blob with bzip2 if we already have a good REPLACE_XZ.
-    if (BzipCompress(new_data, &new_data_bz) && !new_data_bz.empty() &&
-        (!out_blob_set || out_blob->size() > new_data_bz.size())) {
+    if (BzipCompress(new_data, &new_data_bz) &&
+        is_better(InstallOperation::REPLACE_BZ, new_data_bz)) {
       // A REPLACE_BZ is better or nothing else was set.
       *out_type = InstallOperation::REPLACE_BZ;
       *out_blob = std::move(new_data_bz);
@@ -801,7 +1506,11 @@ bool GenerateBestFullOperation(const brillo::Blob& new_data,
   }
 
   // If nothing else worked or it was badly compressed we try a REPLACE.
-  if (!out_blob_set || out_blob->size() >= new_data.size()) {
+  if (!out_blob_set ||
+      (apply_cost.enabled()
+           ? apply_cost_of(InstallOperation::REPLACE, new_data.size()) <=
+                 apply_cost_of(*out_type, out_blob->size())
+           : out_blob->size() >= new_data.size())) {
     *out_type = InstallOperation::REPLACE;
     // This needs to make a copy of the data in the case bzip or xz didn't
     // compress well, which is not the common case so the performance hit is
@@ -818,6 +1527,8 @@ bool ReadExtentsToDiff(const string& old_part,
                        const vector<puffin::BitExtent>& old_deflates,
                        const vector<puffin::BitExtent>& new_deflates,
                        const PayloadVersion& version,
+                       const DiffSettings& settings,
+                       DiffCache* diff_cache,
                        brillo::Blob* out_data,
                        InstallOperation* out_op) {
   InstallOperation operation;
@@ -831,7 +1542,7 @@ bool ReadExtentsToDiff(const string& old_part,
       version.OperationAllowed(InstallOperation::SOURCE_BSDIFF) ||
       version.OperationAllowed(InstallOperation::BSDIFF);
   if (bsdiff_allowed &&
-      blocks_to_read * kBlockSize > kMaxBsdiffDestinationSize) {
+      blocks_to_read * kBlockSize > settings.max_bsdiff_size) {
     LOG(INFO) << "bsdiff blacklisted, data too big: "
               << blocks_to_read * kBlockSize << " bytes";
     bsdiff_allowed = false;
@@ -839,7 +1550,7 @@ bool ReadExtentsToDiff(const string& old_part,
 
   bool puffdiff_allowed = version.OperationAllowed(InstallOperation::PUFFDIFF);
   if (puffdiff_allowed &&
-      blocks_to_read * kBlockSize > kMaxPuffdiffDestinationSize) {
+      blocks_to_read * kBlockSize > settings.max_puffdiff_size) {
     LOG(INFO) << "puffdiff blacklisted, data too big: "
               << blocks_to_read * kBlockSize << " bytes";
     puffdiff_allowed = false;
@@ -851,13 +1562,50 @@ bool ReadExtentsToDiff(const string& old_part,
 
   // Read in bytes from new data.
   brillo::Blob new_data;
-  TEST_AND_RETURN_FALSE(utils::ReadExtents(new_part,
-                                           new_extents,
-                                           &new_data,
-                                           kBlockSize * blocks_to_write,
-                                           kBlockSize));
+  TEST_AND_RETURN_FALSE(ReadImageExtents(new_part,
+                                        new_extents,
+                                        &new_data,
+                                        kBlockSize * blocks_to_write,
+                                        kBlockSize));
   TEST_AND_RETURN_FALSE(!new_data.empty());
 
+  const uint64_t old_size = kBlockSize * blocks_to_read;
+  brillo::Blob old_data;
+  bool data_equals = false;
+  if (blocks_to_read > 0) {
+    if (bsdiff_allowed || puffdiff_allowed) {
+      // Read old data.
+      TEST_AND_RETURN_FALSE(ReadImageExtents(
+          old_part, src_extents, &old_data, old_size, kBlockSize));
+      data_equals = old_data == new_data;
+    } else {
+      // The old data is only compared with the new data, so it isn't read.
+      // This keeps the data too big to be diffed out of the heap.
+      TEST_AND_RETURN_FALSE(
+          CompareExtentsData(old_part, src_extents, new_data, &data_equals));
+    }
+  }
+
+  InstallOperation::Type bsdiff_type = InstallOperation::BSDIFF;
+  if (version.OperationAllowed(InstallOperation::BROTLI_BSDIFF))
+    bsdiff_type = InstallOperation::BROTLI_BSDIFF;
+  else if (version.OperationAllowed(InstallOperation::SOURCE_BSDIFF))
+    bsdiff_type = InstallOperation::SOURCE_BSDIFF;
+
+  // Sorting the suffixes of the old data takes most of the time of bsdiff, in
+  // a single thread. For big data they are sorted in their own thread while
+  // the full operation is compressed in this one, unless the patch is cached.
+  string bsdiff_cache_key;
+  std::unique_ptr<SuffixArrayThread> suffix_array_thread;
+  if (bsdiff_allowed && !data_equals && old_size >= kMinSuffixArrayThreadSize) {
+    if (diff_cache) {
+      bsdiff_cache_key = GetBsdiffCacheKey(
+          bsdiff_type, version, settings, old_data, new_data);
+    }
+    if (!diff_cache || !diff_cache->Contains(bsdiff_cache_key))
+      suffix_array_thread = std::make_unique<SuffixArrayThread>(old_data);
+  }
+
   // Data blob that will be written to delta file.
   brillo::Blob data_blob;
 
@@ -865,18 +1613,12 @@ bool ReadExtentsToDiff(const string& old_part,
   // old_data.
   InstallOperation::Type op_type;
   TEST_AND_RETURN_FALSE(
-      GenerateBestFullOperation(new_data, version, &data_blob, &op_type));
+      GenerateBestFullOperation(
+          new_data, version, settings.apply_cost, &data_blob, &op_type));
   operation.set_type(op_type);
 
-  brillo::Blob old_data;
   if (blocks_to_read > 0) {
-    // Read old data.
-    TEST_AND_RETURN_FALSE(utils::ReadExtents(old_part,
-                                             src_extents,
-                                             &old_data,
-                                             kBlockSize * blocks_to_read,
-                                             kBlockSize));
-    if (old_data == new_data) {
+    if (data_equals) {
       // No change in data.
       operation.set_type(version.OperationAllowed(InstallOperation::SOURCE_COPY)
                              ? InstallOperation::SOURCE_COPY
@@ -886,53 +1628,56 @@ bool ReadExtentsToDiff(const string& old_part,
                    operation, data_blob.size(), 0, src_extents.size())) {
       // No point in trying diff if zero blob size diff operation is
       // still worse than replace.
-      if (bsdiff_allowed) {
-        base::FilePath patch;
-        TEST_AND_RETURN_FALSE(base::CreateTemporaryFile(&patch));
-        ScopedPathUnlinker unlinker(patch.value());
-
-        std::unique_ptr<bsdiff::PatchWriterInterface> bsdiff_patch_writer;
-        InstallOperation::Type operation_type = InstallOperation::BSDIFF;
-        if (version.OperationAllowed(InstallOperation::BROTLI_BSDIFF)) {
-          bsdiff_patch_writer =
-              bsdiff::CreateBSDF2PatchWriter(patch.value(),
-                                             bsdiff::CompressorType::kBrotli,
-                                             kBrotliCompressionQuality);
-          operation_type = InstallOperation::BROTLI_BSDIFF;
-        } else {
-          bsdiff_patch_writer = bsdiff::CreateBsdiffPatchWriter(patch.value());
-          if (version.OperationAllowed(InstallOperation::SOURCE_BSDIFF)) {
-            operation_type = InstallOperation::SOURCE_BSDIFF;
-          }
-        }
-
-        brillo::Blob bsdiff_delta;
-        TEST_AND_RETURN_FALSE(0 == bsdiff::bsdiff(old_data.data(),
-                                                  old_data.size(),
-                                                  new_data.data(),
-                                                  new_data.size(),
-                                                  bsdiff_patch_writer.get(),
-                                                  nullptr));
 
-        TEST_AND_RETURN_FALSE(utils::ReadFile(patch.value(), &bsdiff_delta));
-        CHECK_GT(bsdiff_delta.size(), static_cast<brillo::Blob::size_type>(0));
-        if (IsDiffOperationBetter(operation,
-                                  data_blob.size(),
-                                  bsdiff_delta.size(),
-                                  src_extents.size())) {
-          operation.set_type(operation_type);
-          data_blob = std::move(bsdiff_delta);
-        }
+      // Returns whether a diff of |diff_type| with a |diff_size| bytes blob is
+      // better than the current operation: smaller and, for the devices of
+      // the cost model, faster to download and apply.
+      auto is_diff_better = [&](InstallOperation::Type diff_type,
+                                size_t diff_size) {
+        if (!IsDiffOperationBetter(
+                operation, data_blob.size(), diff_size, src_extents.size()))
+          return false;
+        if (!settings.apply_cost.enabled())
+          return true;
+        return EstimateApplyCost(settings.apply_cost,
+                                 diff_type,
+                                 diff_size,
+                                 old_size,
+                                 new_data.size()) <
+               EstimateApplyCost(settings.apply_cost,
+                                 operation.type(),
+                                 data_blob.size(),
+                                 old_size,
+                                 new_data.size());
+      };
+      // Don't compute the diffs that are too expensive to apply even if
+      // empty.
+      // With a cost model, bsdiff also stores its patch as a ZSTD_BSDIFF one,
+      // quicker to apply on the devices with a slow CPU.
+      bool zstd_bsdiff_allowed =
+          bsdiff_allowed && settings.apply_cost.enabled() &&
+          settings.apply_cost.zstd_bsdiff_speed > 0 &&
+          version.OperationAllowed(InstallOperation::ZSTD_BSDIFF) &&
+          is_diff_better(InstallOperation::ZSTD_BSDIFF, 0);
+      if (bsdiff_allowed && !zstd_bsdiff_allowed &&
+          !is_diff_better(bsdiff_type, 0)) {
+        LOG(INFO) << "bsdiff skipped, too expensive to apply";
+        bsdiff_allowed = false;
       }
+      if (puffdiff_allowed && !is_diff_better(InstallOperation::PUFFDIFF, 0)) {
+        LOG(INFO) << "puffdiff skipped, too expensive to apply";
+        puffdiff_allowed = false;
+      }
+
+      vector<puffin::BitExtent> src_deflates;
+      vector<puffin::BitExtent> dst_deflates;
       if (puffdiff_allowed) {
         // Find all deflate positions inside the given extents and then put all
         // deflates together because we have already read all the extents into
         // one buffer.
-        vector<puffin::BitExtent> src_deflates;
         TEST_AND_RETURN_FALSE(deflate_utils::FindAndCompactDeflates(
             src_extents, old_deflates, &src_deflates));
 
-        vector<puffin::BitExtent> dst_deflates;
         TEST_AND_RETURN_FALSE(deflate_utils::FindAndCompactDeflates(
             dst_extents, new_deflates, &dst_deflates));
 
@@ -949,28 +1694,73 @@ bool ReadExtentsToDiff(const string& old_part,
         }
 
         // Only Puffdiff if both files have at least one deflate left.
-        if (!src_deflates.empty() && !dst_deflates.empty()) {
-          brillo::Blob puffdiff_delta;
-          string temp_file_path;
-          TEST_AND_RETURN_FALSE(utils::MakeTempFile(
-              "puffdiff-delta.XXXXXX", &temp_file_path, nullptr));
-          ScopedPathUnlinker temp_file_unlinker(temp_file_path);
-
-          // Perform PuffDiff operation.
-          TEST_AND_RETURN_FALSE(puffin::PuffDiff(old_data,
-                                                 new_data,
-                                                 src_deflates,
-                                                 dst_deflates,
-                                                 temp_file_path,
-                                                 &puffdiff_delta));
-          TEST_AND_RETURN_FALSE(puffdiff_delta.size() > 0);
-          if (IsDiffOperationBetter(operation,
-                                    data_blob.size(),
-                                    puffdiff_delta.size(),
-                                    src_extents.size())) {
-            operation.set_type(InstallOperation::PUFFDIFF);
-            data_blob = std::move(puffdiff_delta);
-          }
+        puffdiff_allowed = !src_deflates.empty() && !dst_deflates.empty();
+      }
+
+      // Each diff can take minutes on big files, so puffdiff runs in its own
+      // thread while bsdiff runs in this one.
+      brillo::Blob puffdiff_delta;
+      bool puffdiff_success = true;
+      FunctionDelegate puffdiff_delegate([&] {
+        puffdiff_success = PuffdiffData(version,
+                                        old_data,
+                                        new_data,
+                                        src_deflates,
+                                        dst_deflates,
+                                        diff_cache,
+                                        &puffdiff_delta);
+      });
+      std::unique_ptr<base::DelegateSimpleThread> puffdiff_thread;
+      if (puffdiff_allowed && bsdiff_allowed) {
+        puffdiff_thread.reset(
+            new base::DelegateSimpleThread(&puffdiff_delegate, "puffdiff"));
+        puffdiff_thread->Start();
+      }
+
+      brillo::Blob bsdiff_delta;
+      brillo::Blob zstd_bsdiff_delta;
+      bool bsdiff_success = true;
+      if (bsdiff_allowed) {
+        bsdiff_success =
+            BsdiffData(bsdiff_type,
+                       version,
+                       old_data,
+                       new_data,
+                       settings,
+                       diff_cache,
+                       bsdiff_cache_key,
+                       suffix_array_thread.get(),
+                       &bsdiff_delta,
+                       zstd_bsdiff_allowed ? &zstd_bsdiff_delta : nullptr);
+      }
+
+      if (puffdiff_thread)
+        puffdiff_thread->Join();
+      else if (puffdiff_allowed)
+        puffdiff_delegate.Run();
+      TEST_AND_RETURN_FALSE(bsdiff_success);
+      TEST_AND_RETURN_FALSE(puffdiff_success);
+
+      // Pick the smallest diff in the same order they used to be generated,
+      // so the payload doesn't depend on which diff finished first.
+      if (bsdiff_allowed) {
+        CHECK_GT(bsdiff_delta.size(), static_cast<brillo::Blob::size_type>(0));
+        if (is_diff_better(bsdiff_type, bsdiff_delta.size())) {
+          operation.set_type(bsdiff_type);
+          data_blob = std::move(bsdiff_delta);
+        }
+      }
+      if (zstd_bsdiff_allowed &&
+          is_diff_better(InstallOperation::ZSTD_BSDIFF,
+                         zstd_bsdiff_delta.size())) {
+        operation.set_type(InstallOperation::ZSTD_BSDIFF);
+        data_blob = std::move(zstd_bsdiff_delta);
+      }
+      if (puffdiff_allowed) {
+        TEST_AND_RETURN_FALSE(puffdiff_delta.size() > 0);
+        if (is_diff_better(InstallOperation::PUFFDIFF, puffdiff_delta.size())) {
+          operation.set_type(InstallOperation::PUFFDIFF);
+          data_blob = std::move(puffdiff_delta);
         }
       }
     }
@@ -980,7 +1770,7 @@ bool ReadExtentsToDiff(const string& old_part,
   if (operation.type() == InstallOperation::MOVE) {
     auto removed_bytes =
         RemoveIdenticalBlockRanges(&src_extents, &dst_extents, new_data.size());
-    operation.set_src_length(old_data.size() - removed_bytes);
+    operation.set_src_length(old_size - removed_bytes);
     operation.set_dst_length(new_data.size() - removed_bytes);
   }
 
@@ -993,10 +1783,15 @@ bool ReadExtentsToDiff(const string& old_part,
   if (operation.type() == InstallOperation::BSDIFF ||
       (operation.type() == InstallOperation::SOURCE_BSDIFF &&
        version.minor <= kOpSrcHashMinorPayloadVersion)) {
-    operation.set_src_length(old_data.size());
+    operation.set_src_length(old_size);
     operation.set_dst_length(new_data.size());
   }
 
+  uint64_t apply_memory_size =
+      EstimateApplyMemory(operation.type(), old_size, new_data.size());
+  if (apply_memory_size > 0)
+    operation.set_apply_memory_size(apply_memory_size);
+
   // Embed extents in the operation. Replace (all variants), zero and discard
   // operations should not have source extents.
   if (!IsNoSourceOperation(operation.type())) {
@@ -1006,14 +1801,16 @@ bool ReadExtentsToDiff(const string& old_part,
   StoreExtents(dst_extents, operation.mutable_dst_extents());
 
   *out_data = std::move(data_blob);
-  *out_op = operation;
+  out_op->Swap(&operation);
   return true;
 }
 
 bool IsAReplaceOperation(InstallOperation::Type op_type) {
   return (op_type == InstallOperation::REPLACE ||
           op_type == InstallOperation::REPLACE_BZ ||
-          op_type == InstallOperation::REPLACE_XZ);
+          op_type == InstallOperation::REPLACE_XZ ||
+          op_type == InstallOperation::REPLACE_ZSTD ||
+          op_type == InstallOperation::REPLACE_LZ4);
 }
 
 bool IsNoSourceOperation(InstallOperation::Type op_type) {
@@ -1050,8 +1847,8 @@ bool InitializePartitionInfo(const PartitionConfig& part, PartitionInfo* info) {
   return true;
 }
 
-bool CompareAopsByDestination(AnnotatedOperation first_aop,
-                              AnnotatedOperation second_aop) {
+bool CompareAopsByDestination(const AnnotatedOperation& first_aop,
+                              const AnnotatedOperation& second_aop) {
   // We want empty operations to be at the end of the payload.
   if (!first_aop.op.dst_extents().size() || !second_aop.op.dst_extents().size())
     return ((!first_aop.op.dst_extents().size()) <
@@ -1099,6 +1896,128 @@ bool IsExtFilesystem(const string& device) {
   return true;
 }
 
+DiffSettings GetDiffSettings(GenerationProfile profile) {
+  DiffSettings settings;
+  switch (profile) {
+    case GenerationProfile::kFast:
+      // Puffdiff is the slowest diff, and brotli's top qualities take most of
+      // the time of bsdiff on big files.
+      settings.brotli_quality = 5;
+      settings.max_bsdiff_size = 32 * 1024 * 1024;
+      settings.max_puffdiff_size = 0;
+      break;
+    case GenerationProfile::kBalanced:
+      settings.brotli_quality = 9;
+      settings.max_puffdiff_size = 32 * 1024 * 1024;
+      break;
+    case GenerationProfile::kMax:
+      break;
+  }
+  return settings;
+}
+
+ApplyCostModel GetApplyCostModel(TargetDeviceClass device_class) {
+  ApplyCostModel model;
+  switch (device_class) {
+    case TargetDeviceClass::kAny:
+      break;
+    case TargetDeviceClass::kMidRange:
+      model.download_speed = 5 * 1024 * 1024;
+      model.read_speed = 100 * 1024 * 1024;
+      model.replace_bz_speed = 20 * 1024 * 1024;
+      model.replace_xz_speed = 40 * 1024 * 1024;
+      model.replace_zstd_speed = 200 * 1024 * 1024;
+      model.replace_lz4_speed = 800 * 1024 * 1024;
+      model.bsdiff_speed = 20 * 1024 * 1024;
+      model.zstd_bsdiff_speed = 40 * 1024 * 1024;
+      model.puffdiff_speed = 5 * 1024 * 1024;
+      model.max_memory = 512 * 1024 * 1024;
+      break;
+    case TargetDeviceClass::kLowEnd:
+      // Slow eMMC and CPU, where inflating and deflating the data around a
+      // puffdiff patch takes longer than downloading it on most connections.
+      model.download_speed = 2 * 1024 * 1024;
+      model.read_speed = 25 * 1024 * 1024;
+      model.replace_bz_speed = 5 * 1024 * 1024;
+      model.replace_xz_speed = 10 * 1024 * 1024;
+      model.replace_zstd_speed = 50 * 1024 * 1024;
+      model.replace_lz4_speed = 200 * 1024 * 1024;
+      model.bsdiff_speed = 5 * 1024 * 1024;
+      model.zstd_bsdiff_speed = 10 * 1024 * 1024;
+      model.puffdiff_speed = 1024 * 1024;
+      model.max_memory = 64 * 1024 * 1024;
+      break;
+  }
+  return model;
+}
+
+uint64_t EstimateApplyMemory(InstallOperation::Type type,
+                             uint64_t src_size,
+                             uint64_t dst_size) {
+  // The patches are applied with the source data, and for puffdiff the
+  // inflated source and target streams, held in memory. The ZSTD_BSDIFF
+  // patches are applied as they are decompressed.
+  switch (type) {
+    case InstallOperation::BSDIFF:
+    case InstallOperation::SOURCE_BSDIFF:
+    case InstallOperation::BROTLI_BSDIFF:
+      return src_size;
+    case InstallOperation::PUFFDIFF:
+      return src_size + 2 * (src_size + dst_size);
+    default:
+      return 0;
+  }
+}
+
+double EstimateApplyCost(const ApplyCostModel& model,
+                         InstallOperation::Type type,
+                         uint64_t blob_size,
+                         uint64_t src_size,
+                         uint64_t dst_size) {
+  if (model.max_memory > 0 &&
+      EstimateApplyMemory(type, src_size, dst_size) > model.max_memory) {
+    return std::numeric_limits<double>::infinity();
+  }
+
+  double apply_speed = 0;
+  switch (type) {
+    case InstallOperation::REPLACE_BZ:
+      apply_speed = model.replace_bz_speed;
+      break;
+    case InstallOperation::REPLACE_XZ:
+      apply_speed = model.replace_xz_speed;
+      break;
+    case InstallOperation::REPLACE_ZSTD:
+      apply_speed = model.replace_zstd_speed;
+      break;
+    case InstallOperation::REPLACE_LZ4:
+      apply_speed = model.replace_lz4_speed;
+      break;
+    case InstallOperation::BSDIFF:
+    case InstallOperation::SOURCE_BSDIFF:
+    case InstallOperation::BROTLI_BSDIFF:
+      apply_speed = model.bsdiff_speed;
+      break;
+    case InstallOperation::ZSTD_BSDIFF:
+      apply_speed = model.zstd_bsdiff_speed;
+      break;
+    case InstallOperation::PUFFDIFF:
+      apply_speed = model.puffdiff_speed;
+      break;
+    default:
+      break;
+  }
+
+  double cost = 0;
+  if (model.download_speed > 0)
+    cost += blob_size / model.download_speed;
+  if (!IsNoSourceOperation(type) && model.read_speed > 0)
+    cost += src_size / model.read_speed;
+  if (apply_speed > 0)
+    cost += dst_size / apply_speed;
+  return cost;
+}
+
 // Return the number of CPUs on the machine, and 4 threads in minimum.
 size_t GetMaxThreads() {
   return std::max(sysconf(_SC_NPROCESSORS_ONLN), 4L);
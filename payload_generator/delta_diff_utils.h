@@ -25,7 +25,10 @@
 #include <puffin/puffdiff.h>
 
 #include "update_engine/payload_generator/annotated_operation.h"
+#include "update_engine/payload_generator/block_mapping.h"
+#include "update_engine/payload_generator/diff_cache.h"
 #include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/file_similarity_index.h"
 #include "update_engine/payload_generator/payload_generation_config.h"
 #include "update_engine/update_metadata.pb.h"
 
@@ -33,6 +36,90 @@ namespace chromeos_update_engine {
 
 namespace diff_utils {
 
+// The estimated speeds of a class of devices applying the operations, used to
+// pick the operation of each extent by the time it takes to download and apply
+// rather than by its size alone. A diff only replaces a REPLACE operation if
+// the download time it saves is worth the time spent reading the source data
+// and patching it. The default values disable the model.
+struct ApplyCostModel {
+  // Returns whether the operations are picked by their cost.
+  bool enabled() const { return download_speed > 0; }
+
+  // The speed, in bytes per second, the payload is downloaded at.
+  double download_speed = 0;
+
+  // The speed, in bytes per second, the source data of the operations is
+  // read at.
+  double read_speed = 0;
+
+  // The speeds, in bytes of new data per second, of decompressing a
+  // REPLACE_BZ, REPLACE_XZ, REPLACE_ZSTD and REPLACE_LZ4 operation and of
+  // applying a bsdiff, a ZSTD_BSDIFF and a puffdiff patch. A value of 0 means
+  // the time is negligible, except for ZSTD_BSDIFF, which is then never
+  // generated.
+  double replace_bz_speed = 0;
+  double replace_xz_speed = 0;
+  double replace_zstd_speed = 0;
+  double replace_lz4_speed = 0;
+  double bsdiff_speed = 0;
+  double zstd_bsdiff_speed = 0;
+  double puffdiff_speed = 0;
+
+  // The maximum memory, in bytes, an operation may use to be applied. The
+  // operations estimated to use more are never picked. A value of 0 means no
+  // limit.
+  uint64_t max_memory = 0;
+};
+
+// Returns the cost model of the devices of |device_class|.
+ApplyCostModel GetApplyCostModel(TargetDeviceClass device_class);
+
+// Returns the estimated peak memory, in bytes, used to apply an operation of
+// |type| reading |src_size| bytes and writing |dst_size| bytes, not counting
+// its data blob. Returns 0 for the operations that use a fixed amount of
+// memory.
+uint64_t EstimateApplyMemory(InstallOperation::Type type,
+                             uint64_t src_size,
+                             uint64_t dst_size);
+
+// Returns the estimated time, in seconds, to download and apply an operation
+// of |type| with a |blob_size| bytes blob, reading |src_size| bytes and
+// writing |dst_size| bytes, on the devices of the |model|. Returns infinity if
+// the operation uses more memory than the devices allow.
+double EstimateApplyCost(const ApplyCostModel& model,
+                         InstallOperation::Type type,
+                         uint64_t blob_size,
+                         uint64_t src_size,
+                         uint64_t dst_size);
+
+// The settings of the diffs trading their size for the time to compute them.
+// The default values generate the smallest diffs.
+struct DiffSettings {
+  // The quality of the brotli compression of the BROTLI_BSDIFF patches.
+  int brotli_quality = 11;
+
+  // The maximum size, in bytes, of the old data diffed with bsdiff and with
+  // puffdiff. A value of 0 disables the diff. Both diffs work for arbitrary
+  // big data, but need a significant amount of RAM to generate and apply, so
+  // the default limits don't affect any released board but do limit the
+  // Chrome binary in ASan builders.
+  uint64_t max_bsdiff_size = 200 * 1024 * 1024;
+  uint64_t max_puffdiff_size = 150 * 1024 * 1024;
+
+  // The cost of applying the operations on the target devices.
+  ApplyCostModel apply_cost;
+
+  // The number of processes sharing the diffs of a partition through the
+  // on-disk diff cache, and the one this process is. Each process only diffs
+  // its shard of the files, and no operations are produced. A value of 0 for
+  // |num_shards| diffs all the files and produces their operations.
+  uint32_t num_shards = 0;
+  uint32_t shard_index = 0;
+};
+
+// Returns the settings of the diffs generated with the |profile|.
+DiffSettings GetDiffSettings(GenerationProfile profile);
+
 // Create operations in |aops| to produce all the blocks in the |new_part|
 // partition using the filesystem opened in that PartitionConfig.
 // It uses the files reported by the filesystem in |old_part| and the data
@@ -42,13 +129,22 @@ namespace diff_utils {
 // and soft chunk limits in number of blocks respectively. The soft chunk limit
 // is used to split MOVE and SOURCE_COPY operations and REPLACE_BZ of zeroed
 // blocks, while the hard limit is used to split a file when generating other
-// operations. A value of -1 in |hard_chunk_blocks| means whole files.
+// operations. A value of -1 in |hard_chunk_blocks| means whole files. If
+// |content_defined_chunking| is true, the files too big to be diffed at once
+// are split in content-defined chunks instead. The files are processed in
+// parallel while their estimated memory usage fits in |memory_budget| bytes,
+// or without limit if it is 0. The diffs are computed with the |settings|, and
+// are looked up in and stored to the |diff_cache|, if not null.
 bool DeltaReadPartition(std::vector<AnnotatedOperation>* aops,
                         const PartitionConfig& old_part,
                         const PartitionConfig& new_part,
                         ssize_t hard_chunk_blocks,
                         size_t soft_chunk_blocks,
+                        bool content_defined_chunking,
+                        uint64_t memory_budget,
                         const PayloadVersion& version,
+                        const DiffSettings& settings,
+                        DiffCache* diff_cache,
                         BlobFileWriter* blob_file);
 
 // Create operations in |aops| for identical blocks that moved around in the old
@@ -60,18 +156,22 @@ bool DeltaReadPartition(std::vector<AnnotatedOperation>* aops,
 // The collections |old_visited_blocks| and |new_visited_blocks| state what
 // blocks already have operations reading or writing them and only operations
 // for unvisited blocks are produced by this function updating both collections
-// with the used blocks.
-bool DeltaMovedAndZeroBlocks(std::vector<AnnotatedOperation>* aops,
-                             const std::string& old_part,
-                             const std::string& new_part,
-                             size_t old_num_blocks,
-                             size_t new_num_blocks,
-                             ssize_t chunk_blocks,
-                             const PayloadVersion& version,
-                             BlobFileWriter* blob_file,
-                             ExtentRanges* old_visited_blocks,
-                             ExtentRanges* new_visited_blocks,
-                             ExtentRanges* old_zero_blocks);
+// with the used blocks. If not null, the block ids of the blocks of both
+// partitions are stored in |old_block_ids| and |new_block_ids|.
+bool DeltaMovedAndZeroBlocks(
+    std::vector<AnnotatedOperation>* aops,
+    const std::string& old_part,
+    const std::string& new_part,
+    size_t old_num_blocks,
+    size_t new_num_blocks,
+    ssize_t chunk_blocks,
+    const PayloadVersion& version,
+    BlobFileWriter* blob_file,
+    ExtentRanges* old_visited_blocks,
+    ExtentRanges* new_visited_blocks,
+    ExtentRanges* old_zero_blocks,
+    std::vector<BlockMapping::BlockId>* old_block_ids = nullptr,
+    std::vector<BlockMapping::BlockId>* new_block_ids = nullptr);
 
 // For a given file |name| append operations to |aops| to produce it in the
 // |new_part|. The file will be split in chunks of |chunk_blocks| blocks each
@@ -80,7 +180,9 @@ bool DeltaMovedAndZeroBlocks(std::vector<AnnotatedOperation>* aops,
 // exists, the old version exists in |old_part| in the blocks described by
 // |old_extents|. The operations added to |aops| reference the data blob
 // in the |blob_file|. |old_deflates| and |new_deflates| are all deflate
-// locations in |old_part| and |new_part|. Returns true on success.
+// locations in |old_part| and |new_part|. The diffs are computed with the
+// |settings|, and are looked up in and stored to the |diff_cache|, if not null.
+// Returns true on success.
 bool DeltaReadFile(std::vector<AnnotatedOperation>* aops,
                    const std::string& old_part,
                    const std::string& new_part,
@@ -91,8 +193,28 @@ bool DeltaReadFile(std::vector<AnnotatedOperation>* aops,
                    const std::string& name,
                    ssize_t chunk_blocks,
                    const PayloadVersion& version,
+                   const DiffSettings& settings,
+                   DiffCache* diff_cache,
                    BlobFileWriter* blob_file);
 
+// Splits the blocks in |old_extents| of |old_part| and |new_extents| of
+// |new_part| in content-defined chunks, so the chunks of both files start and
+// end on the same data. The new chunks are between |min_chunk_blocks| and
+// |max_chunk_blocks| long, and are cut on average |average_chunk_blocks|
+// after the minimum size. Each chunk of |new_chunks| is paired with the chunk
+// of |old_chunks| at the same index, which is at most |max_old_chunk_blocks|
+// long. Old chunks may be empty.
+bool SplitContentDefinedChunks(const std::string& old_part,
+                               const std::string& new_part,
+                               const std::vector<Extent>& old_extents,
+                               const std::vector<Extent>& new_extents,
+                               uint64_t min_chunk_blocks,
+                               uint64_t average_chunk_blocks,
+                               uint64_t max_chunk_blocks,
+                               uint64_t max_old_chunk_blocks,
+                               std::vector<std::vector<Extent>>* old_chunks,
+                               std::vector<std::vector<Extent>>* new_chunks);
+
 // Reads the blocks |old_extents| from |old_part| (if it exists) and the
 // |new_extents| from |new_part| and determines the smallest way to encode
 // this |new_extents| for the diff. It stores necessary data in |out_data| and
@@ -101,7 +223,9 @@ bool DeltaReadFile(std::vector<AnnotatedOperation>* aops,
 // operations allowed in the given |version| (REPLACE, REPLACE_BZ, BSDIFF,
 // SOURCE_BSDIFF, or PUFFDIFF) wins.
 // |new_extents| must not be empty. |old_deflates| and |new_deflates| are all
-// the deflate locations in |old_part| and |new_part|. Returns true on success.
+// the deflate locations in |old_part| and |new_part|. The diffs are computed
+// with the |settings|, and are looked up in and stored to the |diff_cache|, if
+// not null. Returns true on success.
 bool ReadExtentsToDiff(const std::string& old_part,
                        const std::string& new_part,
                        const std::vector<Extent>& old_extents,
@@ -109,15 +233,20 @@ bool ReadExtentsToDiff(const std::string& old_part,
                        const std::vector<puffin::BitExtent>& old_deflates,
                        const std::vector<puffin::BitExtent>& new_deflates,
                        const PayloadVersion& version,
+                       const DiffSettings& settings,
+                       DiffCache* diff_cache,
                        brillo::Blob* out_data,
                        InstallOperation* out_op);
 
 // Generates the best allowed full operation to produce |new_data|. The allowed
-// operations are based on |payload_version|. The operation blob will be stored
-// in |out_blob| and the resulting operation type in |out_type|. Returns whether
-// a valid full operation was generated.
+// operations are based on |payload_version|. The best operation is the one
+// the |apply_cost| model estimates to be the fastest to download and apply, or
+// the smallest one if the model isn't enabled. The operation blob will be
+// stored in |out_blob| and the resulting operation type in |out_type|. Returns
+// whether a valid full operation was generated.
 bool GenerateBestFullOperation(const brillo::Blob& new_data,
                                const PayloadVersion& version,
+                               const ApplyCostModel& apply_cost,
                                brillo::Blob* out_blob,
                                InstallOperation::Type* out_type);
 
@@ -140,8 +269,8 @@ bool InitializePartitionInfo(const PartitionConfig& partition,
 
 // Compare two AnnotatedOperations by the start block of the first Extent in
 // their destination extents.
-bool CompareAopsByDestination(AnnotatedOperation first_aop,
-                              AnnotatedOperation second_aop);
+bool CompareAopsByDestination(const AnnotatedOperation& first_aop,
+                              const AnnotatedOperation& second_aop);
 
 // Returns whether the filesystem is an ext[234] filesystem. In case of failure,
 // such as if the file |device| doesn't exists or can't be read, it returns
@@ -157,6 +286,16 @@ FilesystemInterface::File GetOldFile(
     const std::map<std::string, FilesystemInterface::File>& old_files_map,
     const std::string& new_file_name);
 
+// Returns the old file with the same name as |new_file| if any, or else the
+// one with the most blocks in common with it according to |old_files_index|,
+// if similar enough, or else the one with the most similar name. The block ids
+// of |new_file| are looked up in |new_block_ids|.
+FilesystemInterface::File GetOldFile(
+    const std::map<std::string, FilesystemInterface::File>& old_files_map,
+    const FileSimilarityIndex& old_files_index,
+    const FilesystemInterface::File& new_file,
+    const std::vector<BlockMapping::BlockId>& new_block_ids);
+
 }  // namespace diff_utils
 
 }  // namespace chromeos_update_engine
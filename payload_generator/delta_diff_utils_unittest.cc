@@ -17,11 +17,15 @@
 #include "update_engine/payload_generator/delta_diff_utils.h"
 
 #include <algorithm>
+#include <limits>
+#include <numeric>
 #include <random>
 #include <string>
 #include <vector>
 
+#include <base/files/file_util.h>
 #include <base/files/scoped_file.h>
+#include <base/files/scoped_temp_dir.h>
 #include <base/format_macros.h>
 #include <base/strings/stringprintf.h>
 #include <gtest/gtest.h>
@@ -29,9 +33,11 @@
 #include "update_engine/common/test_utils.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/diff_cache.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
 #include "update_engine/payload_generator/fake_filesystem.h"
+#include "update_engine/payload_generator/file_similarity_index.h"
 
 using std::string;
 using std::vector;
@@ -180,8 +186,12 @@ TEST_F(DeltaDiffUtilsTest, SkipVerityExtentsTest) {
       new_part_,
       -1,
       -1,
+      false,  // content_defined_chunking
+      0,      // memory_budget
       PayloadVersion(kMaxSupportedMajorPayloadVersion,
                      kVerityMinorPayloadVersion),
+      diff_utils::DiffSettings(),
+      nullptr,  // diff_cache
       &blob_file));
   for (const auto& aop : aops_) {
     new_visited_blocks_.AddRepeatedExtents(aop.op.dst_extents());
@@ -194,6 +204,165 @@ TEST_F(DeltaDiffUtilsTest, SkipVerityExtentsTest) {
   }
 }
 
+TEST_F(DeltaDiffUtilsTest, LargeFileChunksAreKeptInOrderTest) {
+  EXPECT_TRUE(InitializePartitionWithUniqueBlocks(old_part_, block_size_, 5));
+  EXPECT_TRUE(InitializePartitionWithUniqueBlocks(new_part_, block_size_, 42));
+  FakeFilesystem* new_fs =
+      static_cast<FakeFilesystem*>(new_part_.fs_interface.get());
+  new_fs->AddFile("/large-file", {ExtentForRange(10, 40)});
+
+  // The file is processed in three chunks, which should produce the same
+  // operations as if it was processed sequentially.
+  BlobFileWriter blob_file(blob_fd_, &blob_size_);
+  EXPECT_TRUE(diff_utils::DeltaReadPartition(
+      &aops_,
+      old_part_,
+      new_part_,
+      16,
+      -1,
+      false,  // content_defined_chunking
+      0,      // memory_budget
+      PayloadVersion(kMaxSupportedMajorPayloadVersion,
+                     kMaxSupportedMinorPayloadVersion),
+      diff_utils::DiffSettings(),
+      nullptr,  // diff_cache
+      &blob_file));
+
+  vector<AnnotatedOperation> file_aops;
+  for (const AnnotatedOperation& aop : aops_) {
+    if (aop.name.find("/large-file") == 0)
+      file_aops.push_back(aop);
+  }
+  ASSERT_EQ(3U, file_aops.size());
+  const vector<Extent> expected_extents = {
+      ExtentForRange(10, 16), ExtentForRange(26, 16), ExtentForRange(42, 8)};
+  for (size_t i = 0; i < file_aops.size(); i++) {
+    EXPECT_EQ(base::StringPrintf("/large-file:%" PRIuS, i), file_aops[i].name);
+    vector<Extent> dst_extents;
+    ExtentsToVector(file_aops[i].op.dst_extents(), &dst_extents);
+    EXPECT_EQ(vector<Extent>{expected_extents[i]}, dst_extents);
+  }
+}
+
+TEST_F(DeltaDiffUtilsTest, ShardedDiffsAreReusedTest) {
+  EXPECT_TRUE(InitializePartitionWithUniqueBlocks(old_part_, block_size_, 5));
+  EXPECT_TRUE(InitializePartitionWithUniqueBlocks(new_part_, block_size_, 42));
+  for (const PartitionConfig* part : {&old_part_, &new_part_}) {
+    FakeFilesystem* fs = static_cast<FakeFilesystem*>(part->fs_interface.get());
+    fs->AddFile("/a", {ExtentForRange(10, 20)});
+    fs->AddFile("/b", {ExtentForRange(40, 10)});
+  }
+  PayloadVersion version(kMaxSupportedMajorPayloadVersion,
+                         kMaxSupportedMinorPayloadVersion);
+  base::ScopedTempDir cache_dir;
+  ASSERT_TRUE(cache_dir.CreateUniqueTempDir());
+  auto delta_read_partition = [&](const diff_utils::DiffSettings& settings,
+                                  DiffCache* diff_cache,
+                                  vector<AnnotatedOperation>* aops) {
+    BlobFileWriter blob_file(blob_fd_, &blob_size_);
+    return diff_utils::DeltaReadPartition(aops,
+                                          old_part_,
+                                          new_part_,
+                                          -1,
+                                          -1,
+                                          false,  // content_defined_chunking
+                                          0,      // memory_budget
+                                          version,
+                                          settings,
+                                          diff_cache,
+                                          &blob_file);
+  };
+
+  // Each shard stores its diffs in the cache, without producing operations.
+  diff_utils::DiffSettings settings;
+  settings.num_shards = 2;
+  for (settings.shard_index = 0; settings.shard_index < settings.num_shards;
+       settings.shard_index++) {
+    DiffCache diff_cache(cache_dir.GetPath().value());
+    vector<AnnotatedOperation> aops;
+    EXPECT_TRUE(delta_read_partition(settings, &diff_cache, &aops));
+    EXPECT_TRUE(aops.empty());
+  }
+  EXPECT_FALSE(base::IsDirectoryEmpty(cache_dir.GetPath()));
+
+  // The run reading the diffs of all the shards from the cache produces the
+  // same operations as a run without it.
+  DiffCache diff_cache(cache_dir.GetPath().value());
+  vector<AnnotatedOperation> cached_aops, aops;
+  EXPECT_TRUE(delta_read_partition(
+      diff_utils::DiffSettings(), &diff_cache, &cached_aops));
+  EXPECT_TRUE(delta_read_partition(diff_utils::DiffSettings(), nullptr, &aops));
+  ASSERT_EQ(aops.size(), cached_aops.size());
+  for (size_t i = 0; i < aops.size(); i++) {
+    EXPECT_EQ(aops[i].name, cached_aops[i].name);
+    EXPECT_EQ(aops[i].op.type(), cached_aops[i].op.type());
+    EXPECT_EQ(aops[i].op.data_length(), cached_aops[i].op.data_length());
+  }
+}
+
+TEST_F(DeltaDiffUtilsTest, ContentDefinedChunksLineUpTest) {
+  // The new partition has the data of the old one, after a few new blocks.
+  const uint64_t kInsertedBlocks = 3;
+  std::mt19937 gen(42);
+  brillo::Blob old_data(old_part_.size);
+  brillo::Blob new_data(new_part_.size);
+  for (uint8_t& byte : old_data)
+    byte = gen() & 0xff;
+  for (size_t i = 0; i < kInsertedBlocks * block_size_; i++)
+    new_data[i] = gen() & 0xff;
+  std::copy(old_data.begin(),
+            old_data.end() - kInsertedBlocks * block_size_,
+            new_data.begin() + kInsertedBlocks * block_size_);
+  EXPECT_TRUE(test_utils::WriteFileVector(old_part_.path, old_data));
+  EXPECT_TRUE(test_utils::WriteFileVector(new_part_.path, new_data));
+
+  vector<vector<Extent>> old_chunks;
+  vector<vector<Extent>> new_chunks;
+  EXPECT_TRUE(diff_utils::SplitContentDefinedChunks(
+      old_part_.path,
+      new_part_.path,
+      {ExtentForRange(0, kDefaultBlockCount)},
+      {ExtentForRange(0, kDefaultBlockCount)},
+      2,   // min_chunk_blocks
+      4,   // average_chunk_blocks
+      16,  // max_chunk_blocks
+      32,  // max_old_chunk_blocks
+      &old_chunks,
+      &new_chunks));
+  ASSERT_EQ(old_chunks.size(), new_chunks.size());
+
+  // With fixed size chunks, none of them would have the same data in the old
+  // and new partitions.
+  uint64_t new_blocks = 0;
+  size_t identical_chunks = 0;
+  for (size_t i = 0; i < new_chunks.size(); i++) {
+    uint64_t chunk_blocks = utils::BlocksInExtents(new_chunks[i]);
+    EXPECT_LE(chunk_blocks, 16U);
+    if (i + 1 < new_chunks.size()) {
+      EXPECT_GE(chunk_blocks, 2U);
+    }
+    uint64_t old_chunk_blocks = utils::BlocksInExtents(old_chunks[i]);
+    EXPECT_LE(old_chunk_blocks, 32U);
+    new_blocks += chunk_blocks;
+
+    brillo::Blob old_chunk_data, new_chunk_data;
+    EXPECT_TRUE(utils::ReadExtents(old_part_.path,
+                                   old_chunks[i],
+                                   &old_chunk_data,
+                                   kBlockSize * old_chunk_blocks,
+                                   kBlockSize));
+    EXPECT_TRUE(utils::ReadExtents(new_part_.path,
+                                   new_chunks[i],
+                                   &new_chunk_data,
+                                   kBlockSize * chunk_blocks,
+                                   kBlockSize));
+    if (old_chunk_data == new_chunk_data)
+      identical_chunks++;
+  }
+  EXPECT_EQ(kDefaultBlockCount, new_blocks);
+  EXPECT_GE(identical_chunks, new_chunks.size() / 2);
+}
+
 TEST_F(DeltaDiffUtilsTest, MoveSmallTest) {
   brillo::Blob data_blob(block_size_);
   test_utils::FillWithData(&data_blob);
@@ -215,6 +384,8 @@ TEST_F(DeltaDiffUtilsTest, MoveSmallTest) {
       {},  // old_deflates
       {},  // new_deflates
       PayloadVersion(kChromeOSMajorPayloadVersion, kInPlaceMinorPayloadVersion),
+      diff_utils::DiffSettings(),
+      nullptr,  // diff_cache
       &data,
       &op));
   EXPECT_TRUE(data.empty());
@@ -273,6 +444,8 @@ TEST_F(DeltaDiffUtilsTest, MoveWithSameBlock) {
       {},  // old_deflates
       {},  // new_deflates
       PayloadVersion(kChromeOSMajorPayloadVersion, kInPlaceMinorPayloadVersion),
+      diff_utils::DiffSettings(),
+      nullptr,  // diff_cache
       &data,
       &op));
 
@@ -334,6 +507,8 @@ TEST_F(DeltaDiffUtilsTest, BsdiffSmallTest) {
       {},  // old_deflates
       {},  // new_deflates
       PayloadVersion(kChromeOSMajorPayloadVersion, kInPlaceMinorPayloadVersion),
+      diff_utils::DiffSettings(),
+      nullptr,  // diff_cache
       &data,
       &op));
 
@@ -385,6 +560,8 @@ TEST_F(DeltaDiffUtilsTest, ReplaceSmallTest) {
         {},  // new_deflates
         PayloadVersion(kChromeOSMajorPayloadVersion,
                        kInPlaceMinorPayloadVersion),
+        diff_utils::DiffSettings(),
+        nullptr,  // diff_cache
         &data,
         &op));
     EXPECT_FALSE(data.empty());
@@ -427,6 +604,8 @@ TEST_F(DeltaDiffUtilsTest, SourceCopyTest) {
       {},  // old_deflates
       {},  // new_deflates
       PayloadVersion(kChromeOSMajorPayloadVersion, kSourceMinorPayloadVersion),
+      diff_utils::DiffSettings(),
+      nullptr,  // diff_cache
       &data,
       &op));
   EXPECT_TRUE(data.empty());
@@ -461,6 +640,8 @@ TEST_F(DeltaDiffUtilsTest, SourceBsdiffTest) {
       {},  // old_deflates
       {},  // new_deflates
       PayloadVersion(kChromeOSMajorPayloadVersion, kSourceMinorPayloadVersion),
+      diff_utils::DiffSettings(),
+      nullptr,  // diff_cache
       &data,
       &op));
 
@@ -469,12 +650,290 @@ TEST_F(DeltaDiffUtilsTest, SourceBsdiffTest) {
   EXPECT_EQ(InstallOperation::SOURCE_BSDIFF, op.type());
 }
 
+TEST_F(DeltaDiffUtilsTest, DiffSettingsLimitBsdiffTest) {
+  brillo::Blob old_data(kBlockSize);
+  test_utils::FillWithData(&old_data);
+  brillo::Blob new_data = old_data;
+  new_data[0]++;
+  vector<Extent> old_extents = {ExtentForRange(1, 1)};
+  vector<Extent> new_extents = {ExtentForRange(2, 1)};
+  EXPECT_TRUE(WriteExtents(old_part_.path, old_extents, kBlockSize, old_data));
+  EXPECT_TRUE(WriteExtents(new_part_.path, new_extents, kBlockSize, new_data));
+
+  // The data is bigger than the bsdiff limit, so it isn't diffed.
+  diff_utils::DiffSettings settings;
+  settings.max_bsdiff_size = kBlockSize - 1;
+  brillo::Blob data;
+  InstallOperation op;
+  EXPECT_TRUE(diff_utils::ReadExtentsToDiff(
+      old_part_.path,
+      new_part_.path,
+      old_extents,
+      new_extents,
+      {},  // old_deflates
+      {},  // new_deflates
+      PayloadVersion(kChromeOSMajorPayloadVersion, kSourceMinorPayloadVersion),
+      settings,
+      nullptr,  // diff_cache
+      &data,
+      &op));
+  EXPECT_TRUE(diff_utils::IsAReplaceOperation(op.type()));
+}
+
+TEST_F(DeltaDiffUtilsTest, GetDiffSettingsTest) {
+  diff_utils::DiffSettings fast =
+      diff_utils::GetDiffSettings(GenerationProfile::kFast);
+  diff_utils::DiffSettings balanced =
+      diff_utils::GetDiffSettings(GenerationProfile::kBalanced);
+  diff_utils::DiffSettings max =
+      diff_utils::GetDiffSettings(GenerationProfile::kMax);
+  EXPECT_LT(fast.brotli_quality, balanced.brotli_quality);
+  EXPECT_LT(balanced.brotli_quality, max.brotli_quality);
+  EXPECT_LE(fast.max_bsdiff_size, balanced.max_bsdiff_size);
+  EXPECT_LT(fast.max_puffdiff_size, balanced.max_puffdiff_size);
+  EXPECT_LT(balanced.max_puffdiff_size, max.max_puffdiff_size);
+  // The max profile generates the payloads as before.
+  EXPECT_EQ(diff_utils::DiffSettings().brotli_quality, max.brotli_quality);
+  EXPECT_EQ(diff_utils::DiffSettings().max_bsdiff_size, max.max_bsdiff_size);
+  EXPECT_EQ(diff_utils::DiffSettings().max_puffdiff_size,
+            max.max_puffdiff_size);
+}
+
+TEST_F(DeltaDiffUtilsTest, ApplyCostModelSkipsSlowDiffsTest) {
+  brillo::Blob old_data(kBlockSize);
+  test_utils::FillWithData(&old_data);
+  brillo::Blob new_data = old_data;
+  new_data[0]++;
+  vector<Extent> old_extents = {ExtentForRange(1, 1)};
+  vector<Extent> new_extents = {ExtentForRange(2, 1)};
+  EXPECT_TRUE(WriteExtents(old_part_.path, old_extents, kBlockSize, old_data));
+  EXPECT_TRUE(WriteExtents(new_part_.path, new_extents, kBlockSize, new_data));
+
+  // Patching takes a lot longer than downloading the whole data, so the data
+  // isn't diffed even if the diff is smaller.
+  diff_utils::DiffSettings settings;
+  settings.apply_cost.download_speed = 1024 * 1024;
+  settings.apply_cost.bsdiff_speed = 1;
+  brillo::Blob data;
+  InstallOperation op;
+  EXPECT_TRUE(diff_utils::ReadExtentsToDiff(
+      old_part_.path,
+      new_part_.path,
+      old_extents,
+      new_extents,
+      {},  // old_deflates
+      {},  // new_deflates
+      PayloadVersion(kChromeOSMajorPayloadVersion, kSourceMinorPayloadVersion),
+      settings,
+      nullptr,  // diff_cache
+      &data,
+      &op));
+  EXPECT_TRUE(diff_utils::IsAReplaceOperation(op.type()));
+
+  // With a fast enough patching the smaller diff is picked.
+  settings.apply_cost.bsdiff_speed = 1024 * 1024 * 1024;
+  EXPECT_TRUE(diff_utils::ReadExtentsToDiff(
+      old_part_.path,
+      new_part_.path,
+      old_extents,
+      new_extents,
+      {},  // old_deflates
+      {},  // new_deflates
+      PayloadVersion(kChromeOSMajorPayloadVersion, kSourceMinorPayloadVersion),
+      settings,
+      nullptr,  // diff_cache
+      &data,
+      &op));
+  EXPECT_EQ(InstallOperation::SOURCE_BSDIFF, op.type());
+  // The memory needed to apply the diff is recorded in the operation.
+  EXPECT_EQ(kBlockSize, op.apply_memory_size());
+}
+
+TEST_F(DeltaDiffUtilsTest, ApplyCostModelPicksZstdBsdiffTest) {
+  brillo::Blob old_data(kBlockSize);
+  test_utils::FillWithData(&old_data);
+  brillo::Blob new_data = old_data;
+  new_data[0]++;
+  vector<Extent> old_extents = {ExtentForRange(1, 1)};
+  vector<Extent> new_extents = {ExtentForRange(2, 1)};
+  EXPECT_TRUE(WriteExtents(old_part_.path, old_extents, kBlockSize, old_data));
+  EXPECT_TRUE(WriteExtents(new_part_.path, new_extents, kBlockSize, new_data));
+
+  // Devices with a slow download, decompressing zstd a lot faster than
+  // brotli.
+  diff_utils::DiffSettings settings;
+  settings.apply_cost.download_speed = 10 * 1024;
+  settings.apply_cost.bsdiff_speed = 64 * 1024;
+  settings.apply_cost.zstd_bsdiff_speed = 1024 * 1024 * 1024;
+  PayloadVersion version(kBrilloMajorPayloadVersion,
+                         kMaxSupportedMinorPayloadVersion);
+  brillo::Blob data;
+  InstallOperation op;
+  EXPECT_TRUE(diff_utils::ReadExtentsToDiff(old_part_.path,
+                                            new_part_.path,
+                                            old_extents,
+                                            new_extents,
+                                            {},  // old_deflates
+                                            {},  // new_deflates
+                                            version,
+                                            settings,
+                                            nullptr,  // diff_cache
+                                            &data,
+                                            &op));
+  EXPECT_EQ(InstallOperation::ZSTD_BSDIFF, op.type());
+  // The zstd patches are applied without holding the source data.
+  EXPECT_FALSE(op.has_apply_memory_size());
+
+  // The operation isn't allowed before its minor version.
+  version.minor = kLz4MinorPayloadVersion;
+  EXPECT_TRUE(diff_utils::ReadExtentsToDiff(old_part_.path,
+                                            new_part_.path,
+                                            old_extents,
+                                            new_extents,
+                                            {},  // old_deflates
+                                            {},  // new_deflates
+                                            version,
+                                            settings,
+                                            nullptr,  // diff_cache
+                                            &data,
+                                            &op));
+  EXPECT_EQ(InstallOperation::BROTLI_BSDIFF, op.type());
+}
+
+TEST_F(DeltaDiffUtilsTest, EstimateApplyCostTest) {
+  diff_utils::ApplyCostModel model =
+      diff_utils::GetApplyCostModel(TargetDeviceClass::kLowEnd);
+  EXPECT_TRUE(model.enabled());
+  EXPECT_FALSE(
+      diff_utils::GetApplyCostModel(TargetDeviceClass::kAny).enabled());
+
+  const uint64_t kSize = 1024 * 1024;
+  // A REPLACE only costs its download.
+  EXPECT_DOUBLE_EQ(
+      kSize / model.download_speed,
+      diff_utils::EstimateApplyCost(
+          model, InstallOperation::REPLACE, kSize, kSize, kSize));
+  // A SOURCE_COPY only costs reading the source.
+  EXPECT_DOUBLE_EQ(
+      kSize / model.read_speed,
+      diff_utils::EstimateApplyCost(
+          model, InstallOperation::SOURCE_COPY, 0, kSize, kSize));
+  // A puffdiff costs more to apply than a bsdiff of the same size.
+  EXPECT_LT(diff_utils::EstimateApplyCost(
+                model, InstallOperation::BROTLI_BSDIFF, 100, kSize, kSize),
+            diff_utils::EstimateApplyCost(
+                model, InstallOperation::PUFFDIFF, 100, kSize, kSize));
+  // The diffs using more memory than the devices have are never picked.
+  EXPECT_EQ(std::numeric_limits<double>::infinity(),
+            diff_utils::EstimateApplyCost(model,
+                                          InstallOperation::PUFFDIFF,
+                                          100,
+                                          model.max_memory,
+                                          model.max_memory));
+}
+
+TEST_F(DeltaDiffUtilsTest, GenerateBestFullOperationApplyCostTest) {
+  string text;
+  for (int i = 0; text.size() < 64 * 1024; i++)
+    text += base::StringPrintf("line number %d of the file\n", i);
+  brillo::Blob new_data(text.begin(), text.end());
+  PayloadVersion version(kMaxSupportedMajorPayloadVersion,
+                         kMaxSupportedMinorPayloadVersion);
+
+  // Without a cost model the smallest blob is picked, never a REPLACE_LZ4.
+  brillo::Blob blob;
+  InstallOperation::Type op_type;
+  EXPECT_TRUE(diff_utils::GenerateBestFullOperation(
+      new_data, version, diff_utils::ApplyCostModel(), &blob, &op_type));
+  EXPECT_NE(InstallOperation::REPLACE_LZ4, op_type);
+  EXPECT_LT(blob.size(), new_data.size());
+
+  // Devices decompressing everything but LZ4 slower than they download it.
+  diff_utils::ApplyCostModel model;
+  model.download_speed = 10 * 1024 * 1024;
+  model.replace_bz_speed = 1024 * 1024;
+  model.replace_xz_speed = 1024 * 1024;
+  model.replace_zstd_speed = 1024 * 1024;
+  model.replace_lz4_speed = 1024 * 1024 * 1024;
+  EXPECT_TRUE(diff_utils::GenerateBestFullOperation(
+      new_data, version, model, &blob, &op_type));
+  EXPECT_EQ(InstallOperation::REPLACE_LZ4, op_type);
+
+  // LZ4 isn't allowed before its minor version.
+  version.minor = kZstdMinorPayloadVersion;
+  EXPECT_TRUE(diff_utils::GenerateBestFullOperation(
+      new_data, version, model, &blob, &op_type));
+  EXPECT_NE(InstallOperation::REPLACE_LZ4, op_type);
+}
+
+TEST_F(DeltaDiffUtilsTest, SourceBsdiffDiffCacheTest) {
+  brillo::Blob old_data(kBlockSize);
+  test_utils::FillWithData(&old_data);
+  brillo::Blob new_data = old_data;
+  new_data[0]++;
+  vector<Extent> old_extents = {ExtentForRange(1, 1)};
+  vector<Extent> new_extents = {ExtentForRange(2, 1)};
+  EXPECT_TRUE(WriteExtents(old_part_.path, old_extents, kBlockSize, old_data));
+  EXPECT_TRUE(WriteExtents(new_part_.path, new_extents, kBlockSize, new_data));
+
+  base::ScopedTempDir cache_dir;
+  ASSERT_TRUE(cache_dir.CreateUniqueTempDir());
+  DiffCache diff_cache(cache_dir.GetPath().value());
+  PayloadVersion version(kChromeOSMajorPayloadVersion,
+                         kSourceMinorPayloadVersion);
+
+  brillo::Blob data;
+  InstallOperation op;
+  EXPECT_TRUE(diff_utils::ReadExtentsToDiff(old_part_.path,
+                                            new_part_.path,
+                                            old_extents,
+                                            new_extents,
+                                            {},  // old_deflates
+                                            {},  // new_deflates
+                                            version,
+                                            diff_utils::DiffSettings(),
+                                            &diff_cache,
+                                            &data,
+                                            &op));
+  EXPECT_EQ(InstallOperation::SOURCE_BSDIFF, op.type());
+
+  // The diff was stored in the cache.
+  string key = DiffCache::GetKey(InstallOperation::SOURCE_BSDIFF,
+                                 version,
+                                 0,  // compression_quality
+                                 old_data,
+                                 new_data,
+                                 {},
+                                 {});
+  brillo::Blob cached_data;
+  EXPECT_TRUE(diff_cache.Get(key, &cached_data));
+  EXPECT_EQ(data, cached_data);
+
+  // The next diff of the same data is read from the cache.
+  brillo::Blob fake_diff = {'d', 'i', 'f', 'f'};
+  EXPECT_TRUE(diff_cache.Put(key, fake_diff));
+  EXPECT_TRUE(diff_utils::ReadExtentsToDiff(old_part_.path,
+                                            new_part_.path,
+                                            old_extents,
+                                            new_extents,
+                                            {},  // old_deflates
+                                            {},  // new_deflates
+                                            version,
+                                            diff_utils::DiffSettings(),
+                                            &diff_cache,
+                                            &data,
+                                            &op));
+  EXPECT_EQ(InstallOperation::SOURCE_BSDIFF, op.type());
+  EXPECT_EQ(fake_diff, data);
+}
+
 TEST_F(DeltaDiffUtilsTest, PreferReplaceTest) {
   brillo::Blob data_blob(kBlockSize);
   vector<Extent> extents = {ExtentForRange(1, 1)};
 
   // Write something in the first 50 bytes so that REPLACE_BZ will be slightly
-  // larger than BROTLI_BSDIFF.
+  // larger than BROTLI_BSDIFF. The version predates REPLACE_ZSTD, which would
+  // be smaller than both.
   std::iota(data_blob.begin(), data_blob.begin() + 50, 0);
   EXPECT_TRUE(WriteExtents(old_part_.path, extents, kBlockSize, data_blob));
   // Shift the first 50 bytes in the new file by one.
@@ -491,7 +950,9 @@ TEST_F(DeltaDiffUtilsTest, PreferReplaceTest) {
       {},  // old_deflates
       {},  // new_deflates
       PayloadVersion(kMaxSupportedMajorPayloadVersion,
-                     kMaxSupportedMinorPayloadVersion),
+                     kVerityMinorPayloadVersion),
+      diff_utils::DiffSettings(),
+      nullptr,  // diff_cache
       &data,
       &op));
 
@@ -823,4 +1284,42 @@ TEST_F(DeltaDiffUtilsTest, GetOldFileTest) {
             "delta_generator");
 }
 
+TEST_F(DeltaDiffUtilsTest, GetOldFileByContentTest) {
+  vector<BlockMapping::BlockId> block_ids(100);
+  std::iota(block_ids.begin(), block_ids.end(), 0);
+  std::map<string, FilesystemInterface::File> old_files_map;
+  FileSimilarityIndex old_files_index;
+  for (const auto& name : {"lib/libfoo.so.1", "lib/libfoo.so.2"}) {
+    FilesystemInterface::File file;
+    file.name = name;
+    file.extents = {ExtentForRange(old_files_map.size() * 50, 50)};
+    old_files_map.emplace(name, file);
+    old_files_index.AddFile(name, file.extents, block_ids);
+  }
+
+  // The blocks of the renamed file win over the most similar name.
+  FilesystemInterface::File new_file;
+  new_file.name = "lib/libfoo.so.3";
+  new_file.extents = {ExtentForRange(50, 50)};
+  EXPECT_EQ("lib/libfoo.so.2",
+            diff_utils::GetOldFile(
+                old_files_map, old_files_index, new_file, block_ids)
+                .name);
+
+  // An exact name match wins over the blocks.
+  new_file.name = "lib/libfoo.so.1";
+  EXPECT_EQ("lib/libfoo.so.1",
+            diff_utils::GetOldFile(
+                old_files_map, old_files_index, new_file, block_ids)
+                .name);
+
+  // Without blocks in common the name is used.
+  new_file.name = "lib/libfoo.so.3";
+  new_file.extents.clear();
+  EXPECT_EQ("lib/libfoo.so.1",
+            diff_utils::GetOldFile(
+                old_files_map, old_files_index, new_file, block_ids)
+                .name);
+}
+
 }  // namespace chromeos_update_engine
@@ -0,0 +1,146 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/diff_cache.h"
+
+#include <stdio.h>
+
+#include <base/files/file_path.h>
+#include <base/files/file_util.h>
+#include <base/strings/string_number_conversions.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The version of the diffs stored in the cache. It must be increased whenever
+// the diffs generated for the same data change, for example when the
+// compression settings of bsdiff change, so the old entries are not used.
+const uint32_t kDiffCacheVersion = 1;
+
+// The maximum total size of the diffs kept in memory.
+const uint64_t kMaxMemoryDiffsSize = 256 * 1024 * 1024;  // bytes
+
+template <typename T>
+bool UpdateHash(HashCalculator* hasher, T value) {
+  return hasher->Update(&value, sizeof(value));
+}
+
+bool UpdateHashWithDeflates(HashCalculator* hasher,
+                            const vector<puffin::BitExtent>& deflates) {
+  TEST_AND_RETURN_FALSE(UpdateHash<uint64_t>(hasher, deflates.size()));
+  for (const puffin::BitExtent& deflate : deflates) {
+    TEST_AND_RETURN_FALSE(UpdateHash<uint64_t>(hasher, deflate.offset));
+    TEST_AND_RETURN_FALSE(UpdateHash<uint64_t>(hasher, deflate.length));
+  }
+  return true;
+}
+
+}  // namespace
+
+string DiffCache::GetKey(InstallOperation::Type type,
+                         const PayloadVersion& version,
+                         int compression_quality,
+                         const brillo::Blob& old_data,
+                         const brillo::Blob& new_data,
+                         const vector<puffin::BitExtent>& src_deflates,
+                         const vector<puffin::BitExtent>& dst_deflates) {
+  brillo::Blob old_hash, new_hash;
+  HashCalculator hasher;
+  if (!HashCalculator::RawHashOfData(old_data, &old_hash) ||
+      !HashCalculator::RawHashOfData(new_data, &new_hash) ||
+      !UpdateHash<uint32_t>(&hasher, kDiffCacheVersion) ||
+      !UpdateHash<int32_t>(&hasher, type) ||
+      !UpdateHash<uint64_t>(&hasher, version.major) ||
+      !UpdateHash<uint32_t>(&hasher, version.minor) ||
+      !UpdateHash<int32_t>(&hasher, compression_quality) ||
+      !hasher.Update(old_hash.data(), old_hash.size()) ||
+      !hasher.Update(new_hash.data(), new_hash.size()) ||
+      !UpdateHashWithDeflates(&hasher, src_deflates) ||
+      !UpdateHashWithDeflates(&hasher, dst_deflates) || !hasher.Finalize()) {
+    return "";
+  }
+  return base::HexEncode(hasher.raw_hash().data(), hasher.raw_hash().size());
+}
+
+bool DiffCache::Get(const string& key, brillo::Blob* diff) {
+  if (key.empty())
+    return false;
+  {
+    base::AutoLock auto_lock(memory_lock_);
+    auto it = memory_diffs_.find(key);
+    if (it != memory_diffs_.end()) {
+      *diff = it->second;
+      return true;
+    }
+  }
+  if (cache_dir_.empty() || !utils::ReadFile(GetPath(key), diff) ||
+      diff->empty()) {
+    return false;
+  }
+  PutInMemory(key, *diff);
+  return true;
+}
+
+bool DiffCache::Contains(const string& key) {
+  if (key.empty())
+    return false;
+  {
+    base::AutoLock auto_lock(memory_lock_);
+    if (memory_diffs_.count(key) > 0)
+      return true;
+  }
+  return !cache_dir_.empty() && base::PathExists(base::FilePath(GetPath(key)));
+}
+
+bool DiffCache::Put(const string& key, const brillo::Blob& diff) {
+  TEST_AND_RETURN_FALSE(!key.empty());
+  PutInMemory(key, diff);
+  if (cache_dir_.empty())
+    return true;
+  base::FilePath temp_path;
+  TEST_AND_RETURN_FALSE(
+      base::CreateTemporaryFileInDir(base::FilePath(cache_dir_), &temp_path));
+  // Write the diff to a temporary file first, so a diff being written is
+  // never read by another process.
+  if (!utils::WriteFile(temp_path.value().c_str(), diff.data(), diff.size()) ||
+      rename(temp_path.value().c_str(), GetPath(key).c_str()) != 0) {
+    PLOG(ERROR) << "Unable to store the diff " << key << " in " << cache_dir_;
+    base::DeleteFile(temp_path, false);
+    return false;
+  }
+  return true;
+}
+
+string DiffCache::GetPath(const string& key) const {
+  return base::FilePath(cache_dir_).Append(key).value();
+}
+
+void DiffCache::PutInMemory(const string& key, const brillo::Blob& diff) {
+  base::AutoLock auto_lock(memory_lock_);
+  if (memory_diffs_size_ + diff.size() > kMaxMemoryDiffsSize)
+    return;
+  if (memory_diffs_.emplace(key, diff).second)
+    memory_diffs_size_ += diff.size();
+}
+
+}  // namespace chromeos_update_engine
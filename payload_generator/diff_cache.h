@@ -0,0 +1,94 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_DIFF_CACHE_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_DIFF_CACHE_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+#include <base/synchronization/lock.h>
+#include <brillo/secure_blob.h>
+#include <puffin/puffdiff.h>
+
+#include "update_engine/payload_generator/payload_generation_config.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// An on-disk cache of the diffs computed while generating a payload, so
+// generating payloads from several source builds to the same target doesn't
+// compute the diffs of the same data again. Each diff is stored in its own
+// file in the cache directory, named after its key. The files are replaced
+// atomically, so a directory can be shared by several delta_generator
+// processes and threads.
+//
+// The diffs are also kept in memory, up to a limit, so the same old and new
+// data found several times while generating a payload, like an APK in several
+// partitions, is only diffed once even without a cache directory.
+class DiffCache {
+ public:
+  // Creates a cache storing the diffs in |cache_dir|, or only in memory if
+  // |cache_dir| is empty.
+  explicit DiffCache(const std::string& cache_dir) : cache_dir_(cache_dir) {}
+
+  // Returns the key of the diff of |type| from |old_data| to |new_data| for
+  // a payload of |version|. The |compression_quality| is the quality of the
+  // compression of the diffs compressed with a tunable quality, like
+  // BROTLI_BSDIFF, and 0 for the other diffs. The |src_deflates| and
+  // |dst_deflates| are the deflate streams used by puffdiff, and are empty for
+  // the other diffs.
+  static std::string GetKey(
+      InstallOperation::Type type,
+      const PayloadVersion& version,
+      int compression_quality,
+      const brillo::Blob& old_data,
+      const brillo::Blob& new_data,
+      const std::vector<puffin::BitExtent>& src_deflates,
+      const std::vector<puffin::BitExtent>& dst_deflates);
+
+  // Reads the diff stored for |key| in |diff|. Returns false if there is none.
+  bool Get(const std::string& key, brillo::Blob* diff);
+
+  // Returns whether a diff is stored for |key|, without reading it.
+  bool Contains(const std::string& key);
+
+  // Stores the |diff| for |key|. Returns whether it succeeded.
+  bool Put(const std::string& key, const brillo::Blob& diff);
+
+ private:
+  // Returns the path of the file storing the diff for |key|.
+  std::string GetPath(const std::string& key) const;
+
+  // Keeps the |diff| for |key| in memory, unless the limit is reached.
+  void PutInMemory(const std::string& key, const brillo::Blob& diff);
+
+  const std::string cache_dir_;
+
+  // The diffs kept in memory and their total size, protected with the
+  // |memory_lock_|.
+  std::map<std::string, brillo::Blob> memory_diffs_;
+  uint64_t memory_diffs_size_{0};
+  base::Lock memory_lock_;
+
+  DISALLOW_COPY_AND_ASSIGN(DiffCache);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_DIFF_CACHE_H_
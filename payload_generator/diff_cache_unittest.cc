@@ -0,0 +1,151 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/diff_cache.h"
+
+#include <string>
+
+#include <base/files/scoped_temp_dir.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+class DiffCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(cache_dir_.CreateUniqueTempDir());
+    test_utils::FillWithData(&old_data_);
+    new_data_ = old_data_;
+    new_data_[0]++;
+  }
+
+  base::ScopedTempDir cache_dir_;
+  brillo::Blob old_data_ = brillo::Blob(1024);
+  brillo::Blob new_data_;
+  PayloadVersion version_{kBrilloMajorPayloadVersion,
+                          kSourceMinorPayloadVersion};
+};
+
+TEST_F(DiffCacheTest, StoredDiffIsReadTest) {
+  DiffCache diff_cache(cache_dir_.GetPath().value());
+  string key = DiffCache::GetKey(InstallOperation::SOURCE_BSDIFF,
+                                 version_,
+                                 0,  // compression_quality
+                                 old_data_,
+                                 new_data_,
+                                 {},
+                                 {});
+  brillo::Blob diff;
+  EXPECT_FALSE(diff_cache.Get(key, &diff));
+  EXPECT_FALSE(diff_cache.Contains(key));
+
+  brillo::Blob expected_diff = {'d', 'i', 'f', 'f'};
+  EXPECT_TRUE(diff_cache.Put(key, expected_diff));
+  EXPECT_TRUE(diff_cache.Contains(key));
+  EXPECT_TRUE(diff_cache.Get(key, &diff));
+  EXPECT_EQ(expected_diff, diff);
+
+  // Another cache in the same directory reads the same diffs.
+  DiffCache other_diff_cache(cache_dir_.GetPath().value());
+  EXPECT_TRUE(other_diff_cache.Contains(key));
+  diff.clear();
+  EXPECT_TRUE(other_diff_cache.Get(key, &diff));
+  EXPECT_EQ(expected_diff, diff);
+}
+
+TEST_F(DiffCacheTest, MemoryOnlyCacheTest) {
+  DiffCache diff_cache("");
+  string key = DiffCache::GetKey(
+      InstallOperation::PUFFDIFF, version_, 0, old_data_, new_data_, {}, {});
+  brillo::Blob diff;
+  EXPECT_FALSE(diff_cache.Get(key, &diff));
+
+  brillo::Blob expected_diff = {'d', 'i', 'f', 'f'};
+  EXPECT_TRUE(diff_cache.Put(key, expected_diff));
+  EXPECT_TRUE(diff_cache.Get(key, &diff));
+  EXPECT_EQ(expected_diff, diff);
+
+  // The diffs are not shared with other caches.
+  DiffCache other_diff_cache("");
+  EXPECT_FALSE(other_diff_cache.Get(key, &diff));
+}
+
+TEST_F(DiffCacheTest, KeyDependsOnAllInputsTest) {
+  string key = DiffCache::GetKey(InstallOperation::SOURCE_BSDIFF,
+                                 version_,
+                                 0,  // compression_quality
+                                 old_data_,
+                                 new_data_,
+                                 {},
+                                 {});
+  EXPECT_FALSE(key.empty());
+  EXPECT_EQ(key,
+            DiffCache::GetKey(InstallOperation::SOURCE_BSDIFF,
+                              version_,
+                              0,
+                              old_data_,
+                              new_data_,
+                              {},
+                              {}));
+
+  EXPECT_NE(key,
+            DiffCache::GetKey(InstallOperation::BROTLI_BSDIFF,
+                              version_,
+                              0,
+                              old_data_,
+                              new_data_,
+                              {},
+                              {}));
+  EXPECT_NE(key,
+            DiffCache::GetKey(InstallOperation::SOURCE_BSDIFF,
+                              PayloadVersion(kBrilloMajorPayloadVersion,
+                                             kOpSrcHashMinorPayloadVersion),
+                              0,
+                              old_data_,
+                              new_data_,
+                              {},
+                              {}));
+  EXPECT_NE(key,
+            DiffCache::GetKey(InstallOperation::SOURCE_BSDIFF,
+                              version_,
+                              0,
+                              new_data_,
+                              old_data_,
+                              {},
+                              {}));
+  EXPECT_NE(key,
+            DiffCache::GetKey(InstallOperation::SOURCE_BSDIFF,
+                              version_,
+                              0,
+                              old_data_,
+                              new_data_,
+                              {puffin::BitExtent(8, 16)},
+                              {}));
+  EXPECT_NE(key,
+            DiffCache::GetKey(InstallOperation::SOURCE_BSDIFF,
+                              version_,
+                              9,
+                              old_data_,
+                              new_data_,
+                              {},
+                              {}));
+}
+
+}  // namespace chromeos_update_engine
@@ -28,15 +28,21 @@
 #pragma clang diagnostic pop
 #endif
 
+#include <algorithm>
+#include <iterator>
 #include <map>
 #include <set>
 
 #include <base/logging.h>
+#include <base/macros.h>
 #include <base/strings/stringprintf.h>
+#include <base/threading/simple_thread.h>
 
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/mapped_image.h"
 #include "update_engine/update_metadata.pb.h"
 
 using std::set;
@@ -83,6 +89,147 @@ int AddMetadataBlocks(ext2_filsys fs,
   return 0;
 }
 
+// Scans the inodes of a range of block groups on its own handle to the
+// filesystem, since a libext2fs handle can't be shared between threads.
+class InodeScanner : public base::DelegateSimpleThread::Delegate {
+ public:
+  InodeScanner(const string& filename, dgrp_t first_group, dgrp_t last_group)
+      : filename_(filename),
+        first_group_(first_group),
+        last_group_(last_group) {}
+  ~InodeScanner() override = default;
+
+  // Overrides DelegateSimpleThread::Delegate.
+  void Run() override {
+    ext2_filsys filsys;
+    errcode_t error = ext2fs_open(filename_.c_str(),
+                                  0,  // flags (read only)
+                                  0,  // superblock block number
+                                  0,  // block_size (autodetect)
+                                  unix_io_manager,
+                                  &filsys);
+    if (error) {
+      LOG(ERROR) << "Opening ext2fs " << filename_ << " (" << error << ")";
+      return;
+    }
+    ok_ = ScanInodes(filsys);
+    ext2fs_free(filsys);
+  }
+
+  bool ok() const { return ok_; }
+  std::map<ext2_ino_t, FilesystemInterface::File>* inodes() {
+    return &inodes_;
+  }
+  vector<ext2_ino_t>* directories() { return &directories_; }
+  set<uint64_t>* inode_blocks() { return &inode_blocks_; }
+
+ private:
+  bool ScanInodes(ext2_filsys filsys);
+
+  string filename_;
+  // The block groups to scan, |last_group_| excluded.
+  dgrp_t first_group_;
+  dgrp_t last_group_;
+
+  bool ok_{false};
+  std::map<ext2_ino_t, FilesystemInterface::File> inodes_;
+  // List of directories. We need to first parse all the files in a directory
+  // to later fix the absolute paths.
+  vector<ext2_ino_t> directories_;
+  set<uint64_t> inode_blocks_;
+
+  DISALLOW_COPY_AND_ASSIGN(InodeScanner);
+};
+
+bool InodeScanner::ScanInodes(ext2_filsys filsys) {
+  TEST_AND_RETURN_FALSE_ERRCODE(ext2fs_read_inode_bitmap(filsys));
+
+  ext2_inode_scan iscan;
+  TEST_AND_RETURN_FALSE_ERRCODE(
+      ext2fs_open_inode_scan(filsys, 0 /* buffer_blocks */, &iscan));
+  if (first_group_ > 0) {
+    errcode_t error = ext2fs_inode_scan_goto_blockgroup(iscan, first_group_);
+    if (error) {
+      LOG(ERROR) << "Failed to go to block group " << first_group_ << " ("
+                 << error << ")";
+      ext2fs_close_inode_scan(iscan);
+      return false;
+    }
+  }
+  ext2_ino_t last_ino = last_group_ * EXT2_INODES_PER_GROUP(filsys->super);
+
+  // Iterator
+  ext2_ino_t it_ino;
+  ext2_inode it_inode;
+
+  bool ok = true;
+  while (true) {
+    errcode_t error = ext2fs_get_next_inode(iscan, &it_ino, &it_inode);
+    if (error) {
+      LOG(ERROR) << "Failed to retrieve next inode (" << error << ")";
+      ok = false;
+      break;
+    }
+    if (it_ino == 0 || it_ino > last_ino)
+      break;
+
+    // Skip inodes that are not in use.
+    if (!ext2fs_test_inode_bitmap(filsys->inode_map, it_ino))
+      continue;
+
+    FilesystemInterface::File& file = inodes_[it_ino];
+    if (it_ino == EXT2_RESIZE_INO) {
+      file.name = "<group-descriptors>";
+    } else {
+      file.name = base::StringPrintf("<inode-%u>", it_ino);
+    }
+
+    memset(&file.file_stat, 0, sizeof(file.file_stat));
+    file.file_stat.st_ino = it_ino;
+    file.file_stat.st_mode = it_inode.i_mode;
+    file.file_stat.st_nlink = it_inode.i_links_count;
+    file.file_stat.st_uid = it_inode.i_uid;
+    file.file_stat.st_gid = it_inode.i_gid;
+    file.file_stat.st_size = it_inode.i_size;
+    file.file_stat.st_blksize = filsys->blocksize;
+    file.file_stat.st_blocks = it_inode.i_blocks;
+    file.file_stat.st_atime = it_inode.i_atime;
+    file.file_stat.st_mtime = it_inode.i_mtime;
+    file.file_stat.st_ctime = it_inode.i_ctime;
+
+    bool is_dir = (ext2fs_check_directory(filsys, it_ino) == 0);
+    if (is_dir)
+      directories_.push_back(it_ino);
+
+    if (!ext2fs_inode_has_valid_blocks(&it_inode))
+      continue;
+
+    // Process the inode data and metadata blocks.
+    // For normal files, inode blocks are indirect, double indirect
+    // and triple indirect blocks (no data blocks). For directories and
+    // the journal, all blocks are considered metadata blocks.
+    int flags = it_ino < EXT2_GOOD_OLD_FIRST_INO ? 0 : BLOCK_FLAG_DATA_ONLY;
+    error = ext2fs_block_iterate2(filsys,
+                                  it_ino,
+                                  flags,
+                                  nullptr,  // block_buf
+                                  ProcessInodeAllBlocks,
+                                  &file.extents);
+
+    if (error) {
+      LOG(ERROR) << "Failed to enumerate inode " << it_ino << " blocks ("
+                 << error << ")";
+      continue;
+    }
+    if (it_ino >= EXT2_GOOD_OLD_FIRST_INO) {
+      ext2fs_block_iterate2(
+          filsys, it_ino, 0, nullptr, AddMetadataBlocks, &inode_blocks_);
+    }
+  }
+  ext2fs_close_inode_scan(iscan);
+  return ok;
+}
+
 struct UpdateFileAndAppendState {
   std::map<ext2_ino_t, FilesystemInterface::File>* inodes = nullptr;
   set<ext2_ino_t>* used_inodes = nullptr;
@@ -159,91 +306,43 @@ size_t Ext2Filesystem::GetBlockCount() const {
 }
 
 bool Ext2Filesystem::GetFiles(vector<File>* files) const {
-  TEST_AND_RETURN_FALSE_ERRCODE(ext2fs_read_inode_bitmap(filsys_));
-
-  ext2_inode_scan iscan;
-  TEST_AND_RETURN_FALSE_ERRCODE(
-      ext2fs_open_inode_scan(filsys_, 0 /* buffer_blocks */, &iscan));
+  // The inodes are scanned in parallel, each thread handling a range of
+  // block groups. Since the ranges are merged in order, the output is the
+  // same as scanning all the inodes one after the other.
+  dgrp_t num_groups = filsys_->group_desc_count;
+  dgrp_t num_threads = std::max<dgrp_t>(
+      1, std::min<dgrp_t>(num_groups, diff_utils::GetMaxThreads()));
+  vector<unique_ptr<InodeScanner>> scanners;
+  for (dgrp_t i = 0; i < num_threads; i++) {
+    scanners.emplace_back(new InodeScanner(filename_,
+                                           num_groups * i / num_threads,
+                                           num_groups * (i + 1) / num_threads));
+  }
+  if (num_threads == 1) {
+    scanners[0]->Run();
+  } else {
+    base::DelegateSimpleThreadPool thread_pool("ext2-inode-scanner",
+                                               num_threads);
+    thread_pool.Start();
+    for (auto& scanner : scanners)
+      thread_pool.AddWork(scanner.get());
+    thread_pool.JoinAll();
+  }
 
   std::map<ext2_ino_t, File> inodes;
-
-  // List of directories. We need to first parse all the files in a directory
-  // to later fix the absolute paths.
   vector<ext2_ino_t> directories;
-
   set<uint64_t> inode_blocks;
-
-  // Iterator
-  ext2_ino_t it_ino;
-  ext2_inode it_inode;
-
-  bool ok = true;
-  while (true) {
-    errcode_t error = ext2fs_get_next_inode(iscan, &it_ino, &it_inode);
-    if (error) {
-      LOG(ERROR) << "Failed to retrieve next inode (" << error << ")";
-      ok = false;
-      break;
-    }
-    if (it_ino == 0)
-      break;
-
-    // Skip inodes that are not in use.
-    if (!ext2fs_test_inode_bitmap(filsys_->inode_map, it_ino))
-      continue;
-
-    File& file = inodes[it_ino];
-    if (it_ino == EXT2_RESIZE_INO) {
-      file.name = "<group-descriptors>";
-    } else {
-      file.name = base::StringPrintf("<inode-%u>", it_ino);
-    }
-
-    memset(&file.file_stat, 0, sizeof(file.file_stat));
-    file.file_stat.st_ino = it_ino;
-    file.file_stat.st_mode = it_inode.i_mode;
-    file.file_stat.st_nlink = it_inode.i_links_count;
-    file.file_stat.st_uid = it_inode.i_uid;
-    file.file_stat.st_gid = it_inode.i_gid;
-    file.file_stat.st_size = it_inode.i_size;
-    file.file_stat.st_blksize = filsys_->blocksize;
-    file.file_stat.st_blocks = it_inode.i_blocks;
-    file.file_stat.st_atime = it_inode.i_atime;
-    file.file_stat.st_mtime = it_inode.i_mtime;
-    file.file_stat.st_ctime = it_inode.i_ctime;
-
-    bool is_dir = (ext2fs_check_directory(filsys_, it_ino) == 0);
-    if (is_dir)
-      directories.push_back(it_ino);
-
-    if (!ext2fs_inode_has_valid_blocks(&it_inode))
-      continue;
-
-    // Process the inode data and metadata blocks.
-    // For normal files, inode blocks are indirect, double indirect
-    // and triple indirect blocks (no data blocks). For directories and
-    // the journal, all blocks are considered metadata blocks.
-    int flags = it_ino < EXT2_GOOD_OLD_FIRST_INO ? 0 : BLOCK_FLAG_DATA_ONLY;
-    error = ext2fs_block_iterate2(filsys_,
-                                  it_ino,
-                                  flags,
-                                  nullptr,  // block_buf
-                                  ProcessInodeAllBlocks,
-                                  &file.extents);
-
-    if (error) {
-      LOG(ERROR) << "Failed to enumerate inode " << it_ino << " blocks ("
-                 << error << ")";
-      continue;
-    }
-    if (it_ino >= EXT2_GOOD_OLD_FIRST_INO) {
-      ext2fs_block_iterate2(
-          filsys_, it_ino, 0, nullptr, AddMetadataBlocks, &inode_blocks);
-    }
+  for (auto& scanner : scanners) {
+    TEST_AND_RETURN_FALSE(scanner->ok());
+    inodes.insert(std::make_move_iterator(scanner->inodes()->begin()),
+                  std::make_move_iterator(scanner->inodes()->end()));
+    directories.insert(directories.end(),
+                       scanner->directories()->begin(),
+                       scanner->directories()->end());
+    inode_blocks.insert(scanner->inode_blocks()->begin(),
+                        scanner->inode_blocks()->end());
   }
-  ext2fs_close_inode_scan(iscan);
-  if (!ok)
-    return false;
+  scanners.clear();
 
   // The set of inodes already added to the output. There can be less elements
   // here than in files since the later can contain repeated inodes due to
@@ -360,7 +459,7 @@ bool Ext2Filesystem::LoadSettings(brillo::KeyValueStore* store) const {
   // Sparse holes in the settings file are not supported.
   if (EXT2_I_SIZE(&ino_data) > physical_size)
     return false;
-  if (!utils::ReadExtents(
+  if (!ReadImageExtents(
           filename_, extents, &blob, physical_size, filsys_->blocksize))
     return false;
 
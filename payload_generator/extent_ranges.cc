@@ -17,7 +17,6 @@
 #include "update_engine/payload_generator/extent_ranges.h"
 
 #include <algorithm>
-#include <set>
 #include <utility>
 #include <vector>
 
@@ -27,7 +26,6 @@
 #include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_generator/extent_utils.h"
 
-using std::set;
 using std::vector;
 
 namespace chromeos_update_engine {
@@ -66,158 +64,206 @@ void ExtentRanges::SubtractBlock(uint64_t block) {
 
 namespace {
 
+uint64_t ExtentEnd(const Extent& extent) {
+  return extent.start_block() + extent.num_blocks();
+}
+
 Extent UnionOverlappingExtents(const Extent& first, const Extent& second) {
   CHECK_NE(kSparseHole, first.start_block());
   CHECK_NE(kSparseHole, second.start_block());
   uint64_t start = std::min(first.start_block(), second.start_block());
-  uint64_t end = std::max(first.start_block() + first.num_blocks(),
-                          second.start_block() + second.num_blocks());
+  uint64_t end = std::max(ExtentEnd(first), ExtentEnd(second));
   return ExtentForRange(start, end - start);
 }
 
+// Returns base - subtractee (set subtraction), sorted by start block.
+vector<Extent> SubtractOverlappingExtents(const Extent& base,
+                                          const Extent& subtractee) {
+  vector<Extent> ret;
+  if (subtractee.start_block() > base.start_block()) {
+    ret.push_back(ExtentForRange(
+        base.start_block(), subtractee.start_block() - base.start_block()));
+  }
+  uint64_t base_end = ExtentEnd(base);
+  uint64_t subtractee_end = ExtentEnd(subtractee);
+  if (base_end > subtractee_end) {
+    ret.push_back(ExtentForRange(subtractee_end, base_end - subtractee_end));
+  }
+  return ret;
+}
+
+// Sorts the |extents| by their start block and merges the ones that overlap or
+// touch each other, dropping the sparse holes and the empty extents.
+void SortAndMergeExtents(vector<Extent>* extents) {
+  extents->erase(std::remove_if(extents->begin(),
+                                extents->end(),
+                                [](const Extent& extent) {
+                                  return extent.start_block() == kSparseHole ||
+                                         extent.num_blocks() == 0;
+                                }),
+                 extents->end());
+  std::sort(extents->begin(), extents->end(), ExtentLess());
+  size_t merged = 0;
+  for (size_t i = 0; i < extents->size(); i++) {
+    if (merged > 0 &&
+        ExtentEnd((*extents)[merged - 1]) >= (*extents)[i].start_block()) {
+      (*extents)[merged - 1] =
+          UnionOverlappingExtents((*extents)[merged - 1], (*extents)[i]);
+    } else {
+      (*extents)[merged++] = (*extents)[i];
+    }
+  }
+  extents->resize(merged);
+}
+
 }  // namespace
 
 void ExtentRanges::AddExtent(Extent extent) {
   if (extent.start_block() == kSparseHole || extent.num_blocks() == 0)
     return;
 
-  ExtentSet::iterator begin_del = extent_set_.end();
-  ExtentSet::iterator end_del = extent_set_.end();
+  // Find the first extent that could overlap or touch |extent|. Only the one
+  // before the first extent starting after |extent| can start before it.
+  ExtentSet::iterator begin_del = std::upper_bound(
+      extent_set_.begin(), extent_set_.end(), extent, ExtentLess());
+  if (begin_del != extent_set_.begin() &&
+      ExtentEnd(*(begin_del - 1)) >= extent.start_block()) {
+    --begin_del;
+  }
+  ExtentSet::iterator end_del = begin_del;
   uint64_t del_blocks = 0;
-  for (ExtentSet::iterator it = extent_set_.begin(), e = extent_set_.end();
-       it != e;
-       ++it) {
-    if (ExtentsOverlapOrTouch(*it, extent)) {
-      end_del = it;
-      ++end_del;
-      del_blocks += it->num_blocks();
-      if (begin_del == extent_set_.end())
-        begin_del = it;
-
-      extent = UnionOverlappingExtents(extent, *it);
-    }
+  while (end_del != extent_set_.end() &&
+         end_del->start_block() <= ExtentEnd(extent)) {
+    del_blocks += end_del->num_blocks();
+    extent = UnionOverlappingExtents(extent, *end_del);
+    ++end_del;
+  }
+  if (begin_del == end_del) {
+    extent_set_.insert(begin_del, extent);
+  } else {
+    *begin_del = extent;
+    extent_set_.erase(begin_del + 1, end_del);
   }
-  extent_set_.erase(begin_del, end_del);
-  extent_set_.insert(extent);
   blocks_ -= del_blocks;
   blocks_ += extent.num_blocks();
 }
 
-namespace {
-// Returns base - subtractee (set subtraction).
-ExtentRanges::ExtentSet SubtractOverlappingExtents(const Extent& base,
-                                                   const Extent& subtractee) {
-  ExtentRanges::ExtentSet ret;
-  if (subtractee.start_block() > base.start_block()) {
-    ret.insert(ExtentForRange(base.start_block(),
-                              subtractee.start_block() - base.start_block()));
-  }
-  uint64_t base_end = base.start_block() + base.num_blocks();
-  uint64_t subtractee_end = subtractee.start_block() + subtractee.num_blocks();
-  if (base_end > subtractee_end) {
-    ret.insert(ExtentForRange(subtractee_end, base_end - subtractee_end));
-  }
-  return ret;
-}
-}  // namespace
-
 void ExtentRanges::SubtractExtent(const Extent& extent) {
   if (extent.start_block() == kSparseHole || extent.num_blocks() == 0)
     return;
 
-  ExtentSet::iterator begin_del = extent_set_.end();
-  ExtentSet::iterator end_del = extent_set_.end();
+  ExtentSet::iterator begin_del = std::upper_bound(
+      extent_set_.begin(), extent_set_.end(), extent, ExtentLess());
+  if (begin_del != extent_set_.begin() &&
+      ExtentEnd(*(begin_del - 1)) > extent.start_block()) {
+    --begin_del;
+  }
+  ExtentSet::iterator end_del = begin_del;
   uint64_t del_blocks = 0;
-  ExtentSet new_extents;
-  for (ExtentSet::iterator it = extent_set_.begin(), e = extent_set_.end();
-       it != e;
-       ++it) {
-    if (!ExtentsOverlap(*it, extent))
-      continue;
-
-    if (begin_del == extent_set_.end())
-      begin_del = it;
-    end_del = it;
+  vector<Extent> new_extents;
+  while (end_del != extent_set_.end() &&
+         end_del->start_block() < ExtentEnd(extent)) {
+    del_blocks += end_del->num_blocks();
+    for (const Extent& remaining :
+         SubtractOverlappingExtents(*end_del, extent)) {
+      new_extents.push_back(remaining);
+      del_blocks -= remaining.num_blocks();
+    }
     ++end_del;
+  }
+  ExtentSet::iterator next = extent_set_.erase(begin_del, end_del);
+  extent_set_.insert(next, new_extents.begin(), new_extents.end());
+  blocks_ -= del_blocks;
+}
 
-    del_blocks += it->num_blocks();
+void ExtentRanges::AddSortedExtents(const ExtentSet& extents) {
+  if (extents.empty())
+    return;
+  ExtentSet result;
+  result.reserve(extent_set_.size() + extents.size());
+  ExtentSet::const_iterator it = extent_set_.begin();
+  ExtentSet::const_iterator jt = extents.begin();
+  while (it != extent_set_.end() || jt != extents.end()) {
+    const Extent& next =
+        (jt == extents.end() ||
+         (it != extent_set_.end() && it->start_block() < jt->start_block()))
+            ? *it++
+            : *jt++;
+    if (!result.empty() && ExtentEnd(result.back()) >= next.start_block())
+      result.back() = UnionOverlappingExtents(result.back(), next);
+    else
+      result.push_back(next);
+  }
+  extent_set_.swap(result);
+  blocks_ = utils::BlocksInExtents(extent_set_);
+}
 
-    ExtentSet subtraction = SubtractOverlappingExtents(*it, extent);
-    for (ExtentSet::iterator jt = subtraction.begin(), je = subtraction.end();
-         jt != je;
+void ExtentRanges::SubtractSortedExtents(const ExtentSet& extents) {
+  if (extents.empty())
+    return;
+  ExtentSet result;
+  result.reserve(extent_set_.size() + extents.size());
+  ExtentSet::const_iterator first_subtractee = extents.begin();
+  for (const Extent& extent : extent_set_) {
+    uint64_t start = extent.start_block();
+    uint64_t end = ExtentEnd(extent);
+    // The subtracted extents ending before this one can't overlap the next
+    // ones either.
+    while (first_subtractee != extents.end() &&
+           ExtentEnd(*first_subtractee) <= start) {
+      ++first_subtractee;
+    }
+    for (ExtentSet::const_iterator jt = first_subtractee;
+         start < end && jt != extents.end() && jt->start_block() < end;
          ++jt) {
-      new_extents.insert(*jt);
-      del_blocks -= jt->num_blocks();
+      if (jt->start_block() > start)
+        result.push_back(ExtentForRange(start, jt->start_block() - start));
+      start = std::max(start, ExtentEnd(*jt));
     }
+    if (start < end)
+      result.push_back(ExtentForRange(start, end - start));
   }
-  extent_set_.erase(begin_del, end_del);
-  extent_set_.insert(new_extents.begin(), new_extents.end());
-  blocks_ -= del_blocks;
+  extent_set_.swap(result);
+  blocks_ = utils::BlocksInExtents(extent_set_);
 }
 
 void ExtentRanges::AddRanges(const ExtentRanges& ranges) {
-  for (ExtentSet::const_iterator it = ranges.extent_set_.begin(),
-                                 e = ranges.extent_set_.end();
-       it != e;
-       ++it) {
-    AddExtent(*it);
-  }
+  AddSortedExtents(ranges.extent_set_);
 }
 
 void ExtentRanges::SubtractRanges(const ExtentRanges& ranges) {
-  for (ExtentSet::const_iterator it = ranges.extent_set_.begin(),
-                                 e = ranges.extent_set_.end();
-       it != e;
-       ++it) {
-    SubtractExtent(*it);
-  }
+  SubtractSortedExtents(ranges.extent_set_);
 }
 
 void ExtentRanges::AddExtents(const vector<Extent>& extents) {
-  for (vector<Extent>::const_iterator it = extents.begin(), e = extents.end();
-       it != e;
-       ++it) {
-    AddExtent(*it);
-  }
+  vector<Extent> sorted_extents = extents;
+  SortAndMergeExtents(&sorted_extents);
+  AddSortedExtents(sorted_extents);
 }
 
 void ExtentRanges::SubtractExtents(const vector<Extent>& extents) {
-  for (vector<Extent>::const_iterator it = extents.begin(), e = extents.end();
-       it != e;
-       ++it) {
-    SubtractExtent(*it);
-  }
+  vector<Extent> sorted_extents = extents;
+  SortAndMergeExtents(&sorted_extents);
+  SubtractSortedExtents(sorted_extents);
 }
 
 void ExtentRanges::AddRepeatedExtents(
     const ::google::protobuf::RepeatedPtrField<Extent>& exts) {
-  for (int i = 0, e = exts.size(); i != e; ++i) {
-    AddExtent(exts.Get(i));
-  }
+  AddExtents(vector<Extent>(exts.begin(), exts.end()));
 }
 
 void ExtentRanges::SubtractRepeatedExtents(
     const ::google::protobuf::RepeatedPtrField<Extent>& exts) {
-  for (int i = 0, e = exts.size(); i != e; ++i) {
-    SubtractExtent(exts.Get(i));
-  }
+  SubtractExtents(vector<Extent>(exts.begin(), exts.end()));
 }
 
 bool ExtentRanges::ContainsBlock(uint64_t block) const {
-  auto lower = extent_set_.lower_bound(ExtentForRange(block, 1));
-  // The block could be on the extent before the one in |lower|.
-  if (lower != extent_set_.begin())
-    lower--;
-  // Any extent starting at block+1 or later is not interesting, so this is the
-  // upper limit.
-  auto upper = extent_set_.lower_bound(ExtentForRange(block + 1, 0));
-  for (auto iter = lower; iter != upper; ++iter) {
-    if (iter->start_block() <= block &&
-        block < iter->start_block() + iter->num_blocks()) {
-      return true;
-    }
-  }
-  return false;
+  // Only the last extent starting at |block| or before can contain it.
+  auto upper = std::upper_bound(extent_set_.begin(),
+                                extent_set_.end(),
+                                ExtentForRange(block, 1),
+                                ExtentLess());
+  return upper != extent_set_.begin() && ExtentEnd(*(upper - 1)) > block;
 }
 
 void ExtentRanges::Dump() const {
@@ -283,13 +329,17 @@ vector<Extent> FilterExtentRanges(const vector<Extent>& extents,
     // is achieved by looking from the extent whose start_block is *lower* than
     // the extent.start_block() up to the greatest extent whose start_block is
     // lower than extent.start_block() + extent.num_blocks().
-    auto lower = extent_set.lower_bound(extent);
+    auto lower = std::lower_bound(
+        extent_set.begin(), extent_set.end(), extent, ExtentLess());
     // We need to decrement the lower_bound to look at the extent that could
     // overlap the beginning of the current |extent|.
     if (lower != extent_set.begin())
       lower--;
-    auto upper = extent_set.lower_bound(
-        ExtentForRange(extent.start_block() + extent.num_blocks(), 0));
+    auto upper = std::lower_bound(
+        extent_set.begin(),
+        extent_set.end(),
+        ExtentForRange(extent.start_block() + extent.num_blocks(), 0),
+        ExtentLess());
     for (auto iter = lower; iter != upper; ++iter) {
       if (!ExtentRanges::ExtentsOverlap(extent, *iter))
         continue;
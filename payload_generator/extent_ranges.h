@@ -18,7 +18,6 @@
 #define UPDATE_ENGINE_PAYLOAD_GENERATOR_EXTENT_RANGES_H_
 
 #include <map>
-#include <set>
 #include <vector>
 
 #include <base/macros.h>
@@ -47,7 +46,10 @@ Extent ExtentForBytes(uint64_t block_size,
 
 class ExtentRanges {
  public:
-  typedef std::set<Extent, ExtentLess> ExtentSet;
+  // The extents are kept sorted by their start block in a flat vector, which
+  // is faster to search and traverse than a tree. The extents in it never
+  // overlap or touch each other.
+  typedef std::vector<Extent> ExtentSet;
 
   ExtentRanges() : blocks_(0) {}
   void AddBlock(uint64_t block);
@@ -82,6 +84,12 @@ class ExtentRanges {
   std::vector<Extent> GetExtentsForBlockCount(uint64_t count) const;
 
  private:
+  // Adds or subtracts the |extents|, which are sorted by their start block and
+  // don't overlap or touch each other, merging them with |extent_set_| in a
+  // single pass.
+  void AddSortedExtents(const ExtentSet& extents);
+  void SubtractSortedExtents(const ExtentSet& extents);
+
   ExtentSet extent_set_;
   uint64_t blocks_;
 };
@@ -16,6 +16,7 @@
 
 #include "update_engine/payload_generator/extent_ranges.h"
 
+#include <random>
 #include <vector>
 
 #include <gtest/gtest.h>
@@ -267,6 +268,38 @@ TEST(ExtentRangesTest, ContainsBlockTest) {
   EXPECT_FALSE(ranges.ContainsBlock(101));
 }
 
+TEST(ExtentRangesTest, BulkOperationsMatchSingleExtentsTest) {
+  // Add and subtract overlapping, unsorted extents both one at a time and all
+  // at once, which should produce the same ranges.
+  std::mt19937 gen(7);
+  ExtentRanges single_ranges;
+  ExtentRanges bulk_ranges;
+  for (int round = 0; round < 20; round++) {
+    vector<Extent> extents;
+    for (int i = 0; i < 50; i++)
+      extents.push_back(ExtentForRange(gen() % 1000, gen() % 20));
+    if (round % 2 == 0) {
+      for (const Extent& extent : extents)
+        single_ranges.AddExtent(extent);
+      bulk_ranges.AddExtents(extents);
+    } else {
+      for (const Extent& extent : extents)
+        single_ranges.SubtractExtent(extent);
+      bulk_ranges.SubtractExtents(extents);
+    }
+    EXPECT_EQ(single_ranges.blocks(), bulk_ranges.blocks());
+    EXPECT_EQ(single_ranges.extent_set(), bulk_ranges.extent_set());
+  }
+
+  ExtentRanges added_ranges;
+  added_ranges.AddRanges(single_ranges);
+  added_ranges.AddRanges(added_ranges);
+  EXPECT_EQ(single_ranges.extent_set(), added_ranges.extent_set());
+  added_ranges.SubtractRanges(single_ranges);
+  EXPECT_EQ(0U, added_ranges.blocks());
+  EXPECT_TRUE(added_ranges.extent_set().empty());
+}
+
 TEST(ExtentRangesTest, FilterExtentRangesEmptyRanges) {
   ExtentRanges ranges;
   EXPECT_EQ(vector<Extent>(), FilterExtentRanges(vector<Extent>(), ranges));
@@ -0,0 +1,124 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/file_similarity_index.h"
+
+#include <algorithm>
+#include <utility>
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Mixes the bits of a block id, so the smallest hashes are a uniform sample of
+// the block ids regardless of the order they were assigned in.
+uint64_t HashBlockId(BlockMapping::BlockId block_id) {
+  uint64_t x = static_cast<uint64_t>(block_id);
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+}  // namespace
+
+const size_t FileSimilarityIndex::kSketchSize;
+
+FileSimilarityIndex::Sketch FileSimilarityIndex::ComputeSketch(
+    const vector<Extent>& extents,
+    const vector<BlockMapping::BlockId>& block_ids) {
+  Sketch sketch;
+  for (const Extent& extent : extents) {
+    uint64_t end_block = std::min(
+        extent.start_block() + extent.num_blocks(),
+        static_cast<uint64_t>(block_ids.size()));
+    for (uint64_t block = extent.start_block(); block < end_block; block++) {
+      if (block_ids[block] != 0)
+        sketch.push_back(HashBlockId(block_ids[block]));
+    }
+  }
+  std::sort(sketch.begin(), sketch.end());
+  sketch.erase(std::unique(sketch.begin(), sketch.end()), sketch.end());
+  if (sketch.size() > kSketchSize)
+    sketch.resize(kSketchSize);
+  return sketch;
+}
+
+double FileSimilarityIndex::EstimateSimilarity(const Sketch& a,
+                                               const Sketch& b) {
+  // The smallest hashes of the union are a sample of it, and the fraction of
+  // them in both sketches estimates the fraction of the union in both files.
+  size_t i = 0, j = 0, sampled = 0, shared = 0;
+  while (sampled < kSketchSize && (i < a.size() || j < b.size())) {
+    if (j == b.size() || (i < a.size() && a[i] < b[j])) {
+      i++;
+    } else if (i == a.size() || b[j] < a[i]) {
+      j++;
+    } else {
+      i++;
+      j++;
+      shared++;
+    }
+    sampled++;
+  }
+  return sampled == 0 ? 0.0 : static_cast<double>(shared) / sampled;
+}
+
+void FileSimilarityIndex::AddFile(
+    const string& name,
+    const vector<Extent>& extents,
+    const vector<BlockMapping::BlockId>& block_ids) {
+  Sketch sketch = ComputeSketch(extents, block_ids);
+  if (sketch.empty())
+    return;
+  for (uint64_t hash : sketch)
+    files_by_hash_[hash].push_back(names_.size());
+  names_.push_back(name);
+  sketches_.push_back(std::move(sketch));
+}
+
+string FileSimilarityIndex::FindSimilarFile(
+    const vector<Extent>& extents,
+    const vector<BlockMapping::BlockId>& block_ids,
+    double min_similarity) const {
+  Sketch sketch = ComputeSketch(extents, block_ids);
+  vector<size_t> candidates;
+  for (uint64_t hash : sketch) {
+    auto it = files_by_hash_.find(hash);
+    if (it != files_by_hash_.end())
+      candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+  }
+  std::sort(candidates.begin(), candidates.end());
+  candidates.erase(std::unique(candidates.begin(), candidates.end()),
+                   candidates.end());
+
+  string best_name;
+  double best_similarity = min_similarity;
+  for (size_t index : candidates) {
+    double similarity = EstimateSimilarity(sketch, sketches_[index]);
+    if (similarity >= best_similarity &&
+        (best_name.empty() || similarity > best_similarity)) {
+      best_similarity = similarity;
+      best_name = names_[index];
+    }
+  }
+  return best_name;
+}
+
+}  // namespace chromeos_update_engine
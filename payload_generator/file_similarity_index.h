@@ -0,0 +1,85 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_FILE_SIMILARITY_INDEX_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_FILE_SIMILARITY_INDEX_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <base/macros.h>
+
+#include "update_engine/payload_generator/block_mapping.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// FileSimilarityIndex finds the old file with the most data blocks in common
+// with a new file, regardless of their names, so renamed and moved files are
+// diffed against their previous version. Each file is summarized by a MinHash
+// sketch: the smallest hashes of the distinct block ids of its blocks, as
+// assigned by a BlockMapping of both partitions.
+class FileSimilarityIndex {
+ public:
+  using Sketch = std::vector<uint64_t>;
+
+  // The maximum number of hashes in a sketch.
+  static const size_t kSketchSize = 64;
+
+  FileSimilarityIndex() = default;
+
+  // Returns the sorted sketch of the blocks in |extents|, whose block ids are
+  // looked up in |block_ids|. The blocks with all zeros and the ones past the
+  // end of |block_ids| are ignored.
+  static Sketch ComputeSketch(
+      const std::vector<Extent>& extents,
+      const std::vector<BlockMapping::BlockId>& block_ids);
+
+  // Returns the estimated Jaccard similarity, between 0 and 1, of the sets of
+  // blocks summarized by the sketches |a| and |b|.
+  static double EstimateSimilarity(const Sketch& a, const Sketch& b);
+
+  // Adds the old file |name| stored in the blocks |extents|.
+  void AddFile(const std::string& name,
+               const std::vector<Extent>& extents,
+               const std::vector<BlockMapping::BlockId>& block_ids);
+
+  // Returns the name of the added file most similar to the new file stored in
+  // the blocks |extents|, or an empty string if none has a similarity of at
+  // least |min_similarity|. Ties go to the file added first.
+  std::string FindSimilarFile(
+      const std::vector<Extent>& extents,
+      const std::vector<BlockMapping::BlockId>& block_ids,
+      double min_similarity) const;
+
+ private:
+  std::vector<std::string> names_;
+  std::vector<Sketch> sketches_;
+
+  // The indexes of the added files whose sketch contains each hash, so only
+  // the files sharing at least one hash are compared.
+  std::unordered_map<uint64_t, std::vector<size_t>> files_by_hash_;
+
+  DISALLOW_COPY_AND_ASSIGN(FileSimilarityIndex);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_FILE_SIMILARITY_INDEX_H_
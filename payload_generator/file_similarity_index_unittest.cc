@@ -0,0 +1,96 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/file_similarity_index.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/payload_generator/extent_utils.h"
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+class FileSimilarityIndexTest : public ::testing::Test {
+ protected:
+  // The block ids of a partition where block N has id N, so only block 0 has
+  // all zeros.
+  void SetUp() override {
+    block_ids_.resize(1000);
+    for (size_t i = 0; i < block_ids_.size(); i++)
+      block_ids_[i] = i;
+  }
+
+  vector<BlockMapping::BlockId> block_ids_;
+};
+
+TEST_F(FileSimilarityIndexTest, ComputeSketchTest) {
+  // Zero blocks, repeated blocks and blocks past the end are ignored.
+  block_ids_[3] = 0;
+  block_ids_[4] = 5;
+  FileSimilarityIndex::Sketch sketch = FileSimilarityIndex::ComputeSketch(
+      {ExtentForRange(2, 4), ExtentForRange(998, 10)}, block_ids_);
+  EXPECT_EQ(4U, sketch.size());
+  EXPECT_TRUE(std::is_sorted(sketch.begin(), sketch.end()));
+
+  // The sketch of a big file keeps only the smallest hashes.
+  sketch = FileSimilarityIndex::ComputeSketch({ExtentForRange(0, 1000)},
+                                              block_ids_);
+  EXPECT_EQ(FileSimilarityIndex::kSketchSize, sketch.size());
+}
+
+TEST_F(FileSimilarityIndexTest, EstimateSimilarityTest) {
+  FileSimilarityIndex::Sketch a = FileSimilarityIndex::ComputeSketch(
+      {ExtentForRange(0, 400)}, block_ids_);
+  FileSimilarityIndex::Sketch b = FileSimilarityIndex::ComputeSketch(
+      {ExtentForRange(200, 400)}, block_ids_);
+  FileSimilarityIndex::Sketch c = FileSimilarityIndex::ComputeSketch(
+      {ExtentForRange(600, 400)}, block_ids_);
+
+  EXPECT_DOUBLE_EQ(1.0, FileSimilarityIndex::EstimateSimilarity(a, a));
+  EXPECT_DOUBLE_EQ(0.0, FileSimilarityIndex::EstimateSimilarity(a, c));
+  EXPECT_DOUBLE_EQ(0.0, FileSimilarityIndex::EstimateSimilarity(a, {}));
+  // The real similarity is 200 / 600 blocks.
+  double similarity = FileSimilarityIndex::EstimateSimilarity(a, b);
+  EXPECT_GT(similarity, 0.1);
+  EXPECT_LT(similarity, 0.6);
+}
+
+TEST_F(FileSimilarityIndexTest, FindSimilarFileTest) {
+  FileSimilarityIndex index;
+  index.AddFile("/lib/libfoo.so.1", {ExtentForRange(0, 100)}, block_ids_);
+  index.AddFile("/lib/libbar.so.1", {ExtentForRange(100, 100)}, block_ids_);
+  // Files with only zero blocks are never returned.
+  block_ids_[500] = 0;
+  index.AddFile("/empty", {ExtentForRange(500, 1)}, block_ids_);
+
+  // A new file with 90 of the blocks of libbar and 10 new blocks.
+  vector<Extent> new_extents = {ExtentForRange(110, 90),
+                                ExtentForRange(800, 10)};
+  EXPECT_EQ("/lib/libbar.so.1",
+            index.FindSimilarFile(new_extents, block_ids_, 0.5));
+  EXPECT_EQ("", index.FindSimilarFile(new_extents, block_ids_, 0.99));
+  EXPECT_EQ("",
+            index.FindSimilarFile({ExtentForRange(800, 100)}, block_ids_, 0.0));
+  EXPECT_EQ("",
+            index.FindSimilarFile({ExtentForRange(500, 1)}, block_ids_, 0.0));
+}
+
+}  // namespace chromeos_update_engine
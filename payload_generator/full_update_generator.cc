@@ -26,10 +26,12 @@
 #include <base/format_macros.h>
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
+#include <base/synchronization/condition_variable.h>
 #include <base/synchronization/lock.h>
 #include <base/threading/simple_thread.h>
 #include <brillo/secure_blob.h>
 
+#include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_generator/delta_diff_utils.h"
 
@@ -41,70 +43,125 @@ namespace {
 
 const size_t kDefaultFullChunkSize = 1024 * 1024;  // 1 MiB
 
+// The number of chunks compressed ahead of the next chunk to store, for each
+// thread. The compressed chunks are stored in order, so this bounds the number
+// of compressed blobs waiting in memory for a slower chunk before them.
+const size_t kChunksAheadPerThread = 2;
+
+// Signals the blob writer when a ChunkProcessor is done.
+struct ChunkCompletion {
+  base::Lock lock;
+  base::ConditionVariable done{&lock};
+};
+
 // This class encapsulates a full update chunk processing thread work. The
-// processor reads a chunk of data from the input file descriptor and compresses
-// it. The processor will destroy itself when the work is done.
+// processor compresses a chunk of data read from the input file by the blob
+// writer with ReadChunk(). The compressed blob is kept until the blob writer
+// stores it with StoreBlob(), so the blobs are stored in the order of the
+// operations.
 class ChunkProcessor : public base::DelegateSimpleThread::Delegate {
  public:
-  // Read a chunk of |size| bytes from |fd| starting at offset |offset|.
+  // Process a chunk of |size| bytes starting at offset |offset| of the input.
   ChunkProcessor(const PayloadVersion& version,
-                 int fd,
+                 const diff_utils::ApplyCostModel& apply_cost,
                  off_t offset,
                  size_t size,
-                 BlobFileWriter* blob_file,
+                 ChunkCompletion* completion,
                  AnnotatedOperation* aop)
       : version_(version),
-        fd_(fd),
+        apply_cost_(apply_cost),
         offset_(offset),
         size_(size),
-        blob_file_(blob_file),
+        completion_(completion),
         aop_(aop) {}
-  // We use a default move constructor since all the data members are POD types.
+  // We use a default move constructor since all the data members are POD types
+  // or blobs.
   ChunkProcessor(ChunkProcessor&&) = default;
   ~ChunkProcessor() override = default;
 
+  // Reads the chunk from |fd|. The chunks are read in order by a single
+  // thread, so the input is read sequentially even when it is a block device.
+  bool ReadChunk(int fd);
+
   // Overrides DelegateSimpleThread::Delegate.
-  // Run() handles the read from |fd| in a thread-safe way, and stores the
-  // new operation to generate the region starting at |offset| of size |size|
-  // in the output operation |aop|. The associated blob data is stored in
-  // |blob_fd| and |blob_file_size| is updated.
+  // Run() compresses the chunk read by ReadChunk(), and stores the new
+  // operation to generate the region starting at |offset| of size |size| in
+  // the output operation |aop|, except for its blob which is kept until
+  // StoreBlob() is called.
   void Run() override;
 
+  // Waits until Run() is done, then stores the compressed blob in |blob_file|.
+  // Returns whether both succeeded.
+  bool StoreBlob(BlobFileWriter* blob_file);
+
  private:
   bool ProcessChunk();
 
   // Work parameters.
   const PayloadVersion& version_;
-  int fd_;
+  const diff_utils::ApplyCostModel& apply_cost_;
   off_t offset_;
   size_t size_;
-  BlobFileWriter* blob_file_;
+  ChunkCompletion* completion_;
   AnnotatedOperation* aop_;
 
+  // The data of the chunk, released once compressed.
+  brillo::Blob buffer_in_;
+
+  // The compressed blob and whether the processing is done, protected by the
+  // |completion_| lock.
+  brillo::Blob op_blob_;
+  bool done_{false};
+  bool success_{false};
+
   DISALLOW_COPY_AND_ASSIGN(ChunkProcessor);
 };
 
+bool ChunkProcessor::ReadChunk(int fd) {
+  buffer_in_.resize(size_);
+  ssize_t bytes_read = -1;
+  TEST_AND_RETURN_FALSE(utils::PReadAll(
+      fd, buffer_in_.data(), buffer_in_.size(), offset_, &bytes_read));
+  TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(size_));
+  return true;
+}
+
 void ChunkProcessor::Run() {
-  if (!ProcessChunk()) {
+  bool success = ProcessChunk();
+  if (!success) {
     LOG(ERROR) << "Error processing region at " << offset_ << " of size "
                << size_;
   }
+  base::AutoLock auto_lock(completion_->lock);
+  done_ = true;
+  success_ = success;
+  completion_->done.Broadcast();
 }
 
-bool ChunkProcessor::ProcessChunk() {
-  brillo::Blob buffer_in_(size_);
-  brillo::Blob op_blob;
-  ssize_t bytes_read = -1;
-  TEST_AND_RETURN_FALSE(utils::PReadAll(
-      fd_, buffer_in_.data(), buffer_in_.size(), offset_, &bytes_read));
-  TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(size_));
+bool ChunkProcessor::StoreBlob(BlobFileWriter* blob_file) {
+  {
+    base::AutoLock auto_lock(completion_->lock);
+    while (!done_)
+      completion_->done.Wait();
+  }
+  TEST_AND_RETURN_FALSE(success_);
+  TEST_AND_RETURN_FALSE(aop_->SetOperationBlob(op_blob_, blob_file));
+  op_blob_ = brillo::Blob();
+  return true;
+}
 
+bool ChunkProcessor::ProcessChunk() {
+  TEST_AND_RETURN_FALSE(buffer_in_.size() == size_);
   InstallOperation::Type op_type;
   TEST_AND_RETURN_FALSE(diff_utils::GenerateBestFullOperation(
-      buffer_in_, version_, &op_blob, &op_type));
-
+      buffer_in_, version_, apply_cost_, &op_blob_, &op_type));
+  buffer_in_ = brillo::Blob();
   aop_->op.set_type(op_type);
-  TEST_AND_RETURN_FALSE(aop_->SetOperationBlob(op_blob, blob_file_));
+
+  // Hash the blob in this thread, so PayloadFile doesn't need to read it back.
+  brillo::Blob hash;
+  TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfData(op_blob_, &hash));
+  aop_->op.set_data_sha256_hash(hash.data(), hash.size());
   return true;
 }
 
@@ -145,12 +202,18 @@ bool FullUpdateGenerator::GenerateOperations(
   int in_fd = open(new_part.path.c_str(), O_RDONLY, 0);
   TEST_AND_RETURN_FALSE(in_fd >= 0);
   ScopedFdCloser in_fd_closer(&in_fd);
+  // The chunks are read in order, let the kernel read ahead of them.
+  posix_fadvise(in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
 
-  // We potentially have all the ChunkProcessors in memory but only
-  // |max_threads| will actually hold a block in memory while we process.
+  // We potentially have all the ChunkProcessors in memory but only up to
+  // |max_chunks_ahead| will actually hold a chunk or its compressed blob in
+  // memory while we process.
   size_t partition_blocks = new_part.size / config.block_size;
   size_t num_chunks = utils::DivRoundUp(partition_blocks, chunk_blocks);
   aops->resize(num_chunks);
+  ChunkCompletion completion;
+  const diff_utils::ApplyCostModel apply_cost =
+      diff_utils::GetApplyCostModel(config.device_class);
   vector<ChunkProcessor> chunk_processors;
   chunk_processors.reserve(num_chunks);
   blob_file->SetTotalBlobs(num_chunks);
@@ -172,10 +235,10 @@ bool FullUpdateGenerator::GenerateOperations(
 
     chunk_processors.emplace_back(
         config.version,
-        in_fd,
+        apply_cost,
         static_cast<off_t>(start_block) * config.block_size,
         num_blocks * config.block_size,
-        blob_file,
+        &completion,
         aop);
   }
 
@@ -183,12 +246,36 @@ bool FullUpdateGenerator::GenerateOperations(
   base::DelegateSimpleThreadPool thread_pool("full-update-generator",
                                              max_threads);
   thread_pool.Start();
-  for (ChunkProcessor& processor : chunk_processors)
-    thread_pool.AddWork(&processor);
+
+  // Store the blobs in the order of the operations as they are compressed, so
+  // PayloadFile doesn't need to reorder them. The chunks are read in order by
+  // this thread and handed to the thread pool only a few at a time ahead of
+  // the next one to store.
+  const size_t max_chunks_ahead = kChunksAheadPerThread * max_threads;
+  size_t next_chunk_to_add = 0;
+  bool read_success = true;
+  bool success = true;
+  for (size_t i = 0; i < num_chunks; ++i) {
+    for (; read_success && next_chunk_to_add < num_chunks &&
+           next_chunk_to_add < i + max_chunks_ahead;
+         ++next_chunk_to_add) {
+      ChunkProcessor* processor = &chunk_processors[next_chunk_to_add];
+      read_success = processor->ReadChunk(in_fd);
+      if (!read_success)
+        break;
+      thread_pool.AddWork(processor);
+    }
+    // A chunk that couldn't be read was never handed to the thread pool.
+    if (i >= next_chunk_to_add || !chunk_processors[i].StoreBlob(blob_file)) {
+      success = false;
+      break;
+    }
+  }
   thread_pool.JoinAll();
 
   // All the work done, disable logging.
   blob_file->SetTotalBlobs(0);
+  TEST_AND_RETURN_FALSE(success);
 
   // All the operations must have a type set at this point. Otherwise, a
   // ChunkProcessor failed to complete.
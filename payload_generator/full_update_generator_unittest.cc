@@ -81,7 +81,12 @@ TEST_F(FullUpdateGeneratorTest, RunTest) {
                                             &aops));
   int64_t new_part_chunks = new_part_conf.size / config_.hard_chunk_size;
   EXPECT_EQ(new_part_chunks, static_cast<int64_t>(aops.size()));
+  // The blobs are stored in the order of the operations.
+  uint64_t next_blob_offset = 0;
   for (off_t i = 0; i < new_part_chunks; ++i) {
+    EXPECT_EQ(next_blob_offset, aops[i].op.data_offset()) << "i = " << i;
+    EXPECT_TRUE(aops[i].op.has_data_sha256_hash()) << "i = " << i;
+    next_blob_offset += aops[i].op.data_length();
     EXPECT_EQ(1, aops[i].op.dst_extents_size());
     EXPECT_EQ(
         static_cast<uint64_t>(i * config_.hard_chunk_size / config_.block_size),
@@ -93,6 +98,7 @@ TEST_F(FullUpdateGeneratorTest, RunTest) {
       EXPECT_EQ(InstallOperation::REPLACE_BZ, aops[i].op.type());
     }
   }
+  EXPECT_EQ(static_cast<uint64_t>(out_blobs_length_), next_blob_offset);
 }
 
 // Test that if the chunk size is not a divisor of the image size, it handles
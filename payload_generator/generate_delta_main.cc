@@ -14,7 +14,9 @@
 // limitations under the License.
 //
 
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <base/files/file_path.h>
@@ -36,9 +38,14 @@
 #include "update_engine/payload_consumer/download_action.h"
 #include "update_engine/payload_consumer/filesystem_verifier_action.h"
 #include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/cached_filesystem.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/diff_cache.h"
+#include "update_engine/payload_generator/mapped_image.h"
 #include "update_engine/payload_generator/payload_generation_config.h"
 #include "update_engine/payload_generator/payload_signer.h"
+#include "update_engine/payload_generator/phase_timings.h"
+#include "update_engine/payload_generator/sparse_image.h"
 #include "update_engine/payload_generator/xz.h"
 #include "update_engine/update_metadata.pb.h"
 
@@ -281,6 +288,38 @@ int ExtractProperties(const string& payload_path, const string& props_file) {
   return true;
 }
 
+// Expands the Android sparse images of the |image| partitions to temporary
+// raw images, which keep the unused chunks as holes so they only take the
+// space of the data. The raw images are deleted by the |unlinkers|.
+void ExpandSparseImages(
+    ImageConfig* image,
+    vector<std::unique_ptr<ScopedPathUnlinker>>* unlinkers) {
+  for (PartitionConfig& part : image->partitions) {
+    if (part.path.empty() || !IsSparseImage(part.path))
+      continue;
+    string raw_path;
+    CHECK(utils::MakeTempFile("CrAU_raw_image.XXXXXX", &raw_path, nullptr));
+    unlinkers->emplace_back(new ScopedPathUnlinker(raw_path));
+    CHECK(ExpandSparseImage(part.path, raw_path));
+    part.path = raw_path;
+  }
+}
+
+// Sets the partitions of the |source| image of a delta payload to the
+// |old_partitions| paths of the |partition_names|, with the |old_mapfiles|.
+void SetSourcePartitions(const vector<string>& partition_names,
+                         const vector<string>& old_partitions,
+                         const vector<string>& old_mapfiles,
+                         ImageConfig* source) {
+  CHECK(old_partitions.size() == partition_names.size());
+  for (size_t i = 0; i < partition_names.size(); i++) {
+    source->partitions.emplace_back(partition_names[i]);
+    source->partitions.back().path = old_partitions[i];
+    if (i < old_mapfiles.size())
+      source->partitions.back().mapfile_path = old_mapfiles[i];
+  }
+}
+
 int Main(int argc, char** argv) {
   DEFINE_string(old_image, "", "Path to the old rootfs");
   DEFINE_string(new_image, "", "Path to the new rootfs");
@@ -319,7 +358,22 @@ int Main(int argc, char** argv) {
                 "",
                 "Path to input delta payload file used to hash/sign payloads "
                 "and apply delta over old_image (for debugging)");
-  DEFINE_string(out_file, "", "Path to output delta payload file");
+  DEFINE_string(out_file,
+                "",
+                "Path to output delta payload file. Use - to stream the "
+                "generated payload to stdout, e.g. to a pipe or a socket.");
+  DEFINE_string(extra_old_partitions,
+                "",
+                "Paths to more old partitions, to generate a delta from each "
+                "of them to the same new partitions in this run, which reads "
+                "the new partitions only once. Separate the old partitions of "
+                "each payload with a semicolon, and their paths with a colon "
+                "as with -old_partitions. These payloads use the minor "
+                "version of the -old_partitions one.");
+  DEFINE_string(extra_out_files,
+                "",
+                "Paths to output the payloads generated from "
+                "-extra_old_partitions, separated by a colon.");
   DEFINE_string(out_hash_file, "", "Path to output hash file");
   DEFINE_string(
       out_metadata_hash_file, "", "Path to output metadata hash file");
@@ -350,6 +404,57 @@ int Main(int argc, char** argv) {
                 "e.g. /path/to/sig:/path/to/next:/path/to/last_sig .");
   DEFINE_int32(
       chunk_size, 200 * 1024 * 1024, "Payload chunk size (-1 for whole files)");
+  DEFINE_bool(content_defined_chunking,
+              false,
+              "Split the files too big to be diffed at once in content-defined "
+              "chunks.");
+  DEFINE_bool(sort_operations_by_source,
+              false,
+              "Sort the operations by the source blocks they read instead of "
+              "the destination blocks they write, merging more of them.");
+  DEFINE_bool(report_duplicated_blocks,
+              false,
+              "Log how many blocks of each new partition are also in the new "
+              "partitions before it.");
+  DEFINE_bool(usage_report,
+              false,
+              "Write the JSON report of the operations of the payload, with "
+              "their sizes and estimated apply time, next to it in "
+              "<out_file>.usage.json.");
+  DEFINE_uint64(memory_budget_mb,
+                0,
+                "The memory in MiB the files diffed in parallel are estimated "
+                "to use at most (0 means no limit).");
+  DEFINE_bool(mmap_images,
+              false,
+              "Map the old and new partition images in memory and read their "
+              "data from the mapping.");
+  DEFINE_string(diff_cache_dir,
+                "",
+                "Directory where the diffs are cached between runs of "
+                "delta_generator. The cache is disabled if empty.");
+  DEFINE_int32(num_shards,
+               0,
+               "Split the diffs of a delta in this many shards, diffed by "
+               "as many delta_generator runs sharing the -diff_cache_dir, "
+               "which write no payload. A last run without -num_shards "
+               "writes the payload from the cached diffs.");
+  DEFINE_int32(shard_index,
+               0,
+               "The shard diffed by this run, from 0 to -num_shards - 1.");
+  DEFINE_string(profile,
+                "max",
+                "The trade-off between the size of the payload and the time "
+                "to generate it: fast, balanced or max.");
+  DEFINE_string(device_class,
+                "any",
+                "The class of the devices the payload is generated for: any, "
+                "mid_range or low_end. The diffs too slow to apply on the "
+                "slower devices are replaced by bigger operations.");
+  DEFINE_string(out_timings_file,
+                "",
+                "Path to output the time spent in each phase of the payload "
+                "generation and the utilization of the threads, as JSON.");
   DEFINE_uint64(rootfs_partition_size,
                 chromeos_update_engine::kRootFSPartitionSize,
                 "RootFS partition size for the image once installed");
@@ -543,12 +648,28 @@ int Main(int argc, char** argv) {
       LOG(WARNING) << "--old_partitions is empty, using deprecated --old_image "
                    << "and --old_kernel flags.";
     }
-    for (size_t i = 0; i < partition_names.size(); i++) {
-      payload_config.source.partitions.emplace_back(partition_names[i]);
-      payload_config.source.partitions.back().path = old_partitions[i];
-      if (i < old_mapfiles.size())
-        payload_config.source.partitions.back().mapfile_path = old_mapfiles[i];
-    }
+    SetSourcePartitions(partition_names,
+                        old_partitions,
+                        old_mapfiles,
+                        &payload_config.source);
+  }
+
+  vector<string> extra_old_partitions, extra_out_files;
+  if (!FLAGS_extra_old_partitions.empty()) {
+    LOG_IF(FATAL, !payload_config.is_delta || FLAGS_old_partitions.empty())
+        << "Please use --old_partitions if you are using "
+        << "--extra_old_partitions.";
+    extra_old_partitions = base::SplitString(FLAGS_extra_old_partitions,
+                                             ";",
+                                             base::TRIM_WHITESPACE,
+                                             base::SPLIT_WANT_ALL);
+    extra_out_files = base::SplitString(FLAGS_extra_out_files,
+                                        ":",
+                                        base::TRIM_WHITESPACE,
+                                        base::SPLIT_WANT_ALL);
+    LOG_IF(FATAL, extra_out_files.size() != extra_old_partitions.size())
+        << "Pass one --extra_out_files path for each --extra_old_partitions "
+        << "payload.";
   }
 
   if (!FLAGS_in_file.empty()) {
@@ -565,8 +686,40 @@ int Main(int argc, char** argv) {
 
   // Use the default soft_chunk_size defined in the config.
   payload_config.hard_chunk_size = FLAGS_chunk_size;
+  payload_config.content_defined_chunking = FLAGS_content_defined_chunking;
+  payload_config.sort_operations_by_source = FLAGS_sort_operations_by_source;
+  payload_config.report_duplicated_blocks = FLAGS_report_duplicated_blocks;
+  payload_config.write_usage_report = FLAGS_usage_report;
+  payload_config.memory_budget = FLAGS_memory_budget_mb * 1024 * 1024;
+  payload_config.diff_cache_dir = FLAGS_diff_cache_dir;
+  LOG_IF(FATAL, FLAGS_num_shards < 0 || FLAGS_shard_index < 0)
+      << "The shards can't be negative.";
+  payload_config.num_shards = FLAGS_num_shards;
+  payload_config.shard_index = FLAGS_shard_index;
+  if (FLAGS_profile == "fast") {
+    payload_config.profile = GenerationProfile::kFast;
+  } else if (FLAGS_profile == "balanced") {
+    payload_config.profile = GenerationProfile::kBalanced;
+  } else {
+    LOG_IF(FATAL, FLAGS_profile != "max")
+        << "Invalid generation profile: " << FLAGS_profile;
+    payload_config.profile = GenerationProfile::kMax;
+  }
+  if (FLAGS_device_class == "mid_range") {
+    payload_config.device_class = TargetDeviceClass::kMidRange;
+  } else if (FLAGS_device_class == "low_end") {
+    payload_config.device_class = TargetDeviceClass::kLowEnd;
+  } else {
+    LOG_IF(FATAL, FLAGS_device_class != "any")
+        << "Invalid device class: " << FLAGS_device_class;
+    payload_config.device_class = TargetDeviceClass::kAny;
+  }
   payload_config.block_size = kBlockSize;
 
+  vector<std::unique_ptr<ScopedPathUnlinker>> raw_image_unlinkers;
+  ExpandSparseImages(&payload_config.source, &raw_image_unlinkers);
+  ExpandSparseImages(&payload_config.target, &raw_image_unlinkers);
+
   // The partition size is never passed to the delta_generator, so we
   // need to detect those from the provided files.
   if (payload_config.is_delta) {
@@ -574,6 +727,16 @@ int Main(int argc, char** argv) {
   }
   CHECK(payload_config.target.LoadImageSize());
 
+  if (FLAGS_mmap_images) {
+    for (const ImageConfig* image :
+         {&payload_config.source, &payload_config.target}) {
+      for (const PartitionConfig& part : image->partitions) {
+        if (!part.path.empty())
+          CHECK(MappedImage::Map(part.path));
+      }
+    }
+  }
+
   if (!FLAGS_dynamic_partition_info_file.empty()) {
     LOG_IF(FATAL, FLAGS_major_version == kChromeOSMajorPayloadVersion)
         << "Dynamic partition info is only allowed in major version 2 or "
@@ -584,7 +747,7 @@ int Main(int argc, char** argv) {
     CHECK(payload_config.target.ValidateDynamicPartitionMetadata());
   }
 
-  CHECK(!FLAGS_out_file.empty());
+  CHECK(!FLAGS_out_file.empty() || FLAGS_num_shards > 0);
 
   // Ignore failures. These are optional arguments.
   ParseImageInfo(FLAGS_new_channel,
@@ -606,10 +769,20 @@ int Main(int argc, char** argv) {
 
   payload_config.rootfs_partition_size = FLAGS_rootfs_partition_size;
 
+  if (!FLAGS_out_timings_file.empty())
+    PhaseTimings::Get()->Start();
+
   if (payload_config.is_delta) {
     // Avoid opening the filesystem interface for full payloads.
-    for (PartitionConfig& part : payload_config.target.partitions)
+    ScopedPhaseTimer timer(kPhaseOpenFilesystems);
+    for (PartitionConfig& part : payload_config.target.partitions) {
       CHECK(part.OpenFilesystem());
+      // The files of the target are listed again for each extra payload.
+      if (!extra_old_partitions.empty() && part.fs_interface) {
+        part.fs_interface =
+            std::make_unique<CachedFilesystem>(std::move(part.fs_interface));
+      }
+    }
     for (PartitionConfig& part : payload_config.source.partitions)
       CHECK(part.OpenFilesystem());
   }
@@ -654,9 +827,15 @@ int Main(int argc, char** argv) {
     return 1;
   }
 
+  // The diffs and the deflates of the target files are shared by all the
+  // payloads generated in this run.
+  DiffCache diff_cache(payload_config.diff_cache_dir);
   uint64_t metadata_size;
-  if (!GenerateUpdatePayloadFile(
-          payload_config, FLAGS_out_file, FLAGS_private_key, &metadata_size)) {
+  if (!GenerateUpdatePayloadFile(payload_config,
+                                 FLAGS_out_file,
+                                 FLAGS_private_key,
+                                 &diff_cache,
+                                 &metadata_size)) {
     return 1;
   }
   if (!FLAGS_out_metadata_size_file.empty()) {
@@ -665,6 +844,45 @@ int Main(int argc, char** argv) {
                            metadata_size_string.data(),
                            metadata_size_string.size()));
   }
+
+  // The extra payloads only replace the source image, keeping the target
+  // filesystems opened and the files listed for the first payload.
+  for (size_t i = 0; i < extra_old_partitions.size(); i++) {
+    LOG(INFO) << "Generating delta update from " << extra_old_partitions[i];
+    payload_config.source = ImageConfig();
+    SetSourcePartitions(partition_names,
+                        base::SplitString(extra_old_partitions[i],
+                                          ":",
+                                          base::TRIM_WHITESPACE,
+                                          base::SPLIT_WANT_ALL),
+                        {},
+                        &payload_config.source);
+    ExpandSparseImages(&payload_config.source, &raw_image_unlinkers);
+    CHECK(payload_config.source.LoadImageSize());
+    for (PartitionConfig& part : payload_config.source.partitions) {
+      if (FLAGS_mmap_images && !part.path.empty())
+        CHECK(MappedImage::Map(part.path));
+      ScopedPhaseTimer timer(kPhaseOpenFilesystems);
+      CHECK(part.OpenFilesystem());
+    }
+    if (!payload_config.Validate()) {
+      LOG(ERROR) << "Invalid options passed. See errors above.";
+      return 1;
+    }
+    uint64_t extra_metadata_size;
+    if (!GenerateUpdatePayloadFile(payload_config,
+                                   extra_out_files[i],
+                                   FLAGS_private_key,
+                                   &diff_cache,
+                                   &extra_metadata_size)) {
+      return 1;
+    }
+  }
+  if (!FLAGS_out_timings_file.empty()) {
+    string timings = PhaseTimings::Get()->ToJson();
+    CHECK(utils::WriteFile(
+        FLAGS_out_timings_file.c_str(), timings.data(), timings.size()));
+  }
   return 0;
 }
 
@@ -17,8 +17,7 @@
 #ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_GRAPH_TYPES_H_
 #define UPDATE_ENGINE_PAYLOAD_GENERATOR_GRAPH_TYPES_H_
 
-#include <map>
-#include <set>
+#include <algorithm>
 #include <string>
 #include <utility>
 #include <vector>
@@ -50,24 +49,90 @@ struct EdgeProperties {
   }
 };
 
+// The out-edges of a vertex, keyed by the index of the vertex they point to.
+// Graphs of in-place deltas have millions of edges, so unlike a std::map,
+// which allocates a node per edge, the edges are kept sorted in a single
+// vector. Lookups are still logarithmic, but inserting or erasing an edge
+// invalidates the iterators and references to the other edges.
+class FlatEdgeMap {
+ public:
+  typedef size_t key_type;  // Vertex::Index
+  typedef EdgeProperties mapped_type;
+  typedef std::pair<key_type, EdgeProperties> value_type;
+  typedef std::vector<value_type>::iterator iterator;
+  typedef std::vector<value_type>::const_iterator const_iterator;
+  typedef std::vector<value_type>::size_type size_type;
+
+  iterator begin() { return edges_.begin(); }
+  iterator end() { return edges_.end(); }
+  const_iterator begin() const { return edges_.begin(); }
+  const_iterator end() const { return edges_.end(); }
+
+  bool empty() const { return edges_.empty(); }
+  size_type size() const { return edges_.size(); }
+  void clear() { edges_.clear(); }
+
+  iterator find(key_type key) {
+    iterator it = LowerBound(key);
+    return (it != edges_.end() && it->first == key) ? it : edges_.end();
+  }
+  const_iterator find(key_type key) const {
+    return const_cast<FlatEdgeMap*>(this)->find(key);
+  }
+  size_type count(key_type key) const { return find(key) != end() ? 1 : 0; }
+
+  // Like std::map::insert(), doesn't replace an existing edge.
+  std::pair<iterator, bool> insert(const value_type& value) {
+    iterator it = LowerBound(value.first);
+    if (it != edges_.end() && it->first == value.first)
+      return std::make_pair(it, false);
+    return std::make_pair(edges_.insert(it, value), true);
+  }
+  EdgeProperties& operator[](key_type key) {
+    return insert(value_type(key, EdgeProperties())).first->second;
+  }
+
+  iterator erase(iterator it) { return edges_.erase(it); }
+  size_type erase(key_type key) {
+    iterator it = find(key);
+    if (it == edges_.end())
+      return 0;
+    edges_.erase(it);
+    return 1;
+  }
+
+  // Releases the memory reserved for edges and extents yet to be added.
+  void shrink_to_fit() {
+    edges_.shrink_to_fit();
+    for (value_type& edge : edges_) {
+      edge.second.extents.shrink_to_fit();
+      edge.second.write_extents.shrink_to_fit();
+    }
+  }
+
+  bool operator==(const FlatEdgeMap& that) const {
+    return edges_ == that.edges_;
+  }
+
+ private:
+  iterator LowerBound(key_type key) {
+    return std::lower_bound(
+        edges_.begin(),
+        edges_.end(),
+        key,
+        [](const value_type& edge, key_type key) { return edge.first < key; });
+  }
+
+  std::vector<value_type> edges_;
+};
+
 struct Vertex {
-  Vertex() : valid(true), index(-1), lowlink(-1) {}
+  Vertex() : valid(true) {}
   bool valid;
 
-  typedef std::map<std::vector<Vertex>::size_type, EdgeProperties> EdgeMap;
+  typedef FlatEdgeMap EdgeMap;
   EdgeMap out_edges;
 
-  // We sometimes wish to consider a subgraph of a graph. A subgraph would have
-  // a subset of the vertices from the graph and a subset of the edges.
-  // When considering this vertex within a subgraph, subgraph_edges stores
-  // the out-edges.
-  typedef std::set<std::vector<Vertex>::size_type> SubgraphEdgeMap;
-  SubgraphEdgeMap subgraph_edges;
-
-  // For Tarjan's algorithm:
-  std::vector<Vertex>::size_type index;
-  std::vector<Vertex>::size_type lowlink;
-
   // Other Vertex properties:
   AnnotatedOperation aop;
 
@@ -84,7 +84,7 @@ void DropWriteBeforeDeps(Vertex::EdgeMap* edge_map) {
       it->second.write_extents.clear();
     if (it->second.extents.empty()) {
       // Erase *it, as it contains no blocks
-      edge_map->erase(it++);
+      it = edge_map->erase(it);
     } else {
       ++it;
     }
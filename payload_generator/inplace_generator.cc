@@ -30,6 +30,7 @@
 #include "update_engine/payload_generator/cycle_breaker.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
 #include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/diff_cache.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/graph_types.h"
 #include "update_engine/payload_generator/graph_utils.h"
@@ -158,7 +159,8 @@ bool InplaceGenerator::CutEdges(Graph* graph,
     cuts.back().old_src = edge.first;
     cuts.back().old_dst = edge.second;
 
-    EdgeProperties& cut_edge_properties =
+    // A copy, since adding edges to the vertex moves the others around.
+    EdgeProperties cut_edge_properties =
         (*graph)[edge.first].out_edges.find(edge.second)->second;
 
     // This should never happen, as we should only be cutting edges between
@@ -212,18 +214,16 @@ void InplaceGenerator::CreateEdges(Graph* graph, const vector<Block>& blocks) {
     // Don't have a node depend on itself
     if (blocks[i].reader == blocks[i].writer)
       continue;
-    // See if there's already an edge we can add onto
+    // Add onto the existing edge, or create one
     Vertex::EdgeMap::iterator edge_it =
-        (*graph)[blocks[i].writer].out_edges.find(blocks[i].reader);
-    if (edge_it == (*graph)[blocks[i].writer].out_edges.end()) {
-      // No existing edge. Create one
-      (*graph)[blocks[i].writer].out_edges.insert(
-          make_pair(blocks[i].reader, EdgeProperties()));
-      edge_it = (*graph)[blocks[i].writer].out_edges.find(blocks[i].reader);
-      CHECK(edge_it != (*graph)[blocks[i].writer].out_edges.end());
-    }
+        (*graph)[blocks[i].writer]
+            .out_edges.insert(make_pair(blocks[i].reader, EdgeProperties()))
+            .first;
     AppendBlockToExtents(&edge_it->second.extents, i);
   }
+  // The edges are only added to later by CutEdges(), one at a time.
+  for (Vertex& vertex : *graph)
+    vertex.out_edges.shrink_to_fit();
 }
 
 namespace {
@@ -563,6 +563,8 @@ bool InplaceGenerator::ConvertCutToFullOp(Graph* graph,
         (*graph)[cut.old_dst].aop.name,
         -1,  // chunk_blocks, forces to have a single operation.
         kInPlacePayloadVersion,
+        diff_utils::DiffSettings(),
+        nullptr,  // diff_cache
         blob_file));
     TEST_AND_RETURN_FALSE(new_aop.size() == 1);
     TEST_AND_RETURN_FALSE(AddInstallOpToGraph(
@@ -775,18 +777,26 @@ bool InplaceGenerator::GenerateOperations(const PayloadGenerationConfig& config,
            ? -1
            : config.hard_chunk_size / config.block_size);
   size_t soft_chunk_blocks = config.soft_chunk_size / config.block_size;
+  diff_utils::DiffSettings settings =
+      diff_utils::GetDiffSettings(config.profile);
+  settings.apply_cost = diff_utils::GetApplyCostModel(config.device_class);
   uint64_t partition_size = new_part.size;
   if (new_part.name == kPartitionNameRoot)
     partition_size = config.rootfs_partition_size;
 
   LOG(INFO) << "Delta compressing " << new_part.name << " partition...";
-  TEST_AND_RETURN_FALSE(diff_utils::DeltaReadPartition(aops,
-                                                       old_part,
-                                                       new_part,
-                                                       hard_chunk_blocks,
-                                                       soft_chunk_blocks,
-                                                       config.version,
-                                                       blob_file));
+  TEST_AND_RETURN_FALSE(
+      diff_utils::DeltaReadPartition(aops,
+                                     old_part,
+                                     new_part,
+                                     hard_chunk_blocks,
+                                     soft_chunk_blocks,
+                                     config.content_defined_chunking,
+                                     config.memory_budget,
+                                     config.version,
+                                     settings,
+                                     diff_cache_,
+                                     blob_file));
   LOG(INFO) << "Done reading " << new_part.name;
 
   TEST_AND_RETURN_FALSE(ResolveReadAfterWriteDependencies(
@@ -24,6 +24,7 @@
 
 #include "update_engine/payload_generator/blob_file_writer.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/diff_cache.h"
 #include "update_engine/payload_generator/graph_types.h"
 #include "update_engine/payload_generator/operations_generator.h"
 
@@ -66,7 +67,8 @@ class InplaceGenerator : public OperationsGenerator {
     Vertex::Index writer;
   };
 
-  InplaceGenerator() = default;
+  // The diffs are reused from and stored in the |diff_cache|, if not null.
+  explicit InplaceGenerator(DiffCache* diff_cache) : diff_cache_(diff_cache) {}
 
   // Checks all the operations in the graph have a type assigned.
   static void CheckGraph(const Graph& graph);
@@ -232,6 +234,8 @@ class InplaceGenerator : public OperationsGenerator {
                           std::vector<AnnotatedOperation>* aops) override;
 
  private:
+  DiffCache* diff_cache_;
+
   DISALLOW_COPY_AND_ASSIGN(InplaceGenerator);
 };
 
@@ -110,7 +110,9 @@ class InplaceGeneratorTest : public ::testing::Test {
   // the test finishes.
   void CreateBlobFile() {
     // blob_fd_closer_ takes a pointer to blob_fd_. Make sure we destroy a
-    // previous instance before overriding blob_fd_.
+    // previous instance before overriding blob_fd_, and the writer of the
+    // previous file before closing it.
+    blob_file_.reset();
     blob_fd_closer_.reset();
     EXPECT_TRUE(utils::MakeTempFile(
         "InplaceGenerator_blob_file.XXXXXX", &blob_path_, &blob_fd_));
@@ -136,9 +138,11 @@ class InplaceGeneratorTest : public ::testing::Test {
   string blob_path_;
   int blob_fd_{-1};
   off_t blob_file_size_{0};
-  std::unique_ptr<BlobFileWriter> blob_file_;
   std::unique_ptr<ScopedPathUnlinker> blob_path_unlinker_;
   std::unique_ptr<ScopedFdCloser> blob_fd_closer_;
+  // Destroyed first, so the stored blobs are written before the file is
+  // closed.
+  std::unique_ptr<BlobFileWriter> blob_file_;
 };
 
 TEST_F(InplaceGeneratorTest, BlockDefaultValues) {
@@ -0,0 +1,56 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/lz4.h"
+
+#include <lz4frame.h>
+#include <lz4hc.h>
+
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+bool Lz4Compress(const brillo::Blob& in, brillo::Blob* out) {
+  TEST_AND_RETURN_FALSE(out);
+  out->clear();
+  if (in.empty())
+    return true;
+
+  // The slowest compression level doesn't make the decompression any slower.
+  // The blocks are linked so each one can reference the previous ones, and
+  // the operation data is already covered by a SHA-256 hash in the payload,
+  // so the frame doesn't need a checksum of its own.
+  LZ4F_preferences_t preferences = {};
+  preferences.frameInfo.blockSizeID = LZ4F_max4MB;
+  preferences.frameInfo.blockMode = LZ4F_blockLinked;
+  preferences.frameInfo.contentChecksumFlag = LZ4F_noContentChecksum;
+  preferences.frameInfo.contentSize = in.size();
+  preferences.compressionLevel = LZ4HC_CLEVEL_MAX;
+
+  out->resize(LZ4F_compressFrameBound(in.size(), &preferences));
+  size_t size = LZ4F_compressFrame(
+      out->data(), out->size(), in.data(), in.size(), &preferences);
+  if (LZ4F_isError(size)) {
+    LOG(ERROR) << "LZ4F_compressFrame failed: " << LZ4F_getErrorName(size);
+    out->clear();
+    return false;
+  }
+  out->resize(size);
+  return true;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,177 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/mapped_image.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <map>
+#include <utility>
+
+#include <base/logging.h>
+#include <base/synchronization/lock.h>
+
+#include "update_engine/common/utils.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+using MappedImageMap = std::map<string, std::unique_ptr<MappedImage>>;
+
+// The files mapped with MappedImage::Map(), protected by MappedImagesLock().
+MappedImageMap* MappedImages() {
+  static auto* mapped_images = new MappedImageMap;
+  return mapped_images;
+}
+
+base::Lock* MappedImagesLock() {
+  static auto* lock = new base::Lock;
+  return lock;
+}
+
+}  // namespace
+
+MappedImage::~MappedImage() {
+  if (size_ > 0)
+    munmap(const_cast<uint8_t*>(data_), size_);
+}
+
+std::unique_ptr<MappedImage> MappedImage::Create(const string& path) {
+  int fd = HANDLE_EINTR(open(path.c_str(), O_RDONLY));
+  if (fd < 0) {
+    PLOG(ERROR) << "Unable to open " << path;
+    return nullptr;
+  }
+  ScopedFdCloser fd_closer(&fd);
+  off_t size = utils::FileSize(fd);
+  if (size < 0) {
+    LOG(ERROR) << "Unable to get the size of " << path;
+    return nullptr;
+  }
+  // Empty files can't be mapped, but have no data to read either.
+  if (size == 0)
+    return std::unique_ptr<MappedImage>(new MappedImage(nullptr, 0));
+
+  void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    PLOG(ERROR) << "Unable to map " << path;
+    return nullptr;
+  }
+  return std::unique_ptr<MappedImage>(
+      new MappedImage(static_cast<const uint8_t*>(data), size));
+}
+
+bool MappedImage::Map(const string& path) {
+  std::unique_ptr<MappedImage> image = Create(path);
+  TEST_AND_RETURN_FALSE(image);
+  LOG(INFO) << "Mapped " << path << " (" << image->size() << " bytes)";
+  base::AutoLock auto_lock(*MappedImagesLock());
+  (*MappedImages())[path] = std::move(image);
+  return true;
+}
+
+const MappedImage* MappedImage::Get(const string& path) {
+  base::AutoLock auto_lock(*MappedImagesLock());
+  auto it = MappedImages()->find(path);
+  return it == MappedImages()->end() ? nullptr : it->second.get();
+}
+
+void MappedImage::UnmapAll() {
+  base::AutoLock auto_lock(*MappedImagesLock());
+  MappedImages()->clear();
+}
+
+const uint8_t* MappedImage::GetExtentData(const Extent& extent,
+                                          size_t block_size) const {
+  // Accessing the mapping past the end of the file would raise SIGBUS.
+  uint64_t end_block = extent.start_block() + extent.num_blocks();
+  if (end_block < extent.start_block() || end_block > size_ / block_size)
+    return nullptr;
+  return data_ + extent.start_block() * block_size;
+}
+
+const uint8_t* MappedImage::GetContiguousData(const vector<Extent>& extents,
+                                              size_t block_size) const {
+  if (extents.empty())
+    return nullptr;
+  for (size_t i = 1; i < extents.size(); i++) {
+    if (extents[i].start_block() !=
+        extents[i - 1].start_block() + extents[i - 1].num_blocks()) {
+      return nullptr;
+    }
+  }
+  Extent extent;
+  extent.set_start_block(extents.front().start_block());
+  extent.set_num_blocks(extents.back().start_block() +
+                        extents.back().num_blocks() -
+                        extents.front().start_block());
+  return GetExtentData(extent, block_size);
+}
+
+bool ReadImageExtents(const string& path,
+                      const vector<Extent>& extents,
+                      brillo::Blob* out_data,
+                      ssize_t out_data_size,
+                      size_t block_size) {
+  const MappedImage* image = MappedImage::Get(path);
+  if (!image) {
+    return utils::ReadExtents(
+        path, extents, out_data, out_data_size, block_size);
+  }
+
+  TEST_AND_RETURN_FALSE(out_data_size >= 0);
+  TEST_AND_RETURN_FALSE(utils::BlocksInExtents(extents) * block_size ==
+                        static_cast<uint64_t>(out_data_size));
+  out_data->resize(out_data_size);
+  uint8_t* data = out_data->data();
+  for (const Extent& extent : extents) {
+    const uint8_t* extent_data = image->GetExtentData(extent, block_size);
+    TEST_AND_RETURN_FALSE(extent_data);
+    size_t bytes = extent.num_blocks() * block_size;
+    memcpy(data, extent_data, bytes);
+    data += bytes;
+  }
+  return true;
+}
+
+bool ImageExtentsData::Load(const string& path,
+                            const vector<Extent>& extents,
+                            ssize_t data_size,
+                            size_t block_size) {
+  const MappedImage* image = MappedImage::Get(path);
+  const uint8_t* data =
+      image ? image->GetContiguousData(extents, block_size) : nullptr;
+  if (data && utils::BlocksInExtents(extents) * block_size ==
+                  static_cast<uint64_t>(data_size)) {
+    blob_.clear();
+    data_ = data;
+    size_ = data_size;
+    return true;
+  }
+  TEST_AND_RETURN_FALSE(
+      ReadImageExtents(path, extents, &blob_, data_size, block_size));
+  data_ = blob_.data();
+  size_ = blob_.size();
+  return true;
+}
+
+}  // namespace chromeos_update_engine
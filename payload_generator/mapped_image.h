@@ -0,0 +1,114 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_MAPPED_IMAGE_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_MAPPED_IMAGE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// A read-only memory mapping of an image file. The images mapped with Map()
+// are used by all the reads with ReadImageExtents() and ImageExtentsData while
+// generating a payload, which copy the data from the mapping, or don't copy it
+// at all, instead of reading it with pread() in freshly allocated buffers.
+class MappedImage {
+ public:
+  ~MappedImage();
+
+  // Maps the file |path|, or returns nullptr on errors.
+  static std::unique_ptr<MappedImage> Create(const std::string& path);
+
+  // Maps the file |path| for the rest of the process, so the reads of its
+  // extents use the mapping. Returns whether it succeeded.
+  static bool Map(const std::string& path);
+
+  // Returns the mapping of |path| created with Map(), or nullptr if there is
+  // none.
+  static const MappedImage* Get(const std::string& path);
+
+  // Unmaps all the files mapped with Map().
+  static void UnmapAll();
+
+  // Returns the data of the |extent| of |block_size| blocks, or nullptr if it
+  // is past the end of the file.
+  const uint8_t* GetExtentData(const Extent& extent, size_t block_size) const;
+
+  // Returns the data of the |extents| of |block_size| blocks if they are
+  // contiguous in the file, or nullptr otherwise.
+  const uint8_t* GetContiguousData(const std::vector<Extent>& extents,
+                                   size_t block_size) const;
+
+  uint64_t size() const { return size_; }
+
+ private:
+  MappedImage(const uint8_t* data, uint64_t size) : data_(data), size_(size) {}
+
+  const uint8_t* data_;
+  uint64_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(MappedImage);
+};
+
+// Reads the |extents| of the image file |path| like utils::ReadExtents(), but
+// copies them from the mapping of |path| if it was mapped with
+// MappedImage::Map().
+bool ReadImageExtents(const std::string& path,
+                      const std::vector<Extent>& extents,
+                      brillo::Blob* out_data,
+                      ssize_t out_data_size,
+                      size_t block_size);
+
+// The read-only data of some extents of an image file. When the file was
+// mapped with MappedImage::Map() and the extents are contiguous, the data
+// points to the mapping without copying it.
+class ImageExtentsData {
+ public:
+  ImageExtentsData() = default;
+
+  // Loads the |extents| of the image file |path|, with the same arguments as
+  // ReadImageExtents().
+  bool Load(const std::string& path,
+            const std::vector<Extent>& extents,
+            ssize_t data_size,
+            size_t block_size);
+
+  const uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const uint8_t* data_{nullptr};
+  size_t size_{0};
+
+  // The copy of the data, if it doesn't point to a mapping.
+  brillo::Blob blob_;
+
+  DISALLOW_COPY_AND_ASSIGN(ImageExtentsData);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_MAPPED_IMAGE_H_
@@ -0,0 +1,111 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/mapped_image.h"
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+class MappedImageTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    data_.resize(kNumBlocks * kBlockSize);
+    test_utils::FillWithData(&data_);
+    ASSERT_TRUE(test_utils::WriteFileVector(image_.path(), data_));
+  }
+
+  void TearDown() override { MappedImage::UnmapAll(); }
+
+  // Returns the data of |extents| in |data_|.
+  brillo::Blob ExpectedData(const vector<Extent>& extents) {
+    brillo::Blob expected;
+    for (const Extent& extent : extents) {
+      expected.insert(expected.end(),
+                      data_.begin() + extent.start_block() * kBlockSize,
+                      data_.begin() + (extent.start_block() +
+                                       extent.num_blocks()) * kBlockSize);
+    }
+    return expected;
+  }
+
+  static const size_t kBlockSize = 4096;
+  static const size_t kNumBlocks = 16;
+
+  test_utils::ScopedTempFile image_{"MappedImageTest.XXXXXX"};
+  brillo::Blob data_;
+};
+
+TEST_F(MappedImageTest, ReadImageExtentsTest) {
+  const vector<Extent> extents = {ExtentForRange(10, 2),
+                                  ExtentForRange(1, 3)};
+  brillo::Blob read_data;
+  // Without a mapping the data is read from the file.
+  EXPECT_TRUE(ReadImageExtents(
+      image_.path(), extents, &read_data, 5 * kBlockSize, kBlockSize));
+  EXPECT_EQ(ExpectedData(extents), read_data);
+
+  ASSERT_TRUE(MappedImage::Map(image_.path()));
+  ASSERT_NE(nullptr, MappedImage::Get(image_.path()));
+  read_data.clear();
+  EXPECT_TRUE(ReadImageExtents(
+      image_.path(), extents, &read_data, 5 * kBlockSize, kBlockSize));
+  EXPECT_EQ(ExpectedData(extents), read_data);
+
+  // The size must match the extents, and they must be inside the file.
+  EXPECT_FALSE(ReadImageExtents(
+      image_.path(), extents, &read_data, 4 * kBlockSize, kBlockSize));
+  EXPECT_FALSE(ReadImageExtents(image_.path(),
+                                {ExtentForRange(kNumBlocks - 1, 2)},
+                                &read_data,
+                                2 * kBlockSize,
+                                kBlockSize));
+}
+
+TEST_F(MappedImageTest, ContiguousExtentsAreNotCopiedTest) {
+  ASSERT_TRUE(MappedImage::Map(image_.path()));
+  const MappedImage* image = MappedImage::Get(image_.path());
+  ASSERT_NE(nullptr, image);
+
+  const vector<Extent> contiguous = {ExtentForRange(2, 3),
+                                     ExtentForRange(5, 4)};
+  ImageExtentsData data;
+  EXPECT_TRUE(data.Load(image_.path(), contiguous, 7 * kBlockSize, kBlockSize));
+  EXPECT_EQ(image->GetContiguousData(contiguous, kBlockSize), data.data());
+  EXPECT_EQ(ExpectedData(contiguous),
+            brillo::Blob(data.data(), data.data() + data.size()));
+
+  // Discontiguous extents are copied.
+  const vector<Extent> discontiguous = {ExtentForRange(5, 4),
+                                        ExtentForRange(2, 3)};
+  EXPECT_EQ(nullptr, image->GetContiguousData(discontiguous, kBlockSize));
+  EXPECT_TRUE(
+      data.Load(image_.path(), discontiguous, 7 * kBlockSize, kBlockSize));
+  EXPECT_EQ(ExpectedData(discontiguous),
+            brillo::Blob(data.data(), data.data() + data.size()));
+}
+
+}  // namespace chromeos_update_engine
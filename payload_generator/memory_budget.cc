@@ -0,0 +1,40 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/memory_budget.h"
+
+#include <base/logging.h>
+
+namespace chromeos_update_engine {
+
+MemoryBudget::MemoryBudget(uint64_t budget)
+    : budget_(budget), released_(&lock_) {}
+
+void MemoryBudget::Acquire(uint64_t size) {
+  base::AutoLock auto_lock(lock_);
+  while (used_ > 0 && used_ + size > budget_)
+    released_.Wait();
+  used_ += size;
+}
+
+void MemoryBudget::Release(uint64_t size) {
+  base::AutoLock auto_lock(lock_);
+  CHECK_GE(used_, size);
+  used_ -= size;
+  released_.Broadcast();
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,61 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_MEMORY_BUDGET_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_MEMORY_BUDGET_H_
+
+#include <stdint.h>
+
+#include <base/macros.h>
+#include <base/synchronization/condition_variable.h>
+#include <base/synchronization/lock.h>
+
+namespace chromeos_update_engine {
+
+// MemoryBudget limits the memory used by the jobs running concurrently in a
+// thread pool. Each job acquires the memory it is estimated to use before it
+// starts, and waits until enough of the budget is released by the jobs that
+// are done. A job estimated to use more than the whole budget runs once no
+// other job holds any of it, so all the jobs eventually run.
+class MemoryBudget {
+ public:
+  // Creates a budget of |budget| bytes.
+  explicit MemoryBudget(uint64_t budget);
+
+  // Blocks until |size| bytes of the budget are available and takes them.
+  void Acquire(uint64_t size);
+
+  // Returns the |size| bytes taken by a previous call to Acquire().
+  void Release(uint64_t size);
+
+ private:
+  const uint64_t budget_;
+
+  // Protects |used_|.
+  base::Lock lock_;
+
+  // Signaled when part of the budget is released.
+  base::ConditionVariable released_;
+
+  // The number of bytes of the budget currently taken.
+  uint64_t used_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(MemoryBudget);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_MEMORY_BUDGET_H_
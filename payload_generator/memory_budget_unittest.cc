@@ -0,0 +1,110 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/memory_budget.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <base/synchronization/lock.h>
+#include <base/threading/simple_thread.h>
+#include <gtest/gtest.h>
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// A job that records the largest amount of memory held by the jobs running
+// at the same time.
+class BudgetJob : public base::DelegateSimpleThread::Delegate {
+ public:
+  BudgetJob(MemoryBudget* budget,
+            uint64_t size,
+            base::Lock* lock,
+            uint64_t* used,
+            uint64_t* max_used)
+      : budget_(budget),
+        size_(size),
+        lock_(lock),
+        used_(used),
+        max_used_(max_used) {}
+
+  void Run() override {
+    budget_->Acquire(size_);
+    {
+      base::AutoLock auto_lock(*lock_);
+      *used_ += size_;
+      *max_used_ = std::max(*max_used_, *used_);
+    }
+    {
+      base::AutoLock auto_lock(*lock_);
+      *used_ -= size_;
+    }
+    budget_->Release(size_);
+  }
+
+ private:
+  MemoryBudget* budget_;
+  uint64_t size_;
+  base::Lock* lock_;
+  uint64_t* used_;
+  uint64_t* max_used_;
+};
+
+}  // namespace
+
+class MemoryBudgetTest : public ::testing::Test {};
+
+TEST(MemoryBudgetTest, AcquireWithinBudgetTest) {
+  MemoryBudget budget(100);
+  budget.Acquire(40);
+  budget.Acquire(60);
+  budget.Release(40);
+  budget.Acquire(40);
+  budget.Release(100);
+}
+
+TEST(MemoryBudgetTest, OversizedAcquireRunsAloneTest) {
+  MemoryBudget budget(100);
+  // Nothing else holds the budget, so this doesn't wait.
+  budget.Acquire(250);
+  budget.Release(250);
+}
+
+TEST(MemoryBudgetTest, ConcurrentJobsStayWithinBudgetTest) {
+  const uint64_t kBudget = 100;
+  MemoryBudget budget(kBudget);
+  base::Lock lock;
+  uint64_t used = 0;
+  uint64_t max_used = 0;
+  vector<BudgetJob> jobs;
+  for (uint64_t i = 0; i < 64; i++)
+    jobs.emplace_back(&budget, 10 + i % 5 * 20, &lock, &used, &max_used);
+
+  base::DelegateSimpleThreadPool thread_pool("memory-budget-test", 8);
+  thread_pool.Start();
+  for (BudgetJob& job : jobs)
+    thread_pool.AddWork(&job);
+  thread_pool.JoinAll();
+
+  EXPECT_EQ(0U, used);
+  EXPECT_LE(max_used, kBudget);
+  EXPECT_GT(max_used, 0U);
+}
+
+}  // namespace chromeos_update_engine
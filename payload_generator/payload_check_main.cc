@@ -0,0 +1,120 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <base/logging.h>
+#include <base/strings/string_split.h>
+#include <brillo/flag_helper.h>
+
+#include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/payload_checker.h"
+
+// This file contains a program that checks a payload without applying it, so
+// payloads can be validated before they are released.
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+int Main(int argc, char** argv) {
+  DEFINE_string(payload, "", "Path to the payload to check");
+  DEFINE_string(public_key,
+                "",
+                "Path to the public key in .pem format to verify the "
+                "signatures with. The signatures aren't checked if empty.");
+  DEFINE_string(partition_names,
+                "",
+                "Names of the partitions of the --old_partitions, separated "
+                "by ':'.");
+  DEFINE_string(old_partitions,
+                "",
+                "Paths to the source partition images, separated by ':'. "
+                "The source hashes of the operations are checked against "
+                "them.");
+  DEFINE_int32(threads,
+               0,
+               "Number of threads checking the operations, or 0 to use the "
+               "number of CPUs.");
+
+  brillo::FlagHelper::Init(
+      argc,
+      argv,
+      "Checks an update payload without applying it.\n\n"
+      "Verifies its signatures, that its operations fit in their partitions "
+      "and the hashes of their data and, optionally, source data.");
+  logging::LoggingSettings log_settings;
+  log_settings.logging_dest = logging::LOG_TO_SYSTEM_DEBUG_LOG;
+  logging::InitLogging(log_settings);
+
+  LOG_IF(FATAL, FLAGS_payload.empty()) << "Must pass --payload.";
+  CHECK_GE(FLAGS_threads, 0);
+
+  std::map<string, string> source_paths;
+  if (!FLAGS_old_partitions.empty()) {
+    vector<string> partition_names = base::SplitString(FLAGS_partition_names,
+                                                       ":",
+                                                       base::TRIM_WHITESPACE,
+                                                       base::SPLIT_WANT_ALL);
+    vector<string> old_partitions = base::SplitString(FLAGS_old_partitions,
+                                                      ":",
+                                                      base::TRIM_WHITESPACE,
+                                                      base::SPLIT_WANT_ALL);
+    LOG_IF(FATAL, partition_names.size() != old_partitions.size())
+        << "--partition_names and --old_partitions must have the same number "
+        << "of partitions.";
+    for (size_t i = 0; i < partition_names.size(); i++)
+      source_paths[partition_names[i]] = old_partitions[i];
+  }
+
+  PayloadChecker checker(FLAGS_payload);
+  if (!checker.Init()) {
+    LOG(ERROR) << "Failed to parse the payload " << FLAGS_payload;
+    return 1;
+  }
+  bool success = true;
+  if (!FLAGS_public_key.empty()) {
+    if (checker.CheckSignatures(FLAGS_public_key)) {
+      LOG(INFO) << "The signatures are valid.";
+    } else {
+      LOG(ERROR) << "The signatures are invalid.";
+      success = false;
+    }
+  }
+  size_t max_threads = FLAGS_threads > 0 ? FLAGS_threads
+                                         : diff_utils::GetMaxThreads();
+  if (checker.CheckOperations(source_paths, max_threads)) {
+    LOG(INFO) << "The operations are valid.";
+  } else {
+    LOG(ERROR) << "Some operations are invalid. See errors above.";
+    success = false;
+  }
+  return success ? 0 : 1;
+}
+
+}  // namespace
+
+}  // namespace chromeos_update_engine
+
+int main(int argc, char** argv) {
+  return chromeos_update_engine::Main(argc, argv);
+}
@@ -0,0 +1,337 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/payload_checker.h"
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <base/posix/eintr_wrapper.h>
+#include <base/threading/simple_thread.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/packed_extents.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/mapped_image.h"
+#include "update_engine/payload_generator/payload_signer.h"
+
+using google::protobuf::RepeatedPtrField;
+using std::map;
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The number of ranges of operations checked by each thread. Smaller ranges
+// balance the work better when some operations have much bigger blobs.
+const size_t kRangesPerThread = 4;
+
+// The operations of a partition and what they are checked against.
+struct PartitionToCheck {
+  string name;
+  const RepeatedPtrField<InstallOperation>* operations;
+  // The size of the old and new partitions, or 0 if unknown.
+  uint64_t old_size;
+  uint64_t new_size;
+  // The source image of the partition, or null if not given.
+  const string* source_path;
+};
+
+// An operation to check, with its partition.
+struct OperationToCheck {
+  const PartitionToCheck* partition;
+  int index;
+};
+
+// Checks a range of operations, reading their data blobs from the payload and
+// their source data from the source images.
+class OperationCheckProcessor : public base::DelegateSimpleThread::Delegate {
+ public:
+  OperationCheckProcessor(const string& payload_path,
+                          const DeltaArchiveManifest& manifest,
+                          uint64_t blobs_offset,
+                          uint64_t blobs_size,
+                          const OperationToCheck* begin,
+                          const OperationToCheck* end)
+      : payload_path_(payload_path),
+        manifest_(manifest),
+        blobs_offset_(blobs_offset),
+        blobs_size_(blobs_size),
+        begin_(begin),
+        end_(end) {}
+  OperationCheckProcessor(OperationCheckProcessor&&) = default;
+  ~OperationCheckProcessor() override = default;
+
+  // Overrides DelegateSimpleThread::Delegate.
+  void Run() override;
+
+  bool success() const { return success_; }
+
+ private:
+  // Checks the operation |op| of the |partition|, reading its data blob from
+  // the payload |fd|. Logs the errors as the operation |name|.
+  bool CheckOperation(int fd,
+                      const PartitionToCheck& partition,
+                      const InstallOperation& op,
+                      const string& name);
+
+  const string& payload_path_;
+  const DeltaArchiveManifest& manifest_;
+  uint64_t blobs_offset_;
+  uint64_t blobs_size_;
+  const OperationToCheck* begin_;
+  const OperationToCheck* end_;
+  bool success_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(OperationCheckProcessor);
+};
+
+// Returns whether the |extents| fit in a partition of |partition_size| bytes,
+// if known, of blocks of |block_size| bytes.
+bool ExtentsFit(const RepeatedPtrField<Extent>& extents,
+                uint64_t partition_size,
+                uint64_t block_size) {
+  if (partition_size == 0)
+    return true;
+  const uint64_t num_blocks = partition_size / block_size;
+  for (const Extent& extent : extents) {
+    if (extent.start_block() == kSparseHole)
+      continue;
+    if (extent.start_block() > num_blocks ||
+        extent.num_blocks() > num_blocks - extent.start_block())
+      return false;
+  }
+  return true;
+}
+
+bool OperationCheckProcessor::CheckOperation(int fd,
+                                             const PartitionToCheck& partition,
+                                             const InstallOperation& op,
+                                             const string& name) {
+  const uint64_t block_size = manifest_.block_size();
+  if (op.dst_extents_size() == 0) {
+    LOG(ERROR) << name << " has no destination extents.";
+    return false;
+  }
+  if (!ExtentsFit(op.dst_extents(), partition.new_size, block_size)) {
+    LOG(ERROR) << name << " writes past the end of the partition.";
+    return false;
+  }
+  if (!ExtentsFit(op.src_extents(), partition.old_size, block_size)) {
+    LOG(ERROR) << name << " reads past the end of the source partition.";
+    return false;
+  }
+
+  if (op.data_length() > 0) {
+    if (op.data_offset() > blobs_size_ ||
+        op.data_length() > blobs_size_ - op.data_offset()) {
+      LOG(ERROR) << name << " has a data blob past the end of the payload.";
+      return false;
+    }
+    if (!op.has_data_sha256_hash()) {
+      LOG(ERROR) << name << " has no data hash.";
+      return false;
+    }
+    brillo::Blob blob(op.data_length());
+    ssize_t bytes_read;
+    if (!utils::PReadAll(fd,
+                         blob.data(),
+                         blob.size(),
+                         blobs_offset_ + op.data_offset(),
+                         &bytes_read) ||
+        bytes_read != static_cast<ssize_t>(blob.size())) {
+      LOG(ERROR) << "Failed to read the data blob of " << name;
+      return false;
+    }
+    brillo::Blob hash;
+    if (!HashCalculator::RawHashOfData(blob, &hash) ||
+        hash != brillo::Blob(op.data_sha256_hash().begin(),
+                             op.data_sha256_hash().end())) {
+      LOG(ERROR) << name << " doesn't match its data hash.";
+      return false;
+    }
+  }
+
+  if (partition.source_path && op.has_src_sha256_hash()) {
+    vector<Extent> src_extents;
+    ExtentsToVector(op.src_extents(), &src_extents);
+    uint64_t src_length = op.has_src_length()
+                              ? op.src_length()
+                              : utils::BlocksInExtents(src_extents) *
+                                    block_size;
+    ImageExtentsData src_data;
+    brillo::Blob src_hash;
+    if (!src_data.Load(
+            *partition.source_path, src_extents, src_length, block_size) ||
+        !HashCalculator::RawHashOfBytes(
+            src_data.data(), src_data.size(), &src_hash)) {
+      LOG(ERROR) << "Failed to hash the source data of " << name;
+      return false;
+    }
+    if (src_hash != brillo::Blob(op.src_sha256_hash().begin(),
+                                 op.src_sha256_hash().end())) {
+      LOG(ERROR) << name << " doesn't match its source hash.";
+      return false;
+    }
+  }
+  return true;
+}
+
+void OperationCheckProcessor::Run() {
+  int fd = HANDLE_EINTR(open(payload_path_.c_str(), O_RDONLY));
+  if (fd < 0) {
+    PLOG(ERROR) << "Failed to open " << payload_path_;
+    return;
+  }
+  ScopedFdCloser fd_closer(&fd);
+  bool success = true;
+  for (const OperationToCheck* it = begin_; it != end_; ++it) {
+    const InstallOperation& op = it->partition->operations->Get(it->index);
+    // The signature blob has no hash, it is checked with the signatures.
+    if (manifest_.has_signatures_offset() && !op.has_data_sha256_hash() &&
+        op.data_offset() == manifest_.signatures_offset() &&
+        op.data_length() == manifest_.signatures_size())
+      continue;
+    const string name = it->partition->name + " operation " +
+                        std::to_string(it->index) + " (" +
+                        InstallOperationTypeName(op.type()) + ")";
+    // Keep going, so all the invalid operations are logged.
+    if (!CheckOperation(fd, *it->partition, op, name))
+      success = false;
+  }
+  success_ = success;
+}
+
+}  // namespace
+
+bool PayloadChecker::Init() {
+  brillo::Blob header;
+  TEST_AND_RETURN_FALSE(
+      utils::ReadFileChunk(payload_path_, 0, kMaxPayloadHeaderSize, &header));
+  TEST_AND_RETURN_FALSE(metadata_.ParsePayloadHeader(header));
+  brillo::Blob metadata;
+  TEST_AND_RETURN_FALSE(utils::ReadFileChunk(
+      payload_path_, 0, metadata_.GetMetadataSize(), &metadata));
+  TEST_AND_RETURN_FALSE(metadata.size() == metadata_.GetMetadataSize());
+  TEST_AND_RETURN_FALSE(metadata_.GetManifest(metadata, &manifest_));
+
+  for (InstallOperation& op : *manifest_.mutable_install_operations())
+    TEST_AND_RETURN_FALSE(UnpackOperationExtents(&op));
+  for (InstallOperation& op : *manifest_.mutable_kernel_install_operations())
+    TEST_AND_RETURN_FALSE(UnpackOperationExtents(&op));
+  for (PartitionUpdate& partition : *manifest_.mutable_partitions()) {
+    for (InstallOperation& op : *partition.mutable_operations())
+      TEST_AND_RETURN_FALSE(UnpackOperationExtents(&op));
+  }
+
+  blobs_offset_ =
+      metadata_.GetMetadataSize() + metadata_.GetMetadataSignatureSize();
+  const off_t payload_size = utils::FileSize(payload_path_);
+  TEST_AND_RETURN_FALSE(payload_size >= 0 &&
+                        static_cast<uint64_t>(payload_size) >= blobs_offset_);
+  blobs_size_ = payload_size - blobs_offset_;
+  if (manifest_.has_signatures_offset()) {
+    TEST_AND_RETURN_FALSE(manifest_.signatures_offset() <= blobs_size_);
+    blobs_size_ = manifest_.signatures_offset();
+  }
+  LOG(INFO) << "Payload " << payload_path_ << ": major version "
+            << metadata_.GetMajorVersion() << ", minor version "
+            << manifest_.minor_version() << ", " << blobs_size_
+            << " bytes of data blobs.";
+  return true;
+}
+
+bool PayloadChecker::CheckSignatures(const string& public_key_path) const {
+  if (!manifest_.has_signatures_offset()) {
+    LOG(ERROR) << "The payload " << payload_path_ << " isn't signed.";
+    return false;
+  }
+  return PayloadSigner::VerifySignedPayload(payload_path_, public_key_path);
+}
+
+bool PayloadChecker::CheckOperations(const map<string, string>& source_paths,
+                                     size_t max_threads) const {
+  vector<PartitionToCheck> partitions;
+  if (metadata_.GetMajorVersion() == kChromeOSMajorPayloadVersion) {
+    partitions.push_back({kPartitionNameRoot,
+                          &manifest_.install_operations(),
+                          manifest_.old_rootfs_info().size(),
+                          manifest_.new_rootfs_info().size(),
+                          nullptr});
+    partitions.push_back({kPartitionNameKernel,
+                          &manifest_.kernel_install_operations(),
+                          manifest_.old_kernel_info().size(),
+                          manifest_.new_kernel_info().size(),
+                          nullptr});
+  } else {
+    for (const PartitionUpdate& partition : manifest_.partitions()) {
+      partitions.push_back({partition.partition_name(),
+                            &partition.operations(),
+                            partition.old_partition_info().size(),
+                            partition.new_partition_info().size(),
+                            nullptr});
+    }
+  }
+  for (PartitionToCheck& partition : partitions) {
+    auto it = source_paths.find(partition.name);
+    if (it != source_paths.end())
+      partition.source_path = &it->second;
+  }
+
+  vector<OperationToCheck> operations;
+  for (const PartitionToCheck& partition : partitions) {
+    for (int i = 0; i < partition.operations->size(); i++)
+      operations.push_back({&partition, i});
+  }
+  LOG(INFO) << "Checking " << operations.size() << " operations.";
+  if (operations.empty())
+    return true;
+
+  max_threads = std::max(max_threads, static_cast<size_t>(1));
+  size_t range_size =
+      utils::DivRoundUp(operations.size(), max_threads * kRangesPerThread);
+  vector<OperationCheckProcessor> processors;
+  processors.reserve(utils::DivRoundUp(operations.size(), range_size));
+  for (size_t i = 0; i < operations.size(); i += range_size) {
+    size_t end = std::min(i + range_size, operations.size());
+    processors.emplace_back(payload_path_,
+                            manifest_,
+                            blobs_offset_,
+                            blobs_size_,
+                            operations.data() + i,
+                            operations.data() + end);
+  }
+
+  base::DelegateSimpleThreadPool thread_pool("payload-check", max_threads);
+  thread_pool.Start();
+  for (OperationCheckProcessor& processor : processors)
+    thread_pool.AddWork(&processor);
+  thread_pool.JoinAll();
+
+  bool success = true;
+  for (const OperationCheckProcessor& processor : processors)
+    success = success && processor.success();
+  return success;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,77 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_PAYLOAD_CHECKER_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_PAYLOAD_CHECKER_H_
+
+#include <map>
+#include <string>
+
+#include <base/macros.h>
+
+#include "update_engine/payload_consumer/payload_metadata.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// PayloadChecker verifies a payload file without applying it: its signatures,
+// the extents of its operations and the hashes of their data blobs and, when
+// the source images are given, of their source data. The operations are
+// checked by several threads, each reading its own part of the payload.
+class PayloadChecker {
+ public:
+  explicit PayloadChecker(const std::string& payload_path)
+      : payload_path_(payload_path) {}
+
+  // Reads and parses the metadata of the payload. Must be called before the
+  // other methods.
+  bool Init();
+
+  // Verifies the payload and metadata signatures with the public key at
+  // |public_key_path|.
+  bool CheckSignatures(const std::string& public_key_path) const;
+
+  // Checks that the extents of every operation fit in their partition, that
+  // its data blob fits in the payload and that it matches its hash. The source
+  // hash of the operations of the partitions in |source_paths|, which maps
+  // partition names to source images, is checked too. Uses up to
+  // |max_threads| threads. Returns whether all the operations are valid; the
+  // invalid ones are logged.
+  bool CheckOperations(const std::map<std::string, std::string>& source_paths,
+                       size_t max_threads) const;
+
+  const DeltaArchiveManifest& manifest() const { return manifest_; }
+
+ private:
+  std::string payload_path_;
+  PayloadMetadata metadata_;
+
+  // The manifest of the payload, with the extents of the operations unpacked.
+  DeltaArchiveManifest manifest_;
+
+  // The offset of the first data blob in the payload file.
+  uint64_t blobs_offset_{0};
+
+  // The size of the data blobs section of the payload, without the signatures.
+  uint64_t blobs_size_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(PayloadChecker);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_PAYLOAD_CHECKER_H_
@@ -0,0 +1,107 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/payload_checker.h"
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/payload_file.h"
+
+using chromeos_update_engine::test_utils::GetBuildArtifactsPath;
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+extern const char* kUnittestPrivateKeyPath;
+extern const char* kUnittestPublicKeyPath;
+
+class PayloadCheckerTest : public ::testing::Test {
+ protected:
+  // Writes a full payload with a REPLACE operation of one block, signed with
+  // the |private_key| if not empty.
+  void WritePayload(const string& private_key) {
+    test_utils::ScopedTempFile blob_file("Blob-XXXXXX");
+    brillo::Blob blob(kBlockSize, 'x');
+    EXPECT_TRUE(test_utils::WriteFileVector(blob_file.path(), blob));
+
+    PayloadGenerationConfig config;
+    config.version.major = kBrilloMajorPayloadVersion;
+    config.version.minor = kFullPayloadMinorVersion;
+    PayloadFile payload;
+    EXPECT_TRUE(payload.Init(config));
+
+    AnnotatedOperation aop;
+    aop.op.set_type(InstallOperation::REPLACE);
+    aop.op.set_data_offset(0);
+    aop.op.set_data_length(blob.size());
+    *aop.op.add_dst_extents() = ExtentForRange(1, 1);
+    PartitionConfig old_part(kPartitionNameRoot);
+    PartitionConfig new_part(kPartitionNameRoot);
+    new_part.path = "/dev/zero";
+    new_part.size = 4 * kBlockSize;
+    EXPECT_TRUE(payload.AddPartition(old_part, new_part, {aop}));
+
+    uint64_t metadata_size;
+    EXPECT_TRUE(payload.WritePayload(
+        payload_file_.path(), blob_file.path(), private_key, &metadata_size));
+  }
+
+  test_utils::ScopedTempFile payload_file_{"Payload-XXXXXX"};
+};
+
+TEST_F(PayloadCheckerTest, ValidPayloadTest) {
+  WritePayload(GetBuildArtifactsPath(kUnittestPrivateKeyPath));
+  PayloadChecker checker(payload_file_.path());
+  ASSERT_TRUE(checker.Init());
+  EXPECT_EQ(1, checker.manifest().partitions_size());
+  EXPECT_TRUE(
+      checker.CheckSignatures(GetBuildArtifactsPath(kUnittestPublicKeyPath)));
+  EXPECT_TRUE(checker.CheckOperations({}, 2));
+}
+
+TEST_F(PayloadCheckerTest, UnsignedPayloadFailsSignatureCheckTest) {
+  WritePayload("");
+  PayloadChecker checker(payload_file_.path());
+  ASSERT_TRUE(checker.Init());
+  EXPECT_FALSE(
+      checker.CheckSignatures(GetBuildArtifactsPath(kUnittestPublicKeyPath)));
+  EXPECT_TRUE(checker.CheckOperations({}, 2));
+}
+
+TEST_F(PayloadCheckerTest, CorruptedBlobFailsOperationCheckTest) {
+  WritePayload("");
+  // The data blob is at the end of an unsigned payload.
+  brillo::Blob payload;
+  ASSERT_TRUE(utils::ReadFile(payload_file_.path(), &payload));
+  payload.back() ^= 1;
+  ASSERT_TRUE(test_utils::WriteFileVector(payload_file_.path(), payload));
+
+  PayloadChecker checker(payload_file_.path());
+  ASSERT_TRUE(checker.Init());
+  EXPECT_FALSE(checker.CheckOperations({}, 2));
+}
+
+}  // namespace chromeos_update_engine
@@ -17,26 +17,40 @@
 #include "update_engine/payload_generator/payload_file.h"
 
 #include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include <algorithm>
+#include <cmath>
 #include <map>
+#include <memory>
 #include <utility>
 
+#include <base/json/json_writer.h>
+#include <base/macros.h>
 #include <base/strings/stringprintf.h>
+#include <base/values.h>
 
 #include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
 #include "update_engine/payload_consumer/delta_performer.h"
-#include "update_engine/payload_consumer/file_writer.h"
+#include "update_engine/payload_consumer/packed_extents.h"
 #include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_generator/annotated_operation.h"
 #include "update_engine/payload_generator/delta_diff_utils.h"
 #include "update_engine/payload_generator/payload_signer.h"
+#include "update_engine/payload_generator/phase_timings.h"
 
 using std::string;
 using std::vector;
 
 namespace chromeos_update_engine {
 
+const char kStdoutPayloadFile[] = "-";
+const char kUsageReportSuffix[] = ".usage.json";
+
 namespace {
 
 struct DeltaObject {
@@ -50,19 +64,124 @@ struct DeltaObject {
   off_t size;
 };
 
-// Writes the uint64_t passed in in host-endian to the file as big-endian.
-// Returns true on success.
-bool WriteUint64AsBigEndian(FileWriter* writer, const uint64_t value) {
-  uint64_t value_be = htobe64(value);
-  TEST_AND_RETURN_FALSE(writer->Write(&value_be, sizeof(value_be)));
+// The size of the buffer used to copy the data blobs when the kernel can't
+// copy them itself.
+const size_t kCopyBufferSize = 1024 * 1024;
+
+// Copies |length| bytes at |offset| of |in_fd| to the current position of
+// |out_fd|. The copy is done by the kernel with copy_file_range() when the
+// files support it, which can share the data blocks instead of copying them.
+// If |hasher| is not null, the data is copied through it instead.
+bool CopyFileRange(int in_fd,
+                   uint64_t offset,
+                   uint64_t length,
+                   int out_fd,
+                   HashCalculator* hasher) {
+#ifdef __NR_copy_file_range
+  while (!hasher && length > 0) {
+    loff_t in_offset = offset;
+    ssize_t rc = syscall(
+        __NR_copy_file_range, in_fd, &in_offset, out_fd, nullptr, length, 0);
+    if (rc < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+                   errno == EOPNOTSUPP)) {
+      // Not supported for these files, copy the rest below.
+      break;
+    }
+    TEST_AND_RETURN_FALSE_ERRNO(rc >= 0);
+    if (rc == 0) {
+      LOG(ERROR) << "Data blobs file is too short at offset " << offset;
+      return false;
+    }
+    offset += rc;
+    length -= rc;
+  }
+#endif  // __NR_copy_file_range
+
+  brillo::Blob buf(std::min<uint64_t>(length, kCopyBufferSize));
+  while (length > 0) {
+    size_t count = std::min<uint64_t>(length, buf.size());
+    ssize_t bytes_read = 0;
+    TEST_AND_RETURN_FALSE(
+        utils::PReadAll(in_fd, buf.data(), count, offset, &bytes_read));
+    TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(count));
+    if (hasher)
+      TEST_AND_RETURN_FALSE(hasher->Update(buf.data(), count));
+    TEST_AND_RETURN_FALSE_ERRNO(utils::WriteAll(out_fd, buf.data(), count));
+    offset += count;
+    length -= count;
+  }
   return true;
 }
 
+// The classes of devices the apply time of the operations is estimated for in
+// the usage report, and the names of their keys.
+const struct {
+  const char* name;
+  TargetDeviceClass device_class;
+} kReportedDeviceClasses[] = {
+    {"mid_range", TargetDeviceClass::kMidRange},
+    {"low_end", TargetDeviceClass::kLowEnd},
+};
+
+// The usage of the operations of a type, in the usage report.
+struct OperationUsage {
+  uint64_t count{0};
+  uint64_t blob_bytes{0};
+  uint64_t src_blocks{0};
+  uint64_t dst_blocks{0};
+  uint64_t max_blob_bytes{0};
+  // The estimated apply time, in seconds, of the operations on each of the
+  // kReportedDeviceClasses, and the number of operations using more memory
+  // than those devices allow, which are not counted in the time.
+  double apply_seconds[arraysize(kReportedDeviceClasses)] = {};
+  uint64_t over_memory_ops[arraysize(kReportedDeviceClasses)] = {};
+
+  void Add(const OperationUsage& usage) {
+    count += usage.count;
+    blob_bytes += usage.blob_bytes;
+    src_blocks += usage.src_blocks;
+    dst_blocks += usage.dst_blocks;
+    max_blob_bytes = std::max(max_blob_bytes, usage.max_blob_bytes);
+    for (size_t i = 0; i < arraysize(kReportedDeviceClasses); i++) {
+      apply_seconds[i] += usage.apply_seconds[i];
+      over_memory_ops[i] += usage.over_memory_ops[i];
+    }
+  }
+
+  // The byte counts are stored as doubles since they may not fit in the int
+  // values of the JSON writer.
+  std::unique_ptr<base::DictionaryValue> ToValue() const {
+    auto value = std::make_unique<base::DictionaryValue>();
+    value->SetInteger("count", static_cast<int>(count));
+    value->SetDouble("blob_bytes", blob_bytes);
+    value->SetInteger("src_blocks", static_cast<int>(src_blocks));
+    value->SetInteger("dst_blocks", static_cast<int>(dst_blocks));
+    value->SetDouble("max_blob_bytes", max_blob_bytes);
+    auto apply = std::make_unique<base::DictionaryValue>();
+    for (size_t i = 0; i < arraysize(kReportedDeviceClasses); i++) {
+      auto device = std::make_unique<base::DictionaryValue>();
+      device->SetDouble("seconds", apply_seconds[i]);
+      device->SetInteger("over_memory_ops",
+                         static_cast<int>(over_memory_ops[i]));
+      apply->Set(kReportedDeviceClasses[i].name, std::move(device));
+    }
+    value->Set("estimated_apply", std::move(apply));
+    return value;
+  }
+};
+
+// Appends the uint64_t passed in in host-endian to |data| as big-endian.
+void AppendUint64AsBigEndian(string* data, const uint64_t value) {
+  uint64_t value_be = htobe64(value);
+  data->append(reinterpret_cast<const char*>(&value_be), sizeof(value_be));
+}
+
 }  // namespace
 
 bool PayloadFile::Init(const PayloadGenerationConfig& config) {
   TEST_AND_RETURN_FALSE(config.version.Validate());
   major_version_ = config.version.major;
+  packed_extents_ = config.version.PackedExtents();
   manifest_.set_minor_version(config.version.minor);
 
   if (!config.source.ImageInfoIsEmpty())
@@ -73,6 +192,7 @@ bool PayloadFile::Init(const PayloadGenerationConfig& config) {
 
   manifest_.set_block_size(config.block_size);
   manifest_.set_max_timestamp(config.max_timestamp);
+  write_usage_report_ = config.write_usage_report;
 
   if (major_version_ == kBrilloMajorPayloadVersion) {
     if (config.target.dynamic_partition_metadata != nullptr)
@@ -85,7 +205,7 @@ bool PayloadFile::Init(const PayloadGenerationConfig& config) {
 
 bool PayloadFile::AddPartition(const PartitionConfig& old_conf,
                                const PartitionConfig& new_conf,
-                               const vector<AnnotatedOperation>& aops) {
+                               vector<AnnotatedOperation> aops) {
   // Check partitions order for Chrome OS
   if (major_version_ == kChromeOSMajorPayloadVersion) {
     const vector<const char*> part_order = {kPartitionNameRoot,
@@ -95,7 +215,7 @@ bool PayloadFile::AddPartition(const PartitionConfig& old_conf,
   }
   Partition part;
   part.name = new_conf.name;
-  part.aops = aops;
+  part.aops = std::move(aops);
   part.postinstall = new_conf.postinstall;
   part.verity = new_conf.verity;
   // Initialize the PartitionInfo objects if present.
@@ -112,12 +232,13 @@ bool PayloadFile::WritePayload(const string& payload_file,
                                const string& data_blobs_path,
                                const string& private_key_path,
                                uint64_t* metadata_size_out) {
-  // Reorder the data blobs with the manifest_.
-  string ordered_blobs_path;
-  TEST_AND_RETURN_FALSE(utils::MakeTempFile(
-      "CrAU_temp_data.ordered.XXXXXX", &ordered_blobs_path, nullptr));
-  ScopedPathUnlinker ordered_blobs_unlinker(ordered_blobs_path);
-  TEST_AND_RETURN_FALSE(ReorderDataBlobs(data_blobs_path, ordered_blobs_path));
+  // Compute the order of the data blobs in the payload. They are copied from
+  // |data_blobs_path| straight to the payload file after the metadata.
+  vector<BlobRange> blob_ranges;
+  {
+    ScopedPhaseTimer timer(kPhaseReorderBlobs);
+    TEST_AND_RETURN_FALSE(ReorderDataBlobs(data_blobs_path, &blob_ranges));
+  }
 
   // Check that install op blobs are in order.
   uint64_t next_blob_offset = 0;
@@ -148,6 +269,7 @@ bool PayloadFile::WritePayload(const string& payload_file,
         if (!part.postinstall.filesystem_type.empty())
           partition->set_filesystem_type(part.postinstall.filesystem_type);
         partition->set_postinstall_optional(part.postinstall.optional);
+        partition->set_postinstall_parallel(part.postinstall.parallel);
       }
       if (!part.verity.IsEmpty()) {
         if (part.verity.hash_tree_extent.num_blocks() != 0) {
@@ -166,7 +288,10 @@ bool PayloadFile::WritePayload(const string& payload_file,
         }
       }
       for (const AnnotatedOperation& aop : part.aops) {
-        *partition->add_operations() = aop.op;
+        InstallOperation* op = partition->add_operations();
+        *op = aop.op;
+        if (packed_extents_)
+          PackOperationExtents(op);
       }
       if (part.old_info.has_size() || part.old_info.has_hash())
         *(partition->mutable_old_partition_info()) = part.old_info;
@@ -209,125 +334,143 @@ bool PayloadFile::WritePayload(const string& payload_file,
   string serialized_manifest;
   TEST_AND_RETURN_FALSE(manifest_.SerializeToString(&serialized_manifest));
 
-  uint64_t metadata_size =
-      sizeof(kDeltaMagic) + 2 * sizeof(uint64_t) + serialized_manifest.size();
-
-  LOG(INFO) << "Writing final delta file header...";
-  DirectFileWriter writer;
-  TEST_AND_RETURN_FALSE_ERRNO(writer.Open(payload_file.c_str(),
-                                          O_WRONLY | O_CREAT | O_TRUNC,
-                                          0644) == 0);
-  ScopedFileWriterCloser writer_closer(&writer);
-
-  // Write header
-  TEST_AND_RETURN_FALSE_ERRNO(writer.Write(kDeltaMagic, sizeof(kDeltaMagic)));
-
-  // Write major version number
-  TEST_AND_RETURN_FALSE(WriteUint64AsBigEndian(&writer, major_version_));
-
-  // Write protobuf length
-  TEST_AND_RETURN_FALSE(
-      WriteUint64AsBigEndian(&writer, serialized_manifest.size()));
-
-  // Write metadata signature size.
+  // The metadata is the header followed by the protobuf.
+  string metadata(kDeltaMagic, sizeof(kDeltaMagic));
+  // Major version number.
+  AppendUint64AsBigEndian(&metadata, major_version_);
+  // Protobuf length.
+  AppendUint64AsBigEndian(&metadata, serialized_manifest.size());
+  // Metadata signature size.
   uint32_t metadata_signature_size = 0;
   if (major_version_ == kBrilloMajorPayloadVersion) {
     // Metadata signature has the same size as payload signature, because they
     // are both the same kind of signature for the same kind of hash.
-    uint32_t metadata_signature_size = htobe32(signature_blob_length);
-    TEST_AND_RETURN_FALSE_ERRNO(writer.Write(&metadata_signature_size,
-                                             sizeof(metadata_signature_size)));
-    metadata_size += sizeof(metadata_signature_size);
-    // Set correct size instead of big endian size.
     metadata_signature_size = signature_blob_length;
+    uint32_t metadata_signature_size_be = htobe32(metadata_signature_size);
+    metadata.append(reinterpret_cast<const char*>(&metadata_signature_size_be),
+                    sizeof(metadata_signature_size_be));
   }
-
-  // Write protobuf
-  LOG(INFO) << "Writing final delta file protobuf... "
-            << serialized_manifest.size();
+  metadata += serialized_manifest;
+  uint64_t metadata_size = metadata.size();
+
+  LOG(INFO) << "Writing final delta file metadata... " << metadata_size;
+  // The payload is streamed to the standard output when |payload_file| is
+  // kStdoutPayloadFile, which can be a pipe or a socket since the payload is
+  // written in order without seeking.
+  bool to_stdout = payload_file == kStdoutPayloadFile;
+  int payload_fd = to_stdout ? dup(STDOUT_FILENO)
+                             : open(payload_file.c_str(),
+                                    O_WRONLY | O_CREAT | O_TRUNC,
+                                    0644);
+  TEST_AND_RETURN_FALSE_ERRNO(payload_fd >= 0);
+  ScopedFdCloser payload_fd_closer(&payload_fd);
   TEST_AND_RETURN_FALSE_ERRNO(
-      writer.Write(serialized_manifest.data(), serialized_manifest.size()));
+      utils::WriteAll(payload_fd, metadata.data(), metadata.size()));
 
   // Write metadata signature blob.
   if (major_version_ == kBrilloMajorPayloadVersion &&
       !private_key_path.empty()) {
+    ScopedPhaseTimer timer(kPhaseSignPayload);
     brillo::Blob metadata_hash;
-    TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfFile(
-        payload_file, metadata_size, &metadata_hash));
+    TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfBytes(
+        metadata.data(), metadata.size(), &metadata_hash));
     string metadata_signature;
     TEST_AND_RETURN_FALSE(PayloadSigner::SignHashWithKeys(
         metadata_hash, {private_key_path}, &metadata_signature));
-    TEST_AND_RETURN_FALSE_ERRNO(
-        writer.Write(metadata_signature.data(), metadata_signature.size()));
+    TEST_AND_RETURN_FALSE_ERRNO(utils::WriteAll(
+        payload_fd, metadata_signature.data(), metadata_signature.size()));
+  }
+
+  // The payload signature covers the metadata and the data blobs, so they are
+  // hashed while they are written instead of reading the payload back.
+  std::unique_ptr<HashCalculator> payload_hasher;
+  if (!private_key_path.empty()) {
+    payload_hasher.reset(new HashCalculator());
+    TEST_AND_RETURN_FALSE(
+        payload_hasher->Update(metadata.data(), metadata.size()));
   }
 
   // Append the data blobs
   LOG(INFO) << "Writing final delta file data blobs...";
-  int blobs_fd = open(ordered_blobs_path.c_str(), O_RDONLY, 0);
+  int blobs_fd = open(data_blobs_path.c_str(), O_RDONLY, 0);
   ScopedFdCloser blobs_fd_closer(&blobs_fd);
-  TEST_AND_RETURN_FALSE(blobs_fd >= 0);
-  for (;;) {
-    vector<char> buf(1024 * 1024);
-    ssize_t rc = read(blobs_fd, buf.data(), buf.size());
-    if (0 == rc) {
-      // EOF
-      break;
+  TEST_AND_RETURN_FALSE_ERRNO(blobs_fd >= 0);
+  {
+    ScopedPhaseTimer timer(kPhaseWritePayload);
+    for (const BlobRange& range : blob_ranges) {
+      TEST_AND_RETURN_FALSE(CopyFileRange(blobs_fd,
+                                          range.offset,
+                                          range.length,
+                                          payload_fd,
+                                          payload_hasher.get()));
     }
-    TEST_AND_RETURN_FALSE_ERRNO(rc > 0);
-    TEST_AND_RETURN_FALSE_ERRNO(writer.Write(buf.data(), rc));
   }
 
   // Write payload signature blob.
-  if (!private_key_path.empty()) {
+  if (payload_hasher) {
     LOG(INFO) << "Signing the update...";
+    ScopedPhaseTimer timer(kPhaseSignPayload);
+    TEST_AND_RETURN_FALSE(payload_hasher->Finalize());
     string signature;
-    TEST_AND_RETURN_FALSE(PayloadSigner::SignPayload(
-        payload_file,
-        {private_key_path},
-        metadata_size,
-        metadata_signature_size,
-        metadata_size + metadata_signature_size + manifest_.signatures_offset(),
-        &signature));
+    TEST_AND_RETURN_FALSE(PayloadSigner::SignHashWithKeys(
+        payload_hasher->raw_hash(), {private_key_path}, &signature));
     TEST_AND_RETURN_FALSE_ERRNO(
-        writer.Write(signature.data(), signature.size()));
+        utils::WriteAll(payload_fd, signature.data(), signature.size()));
   }
 
-  ReportPayloadUsage(metadata_size);
+  // Keep the report out of the payload when it is written to stdout.
+  ReportPayloadUsage(metadata_size, to_stdout ? stderr : stdout);
+  if (write_usage_report_) {
+    if (to_stdout) {
+      LOG(WARNING) << "Not writing the usage report of a payload written to "
+                   << "the standard output.";
+    } else {
+      string report = GetUsageReportJson(metadata_size);
+      string report_path = payload_file + kUsageReportSuffix;
+      LOG(INFO) << "Writing the usage report to " << report_path;
+      TEST_AND_RETURN_FALSE(
+          utils::WriteFile(report_path.c_str(), report.data(), report.size()));
+    }
+  }
   *metadata_size_out = metadata_size;
   return true;
 }
 
 bool PayloadFile::ReorderDataBlobs(const string& data_blobs_path,
-                                   const string& new_data_blobs_path) {
-  int in_fd = open(data_blobs_path.c_str(), O_RDONLY, 0);
-  TEST_AND_RETURN_FALSE_ERRNO(in_fd >= 0);
-  ScopedFdCloser in_fd_closer(&in_fd);
-
-  DirectFileWriter writer;
-  int rc = writer.Open(
-      new_data_blobs_path.c_str(), O_WRONLY | O_TRUNC | O_CREAT, 0644);
-  if (rc != 0) {
-    PLOG(ERROR) << "Error creating " << new_data_blobs_path;
-    return false;
-  }
-  ScopedFileWriterCloser writer_closer(&writer);
-  uint64_t out_file_size = 0;
+                                   vector<BlobRange>* blob_ranges) {
+  int fd = open(data_blobs_path.c_str(), O_RDONLY, 0);
+  TEST_AND_RETURN_FALSE_ERRNO(fd >= 0);
+  ScopedFdCloser fd_closer(&fd);
 
+  blob_ranges->clear();
+  uint64_t out_file_size = 0;
   for (auto& part : part_vec_) {
     for (AnnotatedOperation& aop : part.aops) {
       if (!aop.op.has_data_offset())
         continue;
       CHECK(aop.op.has_data_length());
-      brillo::Blob buf(aop.op.data_length());
-      ssize_t rc = pread(in_fd, buf.data(), buf.size(), aop.op.data_offset());
-      TEST_AND_RETURN_FALSE(rc == static_cast<ssize_t>(buf.size()));
 
-      // Add the hash of the data blobs for this operation
-      TEST_AND_RETURN_FALSE(AddOperationHash(&aop.op, buf));
+      // Add the hash of the data blobs for this operation, unless the
+      // generator already did.
+      if (!aop.op.has_data_sha256_hash()) {
+        brillo::Blob buf(aop.op.data_length());
+        ssize_t bytes_read = 0;
+        TEST_AND_RETURN_FALSE(utils::PReadAll(
+            fd, buf.data(), buf.size(), aop.op.data_offset(), &bytes_read));
+        TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(buf.size()));
+        TEST_AND_RETURN_FALSE(AddOperationHash(&aop.op, buf));
+      }
 
+      // Blobs stored next to each other are copied at once.
+      if (!blob_ranges->empty() &&
+          blob_ranges->back().offset + blob_ranges->back().length ==
+              aop.op.data_offset()) {
+        blob_ranges->back().length += aop.op.data_length();
+      } else {
+        blob_ranges->push_back({aop.op.data_offset(), aop.op.data_length()});
+      }
       aop.op.set_data_offset(out_file_size);
-      TEST_AND_RETURN_FALSE_ERRNO(writer.Write(buf.data(), buf.size()));
-      out_file_size += buf.size();
+      out_file_size += aop.op.data_length();
     }
   }
   return true;
@@ -341,7 +484,8 @@ bool PayloadFile::AddOperationHash(InstallOperation* op,
   return true;
 }
 
-void PayloadFile::ReportPayloadUsage(uint64_t metadata_size) const {
+void PayloadFile::ReportPayloadUsage(uint64_t metadata_size,
+                                     FILE* out) const {
   std::map<DeltaObject, int> object_counts;
   off_t total_size = 0;
   int total_op = 0;
@@ -365,18 +509,74 @@ void PayloadFile::ReportPayloadUsage(uint64_t metadata_size) const {
     const DeltaObject& object = object_count.first;
     // Use printf() instead of LOG(INFO) because timestamp makes it difficult to
     // compare two reports.
-    printf(kFormatString,
-           object.size * 100.0 / total_size,
-           object.size,
-           (object.type >= 0
-                ? InstallOperationTypeName(
-                      static_cast<InstallOperation::Type>(object.type))
-                : "-"),
-           object.name.c_str(),
-           object_count.second);
+    fprintf(out,
+            kFormatString,
+            object.size * 100.0 / total_size,
+            object.size,
+            (object.type >= 0
+                 ? InstallOperationTypeName(
+                       static_cast<InstallOperation::Type>(object.type))
+                 : "-"),
+            object.name.c_str(),
+            object_count.second);
+  }
+  fprintf(out, kFormatString, 100.0, total_size, "", "<total>", total_op);
+  fflush(out);
+}
+
+string PayloadFile::GetUsageReportJson(uint64_t metadata_size) const {
+  vector<diff_utils::ApplyCostModel> models;
+  for (const auto& device : kReportedDeviceClasses)
+    models.push_back(diff_utils::GetApplyCostModel(device.device_class));
+
+  const uint64_t block_size = manifest_.block_size();
+  std::map<string, OperationUsage> usages;
+  for (const auto& part : part_vec_) {
+    for (const AnnotatedOperation& aop : part.aops) {
+      const InstallOperation& op = aop.op;
+      OperationUsage& usage = usages[InstallOperationTypeName(op.type())];
+      uint64_t src_blocks = utils::BlocksInExtents(op.src_extents());
+      uint64_t dst_blocks = utils::BlocksInExtents(op.dst_extents());
+      usage.count++;
+      usage.blob_bytes += op.data_length();
+      usage.src_blocks += src_blocks;
+      usage.dst_blocks += dst_blocks;
+      usage.max_blob_bytes = std::max(usage.max_blob_bytes, op.data_length());
+      for (size_t i = 0; i < models.size(); i++) {
+        double seconds = diff_utils::EstimateApplyCost(models[i],
+                                                       op.type(),
+                                                       op.data_length(),
+                                                       src_blocks * block_size,
+                                                       dst_blocks * block_size);
+        if (std::isinf(seconds))
+          usage.over_memory_ops[i]++;
+        else
+          usage.apply_seconds[i] += seconds;
+      }
+    }
   }
-  printf(kFormatString, 100.0, total_size, "", "<total>", total_op);
-  fflush(stdout);
+
+  // The types are stored in a list sorted by name, like the phases of the
+  // PhaseTimings, so the reports of two payloads are easy to compare.
+  auto operations = std::make_unique<base::ListValue>();
+  OperationUsage total;
+  for (const auto& it : usages) {
+    auto value = it.second.ToValue();
+    value->SetString("type", it.first);
+    operations->Append(std::move(value));
+    total.Add(it.second);
+  }
+
+  base::DictionaryValue value;
+  value.SetInteger("block_size", static_cast<int>(block_size));
+  value.SetDouble("metadata_bytes", metadata_size);
+  value.Set("operations", std::move(operations));
+  value.Set("total", total.ToValue());
+
+  string json_str;
+  base::JSONWriter::WriteWithOptions(
+      value, base::JSONWriter::OPTIONS_PRETTY_PRINT, &json_str);
+  return json_str;
 }
 
 }  // namespace chromeos_update_engine
@@ -17,6 +17,8 @@
 #ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_PAYLOAD_FILE_H_
 #define UPDATE_ENGINE_PAYLOAD_GENERATOR_PAYLOAD_FILE_H_
 
+#include <stdio.h>
+
 #include <string>
 #include <vector>
 
@@ -29,6 +31,12 @@
 
 namespace chromeos_update_engine {
 
+// The payload file name that writes the payload to the standard output.
+extern const char kStdoutPayloadFile[];
+
+// The suffix of the file, next to the payload, of the JSON usage report.
+extern const char kUsageReportSuffix[];
+
 // Class to handle the creation of a payload file. This class is the only one
 // dealing with writing the payload and its format, but has no logic about what
 // should be on it.
@@ -40,15 +48,18 @@ class PayloadFile {
 
   // Add a partition to the payload manifest. Including partition name, list of
   // operations and partition info. The operations in |aops|
-  // reference a blob stored in the file provided to WritePayload().
+  // reference a blob stored in the file provided to WritePayload(). Pass the
+  // |aops| with std::move() when they aren't needed anymore, to avoid a copy.
   bool AddPartition(const PartitionConfig& old_conf,
                     const PartitionConfig& new_conf,
-                    const std::vector<AnnotatedOperation>& aops);
+                    std::vector<AnnotatedOperation> aops);
 
   // Write the payload to the |payload_file| file. The operations reference
   // blobs in the |data_blobs_path| file and the blobs will be reordered in the
-  // payload file to match the order of the operations. The size of the metadata
-  // section of the payload is stored in |metadata_size_out|.
+  // payload file to match the order of the operations, unless they are already
+  // in that order. The size of the metadata section of the payload is stored in
+  // |metadata_size_out|. The payload is written to stdout if |payload_file| is
+  // kStdoutPayloadFile.
   bool WritePayload(const std::string& payload_file,
                     const std::string& data_blobs_path,
                     const std::string& private_key_path,
@@ -56,6 +67,8 @@ class PayloadFile {
 
  private:
   FRIEND_TEST(PayloadFileTest, ReorderBlobsTest);
+  FRIEND_TEST(PayloadFileTest, ReorderBlobsInOrderTest);
+  FRIEND_TEST(PayloadFileTest, UsageReportJsonTest);
 
   // Computes a SHA256 hash of the given buf and sets the hash value in the
   // operation so that update_engine could verify. This hash should be set
@@ -65,22 +78,41 @@ class PayloadFile {
   // gracefully ignore the dummy signature operation.
   static bool AddOperationHash(InstallOperation* op, const brillo::Blob& buf);
 
+  // A range of bytes in the data blobs file.
+  struct BlobRange {
+    uint64_t offset;
+    uint64_t length;
+  };
+
   // Install operations in the manifest may reference data blobs, which
-  // are in data_blobs_path. This function creates a new data blobs file
-  // with the data blobs in the same order as the referencing install
-  // operations in the manifest. E.g. if manifest[0] has a data blob
-  // "X" at offset 1, manifest[1] has a data blob "Y" at offset 0,
-  // and data_blobs_path's file contains "YX", new_data_blobs_path
-  // will set to be a file that contains "XY".
+  // are in data_blobs_path. This function sets the offsets of the data blobs
+  // in the payload to follow the order of the referencing install operations
+  // in the manifest, and sets |blob_ranges| to the ranges of data_blobs_path
+  // to copy to the payload, in order. E.g. if manifest[0] has a data blob
+  // "X" at offset 1, manifest[1] has a data blob "Y" at offset 0, and
+  // data_blobs_path's file contains "YX", |blob_ranges| will be {1, 1}, {0, 1}
+  // so the payload contains "XY". It also sets the hash of the operations that
+  // don't have one yet.
   bool ReorderDataBlobs(const std::string& data_blobs_path,
-                        const std::string& new_data_blobs_path);
+                        std::vector<BlobRange>* blob_ranges);
+
+  // Print in |out| the Payload usage report.
+  void ReportPayloadUsage(uint64_t metadata_size, FILE* out) const;
 
-  // Print in stderr the Payload usage report.
-  void ReportPayloadUsage(uint64_t metadata_size) const;
+  // Returns the payload usage report as JSON: the count, blob bytes, source
+  // and destination blocks, biggest blob and estimated apply time of the
+  // operations of each type, and their totals.
+  std::string GetUsageReportJson(uint64_t metadata_size) const;
 
   // The major_version of the requested payload.
   uint64_t major_version_;
 
+  // Whether the extents of the operations are written packed.
+  bool packed_extents_{false};
+
+  // Whether the JSON usage report is written next to the payload.
+  bool write_usage_report_{false};
+
   DeltaArchiveManifest manifest_;
 
   // Struct has necessary information to write PartitionUpdate in protobuf.
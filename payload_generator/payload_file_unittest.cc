@@ -16,12 +16,16 @@
 
 #include "update_engine/payload_generator/payload_file.h"
 
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <base/json/json_reader.h>
+#include <base/values.h>
 #include <gtest/gtest.h>
 
+#include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/test_utils.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 
@@ -45,8 +49,6 @@ TEST_F(PayloadFileTest, ReorderBlobsTest) {
   string orig_data = "kernel abcd";
   EXPECT_TRUE(test_utils::WriteFileString(orig_blobs.path(), orig_data));
 
-  test_utils::ScopedTempFile new_blobs("ReorderBlobsTest.new.XXXXXX");
-
   payload_.part_vec_.resize(2);
 
   vector<AnnotatedOperation> aops;
@@ -64,12 +66,14 @@ TEST_F(PayloadFileTest, ReorderBlobsTest) {
   aop.op.set_data_length(6);
   payload_.part_vec_[1].aops = {aop};
 
-  EXPECT_TRUE(payload_.ReorderDataBlobs(orig_blobs.path(), new_blobs.path()));
+  vector<PayloadFile::BlobRange> blob_ranges;
+  EXPECT_TRUE(payload_.ReorderDataBlobs(orig_blobs.path(), &blob_ranges));
 
   const vector<AnnotatedOperation>& part0_aops = payload_.part_vec_[0].aops;
   const vector<AnnotatedOperation>& part1_aops = payload_.part_vec_[1].aops;
   string new_data;
-  EXPECT_TRUE(utils::ReadFile(new_blobs.path(), &new_data));
+  for (const auto& range : blob_ranges)
+    new_data += orig_data.substr(range.offset, range.length);
   // Kernel blobs should appear at the end.
   EXPECT_EQ("bcdakernel", new_data);
 
@@ -82,6 +86,97 @@ TEST_F(PayloadFileTest, ReorderBlobsTest) {
   EXPECT_EQ(1U, part1_aops.size());
   EXPECT_EQ(4U, part1_aops[0].op.data_offset());
   EXPECT_EQ(6U, part1_aops[0].op.data_length());
+
+  brillo::Blob expected_hash;
+  EXPECT_TRUE(HashCalculator::RawHashOfData({'a'}, &expected_hash));
+  const InstallOperation& op = part0_aops[1].op;
+  EXPECT_EQ(expected_hash,
+            brillo::Blob(op.data_sha256_hash().begin(),
+                         op.data_sha256_hash().end()));
+}
+
+TEST_F(PayloadFileTest, ReorderBlobsInOrderTest) {
+  test_utils::ScopedTempFile blobs("ReorderBlobsInOrderTest.XXXXXX");
+  EXPECT_TRUE(test_utils::WriteFileString(blobs.path(), "abcde"));
+
+  payload_.part_vec_.resize(2);
+  AnnotatedOperation aop;
+  aop.op.set_data_offset(0);
+  aop.op.set_data_length(1);
+  payload_.part_vec_[0].aops = {aop};
+  aop.op.set_data_offset(1);
+  aop.op.set_data_length(3);
+  payload_.part_vec_[1].aops = {aop};
+
+  // Blobs already in order are copied at once, without the unused data at the
+  // end.
+  vector<PayloadFile::BlobRange> blob_ranges;
+  EXPECT_TRUE(payload_.ReorderDataBlobs(blobs.path(), &blob_ranges));
+  ASSERT_EQ(1U, blob_ranges.size());
+  EXPECT_EQ(0U, blob_ranges[0].offset);
+  EXPECT_EQ(4U, blob_ranges[0].length);
+  EXPECT_EQ(1U, payload_.part_vec_[1].aops[0].op.data_offset());
+}
+
+TEST_F(PayloadFileTest, UsageReportJsonTest) {
+  payload_.manifest_.set_block_size(4096);
+  payload_.part_vec_.resize(2);
+  AnnotatedOperation aop;
+  aop.op.set_type(InstallOperation::REPLACE);
+  aop.op.set_data_length(100);
+  *aop.op.add_dst_extents() = ExtentForRange(0, 4);
+  payload_.part_vec_[0].aops = {aop};
+  aop.op.Clear();
+  aop.op.set_type(InstallOperation::SOURCE_COPY);
+  *aop.op.add_src_extents() = ExtentForRange(10, 2);
+  *aop.op.add_dst_extents() = ExtentForRange(0, 2);
+  payload_.part_vec_[1].aops = {aop, aop};
+
+  std::unique_ptr<base::Value> report =
+      base::JSONReader::Read(payload_.GetUsageReportJson(50));
+  const base::DictionaryValue* dict = nullptr;
+  ASSERT_TRUE(report && report->GetAsDictionary(&dict));
+  double bytes;
+  EXPECT_TRUE(dict->GetDouble("metadata_bytes", &bytes));
+  EXPECT_DOUBLE_EQ(50.0, bytes);
+
+  // The operations are grouped by type, sorted by name.
+  const base::ListValue* operations = nullptr;
+  ASSERT_TRUE(dict->GetList("operations", &operations));
+  ASSERT_EQ(2U, operations->GetSize());
+  const base::DictionaryValue* usage = nullptr;
+  string type;
+  int count;
+  ASSERT_TRUE(operations->GetDictionary(0, &usage));
+  EXPECT_TRUE(usage->GetString("type", &type));
+  EXPECT_EQ("REPLACE", type);
+  EXPECT_TRUE(usage->GetDouble("max_blob_bytes", &bytes));
+  EXPECT_DOUBLE_EQ(100.0, bytes);
+  EXPECT_TRUE(usage->GetInteger("dst_blocks", &count));
+  EXPECT_EQ(4, count);
+  ASSERT_TRUE(operations->GetDictionary(1, &usage));
+  EXPECT_TRUE(usage->GetString("type", &type));
+  EXPECT_EQ("SOURCE_COPY", type);
+  EXPECT_TRUE(usage->GetInteger("count", &count));
+  EXPECT_EQ(2, count);
+  EXPECT_TRUE(usage->GetInteger("src_blocks", &count));
+  EXPECT_EQ(4, count);
+
+  const base::DictionaryValue* total = nullptr;
+  ASSERT_TRUE(dict->GetDictionary("total", &total));
+  EXPECT_TRUE(total->GetInteger("count", &count));
+  EXPECT_EQ(3, count);
+  EXPECT_TRUE(total->GetDouble("blob_bytes", &bytes));
+  EXPECT_DOUBLE_EQ(100.0, bytes);
+  EXPECT_TRUE(total->GetInteger("dst_blocks", &count));
+  EXPECT_EQ(8, count);
+  // Downloading and writing the blocks takes some time on the low-end devices.
+  double seconds;
+  EXPECT_TRUE(total->GetDouble("estimated_apply.low_end.seconds", &seconds));
+  EXPECT_GT(seconds, 0.0);
+  EXPECT_TRUE(
+      total->GetInteger("estimated_apply.low_end.over_memory_ops", &count));
+  EXPECT_EQ(0, count);
 }
 
 }  // namespace chromeos_update_engine
@@ -38,7 +38,8 @@ using std::string;
 namespace chromeos_update_engine {
 
 bool PostInstallConfig::IsEmpty() const {
-  return !run && path.empty() && filesystem_type.empty() && !optional;
+  return !run && path.empty() && filesystem_type.empty() && !optional &&
+         !parallel;
 }
 
 bool VerityConfig::IsEmpty() const {
@@ -121,6 +122,8 @@ bool ImageConfig::LoadPostInstallConfig(const brillo::KeyValueStore& store) {
                     &part.postinstall.filesystem_type);
     store.GetBoolean("POSTINSTALL_OPTIONAL_" + part.name,
                      &part.postinstall.optional);
+    store.GetBoolean("POSTINSTALL_PARALLEL_" + part.name,
+                     &part.postinstall.parallel);
   }
   if (!found_postinstall) {
     LOG(ERROR) << "No valid postinstall config found.";
@@ -218,7 +221,11 @@ bool PayloadVersion::Validate() const {
                         minor == kOpSrcHashMinorPayloadVersion ||
                         minor == kBrotliBsdiffMinorPayloadVersion ||
                         minor == kPuffdiffMinorPayloadVersion ||
-                        minor == kVerityMinorPayloadVersion);
+                        minor == kVerityMinorPayloadVersion ||
+                        minor == kZstdMinorPayloadVersion ||
+                        minor == kLz4MinorPayloadVersion ||
+                        minor == kZstdBsdiffMinorPayloadVersion ||
+                        minor == kPackedExtentsMinorPayloadVersion);
   return true;
 }
 
@@ -236,6 +243,15 @@ bool PayloadVersion::OperationAllowed(InstallOperation::Type operation) const {
       return major == kBrilloMajorPayloadVersion ||
              minor >= kOpSrcHashMinorPayloadVersion;
 
+    case InstallOperation::REPLACE_ZSTD:
+      // Full payloads don't carry the version of the client they target, so
+      // these operations are only used in delta payloads.
+      return minor >= kZstdMinorPayloadVersion;
+
+    case InstallOperation::REPLACE_LZ4:
+      // Like REPLACE_ZSTD, only used in delta payloads.
+      return minor >= kLz4MinorPayloadVersion;
+
     case InstallOperation::ZERO:
     case InstallOperation::DISCARD:
       // The implementation of these operations had a bug in earlier versions
@@ -258,12 +274,19 @@ bool PayloadVersion::OperationAllowed(InstallOperation::Type operation) const {
     case InstallOperation::BROTLI_BSDIFF:
       return minor >= kBrotliBsdiffMinorPayloadVersion;
 
+    case InstallOperation::ZSTD_BSDIFF:
+      return minor >= kZstdBsdiffMinorPayloadVersion;
+
     case InstallOperation::PUFFDIFF:
       return minor >= kPuffdiffMinorPayloadVersion;
   }
   return false;
 }
 
+bool PayloadVersion::PackedExtents() const {
+  return minor >= kPackedExtentsMinorPayloadVersion;
+}
+
 bool PayloadVersion::IsDelta() const {
   return minor != kFullPayloadMinorVersion;
 }
@@ -313,6 +336,15 @@ bool PayloadGenerationConfig::Validate() const {
 
   TEST_AND_RETURN_FALSE(rootfs_partition_size % block_size == 0);
 
+  // Only the A/B deltas are sharded, and their shards need a cache to store
+  // the diffs.
+  if (num_shards > 0) {
+    TEST_AND_RETURN_FALSE(shard_index < num_shards);
+    TEST_AND_RETURN_FALSE(!diff_cache_dir.empty());
+    TEST_AND_RETURN_FALSE(is_delta);
+    TEST_AND_RETURN_FALSE(version.minor != kInPlaceMinorPayloadVersion);
+  }
+
   return true;
 }
 
@@ -50,6 +50,10 @@ struct PostInstallConfig {
 
   // Whether this postinstall script should be ignored if it fails.
   bool optional = false;
+
+  // Whether this postinstall script may run at the same time as the other
+  // parallel postinstall scripts.
+  bool parallel = false;
 };
 
 // Data will be written to the payload and used for hash tree and FEC generation
@@ -167,6 +171,9 @@ struct PayloadVersion {
   // Return whether the passed |operation| is allowed by this payload.
   bool OperationAllowed(InstallOperation::Type operation) const;
 
+  // Whether the extents of the operations are written packed.
+  bool PackedExtents() const;
+
   // Whether this payload version is a delta payload.
   bool IsDelta() const;
 
@@ -185,6 +192,29 @@ struct PayloadVersion {
 // build the requested payload. This includes information about the old and new
 // image as well as the restrictions applied to the payload (like minor-version
 // and full/delta payload).
+// The trade-off between the size of a payload and the time to generate it.
+enum class GenerationProfile {
+  // Generates the payload in a fraction of the time, for development builds.
+  kFast,
+  // Generates a slightly bigger payload a lot faster.
+  kBalanced,
+  // Generates the smallest payload.
+  kMax,
+};
+
+// The class of the devices a payload is generated for. The operations of the
+// payloads for slower devices are picked by the time they take to download and
+// apply rather than by their size alone.
+enum class TargetDeviceClass {
+  // Picks the smallest operations.
+  kAny,
+  // Devices where the diffs of big files take seconds to apply.
+  kMidRange,
+  // Devices where the updates are limited by the time to apply them rather
+  // than by the bandwidth.
+  kLowEnd,
+};
+
 struct PayloadGenerationConfig {
   // Returns whether the PayloadGenerationConfig is valid.
   bool Validate() const;
@@ -222,6 +252,50 @@ struct PayloadGenerationConfig {
   // chunks.
   size_t soft_chunk_size = 2 * 1024 * 1024;
 
+  // Whether the files too big for bsdiff or puffdiff are split in
+  // content-defined chunks instead of |hard_chunk_size| chunks. The chunks of
+  // the old and new files then line up even when data was inserted or removed,
+  // so they can still be diffed.
+  bool content_defined_chunking = false;
+
+  // Whether the operations of the A/B payloads are sorted by their source
+  // blocks, with the SOURCE_COPY operations reading contiguous blocks merged,
+  // instead of being sorted by their destination blocks. This trades the
+  // sequential writes of the client for sequential reads and fewer operations.
+  bool sort_operations_by_source = false;
+
+  // Whether to log how many blocks of each target partition are also in the
+  // target partitions before it.
+  bool report_duplicated_blocks = false;
+
+  // Whether to write the JSON report of the operations of the payload, with
+  // their sizes and estimated apply time, next to the payload.
+  bool write_usage_report = false;
+
+  // The memory, in bytes, the files processed in parallel are estimated to use
+  // at most. A file too big for the budget is processed alone. A value of 0
+  // means no limit.
+  uint64_t memory_budget = 0;
+
+  // The directory of the on-disk cache of the diffs, shared by the payloads
+  // generated from the same data. With an empty value, the diffs are only
+  // reused within the payload being generated.
+  std::string diff_cache_dir;
+
+  // The number of delta_generator processes, possibly on several machines,
+  // diffing the files of the partitions into the shared |diff_cache_dir|,
+  // and which of them this process is. These processes don't write a payload;
+  // it is written by a last run without shards that finds all the diffs in
+  // the cache. A value of 0 for |num_shards| generates the payload at once.
+  uint32_t num_shards = 0;
+  uint32_t shard_index = 0;
+
+  // The trade-off between the size of the payload and the time to generate it.
+  GenerationProfile profile = GenerationProfile::kMax;
+
+  // The class of the devices the payload is generated for.
+  TargetDeviceClass device_class = TargetDeviceClass::kAny;
+
   // TODO(deymo): Remove the block_size member and maybe replace it with a
   // minimum alignment size for blocks (if needed). Algorithms should be able to
   // pick the block_size they want, but for now only 4 KiB is supported.
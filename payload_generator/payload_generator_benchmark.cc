@@ -0,0 +1,471 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Benchmarks of the payload generation: the ExtentRanges operations, the
+// mapping of the partition blocks, the DeltaReadPartition() of each generation
+// profile, the fragmentation and merge of the operations by the ABGenerator,
+// the PayloadFile writing a payload and the PayloadSigner signing batches of
+// hashes. The images and operations are generated on startup from fixed
+// seeds, so every run uses the same inputs, and the size of the images is set
+// with --image_size_mib.
+//
+// The results of a run can be saved with --benchmark_out=<file>
+// --benchmark_out_format=json and compared with the ones of a previous run
+// with the compare.py tool of google-benchmark.
+
+#include <fcntl.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <base/logging.h>
+#include <benchmark/benchmark.h>
+#include <brillo/flag_helper.h>
+#include <brillo/secure_blob.h>
+#include <openssl/bn.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+
+#include "update_engine/common/constants.h"
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/ab_generator.h"
+#include "update_engine/payload_generator/annotated_operation.h"
+#include "update_engine/payload_generator/blob_file_writer.h"
+#include "update_engine/payload_generator/block_mapping.h"
+#include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/fake_filesystem.h"
+#include "update_engine/payload_generator/payload_file.h"
+#include "update_engine/payload_generator/payload_generation_config.h"
+#include "update_engine/payload_generator/payload_signer.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The size of the files of the generated filesystems.
+const size_t kFileSize = 1024 * 1024;  // 1 MiB
+const size_t kFileBlocks = kFileSize / 4096;
+
+const char kPartitionName[] = "system";
+
+// The size of the generated images, a multiple of |kFileSize|. Set from the
+// command line before running the benchmarks.
+size_t image_size = 0;
+
+// Generates |size| bytes of data that compress about as well as a filesystem
+// image: half of the blocks are random and the other half repeat a short
+// text.
+brillo::Blob GenerateImage(size_t size, uint32_t seed) {
+  std::mt19937 rng(seed);
+  brillo::Blob image(size);
+  for (size_t offset = 0; offset < size; offset += kBlockSize) {
+    const size_t block_end = std::min(size, offset + kBlockSize);
+    if (rng() % 2) {
+      for (size_t i = offset; i < block_end; i++)
+        image[i] = static_cast<uint8_t>(rng());
+    } else {
+      const string text = "block " + std::to_string(offset / kBlockSize) +
+                          " of the generated image\n";
+      for (size_t i = offset; i < block_end; i++)
+        image[i] = text[(i - offset) % text.size()];
+    }
+  }
+  return image;
+}
+
+// Returns a copy of |image| where a few bytes of one out of eight blocks were
+// changed, like an image built from slightly different sources.
+brillo::Blob MutateImage(const brillo::Blob& image, uint32_t seed) {
+  std::mt19937 rng(seed);
+  brillo::Blob mutated = image;
+  for (size_t offset = 0; offset + kBlockSize <= mutated.size();
+       offset += kBlockSize) {
+    if (rng() % 8)
+      continue;
+    const size_t start = offset + rng() % (kBlockSize - 16);
+    for (size_t i = start; i < start + 16; i++)
+      mutated[i] = static_cast<uint8_t>(rng());
+  }
+  return mutated;
+}
+
+// Returns |count| extents of up to |max_blocks| blocks at random places of a
+// partition of |num_blocks| blocks.
+vector<Extent> GenerateExtents(size_t count,
+                               uint64_t num_blocks,
+                               uint64_t max_blocks,
+                               uint32_t seed) {
+  std::mt19937 rng(seed);
+  vector<Extent> extents;
+  extents.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    uint64_t blocks = 1 + rng() % max_blocks;
+    extents.push_back(ExtentForRange(rng() % (num_blocks - blocks), blocks));
+  }
+  return extents;
+}
+
+// Creates a temporary file with the |data| and returns its path. The file is
+// removed when the benchmark exits.
+string CreateTempFile(const brillo::Blob& data) {
+  static vector<std::unique_ptr<ScopedPathUnlinker>> unlinkers;
+  string path;
+  CHECK(utils::MakeTempFile("Benchmark-XXXXXX", &path, nullptr));
+  unlinkers.push_back(std::make_unique<ScopedPathUnlinker>(path));
+  CHECK(utils::WriteFile(path.c_str(), data.data(), data.size()));
+  return path;
+}
+
+// The old and new images of a partition, with a filesystem made of files of
+// |kFileSize| bytes. The last file of the new image is left out of the
+// filesystem, like the metadata of a real one.
+struct PartitionImages {
+  string old_path;
+  string new_path;
+};
+
+const PartitionImages& GetPartitionImages() {
+  static const PartitionImages* images = [] {
+    auto images = new PartitionImages();
+    const brillo::Blob old_image = GenerateImage(image_size, 1);
+    images->old_path = CreateTempFile(old_image);
+    images->new_path = CreateTempFile(MutateImage(old_image, 2));
+    return images;
+  }();
+  return *images;
+}
+
+// Sets up the |part| config of the partition image at |path|.
+void InitPartitionConfig(const string& path, PartitionConfig* part) {
+  part->path = path;
+  part->size = image_size;
+  const uint64_t num_blocks = image_size / kBlockSize;
+  auto fs = std::make_unique<FakeFilesystem>(kBlockSize, num_blocks);
+  for (uint64_t block = 0; block + 2 * kFileBlocks <= num_blocks;
+       block += kFileBlocks) {
+    fs->AddFile("/file" + std::to_string(block / kFileBlocks),
+                {ExtentForRange(block, kFileBlocks)});
+  }
+  part->fs_interface = std::move(fs);
+}
+
+void BM_ExtentRangesAddSubtract(benchmark::State& state) {
+  const uint64_t num_blocks = image_size / kBlockSize;
+  const vector<Extent> added =
+      GenerateExtents(state.range(0), num_blocks, 64, 1);
+  const vector<Extent> subtracted =
+      GenerateExtents(state.range(0), num_blocks, 64, 2);
+  while (state.KeepRunning()) {
+    ExtentRanges ranges;
+    ranges.AddExtents(added);
+    ranges.SubtractExtents(subtracted);
+    benchmark::DoNotOptimize(ranges.GetExtentsForBlockCount(ranges.blocks()));
+  }
+  state.SetItemsProcessed(state.iterations() * 2 * state.range(0));
+}
+BENCHMARK(BM_ExtentRangesAddSubtract)
+    ->RangeMultiplier(8)
+    ->Range(1 << 10, 1 << 16)
+    ->Unit(benchmark::kMillisecond);
+
+void BM_MapPartitionBlocks(benchmark::State& state) {
+  const PartitionImages& images = GetPartitionImages();
+  while (state.KeepRunning()) {
+    vector<BlockMapping::BlockId> old_block_ids, new_block_ids;
+    CHECK(MapPartitionBlocks(images.old_path,
+                             images.new_path,
+                             image_size,
+                             image_size,
+                             kBlockSize,
+                             &old_block_ids,
+                             &new_block_ids));
+  }
+  state.SetBytesProcessed(state.iterations() * 2 * image_size);
+}
+BENCHMARK(BM_MapPartitionBlocks)->Unit(benchmark::kMillisecond);
+
+// Runs DeltaReadPartition() on the partition images with the profile in the
+// first argument of the |state|, as many times as needed by |state|.
+void BM_DeltaReadPartition(benchmark::State& state) {
+  const PartitionImages& images = GetPartitionImages();
+  PartitionConfig old_part(kPartitionName);
+  InitPartitionConfig(images.old_path, &old_part);
+  PartitionConfig new_part(kPartitionName);
+  InitPartitionConfig(images.new_path, &new_part);
+  const diff_utils::DiffSettings settings = diff_utils::GetDiffSettings(
+      static_cast<GenerationProfile>(state.range(0)));
+  const PayloadVersion version(kBrilloMajorPayloadVersion,
+                               kMaxSupportedMinorPayloadVersion);
+  const string blob_path = CreateTempFile(brillo::Blob());
+  uint64_t blob_size = 0;
+  while (state.KeepRunning()) {
+    int blob_fd = open(blob_path.c_str(), O_WRONLY | O_TRUNC);
+    CHECK_GE(blob_fd, 0);
+    ScopedFdCloser blob_fd_closer(&blob_fd);
+    off_t blob_file_size = 0;
+    BlobFileWriter blob_file(blob_fd, &blob_file_size);
+    vector<AnnotatedOperation> aops;
+    CHECK(diff_utils::DeltaReadPartition(&aops,
+                                         old_part,
+                                         new_part,
+                                         kFileBlocks,  // hard_chunk_blocks
+                                         kFileBlocks,  // soft_chunk_blocks
+                                         false,  // content_defined_chunking
+                                         0,      // memory_budget
+                                         version,
+                                         settings,
+                                         nullptr,  // diff_cache
+                                         &blob_file));
+    blob_size = blob_file_size;
+  }
+  state.SetBytesProcessed(state.iterations() * image_size);
+  state.counters["blob_bytes"] = blob_size;
+}
+BENCHMARK(BM_DeltaReadPartition)
+    ->Arg(static_cast<int>(GenerationProfile::kFast))
+    ->Arg(static_cast<int>(GenerationProfile::kBalanced))
+    ->Arg(static_cast<int>(GenerationProfile::kMax))
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// Returns the SOURCE_COPY and REPLACE operations writing the new partition
+// image in order, one per block, alternating every 16 blocks.
+vector<AnnotatedOperation> GenerateBlockOperations() {
+  vector<AnnotatedOperation> aops;
+  for (uint64_t block = 0; block < image_size / kBlockSize; block++) {
+    AnnotatedOperation aop;
+    aop.name = "block " + std::to_string(block);
+    if (block / 16 % 2) {
+      aop.op.set_type(InstallOperation::REPLACE);
+    } else {
+      aop.op.set_type(InstallOperation::SOURCE_COPY);
+      *aop.op.add_src_extents() = ExtentForRange(block, 1);
+    }
+    *aop.op.add_dst_extents() = ExtentForRange(block, 1);
+    aops.push_back(aop);
+  }
+  return aops;
+}
+
+// Runs |function| on a copy of the |aops|, with a new blob file for the
+// operations it creates, as many times as needed by |state|.
+void RunOperationsBenchmark(
+    benchmark::State& state,
+    const vector<AnnotatedOperation>& aops,
+    const std::function<bool(vector<AnnotatedOperation>*, BlobFileWriter*)>&
+        function) {
+  const string blob_path = CreateTempFile(brillo::Blob());
+  while (state.KeepRunning()) {
+    state.PauseTiming();
+    vector<AnnotatedOperation> aops_copy = aops;
+    int blob_fd = open(blob_path.c_str(), O_WRONLY | O_TRUNC);
+    CHECK_GE(blob_fd, 0);
+    ScopedFdCloser blob_fd_closer(&blob_fd);
+    off_t blob_file_size = 0;
+    BlobFileWriter blob_file(blob_fd, &blob_file_size);
+    state.ResumeTiming();
+    CHECK(function(&aops_copy, &blob_file));
+  }
+  state.SetItemsProcessed(state.iterations() * aops.size());
+}
+
+void BM_FragmentOperations(benchmark::State& state) {
+  // Merge the block operations first, so each one has several extents in
+  // random order to fragment.
+  vector<AnnotatedOperation> aops = GenerateBlockOperations();
+  std::mt19937 rng(1);
+  vector<AnnotatedOperation> merged_aops;
+  for (size_t i = 0; i < aops.size(); i += 16) {
+    AnnotatedOperation aop = aops[i];
+    aop.op.clear_src_extents();
+    aop.op.clear_dst_extents();
+    vector<size_t> blocks;
+    for (size_t j = i; j < std::min(aops.size(), i + 16); j++)
+      blocks.push_back(j);
+    std::shuffle(blocks.begin(), blocks.end(), rng);
+    for (size_t block : blocks) {
+      if (aop.op.type() == InstallOperation::SOURCE_COPY)
+        *aop.op.add_src_extents() = ExtentForRange(block, 1);
+      *aop.op.add_dst_extents() = ExtentForRange(block, 1);
+    }
+    merged_aops.push_back(aop);
+  }
+  const PartitionImages& images = GetPartitionImages();
+  const PayloadVersion version(kBrilloMajorPayloadVersion,
+                               kMaxSupportedMinorPayloadVersion);
+  RunOperationsBenchmark(
+      state,
+      merged_aops,
+      [&images, &version](vector<AnnotatedOperation>* aops,
+                          BlobFileWriter* blob_file) {
+        return ABGenerator::FragmentOperations(version,
+                                               diff_utils::ApplyCostModel(),
+                                               aops,
+                                               images.new_path,
+                                               blob_file);
+      });
+}
+BENCHMARK(BM_FragmentOperations)->Unit(benchmark::kMillisecond);
+
+void BM_MergeOperations(benchmark::State& state) {
+  const PartitionImages& images = GetPartitionImages();
+  const PayloadVersion version(kBrilloMajorPayloadVersion,
+                               kMaxSupportedMinorPayloadVersion);
+  RunOperationsBenchmark(
+      state,
+      GenerateBlockOperations(),
+      [&images, &version](vector<AnnotatedOperation>* aops,
+                          BlobFileWriter* blob_file) {
+        return ABGenerator::MergeOperations(aops,
+                                            version,
+                                            diff_utils::ApplyCostModel(),
+                                            kFileBlocks,
+                                            images.new_path,
+                                            blob_file);
+      });
+}
+BENCHMARK(BM_MergeOperations)->Unit(benchmark::kMillisecond);
+
+void BM_WritePayload(benchmark::State& state) {
+  // A REPLACE operation for each file of the new image, with the blobs stored
+  // in reverse order so the PayloadFile reorders them.
+  const PartitionImages& images = GetPartitionImages();
+  brillo::Blob new_image;
+  CHECK(utils::ReadFile(images.new_path, &new_image));
+  vector<AnnotatedOperation> aops;
+  brillo::Blob blobs;
+  for (size_t offset = image_size; offset > 0; offset -= kFileSize) {
+    AnnotatedOperation aop;
+    aop.name = "file " + std::to_string(offset / kFileSize - 1);
+    aop.op.set_type(InstallOperation::REPLACE);
+    *aop.op.add_dst_extents() =
+        ExtentForRange((offset - kFileSize) / kBlockSize, kFileBlocks);
+    aop.op.set_data_offset(blobs.size());
+    aop.op.set_data_length(kFileSize);
+    blobs.insert(blobs.end(),
+                 new_image.begin() + offset - kFileSize,
+                 new_image.begin() + offset);
+    aops.insert(aops.begin(), aop);
+  }
+  const string blobs_path = CreateTempFile(blobs);
+  const string payload_path = CreateTempFile(brillo::Blob());
+
+  PayloadGenerationConfig config;
+  config.version.major = kBrilloMajorPayloadVersion;
+  config.version.minor = kFullPayloadMinorVersion;
+  PartitionConfig old_part(kPartitionName);
+  PartitionConfig new_part(kPartitionName);
+  new_part.path = images.new_path;
+  new_part.size = image_size;
+  while (state.KeepRunning()) {
+    PayloadFile payload_file;
+    CHECK(payload_file.Init(config));
+    CHECK(payload_file.AddPartition(old_part, new_part, aops));
+    uint64_t metadata_size;
+    CHECK(payload_file.WritePayload(
+        payload_path, blobs_path, "", &metadata_size));
+  }
+  state.SetBytesProcessed(state.iterations() * image_size);
+}
+BENCHMARK(BM_WritePayload)->Unit(benchmark::kMillisecond);
+
+// Generates a 2048 bits RSA private key and returns the path of its PEM file.
+string CreatePrivateKey() {
+  std::unique_ptr<BIGNUM, decltype(&BN_free)> exponent(BN_new(), BN_free);
+  CHECK(exponent && BN_set_word(exponent.get(), RSA_F4) == 1);
+  std::unique_ptr<RSA, decltype(&RSA_free)> rsa(RSA_new(), RSA_free);
+  CHECK(rsa &&
+        RSA_generate_key_ex(rsa.get(), 2048, exponent.get(), nullptr) == 1);
+  const string path = CreateTempFile(brillo::Blob());
+  FILE* file = fopen(path.c_str(), "w");
+  CHECK(file);
+  CHECK_EQ(1,
+           PEM_write_RSAPrivateKey(
+               file, rsa.get(), nullptr, nullptr, 0, nullptr, nullptr));
+  CHECK_EQ(0, fclose(file));
+  return path;
+}
+
+// Signs a batch of as many hashes as the first argument of the |state| with
+// the same private key, as many times as needed by |state|.
+void BM_SignHashes(benchmark::State& state) {
+  static const string private_key_path = CreatePrivateKey();
+  vector<brillo::Blob> hashes;
+  for (int64_t i = 0; i < state.range(0); i++) {
+    hashes.emplace_back();
+    CHECK(HashCalculator::RawHashOfData(GenerateImage(kBlockSize, i),
+                                        &hashes.back()));
+  }
+  while (state.KeepRunning()) {
+    vector<string> signatures;
+    CHECK(PayloadSigner::SignHashesWithKeys(
+        hashes,
+        {private_key_path},
+        [](const brillo::Blob& hash,
+           const string& key,
+           brillo::Blob* out_signature) {
+          return PayloadSigner::SignHash(hash, key, out_signature);
+        },
+        &signatures));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SignHashes)
+    ->Arg(1)
+    ->Arg(16)
+    ->Arg(256)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+}  // namespace
+
+}  // namespace chromeos_update_engine
+
+int main(int argc, char** argv) {
+  // Remove the --benchmark_* flags before parsing ours.
+  benchmark::Initialize(&argc, argv);
+  DEFINE_int32(image_size_mib, 64, "The size of the generated images, in MiB.");
+  brillo::FlagHelper::Init(
+      argc,
+      argv,
+      "Benchmarks the generation of the payloads.\n\n"
+      "The --benchmark_* flags of google-benchmark are also supported. Use "
+      "--benchmark_out=<file> --benchmark_out_format=json to save the "
+      "results.");
+  CHECK_GT(FLAGS_image_size_mib, 1);
+  chromeos_update_engine::image_size =
+      static_cast<size_t>(FLAGS_image_size_mib) *
+      chromeos_update_engine::kNumBytesInOneMiB;
+
+  // The payload generator logs every file and operation it processes.
+  logging::SetMinLogLevel(logging::LOG_WARNING);
+
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
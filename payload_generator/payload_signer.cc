@@ -18,12 +18,17 @@
 
 #include <endian.h>
 
+#include <algorithm>
+#include <map>
+#include <memory>
 #include <utility>
 
 #include <base/logging.h>
 #include <base/strings/string_number_conversions.h>
 #include <base/strings/string_split.h>
 #include <base/strings/string_util.h>
+#include <base/synchronization/lock.h>
+#include <base/threading/simple_thread.h>
 #include <brillo/data_encoding.h>
 #include <openssl/err.h>
 #include <openssl/pem.h>
@@ -37,6 +42,7 @@
 #include "update_engine/payload_consumer/payload_metadata.h"
 #include "update_engine/payload_consumer/payload_verifier.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
 #include "update_engine/payload_generator/payload_file.h"
 #include "update_engine/update_metadata.pb.h"
 
@@ -203,6 +209,58 @@ bool CalculateHashFromPayload(const brillo::Blob& payload,
   return true;
 }
 
+// Returns the RSA private key in |private_key_path|, or nullptr if it can't be
+// loaded. Each key is read and parsed only once, and stays loaded until the
+// process exits. Safe to call from several threads.
+RSA* LoadPrivateKey(const string& private_key_path) {
+  static base::Lock* keys_lock = new base::Lock();
+  static std::map<string, RSA*>* keys = new std::map<string, RSA*>();
+  base::AutoLock auto_lock(*keys_lock);
+  auto it = keys->find(private_key_path);
+  if (it != keys->end())
+    return it->second;
+
+  FILE* fprikey = fopen(private_key_path.c_str(), "rb");
+  if (!fprikey) {
+    PLOG(ERROR) << "Unable to open private key " << private_key_path;
+    return nullptr;
+  }
+  RSA* rsa = PEM_read_RSAPrivateKey(fprikey, nullptr, nullptr, nullptr);
+  fclose(fprikey);
+  if (!rsa) {
+    LOG(ERROR) << "Unable to read private key " << private_key_path;
+    return nullptr;
+  }
+  (*keys)[private_key_path] = rsa;
+  return rsa;
+}
+
+// A thread delegate signing one hash with one key.
+class SignHashDelegate : public base::DelegateSimpleThread::Delegate {
+ public:
+  SignHashDelegate(const PayloadSigner::SignHashCallback& sign_hash,
+                   const brillo::Blob& hash,
+                   const string& key)
+      : sign_hash_(sign_hash), hash_(hash), key_(key) {}
+  ~SignHashDelegate() override = default;
+
+  // Overrides DelegateSimpleThread::Delegate.
+  void Run() override { success_ = sign_hash_(hash_, key_, &signature_); }
+
+  bool success() const { return success_; }
+  const brillo::Blob& signature() const { return signature_; }
+
+ private:
+  const PayloadSigner::SignHashCallback& sign_hash_;
+  const brillo::Blob& hash_;
+  const string& key_;
+
+  bool success_{false};
+  brillo::Blob signature_;
+
+  DISALLOW_COPY_AND_ASSIGN(SignHashDelegate);
+};
+
 }  // namespace
 
 void PayloadSigner::AddSignatureToManifest(uint64_t signature_blob_offset,
@@ -278,10 +336,7 @@ bool PayloadSigner::SignHash(const brillo::Blob& hash,
   // openssl rsautl -raw -sign -inkey |private_key_path|
   //   -in |padded_hash| -out |out_signature|
 
-  FILE* fprikey = fopen(private_key_path.c_str(), "rb");
-  TEST_AND_RETURN_FALSE(fprikey != nullptr);
-  RSA* rsa = PEM_read_RSAPrivateKey(fprikey, nullptr, nullptr, nullptr);
-  fclose(fprikey);
+  RSA* rsa = LoadPrivateKey(private_key_path);
   TEST_AND_RETURN_FALSE(rsa != nullptr);
 
   brillo::Blob padded_hash = hash;
@@ -293,7 +348,6 @@ bool PayloadSigner::SignHash(const brillo::Blob& hash,
                                                signature.data(),
                                                rsa,
                                                RSA_NO_PADDING);
-  RSA_free(rsa);
   if (signature_size < 0) {
     LOG(ERROR) << "Signing hash failed: "
                << ERR_error_string(ERR_get_error(), nullptr);
@@ -308,34 +362,50 @@ bool PayloadSigner::SignHash(const brillo::Blob& hash,
 bool PayloadSigner::SignHashWithKeys(const brillo::Blob& hash_data,
                                      const vector<string>& private_key_paths,
                                      string* out_serialized_signature) {
-  vector<brillo::Blob> signatures;
-  for (const string& path : private_key_paths) {
-    brillo::Blob signature;
-    TEST_AND_RETURN_FALSE(SignHash(hash_data, path, &signature));
-    signatures.push_back(signature);
-  }
-  TEST_AND_RETURN_FALSE(
-      ConvertSignaturesToProtobuf(signatures, out_serialized_signature));
+  vector<string> serialized_signatures;
+  TEST_AND_RETURN_FALSE(SignHashesWithKeys(
+      {hash_data}, private_key_paths, SignHash, &serialized_signatures));
+  *out_serialized_signature = std::move(serialized_signatures[0]);
   return true;
 }
 
-bool PayloadSigner::SignPayload(const string& unsigned_payload_path,
-                                const vector<string>& private_key_paths,
-                                const uint64_t metadata_size,
-                                const uint32_t metadata_signature_size,
-                                const uint64_t signatures_offset,
-                                string* out_serialized_signature) {
-  brillo::Blob payload;
-  TEST_AND_RETURN_FALSE(utils::ReadFile(unsigned_payload_path, &payload));
-  brillo::Blob hash_data;
-  TEST_AND_RETURN_FALSE(CalculateHashFromPayload(payload,
-                                                 metadata_size,
-                                                 metadata_signature_size,
-                                                 signatures_offset,
-                                                 &hash_data,
-                                                 nullptr));
-  TEST_AND_RETURN_FALSE(
-      SignHashWithKeys(hash_data, private_key_paths, out_serialized_signature));
+bool PayloadSigner::SignHashesWithKeys(
+    const vector<brillo::Blob>& hashes,
+    const vector<string>& keys,
+    const SignHashCallback& sign_hash,
+    vector<string>* out_serialized_signatures) {
+  // One delegate per signature, ordered by hash and then by key.
+  vector<std::unique_ptr<SignHashDelegate>> delegates;
+  for (const brillo::Blob& hash : hashes) {
+    for (const string& key : keys)
+      delegates.emplace_back(new SignHashDelegate(sign_hash, hash, key));
+  }
+
+  if (delegates.size() == 1) {
+    delegates[0]->Run();
+  } else if (!delegates.empty()) {
+    base::DelegateSimpleThreadPool thread_pool(
+        "payload-signer",
+        std::min(delegates.size(), diff_utils::GetMaxThreads()));
+    thread_pool.Start();
+    for (const auto& delegate : delegates)
+      thread_pool.AddWork(delegate.get());
+    thread_pool.JoinAll();
+  }
+
+  out_serialized_signatures->clear();
+  auto delegate = delegates.begin();
+  for (size_t i = 0; i < hashes.size(); i++) {
+    vector<brillo::Blob> signatures;
+    for (size_t j = 0; j < keys.size(); j++, delegate++) {
+      TEST_AND_RETURN_FALSE((*delegate)->success());
+      signatures.push_back((*delegate)->signature());
+    }
+    string serialized_signature;
+    TEST_AND_RETURN_FALSE(
+        ConvertSignaturesToProtobuf(signatures, &serialized_signature));
+    out_serialized_signatures->push_back(std::move(serialized_signature));
+  }
   return true;
 }
 
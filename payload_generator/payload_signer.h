@@ -17,6 +17,7 @@
 #ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_PAYLOAD_SIGNER_H_
 #define UPDATE_ENGINE_PAYLOAD_GENERATOR_PAYLOAD_SIGNER_H_
 
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -49,6 +50,7 @@ class PayloadSigner {
 
   // Given a raw |hash| and a private key in |private_key_path| calculates the
   // raw signature in |out_signature|. Returns true on success, false otherwise.
+  // The private keys are loaded once and kept in memory.
   static bool SignHash(const brillo::Blob& hash,
                        const std::string& private_key_path,
                        brillo::Blob* out_signature);
@@ -60,22 +62,28 @@ class PayloadSigner {
       const std::vector<std::string>& private_key_paths,
       std::string* out_serialized_signature);
 
-  // Given an unsigned payload in |unsigned_payload_path|, private keys in
-  // |private_key_path|, metadata size in |metadata_size|, metadata signature
-  // size in |metadata_signature_size| and signatures offset in
-  // |signatures_offset|, calculates the payload signature blob into
-  // |out_serialized_signature|. Note that the payload must already have an
-  // updated manifest that includes the dummy signature op and correct metadata
-  // signature size in header. Returns true on success, false otherwise.
-  static bool SignPayload(const std::string& unsigned_payload_path,
-                          const std::vector<std::string>& private_key_paths,
-                          const uint64_t metadata_size,
-                          const uint32_t metadata_signature_size,
-                          const uint64_t signatures_offset,
-                          std::string* out_serialized_signature);
+  // A function computing the raw signature of a raw |hash| with the key
+  // identified by |key|, like SignHash() does with a private key file. Other
+  // signers, like a remote signing service, can be plugged in this way. It is
+  // called from several threads at once.
+  using SignHashCallback =
+      std::function<bool(const brillo::Blob& hash,
+                         const std::string& key,
+                         brillo::Blob* out_signature)>;
+
+  // Sign each of the |hashes| with all the |keys| using |sign_hash|, then
+  // convert the signatures of each hash to serialized protobuf in
+  // |out_serialized_signatures|, in the same order as |hashes|. All the
+  // signatures are computed concurrently, so the latency of a remote signer is
+  // paid once per batch instead of once per signature.
+  static bool SignHashesWithKeys(
+      const std::vector<brillo::Blob>& hashes,
+      const std::vector<std::string>& keys,
+      const SignHashCallback& sign_hash,
+      std::vector<std::string>* out_serialized_signatures);
 
   // Returns the length of out_serialized_signature that will result in a call
-  // to SignPayload with the given private keys. Returns true on success.
+  // to SignHashWithKeys with the given private keys. Returns true on success.
   static bool SignatureBlobLength(
       const std::vector<std::string>& private_key_paths, uint64_t* out_length);
 
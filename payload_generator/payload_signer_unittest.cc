@@ -22,6 +22,7 @@
 #include <base/logging.h>
 #include <gtest/gtest.h>
 
+#include "update_engine/common/constants.h"
 #include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/test_utils.h"
 #include "update_engine/common/utils.h"
@@ -146,6 +147,35 @@ TEST_F(PayloadSignerTest, VerifyAllSignatureTest) {
       PayloadVerifier::VerifySignature(signature, public_key, hash_data_));
 }
 
+TEST_F(PayloadSignerTest, SignHashesWithKeysTest) {
+  brillo::Blob other_hash(kSHA256Size, 0x42);
+  vector<string> private_keys = {
+      GetBuildArtifactsPath(kUnittestPrivateKeyPath),
+      GetBuildArtifactsPath(kUnittestPrivateKey2Path)};
+  vector<string> signatures;
+  EXPECT_TRUE(PayloadSigner::SignHashesWithKeys({hash_data_, other_hash},
+                                                private_keys,
+                                                PayloadSigner::SignHash,
+                                                &signatures));
+  ASSERT_EQ(2U, signatures.size());
+
+  // The batch gives the same signatures as signing each hash on its own.
+  string signature;
+  EXPECT_TRUE(
+      PayloadSigner::SignHashWithKeys(hash_data_, private_keys, &signature));
+  EXPECT_EQ(signature, signatures[0]);
+  EXPECT_TRUE(
+      PayloadSigner::SignHashWithKeys(other_hash, private_keys, &signature));
+  EXPECT_EQ(signature, signatures[1]);
+
+  // A failure of any of the signatures fails the batch.
+  private_keys.push_back("/non/existent/key.pem");
+  EXPECT_FALSE(PayloadSigner::SignHashesWithKeys({hash_data_, other_hash},
+                                                 private_keys,
+                                                 PayloadSigner::SignHash,
+                                                 &signatures));
+}
+
 TEST_F(PayloadSignerTest, VerifySignatureTest) {
   string signature;
   SignSampleData(&signature, {GetBuildArtifactsPath(kUnittestPrivateKeyPath)});
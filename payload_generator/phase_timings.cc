@@ -0,0 +1,132 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/phase_timings.h"
+
+#include <memory>
+#include <utility>
+
+#include <base/json/json_writer.h>
+#include <base/values.h>
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+const char kPhaseOpenFilesystems[] = "open_filesystems";
+const char kPhaseBlockMapping[] = "block_mapping";
+const char kPhaseFileDiff[] = "file_diff";
+const char kPhaseFragmentOperations[] = "fragment_operations";
+const char kPhaseMergeOperations[] = "merge_operations";
+const char kPhaseSourceHashes[] = "source_hashes";
+const char kPhaseReorderBlobs[] = "reorder_blobs";
+const char kPhaseWritePayload[] = "write_payload";
+const char kPhaseSignPayload[] = "sign_payload";
+
+PhaseTimings* PhaseTimings::Get() {
+  static PhaseTimings* timings = new PhaseTimings();
+  return timings;
+}
+
+void PhaseTimings::Start() {
+  base::AutoLock auto_lock(lock_);
+  phases_.clear();
+  items_.clear();
+  threads_.clear();
+  start_time_ = base::TimeTicks::Now();
+  started_ = true;
+}
+
+void PhaseTimings::Add(const string& phase,
+                       const string& item,
+                       base::TimeDelta duration) {
+  if (!started_)
+    return;
+  base::AutoLock auto_lock(lock_);
+  PhaseTime& phase_time = phases_[phase];
+  phase_time.count++;
+  phase_time.time += duration;
+  if (!item.empty())
+    items_.push_back({phase, item, duration});
+  ThreadTime& thread_time = threads_[base::PlatformThread::CurrentId()];
+  if (thread_time.name.empty())
+    thread_time.name = base::PlatformThread::GetName();
+  thread_time.busy_time += duration;
+}
+
+string PhaseTimings::ToJson() const {
+  base::AutoLock auto_lock(lock_);
+  base::TimeDelta wall_time = base::TimeTicks::Now() - start_time_;
+
+  // Names are stored in lists rather than as keys, since the file names
+  // contain the dots used as separators in the keys of a DictionaryValue.
+  auto phases = std::make_unique<base::ListValue>();
+  for (const auto& it : phases_) {
+    auto value = std::make_unique<base::DictionaryValue>();
+    value->SetString("name", it.first);
+    value->SetInteger("count", static_cast<int>(it.second.count));
+    value->SetDouble("time_ms", it.second.time.InMillisecondsF());
+    phases->Append(std::move(value));
+  }
+
+  auto items = std::make_unique<base::ListValue>();
+  for (const ItemTime& item : items_) {
+    auto value = std::make_unique<base::DictionaryValue>();
+    value->SetString("phase", item.phase);
+    value->SetString("name", item.name);
+    value->SetDouble("time_ms", item.time.InMillisecondsF());
+    items->Append(std::move(value));
+  }
+
+  auto threads = std::make_unique<base::ListValue>();
+  for (const auto& it : threads_) {
+    auto value = std::make_unique<base::DictionaryValue>();
+    value->SetString("name", it.second.name);
+    value->SetDouble("busy_time_ms", it.second.busy_time.InMillisecondsF());
+    double utilization = 0.0;
+    if (!wall_time.is_zero())
+      utilization = it.second.busy_time.InSecondsF() / wall_time.InSecondsF();
+    value->SetDouble("utilization", utilization);
+    threads->Append(std::move(value));
+  }
+
+  base::DictionaryValue value;
+  value.SetDouble("wall_time_ms", wall_time.InMillisecondsF());
+  value.Set("phases", std::move(phases));
+  value.Set("items", std::move(items));
+  value.Set("threads", std::move(threads));
+
+  string json_str;
+  base::JSONWriter::WriteWithOptions(
+      value, base::JSONWriter::OPTIONS_PRETTY_PRINT, &json_str);
+  return json_str;
+}
+
+ScopedPhaseTimer::ScopedPhaseTimer(const char* phase, const string& item)
+    : phase_(phase) {
+  if (!PhaseTimings::Get()->started())
+    return;
+  item_ = item;
+  start_ = base::TimeTicks::Now();
+}
+
+ScopedPhaseTimer::~ScopedPhaseTimer() {
+  if (start_.is_null())
+    return;
+  PhaseTimings::Get()->Add(phase_, item_, base::TimeTicks::Now() - start_);
+}
+
+}  // namespace chromeos_update_engine
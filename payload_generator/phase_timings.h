@@ -0,0 +1,118 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_PHASE_TIMINGS_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_PHASE_TIMINGS_H_
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+#include <base/synchronization/lock.h>
+#include <base/threading/platform_thread.h>
+#include <base/time/time.h>
+
+namespace chromeos_update_engine {
+
+// The names of the timed phases of the payload generation.
+extern const char kPhaseOpenFilesystems[];
+extern const char kPhaseBlockMapping[];
+extern const char kPhaseFileDiff[];
+extern const char kPhaseFragmentOperations[];
+extern const char kPhaseMergeOperations[];
+extern const char kPhaseSourceHashes[];
+extern const char kPhaseReorderBlobs[];
+extern const char kPhaseWritePayload[];
+extern const char kPhaseSignPayload[];
+
+// PhaseTimings collects the time spent in each phase of the payload
+// generation, from all the threads, and reports it as JSON along with the
+// time each thread spent in them. Nothing is collected until Start() is
+// called, so the timers cost close to nothing otherwise.
+class PhaseTimings {
+ public:
+  // Returns the timings of this process.
+  static PhaseTimings* Get();
+
+  // Clears the collected timings and starts collecting new ones. The
+  // utilization of the threads is relative to the time since this call.
+  void Start();
+
+  bool started() const { return started_; }
+
+  // Adds |duration| to the time spent in |phase| and by the current thread.
+  // If not empty, |item| is the file or chunk the time was spent on.
+  void Add(const std::string& phase,
+           const std::string& item,
+           base::TimeDelta duration);
+
+  // Returns the collected timings as JSON: the count and time of each phase,
+  // the time of each item and the busy time and utilization of each thread.
+  std::string ToJson() const;
+
+ private:
+  PhaseTimings() = default;
+
+  struct PhaseTime {
+    uint64_t count{0};
+    base::TimeDelta time;
+  };
+
+  struct ItemTime {
+    std::string phase;
+    std::string name;
+    base::TimeDelta time;
+  };
+
+  struct ThreadTime {
+    std::string name;
+    base::TimeDelta busy_time;
+  };
+
+  std::atomic<bool> started_{false};
+  base::TimeTicks start_time_;
+
+  // Protects the collected timings below.
+  mutable base::Lock lock_;
+  std::map<std::string, PhaseTime> phases_;
+  std::vector<ItemTime> items_;
+  std::map<base::PlatformThreadId, ThreadTime> threads_;
+
+  DISALLOW_COPY_AND_ASSIGN(PhaseTimings);
+};
+
+// Adds the time between its creation and destruction to a phase of the
+// PhaseTimings of the process, if they were started.
+class ScopedPhaseTimer {
+ public:
+  explicit ScopedPhaseTimer(const char* phase)
+      : ScopedPhaseTimer(phase, std::string()) {}
+  ScopedPhaseTimer(const char* phase, const std::string& item);
+  ~ScopedPhaseTimer();
+
+ private:
+  const char* phase_;
+  std::string item_;
+  base::TimeTicks start_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedPhaseTimer);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_PHASE_TIMINGS_H_
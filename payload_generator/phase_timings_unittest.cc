@@ -0,0 +1,104 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/phase_timings.h"
+
+#include <memory>
+#include <string>
+
+#include <base/json/json_reader.h>
+#include <base/values.h>
+#include <gtest/gtest.h>
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+class PhaseTimingsTest : public ::testing::Test {
+ protected:
+  // Returns the list |key| of the JSON report of the timings.
+  const base::ListValue* GetReportList(const string& key) {
+    report_ = base::JSONReader::Read(PhaseTimings::Get()->ToJson());
+    const base::DictionaryValue* dict = nullptr;
+    EXPECT_TRUE(report_ && report_->GetAsDictionary(&dict));
+    const base::ListValue* list = nullptr;
+    EXPECT_TRUE(dict && dict->GetList(key, &list));
+    return list;
+  }
+
+  std::unique_ptr<base::Value> report_;
+};
+
+TEST_F(PhaseTimingsTest, AddsTheTimeOfEachPhaseTest) {
+  PhaseTimings* timings = PhaseTimings::Get();
+  timings->Start();
+  timings->Add(kPhaseFileDiff, "/a.txt", base::TimeDelta::FromMilliseconds(2));
+  timings->Add(kPhaseFileDiff, "/b.txt", base::TimeDelta::FromMilliseconds(3));
+  timings->Add(kPhaseBlockMapping, "", base::TimeDelta::FromMilliseconds(5));
+
+  const base::ListValue* phases = GetReportList("phases");
+  ASSERT_TRUE(phases);
+  ASSERT_EQ(2U, phases->GetSize());
+  // The phases are sorted by name.
+  const base::DictionaryValue* phase = nullptr;
+  string name;
+  int count;
+  double time_ms;
+  ASSERT_TRUE(phases->GetDictionary(1, &phase));
+  EXPECT_TRUE(phase->GetString("name", &name));
+  EXPECT_EQ(kPhaseFileDiff, name);
+  EXPECT_TRUE(phase->GetInteger("count", &count));
+  EXPECT_EQ(2, count);
+  EXPECT_TRUE(phase->GetDouble("time_ms", &time_ms));
+  EXPECT_DOUBLE_EQ(5.0, time_ms);
+
+  // Only the file diffs have an item.
+  const base::ListValue* items = GetReportList("items");
+  ASSERT_TRUE(items);
+  ASSERT_EQ(2U, items->GetSize());
+  const base::DictionaryValue* item = nullptr;
+  ASSERT_TRUE(items->GetDictionary(1, &item));
+  EXPECT_TRUE(item->GetString("name", &name));
+  EXPECT_EQ("/b.txt", name);
+
+  // All the time was spent by this thread.
+  const base::ListValue* threads = GetReportList("threads");
+  ASSERT_TRUE(threads);
+  ASSERT_EQ(1U, threads->GetSize());
+  const base::DictionaryValue* thread = nullptr;
+  ASSERT_TRUE(threads->GetDictionary(0, &thread));
+  EXPECT_TRUE(thread->GetDouble("busy_time_ms", &time_ms));
+  EXPECT_DOUBLE_EQ(10.0, time_ms);
+}
+
+TEST_F(PhaseTimingsTest, StartClearsTheTimingsTest) {
+  PhaseTimings* timings = PhaseTimings::Get();
+  timings->Start();
+  { ScopedPhaseTimer timer(kPhaseMergeOperations); }
+  timings->Start();
+  { ScopedPhaseTimer timer(kPhaseSourceHashes, "item"); }
+
+  const base::ListValue* phases = GetReportList("phases");
+  ASSERT_TRUE(phases);
+  ASSERT_EQ(1U, phases->GetSize());
+  const base::DictionaryValue* phase = nullptr;
+  string name;
+  ASSERT_TRUE(phases->GetDictionary(0, &phase));
+  EXPECT_TRUE(phase->GetString("name", &name));
+  EXPECT_EQ(kPhaseSourceHashes, name);
+}
+
+}  // namespace chromeos_update_engine
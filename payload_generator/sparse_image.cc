@@ -0,0 +1,212 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/sparse_image.h"
+
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <base/logging.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/utils.h"
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The format of the Android sparse images, from libsparse's sparse_format.h.
+// All the fields are little-endian.
+const uint32_t kSparseHeaderMagic = 0xed26ff3a;
+const uint16_t kSparseMajorVersion = 1;
+const uint16_t kChunkTypeRaw = 0xCAC1;
+const uint16_t kChunkTypeFill = 0xCAC2;
+const uint16_t kChunkTypeDontCare = 0xCAC3;
+const uint16_t kChunkTypeCrc32 = 0xCAC4;
+
+struct SparseHeader {
+  uint32_t magic;
+  uint16_t major_version;
+  uint16_t minor_version;
+  uint16_t file_hdr_sz;
+  uint16_t chunk_hdr_sz;
+  uint32_t blk_sz;
+  uint32_t total_blks;
+  uint32_t total_chunks;
+  uint32_t image_checksum;
+} __attribute__((packed));
+
+struct ChunkHeader {
+  uint16_t chunk_type;
+  uint16_t reserved1;
+  uint32_t chunk_sz;
+  uint32_t total_sz;
+} __attribute__((packed));
+
+// The size of the buffer used to copy the RAW chunks and write the FILL ones.
+const size_t kCopyBufferSize = 1024 * 1024;
+
+// Reads the sparse image header from |fd|, and returns whether it is valid.
+bool ReadSparseHeader(int fd, SparseHeader* header) {
+  ssize_t bytes_read = 0;
+  if (!utils::PReadAll(fd, header, sizeof(*header), 0, &bytes_read) ||
+      bytes_read != static_cast<ssize_t>(sizeof(*header))) {
+    return false;
+  }
+  header->magic = le32toh(header->magic);
+  header->major_version = le16toh(header->major_version);
+  header->minor_version = le16toh(header->minor_version);
+  header->file_hdr_sz = le16toh(header->file_hdr_sz);
+  header->chunk_hdr_sz = le16toh(header->chunk_hdr_sz);
+  header->blk_sz = le32toh(header->blk_sz);
+  header->total_blks = le32toh(header->total_blks);
+  header->total_chunks = le32toh(header->total_chunks);
+  return header->magic == kSparseHeaderMagic &&
+         header->major_version == kSparseMajorVersion &&
+         header->file_hdr_sz >= sizeof(SparseHeader) &&
+         header->chunk_hdr_sz >= sizeof(ChunkHeader) && header->blk_sz > 0 &&
+         header->blk_sz % 4 == 0;
+}
+
+// Copies |length| bytes at |in_offset| of |in_fd| to |out_offset| of |out_fd|.
+bool CopyRange(int in_fd,
+               off_t in_offset,
+               int out_fd,
+               off_t out_offset,
+               uint64_t length) {
+  brillo::Blob buf(std::min<uint64_t>(length, kCopyBufferSize));
+  while (length > 0) {
+    size_t count = std::min<uint64_t>(length, buf.size());
+    ssize_t bytes_read = 0;
+    TEST_AND_RETURN_FALSE(
+        utils::PReadAll(in_fd, buf.data(), count, in_offset, &bytes_read));
+    TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(count));
+    TEST_AND_RETURN_FALSE(
+        utils::PWriteAll(out_fd, buf.data(), count, out_offset));
+    in_offset += count;
+    out_offset += count;
+    length -= count;
+  }
+  return true;
+}
+
+// Writes |length| bytes repeating the 4 bytes of |fill| at |offset| of |fd|.
+bool WriteFill(int fd, off_t offset, uint64_t length, const uint8_t* fill) {
+  brillo::Blob buf(std::min<uint64_t>(length, kCopyBufferSize));
+  for (size_t i = 0; i < buf.size(); i++)
+    buf[i] = fill[i % 4];
+  while (length > 0) {
+    size_t count = std::min<uint64_t>(length, buf.size());
+    TEST_AND_RETURN_FALSE(utils::PWriteAll(fd, buf.data(), count, offset));
+    offset += count;
+    length -= count;
+  }
+  return true;
+}
+
+}  // namespace
+
+bool IsSparseImage(const string& path) {
+  int fd = HANDLE_EINTR(open(path.c_str(), O_RDONLY));
+  if (fd < 0)
+    return false;
+  ScopedFdCloser fd_closer(&fd);
+  SparseHeader header;
+  return ReadSparseHeader(fd, &header);
+}
+
+bool ExpandSparseImage(const string& sparse_path, const string& raw_path) {
+  int in_fd = HANDLE_EINTR(open(sparse_path.c_str(), O_RDONLY));
+  TEST_AND_RETURN_FALSE_ERRNO(in_fd >= 0);
+  ScopedFdCloser in_fd_closer(&in_fd);
+  SparseHeader header;
+  if (!ReadSparseHeader(in_fd, &header)) {
+    LOG(ERROR) << sparse_path << " is not a valid Android sparse image.";
+    return false;
+  }
+
+  int out_fd = HANDLE_EINTR(
+      open(raw_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+  TEST_AND_RETURN_FALSE_ERRNO(out_fd >= 0);
+  ScopedFdCloser out_fd_closer(&out_fd);
+  // The whole raw image starts as a hole, which reads as zeros.
+  uint64_t raw_size = static_cast<uint64_t>(header.total_blks) * header.blk_sz;
+  TEST_AND_RETURN_FALSE_ERRNO(ftruncate(out_fd, raw_size) == 0);
+
+  off_t in_offset = header.file_hdr_sz;
+  uint64_t block = 0;
+  for (uint32_t i = 0; i < header.total_chunks; i++) {
+    ChunkHeader chunk;
+    ssize_t bytes_read = 0;
+    TEST_AND_RETURN_FALSE(utils::PReadAll(
+        in_fd, &chunk, sizeof(chunk), in_offset, &bytes_read));
+    TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(sizeof(chunk)));
+    uint16_t chunk_type = le16toh(chunk.chunk_type);
+    uint64_t chunk_blocks = le32toh(chunk.chunk_sz);
+    uint64_t data_size = le32toh(chunk.total_sz);
+    TEST_AND_RETURN_FALSE(data_size >= header.chunk_hdr_sz);
+    data_size -= header.chunk_hdr_sz;
+    off_t data_offset = in_offset + header.chunk_hdr_sz;
+    uint64_t chunk_bytes = chunk_blocks * header.blk_sz;
+    off_t out_offset = block * header.blk_sz;
+    if (chunk_type != kChunkTypeCrc32)
+      TEST_AND_RETURN_FALSE(block + chunk_blocks <= header.total_blks);
+
+    switch (chunk_type) {
+      case kChunkTypeRaw:
+        TEST_AND_RETURN_FALSE(data_size == chunk_bytes);
+        TEST_AND_RETURN_FALSE(
+            CopyRange(in_fd, data_offset, out_fd, out_offset, chunk_bytes));
+        break;
+      case kChunkTypeFill: {
+        uint8_t fill[4];
+        TEST_AND_RETURN_FALSE(data_size == sizeof(fill));
+        TEST_AND_RETURN_FALSE(utils::PReadAll(
+            in_fd, fill, sizeof(fill), data_offset, &bytes_read));
+        TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(sizeof(fill)));
+        if (fill[0] || fill[1] || fill[2] || fill[3]) {
+          TEST_AND_RETURN_FALSE(
+              WriteFill(out_fd, out_offset, chunk_bytes, fill));
+        }
+        break;
+      }
+      case kChunkTypeDontCare:
+        TEST_AND_RETURN_FALSE(data_size == 0);
+        break;
+      case kChunkTypeCrc32:
+        // The checksum doesn't cover any block of the image.
+        chunk_blocks = 0;
+        break;
+      default:
+        LOG(ERROR) << "Unknown chunk type 0x" << std::hex << chunk_type
+                   << " in sparse image " << sparse_path;
+        return false;
+    }
+    block += chunk_blocks;
+    in_offset = data_offset + data_size;
+  }
+  TEST_AND_RETURN_FALSE(block == header.total_blks);
+  LOG(INFO) << "Expanded sparse image " << sparse_path << " to " << raw_path
+            << " (" << raw_size << " bytes)";
+  return true;
+}
+
+}  // namespace chromeos_update_engine
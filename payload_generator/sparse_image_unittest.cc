@@ -0,0 +1,131 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/sparse_image.h"
+
+#include <endian.h>
+
+#include <string>
+
+#include <brillo/secure_blob.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+const uint32_t kBlockSize = 4096;
+
+void AppendUint16(brillo::Blob* data, uint16_t value) {
+  value = htole16(value);
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+  data->insert(data->end(), bytes, bytes + sizeof(value));
+}
+
+void AppendUint32(brillo::Blob* data, uint32_t value) {
+  value = htole32(value);
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+  data->insert(data->end(), bytes, bytes + sizeof(value));
+}
+
+// Appends a chunk header of |chunk_type| for |chunk_blocks| blocks followed by
+// |data_size| bytes of data.
+void AppendChunkHeader(brillo::Blob* data,
+                       uint16_t chunk_type,
+                       uint32_t chunk_blocks,
+                       uint32_t data_size) {
+  AppendUint16(data, chunk_type);
+  AppendUint16(data, 0);
+  AppendUint32(data, chunk_blocks);
+  AppendUint32(data, 12 + data_size);
+}
+
+}  // namespace
+
+class SparseImageTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    // The header of a sparse image of 8 blocks in 6 chunks.
+    AppendUint32(&sparse_data_, 0xed26ff3a);
+    AppendUint16(&sparse_data_, 1);
+    AppendUint16(&sparse_data_, 0);
+    AppendUint16(&sparse_data_, 28);
+    AppendUint16(&sparse_data_, 12);
+    AppendUint32(&sparse_data_, kBlockSize);
+    AppendUint32(&sparse_data_, 8);
+    AppendUint32(&sparse_data_, 6);
+    AppendUint32(&sparse_data_, 0);
+
+    // One RAW block.
+    AppendChunkHeader(&sparse_data_, 0xCAC1, 1, kBlockSize);
+    sparse_data_.insert(sparse_data_.end(), kBlockSize, 'a');
+    expected_data_.insert(expected_data_.end(), kBlockSize, 'a');
+    // Two blocks filled with a pattern.
+    AppendChunkHeader(&sparse_data_, 0xCAC2, 2, 4);
+    sparse_data_.insert(sparse_data_.end(), {1, 2, 3, 4});
+    for (size_t i = 0; i < 2 * kBlockSize; i++)
+      expected_data_.push_back(1 + i % 4);
+    // Three DONT_CARE blocks.
+    AppendChunkHeader(&sparse_data_, 0xCAC3, 3, 0);
+    expected_data_.insert(expected_data_.end(), 3 * kBlockSize, 0);
+    // One block filled with zeros.
+    AppendChunkHeader(&sparse_data_, 0xCAC2, 1, 4);
+    sparse_data_.insert(sparse_data_.end(), {0, 0, 0, 0});
+    expected_data_.insert(expected_data_.end(), kBlockSize, 0);
+    // A checksum, which doesn't have any block.
+    AppendChunkHeader(&sparse_data_, 0xCAC4, 0, 4);
+    sparse_data_.insert(sparse_data_.end(), {0, 0, 0, 0});
+    // One last RAW block.
+    AppendChunkHeader(&sparse_data_, 0xCAC1, 1, kBlockSize);
+    sparse_data_.insert(sparse_data_.end(), kBlockSize, 'b');
+    expected_data_.insert(expected_data_.end(), kBlockSize, 'b');
+  }
+
+  brillo::Blob sparse_data_;
+  brillo::Blob expected_data_;
+
+  test_utils::ScopedTempFile sparse_file_{"SparseImageTest_sparse.XXXXXX"};
+  test_utils::ScopedTempFile raw_file_{"SparseImageTest_raw.XXXXXX"};
+};
+
+TEST_F(SparseImageTest, ExpandSparseImageTest) {
+  ASSERT_TRUE(test_utils::WriteFileVector(sparse_file_.path(), sparse_data_));
+  EXPECT_TRUE(IsSparseImage(sparse_file_.path()));
+  EXPECT_TRUE(ExpandSparseImage(sparse_file_.path(), raw_file_.path()));
+
+  brillo::Blob raw_data;
+  EXPECT_TRUE(utils::ReadFile(raw_file_.path(), &raw_data));
+  EXPECT_EQ(expected_data_, raw_data);
+}
+
+TEST_F(SparseImageTest, RawImageIsNotSparseTest) {
+  ASSERT_TRUE(test_utils::WriteFileVector(sparse_file_.path(), expected_data_));
+  EXPECT_FALSE(IsSparseImage(sparse_file_.path()));
+  EXPECT_FALSE(ExpandSparseImage(sparse_file_.path(), raw_file_.path()));
+}
+
+TEST_F(SparseImageTest, TruncatedSparseImageFailsTest) {
+  sparse_data_.resize(sparse_data_.size() - kBlockSize);
+  ASSERT_TRUE(test_utils::WriteFileVector(sparse_file_.path(), sparse_data_));
+  EXPECT_FALSE(ExpandSparseImage(sparse_file_.path(), raw_file_.path()));
+}
+
+}  // namespace chromeos_update_engine
@@ -17,13 +17,17 @@
 #include "update_engine/payload_generator/squashfs_filesystem.h"
 
 #include <fcntl.h>
+#include <zlib.h>
 
 #include <algorithm>
+#include <map>
+#include <set>
 #include <string>
 #include <utility>
 
 #include <base/files/file_util.h>
 #include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
 #include <base/strings/string_number_conversions.h>
 #include <base/strings/string_split.h>
 #include <brillo/streams/file_stream.h>
@@ -36,6 +40,8 @@
 #include "update_engine/payload_generator/extent_utils.h"
 #include "update_engine/update_metadata.pb.h"
 
+using std::map;
+using std::set;
 using std::string;
 using std::unique_ptr;
 using std::vector;
@@ -88,23 +94,9 @@ bool GetFileMapContent(const string& sqfs_path, string* map) {
   return true;
 }
 
-}  // namespace
-
-bool SquashfsFilesystem::Init(const string& map,
-                              const string& sqfs_path,
-                              size_t size,
-                              const SquashfsHeader& header,
-                              bool extract_deflates) {
-  size_ = size;
-
-  bool is_zlib = header.compression_type == kSquashfsZlibCompression;
-  if (!is_zlib) {
-    LOG(WARNING) << "Filesystem is not Gzipped. Not filling deflates!";
-  }
-  vector<puffin::ByteExtent> zlib_blks;
-
-  // Reading files map. For the format of the file map look at the comments for
-  // |CreateFromFileMap()|.
+// Parses the text file map described in CreateFromFileMap().
+bool ParseFileMap(const string& map,
+                  vector<SquashfsFilesystem::FileMapEntry>* entries) {
   auto lines = base::SplitStringPiece(map,
                                       "\n",
                                       base::WhitespaceHandling::KEEP_WHITESPACE,
@@ -117,12 +109,400 @@ bool SquashfsFilesystem::Init(const string& map,
                                base::SplitResult::SPLIT_WANT_NONEMPTY);
     // Only filename is invalid.
     TEST_AND_RETURN_FALSE(splits.size() > 1);
-    uint64_t start;
-    TEST_AND_RETURN_FALSE(base::StringToUint64(splits[1], &start));
-    uint64_t cur_offset = start;
+    SquashfsFilesystem::FileMapEntry entry;
+    entry.name = splits[0].as_string();
+    TEST_AND_RETURN_FALSE(base::StringToUint64(splits[1], &entry.start));
     for (size_t i = 2; i < splits.size(); ++i) {
       uint64_t blk_size;
       TEST_AND_RETURN_FALSE(base::StringToUint64(splits[i], &blk_size));
+      entry.block_sizes.push_back(blk_size);
+    }
+    entries->push_back(std::move(entry));
+  }
+  return true;
+}
+
+// The on-disk structures of squashfs 4, as defined in fs/squashfs/squashfs_fs.h
+// in the kernel header tree. All the fields are little-endian.
+constexpr size_t kSquashfsMetadataSize = 8192;
+constexpr uint16_t kSquashfsMetadataUncompressedBit = 1 << 15;
+constexpr uint32_t kSquashfsInvalidFragment = 0xffffffff;
+constexpr uint16_t kSquashfsDirType = 1;
+constexpr uint16_t kSquashfsRegType = 2;
+constexpr uint16_t kSquashfsLDirType = 8;
+constexpr uint16_t kSquashfsLRegType = 9;
+
+struct SquashfsSuperBlock {
+  uint32_t s_magic;
+  uint32_t inodes;
+  uint32_t mkfs_time;
+  uint32_t block_size;
+  uint32_t fragments;
+  uint16_t compression;
+  uint16_t block_log;
+  uint16_t flags;
+  uint16_t no_ids;
+  uint16_t s_major;
+  uint16_t s_minor;
+  uint64_t root_inode;
+  uint64_t bytes_used;
+  uint64_t id_table_start;
+  uint64_t xattr_id_table_start;
+  uint64_t inode_table_start;
+  uint64_t directory_table_start;
+  uint64_t fragment_table_start;
+  uint64_t lookup_table_start;
+};
+static_assert(sizeof(SquashfsSuperBlock) == kSquashfsSuperBlockSize,
+              "Unexpected squashfs super block size");
+
+struct SquashfsBaseInode {
+  uint16_t inode_type;
+  uint16_t mode;
+  uint16_t uid;
+  uint16_t guid;
+  uint32_t mtime;
+  uint32_t inode_number;
+};
+
+struct SquashfsDirInode {
+  uint32_t start_block;
+  uint32_t nlink;
+  uint16_t file_size;
+  uint16_t offset;
+  uint32_t parent_inode;
+};
+
+struct SquashfsLDirInode {
+  uint32_t nlink;
+  uint32_t file_size;
+  uint32_t start_block;
+  uint32_t parent_inode;
+  uint16_t i_count;
+  uint16_t offset;
+  uint32_t xattr;
+};
+
+struct SquashfsRegInode {
+  uint32_t start_block;
+  uint32_t fragment;
+  uint32_t offset;
+  uint32_t file_size;
+};
+
+struct SquashfsLRegInode {
+  uint64_t start_block;
+  uint64_t file_size;
+  uint64_t sparse;
+  uint32_t nlink;
+  uint32_t fragment;
+  uint32_t offset;
+  uint32_t xattr;
+};
+
+struct SquashfsDirHeader {
+  uint32_t count;
+  uint32_t start_block;
+  uint32_t inode_number;
+};
+
+struct SquashfsDirEntry {
+  uint16_t offset;
+  int16_t inode_number;
+  uint16_t type;
+  uint16_t size;
+};
+
+struct SquashfsFragmentEntry {
+  uint64_t start_block;
+  uint32_t size;
+  uint32_t unused;
+};
+
+// Lists the regular files and the fragment blocks of a gzipped squashfs image
+// by reading its inode, directory and fragment tables, the same way
+// unsquashfs -m does.
+class SquashfsReader {
+ public:
+  explicit SquashfsReader(int fd) : fd_(fd) {}
+
+  bool ReadEntries(vector<SquashfsFilesystem::FileMapEntry>* entries);
+
+ private:
+  struct MetadataBlock {
+    brillo::Blob data;
+    // The address of the metadata block that follows this one.
+    uint64_t next;
+  };
+
+  // A position in a metadata table: the address of a metadata block and an
+  // offset in its uncompressed data.
+  struct MetadataPosition {
+    uint64_t block;
+    size_t offset;
+  };
+
+  // Sets |block| to the metadata block at |address|, reading it if needed.
+  bool GetMetadataBlock(uint64_t address, const MetadataBlock** block);
+
+  // Reads |length| bytes of the metadata starting at |position| and advances
+  // |position| past them.
+  bool ReadMetadata(MetadataPosition* position, void* out, size_t length);
+
+  // Lists the entries of the directory with inode |inode_ref|, whose path is
+  // |path|.
+  bool ReadDirectory(const string& path, uint64_t inode_ref);
+  bool ReadFile(const string& path, uint64_t inode_ref);
+  bool ReadFragments();
+
+  MetadataPosition InodePosition(uint64_t inode_ref) const {
+    return {super_block_.inode_table_start + (inode_ref >> 16),
+            static_cast<size_t>(inode_ref & 0xffff)};
+  }
+
+  int fd_;
+  SquashfsSuperBlock super_block_;
+  map<uint64_t, MetadataBlock> metadata_blocks_;
+  // The directories already listed, to not loop on a corrupted image.
+  set<uint64_t> directories_;
+  vector<SquashfsFilesystem::FileMapEntry>* entries_ = nullptr;
+
+  DISALLOW_COPY_AND_ASSIGN(SquashfsReader);
+};
+
+bool SquashfsReader::ReadEntries(
+    vector<SquashfsFilesystem::FileMapEntry>* entries) {
+  ssize_t bytes_read;
+  TEST_AND_RETURN_FALSE(utils::PReadAll(
+      fd_, &super_block_, sizeof(super_block_), 0, &bytes_read));
+  TEST_AND_RETURN_FALSE(bytes_read == sizeof(super_block_));
+  TEST_AND_RETURN_FALSE(super_block_.compression == kSquashfsZlibCompression);
+
+  entries_ = entries;
+  TEST_AND_RETURN_FALSE(ReadDirectory("", super_block_.root_inode));
+  TEST_AND_RETURN_FALSE(ReadFragments());
+  return true;
+}
+
+bool SquashfsReader::GetMetadataBlock(uint64_t address,
+                                      const MetadataBlock** block) {
+  auto it = metadata_blocks_.find(address);
+  if (it == metadata_blocks_.end()) {
+    uint16_t header;
+    ssize_t bytes_read;
+    TEST_AND_RETURN_FALSE(
+        utils::PReadAll(fd_, &header, sizeof(header), address, &bytes_read));
+    TEST_AND_RETURN_FALSE(bytes_read == sizeof(header));
+    brillo::Blob raw(header & ~kSquashfsMetadataUncompressedBit);
+    TEST_AND_RETURN_FALSE(utils::PReadAll(
+        fd_, raw.data(), raw.size(), address + sizeof(header), &bytes_read));
+    TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(raw.size()));
+
+    MetadataBlock new_block;
+    new_block.next = address + sizeof(header) + raw.size();
+    if (header & kSquashfsMetadataUncompressedBit) {
+      new_block.data = std::move(raw);
+    } else {
+      new_block.data.resize(kSquashfsMetadataSize);
+      uLongf size = new_block.data.size();
+      TEST_AND_RETURN_FALSE(uncompress(new_block.data.data(),
+                                       &size,
+                                       raw.data(),
+                                       raw.size()) == Z_OK);
+      new_block.data.resize(size);
+    }
+    it = metadata_blocks_.emplace(address, std::move(new_block)).first;
+  }
+  *block = &it->second;
+  return true;
+}
+
+bool SquashfsReader::ReadMetadata(MetadataPosition* position,
+                                  void* out,
+                                  size_t length) {
+  uint8_t* data = static_cast<uint8_t*>(out);
+  while (length > 0) {
+    const MetadataBlock* block;
+    TEST_AND_RETURN_FALSE(GetMetadataBlock(position->block, &block));
+    TEST_AND_RETURN_FALSE(position->offset <= block->data.size());
+    if (position->offset == block->data.size()) {
+      // Continue on the next metadata block.
+      *position = {block->next, 0};
+      continue;
+    }
+    size_t size = std::min(length, block->data.size() - position->offset);
+    memcpy(data, block->data.data() + position->offset, size);
+    data += size;
+    length -= size;
+    position->offset += size;
+  }
+  return true;
+}
+
+bool SquashfsReader::ReadDirectory(const string& path, uint64_t inode_ref) {
+  TEST_AND_RETURN_FALSE(directories_.insert(inode_ref).second);
+
+  MetadataPosition position = InodePosition(inode_ref);
+  SquashfsBaseInode base_inode;
+  TEST_AND_RETURN_FALSE(
+      ReadMetadata(&position, &base_inode, sizeof(base_inode)));
+  uint64_t start_block, offset, file_size;
+  if (base_inode.inode_type == kSquashfsDirType) {
+    SquashfsDirInode inode;
+    TEST_AND_RETURN_FALSE(ReadMetadata(&position, &inode, sizeof(inode)));
+    start_block = inode.start_block;
+    offset = inode.offset;
+    file_size = inode.file_size;
+  } else if (base_inode.inode_type == kSquashfsLDirType) {
+    SquashfsLDirInode inode;
+    TEST_AND_RETURN_FALSE(ReadMetadata(&position, &inode, sizeof(inode)));
+    start_block = inode.start_block;
+    offset = inode.offset;
+    file_size = inode.file_size;
+  } else {
+    LOG(ERROR) << "Inode of " << path << " is not a directory.";
+    return false;
+  }
+
+  // The size of a directory includes three bytes for the "." and ".."
+  // entries, which are not stored.
+  uint64_t remaining = file_size > 3 ? file_size - 3 : 0;
+  position = {super_block_.directory_table_start + start_block,
+              static_cast<size_t>(offset)};
+  while (remaining > 0) {
+    SquashfsDirHeader header;
+    TEST_AND_RETURN_FALSE(remaining >= sizeof(header));
+    TEST_AND_RETURN_FALSE(ReadMetadata(&position, &header, sizeof(header)));
+    remaining -= sizeof(header);
+    for (uint64_t i = 0; i <= header.count; i++) {
+      SquashfsDirEntry entry;
+      TEST_AND_RETURN_FALSE(remaining >= sizeof(entry));
+      TEST_AND_RETURN_FALSE(ReadMetadata(&position, &entry, sizeof(entry)));
+      // The size of the name is stored minus one.
+      string name(entry.size + 1, '\0');
+      TEST_AND_RETURN_FALSE(remaining >= sizeof(entry) + name.size());
+      TEST_AND_RETURN_FALSE(ReadMetadata(&position, &name[0], name.size()));
+      remaining -= sizeof(entry) + name.size();
+
+      string entry_path = path.empty() ? name : path + "/" + name;
+      uint64_t entry_inode_ref =
+          (static_cast<uint64_t>(header.start_block) << 16) | entry.offset;
+      if (entry.type == kSquashfsDirType) {
+        TEST_AND_RETURN_FALSE(ReadDirectory(entry_path, entry_inode_ref));
+      } else if (entry.type == kSquashfsRegType) {
+        TEST_AND_RETURN_FALSE(ReadFile(entry_path, entry_inode_ref));
+      }
+    }
+  }
+  return true;
+}
+
+bool SquashfsReader::ReadFile(const string& path, uint64_t inode_ref) {
+  MetadataPosition position = InodePosition(inode_ref);
+  SquashfsBaseInode base_inode;
+  TEST_AND_RETURN_FALSE(
+      ReadMetadata(&position, &base_inode, sizeof(base_inode)));
+  uint64_t start_block, file_size;
+  uint32_t fragment;
+  if (base_inode.inode_type == kSquashfsRegType) {
+    SquashfsRegInode inode;
+    TEST_AND_RETURN_FALSE(ReadMetadata(&position, &inode, sizeof(inode)));
+    start_block = inode.start_block;
+    file_size = inode.file_size;
+    fragment = inode.fragment;
+  } else if (base_inode.inode_type == kSquashfsLRegType) {
+    SquashfsLRegInode inode;
+    TEST_AND_RETURN_FALSE(ReadMetadata(&position, &inode, sizeof(inode)));
+    start_block = inode.start_block;
+    file_size = inode.file_size;
+    fragment = inode.fragment;
+  } else {
+    LOG(ERROR) << "Inode of " << path << " is not a regular file.";
+    return false;
+  }
+
+  // The tail of the file is in a fragment block if it has one, otherwise in
+  // a last, partial, block.
+  uint64_t num_blocks = file_size / super_block_.block_size;
+  if (fragment == kSquashfsInvalidFragment &&
+      file_size % super_block_.block_size != 0) {
+    num_blocks++;
+  }
+
+  SquashfsFilesystem::FileMapEntry entry;
+  entry.name = path;
+  entry.start = start_block;
+  for (uint64_t i = 0; i < num_blocks; i++) {
+    uint32_t block_size;
+    TEST_AND_RETURN_FALSE(
+        ReadMetadata(&position, &block_size, sizeof(block_size)));
+    entry.block_sizes.push_back(block_size);
+  }
+  entries_->push_back(std::move(entry));
+  return true;
+}
+
+bool SquashfsReader::ReadFragments() {
+  // The fragment table is indexed by the addresses of its metadata blocks.
+  size_t entries_per_block =
+      kSquashfsMetadataSize / sizeof(SquashfsFragmentEntry);
+  size_t num_blocks = (super_block_.fragments + entries_per_block - 1) /
+                      entries_per_block;
+  vector<uint64_t> index(num_blocks);
+  ssize_t bytes_read;
+  TEST_AND_RETURN_FALSE(utils::PReadAll(fd_,
+                                        index.data(),
+                                        index.size() * sizeof(uint64_t),
+                                        super_block_.fragment_table_start,
+                                        &bytes_read));
+  TEST_AND_RETURN_FALSE(bytes_read ==
+                        static_cast<ssize_t>(index.size() * sizeof(uint64_t)));
+
+  for (uint32_t i = 0; i < super_block_.fragments; i++) {
+    MetadataPosition position = {
+        index[i / entries_per_block],
+        (i % entries_per_block) * sizeof(SquashfsFragmentEntry)};
+    SquashfsFragmentEntry fragment;
+    TEST_AND_RETURN_FALSE(
+        ReadMetadata(&position, &fragment, sizeof(fragment)));
+    SquashfsFilesystem::FileMapEntry entry;
+    entry.name = "<fragment-" + std::to_string(i) + ">";
+    entry.start = fragment.start_block;
+    entry.block_sizes = {fragment.size};
+    entries_->push_back(std::move(entry));
+  }
+  return true;
+}
+
+// Lists the files of the squashfs image at |sqfs_path|, which must be gzipped.
+bool ReadFileMapEntries(const string& sqfs_path,
+                        vector<SquashfsFilesystem::FileMapEntry>* entries) {
+  int fd = HANDLE_EINTR(open(sqfs_path.c_str(), O_RDONLY));
+  TEST_AND_RETURN_FALSE_ERRNO(fd >= 0);
+  ScopedFdCloser fd_closer(&fd);
+  SquashfsReader reader(fd);
+  return reader.ReadEntries(entries);
+}
+
+}  // namespace
+
+bool SquashfsFilesystem::Init(const vector<FileMapEntry>& entries,
+                              const string& sqfs_path,
+                              size_t size,
+                              const SquashfsHeader& header,
+                              bool extract_deflates) {
+  size_ = size;
+
+  bool is_zlib = header.compression_type == kSquashfsZlibCompression;
+  if (!is_zlib) {
+    LOG(WARNING) << "Filesystem is not Gzipped. Not filling deflates!";
+  }
+  vector<puffin::ByteExtent> zlib_blks;
+
+  for (const auto& entry : entries) {
+    uint64_t start = entry.start;
+    uint64_t cur_offset = start;
+    for (uint64_t blk_size : entry.block_sizes) {
       // TODO(ahassani): For puffin push it into a proper list if uncompressed.
       auto new_blk_size = blk_size & ~kSquashfsCompressedBit;
       TEST_AND_RETURN_FALSE(new_blk_size <= header.block_size);
@@ -138,7 +518,7 @@ bool SquashfsFilesystem::Init(const string& map,
     // If size is zero do not add the file.
     if (cur_offset - start > 0) {
       File file;
-      file.name = splits[0].as_string();
+      file.name = entry.name;
       file.extents = {ExtentForBytes(kBlockSize, start, cur_offset - start)};
       files_.emplace_back(file);
     }
@@ -264,16 +644,25 @@ unique_ptr<SquashfsFilesystem> SquashfsFilesystem::CreateFromFile(
     return nullptr;
   }
 
-  // Read the map file.
-  string filemap;
-  if (!GetFileMapContent(sqfs_path, &filemap)) {
-    LOG(ERROR) << "Failed to produce squashfs map file: " << sqfs_path;
-    return nullptr;
+  vector<FileMapEntry> entries;
+  if (header.compression_type == kSquashfsZlibCompression) {
+    if (!ReadFileMapEntries(sqfs_path, &entries)) {
+      LOG(ERROR) << "Failed to read the squashfs tables: " << sqfs_path;
+      return nullptr;
+    }
+  } else {
+    // Read the map file.
+    string filemap;
+    if (!GetFileMapContent(sqfs_path, &filemap) ||
+        !ParseFileMap(filemap, &entries)) {
+      LOG(ERROR) << "Failed to produce squashfs map file: " << sqfs_path;
+      return nullptr;
+    }
   }
 
   unique_ptr<SquashfsFilesystem> sqfs(new SquashfsFilesystem());
   if (!sqfs->Init(
-          filemap, sqfs_path, sqfs_file->GetSize(), header, extract_deflates)) {
+          entries, sqfs_path, sqfs_file->GetSize(), header, extract_deflates)) {
     LOG(ERROR) << "Failed to initialized the Squashfs file system";
     return nullptr;
   }
@@ -288,8 +677,10 @@ unique_ptr<SquashfsFilesystem> SquashfsFilesystem::CreateFromFileMap(
     return nullptr;
   }
 
+  vector<FileMapEntry> entries;
   unique_ptr<SquashfsFilesystem> sqfs(new SquashfsFilesystem());
-  if (!sqfs->Init(filemap, "", size, header, false)) {
+  if (!ParseFileMap(filemap, &entries) ||
+      !sqfs->Init(entries, "", size, header, false)) {
     LOG(ERROR) << "Failed to initialize the Squashfs file system using filemap";
     return nullptr;
   }
@@ -53,11 +53,24 @@ class SquashfsFilesystem : public FilesystemInterface {
     uint16_t major_version;
   };
 
+  // A regular file or a fragment block of the image, as listed in a file map
+  // (see CreateFromFileMap()).
+  struct FileMapEntry {
+    std::string name;
+    // The byte address of the first block.
+    uint64_t start;
+    // The compressed size of each block, with the 25th bit set if the block
+    // is uncompressed.
+    std::vector<uint64_t> block_sizes;
+  };
+
   ~SquashfsFilesystem() override = default;
 
   // Creates the file system from the Squashfs file itself. If
   // |extract_deflates| is true, it will process files to find location of all
-  // deflate streams.
+  // deflate streams. The inode, directory and fragment tables of gzipped
+  // images are read directly from the file; other images are listed with
+  // unsquashfs -m.
   static std::unique_ptr<SquashfsFilesystem> CreateFromFile(
       const std::string& sqfs_path, bool extract_deflates);
 
@@ -101,7 +114,7 @@ class SquashfsFilesystem : public FilesystemInterface {
   SquashfsFilesystem() = default;
 
   // Initialize and populates the files in the file system.
-  bool Init(const std::string& map,
+  bool Init(const std::vector<FileMapEntry>& entries,
             const std::string& sqfs_path,
             size_t size,
             const SquashfsHeader& header,
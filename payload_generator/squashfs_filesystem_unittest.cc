@@ -58,6 +58,44 @@ void ExpectBlocksInRange(const vector<Extent>& extents, uint64_t total_blocks) {
   }
 }
 
+template <typename T>
+void AppendValue(brillo::Blob* blob, T value) {
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(&value);
+  blob->insert(blob->end(), data, data + sizeof(value));
+}
+
+void AppendInodeHeader(brillo::Blob* blob, uint16_t type, uint32_t number) {
+  AppendValue<uint16_t>(blob, type);
+  AppendValue<uint16_t>(blob, 0755);  // mode
+  AppendValue<uint16_t>(blob, 0);     // uid
+  AppendValue<uint16_t>(blob, 0);     // guid
+  AppendValue<uint32_t>(blob, 0);     // mtime
+  AppendValue<uint32_t>(blob, number);
+}
+
+// Appends a directory listing with a single entry, whose inode is at |offset|
+// of the first metadata block of the inode table.
+void AppendDirectoryListing(brillo::Blob* blob,
+                            uint16_t type,
+                            uint32_t number,
+                            uint16_t offset,
+                            const string& name) {
+  AppendValue<uint32_t>(blob, 0);  // count - 1
+  AppendValue<uint32_t>(blob, 0);  // start_block
+  AppendValue<uint32_t>(blob, number);
+  AppendValue<uint16_t>(blob, offset);
+  AppendValue<int16_t>(blob, 0);  // inode_number delta
+  AppendValue<uint16_t>(blob, type);
+  AppendValue<uint16_t>(blob, name.size() - 1);
+  blob->insert(blob->end(), name.begin(), name.end());
+}
+
+// Appends |data| to |blob| as an uncompressed metadata block.
+void AppendMetadataBlock(brillo::Blob* blob, const brillo::Blob& data) {
+  AppendValue<uint16_t>(blob, data.size() | (1 << 15));
+  blob->insert(blob->end(), data.begin(), data.end());
+}
+
 SquashfsFilesystem::SquashfsHeader GetSimpleHeader() {
   // These properties are enough for now. Add more as needed.
   return {
@@ -108,7 +146,7 @@ class SquashfsFilesystemTest : public ::testing::Test {
   }
 };
 
-// CreateFromFile() depends on unsquashfs -m, which only exists in Chrome OS.
+// The squashfs sample images are only generated in Chrome OS.
 #ifdef __CHROMEOS__
 TEST_F(SquashfsFilesystemTest, EmptyFilesystemTest) {
   unique_ptr<SquashfsFilesystem> fs = SquashfsFilesystem::CreateFromFile(
@@ -150,6 +188,99 @@ TEST_F(SquashfsFilesystemTest, DefaultFilesystemTest) {
 }
 #endif  // __CHROMEOS__
 
+TEST_F(SquashfsFilesystemTest, ReadTablesTest) {
+  // The first block holds the super block, filled in the end.
+  brillo::Blob image(kTestBlockSize);
+  // The two blocks of dir1/file1, the first one uncompressed.
+  image.resize(kTestBlockSize * 2 + 100);
+  image.resize(kTestBlockSize * 3);
+  // The fragment block with the tail of dir1/file1.
+  image.resize(kTestBlockSize * 3 + 50);
+  image.resize(kTestBlockSize * 4);
+
+  // The inodes of dir1/file1, dir1 and the root directory, in this order.
+  brillo::Blob inodes;
+  AppendInodeHeader(&inodes, 2, 1);
+  AppendValue<uint32_t>(&inodes, kTestBlockSize);  // start_block
+  AppendValue<uint32_t>(&inodes, 0);               // fragment
+  AppendValue<uint32_t>(&inodes, 0);               // offset
+  AppendValue<uint32_t>(&inodes, kTestSqfsBlockSize * 2 + 10);
+  AppendValue<uint32_t>(&inodes, kTestBlockSize | (1 << 24));
+  AppendValue<uint32_t>(&inodes, 100);
+  // The listing of dir1 starts after the 24 bytes of the root one.
+  AppendInodeHeader(&inodes, 1, 2);
+  AppendValue<uint32_t>(&inodes, 0);       // start_block
+  AppendValue<uint32_t>(&inodes, 2);       // nlink
+  AppendValue<uint16_t>(&inodes, 25 + 3);  // file_size
+  AppendValue<uint16_t>(&inodes, 24);      // offset
+  AppendValue<uint32_t>(&inodes, 3);       // parent_inode
+  uint16_t root_offset = inodes.size();
+  AppendInodeHeader(&inodes, 1, 3);
+  AppendValue<uint32_t>(&inodes, 0);       // start_block
+  AppendValue<uint32_t>(&inodes, 3);       // nlink
+  AppendValue<uint16_t>(&inodes, 24 + 3);  // file_size
+  AppendValue<uint16_t>(&inodes, 0);       // offset
+  AppendValue<uint32_t>(&inodes, 4);       // parent_inode
+
+  brillo::Blob directories;
+  AppendDirectoryListing(&directories, 1, 2, 40, "dir1");
+  AppendDirectoryListing(&directories, 2, 1, 0, "file1");
+
+  brillo::Blob fragments;
+  AppendValue<uint64_t>(&fragments, kTestBlockSize * 3);  // start_block
+  AppendValue<uint32_t>(&fragments, 50);                  // size
+  AppendValue<uint32_t>(&fragments, 0);
+
+  uint64_t inode_table_start = image.size();
+  AppendMetadataBlock(&image, inodes);
+  uint64_t directory_table_start = image.size();
+  AppendMetadataBlock(&image, directories);
+  uint64_t fragments_start = image.size();
+  AppendMetadataBlock(&image, fragments);
+  uint64_t fragment_table_start = image.size();
+  AppendValue<uint64_t>(&image, fragments_start);
+  image.resize(kTestBlockSize * 5);
+
+  brillo::Blob super_block;
+  AppendValue<uint32_t>(&super_block, 0x73717368);  // magic
+  AppendValue<uint32_t>(&super_block, 3);           // inodes
+  AppendValue<uint32_t>(&super_block, 0);           // mkfs_time
+  AppendValue<uint32_t>(&super_block, kTestSqfsBlockSize);
+  AppendValue<uint32_t>(&super_block, 1);             // fragments
+  AppendValue<uint16_t>(&super_block, 1);             // compression (gzip)
+  AppendValue<uint16_t>(&super_block, 15);            // block_log
+  AppendValue<uint16_t>(&super_block, 0);             // flags
+  AppendValue<uint16_t>(&super_block, 1);             // no_ids
+  AppendValue<uint16_t>(&super_block, 4);             // s_major
+  AppendValue<uint16_t>(&super_block, 0);             // s_minor
+  AppendValue<uint64_t>(&super_block, root_offset);   // root_inode
+  AppendValue<uint64_t>(&super_block, image.size());  // bytes_used
+  AppendValue<uint64_t>(&super_block, 0);             // id_table_start
+  AppendValue<uint64_t>(&super_block, 0);             // xattr_id_table_start
+  AppendValue<uint64_t>(&super_block, inode_table_start);
+  AppendValue<uint64_t>(&super_block, directory_table_start);
+  AppendValue<uint64_t>(&super_block, fragment_table_start);
+  AppendValue<uint64_t>(&super_block, 0);  // lookup_table_start
+  std::copy(super_block.begin(), super_block.end(), image.begin());
+
+  test_utils::ScopedTempFile sqfs_file("ReadTablesTest.XXXXXX");
+  ASSERT_TRUE(test_utils::WriteFileVector(sqfs_file.path(), image));
+  unique_ptr<SquashfsFilesystem> fs =
+      SquashfsFilesystem::CreateFromFile(sqfs_file.path(), false);
+  CheckSquashfs(fs);
+
+  vector<FilesystemInterface::File> files;
+  ASSERT_TRUE(fs->GetFiles(&files));
+  ASSERT_EQ(4u, files.size());
+  EXPECT_EQ("<metadata-0>", files[0].name);
+  EXPECT_EQ("dir1/file1", files[1].name);
+  EXPECT_EQ(vector<Extent>{ExtentForRange(1, 2)}, files[1].extents);
+  EXPECT_EQ("<fragment-0>", files[2].name);
+  EXPECT_EQ(vector<Extent>{ExtentForRange(3, 1)}, files[2].extents);
+  EXPECT_EQ("<metadata-1>", files[3].name);
+  EXPECT_EQ(vector<Extent>{ExtentForRange(4, 1)}, files[3].extents);
+}
+
 TEST_F(SquashfsFilesystemTest, SimpleFileMapTest) {
   string filemap = R"(dir1/file1 96 4000
                       dir1/file2 4096 100)";
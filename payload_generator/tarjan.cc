@@ -16,12 +16,14 @@
 #include "update_engine/payload_generator/tarjan.h"
 
 #include <algorithm>
+#include <utility>
 #include <vector>
 
 #include <base/logging.h>
 #include <base/stl_util.h>
 
 using std::min;
+using std::pair;
 using std::vector;
 
 namespace chromeos_update_engine {
@@ -36,8 +38,8 @@ void TarjanAlgorithm::Execute(Vertex::Index vertex,
   stack_.clear();
   components_.clear();
   index_ = 0;
-  for (Graph::iterator it = graph->begin(); it != graph->end(); ++it)
-    it->index = it->lowlink = kInvalidIndex;
+  indexes_.assign(graph->size(), kInvalidIndex);
+  lowlinks_.assign(graph->size(), kInvalidIndex);
   required_vertex_ = vertex;
 
   Tarjan(vertex, graph);
@@ -46,25 +48,23 @@ void TarjanAlgorithm::Execute(Vertex::Index vertex,
 }
 
 void TarjanAlgorithm::Tarjan(Vertex::Index vertex, Graph* graph) {
-  CHECK_EQ((*graph)[vertex].index, kInvalidIndex);
-  (*graph)[vertex].index = index_;
-  (*graph)[vertex].lowlink = index_;
+  CHECK_EQ(indexes_[vertex], kInvalidIndex);
+  indexes_[vertex] = index_;
+  lowlinks_[vertex] = index_;
   index_++;
   stack_.push_back(vertex);
   for (Vertex::EdgeMap::iterator it = (*graph)[vertex].out_edges.begin();
        it != (*graph)[vertex].out_edges.end();
        ++it) {
     Vertex::Index vertex_next = it->first;
-    if ((*graph)[vertex_next].index == kInvalidIndex) {
+    if (indexes_[vertex_next] == kInvalidIndex) {
       Tarjan(vertex_next, graph);
-      (*graph)[vertex].lowlink =
-          min((*graph)[vertex].lowlink, (*graph)[vertex_next].lowlink);
+      lowlinks_[vertex] = min(lowlinks_[vertex], lowlinks_[vertex_next]);
     } else if (base::ContainsValue(stack_, vertex_next)) {
-      (*graph)[vertex].lowlink =
-          min((*graph)[vertex].lowlink, (*graph)[vertex_next].index);
+      lowlinks_[vertex] = min(lowlinks_[vertex], indexes_[vertex_next]);
     }
   }
-  if ((*graph)[vertex].lowlink == (*graph)[vertex].index) {
+  if (lowlinks_[vertex] == indexes_[vertex]) {
     vector<Vertex::Index> component;
     Vertex::Index other_vertex;
     do {
@@ -80,4 +80,61 @@ void TarjanAlgorithm::Tarjan(Vertex::Index vertex, Graph* graph) {
   }
 }
 
+void TarjanAlgorithm::FindAllComponents(const Graph& graph,
+                                        vector<vector<Vertex::Index>>* out) {
+  out->clear();
+  vector<Vertex::Index> index(graph.size(), kInvalidIndex);
+  vector<Vertex::Index> lowlink(graph.size(), kInvalidIndex);
+  vector<bool> on_stack(graph.size(), false);
+  vector<Vertex::Index> stack;
+  // The vertices being visited, with the next of their edges to follow.
+  vector<pair<Vertex::Index, Vertex::EdgeMap::const_iterator>> call_stack;
+  Vertex::Index next_index = 0;
+
+  for (Vertex::Index root = 0; root < graph.size(); root++) {
+    if (index[root] != kInvalidIndex)
+      continue;
+    index[root] = lowlink[root] = next_index++;
+    stack.push_back(root);
+    on_stack[root] = true;
+    call_stack.emplace_back(root, graph[root].out_edges.begin());
+
+    while (!call_stack.empty()) {
+      Vertex::Index vertex = call_stack.back().first;
+      Vertex::EdgeMap::const_iterator& it = call_stack.back().second;
+      if (it != graph[vertex].out_edges.end()) {
+        Vertex::Index vertex_next = (it++)->first;
+        if (index[vertex_next] == kInvalidIndex) {
+          index[vertex_next] = lowlink[vertex_next] = next_index++;
+          stack.push_back(vertex_next);
+          on_stack[vertex_next] = true;
+          call_stack.emplace_back(vertex_next,
+                                  graph[vertex_next].out_edges.begin());
+        } else if (on_stack[vertex_next]) {
+          lowlink[vertex] = min(lowlink[vertex], index[vertex_next]);
+        }
+        continue;
+      }
+
+      call_stack.pop_back();
+      if (!call_stack.empty()) {
+        Vertex::Index parent = call_stack.back().first;
+        lowlink[parent] = min(lowlink[parent], lowlink[vertex]);
+      }
+      if (lowlink[vertex] == index[vertex]) {
+        vector<Vertex::Index> component;
+        Vertex::Index other_vertex;
+        do {
+          other_vertex = stack.back();
+          stack.pop_back();
+          on_stack[other_vertex] = false;
+          component.push_back(other_vertex);
+        } while (other_vertex != vertex);
+        std::sort(component.begin(), component.end());
+        out->push_back(std::move(component));
+      }
+    }
+  }
+}
+
 }  // namespace chromeos_update_engine
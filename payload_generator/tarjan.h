@@ -21,8 +21,8 @@
 // Strongly Connected Components in a graph.
 
 // Note: a true Tarjan algorithm would find all strongly connected components
-// in the graph. This implementation will only find the strongly connected
-// component containing the vertex passed in.
+// in the graph. Execute() will only find the strongly connected component
+// containing the vertex passed in, while FindAllComponents() finds them all.
 
 #include <vector>
 
@@ -39,11 +39,19 @@ class TarjanAlgorithm {
                Graph* graph,
                std::vector<Vertex::Index>* out);
 
+  // Replaces |out| with all the strongly connected components of |graph|,
+  // each one sorted by vertex index. Unlike Execute(), this doesn't recurse
+  // nor modify the graph, so it can be used on graphs of any size.
+  static void FindAllComponents(
+      const Graph& graph, std::vector<std::vector<Vertex::Index>>* out);
+
  private:
   void Tarjan(Vertex::Index vertex, Graph* graph);
 
   Vertex::Index index_;
   Vertex::Index required_vertex_;
+  std::vector<Vertex::Index> indexes_;
+  std::vector<Vertex::Index> lowlinks_;
   std::vector<Vertex::Index> stack_;
   std::vector<std::vector<Vertex::Index>> components_;
 };
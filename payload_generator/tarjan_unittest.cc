@@ -89,6 +89,15 @@ TEST(TarjanAlgorithmTest, SimpleTest) {
     EXPECT_TRUE(base::ContainsValue(vertex_indexes, n_g));
     EXPECT_TRUE(base::ContainsValue(vertex_indexes, n_h));
   }
+
+  vector<vector<Vertex::Index>> components;
+  TarjanAlgorithm::FindAllComponents(graph, &components);
+  EXPECT_EQ(3U, components.size());
+  EXPECT_TRUE(base::ContainsValue(
+      components, (vector<Vertex::Index>{n_a, n_b, n_c, n_d, n_e})));
+  EXPECT_TRUE(base::ContainsValue(components, (vector<Vertex::Index>{n_f})));
+  EXPECT_TRUE(
+      base::ContainsValue(components, (vector<Vertex::Index>{n_g, n_h})));
 }
 
 }  // namespace chromeos_update_engine
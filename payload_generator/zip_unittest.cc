@@ -26,9 +26,13 @@
 #include "update_engine/common/test_utils.h"
 #include "update_engine/payload_consumer/bzip_extent_writer.h"
 #include "update_engine/payload_consumer/extent_writer.h"
+#include "update_engine/payload_consumer/lz4_extent_writer.h"
 #include "update_engine/payload_consumer/xz_extent_writer.h"
+#include "update_engine/payload_consumer/zstd_extent_writer.h"
 #include "update_engine/payload_generator/bzip.h"
+#include "update_engine/payload_generator/lz4.h"
 #include "update_engine/payload_generator/xz.h"
+#include "update_engine/payload_generator/zstd.h"
 
 using chromeos_update_engine::test_utils::kRandomString;
 using google::protobuf::RepeatedPtrField;
@@ -112,7 +116,33 @@ class ZipTest<XzTest> : public ::testing::Test {
   }
 };
 
-typedef ::testing::Types<BzipTest, XzTest> ZipTestTypes;
+class ZstdTest {};
+
+template <>
+class ZipTest<ZstdTest> : public ::testing::Test {
+ public:
+  bool ZipCompress(const brillo::Blob& in, brillo::Blob* out) const {
+    return ZstdCompress(in, out);
+  }
+  bool ZipDecompress(const brillo::Blob& in, brillo::Blob* out) const {
+    return DecompressWithWriter<ZstdExtentWriter>(in, out);
+  }
+};
+
+class Lz4Test {};
+
+template <>
+class ZipTest<Lz4Test> : public ::testing::Test {
+ public:
+  bool ZipCompress(const brillo::Blob& in, brillo::Blob* out) const {
+    return Lz4Compress(in, out);
+  }
+  bool ZipDecompress(const brillo::Blob& in, brillo::Blob* out) const {
+    return DecompressWithWriter<Lz4ExtentWriter>(in, out);
+  }
+};
+
+typedef ::testing::Types<BzipTest, XzTest, ZstdTest, Lz4Test> ZipTestTypes;
 
 TYPED_TEST_CASE(ZipTest, ZipTestTypes);
 
@@ -0,0 +1,72 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/zstd.h"
+
+#include <zstd.h>
+
+#include <memory>
+
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The level of "zstd -19", the highest one not needing a bigger window.
+const int kZstdCompressionLevel = 19;
+
+// Matches the maximum window accepted by the ZstdExtentWriter.
+const int kZstdWindowLog = 23;
+
+struct ZstdCCtxDeleter {
+  void operator()(ZSTD_CCtx* cctx) const { ZSTD_freeCCtx(cctx); }
+};
+
+}  // namespace
+
+bool ZstdCompress(const brillo::Blob& in, brillo::Blob* out) {
+  TEST_AND_RETURN_FALSE(out);
+  out->clear();
+  if (in.empty())
+    return true;
+
+  std::unique_ptr<ZSTD_CCtx, ZstdCCtxDeleter> cctx(ZSTD_createCCtx());
+  TEST_AND_RETURN_FALSE(cctx);
+  TEST_AND_RETURN_FALSE(!ZSTD_isError(ZSTD_CCtx_setParameter(
+      cctx.get(), ZSTD_c_compressionLevel, kZstdCompressionLevel)));
+  TEST_AND_RETURN_FALSE(!ZSTD_isError(
+      ZSTD_CCtx_setParameter(cctx.get(), ZSTD_c_windowLog, kZstdWindowLog)));
+
+  // The operation data is already covered by a SHA-256 hash in the payload,
+  // so the frame doesn't need a checksum of its own.
+  TEST_AND_RETURN_FALSE(!ZSTD_isError(
+      ZSTD_CCtx_setParameter(cctx.get(), ZSTD_c_checksumFlag, 0)));
+
+  out->resize(ZSTD_compressBound(in.size()));
+  size_t size = ZSTD_compress2(
+      cctx.get(), out->data(), out->size(), in.data(), in.size());
+  if (ZSTD_isError(size)) {
+    LOG(ERROR) << "ZSTD_compress2 failed: " << ZSTD_getErrorName(size);
+    out->clear();
+    return false;
+  }
+  out->resize(size);
+  return true;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,81 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/zstd_bsdiff_patch_writer.h"
+
+#include <endian.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/zstd_bspatch.h"
+#include "update_engine/payload_generator/zstd.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+
+void AppendLE64(uint64_t value, brillo::Blob* blob) {
+  value = htole64(value);
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+  blob->insert(blob->end(), bytes, bytes + sizeof(value));
+}
+
+}  // namespace
+
+bool ZstdBsdiffPatchWriter::Init(size_t new_size) {
+  new_size_ = new_size;
+  ctrl_stream_.clear();
+  diff_stream_.clear();
+  extra_stream_.clear();
+  return true;
+}
+
+bool ZstdBsdiffPatchWriter::WriteDiffStream(const uint8_t* data, size_t size) {
+  diff_stream_.insert(diff_stream_.end(), data, data + size);
+  return true;
+}
+
+bool ZstdBsdiffPatchWriter::WriteExtraStream(const uint8_t* data,
+                                             size_t size) {
+  extra_stream_.insert(extra_stream_.end(), data, data + size);
+  return true;
+}
+
+bool ZstdBsdiffPatchWriter::AddControlEntry(const bsdiff::ControlEntry& entry) {
+  AppendLE64(entry.diff_size, &ctrl_stream_);
+  AppendLE64(entry.extra_size, &ctrl_stream_);
+  AppendLE64(static_cast<uint64_t>(entry.offset_increment), &ctrl_stream_);
+  return true;
+}
+
+bool ZstdBsdiffPatchWriter::Close() {
+  brillo::Blob ctrl, diff, extra;
+  TEST_AND_RETURN_FALSE(ZstdCompress(ctrl_stream_, &ctrl));
+  TEST_AND_RETURN_FALSE(ZstdCompress(diff_stream_, &diff));
+  TEST_AND_RETURN_FALSE(ZstdCompress(extra_stream_, &extra));
+
+  patch_->assign(kZstdBsdiffMagic,
+                 kZstdBsdiffMagic + sizeof(kZstdBsdiffMagic));
+  AppendLE64(ctrl.size(), patch_);
+  AppendLE64(diff.size(), patch_);
+  AppendLE64(new_size_, patch_);
+  patch_->insert(patch_->end(), ctrl.begin(), ctrl.end());
+  patch_->insert(patch_->end(), diff.begin(), diff.end());
+  patch_->insert(patch_->end(), extra.begin(), extra.end());
+  return true;
+}
+
+}  // namespace chromeos_update_engine
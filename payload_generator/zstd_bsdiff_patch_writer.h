@@ -0,0 +1,55 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_ZSTD_BSDIFF_PATCH_WRITER_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_ZSTD_BSDIFF_PATCH_WRITER_H_
+
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+#include <bsdiff/patch_writer_interface.h>
+
+namespace chromeos_update_engine {
+
+// A bsdiff patch writer that stores the patch in the ZSTD_BSDIFF format, see
+// zstd_bspatch.h. The streams are kept in memory and compressed on Close().
+class ZstdBsdiffPatchWriter : public bsdiff::PatchWriterInterface {
+ public:
+  // The patch is stored in |patch| once closed.
+  explicit ZstdBsdiffPatchWriter(brillo::Blob* patch) : patch_(patch) {}
+  ~ZstdBsdiffPatchWriter() override = default;
+
+  // bsdiff::PatchWriterInterface overrides.
+  bool Init(size_t new_size) override;
+  bool WriteDiffStream(const uint8_t* data, size_t size) override;
+  bool WriteExtraStream(const uint8_t* data, size_t size) override;
+  bool AddControlEntry(const bsdiff::ControlEntry& entry) override;
+  bool Close() override;
+
+ private:
+  brillo::Blob* patch_;
+
+  uint64_t new_size_{0};
+  brillo::Blob ctrl_stream_;
+  brillo::Blob diff_stream_;
+  brillo::Blob extra_stream_;
+
+  DISALLOW_COPY_AND_ASSIGN(ZstdBsdiffPatchWriter);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_ZSTD_BSDIFF_PATCH_WRITER_H_
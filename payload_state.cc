@@ -18,8 +18,11 @@
 
 #include <algorithm>
 #include <string>
+#include <vector>
 
 #include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/string_split.h>
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
 #include <metrics/metrics_library.h>
@@ -42,6 +45,7 @@ using base::Time;
 using base::TimeDelta;
 using std::min;
 using std::string;
+using std::vector;
 
 namespace chromeos_update_engine {
 
@@ -49,6 +53,9 @@ using metrics_utils::GetPersistedValue;
 
 const TimeDelta PayloadState::kDurationSlack = TimeDelta::FromSeconds(600);
 
+const TimeDelta PayloadState::kBytesDownloadedPersistInterval =
+    TimeDelta::FromSeconds(10);
+
 // We want to upperbound backoffs to 16 days
 static const int kMaxBackoffDays = 16;
 
@@ -58,6 +65,16 @@ static const uint32_t kMaxBackoffFuzzMinutes = 12 * 60;
 // Limit persisting current update duration uptime to once per second
 static const uint64_t kUptimeResolution = 1;
 
+// The least transfer from a URL measured to update the stats of its server.
+static const uint64_t kMinUrlTransferBytes = 1024 * 1024;
+static const int kMinUrlTransferSeconds = 1;
+
+// The weight of the latest transfer in the moving averages of the stats.
+static const double kUrlStatsWeight = 0.3;
+
+// The number of transfers measured before the stats of a server are used.
+static const uint32_t kMinUrlStatsSamples = 2;
+
 PayloadState::PayloadState()
     : prefs_(nullptr),
       using_p2p_for_downloading_(false),
@@ -71,8 +88,10 @@ PayloadState::PayloadState()
       attempt_num_bytes_downloaded_(0),
       attempt_connection_type_(metrics::ConnectionType::kUnknown),
       attempt_type_(AttemptType::kUpdate) {
-  for (int i = 0; i <= kNumDownloadSources; i++)
+  for (int i = 0; i <= kNumDownloadSources; i++) {
     total_bytes_downloaded_[i] = current_bytes_downloaded_[i] = 0;
+    bytes_downloaded_dirty_[i] = false;
+  }
 }
 
 bool PayloadState::Initialize(SystemState* system_state) {
@@ -85,6 +104,7 @@ bool PayloadState::Initialize(SystemState* system_state) {
   LoadUrlIndex();
   LoadUrlFailureCount();
   LoadUrlSwitchCount();
+  LoadUrlStats();
   LoadBackoffExpiryTime();
   LoadUpdateTimestampStart();
   // The LoadUpdateDurationUptime() method relies on LoadUpdateTimestampStart()
@@ -105,6 +125,11 @@ bool PayloadState::Initialize(SystemState* system_state) {
 }
 
 void PayloadState::SetResponse(const OmahaResponse& omaha_response) {
+  // Persist the new signature together with the reset state, so that a crash
+  // can't keep the old state for the new response.
+  PrefsInterface::Transaction transaction(prefs_);
+  PersistBytesDownloaded();
+
   // Always store the latest response.
   response_ = omaha_response;
 
@@ -126,6 +151,10 @@ void PayloadState::SetResponse(const OmahaResponse& omaha_response) {
     SetNumResponsesSeen(num_responses_seen_ + 1);
     SetResponseSignature(new_response_signature);
     ResetPersistedState();
+    // Start from the server measured to be the fastest, if any.
+    size_t url_index = GetPreferredUrlIndex();
+    if (url_index != url_index_)
+      SetUrlIndex(url_index);
     return;
   }
 
@@ -159,6 +188,8 @@ void PayloadState::SetUsingP2PForDownloading(bool value) {
 
 void PayloadState::DownloadComplete() {
   LOG(INFO) << "Payload downloaded successfully";
+  EndUrlTransfer();
+  PersistBytesDownloaded();
   IncrementPayloadAttemptNumber();
   IncrementFullPayloadAttemptNumber();
 }
@@ -169,6 +200,13 @@ void PayloadState::DownloadProgress(size_t count) {
 
   CalculateUpdateDurationUptime();
   UpdateBytesDownloaded(count);
+  attempt_chunk_intervals_.AddChunk(system_state_->clock()->GetMonotonicTime());
+
+  if (!url_transfer_start_.is_null()) {
+    if (url_transfer_bytes_ == 0)
+      url_transfer_first_byte_ = system_state_->clock()->GetMonotonicTime();
+    url_transfer_bytes_ += count;
+  }
 
   // We've received non-zero bytes from a recent download operation.  Since our
   // URL failure count is meant to penalize a URL only for consecutive
@@ -197,6 +235,7 @@ void PayloadState::AttemptStarted(AttemptType attempt_type) {
   attempt_start_time_boot_ = clock->GetBootTime();
   attempt_start_time_monotonic_ = clock->GetMonotonicTime();
   attempt_num_bytes_downloaded_ = 0;
+  attempt_chunk_intervals_.Reset();
 
   metrics::ConnectionType type;
   ConnectionType network_connection_type;
@@ -212,8 +251,10 @@ void PayloadState::AttemptStarted(AttemptType attempt_type) {
   }
   attempt_connection_type_ = type;
 
-  if (attempt_type == AttemptType::kUpdate)
+  if (attempt_type == AttemptType::kUpdate) {
     PersistAttemptMetrics();
+    StartUrlTransfer();
+  }
 }
 
 void PayloadState::UpdateResumed() {
@@ -224,12 +265,15 @@ void PayloadState::UpdateResumed() {
 
 void PayloadState::UpdateRestarted() {
   LOG(INFO) << "Starting a new update";
+  PrefsInterface::Transaction transaction(prefs_);
   ResetDownloadSourcesOnNewUpdate();
   SetNumReboots(0);
   AttemptStarted(AttemptType::kUpdate);
 }
 
 void PayloadState::UpdateSucceeded() {
+  PrefsInterface::Transaction transaction(prefs_);
+  PersistBytesDownloaded();
   // Send the relevant metrics that are tracked in this class to UMA.
   CalculateUpdateDurationUptime();
   SetUpdateTimestampEnd(system_state_->clock()->GetWallclockTime());
@@ -268,6 +312,11 @@ void PayloadState::UpdateFailed(ErrorCode error) {
     return;
   }
 
+  // Persist the new URL index, failure count and backoff together.
+  PrefsInterface::Transaction transaction(prefs_);
+  PersistBytesDownloaded();
+  EndUrlTransfer();
+
   switch (attempt_type_) {
     case AttemptType::kUpdate:
       CollectAndReportAttemptMetrics(base_error);
@@ -465,6 +514,14 @@ void PayloadState::IncrementFullPayloadAttemptNumber() {
 }
 
 void PayloadState::IncrementUrlIndex() {
+  // The server of the current URL isn't preferred anymore until a transfer
+  // from it succeeds again.
+  auto stats = url_stats_.find(GetUrlOrigin(GetCurrentUrl()));
+  if (stats != url_stats_.end()) {
+    stats->second.failures++;
+    PersistUrlStats();
+  }
+
   size_t next_url_index = url_index_ + 1;
   size_t max_url_size = 0;
   for (const auto& urls : candidate_urls_)
@@ -560,16 +617,38 @@ void PayloadState::UpdateCurrentDownloadSource() {
 }
 
 void PayloadState::UpdateBytesDownloaded(size_t count) {
-  SetCurrentBytesDownloaded(
-      current_download_source_,
-      GetCurrentBytesDownloaded(current_download_source_) + count,
-      false);
-  SetTotalBytesDownloaded(
-      current_download_source_,
-      GetTotalBytesDownloaded(current_download_source_) + count,
-      false);
+  if (current_download_source_ < kNumDownloadSources) {
+    current_bytes_downloaded_[current_download_source_] += count;
+    total_bytes_downloaded_[current_download_source_] += count;
+    bytes_downloaded_dirty_[current_download_source_] = true;
+  }
 
   attempt_num_bytes_downloaded_ += count;
+
+  if (system_state_->clock()->GetMonotonicTime() -
+          bytes_downloaded_persisted_time_ >=
+      kBytesDownloadedPersistInterval) {
+    PersistBytesDownloaded();
+  }
+}
+
+void PayloadState::PersistBytesDownloaded() {
+  bool persisted = false;
+  for (int i = 0; i < kNumDownloadSources; i++) {
+    if (!bytes_downloaded_dirty_[i])
+      continue;
+    DownloadSource source = static_cast<DownloadSource>(i);
+    prefs_->SetInt64(GetPrefsKey(kPrefsCurrentBytesDownloaded, source),
+                     current_bytes_downloaded_[source]);
+    prefs_->SetInt64(GetPrefsKey(kPrefsTotalBytesDownloaded, source),
+                     total_bytes_downloaded_[source]);
+    bytes_downloaded_dirty_[i] = false;
+    persisted = true;
+  }
+  if (persisted) {
+    bytes_downloaded_persisted_time_ =
+        system_state_->clock()->GetMonotonicTime();
+  }
 }
 
 PayloadType PayloadState::CalculatePayloadType() {
@@ -659,6 +738,10 @@ void PayloadState::CollectAndReportAttemptMetrics(ErrorCode code) {
       attempt_result,
       internal_error_code);
 
+  system_state_->metrics_reporter()->ReportDownloadChunkIntervalMetrics(
+      attempt_chunk_intervals_.counts(),
+      attempt_chunk_intervals_.longest_interval());
+
   system_state_->metrics_reporter()->ReportUpdateAttemptDownloadMetrics(
       payload_bytes_downloaded,
       payload_download_speed_bps,
@@ -899,7 +982,9 @@ void PayloadState::SetPayloadIndex(size_t payload_index) {
 bool PayloadState::NextPayload() {
   if (payload_index_ + 1 >= candidate_urls_.size())
     return false;
+  EndUrlTransfer();
   SetPayloadIndex(payload_index_ + 1);
+  StartUrlTransfer();
   return true;
 }
 
@@ -918,6 +1003,126 @@ void PayloadState::SetUrlIndex(uint32_t url_index) {
   UpdateCurrentDownloadSource();
 }
 
+void PayloadState::LoadUrlStats() {
+  CHECK(prefs_);
+  url_stats_.clear();
+  string value;
+  if (!prefs_->Exists(kPrefsUrlStats) ||
+      !prefs_->GetString(kPrefsUrlStats, &value)) {
+    return;
+  }
+  // One line per server: "<origin> <bytes/s> <first byte ms> <samples>
+  // <failures>".
+  for (const string& line : base::SplitString(
+           value, "\n", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY)) {
+    vector<string> fields = base::SplitString(
+        line, " ", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY);
+    UrlStats stats;
+    if (fields.size() != 5 ||
+        !base::StringToDouble(fields[1], &stats.bytes_per_second) ||
+        !base::StringToDouble(fields[2], &stats.first_byte_ms) ||
+        !base::StringToUint(fields[3], &stats.samples) ||
+        !base::StringToUint(fields[4], &stats.failures)) {
+      LOG(WARNING) << "Ignoring invalid URL stats: " << line;
+      continue;
+    }
+    url_stats_[fields[0]] = stats;
+  }
+}
+
+void PayloadState::PersistUrlStats() {
+  CHECK(prefs_);
+  string value;
+  for (const auto& it : url_stats_) {
+    value += base::StringPrintf("%s %.0f %.0f %u %u\n",
+                                it.first.c_str(),
+                                it.second.bytes_per_second,
+                                it.second.first_byte_ms,
+                                it.second.samples,
+                                it.second.failures);
+  }
+  prefs_->SetString(kPrefsUrlStats, value);
+}
+
+void PayloadState::StartUrlTransfer() {
+  url_transfer_start_ = system_state_->clock()->GetMonotonicTime();
+  url_transfer_first_byte_ = Time();
+  url_transfer_bytes_ = 0;
+}
+
+void PayloadState::EndUrlTransfer() {
+  if (url_transfer_start_.is_null())
+    return;
+  Time start = url_transfer_start_;
+  url_transfer_start_ = Time();
+  // Only the servers of the response are compared, not the peers.
+  if (current_download_source_ == kDownloadSourceHttpPeer ||
+      url_transfer_bytes_ < kMinUrlTransferBytes) {
+    return;
+  }
+  string origin = GetUrlOrigin(GetCurrentUrl());
+  TimeDelta duration =
+      system_state_->clock()->GetMonotonicTime() - url_transfer_first_byte_;
+  if (origin.empty() ||
+      duration < TimeDelta::FromSeconds(kMinUrlTransferSeconds)) {
+    return;
+  }
+
+  double bytes_per_second = url_transfer_bytes_ / duration.InSecondsF();
+  double first_byte_ms = (url_transfer_first_byte_ - start).InMillisecondsF();
+  UrlStats& stats = url_stats_[origin];
+  if (stats.samples == 0) {
+    stats.bytes_per_second = bytes_per_second;
+    stats.first_byte_ms = first_byte_ms;
+  } else {
+    stats.bytes_per_second += kUrlStatsWeight *
+                              (bytes_per_second - stats.bytes_per_second);
+    stats.first_byte_ms +=
+        kUrlStatsWeight * (first_byte_ms - stats.first_byte_ms);
+  }
+  stats.samples++;
+  stats.failures = 0;
+  LOG(INFO) << "Measured " << bytes_per_second << " bytes/s after "
+            << first_byte_ms << " ms to the first byte from " << origin;
+  PersistUrlStats();
+}
+
+size_t PayloadState::GetPreferredUrlIndex() {
+  if (candidate_urls_.empty() || response_.packages.empty())
+    return 0;
+  // The time each server is expected to take to download the first payload.
+  size_t best_index = 0;
+  double best_seconds = 0;
+  size_t num_measured = 0;
+  for (size_t i = 0; i < candidate_urls_[0].size(); i++) {
+    auto it = url_stats_.find(GetUrlOrigin(candidate_urls_[0][i]));
+    if (it == url_stats_.end() || it->second.samples < kMinUrlStatsSamples ||
+        it->second.failures > 0 || it->second.bytes_per_second <= 0) {
+      continue;
+    }
+    double seconds = it->second.first_byte_ms / 1000 +
+                     response_.packages[0].size / it->second.bytes_per_second;
+    if (num_measured++ == 0 || seconds < best_seconds) {
+      best_index = i;
+      best_seconds = seconds;
+    }
+  }
+  if (num_measured < 2)
+    return 0;
+  LOG(INFO) << "Preferring Url" << best_index << " expected to download the "
+            << "payload in " << best_seconds << " seconds";
+  return best_index;
+}
+
+// static
+string PayloadState::GetUrlOrigin(const string& url) {
+  size_t host_start = url.find("://");
+  if (host_start == string::npos)
+    return "";
+  size_t host_end = url.find('/', host_start + 3);
+  return base::ToLowerASCII(url.substr(0, host_end));
+}
+
 void PayloadState::LoadScatteringWaitPeriod() {
   SetScatteringWaitPeriod(TimeDelta::FromSeconds(
       GetPersistedValue(kPrefsWallClockScatteringWaitPeriod, prefs_)));
@@ -1107,6 +1312,7 @@ void PayloadState::SetRollbackHappened(bool rollback_happened) {
   CHECK(powerwash_safe_prefs_);
   LOG(INFO) << "Setting rollback-happened to " << rollback_happened << ".";
   rollback_happened_ = rollback_happened;
+  PrefsInterface::Transaction transaction(powerwash_safe_prefs_);
   if (rollback_happened) {
     powerwash_safe_prefs_->SetBoolean(kPrefsRollbackHappened,
                                       rollback_happened);
@@ -1128,6 +1334,7 @@ void PayloadState::SetRollbackVersion(const string& rollback_version) {
   CHECK(powerwash_safe_prefs_);
   LOG(INFO) << "Blacklisting version " << rollback_version;
   rollback_version_ = rollback_version;
+  PrefsInterface::Transaction transaction(powerwash_safe_prefs_);
   powerwash_safe_prefs_->SetString(kPrefsRollbackVersion, rollback_version);
 }
 
@@ -18,6 +18,7 @@
 #define UPDATE_ENGINE_PAYLOAD_STATE_H_
 
 #include <algorithm>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -26,6 +27,7 @@
 
 #include "update_engine/common/prefs_interface.h"
 #include "update_engine/metrics_constants.h"
+#include "update_engine/metrics_utils.h"
 #include "update_engine/payload_state_interface.h"
 
 namespace chromeos_update_engine {
@@ -86,6 +88,13 @@ class PayloadState : public PayloadStateInterface {
                : "";
   }
 
+  inline std::string GetPayloadUrl(size_t payload_index) override {
+    return (payload_index < candidate_urls_.size() &&
+            url_index_ < candidate_urls_[payload_index].size())
+               ? candidate_urls_[payload_index][url_index_]
+               : "";
+  }
+
   inline uint32_t GetUrlFailureCount() override { return url_failure_count_; }
 
   inline uint32_t GetUrlSwitchCount() override { return url_switch_count_; }
@@ -141,6 +150,14 @@ class PayloadState : public PayloadStateInterface {
 
   std::string GetP2PUrl() const override { return p2p_url_; }
 
+  void SetP2PPeerUrls(const std::vector<std::string>& urls) override {
+    p2p_peer_urls_ = urls;
+  }
+
+  std::vector<std::string> GetP2PPeerUrls() const override {
+    return p2p_peer_urls_;
+  }
+
   bool NextPayload() override;
 
  private:
@@ -190,9 +207,14 @@ class PayloadState : public PayloadStateInterface {
   void UpdateCurrentDownloadSource();
 
   // Updates the various metrics corresponding with the given number of bytes
-  // that were downloaded recently.
+  // that were downloaded recently. The byte counters are persisted by
+  // PersistBytesDownloaded() at most every kBytesDownloadedPersistInterval.
   void UpdateBytesDownloaded(size_t count);
 
+  // Persists the byte counters updated by UpdateBytesDownloaded() since they
+  // were last persisted.
+  void PersistBytesDownloaded();
+
   // Calculates the PayloadType we're using.
   PayloadType CalculatePayloadType();
 
@@ -286,6 +308,29 @@ class PayloadState : public PayloadStateInterface {
   // Initializes |url_switch_count_| from the persisted stae.
   void LoadUrlSwitchCount();
 
+  // Initializes |url_stats_| from the persisted state.
+  void LoadUrlStats();
+
+  // Persists |url_stats_|.
+  void PersistUrlStats();
+
+  // Starts measuring the transfer from the current URL.
+  void StartUrlTransfer();
+
+  // Adds the throughput and the time to the first byte of the transfer from
+  // the current URL, if enough was transferred to measure them, to the stats
+  // of its server.
+  void EndUrlTransfer();
+
+  // Returns the index of the candidate URL whose server is expected to
+  // download the payload the fastest, based on the stats of the healthy
+  // servers. Returns 0, the first URL in the response, if less than two of
+  // the candidates have enough stats to compare them.
+  size_t GetPreferredUrlIndex();
+
+  // Returns the scheme, host and port of |url|, which identify its server.
+  static std::string GetUrlOrigin(const std::string& url);
+
   // Initializes the backoff expiry time from the persisted state.
   void LoadBackoffExpiryTime();
 
@@ -438,6 +483,9 @@ class PayloadState : public PayloadStateInterface {
   // Stores the P2P download URL, if one is used.
   std::string p2p_url_;
 
+  // Stores the URLs of the other peers serving the P2P payload, if any.
+  std::vector<std::string> p2p_peer_urls_;
+
   // The cached value of |kPrefsP2PFirstAttemptTimestamp|.
   base::Time p2p_first_attempt_timestamp_;
 
@@ -521,20 +569,30 @@ class PayloadState : public PayloadStateInterface {
   // The number of bytes that have been downloaded for each source for each new
   // update attempt. If we resume an update, we'll continue from the previous
   // value, but if we get a new response or if the previous attempt failed,
-  // we'll reset this to 0 to start afresh. Each update to this value is
-  // persisted so we resume from the same value in case of a process restart.
+  // we'll reset this to 0 to start afresh. This value is persisted so we
+  // resume from about the same value in case of a process restart.
   // The extra index in the array is to no-op accidental access in case the
   // return value from GetCurrentDownloadSource is used without validation.
   uint64_t current_bytes_downloaded_[kNumDownloadSources + 1];
 
   // The number of bytes that have been downloaded for each source since the
   // the last successful update. This is used to compute the overhead we incur.
-  // Each update to this value is persisted so we resume from the same value in
-  // case of a process restart.
+  // This value is persisted so we resume from about the same value in case of
+  // a process restart.
   // The extra index in the array is to no-op accidental access in case the
   // return value from GetCurrentDownloadSource is used without validation.
   uint64_t total_bytes_downloaded_[kNumDownloadSources + 1];
 
+  // Whether the byte counters of each source were updated since they were
+  // last persisted, and the monotonic time when they were last persisted.
+  // Persisting them on every received chunk would write the prefs thousands
+  // of times per update.
+  bool bytes_downloaded_dirty_[kNumDownloadSources + 1];
+  base::Time bytes_downloaded_persisted_time_;
+
+  // The maximum time the updated byte counters are kept unpersisted.
+  static const base::TimeDelta kBytesDownloadedPersistInterval;
+
   // A small timespan used when comparing wall-clock times for coping
   // with the fact that clocks drift and consequently are adjusted
   // (either forwards or backwards) via NTP.
@@ -544,6 +602,28 @@ class PayloadState : public PayloadStateInterface {
   // allowed as per device policy.
   std::vector<std::vector<std::string>> candidate_urls_;
 
+  // The measured performance of a server.
+  struct UrlStats {
+    // The moving averages of the throughput after the first byte and of the
+    // time to the first byte from the start of the transfer.
+    double bytes_per_second{0};
+    double first_byte_ms{0};
+    uint32_t samples{0};
+    // The number of times in a row the server was given up for errors.
+    uint32_t failures{0};
+  };
+
+  // The stats of the servers by URL origin, persisted across the attempts and
+  // the responses so the regional mirrors can be compared.
+  std::map<std::string, UrlStats> url_stats_;
+
+  // The monotonic times the transfer from the current URL started and
+  // received its first byte, and the number of bytes received since, if it
+  // is being measured.
+  base::Time url_transfer_start_;
+  base::Time url_transfer_first_byte_;
+  uint64_t url_transfer_bytes_{0};
+
   // This stores whether rollback has happened since the last time device policy
   // was available during update check. When this is set, we're preventing
   // forced updates to avoid update-rollback loops.
@@ -558,6 +638,9 @@ class PayloadState : public PayloadStateInterface {
   // The number of bytes downloaded per attempt.
   int64_t attempt_num_bytes_downloaded_;
 
+  // The intervals between the chunks received in the attempt.
+  metrics_utils::ChunkIntervalHistogram attempt_chunk_intervals_;
+
   // The boot time when the attempt was started.
   base::Time attempt_start_time_boot_;
 
@@ -18,6 +18,7 @@
 #define UPDATE_ENGINE_PAYLOAD_STATE_INTERFACE_H_
 
 #include <string>
+#include <vector>
 
 #include "update_engine/common/action_processor.h"
 #include "update_engine/common/constants.h"
@@ -114,6 +115,11 @@ class PayloadStateInterface {
   // Returns the current URL. Returns an empty string if there's no valid URL.
   virtual std::string GetCurrentUrl() = 0;
 
+  // Returns the URL the payload at |payload_index| is downloaded from once it
+  // becomes the current payload, unless the current URL changes before then.
+  // Returns an empty string if there's no valid URL.
+  virtual std::string GetPayloadUrl(size_t payload_index) = 0;
+
   // Returns the current URL's failure count.
   virtual uint32_t GetUrlFailureCount() = 0;
 
@@ -203,6 +209,11 @@ class PayloadStateInterface {
   virtual void SetP2PUrl(const std::string& url) = 0;
   virtual std::string GetP2PUrl() const = 0;
 
+  // Sets/gets the URLs of the other peers serving the P2P payload, which
+  // are downloaded from at the same time as the P2P download URL.
+  virtual void SetP2PPeerUrls(const std::vector<std::string>& urls) = 0;
+  virtual std::vector<std::string> GetP2PPeerUrls() const = 0;
+
   // Switch to next payload.
   virtual bool NextPayload() = 0;
 
@@ -16,6 +16,8 @@
 
 #include "update_engine/payload_state.h"
 
+#include <vector>
+
 #include <base/files/file_path.h>
 #include <base/files/file_util.h>
 #include <base/strings/stringprintf.h>
@@ -40,6 +42,7 @@ using std::string;
 using testing::_;
 using testing::AnyNumber;
 using testing::AtLeast;
+using testing::InSequence;
 using testing::Mock;
 using testing::NiceMock;
 using testing::Return;
@@ -143,6 +146,27 @@ TEST(PayloadStateTest, SetResponseWorksWithEmptyResponse) {
   EXPECT_EQ(1, payload_state.GetNumResponsesSeen());
 }
 
+TEST(PayloadStateTest, SetResponseResetsStateInTransaction) {
+  OmahaResponse response;
+  FakeSystemState fake_system_state;
+  NiceMock<MockPrefs>* prefs = fake_system_state.mock_prefs();
+  PayloadState payload_state;
+  EXPECT_TRUE(payload_state.Initialize(&fake_system_state));
+
+  // The new response signature and the reset state are persisted together.
+  EXPECT_CALL(*prefs, SetInt64(_, _)).Times(AnyNumber());
+  {
+    InSequence sequence;
+    EXPECT_CALL(*prefs, StartTransaction()).WillOnce(Return(true));
+    EXPECT_CALL(*prefs, SetString(kPrefsCurrentResponseSignature, _))
+        .WillOnce(Return(true));
+    EXPECT_CALL(*prefs, SetInt64(kPrefsPayloadAttemptNumber, 0))
+        .WillOnce(Return(true));
+    EXPECT_CALL(*prefs, CommitTransaction()).WillOnce(Return(true));
+  }
+  payload_state.SetResponse(response);
+}
+
 TEST(PayloadStateTest, SetResponseWorksWithSingleUrl) {
   OmahaResponse response;
   response.packages.push_back({.payload_urls = {"https://single.url.test"},
@@ -194,6 +218,28 @@ TEST(PayloadStateTest, SetResponseWorksWithSingleUrl) {
   EXPECT_EQ(1, payload_state.GetNumResponsesSeen());
 }
 
+TEST(PayloadStateTest, GetPayloadUrlReturnsTheUrlOfEachPayload) {
+  OmahaResponse response;
+  response.packages.push_back({.payload_urls = {"https://first.url.test"},
+                               .size = 123456789,
+                               .metadata_size = 58123,
+                               .metadata_signature = "msign",
+                               .hash = "hash"});
+  response.packages.push_back({.payload_urls = {"https://second.url.test"},
+                               .size = 1234,
+                               .metadata_size = 58,
+                               .metadata_signature = "msign2",
+                               .hash = "hash2"});
+  FakeSystemState fake_system_state;
+  PayloadState payload_state;
+  EXPECT_TRUE(payload_state.Initialize(&fake_system_state));
+  payload_state.SetResponse(response);
+  EXPECT_EQ("https://first.url.test", payload_state.GetPayloadUrl(0));
+  EXPECT_EQ("https://second.url.test", payload_state.GetPayloadUrl(1));
+  EXPECT_EQ("", payload_state.GetPayloadUrl(2));
+  EXPECT_EQ("https://first.url.test", payload_state.GetCurrentUrl());
+}
+
 TEST(PayloadStateTest, SetResponseWorksWithMultipleUrls) {
   OmahaResponse response;
   response.packages.push_back({.payload_urls = {"http://multiple.url.test",
@@ -917,6 +963,50 @@ TEST(PayloadStateTest, DownloadSourcesUsedIsCorrect) {
   payload_state.UpdateSucceeded();
 }
 
+TEST(PayloadStateTest, BytesDownloadedPersistedPeriodically) {
+  OmahaResponse response;
+  PayloadState payload_state;
+  FakeSystemState fake_system_state;
+  FakeClock fake_clock;
+  FakePrefs fake_prefs;
+  fake_clock.SetMonotonicTime(Time::FromInternalValue(100000000));
+  fake_system_state.set_clock(&fake_clock);
+  fake_system_state.set_prefs(&fake_prefs);
+  EXPECT_TRUE(payload_state.Initialize(&fake_system_state));
+  SetupPayloadStateWith2Urls(
+      "Hash3141", true, false, &payload_state, &response);
+
+  int64_t persisted_bytes = 0;
+  payload_state.DownloadProgress(100);
+  EXPECT_TRUE(
+      fake_prefs.GetInt64(kCurrentBytesDownloadedFromHttp, &persisted_bytes));
+  EXPECT_EQ(100, persisted_bytes);
+
+  // The following chunks are only persisted once the interval passed.
+  payload_state.DownloadProgress(200);
+  EXPECT_EQ(300U,
+            payload_state.GetCurrentBytesDownloaded(kDownloadSourceHttpServer));
+  EXPECT_TRUE(
+      fake_prefs.GetInt64(kCurrentBytesDownloadedFromHttp, &persisted_bytes));
+  EXPECT_EQ(100, persisted_bytes);
+
+  fake_clock.SetMonotonicTime(Time::FromInternalValue(110000000));
+  payload_state.DownloadProgress(50);
+  EXPECT_TRUE(
+      fake_prefs.GetInt64(kCurrentBytesDownloadedFromHttp, &persisted_bytes));
+  EXPECT_EQ(350, persisted_bytes);
+
+  // Or when the download completes.
+  payload_state.DownloadProgress(10);
+  payload_state.DownloadComplete();
+  EXPECT_TRUE(
+      fake_prefs.GetInt64(kCurrentBytesDownloadedFromHttp, &persisted_bytes));
+  EXPECT_EQ(360, persisted_bytes);
+  EXPECT_TRUE(
+      fake_prefs.GetInt64(kTotalBytesDownloadedFromHttp, &persisted_bytes));
+  EXPECT_EQ(360, persisted_bytes);
+}
+
 TEST(PayloadStateTest, RestartingUpdateResetsMetrics) {
   OmahaResponse response;
   FakeSystemState fake_system_state;
@@ -1655,4 +1745,82 @@ TEST(PayloadStateTest, P2PStateVarsAreClearedOnNewResponse) {
   EXPECT_EQ(null_time, payload_state.GetP2PFirstAttemptTimestamp());
 }
 
+// Sets a response with |urls| and downloads |bytes| from its current URL
+// |num_times|, in |seconds| each.
+static void DownloadFromCurrentUrl(const std::vector<string>& urls,
+                                 const string& hash,
+                                 uint64_t bytes,
+                                 int seconds,
+                                 int num_times,
+                                 FakeClock* fake_clock,
+                                 PayloadState* payload_state) {
+  OmahaResponse response;
+  response.packages.push_back(
+      {.payload_urls = urls, .size = bytes, .hash = hash});
+  payload_state->SetResponse(response);
+  for (int i = 0; i < num_times; i++) {
+    payload_state->UpdateRestarted();
+    fake_clock->SetMonotonicTime(fake_clock->GetMonotonicTime() +
+                                 TimeDelta::FromMilliseconds(100));
+    payload_state->DownloadProgress(bytes / 2);
+    fake_clock->SetMonotonicTime(fake_clock->GetMonotonicTime() +
+                                 TimeDelta::FromSeconds(seconds));
+    payload_state->DownloadProgress(bytes - bytes / 2);
+    payload_state->DownloadComplete();
+  }
+}
+
+TEST(PayloadStateTest, PrefersTheFastestMeasuredServer) {
+  FakeSystemState fake_system_state;
+  FakeClock fake_clock;
+  FakePrefs fake_prefs;
+  fake_clock.SetMonotonicTime(Time::FromInternalValue(100000000));
+  fake_system_state.set_clock(&fake_clock);
+  fake_system_state.set_prefs(&fake_prefs);
+  PayloadState payload_state;
+  EXPECT_TRUE(payload_state.Initialize(&fake_system_state));
+
+  const string slow_url = "http://slow.example.com/payload";
+  const string fast_url = "https://FAST.example.com:443/payload";
+  const uint64_t size = 10 * 1024 * 1024;
+  // Without enough stats, the first URL is used.
+  DownloadFromCurrentUrl(
+      {slow_url, fast_url}, "Hash1", size, 10, 2, &fake_clock, &payload_state);
+  DownloadFromCurrentUrl(
+      {fast_url, slow_url}, "Hash2", size, 1, 1, &fake_clock, &payload_state);
+  DownloadFromCurrentUrl(
+      {slow_url, fast_url}, "Hash3", size, 10, 0, &fake_clock, &payload_state);
+  EXPECT_EQ(slow_url, payload_state.GetCurrentUrl());
+
+  DownloadFromCurrentUrl(
+      {fast_url, slow_url}, "Hash4", size, 1, 1, &fake_clock, &payload_state);
+  DownloadFromCurrentUrl(
+      {slow_url, fast_url}, "Hash5", size, 10, 0, &fake_clock, &payload_state);
+  EXPECT_EQ(fast_url, payload_state.GetCurrentUrl());
+
+  // The stats are persisted.
+  PayloadState payload_state2;
+  EXPECT_TRUE(payload_state2.Initialize(&fake_system_state));
+  DownloadFromCurrentUrl({slow_url, fast_url},
+                       "Hash6",
+                       size,
+                       10,
+                       0,
+                       &fake_clock,
+                       &payload_state2);
+  EXPECT_EQ(fast_url, payload_state2.GetCurrentUrl());
+
+  // A server given up for errors isn't preferred anymore.
+  payload_state2.UpdateFailed(ErrorCode::kPayloadHashMismatchError);
+  EXPECT_EQ(slow_url, payload_state2.GetCurrentUrl());
+  DownloadFromCurrentUrl({slow_url, fast_url},
+                       "Hash7",
+                       size,
+                       10,
+                       0,
+                       &fake_clock,
+                       &payload_state2);
+  EXPECT_EQ(slow_url, payload_state2.GetCurrentUrl());
+}
+
 }  // namespace chromeos_update_engine
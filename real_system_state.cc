@@ -16,13 +16,18 @@
 
 #include "update_engine/real_system_state.h"
 
+#include <inttypes.h>
+
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <base/bind.h>
 #include <base/files/file_util.h>
 #include <base/location.h>
+#include <base/strings/string_util.h>
+#include <base/strings/stringprintf.h>
 #include <base/time/time.h>
 #include <brillo/message_loops/message_loop.h>
 #if USE_CHROME_KIOSK_APP
@@ -46,6 +51,37 @@ using brillo::MessageLoop;
 
 namespace chromeos_update_engine {
 
+namespace {
+
+// Logs the time spent initializing each component of the daemon, so the
+// startup cost can be attributed.
+class StartupTrace {
+ public:
+  StartupTrace() : start_(base::TimeTicks::Now()), last_step_(start_) {}
+  ~StartupTrace() {
+    LOG(INFO) << "Startup trace: " << base::JoinString(steps_, " ")
+              << " total=" << (base::TimeTicks::Now() - start_).InMilliseconds()
+              << "ms";
+  }
+
+  // Records the time since the previous step as the cost of |component|.
+  void Step(const char* component) {
+    base::TimeTicks now = base::TimeTicks::Now();
+    steps_.push_back(base::StringPrintf(
+        "%s=%" PRId64 "ms", component, (now - last_step_).InMilliseconds()));
+    last_step_ = now;
+  }
+
+ private:
+  base::TimeTicks start_;
+  base::TimeTicks last_step_;
+  std::vector<std::string> steps_;
+
+  DISALLOW_COPY_AND_ASSIGN(StartupTrace);
+};
+
+}  // namespace
+
 RealSystemState::~RealSystemState() {
   // Prevent any DBus communication from UpdateAttempter when shutting down the
   // daemon.
@@ -54,7 +90,9 @@ RealSystemState::~RealSystemState() {
 }
 
 bool RealSystemState::Initialize() {
+  StartupTrace trace;
   metrics_reporter_.Initialize();
+  trace.Step("metrics");
 
   boot_control_ = boot_control::CreateBootControl();
   if (!boot_control_) {
@@ -62,12 +100,14 @@ bool RealSystemState::Initialize() {
                  << "instead. All update attempts will fail.";
     boot_control_ = std::make_unique<BootControlStub>();
   }
+  trace.Step("boot_control");
 
   hardware_ = hardware::CreateHardware();
   if (!hardware_) {
     LOG(ERROR) << "Error initializing the HardwareInterface.";
     return false;
   }
+  trace.Step("hardware");
 
 #if USE_CHROME_KIOSK_APP
   kiosk_app_proxy_.reset(new org::chromium::KioskAppServiceInterfaceProxy(
@@ -82,18 +122,21 @@ bool RealSystemState::Initialize() {
     LOG(ERROR) << "Error initializing the ConnectionManagerInterface.";
     return false;
   }
+  trace.Step("connection_manager");
 
   power_manager_ = power_manager::CreatePowerManager();
   if (!power_manager_) {
     LOG(ERROR) << "Error initializing the PowerManagerInterface.";
     return false;
   }
+  trace.Step("power_manager");
 
   dlcservice_ = CreateDlcService();
   if (!dlcservice_) {
     LOG(ERROR) << "Error initializing the DlcServiceInterface.";
     return false;
   }
+  trace.Step("dlcservice");
 
   // Initialize standard and powerwash-safe prefs.
   base::FilePath non_volatile_path;
@@ -103,6 +146,8 @@ bool RealSystemState::Initialize() {
     LOG(ERROR) << "Failed to get a non-volatile directory.";
     return false;
   }
+  metrics_reporter_.set_log_path(
+      non_volatile_path.Append(kPerformanceLogFileName));
   Prefs* prefs;
   prefs_.reset(prefs = new Prefs());
   if (!prefs->Init(non_volatile_path.Append(kPrefsSubDirectory))) {
@@ -118,6 +163,9 @@ bool RealSystemState::Initialize() {
     LOG(WARNING) << "No powerwash-safe directory, using non-volatile one.";
   }
   powerwash_safe_prefs_.reset(prefs = new Prefs());
+  // The rollback state must survive the powerwash right after the reboot, so
+  // the transactions writing it are synced.
+  prefs->set_sync_on_commit(true);
   if (!prefs->Init(
           powerwash_safe_path.Append(kPowerwashSafePrefsSubDirectory))) {
     LOG(ERROR) << "Failed to initialize powerwash preferences.";
@@ -135,6 +183,7 @@ bool RealSystemState::Initialize() {
     LOG(WARNING) << "Couldn't detect the bootid, assuming system was rebooted.";
     system_rebooted_ = true;
   }
+  trace.Step("prefs");
 
   // Initialize the OmahaRequestParams with the default settings. These settings
   // will be re-initialized before every request using the actual request
@@ -144,6 +193,7 @@ bool RealSystemState::Initialize() {
     LOG(WARNING) << "Ignoring OmahaRequestParams initialization error. Some "
                     "features might not work properly.";
   }
+  trace.Step("request_params");
 
   certificate_checker_.reset(
       new CertificateChecker(prefs_.get(), &openssl_wrapper_));
@@ -154,6 +204,7 @@ bool RealSystemState::Initialize() {
 
   // Initialize the UpdateAttempter before the UpdateManager.
   update_attempter_->Init();
+  trace.Step("update_attempter");
 
   // Initialize the Update Manager using the default state factory.
   chromeos_update_manager::State* um_state =
@@ -174,6 +225,13 @@ bool RealSystemState::Initialize() {
       base::TimeDelta::FromSeconds(5),
       base::TimeDelta::FromHours(12),
       um_state));
+  trace.Step("update_manager");
+
+#if USE_CHROME_NETWORK_PROXY
+  // The cached proxies may not apply anymore once the network changed.
+  um_state->shill_provider()->var_conn_last_changed()->AddObserver(
+      update_attempter_->chrome_proxy_resolver());
+#endif  // USE_CHROME_NETWORK_PROXY
 
   // The P2P Manager depends on the Update Manager for its initialization.
   p2p_manager_.reset(
@@ -183,12 +241,26 @@ bool RealSystemState::Initialize() {
                             "cros_au",
                             kMaxP2PFilesToKeep,
                             base::TimeDelta::FromDays(kMaxP2PFileAgeDays)));
+  trace.Step("p2p_manager");
 
   if (!payload_state_.Initialize(this)) {
     LOG(ERROR) << "Failed to initialize the payload state object.";
     return false;
   }
+  trace.Step("payload_state");
 
+  // Writing the firmware settings is slow and not needed to serve the status
+  // over D-Bus, so it is done once the daemon is running.
+  MessageLoop::current()->PostTask(
+      FROM_HERE,
+      base::Bind(&RealSystemState::InitializeKernelKeyRollforward,
+                 base::Unretained(this)));
+
+  // All is well. Initialization successful.
+  return true;
+}
+
+void RealSystemState::InitializeKernelKeyRollforward() {
   // For devices that are not rollback enabled (ie. consumer devices),
   // initialize max kernel key version to 0xfffffffe, which is logically
   // infinity.
@@ -199,9 +271,6 @@ bool RealSystemState::Initialize() {
                  << " consumer devices";
     }
   }
-
-  // All is well. Initialization successful.
-  return true;
 }
 
 bool RealSystemState::StartUpdater() {
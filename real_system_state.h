@@ -38,6 +38,7 @@
 #include "update_engine/daemon_state_interface.h"
 #include "update_engine/metrics_reporter_interface.h"
 #include "update_engine/metrics_reporter_omaha.h"
+#include "update_engine/metrics_reporter_performance_log.h"
 #include "update_engine/p2p_manager.h"
 #include "update_engine/payload_state.h"
 #include "update_engine/power_manager_interface.h"
@@ -132,6 +133,10 @@ class RealSystemState : public SystemState, public DaemonStateInterface {
   }
 
  private:
+  // Sets the maximum kernel key version of consumer devices, which can't roll
+  // back, to infinity. Called from the message loop after Initialize().
+  void InitializeKernelKeyRollforward();
+
   // Real DBus proxies using the DBus connection.
 #if USE_CHROME_KIOSK_APP
   std::unique_ptr<org::chromium::KioskAppServiceInterfaceProxy>
@@ -160,8 +165,10 @@ class RealSystemState : public SystemState, public DaemonStateInterface {
   // Interface for the hardware functions.
   std::unique_ptr<HardwareInterface> hardware_;
 
-  // The Metrics reporter for reporting UMA stats.
-  MetricsReporterOmaha metrics_reporter_;
+  // The Metrics reporter for reporting UMA stats, which also logs the
+  // performance of the update attempts.
+  MetricsReporterPerformanceLog metrics_reporter_{
+      std::make_unique<MetricsReporterOmaha>()};
 
   // Interface for persisted store.
   std::unique_ptr<PrefsInterface> prefs_;
@@ -78,6 +78,13 @@ class ServiceDelegateAndroidInterface {
 
   virtual bool SetPerformanceMode(bool enable, brillo::ErrorPtr* error) = 0;
 
+  // Sets the maximum rate of the payload downloads to |rate_bps| bytes per
+  // second, or removes the limit if it is 0. The limit applies to the download
+  // in progress and is lifted while the performance mode is enabled. In case
+  // of error, returns false and sets |error| accordingly.
+  virtual bool SetDownloadRateLimit(int64_t rate_bps,
+                                    brillo::ErrorPtr* error) = 0;
+
  protected:
   ServiceDelegateAndroidInterface() = default;
 };
@@ -0,0 +1,228 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/shill_connection_cache.h"
+
+#include <base/bind.h>
+#include <base/logging.h>
+#include <brillo/type_name_undecorate.h>
+#include <shill/dbus-constants.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/shill_proxy.h"
+
+using org::chromium::flimflam::ManagerProxyInterface;
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Whether the service property |name| is one of the properties kept in the
+// cache.
+bool IsCachedServiceProperty(const string& name) {
+  return name == shill::kTypeProperty ||
+         name == shill::kPhysicalTechnologyProperty ||
+         name == shill::kTetheringProperty;
+}
+
+}  // namespace
+
+ShillConnectionCache::ShillConnectionCache(ShillProxyInterface* shill_proxy)
+    : shill_proxy_(shill_proxy) {}
+
+ShillConnectionCache* ShillConnectionCache::Get() {
+  static ShillConnectionCache* cache =
+      new ShillConnectionCache(new ShillProxy());
+  return cache;
+}
+
+bool ShillConnectionCache::Init() {
+  if (initialized_)
+    return true;
+  ManagerProxyInterface* manager_proxy = shill_proxy_->GetManagerProxy();
+  if (!manager_proxy)
+    return false;
+
+  // Subscribe to the manager's PropertyChanged signal.
+  manager_proxy->RegisterPropertyChangedSignalHandler(
+      base::Bind(&ShillConnectionCache::OnManagerPropertyChanged,
+                 base::Unretained(this)),
+      base::Bind(&ShillConnectionCache::OnSignalConnected,
+                 base::Unretained(this)));
+  initialized_ = true;
+
+  // Attempt to read initial connection status. Even if this fails because shill
+  // is not responding (e.g. it is down) we'll be notified via "PropertyChanged"
+  // signal as soon as it comes up, so this is not a critical step.
+  brillo::VariantDictionary properties;
+  brillo::ErrorPtr error;
+  if (!manager_proxy->GetProperties(&properties, &error))
+    return true;
+
+  const auto& prop_default_service =
+      properties.find(shill::kDefaultServiceProperty);
+  if (prop_default_service != properties.end()) {
+    OnManagerPropertyChanged(prop_default_service->first,
+                             prop_default_service->second);
+  }
+  return true;
+}
+
+bool ShillConnectionCache::Refresh() {
+  ManagerProxyInterface* manager_proxy = shill_proxy_->GetManagerProxy();
+  if (!manager_proxy)
+    return false;
+  brillo::VariantDictionary properties;
+  brillo::ErrorPtr error;
+  TEST_AND_RETURN_FALSE(manager_proxy->GetProperties(&properties, &error));
+
+  const auto& prop_default_service =
+      properties.find(shill::kDefaultServiceProperty);
+  if (prop_default_service == properties.end())
+    return false;
+  ProcessDefaultService(
+      prop_default_service->second.TryGet<dbus::ObjectPath>(), true);
+  return true;
+}
+
+bool ShillConnectionCache::GetConnectionType(ConnectionType* out_type) const {
+  *out_type = ConnectionType::kUnknown;
+  const auto& prop_type = service_properties_.find(shill::kTypeProperty);
+  if (prop_type == service_properties_.end())
+    return false;
+
+  string type_str = prop_type->second.TryGet<string>();
+  if (type_str == shill::kTypeVPN) {
+    const auto& prop_physical =
+        service_properties_.find(shill::kPhysicalTechnologyProperty);
+    if (prop_physical == service_properties_.end()) {
+      LOG(ERROR) << "No PhysicalTechnology property found for a VPN"
+                 << " connection (service: " << default_service_path_.value()
+                 << "). Using default kUnknown value.";
+    } else {
+      *out_type = connection_utils::ParseConnectionType(
+          prop_physical->second.TryGet<string>());
+    }
+  } else {
+    *out_type = connection_utils::ParseConnectionType(type_str);
+  }
+  return true;
+}
+
+bool ShillConnectionCache::GetConnectionTethering(
+    ConnectionTethering* out_tethering) const {
+  *out_tethering = ConnectionTethering::kUnknown;
+  const auto& prop_tethering =
+      service_properties_.find(shill::kTetheringProperty);
+  if (prop_tethering == service_properties_.end())
+    return false;
+  // If the property doesn't contain a string value, the empty string will
+  // become kUnknown.
+  *out_tethering = connection_utils::ParseConnectionTethering(
+      prop_tethering->second.TryGet<string>());
+  return true;
+}
+
+void ShillConnectionCache::OnManagerPropertyChanged(const string& name,
+                                                    const brillo::Any& value) {
+  if (name != shill::kDefaultServiceProperty)
+    return;
+  dbus::ObjectPath service_path = value.TryGet<dbus::ObjectPath>();
+  if (!service_path.IsValid()) {
+    LOG(WARNING) << "Got an invalid DefaultService path. The property value "
+                    "contains a "
+                 << value.GetUndecoratedTypeName()
+                 << ", read as the object path: '" << service_path.value()
+                 << "'";
+  }
+  ProcessDefaultService(service_path, false);
+}
+
+void ShillConnectionCache::OnServicePropertyChanged(
+    const dbus::ObjectPath& service_path,
+    const string& name,
+    const brillo::Any& value) {
+  // The signals of the previous default services are still delivered.
+  if (service_path != default_service_path_ || !IsCachedServiceProperty(name))
+    return;
+  service_properties_[name] = value;
+  NotifyObservers(false);
+}
+
+void ShillConnectionCache::OnSignalConnected(const string& interface_name,
+                                             const string& signal_name,
+                                             bool successful) {
+  if (!successful) {
+    LOG(ERROR) << "Couldn't connect to the signal " << interface_name << "."
+               << signal_name;
+  }
+}
+
+void ShillConnectionCache::ProcessDefaultService(
+    const dbus::ObjectPath& service_path, bool force) {
+  // We assume that if the service path didn't change, then the connection
+  // type and the tethering status of it also didn't change, or a signal of
+  // the service tells otherwise.
+  bool service_changed =
+      !default_service_known_ || default_service_path_ != service_path;
+  if (!service_changed && !force)
+    return;
+
+  default_service_known_ = true;
+  default_service_path_ = service_path;
+  default_service_proxy_.reset();
+  service_properties_.clear();
+  if (is_connected()) {
+    default_service_proxy_ = shill_proxy_->GetServiceForPath(service_path);
+    if (initialized_) {
+      default_service_proxy_->RegisterPropertyChangedSignalHandler(
+          base::Bind(&ShillConnectionCache::OnServicePropertyChanged,
+                     base::Unretained(this),
+                     service_path),
+          base::Bind(&ShillConnectionCache::OnSignalConnected,
+                     base::Unretained(this)));
+    }
+
+    // Get the connection properties synchronously, only once for each new
+    // default service.
+    brillo::VariantDictionary properties;
+    brillo::ErrorPtr error;
+    if (default_service_proxy_->GetProperties(&properties, &error)) {
+      for (const auto& property : properties) {
+        if (IsCachedServiceProperty(property.first))
+          service_properties_.insert(property);
+      }
+      if (service_properties_.find(shill::kTypeProperty) ==
+          service_properties_.end()) {
+        LOG(ERROR) << "Could not find connection type (service: "
+                   << service_path.value() << ")";
+      }
+    } else {
+      LOG(ERROR) << "Couldn't read the properties of the service "
+                 << service_path.value();
+    }
+  }
+  NotifyObservers(service_changed);
+}
+
+void ShillConnectionCache::NotifyObservers(bool service_changed) {
+  for (Observer* observer : observers_)
+    observer->OnConnectionChanged(service_changed);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,146 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_SHILL_CONNECTION_CACHE_H_
+#define UPDATE_ENGINE_SHILL_CONNECTION_CACHE_H_
+
+#include <memory>
+#include <set>
+#include <string>
+
+#include <base/macros.h>
+#include <brillo/any.h>
+#include <brillo/variant_dictionary.h>
+#include <dbus/object_path.h>
+#include <shill/dbus-proxies.h>
+
+#include "update_engine/connection_utils.h"
+#include "update_engine/shill_proxy_interface.h"
+
+namespace chromeos_update_engine {
+
+// ShillConnectionCache keeps the properties of the default service of shill
+// used by update_engine, updated from the PropertyChanged signals of the shill
+// manager and of the default service, so they are read without blocking on a
+// DBus call. It is shared by the ConnectionManager and the RealShillProvider
+// of the UpdateManager.
+class ShillConnectionCache {
+ public:
+  class Observer {
+   public:
+    virtual ~Observer() = default;
+
+    // Called when the default service or its properties changed.
+    // |service_changed| tells whether the default service itself changed.
+    virtual void OnConnectionChanged(bool service_changed) = 0;
+  };
+
+  // Takes the ownership of |shill_proxy|.
+  explicit ShillConnectionCache(ShillProxyInterface* shill_proxy);
+  ~ShillConnectionCache() = default;
+
+  // Returns the cache of the process, connected to the real shill daemon.
+  static ShillConnectionCache* Get();
+
+  // Subscribes to the signals of the shill manager and reads the current
+  // default service, if shill responds; otherwise the first signal sets it.
+  // Only the first call does it. Returns whether the signals are subscribed.
+  bool Init();
+
+  // Whether the cache is kept up to date by the signals.
+  bool initialized() const { return initialized_; }
+
+  // Reads the default service and its properties from shill again. Before
+  // Init() is called, this is the only way to update the cache. Returns
+  // whether shill responded.
+  bool Refresh();
+
+  // Whether shill reported the default service, either when it was read or by
+  // a signal.
+  bool default_service_known() const { return default_service_known_; }
+
+  // The path of the default service, which is invalid until it is known. The
+  // "/" path means that there's no connection.
+  const dbus::ObjectPath& default_service_path() const {
+    return default_service_path_;
+  }
+
+  bool is_connected() const {
+    return default_service_path_.IsValid() &&
+           default_service_path_.value() != "/";
+  }
+
+  // Sets |out_type| to the type of the connection of the default service,
+  // which is its PhysicalTechnology for a VPN. Returns false if the type of
+  // the service isn't known, in which case |out_type| is kUnknown.
+  bool GetConnectionType(ConnectionType* out_type) const;
+
+  // Sets |out_tethering| to the tethering state of the default service.
+  // Returns false if it isn't known, in which case |out_tethering| is
+  // kUnknown.
+  bool GetConnectionTethering(ConnectionTethering* out_tethering) const;
+
+  void AddObserver(Observer* observer) { observers_.insert(observer); }
+  void RemoveObserver(Observer* observer) { observers_.erase(observer); }
+
+ private:
+  // The handlers of the PropertyChanged signals of the shill manager and of
+  // the service |service_path|.
+  void OnManagerPropertyChanged(const std::string& name,
+                                const brillo::Any& value);
+  void OnServicePropertyChanged(const dbus::ObjectPath& service_path,
+                                const std::string& name,
+                                const brillo::Any& value);
+
+  // Called when a PropertyChanged signal is connected.
+  void OnSignalConnected(const std::string& interface_name,
+                         const std::string& signal_name,
+                         bool successful);
+
+  // Sets the default service to |service_path| and reads its properties,
+  // unless it didn't change and |force| is false, then notifies the
+  // observers.
+  void ProcessDefaultService(const dbus::ObjectPath& service_path, bool force);
+
+  // Calls OnConnectionChanged() on all the observers.
+  void NotifyObservers(bool service_changed);
+
+  // The mockable interface to access the shill DBus proxies.
+  std::unique_ptr<ShillProxyInterface> shill_proxy_;
+
+  bool initialized_{false};
+
+  bool default_service_known_{false};
+  dbus::ObjectPath default_service_path_{"uninitialized"};
+
+  // The proxy of |default_service_path_|, kept for its signal once
+  // initialized.
+  std::unique_ptr<org::chromium::flimflam::ServiceProxyInterface>
+      default_service_proxy_;
+
+  // The properties of |default_service_path_| used to get the type and the
+  // tethering state of the connection, empty if they couldn't be read.
+  brillo::VariantDictionary service_properties_;
+
+  std::set<Observer*> observers_;
+
+  DISALLOW_COPY_AND_ASSIGN(ShillConnectionCache);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_SHILL_CONNECTION_CACHE_H_
@@ -0,0 +1,105 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/status_notifier.h"
+
+#include <algorithm>
+
+#include <base/bind.h>
+#include <base/location.h>
+
+using base::TimeDelta;
+using base::TimeTicks;
+using brillo::MessageLoop;
+using update_engine::UpdateEngineStatus;
+
+namespace chromeos_update_engine {
+
+StatusNotifier::StatusNotifier(
+    const std::set<ServiceObserverInterface*>* observers,
+    TimeDelta min_interval)
+    : observers_(observers), min_interval_(min_interval) {}
+
+StatusNotifier::~StatusNotifier() {
+  for (const auto& it : states_) {
+    if (it.second.task_id != MessageLoop::kTaskIdNull)
+      MessageLoop::current()->CancelTask(it.second.task_id);
+  }
+}
+
+void StatusNotifier::Notify(const UpdateEngineStatus& status) {
+  ForgetRemovedObservers();
+  TimeTicks now = TimeTicks::Now();
+  for (ServiceObserverInterface* observer : *observers_) {
+    ObserverState* state = &states_[observer];
+    if (!state->notified || state->status != status.status) {
+      Send(observer, state, status);
+      continue;
+    }
+    state->pending_status = status;
+    if (state->task_id != MessageLoop::kTaskIdNull)
+      continue;
+    TimeDelta delay = std::max(state->time + min_interval_ - now, TimeDelta());
+    state->task_id = MessageLoop::current()->PostDelayedTask(
+        FROM_HERE,
+        base::Bind(&StatusNotifier::SendPending,
+                   base::Unretained(this),
+                   observer),
+        delay);
+  }
+}
+
+void StatusNotifier::Send(ServiceObserverInterface* observer,
+                          ObserverState* state,
+                          const UpdateEngineStatus& status) {
+  if (state->task_id != MessageLoop::kTaskIdNull) {
+    MessageLoop::current()->CancelTask(state->task_id);
+    state->task_id = MessageLoop::kTaskIdNull;
+  }
+  state->notified = true;
+  state->status = status.status;
+  state->time = TimeTicks::Now();
+  observer->SendStatusUpdate(status);
+}
+
+void StatusNotifier::SendPending(ServiceObserverInterface* observer) {
+  auto it = states_.find(observer);
+  if (it == states_.end())
+    return;
+  it->second.task_id = MessageLoop::kTaskIdNull;
+  if (observers_->count(observer) == 0) {
+    states_.erase(it);
+    return;
+  }
+  // Copied, since the observer may notify again from SendStatusUpdate().
+  UpdateEngineStatus status = it->second.pending_status;
+  Send(observer, &it->second, status);
+}
+
+void StatusNotifier::ForgetRemovedObservers() {
+  for (auto it = states_.begin(); it != states_.end();) {
+    if (observers_->count(it->first)) {
+      ++it;
+      continue;
+    }
+    if (it->second.task_id != MessageLoop::kTaskIdNull)
+      MessageLoop::current()->CancelTask(it->second.task_id);
+    it = states_.erase(it);
+  }
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,83 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_STATUS_NOTIFIER_H_
+#define UPDATE_ENGINE_STATUS_NOTIFIER_H_
+
+#include <map>
+#include <set>
+
+#include <base/macros.h>
+#include <base/time/time.h>
+#include <brillo/message_loops/message_loop.h>
+
+#include "update_engine/client_library/include/update_engine/update_status.h"
+#include "update_engine/service_observer_interface.h"
+
+namespace chromeos_update_engine {
+
+// Sends the status updates to the service observers. The status changes are
+// sent to every observer right away, in order. The progress updates within a
+// status are instead coalesced for each observer and sent from the message
+// loop, at most once per |min_interval| with the latest status, so a slow
+// client doesn't slow down the progress callbacks of the update.
+class StatusNotifier {
+ public:
+  // |observers| is the set of observers to notify, which must outlive this
+  // object. Observers may be added and removed from it at any time.
+  StatusNotifier(const std::set<ServiceObserverInterface*>* observers,
+                 base::TimeDelta min_interval);
+  ~StatusNotifier();
+
+  // Sends |status| to the observers, or schedules it if only the progress
+  // changed since the last status sent to them.
+  void Notify(const update_engine::UpdateEngineStatus& status);
+
+ private:
+  struct ObserverState {
+    // The status last sent to the observer, if any.
+    bool notified{false};
+    update_engine::UpdateStatus status{update_engine::UpdateStatus::IDLE};
+    base::TimeTicks time;
+
+    // The latest status not sent yet and the task sending it, if any.
+    update_engine::UpdateEngineStatus pending_status;
+    brillo::MessageLoop::TaskId task_id{brillo::MessageLoop::kTaskIdNull};
+  };
+
+  // Sends |status| to |observer| and cancels its pending status, if any.
+  void Send(ServiceObserverInterface* observer,
+            ObserverState* state,
+            const update_engine::UpdateEngineStatus& status);
+
+  // Sends the pending status of |observer|, if it is still observing.
+  void SendPending(ServiceObserverInterface* observer);
+
+  // Forgets the observers no longer in |observers_|.
+  void ForgetRemovedObservers();
+
+  const std::set<ServiceObserverInterface*>* observers_;
+  const base::TimeDelta min_interval_;
+
+  std::map<ServiceObserverInterface*, ObserverState> states_;
+
+  DISALLOW_COPY_AND_ASSIGN(StatusNotifier);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_STATUS_NOTIFIER_H_
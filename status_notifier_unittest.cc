@@ -0,0 +1,102 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/status_notifier.h"
+
+#include <set>
+
+#include <brillo/message_loops/fake_message_loop.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/mock_service_observer.h"
+
+using base::TimeDelta;
+using testing::_;
+using testing::Field;
+using update_engine::UpdateEngineStatus;
+using update_engine::UpdateStatus;
+
+namespace chromeos_update_engine {
+
+class StatusNotifierTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    loop_.SetAsCurrent();
+    observers_.insert(&observer_);
+  }
+
+  void TearDown() override { EXPECT_FALSE(loop_.PendingTasks()); }
+
+  UpdateEngineStatus MakeStatus(UpdateStatus status, double progress) {
+    UpdateEngineStatus update_engine_status{};
+    update_engine_status.status = status;
+    update_engine_status.progress = progress;
+    return update_engine_status;
+  }
+
+  brillo::FakeMessageLoop loop_{nullptr};
+  testing::StrictMock<MockServiceObserver> observer_;
+  std::set<ServiceObserverInterface*> observers_;
+  StatusNotifier notifier_{&observers_, TimeDelta::FromSeconds(1)};
+};
+
+TEST_F(StatusNotifierTest, StatusChangesAreSentRightAwayTest) {
+  EXPECT_CALL(observer_,
+              SendStatusUpdate(Field(&UpdateEngineStatus::status,
+                                     UpdateStatus::CHECKING_FOR_UPDATE)));
+  EXPECT_CALL(observer_,
+              SendStatusUpdate(Field(&UpdateEngineStatus::status,
+                                     UpdateStatus::UPDATE_AVAILABLE)));
+  notifier_.Notify(MakeStatus(UpdateStatus::CHECKING_FOR_UPDATE, 0.0));
+  notifier_.Notify(MakeStatus(UpdateStatus::UPDATE_AVAILABLE, 0.0));
+  testing::Mock::VerifyAndClearExpectations(&observer_);
+}
+
+TEST_F(StatusNotifierTest, ProgressUpdatesAreCoalescedTest) {
+  EXPECT_CALL(observer_,
+              SendStatusUpdate(Field(&UpdateEngineStatus::progress, 0.1)));
+  notifier_.Notify(MakeStatus(UpdateStatus::DOWNLOADING, 0.1));
+  testing::Mock::VerifyAndClearExpectations(&observer_);
+
+  // Only the latest progress is sent, once the interval passed.
+  notifier_.Notify(MakeStatus(UpdateStatus::DOWNLOADING, 0.2));
+  notifier_.Notify(MakeStatus(UpdateStatus::DOWNLOADING, 0.3));
+  EXPECT_CALL(observer_,
+              SendStatusUpdate(Field(&UpdateEngineStatus::progress, 0.3)));
+  while (loop_.RunOnce(false)) {
+  }
+}
+
+TEST_F(StatusNotifierTest, StatusChangeReplacesThePendingProgressTest) {
+  EXPECT_CALL(observer_, SendStatusUpdate(_)).Times(2);
+  notifier_.Notify(MakeStatus(UpdateStatus::DOWNLOADING, 0.1));
+  notifier_.Notify(MakeStatus(UpdateStatus::DOWNLOADING, 0.2));
+  notifier_.Notify(MakeStatus(UpdateStatus::FINALIZING, 0.0));
+  EXPECT_FALSE(loop_.PendingTasks());
+}
+
+TEST_F(StatusNotifierTest, RemovedObserversAreNotNotifiedTest) {
+  EXPECT_CALL(observer_, SendStatusUpdate(_));
+  notifier_.Notify(MakeStatus(UpdateStatus::DOWNLOADING, 0.1));
+  notifier_.Notify(MakeStatus(UpdateStatus::DOWNLOADING, 0.2));
+  observers_.erase(&observer_);
+  while (loop_.RunOnce(false)) {
+  }
+}
+
+}  // namespace chromeos_update_engine
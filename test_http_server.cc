@@ -45,6 +45,7 @@
 #include <base/strings/string_split.h>
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
+#include <base/time/time.h>
 
 #include "update_engine/common/http_common.h"
 
@@ -384,6 +385,82 @@ ssize_t HandleGet(int fd,
   return HandleGet(fd, request, total_length, 0, 0, 0);
 }
 
+// Generates an HTTP response like HandleGet() over a simulated network link.
+// The response is delayed by |latency_ms| plus a random jitter of up to
+// |jitter_ms| and the payload is sent at |bytes_per_sec|, or as fast as
+// possible if zero. If |drop_every| is not zero, the connection is dropped at
+// each multiple of |drop_every| bytes of the payload, so the client has to
+// resume the transfer with a range request. Returns the total number of bytes
+// delivered or -1 for error.
+ssize_t HandleShapedGet(int fd,
+                        const HttpRequest& request,
+                        const size_t total_length,
+                        const size_t bytes_per_sec,
+                        const int latency_ms,
+                        const int jitter_ms,
+                        const size_t drop_every) {
+  const size_t start_offset = request.start_offset;
+  if (start_offset >= total_length) {
+    return WriteHeaders(
+        fd, total_length, total_length, kHttpResponseReqRangeNotSat);
+  }
+  size_t end_offset = total_length;
+  if (request.end_offset > 0)
+    end_offset = std::min(static_cast<size_t>(request.end_offset), end_offset);
+  if (end_offset < start_offset)
+    return WriteHeaders(fd, 0, 0, kHttpResponseBadRequest);
+
+  int delay_ms = latency_ms;
+  if (jitter_ms > 0)
+    delay_ms += rand() % (jitter_ms + 1);  // NOLINT(runtime/threadsafe_fn)
+  LOG(INFO) << "delaying the response by " << delay_ms << " ms";
+  usleep(delay_ms * 1000);
+
+  ssize_t ret = WriteHeaders(fd, start_offset, end_offset, request.return_code);
+  if (ret < 0)
+    return -1;
+  size_t written = ret;
+
+  // The drops are at absolute offsets, so a resumed transfer makes progress.
+  size_t payload_end = end_offset;
+  if (drop_every > 0) {
+    payload_end =
+        std::min(payload_end, (start_offset / drop_every + 1) * drop_every);
+  }
+
+  LOG(INFO) << "generating shaped response payload: range=" << start_offset
+            << "-" << (payload_end - 1) << " at " << bytes_per_sec
+            << " bytes/s";
+  const size_t chunk_size = bytes_per_sec > 0
+                                ? std::max(bytes_per_sec / 10, size_t{1})
+                                : payload_end - start_offset;
+  const base::TimeTicks start_time = base::TimeTicks::Now();
+  size_t offset = start_offset;
+  while (offset < payload_end) {
+    const size_t chunk_end = std::min(payload_end, offset + chunk_size);
+    const size_t chunk_written = WritePayload(fd, offset, chunk_end);
+    written += chunk_written;
+    if (chunk_written != chunk_end - offset)
+      return -1;
+    offset = chunk_end;
+
+    if (bytes_per_sec > 0) {
+      // Wait until the bytes sent so far would have taken at |bytes_per_sec|.
+      const base::TimeDelta due = base::TimeDelta::FromMicroseconds(
+          (offset - start_offset) * base::Time::kMicrosecondsPerSecond /
+          bytes_per_sec);
+      const base::TimeDelta ahead =
+          due - (base::TimeTicks::Now() - start_time);
+      if (ahead > base::TimeDelta())
+        usleep(ahead.InMicroseconds());
+    }
+  }
+
+  if (payload_end < end_offset)
+    LOG(INFO) << "dropping the connection at offset " << payload_end;
+  return written;
+}
+
 // Handles /redirect/<code>/<url> requests by returning the specified
 // redirect <code> with a location pointing to /<url>.
 void HandleRedirect(int fd, const HttpRequest& request) {
@@ -541,6 +618,27 @@ void HandleConnection(int fd) {
               terms.GetSizeT(2),
               terms.GetInt(3),
               terms.GetInt(4));
+  } else if (base::StartsWith(url, "/shaped/", base::CompareCase::SENSITIVE)) {
+    const UrlTerms terms(url, 6);
+    // Shaped responses are slow on purpose, so they are served by a child
+    // process to let the server accept concurrent connections meanwhile.
+    const pid_t pid = fork();
+    if (pid < 0)
+      PLOG(WARNING) << "fork() failed, serving the connection in-process";
+    if (pid <= 0) {
+      srand(getpid());
+      HandleShapedGet(fd,
+                      request,
+                      terms.GetSizeT(1),
+                      terms.GetSizeT(2),
+                      terms.GetInt(3),
+                      terms.GetInt(4),
+                      terms.GetSizeT(5));
+    }
+    if (pid == 0) {
+      close(fd);
+      exit(RC_OK);
+    }
   } else if (url.find("/redirect/") == 0) {
     HandleRedirect(fd, request);
   } else if (url == "/error") {
@@ -592,6 +690,8 @@ int main(int argc, char** argv) {
 
   // Ignore SIGPIPE on write() to sockets.
   signal(SIGPIPE, SIG_IGN);
+  // Don't leave zombies behind the processes serving shaped responses.
+  signal(SIGCHLD, SIG_IGN);
 
   int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
   if (listen_fd < 0)
@@ -619,7 +719,7 @@ int main(int argc, char** argv) {
     perror("bind");
     exit(RC_ERR_BIND);
   }
-  if (listen(listen_fd, 5) < 0) {
+  if (listen(listen_fd, SOMAXCONN) < 0) {
     perror("listen");
     exit(RC_ERR_LISTEN);
   }
@@ -0,0 +1,158 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/throughput_tracker.h"
+
+#include <algorithm>
+
+#include <base/logging.h>
+
+#include "update_engine/common/constants.h"
+
+using base::TimeDelta;
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The weight of a new sample in the moving averages.
+const double kSmoothingFactor = 0.25;
+
+// The transfers shorter than these don't measure the throughput, only the
+// latency.
+const uint64_t kMinSampleBytes = 64 * 1024;
+const int64_t kMinSampleMilliseconds = 100;
+
+// A transfer is stalled when it is slower than 1/kLowSpeedLimitRatio of the
+// usual throughput, within these bounds.
+const uint64_t kLowSpeedLimitRatio = 50;
+const int kMaxLowSpeedLimitBps = 4096;
+
+// The time a transfer may be stalled is kMinLowSpeedTimeSeconds plus
+// kLowSpeedTimeRttFactor round-trip times, at most kMaxLowSpeedTimeSeconds.
+const int kMinLowSpeedTimeSeconds = 15;
+const int kLowSpeedTimeRttFactor = 10;
+const int kMaxLowSpeedTimeSeconds = 90;
+
+// The first retry waits kRetryDelayRttFactor round-trip times, at least one
+// second.
+const int kRetryDelayRttFactor = 4;
+
+const char* ConnectionTypeKeySuffix(ConnectionType type) {
+  switch (type) {
+    case ConnectionType::kDisconnected:
+      return "disconnected";
+    case ConnectionType::kEthernet:
+      return "ethernet";
+    case ConnectionType::kWifi:
+      return "wifi";
+    case ConnectionType::kWimax:
+      return "wimax";
+    case ConnectionType::kBluetooth:
+      return "bluetooth";
+    case ConnectionType::kCellular:
+      return "cellular";
+    case ConnectionType::kUnknown:
+      return "unknown";
+  }
+  return "unknown";
+}
+
+}  // namespace
+
+ThroughputTracker::ThroughputTracker(PrefsInterface* prefs) : prefs_(prefs) {
+  SetConnectionType(ConnectionType::kUnknown);
+}
+
+void ThroughputTracker::SetConnectionType(ConnectionType type) {
+  connection_type_ = type;
+  throughput_bps_ = 0;
+  rtt_ = TimeDelta();
+  if (!prefs_)
+    return;
+  int64_t throughput_bps = 0, rtt_ms = 0;
+  if (prefs_->GetInt64(GetPrefsKey(kPrefsThroughputHistoryBps),
+                       &throughput_bps) &&
+      throughput_bps > 0) {
+    throughput_bps_ = throughput_bps;
+  }
+  if (prefs_->GetInt64(GetPrefsKey(kPrefsThroughputHistoryRttMs), &rtt_ms) &&
+      rtt_ms > 0) {
+    rtt_ = TimeDelta::FromMilliseconds(rtt_ms);
+  }
+}
+
+void ThroughputTracker::AddSample(uint64_t bytes,
+                                  TimeDelta duration,
+                                  TimeDelta rtt) {
+  bool updated = false;
+  if (bytes >= kMinSampleBytes &&
+      duration.InMilliseconds() >= kMinSampleMilliseconds) {
+    uint64_t sample_bps = bytes * 1000 / duration.InMilliseconds();
+    throughput_bps_ =
+        throughput_bps_ == 0
+            ? sample_bps
+            : static_cast<uint64_t>(kSmoothingFactor * sample_bps +
+                                    (1 - kSmoothingFactor) * throughput_bps_);
+    updated = true;
+  }
+  if (rtt > TimeDelta()) {
+    rtt_ = rtt_.is_zero()
+               ? rtt
+               : TimeDelta::FromMicroseconds(static_cast<int64_t>(
+                     kSmoothingFactor * rtt.InMicroseconds() +
+                     (1 - kSmoothingFactor) * rtt_.InMicroseconds()));
+    updated = true;
+  }
+  if (!updated || !prefs_)
+    return;
+  prefs_->SetInt64(GetPrefsKey(kPrefsThroughputHistoryBps), throughput_bps_);
+  prefs_->SetInt64(GetPrefsKey(kPrefsThroughputHistoryRttMs),
+                   rtt_.InMilliseconds());
+}
+
+bool ThroughputTracker::GetLowSpeedLimit(int* low_speed_bps,
+                                         int* low_speed_seconds) const {
+  if (throughput_bps_ == 0)
+    return false;
+  uint64_t limit_bps = std::min<uint64_t>(
+      throughput_bps_ / kLowSpeedLimitRatio, kMaxLowSpeedLimitBps);
+  *low_speed_bps =
+      std::max(kDownloadLowSpeedLimitBps, static_cast<int>(limit_bps));
+  int64_t seconds =
+      kMinLowSpeedTimeSeconds + (rtt_ * kLowSpeedTimeRttFactor).InSeconds();
+  *low_speed_seconds =
+      static_cast<int>(std::min<int64_t>(kMaxLowSpeedTimeSeconds, seconds));
+  return true;
+}
+
+TimeDelta ThroughputTracker::GetRetryDelay(int attempt,
+                                           TimeDelta max_delay) const {
+  if (throughput_bps_ == 0 && rtt_.is_zero())
+    return max_delay;
+  TimeDelta delay =
+      std::max(TimeDelta::FromSeconds(1), rtt_ * kRetryDelayRttFactor);
+  for (int i = 1; i < attempt && delay < max_delay; i++)
+    delay *= 2;
+  return std::min(delay, max_delay);
+}
+
+string ThroughputTracker::GetPrefsKey(const char* prefix) const {
+  return string(prefix) + "-" + ConnectionTypeKeySuffix(connection_type_);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,84 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_THROUGHPUT_TRACKER_H_
+#define UPDATE_ENGINE_THROUGHPUT_TRACKER_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include <base/macros.h>
+#include <base/time/time.h>
+
+#include "update_engine/common/prefs_interface.h"
+#include "update_engine/connection_utils.h"
+
+namespace chromeos_update_engine {
+
+// Tracks the exponentially weighted moving averages of the download
+// throughput and of the round-trip time over each connection type, and
+// derives from them the stall thresholds and the retry delays of the HTTP
+// transfers. The averages are stored in prefs, so they carry over to the next
+// updates.
+class ThroughputTracker {
+ public:
+  // |prefs| may be null, in which case the averages are not stored.
+  explicit ThroughputTracker(PrefsInterface* prefs);
+
+  // Sets the connection type the following samples were measured over and the
+  // estimates are computed for, and loads its averages from prefs.
+  void SetConnectionType(ConnectionType type);
+  ConnectionType connection_type() const { return connection_type_; }
+
+  // Adds the measurement of a transfer that received |bytes| in |duration|
+  // after its first byte, over a connection whose handshake took |rtt|. A
+  // zero |rtt| means it is unknown, e.g. because the connection was reused.
+  void AddSample(uint64_t bytes, base::TimeDelta duration, base::TimeDelta rtt);
+
+  // Sets |low_speed_bps| and |low_speed_seconds| so a transfer is considered
+  // stalled when it is slower than |low_speed_bps| for |low_speed_seconds|.
+  // The limit is a small fraction of the usual throughput, so slow links are
+  // not aborted, and the time grows with the round-trip time, so dead
+  // connections are dropped quickly on fast links. Returns false and leaves
+  // them unchanged if there's no history for the connection type.
+  bool GetLowSpeedLimit(int* low_speed_bps, int* low_speed_seconds) const;
+
+  // Returns the delay before the |attempt|-th retry of a transfer, starting
+  // at 1. It grows exponentially from a few round-trip times up to
+  // |max_delay|, which is returned if there's no history.
+  base::TimeDelta GetRetryDelay(int attempt, base::TimeDelta max_delay) const;
+
+  // The current averages, zero if unknown.
+  uint64_t throughput_bps() const { return throughput_bps_; }
+  base::TimeDelta rtt() const { return rtt_; }
+
+ private:
+  // Returns the prefs key of |prefix| for the current connection type.
+  std::string GetPrefsKey(const char* prefix) const;
+
+  PrefsInterface* prefs_;
+
+  ConnectionType connection_type_{ConnectionType::kUnknown};
+  uint64_t throughput_bps_{0};
+  base::TimeDelta rtt_;
+
+  DISALLOW_COPY_AND_ASSIGN(ThroughputTracker);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_THROUGHPUT_TRACKER_H_
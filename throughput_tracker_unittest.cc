@@ -0,0 +1,117 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/throughput_tracker.h"
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/fake_prefs.h"
+
+using base::TimeDelta;
+
+namespace chromeos_update_engine {
+
+class ThroughputTrackerTest : public ::testing::Test {
+ protected:
+  FakePrefs fake_prefs_;
+  ThroughputTracker tracker_{&fake_prefs_};
+};
+
+TEST_F(ThroughputTrackerTest, NoHistoryTest) {
+  int low_speed_bps = 10, low_speed_seconds = 90;
+  EXPECT_FALSE(tracker_.GetLowSpeedLimit(&low_speed_bps, &low_speed_seconds));
+  EXPECT_EQ(10, low_speed_bps);
+  EXPECT_EQ(90, low_speed_seconds);
+  EXPECT_EQ(TimeDelta::FromSeconds(20),
+            tracker_.GetRetryDelay(1, TimeDelta::FromSeconds(20)));
+}
+
+TEST_F(ThroughputTrackerTest, ShortSamplesAreIgnoredTest) {
+  tracker_.AddSample(1000, TimeDelta::FromSeconds(1), TimeDelta());
+  tracker_.AddSample(1024 * 1024, TimeDelta::FromMilliseconds(10), TimeDelta());
+  EXPECT_EQ(0U, tracker_.throughput_bps());
+  EXPECT_TRUE(tracker_.rtt().is_zero());
+}
+
+TEST_F(ThroughputTrackerTest, MovingAverageTest) {
+  tracker_.AddSample(100000,
+                     TimeDelta::FromSeconds(1),
+                     TimeDelta::FromMilliseconds(100));
+  EXPECT_EQ(100000U, tracker_.throughput_bps());
+  EXPECT_EQ(TimeDelta::FromMilliseconds(100), tracker_.rtt());
+
+  // An unknown round-trip time doesn't change the average.
+  tracker_.AddSample(200000, TimeDelta::FromSeconds(1), TimeDelta());
+  EXPECT_EQ(125000U, tracker_.throughput_bps());
+  EXPECT_EQ(TimeDelta::FromMilliseconds(100), tracker_.rtt());
+
+  tracker_.AddSample(0, TimeDelta(), TimeDelta::FromMilliseconds(500));
+  EXPECT_EQ(125000U, tracker_.throughput_bps());
+  EXPECT_EQ(TimeDelta::FromMilliseconds(200), tracker_.rtt());
+}
+
+TEST_F(ThroughputTrackerTest, LowSpeedLimitTest) {
+  int low_speed_bps, low_speed_seconds;
+  // A fast link with a long round-trip time.
+  tracker_.AddSample(
+      1024 * 1024, TimeDelta::FromSeconds(1), TimeDelta::FromSeconds(2));
+  EXPECT_TRUE(tracker_.GetLowSpeedLimit(&low_speed_bps, &low_speed_seconds));
+  EXPECT_EQ(4096, low_speed_bps);
+  EXPECT_EQ(35, low_speed_seconds);
+
+  // A slow link, which is only stalled close to zero.
+  ThroughputTracker slow_tracker(nullptr);
+  slow_tracker.AddSample(100000, TimeDelta::FromSeconds(10), TimeDelta());
+  EXPECT_TRUE(
+      slow_tracker.GetLowSpeedLimit(&low_speed_bps, &low_speed_seconds));
+  EXPECT_EQ(200, low_speed_bps);
+  EXPECT_EQ(15, low_speed_seconds);
+}
+
+TEST_F(ThroughputTrackerTest, RetryDelayTest) {
+  const TimeDelta kMaxDelay = TimeDelta::FromSeconds(20);
+  tracker_.AddSample(0, TimeDelta(), TimeDelta::FromMilliseconds(500));
+  EXPECT_EQ(TimeDelta::FromSeconds(2), tracker_.GetRetryDelay(1, kMaxDelay));
+  EXPECT_EQ(TimeDelta::FromSeconds(4), tracker_.GetRetryDelay(2, kMaxDelay));
+  EXPECT_EQ(TimeDelta::FromSeconds(8), tracker_.GetRetryDelay(3, kMaxDelay));
+  EXPECT_EQ(kMaxDelay, tracker_.GetRetryDelay(5, kMaxDelay));
+
+  // Short round-trip times still wait a second.
+  ThroughputTracker fast_tracker(nullptr);
+  fast_tracker.AddSample(0, TimeDelta(), TimeDelta::FromMilliseconds(5));
+  EXPECT_EQ(TimeDelta::FromSeconds(1),
+            fast_tracker.GetRetryDelay(1, kMaxDelay));
+}
+
+TEST_F(ThroughputTrackerTest, HistoryIsStoredPerConnectionTypeTest) {
+  tracker_.SetConnectionType(ConnectionType::kWifi);
+  tracker_.AddSample(100000,
+                     TimeDelta::FromSeconds(1),
+                     TimeDelta::FromMilliseconds(100));
+
+  ThroughputTracker new_tracker(&fake_prefs_);
+  EXPECT_EQ(0U, new_tracker.throughput_bps());
+  new_tracker.SetConnectionType(ConnectionType::kWifi);
+  EXPECT_EQ(100000U, new_tracker.throughput_bps());
+  EXPECT_EQ(TimeDelta::FromMilliseconds(100), new_tracker.rtt());
+
+  new_tracker.SetConnectionType(ConnectionType::kCellular);
+  EXPECT_EQ(0U, new_tracker.throughput_bps());
+  EXPECT_TRUE(new_tracker.rtt().is_zero());
+}
+
+}  // namespace chromeos_update_engine
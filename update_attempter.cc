@@ -44,10 +44,12 @@
 #include "update_engine/common/constants.h"
 #include "update_engine/common/dlcservice_interface.h"
 #include "update_engine/common/hardware_interface.h"
+#include "update_engine/common/parallel_action.h"
 #include "update_engine/common/platform_constants.h"
 #include "update_engine/common/prefs_interface.h"
 #include "update_engine/common/subprocess.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/connection_manager_interface.h"
 #include "update_engine/libcurl_http_fetcher.h"
 #include "update_engine/metrics_reporter_interface.h"
 #include "update_engine/omaha_request_action.h"
@@ -77,6 +79,8 @@ using chromeos_update_manager::EvalStatus;
 using chromeos_update_manager::Policy;
 using chromeos_update_manager::StagingCase;
 using chromeos_update_manager::UpdateCheckParams;
+using chromeos_update_manager::UpdateFetchParams;
+using chromeos_update_manager::UpdateFetchState;
 using std::string;
 using std::vector;
 using update_engine::UpdateAttemptFlags;
@@ -93,6 +97,19 @@ const int kMaxConsecutiveObeyProxyRequests = 20;
 const double kBroadcastThresholdProgress = 0.01;  // 1%
 const int kBroadcastThresholdSeconds = 10;
 
+// The minimum interval between the progress updates sent to each observer.
+const int kObserverProgressIntervalMs = 500;
+
+// The window over which the rate of the current operation is estimated.
+const int kProgressEstimatorWindowSeconds = 30;
+
+// The interval between the samples of the memory used during an update.
+const int kMemorySampleIntervalSeconds = 10;
+
+// The directory in the non-volatile directory where the payloads of the
+// updates deferred by the policy are staged.
+const char kPayloadCacheDirName[] = "payload_cache";
+
 // By default autest bypasses scattering. If we want to test scattering,
 // use kScheduledAUTestURLRequest. The URL used is same in both cases, but
 // different params are passed to CheckForUpdate().
@@ -122,6 +139,11 @@ UpdateAttempter::UpdateAttempter(SystemState* system_state,
     : processor_(new ActionProcessor()),
       system_state_(system_state),
       cert_checker_(cert_checker),
+      status_notifier_(
+          &service_observers_,
+          TimeDelta::FromMilliseconds(kObserverProgressIntervalMs)),
+      progress_estimator_(
+          TimeDelta::FromSeconds(kProgressEstimatorWindowSeconds)),
       is_install_(false) {}
 
 UpdateAttempter::~UpdateAttempter() {
@@ -279,6 +301,9 @@ void UpdateAttempter::Update(const string& app_version,
     return;
   }
 
+  // The connection to Omaha is set up while the update check is built.
+  connection_prewarmer_.Prewarm(omaha_request_params_->update_url());
+
   BuildUpdateActions(interactive);
 
   SetStatusAndNotify(UpdateStatus::CHECKING_FOR_UPDATE);
@@ -618,6 +643,16 @@ void UpdateAttempter::CalculateStagingParams(bool interactive) {
   }
 }
 
+std::unique_ptr<HttpFetcher> UpdateAttempter::CreatePrewarmFetcher() {
+  auto fetcher = std::make_unique<LibcurlHttpFetcher>(
+      GetProxyResolver(), system_state_->hardware());
+  // A HEAD request sets up the connection without downloading anything, and
+  // is not retried since the transfer it prepares retries on its own.
+  fetcher->set_head_request(true);
+  fetcher->set_max_retry_count(0);
+  return fetcher;
+}
+
 void UpdateAttempter::BuildUpdateActions(bool interactive) {
   CHECK(!processor_->IsRunning());
   processor_->set_delegate(this);
@@ -631,6 +666,7 @@ void UpdateAttempter::BuildUpdateActions(bool interactive) {
   update_check_fetcher->set_no_network_max_retries(interactive ? 1 : 3);
   auto update_check_action = std::make_unique<OmahaRequestAction>(
       system_state_, nullptr, std::move(update_check_fetcher), false);
+  update_check_action->set_connection_prewarmer(&connection_prewarmer_);
   auto response_handler_action =
       std::make_unique<OmahaResponseHandlerAction>(system_state_);
   auto update_boot_flags_action =
@@ -642,9 +678,44 @@ void UpdateAttempter::BuildUpdateActions(bool interactive) {
                                            system_state_->hardware()),
       false);
 
+  // The throughput history is kept for each connection type.
+  if (!throughput_tracker_)
+    throughput_tracker_.reset(new ThroughputTracker(prefs_));
+  ConnectionType connection_type = ConnectionType::kUnknown;
+  ConnectionTethering tethering;
+  if (!system_state_->connection_manager()->GetConnectionProperties(
+          &connection_type, &tethering)) {
+    connection_type = ConnectionType::kUnknown;
+  }
+  throughput_tracker_->SetConnectionType(connection_type);
+
+  // Let the policy tune the fetchers for the current connection.
+  UpdateFetchState fetch_state;
+  fetch_state.throughput_bps = throughput_tracker_->throughput_bps();
+  UpdateFetchParams fetch_params = UpdateFetchParams();
+  if (system_state_->update_manager()->PolicyRequest(
+          &Policy::UpdateDownloadFetchParams, &fetch_params, fetch_state) ==
+      EvalStatus::kFailed) {
+    LOG(WARNING) << "Querying the fetch parameters failed, using defaults.";
+    fetch_params = UpdateFetchParams();
+  }
+  int num_connections = fetch_params.num_connections;
+  if (num_connections <= 0)
+    num_connections = system_state_->hardware()->GetDownloadConnections();
+  LOG(INFO) << "Downloading over " << num_connections << " connection(s), "
+            << "policy rate limit " << fetch_params.rate_limit_bps << " B/s.";
+
+  if (!bandwidth_limiter_)
+    bandwidth_limiter_.reset(new BandwidthLimiter(system_state_->clock()));
+  download_interactive_ = interactive;
+  policy_rate_limit_bps_ = fetch_params.rate_limit_bps;
+  UpdateDownloadRateLimit();
+
   LibcurlHttpFetcher* download_fetcher =
       new LibcurlHttpFetcher(GetProxyResolver(), system_state_->hardware());
   download_fetcher->set_server_to_check(ServerToCheck::kDownload);
+  download_fetcher->set_throughput_tracker(throughput_tracker_.get());
+  download_fetcher->set_bandwidth_limiter(bandwidth_limiter_.get());
   if (interactive)
     download_fetcher->set_max_retry_count(kDownloadMaxRetryCountInteractive);
   auto download_action =
@@ -654,7 +725,45 @@ void UpdateAttempter::BuildUpdateActions(bool interactive) {
                                        system_state_,
                                        download_fetcher,  // passes ownership
                                        interactive);
+  // Download the payload over several connections if the policy or the board
+  // asks for it.
+  if (fetch_params.chunk_size > 0)
+    download_action->set_parallel_chunk_size(fetch_params.chunk_size);
+  for (int i = 1; i < num_connections; i++) {
+    LibcurlHttpFetcher* parallel_fetcher =
+        new LibcurlHttpFetcher(GetProxyResolver(), system_state_->hardware());
+    parallel_fetcher->set_server_to_check(ServerToCheck::kDownload);
+    parallel_fetcher->set_throughput_tracker(throughput_tracker_.get());
+    parallel_fetcher->set_bandwidth_limiter(bandwidth_limiter_.get());
+    if (interactive)
+      parallel_fetcher->set_max_retry_count(kDownloadMaxRetryCountInteractive);
+    download_action->AddParallelFetcher(parallel_fetcher);  // passes ownership
+  }
+  // Fetch the next DLC payloads while the current one is applied, within the
+  // same bandwidth limit.
+  const int prefetch_payloads =
+      system_state_->hardware()->GetDownloadPrefetchPayloads();
+  for (int i = 0; i < prefetch_payloads; i++) {
+    LibcurlHttpFetcher* prefetch_fetcher =
+        new LibcurlHttpFetcher(GetProxyResolver(), system_state_->hardware());
+    prefetch_fetcher->set_server_to_check(ServerToCheck::kDownload);
+    prefetch_fetcher->set_throughput_tracker(throughput_tracker_.get());
+    prefetch_fetcher->set_bandwidth_limiter(bandwidth_limiter_.get());
+    if (interactive)
+      prefetch_fetcher->set_max_retry_count(kDownloadMaxRetryCountInteractive);
+    download_action->AddPrefetchFetcher(prefetch_fetcher);  // passes ownership
+  }
   download_action->set_delegate(this);
+  base::FilePath non_volatile_dir;
+  // DLC installs use the cache to link a preloaded or p2p copy of their
+  // payloads instead of downloading them.
+  if ((is_install_ || system_state_->hardware()->StagePayloadsWhenDeferred()) &&
+      system_state_->hardware()->GetNonVolatileDirectory(&non_volatile_dir)) {
+    download_action->set_payload_cache_dir(
+        non_volatile_dir.Append(kPayloadCacheDirName));
+    download_action->set_preloaded_payload_dir(
+        base::FilePath(constants::kPreloadedPayloadsDirectory));
+  }
 
   auto download_finished_action = std::make_unique<OmahaRequestAction>(
       system_state_,
@@ -664,6 +773,8 @@ void UpdateAttempter::BuildUpdateActions(bool interactive) {
       false);
   auto filesystem_verifier_action =
       std::make_unique<FilesystemVerifierAction>();
+  filesystem_verifier_action->set_read_size(
+      system_state_->hardware()->GetVerifierReadSize());
   auto update_complete_action = std::make_unique<OmahaRequestAction>(
       system_state_,
       new OmahaEvent(OmahaEvent::kTypeUpdateComplete),
@@ -683,13 +794,18 @@ void UpdateAttempter::BuildUpdateActions(bool interactive) {
   BondActions(filesystem_verifier_action.get(),
               postinstall_runner_action.get());
 
+  // Reporting the download to Omaha doesn't depend on the verification of the
+  // new partitions, so both run at the same time.
+  auto verify_action = std::make_unique<ParallelAction>();
+  verify_action->AddAction(std::move(download_finished_action));
+  verify_action->AddAction(std::move(filesystem_verifier_action));
+
   processor_->EnqueueAction(std::move(update_check_action));
   processor_->EnqueueAction(std::move(response_handler_action));
   processor_->EnqueueAction(std::move(update_boot_flags_action));
   processor_->EnqueueAction(std::move(download_started_action));
   processor_->EnqueueAction(std::move(download_action));
-  processor_->EnqueueAction(std::move(download_finished_action));
-  processor_->EnqueueAction(std::move(filesystem_verifier_action));
+  processor_->EnqueueAction(std::move(verify_action));
   processor_->EnqueueAction(std::move(postinstall_runner_action));
   processor_->EnqueueAction(std::move(update_complete_action));
 }
@@ -828,6 +944,7 @@ bool UpdateAttempter::CheckForUpdate(const string& app_version,
     // Use the passed-in update attempt flags for this update attempt instead
     // of the previously set ones.
     current_update_attempt_flags_ = flags;
+    NotifyUpdaterStateChanged();
     // Note: The caching for non-interactive update checks happens in
     // OnUpdateScheduled().
   }
@@ -936,6 +1053,7 @@ void UpdateAttempter::OnUpdateScheduled(EvalStatus status,
       // Cache the update attempt flags that will be used by this update attempt
       // so that they can't be changed mid-way through.
       current_update_attempt_flags_ = update_attempt_flags_;
+      NotifyUpdaterStateChanged();
     }
 
     LOG(INFO) << "Update attempt flags in use = 0x" << std::hex
@@ -968,6 +1086,7 @@ void UpdateAttempter::OnUpdateScheduled(EvalStatus status,
 
 void UpdateAttempter::UpdateLastCheckedTime() {
   last_checked_time_ = system_state_->clock()->GetWallclockTime().ToTimeT();
+  NotifyUpdaterStateChanged();
 }
 
 void UpdateAttempter::UpdateRollbackHappened() {
@@ -993,6 +1112,7 @@ void UpdateAttempter::ProcessingDone(const ActionProcessor* processor,
 
   // reset the state that's only valid for a single update pass
   current_update_attempt_flags_ = UpdateAttemptFlags::kNone;
+  NotifyUpdaterStateChanged();
 
   if (forced_update_pending_callback_.get())
     // Clear prior interactive requests once the processor is done.
@@ -1111,6 +1231,11 @@ void UpdateAttempter::ProcessingStopped(const ActionProcessor* processor) {
 void UpdateAttempter::ActionCompleted(ActionProcessor* processor,
                                       AbstractAction* action,
                                       ErrorCode code) {
+  // The completion of each action in a ParallelAction was already reported,
+  // including the failure it completes with, if any.
+  if (action->Type() == ParallelAction::StaticType())
+    return;
+
   // Reset download progress regardless of whether or not the download
   // action succeeded. Also, get the response code from HTTP request
   // actions (update download as well as the initial update check
@@ -1118,6 +1243,7 @@ void UpdateAttempter::ActionCompleted(ActionProcessor* processor,
   const string type = action->Type();
   if (type == DownloadAction::StaticType()) {
     download_progress_ = 0.0;
+    NotifyUpdaterStateChanged();
     DownloadAction* download_action = static_cast<DownloadAction*>(action);
     http_response_code_ = download_action->GetHTTPResponseCode();
   } else if (type == OmahaRequestAction::StaticType()) {
@@ -1140,6 +1266,7 @@ void UpdateAttempter::ActionCompleted(ActionProcessor* processor,
       // Store the server-dictated poll interval, if any.
       server_dictated_poll_interval_ =
           std::max(0, omaha_response.poll_interval);
+      NotifyUpdaterStateChanged();
 
       // This update is ignored by omaha request action because update over
       // cellular connection is not allowed. Needs to ask for user's permissions
@@ -1180,8 +1307,9 @@ void UpdateAttempter::ActionCompleted(ActionProcessor* processor,
   if (code != ErrorCode::kSuccess) {
     // If the current state is at or past the download phase, count the failure
     // in case a switch to full update becomes necessary. Ignore network
-    // transfer timeouts and failures.
-    if (code != ErrorCode::kDownloadTransferError) {
+    // transfer timeouts and failures, and the deferral of a staged update.
+    if (code != ErrorCode::kDownloadTransferError &&
+        code != ErrorCode::kOmahaUpdateDeferredPerPolicy) {
       switch (status_) {
         case UpdateStatus::IDLE:
         case UpdateStatus::CHECKING_FOR_UPDATE:
@@ -1236,6 +1364,7 @@ void UpdateAttempter::BytesReceived(uint64_t bytes_progressed,
   } else {
     ProgressUpdate(progress);
   }
+  progress_estimator_.AddSample(TimeTicks::Now(), bytes_received, total);
 }
 
 void UpdateAttempter::DownloadComplete() {
@@ -1243,6 +1372,9 @@ void UpdateAttempter::DownloadComplete() {
 }
 
 void UpdateAttempter::ProgressUpdate(double progress) {
+  // The download progress is estimated from the bytes in BytesReceived().
+  if (status_ != UpdateStatus::DOWNLOADING)
+    progress_estimator_.AddFraction(TimeTicks::Now(), progress);
   // Self throttle based on progress. Also send notifications if progress is
   // too slow.
   if (progress == 1.0 ||
@@ -1266,6 +1398,7 @@ bool UpdateAttempter::ResetStatus() {
     case UpdateStatus::UPDATED_NEED_REBOOT: {
       bool ret_value = true;
       status_ = UpdateStatus::IDLE;
+      NotifyUpdaterStateChanged();
 
       // Remove the reboot marker so that if the machine is rebooted
       // after resetting to idle state, it doesn't go back to
@@ -1312,18 +1445,35 @@ bool UpdateAttempter::GetStatus(UpdateEngineStatus* out_status) {
   out_status->new_size_bytes = new_payload_size_;
   out_status->new_version = new_version_;
   out_status->new_system_version = new_system_version_;
+  out_status->download_bytes_per_second =
+      status_ == UpdateStatus::DOWNLOADING
+          ? progress_estimator_.GetUnitsPerSecond()
+          : -1.0;
+  out_status->seconds_left = progress_estimator_.GetSecondsLeft();
+  PhaseIoStats io_stats = io_stats_recorder_.GetPhaseStats();
+  out_status->phase_bytes_read = io_stats.process.bytes_read;
+  out_status->phase_bytes_written = io_stats.process.bytes_written;
   return true;
 }
 
+string UpdateAttempter::GetPerfStats() {
+  memory_sampler_.Sample();
+  return memory_sampler_.ToJson();
+}
+
 void UpdateAttempter::BroadcastStatus() {
   UpdateEngineStatus broadcast_status;
   // Use common method for generating the current status.
   GetStatus(&broadcast_status);
 
-  for (const auto& observer : service_observers_) {
-    observer->SendStatusUpdate(broadcast_status);
-  }
+  status_notifier_.Notify(broadcast_status);
   last_notify_time_ = TimeTicks::Now();
+  NotifyUpdaterStateChanged();
+}
+
+void UpdateAttempter::NotifyUpdaterStateChanged() {
+  if (updater_state_changed_callback_)
+    updater_state_changed_callback_->Run();
 }
 
 uint32_t UpdateAttempter::GetErrorCodeFlags() {
@@ -1362,6 +1512,27 @@ bool UpdateAttempter::ShouldCancel(ErrorCode* cancel_reason) {
 }
 
 void UpdateAttempter::SetStatusAndNotify(UpdateStatus status) {
+  // Each operation progresses at its own rate and does its own I/O. The
+  // memory is sampled while an update is in progress.
+  if (status != status_) {
+    progress_estimator_.Reset();
+    const char* phase = UpdatePhaseName(status_);
+    if (phase) {
+      system_state_->metrics_reporter()->ReportPhaseIoMetrics(
+          phase, io_stats_recorder_.GetPhaseStats());
+      memory_sampler_.Sample();
+      LOG(INFO) << "Memory used by " << phase << ": "
+                << memory_sampler_.ToString();
+    }
+    io_stats_recorder_.StartPhase();
+    if (status == UpdateStatus::IDLE ||
+        status == UpdateStatus::UPDATED_NEED_REBOOT) {
+      memory_sampler_.Stop();
+    } else {
+      memory_sampler_.Start(
+          base::TimeDelta::FromSeconds(kMemorySampleIntervalSeconds));
+    }
+  }
   status_ = status;
   BroadcastStatus();
 }
@@ -1632,6 +1803,22 @@ bool UpdateAttempter::IsUpdateRunningOrScheduled() {
           waiting_for_scheduled_check_);
 }
 
+void UpdateAttempter::UpdateDownloadRateLimit() {
+  if (!bandwidth_limiter_)
+    return;
+  int64_t rate_bps = 0;
+  if (download_interactive_ ||
+      !prefs_->GetInt64(kPrefsDownloadRateLimitBps, &rate_bps)) {
+    rate_bps = 0;
+  }
+  // The lower of the two limits applies.
+  if (!download_interactive_ && policy_rate_limit_bps_ > 0 &&
+      (rate_bps <= 0 || policy_rate_limit_bps_ < rate_bps)) {
+    rate_bps = policy_rate_limit_bps_;
+  }
+  bandwidth_limiter_->SetRate(rate_bps);
+}
+
 bool UpdateAttempter::IsAnyUpdateSourceAllowed() const {
   // We allow updates from any source if either of these are true:
   //  * The device is running an unofficial (dev/test) image.
@@ -30,19 +30,26 @@
 #include <gtest/gtest_prod.h>  // for FRIEND_TEST
 
 #if USE_CHROME_NETWORK_PROXY
+#include "update_engine/bandwidth_limiter.h"
 #include "update_engine/chrome_browser_proxy_resolver.h"
 #endif  // USE_CHROME_NETWORK_PROXY
 #include "update_engine/certificate_checker.h"
 #include "update_engine/client_library/include/update_engine/update_status.h"
 #include "update_engine/common/action_processor.h"
 #include "update_engine/common/cpu_limiter.h"
+#include "update_engine/common/io_stats.h"
+#include "update_engine/common/memory_stats.h"
+#include "update_engine/common/progress_estimator.h"
 #include "update_engine/common/proxy_resolver.h"
+#include "update_engine/connection_prewarmer.h"
 #include "update_engine/omaha_request_params.h"
 #include "update_engine/omaha_response_handler_action.h"
 #include "update_engine/payload_consumer/download_action.h"
 #include "update_engine/payload_consumer/postinstall_runner_action.h"
 #include "update_engine/service_observer_interface.h"
+#include "update_engine/status_notifier.h"
 #include "update_engine/system_state.h"
+#include "update_engine/throughput_tracker.h"
 #include "update_engine/update_manager/policy.h"
 #include "update_engine/update_manager/staging_utils.h"
 #include "update_engine/update_manager/update_manager.h"
@@ -108,6 +115,10 @@ class UpdateAttempter : public ActionProcessorDelegate,
   // Returns the current status in the out param. Returns true on success.
   virtual bool GetStatus(update_engine::UpdateEngineStatus* out_status);
 
+  // Returns the performance statistics of the daemon as JSON: the memory it
+  // uses, sampled now, and the memory accounted for by category.
+  virtual std::string GetPerfStats();
+
   UpdateStatus status() const { return status_; }
 
   int http_response_code() const { return http_response_code_; }
@@ -215,12 +226,34 @@ class UpdateAttempter : public ActionProcessorDelegate,
     forced_update_pending_callback_.reset(callback);
   }
 
+  // Sets a callback to be used whenever the values returned by GetStatus(),
+  // GetCurrentUpdateAttemptFlags(), consecutive_failed_update_checks() or
+  // server_dictated_poll_interval() may have changed. Takes ownership of the
+  // callback object. A null value disables callback on these events. Like the
+  // forced update pending callback, only one callback can be set.
+  virtual void set_updater_state_changed_callback(base::Closure* callback) {
+    updater_state_changed_callback_.reset(callback);
+  }
+
+  // Applies the download rate limit stored in prefs, or the one chosen by the
+  // policy if it's lower, to the download in progress, if any. Interactive
+  // downloads are not limited.
+  void UpdateDownloadRateLimit();
+
   // Returns true if we should allow updates from any source. In official builds
   // we want to restrict updates to known safe sources, but under certain
   // conditions it's useful to allow updating from anywhere (e.g. to allow
   // 'cros flash' to function properly).
   bool IsAnyUpdateSourceAllowed() const;
 
+#if USE_CHROME_NETWORK_PROXY
+  // Returns the resolver of the proxies obeyed by the transfers, so its cache
+  // can observe the network changes.
+  ChromeBrowserProxyResolver* chrome_proxy_resolver() {
+    return &chrome_proxy_resolver_;
+  }
+#endif  // USE_CHROME_NETWORK_PROXY
+
   // Add and remove a service observer.
   void AddObserver(ServiceObserverInterface* observer) {
     service_observers_.insert(observer);
@@ -324,6 +357,10 @@ class UpdateAttempter : public ActionProcessorDelegate,
     return &direct_proxy_resolver_;
   }
 
+  // Creates the fetchers of the |connection_prewarmer_|. Virtual for
+  // testing.
+  virtual std::unique_ptr<HttpFetcher> CreatePrewarmFetcher();
+
   // Sends a ping to Omaha.
   // This is used after an update has been applied and we're waiting for the
   // user to reboot.  This ping helps keep the number of actives count
@@ -394,6 +431,9 @@ class UpdateAttempter : public ActionProcessorDelegate,
   // Updates the time an update was last attempted to the current time.
   void UpdateLastCheckedTime();
 
+  // Runs the updater state changed callback, if any.
+  void NotifyUpdaterStateChanged();
+
   // Checks whether we need to clear the rollback-happened preference after
   // policy is available again.
   void UpdateRollbackHappened();
@@ -431,6 +471,9 @@ class UpdateAttempter : public ActionProcessorDelegate,
   // The list of services observing changes in the updater.
   std::set<ServiceObserverInterface*> service_observers_;
 
+  // Sends the status updates to |service_observers_|.
+  StatusNotifier status_notifier_;
+
   // The install plan.
   std::unique_ptr<InstallPlan> install_plan_;
 
@@ -457,6 +500,12 @@ class UpdateAttempter : public ActionProcessorDelegate,
   // For status:
   UpdateStatus status_{UpdateStatus::IDLE};
   double download_progress_ = 0.0;
+  // Estimates the rate and the time left of the current operation.
+  ProgressEstimator progress_estimator_;
+  // Measures the I/O done during the current operation.
+  PhaseIoStatsRecorder io_stats_recorder_;
+  // Samples the memory used during an update.
+  MemorySampler memory_sampler_;
   int64_t last_checked_time_ = 0;
   std::string prev_version_;
   std::string new_version_ = "0.0.0.0";
@@ -481,6 +530,20 @@ class UpdateAttempter : public ActionProcessorDelegate,
   // Used for fetching information about the device policy.
   std::unique_ptr<policy::PolicyProvider> policy_provider_;
 
+  // Tracks the throughput of the payload downloads to tune their fetchers.
+  std::unique_ptr<ThroughputTracker> throughput_tracker_;
+
+  // Connects to the Omaha and payload servers ahead of the transfers.
+  ConnectionPrewarmer connection_prewarmer_{base::Bind(
+      &UpdateAttempter::CreatePrewarmFetcher, base::Unretained(this))};
+
+  // Limits the rate of the payload downloads, and whether the current one is
+  // interactive.
+  std::unique_ptr<BandwidthLimiter> bandwidth_limiter_;
+  bool download_interactive_{false};
+  // The rate limit the policy chose for the current connection, or 0.
+  int64_t policy_rate_limit_bps_{0};
+
   // The current scatter factor as found in the policy setting.
   base::TimeDelta scatter_factor_;
 
@@ -502,6 +565,10 @@ class UpdateAttempter : public ActionProcessorDelegate,
   std::unique_ptr<base::Callback<void(bool, bool)>>
       forced_update_pending_callback_;
 
+  // A callback to use when the update status, the current update attempt flags
+  // or the results of the last update check may have changed.
+  std::unique_ptr<base::Closure> updater_state_changed_callback_;
+
   // The |app_version| and |omaha_url| parameters received during the latest
   // forced update request. They are retrieved for use once the update is
   // actually scheduled.
@@ -37,6 +37,7 @@
 #include "update_engine/common/utils.h"
 #include "update_engine/daemon_state_interface.h"
 #include "update_engine/metrics_reporter_interface.h"
+#include "update_engine/metrics_reporter_performance_log.h"
 #include "update_engine/metrics_utils.h"
 #include "update_engine/network_selector.h"
 #include "update_engine/payload_consumer/delta_performer.h"
@@ -44,6 +45,7 @@
 #include "update_engine/payload_consumer/file_descriptor.h"
 #include "update_engine/payload_consumer/file_descriptor_utils.h"
 #include "update_engine/payload_consumer/filesystem_verifier_action.h"
+#include "update_engine/payload_consumer/packed_extents.h"
 #include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_consumer/payload_metadata.h"
 #include "update_engine/payload_consumer/postinstall_runner_action.h"
@@ -73,6 +75,18 @@ namespace {
 const double kBroadcastThresholdProgress = 0.01;  // 1%
 const int kBroadcastThresholdSeconds = 10;
 
+// The minimum interval between the progress updates sent to each observer.
+const int kObserverProgressIntervalMs = 500;
+
+// The window over which the rate of the current operation is estimated.
+const int kProgressEstimatorWindowSeconds = 30;
+
+// The interval between the samples of the memory used during an update.
+const int kMemorySampleIntervalSeconds = 10;
+
+// The maximum time the downloaded bytes are counted without being persisted.
+const int kBytesDownloadedPersistIntervalSeconds = 10;
+
 const char* const kErrorDomain = "update_engine";
 // TODO(deymo): Convert the different errors to a numeric value to report them
 // back on the service error.
@@ -107,8 +121,20 @@ UpdateAttempterAndroid::UpdateAttempterAndroid(
       boot_control_(boot_control),
       hardware_(hardware),
       processor_(new ActionProcessor()),
+      progress_estimator_(
+          TimeDelta::FromSeconds(kProgressEstimatorWindowSeconds)),
+      status_notifier_(
+          &daemon_state->service_observers(),
+          TimeDelta::FromMilliseconds(kObserverProgressIntervalMs)),
       clock_(new Clock()) {
-  metrics_reporter_ = metrics::CreateMetricsReporter();
+  auto metrics_reporter = std::make_unique<MetricsReporterPerformanceLog>(
+      metrics::CreateMetricsReporter());
+  base::FilePath non_volatile_path;
+  if (hardware_->GetNonVolatileDirectory(&non_volatile_path)) {
+    metrics_reporter->set_log_path(
+        non_volatile_path.Append(kPerformanceLogFileName));
+  }
+  metrics_reporter_ = std::move(metrics_reporter);
   network_selector_ = network::CreateNetworkSelector();
   set_cpuset_policy(0, SP_BACKGROUND);
 }
@@ -260,26 +286,51 @@ bool UpdateAttempterAndroid::ApplyPayload(
   install_plan_.Dump();
 
   HttpFetcher* fetcher = nullptr;
+  vector<HttpFetcher*> parallel_fetchers;
   if (FileFetcher::SupportedUrl(payload_url)) {
     DLOG(INFO) << "Using FileFetcher for file URL.";
-    fetcher = new FileFetcher();
+    FileFetcher* file_fetcher = new FileFetcher();
+    file_fetcher->set_read_size(hardware_->GetFileFetcherReadSize());
+    fetcher = file_fetcher;
   } else {
 #ifdef _UE_SIDELOAD
     LOG(FATAL) << "Unsupported sideload URI: " << payload_url;
 #else
+    if (!throughput_tracker_)
+      throughput_tracker_.reset(new ThroughputTracker(prefs_));
+    if (!bandwidth_limiter_)
+      bandwidth_limiter_.reset(new BandwidthLimiter(clock_.get()));
+    UpdateDownloadRateLimit();
     LibcurlHttpFetcher* libcurl_fetcher =
         new LibcurlHttpFetcher(&proxy_resolver_, hardware_);
     libcurl_fetcher->set_server_to_check(ServerToCheck::kDownload);
+    libcurl_fetcher->set_throughput_tracker(throughput_tracker_.get());
+    libcurl_fetcher->set_bandwidth_limiter(bandwidth_limiter_.get());
     fetcher = libcurl_fetcher;
+    for (int i = 1; i < hardware_->GetDownloadConnections(); i++) {
+      libcurl_fetcher = new LibcurlHttpFetcher(&proxy_resolver_, hardware_);
+      libcurl_fetcher->set_server_to_check(ServerToCheck::kDownload);
+      libcurl_fetcher->set_throughput_tracker(throughput_tracker_.get());
+      libcurl_fetcher->set_bandwidth_limiter(bandwidth_limiter_.get());
+      parallel_fetchers.push_back(libcurl_fetcher);
+    }
 #endif  // _UE_SIDELOAD
   }
   // Setup extra headers.
-  if (!headers[kPayloadPropertyAuthorization].empty())
-    fetcher->SetHeader("Authorization", headers[kPayloadPropertyAuthorization]);
-  if (!headers[kPayloadPropertyUserAgent].empty())
-    fetcher->SetHeader("User-Agent", headers[kPayloadPropertyUserAgent]);
+  vector<HttpFetcher*> all_fetchers = parallel_fetchers;
+  all_fetchers.push_back(fetcher);
+  for (HttpFetcher* header_fetcher : all_fetchers) {
+    if (!headers[kPayloadPropertyAuthorization].empty()) {
+      header_fetcher->SetHeader("Authorization",
+                                headers[kPayloadPropertyAuthorization]);
+    }
+    if (!headers[kPayloadPropertyUserAgent].empty()) {
+      header_fetcher->SetHeader("User-Agent",
+                                headers[kPayloadPropertyUserAgent]);
+    }
+  }
 
-  BuildUpdateActions(fetcher);
+  BuildUpdateActions(fetcher, parallel_fetchers);
 
   SetStatusAndNotify(UpdateStatus::UPDATE_AVAILABLE);
 
@@ -430,9 +481,14 @@ bool UpdateAttempterAndroid::VerifyPayloadApplicable(
       return LogAndSetError(
           error, FROM_HERE, "Failed to open " + partition_path);
     }
-    for (const InstallOperation& operation : partition.operations()) {
-      if (!operation.has_src_sha256_hash())
+    for (const InstallOperation& packed_operation : partition.operations()) {
+      if (!packed_operation.has_src_sha256_hash())
         continue;
+      InstallOperation operation = packed_operation;
+      if (!UnpackOperationExtents(&operation)) {
+        return LogAndSetError(
+            error, FROM_HERE, "Invalid extents in " + partition_path);
+      }
       brillo::Blob source_hash;
       if (!fd_utils::ReadAndHashExtents(fd,
                                         operation.src_extents(),
@@ -460,9 +516,35 @@ bool UpdateAttempterAndroid::SetPerformanceMode(bool enable,
   if (set_cpuset_policy(0, enable ? SP_TOP_APP : SP_BACKGROUND) < 0)
     return LogAndSetError(error, FROM_HERE, "Could not change policy");
   performance_mode_ = enable;
+  UpdateDownloadRateLimit();
+  return true;
+}
+
+bool UpdateAttempterAndroid::SetDownloadRateLimit(int64_t rate_bps,
+                                                  brillo::ErrorPtr* error) {
+  if (rate_bps < 0) {
+    return LogAndSetError(error,
+                          FROM_HERE,
+                          "Invalid download rate limit " +
+                              std::to_string(rate_bps));
+  }
+  if (!prefs_->SetInt64(kPrefsDownloadRateLimitBps, rate_bps))
+    return LogAndSetError(error, FROM_HERE, "Unable to save the rate limit");
+  UpdateDownloadRateLimit();
   return true;
 }
 
+void UpdateAttempterAndroid::UpdateDownloadRateLimit() {
+  if (!bandwidth_limiter_)
+    return;
+  int64_t rate_bps = 0;
+  if (performance_mode_ ||
+      !prefs_->GetInt64(kPrefsDownloadRateLimitBps, &rate_bps)) {
+    rate_bps = 0;
+  }
+  bandwidth_limiter_->SetRate(rate_bps);
+}
+
 void UpdateAttempterAndroid::ProcessingDone(const ActionProcessor* processor,
                                             ErrorCode code) {
   LOG(INFO) << "Processing Done.";
@@ -542,16 +624,32 @@ void UpdateAttempterAndroid::BytesReceived(uint64_t bytes_progressed,
   } else {
     ProgressUpdate(progress);
   }
+  progress_estimator_.AddSample(TimeTicks::Now(), bytes_received, total);
 
-  // Update the bytes downloaded in prefs.
-  int64_t current_bytes_downloaded =
-      metrics_utils::GetPersistedValue(kPrefsCurrentBytesDownloaded, prefs_);
-  int64_t total_bytes_downloaded =
-      metrics_utils::GetPersistedValue(kPrefsTotalBytesDownloaded, prefs_);
-  prefs_->SetInt64(kPrefsCurrentBytesDownloaded,
-                   current_bytes_downloaded + bytes_progressed);
-  prefs_->SetInt64(kPrefsTotalBytesDownloaded,
-                   total_bytes_downloaded + bytes_progressed);
+  Time now = clock_->GetMonotonicTime();
+  chunk_intervals_.AddChunk(now);
+  // The bytes downloaded are counted in memory and only persisted every few
+  // seconds, rather than reading and writing two prefs for every chunk.
+  unpersisted_bytes_downloaded_ += bytes_progressed;
+  if (now - bytes_downloaded_persisted_time_ >=
+      TimeDelta::FromSeconds(kBytesDownloadedPersistIntervalSeconds)) {
+    PersistBytesDownloaded();
+  }
+}
+
+void UpdateAttempterAndroid::PersistBytesDownloaded() {
+  if (unpersisted_bytes_downloaded_ > 0) {
+    int64_t current_bytes_downloaded =
+        metrics_utils::GetPersistedValue(kPrefsCurrentBytesDownloaded, prefs_);
+    int64_t total_bytes_downloaded =
+        metrics_utils::GetPersistedValue(kPrefsTotalBytesDownloaded, prefs_);
+    prefs_->SetInt64(kPrefsCurrentBytesDownloaded,
+                     current_bytes_downloaded + unpersisted_bytes_downloaded_);
+    prefs_->SetInt64(kPrefsTotalBytesDownloaded,
+                     total_bytes_downloaded + unpersisted_bytes_downloaded_);
+    unpersisted_bytes_downloaded_ = 0;
+  }
+  bytes_downloaded_persisted_time_ = clock_->GetMonotonicTime();
 }
 
 bool UpdateAttempterAndroid::ShouldCancel(ErrorCode* cancel_reason) {
@@ -565,6 +663,9 @@ void UpdateAttempterAndroid::DownloadComplete() {
 }
 
 void UpdateAttempterAndroid::ProgressUpdate(double progress) {
+  // The download progress is estimated from the bytes in BytesReceived().
+  if (status_ != UpdateStatus::DOWNLOADING)
+    progress_estimator_.AddFraction(TimeTicks::Now(), progress);
   // Self throttle based on progress. Also send notifications if progress is
   // too slow.
   if (progress == 1.0 ||
@@ -620,20 +721,50 @@ void UpdateAttempterAndroid::TerminateUpdateAndNotify(ErrorCode error_code) {
 }
 
 void UpdateAttempterAndroid::SetStatusAndNotify(UpdateStatus status) {
+  // Each operation progresses at its own rate and does its own I/O. The
+  // memory is sampled while an update is in progress.
+  if (status != status_) {
+    progress_estimator_.Reset();
+    const char* phase = UpdatePhaseName(status_);
+    if (phase) {
+      metrics_reporter_->ReportPhaseIoMetrics(
+          phase, io_stats_recorder_.GetPhaseStats());
+      memory_sampler_.Sample();
+      LOG(INFO) << "Memory used by " << phase << ": "
+                << memory_sampler_.ToString();
+    }
+    io_stats_recorder_.StartPhase();
+    if (status == UpdateStatus::IDLE ||
+        status == UpdateStatus::UPDATED_NEED_REBOOT) {
+      memory_sampler_.Stop();
+    } else {
+      memory_sampler_.Start(
+          base::TimeDelta::FromSeconds(kMemorySampleIntervalSeconds));
+    }
+  }
   status_ = status;
   size_t payload_size =
       install_plan_.payloads.empty() ? 0 : install_plan_.payloads[0].size;
-  UpdateEngineStatus status_to_send = {.status = status_,
-                                       .progress = download_progress_,
-                                       .new_size_bytes = payload_size};
-
-  for (auto observer : daemon_state_->service_observers()) {
-    observer->SendStatusUpdate(status_to_send);
-  }
+  PhaseIoStats io_stats = io_stats_recorder_.GetPhaseStats();
+  UpdateEngineStatus status_to_send = {
+      .status = status_,
+      .progress = download_progress_,
+      .new_size_bytes = payload_size,
+      .download_bytes_per_second =
+          status_ == UpdateStatus::DOWNLOADING
+              ? progress_estimator_.GetUnitsPerSecond()
+              : -1.0,
+      .seconds_left = progress_estimator_.GetSecondsLeft(),
+      .phase_bytes_read = static_cast<int64_t>(io_stats.process.bytes_read),
+      .phase_bytes_written =
+          static_cast<int64_t>(io_stats.process.bytes_written)};
+
+  status_notifier_.Notify(status_to_send);
   last_notify_time_ = TimeTicks::Now();
 }
 
-void UpdateAttempterAndroid::BuildUpdateActions(HttpFetcher* fetcher) {
+void UpdateAttempterAndroid::BuildUpdateActions(
+    HttpFetcher* fetcher, const vector<HttpFetcher*>& parallel_fetchers) {
   CHECK(!processor_->IsRunning());
   processor_->set_delegate(this);
 
@@ -648,10 +779,14 @@ void UpdateAttempterAndroid::BuildUpdateActions(HttpFetcher* fetcher) {
                                        nullptr,  // system_state, not used.
                                        fetcher,  // passes ownership
                                        true /* interactive */);
+  for (HttpFetcher* parallel_fetcher : parallel_fetchers)
+    download_action->AddParallelFetcher(parallel_fetcher);  // passes ownership
   download_action->set_delegate(this);
   download_action->set_base_offset(base_offset_);
   auto filesystem_verifier_action =
       std::make_unique<FilesystemVerifierAction>();
+  filesystem_verifier_action->set_read_size(hardware_->GetVerifierReadSize());
+  filesystem_verifier_action->set_prefs(prefs_);
   auto postinstall_runner_action =
       std::make_unique<PostinstallRunnerAction>(boot_control_, hardware_);
   postinstall_runner_action->set_delegate(this);
@@ -694,6 +829,7 @@ bool UpdateAttempterAndroid::UpdateCompletedOnThisBoot() {
 // Collect and report the android metrics when we terminate the update.
 void UpdateAttempterAndroid::CollectAndReportUpdateMetricsOnUpdateFinished(
     ErrorCode error_code) {
+  PersistBytesDownloaded();
   int64_t attempt_number =
       metrics_utils::GetPersistedValue(kPrefsPayloadAttemptNumber, prefs_);
   PayloadType payload_type = kPayloadTypeFull;
@@ -723,6 +859,9 @@ void UpdateAttempterAndroid::CollectAndReportUpdateMetricsOnUpdateFinished(
       attempt_result,
       error_code);
 
+  metrics_reporter_->ReportDownloadChunkIntervalMetrics(
+      chunk_intervals_.counts(), chunk_intervals_.longest_interval());
+
   int64_t current_bytes_downloaded =
       metrics_utils::GetPersistedValue(kPrefsCurrentBytesDownloaded, prefs_);
   metrics_reporter_->ReportUpdateAttemptDownloadMetrics(
@@ -837,6 +976,7 @@ void UpdateAttempterAndroid::UpdatePrefsOnUpdateStart(bool is_resume) {
   }
   metrics_utils::SetUpdateTimestampStart(clock_->GetMonotonicTime(), prefs_);
   metrics_utils::SetUpdateBootTimestampStart(clock_->GetBootTime(), prefs_);
+  chunk_intervals_.Reset();
 }
 
 void UpdateAttempterAndroid::ClearMetricsPrefs() {
@@ -25,12 +25,16 @@
 
 #include <base/time/time.h>
 
+#include "update_engine/bandwidth_limiter.h"
 #include "update_engine/client_library/include/update_engine/update_status.h"
 #include "update_engine/common/action_processor.h"
 #include "update_engine/common/boot_control_interface.h"
 #include "update_engine/common/clock.h"
 #include "update_engine/common/hardware_interface.h"
+#include "update_engine/common/io_stats.h"
+#include "update_engine/common/memory_stats.h"
 #include "update_engine/common/prefs_interface.h"
+#include "update_engine/common/progress_estimator.h"
 #include "update_engine/daemon_state_interface.h"
 #include "update_engine/metrics_reporter_interface.h"
 #include "update_engine/metrics_utils.h"
@@ -39,6 +43,8 @@
 #include "update_engine/payload_consumer/postinstall_runner_action.h"
 #include "update_engine/service_delegate_android_interface.h"
 #include "update_engine/service_observer_interface.h"
+#include "update_engine/status_notifier.h"
+#include "update_engine/throughput_tracker.h"
 
 namespace chromeos_update_engine {
 
@@ -72,6 +78,8 @@ class UpdateAttempterAndroid
   bool VerifyPayloadApplicable(const std::string& metadata_filename,
                                brillo::ErrorPtr* error) override;
   bool SetPerformanceMode(bool enable, brillo::ErrorPtr* error) override;
+  bool SetDownloadRateLimit(int64_t rate_bps,
+                            brillo::ErrorPtr* error) override;
 
   // ActionProcessorDelegate methods:
   void ProcessingDone(const ActionProcessor* processor,
@@ -107,9 +115,11 @@ class UpdateAttempterAndroid
   void SetStatusAndNotify(UpdateStatus status);
 
   // Helper method to construct the sequence of actions to be performed for
-  // applying an update using a given HttpFetcher. The ownership of |fetcher| is
-  // passed to this function.
-  void BuildUpdateActions(HttpFetcher* fetcher);
+  // applying an update using a given HttpFetcher and the |parallel_fetchers|
+  // downloading parts of the payload along with it. The ownership of |fetcher|
+  // and |parallel_fetchers| is passed to this function.
+  void BuildUpdateActions(HttpFetcher* fetcher,
+                          const std::vector<HttpFetcher*>& parallel_fetchers);
 
   // Writes to the processing completed marker. Does nothing if
   // |update_completed_marker_| is empty.
@@ -132,8 +142,13 @@ class UpdateAttempterAndroid
   // |kPrefsTotalBytesDownloaded|: number of bytes downloaded in total since
   // the last successful update.
 
+  // Adds the bytes received since the last call to
+  // |kPrefsCurrentBytesDownloaded| and |kPrefsTotalBytesDownloaded|.
+  void PersistBytesDownloaded();
+
   // Metrics report function to call:
   //   |ReportUpdateAttemptMetrics|
+  //   |ReportDownloadChunkIntervalMetrics|
   //   |ReportSuccessfulUpdateMetrics|
   // Prefs to update:
   //   |kPrefsSystemUpdatedMarker|
@@ -157,6 +172,10 @@ class UpdateAttempterAndroid
   //   |kPrefsUpdateBootTimestampStart|
   void ClearMetricsPrefs();
 
+  // Applies the download rate limit stored in prefs to |bandwidth_limiter_|,
+  // unless the performance mode is enabled.
+  void UpdateDownloadRateLimit();
+
   DaemonStateInterface* daemon_state_;
 
   // DaemonStateAndroid pointers.
@@ -181,6 +200,23 @@ class UpdateAttempterAndroid
   // For status:
   UpdateStatus status_{UpdateStatus::IDLE};
   double download_progress_{0.0};
+  // Estimates the rate and the time left of the current operation.
+  ProgressEstimator progress_estimator_;
+  // Measures the I/O done during the current operation.
+  PhaseIoStatsRecorder io_stats_recorder_;
+  // Samples the memory used during an update.
+  MemorySampler memory_sampler_;
+
+  // Sends the status updates to the service observers.
+  StatusNotifier status_notifier_;
+
+  // The bytes received since the byte counters were last persisted, and the
+  // monotonic time when they were.
+  int64_t unpersisted_bytes_downloaded_{0};
+  base::Time bytes_downloaded_persisted_time_;
+
+  // The intervals between the chunks received in the current attempt.
+  metrics_utils::ChunkIntervalHistogram chunk_intervals_;
 
   // The offset in the payload file where the CrAU part starts.
   int64_t base_offset_{0};
@@ -188,8 +224,15 @@ class UpdateAttempterAndroid
   // Helper class to select the network to use during the update.
   std::unique_ptr<NetworkSelectorInterface> network_selector_;
 
+  // Tracks the throughput of the payload downloads to tune their fetchers.
+  // The connection type is not known on Android.
+  std::unique_ptr<ThroughputTracker> throughput_tracker_;
+
   std::unique_ptr<ClockInterface> clock_;
 
+  // Limits the rate of the payload downloads.
+  std::unique_ptr<BandwidthLimiter> bandwidth_limiter_;
+
   std::unique_ptr<MetricsReporterInterface> metrics_reporter_;
 
   bool performance_mode_ = false;
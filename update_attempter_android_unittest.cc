@@ -156,8 +156,15 @@ TEST_F(UpdateAttempterAndroidTest, ReportMetricsOnUpdateTerminated) {
 }
 
 TEST_F(UpdateAttempterAndroidTest, ReportMetricsForBytesDownloaded) {
+  // The bytes are only persisted every 10 seconds.
+  update_attempter_android_.BytesReceived(10, 10, 200);
+  EXPECT_EQ(
+      0,
+      metrics_utils::GetPersistedValue(kPrefsCurrentBytesDownloaded, &prefs_));
+  clock_->SetMonotonicTime(Time::FromInternalValue(10000000));
+
   // Check both prefs are updated correctly.
-  update_attempter_android_.BytesReceived(20, 50, 200);
+  update_attempter_android_.BytesReceived(10, 20, 200);
   EXPECT_EQ(
       20,
       metrics_utils::GetPersistedValue(kPrefsCurrentBytesDownloaded, &prefs_));
@@ -165,6 +172,8 @@ TEST_F(UpdateAttempterAndroidTest, ReportMetricsForBytesDownloaded) {
       20,
       metrics_utils::GetPersistedValue(kPrefsTotalBytesDownloaded, &prefs_));
 
+  EXPECT_CALL(*metrics_reporter_, ReportDownloadChunkIntervalMetrics(_, _))
+      .Times(2);
   EXPECT_CALL(*metrics_reporter_,
               ReportUpdateAttemptDownloadMetrics(50, _, _, _, _))
       .Times(1);
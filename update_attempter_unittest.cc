@@ -37,6 +37,7 @@
 #include "update_engine/common/mock_action_processor.h"
 #include "update_engine/common/mock_http_fetcher.h"
 #include "update_engine/common/mock_prefs.h"
+#include "update_engine/common/parallel_action.h"
 #include "update_engine/common/platform_constants.h"
 #include "update_engine/common/prefs.h"
 #include "update_engine/common/test_utils.h"
@@ -109,6 +110,11 @@ class UpdateAttempterUnderTest : public UpdateAttempter {
     }
     return true;
   }
+  // The tests don't connect to the Omaha and payload servers ahead.
+  std::unique_ptr<HttpFetcher> CreatePrewarmFetcher() override {
+    return nullptr;
+  }
+
   void EnableScheduleUpdates() { do_schedule_updates_ = true; }
   void DisableScheduleUpdates() { do_schedule_updates_ = false; }
 
@@ -276,11 +282,13 @@ TEST_F(UpdateAttempterTest, DownloadProgressAccumulationTest) {
                   Field(&UpdateEngineStatus::progress, progress_1),
                   Field(&UpdateEngineStatus::status, UpdateStatus::DOWNLOADING),
                   Field(&UpdateEngineStatus::new_size_bytes, bytes_total))));
+  bool progress_2_sent = false;
   EXPECT_CALL(observer,
               SendStatusUpdate(AllOf(
                   Field(&UpdateEngineStatus::progress, progress_2),
                   Field(&UpdateEngineStatus::status, UpdateStatus::DOWNLOADING),
-                  Field(&UpdateEngineStatus::new_size_bytes, bytes_total))));
+                  Field(&UpdateEngineStatus::new_size_bytes, bytes_total))))
+      .WillOnce(testing::Assign(&progress_2_sent, true));
   attempter_.AddObserver(&observer);
   attempter_.BytesReceived(bytes_progressed_1, bytes_received_1, bytes_total);
   EXPECT_EQ(progress_1, attempter_.download_progress_);
@@ -289,6 +297,12 @@ TEST_F(UpdateAttempterTest, DownloadProgressAccumulationTest) {
   // as the callback is receiving.
   attempter_.BytesReceived(bytes_progressed_2, bytes_received_2, bytes_total);
   EXPECT_EQ(progress_2, attempter_.download_progress_);
+  // The progress within a status is sent to the observers from the loop.
+  brillo::MessageLoopRunUntil(
+      &loop_,
+      TimeDelta::FromSeconds(5),
+      base::Bind([](bool* sent) { return *sent; }, &progress_2_sent));
+  EXPECT_TRUE(progress_2_sent);
 }
 
 TEST_F(UpdateAttempterTest, ChangeToDownloadingOnReceivedBytesTest) {
@@ -351,6 +365,34 @@ TEST_F(UpdateAttempterTest, ActionCompletedOmahaRequestTest) {
   ASSERT_TRUE(attempter_.error_event_.get() == nullptr);
 }
 
+TEST_F(UpdateAttempterTest, UpdaterStateChangedCallbackTest) {
+  int calls = 0;
+  attempter_.set_updater_state_changed_callback(
+      new base::Closure(base::Bind([](int* calls) { (*calls)++; }, &calls)));
+
+  // The results of the update check are reported.
+  unique_ptr<MockHttpFetcher> fetcher(new MockHttpFetcher("", 0, nullptr));
+  fetcher->FailTransfer(500);
+  OmahaRequestAction action(
+      &fake_system_state_, nullptr, std::move(fetcher), false);
+  ObjectCollectorAction<OmahaResponse> collector_action;
+  BondActions(&action, &collector_action);
+  action.SetOutputObject(OmahaResponse());
+  EXPECT_CALL(*prefs_, GetInt64(kPrefsDeltaUpdateFailures, _)).Times(0);
+  attempter_.ActionCompleted(nullptr, &action, ErrorCode::kSuccess);
+  EXPECT_EQ(1, calls);
+
+  // So are the status broadcasts and the last checked time.
+  attempter_.BroadcastStatus();
+  EXPECT_EQ(2, calls);
+  attempter_.UpdateLastCheckedTime();
+  EXPECT_EQ(3, calls);
+
+  attempter_.set_updater_state_changed_callback(nullptr);
+  attempter_.BroadcastStatus();
+  EXPECT_EQ(3, calls);
+}
+
 TEST_F(UpdateAttempterTest, ConstructWithUpdatedMarkerTest) {
   FakePrefs fake_prefs;
   string boot_id;
@@ -467,8 +509,7 @@ const string kUpdateActionTypes[] = {  // NOLINT(runtime/string)
     UpdateBootFlagsAction::StaticType(),
     OmahaRequestAction::StaticType(),
     DownloadAction::StaticType(),
-    OmahaRequestAction::StaticType(),
-    FilesystemVerifierAction::StaticType(),
+    ParallelAction::StaticType(),
     PostinstallRunnerAction::StaticType(),
     OmahaRequestAction::StaticType()};
 
@@ -130,6 +130,8 @@
           'xz-embedded',
           'libbspatch',
           'libpuffpatch',
+          'libzstd',
+          'liblz4',
         ],
         'deps': ['<@(exported_deps)'],
       },
@@ -154,24 +156,34 @@
       'sources': [
         'common/action_processor.cc',
         'common/boot_control_stub.cc',
+        'common/cancellation_token.cc',
         'common/clock.cc',
         'common/constants.cc',
         'common/cpu_limiter.cc',
         'common/error_code_utils.cc',
+        'common/file_fetcher.cc',
         'common/hash_calculator.cc',
         'common/http_common.cc',
         'common/http_fetcher.cc',
         'common/hwid_override.cc',
+        'common/io_stats.cc',
+        'common/memory_stats.cc',
         'common/multi_range_http_fetcher.cc',
+        'common/parallel_action.cc',
         'common/platform_constants_chromeos.cc',
         'common/prefs.cc',
+        'common/progress_estimator.cc',
         'common/proxy_resolver.cc',
         'common/subprocess.cc',
         'common/terminator.cc',
+        'common/trace.cc',
         'common/utils.cc',
+        'payload_consumer/block_ranges.cc',
+        'payload_consumer/buffer_pool.cc',
         'payload_consumer/bzip_extent_writer.cc',
         'payload_consumer/cached_file_descriptor.cc',
         'payload_consumer/delta_performer.cc',
+        'payload_consumer/direct_io_file_descriptor.cc',
         'payload_consumer/download_action.cc',
         'payload_consumer/extent_reader.cc',
         'payload_consumer/extent_writer.cc',
@@ -180,13 +192,24 @@
         'payload_consumer/file_writer.cc',
         'payload_consumer/filesystem_verifier_action.cc',
         'payload_consumer/install_plan.cc',
+        'payload_consumer/lz4_extent_writer.cc',
         'payload_consumer/mount_history.cc',
+        'payload_consumer/packed_extents.cc',
+        'payload_consumer/partition_write_hasher.cc',
+        'payload_consumer/payload_cache_writer.cc',
         'payload_consumer/payload_constants.cc',
         'payload_consumer/payload_metadata.cc',
+        'payload_consumer/payload_prefetcher.cc',
         'payload_consumer/payload_verifier.cc',
         'payload_consumer/postinstall_runner_action.cc',
+        'payload_consumer/skip_unchanged_file_descriptor.cc',
+        'payload_consumer/source_data_cache.cc',
+        'payload_consumer/staging_file_writer.cc',
         'payload_consumer/verity_writer_stub.cc',
+        'payload_consumer/writeback_file_descriptor.cc',
         'payload_consumer/xz_extent_writer.cc',
+        'payload_consumer/zstd_bspatch.cc',
+        'payload_consumer/zstd_extent_writer.cc',
       ],
       'conditions': [
         ['USE_mtd == 1', {
@@ -224,6 +247,7 @@
           'libssl',
           'libupdate_engine-client',
           'vboot_host',
+          'zlib',
         ],
         'conditions':[
           ['USE_dlc == 1', {
@@ -255,10 +279,12 @@
         ],
       },
       'sources': [
+        'bandwidth_limiter.cc',
         'boot_control_chromeos.cc',
         'certificate_checker.cc',
         'common_service.cc',
         'connection_manager.cc',
+        'connection_prewarmer.cc',
         'connection_utils.cc',
         'daemon.cc',
         'dbus_connection.cc',
@@ -267,6 +293,7 @@
         'image_properties_chromeos.cc',
         'libcurl_http_fetcher.cc',
         'metrics_reporter_omaha.cc',
+        'metrics_reporter_performance_log.cc',
         'metrics_utils.cc',
         'omaha_request_action.cc',
         'omaha_request_params.cc',
@@ -276,7 +303,10 @@
         'payload_state.cc',
         'power_manager_chromeos.cc',
         'real_system_state.cc',
+        'shill_connection_cache.cc',
         'shill_proxy.cc',
+        'status_notifier.cc',
+        'throughput_tracker.cc',
         'update_attempter.cc',
         'update_boot_flags_action.cc',
         'update_manager/boxed_value.cc',
@@ -352,6 +382,7 @@
       'sources': [
         'client_library/client.cc',
         'client_library/client_dbus.cc',
+        'client_library/throttled_status_update_handler.cc',
         'update_status_utils.cc',
       ],
       'include_dirs': [
@@ -386,6 +417,7 @@
           'libbsdiff',
           'libpuffdiff',
           'liblzma',
+          'zlib',
         ],
         'deps': ['<@(exported_deps)'],
       },
@@ -404,34 +436,44 @@
         },
       },
       'sources': [
-        'common/file_fetcher.cc',
         'payload_generator/ab_generator.cc',
         'payload_generator/annotated_operation.cc',
         'payload_generator/blob_file_writer.cc',
         'payload_generator/block_mapping.cc',
         'payload_generator/boot_img_filesystem.cc',
         'payload_generator/bzip.cc',
+        'payload_generator/cached_filesystem.cc',
         'payload_generator/cycle_breaker.cc',
         'payload_generator/deflate_utils.cc',
         'payload_generator/delta_diff_generator.cc',
         'payload_generator/delta_diff_utils.cc',
+        'payload_generator/diff_cache.cc',
         'payload_generator/ext2_filesystem.cc',
         'payload_generator/extent_ranges.cc',
         'payload_generator/extent_utils.cc',
+        'payload_generator/file_similarity_index.cc',
         'payload_generator/full_update_generator.cc',
         'payload_generator/graph_types.cc',
         'payload_generator/graph_utils.cc',
         'payload_generator/inplace_generator.cc',
+        'payload_generator/lz4.cc',
         'payload_generator/mapfile_filesystem.cc',
+        'payload_generator/mapped_image.cc',
+        'payload_generator/memory_budget.cc',
+        'payload_generator/payload_checker.cc',
         'payload_generator/payload_file.cc',
         'payload_generator/payload_generation_config_chromeos.cc',
         'payload_generator/payload_generation_config.cc',
         'payload_generator/payload_signer.cc',
+        'payload_generator/phase_timings.cc',
         'payload_generator/raw_filesystem.cc',
+        'payload_generator/sparse_image.cc',
         'payload_generator/squashfs_filesystem.cc',
         'payload_generator/tarjan.cc',
         'payload_generator/topological_sort.cc',
         'payload_generator/xz_chromeos.cc',
+        'payload_generator/zstd.cc',
+        'payload_generator/zstd_bsdiff_patch_writer.cc',
       ],
     },
     # server-side delta generator.
@@ -451,6 +493,23 @@
         'payload_generator/generate_delta_main.cc',
       ],
     },
+    # server-side payload checker.
+    {
+      'target_name': 'payload_check',
+      'type': 'executable',
+      'dependencies': [
+        'libpayload_consumer',
+        'libpayload_generator',
+      ],
+      'link_settings': {
+        'ldflags!': [
+          '-pie',
+        ],
+      },
+      'sources': [
+        'payload_generator/payload_check_main.cc',
+      ],
+    },
     {
       'target_name': 'update_engine_test_libs',
       'type': 'static_library',
@@ -544,66 +603,96 @@
             'update_engine_test_libs',
           ],
           'sources': [
+            'bandwidth_limiter_unittest.cc',
             'boot_control_chromeos_unittest.cc',
             'certificate_checker_unittest.cc',
             'common/action_pipe_unittest.cc',
             'common/action_processor_unittest.cc',
             'common/action_unittest.cc',
+            'common/cancellation_token_unittest.cc',
             'common/cpu_limiter_unittest.cc',
             'common/hash_calculator_unittest.cc',
             'common/http_fetcher_unittest.cc',
             'common/hwid_override_unittest.cc',
+            'common/io_stats_unittest.cc',
+            'common/memory_stats_unittest.cc',
+            'common/parallel_action_unittest.cc',
             'common/prefs_unittest.cc',
+            'common/progress_estimator_unittest.cc',
             'common/proxy_resolver_unittest.cc',
             'common/subprocess_unittest.cc',
             'common/terminator_unittest.cc',
             'common/utils_unittest.cc',
             'common_service_unittest.cc',
             'connection_manager_unittest.cc',
+            'connection_prewarmer_unittest.cc',
             'hardware_chromeos_unittest.cc',
             'image_properties_chromeos_unittest.cc',
             'metrics_reporter_omaha_unittest.cc',
+            'metrics_reporter_performance_log_unittest.cc',
             'metrics_utils_unittest.cc',
             'omaha_request_action_unittest.cc',
             'omaha_request_params_unittest.cc',
             'omaha_response_handler_action_unittest.cc',
             'omaha_utils_unittest.cc',
             'p2p_manager_unittest.cc',
+            'payload_consumer/block_ranges_unittest.cc',
+            'payload_consumer/buffer_pool_unittest.cc',
             'payload_consumer/bzip_extent_writer_unittest.cc',
             'payload_consumer/cached_file_descriptor_unittest.cc',
             'payload_consumer/delta_performer_integration_test.cc',
             'payload_consumer/delta_performer_unittest.cc',
+            'payload_consumer/direct_io_file_descriptor_unittest.cc',
             'payload_consumer/download_action_unittest.cc',
             'payload_consumer/extent_reader_unittest.cc',
             'payload_consumer/extent_writer_unittest.cc',
             'payload_consumer/file_descriptor_utils_unittest.cc',
             'payload_consumer/file_writer_unittest.cc',
             'payload_consumer/filesystem_verifier_action_unittest.cc',
+            'payload_consumer/packed_extents_unittest.cc',
+            'payload_consumer/partition_write_hasher_unittest.cc',
+            'payload_consumer/payload_cache_writer_unittest.cc',
+            'payload_consumer/payload_prefetcher_unittest.cc',
             'payload_consumer/postinstall_runner_action_unittest.cc',
+            'payload_consumer/skip_unchanged_file_descriptor_unittest.cc',
+            'payload_consumer/source_data_cache_unittest.cc',
+            'payload_consumer/staging_file_writer_unittest.cc',
+            'payload_consumer/writeback_file_descriptor_unittest.cc',
             'payload_consumer/xz_extent_writer_unittest.cc',
+            'payload_consumer/zstd_bspatch_unittest.cc',
             'payload_generator/ab_generator_unittest.cc',
             'payload_generator/blob_file_writer_unittest.cc',
             'payload_generator/block_mapping_unittest.cc',
             'payload_generator/boot_img_filesystem_unittest.cc',
+            'payload_generator/cached_filesystem_unittest.cc',
             'payload_generator/cycle_breaker_unittest.cc',
             'payload_generator/deflate_utils_unittest.cc',
             'payload_generator/delta_diff_utils_unittest.cc',
+            'payload_generator/diff_cache_unittest.cc',
             'payload_generator/ext2_filesystem_unittest.cc',
             'payload_generator/extent_ranges_unittest.cc',
             'payload_generator/extent_utils_unittest.cc',
+            'payload_generator/file_similarity_index_unittest.cc',
             'payload_generator/full_update_generator_unittest.cc',
             'payload_generator/graph_utils_unittest.cc',
             'payload_generator/inplace_generator_unittest.cc',
             'payload_generator/mapfile_filesystem_unittest.cc',
+            'payload_generator/mapped_image_unittest.cc',
+            'payload_generator/memory_budget_unittest.cc',
+            'payload_generator/payload_checker_unittest.cc',
             'payload_generator/payload_file_unittest.cc',
             'payload_generator/payload_generation_config_unittest.cc',
             'payload_generator/payload_signer_unittest.cc',
+            'payload_generator/phase_timings_unittest.cc',
+            'payload_generator/sparse_image_unittest.cc',
             'payload_generator/squashfs_filesystem_unittest.cc',
             'payload_generator/tarjan_unittest.cc',
             'payload_generator/topological_sort_unittest.cc',
             'payload_generator/zip_unittest.cc',
             'payload_state_unittest.cc',
+            'status_notifier_unittest.cc',
             'testrunner.cc',
+            'throughput_tracker_unittest.cc',
             'update_attempter_unittest.cc',
             'update_boot_flags_action_unittest.cc',
             'update_manager/boxed_value_unittest.cc',
@@ -624,6 +713,116 @@
             'update_manager/weekly_time_unittest.cc',
           ],
         },
+        # Benchmarks of the payload application.
+        {
+          'target_name': 'payload_consumer_benchmark',
+          'type': 'executable',
+          'variables': {
+            'deps': [
+              'zlib',
+            ],
+          },
+          'dependencies': [
+            'libpayload_consumer',
+            'libpayload_generator',
+          ],
+          'link_settings': {
+            'libraries': [
+              '-lbenchmark',
+            ],
+          },
+          'sources': [
+            'common/fake_prefs.cc',
+            'payload_consumer/payload_consumer_benchmark.cc',
+          ],
+        },
+        # Benchmarks of the payload generation.
+        {
+          'target_name': 'payload_generator_benchmark',
+          'type': 'executable',
+          'dependencies': [
+            'libpayload_consumer',
+            'libpayload_generator',
+          ],
+          'link_settings': {
+            'libraries': [
+              '-lbenchmark',
+            ],
+          },
+          'sources': [
+            'payload_generator/fake_filesystem.cc',
+            'payload_generator/payload_generator_benchmark.cc',
+          ],
+        },
+        # Benchmarks of the verification of the target partitions.
+        {
+          'target_name': 'verification_benchmark',
+          'type': 'executable',
+          'dependencies': [
+            'libpayload_consumer',
+          ],
+          'link_settings': {
+            'libraries': [
+              '-lbenchmark',
+            ],
+          },
+          'sources': [
+            'payload_consumer/verification_benchmark.cc',
+          ],
+        },
+        # Benchmarks of whole updates: download, application and verification.
+        {
+          'target_name': 'update_benchmark',
+          'type': 'executable',
+          'dependencies': [
+            'libpayload_consumer',
+            'libpayload_generator',
+          ],
+          'link_settings': {
+            'libraries': [
+              '-lbenchmark',
+            ],
+          },
+          'sources': [
+            'common/fake_prefs.cc',
+            'payload_consumer/update_benchmark.cc',
+            'payload_generator/fake_filesystem.cc',
+          ],
+        },
+        # Benchmarks of the policy evaluations of the update manager.
+        {
+          'target_name': 'update_manager_benchmark',
+          'type': 'executable',
+          'dependencies': [
+            'libupdate_engine',
+            'update_engine_test_libs',
+          ],
+          'link_settings': {
+            'libraries': [
+              '-lbenchmark',
+            ],
+          },
+          'sources': [
+            'update_manager/update_manager_benchmark.cc',
+          ],
+        },
+        # Benchmarks of the parsing of the Omaha responses.
+        {
+          'target_name': 'omaha_request_action_benchmark',
+          'type': 'executable',
+          'dependencies': [
+            'libupdate_engine',
+            'update_engine_test_libs',
+          ],
+          'link_settings': {
+            'libraries': [
+              '-lbenchmark',
+            ],
+          },
+          'sources': [
+            'omaha_request_action_benchmark.cc',
+          ],
+        },
       ],
     }],
     # Fuzzer target.
@@ -36,6 +36,7 @@
 #include "update_engine/common/error_code_utils.h"
 #include "update_engine/omaha_utils.h"
 #include "update_engine/status_update_handler.h"
+#include "update_engine/throttled_status_update_handler.h"
 #include "update_engine/update_status.h"
 #include "update_engine/update_status_utils.h"
 
@@ -154,6 +155,41 @@ void WatchingStatusUpdateHandler::HandleStatusUpdate(
   LOG(INFO) << "  new_size: " << new_size;
 }
 
+// Prints the status updates coalesced over an interval, along with the
+// download rate and the time left.
+class ThrottledWatchingStatusUpdateHandler
+    : public update_engine::ThrottledStatusUpdateHandler {
+ public:
+  explicit ThrottledWatchingStatusUpdateHandler(base::TimeDelta min_interval)
+      : update_engine::ThrottledStatusUpdateHandler(min_interval) {}
+  ~ThrottledWatchingStatusUpdateHandler() override = default;
+
+  void IPCError(const string& error) override;
+  void HandleThrottledStatusUpdate(
+      const update_engine::ThrottledStatusUpdate& status) override;
+};
+
+void ThrottledWatchingStatusUpdateHandler::IPCError(const string& error) {
+  LOG(ERROR) << error;
+  exit(1);
+}
+
+void ThrottledWatchingStatusUpdateHandler::HandleThrottledStatusUpdate(
+    const update_engine::ThrottledStatusUpdate& status) {
+  LOG(INFO) << "Got status update:";
+  LOG(INFO) << "  last_checked_time: " << status.last_checked_time;
+  LOG(INFO) << "  progress: " << status.progress;
+  LOG(INFO) << "  current_operation: "
+            << UpdateStatusToString(status.current_operation);
+  LOG(INFO) << "  new_version: " << status.new_version;
+  LOG(INFO) << "  new_size: " << status.new_size;
+  if (status.download_bytes_per_second >= 0) {
+    LOG(INFO) << "  download_bytes_per_second: "
+              << status.download_bytes_per_second;
+    LOG(INFO) << "  download_seconds_left: " << status.download_seconds_left;
+  }
+}
+
 bool UpdateEngineClient::ShowStatus() {
   int64_t last_checked_time = 0;
   double progress = 0.0;
@@ -316,11 +352,18 @@ int UpdateEngineClient::ProcessFlags() {
   DEFINE_bool(watch_for_updates,
               false,
               "Listen for status updates and print them to the screen.");
+  DEFINE_int32(status_interval_ms,
+               0,
+               "With --watch_for_updates, print at most one status update "
+               "per interval, along with the download rate and time left.");
   DEFINE_bool(prev_version,
               false,
               "Show the previous OS version used before the update reboot.");
   DEFINE_bool(last_attempt_error, false, "Show the last attempt error.");
   DEFINE_bool(eol_status, false, "Show the current end-of-life status.");
+  DEFINE_bool(show_perf,
+              false,
+              "Show the memory used by the update_engine, as JSON.");
   DEFINE_bool(install, false, "Requests an install.");
   DEFINE_string(dlc_module_ids, "", "colon-separated list of DLC IDs.");
 
@@ -577,7 +620,13 @@ int UpdateEngineClient::ProcessFlags() {
 
   if (FLAGS_watch_for_updates) {
     LOG(INFO) << "Watching for status updates.";
-    auto handler = new WatchingStatusUpdateHandler();
+    update_engine::StatusUpdateHandler* handler;
+    if (FLAGS_status_interval_ms > 0) {
+      handler = new ThrottledWatchingStatusUpdateHandler(
+          base::TimeDelta::FromMilliseconds(FLAGS_status_interval_ms));
+    } else {
+      handler = new WatchingStatusUpdateHandler();
+    }
     handlers_.emplace_back(handler);
     client_->RegisterStatusUpdateHandler(handler);
     return kContinueRunning;
@@ -640,6 +689,15 @@ int UpdateEngineClient::ProcessFlags() {
     }
   }
 
+  if (FLAGS_show_perf) {
+    string perf_stats;
+    if (!client_->GetPerfStats(&perf_stats)) {
+      LOG(ERROR) << "Error getting the performance statistics.";
+    } else {
+      printf("%s\n", perf_stats.c_str());
+    }
+  }
+
   return 0;
 }
 
@@ -17,7 +17,6 @@
 #include "update_engine/update_manager/android_things_policy.h"
 
 #include <string>
-#include <vector>
 
 #include <base/logging.h>
 #include <base/time/time.h>
@@ -30,7 +29,6 @@
 using base::Time;
 using chromeos_update_engine::ErrorCode;
 using std::string;
-using std::vector;
 
 namespace chromeos_update_manager {
 
@@ -65,31 +63,26 @@ EvalStatus AndroidThingsPolicy::UpdateCheckAllowed(
   NextUpdateCheckTimePolicyImpl next_update_check_time_policy(
       kNextUpdateCheckPolicyConstants);
 
-  vector<Policy const*> policies_to_consult = {
+  auto policies_to_consult = MakePolicyChain(
       // Do not perform any updates if there are not enough slots to do
       // A/B updates
-      &enough_slots_ab_updates_policy,
+      enough_slots_ab_updates_policy,
 
       // Check to see if an interactive update was requested.
-      &interactive_update_policy,
+      interactive_update_policy,
 
       // Unofficial builds should not perform periodic update checks.
-      &only_update_official_builds_policy,
+      only_update_official_builds_policy,
 
       // Ensure that periodic update checks are timed properly.
-      &next_update_check_time_policy,
-  };
+      next_update_check_time_policy);
 
   // Now that the list of policy implementations, and the order to consult them,
   // as been setup, do that.  If none of the policies make a definitive
   // decisions about whether or not to check for updates, then allow the update
   // check to happen.
-  EvalStatus status = ConsultPolicies(policies_to_consult,
-                                      &Policy::UpdateCheckAllowed,
-                                      ec,
-                                      state,
-                                      error,
-                                      result);
+  EvalStatus status = policies_to_consult.Consult(
+      &Policy::UpdateCheckAllowed, ec, state, error, result);
   if (status != EvalStatus::kContinue) {
     return status;
   } else {
@@ -111,22 +104,16 @@ EvalStatus AndroidThingsPolicy::UpdateCanBeApplied(
   // result structure, even if it signals kContinue.
   ApiRestrictedDownloadsPolicyImpl api_restricted_downloads_policy;
 
-  vector<Policy const*> policies_to_consult = {
+  auto policies_to_consult = MakePolicyChain(
       // Do not apply the update if all updates are restricted by the API.
-      &api_restricted_downloads_policy,
-  };
+      api_restricted_downloads_policy);
 
   // Now that the list of policy implementations, and the order to consult them,
   // as been setup, do that.  If none of the policies make a definitive
   // decisions about whether or not to check for updates, then allow the update
   // check to happen.
-  EvalStatus status = ConsultPolicies(policies_to_consult,
-                                      &Policy::UpdateCanBeApplied,
-                                      ec,
-                                      state,
-                                      error,
-                                      result,
-                                      install_plan);
+  EvalStatus status = policies_to_consult.Consult(
+      &Policy::UpdateCanBeApplied, ec, state, error, result, install_plan);
   if (EvalStatus::kContinue != status) {
     return status;
   } else {
@@ -145,6 +132,7 @@ EvalStatus AndroidThingsPolicy::UpdateCanStart(EvaluationContext* ec,
                                                UpdateState update_state) const {
   // Update is good to go.
   result->update_can_start = true;
+  result->download_rate_limit_bps = 0;
   return EvalStatus::kSucceeded;
 }
 
@@ -158,6 +146,18 @@ EvalStatus AndroidThingsPolicy::UpdateDownloadAllowed(EvaluationContext* ec,
   return EvalStatus::kSucceeded;
 }
 
+// Always returns |EvalStatus::kSucceeded|
+EvalStatus AndroidThingsPolicy::UpdateDownloadFetchParams(
+    EvaluationContext* ec,
+    State* state,
+    string* error,
+    UpdateFetchParams* result,
+    UpdateFetchState fetch_state) const {
+  // Leave the fetchers to the hardware defaults.
+  *result = UpdateFetchParams();
+  return EvalStatus::kSucceeded;
+}
+
 // P2P is always disabled.  Returns |result|==|false| and
 // |EvalStatus::kSucceeded|
 EvalStatus AndroidThingsPolicy::P2PEnabled(EvaluationContext* ec,
@@ -59,6 +59,15 @@ class AndroidThingsPolicy : public Policy {
                                    std::string* error,
                                    bool* result) const override;
 
+  // Leaves all the fetch parameters to the client's defaults. Always returns
+  // |EvalStatus::kSucceeded|.
+  EvalStatus UpdateDownloadFetchParams(
+      EvaluationContext* ec,
+      State* state,
+      std::string* error,
+      UpdateFetchParams* result,
+      UpdateFetchState fetch_state) const override;
+
   // P2P is always disabled.  Returns |result|==|false| and
   // |EvalStatus::kSucceeded|
   EvalStatus P2PEnabled(EvaluationContext* ec,
@@ -24,7 +24,7 @@
 namespace chromeos_update_manager {
 
 // Allow the API to restrict the downloading of updates.
-class ApiRestrictedDownloadsPolicyImpl : public PolicyImplBase {
+class ApiRestrictedDownloadsPolicyImpl final : public PolicyImplBase {
  public:
   ApiRestrictedDownloadsPolicyImpl() = default;
   ~ApiRestrictedDownloadsPolicyImpl() override = default;
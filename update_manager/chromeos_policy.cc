@@ -19,7 +19,6 @@
 #include <algorithm>
 #include <set>
 #include <string>
-#include <vector>
 
 #include <base/logging.h>
 #include <base/strings/string_util.h>
@@ -48,7 +47,6 @@ using std::get;
 using std::min;
 using std::set;
 using std::string;
-using std::vector;
 
 namespace {
 
@@ -197,6 +195,11 @@ const NextUpdateCheckPolicyConstants
 
 const int ChromeOSPolicy::kMaxP2PAttempts = 10;
 const int ChromeOSPolicy::kMaxP2PAttemptsPeriodInSeconds = 5 * 24 * 60 * 60;
+const int ChromeOSPolicy::kMaxFetchConnections = 4;
+const size_t ChromeOSPolicy::kEthernetFetchChunkSize = 4 * 1024 * 1024;
+const size_t ChromeOSPolicy::kWifiFetchChunkSize = 1024 * 1024;
+const uint64_t ChromeOSPolicy::kMinParallelFetchThroughputBps = 128 * 1024;
+const int64_t ChromeOSPolicy::kMeteredFetchRateLimitBps = 256 * 1024;
 
 EvalStatus ChromeOSPolicy::UpdateCheckAllowed(EvaluationContext* ec,
                                               State* state,
@@ -218,38 +221,33 @@ EvalStatus ChromeOSPolicy::UpdateCheckAllowed(EvaluationContext* ec,
   NextUpdateCheckTimePolicyImpl next_update_check_time_policy(
       kNextUpdateCheckPolicyConstants);
 
-  vector<Policy const*> policies_to_consult = {
+  auto policies_to_consult = MakePolicyChain(
       // Do not perform any updates if there are not enough slots to do A/B
       // updates.
-      &enough_slots_ab_updates_policy,
+      enough_slots_ab_updates_policy,
 
       // Check to see if Enterprise-managed (has DevicePolicy) and/or
       // Kiosk-mode.  If so, then defer to those settings.
-      &enterprise_device_policy,
+      enterprise_device_policy,
 
       // Check to see if an interactive update was requested.
-      &interactive_update_policy,
+      interactive_update_policy,
 
       // Unofficial builds should not perform periodic update checks.
-      &only_update_official_builds_policy,
+      only_update_official_builds_policy,
 
       // If OOBE is enabled, wait until it is completed.
-      &oobe_policy,
+      oobe_policy,
 
       // Ensure that periodic update checks are timed properly.
-      &next_update_check_time_policy,
-  };
+      next_update_check_time_policy);
 
   // Now that the list of policy implementations, and the order to consult them,
   // has been setup, consult the policies. If none of the policies make a
   // definitive decisions about whether or not to check for updates, then allow
   // the update check to happen.
-  EvalStatus status = ConsultPolicies(policies_to_consult,
-                                      &Policy::UpdateCheckAllowed,
-                                      ec,
-                                      state,
-                                      error,
-                                      result);
+  EvalStatus status = policies_to_consult.Consult(
+      &Policy::UpdateCheckAllowed, ec, state, error, result);
   if (EvalStatus::kContinue != status) {
     return status;
   } else {
@@ -267,22 +265,16 @@ EvalStatus ChromeOSPolicy::UpdateCanBeApplied(EvaluationContext* ec,
   UpdateTimeRestrictionsPolicyImpl update_time_restrictions_policy;
   InteractiveUpdatePolicyImpl interactive_update_policy;
 
-  vector<Policy const*> policies_to_consult = {
+  auto policies_to_consult = MakePolicyChain(
       // Check to see if an interactive update has been requested.
-      &interactive_update_policy,
+      interactive_update_policy,
 
       // Do not apply or download an update if we are inside one of the
       // restricted times.
-      &update_time_restrictions_policy,
-  };
-
-  EvalStatus status = ConsultPolicies(policies_to_consult,
-                                      &Policy::UpdateCanBeApplied,
-                                      ec,
-                                      state,
-                                      error,
-                                      result,
-                                      install_plan);
+      update_time_restrictions_policy);
+
+  EvalStatus status = policies_to_consult.Consult(
+      &Policy::UpdateCanBeApplied, ec, state, error, result, install_plan);
   if (EvalStatus::kContinue != status) {
     return status;
   } else {
@@ -311,6 +303,7 @@ EvalStatus ChromeOSPolicy::UpdateCanStart(
   result->download_url_num_errors = 0;
   result->p2p_downloading_allowed = false;
   result->p2p_sharing_allowed = false;
+  result->download_rate_limit_bps = 0;
   result->do_increment_failures = false;
   result->backoff_expiry = update_state.backoff_expiry;
   result->scatter_wait_period = update_state.scatter_wait_period;
@@ -428,6 +421,19 @@ EvalStatus ChromeOSPolicy::UpdateCanStart(
     }
   }
 
+  // Limit the download rate as set by the user, unless the update is
+  // interactive since the user is then waiting for it.
+  const int64_t* download_rate_limit_p =
+      ec->GetValue(state->updater_provider()->var_download_rate_limit());
+  if (download_rate_limit_p && *download_rate_limit_p > 0) {
+    if (update_state.interactive) {
+      LOG(INFO) << "Not limiting the download rate because update is "
+                   "interactive.";
+    } else {
+      result->download_rate_limit_bps = *download_rate_limit_p;
+    }
+  }
+
   // Check for various deterrents.
   if (is_check_due) {
     result->cannot_start_reason = UpdateCannotStartReason::kCheckDue;
@@ -537,6 +543,65 @@ EvalStatus ChromeOSPolicy::UpdateDownloadAllowed(EvaluationContext* ec,
   return (*result ? EvalStatus::kSucceeded : EvalStatus::kAskMeAgainLater);
 }
 
+// Ethernet gets as many connections as the fetchers support and wireless
+// connections half of them with smaller chunks, so a dropped connection
+// retries less data. Metered connections, including tethering, use a
+// single rate limited connection to leave bandwidth to the user. A single
+// connection is also used when the measured throughput is too low for
+// parallel connections to help.
+EvalStatus ChromeOSPolicy::UpdateDownloadFetchParams(
+    EvaluationContext* ec,
+    State* state,
+    string* error,
+    UpdateFetchParams* result,
+    UpdateFetchState fetch_state) const {
+  // Get the current connection type.
+  ShillProvider* const shill_provider = state->shill_provider();
+  const ConnectionType* conn_type_p =
+      ec->GetValue(shill_provider->var_conn_type());
+  POLICY_CHECK_VALUE_AND_FAIL(conn_type_p, error);
+  ConnectionType conn_type = *conn_type_p;
+
+  // If we're tethering, treat it as a cellular connection.
+  if (conn_type != ConnectionType::kCellular) {
+    const ConnectionTethering* conn_tethering_p =
+        ec->GetValue(shill_provider->var_conn_tethering());
+    POLICY_CHECK_VALUE_AND_FAIL(conn_tethering_p, error);
+    if (*conn_tethering_p == ConnectionTethering::kConfirmed)
+      conn_type = ConnectionType::kCellular;
+  }
+
+  *result = UpdateFetchParams();
+  result->num_connections = 1;
+  switch (conn_type) {
+    case ConnectionType::kEthernet:
+      result->num_connections = kMaxFetchConnections;
+      result->chunk_size = kEthernetFetchChunkSize;
+      break;
+
+    case ConnectionType::kWifi:
+    case ConnectionType::kWimax:
+      result->num_connections = kMaxFetchConnections / 2;
+      result->chunk_size = kWifiFetchChunkSize;
+      break;
+
+    case ConnectionType::kBluetooth:
+    case ConnectionType::kCellular:
+      result->rate_limit_bps = kMeteredFetchRateLimitBps;
+      break;
+
+    case ConnectionType::kDisconnected:
+    case ConnectionType::kUnknown:
+      break;
+  }
+
+  if (fetch_state.throughput_bps > 0 &&
+      fetch_state.throughput_bps < kMinParallelFetchThroughputBps) {
+    result->num_connections = 1;
+  }
+  return EvalStatus::kSucceeded;
+}
+
 EvalStatus ChromeOSPolicy::P2PEnabled(EvaluationContext* ec,
                                       State* state,
                                       string* error,
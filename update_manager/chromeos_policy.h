@@ -77,6 +77,13 @@ class ChromeOSPolicy : public Policy {
                                    std::string* error,
                                    bool* result) const override;
 
+  EvalStatus UpdateDownloadFetchParams(
+      EvaluationContext* ec,
+      State* state,
+      std::string* error,
+      UpdateFetchParams* result,
+      UpdateFetchState fetch_state) const override;
+
   EvalStatus P2PEnabled(EvaluationContext* ec,
                         State* state,
                         std::string* error,
@@ -124,6 +131,17 @@ class ChromeOSPolicy : public Policy {
   // Maximum period of time allowed for download a payload via P2P, in seconds.
   static const int kMaxP2PAttemptsPeriodInSeconds;
 
+  // The number of parallel connections and the size of their chunks on
+  // unmetered connections.
+  static const int kMaxFetchConnections;
+  static const size_t kEthernetFetchChunkSize;
+  static const size_t kWifiFetchChunkSize;
+  // The measured throughput under which a single connection is used, in bytes
+  // per second.
+  static const uint64_t kMinParallelFetchThroughputBps;
+  // The maximum download rate on metered connections, in bytes per second.
+  static const int64_t kMeteredFetchRateLimitBps;
+
   // A private policy for determining backoff and the download URL to use.
   // Within |update_state|, |backoff_expiry| and |is_backoff_disabled| are used
   // for determining whether backoff is still in effect; if not,
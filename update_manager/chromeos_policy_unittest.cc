@@ -1106,6 +1106,28 @@ TEST_F(UmChromeOSPolicyTest,
   EXPECT_TRUE(result.p2p_sharing_allowed);
 }
 
+TEST_F(UmChromeOSPolicyTest, UpdateCanStartAllowedWithDownloadRateLimit) {
+  // The UpdateCanStart policy returns true and passes on the download rate
+  // limit set by the user, unless the update is interactive.
+
+  SetUpdateCheckAllowed(false);
+  fake_state_.updater_provider()->var_download_rate_limit()->reset(
+      new int64_t(100000));
+
+  UpdateState update_state = GetDefaultUpdateState(TimeDelta::FromMinutes(10));
+  UpdateDownloadParams result;
+  ExpectPolicyStatus(
+      EvalStatus::kSucceeded, &Policy::UpdateCanStart, &result, update_state);
+  EXPECT_TRUE(result.update_can_start);
+  EXPECT_EQ(100000, result.download_rate_limit_bps);
+
+  update_state.interactive = true;
+  ExpectPolicyStatus(
+      EvalStatus::kSucceeded, &Policy::UpdateCanStart, &result, update_state);
+  EXPECT_TRUE(result.update_can_start);
+  EXPECT_EQ(0, result.download_rate_limit_bps);
+}
+
 TEST_F(UmChromeOSPolicyTest,
        UpdateCanStartAllowedP2PDownloadingBlockedDueToAttemptsPeriod) {
   // The UpdateCanStart policy returns true; device policy permits HTTP but
@@ -1531,6 +1553,66 @@ TEST_F(UmChromeOSPolicyTest, UpdateDownloadAllowedCellularUserOverride) {
   EXPECT_TRUE(result);
 }
 
+TEST_F(UmChromeOSPolicyTest, UpdateDownloadFetchParamsEthernet) {
+  // Ethernet downloads over several unlimited connections.
+
+  fake_state_.shill_provider()->var_conn_type()->reset(
+      new ConnectionType(ConnectionType::kEthernet));
+
+  UpdateFetchState fetch_state = {0};
+  UpdateFetchParams result;
+  ExpectPolicyStatus(EvalStatus::kSucceeded,
+                     &Policy::UpdateDownloadFetchParams,
+                     &result,
+                     fetch_state);
+  EXPECT_EQ(4, result.num_connections);
+  EXPECT_EQ(static_cast<size_t>(4 * 1024 * 1024), result.chunk_size);
+  EXPECT_EQ(0, result.rate_limit_bps);
+}
+
+TEST_F(UmChromeOSPolicyTest, UpdateDownloadFetchParamsWifiLowThroughput) {
+  // Parallel connections don't help when the measured throughput is low.
+
+  fake_state_.shill_provider()->var_conn_type()->reset(
+      new ConnectionType(ConnectionType::kWifi));
+
+  UpdateFetchState fetch_state = {0};
+  UpdateFetchParams result;
+  ExpectPolicyStatus(EvalStatus::kSucceeded,
+                     &Policy::UpdateDownloadFetchParams,
+                     &result,
+                     fetch_state);
+  EXPECT_EQ(2, result.num_connections);
+  EXPECT_EQ(static_cast<size_t>(1024 * 1024), result.chunk_size);
+  EXPECT_EQ(0, result.rate_limit_bps);
+
+  fetch_state.throughput_bps = 10 * 1024;
+  ExpectPolicyStatus(EvalStatus::kSucceeded,
+                     &Policy::UpdateDownloadFetchParams,
+                     &result,
+                     fetch_state);
+  EXPECT_EQ(1, result.num_connections);
+  EXPECT_EQ(0, result.rate_limit_bps);
+}
+
+TEST_F(UmChromeOSPolicyTest, UpdateDownloadFetchParamsWifiTethered) {
+  // Tethered wifi is metered, so a single rate limited connection is used.
+
+  fake_state_.shill_provider()->var_conn_type()->reset(
+      new ConnectionType(ConnectionType::kWifi));
+  fake_state_.shill_provider()->var_conn_tethering()->reset(
+      new ConnectionTethering(ConnectionTethering::kConfirmed));
+
+  UpdateFetchState fetch_state = {10 * 1024 * 1024};
+  UpdateFetchParams result;
+  ExpectPolicyStatus(EvalStatus::kSucceeded,
+                     &Policy::UpdateDownloadFetchParams,
+                     &result,
+                     fetch_state);
+  EXPECT_EQ(1, result.num_connections);
+  EXPECT_EQ(256 * 1024, result.rate_limit_bps);
+}
+
 TEST_F(UmChromeOSPolicyTest, UpdateCanStartAllowedScatteringSupressedDueToP2P) {
   // The UpdateCanStart policy returns true; scattering should have applied, but
   // P2P download is allowed. Scattering values are nonetheless returned, and so
@@ -80,6 +80,7 @@ EvalStatus DefaultPolicy::UpdateCanStart(EvaluationContext* ec,
   result->download_url_num_errors = 0;
   result->p2p_downloading_allowed = false;
   result->p2p_sharing_allowed = false;
+  result->download_rate_limit_bps = 0;
   result->do_increment_failures = false;
   result->backoff_expiry = base::Time();
   result->scatter_wait_period = base::TimeDelta();
@@ -95,6 +96,16 @@ EvalStatus DefaultPolicy::UpdateDownloadAllowed(EvaluationContext* ec,
   return EvalStatus::kSucceeded;
 }
 
+EvalStatus DefaultPolicy::UpdateDownloadFetchParams(
+    EvaluationContext* ec,
+    State* state,
+    std::string* error,
+    UpdateFetchParams* result,
+    UpdateFetchState fetch_state) const {
+  *result = UpdateFetchParams();
+  return EvalStatus::kSucceeded;
+}
+
 EvalStatus DefaultPolicy::P2PEnabled(EvaluationContext* ec,
                                      State* state,
                                      std::string* error,
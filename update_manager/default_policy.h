@@ -88,6 +88,13 @@ class DefaultPolicy : public Policy {
                                    std::string* error,
                                    bool* result) const override;
 
+  EvalStatus UpdateDownloadFetchParams(
+      EvaluationContext* ec,
+      State* state,
+      std::string* error,
+      UpdateFetchParams* result,
+      UpdateFetchState fetch_state) const override;
+
   EvalStatus P2PEnabled(EvaluationContext* ec,
                         State* state,
                         std::string* error,
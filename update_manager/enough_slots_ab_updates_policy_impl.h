@@ -24,7 +24,7 @@
 namespace chromeos_update_manager {
 
 // Do not perform any updates if booted from removable device.
-class EnoughSlotsAbUpdatesPolicyImpl : public PolicyImplBase {
+class EnoughSlotsAbUpdatesPolicyImpl final : public PolicyImplBase {
  public:
   EnoughSlotsAbUpdatesPolicyImpl() = default;
   ~EnoughSlotsAbUpdatesPolicyImpl() override = default;
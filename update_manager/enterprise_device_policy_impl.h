@@ -25,7 +25,7 @@ namespace chromeos_update_manager {
 
 // Check to see if Enterprise-managed (has DevicePolicy) and/or Kiosk-mode.  If
 // so, then defer to those settings.
-class EnterpriseDevicePolicyImpl : public PolicyImplBase {
+class EnterpriseDevicePolicyImpl final : public PolicyImplBase {
  public:
   EnterpriseDevicePolicyImpl() = default;
   ~EnterpriseDevicePolicyImpl() override = default;
@@ -31,14 +31,21 @@ const T* EvaluationContext::GetValue(Variable<T>* var) {
   }
 
   // Search for the value on the cache first.
+  VariableStats* stats = &variable_stats_[var];
   ValueCacheMap::iterator it = value_cache_.find(var);
-  if (it != value_cache_.end())
+  if (it != value_cache_.end()) {
+    stats->hits++;
     return reinterpret_cast<const T*>(it->second.value());
+  }
 
   // Get the value from the variable if not found on the cache.
   std::string errmsg;
+  base::Time read_start = clock_->GetMonotonicTime();
   const T* result =
       var->GetValue(RemainingTime(evaluation_monotonic_deadline_), &errmsg);
+  AddTraceEvent(var->GetName(), "variable", read_start);
+  stats->misses++;
+  stats->read_time += trace_events_.back().duration;
   if (result == nullptr) {
     LOG(WARNING) << "Error reading Variable " << var->GetName() << ": \""
                  << errmsg << "\"";
@@ -46,9 +53,22 @@ const T* EvaluationContext::GetValue(Variable<T>* var) {
   // Cache the value for the next time. The map of CachedValues keeps the
   // ownership of the pointer until the map is destroyed.
   value_cache_.emplace(static_cast<BaseVariable*>(var), BoxedValue(result));
+  if (var->GetMode() != kVariableModeConst)
+    value_comparators_[var] = &EvaluationContext::ValueUnchanged<T>;
   return result;
 }
 
+template <typename T>
+bool EvaluationContext::ValueUnchanged(EvaluationContext* ec,
+                                       BaseVariable* var,
+                                       const void* previous_value) {
+  const T* value = ec->GetValue(static_cast<Variable<T>*>(var));
+  const T* previous = static_cast<const T*>(previous_value);
+  if (value == nullptr || previous == nullptr)
+    return value == previous;
+  return *value == *previous;
+}
+
 }  // namespace chromeos_update_manager
 
 #endif  // UPDATE_ENGINE_UPDATE_MANAGER_EVALUATION_CONTEXT_INL_H_
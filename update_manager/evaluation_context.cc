@@ -60,6 +60,14 @@ TimeDelta GetTimeout(Time curr, Time expires) {
   return expires - curr;
 }
 
+// The granularities the reevaluation timeouts are aligned to on the monotonic
+// clock, from the coarsest, and the maximum delay this alignment can add to a
+// timeout, as a percentage of it. The timeouts of different contexts and poll
+// variables that end up in the same slot fire together, waking up the device
+// once.
+const int64_t kTimeoutAlignmentsInSeconds[] = {300, 60, 30, 5, 1};
+const int kTimeoutSlackPercent = 10;
+
 }  // namespace
 
 namespace chromeos_update_manager {
@@ -102,6 +110,27 @@ TimeDelta EvaluationContext::RemainingTime(Time monotonic_deadline) const {
   return std::max(remaining, TimeDelta());
 }
 
+// static
+TimeDelta EvaluationContext::AlignTimeout(Time monotonic_now,
+                                          TimeDelta timeout) {
+  if (timeout.is_max())
+    return timeout;
+  const TimeDelta slack = timeout * kTimeoutSlackPercent / 100;
+  for (int64_t alignment_in_seconds : kTimeoutAlignmentsInSeconds) {
+    const int64_t alignment =
+        TimeDelta::FromSeconds(alignment_in_seconds).InMicroseconds();
+    if (alignment > slack.InMicroseconds())
+      continue;
+    const int64_t deadline =
+        (monotonic_now + timeout - Time()).InMicroseconds();
+    const int64_t remainder = deadline % alignment;
+    if (remainder == 0)
+      return timeout;
+    return timeout + TimeDelta::FromMicroseconds(alignment - remainder);
+  }
+  return timeout;
+}
+
 Time EvaluationContext::MonotonicDeadline(TimeDelta timeout) {
   return (timeout.is_max() ? Time::Max()
                            : clock_->GetMonotonicTime() + timeout);
@@ -129,13 +158,17 @@ void EvaluationContext::OnValueChangedOrTimeout() {
 }
 
 bool EvaluationContext::IsWallclockTimeGreaterThan(Time timestamp) {
-  return IsTimeGreaterThanHelper(
+  bool result = IsTimeGreaterThanHelper(
       timestamp, evaluation_start_wallclock_, &reevaluation_time_wallclock_);
+  time_queries_.push_back({true, timestamp, result});
+  return result;
 }
 
 bool EvaluationContext::IsMonotonicTimeGreaterThan(Time timestamp) {
-  return IsTimeGreaterThanHelper(
+  bool result = IsTimeGreaterThanHelper(
       timestamp, evaluation_start_monotonic_, &reevaluation_time_monotonic_);
+  time_queries_.push_back({false, timestamp, result});
+  return result;
 }
 
 void EvaluationContext::ResetEvaluation() {
@@ -144,15 +177,39 @@ void EvaluationContext::ResetEvaluation() {
   reevaluation_time_wallclock_ = Time::Max();
   reevaluation_time_monotonic_ = Time::Max();
   evaluation_monotonic_deadline_ = MonotonicDeadline(evaluation_timeout_);
+  trace_events_.clear();
+  variable_stats_.clear();
 
-  // Remove the cached values of non-const variables
+  // Remove the cached values of non-const variables, keeping them with the
+  // time queries for PreviousEvaluationInputsUnchanged().
+  previous_value_cache_.clear();
   for (auto it = value_cache_.begin(); it != value_cache_.end();) {
     if (it->first->GetMode() == kVariableModeConst) {
       ++it;
     } else {
+      previous_value_cache_.emplace(it->first, std::move(it->second));
       it = value_cache_.erase(it);
     }
   }
+  previous_time_queries_ = std::move(time_queries_);
+  time_queries_.clear();
+}
+
+bool EvaluationContext::PreviousEvaluationInputsUnchanged() {
+  if (previous_value_cache_.empty() && previous_time_queries_.empty())
+    return false;
+  for (const auto& it : previous_value_cache_) {
+    if (!value_comparators_[it.first](this, it.first, it.second.value()))
+      return false;
+  }
+  for (const TimeQuery& query : previous_time_queries_) {
+    bool result = query.wallclock
+                      ? IsWallclockTimeGreaterThan(query.timestamp)
+                      : IsMonotonicTimeGreaterThan(query.timestamp);
+    if (result != query.result)
+      return false;
+  }
+  return true;
 }
 
 void EvaluationContext::ResetExpiration() {
@@ -208,6 +265,7 @@ bool EvaluationContext::RunOnValueChangeOrTimeout(Closure callback) {
   timeout_marks_expiration_ = expiration < timeout;
   if (timeout_marks_expiration_)
     timeout = expiration;
+  timeout = AlignTimeout(clock_->GetMonotonicTime(), timeout);
 
   // Store the reevaluation callback.
   callback_.reset(new Closure(callback));
@@ -249,4 +307,53 @@ string EvaluationContext::DumpContext() const {
   return json_str;
 }
 
+string EvaluationContext::TraceToJson() const {
+  auto events = std::make_unique<base::ListValue>();
+  for (const TraceEvent& event : trace_events_) {
+    auto value = std::make_unique<base::DictionaryValue>();
+    value->SetString("name", event.name);
+    value->SetString("cat", event.category);
+    value->SetString("ph", "X");
+    value->SetInteger(
+        "ts",
+        (event.monotonic_start - evaluation_start_monotonic_).InMicroseconds());
+    value->SetInteger("dur", event.duration.InMicroseconds());
+    value->SetInteger("pid", 0);
+    value->SetInteger("tid", 0);
+    events->Append(std::move(value));
+  }
+
+  auto variables = std::make_unique<base::DictionaryValue>();
+  for (const auto& it : variable_stats_) {
+    auto value = std::make_unique<base::DictionaryValue>();
+    value->SetInteger("hits", it.second.hits);
+    value->SetInteger("misses", it.second.misses);
+    value->SetInteger("read_time_us", it.second.read_time.InMicroseconds());
+    variables->Set(it.first->GetName(), std::move(value));
+  }
+
+  base::DictionaryValue value;
+  value.Set("traceEvents", std::move(events));
+  value.Set("variables", std::move(variables));
+
+  string json_str;
+  base::JSONWriter::Write(value, &json_str);
+  return json_str;
+}
+
+void EvaluationContext::AddTraceEvent(const string& name,
+                                      const char* category,
+                                      Time monotonic_start) {
+  trace_events_.push_back(
+      {name, category, monotonic_start,
+       clock_->GetMonotonicTime() - monotonic_start});
+}
+
+ScopedPolicyTrace::ScopedPolicyTrace(EvaluationContext* ec, const string& name)
+    : ec_(ec), name_(name), monotonic_start_(ec->clock_->GetMonotonicTime()) {}
+
+ScopedPolicyTrace::~ScopedPolicyTrace() {
+  ec_->AddTraceEvent(name_, "policy", monotonic_start_);
+}
+
 }  // namespace chromeos_update_manager
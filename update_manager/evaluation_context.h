@@ -20,6 +20,7 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <base/bind.h>
 #include <base/callback.h>
@@ -105,6 +106,14 @@ class EvaluationContext : public base::RefCounted<EvaluationContext>,
   // be called right before any new evaluation starts.
   void ResetEvaluation();
 
+  // Returns whether the values of the non-const variables and the results of
+  // the time queries used by the previous evaluation are still the same, in
+  // which case evaluating the same policy request again gives the same
+  // result. It must be called right after ResetEvaluation(), and the values it
+  // reads are cached for the new evaluation as if the policy read them.
+  // Returns false if the previous evaluation didn't use any of them.
+  bool PreviousEvaluationInputsUnchanged();
+
   // Clears the expiration status of the EvaluationContext and resets its
   // expiration timeout based on |expiration_timeout_|. This should be called if
   // expiration occurred, prior to re-evaluating the policy.
@@ -116,7 +125,8 @@ class EvaluationContext : public base::RefCounted<EvaluationContext>,
   // there's no cached variable, this method returns false.
   //
   // Right before the passed closure is called the EvaluationContext is
-  // reset, removing all the non-const cached values.
+  // reset, removing all the non-const cached values. The timeout can be
+  // delayed by up to 10% so that it fires together with other timeouts.
   bool RunOnValueChangeOrTimeout(base::Closure callback);
 
   // Returns a textual representation of the evaluation context,
@@ -124,12 +134,20 @@ class EvaluationContext : public base::RefCounted<EvaluationContext>,
   // to help with debugging and the format may change in the future.
   std::string DumpContext() const;
 
+  // Returns the profile of the current evaluation as Chrome trace event JSON,
+  // which can be loaded in chrome://tracing. It has a complete event for every
+  // policy timed with a ScopedPolicyTrace and every variable read, and the
+  // number of cache hits and misses and the read time of each variable under
+  // "variables". The timestamps are relative to the start of the evaluation.
+  std::string TraceToJson() const;
+
   // Removes all the Observers callbacks and timeout events scheduled by
   // RunOnValueChangeOrTimeout(). Also releases and returns the closure
   // associated with these events. This method is idempotent.
   std::unique_ptr<base::Closure> RemoveObserversAndTimeout();
 
  private:
+  friend class ScopedPolicyTrace;
   friend class UmEvaluationContextTest;
 
   // BaseVariable::ObserverInterface override.
@@ -151,12 +169,70 @@ class EvaluationContext : public base::RefCounted<EvaluationContext>,
   // since the current time.
   base::Time MonotonicDeadline(base::TimeDelta timeout);
 
+  // Returns |timeout| extended by a small slack so that it ends on a multiple
+  // of a granularity of the monotonic clock, when it started at
+  // |monotonic_now|. Timeouts ending close to each other are then coalesced
+  // into a single wakeup.
+  static base::TimeDelta AlignTimeout(base::Time monotonic_now,
+                                      base::TimeDelta timeout);
+
+  // Reads the value of the Variable<T> |var| with GetValue() and returns
+  // whether it equals the |previous_value| read by the previous evaluation.
+  template <typename T>
+  static bool ValueUnchanged(EvaluationContext* ec,
+                             BaseVariable* var,
+                             const void* previous_value);
+
+  // A call to Is{Wallclock,Monotonic}TimeGreaterThan() and its result.
+  struct TimeQuery {
+    bool wallclock;
+    base::Time timestamp;
+    bool result;
+  };
+
+  // A complete trace event of the current evaluation.
+  struct TraceEvent {
+    std::string name;
+    const char* category;
+    base::Time monotonic_start;
+    base::TimeDelta duration;
+  };
+
+  // The cache statistics of a variable in the current evaluation.
+  struct VariableStats {
+    int hits = 0;
+    int misses = 0;
+    base::TimeDelta read_time;
+  };
+
+  // Adds a trace event |name| from |monotonic_start| until now.
+  void AddTraceEvent(const std::string& name,
+                     const char* category,
+                     base::Time monotonic_start);
+
   // A map to hold the cached values for every variable.
   typedef std::map<BaseVariable*, BoxedValue> ValueCacheMap;
 
   // The cached values of the called Variables.
   ValueCacheMap value_cache_;
 
+  // The ValueUnchanged() functions of the non-const variables read so far.
+  std::map<BaseVariable*,
+           bool (*)(EvaluationContext*, BaseVariable*, const void*)>
+      value_comparators_;
+
+  // The time queries of the current evaluation.
+  std::vector<TimeQuery> time_queries_;
+
+  // The values of the non-const variables and the time queries used by the
+  // previous evaluation, checked by PreviousEvaluationInputsUnchanged().
+  ValueCacheMap previous_value_cache_;
+  std::vector<TimeQuery> previous_time_queries_;
+
+  // The profile of the current evaluation, exported by TraceToJson().
+  std::vector<TraceEvent> trace_events_;
+  std::map<BaseVariable*, VariableStats> variable_stats_;
+
   // A callback used for triggering re-evaluation upon a value change or poll
   // timeout, or notifying about the evaluation context expiration. It is up to
   // the caller to determine whether or not expiration occurred via
@@ -214,6 +290,21 @@ class EvaluationContext : public base::RefCounted<EvaluationContext>,
   DISALLOW_COPY_AND_ASSIGN(EvaluationContext);
 };
 
+// Records the time spent in its scope evaluating the policy |name| as a trace
+// event of the EvaluationContext |ec|.
+class ScopedPolicyTrace {
+ public:
+  ScopedPolicyTrace(EvaluationContext* ec, const std::string& name);
+  ~ScopedPolicyTrace();
+
+ private:
+  EvaluationContext* const ec_;
+  const std::string name_;
+  const base::Time monotonic_start_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedPolicyTrace);
+};
+
 }  // namespace chromeos_update_manager
 
 // Include the implementation of the template methods.
@@ -122,6 +122,10 @@ class UmEvaluationContextTest : public ::testing::Test {
     EXPECT_FALSE(loop_.PendingTasks());
   }
 
+  static TimeDelta AlignTimeout(Time monotonic_now, TimeDelta timeout) {
+    return EvaluationContext::AlignTimeout(monotonic_now, timeout);
+  }
+
   TimeDelta default_timeout_ = TimeDelta::FromSeconds(5);
 
   brillo::FakeMessageLoop loop_{nullptr};
@@ -397,6 +401,25 @@ TEST_F(UmEvaluationContextTest, TimeoutUpdatesWithMonotonicTime) {
   EXPECT_EQ(nullptr, eval_ctx_->GetValue(&mock_var_async_));
 }
 
+TEST_F(UmEvaluationContextTest, AlignTimeoutCoalescesTimeouts) {
+  // The monotonic time set in SetUp() is a multiple of five minutes.
+  Time now = fake_clock_.GetMonotonicTime();
+  EXPECT_EQ(TimeDelta::FromMinutes(5),
+            AlignTimeout(now, TimeDelta::FromMinutes(5)));
+  // Five minutes allow 30 seconds of slack, so they end on a multiple of 30s.
+  EXPECT_EQ(TimeDelta::FromSeconds(323),
+            AlignTimeout(now + TimeDelta::FromSeconds(7),
+                         TimeDelta::FromMinutes(5)));
+  EXPECT_EQ(TimeDelta::FromSeconds(313),
+            AlignTimeout(now + TimeDelta::FromSeconds(17),
+                         TimeDelta::FromMinutes(5)));
+  // Short timeouts and no timeout are left alone.
+  EXPECT_EQ(TimeDelta::FromSeconds(5),
+            AlignTimeout(now + TimeDelta::FromSeconds(7),
+                         TimeDelta::FromSeconds(5)));
+  EXPECT_EQ(TimeDelta::Max(), AlignTimeout(now, TimeDelta::Max()));
+}
+
 TEST_F(UmEvaluationContextTest, ResetEvaluationResetsTimesWallclock) {
   Time cur_time = fake_clock_.GetWallclockTime();
   // Advance the time on the clock but don't call ResetEvaluation yet.
@@ -439,6 +462,57 @@ TEST_F(UmEvaluationContextTest, ResetEvaluationResetsTimesMonotonic) {
       cur_time + TimeDelta::FromSeconds(1)));
 }
 
+TEST_F(UmEvaluationContextTest, PreviousEvaluationInputsUnchangedNoInputs) {
+  eval_ctx_->ResetEvaluation();
+  EXPECT_FALSE(eval_ctx_->PreviousEvaluationInputsUnchanged());
+}
+
+TEST_F(UmEvaluationContextTest, PreviousEvaluationInputsUnchangedValues) {
+  fake_int_var_.reset(new int(42));
+  fake_const_var_.reset(new string("const"));
+  eval_ctx_->GetValue(&fake_int_var_);
+  eval_ctx_->GetValue(&fake_const_var_);
+  eval_ctx_->GetValue(&fake_async_var_);
+
+  // The same values are read again, and cached for the new evaluation.
+  eval_ctx_->ResetEvaluation();
+  fake_int_var_.reset(new int(42));
+  EXPECT_TRUE(eval_ctx_->PreviousEvaluationInputsUnchanged());
+  const int* p_fake_int = eval_ctx_->GetValue(&fake_int_var_);
+  ASSERT_NE(nullptr, p_fake_int);
+  EXPECT_EQ(42, *p_fake_int);
+
+  eval_ctx_->ResetEvaluation();
+  fake_int_var_.reset(new int(5));
+  EXPECT_FALSE(eval_ctx_->PreviousEvaluationInputsUnchanged());
+}
+
+TEST_F(UmEvaluationContextTest, PreviousEvaluationInputsUnchangedNullValue) {
+  EXPECT_EQ(nullptr, eval_ctx_->GetValue(&fake_async_var_));
+
+  eval_ctx_->ResetEvaluation();
+  EXPECT_TRUE(eval_ctx_->PreviousEvaluationInputsUnchanged());
+
+  // A variable that had no value and now has one changed.
+  eval_ctx_->ResetEvaluation();
+  fake_async_var_.reset(new string("async"));
+  EXPECT_FALSE(eval_ctx_->PreviousEvaluationInputsUnchanged());
+}
+
+TEST_F(UmEvaluationContextTest, PreviousEvaluationInputsUnchangedTimes) {
+  Time cur_time = fake_clock_.GetWallclockTime();
+  EXPECT_FALSE(eval_ctx_->IsWallclockTimeGreaterThan(
+      cur_time + TimeDelta::FromSeconds(10)));
+
+  fake_clock_.SetWallclockTime(cur_time + TimeDelta::FromSeconds(5));
+  eval_ctx_->ResetEvaluation();
+  EXPECT_TRUE(eval_ctx_->PreviousEvaluationInputsUnchanged());
+
+  fake_clock_.SetWallclockTime(cur_time + TimeDelta::FromSeconds(20));
+  eval_ctx_->ResetEvaluation();
+  EXPECT_FALSE(eval_ctx_->PreviousEvaluationInputsUnchanged());
+}
+
 TEST_F(UmEvaluationContextTest,
        IsWallclockTimeGreaterThanSignalsTriggerReevaluation) {
   EXPECT_FALSE(eval_ctx_->IsWallclockTimeGreaterThan(
@@ -537,4 +611,35 @@ TEST_F(UmEvaluationContextTest, DumpContext) {
       eval_ctx_->DumpContext());
 }
 
+TEST_F(UmEvaluationContextTest, TraceToJson) {
+  fake_int_var_.reset(new int(42));
+  {
+    ScopedPolicyTrace trace(eval_ctx_.get(), "SomePolicy");
+    eval_ctx_->GetValue(&fake_int_var_);
+    fake_clock_.SetMonotonicTime(fake_clock_.GetMonotonicTime() +
+                                 TimeDelta::FromMilliseconds(3));
+  }
+  eval_ctx_->GetValue(&fake_int_var_);
+  eval_ctx_->GetValue(&fail_var_);
+
+  // The variables are printed in alphabetical order and the trace events in
+  // the order they completed.
+  EXPECT_EQ(
+      "{\"traceEvents\":["
+      "{\"cat\":\"variable\",\"dur\":0,\"name\":\"fake_int\",\"ph\":\"X\","
+      "\"pid\":0,\"tid\":0,\"ts\":0},"
+      "{\"cat\":\"policy\",\"dur\":3000,\"name\":\"SomePolicy\","
+      "\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":0},"
+      "{\"cat\":\"variable\",\"dur\":0,\"name\":\"fail_var\",\"ph\":\"X\","
+      "\"pid\":0,\"tid\":0,\"ts\":3000}],"
+      "\"variables\":{"
+      "\"fail_var\":{\"hits\":0,\"misses\":1,\"read_time_us\":0},"
+      "\"fake_int\":{\"hits\":1,\"misses\":1,\"read_time_us\":0}}}",
+      eval_ctx_->TraceToJson());
+
+  // The profile only covers the current evaluation.
+  eval_ctx_->ResetEvaluation();
+  EXPECT_EQ("{\"traceEvents\":[],\"variables\":{}}", eval_ctx_->TraceToJson());
+}
+
 }  // namespace chromeos_update_manager
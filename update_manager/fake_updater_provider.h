@@ -67,6 +67,10 @@ class FakeUpdaterProvider : public UpdaterProvider {
     return &var_cellular_enabled_;
   }
 
+  FakeVariable<int64_t>* var_download_rate_limit() override {
+    return &var_download_rate_limit_;
+  }
+
   FakeVariable<unsigned int>* var_consecutive_failed_update_checks() override {
     return &var_consecutive_failed_update_checks_;
   }
@@ -100,6 +104,8 @@ class FakeUpdaterProvider : public UpdaterProvider {
   FakeVariable<bool> var_p2p_enabled_{"p2p_enabled", kVariableModeAsync};
   FakeVariable<bool> var_cellular_enabled_{"cellular_enabled",
                                            kVariableModeAsync};
+  FakeVariable<int64_t> var_download_rate_limit_{"download_rate_limit",
+                                                 kVariableModeAsync};
   FakeVariable<unsigned int> var_consecutive_failed_update_checks_{
       "consecutive_failed_update_checks", kVariableModePoll};
   FakeVariable<unsigned int> var_server_dictated_poll_interval_{
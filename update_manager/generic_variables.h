@@ -22,6 +22,7 @@
 #define UPDATE_ENGINE_UPDATE_MANAGER_GENERIC_VARIABLES_H_
 
 #include <string>
+#include <utility>
 
 #include <base/callback.h>
 
@@ -189,12 +190,23 @@ class AsyncCopyVariable : public Variable<T> {
         has_value_(true),
         value_(value) {}
 
+  // Sets the value of the variable, notifying the observers if it changed. An
+  // equal value is not copied.
   void SetValue(const T& new_value) {
-    bool should_notify = !(has_value_ && new_value == value_);
+    if (has_value_ && new_value == value_)
+      return;
     value_ = new_value;
     has_value_ = true;
-    if (should_notify)
-      this->NotifyValueChanged();
+    this->NotifyValueChanged();
+  }
+
+  // Same as above, but moves |new_value| into the variable.
+  void SetValue(T&& new_value) {
+    if (has_value_ && new_value == value_)
+      return;
+    value_ = std::move(new_value);
+    has_value_ = true;
+    this->NotifyValueChanged();
   }
 
   void UnsetValue() {
@@ -17,6 +17,8 @@
 #include "update_engine/update_manager/generic_variables.h"
 
 #include <memory>
+#include <string>
+#include <utility>
 
 #include <base/callback.h>
 #include <brillo/message_loops/fake_message_loop.h>
@@ -28,6 +30,7 @@
 
 using brillo::MessageLoop;
 using brillo::MessageLoopRunMaxIterations;
+using std::string;
 using std::unique_ptr;
 
 namespace chromeos_update_manager {
@@ -167,6 +170,15 @@ TEST_F(UmAsyncCopyVariableTest, SetValueTest) {
   MessageLoopRunMaxIterations(MessageLoop::current(), 100);
 }
 
+TEST_F(UmAsyncCopyVariableTest, SetValueMovesTest) {
+  AsyncCopyVariable<string> var("var");
+  string value = "moved value";
+  var.SetValue(std::move(value));
+  UmTestUtils::ExpectVariableHasValue(string("moved value"), &var);
+  // Execute all the pending observers.
+  MessageLoopRunMaxIterations(MessageLoop::current(), 100);
+}
+
 TEST_F(UmAsyncCopyVariableTest, UnsetValueTest) {
   AsyncCopyVariable<int> var("var", 42);
   var.UnsetValue();
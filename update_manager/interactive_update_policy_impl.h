@@ -26,7 +26,7 @@
 namespace chromeos_update_manager {
 
 // Check to see if an interactive update was requested.
-class InteractiveUpdatePolicyImpl : public PolicyImplBase {
+class InteractiveUpdatePolicyImpl final : public PolicyImplBase {
  public:
   InteractiveUpdatePolicyImpl() = default;
   ~InteractiveUpdatePolicyImpl() override = default;
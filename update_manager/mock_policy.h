@@ -51,6 +51,11 @@ class MockPolicy : public Policy {
         UpdateDownloadAllowed(testing::_, testing::_, testing::_, testing::_))
         .WillByDefault(testing::Invoke(&default_policy_,
                                        &DefaultPolicy::UpdateDownloadAllowed));
+    ON_CALL(*this,
+            UpdateDownloadFetchParams(
+                testing::_, testing::_, testing::_, testing::_, testing::_))
+        .WillByDefault(testing::Invoke(
+            &default_policy_, &DefaultPolicy::UpdateDownloadFetchParams));
     ON_CALL(*this, P2PEnabled(testing::_, testing::_, testing::_, testing::_))
         .WillByDefault(
             testing::Invoke(&default_policy_, &DefaultPolicy::P2PEnabled));
@@ -87,6 +92,13 @@ class MockPolicy : public Policy {
       UpdateDownloadAllowed,
       EvalStatus(EvaluationContext*, State*, std::string*, bool*));
 
+  MOCK_CONST_METHOD5(UpdateDownloadFetchParams,
+                     EvalStatus(EvaluationContext*,
+                                State*,
+                                std::string*,
+                                UpdateFetchParams*,
+                                UpdateFetchState));
+
   MOCK_CONST_METHOD4(
       P2PEnabled, EvalStatus(EvaluationContext*, State*, std::string*, bool*));
 
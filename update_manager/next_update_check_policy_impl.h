@@ -42,7 +42,7 @@ struct NextUpdateCheckPolicyConstants {
 };
 
 // Ensure that periodic update checks are timed properly.
-class NextUpdateCheckTimePolicyImpl : public PolicyImplBase {
+class NextUpdateCheckTimePolicyImpl final : public PolicyImplBase {
  public:
   explicit NextUpdateCheckTimePolicyImpl(
       const NextUpdateCheckPolicyConstants& constants);
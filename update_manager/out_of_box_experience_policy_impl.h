@@ -24,7 +24,7 @@
 namespace chromeos_update_manager {
 
 // If OOBE is enabled, wait until it is completed.
-class OobePolicyImpl : public PolicyImplBase {
+class OobePolicyImpl final : public PolicyImplBase {
  public:
   OobePolicyImpl() = default;
   ~OobePolicyImpl() override = default;
@@ -174,6 +174,9 @@ struct UpdateDownloadParams {
   // Whether P2P download and sharing are allowed.
   bool p2p_downloading_allowed;
   bool p2p_sharing_allowed;
+  // The maximum rate of the download in bytes per second, or 0 if it's not
+  // limited.
+  int64_t download_rate_limit_bps;
 
   // Other values that need to be persisted and handed to the policy as need on
   // the next call.
@@ -191,6 +194,24 @@ struct UpdateDownloadParams {
   int scatter_check_threshold;
 };
 
+// Input arguments to UpdateDownloadFetchParams.
+struct UpdateFetchState {
+  // The throughput measured on the current connection type, in bytes per
+  // second, or 0 if it wasn't measured yet.
+  uint64_t throughput_bps;
+};
+
+// Parameters of the payload fetchers, chosen for the current connection. A
+// value of 0 leaves the corresponding setting to the client's default.
+struct UpdateFetchParams {
+  // The number of connections the payload is downloaded over in parallel.
+  int num_connections;
+  // The size of the chunks the parallel connections download.
+  size_t chunk_size;
+  // The maximum rate of the download in bytes per second.
+  int64_t rate_limit_bps;
+};
+
 // The Policy class is an interface to the ensemble of policy requests that the
 // client can make. A derived class includes the policy implementations of
 // these.
@@ -221,6 +242,9 @@ class Policy {
     if (reinterpret_cast<typeof(&Policy::UpdateDownloadAllowed)>(
             policy_method) == &Policy::UpdateDownloadAllowed)
       return class_name + "UpdateDownloadAllowed";
+    if (reinterpret_cast<typeof(&Policy::UpdateDownloadFetchParams)>(
+            policy_method) == &Policy::UpdateDownloadFetchParams)
+      return class_name + "UpdateDownloadFetchParams";
     if (reinterpret_cast<typeof(&Policy::P2PEnabled)>(policy_method) ==
         &Policy::P2PEnabled)
       return class_name + "P2PEnabled";
@@ -280,6 +304,17 @@ class Policy {
                                            std::string* error,
                                            bool* result) const = 0;
 
+  // Chooses the parameters of the payload fetchers for the current network
+  // connection, given the measured |fetch_state|. Returns
+  // |EvalStatus::kSucceeded| and sets |result|; on error, returns
+  // |EvalStatus::kFailed| and sets |error| accordingly.
+  virtual EvalStatus UpdateDownloadFetchParams(
+      EvaluationContext* ec,
+      State* state,
+      std::string* error,
+      UpdateFetchParams* result,
+      UpdateFetchState fetch_state) const = 0;
+
   // Checks whether P2P is enabled. This may consult device policy and other
   // global settings.
   virtual EvalStatus P2PEnabled(EvaluationContext* ec,
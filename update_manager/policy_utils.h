@@ -18,6 +18,8 @@
 #define UPDATE_ENGINE_UPDATE_MANAGER_POLICY_UTILS_H_
 
 #include <string>
+#include <tuple>
+#include <type_traits>
 #include <vector>
 
 #include "update_engine/update_manager/policy.h"
@@ -52,8 +54,11 @@ EvalStatus ConsultPolicies(const std::vector<Policy const*> policies,
                            R* result,
                            Args... args) {
   for (auto policy : policies) {
-    EvalStatus status =
-        (policy->*policy_method)(ec, state, error, result, args...);
+    EvalStatus status;
+    {
+      ScopedPolicyTrace trace(ec, policy->PolicyRequestName(policy_method));
+      status = (policy->*policy_method)(ec, state, error, result, args...);
+    }
     if (status != EvalStatus::kContinue) {
       LOG(INFO) << "decision by " << policy->PolicyRequestName(policy_method);
       return status;
@@ -62,6 +67,77 @@ EvalStatus ConsultPolicies(const std::vector<Policy const*> policies,
   return EvalStatus::kContinue;
 }
 
+// A chain of Policy implementations consulted in order like ConsultPolicies(),
+// but composed at compile time: the policies keep their concrete types, so the
+// calls to the final policy classes are resolved statically and the loop is
+// unrolled. The chain keeps references to the passed |policies|, which must
+// outlive it. Use MakePolicyChain() to create one, for example:
+//
+//   EnterpriseDevicePolicyImpl enterprise_device_policy;
+//   OobePolicyImpl oobe_policy;
+//   EvalStatus status =
+//       MakePolicyChain(enterprise_device_policy, oobe_policy)
+//           .Consult(&Policy::UpdateCheckAllowed, ec, state, error, result);
+//
+template <typename... Policies>
+class PolicyChain {
+ public:
+  explicit PolicyChain(const Policies&... policies) : policies_(policies...) {}
+
+  // Calls the passed Policy method on the policies of the chain, until one of
+  // them renders a decision by returning a value other than
+  // |EvalStatus::kContinue|.
+  template <typename T, typename R, typename... Args>
+  EvalStatus Consult(T policy_method,
+                     EvaluationContext* ec,
+                     State* state,
+                     std::string* error,
+                     R* result,
+                     Args... args) const {
+    return ConsultFrom<0>(policy_method, ec, state, error, result, args...);
+  }
+
+ private:
+  template <size_t I, typename T, typename R, typename... Args>
+  typename std::enable_if<(I < sizeof...(Policies)), EvalStatus>::type
+  ConsultFrom(T policy_method,
+              EvaluationContext* ec,
+              State* state,
+              std::string* error,
+              R* result,
+              Args... args) const {
+    const auto& policy = std::get<I>(policies_);
+    EvalStatus status;
+    {
+      ScopedPolicyTrace trace(ec, policy.PolicyRequestName(policy_method));
+      status = (policy.*policy_method)(ec, state, error, result, args...);
+    }
+    if (status != EvalStatus::kContinue) {
+      LOG(INFO) << "decision by " << policy.PolicyRequestName(policy_method);
+      return status;
+    }
+    return ConsultFrom<I + 1>(policy_method, ec, state, error, result, args...);
+  }
+
+  template <size_t I, typename T, typename R, typename... Args>
+  typename std::enable_if<(I == sizeof...(Policies)), EvalStatus>::type
+  ConsultFrom(T policy_method,
+              EvaluationContext* ec,
+              State* state,
+              std::string* error,
+              R* result,
+              Args... args) const {
+    return EvalStatus::kContinue;
+  }
+
+  std::tuple<const Policies&...> policies_;
+};
+
+template <typename... Policies>
+PolicyChain<Policies...> MakePolicyChain(const Policies&... policies) {
+  return PolicyChain<Policies...>(policies...);
+}
+
 // Base class implementation that returns |EvalStatus::kContinue| for all
 // decisions, to be used as a base-class for various Policy facets that only
 // pertain to certain situations. This might be better folded into Policy
@@ -100,6 +176,15 @@ class PolicyImplBase : public Policy {
     return EvalStatus::kContinue;
   };
 
+  EvalStatus UpdateDownloadFetchParams(
+      EvaluationContext* ec,
+      State* state,
+      std::string* error,
+      UpdateFetchParams* result,
+      UpdateFetchState fetch_state) const override {
+    return EvalStatus::kContinue;
+  };
+
   EvalStatus P2PEnabled(EvaluationContext* ec,
                         State* state,
                         std::string* error,
@@ -18,6 +18,7 @@
 
 #include <stdint.h>
 
+#include <utility>
 #include <vector>
 
 #include <base/location.h>
@@ -109,7 +110,7 @@ void RealDevicePolicyProvider::UpdateVariable(
   T new_value;
   if (policy_provider_->device_policy_is_loaded() &&
       (policy_provider_->GetDevicePolicy().*getter_method)(&new_value)) {
-    var->SetValue(new_value);
+    var->SetValue(std::move(new_value));
   } else {
     var->UnsetValue();
   }
@@ -122,7 +123,7 @@ void RealDevicePolicyProvider::UpdateVariable(
   T new_value;
   if (policy_provider_->device_policy_is_loaded() &&
       (this->*getter_method)(&new_value)) {
-    var->SetValue(new_value);
+    var->SetValue(std::move(new_value));
   } else {
     var->UnsetValue();
   }
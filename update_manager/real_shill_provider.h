@@ -17,31 +17,27 @@
 #ifndef UPDATE_ENGINE_UPDATE_MANAGER_REAL_SHILL_PROVIDER_H_
 #define UPDATE_ENGINE_UPDATE_MANAGER_REAL_SHILL_PROVIDER_H_
 
-// TODO(garnold) Much of the functionality in this module was adapted from the
-// update engine's connection_manager.  We need to make sure to deprecate use of
-// connection manager when the time comes.
-
-#include <memory>
-#include <string>
-
 #include <base/time/time.h>
-#include <dbus/object_path.h>
 
 #include "update_engine/common/clock_interface.h"
-#include "update_engine/shill_proxy_interface.h"
+#include "update_engine/shill_connection_cache.h"
 #include "update_engine/update_manager/generic_variables.h"
 #include "update_engine/update_manager/shill_provider.h"
 
 namespace chromeos_update_manager {
 
-// ShillProvider concrete implementation.
-class RealShillProvider : public ShillProvider {
+// ShillProvider concrete implementation, which exposes the connection
+// properties of the ShillConnectionCache shared with the ConnectionManager.
+class RealShillProvider
+    : public ShillProvider,
+      public chromeos_update_engine::ShillConnectionCache::Observer {
  public:
-  RealShillProvider(chromeos_update_engine::ShillProxyInterface* shill_proxy,
+  // The |shill_cache| must outlive this object.
+  RealShillProvider(chromeos_update_engine::ShillConnectionCache* shill_cache,
                     chromeos_update_engine::ClockInterface* clock)
-      : shill_proxy_(shill_proxy), clock_(clock) {}
+      : shill_cache_(shill_cache), clock_(clock) {}
 
-  ~RealShillProvider() override = default;
+  ~RealShillProvider() override;
 
   // Initializes the provider and returns whether it succeeded.
   bool Init();
@@ -62,24 +58,11 @@ class RealShillProvider : public ShillProvider {
   }
 
  private:
-  // A handler for ManagerProxy.PropertyChanged signal.
-  void OnManagerPropertyChanged(const std::string& name,
-                                const brillo::Any& value);
-
-  // Called when the signal in ManagerProxy.PropertyChanged is connected.
-  void OnSignalConnected(const std::string& interface_name,
-                         const std::string& signal_name,
-                         bool successful);
-
-  // Get the connection and populate the type and tethering status of the given
-  // default connection.
-  bool ProcessDefaultService(const dbus::ObjectPath& default_service_path);
-
-  // The current default service path, if connected. "/" means not connected.
-  dbus::ObjectPath default_service_path_{"uninitialized"};
+  // ShillConnectionCache::Observer override.
+  void OnConnectionChanged(bool service_changed) override;
 
-  // The mockable interface to access the shill DBus proxies.
-  std::unique_ptr<chromeos_update_engine::ShillProxyInterface> shill_proxy_;
+  // The cache of the connection properties.
+  chromeos_update_engine::ShillConnectionCache* shill_cache_;
 
   // A clock abstraction (mockable).
   chromeos_update_engine::ClockInterface* const clock_;
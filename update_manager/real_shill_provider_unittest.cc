@@ -68,7 +68,9 @@ class UmRealShillProviderTest : public ::testing::Test {
     fake_clock_.SetWallclockTime(InitTime());
     loop_.SetAsCurrent();
     fake_shill_proxy_ = new chromeos_update_engine::FakeShillProxy();
-    provider_.reset(new RealShillProvider(fake_shill_proxy_, &fake_clock_));
+    shill_cache_.reset(
+        new chromeos_update_engine::ShillConnectionCache(fake_shill_proxy_));
+    provider_.reset(new RealShillProvider(shill_cache_.get(), &fake_clock_));
 
     ManagerProxyMock* manager_proxy_mock = fake_shill_proxy_->GetManagerProxy();
 
@@ -79,6 +81,7 @@ class UmRealShillProviderTest : public ::testing::Test {
 
   void TearDown() override {
     provider_.reset();
+    shill_cache_.reset();
     // Check for leaked callbacks on the main loop.
     EXPECT_FALSE(loop_.PendingTasks());
   }
@@ -212,6 +215,7 @@ class UmRealShillProviderTest : public ::testing::Test {
       const std::string&, const brillo::Any&)>
       manager_property_changed_;
 
+  unique_ptr<chromeos_update_engine::ShillConnectionCache> shill_cache_;
   unique_ptr<RealShillProvider> provider_;
 };
 
@@ -525,4 +529,55 @@ TEST_F(UmRealShillProviderTest, NoInitConnStatusReadConnTypeEthernet) {
   UmTestUtils::ExpectVariableHasValue(true, provider_->var_is_connected());
 }
 
+// Test that the changes of the properties of the default service signaled
+// by shill are taken into account, without changing the time of the last
+// connection change.
+TEST_F(UmRealShillProviderTest, ServicePropertyChangedSignal) {
+  InitWithDefaultService("/");
+  chromeos_update_engine::dbus_test_utils::MockSignalHandler<void(
+      const std::string&, const brillo::Any&)>
+      service_property_changed;
+  ServiceProxyMock* service_proxy_mock =
+      SetServiceReply(kFakeWifiServicePath,
+                      shill::kTypeWifi,
+                      nullptr,
+                      shill::kTetheringNotDetectedState);
+  MOCK_SIGNAL_HANDLER_EXPECT_SIGNAL_HANDLER(
+      service_property_changed, *service_proxy_mock, PropertyChanged);
+  Time conn_change_time;
+  SendDefaultServiceSignal(kFakeWifiServicePath, &conn_change_time);
+  EXPECT_TRUE(loop_.RunOnce(false));
+  UmTestUtils::ExpectVariableHasValue(ConnectionTethering::kNotDetected,
+                                      provider_->var_conn_tethering());
+
+  ASSERT_TRUE(service_property_changed.IsHandlerRegistered());
+  service_property_changed.signal_callback().Run(
+      shill::kTetheringProperty,
+      brillo::Any(std::string(shill::kTetheringConfirmedState)));
+  UmTestUtils::ExpectVariableHasValue(ConnectionTethering::kConfirmed,
+                                      provider_->var_conn_tethering());
+  UmTestUtils::ExpectVariableHasValue(ConnectionType::kWifi,
+                                      provider_->var_conn_type());
+  UmTestUtils::ExpectVariableHasValue(conn_change_time,
+                                      provider_->var_conn_last_changed());
+}
+
+// Test that the properties read by another user of the cache before the
+// provider is initialized are used.
+TEST_F(UmRealShillProviderTest, InitFromKnownDefaultService) {
+  SetManagerReply(kFakeEthernetServicePath, true);
+  SetServiceReply(kFakeEthernetServicePath,
+                  shill::kTypeEthernet,
+                  nullptr,
+                  shill::kTetheringNotDetectedState);
+  EXPECT_TRUE(shill_cache_->Refresh());
+
+  SetManagerReply(kFakeEthernetServicePath, true);
+  EXPECT_TRUE(provider_->Init());
+  EXPECT_TRUE(loop_.RunOnce(false));
+  UmTestUtils::ExpectVariableHasValue(true, provider_->var_is_connected());
+  UmTestUtils::ExpectVariableHasValue(ConnectionType::kEthernet,
+                                      provider_->var_conn_type());
+}
+
 }  // namespace chromeos_update_manager
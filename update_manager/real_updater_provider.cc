@@ -18,6 +18,7 @@
 
 #include <inttypes.h>
 
+#include <memory>
 #include <string>
 
 #include <base/bind.h>
@@ -61,6 +62,41 @@ class UpdaterVariableBase : public Variable<T> {
   SystemState* const system_state_;
 };
 
+// A base class for the variables computed from the state of the
+// UpdateAttempter. Instead of being polled, they are checked whenever the
+// UpdateAttempter reports that its state may have changed, and only notify
+// their observers when their value actually changed.
+template <typename T>
+class UpdaterStateVariable : public UpdaterVariableBase<T> {
+ public:
+  UpdaterStateVariable(const string& name, SystemState* system_state)
+      : UpdaterVariableBase<T>(name, kVariableModeAsync, system_state) {}
+
+  // Notifies the observers if the value changed since the last check.
+  void CheckValueChanged() {
+    std::unique_ptr<const T> value(this->GetValue(TimeDelta(), nullptr));
+    const bool changed =
+        !checked_ || (value == nullptr) != (last_value_ == nullptr) ||
+        (value && !(*value == *last_value_));
+    checked_ = true;
+    last_value_ = std::move(value);
+    if (changed)
+      this->NotifyValueChanged();
+  }
+
+ private:
+  // Whether the value was checked before, and the value found then, which is
+  // null if it couldn't be computed.
+  bool checked_ = false;
+  std::unique_ptr<const T> last_value_;
+};
+
+// Returns the |variable| created as an UpdaterStateVariable.
+template <typename T>
+UpdaterStateVariable<T>* AsUpdaterStateVariable(Variable<T>* variable) {
+  return static_cast<UpdaterStateVariable<T>*>(variable);
+}
+
 // Helper class for issuing a GetStatus() to the UpdateAttempter.
 class GetStatusHelper {
  public:
@@ -94,10 +130,10 @@ class GetStatusHelper {
 };
 
 // A variable reporting the time when a last update check was issued.
-class LastCheckedTimeVariable : public UpdaterVariableBase<Time> {
+class LastCheckedTimeVariable : public UpdaterStateVariable<Time> {
  public:
   LastCheckedTimeVariable(const string& name, SystemState* system_state)
-      : UpdaterVariableBase<Time>(name, kVariableModePoll, system_state) {}
+      : UpdaterStateVariable<Time>(name, system_state) {}
 
  private:
   const Time* GetValue(TimeDelta /* timeout */, string* errmsg) override {
@@ -113,10 +149,10 @@ class LastCheckedTimeVariable : public UpdaterVariableBase<Time> {
 
 // A variable reporting the update (download) progress as a decimal fraction
 // between 0.0 and 1.0.
-class ProgressVariable : public UpdaterVariableBase<double> {
+class ProgressVariable : public UpdaterStateVariable<double> {
  public:
   ProgressVariable(const string& name, SystemState* system_state)
-      : UpdaterVariableBase<double>(name, kVariableModePoll, system_state) {}
+      : UpdaterStateVariable<double>(name, system_state) {}
 
  private:
   const double* GetValue(TimeDelta /* timeout */, string* errmsg) override {
@@ -139,10 +175,10 @@ class ProgressVariable : public UpdaterVariableBase<double> {
 };
 
 // A variable reporting the stage in which the update process is.
-class StageVariable : public UpdaterVariableBase<Stage> {
+class StageVariable : public UpdaterStateVariable<Stage> {
  public:
   StageVariable(const string& name, SystemState* system_state)
-      : UpdaterVariableBase<Stage>(name, kVariableModePoll, system_state) {}
+      : UpdaterStateVariable<Stage>(name, system_state) {}
 
  private:
   struct CurrOpStrToStage {
@@ -186,10 +222,10 @@ const Stage* StageVariable::GetValue(TimeDelta /* timeout */, string* errmsg) {
 }
 
 // A variable reporting the version number that an update is updating to.
-class NewVersionVariable : public UpdaterVariableBase<string> {
+class NewVersionVariable : public UpdaterStateVariable<string> {
  public:
   NewVersionVariable(const string& name, SystemState* system_state)
-      : UpdaterVariableBase<string>(name, kVariableModePoll, system_state) {}
+      : UpdaterStateVariable<string>(name, system_state) {}
 
  private:
   const string* GetValue(TimeDelta /* timeout */, string* errmsg) override {
@@ -204,10 +240,10 @@ class NewVersionVariable : public UpdaterVariableBase<string> {
 };
 
 // A variable reporting the size of the update being processed in bytes.
-class PayloadSizeVariable : public UpdaterVariableBase<uint64_t> {
+class PayloadSizeVariable : public UpdaterStateVariable<uint64_t> {
  public:
   PayloadSizeVariable(const string& name, SystemState* system_state)
-      : UpdaterVariableBase<uint64_t>(name, kVariableModePoll, system_state) {}
+      : UpdaterStateVariable<uint64_t>(name, system_state) {}
 
  private:
   const uint64_t* GetValue(TimeDelta /* timeout */, string* errmsg) override {
@@ -339,14 +375,53 @@ class BooleanPrefVariable
   DISALLOW_COPY_AND_ASSIGN(BooleanPrefVariable);
 };
 
+// A variable class for reading integer prefs values.
+class Int64PrefVariable
+    : public AsyncCopyVariable<int64_t>,
+      public chromeos_update_engine::PrefsInterface::ObserverInterface {
+ public:
+  Int64PrefVariable(const string& name,
+                    chromeos_update_engine::PrefsInterface* prefs,
+                    const char* key,
+                    int64_t default_val)
+      : AsyncCopyVariable<int64_t>(name),
+        prefs_(prefs),
+        key_(key),
+        default_val_(default_val) {
+    prefs->AddObserver(key, this);
+    OnPrefSet(key);
+  }
+  ~Int64PrefVariable() { prefs_->RemoveObserver(key_, this); }
+
+ private:
+  // Reads the actual value from the Prefs instance and updates the Variable
+  // value.
+  void OnPrefSet(const string& key) override {
+    int64_t result = default_val_;
+    if (prefs_ && prefs_->Exists(key_) && !prefs_->GetInt64(key_, &result))
+      result = default_val_;
+    // AsyncCopyVariable will take care of values that didn't change.
+    SetValue(result);
+  }
+
+  void OnPrefDeleted(const string& key) override { SetValue(default_val_); }
+
+  chromeos_update_engine::PrefsInterface* prefs_;
+
+  // The integer preference key and default value.
+  const char* const key_;
+  const int64_t default_val_;
+
+  DISALLOW_COPY_AND_ASSIGN(Int64PrefVariable);
+};
+
 // A variable returning the number of consecutive failed update checks.
 class ConsecutiveFailedUpdateChecksVariable
-    : public UpdaterVariableBase<unsigned int> {
+    : public UpdaterStateVariable<unsigned int> {
  public:
   ConsecutiveFailedUpdateChecksVariable(const string& name,
                                         SystemState* system_state)
-      : UpdaterVariableBase<unsigned int>(
-            name, kVariableModePoll, system_state) {}
+      : UpdaterStateVariable<unsigned int>(name, system_state) {}
 
  private:
   const unsigned int* GetValue(TimeDelta /* timeout */,
@@ -360,12 +435,11 @@ class ConsecutiveFailedUpdateChecksVariable
 
 // A variable returning the server-dictated poll interval.
 class ServerDictatedPollIntervalVariable
-    : public UpdaterVariableBase<unsigned int> {
+    : public UpdaterStateVariable<unsigned int> {
  public:
   ServerDictatedPollIntervalVariable(const string& name,
                                      SystemState* system_state)
-      : UpdaterVariableBase<unsigned int>(
-            name, kVariableModePoll, system_state) {}
+      : UpdaterStateVariable<unsigned int>(name, system_state) {}
 
  private:
   const unsigned int* GetValue(TimeDelta /* timeout */,
@@ -414,11 +488,10 @@ class ForcedUpdateRequestedVariable
 
 // A variable returning the current update restrictions that are in effect.
 class UpdateRestrictionsVariable
-    : public UpdaterVariableBase<UpdateRestrictions> {
+    : public UpdaterStateVariable<UpdateRestrictions> {
  public:
   UpdateRestrictionsVariable(const string& name, SystemState* system_state)
-      : UpdaterVariableBase<UpdateRestrictions>(
-            name, kVariableModePoll, system_state) {}
+      : UpdaterStateVariable<UpdateRestrictions>(name, system_state) {}
 
  private:
   const UpdateRestrictions* GetValue(TimeDelta /* timeout */,
@@ -465,6 +538,11 @@ RealUpdaterProvider::RealUpdaterProvider(SystemState* system_state)
           system_state_->prefs(),
           chromeos_update_engine::kPrefsUpdateOverCellularPermission,
           false)),
+      var_download_rate_limit_(new Int64PrefVariable(
+          "download_rate_limit",
+          system_state_->prefs(),
+          chromeos_update_engine::kPrefsDownloadRateLimitBps,
+          0)),
       var_consecutive_failed_update_checks_(
           new ConsecutiveFailedUpdateChecksVariable(
               "consecutive_failed_update_checks", system_state_)),
@@ -473,5 +551,22 @@ RealUpdaterProvider::RealUpdaterProvider(SystemState* system_state)
       var_forced_update_requested_(new ForcedUpdateRequestedVariable(
           "forced_update_requested", system_state_)),
       var_update_restrictions_(new UpdateRestrictionsVariable(
-          "update_restrictions", system_state_)) {}
+          "update_restrictions", system_state_)) {
+  system_state->update_attempter()->set_updater_state_changed_callback(
+      new base::Closure(base::Bind(&RealUpdaterProvider::OnUpdaterStateChanged,
+                                   base::Unretained(this))));
+}
+
+void RealUpdaterProvider::OnUpdaterStateChanged() {
+  AsUpdaterStateVariable(var_last_checked_time_.get())->CheckValueChanged();
+  AsUpdaterStateVariable(var_progress_.get())->CheckValueChanged();
+  AsUpdaterStateVariable(var_stage_.get())->CheckValueChanged();
+  AsUpdaterStateVariable(var_new_version_.get())->CheckValueChanged();
+  AsUpdaterStateVariable(var_payload_size_.get())->CheckValueChanged();
+  AsUpdaterStateVariable(var_consecutive_failed_update_checks_.get())
+      ->CheckValueChanged();
+  AsUpdaterStateVariable(var_server_dictated_poll_interval_.get())
+      ->CheckValueChanged();
+  AsUpdaterStateVariable(var_update_restrictions_.get())->CheckValueChanged();
+}
 }  // namespace chromeos_update_manager
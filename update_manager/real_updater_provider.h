@@ -78,6 +78,10 @@ class RealUpdaterProvider : public UpdaterProvider {
     return var_cellular_enabled_.get();
   }
 
+  Variable<int64_t>* var_download_rate_limit() override {
+    return var_download_rate_limit_.get();
+  }
+
   Variable<unsigned int>* var_consecutive_failed_update_checks() override {
     return var_consecutive_failed_update_checks_.get();
   }
@@ -95,6 +99,10 @@ class RealUpdaterProvider : public UpdaterProvider {
   }
 
  private:
+  // Checks the variables computed from the state of the UpdateAttempter,
+  // called whenever that state may have changed.
+  void OnUpdaterStateChanged();
+
   // A pointer to the update engine's system state aggregator.
   chromeos_update_engine::SystemState* system_state_;
 
@@ -110,6 +118,7 @@ class RealUpdaterProvider : public UpdaterProvider {
   std::unique_ptr<Variable<std::string>> var_new_channel_;
   std::unique_ptr<Variable<bool>> var_p2p_enabled_;
   std::unique_ptr<Variable<bool>> var_cellular_enabled_;
+  std::unique_ptr<Variable<int64_t>> var_download_rate_limit_;
   std::unique_ptr<Variable<unsigned int>> var_consecutive_failed_update_checks_;
   std::unique_ptr<Variable<unsigned int>> var_server_dictated_poll_interval_;
   std::unique_ptr<Variable<UpdateRequestStatus>> var_forced_update_requested_;
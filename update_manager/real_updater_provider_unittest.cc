@@ -20,6 +20,8 @@
 #include <string>
 
 #include <base/time/time.h>
+#include <brillo/message_loops/fake_message_loop.h>
+#include <brillo/message_loops/message_loop_utils.h>
 #include <gtest/gtest.h>
 #include <update_engine/dbus-constants.h>
 
@@ -41,6 +43,7 @@ using std::unique_ptr;
 using testing::_;
 using testing::DoAll;
 using testing::Return;
+using testing::ReturnPointee;
 using testing::SetArgPointee;
 using update_engine::UpdateAttemptFlags;
 
@@ -394,6 +397,18 @@ TEST_F(UmRealUpdaterProviderTest, GetCellularEnabledOkayPrefReadsTrue) {
   UmTestUtils::ExpectVariableHasValue(true, provider_->var_cellular_enabled());
 }
 
+TEST_F(UmRealUpdaterProviderTest, GetDownloadRateLimitOkayPrefDoesntExist) {
+  UmTestUtils::ExpectVariableHasValue(static_cast<int64_t>(0),
+                                      provider_->var_download_rate_limit());
+}
+
+TEST_F(UmRealUpdaterProviderTest, GetDownloadRateLimitOkayPrefReadsValue) {
+  fake_prefs_.SetInt64(chromeos_update_engine::kPrefsDownloadRateLimitBps,
+                       100000);
+  UmTestUtils::ExpectVariableHasValue(static_cast<int64_t>(100000),
+                                      provider_->var_download_rate_limit());
+}
+
 TEST_F(UmRealUpdaterProviderTest, GetUpdateCompletedTimeOkay) {
   Time expected = SetupUpdateCompletedTime(true);
   UmTestUtils::ExpectVariableHasValue(expected,
@@ -420,6 +435,47 @@ TEST_F(UmRealUpdaterProviderTest, GetConsecutiveFailedUpdateChecks) {
       kNumFailedChecks, provider_->var_consecutive_failed_update_checks());
 }
 
+// Counts the notifications of a variable.
+class CallCounterObserver : public BaseVariable::ObserverInterface {
+ public:
+  void ValueChanged(BaseVariable* variable) override { calls_count_++; }
+
+  int calls_count_ = 0;
+};
+
+TEST_F(UmRealUpdaterProviderTest, ConsecutiveFailedUpdateChecksNotified) {
+  brillo::FakeMessageLoop loop(nullptr);
+  loop.SetAsCurrent();
+  unsigned int num_failed_checks = 0;
+  EXPECT_CALL(*fake_sys_state_.mock_update_attempter(),
+              consecutive_failed_update_checks())
+      .WillRepeatedly(ReturnPointee(&num_failed_checks));
+  EXPECT_CALL(*fake_sys_state_.mock_update_attempter(), GetStatus(_))
+      .WillRepeatedly(Return(true));
+  Variable<unsigned int>* var =
+      provider_->var_consecutive_failed_update_checks();
+  EXPECT_EQ(kVariableModeAsync, var->GetMode());
+  CallCounterObserver observer;
+  var->AddObserver(&observer);
+
+  // The variable is checked on every change of the updater state, but only
+  // notifies its observers when its value changed.
+  fake_sys_state_.mock_update_attempter()->BroadcastStatus();
+  brillo::MessageLoopRunMaxIterations(&loop, 10);
+  EXPECT_EQ(1, observer.calls_count_);
+  fake_sys_state_.mock_update_attempter()->BroadcastStatus();
+  brillo::MessageLoopRunMaxIterations(&loop, 10);
+  EXPECT_EQ(1, observer.calls_count_);
+
+  num_failed_checks = 2;
+  fake_sys_state_.mock_update_attempter()->BroadcastStatus();
+  brillo::MessageLoopRunMaxIterations(&loop, 10);
+  EXPECT_EQ(2, observer.calls_count_);
+  UmTestUtils::ExpectVariableHasValue(2U, var);
+
+  var->RemoveObserver(&observer);
+}
+
 TEST_F(UmRealUpdaterProviderTest, GetServerDictatedPollInterval) {
   const unsigned int kPollInterval = 2 * 60 * 60;  // Two hours.
   EXPECT_CALL(*fake_sys_state_.mock_update_attempter(),
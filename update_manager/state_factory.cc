@@ -36,7 +36,7 @@
 #include "update_engine/update_manager/real_time_provider.h"
 #include "update_engine/update_manager/real_updater_provider.h"
 #if USE_SHILL
-#include "update_engine/shill_proxy.h"
+#include "update_engine/shill_connection_cache.h"
 #include "update_engine/update_manager/real_shill_provider.h"
 #endif  // USE_SHILL
 
@@ -63,8 +63,8 @@ State* DefaultStateFactory(
       new RealDevicePolicyProvider(policy_provider));
 #endif  // USE_DBUS
 #if USE_SHILL
-  unique_ptr<RealShillProvider> shill_provider(
-      new RealShillProvider(new chromeos_update_engine::ShillProxy(), clock));
+  unique_ptr<RealShillProvider> shill_provider(new RealShillProvider(
+      chromeos_update_engine::ShillConnectionCache::Get(), clock));
 #else
   unique_ptr<FakeShillProvider> shill_provider(new FakeShillProvider());
 #endif  // USE_SHILL
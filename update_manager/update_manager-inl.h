@@ -39,9 +39,11 @@ EvalStatus UpdateManager::EvaluatePolicy(
   // IMPORTANT: We must still proceed with evaluation of the policy in this
   // case, so that the evaluation time (and corresponding reevaluation timeouts)
   // are readjusted.
-  if (ec->is_expired()) {
+  const bool expired = ec->is_expired();
+  if (expired) {
     LOG(WARNING) << "Request timed out, evaluation context: "
-                 << ec->DumpContext();
+                 << ec->DumpContext()
+                 << "\nLast evaluation trace: " << ec->TraceToJson();
     ec->ResetExpiration();
   }
 
@@ -49,12 +51,35 @@ EvalStatus UpdateManager::EvaluatePolicy(
   ec->ResetEvaluation();
 
   const std::string policy_name = policy_->PolicyRequestName(policy_method);
+
+  // The context is only evaluated again by an AsyncPolicyRequest after the
+  // policy returned EvalStatus::kAskMeAgainLater, which it does again if none
+  // of the values it used changed.
+  if (!expired && ec->PreviousEvaluationInputsUnchanged()) {
+    LOG(INFO) << policy_name << ": UNCHANGED";
+    return EvalStatus::kAskMeAgainLater;
+  }
+  return RunPolicy(ec, policy_method, result, args...);
+}
+
+template <typename R, typename... Args>
+EvalStatus UpdateManager::RunPolicy(
+    EvaluationContext* ec,
+    EvalStatus (Policy::*policy_method)(
+        EvaluationContext*, State*, std::string*, R*, Args...) const,
+    R* result,
+    Args... args) {
+  const std::string policy_name = policy_->PolicyRequestName(policy_method);
   LOG(INFO) << policy_name << ": START";
 
   // First try calling the actual policy.
   std::string error;
-  EvalStatus status = (policy_.get()->*policy_method)(
-      ec, state_.get(), &error, result, args...);
+  EvalStatus status;
+  {
+    ScopedPolicyTrace trace(ec, policy_name);
+    status = (policy_.get()->*policy_method)(
+        ec, state_.get(), &error, result, args...);
+  }
   // If evaluating the main policy failed, defer to the default policy.
   if (status == EvalStatus::kFailed) {
     LOG(WARNING) << "Evaluating policy failed: " << error
@@ -72,6 +97,7 @@ EvalStatus UpdateManager::EvaluatePolicy(
   }
 
   LOG(INFO) << policy_name << ": END";
+  VLOG(1) << policy_name << " trace: " << ec->TraceToJson();
 
   return status;
 }
@@ -135,6 +161,22 @@ EvalStatus UpdateManager::PolicyRequest(
   return ret;
 }
 
+template <typename R, typename... ActualArgs, typename... ExpectedArgs>
+EvalStatus UpdateManager::PolicyBatch::PolicyRequest(
+    EvalStatus (Policy::*policy_method)(
+        EvaluationContext*, State*, std::string*, R*, ExpectedArgs...) const,
+    R* result,
+    ActualArgs... args) {
+  // The evaluation of |ec_| is only reset by its construction, so the values
+  // read by the previous requests remain cached.
+  EvalStatus ret = update_manager_->RunPolicy<R, ExpectedArgs...>(
+      ec_.get(), policy_method, result, args...);
+  DCHECK(EvalStatus::kAskMeAgainLater != ret);
+  LOG_IF(WARNING, EvalStatus::kAskMeAgainLater == ret)
+      << "Sync request used with an async policy; this is a bug";
+  return ret;
+}
+
 template <typename R, typename... ActualArgs, typename... ExpectedArgs>
 void UpdateManager::AsyncPolicyRequest(
     base::Callback<void(EvalStatus, const R& result)> callback,
@@ -16,6 +16,8 @@
 
 #include "update_engine/update_manager/update_manager.h"
 
+#include <memory>
+
 #ifdef __ANDROID__
 #include "update_engine/update_manager/android_things_policy.h"
 #else
@@ -50,6 +52,15 @@ UpdateManager::~UpdateManager() {
     ec->RemoveObserversAndTimeout();
 }
 
+UpdateManager::PolicyBatch::PolicyBatch(UpdateManager* update_manager)
+    : update_manager_(update_manager),
+      ec_(new EvaluationContext(update_manager->clock_,
+                                update_manager->evaluation_timeout_)) {}
+
+std::unique_ptr<UpdateManager::PolicyBatch> UpdateManager::NewPolicyBatch() {
+  return std::unique_ptr<PolicyBatch>(new PolicyBatch(this));
+}
+
 void UpdateManager::UnregisterEvalContext(EvaluationContext* ec) {
   if (!ec_repo_.erase(ec)) {
     LOG(ERROR) << "Unregistering an unknown evaluation context, this is a bug.";
@@ -45,6 +45,35 @@ struct ScopedRefPtrLess {
 // The main Update Manager singleton class.
 class UpdateManager {
  public:
+  // A PolicyBatch evaluates several sync policy requests against the same
+  // snapshot of the state: all its requests share one EvaluationContext, so a
+  // variable used by several of them is only read once. It must not outlive
+  // the UpdateManager that created it.
+  class PolicyBatch {
+   public:
+    // Same as UpdateManager::PolicyRequest(), but evaluated with the values
+    // that the previous requests of this batch read.
+    template <typename R, typename... ActualArgs, typename... ExpectedArgs>
+    EvalStatus PolicyRequest(
+        EvalStatus (Policy::*policy_method)(EvaluationContext*,
+                                            State*,
+                                            std::string*,
+                                            R*,
+                                            ExpectedArgs...) const,
+        R* result,
+        ActualArgs... args);
+
+   private:
+    friend class UpdateManager;
+
+    explicit PolicyBatch(UpdateManager* update_manager);
+
+    UpdateManager* const update_manager_;
+    scoped_refptr<EvaluationContext> ec_;
+
+    DISALLOW_COPY_AND_ASSIGN(PolicyBatch);
+  };
+
   // Creates the UpdateManager instance, assuming ownership on the provided
   // |state|.
   UpdateManager(chromeos_update_engine::ClockInterface* clock,
@@ -76,6 +105,13 @@ class UpdateManager {
       R* result,
       ActualArgs...);
 
+  // Returns a new PolicyBatch for evaluating several sync policy requests
+  // against the same snapshot of the state, for example:
+  //   auto batch = um.NewPolicyBatch();
+  //   batch->PolicyRequest(&Policy::SomePolicyMethod, &bool_result);
+  //   batch->PolicyRequest(&Policy::OtherPolicyMethod, &int_result, arg1);
+  std::unique_ptr<PolicyBatch> NewPolicyBatch();
+
   // Evaluates the given |policy_method| policy with the provided |args|
   // arguments and calls the |callback| callback with the result when done.
   //
@@ -102,6 +138,7 @@ class UpdateManager {
   FRIEND_TEST(UmUpdateManagerTest, PolicyRequestCallsPolicy);
   FRIEND_TEST(UmUpdateManagerTest, PolicyRequestCallsDefaultOnError);
   FRIEND_TEST(UmUpdateManagerTest, PolicyRequestDoesntBlockDeathTest);
+  FRIEND_TEST(UmUpdateManagerTest, PolicyBatchSharesVariableValues);
   FRIEND_TEST(UmUpdateManagerTest, AsyncPolicyRequestDelaysEvaluation);
   FRIEND_TEST(UmUpdateManagerTest, AsyncPolicyRequestTimeoutDoesNotFire);
   FRIEND_TEST(UmUpdateManagerTest, AsyncPolicyRequestTimesOut);
@@ -117,6 +154,17 @@ class UpdateManager {
       R* result,
       Args... args);
 
+  // RunPolicy() runs the passed |policy_method| method on the current policy
+  // with the given |args| arguments, falling back to the default policy if it
+  // fails, without resetting the evaluation of |ec|.
+  template <typename R, typename... Args>
+  EvalStatus RunPolicy(
+      EvaluationContext* ec,
+      EvalStatus (Policy::*policy_method)(
+          EvaluationContext*, State*, std::string*, R*, Args...) const,
+      R* result,
+      Args... args);
+
   // OnPolicyReadyToEvaluate() is called by the main loop when the evaluation
   // of the given |policy_method| should be executed. If the evaluation finishes
   // the |callback| callback is called passing the |result| and the |status|
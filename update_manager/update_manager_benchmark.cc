@@ -0,0 +1,271 @@
+//
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Benchmarks of the policy evaluations of the UpdateManager: the sync
+// UpdateCheckAllowed and UpdateCanStart requests and the async
+// UpdateCheckAllowed request, evaluated by the ChromeOSPolicy against a
+// FakeState set up like a consumer device on wifi whose next update check is
+// due. Besides the time per request, each benchmark reports the heap
+// allocations per request in the "allocs_per_request" counter and, for the
+// async request, the message loop tasks run per request in the
+// "tasks_per_request" counter.
+//
+// The FakeVariables of the FakeState only return their value once, so they
+// are set again outside of the measurements before every request. This also
+// leaves out the copy of the value that the real variables allocate on every
+// read.
+//
+// The results of a run can be saved with --benchmark_out=<file>
+// --benchmark_out_format=json and compared with the ones of a previous run
+// with the compare.py tool of google-benchmark.
+
+#include <stdlib.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <base/bind.h>
+#include <base/logging.h>
+#include <base/time/time.h>
+#include <benchmark/benchmark.h>
+#include <brillo/flag_helper.h>
+#include <brillo/message_loops/fake_message_loop.h>
+#include <brillo/message_loops/message_loop_utils.h>
+
+#include "update_engine/common/fake_clock.h"
+#include "update_engine/update_manager/fake_state.h"
+#include "update_engine/update_manager/update_manager.h"
+
+using base::Time;
+using base::TimeDelta;
+using chromeos_update_engine::ConnectionTethering;
+using chromeos_update_engine::ConnectionType;
+using chromeos_update_engine::ErrorCode;
+using chromeos_update_engine::FakeClock;
+using std::string;
+using std::tuple;
+using std::vector;
+
+namespace {
+
+// The number of heap allocations of the process, counted by the replacement
+// of the global operator new below.
+std::atomic<uint64_t> num_allocations{0};
+
+}  // namespace
+
+void* operator new(size_t size) {
+  num_allocations++;
+  void* ptr = malloc(size);
+  if (!ptr)
+    abort();
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+namespace chromeos_update_manager {
+
+namespace {
+
+// The environment of the benchmarked requests: an UpdateManager that owns a
+// FakeState, and a FakeMessageLoop running its async requests.
+class Environment {
+ public:
+  Environment() {
+    loop_.SetAsCurrent();
+    fake_clock_.SetMonotonicTime(Time::FromInternalValue(12345678L));
+    fake_clock_.SetWallclockTime(Time::FromInternalValue(12345678901234L));
+    fake_state_ = new FakeState();
+    update_manager_.reset(new UpdateManager(&fake_clock_,
+                                            TimeDelta::FromSeconds(5),
+                                            TimeDelta::FromHours(12),
+                                            fake_state_));
+  }
+
+  // Sets all the variables of the FakeState, since they only return their
+  // value once.
+  void SetUpState() {
+    const Time now = fake_clock_.GetWallclockTime();
+    FakeUpdaterProvider* updater_provider = fake_state_->updater_provider();
+    updater_provider->var_updater_started_time()->reset(
+        new Time(now - TimeDelta::FromDays(3)));
+    // The last check was long enough ago for the next one to be due.
+    updater_provider->var_last_checked_time()->reset(
+        new Time(now - TimeDelta::FromDays(2)));
+    updater_provider->var_consecutive_failed_update_checks()->reset(
+        new unsigned int(0));  // NOLINT(readability/casting)
+    updater_provider->var_server_dictated_poll_interval()->reset(
+        new unsigned int(0));  // NOLINT(readability/casting)
+    updater_provider->var_forced_update_requested()->reset(
+        new UpdateRequestStatus{UpdateRequestStatus::kNone});
+    fake_state_->random_provider()->var_seed()->reset(new uint64_t(4));
+
+    fake_state_->config_provider()->var_is_oobe_enabled()->reset(
+        new bool(true));
+    FakeSystemProvider* system_provider = fake_state_->system_provider();
+    system_provider->var_is_official_build()->reset(new bool(true));
+    system_provider->var_is_oobe_complete()->reset(new bool(true));
+    // NOLINTNEXTLINE(readability/casting)
+    system_provider->var_num_slots()->reset(new unsigned int(2));
+
+    fake_state_->shill_provider()->var_conn_type()->reset(
+        new ConnectionType(ConnectionType::kWifi));
+    fake_state_->shill_provider()->var_conn_tethering()->reset(
+        new ConnectionTethering(ConnectionTethering::kNotDetected));
+
+    FakeDevicePolicyProvider* dp_provider =
+        fake_state_->device_policy_provider();
+    dp_provider->var_device_policy_is_loaded()->reset(new bool(true));
+    dp_provider->var_update_disabled()->reset(new bool(false));
+    dp_provider->var_scatter_factor()->reset(new TimeDelta());
+    dp_provider->var_http_downloads_enabled()->reset(new bool(true));
+    dp_provider->var_au_p2p_enabled()->reset(new bool(false));
+    dp_provider->var_release_channel_delegated()->reset(new bool(true));
+    dp_provider->var_disallowed_time_intervals()->reset(
+        new WeeklyTimeIntervalVector());
+  }
+
+  // Returns the state of a full payload seen a day ago at a single URL.
+  UpdateState GetUpdateState() {
+    UpdateState update_state = UpdateState();
+    update_state.first_seen =
+        fake_clock_.GetWallclockTime() - TimeDelta::FromDays(1);
+    update_state.num_checks = 1;
+    update_state.download_urls = vector<string>{"http://fake/url/"};
+    update_state.download_errors_max = 10;
+    update_state.last_download_url_idx = -1;
+    update_state.download_errors = vector<tuple<int, ErrorCode, Time>>();
+    update_state.scatter_wait_period_max = TimeDelta::FromDays(7);
+    return update_state;
+  }
+
+  brillo::MessageLoop* loop() { return &loop_; }
+  UpdateManager* update_manager() { return update_manager_.get(); }
+
+ private:
+  brillo::FakeMessageLoop loop_{nullptr};
+  FakeClock fake_clock_;
+  FakeState* fake_state_;  // Owned by |update_manager_|.
+  std::unique_ptr<UpdateManager> update_manager_;
+};
+
+// Sets the "allocs_per_request" counter of |state| from the |allocations|
+// made by its iterations.
+void SetAllocationsCounter(benchmark::State& state, uint64_t allocations) {
+  state.counters["allocs_per_request"] =
+      static_cast<double>(allocations) / state.iterations();
+}
+
+void BM_UpdateCheckAllowed(benchmark::State& state) {
+  Environment env;
+  uint64_t allocations = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    env.SetUpState();
+    state.ResumeTiming();
+    const uint64_t allocations_start = num_allocations;
+    UpdateCheckParams params;
+    EvalStatus status = env.update_manager()->PolicyRequest(
+        &Policy::UpdateCheckAllowed, &params);
+    allocations += num_allocations - allocations_start;
+    if (status != EvalStatus::kSucceeded) {
+      state.SkipWithError("UpdateCheckAllowed didn't succeed.");
+      break;
+    }
+  }
+  SetAllocationsCounter(state, allocations);
+}
+BENCHMARK(BM_UpdateCheckAllowed);
+
+void BM_UpdateCanStart(benchmark::State& state) {
+  Environment env;
+  const UpdateState update_state = env.GetUpdateState();
+  uint64_t allocations = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    env.SetUpState();
+    state.ResumeTiming();
+    const uint64_t allocations_start = num_allocations;
+    UpdateDownloadParams params;
+    EvalStatus status = env.update_manager()->PolicyRequest(
+        &Policy::UpdateCanStart, &params, update_state);
+    allocations += num_allocations - allocations_start;
+    if (status != EvalStatus::kSucceeded) {
+      state.SkipWithError("UpdateCanStart didn't succeed.");
+      break;
+    }
+  }
+  SetAllocationsCounter(state, allocations);
+}
+BENCHMARK(BM_UpdateCanStart);
+
+// Stores the |status| of an async request in |*result|.
+void SetStatus(EvalStatus* result,
+               EvalStatus status,
+               const UpdateCheckParams& /* params */) {
+  *result = status;
+}
+
+void BM_AsyncUpdateCheckAllowed(benchmark::State& state) {
+  Environment env;
+  uint64_t allocations = 0;
+  uint64_t tasks = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    env.SetUpState();
+    state.ResumeTiming();
+    const uint64_t allocations_start = num_allocations;
+    EvalStatus status = EvalStatus::kContinue;
+    base::Callback<void(EvalStatus, const UpdateCheckParams&)> callback =
+        base::Bind(&SetStatus, &status);
+    env.update_manager()->AsyncPolicyRequest(callback,
+                                             &Policy::UpdateCheckAllowed);
+    tasks += brillo::MessageLoopRunMaxIterations(env.loop(), 100);
+    allocations += num_allocations - allocations_start;
+    if (status != EvalStatus::kSucceeded) {
+      state.SkipWithError("The async UpdateCheckAllowed didn't succeed.");
+      break;
+    }
+  }
+  SetAllocationsCounter(state, allocations);
+  state.counters["tasks_per_request"] =
+      static_cast<double>(tasks) / state.iterations();
+}
+BENCHMARK(BM_AsyncUpdateCheckAllowed);
+
+}  // namespace
+
+}  // namespace chromeos_update_manager
+
+int main(int argc, char** argv) {
+  // Remove the --benchmark_* flags before parsing ours.
+  benchmark::Initialize(&argc, argv);
+  brillo::FlagHelper::Init(
+      argc,
+      argv,
+      "Benchmarks the policy evaluations of the update manager.\n\n"
+      "The --benchmark_* flags of google-benchmark are also supported.");
+  // Every evaluation logs the policies it consults.
+  logging::SetMinLogLevel(logging::LOG_WARNING);
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -38,6 +38,7 @@
 #include "update_engine/update_manager/default_policy.h"
 #include "update_engine/update_manager/fake_state.h"
 #include "update_engine/update_manager/mock_policy.h"
+#include "update_engine/update_manager/policy_utils.h"
 #include "update_engine/update_manager/umtest_utils.h"
 
 using base::Bind;
@@ -173,6 +174,34 @@ class DelayPolicy : public DefaultPolicy {
   int* num_called_p_;
 };
 
+// A policy that reads the random seed in both UpdateCheckAllowed() and
+// P2PEnabled(), failing if it has no value.
+class SeedPolicy : public DefaultPolicy {
+ public:
+  EvalStatus UpdateCheckAllowed(EvaluationContext* ec,
+                                State* state,
+                                string* error,
+                                UpdateCheckParams* result) const override {
+    const uint64_t* seed = ec->GetValue(state->random_provider()->var_seed());
+    POLICY_CHECK_VALUE_AND_FAIL(seed, error);
+    result->updates_enabled = true;
+    return EvalStatus::kSucceeded;
+  }
+
+  EvalStatus P2PEnabled(EvaluationContext* ec,
+                        State* state,
+                        string* error,
+                        bool* result) const override {
+    const uint64_t* seed = ec->GetValue(state->random_provider()->var_seed());
+    POLICY_CHECK_VALUE_AND_FAIL(seed, error);
+    *result = (*seed % 2) == 1;
+    return EvalStatus::kSucceeded;
+  }
+
+ protected:
+  string PolicyName() const override { return "SeedPolicy"; }
+};
+
 // AccumulateCallsCallback() adds to the passed |acc| accumulator vector pairs
 // of EvalStatus and T instances. This allows to create a callback that keeps
 // track of when it is called and the arguments passed to it, to be used with
@@ -236,8 +265,31 @@ TEST_F(UmUpdateManagerTest, PolicyRequestCallsDefaultOnError) {
   EXPECT_TRUE(result.updates_enabled);
 }
 
+TEST_F(UmUpdateManagerTest, PolicyBatchSharesVariableValues) {
+  umut_->set_policy(new SeedPolicy());
+  // The fake variable only returns its value once, so the second request can
+  // only succeed with the value cached by the first one.
+  fake_state_->random_provider()->var_seed()->reset(new uint64_t(3));
+
+  auto batch = umut_->NewPolicyBatch();
+  UpdateCheckParams params;
+  EXPECT_EQ(EvalStatus::kSucceeded,
+            batch->PolicyRequest(&Policy::UpdateCheckAllowed, &params));
+  bool p2p_enabled = false;
+  EXPECT_EQ(EvalStatus::kSucceeded,
+            batch->PolicyRequest(&Policy::P2PEnabled, &p2p_enabled));
+  EXPECT_TRUE(p2p_enabled);
+
+  // A separate request reads the variable again, which fails and falls back
+  // to the default policy.
+  EXPECT_EQ(EvalStatus::kSucceeded,
+            umut_->PolicyRequest(&Policy::P2PEnabled, &p2p_enabled));
+  EXPECT_FALSE(p2p_enabled);
+}
+
 // This test only applies to debug builds where DCHECK is enabled.
 #if DCHECK_IS_ON
+
 TEST_F(UmUpdateManagerTest, PolicyRequestDoesntBlockDeathTest) {
   // The update manager should die (DCHECK) if a policy called synchronously
   // returns a kAskMeAgainLater value.
@@ -19,6 +19,7 @@
 
 #include <base/time/time.h>
 
+#include "update_engine/common/utils.h"
 #include "update_engine/update_manager/device_policy_provider.h"
 #include "update_engine/update_manager/system_provider.h"
 #include "update_engine/update_manager/weekly_time.h"
@@ -63,6 +64,10 @@ EvalStatus UpdateTimeRestrictionsPolicyImpl::UpdateCanBeApplied(
   }
   for (const auto& interval : *intervals) {
     if (interval.InRange(now)) {
+      LOG(INFO) << "Update deferred per policy, the time restrictions change "
+                << "in "
+                << chromeos_update_engine::utils::FormatTimeDelta(
+                       GetDurationToNextTransition(*intervals, now));
       *result = ErrorCode::kOmahaUpdateDeferredPerPolicy;
       return EvalStatus::kSucceeded;
     }
@@ -31,7 +31,7 @@ namespace chromeos_update_manager {
 // the current time falls in the range spanned by the time intervals. If the
 // current time falls in one of the intervals then the update check is
 // blocked by this policy.
-class UpdateTimeRestrictionsPolicyImpl : public PolicyImplBase {
+class UpdateTimeRestrictionsPolicyImpl final : public PolicyImplBase {
  public:
   UpdateTimeRestrictionsPolicyImpl() = default;
   ~UpdateTimeRestrictionsPolicyImpl() override = default;
@@ -100,6 +100,10 @@ class UpdaterProvider : public Provider {
   // network.
   virtual Variable<bool>* var_cellular_enabled() = 0;
 
+  // A variable returning the maximum rate of the downloads set by the user, in
+  // bytes per second, or 0 if it's not limited.
+  virtual Variable<int64_t>* var_download_rate_limit() = 0;
+
   // A variable returning the number of consecutive failed update checks.
   virtual Variable<unsigned int>* var_consecutive_failed_update_checks() = 0;
 
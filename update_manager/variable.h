@@ -18,8 +18,8 @@
 #define UPDATE_ENGINE_UPDATE_MANAGER_VARIABLE_H_
 
 #include <algorithm>
-#include <list>
 #include <string>
+#include <vector>
 
 #include <base/bind.h>
 #include <base/location.h>
@@ -71,6 +71,10 @@ class BaseVariable {
     }
     DCHECK(observer_list_.empty()) << "Don't destroy the variable without "
                                       "removing the observers.";
+    if (notification_task_ != brillo::MessageLoop::kTaskIdNull &&
+        brillo::MessageLoop::current()) {
+      brillo::MessageLoop::current()->CancelTask(notification_task_);
+    }
   }
 
   // Returns the variable name as a string.
@@ -94,7 +98,9 @@ class BaseVariable {
   }
 
   virtual void RemoveObserver(BaseVariable::ObserverInterface* observer) {
-    observer_list_.remove(observer);
+    observer_list_.erase(
+        std::remove(observer_list_.begin(), observer_list_.end(), observer),
+        observer_list_.end());
   }
 
  protected:
@@ -119,9 +125,11 @@ class BaseVariable {
   void NotifyValueChanged() {
     // Fire all the observer methods from the main loop as single call. In order
     // to avoid scheduling these callbacks when it is not needed, we check
-    // first the list of observers.
-    if (!observer_list_.empty()) {
-      brillo::MessageLoop::current()->PostTask(
+    // first the list of observers. Changes that happen while a notification is
+    // already pending are reported by that same notification.
+    if (!observer_list_.empty() &&
+        notification_task_ == brillo::MessageLoop::kTaskIdNull) {
+      notification_task_ = brillo::MessageLoop::current()->PostTask(
           FROM_HERE,
           base::Bind(&BaseVariable::OnValueChangedNotification,
                      base::Unretained(this)));
@@ -133,6 +141,7 @@ class BaseVariable {
   FRIEND_TEST(UmBaseVariableTest, RepeatedObserverTest);
   FRIEND_TEST(UmBaseVariableTest, NotifyValueChangedTest);
   FRIEND_TEST(UmBaseVariableTest, NotifyValueRemovesObserversTest);
+  FRIEND_TEST(UmBaseVariableTest, NotifyValueChangedCoalescesTest);
 
   BaseVariable(const std::string& name,
                VariableMode mode,
@@ -143,14 +152,16 @@ class BaseVariable {
                                                  : base::TimeDelta()) {}
 
   void OnValueChangedNotification() {
+    notification_task_ = brillo::MessageLoop::kTaskIdNull;
+
     // A ValueChanged() method can change the list of observers, for example
     // removing itself and invalidating the iterator, so we create a snapshot
     // of the observers first. Also, to support the case when *another* observer
-    // is removed, we check for them.
-    std::list<BaseVariable::ObserverInterface*> observer_list_copy(
-        observer_list_);
+    // is removed, we check for them. The snapshot reuses its storage, so
+    // notifying doesn't allocate once it is large enough.
+    notified_observers_.assign(observer_list_.begin(), observer_list_.end());
 
-    for (auto& observer : observer_list_copy) {
+    for (auto& observer : notified_observers_) {
       if (std::find(observer_list_.begin(), observer_list_.end(), observer) !=
           observer_list_.end()) {
         observer->ValueChanged(this);
@@ -172,7 +183,14 @@ class BaseVariable {
   base::TimeDelta poll_interval_;
 
   // The list of value changes observers.
-  std::list<BaseVariable::ObserverInterface*> observer_list_;
+  std::vector<BaseVariable::ObserverInterface*> observer_list_;
+
+  // The snapshot of |observer_list_| being notified.
+  std::vector<BaseVariable::ObserverInterface*> notified_observers_;
+
+  // The pending OnValueChangedNotification() task, if any.
+  brillo::MessageLoop::TaskId notification_task_{
+      brillo::MessageLoop::kTaskIdNull};
 
   DISALLOW_COPY_AND_ASSIGN(BaseVariable);
 };
@@ -129,6 +129,34 @@ TEST_F(UmBaseVariableTest, NotifyValueChangedTest) {
   var.RemoveObserver(&observer2);
 }
 
+TEST_F(UmBaseVariableTest, NotifyValueChangedCoalescesTest) {
+  DefaultVariable<int> var("var", kVariableModeAsync);
+  BaseVariableObserver observer;
+  var.AddObserver(&observer);
+  // Several changes before the notification runs are reported once.
+  var.NotifyValueChanged();
+  var.NotifyValueChanged();
+  var.NotifyValueChanged();
+  MessageLoopRunMaxIterations(MessageLoop::current(), 100);
+  EXPECT_EQ(1U, observer.calls_.size());
+
+  // A change after the notification ran is reported again.
+  var.NotifyValueChanged();
+  MessageLoopRunMaxIterations(MessageLoop::current(), 100);
+  EXPECT_EQ(2U, observer.calls_.size());
+
+  // A pending notification is canceled when the variable is destroyed.
+  {
+    DefaultVariable<int> other_var("other_var", kVariableModeAsync);
+    other_var.AddObserver(&observer);
+    other_var.NotifyValueChanged();
+    other_var.RemoveObserver(&observer);
+  }
+  EXPECT_FALSE(loop_.PendingTasks());
+
+  var.RemoveObserver(&observer);
+}
+
 class BaseVariableObserverRemover : public BaseVariable::ObserverInterface {
  public:
   BaseVariableObserverRemover() : calls_(0) {}
@@ -15,6 +15,8 @@
 //
 #include "update_engine/update_manager/weekly_time.h"
 
+#include <algorithm>
+
 #include <base/strings/string_number_conversions.h>
 #include <base/strings/stringprintf.h>
 #include <base/time/time.h>
@@ -63,6 +65,26 @@ bool WeeklyTimeInterval::InRange(const WeeklyTime& time) const {
           time != end_);
 }
 
+TimeDelta WeeklyTimeInterval::GetDurationToNextTransition(
+    const WeeklyTime& time) const {
+  const TimeDelta week = TimeDelta::FromDays(kDaysInWeek);
+  TimeDelta to_start = time.GetDurationTo(start_);
+  TimeDelta to_end = time.GetDurationTo(end_);
+  if (to_start.is_zero())
+    to_start = week;
+  if (to_end.is_zero())
+    to_end = week;
+  return std::min(to_start, to_end);
+}
+
+TimeDelta GetDurationToNextTransition(const WeeklyTimeIntervalVector& intervals,
+                                      const WeeklyTime& time) {
+  TimeDelta duration = TimeDelta::Max();
+  for (const auto& interval : intervals)
+    duration = std::min(duration, interval.GetDurationToNextTransition(time));
+  return duration;
+}
+
 string WeeklyTimeInterval::ToString() const {
   return base::StringPrintf(
       "Start: day_of_week=%d time=%d\nEnd: day_of_week=%d time=%d",
@@ -73,6 +73,11 @@ class WeeklyTimeInterval {
   // Determines if |time| is in this interval.
   bool InRange(const WeeklyTime& time) const;
 
+  // Returns the duration from |time| until the next start or end of this
+  // interval, which is when InRange() may change. It is never zero: at the
+  // start or end of the interval the next transition is a week later.
+  base::TimeDelta GetDurationToNextTransition(const WeeklyTime& time) const;
+
   WeeklyTime start() const { return start_; }
 
   WeeklyTime end() const { return end_; }
@@ -92,6 +97,11 @@ class WeeklyTimeInterval {
 
 using WeeklyTimeIntervalVector = std::vector<WeeklyTimeInterval>;
 
+// Returns the duration from |time| until the next start or end of any of the
+// |intervals|, or base::TimeDelta::Max() if there are none.
+base::TimeDelta GetDurationToNextTransition(
+    const WeeklyTimeIntervalVector& intervals, const WeeklyTime& time);
+
 }  // namespace chromeos_update_manager
 
 #endif  // UPDATE_ENGINE_UPDATE_MANAGER_WEEKLY_TIME_H_
@@ -209,4 +209,41 @@ INSTANTIATE_TEST_CASE_P(
     WeeklyTimeIntervalRangeTest,
     testing::Values(std::make_tuple(kMonday, 0, false, false, true)));
 
+TEST(WeeklyTimeIntervalTest, GetDurationToNextTransition) {
+  WeeklyTimeInterval interval(WeeklyTime(kMonday, TimeDelta::FromHours(10)),
+                              WeeklyTime(kMonday, TimeDelta::FromHours(12)));
+  EXPECT_EQ(TimeDelta::FromHours(1),
+            interval.GetDurationToNextTransition(
+                WeeklyTime(kMonday, TimeDelta::FromHours(9))));
+  EXPECT_EQ(TimeDelta::FromHours(1),
+            interval.GetDurationToNextTransition(
+                WeeklyTime(kMonday, TimeDelta::FromHours(11))));
+  // At a boundary the next transition is the other boundary.
+  EXPECT_EQ(TimeDelta::FromHours(2),
+            interval.GetDurationToNextTransition(
+                WeeklyTime(kMonday, TimeDelta::FromHours(10))));
+  // The week wraps around.
+  EXPECT_EQ(TimeDelta::FromDays(2) + TimeDelta::FromHours(10),
+            interval.GetDurationToNextTransition(
+                WeeklyTime(kSaturday, TimeDelta())));
+}
+
+TEST(WeeklyTimeIntervalTest, GetDurationToNextTransitionOfIntervals) {
+  WeeklyTimeIntervalVector intervals;
+  EXPECT_EQ(TimeDelta::Max(),
+            GetDurationToNextTransition(
+                intervals, WeeklyTime(kMonday, TimeDelta())));
+
+  intervals.emplace_back(WeeklyTime(kFriday, TimeDelta::FromHours(20)),
+                         WeeklyTime(kMonday, TimeDelta::FromHours(6)));
+  intervals.emplace_back(WeeklyTime(kTuesday, TimeDelta::FromHours(1)),
+                         WeeklyTime(kTuesday, TimeDelta::FromHours(2)));
+  EXPECT_EQ(TimeDelta::FromHours(6),
+            GetDurationToNextTransition(
+                intervals, WeeklyTime(kMonday, TimeDelta())));
+  EXPECT_EQ(TimeDelta::FromHours(19),
+            GetDurationToNextTransition(
+                intervals, WeeklyTime(kMonday, TimeDelta::FromHours(6))));
+}
+
 }  // namespace chromeos_update_manager
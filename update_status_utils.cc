@@ -90,4 +90,19 @@ bool StringToUpdateStatus(const std::string& s, UpdateStatus* status) {
   return false;
 }
 
+const char* UpdatePhaseName(UpdateStatus status) {
+  switch (status) {
+    case UpdateStatus::CHECKING_FOR_UPDATE:
+      return "Checking";
+    case UpdateStatus::DOWNLOADING:
+      return "Downloading";
+    case UpdateStatus::VERIFYING:
+      return "Verifying";
+    case UpdateStatus::FINALIZING:
+      return "Finalizing";
+    default:
+      return nullptr;
+  }
+}
+
 }  // namespace chromeos_update_engine
@@ -28,6 +28,10 @@ const char* UpdateStatusToString(const update_engine::UpdateStatus& status);
 bool StringToUpdateStatus(const std::string& update_status_as_string,
                           update_engine::UpdateStatus* status);
 
+// Returns the name of the phase of an update |status| is, as used in the
+// metrics, or nullptr if it isn't a phase of an update.
+const char* UpdatePhaseName(update_engine::UpdateStatus status);
+
 }  // namespace chromeos_update_engine
 
 #endif  // UPDATE_ENGINE_UPDATE_STATUS_UTILS_H_